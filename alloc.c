@@ -5,7 +5,7 @@
  *
  * The standard malloc/free wastes too much space for objects, partly because
  * it maintains all the allocation infrastructure (which isn't needed, since
- * we never free an object descriptor anyway), but even more because it ends
+ * we never free an object descriptor on its own), but even more because it ends
  * up with maximal alignment because it doesn't know what the object alignment
  * for the new allocation is.
  */
@@ -30,8 +30,38 @@ struct alloc_state {
 	int count; /* total number of nodes allocated */
 	int nr;    /* number of nodes left in current allocation */
 	void *p;   /* first free node in current allocation */
+	size_t node_size;
+	void **slabs; /* every allocation, to release them */
+	int slab_nr, slab_alloc;
 };
 
+/*
+ * Nodes come from the innermost arena.  The base arena lives as long as
+ * the process; the others are released by release_object_arena().
+ */
+struct object_arena {
+	struct alloc_state blob_state;
+	struct alloc_state tree_state;
+	struct alloc_state tag_state;
+	struct alloc_state object_state;
+	struct alloc_state commit_state;
+	struct object_arena *prev;
+};
+
+static struct object_arena base_arena;
+static struct object_arena *arena = &base_arena;
+
+static struct trace_key trace_alloc = TRACE_KEY_INIT(ALLOC);
+
+/*
+ * Every node is an object and gets the next object index, whichever
+ * arena it comes from; indices are never handed out twice.
+ */
+static unsigned int object_index;
+
+/* bytes held in slabs by all arenas, and the most ever held at once */
+static size_t slab_bytes, peak_slab_bytes;
+
 static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 {
 	void *ret;
@@ -39,49 +69,51 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 	if (!s->nr) {
 		s->nr = BLOCKING;
 		s->p = xmalloc(BLOCKING * node_size);
+		s->node_size = node_size;
+		ALLOC_GROW(s->slabs, s->slab_nr + 1, s->slab_alloc);
+		s->slabs[s->slab_nr++] = s->p;
+		slab_bytes += BLOCKING * node_size;
+		if (peak_slab_bytes < slab_bytes)
+			peak_slab_bytes = slab_bytes;
+		trace_memory_sample();
 	}
 	s->nr--;
 	s->count++;
 	ret = s->p;
 	s->p = (char *)s->p + node_size;
 	memset(ret, 0, node_size);
+	((struct object *)ret)->index = object_index++;
 	return ret;
 }
 
-static struct alloc_state blob_state;
 void *alloc_blob_node(void)
 {
-	struct blob *b = alloc_node(&blob_state, sizeof(struct blob));
+	struct blob *b = alloc_node(&arena->blob_state, sizeof(struct blob));
 	b->object.type = OBJ_BLOB;
 	return b;
 }
 
-static struct alloc_state tree_state;
 void *alloc_tree_node(void)
 {
-	struct tree *t = alloc_node(&tree_state, sizeof(struct tree));
+	struct tree *t = alloc_node(&arena->tree_state, sizeof(struct tree));
 	t->object.type = OBJ_TREE;
 	return t;
 }
 
-static struct alloc_state tag_state;
 void *alloc_tag_node(void)
 {
-	struct tag *t = alloc_node(&tag_state, sizeof(struct tag));
+	struct tag *t = alloc_node(&arena->tag_state, sizeof(struct tag));
 	t->object.type = OBJ_TAG;
 	return t;
 }
 
-static struct alloc_state object_state;
 void *alloc_object_node(void)
 {
-	struct object *obj = alloc_node(&object_state, sizeof(union any_object));
+	struct object *obj = alloc_node(&arena->object_state, sizeof(union any_object));
 	obj->type = OBJ_NONE;
 	return obj;
 }
 
-static struct alloc_state commit_state;
-
 unsigned int alloc_commit_index(void)
 {
 	static unsigned int count;
@@ -90,12 +122,168 @@ unsigned int alloc_commit_index(void)
 
 void *alloc_commit_node(void)
 {
-	struct commit *c = alloc_node(&commit_state, sizeof(struct commit));
+	struct commit *c = alloc_node(&arena->commit_state, sizeof(struct commit));
 	c->object.type = OBJ_COMMIT;
 	c->index = alloc_commit_index();
 	return c;
 }
 
+struct object_arena *begin_object_arena(void)
+{
+	struct object_arena *a = xcalloc(1, sizeof(*a));
+
+	a->prev = arena;
+	arena = a;
+	return a;
+}
+
+struct slab_range {
+	uintptr_t start, end;
+};
+
+static int slab_range_cmp(const void *a_, const void *b_)
+{
+	const struct slab_range *a = a_, *b = b_;
+	return a->start < b->start ? -1 : a->start > b->start;
+}
+
+struct arena_slabs {
+	struct slab_range *range;
+	int nr, alloc;
+};
+
+static void add_slabs(struct arena_slabs *slabs, struct alloc_state *s)
+{
+	int i;
+
+	for (i = 0; i < s->slab_nr; i++) {
+		ALLOC_GROW(slabs->range, slabs->nr + 1, slabs->alloc);
+		slabs->range[slabs->nr].start = (uintptr_t)s->slabs[i];
+		slabs->range[slabs->nr].end =
+			(uintptr_t)s->slabs[i] + BLOCKING * s->node_size;
+		slabs->nr++;
+	}
+}
+
+static int in_slabs(struct arena_slabs *slabs, const void *ptr)
+{
+	uintptr_t p = (uintptr_t)ptr;
+	int lo = 0, hi = slabs->nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (p < slabs->range[mi].start)
+			hi = mi;
+		else if (p >= slabs->range[mi].end)
+			lo = mi + 1;
+		else
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Called for every object known to lookup_object().  Objects of the
+ * arena have what they own freed and are dropped; older objects that
+ * were parsed while the arena was active and point into it are made
+ * unparsed again, so that they are parsed afresh when next needed.
+ */
+static int release_arena_object(struct object *obj, void *data)
+{
+	struct arena_slabs *slabs = data;
+
+	if (!in_slabs(slabs, obj)) {
+		if (obj->type == OBJ_COMMIT) {
+			struct commit *c = (struct commit *)obj;
+			struct commit_list *p;
+			int dangling = c->maybe_tree &&
+				in_slabs(slabs, c->maybe_tree);
+
+			for (p = c->parents; p && !dangling; p = p->next)
+				dangling = in_slabs(slabs, p->item);
+			if (dangling) {
+				free_commit_list(c->parents);
+				c->parents = NULL;
+				c->maybe_tree = NULL;
+				obj->parsed = 0;
+			}
+		} else if (obj->type == OBJ_TAG) {
+			struct tag *t = (struct tag *)obj;
+			if (t->tagged && in_slabs(slabs, t->tagged)) {
+				t->tagged = NULL;
+				free(t->tag);
+				t->tag = NULL;
+				obj->parsed = 0;
+			}
+		}
+		return 0;
+	}
+
+	switch (obj->type) {
+	case OBJ_COMMIT:
+		free_commit_list(((struct commit *)obj)->parents);
+		free_commit_buffer((struct commit *)obj);
+		break;
+	case OBJ_TREE:
+		free_tree_buffer((struct tree *)obj);
+		break;
+	case OBJ_TAG:
+		free(((struct tag *)obj)->tag);
+		break;
+	}
+	return 1;
+}
+
+static void release_slabs(struct alloc_state *s)
+{
+	int i;
+
+	for (i = 0; i < s->slab_nr; i++)
+		free(s->slabs[i]);
+	free(s->slabs);
+	slab_bytes -= s->slab_nr * BLOCKING * s->node_size;
+}
+
+#define TRACE_STATE(a, name, type) \
+	trace_printf_key(&trace_alloc, "arena: %s %d (%"PRIuMAX" kB)\n", \
+			 #name, (a)->name##_state.count, \
+			 (uintmax_t)((a)->name##_state.slab_nr * \
+				     BLOCKING * sizeof(type) >> 10))
+
+void release_object_arena(struct object_arena *a)
+{
+	struct arena_slabs slabs = { NULL, 0, 0 };
+
+	if (a != arena || a == &base_arena)
+		die("BUG: releasing an object arena that is not the innermost");
+
+	add_slabs(&slabs, &a->blob_state);
+	add_slabs(&slabs, &a->tree_state);
+	add_slabs(&slabs, &a->tag_state);
+	add_slabs(&slabs, &a->object_state);
+	add_slabs(&slabs, &a->commit_state);
+	qsort(slabs.range, slabs.nr, sizeof(*slabs.range), slab_range_cmp);
+	remove_objects(release_arena_object, &slabs);
+	free(slabs.range);
+
+	if (trace_want(&trace_alloc)) {
+		trace_printf_key(&trace_alloc, "arena: releasing\n");
+		TRACE_STATE(a, blob, struct blob);
+		TRACE_STATE(a, tree, struct tree);
+		TRACE_STATE(a, commit, struct commit);
+		TRACE_STATE(a, tag, struct tag);
+		TRACE_STATE(a, object, union any_object);
+	}
+
+	release_slabs(&a->blob_state);
+	release_slabs(&a->tree_state);
+	release_slabs(&a->tag_state);
+	release_slabs(&a->object_state);
+	release_slabs(&a->commit_state);
+	arena = a->prev;
+	free(a);
+}
+
 static void report(const char *name, unsigned int count, size_t size)
 {
 	fprintf(stderr, "%10s: %8u (%"PRIuMAX" kB)\n",
@@ -103,7 +291,13 @@ static void report(const char *name, unsigned int count, size_t size)
 }
 
 #define REPORT(name, type)	\
-    report(#name, name##_state.count, name##_state.count * sizeof(type) >> 10)
+    do { \
+	struct object_arena *a; \
+	unsigned int count = 0; \
+	for (a = arena; a; a = a->prev) \
+		count += a->name##_state.count; \
+	report(#name, count, count * sizeof(type) >> 10); \
+    } while (0)
 
 void alloc_report(void)
 {
@@ -113,3 +307,10 @@ void alloc_report(void)
 	REPORT(tag, struct tag);
 	REPORT(object, union any_object);
 }
+
+size_t alloc_memory_usage(size_t *peak)
+{
+	if (peak)
+		*peak = peak_slab_bytes;
+	return slab_bytes;
+}
@@ -0,0 +1,260 @@
+#include "cache.h"
+#include "lockfile.h"
+#include "quote.h"
+#include "append-cache.h"
+
+struct append_cache_entry {
+	struct hashmap_entry ent;
+	unsigned int seq;
+	char *value;
+	char key[FLEX_ARRAY];
+};
+
+static int append_cache_entry_cmp(const struct append_cache_entry *e1,
+				  const struct append_cache_entry *e2,
+				  const char *key)
+{
+	return strcmp(e1->key, key ? key : e2->key);
+}
+
+static void add_append_cache_entry(struct append_cache *c, const char *key,
+				   size_t keylen, char *value)
+{
+	struct append_cache_entry *e = xmalloc(sizeof(*e) + keylen + 1);
+	struct append_cache_entry *old;
+
+	memcpy(e->key, key, keylen);
+	e->key[keylen] = '\0';
+	hashmap_entry_init(e, memhash(key, keylen));
+	e->seq = c->seq++;
+	e->value = value;
+	old = hashmap_put(&c->map, e);
+	if (old) {
+		free(old->value);
+		free(old);
+	}
+}
+
+static void format_append_cache_line(struct strbuf *sb, const char *key,
+				     const char *value)
+{
+	strbuf_addstr(sb, key);
+	if (*value) {
+		strbuf_addch(sb, ' ');
+		quote_c_style(value, sb, NULL, 0);
+	}
+	strbuf_addch(sb, '\n');
+}
+
+static int parse_append_cache_line(struct append_cache *c,
+				   const char *line, const char *eol)
+{
+	const char *sp = memchr(line, ' ', eol - line);
+	char *value;
+
+	if (!sp)
+		sp = eol;
+	if (sp == line)
+		return -1;
+	if (sp == eol)
+		value = xstrdup("");
+	else if (sp[1] == '"') {
+		struct strbuf sb = STRBUF_INIT;
+		const char *end;
+
+		if (unquote_c_style(&sb, sp + 1, &end) || end != eol) {
+			strbuf_release(&sb);
+			return -1;
+		}
+		value = strbuf_detach(&sb, NULL);
+	} else
+		value = xmemdupz(sp + 1, eol - sp - 1);
+	add_append_cache_entry(c, line, sp - line, value);
+	return 0;
+}
+
+static unsigned long append_cache_limit(void)
+{
+	unsigned long limit = 16 * 1024 * 1024;
+
+	git_config_get_ulong("gc.cachelimit", &limit);
+	return limit;
+}
+
+static void setup_append_cache(struct append_cache *c, const char *path,
+			       const char *validity)
+{
+	hashmap_init(&c->map, (hashmap_cmp_fn)append_cache_entry_cmp, 0);
+	c->path = xstrdup(path);
+	c->validity = validity ? xstrdup(validity) : NULL;
+	c->valid = 0;
+	c->seq = 0;
+}
+
+/*
+ * Fill "c" from its file, taking the validity line from there if
+ * c->validity is NULL.  Returns the number of well-formed lines read;
+ * "size" is set to the size of the file.
+ */
+static unsigned int read_append_cache(struct append_cache *c, size_t *size)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *line, *eol, *end;
+	unsigned int nr = 0;
+
+	*size = 0;
+	if (strbuf_read_file(&buf, c->path, 0) < 0) {
+		if (errno != ENOENT)
+			warning(_("unable to read %s: %s"),
+				c->path, strerror(errno));
+		return 0;
+	}
+	*size = buf.len;
+	end = buf.buf + buf.len;
+	eol = memchr(buf.buf, '\n', buf.len);
+	if (!eol)
+		goto out;
+	if (!c->validity)
+		c->validity = xmemdupz(buf.buf, eol - buf.buf);
+	else if (strlen(c->validity) != eol - buf.buf ||
+		 memcmp(buf.buf, c->validity, eol - buf.buf))
+		goto out;
+	c->valid = 1;
+
+	for (line = eol + 1; (eol = memchr(line, '\n', end - line)); line = eol + 1)
+		if (!parse_append_cache_line(c, line, eol))
+			nr++;
+out:
+	strbuf_release(&buf);
+	return nr;
+}
+
+static int append_cache_seq_cmp(const void *a_, const void *b_)
+{
+	const struct append_cache_entry *a = *(const struct append_cache_entry **)a_;
+	const struct append_cache_entry *b = *(const struct append_cache_entry **)b_;
+
+	return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/*
+ * Rewrite the file with one line per entry, oldest first.  If that
+ * is still more than "limit", the oldest entries are left out until
+ * the rest fits in half of it, so that the file does not need to be
+ * rewritten again right away.  Lines that other processes append
+ * while we do this may be lost, which is fine for a cache.
+ */
+static void compact_append_cache(struct append_cache *c, unsigned long limit)
+{
+	static struct lock_file lock;
+	struct append_cache_entry **list, *e;
+	struct hashmap_iter iter;
+	struct strbuf lines = STRBUF_INIT, sb = STRBUF_INIT;
+	size_t *offset;
+	unsigned int nr = 0, i = 0;
+
+	list = xmalloc(c->map.size * sizeof(*list));
+	offset = xmalloc(c->map.size * sizeof(*offset));
+	for (e = hashmap_iter_first(&c->map, &iter); e; e = hashmap_iter_next(&iter))
+		list[nr++] = e;
+	qsort(list, nr, sizeof(*list), append_cache_seq_cmp);
+	for (i = 0; i < nr; i++) {
+		offset[i] = lines.len;
+		format_append_cache_line(&lines, list[i]->key, list[i]->value);
+	}
+	i = 0;
+	if (lines.len > limit)
+		while (i < nr && lines.len - offset[i] > limit / 2)
+			i++;
+
+	strbuf_addf(&sb, "%s\n", c->validity);
+	if (i < nr)
+		strbuf_add(&sb, lines.buf + offset[i], lines.len - offset[i]);
+	if (hold_lock_file_for_update(&lock, c->path, 0) >= 0) {
+		if (write_in_full(lock.fd, sb.buf, sb.len) == sb.len &&
+		    !commit_lock_file(&lock))
+			adjust_shared_perm(c->path);
+		else
+			rollback_lock_file(&lock);
+	}
+
+	strbuf_release(&sb);
+	strbuf_release(&lines);
+	free(offset);
+	free(list);
+}
+
+void append_cache_init(struct append_cache *c, const char *path,
+		       const char *validity)
+{
+	unsigned long limit = append_cache_limit();
+	unsigned int nr;
+	size_t size;
+
+	setup_append_cache(c, path, validity);
+	nr = read_append_cache(c, &size);
+	/* rewrite it once it is too big or most of its lines are superseded */
+	if (c->valid &&
+	    (size > limit || (nr > 64 && nr - c->map.size > c->map.size)))
+		compact_append_cache(c, limit);
+}
+
+const char *append_cache_get(struct append_cache *c, const char *key)
+{
+	struct append_cache_entry *e;
+
+	e = hashmap_get_from_hash(&c->map, memhash(key, strlen(key)), key);
+	return e ? e->value : NULL;
+}
+
+void append_cache_put(struct append_cache *c, const char *key,
+		      const char *value)
+{
+	static struct lock_file lock;
+	struct strbuf line = STRBUF_INIT;
+	int fd;
+
+	add_append_cache_entry(c, key, strlen(key), xstrdup(value));
+
+	/* the cache is only an optimization; never fail because of it */
+	if (c->valid) {
+		format_append_cache_line(&line, key, value);
+		fd = open(c->path, O_WRONLY | O_APPEND);
+		if (fd >= 0) {
+			write_in_full(fd, line.buf, line.len);
+			close(fd);
+		}
+	} else if (!safe_create_leading_directories_const(c->path) &&
+		   hold_lock_file_for_update(&lock, c->path, 0) >= 0) {
+		/* the file is missing or was made for something else */
+		strbuf_addf(&line, "%s\n", c->validity);
+		format_append_cache_line(&line, key, value);
+		if (write_in_full(lock.fd, line.buf, line.len) == line.len &&
+		    !commit_lock_file(&lock)) {
+			adjust_shared_perm(c->path);
+			c->valid = 1;
+		} else
+			rollback_lock_file(&lock);
+	}
+	strbuf_release(&line);
+}
+
+void append_cache_trim(const char *path)
+{
+	unsigned long limit = append_cache_limit();
+	struct append_cache c;
+	struct append_cache_entry *e;
+	struct hashmap_iter iter;
+	unsigned int nr;
+	size_t size;
+
+	setup_append_cache(&c, path, NULL);
+	nr = read_append_cache(&c, &size);
+	if (c.valid && (size > limit || nr > c.map.size))
+		compact_append_cache(&c, limit);
+	for (e = hashmap_iter_first(&c.map, &iter); e; e = hashmap_iter_next(&iter))
+		free(e->value);
+	hashmap_free(&c.map, 1);
+	free(c.path);
+	free(c.validity);
+}
@@ -0,0 +1,43 @@
+#ifndef APPEND_CACHE_H
+#define APPEND_CACHE_H
+
+#include "hashmap.h"
+
+/*
+ * A cache of string values keyed by strings without whitespace (usually
+ * the hex name of a hash of everything the value depends on), kept in a
+ * file that is only ever appended to.  The first line of the file is
+ * the "validity" string; a file that starts with any other line is
+ * ignored and replaced by the next append_cache_put().  Every other
+ * line is a key, followed by a space and the value, C-quoted if needed,
+ * unless the value is empty.  Lines are appended with a single write(2)
+ * each, so concurrent writers do not interleave them; a malformed or
+ * incomplete line is ignored, and a later line for the same key wins.
+ *
+ * Superseded lines are dropped when most of the file consists of them,
+ * and the oldest entries once it outgrows gc.cacheLimit; "git gc" does
+ * the same with append_cache_trim().
+ */
+struct append_cache {
+	struct hashmap map;
+	char *path;
+	char *validity;
+	int valid;
+	unsigned int seq;
+};
+
+/* Read the cache at "path", which must start with "validity" to be used. */
+extern void append_cache_init(struct append_cache *c, const char *path,
+			      const char *validity);
+
+/* Return the value for "key", or NULL. */
+extern const char *append_cache_get(struct append_cache *c, const char *key);
+
+/* Remember "value" for "key"; failing to write the file is not an error. */
+extern void append_cache_put(struct append_cache *c, const char *key,
+			     const char *value);
+
+/* Drop the superseded and, past gc.cacheLimit, the oldest entries of "path". */
+extern void append_cache_trim(const char *path);
+
+#endif /* APPEND_CACHE_H */
@@ -6,6 +6,7 @@
 #include "archive.h"
 #include "streaming.h"
 #include "run-command.h"
+#include "thread-utils.h"
 
 #define RECORDSIZE	(512)
 #define BLOCKSIZE	(RECORDSIZE * 20)
@@ -18,11 +19,19 @@ static int tar_umask = 002;
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args);
 
+static void write_to_stdout(const void *buf, unsigned long size)
+{
+	write_or_die(1, buf, size);
+}
+
+/* where the tar stream goes; the built-in gzip replaces it */
+static void (*write_tar_data)(const void *, unsigned long) = write_to_stdout;
+
 /* writes out the whole block, but only if it is full */
 static void write_if_needed(void)
 {
 	if (offset == BLOCKSIZE) {
-		write_or_die(1, block, BLOCKSIZE);
+		write_tar_data(block, BLOCKSIZE);
 		offset = 0;
 	}
 }
@@ -46,7 +55,7 @@ static void do_write_blocked(const void *data, unsigned long size)
 		write_if_needed();
 	}
 	while (size >= BLOCKSIZE) {
-		write_or_die(1, buf, BLOCKSIZE);
+		write_tar_data(buf, BLOCKSIZE);
 		size -= BLOCKSIZE;
 		buf += BLOCKSIZE;
 	}
@@ -81,10 +90,10 @@ static void write_trailer(void)
 {
 	int tail = BLOCKSIZE - offset;
 	memset(block + offset, 0, tail);
-	write_or_die(1, block, BLOCKSIZE);
+	write_tar_data(block, BLOCKSIZE);
 	if (tail < 2 * RECORDSIZE) {
 		memset(block, 0, offset);
-		write_or_die(1, block, BLOCKSIZE);
+		write_tar_data(block, BLOCKSIZE);
 	}
 }
 
@@ -391,6 +400,285 @@ static int write_tar_archive(const struct archiver *ar,
 	return err;
 }
 
+/*
+ * The built-in gzip, used for the command "git archive gzip".  The
+ * tar stream is cut into chunks that are deflated independently, each
+ * primed with the 32 KiB of input before it, so that threads can
+ * compress them in parallel.  Every chunk but the last ends with a
+ * sync flush, which lets them concatenate into a single deflate
+ * stream, and the CRC of the whole is combined from theirs.  The
+ * output does not depend on the number of threads.
+ */
+#define GZIP_COMMAND "git archive gzip"
+#define GZIP_CHUNK_SIZE (128 * 1024)
+#define GZIP_WINDOW_SIZE (32 * 1024)
+
+struct gzip_chunk {
+	struct strbuf in;	/* dict_len bytes of window, then the data */
+	size_t dict_len;
+	struct strbuf out;
+	uint32_t crc;
+	int last;
+	int done;
+};
+
+static struct gzip_state {
+	int level;
+	struct strbuf buf;	/* input not yet handed to a chunk */
+	struct strbuf window;	/* the last input handed to one */
+	uint32_t crc;
+	uint32_t size;
+	int nr_threads;
+	struct gzip_chunk *chunk;
+	unsigned int nr_slots;
+	/* chunk n is in slot n % nr_slots */
+	unsigned long queued, taken, written;
+#ifndef NO_PTHREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int stop;
+#endif
+} gzip;
+
+static void compress_gzip_chunk(struct gzip_chunk *chunk)
+{
+	git_zstream s;
+	unsigned char *data = (unsigned char *)chunk->in.buf + chunk->dict_len;
+	size_t len = chunk->in.len - chunk->dict_len;
+	int ret;
+
+	git_deflate_init_raw(&s, gzip.level);
+	if (chunk->dict_len)
+		deflateSetDictionary(&s.z, (unsigned char *)chunk->in.buf,
+				     chunk->dict_len);
+	strbuf_reset(&chunk->out);
+	/* leave room for the empty block of the sync flush */
+	strbuf_grow(&chunk->out, git_deflate_bound(&s, len) + 16);
+	s.next_in = data;
+	s.avail_in = len;
+	s.next_out = (unsigned char *)chunk->out.buf;
+	s.avail_out = chunk->out.alloc - 1;
+	ret = git_deflate(&s, chunk->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (ret != (chunk->last ? Z_STREAM_END : Z_OK) || s.avail_in)
+		die("deflate error (%d)", ret);
+	strbuf_setlen(&chunk->out, s.total_out);
+	/* a chunk but the last leaves its deflate stream unfinished */
+	git_deflate_abort(&s);
+
+	chunk->crc = crc32(crc32(0, NULL, 0), data, len);
+}
+
+static void write_gzip_chunk(struct gzip_chunk *chunk)
+{
+	size_t len = chunk->in.len - chunk->dict_len;
+
+	write_or_die(1, chunk->out.buf, chunk->out.len);
+	gzip.crc = crc32_combine(gzip.crc, chunk->crc, len);
+	gzip.size += len;
+}
+
+#ifndef NO_PTHREADS
+static void *gzip_worker(void *data)
+{
+	for (;;) {
+		struct gzip_chunk *chunk;
+
+		pthread_mutex_lock(&gzip.mutex);
+		while (gzip.taken == gzip.queued && !gzip.stop)
+			pthread_cond_wait(&gzip.cond, &gzip.mutex);
+		if (gzip.taken == gzip.queued) {
+			pthread_mutex_unlock(&gzip.mutex);
+			return NULL;
+		}
+		chunk = &gzip.chunk[gzip.taken++ % gzip.nr_slots];
+		pthread_mutex_unlock(&gzip.mutex);
+
+		compress_gzip_chunk(chunk);
+
+		pthread_mutex_lock(&gzip.mutex);
+		chunk->done = 1;
+		pthread_cond_broadcast(&gzip.cond);
+		pthread_mutex_unlock(&gzip.mutex);
+	}
+}
+
+/* Write out the oldest queued chunk, once it is compressed. */
+static void write_oldest_gzip_chunk(void)
+{
+	struct gzip_chunk *chunk = &gzip.chunk[gzip.written % gzip.nr_slots];
+
+	pthread_mutex_lock(&gzip.mutex);
+	while (!chunk->done)
+		pthread_cond_wait(&gzip.cond, &gzip.mutex);
+	pthread_mutex_unlock(&gzip.mutex);
+	write_gzip_chunk(chunk);
+	gzip.written++;
+}
+
+static void start_gzip_threads(void)
+{
+	int i;
+
+	pthread_mutex_init(&gzip.mutex, NULL);
+	pthread_cond_init(&gzip.cond, NULL);
+	gzip.threads = xcalloc(gzip.nr_threads, sizeof(*gzip.threads));
+	for (i = 0; i < gzip.nr_threads; i++) {
+		int err = pthread_create(&gzip.threads[i], NULL,
+					 gzip_worker, NULL);
+		if (err)
+			die("unable to create thread: %s", strerror(err));
+	}
+}
+
+static void stop_gzip_threads(void)
+{
+	int i;
+
+	while (gzip.written < gzip.queued)
+		write_oldest_gzip_chunk();
+	pthread_mutex_lock(&gzip.mutex);
+	gzip.stop = 1;
+	pthread_cond_broadcast(&gzip.cond);
+	pthread_mutex_unlock(&gzip.mutex);
+	for (i = 0; i < gzip.nr_threads; i++)
+		pthread_join(gzip.threads[i], NULL);
+	free(gzip.threads);
+	pthread_cond_destroy(&gzip.cond);
+	pthread_mutex_destroy(&gzip.mutex);
+}
+#endif
+
+/* Make the buffered input the next chunk. */
+static void queue_gzip_chunk(int last)
+{
+	struct gzip_chunk *chunk;
+
+#ifndef NO_PTHREADS
+	if (gzip.nr_threads > 1)
+		while (gzip.queued - gzip.written >= gzip.nr_slots)
+			write_oldest_gzip_chunk();
+#endif
+	chunk = &gzip.chunk[gzip.queued % gzip.nr_slots];
+	strbuf_reset(&chunk->in);
+	strbuf_addbuf(&chunk->in, &gzip.window);
+	chunk->dict_len = gzip.window.len;
+	strbuf_addbuf(&chunk->in, &gzip.buf);
+	chunk->last = last;
+	chunk->done = 0;
+
+	strbuf_reset(&gzip.window);
+	if (chunk->in.len > GZIP_WINDOW_SIZE)
+		strbuf_add(&gzip.window,
+			   chunk->in.buf + chunk->in.len - GZIP_WINDOW_SIZE,
+			   GZIP_WINDOW_SIZE);
+	else
+		strbuf_addbuf(&gzip.window, &chunk->in);
+	strbuf_reset(&gzip.buf);
+
+#ifndef NO_PTHREADS
+	if (gzip.nr_threads > 1) {
+		pthread_mutex_lock(&gzip.mutex);
+		gzip.queued++;
+		pthread_cond_broadcast(&gzip.cond);
+		pthread_mutex_unlock(&gzip.mutex);
+		return;
+	}
+#endif
+	compress_gzip_chunk(chunk);
+	write_gzip_chunk(chunk);
+	gzip.queued++;
+	gzip.written++;
+}
+
+static void write_gzip_data(const void *data, unsigned long size)
+{
+	const char *p = data;
+
+	while (size) {
+		size_t n = GZIP_CHUNK_SIZE - gzip.buf.len;
+		if (n > size)
+			n = size;
+		strbuf_add(&gzip.buf, p, n);
+		p += n;
+		size -= n;
+		if (gzip.buf.len == GZIP_CHUNK_SIZE)
+			queue_gzip_chunk(0);
+	}
+}
+
+static void copy_le32(unsigned char *dest, uint32_t n)
+{
+	dest[0] = 0xff & n;
+	dest[1] = 0xff & (n >> 010);
+	dest[2] = 0xff & (n >> 020);
+	dest[3] = 0xff & (n >> 030);
+}
+
+static int write_tar_gzip_archive(const struct archiver *ar,
+				  struct archiver_args *args)
+{
+	unsigned char header[10] = {
+		0x1f, 0x8b,	/* magic */
+		8,		/* deflate */
+		0,		/* no flags */
+		0, 0, 0, 0,	/* no mtime, like "gzip -n" */
+		0,		/* extra flags */
+		3		/* Unix */
+	};
+	unsigned char trailer[8];
+	unsigned int i;
+	int r;
+
+	memset(&gzip, 0, sizeof(gzip));
+	gzip.level = args->compression_level;
+	gzip.crc = crc32(0, NULL, 0);
+	strbuf_init(&gzip.buf, GZIP_CHUNK_SIZE);
+	strbuf_init(&gzip.window, GZIP_WINDOW_SIZE);
+	gzip.nr_threads = args->nr_threads;
+#ifdef NO_PTHREADS
+	gzip.nr_threads = 1;
+#endif
+	gzip.nr_slots = gzip.nr_threads > 1 ? 2 * gzip.nr_threads : 1;
+	gzip.chunk = xcalloc(gzip.nr_slots, sizeof(*gzip.chunk));
+	for (i = 0; i < gzip.nr_slots; i++) {
+		strbuf_init(&gzip.chunk[i].in, 0);
+		strbuf_init(&gzip.chunk[i].out, 0);
+	}
+#ifndef NO_PTHREADS
+	if (gzip.nr_threads > 1)
+		start_gzip_threads();
+#endif
+
+	if (gzip.level == Z_BEST_COMPRESSION)
+		header[8] = 2;
+	else if (gzip.level == Z_BEST_SPEED)
+		header[8] = 4;
+	write_or_die(1, header, sizeof(header));
+
+	write_tar_data = write_gzip_data;
+	r = write_tar_archive(ar, args);
+	write_tar_data = write_to_stdout;
+	queue_gzip_chunk(1);
+#ifndef NO_PTHREADS
+	if (gzip.nr_threads > 1)
+		stop_gzip_threads();
+#endif
+
+	copy_le32(trailer, gzip.crc);
+	copy_le32(trailer + 4, gzip.size);
+	write_or_die(1, trailer, sizeof(trailer));
+
+	for (i = 0; i < gzip.nr_slots; i++) {
+		strbuf_release(&gzip.chunk[i].in);
+		strbuf_release(&gzip.chunk[i].out);
+	}
+	free(gzip.chunk);
+	strbuf_release(&gzip.buf);
+	strbuf_release(&gzip.window);
+	return r;
+}
+
 static int write_tar_filter_archive(const struct archiver *ar,
 				    struct archiver_args *args)
 {
@@ -402,6 +690,9 @@ static int write_tar_filter_archive(const struct archiver *ar,
 	if (!ar->data)
 		die("BUG: tar-filter archiver called with no filter defined");
 
+	if (!strcmp(ar->data, GZIP_COMMAND))
+		return write_tar_gzip_archive(ar, args);
+
 	strbuf_addstr(&cmd, ar->data);
 	if (args->compression_level >= 0)
 		strbuf_addf(&cmd, " -%d", args->compression_level);
@@ -440,9 +731,9 @@ void init_tar_archiver(void)
 	int i;
 	register_archiver(&tar_archiver);
 
-	tar_filter_config("tar.tgz.command", "gzip -cn", NULL);
+	tar_filter_config("tar.tgz.command", GZIP_COMMAND, NULL);
 	tar_filter_config("tar.tgz.remote", "true", NULL);
-	tar_filter_config("tar.tar.gz.command", "gzip -cn", NULL);
+	tar_filter_config("tar.tar.gz.command", GZIP_COMMAND, NULL);
 	tar_filter_config("tar.tar.gz.remote", "true", NULL);
 	git_config(git_tar_config, NULL);
 	for (i = 0; i < nr_tar_filters; i++) {
@@ -7,9 +7,12 @@
 #include "utf8.h"
 #include "userdiff.h"
 #include "xdiff-interface.h"
+#include "pack-revindex.h"
+#include "thread-utils.h"
 
 static int zip_date;
 static int zip_time;
+static unsigned long zip_mtime;
 
 static unsigned char *zip_dir;
 static unsigned int zip_dir_size;
@@ -202,165 +205,394 @@ static int entry_is_binary(const char *path, const void *buffer, size_t size)
 
 #define STREAM_BUFFER_SIZE (1024 * 16)
 
-static int write_zip_entry(struct archiver_args *args,
-			   const unsigned char *sha1,
-			   const char *path, size_t pathlen,
-			   unsigned int mode)
-{
-	struct zip_local_header header;
-	struct zip_dir_header dirent;
-	struct zip_extra_mtime extra;
+/*
+ * An entry of the archive.  Entries with their data in memory are
+ * queued, deflated by threads and written in the order they came in;
+ * a streamed entry waits for all queued ones to be written first.
+ */
+struct zip_entry {
+	char *path;
+	size_t pathlen;
+	unsigned int mode;
+	unsigned long flags;
 	unsigned long attr2;
-	unsigned long compressed_size;
-	unsigned long crc;
-	unsigned long direntsize;
 	int method;
-	unsigned char *out;
-	void *deflated = NULL;
+	int is_binary;
 	void *buffer;
-	struct git_istream *stream = NULL;
-	unsigned long flags = 0;
 	unsigned long size;
-	int is_binary = -1;
-	const char *path_without_prefix = path + args->baselen;
+	struct strbuf packed;	/* zlib stream of the blob in a pack */
+	void *deflated;
+	const void *out;
+	unsigned long compressed_size;
+	unsigned long crc;
+	int done;
+};
 
-	crc = crc32(0, NULL, 0);
+static struct zip_queue {
+	int compression_level;
+	int nr_threads;
+	struct zip_entry *entry;
+	unsigned int nr_slots;
+	/* entry n is in slot n % nr_slots */
+	unsigned long queued, taken, written;
+#ifndef NO_PTHREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int stop;
+#endif
+} zip_queue;
 
-	if (!has_only_ascii(path)) {
-		if (is_utf8(path))
-			flags |= ZIP_UTF8;
-		else
-			warning("Path is not valid UTF-8: %s", path);
+/*
+ * Read the zlib stream of a blob stored whole (not as a delta) in a
+ * pack, which zip can take without recompressing it.
+ */
+static int read_packed_stream(const unsigned char *sha1, unsigned long size,
+			      struct strbuf *out)
+{
+	struct packed_git *p;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		struct pack_window *w_curs = NULL;
+		off_t offset = find_pack_entry_one(sha1, p);
+		off_t end;
+		unsigned long obj_size;
+		uint32_t pos;
+
+		if (!offset)
+			continue;
+		if (offset_to_pack_pos(p, offset, &pos))
+			return -1;
+		end = pack_pos_to_offset(p, pos + 1);
+		if (unpack_object_header(p, &w_curs, &offset, &obj_size) != OBJ_BLOB ||
+		    obj_size != size) {
+			unuse_pack(&w_curs);
+			return -1;
+		}
+		while (offset < end) {
+			unsigned long avail;
+			unsigned char *in = use_pack(p, &w_curs, offset, &avail);
+			if (avail > end - offset)
+				avail = end - offset;
+			strbuf_add(out, in, avail);
+			offset += avail;
+		}
+		unuse_pack(&w_curs);
+		return 0;
 	}
+	return -1;
+}
 
-	if (pathlen > 0xffff) {
-		return error("path too long (%d chars, SHA1: %s): %s",
-				(int)pathlen, sha1_to_hex(sha1), path);
-	}
+/*
+ * Check that the zlib stream from the pack inflates to exactly the
+ * data of the entry, which attributes may have changed, and return
+ * the length of the raw deflate stream inside it.
+ */
+static int check_packed_stream(struct zip_entry *e, unsigned long *len)
+{
+	const unsigned char *z = (const unsigned char *)e->packed.buf;
+	unsigned char buf[STREAM_BUFFER_SIZE];
+	unsigned long pos = 0;
+	git_zstream stream;
+	int status;
 
-	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
-		method = 0;
-		attr2 = 16;
-		out = NULL;
-		size = 0;
-		compressed_size = 0;
-		buffer = NULL;
-	} else if (S_ISREG(mode) || S_ISLNK(mode)) {
-		enum object_type type = sha1_object_info(sha1, &size);
-
-		method = 0;
-		attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
-			(mode & 0111) ? ((mode) << 16) : 0;
-		if (S_ISREG(mode) && args->compression_level != 0 && size > 0)
-			method = 8;
-
-		if (S_ISREG(mode) && type == OBJ_BLOB && !args->convert &&
-		    size > big_file_threshold) {
-			stream = open_istream(sha1, &type, &size, NULL);
-			if (!stream)
-				return error("cannot stream blob %s",
-					     sha1_to_hex(sha1));
-			flags |= ZIP_STREAM;
-			out = buffer = NULL;
-		} else {
-			buffer = sha1_file_to_archive(args, path, sha1, mode,
-						      &type, &size);
-			if (!buffer)
-				return error("cannot read %s",
-					     sha1_to_hex(sha1));
-			crc = crc32(crc, buffer, size);
-			is_binary = entry_is_binary(path_without_prefix,
-						    buffer, size);
-			out = buffer;
-		}
-		compressed_size = (method == 0) ? size : 0;
-	} else {
-		return error("unsupported file mode: 0%o (SHA1: %s)", mode,
-				sha1_to_hex(sha1));
-	}
+	/* deflate without a preset dictionary */
+	if (e->packed.len < 6 || (z[0] & 0x0f) != 8 || (z[1] & 0x20))
+		return -1;
 
-	if (buffer && method == 8) {
-		out = deflated = zlib_deflate_raw(buffer, size,
-						  args->compression_level,
-						  &compressed_size);
-		if (!out || compressed_size >= size) {
-			out = buffer;
-			method = 0;
-			compressed_size = size;
+	memset(&stream, 0, sizeof(stream));
+	git_inflate_init(&stream);
+	stream.next_in = (unsigned char *)z;
+	stream.avail_in = e->packed.len;
+	do {
+		unsigned long n;
+
+		stream.next_out = buf;
+		stream.avail_out = sizeof(buf);
+		status = git_inflate(&stream, 0);
+		n = stream.next_out - buf;
+		if (n > e->size - pos ||
+		    memcmp((char *)e->buffer + pos, buf, n))
+			break;
+		pos += n;
+	} while (status == Z_OK);
+	git_inflate_end(&stream);
+
+	if (status != Z_STREAM_END || pos != e->size)
+		return -1;
+	*len = stream.total_in - 6; /* zlib header and Adler-32 */
+	return 0;
+}
+
+static void deflate_zip_entry(struct zip_entry *e)
+{
+	unsigned long len;
+
+	e->crc = crc32(crc32(0, NULL, 0), e->buffer, e->size);
+	e->out = e->buffer;
+	e->compressed_size = e->size;
+	if (e->method != 8)
+		return;
+
+	if (e->packed.len && !check_packed_stream(e, &len)) {
+		e->out = e->packed.buf + 2;
+		e->compressed_size = len;
+	} else {
+		e->deflated = zlib_deflate_raw(e->buffer, e->size,
+					       zip_queue.compression_level,
+					       &len);
+		if (e->deflated) {
+			e->out = e->deflated;
+			e->compressed_size = len;
 		}
 	}
+	if (e->out == e->buffer || e->compressed_size >= e->size) {
+		e->out = e->buffer;
+		e->method = 0;
+		e->compressed_size = e->size;
+	}
+}
 
-	copy_le16(extra.magic, 0x5455);
-	copy_le16(extra.extra_size, ZIP_EXTRA_MTIME_PAYLOAD_SIZE);
-	extra.flags[0] = 1;	/* just mtime */
-	copy_le32(extra.mtime, args->time);
+static void prepare_zip_extra(struct zip_extra_mtime *extra)
+{
+	copy_le16(extra->magic, 0x5455);
+	copy_le16(extra->extra_size, ZIP_EXTRA_MTIME_PAYLOAD_SIZE);
+	extra->flags[0] = 1;	/* just mtime */
+	copy_le32(extra->mtime, zip_mtime);
+}
 
-	/* make sure we have enough free space in the dictionary */
-	direntsize = ZIP_DIR_HEADER_SIZE + pathlen + ZIP_EXTRA_MTIME_SIZE;
-	while (zip_dir_size < zip_dir_offset + direntsize) {
-		zip_dir_size += ZIP_DIRECTORY_MIN_SIZE;
-		zip_dir = xrealloc(zip_dir, zip_dir_size);
-	}
+/*
+ * Write the local header of an entry, and prepare its directory
+ * entry; for a streamed entry, the sizes and CRC are still zero.
+ */
+static void write_zip_header(struct zip_entry *e, struct zip_dir_header *dirent)
+{
+	struct zip_local_header header;
+	struct zip_extra_mtime extra;
+	unsigned int mode = e->mode;
+
+	prepare_zip_extra(&extra);
 
-	copy_le32(dirent.magic, 0x02014b50);
-	copy_le16(dirent.creator_version,
+	copy_le32(dirent->magic, 0x02014b50);
+	copy_le16(dirent->creator_version,
 		S_ISLNK(mode) || (S_ISREG(mode) && (mode & 0111)) ? 0x0317 : 0);
-	copy_le16(dirent.version, 10);
-	copy_le16(dirent.flags, flags);
-	copy_le16(dirent.compression_method, method);
-	copy_le16(dirent.mtime, zip_time);
-	copy_le16(dirent.mdate, zip_date);
-	set_zip_dir_data_desc(&dirent, size, compressed_size, crc);
-	copy_le16(dirent.filename_length, pathlen);
-	copy_le16(dirent.extra_length, ZIP_EXTRA_MTIME_SIZE);
-	copy_le16(dirent.comment_length, 0);
-	copy_le16(dirent.disk, 0);
-	copy_le32(dirent.attr2, attr2);
-	copy_le32(dirent.offset, zip_offset);
+	copy_le16(dirent->version, 10);
+	copy_le16(dirent->flags, e->flags);
+	copy_le16(dirent->compression_method, e->method);
+	copy_le16(dirent->mtime, zip_time);
+	copy_le16(dirent->mdate, zip_date);
+	set_zip_dir_data_desc(dirent, e->size, e->compressed_size, e->crc);
+	copy_le16(dirent->filename_length, e->pathlen);
+	copy_le16(dirent->extra_length, ZIP_EXTRA_MTIME_SIZE);
+	copy_le16(dirent->comment_length, 0);
+	copy_le16(dirent->disk, 0);
+	copy_le32(dirent->attr2, e->attr2);
+	copy_le32(dirent->offset, zip_offset);
 
 	copy_le32(header.magic, 0x04034b50);
 	copy_le16(header.version, 10);
-	copy_le16(header.flags, flags);
-	copy_le16(header.compression_method, method);
+	copy_le16(header.flags, e->flags);
+	copy_le16(header.compression_method, e->method);
 	copy_le16(header.mtime, zip_time);
 	copy_le16(header.mdate, zip_date);
-	set_zip_header_data_desc(&header, size, compressed_size, crc);
-	copy_le16(header.filename_length, pathlen);
+	set_zip_header_data_desc(&header, e->size, e->compressed_size, e->crc);
+	copy_le16(header.filename_length, e->pathlen);
 	copy_le16(header.extra_length, ZIP_EXTRA_MTIME_SIZE);
 	write_or_die(1, &header, ZIP_LOCAL_HEADER_SIZE);
 	zip_offset += ZIP_LOCAL_HEADER_SIZE;
-	write_or_die(1, path, pathlen);
-	zip_offset += pathlen;
+	write_or_die(1, e->path, e->pathlen);
+	zip_offset += e->pathlen;
 	write_or_die(1, &extra, ZIP_EXTRA_MTIME_SIZE);
 	zip_offset += ZIP_EXTRA_MTIME_SIZE;
-	if (stream && method == 0) {
-		unsigned char buf[STREAM_BUFFER_SIZE];
-		ssize_t readlen;
+}
+
+static void add_zip_dirent(struct zip_entry *e, struct zip_dir_header *dirent)
+{
+	struct zip_extra_mtime extra;
+	unsigned long direntsize;
 
+	prepare_zip_extra(&extra);
+	set_zip_dir_data_desc(dirent, e->size, e->compressed_size, e->crc);
+	copy_le16(dirent->attr1, !e->is_binary);
+
+	/* make sure we have enough free space in the dictionary */
+	direntsize = ZIP_DIR_HEADER_SIZE + e->pathlen + ZIP_EXTRA_MTIME_SIZE;
+	while (zip_dir_size < zip_dir_offset + direntsize) {
+		zip_dir_size += ZIP_DIRECTORY_MIN_SIZE;
+		zip_dir = xrealloc(zip_dir, zip_dir_size);
+	}
+
+	memcpy(zip_dir + zip_dir_offset, dirent, ZIP_DIR_HEADER_SIZE);
+	zip_dir_offset += ZIP_DIR_HEADER_SIZE;
+	memcpy(zip_dir + zip_dir_offset, e->path, e->pathlen);
+	zip_dir_offset += e->pathlen;
+	memcpy(zip_dir + zip_dir_offset, &extra, ZIP_EXTRA_MTIME_SIZE);
+	zip_dir_offset += ZIP_EXTRA_MTIME_SIZE;
+	zip_dir_entries++;
+}
+
+static void write_zip_entry_data(struct zip_entry *e)
+{
+	struct zip_dir_header dirent;
+
+	write_zip_header(e, &dirent);
+	if (e->compressed_size > 0) {
+		write_or_die(1, e->out, e->compressed_size);
+		zip_offset += e->compressed_size;
+	}
+	add_zip_dirent(e, &dirent);
+
+	free(e->path);
+	free(e->buffer);
+	free(e->deflated);
+	e->path = NULL;
+	e->buffer = NULL;
+	e->deflated = NULL;
+	strbuf_release(&e->packed);
+}
+
+#ifndef NO_PTHREADS
+static void *zip_worker(void *data)
+{
+	for (;;) {
+		struct zip_entry *e;
+
+		pthread_mutex_lock(&zip_queue.mutex);
+		while (zip_queue.taken == zip_queue.queued && !zip_queue.stop)
+			pthread_cond_wait(&zip_queue.cond, &zip_queue.mutex);
+		if (zip_queue.taken == zip_queue.queued) {
+			pthread_mutex_unlock(&zip_queue.mutex);
+			return NULL;
+		}
+		e = &zip_queue.entry[zip_queue.taken++ % zip_queue.nr_slots];
+		pthread_mutex_unlock(&zip_queue.mutex);
+
+		deflate_zip_entry(e);
+
+		pthread_mutex_lock(&zip_queue.mutex);
+		e->done = 1;
+		pthread_cond_broadcast(&zip_queue.cond);
+		pthread_mutex_unlock(&zip_queue.mutex);
+	}
+}
+
+static void start_zip_threads(void)
+{
+	int i;
+
+	pthread_mutex_init(&zip_queue.mutex, NULL);
+	pthread_cond_init(&zip_queue.cond, NULL);
+	zip_queue.threads = xcalloc(zip_queue.nr_threads,
+				    sizeof(*zip_queue.threads));
+	for (i = 0; i < zip_queue.nr_threads; i++) {
+		int err = pthread_create(&zip_queue.threads[i], NULL,
+					 zip_worker, NULL);
+		if (err)
+			die("unable to create thread: %s", strerror(err));
+	}
+}
+
+static void stop_zip_threads(void)
+{
+	int i;
+
+	pthread_mutex_lock(&zip_queue.mutex);
+	zip_queue.stop = 1;
+	pthread_cond_broadcast(&zip_queue.cond);
+	pthread_mutex_unlock(&zip_queue.mutex);
+	for (i = 0; i < zip_queue.nr_threads; i++)
+		pthread_join(zip_queue.threads[i], NULL);
+	free(zip_queue.threads);
+	pthread_cond_destroy(&zip_queue.cond);
+	pthread_mutex_destroy(&zip_queue.mutex);
+}
+#endif
+
+/* Write out the oldest queued entry, once it is deflated. */
+static void write_oldest_zip_entry(void)
+{
+	struct zip_entry *e = &zip_queue.entry[zip_queue.written % zip_queue.nr_slots];
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&zip_queue.mutex);
+	while (!e->done)
+		pthread_cond_wait(&zip_queue.cond, &zip_queue.mutex);
+	pthread_mutex_unlock(&zip_queue.mutex);
+#endif
+	write_zip_entry_data(e);
+	zip_queue.written++;
+}
+
+static void flush_zip_queue(void)
+{
+	while (zip_queue.written < zip_queue.queued)
+		write_oldest_zip_entry();
+}
+
+/* Take a free slot for the next entry. */
+static struct zip_entry *next_zip_entry(void)
+{
+	struct zip_entry *e;
+
+	while (zip_queue.queued - zip_queue.written >= zip_queue.nr_slots)
+		write_oldest_zip_entry();
+	e = &zip_queue.entry[zip_queue.queued % zip_queue.nr_slots];
+	e->done = 0;
+	e->buffer = NULL;
+	e->deflated = NULL;
+	e->out = NULL;
+	e->size = 0;
+	e->compressed_size = 0;
+	e->crc = crc32(0, NULL, 0);
+	e->is_binary = -1;
+	strbuf_reset(&e->packed);
+	return e;
+}
+
+static void queue_zip_entry(struct zip_entry *e)
+{
+#ifndef NO_PTHREADS
+	if (zip_queue.nr_threads > 1) {
+		pthread_mutex_lock(&zip_queue.mutex);
+		zip_queue.queued++;
+		pthread_cond_broadcast(&zip_queue.cond);
+		pthread_mutex_unlock(&zip_queue.mutex);
+		return;
+	}
+#endif
+	deflate_zip_entry(e);
+	e->done = 1;
+	zip_queue.queued++;
+	write_oldest_zip_entry();
+}
+
+static int write_zip_stream(struct archiver_args *args, struct zip_entry *e,
+			    struct git_istream *stream)
+{
+	const char *path_without_prefix = e->path + args->baselen;
+	struct zip_dir_header dirent;
+	unsigned char buf[STREAM_BUFFER_SIZE];
+	ssize_t readlen;
+
+	write_zip_header(e, &dirent);
+	if (e->method == 0) {
 		for (;;) {
 			readlen = read_istream(stream, buf, sizeof(buf));
 			if (readlen <= 0)
 				break;
-			crc = crc32(crc, buf, readlen);
-			if (is_binary == -1)
-				is_binary = entry_is_binary(path_without_prefix,
-							    buf, readlen);
+			e->crc = crc32(e->crc, buf, readlen);
+			if (e->is_binary == -1)
+				e->is_binary = entry_is_binary(path_without_prefix,
+							       buf, readlen);
 			write_or_die(1, buf, readlen);
 		}
 		close_istream(stream);
 		if (readlen)
 			return readlen;
 
-		compressed_size = size;
-		zip_offset += compressed_size;
-
-		write_zip_data_desc(size, compressed_size, crc);
-		zip_offset += ZIP_DATA_DESC_SIZE;
-
-		set_zip_dir_data_desc(&dirent, size, compressed_size, crc);
-	} else if (stream && method == 8) {
-		unsigned char buf[STREAM_BUFFER_SIZE];
-		ssize_t readlen;
+		e->compressed_size = e->size;
+	} else {
 		git_zstream zstream;
 		int result;
 		size_t out_len;
@@ -368,7 +600,7 @@ static int write_zip_entry(struct archiver_args *args,
 
 		git_deflate_init_raw(&zstream, args->compression_level);
 
-		compressed_size = 0;
+		e->compressed_size = 0;
 		zstream.next_out = compressed;
 		zstream.avail_out = sizeof(compressed);
 
@@ -376,10 +608,10 @@ static int write_zip_entry(struct archiver_args *args,
 			readlen = read_istream(stream, buf, sizeof(buf));
 			if (readlen <= 0)
 				break;
-			crc = crc32(crc, buf, readlen);
-			if (is_binary == -1)
-				is_binary = entry_is_binary(path_without_prefix,
-							    buf, readlen);
+			e->crc = crc32(e->crc, buf, readlen);
+			if (e->is_binary == -1)
+				e->is_binary = entry_is_binary(path_without_prefix,
+							       buf, readlen);
 
 			zstream.next_in = buf;
 			zstream.avail_in = readlen;
@@ -390,7 +622,7 @@ static int write_zip_entry(struct archiver_args *args,
 
 			if (out_len > 0) {
 				write_or_die(1, compressed, out_len);
-				compressed_size += out_len;
+				e->compressed_size += out_len;
 				zstream.next_out = compressed;
 				zstream.avail_out = sizeof(compressed);
 			}
@@ -409,31 +641,96 @@ static int write_zip_entry(struct archiver_args *args,
 		git_deflate_end(&zstream);
 		out_len = zstream.next_out - compressed;
 		write_or_die(1, compressed, out_len);
-		compressed_size += out_len;
-		zip_offset += compressed_size;
+		e->compressed_size += out_len;
+	}
+	zip_offset += e->compressed_size;
 
-		write_zip_data_desc(size, compressed_size, crc);
-		zip_offset += ZIP_DATA_DESC_SIZE;
+	write_zip_data_desc(e->size, e->compressed_size, e->crc);
+	zip_offset += ZIP_DATA_DESC_SIZE;
+
+	add_zip_dirent(e, &dirent);
+	free(e->path);
+	e->path = NULL;
+	return 0;
+}
 
-		set_zip_dir_data_desc(&dirent, size, compressed_size, crc);
-	} else if (compressed_size > 0) {
-		write_or_die(1, out, compressed_size);
-		zip_offset += compressed_size;
+static int write_zip_entry(struct archiver_args *args,
+			   const unsigned char *sha1,
+			   const char *path, size_t pathlen,
+			   unsigned int mode)
+{
+	struct zip_entry *e;
+	struct git_istream *stream = NULL;
+	enum object_type type;
+	unsigned long flags = 0;
+	unsigned long size = 0;
+	const char *path_without_prefix = path + args->baselen;
+
+	if (!has_only_ascii(path)) {
+		if (is_utf8(path))
+			flags |= ZIP_UTF8;
+		else
+			warning("Path is not valid UTF-8: %s", path);
 	}
 
-	free(deflated);
-	free(buffer);
+	if (pathlen > 0xffff) {
+		return error("path too long (%d chars, SHA1: %s): %s",
+				(int)pathlen, sha1_to_hex(sha1), path);
+	}
 
-	copy_le16(dirent.attr1, !is_binary);
+	if (!(S_ISDIR(mode) || S_ISGITLINK(mode) ||
+	      S_ISREG(mode) || S_ISLNK(mode)))
+		return error("unsupported file mode: 0%o (SHA1: %s)", mode,
+				sha1_to_hex(sha1));
 
-	memcpy(zip_dir + zip_dir_offset, &dirent, ZIP_DIR_HEADER_SIZE);
-	zip_dir_offset += ZIP_DIR_HEADER_SIZE;
-	memcpy(zip_dir + zip_dir_offset, path, pathlen);
-	zip_dir_offset += pathlen;
-	memcpy(zip_dir + zip_dir_offset, &extra, ZIP_EXTRA_MTIME_SIZE);
-	zip_dir_offset += ZIP_EXTRA_MTIME_SIZE;
-	zip_dir_entries++;
+	if (S_ISREG(mode) && !args->convert &&
+	    sha1_object_info(sha1, &size) == OBJ_BLOB &&
+	    size > big_file_threshold) {
+		stream = open_istream(sha1, &type, &size, NULL);
+		if (!stream)
+			return error("cannot stream blob %s",
+				     sha1_to_hex(sha1));
+		flags |= ZIP_STREAM;
+		flush_zip_queue();
+	}
 
+	e = next_zip_entry();
+	e->path = xmemdupz(path, pathlen);
+	e->pathlen = pathlen;
+	e->mode = mode;
+	e->flags = flags;
+	e->method = 0;
+
+	if (S_ISDIR(mode) || S_ISGITLINK(mode)) {
+		e->attr2 = 16;
+		e->is_binary = -1;
+	} else {
+		e->attr2 = S_ISLNK(mode) ? ((mode | 0777) << 16) :
+			(mode & 0111) ? ((mode) << 16) : 0;
+		if (stream) {
+			e->size = size;
+			if (args->compression_level != 0 && size > 0)
+				e->method = 8;
+			return write_zip_stream(args, e, stream);
+		}
+
+		e->buffer = sha1_file_to_archive(args, path, sha1, mode,
+						 &type, &e->size);
+		if (!e->buffer) {
+			free(e->path);
+			e->path = NULL;
+			return error("cannot read %s", sha1_to_hex(sha1));
+		}
+		e->is_binary = entry_is_binary(path_without_prefix,
+					       e->buffer, e->size);
+		if (S_ISREG(mode) && args->compression_level != 0 && e->size > 0)
+			e->method = 8;
+		if (e->method == 8 &&
+		    args->compression_level == Z_DEFAULT_COMPRESSION)
+			read_packed_stream(sha1, e->size, &e->packed);
+	}
+
+	queue_zip_entry(e);
 	return 0;
 }
 
@@ -468,14 +765,38 @@ static void dos_time(time_t *time, int *dos_date, int *dos_time)
 static int write_zip_archive(const struct archiver *ar,
 			     struct archiver_args *args)
 {
+	unsigned int i;
 	int err;
 
 	dos_time(&args->time, &zip_date, &zip_time);
+	zip_mtime = args->time;
 
 	zip_dir = xmalloc(ZIP_DIRECTORY_MIN_SIZE);
 	zip_dir_size = ZIP_DIRECTORY_MIN_SIZE;
 
+	memset(&zip_queue, 0, sizeof(zip_queue));
+	zip_queue.compression_level = args->compression_level;
+	zip_queue.nr_threads = args->nr_threads;
+#ifdef NO_PTHREADS
+	zip_queue.nr_threads = 1;
+#endif
+	zip_queue.nr_slots = zip_queue.nr_threads > 1 ?
+		2 * zip_queue.nr_threads : 1;
+	zip_queue.entry = xcalloc(zip_queue.nr_slots, sizeof(*zip_queue.entry));
+	for (i = 0; i < zip_queue.nr_slots; i++)
+		strbuf_init(&zip_queue.entry[i].packed, 0);
+#ifndef NO_PTHREADS
+	if (zip_queue.nr_threads > 1)
+		start_zip_threads();
+#endif
+
 	err = write_archive_entries(args, write_zip_entry);
+	flush_zip_queue();
+#ifndef NO_PTHREADS
+	if (zip_queue.nr_threads > 1)
+		stop_zip_threads();
+#endif
+	free(zip_queue.entry);
 	if (!err)
 		write_zip_trailer(args->commit_sha1);
 
@@ -6,6 +6,7 @@
 #include "parse-options.h"
 #include "unpack-trees.h"
 #include "dir.h"
+#include "thread-utils.h"
 
 static char const * const archive_usage[] = {
 	N_("git archive [<options>] <tree-ish> [<path>...]"),
@@ -518,6 +519,9 @@ int write_archive(int argc, const char **argv, const char *prefix,
 	init_zip_archiver();
 
 	argc = parse_archive_args(argc, argv, &ar, &args, name_hint, remote);
+	if (git_config_get_int("archive.threads", &args.nr_threads) ||
+	    args.nr_threads <= 0)
+		args.nr_threads = online_cpus();
 	if (nongit) {
 		/*
 		 * We know this will die() with an error, so we could just
@@ -15,6 +15,7 @@ struct archiver_args {
 	unsigned int worktree_attributes : 1;
 	unsigned int convert : 1;
 	int compression_level;
+	int nr_threads;
 };
 
 #define ARCHIVER_WANT_COMPRESSION_LEVELS 1
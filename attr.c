@@ -13,6 +13,7 @@
 #include "attr.h"
 #include "dir.h"
 #include "utf8.h"
+#include "thread-utils.h"
 
 const char git_attr__true[] = "(builtin)true";
 const char git_attr__false[] = "\0(builtin)false";
@@ -43,6 +44,42 @@ static int cannot_trust_maybe_real;
 static struct git_attr_check *check_all_attr;
 static struct git_attr *(git_attr_hash[HASHSIZE]);
 
+#ifndef NO_PTHREADS
+static pthread_mutex_t attr_mutex;
+static int attr_use_lock;
+
+void enable_attr_lock(void)
+{
+	if (attr_use_lock++)
+		return;
+	pthread_mutex_init(&attr_mutex, NULL);
+}
+
+void disable_attr_lock(void)
+{
+	if (!attr_use_lock)
+		die("BUG: unbalanced disable_attr_lock()");
+	if (--attr_use_lock)
+		return;
+	pthread_mutex_destroy(&attr_mutex);
+}
+
+static inline void attr_lock(void)
+{
+	if (attr_use_lock)
+		pthread_mutex_lock(&attr_mutex);
+}
+
+static inline void attr_unlock(void)
+{
+	if (attr_use_lock)
+		pthread_mutex_unlock(&attr_mutex);
+}
+#else
+#define attr_lock()
+#define attr_unlock()
+#endif
+
 char *git_attr_name(struct git_attr *attr)
 {
 	return attr->name;
@@ -111,7 +148,12 @@ static struct git_attr *git_attr_internal(const char *name, int len)
 
 struct git_attr *git_attr(const char *name)
 {
-	return git_attr_internal(name, strlen(name));
+	struct git_attr *a;
+
+	attr_lock();
+	a = git_attr_internal(name, strlen(name));
+	attr_unlock();
+	return a;
 }
 
 /* What does a matched pattern decide? */
@@ -300,19 +342,43 @@ static struct match_attr *parse_attr_line(const char *line, const char *src,
  * .gitignore
  */
 
+/*
+ * Where read_attr() found the rules of a directory, so that a cached
+ * attr_stack can be checked against what it would read now.
+ */
+struct attr_source {
+	unsigned char sha1[20];	/* of the blob in the index */
+	struct stat_data st;	/* of the file in the working tree */
+	unsigned in_index:1;
+	unsigned in_file:1;
+};
+
 static struct attr_stack {
+	struct hashmap_entry ent;	/* in attr_dirs, if "cached" */
 	struct attr_stack *prev;
 	char *origin;
 	size_t originlen;
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
+	struct pattern_index *index;
+	struct attr_source source;
+	unsigned indexed:1;
+	unsigned cached:1;
 } *attr_stack;
 
+/*
+ * The attr_stack elements of the directories seen so far, by origin.
+ * Going back to a directory reuses its rules instead of reading and
+ * parsing its .gitattributes again.
+ */
+static struct hashmap attr_dirs;
+
 static void free_attr_elem(struct attr_stack *e)
 {
 	int i;
 	free(e->origin);
+	free_pattern_index(e->index);
 	for (i = 0; i < e->num_matches; i++) {
 		struct match_attr *a = e->attrs[i];
 		int j;
@@ -415,6 +481,71 @@ static struct attr_stack *read_attr_from_index(const char *path, int macro_ok)
 	return res;
 }
 
+static const unsigned char *attr_index_sha1(const char *path)
+{
+	struct index_state *istate = use_index ? use_index : &the_index;
+	int pos = index_name_pos(istate, path, strlen(path));
+	int i;
+
+	if (0 <= pos)
+		return istate->cache[pos]->sha1;
+	/* like read_blob_data_from_index(), use "ours" during a merge */
+	for (i = -pos - 1;
+	     i < istate->cache_nr && !strcmp(istate->cache[i]->name, path);
+	     i++)
+		if (ce_stage(istate->cache[i]) == 2)
+			return istate->cache[i]->sha1;
+	return NULL;
+}
+
+static int attr_file_stat(const char *path, struct attr_source *src)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return 0;
+	fill_stat_data(&src->st, &st);
+	src->in_file = 1;
+	return 1;
+}
+
+static int attr_index_stat(const char *path, struct attr_source *src)
+{
+	const unsigned char *sha1 = attr_index_sha1(path);
+
+	if (!sha1)
+		return 0;
+	hashcpy(src->sha1, sha1);
+	src->in_index = 1;
+	return 1;
+}
+
+/* Find where read_attr() would read path from, in the same order. */
+static void stat_attr_source(const char *path, struct attr_source *src)
+{
+	memset(src, 0, sizeof(*src));
+	if (direction == GIT_ATTR_CHECKOUT) {
+		if (!attr_index_stat(path, src))
+			attr_file_stat(path, src);
+	} else if (direction == GIT_ATTR_CHECKIN) {
+		if (!attr_file_stat(path, src))
+			attr_index_stat(path, src);
+	} else
+		attr_index_stat(path, src);
+}
+
+static int same_attr_source(const struct attr_source *a,
+			    const struct attr_source *b)
+{
+	if (a->in_index != b->in_index || a->in_file != b->in_file)
+		return 0;
+	if (a->in_index && hashcmp(a->sha1, b->sha1))
+		return 0;
+	if (a->in_file && memcmp(&a->st, &b->st, sizeof(a->st)))
+		return 0;
+	return 1;
+}
+
 static struct attr_stack *read_attr(const char *path, int macro_ok)
 {
 	struct attr_stack *res;
@@ -468,13 +599,44 @@ static void debug_set(const char *what, const char *match, struct git_attr *attr
 #define debug_set(a,b,c,d) do { ; } while (0)
 #endif
 
+static void forget_attrs(void);
+
+static int attr_dir_cmp(const struct attr_stack *a, const struct attr_stack *b,
+			const char *origin)
+{
+	return a->originlen != b->originlen ||
+		memcmp(a->origin, origin ? origin : b->origin, a->originlen);
+}
+
+static struct attr_stack *find_attr_dir(const char *origin, size_t len)
+{
+	struct attr_stack k;
+
+	if (!attr_dirs.tablesize)
+		return NULL;
+	hashmap_entry_init(&k, memhash(origin, len));
+	k.originlen = len;
+	return hashmap_get(&attr_dirs, &k, origin);
+}
+
 static void drop_attr_stack(void)
 {
+	struct hashmap_iter iter;
+	struct attr_stack *elem;
+
 	while (attr_stack) {
-		struct attr_stack *elem = attr_stack;
+		elem = attr_stack;
 		attr_stack = elem->prev;
-		free_attr_elem(elem);
+		if (!elem->cached)
+			free_attr_elem(elem);
 	}
+	if (attr_dirs.tablesize) {
+		for (elem = hashmap_iter_first(&attr_dirs, &iter); elem;
+		     elem = hashmap_iter_next(&iter))
+			free_attr_elem(elem);
+		hashmap_free(&attr_dirs, 0);
+	}
+	forget_attrs();
 }
 
 static const char *git_etc_gitattributes(void)
@@ -585,7 +747,8 @@ static void prepare_attr_stack(const char *path, int dirlen)
 
 		debug_pop(elem);
 		attr_stack = elem->prev;
-		free_attr_elem(elem);
+		if (!elem->cached)
+			free_attr_elem(elem);
 	}
 
 	/*
@@ -599,6 +762,7 @@ static void prepare_attr_stack(const char *path, int dirlen)
 		 * empty string.
 		 */
 		struct strbuf pathbuf = STRBUF_INIT;
+		struct attr_source source;
 
 		assert(attr_stack->origin);
 		while (1) {
@@ -611,9 +775,31 @@ static void prepare_attr_stack(const char *path, int dirlen)
 			strbuf_add(&pathbuf, path, cp - path);
 			strbuf_addch(&pathbuf, '/');
 			strbuf_addstr(&pathbuf, GITATTRIBUTES_FILE);
-			elem = read_attr(pathbuf.buf, 0);
-			strbuf_setlen(&pathbuf, cp - path);
-			elem->origin = strbuf_detach(&pathbuf, &elem->originlen);
+			stat_attr_source(pathbuf.buf, &source);
+			elem = find_attr_dir(path, cp - path);
+			if (elem && !same_attr_source(&elem->source, &source)) {
+				/* results remembered so far may point into it */
+				hashmap_remove(&attr_dirs, elem, NULL);
+				free_attr_elem(elem);
+				forget_attrs();
+				elem = NULL;
+			}
+			if (elem) {
+				strbuf_reset(&pathbuf);
+			} else {
+				elem = read_attr(pathbuf.buf, 0);
+				elem->source = source;
+				strbuf_setlen(&pathbuf, cp - path);
+				elem->origin = strbuf_detach(&pathbuf,
+							     &elem->originlen);
+				if (!attr_dirs.tablesize)
+					hashmap_init(&attr_dirs,
+						     (hashmap_cmp_fn)attr_dir_cmp, 0);
+				hashmap_entry_init(elem, memhash(elem->origin,
+								 elem->originlen));
+				hashmap_add(&attr_dirs, elem);
+				elem->cached = 1;
+			}
 			elem->prev = attr_stack;
 			attr_stack = elem;
 			debug_push(elem);
@@ -676,11 +862,44 @@ static int fill_one(const char *what, struct match_attr *a, int rem)
 	return rem;
 }
 
+static void index_attr_stack(struct attr_stack *stk)
+{
+	const char *base = stk->origin ? stk->origin : "";
+	int i;
+
+	for (i = 0; i < stk->num_matches; i++) {
+		struct match_attr *a = stk->attrs[i];
+		if (a->is_macro)
+			continue;
+		add_pattern_to_index(&stk->index, i, a->u.pat.pattern,
+				     a->u.pat.patternlen,
+				     a->u.pat.nowildcardlen, a->u.pat.flags,
+				     base, stk->originlen);
+	}
+	stk->indexed = 1;
+}
+
 static int fill(const char *path, int pathlen, int basename_offset,
 		struct attr_stack *stk, int rem)
 {
+	struct pattern_candidates c;
 	int i;
 	const char *base = stk->origin ? stk->origin : "";
+	int isdir = (pathlen && path[pathlen - 1] == '/');
+
+	if (!stk->indexed)
+		index_attr_stack(stk);
+	if (!start_pattern_candidates(&c, stk->index, path, pathlen - isdir,
+				      pathlen - basename_offset - isdir)) {
+		while (0 < rem && 0 <= (i = next_pattern_candidate(&c))) {
+			struct match_attr *a = stk->attrs[i];
+			if (path_matches(path, pathlen, basename_offset,
+					 &a->u.pat, base, stk->originlen))
+				rem = fill_one("fill", a, rem);
+		}
+		end_pattern_candidates(&c);
+		return rem;
+	}
 
 	for (i = stk->num_matches - 1; 0 < rem && 0 <= i; i--) {
 		struct match_attr *a = stk->attrs[i];
@@ -718,13 +937,103 @@ static int macroexpand_one(int nr, int rem)
 	return rem;
 }
 
+/*
+ * The answers to the last git_check_attr() calls, by path and the
+ * attributes asked for; many callers ask about the same path over and
+ * over again.  They are forgotten when an attr_stack they may have
+ * come from is read again or dropped.
+ */
+struct attr_memo {
+	struct hashmap_entry ent;
+	int num;
+	int pathlen;
+	const char *path;
+	struct git_attr_check check[FLEX_ARRAY];
+};
+
+#define ATTR_MEMO_MAX 4096
+static struct hashmap attr_memo;
+
+static int attr_memo_cmp(const struct attr_memo *a, const struct attr_memo *b,
+			 const struct git_attr_check *check)
+{
+	int i;
+
+	if (a->num != b->num || a->pathlen != b->pathlen ||
+	    memcmp(a->path, b->path, a->pathlen))
+		return 1;
+	if (!check)
+		check = b->check;
+	for (i = 0; i < a->num; i++)
+		if (a->check[i].attr != check[i].attr)
+			return 1;
+	return 0;
+}
+
+static unsigned int attr_memo_hash(const char *path, int pathlen,
+				   int num, const struct git_attr_check *check)
+{
+	unsigned int hash = memhash(path, pathlen);
+	int i;
+
+	for (i = 0; i < num; i++)
+		hash = hash * 31 + check[i].attr->attr_nr;
+	return hash;
+}
+
+static void forget_attrs(void)
+{
+	hashmap_free(&attr_memo, 1);
+}
+
+static struct attr_memo *find_attr_memo(const char *path, int pathlen,
+					int num, struct git_attr_check *check)
+{
+	struct attr_memo k;
+
+	if (!attr_memo.tablesize)
+		return NULL;
+	hashmap_entry_init(&k, attr_memo_hash(path, pathlen, num, check));
+	k.num = num;
+	k.pathlen = pathlen;
+	k.path = path;
+	return hashmap_get(&attr_memo, &k, check);
+}
+
+static void remember_attrs(const char *path, int num,
+			   const struct git_attr_check *check)
+{
+	int pathlen = strlen(path);
+	struct attr_memo *memo;
+	char *p;
+
+	if (!attr_memo.tablesize)
+		hashmap_init(&attr_memo, (hashmap_cmp_fn)attr_memo_cmp, 0);
+	else if (attr_memo.size >= ATTR_MEMO_MAX) {
+		forget_attrs();
+		hashmap_init(&attr_memo, (hashmap_cmp_fn)attr_memo_cmp, 0);
+	}
+	memo = xmalloc(sizeof(*memo) + num * sizeof(*check) + pathlen + 1);
+	hashmap_entry_init(memo, attr_memo_hash(path, pathlen, num, check));
+	memo->num = num;
+	memo->pathlen = pathlen;
+	memcpy(memo->check, check, num * sizeof(*check));
+	p = (char *)(memo->check + num);
+	memcpy(p, path, pathlen + 1);
+	memo->path = p;
+	hashmap_add(&attr_memo, memo);
+}
+
 /*
  * Collect attributes for path into the array pointed to by
  * check_all_attr. If num is non-zero, only attributes in check[] are
  * collected. Otherwise all attributes are collected.
+ *
+ * If the values of the attributes in check[] are remembered from an
+ * earlier call, they are filled into check[] instead and 1 is returned.
  */
-static void collect_some_attrs(const char *path, int num,
-			       struct git_attr_check *check)
+static int collect_some_attrs(const char *path, int num,
+			      struct git_attr_check *check)
 
 {
 	struct attr_stack *stk;
@@ -746,6 +1055,15 @@ static void collect_some_attrs(const char *path, int num,
 	}
 
 	prepare_attr_stack(path, dirlen);
+	if (num) {
+		struct attr_memo *memo;
+
+		memo = find_attr_memo(path, pathlen, num, check);
+		if (memo) {
+			memcpy(check, memo->check, num * sizeof(*check));
+			return 1;
+		}
+	}
 	for (i = 0; i < attr_nr; i++)
 		check_all_attr[i].value = ATTR__UNKNOWN;
 	if (num && !cannot_trust_maybe_real) {
@@ -759,26 +1077,30 @@ static void collect_some_attrs(const char *path, int num,
 			}
 		}
 		if (rem == num)
-			return;
+			return 0;
 	}
 
 	rem = attr_nr;
 	for (stk = attr_stack; 0 < rem && stk; stk = stk->prev)
 		rem = fill(path, pathlen, basename_offset, stk, rem);
+	return 0;
 }
 
 int git_check_attr(const char *path, int num, struct git_attr_check *check)
 {
 	int i;
 
-	collect_some_attrs(path, num, check);
-
-	for (i = 0; i < num; i++) {
-		const char *value = check_all_attr[check[i].attr->attr_nr].value;
-		if (value == ATTR__UNKNOWN)
-			value = ATTR__UNSET;
-		check[i].value = value;
+	attr_lock();
+	if (!collect_some_attrs(path, num, check)) {
+		for (i = 0; i < num; i++) {
+			const char *value = check_all_attr[check[i].attr->attr_nr].value;
+			if (value == ATTR__UNKNOWN)
+				value = ATTR__UNSET;
+			check[i].value = value;
+		}
+		remember_attrs(path, num, check);
 	}
+	attr_unlock();
 
 	return 0;
 }
@@ -787,6 +1109,7 @@ int git_all_attrs(const char *path, int *num, struct git_attr_check **check)
 {
 	int i, count, j;
 
+	attr_lock();
 	collect_some_attrs(path, 0, NULL);
 
 	/* Count the number of attributes that are set. */
@@ -807,6 +1130,7 @@ int git_all_attrs(const char *path, int *num, struct git_attr_check **check)
 			++j;
 		}
 	}
+	attr_unlock();
 
 	return 0;
 }
@@ -818,8 +1142,10 @@ void git_attr_set_direction(enum git_attr_direction new, struct index_state *ist
 	if (is_bare_repository() && new != GIT_ATTR_INDEX)
 		die("BUG: non-INDEX attr direction in a bare repo");
 
+	attr_lock();
 	direction = new;
 	if (new != old)
 		drop_attr_stack();
 	use_index = istate;
+	attr_unlock();
 }
@@ -54,4 +54,16 @@ enum git_attr_direction {
 };
 void git_attr_set_direction(enum git_attr_direction, struct index_state *);
 
+/*
+ * After enable_attr_lock(), the functions above can be called from
+ * several threads at once.  Calls nest.
+ */
+#ifndef NO_PTHREADS
+extern void enable_attr_lock(void);
+extern void disable_attr_lock(void);
+#else
+#define enable_attr_lock()
+#define disable_attr_lock()
+#endif
+
 #endif /* ATTR_H */
@@ -0,0 +1,132 @@
+/*
+ * Per-request audit log of the transfer services.  The line is
+ *
+ *   audit service=<name> time=<epoch> pid=<pid> repo=<dir>
+ *     [remote=<addr>] status=<status> <key>=<value>... ms_<phase>=<n>...
+ *     ms_total=<n>
+ *
+ * and values that contain spaces or quotes are C-quoted.
+ */
+#include "cache.h"
+#include "audit-log.h"
+#include "quote.h"
+
+static int enabled;
+static const char *destination;
+static const char *service_name;
+static const char *status = "error";
+static const char *current_phase;
+static audit_log_report_fn report_fn;
+static uint64_t start_time, phase_start;
+static struct strbuf fields = STRBUF_INIT;
+static struct strbuf phases = STRBUF_INIT;
+
+static void add_field(struct strbuf *sb, const char *key, const char *value)
+{
+	const char *p;
+
+	strbuf_addf(sb, " %s=", key);
+	for (p = value; *p; p++)
+		if (*p == ' ' || *p == '"' || *p == '\\' || iscntrl(*p))
+			break;
+	if (!*p && *value) {
+		strbuf_addstr(sb, value);
+		return;
+	}
+	strbuf_addch(sb, '"');
+	quote_c_style(value, sb, NULL, 1);
+	strbuf_addch(sb, '"');
+}
+
+static void end_phase(uint64_t now)
+{
+	if (current_phase)
+		strbuf_addf(&phases, " ms_%s=%"PRIuMAX, current_phase,
+			    (uintmax_t)((now - phase_start) / 1000000));
+	phase_start = now;
+}
+
+static void write_audit_log(void)
+{
+	struct strbuf line = STRBUF_INIT;
+	uint64_t now = getnanotime();
+	const char *remote = getenv("REMOTE_ADDR");
+	const char *repo = real_path_if_valid(get_git_dir());
+	int fd;
+
+	end_phase(now);
+	current_phase = NULL;
+	if (report_fn)
+		report_fn();
+
+	strbuf_addstr(&line, "audit");
+	add_field(&line, "service", service_name);
+	strbuf_addf(&line, " time=%lu pid=%"PRIuMAX,
+		    (unsigned long)time(NULL), (uintmax_t)getpid());
+	add_field(&line, "repo", repo ? repo : get_git_dir());
+	if (remote && *remote)
+		add_field(&line, "remote", remote);
+	strbuf_addf(&line, " status=%s", status);
+	strbuf_addbuf(&line, &fields);
+	strbuf_addbuf(&line, &phases);
+	strbuf_addf(&line, " ms_total=%"PRIuMAX"\n",
+		    (uintmax_t)((now - start_time) / 1000000));
+
+	if (!strcmp(destination, "stderr"))
+		fd = 2;
+	else
+		fd = open(destination, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd >= 0) {
+		/* a single write, so that concurrent requests do not mix */
+		write_in_full(fd, line.buf, line.len);
+		if (fd != 2)
+			close(fd);
+	}
+	strbuf_release(&line);
+}
+
+void audit_log_start(const char *service, const char *phase,
+		     audit_log_report_fn report)
+{
+	if (git_config_get_string_const("transfer.auditlog", &destination) ||
+	    !*destination)
+		return;
+	enabled = 1;
+	service_name = service;
+	report_fn = report;
+	start_time = phase_start = getnanotime();
+	current_phase = phase;
+	atexit(write_audit_log);
+}
+
+int audit_log_enabled(void)
+{
+	return enabled;
+}
+
+void audit_log_phase(const char *phase)
+{
+	if (!enabled)
+		return;
+	end_phase(getnanotime());
+	current_phase = phase;
+}
+
+void audit_log_addf(const char *key, const char *fmt, ...)
+{
+	struct strbuf value = STRBUF_INIT;
+	va_list ap;
+
+	if (!enabled)
+		return;
+	va_start(ap, fmt);
+	strbuf_vaddf(&value, fmt, ap);
+	va_end(ap);
+	add_field(&fields, key, value.buf);
+	strbuf_release(&value);
+}
+
+void audit_log_status(const char *s)
+{
+	status = s;
+}
@@ -0,0 +1,29 @@
+#ifndef AUDIT_LOG_H
+#define AUDIT_LOG_H
+
+/*
+ * One summary line per upload-pack or receive-pack request, written
+ * when the process exits, if transfer.auditLog is set.  Everything
+ * here is a no-op otherwise.
+ */
+
+/*
+ * Read transfer.auditLog and, if set, start timing the first phase.
+ * "report" is called just before the line is written, also when dying,
+ * to add the counters of the service with audit_log_addf().
+ */
+typedef void (*audit_log_report_fn)(void);
+extern void audit_log_start(const char *service, const char *phase,
+			    audit_log_report_fn report);
+extern int audit_log_enabled(void);
+
+/* End the current phase, recording its duration, and begin the next. */
+extern void audit_log_phase(const char *phase);
+
+__attribute__((format (printf, 2, 3)))
+extern void audit_log_addf(const char *key, const char *fmt, ...);
+
+/* The status logged is "error" unless this is called first. */
+extern void audit_log_status(const char *status);
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * SHA1 block functions using the SHA instructions of the CPU: the SHA
+ * extensions on x86-64 and the cryptography extension on ARMv8.  They
+ * are only used when the CPU we are running on has them, so that one
+ * binary runs everywhere.
+ *
+ * On x86-64 there also is a function hashing one block of each of
+ * eight independent messages at once in the lanes of the AVX2
+ * registers, for blk_SHA1_Multi().
+ */
+
+#include "../git-compat-util.h"
+
+#include "sha1.h"
+
+#ifndef NO_HW_SHA1
+
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define HAVE_HW_SHA1
+
+/*
+ * Four rounds of group k (of 20), with the message words of the group
+ * computed from those of the four groups before it once the first 16
+ * words, read from the block, are used up.
+ */
+#define SHANI_GROUP(k, f) do { \
+	if (k >= 4) \
+		M[(k) & 3] = _mm_sha1msg2_epu32( \
+			_mm_xor_si128(_mm_sha1msg1_epu32(M[(k) & 3], M[((k) + 1) & 3]), \
+				      M[((k) + 2) & 3]), \
+			M[((k) + 3) & 3]); \
+	E1 = (k) ? _mm_sha1nexte_epu32(PREV, M[(k) & 3]) \
+		 : _mm_add_epi32(E0, M[(k) & 3]); \
+	PREV = ABCD; \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E1, f); \
+} while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_blocks_shani(unsigned int *H, const unsigned char *data,
+			      unsigned long blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1, PREV, M[4];
+	int i;
+
+	/* A in the highest lane, E in the highest lane of its own */
+	ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1b);
+	E0 = _mm_set_epi32(H[4], 0, 0, 0);
+
+	while (blocks--) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		for (i = 0; i < 4; i++)
+			M[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(data + 16 * i)),
+				bswap);
+
+		SHANI_GROUP(0, 0);
+		SHANI_GROUP(1, 0);
+		SHANI_GROUP(2, 0);
+		SHANI_GROUP(3, 0);
+		SHANI_GROUP(4, 0);
+		SHANI_GROUP(5, 1);
+		SHANI_GROUP(6, 1);
+		SHANI_GROUP(7, 1);
+		SHANI_GROUP(8, 1);
+		SHANI_GROUP(9, 1);
+		SHANI_GROUP(10, 2);
+		SHANI_GROUP(11, 2);
+		SHANI_GROUP(12, 2);
+		SHANI_GROUP(13, 2);
+		SHANI_GROUP(14, 2);
+		SHANI_GROUP(15, 3);
+		SHANI_GROUP(16, 3);
+		SHANI_GROUP(17, 3);
+		SHANI_GROUP(18, 3);
+		SHANI_GROUP(19, 3);
+
+		E0 = _mm_sha1nexte_epu32(PREV, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+		data += 64;
+	}
+
+	_mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(ABCD, 0x1b));
+	H[4] = _mm_extract_epi32(E0, 3);
+}
+
+#define LANE_ROL(x, n) \
+	_mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+#define LANE_XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256((x), (y)), (z))
+
+/* As SHA_SRC() and SHA_MIX() in sha1.c, for eight messages at once */
+#define LANE_SRC(t) (W[t])
+#define LANE_MIX(t) (W[(t) & 15] = LANE_ROL(_mm256_xor_si256( \
+	LANE_XOR3(W[((t) + 13) & 15], W[((t) + 8) & 15], W[((t) + 2) & 15]), \
+	W[(t) & 15]), 1))
+
+#define LANE_ROUND(t, input, fn, constant, A, B, C, D, E) do { \
+	E = _mm256_add_epi32(_mm256_add_epi32(E, input(t)), \
+		_mm256_add_epi32(_mm256_add_epi32(LANE_ROL(A, 5), (fn)), \
+				 _mm256_set1_epi32(constant))); \
+	B = LANE_ROL(B, 30); } while (0)
+
+#define LANE_F1(B, C, D) _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(C, D), B), D)
+#define LANE_F2(B, C, D) LANE_XOR3(B, C, D)
+#define LANE_F3(B, C, D) _mm256_or_si256(_mm256_and_si256(B, C), \
+					 _mm256_and_si256(D, _mm256_xor_si256(B, C)))
+
+#define L_0_15(t, A, B, C, D, E)  LANE_ROUND(t, LANE_SRC, LANE_F1(B, C, D), 0x5a827999, A, B, C, D, E)
+#define L_16_19(t, A, B, C, D, E) LANE_ROUND(t, LANE_MIX, LANE_F1(B, C, D), 0x5a827999, A, B, C, D, E)
+#define L_20_39(t, A, B, C, D, E) LANE_ROUND(t, LANE_MIX, LANE_F2(B, C, D), 0x6ed9eba1, A, B, C, D, E)
+#define L_40_59(t, A, B, C, D, E) LANE_ROUND(t, LANE_MIX, LANE_F3(B, C, D), 0x8f1bbcdc, A, B, C, D, E)
+#define L_60_79(t, A, B, C, D, E) LANE_ROUND(t, LANE_MIX, LANE_F2(B, C, D), 0xca62c1d6, A, B, C, D, E)
+
+/* Five rounds, after which the variables are back in their places */
+#define LANE_ROUNDS5(t, R) do { \
+	R((t), A, B, C, D, E); \
+	R((t) + 1, E, A, B, C, D); \
+	R((t) + 2, D, E, A, B, C); \
+	R((t) + 3, C, D, E, A, B); \
+	R((t) + 4, B, C, D, E, A); \
+} while (0)
+
+/*
+ * Read eight 32-byte pieces, one per message, into W[0..7] so that
+ * W[i] holds word i of every message, in the lane of its message.
+ */
+__attribute__((target("avx2")))
+static inline void load_lanes(__m256i *W, const unsigned char **blocks, int ofs)
+{
+	const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL,
+						0x0405060700010203ULL,
+						0x0c0d0e0f08090a0bULL,
+						0x0405060700010203ULL);
+	__m256i r[8], t[8], u[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = _mm256_shuffle_epi8(
+			_mm256_loadu_si256((const __m256i *)(blocks[i] + ofs)),
+			bswap);
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		W[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		W[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+__attribute__((target("avx2")))
+static void sha1_lanes_avx2(unsigned int (*H)[5], const unsigned char **blocks)
+{
+	__m256i A, B, C, D, E, W[16], state[5];
+	unsigned int out[5][8];
+	int i;
+
+#define LANE_LOAD_H(j) _mm256_set_epi32(H[7][j], H[6][j], H[5][j], H[4][j], \
+					H[3][j], H[2][j], H[1][j], H[0][j])
+	A = state[0] = LANE_LOAD_H(0);
+	B = state[1] = LANE_LOAD_H(1);
+	C = state[2] = LANE_LOAD_H(2);
+	D = state[3] = LANE_LOAD_H(3);
+	E = state[4] = LANE_LOAD_H(4);
+#undef LANE_LOAD_H
+
+	load_lanes(W, blocks, 0);
+	load_lanes(W + 8, blocks, 32);
+
+	LANE_ROUNDS5(0, L_0_15);
+	LANE_ROUNDS5(5, L_0_15);
+	LANE_ROUNDS5(10, L_0_15);
+	L_0_15(15, A, B, C, D, E);
+	L_16_19(16, E, A, B, C, D);
+	L_16_19(17, D, E, A, B, C);
+	L_16_19(18, C, D, E, A, B);
+	L_16_19(19, B, C, D, E, A);
+	LANE_ROUNDS5(20, L_20_39);
+	LANE_ROUNDS5(25, L_20_39);
+	LANE_ROUNDS5(30, L_20_39);
+	LANE_ROUNDS5(35, L_20_39);
+	LANE_ROUNDS5(40, L_40_59);
+	LANE_ROUNDS5(45, L_40_59);
+	LANE_ROUNDS5(50, L_40_59);
+	LANE_ROUNDS5(55, L_40_59);
+	LANE_ROUNDS5(60, L_60_79);
+	LANE_ROUNDS5(65, L_60_79);
+	LANE_ROUNDS5(70, L_60_79);
+	LANE_ROUNDS5(75, L_60_79);
+
+	_mm256_storeu_si256((__m256i *)out[0], _mm256_add_epi32(A, state[0]));
+	_mm256_storeu_si256((__m256i *)out[1], _mm256_add_epi32(B, state[1]));
+	_mm256_storeu_si256((__m256i *)out[2], _mm256_add_epi32(C, state[2]));
+	_mm256_storeu_si256((__m256i *)out[3], _mm256_add_epi32(D, state[3]));
+	_mm256_storeu_si256((__m256i *)out[4], _mm256_add_epi32(E, state[4]));
+	for (i = 0; i < 8; i++) {
+		H[i][0] = out[0][i];
+		H[i][1] = out[1][i];
+		H[i][2] = out[2][i];
+		H[i][3] = out[3][i];
+		H[i][4] = out[4][i];
+	}
+}
+
+static blk_SHA1_Lanes_fn find_hw_sha1_lanes(void)
+{
+	unsigned int eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return NULL;
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return NULL;
+	/* the OS must save the YMM registers for us */
+	__asm__("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	if ((xcr0_lo & 6) != 6)
+		return NULL;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (!(ebx & (1 << 5))) /* AVX2 */
+		return NULL;
+	return sha1_lanes_avx2;
+}
+
+#define HAVE_HW_SHA1_LANES
+
+static blk_SHA1_Blocks_fn find_hw_sha1_blocks(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return NULL;
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+		return NULL;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (!(ebx & (1 << 29))) /* SHA */
+		return NULL;
+	return sha1_blocks_shani;
+}
+
+#elif defined(__aarch64__) && defined(__linux__) && \
+	(defined(__ARM_FEATURE_CRYPTO) || \
+	 (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8))
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+
+#define HAVE_HW_SHA1
+
+/*
+ * Four rounds of group k (of 20); "op" is the round function of the
+ * group and K its constant.  The message words are computed as in
+ * SHANI_GROUP() above.
+ */
+#define ARMV8_GROUP(k, op, K) do { \
+	if (k >= 4) \
+		M[(k) & 3] = vsha1su1q_u32( \
+			vsha1su0q_u32(M[(k) & 3], M[((k) + 1) & 3], M[((k) + 2) & 3]), \
+			M[((k) + 3) & 3]); \
+	E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0)); \
+	ABCD = op(ABCD, E0, vaddq_u32(M[(k) & 3], vdupq_n_u32(K))); \
+	E0 = E1; \
+} while (0)
+
+#define ARMV8_K0 0x5a827999
+#define ARMV8_K1 0x6ed9eba1
+#define ARMV8_K2 0x8f1bbcdc
+#define ARMV8_K3 0xca62c1d6
+
+__attribute__((target("+crypto")))
+static void sha1_blocks_armv8(unsigned int *H, const unsigned char *data,
+			      unsigned long blocks)
+{
+	uint32x4_t ABCD, ABCD_SAVE, M[4];
+	uint32_t E0, E0_SAVE, E1;
+	int i;
+
+	ABCD = vld1q_u32(H);
+	E0 = H[4];
+
+	while (blocks--) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		for (i = 0; i < 4; i++)
+			M[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+
+		ARMV8_GROUP(0, vsha1cq_u32, ARMV8_K0);
+		ARMV8_GROUP(1, vsha1cq_u32, ARMV8_K0);
+		ARMV8_GROUP(2, vsha1cq_u32, ARMV8_K0);
+		ARMV8_GROUP(3, vsha1cq_u32, ARMV8_K0);
+		ARMV8_GROUP(4, vsha1cq_u32, ARMV8_K0);
+		ARMV8_GROUP(5, vsha1pq_u32, ARMV8_K1);
+		ARMV8_GROUP(6, vsha1pq_u32, ARMV8_K1);
+		ARMV8_GROUP(7, vsha1pq_u32, ARMV8_K1);
+		ARMV8_GROUP(8, vsha1pq_u32, ARMV8_K1);
+		ARMV8_GROUP(9, vsha1pq_u32, ARMV8_K1);
+		ARMV8_GROUP(10, vsha1mq_u32, ARMV8_K2);
+		ARMV8_GROUP(11, vsha1mq_u32, ARMV8_K2);
+		ARMV8_GROUP(12, vsha1mq_u32, ARMV8_K2);
+		ARMV8_GROUP(13, vsha1mq_u32, ARMV8_K2);
+		ARMV8_GROUP(14, vsha1mq_u32, ARMV8_K2);
+		ARMV8_GROUP(15, vsha1pq_u32, ARMV8_K3);
+		ARMV8_GROUP(16, vsha1pq_u32, ARMV8_K3);
+		ARMV8_GROUP(17, vsha1pq_u32, ARMV8_K3);
+		ARMV8_GROUP(18, vsha1pq_u32, ARMV8_K3);
+		ARMV8_GROUP(19, vsha1pq_u32, ARMV8_K3);
+
+		E0 += E0_SAVE;
+		ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+		data += 64;
+	}
+
+	vst1q_u32(H, ABCD);
+	H[4] = E0;
+}
+
+static blk_SHA1_Blocks_fn find_hw_sha1_blocks(void)
+{
+	if (!(getauxval(AT_HWCAP) & HWCAP_SHA1))
+		return NULL;
+	return sha1_blocks_armv8;
+}
+
+#endif
+#endif /* NO_HW_SHA1 */
+
+#ifdef HAVE_HW_SHA1
+/*
+ * Check the block function against the portable one, so that a
+ * miscompiled kernel (or a CPU misreporting its features) costs speed
+ * rather than correctness.
+ */
+static int hw_sha1_blocks_work(blk_SHA1_Blocks_fn fn)
+{
+	unsigned char data[128];
+	unsigned int expect[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+	};
+	unsigned int actual[5];
+	int i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7 + 3;
+	memcpy(actual, expect, sizeof(expect));
+	blk_SHA1_Blocks_portable(expect, data, 2);
+	fn(actual, data, 2);
+	return !memcmp(expect, actual, sizeof(expect));
+}
+
+blk_SHA1_Blocks_fn blk_SHA1_hw_blocks(void)
+{
+	blk_SHA1_Blocks_fn fn = find_hw_sha1_blocks();
+
+	if (fn && !hw_sha1_blocks_work(fn))
+		return NULL;
+	return fn;
+}
+#else
+blk_SHA1_Blocks_fn blk_SHA1_hw_blocks(void)
+{
+	return NULL;
+}
+#endif
+
+#ifdef HAVE_HW_SHA1_LANES
+/* Likewise, with eight different blocks for the eight lanes */
+static int hw_sha1_lanes_work(blk_SHA1_Lanes_fn fn)
+{
+	unsigned char data[BLK_SHA1_LANES][64];
+	const unsigned char *blocks[BLK_SHA1_LANES];
+	unsigned int expect[BLK_SHA1_LANES][5], actual[BLK_SHA1_LANES][5];
+	int i, j;
+
+	for (i = 0; i < BLK_SHA1_LANES; i++) {
+		for (j = 0; j < 64; j++)
+			data[i][j] = i * 31 + j * 7 + 3;
+		for (j = 0; j < 5; j++)
+			expect[i][j] = 0x01020304 * (i + 1) + j;
+		blocks[i] = data[i];
+	}
+	memcpy(actual, expect, sizeof(expect));
+	for (i = 0; i < BLK_SHA1_LANES; i++)
+		blk_SHA1_Blocks_portable(expect[i], data[i], 1);
+	fn(actual, blocks);
+	return !memcmp(expect, actual, sizeof(expect));
+}
+
+blk_SHA1_Lanes_fn blk_SHA1_hw_lanes(void)
+{
+	blk_SHA1_Lanes_fn fn = find_hw_sha1_lanes();
+
+	if (fn && !hw_sha1_lanes_work(fn))
+		return NULL;
+	return fn;
+}
+#else
+blk_SHA1_Lanes_fn blk_SHA1_hw_lanes(void)
+{
+	return NULL;
+}
+#endif
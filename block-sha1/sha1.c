@@ -83,16 +83,16 @@
 #define T_40_59(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, ((B&C)+(D&(B^C))) , 0x8f1bbcdc, A, B, C, D, E )
 #define T_60_79(t, A, B, C, D, E) SHA_ROUND(t, SHA_MIX, (B^C^D) ,  0xca62c1d6, A, B, C, D, E )
 
-static void blk_SHA1_Block(blk_SHA_CTX *ctx, const void *block)
+static void blk_SHA1_Block(unsigned int *H, const void *block)
 {
 	unsigned int A,B,C,D,E;
 	unsigned int array[16];
 
-	A = ctx->H[0];
-	B = ctx->H[1];
-	C = ctx->H[2];
-	D = ctx->H[3];
-	E = ctx->H[4];
+	A = H[0];
+	B = H[1];
+	C = H[2];
+	D = H[3];
+	E = H[4];
 
 	/* Round 1 - iterations 0-16 take their input from 'block' */
 	T_0_15( 0, A, B, C, D, E);
@@ -184,11 +184,36 @@ static void blk_SHA1_Block(blk_SHA_CTX *ctx, const void *block)
 	T_60_79(78, C, D, E, A, B);
 	T_60_79(79, B, C, D, E, A);
 
-	ctx->H[0] += A;
-	ctx->H[1] += B;
-	ctx->H[2] += C;
-	ctx->H[3] += D;
-	ctx->H[4] += E;
+	H[0] += A;
+	H[1] += B;
+	H[2] += C;
+	H[3] += D;
+	H[4] += E;
+}
+
+void blk_SHA1_Blocks_portable(unsigned int *H, const unsigned char *data,
+			      unsigned long blocks)
+{
+	while (blocks--) {
+		blk_SHA1_Block(H, data);
+		data += 64;
+	}
+}
+
+/*
+ * Hash whole blocks with the SHA instructions of the CPU if it has
+ * them (see sha1-hw.c), and with the portable code above otherwise.
+ */
+static void blk_SHA1_Blocks(unsigned int *H, const void *data,
+			    unsigned long blocks)
+{
+	static blk_SHA1_Blocks_fn blocks_fn;
+
+	if (!blocks_fn) {
+		blk_SHA1_Blocks_fn fn = blk_SHA1_hw_blocks();
+		blocks_fn = fn ? fn : blk_SHA1_Blocks_portable;
+	}
+	blocks_fn(H, data, blocks);
 }
 
 void blk_SHA1_Init(blk_SHA_CTX *ctx)
@@ -220,12 +245,12 @@ void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *data, unsigned long len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return;
-		blk_SHA1_Block(ctx, ctx->W);
+		blk_SHA1_Blocks(ctx->H, ctx->W, 1);
 	}
-	while (len >= 64) {
-		blk_SHA1_Block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		blk_SHA1_Blocks(ctx->H, data, len / 64);
+		data = ((const char *)data + (len & ~63UL));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -249,3 +274,146 @@ void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx)
 	for (i = 0; i < 5; i++)
 		put_be32(hashout + i * 4, ctx->H[i]);
 }
+
+/*
+ * One of the messages hashed side by side by blk_SHA1_Multi(): the
+ * block left over in the context completed with the start of the data,
+ * then the whole blocks of the data itself, then the end of the data
+ * with the padding.
+ */
+struct sha1_lane {
+	blk_SHA1_Job *job;
+	int head;
+	const unsigned char *data;
+	unsigned long blocks;
+	int tail_pos, tail_blocks;
+	unsigned char head_block[64];
+	unsigned char tail[128];
+};
+
+static void start_lane(struct sha1_lane *lane, unsigned int *H,
+		       blk_SHA1_Job *job)
+{
+	const unsigned char *data = job->data;
+	unsigned long len = job->len;
+	unsigned int lenW = job->ctx.size & 63;
+	unsigned long long size = job->ctx.size + len;
+	unsigned int rest;
+
+	memcpy(H, job->ctx.H, sizeof(job->ctx.H));
+	lane->job = job;
+	lane->head = 0;
+	if (lenW && lenW + len >= 64) {
+		memcpy(lane->head_block, job->ctx.W, lenW);
+		memcpy(lane->head_block + lenW, data, 64 - lenW);
+		lane->head = 1;
+		data += 64 - lenW;
+		len -= 64 - lenW;
+		lenW = 0;
+	}
+	lane->data = data;
+	lane->blocks = len / 64;
+	data += len & ~63UL;
+	len &= 63;
+
+	rest = lenW + len;
+	memcpy(lane->tail, job->ctx.W, lenW);
+	memcpy(lane->tail + lenW, data, len);
+	lane->tail[rest] = 0x80;
+	lane->tail_blocks = rest < 56 ? 1 : 2;
+	lane->tail_pos = 0;
+	memset(lane->tail + rest + 1, 0, lane->tail_blocks * 64 - rest - 9);
+	put_be32(lane->tail + lane->tail_blocks * 64 - 8, size >> 29);
+	put_be32(lane->tail + lane->tail_blocks * 64 - 4, size << 3);
+}
+
+static const unsigned char *next_lane_block(struct sha1_lane *lane)
+{
+	const unsigned char *block;
+
+	if (lane->head) {
+		lane->head = 0;
+		return lane->head_block;
+	}
+	if (lane->blocks) {
+		block = lane->data;
+		lane->data += 64;
+		lane->blocks--;
+		return block;
+	}
+	if (lane->tail_pos < lane->tail_blocks)
+		return lane->tail + 64 * lane->tail_pos++;
+	return NULL;
+}
+
+static void finish_lane(struct sha1_lane *lane, const unsigned int *H)
+{
+	int i;
+
+	for (i = 0; i < 5; i++)
+		put_be32(lane->job->hashout + i * 4, H[i]);
+	lane->job = NULL;
+}
+
+void blk_SHA1_Multi(blk_SHA1_Job *jobs, int nr)
+{
+	static int initialized;
+	static blk_SHA1_Lanes_fn lanes_fn;
+	static const unsigned char idle[64];
+	struct sha1_lane lane[BLK_SHA1_LANES];
+	unsigned int H[BLK_SHA1_LANES][5];
+	const unsigned char *blocks[BLK_SHA1_LANES];
+	int i, next = 0, active;
+
+	/*
+	 * The SHA instructions hash one message faster than the vector
+	 * registers hash eight of them, so only use the lanes without.
+	 */
+	if (!initialized) {
+		if (!blk_SHA1_hw_blocks())
+			lanes_fn = blk_SHA1_hw_lanes();
+		initialized = 1;
+	}
+	if (!lanes_fn || nr < 2) {
+		for (i = 0; i < nr; i++) {
+			blk_SHA1_Update(&jobs[i].ctx, jobs[i].data, jobs[i].len);
+			blk_SHA1_Final(jobs[i].hashout, &jobs[i].ctx);
+		}
+		return;
+	}
+
+	for (i = 0; i < BLK_SHA1_LANES; i++)
+		lane[i].job = NULL;
+	for (;;) {
+		active = 0;
+		for (i = 0; i < BLK_SHA1_LANES; i++) {
+			blocks[i] = NULL;
+			if (lane[i].job) {
+				blocks[i] = next_lane_block(&lane[i]);
+				if (!blocks[i])
+					finish_lane(&lane[i], H[i]);
+			}
+			if (!lane[i].job && next < nr) {
+				start_lane(&lane[i], H[i], &jobs[next++]);
+				blocks[i] = next_lane_block(&lane[i]);
+			}
+			if (blocks[i])
+				active++;
+			else
+				blocks[i] = idle;
+		}
+		if (active <= 1 && next == nr)
+			break;
+		lanes_fn(H, blocks);
+	}
+
+	/* The last message is not worth the other lanes idling */
+	for (i = 0; i < BLK_SHA1_LANES; i++) {
+		if (!lane[i].job)
+			continue;
+		do {
+			blk_SHA1_Blocks(H[i], blocks[i], 1);
+		} while ((blocks[i] = next_lane_block(&lane[i])));
+		finish_lane(&lane[i], H[i]);
+	}
+}
@@ -16,7 +16,46 @@ void blk_SHA1_Init(blk_SHA_CTX *ctx);
 void blk_SHA1_Update(blk_SHA_CTX *ctx, const void *dataIn, unsigned long len);
 void blk_SHA1_Final(unsigned char hashout[20], blk_SHA_CTX *ctx);
 
+/*
+ * Functions hashing a number of whole 64-byte blocks into H.  The
+ * portable one always works; blk_SHA1_hw_blocks() returns one using
+ * the SHA instructions of the CPU, or NULL if there are none we can use.
+ */
+typedef void (*blk_SHA1_Blocks_fn)(unsigned int *H, const unsigned char *data,
+				   unsigned long blocks);
+void blk_SHA1_Blocks_portable(unsigned int *H, const unsigned char *data,
+			      unsigned long blocks);
+blk_SHA1_Blocks_fn blk_SHA1_hw_blocks(void);
+
+/*
+ * A function hashing one 64-byte block of each of BLK_SHA1_LANES
+ * independent messages at once, into H[0] to H[BLK_SHA1_LANES - 1].
+ * blk_SHA1_hw_lanes() returns one using the vector instructions of the
+ * CPU, or NULL if there are none we can use.
+ */
+#define BLK_SHA1_LANES 8
+typedef void (*blk_SHA1_Lanes_fn)(unsigned int (*H)[5],
+				  const unsigned char **blocks);
+blk_SHA1_Lanes_fn blk_SHA1_hw_lanes(void);
+
+/*
+ * Hash "len" bytes at "data" on top of what was fed to "ctx" already,
+ * and store the result in "hashout", for each of "nr" jobs.  Short
+ * messages hash faster this way than one after another, as several of
+ * them share the vector registers when the CPU allows.
+ */
+typedef struct {
+	blk_SHA_CTX ctx;
+	const void *data;
+	unsigned long len;
+	unsigned char *hashout;
+} blk_SHA1_Job;
+
+void blk_SHA1_Multi(blk_SHA1_Job *jobs, int nr);
+
 #define git_SHA_CTX	blk_SHA_CTX
 #define git_SHA1_Init	blk_SHA1_Init
 #define git_SHA1_Update	blk_SHA1_Update
 #define git_SHA1_Final	blk_SHA1_Final
+#define git_SHA1_Job	blk_SHA1_Job
+#define git_SHA1_Multi	blk_SHA1_Multi
@@ -0,0 +1,176 @@
+#include "cache.h"
+#include "bloom.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "string-list.h"
+
+static uint32_t rotate_left(uint32_t value, int count)
+{
+	return (value << count) | (value >> ((sizeof(value) * 8) - count));
+}
+
+/* The 32-bit x86 flavour of MurmurHash3 */
+uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	const unsigned char *tail;
+	uint32_t seed_copy = seed, k1 = 0;
+	size_t i, len4 = len / sizeof(uint32_t);
+
+	for (i = 0; i < len4; i++) {
+		const unsigned char *p = (const unsigned char *)data + i * 4;
+		uint32_t k = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+			     ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		seed_copy ^= k;
+		seed_copy = rotate_left(seed_copy, r2) * m + n;
+	}
+
+	tail = (const unsigned char *)data + len4 * sizeof(uint32_t);
+	switch (len & (sizeof(uint32_t) - 1)) {
+	case 3:
+		k1 ^= (uint32_t)tail[2] << 16;
+		/* fallthrough */
+	case 2:
+		k1 ^= (uint32_t)tail[1] << 8;
+		/* fallthrough */
+	case 1:
+		k1 ^= tail[0];
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		seed_copy ^= k1;
+		break;
+	}
+
+	seed_copy ^= (uint32_t)len;
+	seed_copy ^= (seed_copy >> 16);
+	seed_copy *= 0x85ebca6b;
+	seed_copy ^= (seed_copy >> 13);
+	seed_copy *= 0xc2b2ae35;
+	seed_copy ^= (seed_copy >> 16);
+
+	return seed_copy;
+}
+
+/*
+ * Use double hashing: the i-th bit position of a path is h0 + i * h1,
+ * with two differently seeded hashes of it.
+ */
+void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+	uint32_t i;
+
+	key->hashes = xcalloc(settings->num_hashes, sizeof(*key->hashes));
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	free(key->hashes);
+	key->hashes = NULL;
+}
+
+void add_key_to_filter(const struct bloom_key *key, struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	uint64_t nbits = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t bit = key->hashes[i] % nbits;
+		filter->data[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	uint64_t nbits = (uint64_t)filter->len * 8;
+	uint32_t i;
+
+	/* a commit that changed nothing has an empty filter */
+	if (!nbits)
+		return 0;
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t bit = key->hashes[i] % nbits;
+		if (!(filter->data[bit / 8] & (1 << (bit % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+void compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+			  const struct bloom_filter_settings *settings)
+{
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	struct diff_options opt;
+	int i;
+
+	diff_setup(&opt);
+	DIFF_OPT_SET(&opt, RECURSIVE);
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opt);
+
+	if (c->parents && parse_commit(c->parents->item))
+		die("unable to parse commit %s",
+		    sha1_to_hex(c->parents->item->object.sha1));
+	if (c->parents)
+		diff_tree_sha1(get_commit_tree_sha1(c->parents->item),
+			       get_commit_tree_sha1(c), "", &opt);
+	else
+		diff_tree_sha1(NULL, get_commit_tree_sha1(c), "", &opt);
+
+	if (diff_queued_diff.nr > BLOOM_MAX_CHANGED_PATHS) {
+		diff_flush(&opt);
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xff;
+		return;
+	}
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		const char *path = diff_queued_diff.queue[i]->two->path;
+		const char *slash = path + strlen(path);
+
+		/* a change to "a/b/c" is a change to "a/b" and "a", too */
+		for (;;) {
+			string_list_append_nodup(&paths,
+						 xmemdupz(path, slash - path));
+			while (slash > path && *--slash != '/')
+				;
+			if (slash == path)
+				break;
+		}
+	}
+	diff_flush(&opt);
+	string_list_sort(&paths);
+	string_list_remove_duplicates(&paths, 0);
+
+	filter->len = DIV_ROUND_UP(paths.nr * settings->bits_per_entry, 8);
+	filter->data = xcalloc(filter->len ? filter->len : 1, 1);
+	for (i = 0; i < paths.nr; i++) {
+		struct bloom_key key;
+		fill_bloom_key(paths.items[i].string,
+			       strlen(paths.items[i].string), &key, settings);
+		add_key_to_filter(&key, filter, settings);
+		clear_bloom_key(&key);
+	}
+	string_list_clear(&paths, 0);
+}
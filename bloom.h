@@ -0,0 +1,63 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+struct commit;
+
+/*
+ * A changed-path Bloom filter records the paths a commit changed
+ * relative to its first parent, including their leading directories,
+ * so that a path-limited history walk can tell that a commit did not
+ * touch a path without diffing any trees.  See the commit-graph format
+ * documentation for how the filters are stored.
+ */
+
+struct bloom_filter_settings {
+	uint32_t num_hashes;
+	uint32_t bits_per_entry;
+};
+
+#define DEFAULT_BLOOM_FILTER_SETTINGS { 7, 10 }
+
+/*
+ * Commits that change more paths than this get a filter with all bits
+ * set, which never rules anything out.
+ */
+#define BLOOM_MAX_CHANGED_PATHS 512
+
+struct bloom_filter {
+	unsigned char *data;
+	size_t len;
+};
+
+/* The num_hashes bit positions (before taking them modulo the size) of a path */
+struct bloom_key {
+	uint32_t *hashes;
+};
+
+extern uint32_t murmur3_seeded(uint32_t seed, const char *data, size_t len);
+
+extern void fill_bloom_key(const char *data, size_t len, struct bloom_key *key,
+			   const struct bloom_filter_settings *settings);
+extern void clear_bloom_key(struct bloom_key *key);
+
+extern void add_key_to_filter(const struct bloom_key *key,
+			      struct bloom_filter *filter,
+			      const struct bloom_filter_settings *settings);
+
+/*
+ * Returns 0 if the path of "key" is definitely not in "filter", and 1
+ * if it may be.
+ */
+extern int bloom_filter_contains(const struct bloom_filter *filter,
+				 const struct bloom_key *key,
+				 const struct bloom_filter_settings *settings);
+
+/*
+ * Compute the filter of the paths "c" changed relative to its first
+ * parent (or the empty tree for a root commit) into a freshly
+ * allocated filter->data.
+ */
+extern void compute_bloom_filter(struct commit *c, struct bloom_filter *filter,
+				 const struct bloom_filter_settings *settings);
+
+#endif
@@ -2595,80 +2595,238 @@ static void remove_last_line(struct image *img)
 	img->len -= img->line[--img->nr].len;
 }
 
+/*
+ * The image the hunks of a patch are being applied to.  Hunks almost
+ * always land in order, so instead of rebuilding the whole image for
+ * each of them, everything up to the end of the last hunk applied is
+ * collected in "done", and "rest" is what follows it, still in the
+ * original buffer.  Applying a hunk then only costs the lines between
+ * the previous hunk and itself.  The odd hunk that wants to match
+ * inside "done" makes us put the two halves back together first.
+ */
+struct split_image {
+	struct image *rest;	/* buf and line advance into the original */
+	char *rest_buf;		/* ... which is this */
+	struct strbuf done;
+	struct line *done_line;
+	size_t done_nr, done_alloc;
+};
+
+static void init_split_image(struct split_image *si, struct image *img)
+{
+	memset(si, 0, sizeof(*si));
+	si->rest = img;
+	si->rest_buf = img->buf;
+	strbuf_init(&si->done, 0);
+}
+
+static size_t split_image_nr(struct split_image *si)
+{
+	return si->done_nr + si->rest->nr;
+}
+
+/* Put "done" and "rest" back together into si->rest. */
+static void flatten_split_image(struct split_image *si)
+{
+	struct image *img = si->rest;
+
+	if (!si->done_nr && img->buf == si->rest_buf)
+		return;
+	strbuf_add(&si->done, img->buf, img->len);
+	ALLOC_GROW(si->done_line, si->done_nr + img->nr, si->done_alloc);
+	memcpy(si->done_line + si->done_nr, img->line,
+	       img->nr * sizeof(*img->line));
+	free(si->rest_buf);
+	free(img->line_allocated);
+
+	img->nr += si->done_nr;
+	img->buf = si->rest_buf = strbuf_detach(&si->done, &img->len);
+	img->line = img->line_allocated = si->done_line;
+	img->alloc = si->done_alloc;
+	si->done_line = NULL;
+	si->done_nr = si->done_alloc = 0;
+}
+
+/* Move the first "nr" lines of "rest" to "done", or drop them. */
+static void take_rest_lines(struct split_image *si, size_t nr, int keep)
+{
+	struct image *img = si->rest;
+	size_t i, len = 0;
+
+	for (i = 0; i < nr; i++)
+		len += img->line[i].len;
+	if (keep) {
+		strbuf_add(&si->done, img->buf, len);
+		ALLOC_GROW(si->done_line, si->done_nr + nr, si->done_alloc);
+		memcpy(si->done_line + si->done_nr, img->line,
+		       nr * sizeof(*img->line));
+		si->done_nr += nr;
+	}
+	img->buf += len;
+	img->len -= len;
+	img->line += nr;
+	img->nr -= nr;
+}
+
+/*
+ * Could "preimage" match at "try_lno", which is inside "done"?  These
+ * are the checks match_fragment() makes before it looks at the text.
+ */
+static int may_match_in_done(struct split_image *si, struct image *preimage,
+			     int try_lno, unsigned ws_rule,
+			     int match_beginning, int match_end)
+{
+	size_t nr = split_image_nr(si);
+	int i, preimage_limit;
+
+	if (preimage->nr + try_lno <= nr) {
+		preimage_limit = preimage->nr;
+		if (match_end && (preimage->nr + try_lno != nr))
+			return 0;
+	} else if (ws_error_action == correct_ws_error &&
+		   (ws_rule & WS_BLANK_AT_EOF))
+		preimage_limit = nr - try_lno;
+	else
+		return 0;
+
+	if (match_beginning && try_lno)
+		return 0;
+
+	for (i = 0; i < preimage_limit; i++) {
+		size_t lno = try_lno + i;
+		struct line *line = lno < si->done_nr ?
+			&si->done_line[lno] : &si->rest->line[lno - si->done_nr];
+
+		if ((line->flag & LINE_PATCHED) ||
+		    preimage->line[i].hash != line->hash)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * find_pos() for a split image: the same positions are tried in the
+ * same order, but the text is only looked at in "rest".
+ */
+static int find_split_pos(struct split_image *si,
+			  struct image *preimage,
+			  struct image *postimage,
+			  int line,
+			  unsigned ws_rule,
+			  int match_beginning, int match_end)
+{
+	struct image *img = si->rest;
+	size_t nr = split_image_nr(si);
+	int i, orig_line = line;
+	unsigned long backwards, forwards, try;
+	int backwards_lno, forwards_lno, try_lno;
+
+	if (!si->done_nr)
+		return find_pos(img, preimage, postimage, line, ws_rule,
+				match_beginning, match_end);
+
+	if (match_beginning)
+		line = 0;
+	else if (match_end)
+		line = nr - preimage->nr;
+	if ((size_t) line > nr)
+		line = nr;
+
+	/* offsets are into "rest", and only mean something there */
+	try = 0;
+	for (i = si->done_nr; i < line; i++)
+		try += img->line[i - si->done_nr].len;
+
+	backwards = try;
+	backwards_lno = line;
+	forwards = try;
+	forwards_lno = line;
+	try_lno = line;
+
+	for (i = 0; ; i++) {
+		if (try_lno < si->done_nr) {
+			if (may_match_in_done(si, preimage, try_lno, ws_rule,
+					      match_beginning, match_end)) {
+				flatten_split_image(si);
+				return find_pos(img, preimage, postimage,
+						orig_line, ws_rule,
+						match_beginning, match_end);
+			}
+		} else if (!match_beginning &&
+			   match_fragment(img, preimage, postimage,
+					  try, try_lno - si->done_nr, ws_rule,
+					  0, match_end))
+			return try_lno;
+
+	again:
+		if (backwards_lno == 0 && forwards_lno == nr)
+			break;
+
+		if (i & 1) {
+			if (backwards_lno == 0) {
+				i++;
+				goto again;
+			}
+			backwards_lno--;
+			if (backwards_lno >= si->done_nr)
+				backwards -= img->line[backwards_lno - si->done_nr].len;
+			try = backwards;
+			try_lno = backwards_lno;
+		} else {
+			if (forwards_lno == nr) {
+				i++;
+				goto again;
+			}
+			if (forwards_lno >= si->done_nr)
+				forwards += img->line[forwards_lno - si->done_nr].len;
+			forwards_lno++;
+			try = forwards;
+			try_lno = forwards_lno;
+		}
+	}
+	return -1;
+}
+
 /*
  * The change from "preimage" and "postimage" has been found to
- * apply at applied_pos (counts in line numbers) in "img".
- * Update "img" to remove "preimage" and replace it with "postimage".
+ * apply at applied_pos (counts in line numbers) in "si".
+ * Update "si" to remove "preimage" and replace it with "postimage".
  */
-static void update_image(struct image *img,
-			 int applied_pos,
-			 struct image *preimage,
-			 struct image *postimage)
+static void update_split_image(struct split_image *si,
+			       int applied_pos,
+			       struct image *preimage,
+			       struct image *postimage)
 {
-	/*
-	 * remove the copy of preimage at offset in img
-	 * and replace it with postimage
-	 */
-	int i, nr;
-	size_t remove_count, insert_count, applied_at = 0;
-	char *result;
-	int preimage_limit;
+	struct image *img = si->rest;
+	size_t preimage_limit;
+	int i;
+
+	if (applied_pos < si->done_nr)
+		flatten_split_image(si);
+	applied_pos -= si->done_nr;
 
 	/*
 	 * If we are removing blank lines at the end of img,
 	 * the preimage may extend beyond the end.
 	 * If that is the case, we must be careful only to
 	 * remove the part of the preimage that falls within
-	 * the boundaries of img. Initialize preimage_limit
-	 * to the number of lines in the preimage that falls
-	 * within the boundaries.
+	 * the boundaries.
 	 */
 	preimage_limit = preimage->nr;
 	if (preimage_limit > img->nr - applied_pos)
 		preimage_limit = img->nr - applied_pos;
 
-	for (i = 0; i < applied_pos; i++)
-		applied_at += img->line[i].len;
+	take_rest_lines(si, applied_pos, 1);
+	take_rest_lines(si, preimage_limit, 0);
 
-	remove_count = 0;
-	for (i = 0; i < preimage_limit; i++)
-		remove_count += img->line[applied_pos + i].len;
-	insert_count = postimage->len;
-
-	/* Adjust the contents */
-	result = xmalloc(img->len + insert_count - remove_count + 1);
-	memcpy(result, img->buf, applied_at);
-	memcpy(result + applied_at, postimage->buf, postimage->len);
-	memcpy(result + applied_at + postimage->len,
-	       img->buf + (applied_at + remove_count),
-	       img->len - (applied_at + remove_count));
-	free(img->buf);
-	img->buf = result;
-	img->len += insert_count - remove_count;
-	result[img->len] = '\0';
-
-	/* Adjust the line table */
-	nr = img->nr + postimage->nr - preimage_limit;
-	if (preimage_limit < postimage->nr) {
-		/*
-		 * NOTE: this knows that we never call remove_first_line()
-		 * on anything other than pre/post image.
-		 */
-		REALLOC_ARRAY(img->line, nr);
-		img->line_allocated = img->line;
-	}
-	if (preimage_limit != postimage->nr)
-		memmove(img->line + applied_pos + postimage->nr,
-			img->line + applied_pos + preimage_limit,
-			(img->nr - (applied_pos + preimage_limit)) *
-			sizeof(*img->line));
-	memcpy(img->line + applied_pos,
-	       postimage->line,
-	       postimage->nr * sizeof(*img->line));
+	strbuf_add(&si->done, postimage->buf, postimage->len);
+	ALLOC_GROW(si->done_line, si->done_nr + postimage->nr, si->done_alloc);
+	memcpy(si->done_line + si->done_nr, postimage->line,
+	       postimage->nr * sizeof(*postimage->line));
 	if (!allow_overlap)
 		for (i = 0; i < postimage->nr; i++)
-			img->line[applied_pos + i].flag |= LINE_PATCHED;
-	img->nr = nr;
+			si->done_line[si->done_nr + i].flag |= LINE_PATCHED;
+	si->done_nr += postimage->nr;
 }
 
 /*
@@ -2676,7 +2834,7 @@ static void update_image(struct image *img,
  * postimage) for the hunk.  Find lines that match "preimage" in "img" and
  * replace the part of "img" with "postimage" text.
  */
-static int apply_one_fragment(struct image *img, struct fragment *frag,
+static int apply_one_fragment(struct split_image *img, struct fragment *frag,
 			      int inaccurate_eof, unsigned ws_rule,
 			      int nth_fragment)
 {
@@ -2838,8 +2996,8 @@ static int apply_one_fragment(struct image *img, struct fragment *frag,
 
 	for (;;) {
 
-		applied_pos = find_pos(img, &preimage, &postimage, pos,
-				       ws_rule, match_beginning, match_end);
+		applied_pos = find_split_pos(img, &preimage, &postimage, pos,
+					     ws_rule, match_beginning, match_end);
 
 		if (applied_pos >= 0)
 			break;
@@ -2872,7 +3030,7 @@ static int apply_one_fragment(struct image *img, struct fragment *frag,
 
 	if (applied_pos >= 0) {
 		if (new_blank_lines_at_end &&
-		    preimage.nr + applied_pos >= img->nr &&
+		    preimage.nr + applied_pos >= split_image_nr(img) &&
 		    (ws_rule & WS_BLANK_AT_EOF) &&
 		    ws_error_action != nowarn_ws_error) {
 			record_ws_error(WS_BLANK_AT_EOF, "+", 1,
@@ -2912,7 +3070,7 @@ static int apply_one_fragment(struct image *img, struct fragment *frag,
 			fprintf_ln(stderr, _("Context reduced to (%ld/%ld)"
 					     " to apply fragment at %d"),
 				   leading, trailing, applied_pos+1);
-		update_image(img, applied_pos, &preimage, &postimage);
+		update_split_image(img, applied_pos, &preimage, &postimage);
 	} else {
 		if (apply_verbosely)
 			error(_("while searching for:\n%.*s"),
@@ -3055,22 +3213,28 @@ static int apply_fragments(struct image *img, struct patch *patch)
 	const char *name = patch->old_name ? patch->old_name : patch->new_name;
 	unsigned ws_rule = patch->ws_rule;
 	unsigned inaccurate_eof = patch->inaccurate_eof;
-	int nth = 0;
+	struct split_image si;
+	int nth = 0, ret = 0;
 
 	if (patch->is_binary)
 		return apply_binary(img, patch);
 
+	init_split_image(&si, img);
 	while (frag) {
 		nth++;
-		if (apply_one_fragment(img, frag, inaccurate_eof, ws_rule, nth)) {
+		if (apply_one_fragment(&si, frag, inaccurate_eof, ws_rule, nth)) {
 			error(_("patch failed: %s:%ld"), name, frag->oldpos);
-			if (!apply_with_reject)
-				return -1;
+			if (!apply_with_reject) {
+				ret = -1;
+				break;
+			}
 			frag->rejected = 1;
 		}
 		frag = frag->next;
 	}
-	return 0;
+	flatten_split_image(&si);
+	strbuf_release(&si.done);
+	return ret;
 }
 
 static int read_blob_object(struct strbuf *buf, const unsigned char *sha1, unsigned mode)
@@ -27,6 +27,9 @@
 #include "line-range.h"
 #include "line-log.h"
 #include "dir.h"
+#include "append-cache.h"
+#include "commit-graph.h"
+#include "thread-utils.h"
 
 static char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
 
@@ -60,6 +63,25 @@ static struct string_list mailmap;
 #endif
 
 /* stats */
+/*
+ * With blame.threads, the diffs against the parents of a merge, and
+ * those of the move and copy searches, are spread over that many
+ * threads.  The threads only take the origin refcounts under
+ * blame_mutex; blobs are read, and the results applied to the
+ * scoreboard, by the main thread, in the order the serial code
+ * would use, so the answer does not depend on the thread count.
+ */
+static int blame_threads = 1;
+#ifndef NO_PTHREADS
+static pthread_mutex_t blame_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int blame_use_locks;
+#define blame_lock() do { if (blame_use_locks) pthread_mutex_lock(&blame_mutex); } while (0)
+#define blame_unlock() do { if (blame_use_locks) pthread_mutex_unlock(&blame_mutex); } while (0)
+#else
+#define blame_lock()
+#define blame_unlock()
+#endif
+
 static int num_read_blob;
 static int num_get_patch;
 static int num_commits;
@@ -140,6 +162,94 @@ static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b, long ctxlen,
 	return xdi_diff(file_a, file_b, &xpp, &xecfg, &ecb);
 }
 
+/* The hunks of a diff_hunks() run, four numbers each, to replay later. */
+struct recorded_hunks {
+	long *v;
+	int nr, alloc;
+};
+
+static int record_hunk_cb(long start_a, long count_a,
+			  long start_b, long count_b, void *data)
+{
+	struct recorded_hunks *h = data;
+
+	ALLOC_GROW(h->v, h->nr + 4, h->alloc);
+	h->v[h->nr++] = start_a;
+	h->v[h->nr++] = count_a;
+	h->v[h->nr++] = start_b;
+	h->v[h->nr++] = count_b;
+	return 0;
+}
+
+/* How many slices run_blame_slices() cuts "nr" items into. */
+static int blame_slices(int nr)
+{
+	int n = blame_threads;
+
+#ifdef NO_PTHREADS
+	n = 1;
+#endif
+	if (n > nr)
+		n = nr;
+	return n < 1 ? 1 : n;
+}
+
+struct blame_slice {
+	void (*fn)(void *data, int slice, int begin, int end);
+	void *data;
+	int slice, begin, end;
+#ifndef NO_PTHREADS
+	pthread_t thread;
+#endif
+};
+
+static void *run_blame_slice(void *arg)
+{
+	struct blame_slice *s = arg;
+
+	s->fn(s->data, s->slice, s->begin, s->end);
+	return NULL;
+}
+
+/*
+ * Call fn() on blame_slices(nr) consecutive slices of the items
+ * 0..nr-1, each on a thread of its own; the main thread takes the
+ * first slice.
+ */
+static void run_blame_slices(int nr,
+			     void (*fn)(void *data, int slice, int begin, int end),
+			     void *data)
+{
+	int n = blame_slices(nr);
+#ifndef NO_PTHREADS
+	struct blame_slice *s;
+	int i;
+#endif
+
+	if (n <= 1) {
+		fn(data, 0, 0, nr);
+		return;
+	}
+#ifndef NO_PTHREADS
+	s = xcalloc(n, sizeof(*s));
+	blame_use_locks = 1;
+	for (i = 0; i < n; i++) {
+		s[i].fn = fn;
+		s[i].data = data;
+		s[i].slice = i;
+		s[i].begin = (long long)nr * i / n;
+		s[i].end = (long long)nr * (i + 1) / n;
+		if (i && pthread_create(&s[i].thread, NULL, run_blame_slice, &s[i]))
+			die("unable to create thread: %s", strerror(errno));
+	}
+	run_blame_slice(&s[0]);
+	for (i = 1; i < n; i++)
+		pthread_join(s[i].thread, NULL);
+	blame_use_locks = 0;
+	free(s);
+#endif
+}
+
 /*
  * Prepare diff_filespec and convert it using diff textconv API
  * if the textconv driver exists.
@@ -203,14 +313,25 @@ static void fill_origin_blob(struct diff_options *opt,
  */
 static inline struct origin *origin_incref(struct origin *o)
 {
-	if (o)
+	if (o) {
+		blame_lock();
 		o->refcnt++;
+		blame_unlock();
+	}
 	return o;
 }
 
+/* Only the main thread ever drops the last reference. */
 static void origin_decref(struct origin *o)
 {
-	if (o && --o->refcnt <= 0) {
+	int refcnt;
+
+	if (!o)
+		return;
+	blame_lock();
+	refcnt = --o->refcnt;
+	blame_unlock();
+	if (refcnt <= 0) {
 		struct origin *p, *l = NULL;
 		if (o->previous)
 			origin_decref(o->previous);
@@ -556,10 +677,10 @@ static struct origin *find_origin(struct scoreboard *sb,
 	diff_setup_done(&diff_opts);
 
 	if (is_null_sha1(origin->commit->object.sha1))
-		do_diff_cache(parent->tree->object.sha1, &diff_opts);
+		do_diff_cache(get_commit_tree_sha1(parent), &diff_opts);
 	else
-		diff_tree_sha1(parent->tree->object.sha1,
-			       origin->commit->tree->object.sha1,
+		diff_tree_sha1(get_commit_tree_sha1(parent),
+			       get_commit_tree_sha1(origin->commit),
 			       "", &diff_opts);
 	diffcore_std(&diff_opts);
 
@@ -626,10 +747,10 @@ static struct origin *find_rename(struct scoreboard *sb,
 	diff_setup_done(&diff_opts);
 
 	if (is_null_sha1(origin->commit->object.sha1))
-		do_diff_cache(parent->tree->object.sha1, &diff_opts);
+		do_diff_cache(get_commit_tree_sha1(parent), &diff_opts);
 	else
-		diff_tree_sha1(parent->tree->object.sha1,
-			       origin->commit->tree->object.sha1,
+		diff_tree_sha1(get_commit_tree_sha1(parent),
+			       get_commit_tree_sha1(origin->commit),
 			       "", &diff_opts);
 	diffcore_std(&diff_opts);
 
@@ -956,11 +1077,13 @@ static int blame_chunk_cb(long start_a, long count_a,
  */
 static void pass_blame_to_parent(struct scoreboard *sb,
 				 struct origin *target,
-				 struct origin *parent)
+				 struct origin *parent,
+				 const struct recorded_hunks *hunks)
 {
 	mmfile_t file_p, file_o;
 	struct blame_chunk_cb_data d;
 	struct blame_entry *newdest = NULL;
+	int i;
 
 	if (!target->suspects)
 		return; /* nothing remains for this target */
@@ -973,7 +1096,12 @@ static void pass_blame_to_parent(struct scoreboard *sb,
 	fill_origin_blob(&sb->revs->diffopt, target, &file_o);
 	num_get_patch++;
 
-	diff_hunks(&file_p, &file_o, 0, blame_chunk_cb, &d);
+	if (hunks)
+		for (i = 0; i < hunks->nr; i += 4)
+			blame_chunk_cb(hunks->v[i], hunks->v[i + 1],
+				       hunks->v[i + 2], hunks->v[i + 3], &d);
+	else
+		diff_hunks(&file_p, &file_o, 0, blame_chunk_cb, &d);
 	/* The rest are the same as the parent */
 	blame_chunk(&d.dstq, &d.srcq, INT_MAX, d.offset, INT_MAX, parent);
 	*d.dstq = NULL;
@@ -1152,6 +1280,50 @@ static struct blame_entry **filter_small(struct scoreboard *sb,
 	return small;
 }
 
+struct blame_list {
+	struct blame_entry *ent;
+	struct blame_entry split[3];
+};
+
+/*
+ * Count the number of entries the target is suspected for,
+ * and prepare a list of entry and the best split.
+ */
+static struct blame_list *setup_blame_list(struct blame_entry *unblamed,
+					   int *num_ents_p)
+{
+	struct blame_entry *e;
+	int num_ents, i;
+	struct blame_list *blame_list = NULL;
+
+	for (e = unblamed, num_ents = 0; e; e = e->next)
+		num_ents++;
+	if (num_ents) {
+		blame_list = xcalloc(num_ents, sizeof(struct blame_list));
+		for (e = unblamed, i = 0; e; e = e->next)
+			blame_list[i++].ent = e;
+	}
+	*num_ents_p = num_ents;
+	return blame_list;
+}
+
+struct move_search {
+	struct scoreboard *sb;
+	struct origin *parent;
+	mmfile_t *file_p;
+	struct blame_list *blame_list;
+};
+
+static void find_move_in_slice(void *data, int slice, int begin, int end)
+{
+	struct move_search *ms = data;
+	int j;
+
+	for (j = begin; j < end; j++)
+		find_copy_in_blob(ms->sb, ms->blame_list[j].ent, ms->parent,
+				  ms->blame_list[j].split, ms->file_p);
+}
+
 /*
  * See if lines currently target is suspected for can be attributed to
  * parent.
@@ -1162,9 +1334,9 @@ static void find_move_in_parent(struct scoreboard *sb,
 				struct origin *target,
 				struct origin *parent)
 {
-	struct blame_entry *e, split[3];
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct move_search ms;
 	mmfile_t file_p;
 
 	if (!unblamed)
@@ -1179,12 +1351,19 @@ static void find_move_in_parent(struct scoreboard *sb,
 	 * contains the reversed list of entries that have been tested
 	 * without being assignable to the parent.
 	 */
+	ms.sb = sb;
+	ms.parent = parent;
+	ms.file_p = &file_p;
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
-		struct blame_entry *next;
-		for (e = unblamed; e; e = next) {
-			next = e->next;
-			find_copy_in_blob(sb, e, parent, split, &file_p);
+		int j, num_ents;
+
+		ms.blame_list = setup_blame_list(unblamed, &num_ents);
+		run_blame_slices(num_ents, find_move_in_slice, &ms);
+		for (j = 0; j < num_ents; j++) {
+			struct blame_entry *e = ms.blame_list[j].ent;
+			struct blame_entry *split = ms.blame_list[j].split;
+
 			if (split[1].suspect &&
 			    blame_move_score < ent_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split, e);
@@ -1194,37 +1373,69 @@ static void find_move_in_parent(struct scoreboard *sb,
 			}
 			decref_split(split);
 		}
+		free(ms.blame_list);
 		*unblamedtail = NULL;
 		toosmall = filter_small(sb, toosmall, &unblamed, blame_move_score);
 	} while (unblamed);
 	target->suspects = reverse_blame(leftover, NULL);
 }
 
-struct blame_list {
-	struct blame_entry *ent;
-	struct blame_entry split[3];
-};
-
 /*
- * Count the number of entries the target is suspected for,
- * and prepare a list of entry and the best split.
+ * Blobs a copy search looks at together; each slice finds the best
+ * split of every entry among its own candidates, and the slices'
+ * winners are then compared in candidate order, just as if a single
+ * thread had gone through them all.
  */
-static struct blame_list *setup_blame_list(struct blame_entry *unblamed,
-					   int *num_ents_p)
+#define COPY_BATCH 32
+
+struct copy_search {
+	struct scoreboard *sb;
+	struct blame_list *blame_list;
+	int num_ents;
+	struct origin **cand;
+	struct blame_entry *best;	/* [slice][num_ents][3] */
+};
+
+static void find_copy_in_slice(void *data, int slice, int begin, int end)
 {
-	struct blame_entry *e;
-	int num_ents, i;
-	struct blame_list *blame_list = NULL;
+	struct copy_search *cs = data;
+	struct blame_entry *best = cs->best + (size_t)slice * cs->num_ents * 3;
+	int i, j;
 
-	for (e = unblamed, num_ents = 0; e; e = e->next)
-		num_ents++;
-	if (num_ents) {
-		blame_list = xcalloc(num_ents, sizeof(struct blame_list));
-		for (e = unblamed, i = 0; e; e = e->next)
-			blame_list[i++].ent = e;
+	for (i = begin; i < end; i++) {
+		struct origin *norigin = cs->cand[i];
+
+		for (j = 0; j < cs->num_ents; j++) {
+			struct blame_entry this[3];
+
+			find_copy_in_blob(cs->sb, cs->blame_list[j].ent,
+					  norigin, this, &norigin->file);
+			copy_split_if_better(cs->sb, best + 3 * j, this);
+			decref_split(this);
+		}
 	}
-	*num_ents_p = num_ents;
-	return blame_list;
+}
+
+static void find_copy_in_candidates(struct copy_search *cs, int nr)
+{
+	int slices = blame_slices(nr);
+	int i, j;
+
+	cs->best = xcalloc((size_t)slices * cs->num_ents * 3,
+			   sizeof(struct blame_entry));
+	run_blame_slices(nr, find_copy_in_slice, cs);
+	for (i = 0; i < slices; i++)
+		for (j = 0; j < cs->num_ents; j++) {
+			struct blame_entry *best;
+
+			best = cs->best + ((size_t)i * cs->num_ents + j) * 3;
+			copy_split_if_better(cs->sb, cs->blame_list[j].split,
+					     best);
+			decref_split(best);
+		}
+	free(cs->best);
+	for (i = 0; i < nr; i++)
+		origin_decref(cs->cand[i]);
 }
 
 /*
@@ -1241,11 +1452,13 @@ static void find_copy_in_parent(struct scoreboard *sb,
 				int opt)
 {
 	struct diff_options diff_opts;
-	int i, j;
+	int i, j, nr;
 	struct blame_list *blame_list;
 	int num_ents;
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct copy_search cs;
+	int batch = blame_slices(COPY_BATCH) > 1 ? COPY_BATCH : 1;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -1269,10 +1482,10 @@ static void find_copy_in_parent(struct scoreboard *sb,
 		DIFF_OPT_SET(&diff_opts, FIND_COPIES_HARDER);
 
 	if (is_null_sha1(target->commit->object.sha1))
-		do_diff_cache(parent->tree->object.sha1, &diff_opts);
+		do_diff_cache(get_commit_tree_sha1(parent), &diff_opts);
 	else
-		diff_tree_sha1(parent->tree->object.sha1,
-			       target->commit->tree->object.sha1,
+		diff_tree_sha1(get_commit_tree_sha1(parent),
+			       get_commit_tree_sha1(target->commit),
 			       "", &diff_opts);
 
 	if (!DIFF_OPT_TST(&diff_opts, FIND_COPIES_HARDER))
@@ -1281,12 +1494,16 @@ static void find_copy_in_parent(struct scoreboard *sb,
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		blame_list = setup_blame_list(unblamed, &num_ents);
+		cs.sb = sb;
+		cs.blame_list = blame_list;
+		cs.num_ents = num_ents;
+		cs.cand = xmalloc(batch * sizeof(*cs.cand));
+		nr = 0;
 
 		for (i = 0; i < diff_queued_diff.nr; i++) {
 			struct diff_filepair *p = diff_queued_diff.queue[i];
 			struct origin *norigin;
 			mmfile_t file_p;
-			struct blame_entry this[3];
 
 			if (!DIFF_FILE_VALID(p->one))
 				continue; /* does not exist in parent */
@@ -1303,15 +1520,14 @@ static void find_copy_in_parent(struct scoreboard *sb,
 			if (!file_p.ptr)
 				continue;
 
-			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, this, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     this);
-				decref_split(this);
+			cs.cand[nr++] = norigin;
+			if (nr == batch) {
+				find_copy_in_candidates(&cs, nr);
+				nr = 0;
 			}
-			origin_decref(norigin);
 		}
+		find_copy_in_candidates(&cs, nr);
+		free(cs.cand);
 
 		for (j = 0; j < num_ents; j++) {
 			struct blame_entry *split = blame_list[j].split;
@@ -1397,6 +1613,53 @@ static void distribute_blame(struct scoreboard *sb, struct blame_entry *blamed)
 	}
 }
 
+struct parent_diff {
+	struct origin *target;
+	struct origin **parent;
+	struct recorded_hunks *hunks;
+};
+
+static void diff_parents_slice(void *data, int slice, int begin, int end)
+{
+	struct parent_diff *pd = data;
+	int i;
+
+	for (i = begin; i < end; i++)
+		if (pd->parent[i])
+			diff_hunks(&pd->parent[i]->file, &pd->target->file, 0,
+				   record_hunk_cb, &pd->hunks[i]);
+}
+
+/*
+ * Diff a merge against all of its parents at once, for
+ * pass_blame_to_parent() to replay one after the other.  Returns
+ * NULL when there is nothing to run side by side.
+ */
+static struct recorded_hunks *diff_parents(struct scoreboard *sb,
+					   struct origin *target,
+					   struct origin **parent, int nr)
+{
+	struct parent_diff pd;
+	mmfile_t file;
+	int i, n = 0;
+
+	for (i = 0; i < nr; i++)
+		if (parent[i])
+			n++;
+	if (blame_slices(n) < 2)
+		return NULL;
+
+	fill_origin_blob(&sb->revs->diffopt, target, &file);
+	for (i = 0; i < nr; i++)
+		if (parent[i])
+			fill_origin_blob(&sb->revs->diffopt, parent[i], &file);
+	pd.target = target;
+	pd.parent = parent;
+	pd.hunks = xcalloc(nr, sizeof(*pd.hunks));
+	run_blame_slices(nr, diff_parents_slice, &pd);
+	return pd.hunks;
+}
+
 #define MAXSG 16
 
 static void pass_blame(struct scoreboard *sb, struct origin *origin, int opt)
@@ -1409,6 +1672,7 @@ static void pass_blame(struct scoreboard *sb, struct origin *origin, int opt)
 	struct origin *porigin, **sg_origin = sg_buf;
 	struct blame_entry *toosmall = NULL;
 	struct blame_entry *blames, **blametail = &blames;
+	struct recorded_hunks *hunks = NULL;
 
 	num_sg = num_scapegoats(revs, commit);
 	if (!num_sg)
@@ -1460,6 +1724,7 @@ static void pass_blame(struct scoreboard *sb, struct origin *origin, int opt)
 	}
 
 	num_commits++;
+	hunks = diff_parents(sb, origin, sg_origin, num_sg);
 	for (i = 0, sg = first_scapegoat(revs, commit);
 	     i < num_sg && sg;
 	     sg = sg->next, i++) {
@@ -1470,7 +1735,7 @@ static void pass_blame(struct scoreboard *sb, struct origin *origin, int opt)
 			origin_incref(porigin);
 			origin->previous = porigin;
 		}
-		pass_blame_to_parent(sb, origin, porigin);
+		pass_blame_to_parent(sb, origin, porigin, hunks ? &hunks[i] : NULL);
 		if (!origin->suspects)
 			goto finish;
 	}
@@ -1540,7 +1805,10 @@ finish:
 			drop_origin_blob(sg_origin[i]);
 			origin_decref(sg_origin[i]);
 		}
+		if (hunks)
+			free(hunks[i].v);
 	}
+	free(hunks);
 	drop_origin_blob(origin);
 	if (sg_buf != sg_origin)
 		free(sg_origin);
@@ -1746,6 +2014,267 @@ static void found_guilty_entry(struct blame_entry *ent)
 	}
 }
 
+/*
+ * With blame.cache, the blame of a whole file at a commit is kept in
+ * $GIT_DIR/blame-cache, keyed by a hash of the commit, the path and
+ * the options that change the answer.  The value describes the lines
+ * of the file in runs, each followed by the preceding blame record of
+ * its origin when there is one:
+ *
+ *	<start> <count> <s_lno> <commit> <path>
+ *	previous <commit> <path>
+ *
+ * When the walk reaches an origin that has an entry, the lines still
+ * suspected in it are attributed from the entry instead of being
+ * passed further down the history.
+ */
+static int use_blame_cache;
+static struct append_cache *blame_cache;
+
+static void blame_cache_key(unsigned char *key, struct commit *commit,
+			    const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	git_SHA_CTX ctx;
+
+	strbuf_addf(&buf, "blame %s %d %d %s",
+		    sha1_to_hex(commit->object.sha1),
+		    xdl_opts, no_whole_file_rename, path);
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, buf.buf, buf.len);
+	git_SHA1_Final(key, &ctx);
+	strbuf_release(&buf);
+}
+
+/* Parse "<commit> <path>" and return the origin it names, or NULL. */
+static struct origin *parse_cached_origin(struct scoreboard *sb,
+					  const char *p, const char *eol)
+{
+	struct strbuf path = STRBUF_INIT;
+	unsigned char sha1[20];
+	struct commit *commit;
+	struct origin *o;
+
+	if (eol - p < 42 || get_sha1_hex(p, sha1) || p[40] != ' ')
+		return NULL;
+	p += 41;
+	if (*p == '"') {
+		const char *end;
+		if (unquote_c_style(&path, p, &end) || end != eol)
+			goto malformed;
+	} else
+		strbuf_add(&path, p, eol - p);
+
+	commit = lookup_commit(sha1);
+	if (!commit || parse_commit_gently(commit, 1) < 0)
+		goto malformed;
+	o = get_origin(sb, commit, path.buf);
+	strbuf_release(&path);
+	return o;
+
+malformed:
+	strbuf_release(&path);
+	return NULL;
+}
+
+struct cached_run {
+	int start, count, s_lno;
+	struct origin *suspect;
+};
+
+static int parse_cached_blame(struct scoreboard *sb, const char *buf,
+			      size_t size, struct cached_run **runs_p)
+{
+	struct cached_run *runs = NULL;
+	const char *p = buf, *end = buf + size, *eol;
+	int nr = 0, alloc = 0, i;
+
+	for (; p < end && (eol = memchr(p, '\n', end - p)); p = eol + 1) {
+		struct cached_run *run;
+		char *q;
+
+		if (skip_prefix(p, "previous ", &p)) {
+			struct origin *prev;
+
+			if (!nr || !(prev = parse_cached_origin(sb, p, eol)))
+				goto malformed;
+			if (runs[nr - 1].suspect->previous)
+				origin_decref(prev);
+			else
+				runs[nr - 1].suspect->previous = prev;
+			continue;
+		}
+
+		ALLOC_GROW(runs, nr + 1, alloc);
+		run = &runs[nr];
+		run->start = strtol(p, &q, 10);
+		if (*q != ' ' || run->start != (nr ? run[-1].start + run[-1].count : 0))
+			goto malformed;
+		run->count = strtol(q + 1, &q, 10);
+		if (*q != ' ' || run->count <= 0)
+			goto malformed;
+		run->s_lno = strtol(q + 1, &q, 10);
+		if (*q != ' ' || run->s_lno < 0)
+			goto malformed;
+		run->suspect = parse_cached_origin(sb, q + 1, eol);
+		if (!run->suspect)
+			goto malformed;
+		nr++;
+	}
+	if (p != end)
+		goto malformed;
+	*runs_p = runs;
+	return nr;
+
+malformed:
+	for (i = 0; i < nr; i++)
+		origin_decref(runs[i].suspect);
+	free(runs);
+	return -1;
+}
+
+/*
+ * If the blame of the whole of origin is in the cache, attribute its
+ * remaining suspects from there, ship them to the scoreboard and
+ * return 1.
+ */
+static int blame_from_cache(struct scoreboard *sb, struct origin *origin)
+{
+	unsigned char key[20];
+	struct cached_run *runs;
+	struct blame_entry *e, *next;
+	const char *value;
+	int nr, lines, i;
+
+	if (!blame_cache)
+		return 0;
+	blame_cache_key(key, origin->commit, origin->path);
+	value = append_cache_get(blame_cache, sha1_to_hex(key));
+	if (!value)
+		return 0;
+	nr = parse_cached_blame(sb, value, strlen(value), &runs);
+	if (nr < 0)
+		return 0;
+
+	lines = nr ? runs[nr - 1].start + runs[nr - 1].count : 0;
+	for (e = origin->suspects; e; e = e->next)
+		if (lines < e->s_lno + e->num_lines)
+			break;
+	if (e) {
+		/* the entry does not describe this file */
+		for (i = 0; i < nr; i++)
+			origin_decref(runs[i].suspect);
+		free(runs);
+		return 0;
+	}
+
+	for (e = origin->suspects; e; e = next) {
+		int lo = 0, hi = nr;
+
+		next = e->next;
+		while (lo + 1 < hi) {
+			int mi = lo + (hi - lo) / 2;
+			if (runs[mi].start <= e->s_lno)
+				lo = mi;
+			else
+				hi = mi;
+		}
+		for (i = lo; i < nr && runs[i].start < e->s_lno + e->num_lines; i++) {
+			struct cached_run *run = &runs[i];
+			struct blame_entry *ent = xcalloc(1, sizeof(*ent));
+			int from = run->start < e->s_lno ? e->s_lno : run->start;
+			int to = run->start + run->count;
+
+			if (e->s_lno + e->num_lines < to)
+				to = e->s_lno + e->num_lines;
+			ent->lno = e->lno + from - e->s_lno;
+			ent->num_lines = to - from;
+			ent->s_lno = run->s_lno + from - run->start;
+			ent->suspect = origin_incref(run->suspect);
+			ent->suspect->guilty = 1;
+			if (!ent->suspect->commit->parents && !show_root)
+				ent->suspect->commit->object.flags |= UNINTERESTING;
+			found_guilty_entry(ent);
+			ent->next = sb->ent;
+			sb->ent = ent;
+		}
+		origin_decref(e->suspect);
+		free(e);
+	}
+	origin->suspects = NULL;
+	drop_origin_blob(origin);
+
+	for (i = 0; i < nr; i++)
+		origin_decref(runs[i].suspect);
+	free(runs);
+	return 1;
+}
+
+static void add_cached_origin(struct strbuf *buf, struct origin *o)
+{
+	strbuf_addf(buf, "%s ", sha1_to_hex(o->commit->object.sha1));
+	quote_c_style(o->path, buf, NULL, 0);
+	strbuf_addch(buf, '\n');
+}
+
+/*
+ * Remember the blame of the whole final image; sb->ent must be sorted
+ * and coalesced.
+ */
+static void store_blame_cache(struct scoreboard *sb)
+{
+	unsigned char key[20];
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_entry *ent;
+
+	if (!blame_cache || is_null_sha1(sb->final->object.sha1))
+		return;
+	blame_cache_key(key, sb->final, sb->path);
+	if (append_cache_get(blame_cache, sha1_to_hex(key)))
+		return;
+
+	for (ent = sb->ent; ent; ent = ent->next) {
+		strbuf_addf(&buf, "%d %d %d ",
+			    ent->lno, ent->num_lines, ent->s_lno);
+		add_cached_origin(&buf, ent->suspect);
+		if (ent->suspect->previous) {
+			strbuf_addstr(&buf, "previous ");
+			add_cached_origin(&buf, ent->suspect->previous);
+		}
+	}
+	append_cache_put(blame_cache, sha1_to_hex(key), buf.buf);
+	strbuf_release(&buf);
+}
+
+/*
+ * The cached answers only hold for a plain walk down the whole
+ * history that follows lines within a single file.
+ */
+static void setup_blame_cache(struct scoreboard *sb, const char *path,
+			      int opt, const char *revs_file)
+{
+	struct rev_info *revs = sb->revs;
+	struct userdiff_driver *driver;
+	int i;
+
+	if (!use_blame_cache || reverse || opt || revs_file ||
+	    revs->max_age != -1 || revs->first_parent_only)
+		return;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return;
+	if (!commit_graph_compatible() || is_repository_shallow())
+		return;
+	driver = userdiff_find_by_path(path);
+	if (DIFF_OPT_TST(&revs->diffopt, ALLOW_TEXTCONV) &&
+	    driver && driver->textconv)
+		return;
+
+	blame_cache = xmalloc(sizeof(*blame_cache));
+	append_cache_init(blame_cache, git_path("blame-cache"),
+			  "blame cache version 1");
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -1778,9 +2307,10 @@ static void assign_blame(struct scoreboard *sb, int opt)
 		parse_commit(commit);
 		if (reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!blame_from_cache(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(commit);
@@ -2184,6 +2714,19 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 			*output_option &= ~OUTPUT_SHOW_EMAIL;
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "blame.threads")) {
+		blame_threads = git_config_int(var, value);
+		if (blame_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    blame_threads, var);
+		if (!blame_threads)
+			blame_threads = online_cpus();
+		return 0;
+	}
 	if (!strcmp(var, "blame.date")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -2488,6 +3031,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	struct origin *o;
 	struct blame_entry *ent = NULL;
 	long dashdash_pos, lno;
+	int whole_file;
 	char *final_commit_name = NULL;
 	enum object_type type;
 
@@ -2696,6 +3240,8 @@ parse_done:
 	else if (contents_from)
 		die("Cannot use --contents with final commit object name");
 
+	setup_blame_cache(&sb, path, opt, revs_file);
+
 	/*
 	 * If we have bottom, this will mark the ancestors of the
 	 * bottom commits we would reach while traversing as
@@ -2752,6 +3298,8 @@ parse_done:
 		anchor = top + 1;
 	}
 	sort_and_merge_range_set(&ranges);
+	whole_file = !lno || (ranges.nr == 1 &&
+			      !ranges.ranges[0].start && ranges.ranges[0].end == lno);
 
 	for (range_i = ranges.nr; range_i > 0; --range_i) {
 		const struct range *r = &ranges.ranges[range_i - 1];
@@ -2794,6 +3342,9 @@ parse_done:
 
 	coalesce(&sb);
 
+	if (whole_file)
+		store_blame_cache(&sb);
+
 	if (!(output_option & OUTPUT_PORCELAIN))
 		find_alignment(&sb, &output_option);
 
@@ -290,7 +290,8 @@ struct ref_list {
 	struct rev_info revs;
 	int index, alloc, maxwidth, verbose, abbrev;
 	struct ref_item *list;
-	struct commit_list *with_commit;
+	struct commit_list *with_commit, *no_commit;
+	struct contains_cache contains_cache, no_contains_cache;
 	int kinds;
 };
 
@@ -326,6 +327,20 @@ static int match_patterns(const char **pattern, const char *refname)
 	return 0;
 }
 
+/* Does "commit" pass the --contains and --no-contains filters? */
+static int filter_contains(struct ref_list *ref_list, struct commit *commit)
+{
+	if (ref_list->with_commit &&
+	    !commit_contains(commit, ref_list->with_commit,
+			     &ref_list->contains_cache))
+		return 0;
+	if (ref_list->no_commit &&
+	    commit_contains(commit, ref_list->no_commit,
+			    &ref_list->no_contains_cache))
+		return 0;
+	return 1;
+}
+
 static int append_ref(const char *refname, const struct object_id *oid, int flags, void *cb_data)
 {
 	struct append_ref_cb *cb = (struct append_ref_cb *)(cb_data);
@@ -362,15 +377,15 @@ static int append_ref(const char *refname, const struct object_id *oid, int flag
 		return 0;
 
 	commit = NULL;
-	if (ref_list->verbose || ref_list->with_commit || merge_filter != NO_FILTER) {
+	if (ref_list->verbose || ref_list->with_commit || ref_list->no_commit ||
+	    merge_filter != NO_FILTER) {
 		commit = lookup_commit_reference_gently(oid->hash, 1);
 		if (!commit) {
 			cb->ret = error(_("branch '%s' does not point at a commit"), refname);
 			return 0;
 		}
 
-		/* Filter with with_commit if specified */
-		if (!is_descendant_of(commit, ref_list->with_commit))
+		if (!filter_contains(ref_list, commit))
 			return 0;
 
 		if (merge_filter != NO_FILTER)
@@ -603,7 +618,7 @@ static void show_detached(struct ref_list *ref_list)
 {
 	struct commit *head_commit = lookup_commit_reference_gently(head_sha1, 1);
 
-	if (head_commit && is_descendant_of(head_commit, ref_list->with_commit)) {
+	if (head_commit && filter_contains(ref_list, head_commit)) {
 		struct ref_item item;
 		item.name = get_head_description();
 		item.width = utf8_strwidth(item.name);
@@ -618,7 +633,9 @@ static void show_detached(struct ref_list *ref_list)
 	}
 }
 
-static int print_ref_list(int kinds, int detached, int verbose, int abbrev, struct commit_list *with_commit, const char **pattern)
+static int print_ref_list(int kinds, int detached, int verbose, int abbrev,
+			  struct commit_list *with_commit,
+			  struct commit_list *no_commit, const char **pattern)
 {
 	int i;
 	struct append_ref_cb cb;
@@ -629,12 +646,18 @@ static int print_ref_list(int kinds, int detached, int verbose, int abbrev, stru
 	ref_list.verbose = verbose;
 	ref_list.abbrev = abbrev;
 	ref_list.with_commit = with_commit;
+	ref_list.no_commit = no_commit;
+	init_contains_cache(&ref_list.contains_cache);
+	init_contains_cache(&ref_list.no_contains_cache);
 	if (merge_filter != NO_FILTER)
 		init_revisions(&ref_list.revs, NULL);
 	cb.ref_list = &ref_list;
 	cb.pattern = pattern;
 	cb.ret = 0;
-	for_each_rawref(append_ref, &cb);
+	if (kinds & REF_LOCAL_BRANCH)
+		for_each_fullref_in("refs/heads/", append_ref, &cb, 1);
+	if (kinds & REF_REMOTE_BRANCH)
+		for_each_fullref_in("refs/remotes/", append_ref, &cb, 1);
 	if (merge_filter != NO_FILTER) {
 		struct commit *filter;
 		filter = lookup_commit_reference_gently(merge_filter_ref, 0);
@@ -685,6 +708,8 @@ static int print_ref_list(int kinds, int detached, int verbose, int abbrev, stru
 	}
 
 	free_ref_list(&ref_list);
+	clear_contains_cache(&ref_list.contains_cache);
+	clear_contains_cache(&ref_list.no_contains_cache);
 
 	if (cb.ret)
 		error(_("some refs could not be read"));
@@ -804,7 +829,7 @@ int cmd_branch(int argc, const char **argv, const char *prefix)
 	const char *new_upstream = NULL;
 	enum branch_track track;
 	int kinds = REF_LOCAL_BRANCH;
-	struct commit_list *with_commit = NULL;
+	struct commit_list *with_commit = NULL, *no_commit = NULL;
 
 	struct option options[] = {
 		OPT_GROUP(N_("Generic options")),
@@ -823,15 +848,21 @@ int cmd_branch(int argc, const char **argv, const char *prefix)
 		{
 			OPTION_CALLBACK, 0, "contains", &with_commit, N_("commit"),
 			N_("print only branches that contain the commit"),
-			PARSE_OPT_LASTARG_DEFAULT,
+			PARSE_OPT_NONEG | PARSE_OPT_LASTARG_DEFAULT,
 			parse_opt_with_commit, (intptr_t)"HEAD",
 		},
 		{
 			OPTION_CALLBACK, 0, "with", &with_commit, N_("commit"),
 			N_("print only branches that contain the commit"),
-			PARSE_OPT_HIDDEN | PARSE_OPT_LASTARG_DEFAULT,
+			PARSE_OPT_HIDDEN | PARSE_OPT_NONEG | PARSE_OPT_LASTARG_DEFAULT,
 			parse_opt_with_commit, (intptr_t) "HEAD",
 		},
+		{
+			OPTION_CALLBACK, 0, "no-contains", &no_commit, N_("commit"),
+			N_("print only branches that don't contain the commit"),
+			PARSE_OPT_NONEG | PARSE_OPT_LASTARG_DEFAULT,
+			parse_opt_with_commit, (intptr_t)"HEAD",
+		},
 		OPT__ABBREV(&abbrev),
 
 		OPT_GROUP(N_("Specific git-branch actions:")),
@@ -885,7 +916,7 @@ int cmd_branch(int argc, const char **argv, const char *prefix)
 	if (!delete && !rename && !edit_description && !new_upstream && !unset_upstream && argc == 0)
 		list = 1;
 
-	if (with_commit || merge_filter != NO_FILTER)
+	if (with_commit || no_commit || merge_filter != NO_FILTER)
 		list = 1;
 
 	if (!!delete + !!rename + !!new_upstream +
@@ -912,7 +943,7 @@ int cmd_branch(int argc, const char **argv, const char *prefix)
 		return delete_branches(argc, argv, delete > 1, kinds, quiet);
 	} else if (list) {
 		int ret = print_ref_list(kinds, detached, verbose, abbrev,
-					 with_commit, argv);
+					 with_commit, no_commit, argv);
 		print_columns(&output, colopts, NULL);
 		string_list_clear(&output, 0);
 		return ret;
@@ -9,6 +9,7 @@
 #include "userdiff.h"
 #include "streaming.h"
 #include "tree-walk.h"
+#include "sha1-array.h"
 
 static int cat_one_file(int opt, const char *exp_type, const char *obj_name,
 			int unknown_type)
@@ -236,13 +237,37 @@ struct batch_options {
 	int enabled;
 	int follow_symlinks;
 	int print_contents;
+	int all_objects;
+	int unordered;
 	const char *format;
 };
 
+static void batch_object_write(const char *obj_name, struct batch_options *opt,
+			       struct expand_data *data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned flags = opt->all_objects ? 0 : LOOKUP_REPLACE_OBJECT;
+
+	if (sha1_object_info_extended(data->sha1, &data->info, flags) < 0) {
+		printf("%s missing\n", obj_name ? obj_name : sha1_to_hex(data->sha1));
+		fflush(stdout);
+		return;
+	}
+
+	strbuf_expand(&buf, opt->format, expand_format, data);
+	strbuf_addch(&buf, '\n');
+	write_or_die(1, buf.buf, buf.len);
+	strbuf_release(&buf);
+
+	if (opt->print_contents) {
+		print_object_or_die(1, data);
+		write_or_die(1, "\n", 1);
+	}
+}
+
 static int batch_one_object(const char *obj_name, struct batch_options *opt,
 			    struct expand_data *data)
 {
-	struct strbuf buf = STRBUF_INIT;
 	struct object_context ctx;
 	int flags = opt->follow_symlinks ? GET_SHA1_FOLLOW_SYMLINKS : 0;
 	enum follow_symlinks_result result;
@@ -285,21 +310,176 @@ static int batch_one_object(const char *obj_name, struct batch_options *opt,
 		return 0;
 	}
 
-	if (sha1_object_info_extended(data->sha1, &data->info, LOOKUP_REPLACE_OBJECT) < 0) {
-		printf("%s missing\n", obj_name);
-		fflush(stdout);
-		return 0;
+	batch_object_write(obj_name, opt, data);
+	return 0;
+}
+
+static int batch_one_line(char *line, struct batch_options *opt,
+			  struct expand_data *data)
+{
+	if (data->split_on_whitespace) {
+		/*
+		 * Split at first whitespace, tying off the beginning
+		 * of the string and saving the remainder (or NULL) in
+		 * data->rest.
+		 */
+		char *p = strpbrk(line, " \t");
+		if (p) {
+			while (*p && strchr(" \t", *p))
+				*p++ = '\0';
+		}
+		data->rest = p;
 	}
 
-	strbuf_expand(&buf, opt->format, expand_format, data);
-	strbuf_addch(&buf, '\n');
-	write_or_die(1, buf.buf, buf.len);
-	strbuf_release(&buf);
+	return batch_one_object(line, opt, data);
+}
 
-	if (opt->print_contents) {
-		print_object_or_die(1, data);
-		write_or_die(1, "\n", 1);
+/*
+ * An object to show in --unordered mode, with where it is stored:
+ * objects are shown in the order of the packs they are in, so that
+ * they are read from each pack front to back rather than jumping
+ * around in it (and thrashing the pack windows and the delta base
+ * cache).  Loose and missing objects come last, in the order they
+ * were asked for.
+ */
+struct batch_entry {
+	char *line;
+	unsigned char sha1[20];
+	struct packed_git *pack;
+	off_t offset;
+	unsigned int nr;
+};
+
+struct batch_entries {
+	struct batch_entry *entry;
+	unsigned int nr, alloc;
+};
+
+static struct batch_entry *add_batch_entry(struct batch_entries *list,
+					   const unsigned char *sha1)
+{
+	struct batch_entry *e;
+
+	ALLOC_GROW(list->entry, list->nr + 1, list->alloc);
+	e = &list->entry[list->nr];
+	memset(e, 0, sizeof(*e));
+	e->nr = list->nr++;
+	if (sha1)
+		hashcpy(e->sha1, sha1);
+	return e;
+}
+
+static void locate_batch_entry(struct batch_entry *e)
+{
+	struct object_info oi = {NULL};
+
+	if (sha1_object_info_extended(e->sha1, &oi, 0) < 0 ||
+	    oi.whence != OI_PACKED)
+		return;
+	e->pack = oi.u.packed.pack;
+	e->offset = oi.u.packed.offset;
+}
+
+static int compare_batch_location(const void *va, const void *vb)
+{
+	const struct batch_entry *a = va, *b = vb;
+
+	if (a->pack != b->pack) {
+		if (!a->pack || !b->pack)
+			return a->pack ? -1 : 1;
+		return (uintptr_t)a->pack < (uintptr_t)b->pack ? -1 : 1;
+	}
+	if (a->pack && a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a->nr < b->nr ? -1 : a->nr > b->nr;
+}
+
+static int compare_batch_sha1(const void *va, const void *vb)
+{
+	const struct batch_entry *a = va, *b = vb;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	return a->nr < b->nr ? -1 : a->nr > b->nr;
+}
+
+static int batch_unordered_lines(struct batch_options *opt,
+				 struct expand_data *data)
+{
+	struct batch_entries list = { NULL };
+	struct strbuf buf = STRBUF_INIT;
+	unsigned int i;
+	int retval = 0;
+
+	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+		struct batch_entry *e = add_batch_entry(&list, NULL);
+		size_t namelen = data->split_on_whitespace ?
+			strcspn(buf.buf, " \t") : buf.len;
+		char *name = xmemdupz(buf.buf, namelen);
+
+		e->line = strbuf_detach(&buf, NULL);
+		if (!get_sha1(name, e->sha1))
+			locate_batch_entry(e);
+		free(name);
+	}
+	qsort(list.entry, list.nr, sizeof(*list.entry), compare_batch_location);
+
+	for (i = 0; i < list.nr; i++) {
+		if (!retval)
+			retval = batch_one_line(list.entry[i].line, opt, data);
+		free(list.entry[i].line);
+	}
+	free(list.entry);
+	return retval;
+}
+
+static int collect_loose_object(const unsigned char *sha1,
+				const char *path,
+				void *data)
+{
+	add_batch_entry(data, sha1);
+	return 0;
+}
+
+static int collect_packed_object(const unsigned char *sha1,
+				 struct packed_git *pack,
+				 uint32_t pos,
+				 void *data)
+{
+	struct batch_entry *e = add_batch_entry(data, sha1);
+
+	e->pack = pack;
+	e->offset = nth_packed_object_offset(pack, pos);
+	return 0;
+}
+
+static int batch_all_objects(struct batch_options *opt,
+			     struct expand_data *data)
+{
+	struct batch_entries list = { NULL };
+	unsigned int i, nr = 0;
+
+	for_each_packed_object(collect_packed_object, &list, 0);
+	for_each_loose_object(collect_loose_object, &list, 0);
+
+	/*
+	 * Show each object once, by name, unless --unordered asks for
+	 * the order they are stored in.  The packed copy of an object
+	 * goes first, as it was collected first.
+	 */
+	qsort(list.entry, list.nr, sizeof(*list.entry), compare_batch_sha1);
+	for (i = 0; i < list.nr; i++)
+		if (!nr || hashcmp(list.entry[nr - 1].sha1, list.entry[i].sha1))
+			list.entry[nr++] = list.entry[i];
+	if (opt->unordered)
+		qsort(list.entry, nr, sizeof(*list.entry), compare_batch_location);
+
+	for (i = 0; i < nr; i++) {
+		hashcpy(data->sha1, list.entry[i].sha1);
+		batch_object_write(NULL, opt, data);
 	}
+	free(list.entry);
 	return 0;
 }
 
@@ -340,24 +520,16 @@ static int batch_objects(struct batch_options *opt)
 	save_warning = warn_on_object_refname_ambiguity;
 	warn_on_object_refname_ambiguity = 0;
 
-	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
-		if (data.split_on_whitespace) {
-			/*
-			 * Split at first whitespace, tying off the beginning
-			 * of the string and saving the remainder (or NULL) in
-			 * data.rest.
-			 */
-			char *p = strpbrk(buf.buf, " \t");
-			if (p) {
-				while (*p && strchr(" \t", *p))
-					*p++ = '\0';
-			}
-			data.rest = p;
+	if (opt->all_objects)
+		retval = batch_all_objects(opt, &data);
+	else if (opt->unordered)
+		retval = batch_unordered_lines(opt, &data);
+	else {
+		while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+			retval = batch_one_line(buf.buf, opt, &data);
+			if (retval)
+				break;
 		}
-
-		retval = batch_one_object(buf.buf, opt, &data);
-		if (retval)
-			break;
 	}
 
 	strbuf_release(&buf);
@@ -367,7 +539,8 @@ static int batch_objects(struct batch_options *opt)
 
 static const char * const cat_file_usage[] = {
 	N_("git cat-file (-t [--allow-unknown-type]|-s [--allow-unknown-type]|-e|-p|<type>|--textconv) <object>"),
-	N_("git cat-file (--batch | --batch-check) [--follow-symlinks] < <list-of-objects>"),
+	N_("git cat-file (--batch | --batch-check) [--follow-symlinks] [--unordered] < <list-of-objects>"),
+	N_("git cat-file (--batch | --batch-check) --batch-all-objects [--unordered]"),
 	NULL
 };
 
@@ -422,6 +595,10 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 			PARSE_OPT_OPTARG, batch_option_callback },
 		OPT_BOOL(0, "follow-symlinks", &batch.follow_symlinks,
 			 N_("follow in-tree symlinks (used with --batch or --batch-check)")),
+		OPT_BOOL(0, "batch-all-objects", &batch.all_objects,
+			 N_("show all objects with --batch or --batch-check")),
+		OPT_BOOL(0, "unordered", &batch.unordered,
+			 N_("show objects in the order they are stored in")),
 		OPT_END()
 	};
 
@@ -446,7 +623,8 @@ int cmd_cat_file(int argc, const char **argv, const char *prefix)
 		usage_with_options(cat_file_usage, options);
 	}
 
-	if (batch.follow_symlinks && !batch.enabled) {
+	if ((batch.follow_symlinks || batch.all_objects || batch.unordered) &&
+	    !batch.enabled) {
 		usage_with_options(cat_file_usage, options);
 	}
 
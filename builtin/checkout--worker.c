@@ -0,0 +1,87 @@
+/*
+ * Write out the files "git checkout" and friends hand it; see
+ * parallel-checkout.h.
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "streaming.h"
+
+static const char checkout_worker_usage[] =
+"git checkout--worker";
+
+static int write_item(const char *path, unsigned int mode,
+		      const unsigned char *sha1, struct stat *st)
+{
+	int fd, fstat_done = 0;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL,
+		  (mode & 0100) ? 0777 : 0666);
+	if (fd < 0)
+		return error("unable to create file %s (%s)",
+			     path, strerror(errno));
+	if (stream_blob_to_fd(fd, sha1, NULL, 1)) {
+		close(fd);
+		unlink(path);
+		return error("unable to write file %s", path);
+	}
+	if (fstat_is_reliable() && !fstat(fd, st))
+		fstat_done = 1;
+	if (close(fd)) {
+		unlink(path);
+		return error("unable to write file %s", path);
+	}
+	if (!fstat_done && lstat(path, st))
+		return error("unable to stat just-written file %s", path);
+	return 0;
+}
+
+static void handle_item(const char *record)
+{
+	struct parallel_checkout_result res;
+	unsigned char sha1[20];
+	unsigned int mode;
+	char *end;
+
+	memset(&res, 0, sizeof(res));
+	res.id = strtoumax(record, &end, 10);
+	if (*end++ != ' ')
+		die("checkout--worker: bad record '%s'", record);
+	mode = strtoul(end, &end, 8);
+	if (*end++ != ' ' || get_sha1_hex(end, sha1) || end[40] != ' ')
+		die("checkout--worker: bad record '%s'", record);
+
+	res.status = write_item(end + 41, mode, sha1, &res.st);
+	if (write_in_full(1, &res, sizeof(res)) != sizeof(res))
+		die_errno("checkout--worker: unable to send result");
+}
+
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	struct strbuf input = STRBUF_INIT;
+	size_t bol = 0, i;
+
+	if (argc != 1)
+		usage(checkout_worker_usage);
+
+	git_config(git_default_config, NULL);
+
+	/*
+	 * Read everything before writing anything, so that the other
+	 * end never waits for us to read while we wait for it.
+	 */
+	if (strbuf_read(&input, 0, 0) < 0)
+		die_errno("checkout--worker: unable to read input");
+
+	for (i = 0; i < input.len; i++) {
+		if (input.buf[i])
+			continue;
+		handle_item(input.buf + bol);
+		bol = i + 1;
+	}
+	if (bol != input.len)
+		die("checkout--worker: truncated input");
+
+	strbuf_release(&input);
+	return 0;
+}
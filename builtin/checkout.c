@@ -364,6 +364,8 @@ static int checkout_paths(const struct checkout_opts *opts,
 	state.force = 1;
 	state.refresh_cache = 1;
 	state.istate = &the_index;
+
+	enable_delayed_checkout(&state);
 	for (pos = 0; pos < active_nr; pos++) {
 		struct cache_entry *ce = active_cache[pos];
 		if (ce->ce_flags & CE_MATCHED) {
@@ -378,6 +380,7 @@ static int checkout_paths(const struct checkout_opts *opts,
 			pos = skip_same_name(ce, pos) - 1;
 		}
 	}
+	errs |= finish_delayed_checkout(&state);
 
 	if (write_locked_index(&the_index, lock_file, COMMIT_LOCK))
 		die(_("unable to write new index file"));
@@ -482,7 +485,7 @@ static int merge_working_tree(const struct checkout_opts *opts,
 
 	resolve_undo_clear();
 	if (opts->force) {
-		ret = reset_tree(new->commit->tree, opts, 1, writeout_error);
+		ret = reset_tree(get_commit_tree(new->commit), opts, 1, writeout_error);
 		if (ret)
 			return ret;
 	} else {
@@ -497,7 +500,9 @@ static int merge_working_tree(const struct checkout_opts *opts,
 
 		setup_unpack_trees_porcelain(&topts, "checkout");
 
+		trace_region_enter("checkout", "refresh index");
 		refresh_cache(REFRESH_QUIET);
+		trace_region_leave("checkout", "refresh index");
 
 		if (unmerged_cache()) {
 			error(_("you need to resolve your current index first"));
@@ -523,7 +528,9 @@ static int merge_working_tree(const struct checkout_opts *opts,
 		tree = parse_tree_indirect(new->commit->object.sha1);
 		init_tree_desc(&trees[1], tree->buffer, tree->size);
 
+		trace_region_enter("checkout", "unpack trees");
 		ret = unpack_trees(2, trees, &topts);
+		trace_region_leave("checkout", "unpack trees");
 		if (ret == -1) {
 			/*
 			 * Unpack couldn't do a trivial merge; either
@@ -568,16 +575,16 @@ static int merge_working_tree(const struct checkout_opts *opts,
 			o.verbosity = 0;
 			work = write_tree_from_memory(&o);
 
-			ret = reset_tree(new->commit->tree, opts, 1,
+			ret = reset_tree(get_commit_tree(new->commit), opts, 1,
 					 writeout_error);
 			if (ret)
 				return ret;
 			o.ancestor = old->name;
 			o.branch1 = new->name;
 			o.branch2 = "local";
-			merge_trees(&o, new->commit->tree, work,
-				old->commit->tree, &result);
-			ret = reset_tree(new->commit->tree, opts, 0,
+			merge_trees(&o, get_commit_tree(new->commit), work,
+				get_commit_tree(old->commit), &result);
+			ret = reset_tree(get_commit_tree(new->commit), opts, 0,
 					 writeout_error);
 			if (ret)
 				return ret;
@@ -1248,7 +1255,7 @@ static int parse_branchname_arg(int argc, const char **argv,
 		*source_tree = parse_tree_indirect(rev);
 	} else {
 		parse_commit_or_die(new->commit);
-		*source_tree = new->commit->tree;
+		*source_tree = get_commit_tree(new->commit);
 	}
 
 	if (!*source_tree)                   /* case (1): want a tree */
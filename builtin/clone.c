@@ -18,12 +18,16 @@
 #include "unpack-trees.h"
 #include "transport.h"
 #include "strbuf.h"
+#include "list-objects-filter.h"
 #include "dir.h"
 #include "sigchain.h"
 #include "branch.h"
 #include "remote.h"
 #include "run-command.h"
 #include "connected.h"
+#include "connect.h"
+#include "bundle.h"
+#include "thread-utils.h"
 
 /*
  * Overall FIXMEs:
@@ -40,8 +44,9 @@ static const char * const builtin_clone_usage[] = {
 
 static int option_no_checkout, option_bare, option_mirror, option_single_branch = -1;
 static int option_local = -1, option_no_hardlinks, option_shared, option_recursive;
-static char *option_template, *option_depth;
+static char *option_template, *option_depth, *option_ref_format;
 static char *option_origin = NULL;
+static struct list_objects_filter_options filter_options;
 static char *option_branch = NULL;
 static const char *real_git_dir;
 static char *option_upload_pack = "git-upload-pack";
@@ -49,6 +54,7 @@ static int option_verbosity;
 static int option_progress = -1;
 static struct string_list option_config;
 static struct string_list option_reference;
+static struct string_list option_bundle_uri;
 static int option_dissociate;
 
 static struct option builtin_clone_options[] = {
@@ -74,6 +80,8 @@ static struct option builtin_clone_options[] = {
 		    N_("initialize submodules in the clone")),
 	OPT_STRING(0, "template", &option_template, N_("template-directory"),
 		   N_("directory from which templates will be used")),
+	OPT_STRING(0, "ref-format", &option_ref_format, N_("format"),
+		   N_("how to store refs (files or reftable)")),
 	OPT_STRING_LIST(0, "reference", &option_reference, N_("repo"),
 			N_("reference repository")),
 	OPT_BOOL(0, "dissociate", &option_dissociate,
@@ -92,6 +100,9 @@ static struct option builtin_clone_options[] = {
 		   N_("separate git dir from working tree")),
 	OPT_STRING_LIST('c', "config", &option_config, N_("key=value"),
 			N_("set config inside the new repository")),
+	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
+	OPT_STRING_LIST(0, "bundle-uri", &option_bundle_uri, N_("uri"),
+			N_("start from the bundle at <uri>")),
 	OPT_END()
 };
 
@@ -300,6 +311,76 @@ static void copy_alternates(struct strbuf *src, struct strbuf *dst,
 	fclose(in);
 }
 
+/*
+ * The files of a local clone are collected while walking the source
+ * object directory, and then linked or copied by several threads at
+ * once; on network storage most of the time goes to waiting for the
+ * server, one file at a time.
+ */
+struct copy_job {
+	char *src, *dest;
+};
+
+static struct copy_job *copy_jobs;
+static int nr_copy_jobs, alloc_copy_jobs;
+
+/* The packs of the source repository */
+static struct packed_git *src_packs;
+
+static void prepare_src_packs(const char *objdir)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t len;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/pack/", objdir);
+	len = path.len;
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+		strbuf_setlen(&path, len);
+		strbuf_addstr(&path, de->d_name);
+		p = add_packed_git(path.buf, path.len, 1);
+		if (!p)
+			continue;
+		p->next = src_packs;
+		src_packs = p;
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+/*
+ * Is "name" (relative to the object directory) a loose object that
+ * one of the packs we copy has, too?
+ */
+static int loose_object_is_packed(const char *name)
+{
+	unsigned char sha1[20];
+	char hex[41];
+	struct packed_git *p;
+
+	if (strlen(name) != 1 + 2 + 1 + 38 || name[0] != '/' || name[3] != '/')
+		return 0;
+	memcpy(hex, name + 1, 2);
+	memcpy(hex + 2, name + 4, 38);
+	hex[40] = '\0';
+	if (get_sha1_hex(hex, sha1))
+		return 0;
+	for (p = src_packs; p; p = p->next)
+		if (find_pack_entry_one(sha1, p))
+			return 1;
+	return 0;
+}
+
 static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 				   const char *src_repo, int src_baselen)
 {
@@ -327,6 +408,8 @@ static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 	dest_len = dest->len;
 
 	while ((de = readdir(dir)) != NULL) {
+		struct copy_job *job;
+
 		strbuf_setlen(src, src_len);
 		strbuf_addstr(src, de->d_name);
 		strbuf_setlen(dest, dest_len);
@@ -348,21 +431,97 @@ static void copy_or_link_directory(struct strbuf *src, struct strbuf *dest,
 			continue;
 		}
 
-		if (unlink(dest->buf) && errno != ENOENT)
-			die_errno(_("failed to unlink '%s'"), dest->buf);
-		if (!option_no_hardlinks) {
-			if (!link(src->buf, dest->buf))
-				continue;
-			if (option_local > 0)
-				die_errno(_("failed to create link '%s'"), dest->buf);
-			option_no_hardlinks = 1;
-		}
-		if (copy_file_with_time(dest->buf, src->buf, 0666))
-			die_errno(_("failed to copy file to '%s'"), dest->buf);
+		/* ... and those we do not need at all */
+		if (loose_object_is_packed(src->buf + src_baselen))
+			continue;
+
+		ALLOC_GROW(copy_jobs, nr_copy_jobs + 1, alloc_copy_jobs);
+		job = &copy_jobs[nr_copy_jobs++];
+		job->src = xstrdup(src->buf);
+		job->dest = xstrdup(dest->buf);
 	}
 	closedir(dir);
 }
 
+static void copy_or_link_file(struct copy_job *job)
+{
+	if (unlink(job->dest) && errno != ENOENT)
+		die_errno(_("failed to unlink '%s'"), job->dest);
+	if (!option_no_hardlinks) {
+		if (!link(job->src, job->dest))
+			return;
+		if (option_local > 0)
+			die_errno(_("failed to create link '%s'"), job->dest);
+		option_no_hardlinks = 1;
+	}
+	if (copy_file_with_time(job->dest, job->src, 0666))
+		die_errno(_("failed to copy file to '%s'"), job->dest);
+}
+
+#ifndef NO_PTHREADS
+#define MIN_COPY_THREADS 4
+#define MAX_COPY_THREADS 16
+
+static pthread_mutex_t copy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int next_copy_job;
+
+static void *copy_worker(void *data)
+{
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&copy_mutex);
+		i = next_copy_job++;
+		pthread_mutex_unlock(&copy_mutex);
+		if (nr_copy_jobs <= i)
+			return NULL;
+		copy_or_link_file(&copy_jobs[i]);
+	}
+}
+
+static void run_copy_jobs(void)
+{
+	pthread_t threads[MAX_COPY_THREADS];
+	int nr_threads = online_cpus();
+	int i;
+
+	/* the threads mostly wait for the filesystem, not the CPU */
+	if (nr_threads < MIN_COPY_THREADS)
+		nr_threads = MIN_COPY_THREADS;
+	if (nr_threads > MAX_COPY_THREADS)
+		nr_threads = MAX_COPY_THREADS;
+	if (nr_threads > nr_copy_jobs)
+		nr_threads = nr_copy_jobs;
+	if (nr_threads <= 1) {
+		for (i = 0; i < nr_copy_jobs; i++)
+			copy_or_link_file(&copy_jobs[i]);
+		return;
+	}
+
+	/*
+	 * Do the first one by ourselves, so that it is settled whether
+	 * hardlinks work before the threads start.
+	 */
+	copy_or_link_file(&copy_jobs[0]);
+	next_copy_job = 1;
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, copy_worker, NULL);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+}
+#else
+static void run_copy_jobs(void)
+{
+	int i;
+
+	for (i = 0; i < nr_copy_jobs; i++)
+		copy_or_link_file(&copy_jobs[i]);
+}
+#endif
+
 static void clone_local(const char *src_repo, const char *dest_repo)
 {
 	if (option_shared) {
@@ -373,9 +532,18 @@ static void clone_local(const char *src_repo, const char *dest_repo)
 	} else {
 		struct strbuf src = STRBUF_INIT;
 		struct strbuf dest = STRBUF_INIT;
+		int i;
+
 		strbuf_addf(&src, "%s/objects", src_repo);
 		strbuf_addf(&dest, "%s/objects", dest_repo);
+		prepare_src_packs(src.buf);
 		copy_or_link_directory(&src, &dest, src_repo, src.len);
+		run_copy_jobs();
+		for (i = 0; i < nr_copy_jobs; i++) {
+			free(copy_jobs[i].src);
+			free(copy_jobs[i].dest);
+		}
+		free(copy_jobs);
 		strbuf_release(&src);
 		strbuf_release(&dest);
 	}
@@ -574,6 +742,121 @@ static void update_remote_refs(const struct ref *refs,
 	}
 }
 
+static int apply_bundle(const char *path, int nr)
+{
+	struct bundle_header header;
+	struct strbuf name = STRBUF_INIT;
+	int fd, i, ret = 0;
+
+	memset(&header, 0, sizeof(header));
+	fd = read_bundle_header(path, &header);
+	if (fd < 0)
+		return -1;
+	if (unbundle(&header, fd, 0))
+		ret = -1;
+	for (i = 0; i < header.references.nr; i++) {
+		struct ref_list_entry *e = &header.references.list[i];
+		const char *refname = e->name;
+
+		if (!ret && has_sha1_file(e->sha1)) {
+			skip_prefix(refname, "refs/", &refname);
+			strbuf_reset(&name);
+			strbuf_addf(&name, "refs/bundles/%d/%s", nr, refname);
+			if (check_refname_format(name.buf, 0) ||
+			    update_ref("clone: from bundle", name.buf, e->sha1,
+				       NULL, 0, UPDATE_REFS_QUIET_ON_ERR))
+				warning(_("ignoring bundle ref '%s'"), e->name);
+		}
+		free(e->name);
+	}
+	for (i = 0; i < header.prerequisites.nr; i++)
+		free(header.prerequisites.list[i].name);
+	free(header.references.list);
+	free(header.prerequisites.list);
+	strbuf_release(&name);
+	return ret;
+}
+
+/*
+ * Before fetching, get as much as we can from bundles: either those
+ * given with --bundle-uri or, with transfer.bundleURI, those the
+ * server advertises.  They are applied in order, each on top of the
+ * ones before, and their tips go to refs/bundles/ so that the fetch
+ * only asks for what they lack.  Bundles over HTTP are downloaded
+ * by "http-fetch --bundle", which resumes broken-off transfers.
+ *
+ * Returns the number of bundles applied.
+ */
+static int apply_bundle_uris(void)
+{
+	const struct string_list *uris = &option_bundle_uri;
+	int use_advertised = 0, applied = 0, i;
+
+	if (!uris->nr &&
+	    !git_config_get_bool("transfer.bundleuri", &use_advertised) &&
+	    use_advertised)
+		uris = server_bundle_uris();
+	if (!uris->nr)
+		return 0;
+	if (option_depth || filter_options.choice) {
+		if (option_bundle_uri.nr)
+			warning(_("--bundle-uri is ignored with --depth and --filter"));
+		return 0;
+	}
+
+	for (i = 0; i < uris->nr; i++) {
+		const char *uri = uris->items[i].string;
+		char *path;
+		int downloaded = !!strstr(uri, "://");
+
+		if (downloaded) {
+			struct child_process cmd = CHILD_PROCESS_INIT;
+
+			path = git_pathdup("bundle-%d", i);
+			argv_array_push(&cmd.args, "http-fetch");
+			argv_array_pushf(&cmd.args, "--bundle=%s", path);
+			argv_array_push(&cmd.args, uri);
+			cmd.git_cmd = 1;
+			if (option_verbosity >= 0)
+				fprintf(stderr, _("Fetching bundle %s\n"), uri);
+			if (run_command(&cmd)) {
+				warning(_("could not download bundle %s"), uri);
+				free(path);
+				continue;
+			}
+		} else
+			path = xstrdup(uri);
+
+		if (apply_bundle(path, i))
+			warning(_("could not use bundle %s"), uri);
+		else
+			applied++;
+		if (downloaded)
+			unlink_or_warn(path);
+		free(path);
+	}
+	return applied;
+}
+
+static int collect_bundle_ref(const char *refname, const struct object_id *oid,
+			      int flags, void *cb_data)
+{
+	string_list_append(cb_data, refname);
+	return 0;
+}
+
+static void remove_bundle_refs(void)
+{
+	struct string_list refs = STRING_LIST_INIT_DUP;
+	int i;
+
+	for_each_ref_in("refs/bundles/", collect_bundle_ref, &refs);
+	for (i = 0; i < refs.nr; i++)
+		delete_ref(mkpath("refs/bundles/%s", refs.items[i].string),
+			   NULL, 0);
+	string_list_clear(&refs, 0);
+}
+
 static void update_head(const struct ref *our, const struct ref *remote,
 			const char *msg)
 {
@@ -667,6 +950,24 @@ static int write_one_config(const char *key, const char *value, void *data)
 	return git_config_set_multivar(key, value ? value : "true", "^$", 0);
 }
 
+/*
+ * Mark the new repository as a partial clone of "origin", so that the
+ * objects the filter leaves out are fetched from there when needed.
+ */
+static void partial_clone_register(const char *origin)
+{
+	struct strbuf key = STRBUF_INIT;
+
+	git_config_set("core.repositoryformatversion", "1");
+	git_config_set("extensions.partialclone", origin);
+	strbuf_addf(&key, "remote.%s.partialclonefilter", origin);
+	git_config_set(key.buf, filter_options.filter_spec);
+	strbuf_release(&key);
+
+	free(repository_format_partial_clone);
+	repository_format_partial_clone = xstrdup(origin);
+}
+
 static void write_config(struct string_list *config)
 {
 	int i;
@@ -742,7 +1043,7 @@ static void dissociate_from_references(void)
 
 int cmd_clone(int argc, const char **argv, const char *prefix)
 {
-	int is_bundle = 0, is_local;
+	int is_bundle = 0, is_local, bundles_applied = 0;
 	struct stat buf;
 	const char *repo_name, *repo, *work_tree, *git_dir;
 	char *path, *dir;
@@ -761,6 +1062,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 
 	struct refspec *refspec;
 	const char *fetch_pattern;
+	struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
 
 	packet_trace_identity("clone");
 	argc = parse_options(argc, argv, prefix, builtin_clone_options,
@@ -774,6 +1076,10 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		usage_msg_opt(_("You must specify a repository to clone."),
 			builtin_clone_usage, builtin_clone_options);
 
+	if (option_ref_format && strcmp(option_ref_format, "files") &&
+	    strcmp(option_ref_format, "reftable"))
+		die(_("unknown ref storage format '%s'"), option_ref_format);
+
 	if (option_single_branch == -1)
 		option_single_branch = option_depth ? 1 : 0;
 
@@ -864,7 +1170,9 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		else
 			fprintf(stderr, _("Cloning into '%s'...\n"), dir);
 	}
-	init_db(option_template, INIT_DB_QUIET);
+	init_db(option_template, INIT_DB_QUIET |
+		(option_ref_format && !strcmp(option_ref_format, "reftable") ?
+		 INIT_DB_REFTABLE : 0));
 	write_config(&option_config);
 
 	git_config(git_default_config, NULL);
@@ -905,6 +1213,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	if (is_local) {
 		if (option_depth)
 			warning(_("--depth is ignored in local clones; use file:// instead."));
+		if (filter_options.choice)
+			warning(_("--filter is ignored in local clones; use file:// instead."));
 		if (!access(mkpath("%s/shallow", path), F_OK)) {
 			if (option_local > 0)
 				warning(_("source repository is shallow, ignoring --local"));
@@ -930,10 +1240,27 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 		transport_set_option(transport, TRANS_OPT_UPLOADPACK,
 				     option_upload_pack);
 
-	if (transport->smart_options && !option_depth)
+	if (filter_options.choice && !is_local) {
+		transport_set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER,
+				     filter_options.filter_spec);
+		partial_clone_register(option_origin);
+	}
+
+	if (transport->smart_options && !option_depth && !filter_options.choice)
 		transport->smart_options->check_self_contained_and_connected = 1;
 
-	refs = transport_get_remote_refs(transport);
+	argv_array_push(&ref_prefixes, "HEAD");
+	refspec_ref_prefixes(refspec, &ref_prefixes);
+	argv_array_push(&ref_prefixes, "refs/tags/");
+	refs = transport_get_remote_refs(transport, &ref_prefixes);
+	argv_array_clear(&ref_prefixes);
+
+	if (refs && !is_local && apply_bundle_uris()) {
+		bundles_applied = 1;
+		/* the pack we fetch now builds on the bundles */
+		if (transport->smart_options)
+			transport->smart_options->check_self_contained_and_connected = 0;
+	}
 
 	if (refs) {
 		mapped_refs = wanted_peer_refs(refs, refspec);
@@ -997,6 +1324,8 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 
 	update_remote_refs(refs, mapped_refs, remote_head_points_at,
 			   branch_top.buf, reflog_msg.buf, transport, !is_local);
+	if (bundles_applied)
+		remove_bundle_refs();
 
 	update_head(our_head_points_at, remote_head, reflog_msg.buf);
 
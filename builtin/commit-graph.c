@@ -0,0 +1,51 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "commit-graph.h"
+
+static const char * const commit_graph_usage[] = {
+	N_("git commit-graph [--object-dir=<dir>] [--[no-]changed-paths] (write | verify | clear)"),
+	NULL
+};
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	const char *object_dir = NULL;
+	int changed_paths = -1;
+	const struct option options[] = {
+		OPT_FILENAME(0, "object-dir", &object_dir,
+			N_("object directory to store the commit-graph in")),
+		OPT_BOOL(0, "changed-paths", &changed_paths,
+			N_("write changed-path Bloom filters")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     commit_graph_usage, 0);
+	if (argc != 1)
+		usage_with_options(commit_graph_usage, options);
+
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	/* always look at the commit objects themselves, not an old graph */
+	core_commit_graph = 0;
+
+	if (!strcmp(argv[0], "write")) {
+		/* keep the filters of the existing file unless told otherwise */
+		if (changed_paths < 0)
+			changed_paths = commit_graph_has_changed_paths(object_dir);
+		return !!write_commit_graph(object_dir, changed_paths ?
+					    COMMIT_GRAPH_CHANGED_PATHS : 0);
+	}
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_commit_graph(object_dir);
+	if (!strcmp(argv[0], "clear")) {
+		clear_commit_graph(object_dir);
+		return 0;
+	}
+
+	usage_with_options(commit_graph_usage, options);
+}
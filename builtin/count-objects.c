@@ -8,6 +8,10 @@
 #include "dir.h"
 #include "builtin.h"
 #include "parse-options.h"
+#include "pack.h"
+#include "pack-revindex.h"
+#include "pack-sizes.h"
+#include "prio-queue.h"
 
 static unsigned long garbage;
 static off_t size_garbage;
@@ -51,18 +55,289 @@ static int count_cruft(const char *basename, const char *path, void *data)
 	return 0;
 }
 
+struct type_stats {
+	unsigned long objects, deltas;
+	uintmax_t disk, inflated;
+};
+
+struct pack_stats {
+	struct type_stats types[OBJ_TAG + 1];
+	unsigned long *depths;
+	uint32_t max_depth;
+};
+
+static struct pack_stats total_stats;
+
+struct stats_pack {
+	struct packed_git *pack;
+	/* on-disk size of each object, in index order */
+	unsigned long *disk;
+	/* next object to merge when looking for duplicates */
+	uint32_t next;
+	const unsigned char *sha1;
+};
+
+static struct stats_pack *stats_packs;
+static int stats_packs_nr, stats_packs_alloc;
+
+static void count_depth(struct pack_stats *stats, uint32_t depth)
+{
+	if (depth >= stats->max_depth) {
+		uint32_t old = stats->max_depth;
+		stats->max_depth = depth + 1;
+		REALLOC_ARRAY(stats->depths, stats->max_depth);
+		memset(stats->depths + old, 0,
+		       (stats->max_depth - old) * sizeof(*stats->depths));
+	}
+	stats->depths[depth]++;
+}
+
+static void print_pack_stats(const char *name, struct pack_stats *stats)
+{
+	int type;
+	uint32_t depth;
+
+	for (type = OBJ_COMMIT; type <= OBJ_TAG; type++) {
+		struct type_stats *t = &stats->types[type];
+		printf("type %s %s %lu %lu %"PRIuMAX" %"PRIuMAX"\n",
+		       name, typename(type), t->objects, t->deltas,
+		       t->disk, t->inflated);
+	}
+	for (depth = 0; depth < stats->max_depth; depth++)
+		if (stats->depths[depth])
+			printf("depth %s %"PRIu32" %lu\n",
+			       name, depth, stats->depths[depth]);
+}
+
+#define DEPTH_UNKNOWN ((uint32_t)-1)
+
+/*
+ * Gather the statistics of one pack from the object headers alone.
+ * The inflated size of a delta comes from the .sizes table if there
+ * is one, and from the header of the delta data otherwise; its type
+ * and depth are those of its base.
+ */
+static void count_pack(struct packed_git *p)
+{
+	struct pack_window *w_curs = NULL;
+	struct pack_stats stats;
+	struct stats_pack *sp;
+	uint32_t i, nr;
+	uint32_t *base, *depth, *stack;
+	unsigned char *type;
+	unsigned long *inflated;
+	int have_sizes;
+	const char *name;
+
+	if (open_pack_index(p))
+		return;
+	if (load_pack_revindex(p) || !is_pack_valid(p)) {
+		error("unable to read pack %s", p->pack_name);
+		return;
+	}
+	have_sizes = !load_pack_sizes(p);
+	nr = p->num_objects;
+
+	ALLOC_GROW(stats_packs, stats_packs_nr + 1, stats_packs_alloc);
+	sp = &stats_packs[stats_packs_nr++];
+	memset(sp, 0, sizeof(*sp));
+	sp->pack = p;
+	sp->disk = xmalloc(nr * sizeof(*sp->disk));
+
+	base = xmalloc(nr * sizeof(*base));
+	depth = xmalloc(nr * sizeof(*depth));
+	type = xmalloc(nr);
+	inflated = xmalloc(nr * sizeof(*inflated));
+
+	for (i = 0; i < nr; i++) {
+		off_t offset = pack_pos_to_offset(p, i);
+		off_t curpos = offset;
+		uint32_t index_pos = pack_pos_to_index(p, i);
+		enum object_type in_pack_type;
+		unsigned long size;
+
+		sp->disk[index_pos] = pack_pos_to_offset(p, i + 1) - offset;
+		in_pack_type = unpack_object_header(p, &w_curs, &curpos, &size);
+
+		if (in_pack_type == OBJ_OFS_DELTA ||
+		    in_pack_type == OBJ_REF_DELTA) {
+			off_t base_offset = get_delta_base(p, &w_curs, &curpos,
+							   in_pack_type, offset);
+
+			if (!base_offset ||
+			    offset_to_pack_pos(p, base_offset, &base[i]))
+				die("cannot find the delta base of the object at "
+				    "offset %"PRIuMAX" in %s",
+				    (uintmax_t)offset, p->pack_name);
+			/* the size in the header is that of the delta data */
+			if (!have_sizes ||
+			    pack_sizes_lookup(p, index_pos, NULL, NULL, &size))
+				size = get_size_from_delta(p, &w_curs, curpos);
+			depth[i] = DEPTH_UNKNOWN;
+		} else if (in_pack_type >= OBJ_COMMIT && in_pack_type <= OBJ_TAG) {
+			base[i] = i;
+			depth[i] = 0;
+			type[i] = in_pack_type;
+		} else {
+			die("unknown object type %d at offset %"PRIuMAX" in %s",
+			    in_pack_type, (uintmax_t)offset, p->pack_name);
+		}
+		inflated[i] = size;
+	}
+	unuse_pack(&w_curs);
+
+	/*
+	 * Resolve the depth and type of the deltas by following their
+	 * chains down to the first object we know about.
+	 */
+	stack = xmalloc(nr * sizeof(*stack));
+	for (i = 0; i < nr; i++) {
+		uint32_t top = 0, pos = i;
+
+		while (depth[pos] == DEPTH_UNKNOWN) {
+			if (top == nr)
+				die("delta chain loop in %s", p->pack_name);
+			stack[top++] = pos;
+			pos = base[pos];
+		}
+		while (top--) {
+			uint32_t delta = stack[top];
+			depth[delta] = depth[base[delta]] + 1;
+			type[delta] = type[base[delta]];
+		}
+	}
+	free(stack);
+
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < nr; i++) {
+		struct type_stats *t = &stats.types[type[i]];
+		unsigned long disk = sp->disk[pack_pos_to_index(p, i)];
+
+		t->objects++;
+		if (depth[i])
+			t->deltas++;
+		t->disk += disk;
+		t->inflated += inflated[i];
+		count_depth(&stats, depth[i]);
+
+		t = &total_stats.types[type[i]];
+		t->objects++;
+		if (depth[i])
+			t->deltas++;
+		t->disk += disk;
+		t->inflated += inflated[i];
+		count_depth(&total_stats, depth[i]);
+	}
+
+	name = strrchr(p->pack_name, '/');
+	name = name ? name + 1 : p->pack_name;
+	printf("pack %s %"PRIu32" %"PRIuMAX" %"PRIuMAX"\n", name, nr,
+	       (uintmax_t)p->pack_size, (uintmax_t)p->index_size);
+	print_pack_stats(name, &stats);
+	fflush(stdout);
+
+	free(stats.depths);
+	free(base);
+	free(depth);
+	free(type);
+	free(inflated);
+}
+
+static int compare_next_sha1(const void *a_, const void *b_, void *unused)
+{
+	const struct stats_pack *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static void advance(struct stats_pack *sp, struct prio_queue *queue)
+{
+	if (sp->next >= sp->pack->num_objects)
+		return;
+	sp->sha1 = nth_packed_object_sha1(sp->pack, sp->next);
+	prio_queue_put(queue, sp);
+}
+
+/*
+ * Merge the sorted indexes of all packs to find the objects that are
+ * in more than one of them; the copies beyond the smallest one count
+ * as duplicates.
+ */
+static void count_duplicates(void)
+{
+	struct prio_queue queue = { compare_next_sha1 };
+	struct stats_pack *sp;
+	const unsigned char *last = NULL;
+	unsigned long copies = 0, objects = 0;
+	uintmax_t sum = 0, min = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < stats_packs_nr; i++)
+		advance(&stats_packs[i], &queue);
+
+	while ((sp = prio_queue_get(&queue))) {
+		unsigned long disk = sp->disk[sp->next];
+
+		if (!last || hashcmp(last, sp->sha1)) {
+			if (copies > 1) {
+				objects += copies - 1;
+				bytes += sum - min;
+			}
+			last = sp->sha1;
+			copies = 0;
+			sum = 0;
+			min = disk;
+		}
+		copies++;
+		sum += disk;
+		if (disk < min)
+			min = disk;
+		sp->next++;
+		advance(sp, &queue);
+	}
+	if (copies > 1) {
+		objects += copies - 1;
+		bytes += sum - min;
+	}
+	clear_prio_queue(&queue);
+
+	printf("duplicates %lu %"PRIuMAX"\n", objects, bytes);
+}
+
+static void count_packs(void)
+{
+	struct packed_git *p;
+	int i;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		count_pack(p);
+	}
+	print_pack_stats("total", &total_stats);
+	count_duplicates();
+
+	for (i = 0; i < stats_packs_nr; i++)
+		free(stats_packs[i].disk);
+	free(stats_packs);
+	free(total_stats.depths);
+}
+
 static char const * const count_objects_usage[] = {
 	N_("git count-objects [-v] [-H | --human-readable]"),
+	N_("git count-objects --pack-stats"),
 	NULL
 };
 
 int cmd_count_objects(int argc, const char **argv, const char *prefix)
 {
-	int human_readable = 0;
+	int human_readable = 0, pack_stats = 0;
 	struct option opts[] = {
 		OPT__VERBOSE(&verbose, N_("be verbose")),
 		OPT_BOOL('H', "human-readable", &human_readable,
 			 N_("print sizes in human readable format")),
+		OPT_BOOL(0, "pack-stats", &pack_stats,
+			 N_("print statistics of the objects in each pack")),
 		OPT_END(),
 	};
 
@@ -70,6 +345,12 @@ int cmd_count_objects(int argc, const char **argv, const char *prefix)
 	/* we do not take arguments other than flags for now */
 	if (argc)
 		usage_with_options(count_objects_usage, opts);
+	if (pack_stats) {
+		if (verbose || human_readable)
+			die(_("--pack-stats cannot be used with -v or -H"));
+		count_packs();
+		return 0;
+	}
 	if (verbose) {
 		report_garbage = real_report_garbage;
 		report_linked_checkout_garbage();
@@ -9,6 +9,8 @@
 #include "diff.h"
 #include "hashmap.h"
 #include "argv-array.h"
+#include "commit-graph.h"
+#include "append-cache.h"
 
 #define SEEN		(1u << 0)
 #define MAX_TAGS	(FLAG_BITS - 1)
@@ -31,6 +33,7 @@ static int have_util;
 static const char *pattern;
 static int always;
 static const char *dirty;
+static uint32_t min_name_generation;
 
 /* diff-index command arguments to check if working tree is dirty. */
 static const char *diff_index_args[] = {
@@ -235,6 +238,111 @@ static void show_suffix(int depth, const unsigned char *sha1)
 	printf("-%d-g%s", depth, find_unique_abbrev(sha1, abbrev));
 }
 
+/*
+ * With describe.cache, the answers for commits that are not tagged
+ * themselves are remembered in $GIT_DIR/describe-cache.  Its validity
+ * string names the set of candidate names and the options that affect
+ * the search, so the whole file is started anew when the tags change;
+ * the value for a described commit is the peeled name of the tag
+ * chosen for it and the depth.
+ */
+static int use_describe_cache;
+static struct append_cache describe_cache;
+static char describe_cache_key[41];
+
+static int commit_name_peeled_cmp(const void *a_, const void *b_)
+{
+	const struct commit_name *a = *(const struct commit_name **)a_;
+	const struct commit_name *b = *(const struct commit_name **)b_;
+	return hashcmp(a->peeled, b->peeled);
+}
+
+static void compute_describe_cache_key(void)
+{
+	struct commit_name **list;
+	struct hashmap_iter iter;
+	struct commit_name *n;
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	int i, nr = 0;
+
+	list = xmalloc(names.size * sizeof(*list));
+	for (n = hashmap_iter_first(&names, &iter); n; n = hashmap_iter_next(&iter))
+		list[nr++] = n;
+	qsort(list, nr, sizeof(*list), commit_name_peeled_cmp);
+
+	git_SHA1_Init(&ctx);
+	strbuf_addf(&buf, "all=%d tags=%d first-parent=%d candidates=%d match=%s\n",
+		    all, tags, first_parent, max_candidates,
+		    pattern ? pattern : "");
+	git_SHA1_Update(&ctx, buf.buf, buf.len);
+	for (i = 0; i < nr; i++) {
+		strbuf_reset(&buf);
+		strbuf_addf(&buf, "%s %s %d %s\n", sha1_to_hex(list[i]->peeled),
+			    sha1_to_hex(list[i]->sha1), list[i]->prio,
+			    list[i]->path);
+		git_SHA1_Update(&ctx, buf.buf, buf.len);
+	}
+	git_SHA1_Final(sha1, &ctx);
+	memcpy(describe_cache_key, sha1_to_hex(sha1), sizeof(describe_cache_key));
+
+	strbuf_release(&buf);
+	free(list);
+}
+
+static void prepare_describe_cache(void)
+{
+	compute_describe_cache_key();
+	append_cache_init(&describe_cache, git_path("describe-cache"),
+			  describe_cache_key);
+}
+
+static int lookup_describe_cache(const unsigned char *commit,
+				 unsigned char *peeled, int *depth)
+{
+	const char *value = append_cache_get(&describe_cache,
+					     sha1_to_hex(commit));
+	char *p;
+	long l;
+
+	if (!value || get_sha1_hex(value, peeled) || value[40] != ' ')
+		return -1;
+	l = strtol(value + 41, &p, 10);
+	if (*p || l <= 0 || l > INT_MAX)
+		return -1;
+	*depth = l;
+	return 0;
+}
+
+static void store_describe_cache(const unsigned char *commit,
+				 const unsigned char *peeled, int depth)
+{
+	struct strbuf value = STRBUF_INIT;
+
+	strbuf_addf(&value, "%s %d", sha1_to_hex(peeled), depth);
+	append_cache_put(&describe_cache, sha1_to_hex(commit), value.buf);
+	strbuf_release(&value);
+}
+
+/*
+ * Can the walk in describe() stop before it runs out of commits?  Only
+ * once no commit left in "list" can reach any of the names (which the
+ * generation numbers tell us), and every one of them is already known
+ * to be reachable from all the matches found so far, so that the walk
+ * cannot change any of their depths anymore.
+ */
+static int search_is_finished(struct commit_list *list, int nr_above,
+			      unsigned flags)
+{
+	if (nr_above)
+		return 0;
+	for (; list; list = list->next)
+		if ((list->item->object.flags & flags) != flags)
+			return 0;
+	return 1;
+}
+
 static void describe(const char *arg, int last_one)
 {
 	unsigned char sha1[20];
@@ -245,6 +353,7 @@ static void describe(const char *arg, int last_one)
 	unsigned int match_cnt = 0, annotated_cnt = 0, cur_match;
 	unsigned long seen_commits = 0;
 	unsigned int unannotated_cnt = 0;
+	unsigned int nr_above = 0, match_flags = 0;
 
 	if (get_sha1(arg, sha1))
 		die(_("Not a valid object name %s"), arg);
@@ -268,6 +377,22 @@ static void describe(const char *arg, int last_one)
 
 	if (!max_candidates)
 		die(_("no tag exactly matches '%s'"), sha1_to_hex(cmit->object.sha1));
+	if (use_describe_cache) {
+		unsigned char peeled[20];
+		int depth;
+
+		if (!lookup_describe_cache(cmit->object.sha1, peeled, &depth) &&
+		    (n = find_commit_name(peeled))) {
+			display_name(n);
+			if (abbrev)
+				show_suffix(depth, cmit->object.sha1);
+			if (dirty)
+				printf("%s", dirty);
+			printf("\n");
+			return;
+		}
+	}
+
 	if (debug)
 		fprintf(stderr, _("searching to describe %s\n"), arg);
 
@@ -275,10 +400,20 @@ static void describe(const char *arg, int last_one)
 		struct hashmap_iter iter;
 		struct commit *c;
 		struct commit_name *n = hashmap_iter_first(&names, &iter);
+
+		/*
+		 * Without generation numbers, leave min_name_generation
+		 * at zero so that no commit is ever below it.
+		 */
+		if (generation_numbers_enabled())
+			min_name_generation = GENERATION_NUMBER_INFINITY;
 		for (; n; n = hashmap_iter_next(&iter)) {
 			c = lookup_commit_reference_gently(n->peeled, 1);
-			if (c)
+			if (c) {
 				c->util = n;
+				if (c->generation < min_name_generation)
+					min_name_generation = c->generation;
+			}
 		}
 		have_util = 1;
 	}
@@ -286,9 +421,22 @@ static void describe(const char *arg, int last_one)
 	list = NULL;
 	cmit->object.flags = SEEN;
 	commit_list_insert(cmit, &list);
+	if (cmit->generation >= min_name_generation)
+		nr_above++;
 	while (list) {
-		struct commit *c = pop_commit(&list);
-		struct commit_list *parents = c->parents;
+		struct commit *c;
+		struct commit_list *parents;
+
+		if (search_is_finished(list, nr_above, match_flags)) {
+			if (debug)
+				fprintf(stderr, _("no more names reachable from %s\n"),
+					sha1_to_hex(list->item->object.sha1));
+			break;
+		}
+		c = pop_commit(&list);
+		parents = c->parents;
+		if (c->generation >= min_name_generation)
+			nr_above--;
 		seen_commits++;
 		n = c->util;
 		if (n) {
@@ -301,6 +449,7 @@ static void describe(const char *arg, int last_one)
 				t->flag_within = 1u << match_cnt;
 				t->found_order = match_cnt;
 				c->object.flags |= t->flag_within;
+				match_flags |= t->flag_within;
 				if (n->prio == 2)
 					annotated_cnt++;
 			}
@@ -323,8 +472,11 @@ static void describe(const char *arg, int last_one)
 		while (parents) {
 			struct commit *p = parents->item;
 			parse_commit(p);
-			if (!(p->object.flags & SEEN))
+			if (!(p->object.flags & SEEN)) {
 				commit_list_insert_by_date(p, &list);
+				if (p->generation >= min_name_generation)
+					nr_above++;
+			}
 			p->object.flags |= c->object.flags;
 			parents = parents->next;
 
@@ -385,6 +537,11 @@ static void describe(const char *arg, int last_one)
 		printf("%s", dirty);
 	printf("\n");
 
+	if (use_describe_cache)
+		store_describe_cache(cmit->object.sha1,
+				     all_matches[0].name->peeled,
+				     all_matches[0].depth);
+
 	if (!last_one)
 		clear_commit_marks(cmit, -1);
 }
@@ -416,6 +573,8 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 
 	git_config(git_default_config, NULL);
 	argc = parse_options(argc, argv, prefix, options, describe_usage, 0);
+	if (git_config_get_bool("describe.cache", &use_describe_cache))
+		use_describe_cache = 0;
 	if (abbrev < 0)
 		abbrev = DEFAULT_ABBREV;
 
@@ -455,6 +614,13 @@ int cmd_describe(int argc, const char **argv, const char *prefix)
 	if (!names.size && !always)
 		die(_("No names found, cannot describe anything."));
 
+	/* grafts and replacements change the answers behind our back */
+	if (use_describe_cache && (debug || !max_candidates ||
+				   !commit_graph_compatible()))
+		use_describe_cache = 0;
+	if (use_describe_cache)
+		prepare_describe_cache();
+
 	if (argc == 0) {
 		if (dirty) {
 			static struct lock_file index_lock;
@@ -12,7 +12,7 @@
 #include "diffcore.h"
 #include "log-tree.h"
 #include "revision.h"
-#include "decorate.h"
+#include "object-slab.h"
 #include "string-list.h"
 #include "utf8.h"
 #include "parse-options.h"
@@ -69,9 +69,14 @@ static int parse_opt_tag_of_filtered_mode(const struct option *opt,
 	return 0;
 }
 
-static struct decoration idnums;
+define_object_slab(idnums, uint32_t);
+static struct idnums idnums = OBJECT_SLAB_INIT(1, idnums);
 static uint32_t last_idnum;
 
+/* the objects with a mark, for --export-marks */
+static struct object **marked_objects;
+static int marked_objects_nr, marked_objects_alloc;
+
 static int has_unshown_parent(struct commit *commit)
 {
 	struct commit_list *parent;
@@ -153,20 +158,16 @@ static void anonymize_path(struct strbuf *out, const char *path,
 	}
 }
 
-/* Since intptr_t is C99, we do not use it here */
-static inline uint32_t *mark_to_ptr(uint32_t mark)
-{
-	return ((uint32_t *)NULL) + mark;
-}
-
-static inline uint32_t ptr_to_mark(void * mark)
-{
-	return (uint32_t *)mark - (uint32_t *)NULL;
-}
-
 static inline void mark_object(struct object *object, uint32_t mark)
 {
-	add_decoration(&idnums, object, mark_to_ptr(mark));
+	uint32_t *slot = idnums_at(&idnums, object);
+
+	if (!*slot) {
+		ALLOC_GROW(marked_objects, marked_objects_nr + 1,
+			   marked_objects_alloc);
+		marked_objects[marked_objects_nr++] = object;
+	}
+	*slot = mark;
 }
 
 static inline void mark_next_object(struct object *object)
@@ -176,10 +177,8 @@ static inline void mark_next_object(struct object *object)
 
 static int get_object_mark(struct object *object)
 {
-	void *decoration = lookup_decoration(&idnums, object);
-	if (!decoration)
-		return 0;
-	return ptr_to_mark(decoration);
+	uint32_t *mark = idnums_peek(&idnums, object);
+	return mark ? *mark : 0;
 }
 
 static void show_progress(void)
@@ -561,11 +560,11 @@ static void handle_commit(struct commit *commit, struct rev_info *rev)
 	    get_object_mark(&commit->parents->item->object) != 0 &&
 	    !full_tree) {
 		parse_commit_or_die(commit->parents->item);
-		diff_tree_sha1(commit->parents->item->tree->object.sha1,
-			       commit->tree->object.sha1, "", &rev->diffopt);
+		diff_tree_sha1(get_commit_tree_sha1(commit->parents->item),
+			       get_commit_tree_sha1(commit), "", &rev->diffopt);
 	}
 	else
-		diff_root_tree_sha1(commit->tree->object.sha1,
+		diff_root_tree_sha1(get_commit_tree_sha1(commit),
 				    "", &rev->diffopt);
 
 	/* Export the referenced blobs, and remember the marks. */
@@ -873,9 +872,7 @@ static void handle_tags_and_duplicates(void)
 
 static void export_marks(char *file)
 {
-	unsigned int i;
-	uint32_t mark;
-	struct object_decoration *deco = idnums.hash;
+	int i;
 	FILE *f;
 	int e = 0;
 
@@ -883,16 +880,16 @@ static void export_marks(char *file)
 	if (!f)
 		die_errno("Unable to open marks file %s for writing.", file);
 
-	for (i = 0; i < idnums.size; i++) {
-		if (deco->base && deco->base->type == 1) {
-			mark = ptr_to_mark(deco->decoration);
-			if (fprintf(f, ":%"PRIu32" %s\n", mark,
-				sha1_to_hex(deco->base->sha1)) < 0) {
-			    e = 1;
-			    break;
-			}
+	for (i = 0; i < marked_objects_nr; i++) {
+		struct object *object = marked_objects[i];
+
+		if (object->type != OBJ_COMMIT)
+			continue;
+		if (fprintf(f, ":%"PRIu32" %s\n", *idnums_at(&idnums, object),
+			    sha1_to_hex(object->sha1)) < 0) {
+			e = 1;
+			break;
 		}
-		deco++;
 	}
 
 	e |= ferror(f);
@@ -8,6 +8,8 @@
 static const char fetch_pack_usage[] =
 "git fetch-pack [--all] [--stdin] [--quiet | -q] [--keep | -k] [--thin] "
 "[--include-tag] [--upload-pack=<git-upload-pack>] [--depth=<n>] "
+"[--filter=<filter-spec>] [--no-dependents] "
+"[--negotiate-only --negotiation-tip=<commit>...] "
 "[--no-progress] [--diag-url] [-v] [<host>:]<directory> [<refs>...]";
 
 static void add_sought_entry_mem(struct ref ***sought, int *nr, int *alloc,
@@ -48,6 +50,8 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 	struct child_process *conn;
 	struct fetch_pack_args args;
 	struct sha1_array shallow = SHA1_ARRAY_INIT;
+	struct sha1_array negotiation_tips = SHA1_ARRAY_INIT;
+	struct sha1_array common = SHA1_ARRAY_INIT;
 
 	packet_trace_identity("fetch-pack");
 
@@ -127,6 +131,26 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 			args.update_shallow = 1;
 			continue;
 		}
+		if (skip_prefix(arg, "--filter=", &arg)) {
+			if (parse_list_objects_filter(&args.filter_options, arg))
+				usage(fetch_pack_usage);
+			continue;
+		}
+		if (!strcmp("--no-dependents", arg)) {
+			args.no_dependents = 1;
+			continue;
+		}
+		if (!strcmp("--negotiate-only", arg)) {
+			args.negotiate_only = 1;
+			continue;
+		}
+		if (skip_prefix(arg, "--negotiation-tip=", &arg)) {
+			unsigned char sha1[20];
+			if (get_sha1_commit(arg, sha1))
+				die("not a valid commit: %s", arg);
+			sha1_array_append(&negotiation_tips, sha1);
+			continue;
+		}
 		usage(fetch_pack_usage);
 	}
 
@@ -134,6 +158,14 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 		dest = argv[i++];
 	else
 		usage(fetch_pack_usage);
+	if (args.negotiate_only) {
+		if (i < argc || args.stdin_refs || args.depth > 0)
+			usage(fetch_pack_usage);
+		/* any of their refs will do for the want */
+		args.fetch_all = 1;
+		args.negotiation_tips = &negotiation_tips;
+		args.common = &common;
+	}
 
 	/*
 	 * Copy refs from cmdline to growable list, then append any
@@ -170,12 +202,28 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 		int flags = args.verbose ? CONNECT_VERBOSE : 0;
 		if (args.diag_url)
 			flags |= CONNECT_DIAG_URL;
+		if (get_protocol_version_config() == protocol_v2)
+			flags |= CONNECT_PROTOCOL_V2;
 		conn = git_connect(fd, dest, args.uploadpack,
 				   flags);
 		if (!conn)
 			return args.diag_url ? 0 : 1;
 	}
 	get_remote_heads(fd[0], NULL, 0, &ref, 0, NULL, &shallow);
+	if (server_protocol_version() == protocol_v2) {
+		args.protocol_v2 = 1;
+		if (args.stateless_rpc)
+			/* the helper passes on the refs it listed */
+			read_ls_refs_v2(fd[0], NULL, 0, &ref, 0, &shallow);
+		else {
+			struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+
+			for (i = 0; !args.fetch_all && i < nr_sought; i++)
+				argv_array_push(&ref_prefixes, sought[i]->name);
+			ls_refs_v2(fd, &ref, 0, &ref_prefixes, &shallow);
+			argv_array_clear(&ref_prefixes);
+		}
+	}
 
 	ref = fetch_pack(&args, fd, conn, ref, dest, sought, nr_sought,
 			 &shallow, pack_lockfile_ptr);
@@ -193,6 +241,12 @@ int cmd_fetch_pack(int argc, const char **argv, const char *prefix)
 	if (finish_connect(conn))
 		return 1;
 
+	if (args.negotiate_only) {
+		for (i = 0; i < common.nr; i++)
+			printf("%s\n", sha1_to_hex(common.sha1[i]));
+		return 0;
+	}
+
 	ret = !ref;
 
 	/*
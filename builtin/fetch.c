@@ -6,6 +6,7 @@
 #include "commit.h"
 #include "builtin.h"
 #include "string-list.h"
+#include "strmap.h"
 #include "remote.h"
 #include "transport.h"
 #include "run-command.h"
@@ -14,6 +15,7 @@
 #include "submodule.h"
 #include "connected.h"
 #include "argv-array.h"
+#include "list-objects-filter.h"
 
 static const char * const builtin_fetch_usage[] = {
 	N_("git fetch [<options>] [<repository> [<refspec>...]]"),
@@ -35,6 +37,7 @@ static int prune = -1; /* unspecified */
 
 static int all, append, dry_run, force, keep, multiple, update_head_ok, verbosity;
 static int progress = -1, recurse_submodules = RECURSE_SUBMODULES_DEFAULT;
+static int max_children = -1;
 static int tags = TAGS_DEFAULT, unshallow, update_shallow;
 static const char *depth;
 static const char *upload_pack;
@@ -46,6 +49,7 @@ static const char *recurse_submodules_default;
 static int shown_url = 0;
 static int refmap_alloc, refmap_nr;
 static const char **refmap_array;
+static struct list_objects_filter_options filter_options;
 
 static int option_parse_recurse_submodules(const struct option *opt,
 				   const char *arg, int unset)
@@ -94,6 +98,8 @@ static struct option builtin_fetch_options[] = {
 	OPT__FORCE(&force, N_("force overwrite of local branch")),
 	OPT_BOOL('m', "multiple", &multiple,
 		 N_("fetch from multiple remotes")),
+	OPT_INTEGER('j', "jobs", &max_children,
+		    N_("number of submodules fetched in parallel")),
 	OPT_SET_INT('t', "tags", &tags,
 		    N_("fetch all tags and associated objects"), TAGS_SET),
 	OPT_SET_INT('n', NULL, &tags,
@@ -123,6 +129,7 @@ static struct option builtin_fetch_options[] = {
 		 N_("accept refs that update .git/shallow")),
 	{ OPTION_CALLBACK, 0, "refmap", NULL, N_("refmap"),
 	  N_("specify fetch refmap"), PARSE_OPT_NONEG, parse_refmap_arg },
+	OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 	OPT_END()
 };
 
@@ -182,12 +189,11 @@ static void add_merge_config(struct ref **head,
 static int add_existing(const char *refname, const struct object_id *oid,
 			int flag, void *cbdata)
 {
-	struct string_list *list = (struct string_list *)cbdata;
-	struct string_list_item *item = string_list_insert(list, refname);
+	struct strmap *existing = cbdata;
 	struct object_id *old_oid = xmalloc(sizeof(*old_oid));
 
 	oidcpy(old_oid, oid);
-	item->util = old_oid;
+	free(strmap_put(existing, refname, old_oid));
 	return 0;
 }
 
@@ -206,13 +212,14 @@ static void find_non_local_tags(struct transport *transport,
 			struct ref **head,
 			struct ref ***tail)
 {
-	struct string_list existing_refs = STRING_LIST_INIT_DUP;
+	struct strmap existing_refs;
 	struct string_list remote_refs = STRING_LIST_INIT_NODUP;
 	const struct ref *ref;
 	struct string_list_item *item = NULL;
 
+	strmap_init(&existing_refs, 1);
 	for_each_ref(add_existing, &existing_refs);
-	for (ref = transport_get_remote_refs(transport); ref; ref = ref->next) {
+	for (ref = transport_get_remote_refs(transport, NULL); ref; ref = ref->next) {
 		if (!starts_with(ref->name, "refs/tags/"))
 			continue;
 
@@ -246,13 +253,13 @@ static void find_non_local_tags(struct transport *transport,
 
 		/* skip duplicates and refs that we already have */
 		if (string_list_has_string(&remote_refs, ref->name) ||
-		    string_list_has_string(&existing_refs, ref->name))
+		    strmap_contains(&existing_refs, ref->name))
 			continue;
 
 		item = string_list_insert(&remote_refs, ref->name);
 		item->util = (void *)ref->old_sha1;
 	}
-	string_list_clear(&existing_refs, 1);
+	strmap_clear(&existing_refs, 1);
 
 	/*
 	 * We may have a final lightweight tag that needs to be
@@ -281,6 +288,43 @@ static void find_non_local_tags(struct transport *transport,
 	string_list_clear(&remote_refs, 0);
 }
 
+/*
+ * The refs get_ref_map() can pick from the remote begin with one of
+ * these, so a server that filters its refs need not send the others.
+ */
+static void get_ref_prefixes(struct transport *transport,
+			     struct refspec *refspecs, int refspec_count,
+			     int tags, struct argv_array *ref_prefixes)
+{
+	int i, autotags = 0;
+
+	if (refspec_count) {
+		for (i = 0; i < refspec_count; i++) {
+			refspec_ref_prefixes(&refspecs[i], ref_prefixes);
+			if (refspecs[i].dst && refspecs[i].dst[0])
+				autotags = 1;
+		}
+	} else {
+		struct remote *remote = transport->remote;
+		struct branch *branch = branch_get(NULL);
+		int has_merge = branch_has_merge_config(branch) && remote &&
+			!strcmp(branch->remote_name, remote->name);
+
+		if (!remote || (!remote->fetch_refspec_nr && !has_merge))
+			argv_array_push(ref_prefixes, "HEAD");
+		for (i = 0; remote && i < remote->fetch_refspec_nr; i++) {
+			refspec_ref_prefixes(&remote->fetch[i], ref_prefixes);
+			if (remote->fetch[i].dst && remote->fetch[i].dst[0])
+				autotags = 1;
+		}
+		for (i = 0; has_merge && i < branch->merge_nr; i++)
+			expand_ref_prefix(ref_prefixes, branch->merge[i]->src);
+	}
+
+	if (tags == TAGS_SET || (tags == TAGS_DEFAULT && autotags))
+		argv_array_push(ref_prefixes, "refs/tags/");
+}
+
 static struct ref *get_ref_map(struct transport *transport,
 			       struct refspec *refspecs, int refspec_count,
 			       int tags, int *autotags)
@@ -293,17 +337,27 @@ static struct ref *get_ref_map(struct transport *transport,
 	/* opportunistically-updated references: */
 	struct ref *orefs = NULL, **oref_tail = &orefs;
 
-	const struct ref *remote_refs = transport_get_remote_refs(transport);
+	struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+	const struct ref *remote_refs;
+
+	get_ref_prefixes(transport, refspecs, refspec_count, tags,
+			 &ref_prefixes);
+	remote_refs = transport_get_remote_refs(transport, &ref_prefixes);
+	argv_array_clear(&ref_prefixes);
 
 	if (refspec_count) {
 		struct refspec *fetch_refspec;
 		int fetch_refspec_nr;
 
+		struct fetch_map_index index;
+
+		fetch_map_index_init(&index, remote_refs, refspecs, refspec_count);
 		for (i = 0; i < refspec_count; i++) {
-			get_fetch_map(remote_refs, &refspecs[i], &tail, 0);
+			get_fetch_map_indexed(&index, i, &tail, 0);
 			if (refspecs[i].dst && refspecs[i].dst[0])
 				*autotags = 1;
 		}
+		fetch_map_index_clear(&index);
 		/* Merge everything on the command line (but not --tags) */
 		for (rm = ref_map; rm; rm = rm->next)
 			rm->fetch_head_status = FETCH_HEAD_MERGE;
@@ -336,8 +390,11 @@ static struct ref *get_ref_map(struct transport *transport,
 			fetch_refspec_nr = transport->remote->fetch_refspec_nr;
 		}
 
+		fetch_map_index_init(&index, ref_map, fetch_refspec,
+				     fetch_refspec_nr);
 		for (i = 0; i < fetch_refspec_nr; i++)
-			get_fetch_map(ref_map, &fetch_refspec[i], &oref_tail, 1);
+			get_fetch_map_indexed(&index, i, &oref_tail, 1);
+		fetch_map_index_clear(&index);
 
 		if (tags == TAGS_SET)
 			get_fetch_map(remote_refs, tag_refspec, &tail, 0);
@@ -352,8 +409,12 @@ static struct ref *get_ref_map(struct transport *transport,
 		    (remote->fetch_refspec_nr ||
 		     /* Note: has_merge implies non-NULL branch->remote_name */
 		     (has_merge && !strcmp(branch->remote_name, remote->name)))) {
+			struct fetch_map_index index;
+
+			fetch_map_index_init(&index, remote_refs, remote->fetch,
+					     remote->fetch_refspec_nr);
 			for (i = 0; i < remote->fetch_refspec_nr; i++) {
-				get_fetch_map(remote_refs, &remote->fetch[i], &tail, 0);
+				get_fetch_map_indexed(&index, i, &tail, 0);
 				if (remote->fetch[i].dst &&
 				    remote->fetch[i].dst[0])
 					*autotags = 1;
@@ -361,6 +422,7 @@ static struct ref *get_ref_map(struct transport *transport,
 				    !remote->fetch[0].pattern)
 					ref_map->fetch_head_status = FETCH_HEAD_MERGE;
 			}
+			fetch_map_index_clear(&index);
 			/*
 			 * if the remote we're fetching from is the same
 			 * as given in branch.<name>.remote, we add the
@@ -399,52 +461,132 @@ static struct ref *get_ref_map(struct transport *transport,
 #define STORE_REF_ERROR_OTHER 1
 #define STORE_REF_ERROR_DF_CONFLICT 2
 
-static int s_update_ref(const char *action,
-			struct ref *ref,
-			int check_old)
+/*
+ * While store_updated_refs() runs, the refs it updates are queued into
+ * one transaction, so that they are written together (and, when there
+ * are many, straight into packed-refs) instead of one by one.
+ */
+static struct ref_transaction *transaction;
+static struct queued_ref_update {
+	struct ref *ref;
+	int check_old;
+	char *msg;
+} *queued_updates;
+static int queued_updates_nr, queued_updates_alloc;
+
+static int update_ref_alone(const char *msg, struct ref *ref, int check_old)
 {
-	char msg[1024];
-	char *rla = getenv("GIT_REFLOG_ACTION");
-	struct ref_transaction *transaction;
+	struct ref_transaction *t;
 	struct strbuf err = STRBUF_INIT;
 	int ret, df_conflict = 0;
 
-	if (dry_run)
-		return 0;
-	if (!rla)
-		rla = default_rla.buf;
-	snprintf(msg, sizeof(msg), "%s: %s", rla, action);
-
-	transaction = ref_transaction_begin(&err);
-	if (!transaction ||
-	    ref_transaction_update(transaction, ref->name,
-				   ref->new_sha1,
+	t = ref_transaction_begin(&err);
+	if (!t ||
+	    ref_transaction_update(t, ref->name, ref->new_sha1,
 				   check_old ? ref->old_sha1 : NULL,
 				   0, msg, &err))
 		goto fail;
 
-	ret = ref_transaction_commit(transaction, &err);
+	ret = ref_transaction_commit(t, &err);
 	if (ret) {
 		df_conflict = (ret == TRANSACTION_NAME_CONFLICT);
 		goto fail;
 	}
 
-	ref_transaction_free(transaction);
+	ref_transaction_free(t);
 	strbuf_release(&err);
 	return 0;
 fail:
-	ref_transaction_free(transaction);
+	ref_transaction_free(t);
 	error("%s", err.buf);
 	strbuf_release(&err);
 	return df_conflict ? STORE_REF_ERROR_DF_CONFLICT
 			   : STORE_REF_ERROR_OTHER;
 }
 
+static int s_update_ref(const char *action,
+			struct ref *ref,
+			int check_old)
+{
+	char msg[1024];
+	char *rla = getenv("GIT_REFLOG_ACTION");
+	struct strbuf err = STRBUF_INIT;
+	struct queued_ref_update *queued;
+
+	if (dry_run)
+		return 0;
+	if (!rla)
+		rla = default_rla.buf;
+	snprintf(msg, sizeof(msg), "%s: %s", rla, action);
+
+	if (!transaction)
+		return update_ref_alone(msg, ref, check_old);
+
+	if (ref_transaction_update(transaction, ref->name, ref->new_sha1,
+				   check_old ? ref->old_sha1 : NULL,
+				   0, msg, &err)) {
+		error("%s", err.buf);
+		strbuf_release(&err);
+		return STORE_REF_ERROR_OTHER;
+	}
+	ALLOC_GROW(queued_updates, queued_updates_nr + 1, queued_updates_alloc);
+	queued = &queued_updates[queued_updates_nr++];
+	queued->ref = copy_ref(ref);
+	queued->check_old = check_old;
+	queued->msg = xstrdup(msg);
+	return 0;
+}
+
+static void begin_ref_updates(void)
+{
+	struct strbuf err = STRBUF_INIT;
+
+	if (dry_run)
+		return;
+	transaction = ref_transaction_begin(&err);
+	if (!transaction)
+		die("%s", err.buf);
+}
+
+/*
+ * Commit the updates queued by s_update_ref().  If the transaction
+ * fails (because one of the refs conflicts with an existing ref, say),
+ * fall back to updating the refs one by one, so that all but the
+ * offending ones are still updated.
+ */
+static int commit_ref_updates(void)
+{
+	struct strbuf err = STRBUF_INIT;
+	int i, rc = 0;
+
+	if (!transaction)
+		return 0;
+	if (ref_transaction_commit(transaction, &err)) {
+		for (i = 0; i < queued_updates_nr; i++) {
+			struct queued_ref_update *queued = &queued_updates[i];
+
+			rc |= update_ref_alone(queued->msg, queued->ref,
+					       queued->check_old);
+		}
+	}
+	ref_transaction_free(transaction);
+	transaction = NULL;
+
+	for (i = 0; i < queued_updates_nr; i++) {
+		free_refs(queued_updates[i].ref);
+		free(queued_updates[i].msg);
+	}
+	queued_updates_nr = 0;
+	strbuf_release(&err);
+	return rc;
+}
+
 #define REFCOL_WIDTH  10
 
 static int update_local_ref(struct ref *ref,
 			    const char *remote,
 			    const struct ref *remote_ref,
+			    int fast_forward,
 			    struct strbuf *display)
 {
 	struct commit *current = NULL, *updated;
@@ -526,7 +668,9 @@ static int update_local_ref(struct ref *ref,
 		return r;
 	}
 
-	if (in_merge_bases(current, updated)) {
+	if (fast_forward < 0)
+		fast_forward = in_merge_bases(current, updated);
+	if (fast_forward) {
 		char quickref[83];
 		int r;
 		strcpy(quickref, find_unique_abbrev(current->object.sha1, DEFAULT_ABBREV));
@@ -581,6 +725,57 @@ static int iterate_ref_map(void *cb_data, unsigned char sha1[20])
 	return 0;
 }
 
+/*
+ * Find out which of the refs that update_local_ref() will have to check
+ * are fast-forwards, in one walk for all of them instead of a walk per
+ * ref.  The result is indexed like ref_map; -1 means "not checked".
+ */
+static int *find_fast_forwards(struct ref *ref_map)
+{
+	struct commit **current, **updated;
+	int *fast_forward, *pos, *result;
+	int nr = 0, n, i;
+	struct ref *rm;
+
+	for (rm = ref_map, n = 0; rm; rm = rm->next)
+		n++;
+	fast_forward = xmalloc(n * sizeof(*fast_forward));
+	current = xmalloc(n * sizeof(*current));
+	updated = xmalloc(n * sizeof(*updated));
+	pos = xmalloc(n * sizeof(*pos));
+
+	for (rm = ref_map, n = 0; rm; rm = rm->next, n++) {
+		struct commit *old, *new;
+
+		fast_forward[n] = -1;
+		if (rm->status == REF_STATUS_REJECT_SHALLOW || !rm->peer_ref ||
+		    is_null_sha1(rm->peer_ref->old_sha1) ||
+		    !hashcmp(rm->peer_ref->old_sha1, rm->old_sha1) ||
+		    starts_with(rm->peer_ref->name, "refs/tags/"))
+			continue;
+		old = lookup_commit_reference_gently(rm->peer_ref->old_sha1, 1);
+		new = lookup_commit_reference_gently(rm->old_sha1, 1);
+		if (!old || !new)
+			continue;
+
+		current[nr] = old;
+		updated[nr] = new;
+		pos[nr++] = n;
+	}
+
+	if (nr) {
+		result = xmalloc(nr * sizeof(*result));
+		in_merge_bases_batch(nr, current, updated, result);
+		for (i = 0; i < nr; i++)
+			fast_forward[pos[i]] = result[i];
+		free(result);
+	}
+	free(current);
+	free(updated);
+	free(pos);
+	return fast_forward;
+}
+
 static int store_updated_refs(const char *raw_url, const char *remote_name,
 		struct ref *ref_map)
 {
@@ -592,7 +787,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 	struct ref *rm;
 	char *url;
 	const char *filename = dry_run ? "/dev/null" : git_path("FETCH_HEAD");
-	int want_status;
+	int want_status, n;
+	int *fast_forward;
 
 	fp = fopen(filename, "a");
 	if (!fp)
@@ -609,6 +805,10 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 		goto abort;
 	}
 
+	trace_region_enter("fetch", "update refs");
+	fast_forward = find_fast_forwards(ref_map);
+	begin_ref_updates();
+
 	/*
 	 * We do a pass for each fetch_head_status type in their enum order, so
 	 * merged entries are written before not-for-merge. That lets readers
@@ -617,7 +817,7 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 	for (want_status = FETCH_HEAD_MERGE;
 	     want_status <= FETCH_HEAD_IGNORE;
 	     want_status++) {
-		for (rm = ref_map; rm; rm = rm->next) {
+		for (rm = ref_map, n = 0; rm; rm = rm->next, n++) {
 			struct ref *ref = NULL;
 			const char *merge_status_marker = "";
 
@@ -701,7 +901,8 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 
 			strbuf_reset(&note);
 			if (ref) {
-				rc |= update_local_ref(ref, what, rm, &note);
+				rc |= update_local_ref(ref, what, rm,
+						       fast_forward[n], &note);
 				free(ref);
 			} else
 				strbuf_addf(&note, "* %-*s %-*s -> FETCH_HEAD",
@@ -720,6 +921,9 @@ static int store_updated_refs(const char *raw_url, const char *remote_name,
 			}
 		}
 	}
+	rc |= commit_ref_updates();
+	free(fast_forward);
+	trace_region_leave("fetch", "update refs");
 
 	if (rc & STORE_REF_ERROR_DF_CONFLICT)
 		error(_("some local refs could not be updated; try running\n"
@@ -757,8 +961,11 @@ static int quickfetch(struct ref *ref_map)
 static int fetch_refs(struct transport *transport, struct ref *ref_map)
 {
 	int ret = quickfetch(ref_map);
-	if (ret)
+	if (ret) {
+		trace_region_enter("fetch", "transfer");
 		ret = transport_fetch_refs(transport, ref_map);
+		trace_region_leave("fetch", "transfer");
+	}
 	if (!ret)
 		ret |= store_updated_refs(transport->url,
 				transport->remote->name,
@@ -858,9 +1065,37 @@ static struct transport *prepare_transport(struct remote *remote)
 		set_option(transport, TRANS_OPT_DEPTH, depth);
 	if (update_shallow)
 		set_option(transport, TRANS_OPT_UPDATE_SHALLOW, "yes");
+	if (filter_options.choice)
+		set_option(transport, TRANS_OPT_LIST_OBJECTS_FILTER,
+			   filter_options.filter_spec);
 	return transport;
 }
 
+/*
+ * "--filter" only makes sense for the remote we are a partial clone
+ * of; without it, fetching from that remote uses the filter recorded
+ * when the repository was cloned.
+ */
+static void partial_fetch_setup(struct remote *remote)
+{
+	struct strbuf key = STRBUF_INIT;
+	const char *spec;
+
+	if (!repository_format_partial_clone ||
+	    strcmp(remote->name, repository_format_partial_clone)) {
+		if (filter_options.choice)
+			die(_("--filter can only be used with the remote configured in extensions.partialclone"));
+		return;
+	}
+	if (filter_options.choice)
+		return;
+	strbuf_addf(&key, "remote.%s.partialclonefilter", remote->name);
+	if (!git_config_get_string_const(key.buf, &spec) &&
+	    parse_list_objects_filter(&filter_options, spec))
+		die(_("invalid %s"), key.buf);
+	strbuf_release(&key);
+}
+
 static void backfill_tags(struct transport *transport, struct ref *ref_map)
 {
 	if (transport->cannot_reuse) {
@@ -881,12 +1116,13 @@ static void backfill_tags(struct transport *transport, struct ref *ref_map)
 static int do_fetch(struct transport *transport,
 		    struct refspec *refs, int ref_count)
 {
-	struct string_list existing_refs = STRING_LIST_INIT_DUP;
+	struct strmap existing_refs;
 	struct ref *ref_map;
 	struct ref *rm;
 	int autotags = (transport->remote->fetch_tags == 1);
 	int retcode = 0;
 
+	strmap_init(&existing_refs, 1);
 	for_each_ref(add_existing, &existing_refs);
 
 	if (tags == TAGS_DEFAULT) {
@@ -912,19 +1148,17 @@ static int do_fetch(struct transport *transport,
 
 	for (rm = ref_map; rm; rm = rm->next) {
 		if (rm->peer_ref) {
-			struct string_list_item *peer_item =
-				string_list_lookup(&existing_refs,
-						   rm->peer_ref->name);
-			if (peer_item) {
-				struct object_id *old_oid = peer_item->util;
+			struct object_id *old_oid =
+				strmap_get(&existing_refs, rm->peer_ref->name);
+			if (old_oid)
 				hashcpy(rm->peer_ref->old_sha1, old_oid->hash);
-			}
 		}
 	}
 
 	if (tags == TAGS_DEFAULT && autotags)
 		transport_set_option(transport, TRANS_OPT_FOLLOWTAGS, "1");
 	if (prune) {
+		trace_region_enter("fetch", "prune");
 		/*
 		 * We only prune based on refspecs specified
 		 * explicitly (via command line or configuration); we
@@ -938,6 +1172,7 @@ static int do_fetch(struct transport *transport,
 				   ref_map,
 				   transport->url);
 		}
+		trace_region_leave("fetch", "prune");
 	}
 	if (fetch_refs(transport, ref_map)) {
 		free_refs(ref_map);
@@ -958,7 +1193,7 @@ static int do_fetch(struct transport *transport,
 	}
 
  cleanup:
-	string_list_clear(&existing_refs, 1);
+	strmap_clear(&existing_refs, 1);
 	return retcode;
 }
 
@@ -1055,6 +1290,8 @@ static int fetch_multiple(struct string_list *list)
 
 	argv_array_pushl(&argv, "fetch", "--append", NULL);
 	add_options_to_argv(&argv);
+	if (filter_options.choice)
+		argv_array_pushf(&argv, "--filter=%s", filter_options.filter_spec);
 
 	for (i = 0; i < list->nr; i++) {
 		const char *name = list->items[i].string;
@@ -1083,6 +1320,7 @@ static int fetch_one(struct remote *remote, int argc, const char **argv)
 		die(_("No remote repository specified.  Please, specify either a URL or a\n"
 		    "remote name from which new revisions should be fetched."));
 
+	partial_fetch_setup(remote);
 	gtransport = prepare_transport(remote);
 
 	if (prune < 0) {
@@ -1133,6 +1371,9 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 
 	packet_trace_identity("fetch");
 
+	/* objects missing from a partial clone are what we are fetching */
+	fetch_if_missing = 0;
+
 	/* Record the command line for the reflog */
 	strbuf_addstr(&default_rla, "fetch");
 	for (i = 1; i < argc; i++)
@@ -1203,11 +1444,15 @@ int cmd_fetch(int argc, const char **argv, const char *prefix)
 	if (!result && (recurse_submodules != RECURSE_SUBMODULES_OFF)) {
 		struct argv_array options = ARGV_ARRAY_INIT;
 
+		if (max_children < 0)
+			max_children = parallel_submodules();
+
 		add_options_to_argv(&options);
 		result = fetch_populated_submodules(&options,
 						    submodule_prefix,
 						    recurse_submodules,
-						    verbosity < 0);
+						    verbosity < 0,
+						    max_children);
 		argv_array_clear(&options);
 	}
 
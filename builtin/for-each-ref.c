@@ -10,6 +10,7 @@
 #include "parse-options.h"
 #include "remote.h"
 #include "color.h"
+#include "streaming.h"
 
 /* Quoting styles */
 #define QUOTE_NONE 0
@@ -93,7 +94,7 @@ static struct {
  */
 static const char **used_atom;
 static cmp_type *used_atom_type;
-static int used_atom_cnt, need_tagged, need_symref;
+static int used_atom_cnt, need_tagged, need_symref, need_body;
 static int need_color_reset_at_eol;
 
 /*
@@ -147,6 +148,10 @@ static int parse_atom(const char *atom, const char *ep)
 		need_tagged = 1;
 	if (!strcmp(used_atom[at], "symref"))
 		need_symref = 1;
+	if (!strcmp(valid_atom[i].name, "subject") ||
+	    !strcmp(valid_atom[i].name, "body") ||
+	    starts_with(valid_atom[i].name, "contents"))
+		need_body = 1;
 	return at;
 }
 
@@ -197,19 +202,67 @@ static int verify_format(const char *format)
 	return 0;
 }
 
+/*
+ * Read an object like read_sha1_file(), but stop after the header of a
+ * commit or a tag, i.e. at the empty line before its message, without
+ * inflating the rest where the object can be streamed.  *sz is set to
+ * the size of the whole object and *len to the length of the returned
+ * (NUL-terminated) data.
+ */
+static void *read_object_header(const unsigned char *sha1, enum object_type *type,
+				unsigned long *sz, unsigned long *len)
+{
+	struct git_istream *st = open_istream(sha1, type, sz, NULL);
+	struct strbuf buf = STRBUF_INIT;
+	int header_only;
+
+	if (!st)
+		return NULL;
+	header_only = *type == OBJ_COMMIT || *type == OBJ_TAG;
+	for (;;) {
+		ssize_t readlen;
+
+		strbuf_grow(&buf, 1024);
+		readlen = read_istream(st, buf.buf + buf.len, 1024);
+		if (readlen < 0) {
+			close_istream(st);
+			strbuf_release(&buf);
+			return NULL;
+		}
+		if (!readlen)
+			break;
+		strbuf_setlen(&buf, buf.len + readlen);
+		if (header_only && memmem(buf.buf, buf.len, "\n\n", 2))
+			break;
+	}
+	close_istream(st);
+	*len = buf.len;
+	return strbuf_detach(&buf, NULL);
+}
+
 /*
  * Given an object name, read the object data and size, and return a
  * "struct object".  If the object data we are returning is also borrowed
  * by the "struct object" representation, set *eaten as well---it is a
  * signal from parse_object_buffer to us not to free the buffer.
+ *
+ * Unless an atom needs the message of a commit or tag, only its header
+ * is read.
  */
 static void *get_obj(const unsigned char *sha1, struct object **obj, unsigned long *sz, int *eaten)
 {
 	enum object_type type;
-	void *buf = read_sha1_file(sha1, &type, sz);
+	unsigned long len;
+	void *buf;
+
+	if (need_body) {
+		buf = read_sha1_file(sha1, &type, sz);
+		len = *sz;
+	} else
+		buf = read_object_header(sha1, &type, sz, &len);
 
 	if (buf)
-		*obj = parse_object_buffer(sha1, type, *sz, buf, eaten);
+		*obj = parse_object_buffer(sha1, type, len, buf, eaten);
 	else
 		*obj = NULL;
 	return buf;
@@ -296,7 +349,7 @@ static void grab_commit_values(struct atom_value *val, int deref, struct object
 			name++;
 		if (!strcmp(name, "tree")) {
 			char *s = xmalloc(41);
-			strcpy(s, sha1_to_hex(commit->tree->object.sha1));
+			strcpy(s, sha1_to_hex(get_commit_tree_sha1(commit)));
 			v->s = s;
 		}
 		if (!strcmp(name, "numparent")) {
@@ -848,8 +901,38 @@ struct grab_ref_cbdata {
 	struct refinfo **grab_array;
 	const char **grab_pattern;
 	int grab_cnt;
+	struct commit_list *with_commit, *no_commit;
+	struct contains_cache contains_cache, no_contains_cache;
 };
 
+/*
+ * The directory, ending with '/', that all refs matching one of the
+ * patterns are in: the common leading directories before the first
+ * wildcard (or backslash) of each pattern, or "" if there are no
+ * patterns.
+ */
+static char *pattern_base(const char **patterns)
+{
+	const char **p;
+	size_t len;
+
+	if (!*patterns)
+		return xstrdup("");
+	len = strlen(patterns[0]);
+	for (p = patterns; *p; p++) {
+		const char *glob = strpbrk(*p, "?*[\\");
+		size_t i;
+
+		for (i = 0; i < len && (*p)[i] == patterns[0][i] &&
+			    (!glob || *p + i < glob); i++)
+			;
+		len = i;
+	}
+	while (len && patterns[0][len - 1] != '/')
+		len--;
+	return xmemdupz(patterns[0], len);
+}
+
 /*
  * A call-back given to for_each_ref().  Filter refs and keep them for
  * later object processing.
@@ -891,6 +974,22 @@ static int grab_single_ref(const char *refname, const struct object_id *oid,
 			return 0;
 	}
 
+	if (cb->with_commit || cb->no_commit) {
+		struct commit *commit;
+
+		commit = lookup_commit_reference_gently(oid->hash, 1);
+		if (!commit)
+			return 0;
+		if (cb->with_commit &&
+		    !commit_contains(commit, cb->with_commit,
+				     &cb->contains_cache))
+			return 0;
+		if (cb->no_commit &&
+		    commit_contains(commit, cb->no_commit,
+				    &cb->no_contains_cache))
+			return 0;
+	}
+
 	/*
 	 * We do not open the object yet; sort may only need refname
 	 * to do its job and the resulting list may yet to be pruned
@@ -1092,6 +1191,8 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 	int maxcount = 0, quote_style = 0;
 	struct refinfo **refs;
 	struct grab_ref_cbdata cbdata;
+	struct commit_list *with_commit = NULL, *no_commit = NULL;
+	char *base;
 
 	struct option opts[] = {
 		OPT_BIT('s', "shell", &quote_style,
@@ -1108,9 +1209,33 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 		OPT_STRING(  0 , "format", &format, N_("format"), N_("format to use for the output")),
 		OPT_CALLBACK(0 , "sort", sort_tail, N_("key"),
 			    N_("field name to sort on"), &opt_parse_sort),
+		{
+			OPTION_CALLBACK, 0, "contains", &with_commit, N_("commit"),
+			N_("print only refs that contain the commit"),
+			PARSE_OPT_NONEG | PARSE_OPT_LASTARG_DEFAULT,
+			parse_opt_with_commit, (intptr_t)"HEAD",
+		},
+		{
+			OPTION_CALLBACK, 0, "no-contains", &no_commit, N_("commit"),
+			N_("print only refs that don't contain the commit"),
+			PARSE_OPT_NONEG | PARSE_OPT_LASTARG_DEFAULT,
+			parse_opt_with_commit, (intptr_t)"HEAD",
+		},
 		OPT_END(),
 	};
 
+	/*
+	 * for warn_ambiguous_refs, and read before --contains looks up
+	 * its commit, which may already use the commit-graph
+	 */
+	git_config(git_default_config, NULL);
+
+	/*
+	 * The values are taken from the object data we read ourselves;
+	 * do not keep the (possibly partial) commit buffers around.
+	 */
+	save_commit_buffer = 0;
+
 	parse_options(argc, argv, prefix, opts, for_each_ref_usage, 0);
 	if (maxcount < 0) {
 		error("invalid --count argument: `%d'", maxcount);
@@ -1126,12 +1251,17 @@ int cmd_for_each_ref(int argc, const char **argv, const char *prefix)
 	if (!sort)
 		sort = default_sort();
 
-	/* for warn_ambiguous_refs */
-	git_config(git_default_config, NULL);
-
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.grab_pattern = argv;
-	for_each_rawref(grab_single_ref, &cbdata);
+	cbdata.with_commit = with_commit;
+	cbdata.no_commit = no_commit;
+	init_contains_cache(&cbdata.contains_cache);
+	init_contains_cache(&cbdata.no_contains_cache);
+	base = pattern_base(argv);
+	for_each_fullref_in(base, grab_single_ref, &cbdata, 1);
+	free(base);
+	clear_contains_cache(&cbdata.contains_cache);
+	clear_contains_cache(&cbdata.no_contains_cache);
 	refs = cbdata.grab_array;
 	num_refs = cbdata.grab_cnt;
 
@@ -13,6 +13,7 @@
 #include "dir.h"
 #include "progress.h"
 #include "streaming.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -32,6 +33,7 @@ static int write_lost_and_found;
 static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
+static int nr_threads;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -76,6 +78,16 @@ static int fsck_error_func(struct object *obj, int type, const char *err, ...)
 
 static struct object_array pending;
 
+/*
+ * In a partial clone, the trees and blobs left out by the filter are
+ * missing on purpose; they are fetched when they are needed.
+ */
+static int is_promised_object(struct object *obj)
+{
+	return repository_format_partial_clone &&
+		(obj->type == OBJ_TREE || obj->type == OBJ_BLOB);
+}
+
 static int mark_object(struct object *obj, int type, void *data)
 {
 	struct object *parent = data;
@@ -103,7 +115,8 @@ static int mark_object(struct object *obj, int type, void *data)
 		return 0;
 	obj->flags |= REACHABLE;
 	if (!(obj->flags & HAS_OBJ)) {
-		if (parent && !has_sha1_file(obj->sha1)) {
+		if (parent && !has_sha1_file(obj->sha1) &&
+		    !is_promised_object(obj)) {
 			printf("broken link from %7s %s\n",
 				 typename(parent->type), sha1_to_hex(parent->sha1));
 			printf("              to %7s %s\n",
@@ -179,6 +192,8 @@ static void check_reachable_object(struct object *obj)
 	if (!(obj->flags & HAS_OBJ)) {
 		if (has_sha1_pack(obj->sha1))
 			return; /* it is in pack - forget about it */
+		if (is_promised_object(obj))
+			return;
 		printf("missing %s %s\n", typename(obj->type), sha1_to_hex(obj->sha1));
 		errors_found |= ERROR_REACHABLE;
 		return;
@@ -625,6 +640,7 @@ static struct option fsck_opts[] = {
 	OPT_BOOL(0, "lost-found", &write_lost_and_found,
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
+	OPT_INTEGER(0, "threads", &nr_threads, N_("use <n> threads to check packs")),
 	OPT_END(),
 };
 
@@ -635,8 +651,14 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	errors_found = 0;
 	check_replace_refs = 0;
+	fetch_if_missing = 0;
 
+	git_config_get_int("pack.threads", &nr_threads);
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
+	if (nr_threads < 0)
+		die(_("invalid number of threads specified (%d)"), nr_threads);
+	if (!nr_threads)
+		nr_threads = online_cpus();
 
 	if (show_progress == -1)
 		show_progress = isatty(2);
@@ -679,7 +701,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 		for (p = packed_git; p; p = p->next) {
 			/* verify gives error messages itself */
 			if (verify_pack(p, fsck_obj_buffer,
-					progress, count))
+					progress, count, nr_threads))
 				errors_found |= ERROR_PACK;
 			count += p->num_objects;
 		}
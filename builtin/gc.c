@@ -17,6 +17,10 @@
 #include "sigchain.h"
 #include "argv-array.h"
 #include "commit.h"
+#include "commit-graph.h"
+#include "refs.h"
+#include "remote.h"
+#include "append-cache.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -25,7 +29,7 @@ static const char * const builtin_gc_usage[] = {
 	NULL
 };
 
-static int pack_refs = 1;
+static int gc_pack_refs = 1;
 static int prune_reflogs = 1;
 static int aggressive_depth = 250;
 static int aggressive_window = 250;
@@ -41,6 +45,7 @@ static struct argv_array repack = ARGV_ARRAY_INIT;
 static struct argv_array prune = ARGV_ARRAY_INIT;
 static struct argv_array prune_worktrees = ARGV_ARRAY_INIT;
 static struct argv_array rerere = ARGV_ARRAY_INIT;
+static struct argv_array commit_graph = ARGV_ARRAY_INIT;
 
 static char *pidfile;
 
@@ -74,9 +79,9 @@ static void gc_config(void)
 
 	if (!git_config_get_value("gc.packrefs", &value)) {
 		if (value && !strcmp(value, "notbare"))
-			pack_refs = -1;
+			gc_pack_refs = -1;
 		else
-			pack_refs = git_config_bool("gc.packrefs", value);
+			gc_pack_refs = git_config_bool("gc.packrefs", value);
 	}
 
 	git_config_get_int("gc.aggressivewindow", &aggressive_window);
@@ -253,15 +258,38 @@ static const char *lock_repo_for_gc(int force, pid_t* ret_pid)
 	return NULL;
 }
 
+/* Drop what has been superseded from the caches that only grow */
+static void trim_caches(void)
+{
+	static const char *git_dir_caches[] = {
+		"blame-cache", "describe-cache", "gpg-verify-cache"
+	};
+	static const char *object_dir_caches[] = {
+		"merge-base-cache", "patch-id-cache", "rename-cache"
+	};
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(git_dir_caches); i++)
+		append_cache_trim(git_path("%s", git_dir_caches[i]));
+	for (i = 0; i < ARRAY_SIZE(object_dir_caches); i++) {
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/info/%s", get_object_directory(),
+			    object_dir_caches[i]);
+		append_cache_trim(path.buf);
+	}
+	strbuf_release(&path);
+}
+
 static int gc_before_repack(void)
 {
-	if (pack_refs && run_command_v_opt(pack_refs_cmd.argv, RUN_GIT_CMD))
+	if (gc_pack_refs && run_command_v_opt(pack_refs_cmd.argv, RUN_GIT_CMD))
 		return error(FAILED_RUN, pack_refs_cmd.argv[0]);
 
 	if (prune_reflogs && run_command_v_opt(reflog.argv, RUN_GIT_CMD))
 		return error(FAILED_RUN, reflog.argv[0]);
 
-	pack_refs = 0;
+	gc_pack_refs = 0;
 	prune_reflogs = 0;
 	return 0;
 }
@@ -295,11 +323,12 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	argv_array_pushl(&prune, "prune", "--expire", NULL);
 	argv_array_pushl(&prune_worktrees, "prune", "--worktrees", "--expire", NULL);
 	argv_array_pushl(&rerere, "rerere", "gc", NULL);
+	argv_array_pushl(&commit_graph, "commit-graph", "write", NULL);
 
 	gc_config();
 
-	if (pack_refs < 0)
-		pack_refs = !is_bare_repository();
+	if (gc_pack_refs < 0)
+		gc_pack_refs = !is_bare_repository();
 
 	argc = parse_options(argc, argv, prefix, builtin_gc_options,
 			     builtin_gc_usage, 0);
@@ -372,9 +401,457 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command_v_opt(rerere.argv, RUN_GIT_CMD))
 		return error(FAILED_RUN, rerere.argv[0]);
 
+	trim_caches();
+
+	/* the old graph may name commits that were just pruned */
+	if (core_commit_graph && !is_repository_shallow() &&
+	    run_command_v_opt(commit_graph.argv, RUN_GIT_CMD))
+		return error(FAILED_RUN, commit_graph.argv[0]);
+
 	if (auto_gc && too_many_loose_objects())
 		warning(_("There are too many unreachable loose objects; "
 			"run 'git prune' to remove them."));
 
 	return 0;
 }
+
+static const char * const builtin_maintenance_usage[] = {
+	N_("git maintenance run [--auto] [--scheduled] [--quiet] [--task=<task>...]"),
+	NULL
+};
+
+/*
+ * Each task can be run on its own, when its --auto condition says it
+ * has work to do, or when its schedule says it is due.  A task takes a
+ * lock of its own, so that two runs of one task do not overlap while
+ * different tasks still can, and remembers when it last ran.
+ */
+enum schedule_frequency {
+	SCHEDULE_NONE = 0,
+	SCHEDULE_HOURLY,
+	SCHEDULE_DAILY,
+	SCHEDULE_WEEKLY
+};
+
+/* a job that is started hourly may find the last one a bit less than an hour ago */
+#define SCHEDULE_SLACK 300
+
+struct maintenance_opts {
+	int auto_flag;
+	int scheduled;
+	int quiet;
+};
+
+typedef int maintenance_task_fn(struct maintenance_opts *opts);
+typedef int maintenance_auto_fn(void);
+
+struct maintenance_task {
+	const char *name;
+	maintenance_task_fn *fn;
+	maintenance_auto_fn *auto_condition;
+	int enabled;
+	enum schedule_frequency schedule;
+	int selected;
+};
+
+static int prefetch_remote(struct remote *remote, void *cb_data)
+{
+	struct maintenance_opts *opts = cb_data;
+	struct argv_array fetch = ARGV_ARRAY_INIT;
+	int ret = 0;
+
+	if (!remote->url_nr)
+		return 0;
+
+	argv_array_pushl(&fetch, "fetch", remote->name, "--prune", "--no-tags",
+			 "--refmap=", NULL);
+	if (opts->quiet)
+		argv_array_push(&fetch, "--quiet");
+	argv_array_pushf(&fetch, "+refs/heads/*:refs/prefetch/%s/*", remote->name);
+	if (run_command_v_opt(fetch.argv, RUN_GIT_CMD))
+		ret = error(_("failed to prefetch remote '%s'"), remote->name);
+	argv_array_clear(&fetch);
+	return ret;
+}
+
+static int maintenance_task_prefetch(struct maintenance_opts *opts)
+{
+	return for_each_remote(prefetch_remote, opts);
+}
+
+static int loose_object_auto_limit = 100;
+static int loose_object_batch_size = 50000;
+
+static int count_loose_object(const unsigned char *sha1,
+			      const char *path, void *data)
+{
+	int *count = data;
+
+	return ++*count >= loose_object_auto_limit;
+}
+
+static int loose_object_auto_condition(void)
+{
+	int count = 0;
+
+	if (loose_object_auto_limit <= 0)
+		return loose_object_auto_limit == 0;
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      count_loose_object, NULL, NULL, &count);
+	return count >= loose_object_auto_limit;
+}
+
+struct write_loose_object_data {
+	FILE *in;
+	int count;
+};
+
+static int write_loose_object_to_stdin(const unsigned char *sha1,
+				       const char *path, void *data)
+{
+	struct write_loose_object_data *d = data;
+
+	fprintf(d->in, "%s\n", sha1_to_hex(sha1));
+	return ++d->count >= loose_object_batch_size;
+}
+
+/*
+ * Put loose objects into a pack of their own.  The loose copies are only
+ * deleted by the next run, so that nothing that found an object loose
+ * a moment ago has it disappear under its feet.
+ */
+static int maintenance_task_loose_objects(struct maintenance_opts *opts)
+{
+	struct child_process pack_proc = CHILD_PROCESS_INIT;
+	struct write_loose_object_data data;
+	const char *prune_packed[] = { "prune-packed", NULL, NULL };
+
+	if (opts->quiet)
+		prune_packed[1] = "--quiet";
+	if (run_command_v_opt(prune_packed, RUN_GIT_CMD))
+		return error(FAILED_RUN, prune_packed[0]);
+
+	pack_proc.git_cmd = 1;
+	argv_array_push(&pack_proc.args, "pack-objects");
+	if (opts->quiet)
+		argv_array_push(&pack_proc.args, "--quiet");
+	argv_array_pushf(&pack_proc.args, "%s/pack/loose", get_object_directory());
+	pack_proc.in = -1;
+	pack_proc.no_stdout = 1;
+	if (start_command(&pack_proc))
+		return error(FAILED_RUN, "pack-objects");
+
+	data.in = xfdopen(pack_proc.in, "w");
+	data.count = 0;
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      write_loose_object_to_stdin,
+				      NULL, NULL, &data);
+	fclose(data.in);
+
+	if (finish_command(&pack_proc))
+		return error(FAILED_RUN, "pack-objects");
+	return 0;
+}
+
+static int incremental_repack_auto_limit = 10;
+
+static int incremental_repack_auto_condition(void)
+{
+	struct packed_git *p;
+	int cnt = 0;
+
+	if (incremental_repack_auto_limit <= 0)
+		return incremental_repack_auto_limit == 0;
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next)
+		if (p->pack_local && !p->pack_keep)
+			cnt++;
+	return cnt >= incremental_repack_auto_limit;
+}
+
+/*
+ * Merge the small packs into bigger ones without rewriting the big
+ * ones, see "git repack --geometric".
+ */
+static int maintenance_task_incremental_repack(struct maintenance_opts *opts)
+{
+	struct argv_array cmd = ARGV_ARRAY_INIT;
+	int ret = 0;
+
+	argv_array_pushl(&cmd, "repack", "-d", "-l", "--geometric=2", NULL);
+	if (opts->quiet)
+		argv_array_push(&cmd, "-q");
+	if (run_command_v_opt(cmd.argv, RUN_GIT_CMD))
+		ret = error(FAILED_RUN, cmd.argv[0]);
+	argv_array_clear(&cmd);
+	return ret;
+}
+
+static int maintenance_task_gc(struct maintenance_opts *opts)
+{
+	struct argv_array cmd = ARGV_ARRAY_INIT;
+	int ret = 0;
+
+	argv_array_push(&cmd, "gc");
+	if (opts->auto_flag)
+		argv_array_push(&cmd, "--auto");
+	if (opts->quiet)
+		argv_array_push(&cmd, "--quiet");
+	if (run_command_v_opt(cmd.argv, RUN_GIT_CMD))
+		ret = error(FAILED_RUN, cmd.argv[0]);
+	argv_array_clear(&cmd);
+	return ret;
+}
+
+static int ref_not_in_commit_graph(const char *refname,
+				   const struct object_id *oid,
+				   int flags, void *cb_data)
+{
+	if (sha1_object_info(oid->hash, NULL) != OBJ_COMMIT)
+		return 0;
+	/* the graph has all history of the commits it has */
+	return !parse_commit_in_graph(lookup_commit(oid->hash));
+}
+
+static int commit_graph_auto_condition(void)
+{
+	if (!core_commit_graph || !commit_graph_compatible())
+		return 0;
+	return for_each_ref(ref_not_in_commit_graph, NULL);
+}
+
+static int maintenance_task_commit_graph(struct maintenance_opts *opts)
+{
+	const char *argv[] = { "commit-graph", "write", NULL };
+
+	if (run_command_v_opt(argv, RUN_GIT_CMD))
+		return error(FAILED_RUN, argv[0]);
+	return 0;
+}
+
+static int pack_refs_auto_limit = 100;
+
+static int count_loose_ref(const char *refname, const struct object_id *oid,
+			   int flags, void *cb_data)
+{
+	int *count = cb_data;
+
+	if (flags & REF_ISPACKED)
+		return 0;
+	return ++*count >= pack_refs_auto_limit;
+}
+
+static int pack_refs_auto_condition(void)
+{
+	int count = 0;
+
+	if (pack_refs_auto_limit <= 0)
+		return pack_refs_auto_limit == 0;
+	for_each_rawref(count_loose_ref, &count);
+	return count >= pack_refs_auto_limit;
+}
+
+static int maintenance_task_pack_refs(struct maintenance_opts *opts)
+{
+	if (run_command_v_opt(pack_refs_cmd.argv, RUN_GIT_CMD))
+		return error(FAILED_RUN, pack_refs_cmd.argv[0]);
+	return 0;
+}
+
+/* in the order they are run in */
+static struct maintenance_task tasks[] = {
+	{ "prefetch", maintenance_task_prefetch, NULL,
+	  0, SCHEDULE_HOURLY },
+	{ "loose-objects", maintenance_task_loose_objects,
+	  loose_object_auto_condition, 0, SCHEDULE_DAILY },
+	{ "incremental-repack", maintenance_task_incremental_repack,
+	  incremental_repack_auto_condition, 0, SCHEDULE_DAILY },
+	{ "gc", maintenance_task_gc, NULL,
+	  1, SCHEDULE_DAILY },
+	{ "commit-graph", maintenance_task_commit_graph,
+	  commit_graph_auto_condition, 0, SCHEDULE_HOURLY },
+	{ "pack-refs", maintenance_task_pack_refs,
+	  pack_refs_auto_condition, 0, SCHEDULE_WEEKLY },
+};
+
+static enum schedule_frequency parse_schedule(const char *key, const char *value)
+{
+	if (!strcasecmp(value, "hourly"))
+		return SCHEDULE_HOURLY;
+	if (!strcasecmp(value, "daily"))
+		return SCHEDULE_DAILY;
+	if (!strcasecmp(value, "weekly"))
+		return SCHEDULE_WEEKLY;
+	if (!strcasecmp(value, "never"))
+		return SCHEDULE_NONE;
+	git_die_config(key, _("unknown schedule '%s'"), value);
+}
+
+static unsigned long schedule_interval(enum schedule_frequency schedule)
+{
+	switch (schedule) {
+	case SCHEDULE_HOURLY:
+		return 3600;
+	case SCHEDULE_DAILY:
+		return 24 * 3600;
+	case SCHEDULE_WEEKLY:
+		return 7 * 24 * 3600;
+	default:
+		return 0;
+	}
+}
+
+static void maintenance_config(void)
+{
+	struct strbuf key = STRBUF_INIT;
+	const char *value;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tasks); i++) {
+		strbuf_reset(&key);
+		strbuf_addf(&key, "maintenance.%s.enabled", tasks[i].name);
+		git_config_get_bool(key.buf, &tasks[i].enabled);
+
+		strbuf_reset(&key);
+		strbuf_addf(&key, "maintenance.%s.schedule", tasks[i].name);
+		if (!git_config_get_string_const(key.buf, &value))
+			tasks[i].schedule = parse_schedule(key.buf, value);
+	}
+	strbuf_release(&key);
+
+	git_config_get_int("maintenance.loose-objects.auto", &loose_object_auto_limit);
+	git_config_get_int("maintenance.loose-objects.batchsize", &loose_object_batch_size);
+	if (loose_object_batch_size <= 0)
+		loose_object_batch_size = INT_MAX;
+	git_config_get_int("maintenance.incremental-repack.auto", &incremental_repack_auto_limit);
+	git_config_get_int("maintenance.pack-refs.auto", &pack_refs_auto_limit);
+}
+
+/* when the task last ran, from the timestamp it leaves in its state file */
+static unsigned long task_last_run(struct maintenance_task *task)
+{
+	struct strbuf sb = STRBUF_INIT;
+	unsigned long last = 0;
+
+	if (strbuf_read_file(&sb, git_path("maintenance/%s", task->name), 0) > 0)
+		last = strtoul(sb.buf, NULL, 10);
+	strbuf_release(&sb);
+	return last;
+}
+
+static int task_is_due(struct maintenance_task *task, unsigned long now)
+{
+	unsigned long interval = schedule_interval(task->schedule);
+
+	if (!interval)
+		return 0;
+	return now + SCHEDULE_SLACK >= task_last_run(task) + interval;
+}
+
+static int run_task(struct maintenance_task *task, struct maintenance_opts *opts)
+{
+	struct lock_file *lock = xcalloc(1, sizeof(*lock));
+	char *path = git_pathdup("maintenance/%s", task->name);
+	struct strbuf sb = STRBUF_INIT;
+	int fd, ret;
+
+	if (safe_create_leading_directories(path)) {
+		ret = error(_("unable to create '%s'"), path);
+		free(path);
+		return ret;
+	}
+	fd = hold_lock_file_for_update(lock, path, 0);
+	if (fd < 0) {
+		if (!opts->quiet)
+			warning(_("skipping maintenance task '%s': %s"), task->name,
+				errno == EEXIST ? _("it is already running") : strerror(errno));
+		free(path);
+		return 0;
+	}
+
+	ret = task->fn(opts);
+	if (ret) {
+		rollback_lock_file(lock);
+		error(_("maintenance task '%s' failed"), task->name);
+	} else {
+		strbuf_addf(&sb, "%lu\n", (unsigned long)time(NULL));
+		if (write_in_full(fd, sb.buf, sb.len) != sb.len ||
+		    commit_lock_file(lock))
+			ret = error(_("unable to write '%s': %s"), path, strerror(errno));
+	}
+	strbuf_release(&sb);
+	free(path);
+	return ret;
+}
+
+static int select_task(const struct option *opt, const char *arg, int unset)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tasks); i++) {
+		if (!strcmp(arg, tasks[i].name)) {
+			if (tasks[i].selected)
+				return error(_("task '%s' cannot be selected multiple times"), arg);
+			tasks[i].selected = 1;
+			return 0;
+		}
+	}
+	return error(_("'%s' is not a valid task"), arg);
+}
+
+static int maintenance_run(int argc, const char **argv, const char *prefix)
+{
+	struct maintenance_opts opts;
+	int i, selected = 0, ret = 0;
+	unsigned long now = time(NULL);
+	struct option options[] = {
+		OPT_BOOL(0, "auto", &opts.auto_flag,
+			 N_("run tasks based on the state of the repository")),
+		OPT_BOOL(0, "scheduled", &opts.scheduled,
+			 N_("run tasks whose schedule says they are due")),
+		OPT__QUIET(&opts.quiet, N_("do not report progress or other information over stderr")),
+		{ OPTION_CALLBACK, 0, "task", NULL, N_("task"),
+		  N_("run a specific task"), PARSE_OPT_NONEG, select_task },
+		OPT_END()
+	};
+
+	memset(&opts, 0, sizeof(opts));
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_maintenance_usage, 0);
+	if (argc)
+		usage_with_options(builtin_maintenance_usage, options);
+
+	for (i = 0; i < ARRAY_SIZE(tasks); i++)
+		selected |= tasks[i].selected;
+
+	for (i = 0; i < ARRAY_SIZE(tasks); i++) {
+		struct maintenance_task *task = &tasks[i];
+
+		if (selected ? !task->selected : !task->enabled)
+			continue;
+		if (opts.scheduled && !task_is_due(task, now))
+			continue;
+		if (opts.auto_flag && task->auto_condition &&
+		    !task->auto_condition())
+			continue;
+		if (run_task(task, &opts))
+			ret = 1;
+		/* the task may have added or removed packs */
+		reprepare_packed_git();
+	}
+	return ret;
+}
+
+int cmd_maintenance(int argc, const char **argv, const char *prefix)
+{
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage(builtin_maintenance_usage[0]);
+
+	argv_array_pushl(&pack_refs_cmd, "pack-refs", "--all", "--prune", NULL);
+	gc_config();
+	maintenance_config();
+
+	if (argc >= 2 && !strcmp(argv[1], "run"))
+		return maintenance_run(argc - 1, argv + 1, prefix);
+	usage(builtin_maintenance_usage[0]);
+}
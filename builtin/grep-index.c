@@ -0,0 +1,40 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "grep-index.h"
+
+static const char * const grep_index_usage[] = {
+	N_("git grep-index [--object-dir=<dir>] (write | clear)"),
+	NULL
+};
+
+int cmd_grep_index(int argc, const char **argv, const char *prefix)
+{
+	const char *object_dir = NULL;
+	const struct option options[] = {
+		OPT_FILENAME(0, "object-dir", &object_dir,
+			N_("object directory to store the grep index in")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     grep_index_usage, 0);
+	if (argc != 1)
+		usage_with_options(grep_index_usage, options);
+
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_grep_index(object_dir);
+	if (!strcmp(argv[0], "clear")) {
+		char *name = get_grep_index_filename(object_dir);
+		unlink_or_warn(name);
+		free(name);
+		return 0;
+	}
+
+	usage_with_options(grep_index_usage, options);
+}
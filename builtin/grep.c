@@ -18,6 +18,8 @@
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
+#include "grep-index.h"
+#include "attr.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -26,11 +28,18 @@ static char const * const grep_usage[] = {
 
 static int use_threads = 1;
 
+/* 0 means one thread per CPU */
+static int num_threads;
+
+/* blobs that cannot match, according to the grep index, are skipped */
+static int use_grep_index = 1;
+static struct grep_index *grep_index;
+static struct grep_index_query grep_index_query;
+
 #ifndef NO_PTHREADS
-#define THREADS 8
-static pthread_t threads[THREADS];
+static pthread_t *threads;
 
-/* We use one producer thread and THREADS consumer
+/* We use one producer thread and num_threads consumer
  * threads. The producer adds struct work_items to 'todo' and the
  * consumers pick work items from the same array.
  */
@@ -195,7 +204,8 @@ static void start_threads(struct grep_opt *opt)
 	int i;
 
 	pthread_mutex_init(&grep_mutex, NULL);
-	pthread_mutex_init(&grep_read_mutex, NULL);
+	enable_obj_read_lock();
+	enable_attr_lock();
 	pthread_mutex_init(&grep_attr_mutex, NULL);
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
@@ -206,7 +216,8 @@ static void start_threads(struct grep_opt *opt)
 		strbuf_init(&todo[i].out, 0);
 	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	threads = xcalloc(num_threads, sizeof(*threads));
+	for (i = 0; i < num_threads; i++) {
 		int err;
 		struct grep_opt *o = grep_opt_dup(opt);
 		o->output = strbuf_out;
@@ -238,14 +249,16 @@ static int wait_all(void)
 	pthread_cond_broadcast(&cond_add);
 	grep_unlock();
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	for (i = 0; i < num_threads; i++) {
 		void *h;
 		pthread_join(threads[i], &h);
 		hit |= (int) (intptr_t) h;
 	}
+	free(threads);
 
 	pthread_mutex_destroy(&grep_mutex);
-	pthread_mutex_destroy(&grep_read_mutex);
+	disable_obj_read_lock();
+	disable_attr_lock();
 	pthread_mutex_destroy(&grep_attr_mutex);
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
@@ -265,27 +278,29 @@ static int wait_all(void)
 static int grep_cmd_config(const char *var, const char *value, void *cb)
 {
 	int st = grep_config(var, value, cb);
+	if (!strcmp(var, "grep.trigramindex"))
+		use_grep_index = git_config_bool(var, value);
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+	}
 	if (git_color_default_config(var, value, cb) < 0)
 		st = -1;
 	return st;
 }
 
-static void *lock_and_read_sha1_file(const unsigned char *sha1, enum object_type *type, unsigned long *size)
-{
-	void *data;
-
-	grep_read_lock();
-	data = read_sha1_file(sha1, type, size);
-	grep_read_unlock();
-	return data;
-}
-
 static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
 		     const char *filename, int tree_name_len,
 		     const char *path)
 {
 	struct strbuf pathbuf = STRBUF_INIT;
 
+	if (grep_index &&
+	    !grep_index_may_match(grep_index, &grep_index_query, sha1))
+		return 0;
+
 	if (opt->relative && opt->prefix_length) {
 		quote_path_relative(filename + tree_name_len, opt->prefix, &pathbuf);
 		strbuf_insert(&pathbuf, 0, filename, tree_name_len);
@@ -367,6 +382,19 @@ static void run_pager(struct grep_opt *opt, const char *prefix)
 	free(argv);
 }
 
+/*
+ * A file that is unchanged since it was added to the index has the
+ * contents of the indexed blob, which the grep index may know about.
+ */
+static int worktree_may_match(const struct cache_entry *ce)
+{
+	struct stat st;
+
+	if (lstat(ce->name, &st) || ie_match_stat(&the_index, ce, &st, 0))
+		return 1;
+	return grep_index_may_match(grep_index, &grep_index_query, ce->sha1);
+}
+
 static int grep_cache(struct grep_opt *opt, const struct pathspec *pathspec, int cached)
 {
 	int hit = 0;
@@ -389,7 +417,7 @@ static int grep_cache(struct grep_opt *opt, const struct pathspec *pathspec, int
 				continue;
 			hit |= grep_sha1(opt, ce->sha1, ce->name, 0, ce->name);
 		}
-		else
+		else if (!grep_index || worktree_may_match(ce))
 			hit |= grep_file(opt, ce->name);
 		if (ce_stage(ce)) {
 			do {
@@ -436,7 +464,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = lock_and_read_sha1_file(entry.sha1, &type, &size);
+			data = read_sha1_file(entry.sha1, &type, &size);
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    sha1_to_hex(entry.sha1));
@@ -467,10 +495,8 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		struct strbuf base;
 		int hit, len;
 
-		grep_read_lock();
 		data = read_object_with_reference(obj->sha1, tree_type,
 						  &size, NULL);
-		grep_read_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), sha1_to_hex(obj->sha1));
@@ -736,6 +762,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		{ OPTION_STRING, 'O', "open-files-in-pager", &show_in_pager,
 			N_("pager"), N_("show matching files in the pager"),
 			PARSE_OPT_OPTARG, NULL, (intptr_t)default_pager },
+		OPT_INTEGER(0, "threads", &num_threads,
+			N_("use <n> worker threads")),
 		OPT_BOOL(0, "ext-grep", &external_grep_allowed__ignored,
 			 N_("allow calling of grep(1) (ignored by this build)")),
 		{ OPTION_CALLBACK, 0, "help-all", NULL, NULL, N_("show usage"),
@@ -811,6 +839,14 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 
 	compile_grep_patterns(&opt);
 
+	if (use_grep_index && use_index && startup_info->have_repository) {
+		grep_index = load_grep_index(get_object_directory());
+		if (prepare_grep_index_query(&grep_index_query, &opt, grep_index)) {
+			free_grep_index(grep_index);
+			grep_index = NULL;
+		}
+	}
+
 	/* Check revs and then paths */
 	for (i = 0; i < argc; i++) {
 		const char *arg = argv[i];
@@ -832,7 +868,11 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	}
 
 #ifndef NO_PTHREADS
-	if (list.nr || cached || online_cpus() == 1)
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
+	if (!num_threads)
+		num_threads = online_cpus();
+	if (num_threads == 1)
 		use_threads = 0;
 #else
 	use_threads = 0;
@@ -913,6 +953,10 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		hit |= wait_all();
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
+	if (grep_index) {
+		clear_grep_index_query(&grep_index_query);
+		free_grep_index(grep_index);
+	}
 	free_grep_patterns(&opt);
 	return !hit;
 }
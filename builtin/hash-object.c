@@ -9,6 +9,8 @@
 #include "quote.h"
 #include "parse-options.h"
 #include "exec_cmd.h"
+#include "bulk-checkin.h"
+#include "thread-utils.h"
 
 /*
  * This is to create corrupt objects for debugging and as such it
@@ -74,11 +76,216 @@ static void hash_stdin_paths(const char *type, int no_filters, unsigned flags,
 	strbuf_release(&nbuf);
 }
 
+#ifndef NO_PTHREADS
+/*
+ * With --threads, "--stdin-paths -w" reads, hashes and deflates the
+ * files in worker threads, and the main thread writes the objects into
+ * a single pack in the order the paths came in.  Paths that need to go
+ * through convert_to_git() are read and converted by the main thread,
+ * as attribute lookups are not thread-safe, and files bigger than
+ * core.bigFileThreshold are left to the usual streaming code.
+ */
+struct ingest_slot {
+	struct strbuf path;
+	unsigned convert:1, big:1, done:1;
+	int err;
+	struct bulk_checkin_object obj;
+};
+
+struct ingest_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct ingest_slot *slot;
+	int nr_slots;
+	/* path n is in slot n % nr_slots */
+	unsigned long queued, taken;
+	int stop;
+};
+
+static void ingest_path(struct ingest_slot *slot)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+	int fd;
+
+	fd = open(slot->path.buf, O_RDONLY);
+	if (fd < 0) {
+		slot->err = errno;
+		return;
+	}
+	if (fstat(fd, &st) < 0) {
+		slot->err = errno;
+		close(fd);
+		return;
+	}
+	if (S_ISREG(st.st_mode) && st.st_size > big_file_threshold) {
+		slot->big = 1;
+		close(fd);
+		return;
+	}
+	if (strbuf_read(&buf, fd, S_ISREG(st.st_mode) ? st.st_size : 0) < 0)
+		slot->err = errno;
+	else
+		prepare_bulk_checkin_object(&slot->obj, OBJ_BLOB,
+					    buf.buf, buf.len);
+	close(fd);
+	strbuf_release(&buf);
+}
+
+static void *ingest_worker(void *data)
+{
+	struct ingest_pool *pool = data;
+
+	for (;;) {
+		struct ingest_slot *slot;
+
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->taken == pool->queued && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->taken == pool->queued) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		slot = &pool->slot[pool->taken++ % pool->nr_slots];
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (!slot->convert)
+			ingest_path(slot);
+
+		pthread_mutex_lock(&pool->mutex);
+		slot->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+static void ingest_converted(struct ingest_slot *slot)
+{
+	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
+	int fd;
+
+	fd = open(slot->path.buf, O_RDONLY);
+	if (fd < 0)
+		die_errno("Cannot open '%s'", slot->path.buf);
+	if (strbuf_read(&buf, fd, 0) < 0)
+		die_errno("Unable to add %s to database", slot->path.buf);
+	close(fd);
+	if (convert_to_git(slot->path.buf, buf.buf, buf.len, &nbuf, safe_crlf))
+		strbuf_swap(&buf, &nbuf);
+	prepare_bulk_checkin_object(&slot->obj, OBJ_BLOB, buf.buf, buf.len);
+	strbuf_release(&buf);
+	strbuf_release(&nbuf);
+}
+
+static void finish_slot(struct ingest_slot *slot, unsigned flags)
+{
+	if (slot->err) {
+		errno = slot->err;
+		die_errno("Cannot open '%s'", slot->path.buf);
+	}
+	if (slot->big) {
+		hash_object(slot->path.buf, blob_type,
+			    slot->convert ? slot->path.buf : NULL, flags, 0);
+		return;
+	}
+	if (slot->convert)
+		ingest_converted(slot);
+	if (write_bulk_checkin_object(&slot->obj))
+		die("Unable to add %s to database", slot->path.buf);
+	printf("%s\n", sha1_to_hex(slot->obj.sha1));
+	maybe_flush_or_die(stdout, "hash to stdout");
+}
+
+static void hash_stdin_paths_threaded(int no_filters, unsigned flags,
+				      int nr_threads)
+{
+	struct ingest_pool pool;
+	struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
+	pthread_t *threads;
+	unsigned long emitted = 0;
+	int eof = 0, i;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pool.nr_slots = 4 * nr_threads;
+	pool.slot = xcalloc(pool.nr_slots, sizeof(*pool.slot));
+	for (i = 0; i < pool.nr_slots; i++)
+		strbuf_init(&pool.slot[i].path, 0);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, ingest_worker, &pool);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	plug_bulk_checkin();
+	for (;;) {
+		struct ingest_slot *slot;
+
+		/* keep the threads busy */
+		while (!eof && pool.queued - emitted < pool.nr_slots) {
+			if (strbuf_getline(&buf, stdin, '\n') == EOF) {
+				eof = 1;
+				break;
+			}
+			if (buf.buf[0] == '"') {
+				strbuf_reset(&nbuf);
+				if (unquote_c_style(&nbuf, buf.buf, NULL))
+					die("line is badly quoted");
+				strbuf_swap(&buf, &nbuf);
+			}
+			slot = &pool.slot[pool.queued % pool.nr_slots];
+			strbuf_swap(&slot->path, &buf);
+			slot->convert = !no_filters &&
+				would_convert_to_git(slot->path.buf);
+			slot->big = 0;
+			slot->done = 0;
+			slot->err = 0;
+
+			pthread_mutex_lock(&pool.mutex);
+			pool.queued++;
+			pthread_cond_broadcast(&pool.cond);
+			pthread_mutex_unlock(&pool.mutex);
+		}
+		if (emitted == pool.queued)
+			break;
+
+		slot = &pool.slot[emitted % pool.nr_slots];
+		pthread_mutex_lock(&pool.mutex);
+		while (!slot->done)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		finish_slot(slot, flags);
+		emitted++;
+	}
+	unplug_bulk_checkin();
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	for (i = 0; i < pool.nr_slots; i++) {
+		strbuf_release(&pool.slot[i].path);
+		clear_bulk_checkin_object(&pool.slot[i].obj);
+	}
+	free(pool.slot);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	strbuf_release(&buf);
+	strbuf_release(&nbuf);
+}
+#endif
+
 int cmd_hash_object(int argc, const char **argv, const char *prefix)
 {
 	static const char * const hash_object_usage[] = {
 		N_("git hash-object [-t <type>] [-w] [--path=<file> | --no-filters] [--stdin] [--] <file>..."),
-		N_("git hash-object  --stdin-paths < <list-of-paths>"),
+		N_("git hash-object  --stdin-paths [--threads=<n>] < <list-of-paths>"),
 		NULL
 	};
 	const char *type = blob_type;
@@ -86,6 +293,7 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 	int stdin_paths = 0;
 	int no_filters = 0;
 	int literally = 0;
+	int nr_threads = 1;
 	unsigned flags = HASH_FORMAT_CHECK;
 	const char *vpath = NULL;
 	const struct option hash_object_options[] = {
@@ -97,6 +305,7 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 		OPT_BOOL( 0 , "no-filters", &no_filters, N_("store file as is without filters")),
 		OPT_BOOL( 0, "literally", &literally, N_("just hash any random garbage to create corrupt objects for debugging Git")),
 		OPT_STRING( 0 , "path", &vpath, N_("file"), N_("process file as it were from this path")),
+		OPT_INTEGER(0, "threads", &nr_threads, N_("write files from --stdin-paths into a pack using <n> threads")),
 		OPT_END()
 	};
 	int i;
@@ -147,8 +356,18 @@ int cmd_hash_object(int argc, const char **argv, const char *prefix)
 			    flags, literally);
 	}
 
-	if (stdin_paths)
+	if (stdin_paths) {
+		if (nr_threads < 1)
+			nr_threads = online_cpus();
+#ifndef NO_PTHREADS
+		if (nr_threads > 1 && (flags & HASH_WRITE_OBJECT) &&
+		    !literally && type_from_string(type) == OBJ_BLOB) {
+			hash_stdin_paths_threaded(no_filters, flags, nr_threads);
+			return 0;
+		}
+#endif
 		hash_stdin_paths(type, no_filters, flags, literally);
+	}
 
 	return 0;
 }
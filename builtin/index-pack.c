@@ -13,7 +13,7 @@
 #include "thread-utils.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict | --fsck-objects] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -62,6 +62,8 @@ struct ref_delta_entry {
 
 static struct object_entry *objects;
 static struct object_stat *obj_stat;
+/* with WRITE_SIZES, the size each delta resolves to */
+static unsigned long *delta_sizes;
 static struct ofs_delta_entry *ofs_deltas;
 static struct ref_delta_entry *ref_deltas;
 static struct thread_local nothread_data;
@@ -91,44 +93,72 @@ static uint32_t input_crc32;
 static int input_fd, output_fd;
 static const char *curr_pack;
 
+/*
+ * An inflated non-delta object of the first pass, to be hashed and
+ * checked.  They are hashed in batches with hash_sha1_files(), which
+ * is faster than one at a time for small objects.
+ */
+struct first_pass_job {
+	struct object_entry *obj;
+	void *data;
+};
+
+#define FIRST_PASS_BATCH 16
+#define FIRST_PASS_BATCH_BYTES (1024 * 1024)
+
 #ifndef NO_PTHREADS
 
 static struct thread_local *thread_data;
 static int nr_dispatched;
 static int threads_active;
 
-static pthread_mutex_t read_mutex;
+static struct traced_mutex read_mutex;
 #define read_lock()		lock_mutex(&read_mutex)
 #define read_unlock()		unlock_mutex(&read_mutex)
 
-static pthread_mutex_t counter_mutex;
+static struct traced_mutex counter_mutex;
 #define counter_lock()		lock_mutex(&counter_mutex)
 #define counter_unlock()	unlock_mutex(&counter_mutex)
 
-static pthread_mutex_t work_mutex;
+static struct traced_mutex work_mutex;
 #define work_lock()		lock_mutex(&work_mutex)
 #define work_unlock()		unlock_mutex(&work_mutex)
 
-static pthread_mutex_t deepest_delta_mutex;
+static struct traced_mutex deepest_delta_mutex;
 #define deepest_delta_lock()	lock_mutex(&deepest_delta_mutex)
 #define deepest_delta_unlock()	unlock_mutex(&deepest_delta_mutex)
 
-static pthread_mutex_t type_cas_mutex;
+static struct traced_mutex type_cas_mutex;
 #define type_cas_lock()		lock_mutex(&type_cas_mutex)
 #define type_cas_unlock()	unlock_mutex(&type_cas_mutex)
 
 static pthread_key_t key;
 
-static inline void lock_mutex(pthread_mutex_t *mutex)
+/*
+ * In the first pass the main thread reads the pack and inflates each
+ * entry (it has to, to find where the next one starts), and hands the
+ * inflated non-delta objects to worker threads to be hashed and
+ * checked.  The queue is bounded both in entries and in bytes, so a
+ * slow worker cannot make us hold the whole pack in memory.
+ */
+#define FIRST_PASS_QUEUE_BYTES (32 * 1024 * 1024)
+
+static struct first_pass_job *first_pass_queue;
+static int first_pass_alloc, first_pass_head, first_pass_nr;
+static unsigned long first_pass_bytes;
+static int first_pass_done;
+static pthread_cond_t first_pass_cond;
+
+static inline void lock_mutex(struct traced_mutex *mutex)
 {
 	if (threads_active)
-		pthread_mutex_lock(mutex);
+		traced_mutex_lock(mutex);
 }
 
-static inline void unlock_mutex(pthread_mutex_t *mutex)
+static inline void unlock_mutex(struct traced_mutex *mutex)
 {
 	if (threads_active)
-		pthread_mutex_unlock(mutex);
+		traced_mutex_unlock(mutex);
 }
 
 /*
@@ -137,13 +167,15 @@ static inline void unlock_mutex(pthread_mutex_t *mutex)
 static void init_thread(void)
 {
 	int i;
-	init_recursive_mutex(&read_mutex);
-	pthread_mutex_init(&counter_mutex, NULL);
-	pthread_mutex_init(&work_mutex, NULL);
-	pthread_mutex_init(&type_cas_mutex, NULL);
+	traced_mutex_init(&read_mutex, "index-pack read", 1);
+	traced_mutex_init(&counter_mutex, "index-pack counter", 0);
+	traced_mutex_init(&work_mutex, "index-pack work", 0);
+	traced_mutex_init(&type_cas_mutex, "index-pack type_cas", 0);
 	if (show_stat)
-		pthread_mutex_init(&deepest_delta_mutex, NULL);
+		traced_mutex_init(&deepest_delta_mutex,
+				  "index-pack deepest_delta", 0);
 	pthread_key_create(&key, NULL);
+	pthread_cond_init(&first_pass_cond, NULL);
 	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
 	for (i = 0; i < nr_threads; i++) {
 		thread_data[i].pack_fd = open(curr_pack, O_RDONLY);
@@ -160,12 +192,13 @@ static void cleanup_thread(void)
 	if (!threads_active)
 		return;
 	threads_active = 0;
-	pthread_mutex_destroy(&read_mutex);
-	pthread_mutex_destroy(&counter_mutex);
-	pthread_mutex_destroy(&work_mutex);
-	pthread_mutex_destroy(&type_cas_mutex);
+	traced_mutex_destroy(&read_mutex);
+	traced_mutex_destroy(&counter_mutex);
+	traced_mutex_destroy(&work_mutex);
+	traced_mutex_destroy(&type_cas_mutex);
+	pthread_cond_destroy(&first_pass_cond);
 	if (show_stat)
-		pthread_mutex_destroy(&deepest_delta_mutex);
+		traced_mutex_destroy(&deepest_delta_mutex);
 	for (i = 0; i < nr_threads; i++)
 		close(thread_data[i].pack_fd);
 	pthread_key_delete(key);
@@ -538,6 +571,13 @@ static void *unpack_raw_entry(struct object_entry *obj,
 	}
 	obj->hdr_size = consumed_bytes - obj->idx.offset;
 
+	/*
+	 * Large blobs are not kept in memory, so whoever wanted to hash
+	 * the data later cannot; do it while inflating.
+	 */
+	if (!sha1 && obj->type == OBJ_BLOB && obj->size > big_file_threshold)
+		sha1 = obj->idx.sha1;
+
 	data = unpack_entry_data(obj->idx.offset, obj->size, obj->type, sha1);
 	obj->idx.crc32 = input_crc32;
 	return data;
@@ -815,7 +855,7 @@ static void sha1_object(const void *data, struct object_entry *obj_entry,
 		free(has_data);
 	}
 
-	if (strict) {
+	if (strict || do_fsck_object) {
 		read_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(sha1);
@@ -950,6 +990,8 @@ static void resolve_delta(struct object_entry *delta_obj,
 		       typename(delta_obj->real_type), delta_obj->idx.sha1);
 	sha1_object(result->data, NULL, result->size, delta_obj->real_type,
 		    delta_obj->idx.sha1);
+	if (delta_sizes)
+		delta_sizes[delta_obj - objects] = result->size;
 	counter_lock();
 	nr_resolved_deltas++;
 	counter_unlock();
@@ -1074,10 +1116,31 @@ static void resolve_base(struct object_entry *obj)
 	find_unresolved_deltas(base_obj);
 }
 
+static void check_first_pass_jobs(struct first_pass_job *job, int nr)
+{
+	struct hash_object_job hash[FIRST_PASS_BATCH];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		hash[i].buf = job[i].data;
+		hash[i].len = job[i].obj->size;
+		hash[i].type = typename(job[i].obj->type);
+		hash[i].sha1 = job[i].obj->idx.sha1;
+	}
+	hash_sha1_files(hash, nr);
+	for (i = 0; i < nr; i++) {
+		sha1_object(job[i].data, NULL, job[i].obj->size,
+			    job[i].obj->type, job[i].obj->idx.sha1);
+		free(job[i].data);
+	}
+}
+
 #ifndef NO_PTHREADS
 static void *threaded_second_pass(void *data)
 {
 	set_thread_data(data);
+	trace_thread_start("resolve-deltas");
+	thread_stats_start("resolve-deltas");
 	for (;;) {
 		int i;
 		counter_lock();
@@ -1096,10 +1159,100 @@ static void *threaded_second_pass(void *data)
 
 		resolve_base(&objects[i]);
 	}
+	thread_stats_exit();
+	trace_thread_exit();
 	return NULL;
 }
 #endif
 
+#ifndef NO_PTHREADS
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	trace_thread_start("first-pass");
+	thread_stats_start("first-pass");
+	for (;;) {
+		struct first_pass_job job[FIRST_PASS_BATCH];
+		unsigned long bytes = 0;
+		int nr = 0;
+
+		work_lock();
+		while (!first_pass_nr && !first_pass_done)
+			traced_cond_wait(&first_pass_cond, &work_mutex);
+		if (!first_pass_nr) {
+			work_unlock();
+			break;
+		}
+		while (first_pass_nr && nr < FIRST_PASS_BATCH &&
+		       bytes < FIRST_PASS_BATCH_BYTES) {
+			job[nr] = first_pass_queue[first_pass_head];
+			first_pass_head = (first_pass_head + 1) % first_pass_alloc;
+			first_pass_nr--;
+			first_pass_bytes -= job[nr].obj->size;
+			bytes += job[nr++].obj->size;
+		}
+		pthread_cond_broadcast(&first_pass_cond);
+		work_unlock();
+
+		check_first_pass_jobs(job, nr);
+	}
+	thread_stats_exit();
+	trace_thread_exit();
+	return NULL;
+}
+
+static void queue_first_pass(struct object_entry *obj, void *data)
+{
+	struct first_pass_job *job;
+
+	work_lock();
+	while (first_pass_nr == first_pass_alloc ||
+	       (first_pass_nr &&
+		first_pass_bytes + obj->size > FIRST_PASS_QUEUE_BYTES))
+		traced_cond_wait(&first_pass_cond, &work_mutex);
+	job = &first_pass_queue[(first_pass_head + first_pass_nr) % first_pass_alloc];
+	job->obj = obj;
+	job->data = data;
+	first_pass_nr++;
+	first_pass_bytes += obj->size;
+	pthread_cond_broadcast(&first_pass_cond);
+	work_unlock();
+}
+
+static void start_first_pass_threads(void)
+{
+	int i;
+
+	init_thread();
+	first_pass_alloc = nr_threads * 16;
+	first_pass_queue = xcalloc(first_pass_alloc, sizeof(*first_pass_queue));
+	first_pass_head = first_pass_nr = 0;
+	first_pass_bytes = 0;
+	first_pass_done = 0;
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void finish_first_pass_threads(void)
+{
+	int i;
+
+	work_lock();
+	first_pass_done = 1;
+	pthread_cond_broadcast(&first_pass_cond);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+	cleanup_thread();
+	free(first_pass_queue);
+	first_pass_queue = NULL;
+}
+#endif
+
 /*
  * First pass:
  * - find locations of all objects;
@@ -1108,7 +1261,10 @@ static void *threaded_second_pass(void *data)
  */
 static void parse_pack_objects(unsigned char *sha1)
 {
-	int i, nr_delays = 0;
+	int i, nr_delays = 0, threaded = 0;
+	struct first_pass_job batch[FIRST_PASS_BATCH];
+	unsigned long batch_bytes = 0;
+	int batch_nr = 0;
 	struct ofs_delta_entry *ofs_delta = ofs_deltas;
 	unsigned char ref_delta_sha1[20];
 	struct stat st;
@@ -1117,10 +1273,16 @@ static void parse_pack_objects(unsigned char *sha1)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS")) {
+		start_first_pass_threads();
+		threaded = 1;
+	}
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
-					      ref_delta_sha1, obj->idx.sha1);
+					      ref_delta_sha1, NULL);
 		obj->real_type = obj->type;
 		if (obj->type == OBJ_OFS_DELTA) {
 			nr_ofs_deltas++;
@@ -1135,12 +1297,34 @@ static void parse_pack_objects(unsigned char *sha1)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
-			sha1_object(data, NULL, obj->size, obj->type, obj->idx.sha1);
+		}
+#ifndef NO_PTHREADS
+		else if (threaded) {
+			queue_first_pass(obj, data);
+			data = NULL;
+		}
+#endif
+		else {
+			batch[batch_nr].obj = obj;
+			batch[batch_nr++].data = data;
+			batch_bytes += obj->size;
+			data = NULL;
+			if (batch_nr == FIRST_PASS_BATCH ||
+			    batch_bytes >= FIRST_PASS_BATCH_BYTES) {
+				check_first_pass_jobs(batch, batch_nr);
+				batch_nr = 0;
+				batch_bytes = 0;
+			}
+		}
 		free(data);
 		display_progress(progress, i+1);
 	}
+	check_first_pass_jobs(batch, batch_nr);
 	objects[i].idx.offset = consumed_bytes;
+#ifndef NO_PTHREADS
+	if (threaded)
+		finish_first_pass_threads();
+#endif
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1373,8 +1557,25 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 	free(sorted_by_pos);
 }
 
+static void object_info(struct pack_idx_entry *entry,
+			enum object_type *type,
+			enum object_type *in_pack_type,
+			unsigned long *size)
+{
+	struct object_entry *obj = (struct object_entry *)entry;
+
+	*type = obj->real_type;
+	*in_pack_type = obj->type;
+	if (is_delta_type(obj->type))
+		*size = delta_sizes[obj - objects];
+	else
+		*size = obj->size;
+}
+
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *final_rev_name, const char *curr_rev_name,
+		  const char *final_sizes_name, const char *curr_sizes_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -1426,6 +1627,28 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else if (from_stdin)
 		chmod(final_pack_name, 0444);
 
+	if (curr_rev_name && final_rev_name != curr_rev_name) {
+		if (!final_rev_name) {
+			snprintf(name, sizeof(name), "%s/pack/pack-%s.rev",
+				 get_object_directory(), sha1_to_hex(sha1));
+			final_rev_name = name;
+		}
+		if (move_temp_to_file(curr_rev_name, final_rev_name))
+			die(_("cannot store reverse index file"));
+	} else if (curr_rev_name)
+		chmod(final_rev_name, 0444);
+
+	if (curr_sizes_name && final_sizes_name != curr_sizes_name) {
+		if (!final_sizes_name) {
+			snprintf(name, sizeof(name), "%s/pack/pack-%s.sizes",
+				 get_object_directory(), sha1_to_hex(sha1));
+			final_sizes_name = name;
+		}
+		if (move_temp_to_file(curr_sizes_name, final_sizes_name))
+			die(_("cannot store object size table"));
+	} else if (curr_sizes_name)
+		chmod(final_sizes_name, 0444);
+
 	if (final_index_name != curr_index_name) {
 		if (!final_index_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.idx",
@@ -1481,6 +1704,20 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_REV;
+		else
+			opts->flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.writeobjectsizes")) {
+		if (git_config_bool(k, v))
+			opts->flags |= WRITE_SIZES;
+		else
+			opts->flags &= ~WRITE_SIZES;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -1601,10 +1838,13 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0;
-	const char *curr_index;
-	const char *index_name = NULL, *pack_name = NULL;
+	const char *curr_index, *curr_rev = NULL, *curr_sizes = NULL;
+	const char *index_name = NULL, *pack_name = NULL, *rev_name = NULL;
+	const char *sizes_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	struct strbuf index_name_buf = STRBUF_INIT,
+		      rev_name_buf = STRBUF_INIT,
+		      sizes_name_buf = STRBUF_INIT,
 		      keep_name_buf = STRBUF_INIT;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
@@ -1632,6 +1872,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			} else if (!strcmp(arg, "--strict")) {
 				strict = 1;
 				do_fsck_object = 1;
+			} else if (!strcmp(arg, "--fsck-objects")) {
+				do_fsck_object = 1;
 			} else if (!strcmp(arg, "--check-self-contained-and-connected")) {
 				strict = 1;
 				check_self_contained_and_connected = 1;
@@ -1724,6 +1966,25 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 			die(_("--verify with no packfile name given"));
 		read_idx_option(&opts, index_name);
 		opts.flags |= WRITE_IDX_VERIFY | WRITE_IDX_STRICT;
+		opts.flags &= ~(WRITE_REV | WRITE_SIZES);
+	}
+	if ((opts.flags & WRITE_REV) && index_name) {
+		size_t len;
+		if (!strip_suffix(index_name, ".idx", &len))
+			die(_("index file name '%s' does not end with '.idx'"),
+			    index_name);
+		strbuf_add(&rev_name_buf, index_name, len);
+		strbuf_addstr(&rev_name_buf, ".rev");
+		rev_name = rev_name_buf.buf;
+	}
+	if ((opts.flags & WRITE_SIZES) && index_name) {
+		size_t len;
+		if (!strip_suffix(index_name, ".idx", &len))
+			die(_("index file name '%s' does not end with '.idx'"),
+			    index_name);
+		strbuf_add(&sizes_name_buf, index_name, len);
+		strbuf_addstr(&sizes_name_buf, ".sizes");
+		sizes_name = sizes_name_buf.buf;
 	}
 	if (strict)
 		opts.flags |= WRITE_IDX_STRICT;
@@ -1742,10 +2003,19 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	objects = xcalloc(nr_objects + 1, sizeof(struct object_entry));
 	if (show_stat)
 		obj_stat = xcalloc(nr_objects + 1, sizeof(struct object_stat));
+	if (opts.flags & WRITE_SIZES)
+		delta_sizes = xcalloc(nr_objects + 1, sizeof(*delta_sizes));
 	ofs_deltas = xcalloc(nr_objects, sizeof(struct ofs_delta_entry));
+	trace_region_enter("index-pack", "parse objects");
 	parse_pack_objects(pack_sha1);
+	trace_region_leave("index-pack", "parse objects");
+	trace_region_enter("index-pack", "resolve deltas");
 	resolve_deltas();
+	trace_region_leave("index-pack", "resolve deltas");
+	trace_region_enter("index-pack", "conclude pack");
 	conclude_pack(fix_thin_pack, curr_pack, pack_sha1);
+	trace_region_leave("index-pack", "conclude pack");
+	trace_counter("index-pack", "objects", nr_objects);
 	free(ofs_deltas);
 	free(ref_deltas);
 	if (strict)
@@ -1758,22 +2028,36 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if (opts.flags & WRITE_REV)
+		curr_rev = write_rev_file(rev_name, idx_objects, nr_objects, pack_sha1);
+	if (opts.flags & WRITE_SIZES)
+		curr_sizes = write_sizes_file(sizes_name, idx_objects, nr_objects,
+					      object_info, pack_sha1);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
 		      index_name, curr_index,
+		      rev_name, curr_rev,
+		      sizes_name, curr_sizes,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
 		close(input_fd);
 	free(objects);
+	free(delta_sizes);
 	strbuf_release(&index_name_buf);
+	strbuf_release(&rev_name_buf);
+	strbuf_release(&sizes_name_buf);
 	strbuf_release(&keep_name_buf);
 	if (pack_name == NULL)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	if (rev_name == NULL)
+		free((void *) curr_rev);
+	if (sizes_name == NULL)
+		free((void *) curr_sizes);
 
 	/*
 	 * Let the caller know this pack is not self contained
@@ -206,6 +206,7 @@ static int create_default_files(const char *template_path)
 	char junk[2];
 	int reinit;
 	int filemode;
+	int format_version;
 
 	if (len > sizeof(path)-50)
 		die(_("insane git directory %s"), git_dir);
@@ -260,8 +261,15 @@ static int create_default_files(const char *template_path)
 			exit(1);
 	}
 
-	/* This forces creation of new config file */
-	sprintf(repo_version_string, "%d", GIT_REPO_VERSION);
+	/*
+	 * This forces creation of new config file.  Do not downgrade a
+	 * repository that needs a newer format, e.g. a partial clone.
+	 */
+	if (!reinit ||
+	    git_config_get_int("core.repositoryformatversion", &format_version) ||
+	    format_version < GIT_REPO_VERSION)
+		format_version = GIT_REPO_VERSION;
+	sprintf(repo_version_string, "%d", format_version);
 	git_config_set("core.repositoryformatversion", repo_version_string);
 
 	path[len] = 0;
@@ -401,6 +409,22 @@ int init_db(const char *template_dir, unsigned int flags)
 
 	reinit = create_default_files(template_dir);
 
+	if (flags & INIT_DB_REFTABLE && !repository_format_reftable) {
+		if (reinit)
+			die(_("cannot change the ref storage format of an existing repository"));
+		git_config_set("core.repositoryformatversion", "1");
+		git_config_set("extensions.refstorage", "reftable");
+		repository_format_version = 1;
+		repository_format_reftable = 1;
+	}
+	if (repository_format_reftable) {
+		const char *tables_list = git_path("reftable/tables.list");
+
+		safe_create_dir(git_path("reftable"), 1);
+		if (access(tables_list, F_OK))
+			write_file(tables_list, 1, "%s", "");
+	}
+
 	create_object_directory();
 
 	if (shared_repository) {
@@ -495,6 +519,7 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 	const char *real_git_dir = NULL;
 	const char *work_tree;
 	const char *template_dir = NULL;
+	const char *ref_format = NULL;
 	unsigned int flags = 0;
 	const struct option init_db_options[] = {
 		OPT_STRING(0, "template", &template_dir, N_("template-directory"),
@@ -508,11 +533,18 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-format", &ref_format, N_("format"),
+			   N_("how to store refs (files or reftable)")),
 		OPT_END()
 	};
 
 	argc = parse_options(argc, argv, prefix, init_db_options, init_db_usage, 0);
 
+	if (ref_format && !strcmp(ref_format, "reftable"))
+		flags |= INIT_DB_REFTABLE;
+	else if (ref_format && strcmp(ref_format, "files"))
+		die(_("unknown ref storage format '%s'"), ref_format);
+
 	if (real_git_dir && !is_absolute_path(real_git_dir))
 		real_git_dir = xstrdup(real_path(real_git_dir));
 
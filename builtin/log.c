@@ -25,6 +25,8 @@
 #include "version.h"
 #include "mailmap.h"
 #include "gpg-interface.h"
+#include "thread-utils.h"
+#include "diffstat-pipeline.h"
 
 /* Set a default date-time format for git log ("log.date" config variable) */
 static const char *default_date_mode = NULL;
@@ -34,6 +36,7 @@ static int default_show_root = 1;
 static int decoration_style;
 static int decoration_given;
 static int use_mailmap_config;
+static int log_threads = 1;
 static const char *fmt_patch_subject_prefix = "PATCH";
 static const char *fmt_pretty;
 
@@ -191,6 +194,8 @@ static void cmd_log_init_finish(int argc, const char **argv, const char *prefix,
 	if (rev->line_level_traverse)
 		line_log_init(rev, line_cb.prefix, &line_cb.args);
 
+	rev->grep_threads = log_threads ? log_threads : online_cpus();
+
 	setup_pager();
 }
 
@@ -317,11 +322,87 @@ static void finish_early_output(struct rev_info *rev)
 	show_early_header(rev, "done", n);
 }
 
+/*
+ * With log.threads, the walk runs up to LOOKAHEAD_COMMITS commits (or
+ * LOOKAHEAD_BYTES of blobs waiting to be diffed) ahead of the commit
+ * being shown, so that the diffstat pipeline can count the lines of
+ * the upcoming commits in the background.
+ */
+#define LOOKAHEAD_COMMITS 64
+#define LOOKAHEAD_BYTES (64 * 1024 * 1024)
+
+struct log_lookahead {
+	struct commit **commits;
+	int nr, alloc, first;
+	unsigned seq;	/* of commits[first] */
+	int done;
+};
+
+/*
+ * Looking ahead calls get_revision() earlier than the commits are
+ * shown, which is only safe when showing a commit does not depend on
+ * the state of the walk at that point (or feed back into it, as the
+ * max_count adjustment in cmd_log_walk() does).
+ */
+static int want_lookahead(struct rev_info *rev)
+{
+	int nr_threads = log_threads ? log_threads : online_cpus();
+
+	if (nr_threads <= 1 || !rev->diff ||
+	    !(rev->diffopt.output_format &
+	      (DIFF_FORMAT_DIFFSTAT | DIFF_FORMAT_NUMSTAT |
+	       DIFF_FORMAT_SHORTSTAT)))
+		return 0;
+	if (rev->graph || rev->reflog_info || rev->early_output ||
+	    rev->track_linear || rev->line_level_traverse ||
+	    DIFF_OPT_TST(&rev->diffopt, FOLLOW_RENAMES) ||
+	    (rev->max_count >= 0 && !rev->always_show_header))
+		return 0;
+	return nr_threads;
+}
+
+static struct commit *next_log_commit(struct rev_info *rev,
+				      struct log_lookahead *ahead)
+{
+	struct commit *commit;
+
+	if (!ahead)
+		return get_revision(rev);
+
+	while (!ahead->done &&
+	       (!ahead->nr ||
+		(ahead->nr < LOOKAHEAD_COMMITS &&
+		 diffstat_pipeline_pending() < LOOKAHEAD_BYTES))) {
+		commit = get_revision(rev);
+		if (!commit) {
+			ahead->done = 1;
+			break;
+		}
+		ALLOC_GROW(ahead->commits, ahead->nr + 1, ahead->alloc);
+		if (ahead->first + ahead->nr >= ahead->alloc) {
+			/* slide the window back to the start of the array */
+			memmove(ahead->commits, ahead->commits + ahead->first,
+				ahead->nr * sizeof(*ahead->commits));
+			ahead->first = 0;
+		}
+		ahead->commits[ahead->first + ahead->nr] = commit;
+		prefetch_log_tree_diffstat(rev, commit, ahead->seq + ahead->nr);
+		ahead->nr++;
+	}
+	if (!ahead->nr)
+		return NULL;
+	commit = ahead->commits[ahead->first++];
+	ahead->nr--;
+	return commit;
+}
+
 static int cmd_log_walk(struct rev_info *rev)
 {
 	struct commit *commit;
+	struct log_lookahead lookahead, *ahead = NULL;
 	int saved_nrl = 0;
 	int saved_dcctc = 0;
+	int nr_threads;
 
 	if (rev->early_output)
 		setup_early_output(rev);
@@ -332,12 +413,23 @@ static int cmd_log_walk(struct rev_info *rev)
 	if (rev->early_output)
 		finish_early_output(rev);
 
+	nr_threads = want_lookahead(rev);
+	if (nr_threads) {
+		start_diffstat_pipeline(nr_threads, rev->diffopt.xdl_opts,
+					rev->diffopt.context,
+					rev->diffopt.interhunkcontext);
+		if (diffstat_pipeline_active()) {
+			memset(&lookahead, 0, sizeof(lookahead));
+			ahead = &lookahead;
+		}
+	}
+
 	/*
 	 * For --check and --exit-code, the exit code is based on CHECK_FAILED
 	 * and HAS_CHANGES being accumulated in rev->diffopt, so be careful to
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
-	while ((commit = get_revision(rev)) != NULL) {
+	while ((commit = next_log_commit(rev, ahead)) != NULL) {
 		if (!log_tree_commit(rev, commit) &&
 		    rev->max_count >= 0)
 			/*
@@ -345,6 +437,8 @@ static int cmd_log_walk(struct rev_info *rev)
 			 * but we didn't actually show the commit.
 			 */
 			rev->max_count++;
+		if (ahead)
+			diffstat_pipeline_retire(ahead->seq++);
 		if (!rev->reflog_info) {
 			/* we allow cycles in reflog ancestry */
 			free_commit_buffer(commit);
@@ -358,6 +452,10 @@ static int cmd_log_walk(struct rev_info *rev)
 	}
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
+	if (ahead) {
+		finish_diffstat_pipeline();
+		free(lookahead.commits);
+	}
 
 	if (rev->diffopt.output_format & DIFF_FORMAT_CHECKDIFF &&
 	    DIFF_OPT_TST(&rev->diffopt, CHECK_FAILED)) {
@@ -396,6 +494,13 @@ static int git_log_config(const char *var, const char *value, void *cb)
 		use_mailmap_config = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "log.threads")) {
+		log_threads = git_config_int(var, value);
+		if (log_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    log_threads, var);
+		return 0;
+	}
 
 	if (grep_config(var, value, cb) < 0)
 		return -1;
@@ -969,8 +1074,8 @@ static void make_cover_letter(struct rev_info *rev, int use_stdout,
 
 	diff_setup_done(&opts);
 
-	diff_tree_sha1(origin->tree->object.sha1,
-		       head->tree->object.sha1,
+	diff_tree_sha1(get_commit_tree_sha1(origin),
+		       get_commit_tree_sha1(head),
 		       "", &opts);
 	diffcore_std(&opts);
 	diff_flush(&opts);
@@ -14,6 +14,7 @@
 #include "resolve-undo.h"
 #include "string-list.h"
 #include "pathspec.h"
+#include "sparse-index.h"
 
 static int abbrev;
 static int show_deleted;
@@ -27,6 +28,7 @@ static int show_killed;
 static int show_valid_bit;
 static int line_terminator = '\n';
 static int debug_mode;
+static int show_sparse_dirs;
 
 static const char *prefix;
 static int max_prefix_len;
@@ -47,14 +49,41 @@ static const char *tag_modified = "";
 static const char *tag_skip_worktree = "";
 static const char *tag_resolve_undo = "";
 
+/*
+ * What is shown is gathered here and written out in large chunks,
+ * instead of going through stdio field by field.
+ */
+static struct strbuf out = STRBUF_INIT;
+#define OUTPUT_CHUNK 65536
+
+static void flush_output(void)
+{
+	write_or_die(1, out.buf, out.len);
+	strbuf_reset(&out);
+}
+
 static void write_name(const char *name)
 {
+	struct strbuf sb = STRBUF_INIT;
+	const char *rel = name;
+
 	/*
-	 * With "--full-name", prefix_len=0; this caller needs to pass
-	 * an empty string in that case (a NULL is good for "").
+	 * With "--full-name", prefix_len=0 and names are shown as they
+	 * are.  Names inside the prefix only lose it; it takes
+	 * relative_path() to go up from there.
 	 */
-	write_name_quoted_relative(name, prefix_len ? prefix : NULL,
-				   stdout, line_terminator);
+	if (prefix_len) {
+		if (!strncmp(name, prefix, prefix_len) && name[prefix_len])
+			rel = name + prefix_len;
+		else
+			rel = relative_path(name, prefix, &sb);
+	}
+	if (line_terminator)
+		quote_c_style(rel, &out, NULL, 0);
+	else
+		strbuf_addstr(&out, rel);
+	strbuf_addch(&out, line_terminator);
+	strbuf_release(&sb);
 }
 
 static void show_dir_entry(const char *tag, struct dir_entry *ent)
@@ -67,7 +96,9 @@ static void show_dir_entry(const char *tag, struct dir_entry *ent)
 	if (!dir_path_match(ent, &pathspec, len, ps_matched))
 		return;
 
-	fputs(tag, stdout);
+	if (out.len >= OUTPUT_CHUNK)
+		flush_output();
+	strbuf_addstr(&out, tag);
 	write_name(ent->name);
 }
 
@@ -161,24 +192,26 @@ static void show_ce_entry(const char *tag, const struct cache_entry *ce)
 		tag = alttag;
 	}
 
+	if (out.len >= OUTPUT_CHUNK)
+		flush_output();
 	if (!show_stage) {
-		fputs(tag, stdout);
+		strbuf_addstr(&out, tag);
 	} else {
-		printf("%s%06o %s %d\t",
-		       tag,
-		       ce->ce_mode,
-		       find_unique_abbrev(ce->sha1,abbrev),
-		       ce_stage(ce));
+		strbuf_addf(&out, "%s%06o %s %d\t",
+			    tag,
+			    ce->ce_mode,
+			    find_unique_abbrev(ce->sha1,abbrev),
+			    ce_stage(ce));
 	}
 	write_name(ce->name);
 	if (debug_mode) {
 		const struct stat_data *sd = &ce->ce_stat_data;
 
-		printf("  ctime: %d:%d\n", sd->sd_ctime.sec, sd->sd_ctime.nsec);
-		printf("  mtime: %d:%d\n", sd->sd_mtime.sec, sd->sd_mtime.nsec);
-		printf("  dev: %d\tino: %d\n", sd->sd_dev, sd->sd_ino);
-		printf("  uid: %d\tgid: %d\n", sd->sd_uid, sd->sd_gid);
-		printf("  size: %d\tflags: %x\n", sd->sd_size, ce->ce_flags);
+		strbuf_addf(&out, "  ctime: %d:%d\n", sd->sd_ctime.sec, sd->sd_ctime.nsec);
+		strbuf_addf(&out, "  mtime: %d:%d\n", sd->sd_mtime.sec, sd->sd_mtime.nsec);
+		strbuf_addf(&out, "  dev: %d\tino: %d\n", sd->sd_dev, sd->sd_ino);
+		strbuf_addf(&out, "  uid: %d\tgid: %d\n", sd->sd_uid, sd->sd_gid);
+		strbuf_addf(&out, "  size: %d\tflags: %x\n", sd->sd_size, ce->ce_flags);
 	}
 }
 
@@ -203,9 +236,12 @@ static void show_ru_info(void)
 		for (i = 0; i < 3; i++) {
 			if (!ui->mode[i])
 				continue;
-			printf("%s%06o %s %d\t", tag_resolve_undo, ui->mode[i],
-			       find_unique_abbrev(ui->sha1[i], abbrev),
-			       i + 1);
+			if (out.len >= OUTPUT_CHUNK)
+				flush_output();
+			strbuf_addf(&out, "%s%06o %s %d\t", tag_resolve_undo,
+				    ui->mode[i],
+				    find_unique_abbrev(ui->sha1[i], abbrev),
+				    i + 1);
 			write_name(path);
 		}
 	}
@@ -293,6 +329,59 @@ static void prune_cache(const char *prefix)
 	active_nr = last;
 }
 
+/*
+ * Listing what is cached needs neither the work tree nor the index as
+ * a whole, so it can stream the entries out of the mmapped index file
+ * instead of decoding all of them first.  A pathspec with a trailing
+ * slash needs the index while it is parsed, to see if it names a
+ * submodule.
+ */
+static int can_use_index_view(struct dir_struct *dir, int argc,
+			      const char **argv)
+{
+	int i;
+
+	if (show_deleted || show_modified || show_others || show_killed ||
+	    show_resolve_undo || show_sparse_dirs || with_tree ||
+	    (dir->flags & DIR_SHOW_IGNORED))
+		return 0;
+	for (i = 0; i < argc; i++)
+		if (ends_with(argv[i], "/"))
+			return 0;
+	return 1;
+}
+
+static void show_view_files(struct index_view *view, const char *prefix)
+{
+	int pos = 0, first, last = view->nr;
+
+	if (prefix) {
+		/* like prune_cache() */
+		pos = index_view_name_pos(view, prefix, max_prefix_len);
+		if (pos < 0)
+			pos = -pos-1;
+		first = pos;
+		while (last > first) {
+			int next = (last + first) >> 1, len;
+			const char *name = index_view_name(view, next, &len);
+			if (!strncmp(name, prefix, max_prefix_len)) {
+				first = next+1;
+				continue;
+			}
+			last = next;
+		}
+	}
+	for (; pos < last; pos++) {
+		const struct cache_entry *ce;
+
+		if (show_unmerged && !index_view_stage(view, pos))
+			continue;
+		ce = index_view_entry(view, pos);
+		show_ce_entry(ce_stage(ce) ? tag_unmerged :
+			(ce_skip_worktree(ce) ? tag_skip_worktree : tag_cached), ce);
+	}
+}
+
 /*
  * Read the tree specified with --with-tree option
  * (typically, HEAD) into stage #1 and then
@@ -402,8 +491,9 @@ static int option_parse_exclude_standard(const struct option *opt,
 
 int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 {
-	int require_work_tree = 0, show_tag = 0, i;
+	int require_work_tree = 0, show_tag = 0, use_view, i;
 	const char *max_prefix;
+	struct index_view view;
 	struct dir_struct dir;
 	struct exclude_list *el;
 	struct string_list exclude_list = STRING_LIST_INIT_NODUP;
@@ -460,6 +550,8 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 			N_("pretend that paths removed since <tree-ish> are still present")),
 		OPT__ABBREV(&abbrev),
 		OPT_BOOL(0, "debug", &debug_mode, N_("show debugging data")),
+		OPT_BOOL(0, "sparse", &show_sparse_dirs,
+			N_("show sparse directories in a sparse index")),
 		OPT_END()
 	};
 
@@ -472,11 +564,17 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 		prefix_len = strlen(prefix);
 	git_config(git_default_config, NULL);
 
-	if (read_cache() < 0)
-		die("index file corrupt");
-
 	argc = parse_options(argc, argv, prefix, builtin_ls_files_options,
 			ls_files_usage, 0);
+	use_view = can_use_index_view(&dir, argc, argv) &&
+		   !index_view_open(&view, get_index_file());
+	if (!use_view) {
+		command_requires_full_index = 0;
+		if (read_cache() < 0)
+			die("index file corrupt");
+		if (!show_sparse_dirs)
+			ensure_full_index(&the_index);
+	}
 	el = add_exclude_list(&dir, EXC_CMDL, "--exclude option");
 	for (i = 0; i < exclude_list.nr; i++) {
 		add_exclude(exclude_list.items[i].string, "", 0, el, --exclude_args);
@@ -526,6 +624,11 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 	      show_killed || show_modified || show_resolve_undo))
 		show_cached = 1;
 
+	if (use_view) {
+		show_view_files(&view, max_prefix);
+		index_view_release(&view);
+		goto report;
+	}
 	if (max_prefix)
 		prune_cache(max_prefix);
 	if (with_tree) {
@@ -541,6 +644,8 @@ int cmd_ls_files(int argc, const char **argv, const char *cmd_prefix)
 	if (show_resolve_undo)
 		show_ru_info();
 
+report:
+	flush_output();
 	if (ps_matched) {
 		int bad;
 		bad = report_path_error(ps_matched, &pathspec, prefix);
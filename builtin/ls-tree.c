@@ -24,6 +24,40 @@ static struct pathspec pathspec;
 static int chomp_prefix;
 static const char *ls_tree_prefix;
 
+/*
+ * Entries are gathered here and written out in large chunks,
+ * instead of going through stdio field by field.
+ */
+static struct strbuf out = STRBUF_INIT;
+#define OUTPUT_CHUNK 65536
+
+static void flush_output(void)
+{
+	write_or_die(1, out.buf, out.len);
+	strbuf_reset(&out);
+}
+
+static void write_name(const char *name)
+{
+	struct strbuf sb = STRBUF_INIT;
+	const char *rel = name;
+
+	/* Names inside the prefix only lose it, as relative_path() would do */
+	if (chomp_prefix) {
+		if (!strncmp(name, ls_tree_prefix, chomp_prefix) &&
+		    name[chomp_prefix])
+			rel = name + chomp_prefix;
+		else
+			rel = relative_path(name, ls_tree_prefix, &sb);
+	}
+	if (line_termination)
+		quote_c_style(rel, &out, NULL, 0);
+	else
+		strbuf_addstr(&out, rel);
+	strbuf_addch(&out, line_termination);
+	strbuf_release(&sb);
+}
+
 static const  char * const ls_tree_usage[] = {
 	N_("git ls-tree [<options>] <tree-ish> [<path>...]"),
 	NULL
@@ -90,6 +124,8 @@ static int show_tree(const unsigned char *sha1, struct strbuf *base,
 	else if (ls_options & LS_TREE_ONLY)
 		return 0;
 
+	if (out.len >= OUTPUT_CHUNK)
+		flush_output();
 	if (!(ls_options & LS_NAME_ONLY)) {
 		if (ls_options & LS_SHOW_SIZE) {
 			char size_text[24];
@@ -102,18 +138,16 @@ static int show_tree(const unsigned char *sha1, struct strbuf *base,
 						 "%lu", size);
 			} else
 				strcpy(size_text, "-");
-			printf("%06o %s %s %7s\t", mode, type,
-			       find_unique_abbrev(sha1, abbrev),
-			       size_text);
+			strbuf_addf(&out, "%06o %s %s %7s\t", mode, type,
+				    find_unique_abbrev(sha1, abbrev),
+				    size_text);
 		} else
-			printf("%06o %s %s\t", mode, type,
-			       find_unique_abbrev(sha1, abbrev));
+			strbuf_addf(&out, "%06o %s %s\t", mode, type,
+				    find_unique_abbrev(sha1, abbrev));
 	}
 	baselen = base->len;
 	strbuf_addstr(base, pathname);
-	write_name_quoted_relative(base->buf,
-				   chomp_prefix ? ls_tree_prefix : NULL,
-				   stdout, line_termination);
+	write_name(base->buf);
 	strbuf_setlen(base, baselen);
 	return retval;
 }
@@ -184,5 +218,7 @@ int cmd_ls_tree(int argc, const char **argv, const char *prefix)
 	tree = parse_tree_indirect(sha1);
 	if (!tree)
 		die("not a tree object");
-	return !!read_tree_recursive(tree, "", 0, 0, &pathspec, show_tree, NULL);
+	i = read_tree_recursive(tree, "", 0, 0, &pathspec, show_tree, NULL);
+	flush_output();
+	return !!i;
 }
@@ -20,6 +20,16 @@ static int label_cb(const struct option *opt, const char *arg, int unset)
 	return 0;
 }
 
+static int write_to_stdout(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	int i;
+
+	for (i = 0; i < nbuf; i++)
+		if (fwrite(mb[i].ptr, mb[i].size, 1, stdout) != 1)
+			return -1;
+	return 0;
+}
+
 int cmd_merge_file(int argc, const char **argv, const char *prefix)
 {
 	const char *names[3] = { NULL, NULL, NULL };
@@ -83,6 +93,23 @@ int cmd_merge_file(int argc, const char **argv, const char *prefix)
 	xmp.ancestor = names[1];
 	xmp.file1 = names[0];
 	xmp.file2 = names[2];
+
+	if (to_stdout) {
+		/* nothing is overwritten, so there is no need to hold it all */
+		xdemitcb_t ecb;
+
+		ecb.priv = NULL;
+		ecb.outf = write_to_stdout;
+		ret = xdl_merge_stream(mmfs + 1, mmfs + 0, mmfs + 2, &xmp, &ecb);
+		for (i = 0; i < 3; i++)
+			free(mmfs[i].ptr);
+		if (ret < 0 && ferror(stdout))
+			return error("Could not write to stdout");
+		if (fclose(stdout))
+			return error("Could not close stdout");
+		return ret;
+	}
+
 	ret = xdl_merge(mmfs + 1, mmfs + 0, mmfs + 2, &xmp, &result);
 
 	for (i = 0; i < 3; i++)
@@ -91,7 +118,7 @@ int cmd_merge_file(int argc, const char **argv, const char *prefix)
 	if (ret >= 0) {
 		const char *filename = argv[0];
 		const char *fpath = prefix_filename(prefix, prefixlen, argv[0]);
-		FILE *f = to_stdout ? stdout : fopen(fpath, "wb");
+		FILE *f = fopen(fpath, "wb");
 
 		if (!f)
 			ret = error("Could not open %s for writing", filename);
@@ -4,8 +4,12 @@
 #include "blob.h"
 #include "exec_cmd.h"
 #include "merge-blobs.h"
+#include "merge-recursive.h"
+#include "quote.h"
 
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+static const char merge_tree_usage[] =
+"git merge-tree <base-tree> <branch1> <branch2>\n"
+"   or: git merge-tree --write-tree <branch1> <branch2>";
 
 struct merge_list {
 	struct merge_list *next;
@@ -25,7 +29,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -218,7 +222,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(t+2, ENTRY_SHA1(n + 2));
 #undef ENTRY_SHA1
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -335,7 +339,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -357,18 +361,72 @@ static void *get_tree_descriptor(struct tree_desc *desc, const char *rev)
 	return buf;
 }
 
+static struct commit *get_merge_commit(const char *rev)
+{
+	struct commit *commit = lookup_commit_reference_by_name(rev);
+
+	if (!commit)
+		die("%s is not a commit", rev);
+	return commit;
+}
+
+/*
+ * Merge two commits the way "git merge" would, but in memory: write
+ * out the resulting tree, with conflict markers where the merge did
+ * not go cleanly, list the conflicted stages and the messages, and
+ * leave the index and the work tree alone.
+ */
+static int write_tree(int argc, const char **argv)
+{
+	struct merge_options o;
+	struct commit *result;
+	int clean, i;
+
+	if (argc != 3)
+		usage(merge_tree_usage);
+
+	init_merge_options(&o);
+	o.branch1 = argv[1];
+	o.branch2 = argv[2];
+	o.in_memory = 1;
+	o.buffer_output = 2;
+	clean = merge_recursive(&o, get_merge_commit(argv[1]),
+				get_merge_commit(argv[2]), NULL, &result);
+	if (clean < 0)
+		die("merging %s and %s failed", argv[1], argv[2]);
+
+	printf("%s\n", sha1_to_hex(get_commit_tree(result)->object.sha1));
+	for (i = 0; i < active_nr; i++) {
+		const struct cache_entry *ce = active_cache[i];
+
+		if (!ce_stage(ce))
+			continue;
+		printf("%06o %s %d\t", ce->ce_mode, sha1_to_hex(ce->sha1),
+		       ce_stage(ce));
+		write_name_quoted(ce->name, stdout, '\n');
+	}
+	if (o.obuf.len) {
+		putchar('\n');
+		fputs(o.obuf.buf, stdout);
+	}
+	strbuf_release(&o.obuf);
+	return clean ? 0 : 1;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
 
+	if (argc > 1 && !strcmp(argv[1], "--write-tree"))
+		return write_tree(argc - 1, argv + 1);
 	if (argc != 4)
 		usage(merge_tree_usage);
 
 	buf1 = get_tree_descriptor(t+0, argv[1]);
 	buf2 = get_tree_descriptor(t+1, argv[2]);
 	buf3 = get_tree_descriptor(t+2, argv[3]);
-	merge_trees(t, "");
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -0,0 +1,40 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static const char * const multi_pack_index_usage[] = {
+	N_("git multi-pack-index [--object-dir=<dir>] (write | verify | clear)"),
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	const char *object_dir = NULL;
+	const struct option options[] = {
+		OPT_FILENAME(0, "object-dir", &object_dir,
+			N_("object directory containing the packs to index")),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, options,
+			     multi_pack_index_usage, 0);
+	if (argc != 1)
+		usage_with_options(multi_pack_index_usage, options);
+
+	if (!object_dir)
+		object_dir = get_object_directory();
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_multi_pack_index(object_dir);
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_multi_pack_index(object_dir);
+	if (!strcmp(argv[0], "clear")) {
+		clear_multi_pack_index(object_dir);
+		return 0;
+	}
+
+	usage_with_options(multi_pack_index_usage, options);
+}
@@ -5,6 +5,8 @@
 #include "refs.h"
 #include "parse-options.h"
 #include "sha1-lookup.h"
+#include "commit-slab.h"
+#include "commit-graph.h"
 
 #define CUTOFF_DATE_SLOP 86400 /* one day */
 
@@ -14,67 +16,129 @@ typedef struct rev_name {
 	int distance;
 } rev_name;
 
+define_commit_slab(commit_rev_name, struct rev_name *);
+
+static struct commit_rev_name rev_names;
 static long cutoff = LONG_MAX;
+static uint32_t generation_cutoff;
 
 /* How many generations are maximally preferred over _one_ merge traversal? */
 #define MERGE_TRAVERSAL_WEIGHT 65535
 
-static void name_rev(struct commit *commit,
-		const char *tip_name, int generation, int distance,
-		int deref)
+static struct rev_name *get_commit_rev_name(const struct commit *commit)
 {
-	struct rev_name *name = (struct rev_name *)commit->util;
-	struct commit_list *parents;
-	int parent_number = 1;
+	struct rev_name **slot = commit_rev_name_peek(&rev_names, commit);
 
-	parse_commit(commit);
+	return slot ? *slot : NULL;
+}
 
-	if (commit->date < cutoff)
-		return;
+/*
+ * A commit waiting to be named.  For the first parent of a commit
+ * (and for the tips), "tip_name" and "generation" are its name; for
+ * the other parents of a merge, the name is only built from them, the
+ * merge's own name and "parent_number", when it turns out to be better
+ * than the one the commit already has.
+ */
+struct name_rev_entry {
+	struct commit *commit;
+	const char *tip_name;
+	int generation;
+	int distance;
+	int parent_number;
+};
 
-	if (deref) {
+static struct name_rev_stack {
+	struct name_rev_entry *entries;
+	int nr, alloc;
+} name_rev_stack;
+
+static void push_name_rev(struct commit *commit, const char *tip_name,
+			  int generation, int distance, int parent_number)
+{
+	struct name_rev_entry *e;
+
+	ALLOC_GROW(name_rev_stack.entries, name_rev_stack.nr + 1,
+		   name_rev_stack.alloc);
+	e = &name_rev_stack.entries[name_rev_stack.nr++];
+	e->commit = commit;
+	e->tip_name = tip_name;
+	e->generation = generation;
+	e->distance = distance;
+	e->parent_number = parent_number;
+}
+
+static const char *merge_parent_name(const char *tip_name, int generation,
+				     int parent_number)
+{
+	int len = strlen(tip_name);
+
+	if (len > 2 && !strcmp(tip_name + len - 2, "^0"))
+		len -= 2;
+	if (generation > 0)
+		return xstrfmt("%.*s~%d^%d", len, tip_name,
+			       generation, parent_number);
+	return xstrfmt("%.*s^%d", len, tip_name, parent_number);
+}
+
+/*
+ * Name "commit" and its ancestors after the tip "tip_name", wherever
+ * that gives a shorter name than they already have.  The history is
+ * walked depth first, following the first parents before the others,
+ * with an explicit stack so that long histories do not overflow the
+ * C stack.
+ */
+static void name_rev(struct commit *commit, const char *tip_name, int deref)
+{
+	if (deref)
 		tip_name = xstrfmt("%s^0", tip_name);
+	push_name_rev(commit, tip_name, 0, 0, 1);
 
-		if (generation)
-			die("generation: %d, but deref?", generation);
-	}
+	while (name_rev_stack.nr) {
+		struct name_rev_entry e = name_rev_stack.entries[--name_rev_stack.nr];
+		struct rev_name *name;
+		struct commit_list *parents;
+		int parent_number, nr_parents;
+
+		parse_commit(e.commit);
+		if (e.commit->date < cutoff)
+			continue;
+		/* nothing below the commits we were asked about can lead to them */
+		if (e.commit->generation < generation_cutoff)
+			continue;
 
-	if (name == NULL) {
-		name = xmalloc(sizeof(rev_name));
-		commit->util = name;
-		goto copy_data;
-	} else if (name->distance > distance) {
-copy_data:
-		name->tip_name = tip_name;
-		name->generation = generation;
-		name->distance = distance;
-	} else
-		return;
-
-	for (parents = commit->parents;
-			parents;
-			parents = parents->next, parent_number++) {
-		if (parent_number > 1) {
-			int len = strlen(tip_name);
-			char *new_name = xmalloc(len +
-				1 + decimal_length(generation) +  /* ~<n> */
-				1 + 2 +				  /* ^NN */
-				1);
-
-			if (len > 2 && !strcmp(tip_name + len - 2, "^0"))
-				len -= 2;
-			if (generation > 0)
-				sprintf(new_name, "%.*s~%d^%d", len, tip_name,
-						generation, parent_number);
+		name = get_commit_rev_name(e.commit);
+		if (name && name->distance <= e.distance)
+			continue;
+		if (!name) {
+			name = xmalloc(sizeof(rev_name));
+			*commit_rev_name_at(&rev_names, e.commit) = name;
+		}
+		if (e.parent_number > 1) {
+			e.tip_name = merge_parent_name(e.tip_name, e.generation,
+						       e.parent_number);
+			e.generation = 0;
+		}
+		name->tip_name = e.tip_name;
+		name->generation = e.generation;
+		name->distance = e.distance;
+
+		/* push in reverse, so that the first parent is named first */
+		nr_parents = commit_list_count(e.commit->parents);
+		for (parent_number = nr_parents; parent_number > 0; parent_number--) {
+			int i;
+
+			parents = e.commit->parents;
+			for (i = 1; i < parent_number; i++)
+				parents = parents->next;
+			if (parent_number > 1)
+				push_name_rev(parents->item, e.tip_name,
+					      e.generation,
+					      e.distance + MERGE_TRAVERSAL_WEIGHT,
+					      parent_number);
 			else
-				sprintf(new_name, "%.*s^%d", len, tip_name,
-						parent_number);
-
-			name_rev(parents->item, new_name, 0,
-				distance + MERGE_TRAVERSAL_WEIGHT, 0);
-		} else {
-			name_rev(parents->item, tip_name, generation + 1,
-				distance + 1, 0);
+				push_name_rev(parents->item, e.tip_name,
+					      e.generation + 1,
+					      e.distance + 1, 1);
 		}
 	}
 }
@@ -173,7 +237,7 @@ static int name_ref(const char *path, const struct object_id *oid, int flags, vo
 		struct commit *commit = (struct commit *)o;
 
 		path = name_ref_abbrev(path, can_abbreviate_output);
-		name_rev(commit, xstrdup(path), 0, 0, deref);
+		name_rev(commit, xstrdup(path), deref);
 	}
 	return 0;
 }
@@ -214,7 +278,7 @@ static const char *get_rev_name(const struct object *o)
 	if (o->type != OBJ_COMMIT)
 		return get_exact_ref_match(o);
 	c = (struct commit *) o;
-	n = c->util;
+	n = get_commit_rev_name(c);
 	if (!n)
 		return NULL;
 
@@ -333,6 +397,9 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 	}
 	if (all || transform_stdin)
 		cutoff = 0;
+	else if (generation_numbers_enabled())
+		generation_cutoff = GENERATION_NUMBER_INFINITY;
+	init_commit_rev_name(&rev_names);
 
 	for (; argc; argc--, argv++) {
 		unsigned char sha1[20];
@@ -362,6 +429,8 @@ int cmd_name_rev(int argc, const char **argv, const char *prefix)
 		if (commit) {
 			if (cutoff > commit->date)
 				cutoff = commit->date;
+			if (generation_cutoff > commit->generation)
+				generation_cutoff = commit->generation;
 		}
 
 		if (peel_tag) {
@@ -9,6 +9,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-bases.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -21,8 +22,12 @@
 #include "thread-utils.h"
 #include "pack-bitmap.h"
 #include "reachable.h"
-#include "sha1-array.h"
+#include "oidset.h"
 #include "argv-array.h"
+#include "delta-islands.h"
+#include "list-objects-filter.h"
+#include "pkt-line.h"
+#include "string-list.h"
 
 static const char *pack_usage[] = {
 	N_("git pack-objects --stdout [options...] [< ref-list | < object-list]"),
@@ -37,6 +42,18 @@ static const char *pack_usage[] = {
  */
 static struct packing_data to_pack;
 
+#define IN_PACK(obj) oe_in_pack(&to_pack, obj)
+#define SIZE(obj) oe_size(&to_pack, obj)
+#define SET_SIZE(obj, size) oe_set_size(&to_pack, obj, size)
+#define DELTA_SIZE(obj) oe_delta_size(&to_pack, obj)
+#define SET_DELTA_SIZE(obj, size) oe_set_delta_size(&to_pack, obj, size)
+#define DELTA(obj) oe_delta(&to_pack, obj)
+#define SET_DELTA(obj, val) oe_set_delta(&to_pack, obj, val)
+#define DELTA_CHILD(obj) oe_delta_child(&to_pack, obj)
+#define SET_DELTA_CHILD(obj, val) oe_set_delta_child(&to_pack, obj, val)
+#define DELTA_SIBLING(obj) oe_delta_sibling(&to_pack, obj)
+#define SET_DELTA_SIBLING(obj, val) oe_set_delta_sibling(&to_pack, obj, val)
+
 static struct pack_idx_entry **written_list;
 static uint32_t nr_result, nr_written;
 
@@ -51,11 +68,13 @@ static int allow_ofs_delta;
 static struct pack_idx_option pack_idx_opts;
 static const char *base_name;
 static int progress = 1;
+static int record_delta_search;
 static int window = 10;
 static unsigned long pack_size_limit;
 static int depth = 50;
 static int delta_search_threads;
 static int pack_to_stdout;
+static int pipeline_writes = 1;
 static int num_preferred_base;
 static struct progress *progress_state;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
@@ -63,11 +82,30 @@ static int pack_compression_seen;
 
 static struct packed_git *reuse_packfile;
 static uint32_t reuse_packfile_objects;
-static off_t reuse_packfile_offset;
+static struct bitmap *reuse_packfile_bitmap;
 
 static int use_bitmap_index = 1;
+static int used_bitmap_index;
+static int stats_fd = -1;
+static int use_delta_islands;
+static struct list_objects_filter_options filter_options;
+static int allow_missing;
+
+/*
+ * Packs configured with uploadpack.packfileURI that the client can
+ * download over one of its "--uri-protocol"s.  Objects found in them
+ * are left out of our pack; the client fetches the whole pack instead.
+ */
+static struct string_list uri_protocols = STRING_LIST_INIT_NODUP;
+static struct string_list packfile_uri_config = STRING_LIST_INIT_DUP;
+static struct offloaded_pack {
+	struct packed_git *p;
+	const char *uri;
+	int used;
+} *offloaded_packs;
+static int offloaded_packs_nr, offloaded_packs_alloc;
 static int write_bitmap_index;
-static uint16_t write_bitmap_options;
+static uint16_t write_bitmap_options = BITMAP_OPT_HASH_CACHE;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 256 * 1024 * 1024;
@@ -107,12 +145,12 @@ static void *get_delta(struct object_entry *entry)
 	buf = read_sha1_file(entry->idx.sha1, &type, &size);
 	if (!buf)
 		die("unable to read %s", sha1_to_hex(entry->idx.sha1));
-	base_buf = read_sha1_file(entry->delta->idx.sha1, &type, &base_size);
+	base_buf = read_sha1_file(DELTA(entry)->idx.sha1, &type, &base_size);
 	if (!base_buf)
-		die("unable to read %s", sha1_to_hex(entry->delta->idx.sha1));
+		die("unable to read %s", sha1_to_hex(DELTA(entry)->idx.sha1));
 	delta_buf = diff_delta(base_buf, base_size,
 			       buf, size, &delta_size, 0);
-	if (!delta_buf || delta_size != entry->delta_size)
+	if (!delta_buf || delta_size != DELTA_SIZE(entry))
 		die("delta size changed");
 	free(buf);
 	free(base_buf);
@@ -244,8 +282,8 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 	struct git_istream *st = NULL;
 
 	if (!usable_delta) {
-		if (entry->type == OBJ_BLOB &&
-		    entry->size > big_file_threshold &&
+		if (oe_type(entry) == OBJ_BLOB &&
+		    SIZE(entry) > big_file_threshold &&
 		    (st = open_istream(entry->idx.sha1, &type, &size, NULL)) != NULL)
 			buf = NULL;
 		else {
@@ -261,15 +299,15 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		entry->delta_data = NULL;
 		entry->z_delta_size = 0;
 	} else if (entry->delta_data) {
-		size = entry->delta_size;
+		size = DELTA_SIZE(entry);
 		buf = entry->delta_data;
 		entry->delta_data = NULL;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	} else {
 		buf = get_delta(entry);
-		size = entry->delta_size;
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+		size = DELTA_SIZE(entry);
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
@@ -292,7 +330,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 		 * encoding of the relative offset for the delta
 		 * base from this object's position in the pack.
 		 */
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
@@ -318,7 +356,7 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.sha1, 20);
+		sha1write(f, DELTA(entry)->idx.sha1, 20);
 		hdrlen += 20;
 	} else {
 		if (limit && hdrlen + datalen + 20 >= limit) {
@@ -344,25 +382,28 @@ static unsigned long write_no_reuse_object(struct sha1file *f, struct object_ent
 static unsigned long write_reuse_object(struct sha1file *f, struct object_entry *entry,
 					unsigned long limit, int usable_delta)
 {
-	struct packed_git *p = entry->in_pack;
+	struct packed_git *p = IN_PACK(entry);
 	struct pack_window *w_curs = NULL;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	off_t offset;
-	enum object_type type = entry->type;
+	enum object_type type = oe_type(entry);
 	unsigned long datalen;
 	unsigned char header[10], dheader[10];
 	unsigned hdrlen;
 
-	if (entry->delta)
-		type = (allow_ofs_delta && entry->delta->idx.offset) ?
+	if (DELTA(entry))
+		type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
-	hdrlen = encode_in_pack_object_header(type, entry->size, header);
+	hdrlen = encode_in_pack_object_header(type, SIZE(entry), header);
 
 	offset = entry->in_pack_offset;
-	revidx = find_pack_revindex(p, offset);
-	datalen = revidx[1].offset - offset;
+	if (offset_to_pack_pos(p, offset, &pos) < 0)
+		die(_("unable to find the pack position of %s"),
+		    sha1_to_hex(entry->idx.sha1));
+	datalen = pack_pos_to_offset(p, pos + 1) - offset;
 	if (!pack_to_stdout && p->index_version > 1 &&
-	    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+	    check_pack_crc(p, &w_curs, offset, datalen,
+			   pack_pos_to_index(p, pos))) {
 		error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
@@ -372,14 +413,14 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 	datalen -= entry->in_pack_header_size;
 
 	if (!pack_to_stdout && p->index_version == 1 &&
-	    check_pack_inflate(p, &w_curs, offset, datalen, entry->size)) {
+	    check_pack_inflate(p, &w_curs, offset, datalen, SIZE(entry))) {
 		error("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 		unuse_pack(&w_curs);
 		return write_no_reuse_object(f, entry, limit, usable_delta);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
-		off_t ofs = entry->idx.offset - entry->delta->idx.offset;
+		off_t ofs = entry->idx.offset - DELTA(entry)->idx.offset;
 		unsigned pos = sizeof(dheader) - 1;
 		dheader[pos] = ofs & 127;
 		while (ofs >>= 7)
@@ -398,7 +439,7 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 			return 0;
 		}
 		sha1write(f, header, hdrlen);
-		sha1write(f, entry->delta->idx.sha1, 20);
+		sha1write(f, DELTA(entry)->idx.sha1, 20);
 		hdrlen += 20;
 		reused_delta++;
 	} else {
@@ -415,6 +456,45 @@ static unsigned long write_reuse_object(struct sha1file *f, struct object_entry
 }
 
 /* Return 0 if we will bust the pack-size limit */
+/* For the .sizes file of the pack we just wrote */
+static void written_object_info(struct pack_idx_entry *idx,
+				enum object_type *type,
+				enum object_type *in_pack_type,
+				unsigned long *size)
+{
+	struct object_entry *entry = (struct object_entry *)idx;
+
+	if (oe_type(entry) == OBJ_OFS_DELTA || oe_type(entry) == OBJ_REF_DELTA) {
+		/* a reused delta; we only know the size of the delta */
+		*type = sha1_object_info(entry->idx.sha1, size);
+		if (*type < 0)
+			die(_("unable to get the size of %s"),
+			    sha1_to_hex(entry->idx.sha1));
+	} else {
+		*type = oe_type(entry);
+		*size = SIZE(entry);
+	}
+	*in_pack_type = entry->written_type ? entry->written_type : *type;
+}
+
+/* For the .bases file of the pack we just wrote */
+static int written_delta_base(struct pack_idx_entry *idx,
+			      struct pack_idx_entry **base,
+			      unsigned long *delta_size)
+{
+	struct object_entry *entry = (struct object_entry *)idx;
+
+	if (!entry->delta_searched)
+		return -1;
+	if (!DELTA(entry))
+		return 0;
+	if (!entry->written_type)
+		return -1; /* the delta was not used after all */
+	*base = &DELTA(entry)->idx;
+	*delta_size = DELTA_SIZE(entry);
+	return 1;
+}
+
 static unsigned long write_object(struct sha1file *f,
 				  struct object_entry *entry,
 				  off_t write_offset)
@@ -437,28 +517,28 @@ static unsigned long write_object(struct sha1file *f,
 	else
 		limit = pack_size_limit - write_offset;
 
-	if (!entry->delta)
+	if (!DELTA(entry))
 		usable_delta = 0;	/* no delta */
 	else if (!pack_size_limit)
 	       usable_delta = 1;	/* unlimited packfile */
-	else if (entry->delta->idx.offset == (off_t)-1)
+	else if (DELTA(entry)->idx.offset == (off_t)-1)
 		usable_delta = 0;	/* base was written to another pack */
-	else if (entry->delta->idx.offset)
+	else if (DELTA(entry)->idx.offset)
 		usable_delta = 1;	/* base already exists in this pack */
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
 	if (!reuse_object)
 		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
+	else if (!IN_PACK(entry))
 		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+	else if (oe_type(entry) == OBJ_REF_DELTA || oe_type(entry) == OBJ_OFS_DELTA)
 				/* check_object() decided it for us ... */
 		to_reuse = usable_delta;
 				/* ... but pack split may override that */
-	else if (entry->type != entry->in_pack_type)
+	else if (oe_type(entry) != entry->in_pack_type)
 		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
+	else if (DELTA(entry))
 		to_reuse = 0;	/* we want to pack afresh */
 	else
 		to_reuse = 1;	/* we have it in-pack undeltified,
@@ -472,8 +552,12 @@ static unsigned long write_object(struct sha1file *f,
 	if (!len)
 		return 0;
 
-	if (usable_delta)
+	if (usable_delta) {
 		written_delta++;
+		entry->written_type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+			OBJ_OFS_DELTA : OBJ_REF_DELTA;
+	} else
+		entry->written_type = 0;
 	written++;
 	if (!pack_to_stdout)
 		entry->idx.crc32 = crc32_end(f);
@@ -510,12 +594,12 @@ static enum write_one_status write_one(struct sha1file *f,
 	}
 
 	/* if we are deltified, write out base object first. */
-	if (e->delta) {
+	if (DELTA(e)) {
 		e->idx.offset = 1; /* now recurse */
-		switch (write_one(f, e->delta, offset)) {
+		switch (write_one(f, DELTA(e), offset)) {
 		case WRITE_ONE_RECURSIVE:
 			/* we cannot depend on this one */
-			e->delta = NULL;
+			SET_DELTA(e, NULL);
 			break;
 		default:
 			break;
@@ -577,34 +661,34 @@ static void add_descendants_to_write_order(struct object_entry **wo,
 			/* add this node... */
 			add_to_write_order(wo, endp, e);
 			/* all its siblings... */
-			for (s = e->delta_sibling; s; s = s->delta_sibling) {
+			for (s = DELTA_SIBLING(e); s; s = DELTA_SIBLING(s)) {
 				add_to_write_order(wo, endp, s);
 			}
 		}
 		/* drop down a level to add left subtree nodes if possible */
-		if (e->delta_child) {
+		if (DELTA_CHILD(e)) {
 			add_to_order = 1;
-			e = e->delta_child;
+			e = DELTA_CHILD(e);
 		} else {
 			add_to_order = 0;
 			/* our sibling might have some children, it is next */
-			if (e->delta_sibling) {
-				e = e->delta_sibling;
+			if (DELTA_SIBLING(e)) {
+				e = DELTA_SIBLING(e);
 				continue;
 			}
 			/* go back to our parent node */
-			e = e->delta;
-			while (e && !e->delta_sibling) {
+			e = DELTA(e);
+			while (e && !DELTA_SIBLING(e)) {
 				/* we're on the right side of a subtree, keep
 				 * going up until we can go right again */
-				e = e->delta;
+				e = DELTA(e);
 			}
 			if (!e) {
 				/* done- we hit our original root node */
 				return;
 			}
 			/* pass it off to sibling at this level */
-			e = e->delta_sibling;
+			e = DELTA_SIBLING(e);
 		}
 	};
 }
@@ -615,7 +699,7 @@ static void add_family_to_write_order(struct object_entry **wo,
 {
 	struct object_entry *root;
 
-	for (root = e; root->delta; root = root->delta)
+	for (root = e; DELTA(root); root = DELTA(root))
 		; /* nothing */
 	add_descendants_to_write_order(wo, endp, root);
 }
@@ -630,8 +714,8 @@ static struct object_entry **compute_write_order(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		objects[i].tagged = 0;
 		objects[i].filled = 0;
-		objects[i].delta_child = NULL;
-		objects[i].delta_sibling = NULL;
+		SET_DELTA_CHILD(&objects[i], NULL);
+		SET_DELTA_SIBLING(&objects[i], NULL);
 	}
 
 	/*
@@ -641,11 +725,11 @@ static struct object_entry **compute_write_order(void)
 	 */
 	for (i = to_pack.nr_objects; i > 0;) {
 		struct object_entry *e = &objects[--i];
-		if (!e->delta)
+		if (!DELTA(e))
 			continue;
 		/* Mark me as the first child */
-		e->delta_sibling = e->delta->delta_child;
-		e->delta->delta_child = e;
+		SET_DELTA_SIBLING(e, DELTA_CHILD(DELTA(e)));
+		SET_DELTA_CHILD(DELTA(e), e);
 	}
 
 	/*
@@ -676,8 +760,8 @@ static struct object_entry **compute_write_order(void)
 	 * And then all remaining commits and tags.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_COMMIT &&
-		    objects[i].type != OBJ_TAG)
+		if (oe_type(&objects[i]) != OBJ_COMMIT &&
+		    oe_type(&objects[i]) != OBJ_TAG)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -686,7 +770,7 @@ static struct object_entry **compute_write_order(void)
 	 * And then all the trees.
 	 */
 	for (i = last_untagged; i < to_pack.nr_objects; i++) {
-		if (objects[i].type != OBJ_TREE)
+		if (oe_type(&objects[i]) != OBJ_TREE)
 			continue;
 		add_to_write_order(wo, &wo_end, &objects[i]);
 	}
@@ -705,57 +789,144 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
-static off_t write_reused_pack(struct sha1file *f)
-{
-	unsigned char buffer[8192];
-	off_t to_write, total;
-	int fd;
+/*
+ * The reused objects of reuse_packfile come out in runs, each of which
+ * is shifted by the same amount in our pack; OFS_DELTAs that point
+ * across a hole left by the objects we skip need their offset fixed.
+ */
+static struct reused_chunk {
+	/* where the run starts in reuse_packfile */
+	off_t original;
+	/* how much further ahead it is there than in our pack */
+	off_t difference;
+} *reused_chunks;
+static int reused_chunks_nr, reused_chunks_alloc;
+
+static void record_reused_object(off_t where, off_t difference)
+{
+	if (reused_chunks_nr &&
+	    reused_chunks[reused_chunks_nr - 1].difference == difference)
+		return;
+	ALLOC_GROW(reused_chunks, reused_chunks_nr + 1, reused_chunks_alloc);
+	reused_chunks[reused_chunks_nr].original = where;
+	reused_chunks[reused_chunks_nr].difference = difference;
+	reused_chunks_nr++;
+}
 
-	if (!is_pack_valid(reuse_packfile))
-		die("packfile is invalid: %s", reuse_packfile->pack_name);
+static off_t find_reused_offset(off_t where)
+{
+	int lo = 0, hi = reused_chunks_nr;
 
-	fd = git_open_noatime(reuse_packfile->pack_name);
-	if (fd < 0)
-		die_errno("unable to open packfile for reuse: %s",
-			  reuse_packfile->pack_name);
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (where == reused_chunks[mi].original)
+			return reused_chunks[mi].difference;
+		if (where < reused_chunks[mi].original)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	/* a base is always reused, so always after the first run starts */
+	assert(lo);
+	return reused_chunks[lo - 1].difference;
+}
 
-	if (lseek(fd, sizeof(struct pack_header), SEEK_SET) == -1)
-		die_errno("unable to seek in reused packfile");
+static void write_reused_pack_one(struct sha1file *f, uint32_t pos,
+				  off_t *out, struct pack_window **w_curs)
+{
+	off_t offset, next, cur;
+	unsigned long size;
+	int type;
 
-	if (reuse_packfile_offset < 0)
-		reuse_packfile_offset = reuse_packfile->pack_size - 20;
+	offset = pack_pos_to_offset(reuse_packfile, pos);
+	next = pack_pos_to_offset(reuse_packfile, pos + 1);
+	record_reused_object(offset, offset - *out);
 
-	total = to_write = reuse_packfile_offset - sizeof(struct pack_header);
+	cur = offset;
+	type = unpack_object_header(reuse_packfile, w_curs, &cur, &size);
+	if (type < 0)
+		die("corrupt packed object at %"PRIuMAX" in %s",
+		    (uintmax_t)offset, reuse_packfile->pack_name);
 
-	while (to_write) {
-		int read_pack = xread(fd, buffer, sizeof(buffer));
+	if (type == OBJ_OFS_DELTA) {
+		off_t base_offset, fixup;
+
+		base_offset = get_delta_base(reuse_packfile, w_curs, &cur,
+					     type, offset);
+		if (!base_offset)
+			die("bad delta base at %"PRIuMAX" in %s",
+			    (uintmax_t)offset, reuse_packfile->pack_name);
+
+		fixup = find_reused_offset(offset) -
+			find_reused_offset(base_offset);
+		if (fixup) {
+			unsigned char header[10], dheader[10];
+			unsigned hdrlen, dpos = sizeof(dheader) - 1;
+			off_t ofs = offset - base_offset - fixup;
+
+			hdrlen = encode_in_pack_object_header(type, size, header);
+			dheader[dpos] = ofs & 127;
+			while (ofs >>= 7)
+				dheader[--dpos] = 128 | (--ofs & 127);
+
+			sha1write(f, header, hdrlen);
+			sha1write(f, dheader + dpos, sizeof(dheader) - dpos);
+			copy_pack_data(f, reuse_packfile, w_curs, cur, next - cur);
+			*out += hdrlen + sizeof(dheader) - dpos + next - cur;
+			return;
+		}
+	}
 
-		if (read_pack <= 0)
-			die_errno("unable to read from reused packfile");
+	copy_pack_data(f, reuse_packfile, w_curs, offset, next - offset);
+	*out += next - offset;
+}
 
-		if (read_pack > to_write)
-			read_pack = to_write;
+/*
+ * Copy the objects of reuse_packfile marked in reuse_packfile_bitmap,
+ * the leading run of whole words of them in one go.  Returns the number
+ * of bytes written.
+ */
+static off_t write_reused_pack(struct sha1file *f)
+{
+	struct bitmap *reuse = reuse_packfile_bitmap;
+	struct pack_window *w_curs = NULL;
+	off_t out = sizeof(struct pack_header);
+	size_t i = 0;
 
-		sha1write(f, buffer, read_pack);
-		to_write -= read_pack;
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile is invalid: %s", reuse_packfile->pack_name);
 
-		/*
-		 * We don't know the actual number of objects written,
-		 * only how many bytes written, how many bytes total, and
-		 * how many objects total. So we can fake it by pretending all
-		 * objects we are writing are the same size. This gives us a
-		 * smooth progress meter, and at the end it matches the true
-		 * answer.
-		 */
-		written = reuse_packfile_objects *
-				(((double)(total - to_write)) / total);
+	while (i < reuse->word_alloc && reuse->words[i] == (eword_t)~0)
+		i++;
+	if (i) {
+		uint32_t nr = i * BITS_IN_EWORD;
+
+		out = pack_pos_to_offset(reuse_packfile, nr);
+		record_reused_object(sizeof(struct pack_header), 0);
+		copy_pack_data(f, reuse_packfile, &w_curs,
+			       sizeof(struct pack_header),
+			       out - sizeof(struct pack_header));
+		written += nr;
 		display_progress(progress_state, written);
 	}
 
-	close(fd);
-	written = reuse_packfile_objects;
-	display_progress(progress_state, written);
-	return reuse_packfile_offset - sizeof(struct pack_header);
+	for (; i < reuse->word_alloc; i++) {
+		eword_t word = reuse->words[i];
+		size_t pos = i * BITS_IN_EWORD;
+		size_t offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			write_reused_pack_one(f, pos + offset, &out, &w_curs);
+			written++;
+			display_progress(progress_state, written);
+		}
+	}
+
+	unuse_pack(&w_curs);
+	return out - sizeof(struct pack_header);
 }
 
 static void write_pack_file(void)
@@ -780,6 +951,8 @@ static void write_pack_file(void)
 			f = sha1fd_throughput(1, "<stdout>", progress_state);
 		else
 			f = create_tmp_packfile(&pack_tmp_name);
+		if (pipeline_writes)
+			sha1file_pipeline(f);
 
 		offset = write_pack_header(f, nr_remaining);
 
@@ -844,7 +1017,8 @@ static void write_pack_file(void)
 
 			if (write_bitmap_index) {
 				bitmap_writer_set_checksum(sha1);
-				bitmap_writer_build_type_index(written_list, nr_written);
+				bitmap_writer_build_type_index(&to_pack, written_list,
+							       nr_written);
 			}
 
 			finish_tmp_packfile(&tmpname, pack_tmp_name,
@@ -857,6 +1031,7 @@ static void write_pack_file(void)
 				stop_progress(&progress_state);
 
 				bitmap_writer_show_progress(progress);
+				bitmap_writer_set_threads(delta_search_threads);
 				bitmap_writer_reuse_bitmaps(&to_pack);
 				bitmap_writer_select_commits(indexed_commits, indexed_commits_nr, -1);
 				bitmap_writer_build(&to_pack);
@@ -993,14 +1168,13 @@ static void create_object_entry(const unsigned char *sha1,
 
 	entry = packlist_alloc(&to_pack, sha1, index_pos);
 	entry->hash = hash;
-	if (type)
-		entry->type = type;
+	oe_set_type(entry, type);
 	if (exclude)
 		entry->preferred_base = 1;
 	else
 		nr_result++;
 	if (found_pack) {
-		entry->in_pack = found_pack;
+		oe_set_in_pack(&to_pack, entry, found_pack);
 		entry->in_pack_offset = found_offset;
 	}
 
@@ -1011,6 +1185,25 @@ static const char no_closure_warning[] = N_(
 "disabling bitmap writing, as some objects are not being packed"
 );
 
+/*
+ * If the object is in a pack the client will download from a URI,
+ * mark that pack as needed and leave the object out of ours.
+ */
+static int offload_object(const unsigned char *sha1)
+{
+	int i;
+
+	for (i = 0; i < offloaded_packs_nr; i++) {
+		struct offloaded_pack *op = &offloaded_packs[i];
+
+		if (find_pack_entry_one(sha1, op->p)) {
+			op->used = 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static int add_object_entry(const unsigned char *sha1, enum object_type type,
 			    const char *name, int exclude)
 {
@@ -1021,6 +1214,9 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	if (have_duplicate_entry(sha1, exclude, &index_pos))
 		return 0;
 
+	if (!exclude && offloaded_packs_nr && offload_object(sha1))
+		return 0;
+
 	if (!want_object_in_pack(sha1, exclude, &found_pack, &found_offset)) {
 		/* The pack is missing an object, so it will not have closure */
 		if (write_bitmap_index) {
@@ -1048,6 +1244,9 @@ static int add_object_entry_from_bitmap(const unsigned char *sha1,
 	if (have_duplicate_entry(sha1, 0, &index_pos))
 		return 0;
 
+	if (offloaded_packs_nr && offload_object(sha1))
+		return 0;
+
 	create_object_entry(sha1, type, name_hash, 0, 0, index_pos, pack, offset);
 
 	display_progress(progress_state, nr_result);
@@ -1325,13 +1524,17 @@ static void cleanup_preferred_base(void)
 
 static void check_object(struct object_entry *entry)
 {
-	if (entry->in_pack) {
-		struct packed_git *p = entry->in_pack;
+	unsigned long size;
+
+	if (IN_PACK(entry)) {
+		struct packed_git *p = IN_PACK(entry);
 		struct pack_window *w_curs = NULL;
 		const unsigned char *base_ref = NULL;
 		struct object_entry *base_entry;
 		unsigned long used, used_0;
 		unsigned long avail;
+		unsigned long in_pack_size;
+		enum object_type in_pack_type;
 		off_t ofs;
 		unsigned char *buf, c;
 
@@ -1342,10 +1545,12 @@ static void check_object(struct object_entry *entry)
 		 * since non-delta representations could still be reused.
 		 */
 		used = unpack_object_header_buffer(buf, avail,
-						   &entry->in_pack_type,
-						   &entry->size);
+						   &in_pack_type,
+						   &in_pack_size);
 		if (used == 0)
 			goto give_up;
+		entry->in_pack_type = in_pack_type;
+		SET_SIZE(entry, in_pack_size);
 
 		/*
 		 * Determine if this is a delta and if so whether we can
@@ -1355,9 +1560,9 @@ static void check_object(struct object_entry *entry)
 		switch (entry->in_pack_type) {
 		default:
 			/* Not a delta hence we've already got all we need. */
-			entry->type = entry->in_pack_type;
+			oe_set_type(entry, entry->in_pack_type);
 			entry->in_pack_header_size = used;
-			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
+			if (oe_type(entry) < OBJ_COMMIT || oe_type(entry) > OBJ_BLOB)
 				goto give_up;
 			unuse_pack(&w_curs);
 			return;
@@ -1390,17 +1595,18 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				uint32_t pos;
+				if (offset_to_pack_pos(p, ofs, &pos) < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL))) {
+		if (base_ref && (base_entry = packlist_find(&to_pack, base_ref, NULL)) &&
+		    in_same_island(entry->idx.sha1, base_entry->idx.sha1)) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1411,24 +1617,24 @@ static void check_object(struct object_entry *entry)
 			 * deltify other objects against, in order to avoid
 			 * circular deltas.
 			 */
-			entry->type = entry->in_pack_type;
-			entry->delta = base_entry;
-			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			oe_set_type(entry, entry->in_pack_type);
+			SET_DELTA(entry, base_entry);
+			SET_DELTA_SIZE(entry, SIZE(entry));
+			SET_DELTA_SIBLING(entry, DELTA_CHILD(base_entry));
+			SET_DELTA_CHILD(base_entry, entry);
 			unuse_pack(&w_curs);
 			return;
 		}
 
-		if (entry->type) {
+		if (oe_type(entry)) {
 			/*
 			 * This must be a delta and we already know what the
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
-			entry->size = get_size_from_delta(p, &w_curs,
-					entry->in_pack_offset + entry->in_pack_header_size);
-			if (entry->size == 0)
+			SET_SIZE(entry, get_size_from_delta(p, &w_curs,
+					entry->in_pack_offset + entry->in_pack_header_size));
+			if (SIZE(entry) == 0)
 				goto give_up;
 			unuse_pack(&w_curs);
 			return;
@@ -1443,7 +1649,9 @@ static void check_object(struct object_entry *entry)
 		unuse_pack(&w_curs);
 	}
 
-	entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
+	oe_set_type(entry, sha1_object_info(entry->idx.sha1, &size));
+	if (oe_type(entry) >= 0)
+		SET_SIZE(entry, size);
 	/*
 	 * The error condition is checked in prepare_pack().  This is
 	 * to permit a missing preferred base object to be ignored
@@ -1458,12 +1666,12 @@ static int pack_offset_sort(const void *_a, const void *_b)
 	const struct object_entry *b = *(struct object_entry **)_b;
 
 	/* avoid filesystem trashing with loose objects */
-	if (!a->in_pack && !b->in_pack)
+	if (!IN_PACK(a) && !IN_PACK(b))
 		return hashcmp(a->idx.sha1, b->idx.sha1);
 
-	if (a->in_pack < b->in_pack)
+	if (IN_PACK(a) < IN_PACK(b))
 		return -1;
-	if (a->in_pack > b->in_pack)
+	if (IN_PACK(a) > IN_PACK(b))
 		return 1;
 	return a->in_pack_offset < b->in_pack_offset ? -1 :
 			(a->in_pack_offset > b->in_pack_offset);
@@ -1482,13 +1690,102 @@ static void get_object_details(void)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = sorted_by_offset[i];
 		check_object(entry);
-		if (big_file_threshold < entry->size)
+		if (big_file_threshold < SIZE(entry))
 			entry->no_try_delta = 1;
 	}
 
 	free(sorted_by_offset);
 }
 
+static int delta_search_recorded(struct packed_git *p)
+{
+	uint32_t rec_window, rec_depth;
+
+	if (load_pack_bases(p))
+		return 0;
+	pack_bases_params(p, &rec_window, &rec_depth);
+	return rec_window >= window && rec_depth <= depth;
+}
+
+/*
+ * Take the decisions that the delta search which wrote the packs we
+ * are repacking made, instead of searching for them again.  Only a
+ * search with a window at least as large as ours and a depth no larger
+ * counts, and an object only gets the base that search picked if that
+ * base is still one we could pick ourselves.
+ */
+static void apply_delta_search_records(void)
+{
+	struct object_entry **applied;
+	uint32_t i, nr_applied = 0, nr_searched = 0;
+
+	applied = xmalloc(to_pack.nr_objects * sizeof(*applied));
+	for (i = 0; i < to_pack.nr_objects; i++) {
+		struct object_entry *entry = to_pack.objects + i;
+		struct object_entry *base;
+		struct packed_git *p = IN_PACK(entry);
+		uint32_t pos, base_pos;
+		unsigned long delta_size;
+
+		if (!p || DELTA(entry) || entry->preferred_base ||
+		    entry->no_try_delta || !delta_search_recorded(p))
+			continue;
+		if (offset_to_pack_pos(p, entry->in_pack_offset, &pos) < 0)
+			continue;
+		switch (pack_bases_lookup(p, pack_pos_to_index(p, pos),
+					  &base_pos, &delta_size)) {
+		case 0:
+			entry->delta_searched = 1;
+			nr_searched++;
+			continue;
+		case 1:
+			break;
+		default:
+			continue;
+		}
+
+		base = packlist_find(&to_pack, nth_packed_object_sha1(p, base_pos), NULL);
+		if (!base || base == entry || base->preferred_base ||
+		    oe_type(base) != oe_type(entry) ||
+		    delta_size >= SIZE(entry) ||
+		    !in_same_island(entry->idx.sha1, base->idx.sha1))
+			continue;
+		SET_DELTA(entry, base);
+		SET_DELTA_SIZE(entry, delta_size);
+		entry->delta_searched = 1;
+		applied[nr_applied++] = entry;
+	}
+
+	/*
+	 * The records may come from several packs, so they are not
+	 * guaranteed to form short chains, or chains at all.  Anything
+	 * that does not reach a full object within "depth" steps is
+	 * searched for again.
+	 */
+	for (i = 0; i < nr_applied; i++) {
+		struct object_entry *entry = applied[i], *e = entry;
+		int d = 0;
+
+		while (DELTA(e) && d <= depth) {
+			e = DELTA(e);
+			d++;
+		}
+		if (d > depth) {
+			SET_DELTA(entry, NULL);
+			entry->delta_searched = 0;
+			continue;
+		}
+		SET_DELTA_SIBLING(entry, DELTA_CHILD(DELTA(entry)));
+		SET_DELTA_CHILD(DELTA(entry), entry);
+		nr_searched++;
+	}
+	free(applied);
+
+	if (nr_searched && progress)
+		fprintf(stderr, _("Reusing %"PRIu32" delta search results\n"),
+			nr_searched);
+}
+
 /*
  * We search for deltas in a list sorted by type, by filename hash, and then
  * by size, so that we see progressively smaller and smaller files.
@@ -1503,9 +1800,9 @@ static int type_size_sort(const void *_a, const void *_b)
 	const struct object_entry *a = *(struct object_entry **)_a;
 	const struct object_entry *b = *(struct object_entry **)_b;
 
-	if (a->type > b->type)
+	if (oe_type(a) > oe_type(b))
 		return -1;
-	if (a->type < b->type)
+	if (oe_type(a) < oe_type(b))
 		return 1;
 	if (a->hash > b->hash)
 		return -1;
@@ -1515,9 +1812,14 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
-	if (a->size > b->size)
+	if (use_delta_islands) {
+		int cmp = island_delta_cmp(a->idx.sha1, b->idx.sha1);
+		if (cmp)
+			return cmp;
+	}
+	if (SIZE(a) > SIZE(b))
 		return -1;
-	if (a->size < b->size)
+	if (SIZE(a) < SIZE(b))
 		return 1;
 	return a < b ? -1 : (a > b);  /* newest first */
 }
@@ -1547,17 +1849,17 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 
 #ifndef NO_PTHREADS
 
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+static struct traced_mutex read_mutex;
+#define read_lock()		traced_mutex_lock(&read_mutex)
+#define read_unlock()		traced_mutex_unlock(&read_mutex)
 
-static pthread_mutex_t cache_mutex;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+static struct traced_mutex cache_mutex;
+#define cache_lock()		traced_mutex_lock(&cache_mutex)
+#define cache_unlock()		traced_mutex_unlock(&cache_mutex)
 
-static pthread_mutex_t progress_mutex;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+static struct traced_mutex progress_mutex;
+#define progress_lock()		traced_mutex_lock(&progress_mutex)
+#define progress_unlock()	traced_mutex_unlock(&progress_mutex)
 
 #else
 
@@ -1581,9 +1883,17 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	void *delta_buf;
 
 	/* Don't bother doing diffs between different types */
-	if (trg_entry->type != src_entry->type)
+	if (oe_type(trg_entry) != oe_type(src_entry))
 		return -1;
 
+	/*
+	 * Nor against a base some island of the target cannot reach; unlike
+	 * a type mismatch, that says nothing about the rest of the window.
+	 */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return 0;
+
 	/*
 	 * We do not bother to try a delta that we discarded on an
 	 * earlier try, but only when reusing delta data.  Note that
@@ -1592,8 +1902,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	 * it, we will still save the transfer cost, as we already know
 	 * the other side has it and we won't send src_entry at all.
 	 */
-	if (reuse_delta && trg_entry->in_pack &&
-	    trg_entry->in_pack == src_entry->in_pack &&
+	if (reuse_delta && IN_PACK(trg_entry) &&
+	    IN_PACK(trg_entry) == IN_PACK(src_entry) &&
 	    !src_entry->preferred_base &&
 	    trg_entry->in_pack_type != OBJ_REF_DELTA &&
 	    trg_entry->in_pack_type != OBJ_OFS_DELTA)
@@ -1604,19 +1914,19 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		return 0;
 
 	/* Now some size filtering heuristics. */
-	trg_size = trg_entry->size;
-	if (!trg_entry->delta) {
+	trg_size = SIZE(trg_entry);
+	if (!DELTA(trg_entry)) {
 		max_size = trg_size/2 - 20;
 		ref_depth = 1;
 	} else {
-		max_size = trg_entry->delta_size;
+		max_size = DELTA_SIZE(trg_entry);
 		ref_depth = trg->depth;
 	}
 	max_size = (uint64_t)max_size * (max_depth - src->depth) /
 						(max_depth - ref_depth + 1);
 	if (max_size == 0)
 		return 0;
-	src_size = src_entry->size;
+	src_size = SIZE(src_entry);
 	sizediff = src_size < trg_size ? trg_size - src_size : 0;
 	if (sizediff >= max_size)
 		return 0;
@@ -1677,9 +1987,9 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (!delta_buf)
 		return 0;
 
-	if (trg_entry->delta) {
+	if (DELTA(trg_entry)) {
 		/* Prefer only shallower same-sized deltas. */
-		if (delta_size == trg_entry->delta_size &&
+		if (delta_size == DELTA_SIZE(trg_entry) &&
 		    src->depth + 1 >= trg->depth) {
 			free(delta_buf);
 			return 0;
@@ -1694,7 +2004,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	free(trg_entry->delta_data);
 	cache_lock();
 	if (trg_entry->delta_data) {
-		delta_cache_size -= trg_entry->delta_size;
+		delta_cache_size -= DELTA_SIZE(trg_entry);
 		trg_entry->delta_data = NULL;
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
@@ -1706,8 +2016,8 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		free(delta_buf);
 	}
 
-	trg_entry->delta = src_entry;
-	trg_entry->delta_size = delta_size;
+	SET_DELTA(trg_entry, src_entry);
+	SET_DELTA_SIZE(trg_entry, delta_size);
 	trg->depth = src->depth + 1;
 
 	return 1;
@@ -1715,13 +2025,13 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 static unsigned int check_delta_limit(struct object_entry *me, unsigned int n)
 {
-	struct object_entry *child = me->delta_child;
+	struct object_entry *child = DELTA_CHILD(me);
 	unsigned int m = n;
 	while (child) {
 		unsigned int c = check_delta_limit(child, n + 1);
 		if (m < c)
 			m = c;
-		child = child->delta_sibling;
+		child = DELTA_SIBLING(child);
 	}
 	return m;
 }
@@ -1732,7 +2042,7 @@ static unsigned long free_unpacked(struct unpacked *n)
 	free_delta_index(n->index);
 	n->index = NULL;
 	if (n->data) {
-		freed_mem += n->entry->size;
+		freed_mem += SIZE(n->entry);
 		free(n->data);
 		n->data = NULL;
 	}
@@ -1782,7 +2092,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		/* We do not compute delta to *create* objects we are not
 		 * going to pack.
 		 */
-		if (entry->preferred_base)
+		if (entry->preferred_base || entry->delta_searched)
 			goto next;
 
 		/*
@@ -1791,7 +2101,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * otherwise they would become too deep.
 		 */
 		max_depth = depth;
-		if (entry->delta_child) {
+		if (DELTA_CHILD(entry)) {
 			max_depth -= check_delta_limit(entry, 0);
 			if (max_depth <= 0)
 				goto next;
@@ -1813,6 +2123,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 			else if (ret > 0)
 				best_base = other_idx;
 		}
+		entry->delta_searched = 1;
 
 		/*
 		 * If we decided to cache the delta data, then it is best
@@ -1829,11 +2140,18 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * between writes at that moment.
 		 */
 		if (entry->delta_data && !pack_to_stdout) {
-			entry->z_delta_size = do_compress(&entry->delta_data,
-							  entry->delta_size);
+			unsigned long z_size = do_compress(&entry->delta_data,
+							   DELTA_SIZE(entry));
 			cache_lock();
-			delta_cache_size -= entry->delta_size;
-			delta_cache_size += entry->z_delta_size;
+			delta_cache_size -= DELTA_SIZE(entry);
+			if (z_size < (1UL << OE_Z_DELTA_BITS)) {
+				entry->z_delta_size = z_size;
+				delta_cache_size += z_size;
+			} else {
+				/* too big to keep; write_object() redoes it */
+				free(entry->delta_data);
+				entry->delta_data = NULL;
+			}
 			cache_unlock();
 		}
 
@@ -1841,7 +2159,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * depth, leaving it in the window is pointless.  we
 		 * should evict it first.
 		 */
-		if (entry->delta && max_depth <= n->depth)
+		if (DELTA(entry) && max_depth <= n->depth)
 			continue;
 
 		/*
@@ -1849,7 +2167,7 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 		 * currently deltified object, to keep it longer.  It will
 		 * be the first base object to be attempted next.
 		 */
-		if (entry->delta) {
+		if (DELTA(entry)) {
 			struct unpacked swap = array[best_base];
 			int dist = (window + idx - best_base) % window;
 			int dst = best_base;
@@ -1905,7 +2223,7 @@ struct thread_params {
 	int depth;
 	int working;
 	int data_ready;
-	pthread_mutex_t mutex;
+	struct traced_mutex mutex;
 	pthread_cond_t cond;
 	unsigned *processed;
 };
@@ -1917,9 +2235,9 @@ static pthread_cond_t progress_cond;
  */
 static void init_threaded_search(void)
 {
-	init_recursive_mutex(&read_mutex);
-	pthread_mutex_init(&cache_mutex, NULL);
-	pthread_mutex_init(&progress_mutex, NULL);
+	traced_mutex_init(&read_mutex, "pack-objects read", 1);
+	traced_mutex_init(&cache_mutex, "pack-objects cache", 0);
+	traced_mutex_init(&progress_mutex, "pack-objects progress", 0);
 	pthread_cond_init(&progress_cond, NULL);
 	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
 }
@@ -1928,15 +2246,17 @@ static void cleanup_threaded_search(void)
 {
 	set_try_to_free_routine(old_try_to_free_routine);
 	pthread_cond_destroy(&progress_cond);
-	pthread_mutex_destroy(&read_mutex);
-	pthread_mutex_destroy(&cache_mutex);
-	pthread_mutex_destroy(&progress_mutex);
+	traced_mutex_destroy(&read_mutex);
+	traced_mutex_destroy(&cache_mutex);
+	traced_mutex_destroy(&progress_mutex);
 }
 
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
 
+	trace_thread_start("find-deltas");
+	thread_stats_start("find-deltas");
 	while (me->remaining) {
 		find_deltas(me->list, &me->remaining,
 			    me->window, me->depth, me->processed);
@@ -1954,12 +2274,14 @@ static void *threaded_find_deltas(void *arg)
 		 * was initialized to 0 before this thread was spawned
 		 * and we reset it to 0 right away.
 		 */
-		pthread_mutex_lock(&me->mutex);
+		traced_mutex_lock(&me->mutex);
 		while (!me->data_ready)
-			pthread_cond_wait(&me->cond, &me->mutex);
+			traced_cond_wait(&me->cond, &me->mutex);
 		me->data_ready = 0;
-		pthread_mutex_unlock(&me->mutex);
+		traced_mutex_unlock(&me->mutex);
 	}
+	thread_stats_exit();
+	trace_thread_exit();
 	/* leave ->working 1 so that this doesn't get more work assigned */
 	return NULL;
 }
@@ -2014,7 +2336,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 	for (i = 0; i < delta_search_threads; i++) {
 		if (!p[i].list_size)
 			continue;
-		pthread_mutex_init(&p[i].mutex, NULL);
+		traced_mutex_init(&p[i].mutex, "find-deltas work", 0);
 		pthread_cond_init(&p[i].cond, NULL);
 		ret = pthread_create(&p[i].thread, NULL,
 				     threaded_find_deltas, &p[i]);
@@ -2043,7 +2365,7 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 					target = &p[i];
 			if (target)
 				break;
-			pthread_cond_wait(&progress_cond, &progress_mutex);
+			traced_cond_wait(&progress_cond, &progress_mutex);
 		}
 
 		for (i = 0; i < delta_search_threads; i++)
@@ -2077,15 +2399,15 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 		target->working = 1;
 		progress_unlock();
 
-		pthread_mutex_lock(&target->mutex);
+		traced_mutex_lock(&target->mutex);
 		target->data_ready = 1;
 		pthread_cond_signal(&target->cond);
-		pthread_mutex_unlock(&target->mutex);
+		traced_mutex_unlock(&target->mutex);
 
 		if (!sub_size) {
 			pthread_join(target->thread, NULL);
 			pthread_cond_destroy(&target->cond);
-			pthread_mutex_destroy(&target->mutex);
+			traced_mutex_destroy(&target->mutex);
 			active_threads--;
 		}
 	}
@@ -2115,6 +2437,8 @@ static void prepare_pack(int window, int depth)
 	unsigned n;
 
 	get_object_details();
+	if (record_delta_search && window && depth)
+		apply_delta_search_records();
 
 	/*
 	 * If we're locally repacking then we need to be doubly careful
@@ -2135,13 +2459,13 @@ static void prepare_pack(int window, int depth)
 	for (i = 0; i < to_pack.nr_objects; i++) {
 		struct object_entry *entry = to_pack.objects + i;
 
-		if (entry->delta)
+		if (DELTA(entry))
 			/* This happens if we decided to reuse existing
 			 * delta from a pack.  "reuse_delta &&" is implied.
 			 */
 			continue;
 
-		if (entry->size < 50)
+		if (SIZE(entry) < 50)
 			continue;
 
 		if (entry->no_try_delta)
@@ -2149,11 +2473,11 @@ static void prepare_pack(int window, int depth)
 
 		if (!entry->preferred_base) {
 			nr_deltas++;
-			if (entry->type < 0)
+			if (oe_type(entry) < 0)
 				die("unable to get type of object %s",
 				    sha1_to_hex(entry->idx.sha1));
 		} else {
-			if (entry->type < 0) {
+			if (oe_type(entry) < 0) {
 				/*
 				 * This object is not found, but we
 				 * don't have to include it anyway.
@@ -2171,7 +2495,9 @@ static void prepare_pack(int window, int depth)
 			progress_state = start_progress(_("Compressing objects"),
 							nr_deltas);
 		qsort(delta_list, n, sizeof(*delta_list), type_size_sort);
+		trace_region_enter("pack-objects", "find deltas");
 		ll_find_deltas(delta_list, n, window+1, depth, &nr_done);
+		trace_region_leave("pack-objects", "find deltas");
 		stop_progress(&progress_state);
 		if (nr_done != nr_deltas)
 			die("inconsistency with delta count");
@@ -2217,6 +2543,17 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writebitmaplookuptable")) {
+		if (git_config_bool(k, v))
+			write_bitmap_options |= BITMAP_OPT_LOOKUP_TABLE;
+		else
+			write_bitmap_options &= ~BITMAP_OPT_LOOKUP_TABLE;
+		return 0;
+	}
+	if (!strcmp(k, "pack.pipelinewrites")) {
+		pipeline_writes = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index = git_config_bool(k, v);
 		return 0;
@@ -2232,6 +2569,12 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "uploadpack.packfileuri")) {
+		if (!v)
+			return config_error_nonbool(k);
+		string_list_append(&packfile_uri_config, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2239,6 +2582,24 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 			    pack_idx_opts.version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_REV;
+		else
+			pack_idx_opts.flags &= ~WRITE_REV;
+		return 0;
+	}
+	if (!strcmp(k, "pack.recorddeltasearch")) {
+		record_delta_search = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writeobjectsizes")) {
+		if (git_config_bool(k, v))
+			pack_idx_opts.flags |= WRITE_SIZES;
+		else
+			pack_idx_opts.flags &= ~WRITE_SIZES;
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2282,6 +2643,9 @@ static void show_commit(struct commit *commit, void *data)
 
 	if (write_bitmap_index)
 		index_commit_for_bitmap(commit);
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
 }
 
 static void show_object(struct object *obj,
@@ -2301,6 +2665,19 @@ static void show_object(struct object *obj,
 	free((char *)name);
 }
 
+/*
+ * With --missing=allow-any, leave out the trees and blobs a partial
+ * clone does not have instead of failing on them.
+ */
+static void show_object_allow_missing(struct object *obj,
+				      const struct name_path *path,
+				      const char *last, void *data)
+{
+	if (obj->type == OBJ_TREE ? !obj->parsed : !has_sha1_file(obj->sha1))
+		return;
+	show_object(obj, path, last, data);
+}
+
 static void show_edge(struct commit *commit)
 {
 	add_preferred_base(commit->object.sha1);
@@ -2412,16 +2789,19 @@ static int has_sha1_pack_kept_or_nonlocal(const unsigned char *sha1)
  *
  * This is filled by get_object_list.
  */
-static struct sha1_array recent_objects;
+static struct oidset recent_objects;
 
 static int loosened_object_can_be_discarded(const unsigned char *sha1,
 					    unsigned long mtime)
 {
+	struct object_id oid;
+
 	if (!unpack_unreachable_expiration)
 		return 0;
 	if (mtime > unpack_unreachable_expiration)
 		return 0;
-	if (sha1_array_lookup(&recent_objects, sha1) >= 0)
+	hashcpy(oid.hash, sha1);
+	if (oidset_contains(&recent_objects, &oid))
 		return 0;
 	return 1;
 }
@@ -2457,7 +2837,8 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
  */
 static int pack_options_allow_reuse(void)
 {
-	return allow_ofs_delta;
+	/* a verbatim copy would not leave out offloaded objects */
+	return allow_ofs_delta && !offloaded_packs_nr;
 }
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
@@ -2469,13 +2850,14 @@ static int get_object_list_from_bitmap(struct rev_info *revs)
 	    !reuse_partial_packfile_from_bitmap(
 			&reuse_packfile,
 			&reuse_packfile_objects,
-			&reuse_packfile_offset)) {
+			&reuse_packfile_bitmap)) {
 		assert(reuse_packfile_objects);
 		nr_result += reuse_packfile_objects;
 		display_progress(progress_state, nr_result);
 	}
 
 	traverse_bitmap_commit_list(&add_object_entry_from_bitmap);
+	used_bitmap_index = 1;
 	return 0;
 }
 
@@ -2484,12 +2866,82 @@ static void record_recent_object(struct object *obj,
 				 const char *last,
 				 void *data)
 {
-	sha1_array_append(&recent_objects, obj->sha1);
+	struct object_id oid;
+
+	hashcpy(oid.hash, obj->sha1);
+	oidset_add(&recent_objects, &oid);
 }
 
 static void record_recent_commit(struct commit *commit, void *data)
 {
-	sha1_array_append(&recent_objects, commit->object.sha1);
+	struct object_id oid;
+
+	hashcpy(oid.hash, commit->object.sha1);
+	oidset_add(&recent_objects, &oid);
+}
+
+static int uri_protocol_allowed(const char *uri)
+{
+	const char *colon = strstr(uri, "://");
+	int i;
+
+	if (!colon)
+		return 0;
+	for (i = 0; i < uri_protocols.nr; i++) {
+		const char *proto = uri_protocols.items[i].string;
+
+		if (strlen(proto) == colon - uri &&
+		    !strncmp(uri, proto, colon - uri))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Each uploadpack.packfileURI is "<pack-hash> <uri>", naming one of our
+ * local packs and where the client can download an identical copy.
+ */
+static void prepare_offloaded_packs(void)
+{
+	int i;
+
+	for (i = 0; i < packfile_uri_config.nr; i++) {
+		const char *value = packfile_uri_config.items[i].string;
+		unsigned char sha1[20];
+		struct packed_git *p;
+
+		if (get_sha1_hex(value, sha1) || value[40] != ' ')
+			die("invalid uploadpack.packfileURI: %s", value);
+		if (!uri_protocol_allowed(value + 41))
+			continue;
+		for (p = packed_git; p; p = p->next)
+			if (p->pack_local && !hashcmp(p->sha1, sha1))
+				break;
+		if (!p || open_pack_index(p))
+			continue;
+		ALLOC_GROW(offloaded_packs, offloaded_packs_nr + 1,
+			   offloaded_packs_alloc);
+		offloaded_packs[offloaded_packs_nr].p = p;
+		offloaded_packs[offloaded_packs_nr].uri = value + 41;
+		offloaded_packs[offloaded_packs_nr].used = 0;
+		offloaded_packs_nr++;
+	}
+}
+
+/*
+ * Tell the client which packs to download, as pkt-lines ending with a
+ * flush-pkt, ahead of the pack data.
+ */
+static void write_packfile_uris(void)
+{
+	int i;
+
+	for (i = 0; i < offloaded_packs_nr; i++)
+		if (offloaded_packs[i].used)
+			packet_write(1, "%s %s\n",
+				     sha1_to_hex(offloaded_packs[i].p->sha1),
+				     offloaded_packs[i].uri);
+	packet_flush(1);
 }
 
 static void get_object_list(int ac, const char **av)
@@ -2531,13 +2983,20 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	if (use_delta_islands)
+		load_delta_islands();
+
 	if (use_bitmap_index && !get_object_list_from_bitmap(&revs))
 		return;
 
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(&revs, show_edge);
-	traverse_commit_list(&revs, show_commit, show_object, NULL);
+	revs.do_not_die_on_missing_tree = allow_missing;
+	traverse_commit_list_filtered(&filter_options, &revs, show_commit,
+				      allow_missing ? show_object_allow_missing
+						    : show_object,
+				      NULL);
 
 	if (unpack_unreachable_expiration) {
 		revs.ignore_missing_links = 1;
@@ -2555,7 +3014,7 @@ static void get_object_list(int ac, const char **av)
 	if (unpack_unreachable)
 		loosen_unused_packed_objects(&revs);
 
-	sha1_array_clear(&recent_objects);
+	oidset_clear(&recent_objects);
 }
 
 static int option_parse_index_version(const struct option *opt,
@@ -2588,6 +3047,18 @@ static int option_parse_unpack_unreachable(const struct option *opt,
 	return 0;
 }
 
+static int option_parse_missing_action(const struct option *opt,
+				       const char *arg, int unset)
+{
+	if (!strcmp(arg, "error"))
+		allow_missing = 0;
+	else if (!strcmp(arg, "allow-any"))
+		allow_missing = 1;
+	else
+		die(_("invalid value for --missing"));
+	return 0;
+}
+
 static int option_parse_ulong(const struct option *opt,
 			      const char *arg, int unset)
 {
@@ -2686,12 +3157,24 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "delta-islands", &use_delta_islands,
+			 N_("respect islands during delta compression")),
+		OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
+		{ OPTION_CALLBACK, 0, "missing", NULL, N_("action"),
+		  N_("handling for missing objects"), PARSE_OPT_NONEG,
+		  option_parse_missing_action },
+		OPT_STRING_LIST(0, "uri-protocol", &uri_protocols,
+				N_("protocol"),
+				N_("exclude objects in packs the client can download over this protocol")),
+		OPT_INTEGER(0, "stats-fd", &stats_fd,
+			    N_("write statistics of the pack to this descriptor")),
 		OPT_END(),
 	};
 
 	check_replace_refs = 0;
 
 	reset_pack_idx_option(&pack_idx_opts);
+	pack_idx_opts.object_info = written_object_info;
 	git_config(git_pack_config, NULL);
 	if (!pack_compression_seen && core_compression_seen)
 		pack_compression_level = core_compression_level;
@@ -2759,14 +3242,44 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!pack_to_stdout && thin)
 		die("--thin cannot be used to build an indexable pack.");
 
+	if (!pack_to_stdout && record_delta_search && window && depth) {
+		pack_idx_opts.flags |= WRITE_BASES;
+		pack_idx_opts.delta_base = written_delta_base;
+		pack_idx_opts.search_window = window;
+		pack_idx_opts.search_depth = depth;
+	}
+
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
+	if (filter_options.choice) {
+		if (!pack_to_stdout)
+			die("cannot use --filter without --stdout.");
+		use_bitmap_index = 0;
+	}
+	if (uri_protocols.nr && !pack_to_stdout)
+		die("cannot use --uri-protocol without --stdout.");
+	if (allow_missing) {
+		/* a bitmap has to cover everything reachable */
+		fetch_if_missing = 0;
+		write_bitmap_index = 0;
+	}
 	if (!rev_list_all || !rev_list_reflog || !rev_list_index)
 		unpack_unreachable_expiration = 0;
 
 	if (!use_internal_rev_list || !pack_to_stdout || is_repository_shallow())
 		use_bitmap_index = 0;
 
+	/*
+	 * Island marks are propagated during our own traversal, which has
+	 * to visit every commit (children first) to do so.
+	 */
+	if (!use_internal_rev_list)
+		use_delta_islands = 0;
+	if (use_delta_islands) {
+		use_bitmap_index = 0;
+		argv_array_push(&rp, "--topo-order");
+	}
+
 	if (pack_to_stdout || !rev_list_all)
 		write_bitmap_index = 0;
 
@@ -2774,9 +3287,13 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		progress = 2;
 
 	prepare_packed_git();
+	prepare_packing_data(&to_pack);
+	if (uri_protocols.nr)
+		prepare_offloaded_packs();
 
 	if (progress)
 		progress_state = start_progress(_("Counting objects"), 0);
+	trace_region_enter("pack-objects", "enumerate objects");
 	if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
@@ -2786,16 +3303,41 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	cleanup_preferred_base();
 	if (include_tag && nr_result)
 		for_each_ref(add_ref_tag, NULL);
+	trace_region_leave("pack-objects", "enumerate objects");
 	stop_progress(&progress_state);
 
+	if (use_delta_islands)
+		resolve_tree_islands(progress, &to_pack);
+
+	if (uri_protocols.nr)
+		write_packfile_uris();
+
 	if (non_empty && !nr_result)
 		return 0;
 	if (nr_result)
 		prepare_pack(window, depth);
+	trace_region_enter("pack-objects", "write pack");
 	write_pack_file();
+	trace_region_leave("pack-objects", "write pack");
+	trace_counter("pack-objects", "written", written);
+	trace_counter("pack-objects", "reused", reused);
 	if (progress)
 		fprintf(stderr, "Total %"PRIu32" (delta %"PRIu32"),"
-			" reused %"PRIu32" (delta %"PRIu32")\n",
-			written, written_delta, reused, reused_delta);
+			" reused %"PRIu32" (delta %"PRIu32"),"
+			" pack-reused %"PRIu32"\n",
+			written, written_delta, reused, reused_delta,
+			reuse_packfile_objects);
+	if (stats_fd >= 0) {
+		struct strbuf stats = STRBUF_INIT;
+
+		strbuf_addf(&stats, "objects=%"PRIu32" deltas=%"PRIu32
+			    " reused=%"PRIu32" reused_deltas=%"PRIu32
+			    " bitmap=%d pack_reused=%"PRIu32"\n",
+			    written, written_delta, reused, reused_delta,
+			    used_bitmap_index, reuse_packfile_objects);
+		write_in_full(stats_fd, stats.buf, stats.len);
+		close(stats_fd);
+		strbuf_release(&stats);
+	}
 	return 0;
 }
@@ -19,6 +19,8 @@
 #include "tag.h"
 #include "gpg-interface.h"
 #include "sigchain.h"
+#include "ref-snapshot.h"
+#include "audit-log.h"
 
 static const char receive_pack_usage[] = "git receive-pack <git-dir>";
 
@@ -39,6 +41,7 @@ static int transfer_fsck_objects = -1;
 static int receive_unpack_limit = -1;
 static int transfer_unpack_limit = -1;
 static int advertise_atomic_push = 1;
+static int use_ref_snapshot;
 static int unpack_limit = 100;
 static int report_status;
 static int use_sideband;
@@ -163,6 +166,11 @@ static int receive_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (strcmp(var, "transfer.refsnapshot") == 0) {
+		use_ref_snapshot = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (strcmp(var, "receive.advertiseatomic") == 0) {
 		advertise_atomic_push = git_config_bool(var, value);
 		return 0;
@@ -171,11 +179,19 @@ static int receive_pack_config(const char *var, const char *value, void *cb)
 	return git_default_config(var, value, cb);
 }
 
+/* For the audit log */
+static unsigned int refs_advertised;
+static struct command *audit_commands;
+static uint32_t pack_objects_received;
+static const char *unpacker, *unpack_result;
+
 static void show_ref(const char *path, const unsigned char *sha1)
 {
 	if (ref_is_hidden(path))
 		return;
 
+	if (!is_null_sha1(sha1))
+		refs_advertised++;
 	if (sent_capabilities) {
 		packet_write(1, "%s %s\n", sha1_to_hex(sha1), path);
 	} else {
@@ -214,6 +230,13 @@ static int show_ref_cb(const char *path, const struct object_id *oid, int flag,
 	return 0;
 }
 
+static int show_snapshot_ref(const char *path, const struct object_id *oid,
+			     const struct object_id *peeled,
+			     const char *symref_target, void *unused)
+{
+	return show_ref_cb(path, oid, 0, NULL);
+}
+
 static void show_one_alternate_sha1(const unsigned char sha1[20], void *unused)
 {
 	show_ref(".have", sha1);
@@ -232,7 +255,11 @@ static void write_head_info(void)
 	for_each_alternate_ref(collect_one_alternate_ref, &sa);
 	sha1_array_for_each_unique(&sa, show_one_alternate_sha1, NULL);
 	sha1_array_clear(&sa);
-	for_each_ref(show_ref_cb, NULL);
+	if (use_ref_snapshot)
+		ref_snapshot_for_each(get_ref_snapshot(), "",
+				      show_snapshot_ref, NULL);
+	else
+		for_each_ref(show_ref_cb, NULL);
 	if (!sent_capabilities)
 		show_ref("capabilities^{}", null_sha1);
 
@@ -1475,6 +1502,7 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 			close(err_fd);
 		return hdr_err;
 	}
+	pack_objects_received = ntohl(hdr.hdr_entries);
 	snprintf(hdr_arg, sizeof(hdr_arg),
 			"--pack_header=%"PRIu32",%"PRIu32,
 			ntohl(hdr.hdr_version), ntohl(hdr.hdr_entries));
@@ -1486,6 +1514,7 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 	}
 
 	if (ntohl(hdr.hdr_entries) < unpack_limit) {
+		unpacker = "unpack-objects";
 		argv_array_pushl(&child.args, "unpack-objects", hdr_arg, NULL);
 		if (quiet)
 			argv_array_push(&child.args, "-q");
@@ -1505,6 +1534,7 @@ static const char *unpack(int err_fd, struct shallow_info *si)
 		if (gethostname(keep_arg + s, sizeof(keep_arg) - s))
 			strcpy(keep_arg + s, "localhost");
 
+		unpacker = "index-pack";
 		argv_array_pushl(&child.args, "index-pack",
 				 "--stdin", hdr_arg, keep_arg, NULL);
 		if (fsck_objects)
@@ -1666,6 +1696,28 @@ static int delete_only(struct command *commands)
 	return 1;
 }
 
+static void audit_receive_pack(void)
+{
+	struct command *cmd;
+	unsigned int nr = 0, rejected = 0;
+
+	for (cmd = audit_commands; cmd; cmd = cmd->next) {
+		nr++;
+		if (cmd->error_string)
+			rejected++;
+	}
+	audit_log_addf("refs", "%u", refs_advertised);
+	audit_log_addf("commands", "%u", nr);
+	audit_log_addf("updated", "%u", nr - rejected);
+	audit_log_addf("rejected", "%u", rejected);
+	if (unpacker) {
+		audit_log_addf("objects", "%"PRIu32, pack_objects_received);
+		audit_log_addf("unpacker", "%s", unpacker);
+	}
+	if (unpack_result)
+		audit_log_addf("unpack", "%s", unpack_result);
+}
+
 int cmd_receive_pack(int argc, const char **argv, const char *prefix)
 {
 	int advertise_refs = 0;
@@ -1723,27 +1775,36 @@ int cmd_receive_pack(int argc, const char **argv, const char *prefix)
 	else if (0 <= receive_unpack_limit)
 		unpack_limit = receive_unpack_limit;
 
+	audit_log_start("receive-pack", "advertise", audit_receive_pack);
 	if (advertise_refs || !stateless_rpc) {
 		write_head_info();
 	}
-	if (advertise_refs)
+	if (advertise_refs) {
+		audit_log_status("ok");
 		return 0;
+	}
 
+	audit_log_phase("commands");
 	if ((commands = read_head_info(&shallow)) != NULL) {
 		const char *unpack_status = NULL;
 
+		audit_commands = commands;
 		prepare_shallow_info(&si, &shallow);
 		if (!si.nr_ours && !si.nr_theirs)
 			shallow_update = 0;
 		if (!delete_only(commands)) {
+			audit_log_phase("unpack");
 			unpack_status = unpack_with_sideband(&si);
+			unpack_result = unpack_status ? unpack_status : "ok";
 			update_shallow_info(commands, &si, &ref);
 		}
+		audit_log_phase("update");
 		execute_commands(commands, unpack_status, &si);
 		if (pack_lockfile)
 			unlink_or_warn(pack_lockfile);
 		if (report_status)
 			report(commands, unpack_status);
+		audit_log_phase("hooks");
 		run_receive_hook(commands, "post-receive", 1);
 		run_update_post_hook(commands);
 		if (auto_gc) {
@@ -1762,5 +1823,6 @@ int cmd_receive_pack(int argc, const char **argv, const char *prefix)
 	sha1_array_clear(&shallow);
 	sha1_array_clear(&ref);
 	free((void *)push_cert_nonce);
+	audit_log_status("ok");
 	return 0;
 }
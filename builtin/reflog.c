@@ -33,6 +33,7 @@ struct expire_reflog_policy_cb {
 	} unreachable_expire_kind;
 	struct commit_list *mark_list;
 	unsigned long mark_limit;
+	int marked;
 	struct cmd_reflog_expire_cb cmd;
 	struct commit *tip_commit;
 	struct commit_list *tips;
@@ -150,7 +151,7 @@ static int commit_is_complete(struct commit *commit)
 		for (i = 0; i < found.nr; i++) {
 			struct commit *c =
 				(struct commit *)found.objects[i].item;
-			if (!tree_is_complete(c->tree->object.sha1)) {
+			if (!tree_is_complete(get_commit_tree_sha1(c))) {
 				is_incomplete = 1;
 				c->object.flags |= INCOMPLETE;
 			}
@@ -270,6 +271,16 @@ static int unreachable(struct expire_reflog_policy_cb *cb, struct commit *commit
 			return 0;
 	}
 
+	/*
+	 * Only walk from the tip once an entry old enough to need
+	 * it shows up; first down to expire_total, as that usually
+	 * finds the commits of the entries.
+	 */
+	if (!cb->marked) {
+		mark_reachable(cb);
+		cb->marked = 1;
+	}
+
 	/* Reachable from the current ref?  Don't prune. */
 	if (commit->object.flags & REACHABLE)
 		return 0;
@@ -360,8 +371,8 @@ static void reflog_expiry_prepare(const char *refname,
 			commit_list_insert(cb->tip_commit, &cb->mark_list);
 		}
 		cb->mark_limit = cb->cmd.expire_total;
-		mark_reachable(cb);
 	}
+	cb->marked = 0;
 }
 
 static void reflog_expiry_cleanup(void *cb_data)
@@ -377,9 +388,43 @@ static void reflog_expiry_cleanup(void *cb_data)
 		} else {
 			clear_commit_marks(cb->tip_commit, REACHABLE);
 		}
+		free_commit_list(cb->mark_list);
 	}
 }
 
+static int oldest_reflog_ent(unsigned char *osha1, unsigned char *nsha1,
+			     const char *email, unsigned long timestamp, int tz,
+			     const char *message, void *cb_data)
+{
+	unsigned long *oldest = cb_data;
+
+	if (timestamp < *oldest)
+		*oldest = timestamp;
+	return 0;
+}
+
+/*
+ * Whether expiring the reflog of "ref" may drop any of its entries.
+ * Without --stale-fix, an entry younger than both expiry times is
+ * kept no matter what, so a reflog with only such entries does not
+ * have to be locked and rewritten, nor the history of the ref walked;
+ * this is the common case for "reflog expire --all".  The entries
+ * are not necessarily in chronological order (GIT_COMMITTER_DATE can
+ * be set to anything), so all their timestamps have to be looked at.
+ */
+static int reflog_may_expire(const char *ref, struct cmd_reflog_expire_cb *cmd,
+			     unsigned int flags)
+{
+	unsigned long oldest = ULONG_MAX;
+
+	if (cmd->stalefix || cmd->recno ||
+	    (flags & (EXPIRE_REFLOGS_VERBOSE | EXPIRE_REFLOGS_REWRITE |
+		      EXPIRE_REFLOGS_UPDATE_REF)))
+		return 1;
+	for_each_reflog_ent(ref, oldest_reflog_ent, &oldest);
+	return oldest < cmd->expire_total || oldest < cmd->expire_unreachable;
+}
+
 static int collect_reflog(const char *ref, const struct object_id *oid, int unused, void *cb_data)
 {
 	struct collected_reflog *e;
@@ -595,11 +640,12 @@ static int cmd_reflog_expire(int argc, const char **argv, const char *prefix)
 		for (i = 0; i < collected.nr; i++) {
 			struct collected_reflog *e = collected.e[i];
 			set_reflog_expiry_param(&cb.cmd, explicit_expiry, e->reflog);
-			status |= reflog_expire(e->reflog, e->sha1, flags,
-						reflog_expiry_prepare,
-						should_expire_reflog_ent,
-						reflog_expiry_cleanup,
-						&cb);
+			if (reflog_may_expire(e->reflog, &cb.cmd, flags))
+				status |= reflog_expire(e->reflog, e->sha1, flags,
+							reflog_expiry_prepare,
+							should_expire_reflog_ent,
+							reflog_expiry_cleanup,
+							&cb);
 			free(e);
 		}
 		free(collected.e);
@@ -613,11 +659,12 @@ static int cmd_reflog_expire(int argc, const char **argv, const char *prefix)
 			continue;
 		}
 		set_reflog_expiry_param(&cb.cmd, explicit_expiry, ref);
-		status |= reflog_expire(ref, sha1, flags,
-					reflog_expiry_prepare,
-					should_expire_reflog_ent,
-					reflog_expiry_cleanup,
-					&cb);
+		if (reflog_may_expire(ref, &cb.cmd, flags))
+			status |= reflog_expire(ref, sha1, flags,
+						reflog_expiry_prepare,
+						should_expire_reflog_ent,
+						reflog_expiry_cleanup,
+						&cb);
 	}
 	return status;
 }
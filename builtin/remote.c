@@ -328,12 +328,16 @@ static int get_ref_states(const struct ref *remote_refs, struct ref_states *stat
 {
 	struct ref *fetch_map = NULL, **tail = &fetch_map;
 	struct ref *ref, *stale_refs;
+	struct fetch_map_index index;
 	int i;
 
+	fetch_map_index_init(&index, remote_refs, states->remote->fetch,
+			     states->remote->fetch_refspec_nr);
 	for (i = 0; i < states->remote->fetch_refspec_nr; i++)
-		if (get_fetch_map(remote_refs, states->remote->fetch + i, &tail, 1))
+		if (get_fetch_map_indexed(&index, i, &tail, 1))
 			die(_("Could not get fetch map for refspec %s"),
 				states->remote->fetch_refspec[i]);
+	fetch_map_index_clear(&index);
 
 	states->new.strdup_strings = 1;
 	states->tracked.strdup_strings = 1;
@@ -896,7 +900,7 @@ static int get_remote_ref_states(const char *name,
 	if (query) {
 		transport = transport_get(states->remote, states->remote->url_nr > 0 ?
 			states->remote->url[0] : NULL);
-		remote_refs = transport_get_remote_refs(transport);
+		remote_refs = transport_get_remote_refs(transport, NULL);
 		transport_disconnect(transport);
 
 		states->queried = 1;
@@ -7,10 +7,13 @@
 #include "strbuf.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "midx.h"
 
 static int delta_base_offset = 1;
 static int pack_kept_objects = -1;
 static int write_bitmaps;
+static int use_delta_islands;
+static int write_midx = -1;
 static char *packdir, *packtmp;
 
 static const char *const git_repack_usage[] = {
@@ -104,7 +107,8 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list)
 
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap"};
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".rev", ".sizes",
+			      ".bases"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -120,6 +124,115 @@ static void remove_redundant_pack(const char *dir_name, const char *base_name)
 	strbuf_release(&buf);
 }
 
+/*
+ * The local packs that a geometric repack may roll up, sorted by
+ * object count; those before "split" are rolled into the new pack.
+ */
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	const struct packed_git *a = *(const struct packed_git **)va;
+	const struct packed_git *b = *(const struct packed_git **)vb;
+
+	if (a->num_objects < b->num_objects)
+		return -1;
+	if (a->num_objects > b->num_objects)
+		return 1;
+	return 0;
+}
+
+static void init_pack_geometry(struct pack_geometry *geometry)
+{
+	struct packed_git *p;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		/* packs with a .keep file are never rolled up */
+		if (!p->pack_local || p->pack_keep)
+			continue;
+		if (open_pack_index(p))
+			die(_("cannot open index of '%s'"), p->pack_name);
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+	qsort(geometry->pack, geometry->pack_nr, sizeof(*geometry->pack),
+	      geometry_cmp);
+}
+
+/*
+ * Find the smallest set of small packs to roll up so that the packs
+ * left over, together with the new one, have at least "factor" times
+ * as many objects as the next smaller pack.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint64_t total = 0;
+	uint32_t i, split;
+
+	if (!geometry->pack_nr)
+		return;
+
+	/* the largest packs that already form a progression stay */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		struct packed_git *ours = geometry->pack[i];
+		struct packed_git *prev = geometry->pack[i - 1];
+
+		if (ours->num_objects < (uint64_t)factor * prev->num_objects)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	/*
+	 * The new pack may itself be too large to sit below the packs we
+	 * meant to keep; roll those into it as well until it fits.
+	 */
+	for (i = 0; i < split; i++)
+		total += geometry->pack[i]->num_objects;
+	for (i = split; i < geometry->pack_nr; i++) {
+		struct packed_git *ours = geometry->pack[i];
+
+		if (ours->num_objects >= (uint64_t)factor * total)
+			break;
+		total += ours->num_objects;
+		split++;
+	}
+	geometry->split = split;
+}
+
+static int write_loose_object_name(const unsigned char *sha1,
+				   const char *path, void *data)
+{
+	/* objects in the packs we keep stay there */
+	if (!has_sha1_pack(sha1))
+		fprintf(data, "%s\n", sha1_to_hex(sha1));
+	return 0;
+}
+
+/*
+ * Feed pack-objects the objects of the packs being rolled up, and the
+ * loose objects no pack has yet.
+ */
+static void write_geometry_objects(FILE *out, struct pack_geometry *geometry)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < geometry->split; i++) {
+		struct packed_git *p = geometry->pack[i];
+
+		for (j = 0; j < p->num_objects; j++)
+			fprintf(out, "%s\n",
+				sha1_to_hex(nth_packed_object_sha1(p, j)));
+	}
+	for_each_loose_object(write_loose_object_name, out,
+			      FOR_EACH_OBJECT_LOCAL_ONLY);
+}
+
 #define ALL_INTO_ONE 1
 #define LOOSEN_UNREACHABLE 2
 
@@ -132,12 +245,16 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		{".pack"},
 		{".idx"},
 		{".bitmap", 1},
+		{".rev", 1},
+		{".sizes", 1},
+		{".bases", 1},
 	};
 	struct child_process cmd = CHILD_PROCESS_INIT;
 	struct string_list_item *item;
 	struct string_list names = STRING_LIST_INIT_DUP;
 	struct string_list rollback = STRING_LIST_INIT_NODUP;
 	struct string_list existing_packs = STRING_LIST_INIT_DUP;
+	struct pack_geometry geometry = { NULL };
 	struct strbuf line = STRBUF_INIT;
 	int ext, ret, failed;
 	FILE *out;
@@ -153,6 +270,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	int no_update_server_info = 0;
 	int quiet = 0;
 	int local = 0;
+	int geometric_factor = 0;
 
 	struct option builtin_repack_options[] = {
 		OPT_BIT('a', NULL, &pack_everything,
@@ -160,6 +278,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("roll up small packs to keep a geometric progression with factor <n>")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &no_reuse_delta,
@@ -173,6 +293,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				N_("pass --local to git-pack-objects")),
 		OPT_BOOL('b', "write-bitmap-index", &write_bitmaps,
 				N_("write bitmap index")),
+		OPT_BOOL('i', "delta-islands", &use_delta_islands,
+				N_("pass --delta-islands to git-pack-objects")),
+		OPT_BOOL(0, "write-midx", &write_midx,
+				N_("write a multi-pack index of the resulting packs")),
 		OPT_STRING(0, "unpack-unreachable", &unpack_unreachable, N_("approxidate"),
 				N_("with -A, do not loosen objects older than this")),
 		OPT_STRING(0, "window", &window, N_("n"),
@@ -193,8 +317,20 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	argc = parse_options(argc, argv, prefix, builtin_repack_options,
 				git_repack_usage, 0);
 
+	if (geometric_factor) {
+		if (pack_everything)
+			die(_("--geometric is incompatible with -a and -A"));
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+		/* the new pack lacks closure; see Documentation/git-repack.txt */
+		write_bitmaps = 0;
+		pack_kept_objects = 0;
+	}
+
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
+	if (write_midx < 0)
+		write_midx = core_multi_pack_index || geometric_factor;
 
 	packdir = mkpathdup("%s/pack", get_object_directory());
 	packtmp = mkpathdup("%s/.tmp-%d-pack", packdir, (int)getpid());
@@ -202,13 +338,16 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	sigchain_push_common(remove_pack_on_signal);
 
 	argv_array_push(&cmd.args, "pack-objects");
-	argv_array_push(&cmd.args, "--keep-true-parents");
+	if (!geometric_factor)
+		argv_array_push(&cmd.args, "--keep-true-parents");
 	if (!pack_kept_objects)
 		argv_array_push(&cmd.args, "--honor-pack-keep");
 	argv_array_push(&cmd.args, "--non-empty");
-	argv_array_push(&cmd.args, "--all");
-	argv_array_push(&cmd.args, "--reflog");
-	argv_array_push(&cmd.args, "--indexed-objects");
+	if (!geometric_factor) {
+		argv_array_push(&cmd.args, "--all");
+		argv_array_push(&cmd.args, "--reflog");
+		argv_array_push(&cmd.args, "--indexed-objects");
+	}
 	if (window)
 		argv_array_pushf(&cmd.args, "--window=%s", window);
 	if (window_memory)
@@ -223,8 +362,26 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_pushf(&cmd.args, "--no-reuse-object");
 	if (write_bitmaps)
 		argv_array_push(&cmd.args, "--write-bitmap-index");
-
-	if (pack_everything & ALL_INTO_ONE) {
+	if (use_delta_islands)
+		argv_array_push(&cmd.args, "--delta-islands");
+
+	if (geometric_factor) {
+		uint32_t i;
+
+		init_pack_geometry(&geometry);
+		split_pack_geometry(&geometry, geometric_factor);
+		for (i = 0; i < geometry.split; i++) {
+			const char *name = geometry.pack[i]->pack_name;
+			const char *slash = strrchr(name, '/');
+			size_t len;
+
+			if (slash)
+				name = slash + 1;
+			if (strip_suffix(name, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(name, len));
+		}
+	} else if (pack_everything & ALL_INTO_ONE) {
 		get_non_kept_pack_filenames(&existing_packs);
 
 		if (existing_packs.nr && delete_redundant) {
@@ -251,16 +408,28 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		argv_array_push(&cmd.args,  "--quiet");
 	if (delta_base_offset)
 		argv_array_push(&cmd.args,  "--delta-base-offset");
+	if (repository_format_partial_clone)
+		argv_array_push(&cmd.args,  "--missing=allow-any");
 
 	argv_array_push(&cmd.args, packtmp);
 
 	cmd.git_cmd = 1;
 	cmd.out = -1;
-	cmd.no_stdin = 1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
 
 	ret = start_command(&cmd);
 	if (ret)
 		return ret;
+	trace_region_enter("repack", "pack-objects");
+
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+		write_geometry_objects(in, &geometry);
+		fclose(in);
+	}
 
 	out = xfdopen(cmd.out, "r");
 	while (strbuf_getline(&line, out, '\n') != EOF) {
@@ -270,8 +439,10 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	}
 	fclose(out);
 	ret = finish_command(&cmd);
+	trace_region_leave("repack", "pack-objects");
 	if (ret)
 		return ret;
+	trace_counter("repack", "packs written", names.nr);
 
 	if (!names.nr && !quiet)
 		printf("Nothing new to pack.\n");
@@ -282,6 +453,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	 * if we can move them out of the way (this can happen if we
 	 * repacked immediately after packing fully.
 	 */
+	trace_region_enter("repack", "install packs");
 	failed = 0;
 	for_each_string_list_item(item, &names) {
 		for (ext = 0; ext < ARRAY_SIZE(exts); ext++) {
@@ -379,9 +551,14 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	}
 
 	/* End of pack replacement. */
+	trace_region_leave("repack", "install packs");
+
+	/* we looked at the packs before; make prune-packed see the new ones */
+	if (geometric_factor)
+		reprepare_packed_git();
 
 	if (delete_redundant) {
-		int opts = 0;
+		trace_region_enter("repack", "remove redundant");
 		string_list_sort(&names);
 		for_each_string_list_item(item, &existing_packs) {
 			char *sha1;
@@ -392,9 +569,26 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 			if (!string_list_has_string(&names, sha1))
 				remove_redundant_pack(packdir, item->string);
 		}
+		trace_region_leave("repack", "remove redundant");
+	}
+
+	/*
+	 * A multi-pack index naming packs we just removed would be
+	 * ignored by readers anyway; drop it rather than leave it stale.
+	 */
+	if (write_midx) {
+		if (write_multi_pack_index(get_object_directory()))
+			die(_("failed to write multi-pack index"));
+	} else if (delete_redundant && existing_packs.nr)
+		clear_multi_pack_index(get_object_directory());
+
+	if (delete_redundant) {
+		int opts = 0;
 		if (!quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
+		trace_region_enter("repack", "prune packed");
 		prune_packed_objects(opts);
+		trace_region_leave("repack", "prune packed");
 	}
 
 	if (!no_update_server_info)
@@ -403,6 +597,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free(geometry.pack);
 	strbuf_release(&line);
 
 	return 0;
@@ -9,6 +9,7 @@
 #include "log-tree.h"
 #include "graph.h"
 #include "bisect.h"
+#include "list-objects-filter.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -37,6 +38,8 @@ static const char rev_list_usage[] =
 "    --parents\n"
 "    --children\n"
 "    --objects | --objects-edge\n"
+"    --filter=<filter-spec> | --no-filter\n"
+"    --missing=(error|allow-any|print)\n"
 "    --unpacked\n"
 "    --header | --pretty\n"
 "    --abbrev=<n> | --no-abbrev\n"
@@ -48,6 +51,15 @@ static const char rev_list_usage[] =
 "    --bisect-all"
 ;
 
+static struct list_objects_filter_options filter_options;
+
+enum missing_action {
+	MA_ERROR = 0,    /* fail if any missing objects are encountered */
+	MA_ALLOW_ANY,    /* silently allow ALL missing objects */
+	MA_PRINT         /* print ALL missing objects in special section */
+};
+static enum missing_action arg_missing_action;
+
 static void finish_commit(struct commit *commit, void *data);
 static void show_commit(struct commit *commit, void *data)
 {
@@ -106,7 +118,8 @@ static void show_commit(struct commit *commit, void *data)
 	else
 		putchar('\n');
 
-	if (revs->verbose_header && get_cached_commit_buffer(commit, NULL)) {
+	if (revs->verbose_header &&
+	    (save_commit_buffer || get_cached_commit_buffer(commit, NULL))) {
 		struct strbuf buf = STRBUF_INIT;
 		struct pretty_print_context ctx = {0};
 		ctx.abbrev = revs->abbrev;
@@ -176,15 +189,38 @@ static void finish_commit(struct commit *commit, void *data)
 	free_commit_buffer(commit);
 }
 
-static void finish_object(struct object *obj,
-			  const struct name_path *path, const char *name,
-			  void *cb_data)
+/*
+ * Returns 1 if the object is missing and --missing says to go on
+ * without it.
+ */
+static int finish_object(struct object *obj,
+			 const struct name_path *path, const char *name,
+			 void *cb_data)
 {
 	struct rev_list_info *info = cb_data;
-	if (obj->type == OBJ_BLOB && !has_sha1_file(obj->sha1))
-		die("missing blob object '%s'", sha1_to_hex(obj->sha1));
+	int missing;
+
+	if (arg_missing_action == MA_ERROR)
+		missing = obj->type == OBJ_BLOB && !has_sha1_file(obj->sha1);
+	else if (obj->type == OBJ_TREE)
+		missing = !obj->parsed;
+	else
+		missing = obj->type != OBJ_COMMIT && !has_sha1_file(obj->sha1);
+
+	if (missing) {
+		switch (arg_missing_action) {
+		case MA_ERROR:
+			die("missing blob object '%s'", sha1_to_hex(obj->sha1));
+		case MA_PRINT:
+			printf("?%s\n", sha1_to_hex(obj->sha1));
+			/* fallthrough */
+		case MA_ALLOW_ANY:
+			return 1;
+		}
+	}
 	if (info->revs->verify_objects && !obj->parsed && obj->type != OBJ_COMMIT)
 		parse_object(obj->sha1);
+	return 0;
 }
 
 static void show_object(struct object *obj,
@@ -192,7 +228,8 @@ static void show_object(struct object *obj,
 			void *cb_data)
 {
 	struct rev_list_info *info = cb_data;
-	finish_object(obj, path, component, cb_data);
+	if (finish_object(obj, path, component, cb_data))
+		return;
 	if (info->flags & REV_LIST_QUIET)
 		return;
 	show_object_with_name(stdout, obj, path, component);
@@ -270,6 +307,93 @@ static int show_object_fast(
 	return 1;
 }
 
+static int is_merge_base_arg(struct rev_info *revs, struct object *obj)
+{
+	unsigned int i;
+
+	for (i = 0; i < revs->cmdline.nr; i++)
+		if (revs->cmdline.rev[i].item == obj &&
+		    revs->cmdline.rev[i].whence == REV_CMD_MERGE_BASE)
+			return 1;
+	return 0;
+}
+
+/*
+ * "--count" of what "A...B", or some commits less others, leaves needs
+ * no full walk when nothing else limits what is counted: hand it to
+ * count_ahead_behind().  Returns -1 if that cannot be done.
+ */
+static int count_without_walk(struct rev_info *revs)
+{
+	struct commit **pos = NULL, **neg = NULL;
+	int nr_pos = 0, alloc_pos = 0, nr_neg = 0, alloc_neg = 0;
+	struct commit *left = NULL;
+	int num_pos, num_neg, i, ret = -1;
+
+	if (revs->cherry_mark || revs->cherry_pick ||
+	    revs->left_only || revs->right_only ||
+	    revs->prune || revs->reflog_info || revs->bisect ||
+	    revs->ancestry_path || revs->first_parent_only ||
+	    revs->boundary || revs->show_all || revs->no_walk ||
+	    revs->simplify_by_decoration || revs->line_level_traverse ||
+	    revs->tag_objects || revs->tree_objects || revs->blob_objects ||
+	    revs->max_count >= 0 || revs->skip_count >= 0 ||
+	    revs->max_age != -1 || revs->min_age != -1 ||
+	    revs->min_parents || revs->max_parents >= 0 ||
+	    revs->include_check ||
+	    revs->grep_filter.pattern_list || revs->grep_filter.header_list)
+		return -1;
+
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		struct commit *commit = (struct commit *)obj;
+
+		if (obj->type != OBJ_COMMIT)
+			goto out;
+		if (obj->flags & UNINTERESTING) {
+			ALLOC_GROW(neg, nr_neg + 1, alloc_neg);
+			neg[nr_neg++] = commit;
+		} else if (obj->flags & SYMMETRIC_LEFT) {
+			if (left)
+				goto out;
+			left = commit;
+		} else {
+			ALLOC_GROW(pos, nr_pos + 1, alloc_pos);
+			pos[nr_pos++] = commit;
+		}
+	}
+
+	if (!left) {
+		if (count_ahead_behind(nr_pos, pos, nr_neg, neg,
+				       &num_pos, &num_neg))
+			goto out;
+		revs->count_right = num_pos;
+	} else if (!nr_pos) {
+		/* "A...B" where B is a merge base, i.e. an ancestor of A */
+		if (count_ahead_behind(1, &left, nr_neg, neg,
+				       &revs->count_left, &num_neg))
+			goto out;
+	} else {
+		/*
+		 * For "A...B" alone, the only commits excluded are merge
+		 * bases of the two, which neither side counts anyway.
+		 */
+		if (nr_pos != 1)
+			goto out;
+		for (i = 0; i < nr_neg; i++)
+			if (!is_merge_base_arg(revs, &neg[i]->object))
+				goto out;
+		if (count_ahead_behind(1, &left, 1, pos,
+				       &revs->count_left, &revs->count_right))
+			goto out;
+	}
+	ret = 0;
+out:
+	free(pos);
+	free(neg);
+	return ret;
+}
+
 int cmd_rev_list(int argc, const char **argv, const char *prefix)
 {
 	struct rev_info revs;
@@ -279,6 +403,28 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	int bisect_show_vars = 0;
 	int bisect_find_all = 0;
 	int use_bitmap_index = 0;
+	const char *arg;
+
+	/*
+	 * A missing object has to be noticed (and handled as asked)
+	 * rather than fetched from a partial clone remote, before
+	 * setup_revisions() reads any of them.
+	 */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--"))
+			break;
+		if (skip_prefix(argv[i], "--missing=", &arg)) {
+			if (!strcmp(arg, "error"))
+				arg_missing_action = MA_ERROR;
+			else if (!strcmp(arg, "allow-any"))
+				arg_missing_action = MA_ALLOW_ANY;
+			else if (!strcmp(arg, "print"))
+				arg_missing_action = MA_PRINT;
+			else
+				die(_("invalid value for --missing"));
+			fetch_if_missing = 0;
+		}
+	}
 
 	git_config(git_default_config, NULL);
 	init_revisions(&revs, prefix);
@@ -294,7 +440,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (DIFF_OPT_TST(&revs.diffopt, QUICK))
 		info.flags |= REV_LIST_QUIET;
 	for (i = 1 ; i < argc; i++) {
-		const char *arg = argv[i];
+		arg = argv[i];
 
 		if (!strcmp(arg, "--header")) {
 			revs.verbose_header = 1;
@@ -328,6 +474,17 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			test_bitmap_walk(&revs);
 			return 0;
 		}
+		if (skip_prefix(arg, "--filter=", &arg)) {
+			if (parse_list_objects_filter(&filter_options, arg))
+				usage(rev_list_usage);
+			continue;
+		}
+		if (!strcmp(arg, "--no-filter")) {
+			list_objects_filter_release(&filter_options);
+			continue;
+		}
+		if (starts_with(arg, "--missing="))
+			continue; /* already handled above */
 		usage(rev_list_usage);
 
 	}
@@ -354,6 +511,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			      revs.grep_filter.header_list);
 	if (bisect_list)
 		revs.limited = 1;
+	if (filter_options.choice)
+		use_bitmap_index = 0;
+	if (arg_missing_action != MA_ERROR)
+		revs.do_not_die_on_missing_tree = 1;
 
 	if (use_bitmap_index) {
 		if (revs.count && !revs.left_right && !revs.cherry_mark) {
@@ -371,6 +532,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 		}
 	}
 
+	if (revs.count && !bisect_list && !filter_options.choice &&
+	    !count_without_walk(&revs))
+		goto show_count;
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
@@ -386,8 +551,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			return show_bisect_vars(&info, reaches, all);
 	}
 
-	traverse_commit_list(&revs, show_commit, show_object, &info);
+	traverse_commit_list_filtered(&filter_options, &revs,
+				      show_commit, show_object, &info);
 
+show_count:
 	if (revs.count) {
 		if (revs.left_right && revs.cherry_mark)
 			printf("%d\t%d\t%d\n", revs.count_left, revs.count_right, revs.count_same);
@@ -8,6 +8,7 @@
 #include "mailmap.h"
 #include "shortlog.h"
 #include "parse-options.h"
+#include "thread-utils.h"
 
 static char const * const shortlog_usage[] = {
 	N_("git shortlog [<options>] [<revision-range>] [[--] [<path>...]]"),
@@ -17,7 +18,7 @@ static char const * const shortlog_usage[] = {
 static int compare_by_number(const void *a1, const void *a2)
 {
 	const struct string_list_item *i1 = a1, *i2 = a2;
-	const struct string_list *l1 = i1->util, *l2 = i2->util;
+	const struct shortlog_author *l1 = i1->util, *l2 = i2->util;
 
 	if (l1->nr < l2->nr)
 		return 1;
@@ -27,13 +28,21 @@ static int compare_by_number(const void *a1, const void *a2)
 		return -1;
 }
 
+/*
+ * Count a commit of "author" in "authors" and, unless only the counts
+ * are shown, add its subject, taken from "oneline", to the list of
+ * the author.  "seq" is remembered with the subject (see
+ * add_from_rev_threaded()).
+ */
 static void insert_one_record(struct shortlog *log,
+			      struct strmap *authors,
 			      const char *author,
-			      const char *oneline)
+			      const char *oneline,
+			      unsigned long seq)
 {
 	const char *dot3 = log->common_repo_prefix;
 	char *buffer, *p;
-	struct string_list_item *item;
+	struct shortlog_author *item;
 	const char *mailbuf, *namebuf;
 	size_t namelen, maillen;
 	const char *eol;
@@ -55,9 +64,15 @@ static void insert_one_record(struct shortlog *log,
 	if (log->email)
 		strbuf_addf(&namemailbuf, " <%.*s>", (int)maillen, mailbuf);
 
-	item = string_list_insert(&log->list, namemailbuf.buf);
-	if (item->util == NULL)
-		item->util = xcalloc(1, sizeof(struct string_list));
+	item = strmap_get(authors, namemailbuf.buf);
+	if (!item) {
+		item = xcalloc(1, sizeof(*item));
+		strmap_put(authors, namemailbuf.buf, item);
+	}
+	strbuf_release(&namemailbuf);
+	item->nr++;
+	if (log->summary)
+		return;
 
 	/* Skip any leading whitespace, including any blank lines. */
 	while (*oneline && isspace(*oneline))
@@ -86,7 +101,7 @@ static void insert_one_record(struct shortlog *log,
 		}
 	}
 
-	string_list_append(item->util, buffer);
+	string_list_append(&item->onelines, buffer)->util = (void *)(uintptr_t)seq;
 }
 
 static void read_from_stdin(struct shortlog *log)
@@ -103,36 +118,61 @@ static void read_from_stdin(struct shortlog *log)
 		while (fgets(oneline, sizeof(oneline), stdin) &&
 		       oneline[0] == '\n')
 			; /* discard blanks */
-		insert_one_record(log, author + 8, oneline);
+		insert_one_record(log, &log->authors, author + 8, oneline, 0);
 	}
 }
 
-void shortlog_add_commit(struct shortlog *log, struct commit *commit)
+/* The first paragraph of "msg", as CMIT_FMT_RAW would show it */
+static void add_subject_paragraph(struct strbuf *sb, const char *msg)
 {
-	const char *author = NULL, *buffer;
-	struct strbuf buf = STRBUF_INIT;
-	struct strbuf ufbuf = STRBUF_INIT;
-
-	pp_commit_easy(CMIT_FMT_RAW, commit, &buf);
-	buffer = buf.buf;
-	while (*buffer && *buffer != '\n') {
-		const char *eol = strchr(buffer, '\n');
-
-		if (eol == NULL)
-			eol = buffer + strlen(buffer);
-		else
-			eol++;
-
-		if (starts_with(buffer, "author "))
-			author = buffer + 7;
-		buffer = eol;
+	while (*msg) {
+		const char *eol = strchrnul(msg, '\n');
+		int len = eol - msg;
+
+		while (len && isspace(msg[len - 1]))
+			len--;
+		if (len) {
+			strbuf_addstr(sb, "    ");
+			strbuf_add(sb, msg, len);
+			strbuf_addch(sb, '\n');
+		} else if (sb->len)
+			break;
+		msg = *eol ? eol + 1 : eol;
+	}
+}
+
+/*
+ * Put the author ident of "commit" into "author" and, unless only the
+ * counts are shown, the text to take its subject from into "oneline".
+ * Returns -1 if the commit has no author.
+ */
+static int read_commit_record(struct shortlog *log, struct commit *commit,
+			      struct strbuf *author, struct strbuf *oneline)
+{
+	const char *buffer, *p, *author_line = NULL;
+	size_t author_len = 0;
+
+	buffer = logmsg_reencode(commit, NULL, get_log_output_encoding());
+	for (p = buffer; *p && *p != '\n'; ) {
+		const char *eol = strchrnul(p, '\n');
+
+		if (starts_with(p, "author ")) {
+			author_line = p + 7;
+			author_len = eol - author_line;
+		}
+		p = *eol ? eol + 1 : eol;
 	}
-	if (!author) {
+	if (!author_line) {
+		unuse_commit_buffer(commit, buffer);
 		warning(_("Missing author: %s"),
 		    sha1_to_hex(commit->object.sha1));
-		return;
+		return -1;
 	}
-	if (log->user_format) {
+	strbuf_add(author, author_line, author_len);
+
+	if (log->summary)
+		; /* the subjects are not shown */
+	else if (log->user_format) {
 		struct pretty_print_context ctx = {0};
 		ctx.fmt = CMIT_FMT_USERFORMAT;
 		ctx.abbrev = log->abbrev;
@@ -140,22 +180,231 @@ void shortlog_add_commit(struct shortlog *log, struct commit *commit)
 		ctx.after_subject = "";
 		ctx.date_mode = DATE_NORMAL;
 		ctx.output_encoding = get_log_output_encoding();
-		pretty_print_commit(&ctx, commit, &ufbuf);
-		buffer = ufbuf.buf;
-	} else if (*buffer) {
-		buffer++;
+		pretty_print_commit(&ctx, commit, oneline);
+	} else if (*p)
+		add_subject_paragraph(oneline, p + 1);
+	if (!log->summary && !oneline->len)
+		strbuf_addstr(oneline, "<none>");
+	unuse_commit_buffer(commit, buffer);
+	return 0;
+}
+
+void shortlog_add_commit(struct shortlog *log, struct commit *commit)
+{
+	struct strbuf author = STRBUF_INIT;
+	struct strbuf oneline = STRBUF_INIT;
+
+	if (!read_commit_record(log, commit, &author, &oneline))
+		insert_one_record(log, &log->authors, author.buf, oneline.buf, 0);
+	strbuf_release(&author);
+	strbuf_release(&oneline);
+}
+
+#ifndef NO_PTHREADS
+/*
+ * With more than one thread, the walk stays on the main thread, which
+ * only copies the author and the subject paragraph of each commit into
+ * a batch.  The workers take the batches in walk order, and split the
+ * idents, look them up in the mailmap, format the subjects and count
+ * them into tables of their own, which are merged at the end.  Each
+ * subject carries its position in the walk, and sorting the subjects
+ * of an author by it restores the order they were added in.
+ */
+#define RECORDS_PER_BATCH 256
+
+struct record_batch {
+	unsigned long first;	/* position of the first record in the walk */
+	int nr;
+	struct {
+		char *author;
+		char *oneline;
+	} records[RECORDS_PER_BATCH];
+	struct record_batch *next;
+};
+
+struct record_queue {
+	struct shortlog *log;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct record_batch *todo, **tail;
+	int done;
+};
+
+struct record_worker {
+	struct record_queue *queue;
+	pthread_t thread;
+	struct strmap authors;
+};
+
+static void *count_records(void *data)
+{
+	struct record_worker *worker = data;
+	struct record_queue *queue = worker->queue;
+
+	for (;;) {
+		struct record_batch *batch;
+		int i;
+
+		pthread_mutex_lock(&queue->mutex);
+		while (!queue->todo && !queue->done)
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+		batch = queue->todo;
+		if (batch) {
+			queue->todo = batch->next;
+			if (!queue->todo)
+				queue->tail = &queue->todo;
+		}
+		pthread_mutex_unlock(&queue->mutex);
+		if (!batch)
+			break;
+
+		for (i = 0; i < batch->nr; i++) {
+			insert_one_record(queue->log, &worker->authors,
+					  batch->records[i].author,
+					  batch->records[i].oneline,
+					  batch->first + i);
+			free(batch->records[i].author);
+			free(batch->records[i].oneline);
+		}
+		free(batch);
 	}
-	insert_one_record(log, author, !*buffer ? "<none>" : buffer);
-	strbuf_release(&ufbuf);
-	strbuf_release(&buf);
+	return NULL;
 }
 
+static void queue_batch(struct record_queue *queue, struct record_batch *batch)
+{
+	pthread_mutex_lock(&queue->mutex);
+	*queue->tail = batch;
+	queue->tail = &batch->next;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static int compare_by_seq(const void *a1, const void *a2)
+{
+	const struct string_list_item *i1 = a1, *i2 = a2;
+	uintptr_t s1 = (uintptr_t)i1->util, s2 = (uintptr_t)i2->util;
+
+	return s1 < s2 ? -1 : s1 > s2;
+}
+
+static void merge_authors(struct shortlog *log, struct strmap *authors)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(authors, &iter, e) {
+		struct shortlog_author *from = e->value;
+		struct shortlog_author *to = strmap_get(&log->authors, e->key);
+		int i;
+
+		if (!to) {
+			strmap_put(&log->authors, e->key, from);
+			continue;
+		}
+		to->nr += from->nr;
+		for (i = 0; i < from->onelines.nr; i++) {
+			struct string_list_item *item = &from->onelines.items[i];
+			string_list_append(&to->onelines, item->string)->util = item->util;
+		}
+		string_list_clear(&from->onelines, 0);
+		free(from);
+	}
+	strmap_clear(authors, 0);
+}
+
+static void add_from_rev_threaded(struct rev_info *rev, struct shortlog *log,
+				  int nr_threads)
+{
+	struct record_queue queue;
+	struct record_worker *workers;
+	struct record_batch *batch = NULL;
+	struct strbuf author = STRBUF_INIT;
+	struct strbuf oneline = STRBUF_INIT;
+	struct commit *commit;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	unsigned long nr = 0;
+	int i, started;
+
+	memset(&queue, 0, sizeof(queue));
+	queue.log = log;
+	queue.tail = &queue.todo;
+	pthread_mutex_init(&queue.mutex, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+
+	workers = xcalloc(nr_threads, sizeof(*workers));
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].queue = &queue;
+		strmap_init(&workers[i].authors, 1);
+	}
+	for (started = 0; started < nr_threads; started++) {
+		if (pthread_create(&workers[started].thread, NULL,
+				   count_records, &workers[started])) {
+			warning(_("unable to create thread: %s"), strerror(errno));
+			break;
+		}
+	}
+
+	while ((commit = get_revision(rev)) != NULL) {
+		if (read_commit_record(log, commit, &author, &oneline))
+			continue;
+		if (!batch) {
+			batch = xmalloc(sizeof(*batch));
+			batch->first = nr;
+			batch->nr = 0;
+			batch->next = NULL;
+		}
+		batch->records[batch->nr].author = strbuf_detach(&author, NULL);
+		batch->records[batch->nr].oneline = strbuf_detach(&oneline, NULL);
+		batch->nr++;
+		nr++;
+		if (batch->nr == RECORDS_PER_BATCH) {
+			queue_batch(&queue, batch);
+			batch = NULL;
+		}
+	}
+	if (batch)
+		queue_batch(&queue, batch);
+
+	pthread_mutex_lock(&queue.mutex);
+	queue.done = 1;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.mutex);
+	if (!started)
+		count_records(&workers[0]);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < nr_threads; i++)
+		merge_authors(log, &workers[i].authors);
+	strmap_for_each_entry(&log->authors, &iter, e) {
+		struct shortlog_author *item = e->value;
+		qsort(item->onelines.items, item->onelines.nr,
+		      sizeof(*item->onelines.items), compare_by_seq);
+	}
+
+	free(workers);
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.mutex);
+}
+#endif
+
 static void get_from_rev(struct rev_info *rev, struct shortlog *log)
 {
 	struct commit *commit;
 
 	if (prepare_revision_walk(rev))
 		die(_("revision walk setup failed"));
+#ifndef NO_PTHREADS
+	if (log->threads != 1) {
+		int nr_threads = log->threads ? log->threads : online_cpus();
+		if (nr_threads > 1) {
+			add_from_rev_threaded(rev, log, nr_threads);
+			return;
+		}
+	}
+#endif
 	while ((commit = get_revision(rev)) != NULL)
 		shortlog_add_commit(log, commit);
 }
@@ -213,12 +462,27 @@ void shortlog_init(struct shortlog *log)
 
 	read_mailmap(&log->mailmap, &log->common_repo_prefix);
 
-	log->list.strdup_strings = 1;
+	strmap_init(&log->authors, 1);
+	log->threads = 1;
 	log->wrap = DEFAULT_WRAPLEN;
 	log->in1 = DEFAULT_INDENT1;
 	log->in2 = DEFAULT_INDENT2;
 }
 
+static int shortlog_threads;
+
+static int git_shortlog_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "shortlog.threads")) {
+		shortlog_threads = git_config_int(var, value);
+		if (shortlog_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    shortlog_threads, var);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_shortlog(int argc, const char **argv, const char *prefix)
 {
 	static struct shortlog log;
@@ -239,8 +503,9 @@ int cmd_shortlog(int argc, const char **argv, const char *prefix)
 
 	struct parse_opt_ctx_t ctx;
 
-	git_config(git_default_config, NULL);
+	git_config(git_shortlog_config, NULL);
 	shortlog_init(&log);
+	log.threads = shortlog_threads;
 	init_revisions(&rev, prefix);
 	parse_options_start(&ctx, argc, argv, prefix, options,
 			    PARSE_OPT_KEEP_DASHDASH | PARSE_OPT_KEEP_ARGV0);
@@ -291,17 +556,24 @@ void shortlog_output(struct shortlog *log)
 {
 	int i, j;
 	struct strbuf sb = STRBUF_INIT;
+	struct string_list list = STRING_LIST_INIT_NODUP;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
 
+	strmap_for_each_entry(&log->authors, &iter, e)
+		string_list_append(&list, e->key)->util = e->value;
+	string_list_sort(&list);
 	if (log->sort_by_number)
-		qsort(log->list.items, log->list.nr, sizeof(struct string_list_item),
+		qsort(list.items, list.nr, sizeof(struct string_list_item),
 			compare_by_number);
-	for (i = 0; i < log->list.nr; i++) {
-		struct string_list *onelines = log->list.items[i].util;
+	for (i = 0; i < list.nr; i++) {
+		struct shortlog_author *author = list.items[i].util;
+		struct string_list *onelines = &author->onelines;
 
 		if (log->summary) {
-			printf("%6d\t%s\n", onelines->nr, log->list.items[i].string);
+			printf("%6d\t%s\n", author->nr, list.items[i].string);
 		} else {
-			printf("%s (%d):\n", log->list.items[i].string, onelines->nr);
+			printf("%s (%d):\n", list.items[i].string, author->nr);
 			for (j = onelines->nr - 1; j >= 0; j--) {
 				const char *msg = onelines->items[j].string;
 
@@ -318,12 +590,11 @@ void shortlog_output(struct shortlog *log)
 
 		onelines->strdup_strings = 1;
 		string_list_clear(onelines, 0);
-		free(onelines);
-		log->list.items[i].util = NULL;
+		free(author);
 	}
 
 	strbuf_release(&sb);
-	log->list.strdup_strings = 1;
-	string_list_clear(&log->list, 1);
+	string_list_clear(&list, 0);
+	strmap_clear(&log->authors, 0);
 	clear_mailmap(&log->mailmap);
 }
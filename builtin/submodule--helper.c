@@ -0,0 +1,114 @@
+/*
+ * Helpers for git-submodule.sh that are better done in C.
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "run-command.h"
+
+struct job_list {
+	struct strbuf *cmds;
+	int nr, alloc, next;
+	int result;
+};
+
+static int get_next_job(struct child_process *cp, struct strbuf *err,
+			void *data, void **task_cb)
+{
+	struct job_list *jobs = data;
+
+	if (jobs->next >= jobs->nr)
+		return 0;
+	argv_array_push(&cp->args, jobs->cmds[jobs->next++].buf);
+	cp->use_shell = 1;
+	return 1;
+}
+
+static int job_start_failure(struct strbuf *err, void *data, void *task_cb)
+{
+	struct job_list *jobs = data;
+
+	if (!jobs->result)
+		jobs->result = 1;
+	return 0;
+}
+
+static int job_finished(int result, struct strbuf *err,
+			void *data, void *task_cb)
+{
+	struct job_list *jobs = data;
+
+	if (result > jobs->result)
+		jobs->result = result;
+	return 0;
+}
+
+/*
+ * Run the shell commands read from stdin, one per line, up to
+ * "--jobs" of them at a time, and exit with the highest status
+ * any of them exited with.
+ */
+static int run_jobs(int argc, const char **argv, const char *prefix)
+{
+	struct job_list jobs;
+	int max_jobs = 1;
+	struct strbuf **lines, **p;
+	struct strbuf input = STRBUF_INIT;
+	struct option options[] = {
+		OPT_INTEGER('j', "jobs", &max_jobs,
+			    N_("number of commands run in parallel")),
+		OPT_END()
+	};
+	const char *const usage[] = {
+		N_("git submodule--helper run-jobs [--jobs=<n>]"),
+		NULL
+	};
+
+	argc = parse_options(argc, argv, prefix, options, usage, 0);
+	if (argc)
+		usage_with_options(usage, options);
+
+	if (strbuf_read(&input, 0, 0) < 0)
+		die_errno(_("unable to read commands"));
+	lines = strbuf_split(&input, '\n');
+	strbuf_release(&input);
+
+	memset(&jobs, 0, sizeof(jobs));
+	for (p = lines; *p; p++) {
+		strbuf_trim(*p);
+		if (!(*p)->len)
+			continue;
+		ALLOC_GROW(jobs.cmds, jobs.nr + 1, jobs.alloc);
+		strbuf_init(&jobs.cmds[jobs.nr], 0);
+		strbuf_swap(&jobs.cmds[jobs.nr++], *p);
+	}
+	strbuf_list_free(lines);
+
+	run_processes_parallel(max_jobs, get_next_job, job_start_failure,
+			       job_finished, &jobs);
+	while (jobs.nr)
+		strbuf_release(&jobs.cmds[--jobs.nr]);
+	free(jobs.cmds);
+	return jobs.result;
+}
+
+static struct cmd_struct {
+	const char *cmd;
+	int (*fn)(int, const char **, const char *);
+} commands[] = {
+	{"run-jobs", run_jobs},
+};
+
+int cmd_submodule__helper(int argc, const char **argv, const char *prefix)
+{
+	int i;
+
+	if (argc < 2)
+		die(_("submodule--helper must be called with a subcommand"));
+
+	for (i = 0; i < ARRAY_SIZE(commands); i++)
+		if (!strcmp(argv[1], commands[i].cmd))
+			return commands[i].fn(argc - 1, argv + 1, prefix);
+
+	die(_("'%s' is not a valid submodule--helper subcommand"), argv[1]);
+}
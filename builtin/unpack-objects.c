@@ -9,10 +9,12 @@
 #include "tree.h"
 #include "tree-walk.h"
 #include "progress.h"
-#include "decorate.h"
+#include "object-slab.h"
 #include "fsck.h"
+#include "hashmap.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
+static unsigned long spill_limit = 32 * 1024 * 1024;
 static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] < pack-file";
 
 /* We always read in 4kB chunks. */
@@ -27,25 +29,104 @@ static git_SHA_CTX ctx;
  * store.
  */
 struct obj_buffer {
-	char *buffer;
+	char *buffer;		/* NULL once spilled */
 	unsigned long size;
+	off_t spill_pos;
 };
 
-static struct decoration obj_decorate;
+define_object_slab(obj_buffers, struct obj_buffer *);
+static struct obj_buffers obj_buffers = OBJECT_SLAB_INIT(1, obj_buffers);
 
 static struct obj_buffer *lookup_object_buffer(struct object *base)
 {
-	return lookup_decoration(&obj_decorate, base);
+	struct obj_buffer **obj = obj_buffers_peek(&obj_buffers, base);
+	return obj ? *obj : NULL;
 }
 
-static void add_object_buffer(struct object *object, char *buffer, unsigned long size)
+static struct obj_buffer *add_object_buffer(struct object *object,
+					    char *buffer, unsigned long size)
 {
+	struct obj_buffer **slot = obj_buffers_at(&obj_buffers, object);
 	struct obj_buffer *obj;
+
+	if (*slot)
+		die("object %s tried to add buffer twice!", sha1_to_hex(object->sha1));
 	obj = xcalloc(1, sizeof(struct obj_buffer));
 	obj->buffer = buffer;
 	obj->size = size;
-	if (add_decoration(&obj_decorate, object, obj))
-		die("object %s tried to add buffer twice!", sha1_to_hex(object->sha1));
+	*slot = obj;
+	return obj;
+}
+
+/*
+ * Deltas whose base has not been seen yet, and under --strict the
+ * objects waiting to be checked, are held in core up to spill_limit
+ * bytes in total (unpack.spillLimit).  Beyond that, their data is
+ * appended to a temporary file in the object directory and read back
+ * when it is needed, so that the memory we use does not grow with the
+ * size of the pack.
+ */
+static unsigned long held_bytes;
+static int spill_fd = -1;
+static char spill_name[PATH_MAX];
+static off_t spill_size;
+
+static void remove_spill_file(void)
+{
+	if (spill_fd < 0)
+		return;
+	close(spill_fd);
+	unlink_or_warn(spill_name);
+	spill_fd = -1;
+}
+
+static int hold_in_core(unsigned long size)
+{
+	if (spill_limit && held_bytes + size > spill_limit)
+		return 0;
+	held_bytes += size;
+	return 1;
+}
+
+static off_t spill(const void *buf, unsigned long size)
+{
+	off_t pos = spill_size;
+
+	if (spill_fd < 0) {
+		spill_fd = odb_mkstemp(spill_name, sizeof(spill_name),
+				       "pack/tmp_unpack_XXXXXX");
+		atexit(remove_spill_file);
+	}
+	write_or_die(spill_fd, buf, size);
+	spill_size += size;
+	return pos;
+}
+
+static void *unspill(off_t pos, unsigned long size)
+{
+	void *buf = xmallocz(size);
+
+	if (pread_in_full(spill_fd, buf, size, pos) != size)
+		die_errno("unable to read back from %s", spill_name);
+	return buf;
+}
+
+/*
+ * Put the buffer of a parsed object aside in the spill file, and drop
+ * the copy the object itself may have kept ("eaten").
+ */
+static void spill_object_buffer(struct object *object, char *buffer,
+				unsigned long size, int eaten)
+{
+	struct obj_buffer *obj = add_object_buffer(object, NULL, size);
+
+	obj->spill_pos = spill(buffer, size);
+	if (!eaten)
+		free(buffer);
+	else if (object->type == OBJ_TREE)
+		free_tree_buffer((struct tree *)object);
+	else if (object->type == OBJ_COMMIT)
+		free_commit_buffer((struct commit *)object);
 }
 
 /*
@@ -122,36 +203,26 @@ static void *get_data(unsigned long size)
 	return buf;
 }
 
+/*
+ * A delta that cannot be resolved yet waits for its base: a REF_DELTA
+ * in ref_deltas under the name of the base, an OFS_DELTA on the
+ * ofs_deltas list of the base in obj_list.
+ */
 struct delta_info {
+	struct hashmap_entry ent;
 	unsigned char base_sha1[20];
 	unsigned nr;
-	off_t base_offset;
 	unsigned long size;
-	void *delta;
+	void *delta;		/* NULL once spilled */
+	off_t spill_pos;
 	struct delta_info *next;
 };
 
-static struct delta_info *delta_list;
-
-static void add_delta_to_list(unsigned nr, unsigned const char *base_sha1,
-			      off_t base_offset,
-			      void *delta, unsigned long size)
-{
-	struct delta_info *info = xmalloc(sizeof(*info));
-
-	hashcpy(info->base_sha1, base_sha1);
-	info->base_offset = base_offset;
-	info->size = size;
-	info->delta = delta;
-	info->nr = nr;
-	info->next = delta_list;
-	delta_list = info;
-}
-
 struct obj_info {
 	off_t offset;
 	unsigned char sha1[20];
 	struct object *obj;
+	struct delta_info *ofs_deltas;
 };
 
 #define FLAG_OPEN (1u<<20)
@@ -160,15 +231,60 @@ struct obj_info {
 static struct obj_info *obj_list;
 static unsigned nr_objects;
 
+static struct hashmap ref_deltas;
+static unsigned nr_pending_deltas;
+
+static int delta_base_cmp(const struct delta_info *a,
+			  const struct delta_info *b, const void *unused)
+{
+	return hashcmp(a->base_sha1, b->base_sha1);
+}
+
+static struct delta_info *new_pending_delta(unsigned nr, void *delta,
+					    unsigned long size)
+{
+	struct delta_info *info = xcalloc(1, sizeof(*info));
+
+	info->nr = nr;
+	info->size = size;
+	if (hold_in_core(size))
+		info->delta = delta;
+	else {
+		info->spill_pos = spill(delta, size);
+		free(delta);
+	}
+	nr_pending_deltas++;
+	return info;
+}
+
+static void add_ref_delta(unsigned nr, const unsigned char *base_sha1,
+			  void *delta, unsigned long size)
+{
+	struct delta_info *info = new_pending_delta(nr, delta, size);
+
+	hashcpy(info->base_sha1, base_sha1);
+	hashmap_entry_init(info, sha1hash(base_sha1));
+	hashmap_add(&ref_deltas, info);
+}
+
+static void add_ofs_delta(unsigned nr, unsigned base,
+			  void *delta, unsigned long size)
+{
+	struct delta_info *info = new_pending_delta(nr, delta, size);
+
+	info->next = obj_list[base].ofs_deltas;
+	obj_list[base].ofs_deltas = info;
+}
+
 /*
  * Called only from check_object() after it verified this object
  * is Ok.
  */
-static void write_cached_object(struct object *obj, struct obj_buffer *obj_buf)
+static void write_cached_object(struct object *obj, void *buf, unsigned long size)
 {
 	unsigned char sha1[20];
 
-	if (write_sha1_file(obj_buf->buffer, obj_buf->size, typename(obj->type), sha1) < 0)
+	if (write_sha1_file(buf, size, typename(obj->type), sha1) < 0)
 		die("failed to write object %s", sha1_to_hex(obj->sha1));
 	obj->flags |= FLAG_WRITTEN;
 }
@@ -181,6 +297,7 @@ static void write_cached_object(struct object *obj, struct obj_buffer *obj_buf)
 static int check_object(struct object *obj, int type, void *data)
 {
 	struct obj_buffer *obj_buf;
+	char *buf;
 
 	if (!obj)
 		return 1;
@@ -203,12 +320,25 @@ static int check_object(struct object *obj, int type, void *data)
 	obj_buf = lookup_object_buffer(obj);
 	if (!obj_buf)
 		die("Whoops! Cannot find object '%s'", sha1_to_hex(obj->sha1));
-	if (fsck_object(obj, obj_buf->buffer, obj_buf->size, 1,
+	buf = obj_buf->buffer;
+	if (!buf) {
+		buf = unspill(obj_buf->spill_pos, obj_buf->size);
+		/* fsck and the walk look at the tree through its buffer */
+		if (obj->type == OBJ_TREE && !obj->parsed)
+			parse_tree_buffer((struct tree *)obj, buf, obj_buf->size);
+	}
+	if (fsck_object(obj, buf, obj_buf->size, 1,
 			fsck_error_function))
 		die("Error in object");
 	if (fsck_walk(obj, check_object, NULL))
 		die("Error on reachable objects of %s", sha1_to_hex(obj->sha1));
-	write_cached_object(obj, obj_buf);
+	write_cached_object(obj, buf, obj_buf->size);
+	if (!obj_buf->buffer) {
+		if (obj->type == OBJ_TREE && ((struct tree *)obj)->buffer == buf)
+			free_tree_buffer((struct tree *)obj);
+		else
+			free(buf);
+	}
 	return 0;
 }
 
@@ -259,7 +389,10 @@ static void write_object(unsigned nr, enum object_type type,
 		obj = parse_object_buffer(obj_list[nr].sha1, type, size, buf, &eaten);
 		if (!obj)
 			die("invalid %s", typename(type));
-		add_object_buffer(obj, buf, size);
+		if (hold_in_core(size))
+			add_object_buffer(obj, buf, size);
+		else
+			spill_object_buffer(obj, buf, size, eaten);
 		obj->flags |= FLAG_OPEN;
 		obj_list[nr].obj = obj;
 	}
@@ -281,6 +414,22 @@ static void resolve_delta(unsigned nr, enum object_type type,
 	write_object(nr, type, result, result_size);
 }
 
+static void resolve_pending_delta(struct delta_info *info, enum object_type type,
+				  void *base, unsigned long base_size)
+{
+	unsigned nr = info->nr;
+	unsigned long size = info->size;
+	void *delta = info->delta;
+
+	if (delta)
+		held_bytes -= size;
+	else
+		delta = unspill(info->spill_pos, size);
+	nr_pending_deltas--;
+	free(info);
+	resolve_delta(nr, type, base, base_size, delta, size);
+}
+
 /*
  * We now know the contents of an object (which is nr-th in the pack);
  * resolve all the deltified objects that are based on it.
@@ -288,21 +437,17 @@ static void resolve_delta(unsigned nr, enum object_type type,
 static void added_object(unsigned nr, enum object_type type,
 			 void *data, unsigned long size)
 {
-	struct delta_info **p = &delta_list;
-	struct delta_info *info;
-
-	while ((info = *p) != NULL) {
-		if (!hashcmp(info->base_sha1, obj_list[nr].sha1) ||
-		    info->base_offset == obj_list[nr].offset) {
-			*p = info->next;
-			p = &delta_list;
-			resolve_delta(info->nr, type, data, size,
-				      info->delta, info->size);
-			free(info);
-			continue;
-		}
-		p = &info->next;
+	struct delta_info key, *info;
+
+	while ((info = obj_list[nr].ofs_deltas) != NULL) {
+		obj_list[nr].ofs_deltas = info->next;
+		resolve_pending_delta(info, type, data, size);
 	}
+
+	hashcpy(key.base_sha1, obj_list[nr].sha1);
+	hashmap_entry_init(&key, sha1hash(key.base_sha1));
+	while ((info = hashmap_remove(&ref_deltas, &key, NULL)) != NULL)
+		resolve_pending_delta(info, type, data, size);
 }
 
 static void unpack_non_delta_entry(enum object_type type, unsigned long size,
@@ -327,8 +472,15 @@ static int resolve_against_held(unsigned nr, const unsigned char *base,
 	obj_buffer = lookup_object_buffer(obj);
 	if (!obj_buffer)
 		return 0;
-	resolve_delta(nr, obj->type, obj_buffer->buffer,
-		      obj_buffer->size, delta_data, delta_size);
+	if (obj_buffer->buffer)
+		resolve_delta(nr, obj->type, obj_buffer->buffer,
+			      obj_buffer->size, delta_data, delta_size);
+	else {
+		void *base = unspill(obj_buffer->spill_pos, obj_buffer->size);
+		resolve_delta(nr, obj->type, base,
+			      obj_buffer->size, delta_data, delta_size);
+		free(base);
+	}
 	return 1;
 }
 
@@ -355,11 +507,11 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 		else {
 			/* cannot resolve yet --- queue it */
 			hashcpy(obj_list[nr].sha1, null_sha1);
-			add_delta_to_list(nr, base_sha1, 0, delta_data, delta_size);
+			add_ref_delta(nr, base_sha1, delta_data, delta_size);
 			return;
 		}
 	} else {
-		unsigned base_found = 0;
+		int base = -1;
 		unsigned char *pack, c;
 		off_t base_offset;
 		unsigned lo, mid, hi;
@@ -395,18 +547,20 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			} else if (base_offset > obj_list[mid].offset) {
 				lo = mid + 1;
 			} else {
-				hashcpy(base_sha1, obj_list[mid].sha1);
-				base_found = !is_null_sha1(base_sha1);
+				base = mid;
 				break;
 			}
 		}
-		if (!base_found) {
+		if (base < 0)
+			die("delta base offset does not point to an object");
+		hashcpy(base_sha1, obj_list[base].sha1);
+		if (is_null_sha1(base_sha1)) {
 			/*
 			 * The delta base object is itself a delta that
 			 * has not been resolved yet.
 			 */
 			hashcpy(obj_list[nr].sha1, null_sha1);
-			add_delta_to_list(nr, null_sha1, base_offset, delta_data, delta_size);
+			add_ofs_delta(nr, base, delta_data, delta_size);
 			return;
 		}
 	}
@@ -488,16 +642,26 @@ static void unpack_all(void)
 	if (!quiet)
 		progress = start_progress(_("Unpacking objects"), nr_objects);
 	obj_list = xcalloc(nr_objects, sizeof(*obj_list));
+	hashmap_init(&ref_deltas, (hashmap_cmp_fn)delta_base_cmp, 0);
 	for (i = 0; i < nr_objects; i++) {
 		unpack_one(i);
 		display_progress(progress, i + 1);
 	}
 	stop_progress(&progress);
 
-	if (delta_list)
+	if (nr_pending_deltas)
 		die("unresolved deltas left after unpacking");
 }
 
+static int git_unpack_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "unpack.spilllimit")) {
+		spill_limit = git_config_ulong(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 {
 	int i;
@@ -505,7 +669,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 
 	check_replace_refs = 0;
 
-	git_config(git_default_config, NULL);
+	git_config(git_unpack_config, NULL);
 
 	quiet = !isatty(2);
 
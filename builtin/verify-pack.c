@@ -2,56 +2,92 @@
 #include "cache.h"
 #include "run-command.h"
 #include "parse-options.h"
+#include "thread-utils.h"
 
 #define VERIFY_PACK_VERBOSE 01
 #define VERIFY_PACK_STAT_ONLY 02
 
-static int verify_one_pack(const char *path, unsigned int flags)
+struct verify_pack_job {
+	struct child_process index_pack;
+	const char *argv[4];
+	struct strbuf arg;
+};
+
+static void start_verify_one_pack(struct verify_pack_job *job,
+				  const char *path, unsigned int flags,
+				  int capture)
 {
-	struct child_process index_pack = CHILD_PROCESS_INIT;
-	const char *argv[] = {"index-pack", NULL, NULL, NULL };
-	struct strbuf arg = STRBUF_INIT;
 	int verbose = flags & VERIFY_PACK_VERBOSE;
 	int stat_only = flags & VERIFY_PACK_STAT_ONLY;
-	int err;
 
+	child_process_init(&job->index_pack);
+	strbuf_init(&job->arg, 0);
+	job->argv[0] = "index-pack";
 	if (stat_only)
-		argv[1] = "--verify-stat-only";
+		job->argv[1] = "--verify-stat-only";
 	else if (verbose)
-		argv[1] = "--verify-stat";
+		job->argv[1] = "--verify-stat";
 	else
-		argv[1] = "--verify";
+		job->argv[1] = "--verify";
 
 	/*
 	 * In addition to "foo.pack" we accept "foo.idx" and "foo";
 	 * normalize these forms to "foo.pack" for "index-pack --verify".
 	 */
-	strbuf_addstr(&arg, path);
-	if (strbuf_strip_suffix(&arg, ".idx") ||
-	    !ends_with(arg.buf, ".pack"))
-		strbuf_addstr(&arg, ".pack");
-	argv[2] = arg.buf;
+	strbuf_addstr(&job->arg, path);
+	if (strbuf_strip_suffix(&job->arg, ".idx") ||
+	    !ends_with(job->arg.buf, ".pack"))
+		strbuf_addstr(&job->arg, ".pack");
+	job->argv[2] = job->arg.buf;
+	job->argv[3] = NULL;
 
-	index_pack.argv = argv;
-	index_pack.git_cmd = 1;
+	job->index_pack.argv = job->argv;
+	job->index_pack.git_cmd = 1;
+	/* with several packs at once, keep the output of each together */
+	if (capture)
+		job->index_pack.out = -1;
+
+	if (start_command(&job->index_pack))
+		job->index_pack.pid = 0;
+}
 
-	err = run_command(&index_pack);
+static int finish_verify_one_pack(struct verify_pack_job *job,
+				  unsigned int flags)
+{
+	int verbose = flags & VERIFY_PACK_VERBOSE;
+	int stat_only = flags & VERIFY_PACK_STAT_ONLY;
+	int err;
+
+	if (!job->index_pack.pid)
+		err = -1;
+	else {
+		if (job->index_pack.out > 0) {
+			struct strbuf out = STRBUF_INIT;
+
+			strbuf_read(&out, job->index_pack.out, 0);
+			close(job->index_pack.out);
+			fwrite(out.buf, 1, out.len, stdout);
+			strbuf_release(&out);
+		}
+		err = finish_command(&job->index_pack);
+	}
 
 	if (verbose || stat_only) {
 		if (err)
-			printf("%s: bad\n", arg.buf);
+			printf("%s: bad\n", job->arg.buf);
 		else {
 			if (!stat_only)
-				printf("%s: ok\n", arg.buf);
+				printf("%s: ok\n", job->arg.buf);
 		}
 	}
-	strbuf_release(&arg);
+	fflush(stdout);
+	strbuf_release(&job->arg);
 
 	return err;
 }
 
 static const char * const verify_pack_usage[] = {
-	N_("git verify-pack [-v | --verbose] [-s | --stat-only] <pack>..."),
+	N_("git verify-pack [-v | --verbose] [-s | --stat-only] [-j <n>] <pack>..."),
 	NULL
 };
 
@@ -59,12 +95,16 @@ int cmd_verify_pack(int argc, const char **argv, const char *prefix)
 {
 	int err = 0;
 	unsigned int flags = 0;
-	int i;
+	int jobs = 1;
+	struct verify_pack_job *running;
+	int started = 0, finished = 0;
 	const struct option verify_pack_options[] = {
 		OPT_BIT('v', "verbose", &flags, N_("verbose"),
 			VERIFY_PACK_VERBOSE),
 		OPT_BIT('s', "stat-only", &flags, N_("show statistics only"),
 			VERIFY_PACK_STAT_ONLY),
+		OPT_INTEGER('j', "jobs", &jobs,
+			    N_("verify up to <n> packs at the same time")),
 		OPT_END()
 	};
 
@@ -73,10 +113,27 @@ int cmd_verify_pack(int argc, const char **argv, const char *prefix)
 			     verify_pack_usage, 0);
 	if (argc < 1)
 		usage_with_options(verify_pack_usage, verify_pack_options);
-	for (i = 0; i < argc; i++) {
-		if (verify_one_pack(argv[i], flags))
+	if (jobs <= 0)
+		jobs = online_cpus();
+	if (jobs > argc)
+		jobs = argc;
+
+	/*
+	 * Keep up to "jobs" packs in flight and report on them in the
+	 * order they were given.
+	 */
+	running = xcalloc(jobs, sizeof(*running));
+	while (finished < argc) {
+		while (started < argc && started - finished < jobs) {
+			start_verify_one_pack(&running[started % jobs],
+					      argv[started], flags, jobs > 1);
+			started++;
+		}
+		if (finish_verify_one_pack(&running[finished % jobs], flags))
 			err = 1;
+		finished++;
 	}
+	free(running);
 
 	return err;
 }
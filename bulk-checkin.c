@@ -6,6 +6,8 @@
 #include "csum-file.h"
 #include "pack.h"
 #include "strbuf.h"
+#include "thread-utils.h"
+#include "hashmap.h"
 
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 
@@ -20,13 +22,45 @@ static struct bulk_checkin_state {
 	struct pack_idx_entry **written;
 	uint32_t alloc_written;
 	uint32_t nr_written;
+	/* the objects in "written", to look them up quickly */
+	struct hashmap written_map;
 } state;
 
+struct written_entry {
+	struct hashmap_entry ent;
+	const unsigned char *sha1;
+};
+
+static int written_entry_cmp(const struct written_entry *a,
+			     const struct written_entry *b,
+			     const unsigned char *sha1)
+{
+	return hashcmp(a->sha1, sha1 ? sha1 : b->sha1);
+}
+
+static void add_written(struct bulk_checkin_state *state,
+			struct pack_idx_entry *idx)
+{
+	struct written_entry *e = xmalloc(sizeof(*e));
+
+	if (!state->written_map.tablesize)
+		hashmap_init(&state->written_map,
+			     (hashmap_cmp_fn)written_entry_cmp, 0);
+	hashmap_entry_init(e, sha1hash(idx->sha1));
+	e->sha1 = idx->sha1;
+	hashmap_add(&state->written_map, e);
+
+	ALLOC_GROW(state->written,
+		   state->nr_written + 1,
+		   state->alloc_written);
+	state->written[state->nr_written++] = idx;
+}
+
 static void finish_bulk_checkin(struct bulk_checkin_state *state)
 {
 	struct object_id oid;
 	struct strbuf packname = STRBUF_INIT;
-	int i;
+	int i, plugged;
 
 	if (!state->f)
 		return;
@@ -54,28 +88,31 @@ static void finish_bulk_checkin(struct bulk_checkin_state *state)
 
 clear_exit:
 	free(state->written);
+	if (state->written_map.tablesize)
+		hashmap_free(&state->written_map, 1);
+	plugged = state->plugged;
 	memset(state, 0, sizeof(*state));
+	/* a full pack being split does not end the bulk checkin */
+	state->plugged = plugged;
 
 	strbuf_release(&packname);
 	/* Make objects we just wrote available to ourselves */
 	reprepare_packed_git();
 }
 
-static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+static int already_written(struct bulk_checkin_state *state,
+			   const unsigned char *sha1)
 {
-	int i;
+	struct hashmap_entry key;
 
 	/* The object may already exist in the repository */
 	if (has_sha1_file(sha1))
 		return 1;
 
-	/* Might want to keep the list sorted */
-	for (i = 0; i < state->nr_written; i++)
-		if (!hashcmp(state->written[i]->sha1, sha1))
-			return 1;
-
-	/* This is a new object we need to keep */
-	return 0;
+	if (!state->written_map.tablesize)
+		return 0;
+	hashmap_entry_init(&key, sha1hash(sha1));
+	return !!hashmap_get(&state->written_map, &key, sha1);
 }
 
 /*
@@ -167,6 +204,242 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 	return 0;
 }
 
+static int write_to_pack(struct bulk_checkin_state *state,
+			 const void *buf, size_t len)
+{
+	/* would we bust the size limit? */
+	if (state->nr_written &&
+	    pack_size_limit_cfg &&
+	    pack_size_limit_cfg < state->offset + len)
+		return -1;
+
+	sha1write(state->f, buf, len);
+	state->offset += len;
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+/*
+ * A big file is cut into chunks, which threads compress into raw
+ * deflate streams at the same time.  All chunks but the last end with
+ * a sync flush, so that the streams join into one, which we wrap in a
+ * zlib header and trailer.  Each chunk is compressed with the end of
+ * the chunk before it as its dictionary, so that hardly anything is
+ * lost at the seams.  Meanwhile, we read and hash the chunks ahead,
+ * and write the compressed ones out in order.
+ */
+#define DEFLATE_CHUNK_SIZE (1024 * 1024)
+#define DEFLATE_DICT_SIZE (32 * 1024)
+
+struct deflate_chunk {
+	unsigned char *buf;	/* the dictionary, then the data */
+	size_t dict_len, len;
+	unsigned char *out;
+	size_t out_len, out_alloc;
+	uLong adler;
+	int last;
+	int done;
+};
+
+struct deflate_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct deflate_chunk *chunk;
+	int nr_slots;
+	/* chunk n is in slot n % nr_slots */
+	unsigned long queued, taken;
+	int stop;
+};
+
+static void deflate_chunk(struct deflate_chunk *c)
+{
+	git_zstream s;
+	size_t bound;
+	int status;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init_raw(&s, pack_compression_level);
+	if (c->dict_len &&
+	    deflateSetDictionary(&s.z, c->buf, c->dict_len) != Z_OK)
+		die("unable to set the deflate dictionary");
+
+	/* the sync flush adds an empty stored block */
+	bound = git_deflate_bound(&s, c->len) + 16;
+	ALLOC_GROW(c->out, bound, c->out_alloc);
+	s.next_in = c->buf + c->dict_len;
+	s.avail_in = c->len;
+	s.next_out = c->out;
+	s.avail_out = c->out_alloc;
+	status = git_deflate(&s, c->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (status != (c->last ? Z_STREAM_END : Z_OK) || s.avail_in)
+		die("unexpected deflate failure: %d", status);
+	c->out_len = s.next_out - c->out;
+	/* deflateEnd() minds that a sync-flushed stream is unfinished */
+	git_deflate_abort(&s);
+
+	c->adler = adler32(adler32(0, NULL, 0), c->buf + c->dict_len, c->len);
+}
+
+static void *deflate_worker(void *data)
+{
+	struct deflate_pool *pool = data;
+
+	for (;;) {
+		struct deflate_chunk *c;
+
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->taken == pool->queued && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->taken == pool->queued) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		c = &pool->chunk[pool->taken++ % pool->nr_slots];
+		pthread_mutex_unlock(&pool->mutex);
+
+		deflate_chunk(c);
+
+		pthread_mutex_lock(&pool->mutex);
+		c->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+/* The second byte of the zlib header deflate() would write */
+static unsigned char zlib_header_flags(int level)
+{
+	int flevel, header;
+
+	if (level == Z_DEFAULT_COMPRESSION)
+		level = 6;
+	flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+	header = (0x78 << 8) | (flevel << 6);
+	header += 31 - (header % 31);
+	return header & 0xff;
+}
+
+/* Like stream_to_pack(), with "nr_threads" threads compressing */
+static int stream_to_pack_threaded(struct bulk_checkin_state *state,
+				   git_SHA_CTX *ctx, off_t *already_hashed_to,
+				   int fd, size_t size, enum object_type type,
+				   const char *path, int nr_threads)
+{
+	struct deflate_pool pool;
+	pthread_t *threads;
+	unsigned long nr_chunks = (size + DEFLATE_CHUNK_SIZE - 1) / DEFLATE_CHUNK_SIZE;
+	unsigned long written = 0;
+	unsigned char hdr[32];
+	unsigned hdrlen;
+	uLong adler = adler32(0, NULL, 0);
+	off_t offset = 0;
+	int i, ret = 0;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pool.nr_slots = 2 * nr_threads;
+	pool.chunk = xcalloc(pool.nr_slots, sizeof(*pool.chunk));
+	for (i = 0; i < pool.nr_slots; i++)
+		pool.chunk[i].buf = xmalloc(DEFLATE_DICT_SIZE + DEFLATE_CHUNK_SIZE);
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, deflate_worker, &pool);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	hdrlen = encode_in_pack_object_header(type, size, hdr);
+	hdr[hdrlen++] = 0x78;
+	hdr[hdrlen++] = zlib_header_flags(pack_compression_level);
+	if (write_to_pack(state, hdr, hdrlen))
+		ret = -1;
+
+	while (!ret && written < nr_chunks) {
+		struct deflate_chunk *c;
+
+		/* keep the threads busy */
+		while (pool.queued < nr_chunks &&
+		       pool.queued - written < pool.nr_slots) {
+			c = &pool.chunk[pool.queued % pool.nr_slots];
+			c->dict_len = 0;
+			if (pool.queued) {
+				struct deflate_chunk *prev =
+					&pool.chunk[(pool.queued - 1) % pool.nr_slots];
+				c->dict_len = prev->len < DEFLATE_DICT_SIZE ?
+					prev->len : DEFLATE_DICT_SIZE;
+				memcpy(c->buf, prev->buf + prev->dict_len +
+				       prev->len - c->dict_len, c->dict_len);
+			}
+			c->len = size - offset < DEFLATE_CHUNK_SIZE ?
+				size - offset : DEFLATE_CHUNK_SIZE;
+			if (read_in_full(fd, c->buf + c->dict_len, c->len) != c->len)
+				die("failed to read %d bytes from '%s'",
+				    (int)c->len, path);
+			offset += c->len;
+			if (*already_hashed_to < offset) {
+				size_t hsize = offset - *already_hashed_to;
+				if (c->len < hsize)
+					hsize = c->len;
+				git_SHA1_Update(ctx, c->buf + c->dict_len + c->len - hsize,
+						hsize);
+				*already_hashed_to = offset;
+			}
+			c->last = pool.queued + 1 == nr_chunks;
+			c->done = 0;
+
+			pthread_mutex_lock(&pool.mutex);
+			pool.queued++;
+			pthread_cond_broadcast(&pool.cond);
+			pthread_mutex_unlock(&pool.mutex);
+		}
+
+		c = &pool.chunk[written % pool.nr_slots];
+		pthread_mutex_lock(&pool.mutex);
+		while (!c->done)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		adler = adler32_combine(adler, c->adler, c->len);
+		if (write_to_pack(state, c->out, c->out_len))
+			ret = -1;
+		written++;
+	}
+	if (!ret) {
+		put_be32(hdr, adler);
+		if (write_to_pack(state, hdr, 4))
+			ret = -1;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	for (i = 0; i < pool.nr_slots; i++) {
+		free(pool.chunk[i].buf);
+		free(pool.chunk[i].out);
+	}
+	free(pool.chunk);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	return ret;
+}
+
+static int deflate_threads(size_t size, unsigned flags)
+{
+	if (!(flags & HASH_WRITE_OBJECT) || size <= DEFLATE_CHUNK_SIZE)
+		return 1;
+	return big_file_threads ? big_file_threads : online_cpus();
+}
+#else
+#define stream_to_pack_threaded(state, ctx, hashed_to, fd, size, type, path, nr) \
+	stream_to_pack(state, ctx, hashed_to, fd, size, type, path, HASH_WRITE_OBJECT)
+#define deflate_threads(size, flags) 1
+#endif
+
 /* Lazily create backing packfile for the state */
 static void prepare_to_stream(struct bulk_checkin_state *state,
 			      unsigned flags)
@@ -195,6 +468,8 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 	unsigned header_len;
 	struct sha1file_checkpoint checkpoint;
 	struct pack_idx_entry *idx = NULL;
+	int nr_threads = deflate_threads(size, flags);
+	int status;
 
 	seekback = lseek(fd, 0, SEEK_CUR);
 	if (seekback == (off_t) -1)
@@ -218,8 +493,15 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 			idx->offset = state->offset;
 			crc32_begin(state->f);
 		}
-		if (!stream_to_pack(state, &ctx, &already_hashed_to,
-				    fd, size, type, path, flags))
+		if (nr_threads > 1)
+			status = stream_to_pack_threaded(state, &ctx,
+							 &already_hashed_to,
+							 fd, size, type, path,
+							 nr_threads);
+		else
+			status = stream_to_pack(state, &ctx, &already_hashed_to,
+						fd, size, type, path, flags);
+		if (!status)
 			break;
 		/*
 		 * Writing this object to the current pack will make
@@ -245,14 +527,85 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 		free(idx);
 	} else {
 		hashcpy(idx->sha1, result_sha1);
-		ALLOC_GROW(state->written,
-			   state->nr_written + 1,
-			   state->alloc_written);
-		state->written[state->nr_written++] = idx;
+		add_written(state, idx);
 	}
 	return 0;
 }
 
+void prepare_bulk_checkin_object(struct bulk_checkin_object *obj,
+				 enum object_type type,
+				 const void *buf, size_t len)
+{
+	git_zstream s;
+	git_SHA_CTX ctx;
+	char hdr[32];
+	int hdrlen;
+
+	hdrlen = sprintf(hdr, "%s %" PRIuMAX, typename(type),
+			 (uintmax_t)len) + 1;
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, hdr, hdrlen);
+	git_SHA1_Update(&ctx, buf, len);
+	git_SHA1_Final(obj->sha1, &ctx);
+	obj->type = type;
+	obj->size = len;
+
+	memset(&s, 0, sizeof(s));
+	git_deflate_init(&s, pack_compression_level);
+	ALLOC_GROW(obj->deflated, git_deflate_bound(&s, len), obj->alloc);
+	s.next_in = (void *)buf;
+	s.avail_in = len;
+	s.next_out = obj->deflated;
+	s.avail_out = obj->alloc;
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	if (s.avail_in)
+		die("unexpected deflate failure");
+	obj->deflated_len = s.total_out;
+	git_deflate_end(&s);
+}
+
+int write_bulk_checkin_object(struct bulk_checkin_object *obj)
+{
+	struct bulk_checkin_state *st = &state;
+	struct sha1file_checkpoint checkpoint;
+	struct pack_idx_entry *idx;
+	unsigned char hdr[32];
+	unsigned hdrlen;
+
+	if (already_written(st, obj->sha1))
+		return 0;
+
+	idx = xcalloc(1, sizeof(*idx));
+	hdrlen = encode_in_pack_object_header(obj->type, obj->size, hdr);
+	for (;;) {
+		prepare_to_stream(st, HASH_WRITE_OBJECT);
+		sha1file_checkpoint(st->f, &checkpoint);
+		idx->offset = st->offset;
+		crc32_begin(st->f);
+		if (!write_to_pack(st, hdr, hdrlen) &&
+		    !write_to_pack(st, obj->deflated, obj->deflated_len))
+			break;
+		/* too big for the current pack; start a new one */
+		sha1file_truncate(st->f, &checkpoint);
+		st->offset = checkpoint.offset;
+		finish_bulk_checkin(st);
+	}
+	idx->crc32 = crc32_end(st->f);
+	hashcpy(idx->sha1, obj->sha1);
+	add_written(st, idx);
+
+	if (!st->plugged)
+		finish_bulk_checkin(st);
+	return 0;
+}
+
+void clear_bulk_checkin_object(struct bulk_checkin_object *obj)
+{
+	free(obj->deflated);
+	memset(obj, 0, sizeof(*obj));
+}
+
 int index_bulk_checkin(unsigned char *sha1,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
@@ -267,6 +620,7 @@ int index_bulk_checkin(unsigned char *sha1,
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
+	begin_loose_object_batch();
 }
 
 void unplug_bulk_checkin(void)
@@ -274,4 +628,5 @@ void unplug_bulk_checkin(void)
 	state.plugged = 0;
 	if (state.f)
 		finish_bulk_checkin(&state);
+	end_loose_object_batch();
 }
@@ -8,6 +8,26 @@ extern int index_bulk_checkin(unsigned char sha1[],
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/*
+ * An object hashed and deflated ahead of time, so that the work can be
+ * spread over threads while the objects are written out in order.
+ * prepare_bulk_checkin_object() may be called from several threads at
+ * once; write_bulk_checkin_object() only from one.
+ */
+struct bulk_checkin_object {
+	unsigned char sha1[20];
+	enum object_type type;
+	size_t size;
+	unsigned char *deflated;
+	size_t deflated_len, alloc;
+};
+
+extern void prepare_bulk_checkin_object(struct bulk_checkin_object *obj,
+					enum object_type type,
+					const void *buf, size_t len);
+extern int write_bulk_checkin_object(struct bulk_checkin_object *obj);
+extern void clear_bulk_checkin_object(struct bulk_checkin_object *obj);
+
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
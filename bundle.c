@@ -9,6 +9,8 @@
 #include "run-command.h"
 #include "refs.h"
 #include "argv-array.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 static const char bundle_signature[] = "# v2 git bundle\n";
 
@@ -270,6 +272,131 @@ static int write_pack_data(int bundle_fd, struct lock_file *lock, struct rev_inf
 	return 0;
 }
 
+/*
+ * The options that only name tips, and so cannot make "rev-list" stop
+ * short of the boundary it would find from the tips alone.
+ */
+static int only_names_tips(int argc, const char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (*arg != '-')
+			continue;
+		if (!strcmp(arg, "--all") || !strcmp(arg, "--not") ||
+		    !strcmp(arg, "--branches") || !strcmp(arg, "--tags") ||
+		    !strcmp(arg, "--remotes") ||
+		    starts_with(arg, "--branches=") ||
+		    starts_with(arg, "--tags=") ||
+		    starts_with(arg, "--remotes=") ||
+		    starts_with(arg, "--glob=") ||
+		    starts_with(arg, "--exclude="))
+			continue;
+		return 0;
+	}
+	return 1;
+}
+
+static void write_prerequisite(int bundle_fd, struct rev_info *revs,
+			       struct commit *commit)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	parse_commit_or_die(commit);
+	strbuf_addf(&buf, "-%s ", sha1_to_hex(commit->object.sha1));
+	pp_commit_easy(CMIT_FMT_ONELINE, commit, &buf);
+	strbuf_addch(&buf, '\n');
+	write_or_die(bundle_fd, buf.buf, buf.len);
+	strbuf_release(&buf);
+
+	commit->object.flags |= UNINTERESTING;
+	add_pending_object(revs, &commit->object,
+			   sha1_to_hex(commit->object.sha1));
+}
+
+/*
+ * Find the prerequisites without running "rev-list --boundary", which
+ * has to walk the history behind the negative tips until it knows what
+ * is reachable from them.  The bitmap index answers that instead, so
+ * only the commits that go into the bundle are walked; without negative
+ * tips there is no boundary to find at all.  Returns -1, having written
+ * nothing, if the arguments or the repository do not allow this.
+ */
+static int compute_prerequisites_from_bitmap(int bundle_fd,
+					     struct rev_info *revs,
+					     int argc, const char **argv)
+{
+	struct rev_info tips;
+	struct commit_list *wants = NULL, *haves = NULL, *work = NULL;
+	struct bitmap *reachable;
+	int i;
+
+	if (!only_names_tips(argc, argv))
+		return -1;
+	init_revisions(&tips, NULL);
+	if (setup_revisions(argc, argv, &tips, NULL) > 1)
+		return -1;
+
+	for (i = 0; i < tips.pending.nr; i++) {
+		struct object_array_entry *e = tips.pending.objects + i;
+		struct commit *commit =
+			lookup_commit_reference_gently(e->item->sha1, 1);
+
+		if (!commit)
+			continue;
+		if (e->item->flags & UNINTERESTING) {
+			/* or the bitmap walk would not look behind it */
+			commit->object.flags &= ~UNINTERESTING;
+			commit_list_insert(commit, &haves);
+		} else
+			commit_list_insert(commit, &wants);
+	}
+	object_array_clear(&tips.pending);
+
+	if (!haves) {
+		while (wants)
+			pop_commit(&wants)->object.flags |= SHOWN;
+		return 0;
+	}
+
+	reachable = bitmap_for_commits(haves);
+	free_commit_list(haves);
+	if (!reachable) {
+		free_commit_list(wants);
+		return -1;
+	}
+
+	while (wants) {
+		struct commit *commit = pop_commit(&wants);
+
+		if (!bitmap_has_sha1(reachable, commit->object.sha1))
+			commit_list_insert(commit, &work);
+	}
+	while (work) {
+		struct commit *commit = pop_commit(&work);
+		struct commit_list *p;
+
+		if (commit->object.flags & SHOWN)
+			continue;
+		commit->object.flags |= SHOWN;
+		parse_commit_or_die(commit);
+		for (p = commit->parents; p; p = p->next) {
+			struct commit *parent = p->item;
+
+			if (parent->object.flags & (SHOWN | UNINTERESTING))
+				continue;
+			if (bitmap_has_sha1(reachable, parent->object.sha1))
+				write_prerequisite(bundle_fd, revs, parent);
+			else
+				commit_list_insert(parent, &work);
+		}
+	}
+	bitmap_free(reachable);
+	return 0;
+}
+
 static int compute_and_write_prerequisites(int bundle_fd,
 					   struct rev_info *revs,
 					   int argc, const char **argv)
@@ -279,6 +406,9 @@ static int compute_and_write_prerequisites(int bundle_fd,
 	FILE *rls_fout;
 	int i;
 
+	if (!compute_prerequisites_from_bitmap(bundle_fd, revs, argc, argv))
+		return 0;
+
 	argv_array_pushl(&rls.args,
 			 "rev-list", "--boundary", "--pretty=oneline",
 			 NULL);
@@ -3,11 +3,60 @@
 #include "tree.h"
 #include "tree-walk.h"
 #include "cache-tree.h"
+#include "thread-utils.h"
 
 #ifndef DEBUG
 #define DEBUG 0
 #endif
 
+/*
+ * Invalid subtrees are independent of each other until their parent is
+ * hashed, so cache_tree_update() can hand them to several threads.
+ * Those only hash the trees they build, and queue them in a tree_batch
+ * to be written once they are all done.
+ */
+struct pending_tree {
+	struct cache_tree *it;
+	struct strbuf buf;
+};
+
+struct tree_batch {
+	struct pending_tree *trees;
+	int nr, alloc;
+};
+
+static void add_pending_tree(struct tree_batch *batch, struct cache_tree *it,
+			     struct strbuf *buf)
+{
+	ALLOC_GROW(batch->trees, batch->nr + 1, batch->alloc);
+	batch->trees[batch->nr].it = it;
+	batch->trees[batch->nr].buf = *buf;
+	strbuf_init(buf, 0);
+	batch->nr++;
+}
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t cache_tree_mutex;
+static int cache_tree_use_locks;
+#endif
+
+/* The object store is not thread-safe. */
+static int locked_has_sha1_file(const unsigned char *sha1)
+{
+#ifndef NO_PTHREADS
+	int ret;
+
+	if (!cache_tree_use_locks)
+		return has_sha1_file(sha1);
+	pthread_mutex_lock(&cache_tree_mutex);
+	ret = has_sha1_file(sha1);
+	pthread_mutex_unlock(&cache_tree_mutex);
+	return ret;
+#else
+	return has_sha1_file(sha1);
+#endif
+}
+
 struct cache_tree *cache_tree(void)
 {
 	struct cache_tree *it = xcalloc(1, sizeof(struct cache_tree));
@@ -42,7 +91,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -69,7 +118,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -123,7 +172,7 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	it->entry_count = -1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -242,7 +291,8 @@ static int update_one(struct cache_tree *it,
 		      const char *base,
 		      int baselen,
 		      int *skip_count,
-		      int flags)
+		      int flags,
+		      struct tree_batch *batch)
 {
 	struct strbuf buffer;
 	int missing_ok = flags & WRITE_TREE_MISSING_OK;
@@ -255,9 +305,21 @@ static int update_one(struct cache_tree *it,
 
 	*skip_count = 0;
 
-	if (0 <= it->entry_count && has_sha1_file(it->sha1))
+	if (0 <= it->entry_count && locked_has_sha1_file(it->sha1))
 		return it->entry_count;
 
+	/*
+	 * A sparse directory entry for this very directory stands for
+	 * the whole subtree, which it already names.
+	 */
+	if (entries && S_ISSPARSEDIR(cache[0]->ce_mode) &&
+	    ce_namelen(cache[0]) == baselen &&
+	    !memcmp(cache[0]->name, base, baselen)) {
+		it->entry_count = 1;
+		hashcpy(it->sha1, cache[0]->sha1);
+		return 1;
+	}
+
 	/*
 	 * We first scan for subtrees and update them; we start by
 	 * marking existing subtrees -- the ones that are unmarked
@@ -300,7 +362,7 @@ static int update_one(struct cache_tree *it,
 				    path,
 				    baselen + sublen + 1,
 				    &subskip,
-				    flags);
+				    flags, batch);
 		if (subcnt < 0)
 			return subcnt;
 		if (!subcnt)
@@ -354,9 +416,13 @@ static int update_one(struct cache_tree *it,
 			entlen = pathlen - baselen;
 			i++;
 		}
-		if (mode != S_IFGITLINK && !missing_ok && !has_sha1_file(sha1)) {
+		/* a valid subtree of a batch may not be written yet */
+		if (mode != S_IFGITLINK && !missing_ok &&
+		    !(batch && slash && !expected_missing) &&
+		    !locked_has_sha1_file(sha1)) {
 			strbuf_release(&buffer);
-			if (expected_missing)
+			/* leave it to the serial pass to complain */
+			if (expected_missing || batch)
 				return -1;
 			return error("invalid object %06o %s for '%.*s'",
 				mode, sha1_to_hex(sha1), entlen+baselen, path);
@@ -401,7 +467,10 @@ static int update_one(struct cache_tree *it,
 			to_invalidate = 1;
 	} else if (dryrun)
 		hash_sha1_file(buffer.buf, buffer.len, tree_type, it->sha1);
-	else if (write_sha1_file(buffer.buf, buffer.len, tree_type, it->sha1)) {
+	else if (batch) {
+		hash_sha1_file(buffer.buf, buffer.len, tree_type, it->sha1);
+		add_pending_tree(batch, it, &buffer);
+	} else if (write_sha1_file(buffer.buf, buffer.len, tree_type, it->sha1)) {
 		strbuf_release(&buffer);
 		return -1;
 	}
@@ -416,6 +485,189 @@ static int update_one(struct cache_tree *it,
 	return i;
 }
 
+#ifndef NO_PTHREADS
+/* Invalid entries it takes for an extra thread to be worth it. */
+#define THREAD_COST (2000)
+
+struct tree_job {
+	struct cache_tree *it;
+	struct cache_entry **cache;
+	int entries;
+	const char *base;
+	int baselen;
+	struct tree_batch batch;
+};
+
+struct tree_jobs {
+	struct tree_job *job;
+	int nr, alloc, next, total;
+	int flags;
+	pthread_mutex_t mutex;
+};
+
+/*
+ * Queue the invalid subtrees of "it" that cover at most "limit"
+ * entries, and look inside the bigger ones; their own level is left
+ * to the serial pass.
+ */
+static void collect_tree_jobs(struct tree_jobs *jobs, struct cache_tree *it,
+			      struct cache_entry **cache, int entries,
+			      const char *base, int baselen, int limit)
+{
+	int i = 0;
+
+	while (i < entries) {
+		const struct cache_entry *ce = cache[i];
+		struct cache_tree_sub *sub;
+		const char *path = ce->name, *slash;
+		int pathlen = ce_namelen(ce), sublen, j;
+
+		if (pathlen <= baselen || memcmp(base, path, baselen))
+			break;
+		slash = strchr(path + baselen, '/');
+		if (!slash) {
+			i++;
+			continue;
+		}
+		sublen = slash - (path + baselen);
+		for (j = i + 1; j < entries; j++)
+			if (strncmp(cache[j]->name, path, baselen + sublen + 1))
+				break;
+
+		sub = find_subtree(it, path + baselen, sublen, 1);
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+		if (sub->cache_tree->entry_count >= 0)
+			;  /* most likely nothing to do */
+		else if (j - i > limit)
+			collect_tree_jobs(jobs, sub->cache_tree, cache + i, j - i,
+					  path, baselen + sublen + 1, limit);
+		else {
+			struct tree_job *job;
+
+			ALLOC_GROW(jobs->job, jobs->nr + 1, jobs->alloc);
+			job = &jobs->job[jobs->nr++];
+			memset(job, 0, sizeof(*job));
+			job->it = sub->cache_tree;
+			job->cache = cache + i;
+			job->entries = j - i;
+			job->base = path;
+			job->baselen = baselen + sublen + 1;
+			jobs->total += j - i;
+		}
+		i = j;
+	}
+}
+
+static void *update_subtrees_thread(void *data)
+{
+	struct tree_jobs *jobs = data;
+
+	for (;;) {
+		struct tree_job *job;
+		int skip;
+
+		pthread_mutex_lock(&jobs->mutex);
+		job = jobs->next < jobs->nr ? &jobs->job[jobs->next++] : NULL;
+		pthread_mutex_unlock(&jobs->mutex);
+		if (!job)
+			break;
+		update_one(job->it, job->cache, job->entries,
+			   job->base, job->baselen, &skip,
+			   jobs->flags, &job->batch);
+	}
+	return NULL;
+}
+
+static int cache_tree_threads(void)
+{
+	int is_bool, val;
+
+	if (git_config_get_bool_or_int("core.cachetreethreads", &is_bool, &val))
+		return 0;
+	if (is_bool)
+		return val ? 0 : 1;
+	if (val < 0)
+		die(_("core.cacheTreeThreads must be non-negative"));
+	return val;
+}
+
+/* Write out what a job hashed; on failure, have it all redone. */
+static void write_tree_batch(struct tree_batch *batch)
+{
+	int i, failed = 0;
+
+	for (i = 0; i < batch->nr; i++) {
+		struct pending_tree *t = &batch->trees[i];
+		unsigned char sha1[20];
+
+		if (!failed &&
+		    (write_sha1_file(t->buf.buf, t->buf.len, tree_type, sha1) ||
+		     hashcmp(sha1, t->it->sha1)))
+			failed = 1;
+		strbuf_release(&t->buf);
+	}
+	if (failed)
+		for (i = 0; i < batch->nr; i++)
+			batch->trees[i].it->entry_count = -1;
+	free(batch->trees);
+}
+
+/*
+ * Bring as many invalid subtrees of "it" as possible up to date with
+ * several threads.  Whatever is left, including any error, is for the
+ * serial update_one() that follows.
+ */
+static void update_subtrees_threaded(struct cache_tree *it,
+				     struct cache_entry **cache,
+				     int entries, int flags)
+{
+	struct tree_jobs jobs;
+	pthread_t *threads;
+	int nr_threads, i;
+
+	nr_threads = cache_tree_threads();
+	if (nr_threads == 1 || (!nr_threads && online_cpus() < 2) ||
+	    it->entry_count >= 0)
+		return;
+
+	memset(&jobs, 0, sizeof(jobs));
+	jobs.flags = flags;
+	collect_tree_jobs(&jobs, it, cache, entries, "", 0,
+			  entries / ((nr_threads ? nr_threads : online_cpus()) * 4) + 1);
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		if (nr_threads > jobs.total / THREAD_COST)
+			nr_threads = jobs.total / THREAD_COST;
+	}
+	if (nr_threads > jobs.nr)
+		nr_threads = jobs.nr;
+	if (nr_threads < 2) {
+		free(jobs.job);
+		return;
+	}
+
+	pthread_mutex_init(&jobs.mutex, NULL);
+	pthread_mutex_init(&cache_tree_mutex, NULL);
+	cache_tree_use_locks = 1;
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, update_subtrees_thread, &jobs))
+			die("unable to create cache-tree thread");
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i], NULL))
+			die("unable to join cache-tree thread");
+	cache_tree_use_locks = 0;
+	pthread_mutex_destroy(&cache_tree_mutex);
+	pthread_mutex_destroy(&jobs.mutex);
+	free(threads);
+
+	for (i = 0; i < jobs.nr; i++)
+		write_tree_batch(&jobs.job[i].batch);
+	free(jobs.job);
+}
+#endif
+
 int cache_tree_update(struct index_state *istate, int flags)
 {
 	struct cache_tree *it = istate->cache_tree;
@@ -425,7 +677,13 @@ int cache_tree_update(struct index_state *istate, int flags)
 
 	if (i)
 		return i;
-	i = update_one(it, cache, entries, "", 0, &skip, flags);
+	begin_loose_object_batch();
+#ifndef NO_PTHREADS
+	if (!(flags & (WRITE_TREE_DRY_RUN | WRITE_TREE_REPAIR)))
+		update_subtrees_threaded(it, cache, entries, flags);
+#endif
+	i = update_one(it, cache, entries, "", 0, &skip, flags, NULL);
+	end_loose_object_batch();
 	if (i < 0)
 		return i;
 	istate->cache_changed |= CACHE_TREE_CHANGED;
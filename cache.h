@@ -17,6 +17,24 @@
 #define git_SHA1_Update	SHA1_Update
 #define git_SHA1_Final	SHA1_Final
 #endif
+#ifndef git_SHA1_Multi
+typedef struct {
+	git_SHA_CTX ctx;
+	const void *data;
+	unsigned long len;
+	unsigned char *hashout;
+} git_SHA1_Job;
+
+static inline void git_SHA1_Multi(git_SHA1_Job *jobs, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		git_SHA1_Update(&jobs[i].ctx, jobs[i].data, jobs[i].len);
+		git_SHA1_Final(jobs[i].hashout, &jobs[i].ctx);
+	}
+}
+#endif
 
 #include <zlib.h>
 typedef struct git_zstream {
@@ -33,6 +51,17 @@ void git_inflate_init(git_zstream *);
 void git_inflate_init_gzip_only(git_zstream *);
 void git_inflate_end(git_zstream *);
 int git_inflate(git_zstream *, int flush);
+/*
+ * Inflate the zlib stream at "in", of which the "avail_in" bytes there
+ * may be followed by anything, into exactly "size" bytes at "out" in
+ * one go.  Returns the number of input bytes used, or -1 if it cannot
+ * do that; the caller is to fall back to git_inflate() then, which also
+ * tells a corrupt stream from one that goes beyond "avail_in".
+ */
+long git_inflate_buffer(void *out, unsigned long size,
+			const void *in, unsigned long avail_in);
+/* Total number of bytes inflated so far by this process */
+uintmax_t git_inflated_bytes(void);
 
 void git_deflate_init(git_zstream *, int level);
 void git_deflate_init_gzip(git_zstream *, int level);
@@ -77,6 +106,9 @@ struct object_id {
 #define S_IFGITLINK	0160000
 #define S_ISGITLINK(m)	(((m) & S_IFMT) == S_IFGITLINK)
 
+/* A sparse directory entry in the index; see sparse-index.h. */
+#define S_ISSPARSEDIR(m)	((m) == S_IFDIR)
+
 /*
  * Some mode bits are also used internally for computations.
  *
@@ -178,6 +210,7 @@ struct cache_entry {
 #define CE_ADDED             (1 << 19)
 
 #define CE_HASHED            (1 << 20)
+#define CE_FSMONITOR_VALID   (1 << 21)
 #define CE_WT_REMOVE         (1 << 22) /* remove in work directory */
 #define CE_CONFLICTED        (1 << 23)
 
@@ -298,9 +331,11 @@ static inline unsigned int canon_mode(unsigned int mode)
 #define CACHE_TREE_CHANGED	(1 << 5)
 #define SPLIT_INDEX_ORDERED	(1 << 6)
 #define UNTRACKED_CHANGED	(1 << 7)
+#define FSMONITOR_CHANGED	(1 << 8)
 
 struct split_index;
 struct untracked_cache;
+struct ewah_bitmap;
 
 struct index_state {
 	struct cache_entry **cache;
@@ -311,11 +346,15 @@ struct index_state {
 	struct split_index *split_index;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 sparse_index : 1;
 	struct hashmap name_hash;
 	struct hashmap dir_hash;
 	unsigned char sha1[20];
 	struct untracked_cache *untracked;
+	uint64_t fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
+	unsigned fsmonitor_has_run_once : 1;
 };
 
 extern struct index_state the_index;
@@ -323,6 +362,7 @@ extern struct index_state the_index;
 /* Name hashing */
 extern void add_name_hash(struct index_state *istate, struct cache_entry *ce);
 extern void remove_name_hash(struct index_state *istate, struct cache_entry *ce);
+extern void lazy_init_name_hash(struct index_state *istate);
 extern void free_name_hash(struct index_state *istate);
 
 
@@ -467,6 +507,7 @@ extern void verify_non_filename(const char *prefix, const char *name);
 extern int path_inside_repo(const char *prefix, const char *path);
 
 #define INIT_DB_QUIET 0x0001
+#define INIT_DB_REFTABLE 0x0002
 
 extern int set_git_dir_init(const char *git_dir, const char *real_git_dir, int);
 extern int init_db(const char *template_dir, unsigned int flags);
@@ -503,6 +544,46 @@ extern int do_read_index(struct index_state *istate, const char *path,
 extern int read_index_from(struct index_state *, const char *path);
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
+
+/*
+ * A read-only view of an index file that keeps it mmapped and only
+ * decodes the entries asked for, for commands that look at a few
+ * entries or stream through them once.  index_view_open() returns -1
+ * when the file cannot be viewed this way (split or sparse index); the
+ * caller should read_index() instead.
+ */
+struct index_view_dir;
+struct index_view {
+	void *mmap;
+	size_t mmap_size;
+	unsigned int version, nr;
+	unsigned long *offset;
+	struct cache_entry *ce;
+
+	/*
+	 * Index v4 only records how each name differs from the one
+	 * before it.  The names are decoded once and kept as the
+	 * directory they are in, interned component by component, and
+	 * their basename; full names are put together when asked for.
+	 */
+	struct index_view_dir **dir;
+	unsigned int dir_nr, dir_alloc;
+	struct hashmap dir_hash;
+	uint32_t *name_dir;
+	unsigned long *basename;
+	struct strbuf basenames;
+	struct strbuf name;
+	uint32_t name_dir_id;
+	size_t name_dir_len;
+};
+extern int index_view_open(struct index_view *view, const char *path);
+extern void index_view_release(struct index_view *view);
+/* The name is only valid until the next call */
+extern const char *index_view_name(struct index_view *view, int pos, int *namelen);
+extern int index_view_stage(const struct index_view *view, int pos);
+extern int index_view_name_pos(struct index_view *view, const char *name, int namelen);
+/* The entry is only valid until the next call */
+extern const struct cache_entry *index_view_entry(struct index_view *view, int pos);
 #define COMMIT_LOCK		(1 << 0)
 #define CLOSE_LOCK		(1 << 1)
 extern int write_locked_index(struct index_state *, struct lock_file *lock, unsigned flags);
@@ -610,7 +691,10 @@ extern int core_compression_seen;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern int delta_compose_depth;
+extern size_t tree_cache_limit;
 extern unsigned long big_file_threshold;
+extern int big_file_threads;
 extern unsigned long pack_size_limit_cfg;
 
 /*
@@ -623,9 +707,16 @@ extern unsigned long pack_size_limit_cfg;
  */
 extern int check_replace_refs;
 
+/* core.fsyncObjectFiles: 0, 1, or "batch" */
+#define FSYNC_OBJECT_FILES_BATCH 2
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_multi_pack_index;
+extern int core_commit_graph;
+extern int core_loose_object_cache;
+extern int core_alternates_cache;
 extern int core_apply_sparse_checkout;
+extern int command_requires_full_index;
 extern int precomposed_unicode;
 extern int protect_hfs;
 extern int protect_ntfs;
@@ -687,7 +778,26 @@ extern char *notes_ref_name;
 extern int grafts_replace_parents;
 
 #define GIT_REPO_VERSION 0
+#define GIT_REPO_VERSION_READ 1
 extern int repository_format_version;
+/*
+ * The remote named by "extensions.partialClone": this repository was
+ * cloned with an object filter, and objects missing locally can be
+ * fetched from that remote on demand.  NULL in a complete repository.
+ */
+extern char *repository_format_partial_clone;
+/*
+ * Whether "extensions.refStorage" is "reftable": the refs of this
+ * repository are kept in $GIT_DIR/reftable (see reftable.h) instead
+ * of in loose files and packed-refs.
+ */
+extern int repository_format_reftable;
+/*
+ * Whether to fetch missing objects from the partial clone remote when
+ * they are read; commands that want to see what is missing (fsck,
+ * rev-list --missing) turn it off.
+ */
+extern int fetch_if_missing;
 extern int check_repository_format(void);
 
 #define MTIME_CHANGED	0x0001
@@ -892,6 +1002,26 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
 	return read_sha1_file_extended(sha1, type, size, LOOKUP_REPLACE_OBJECT);
 }
 
+/*
+ * After enable_obj_read_lock(), read_sha1_file() and the
+ * sha1_object_info() family can be called from several threads at once;
+ * they serialize their access to the object store internally but
+ * inflate and apply deltas in parallel.  Callers that use other parts
+ * of the object store from threads must wrap them in obj_read_lock()
+ * and obj_read_unlock() themselves.  Calls nest.
+ */
+#ifndef NO_PTHREADS
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+#else
+#define enable_obj_read_lock()
+#define disable_obj_read_lock()
+#define obj_read_lock()
+#define obj_read_unlock()
+#endif
+
 /*
  * This internal function is only declared here for the benefit of
  * lookup_replace_object().  Please do not call it directly.
@@ -921,6 +1051,19 @@ static inline const unsigned char *lookup_replace_object_extended(const unsigned
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
+
+/*
+ * Like hash_sha1_file() for each of "nr" objects, but faster for small
+ * objects, several of which are hashed side by side.
+ */
+struct hash_object_job {
+	const void *buf;
+	unsigned long len;
+	const char *type;
+	unsigned char *sha1;
+};
+extern void hash_sha1_files(struct hash_object_job *jobs, int nr);
+
 extern int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
 extern int hash_sha1_file_literally(const void *buf, unsigned long len, const char *type, unsigned char *sha1, unsigned flags);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
@@ -1088,6 +1231,12 @@ extern int get_sha1_mb(const char *str, unsigned char *sha1);
  * refs.c.
  */
 extern int refname_match(const char *abbrev_name, const char *full_name);
+/*
+ * Add to prefixes the full names that refname_match() would match
+ * abbrev_name against, as ref prefixes to ask a server for.
+ */
+struct argv_array;
+extern void expand_ref_prefix(struct argv_array *prefixes, const char *abbrev_name);
 
 extern int create_symref(const char *ref, const char *refs_heads_master, const char *logmsg);
 extern int validate_headref(const char *ref);
@@ -1182,11 +1331,20 @@ struct checkout {
 		 quiet:1,
 		 not_new:1,
 		 refresh_cache:1;
+	struct delayed_checkout *delayed_checkout;
 };
 
 #define TEMPORARY_FILENAME_LENGTH 25
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
 
+/*
+ * Let filter processes delay the smudged content of the entries
+ * checked out with "state"; finish_delayed_checkout() then waits for
+ * and writes out the delayed ones, returning non-zero on errors.
+ */
+extern void enable_delayed_checkout(struct checkout *state);
+extern int finish_delayed_checkout(struct checkout *state);
+
 struct cache_def {
 	struct strbuf path;
 	int flags;
@@ -1217,6 +1375,14 @@ extern void add_to_alternates_file(const char *reference);
 typedef int alt_odb_fn(struct alternate_object_database *, void *);
 extern int foreach_alt_odb(alt_odb_fn, void*);
 
+/*
+ * Make the objects in the object directory of a submodule (and in its
+ * alternates) visible to object lookups, until the next call to
+ * deactivate_submodule_odb().  Only one submodule is active at a time.
+ */
+extern void activate_submodule_odb(const char *objdir);
+extern void deactivate_submodule_odb(void);
+
 struct pack_window {
 	struct pack_window *next;
 	unsigned char *base;
@@ -1224,8 +1390,17 @@ struct pack_window {
 	size_t len;
 	unsigned int last_used;
 	unsigned int inuse_cnt;
+	/* cursors moved here, halved whenever a window is evicted */
+	unsigned int hits;
+	/* to tell a reader going through the window in order */
+	off_t last_access;
+	unsigned int forward_run;
+	int sequential;
+	off_t readahead;
 };
 
+struct revindex_entry;
+
 extern struct packed_git {
 	struct packed_git *next;
 	struct pack_window *windows;
@@ -1238,10 +1413,26 @@ extern struct packed_git {
 	int index_version;
 	time_t mtime;
 	int pack_fd;
+	/* reverse index, see pack-revindex.h */
+	struct revindex_entry *revindex;
+	const uint32_t *revindex_data;
+	const void *revindex_map;
+	size_t revindex_size;
+	/* object size table, see pack-sizes.h */
+	const void *sizes_map;
+	size_t sizes_size;
+	/* delta base table, see pack-bases.h */
+	const void *bases_map;
+	size_t bases_size;
+	unsigned int index; /* for pack-objects, see oe_set_in_pack() */
 	unsigned pack_local:1,
 		 pack_keep:1,
 		 freshened:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1,
+		 no_sizes:1,
+		 no_bases:1,
+		 pack_submodule:1;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -1249,6 +1440,7 @@ extern struct packed_git {
 
 struct pack_entry {
 	off_t offset;
+	uint32_t pos; /* in the .idx */
 	unsigned char sha1[20];
 	struct packed_git *p;
 };
@@ -1266,6 +1458,7 @@ extern struct packed_git *find_sha1_pack(const unsigned char *sha1,
 					 struct packed_git *packs);
 
 extern void pack_report(void);
+extern size_t pack_window_usage(size_t *peak);
 
 /*
  * mmap the index file for the specified packfile (if it is not
@@ -1284,6 +1477,39 @@ extern void close_pack_windows(struct packed_git *);
 extern void unuse_pack(struct pack_window **);
 extern void free_pack_by_name(const char *);
 extern void clear_delta_base_cache(void);
+
+struct delta_base_cache_stats {
+	unsigned long slots;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t cached;
+};
+extern void get_delta_base_cache_stats(struct delta_base_cache_stats *);
+
+/*
+ * Counters of how objects were looked up and read, cheap enough to be
+ * kept all the time.  Updated without locking, so they are approximate
+ * when several threads read objects.  delta_chain[n] counts the
+ * entries unpacked by resolving a chain of 2^(n-1) to 2^n - 1 deltas
+ * (none for n = 0), the last bucket taking all longer chains.
+ */
+#define DELTA_CHAIN_BUCKETS 8
+struct object_access_stats {
+	unsigned long info_cached;
+	unsigned long info_loose;
+	unsigned long info_packed;
+	unsigned long read_loose;
+	unsigned long read_packed;
+	unsigned long missing;
+	unsigned long unpacked_entries;
+	unsigned long deltas_applied;
+	unsigned long delta_chain[DELTA_CHAIN_BUCKETS];
+	unsigned long delta_chain_max;
+	uintmax_t inflated_bytes;
+};
+extern void get_object_access_stats(struct object_access_stats *);
+extern void trace_object_access_stats(void);
 extern struct packed_git *add_packed_git(const char *, int, int);
 
 /*
@@ -1308,10 +1534,25 @@ extern off_t find_pack_entry_one(const unsigned char *sha1, struct packed_git *)
 
 extern int is_pack_valid(struct packed_git *);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
+/*
+ * Like unpack_entry(), but for an object that other deltas are applied
+ * to: it is taken from the delta base cache if it is there, and left
+ * there for the next delta against it otherwise.
+ */
+extern void *unpack_delta_base(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
+/*
+ * Read the base of the delta of the given type whose data starts at
+ * *curpos, and advance *curpos past it.  Returns the offset of the base
+ * in "p", or 0 if it is out of bounds or (for a REF_DELTA) not in "p".
+ */
+extern off_t get_delta_base(struct packed_git *p, struct pack_window **w_curs,
+			    off_t *curpos, enum object_type type,
+			    off_t delta_obj_offset);
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
@@ -1365,6 +1606,26 @@ typedef int each_packed_object_fn(const unsigned char *sha1,
 				  uint32_t pos,
 				  void *data);
 extern int for_each_loose_object(each_loose_object_fn, void *, unsigned flags);
+
+/*
+ * The names of the loose objects in all object directories that start
+ * with the byte "first", as a sha1_array.  The directories are read the
+ * first time each byte is asked for, or again with "refresh"; objects
+ * this process writes are added, and reprepare_packed_git() forgets
+ * all of it.
+ */
+struct sha1_array;
+extern struct sha1_array *loose_objects_with_prefix(unsigned char first, int refresh);
+
+/*
+ * With core.fsyncObjectFiles=batch, the loose objects written until
+ * the matching end_loose_object_batch() are flushed to disk together
+ * when it is called, instead of one fsync() each, and are moved into
+ * the object directory only then.  They can be read back meanwhile.
+ * Batches nest; only the outermost one counts.
+ */
+extern void begin_loose_object_batch(void);
+extern void end_loose_object_batch(void);
 extern int for_each_packed_object(each_packed_object_fn, void *, unsigned flags);
 
 struct object_info {
@@ -1488,7 +1749,6 @@ extern int parse_config_key(const char *var,
 			    const char **key);
 
 struct config_set_element {
-	struct hashmap_entry ent;
 	char *key;
 	struct string_list value_list;
 };
@@ -1510,7 +1770,7 @@ struct configset_list {
 };
 
 struct config_set {
-	struct hashmap config_hash;
+	struct oahashmap config_hash;
 	int hash_initialized;
 	struct configset_list list;
 };
@@ -1609,6 +1869,23 @@ extern void *alloc_commit_node(void);
 extern void *alloc_tag_node(void);
 extern void *alloc_object_node(void);
 extern void alloc_report(void);
+extern size_t alloc_memory_usage(size_t *peak);
+
+/*
+ * Objects created between begin_object_arena() and the matching
+ * release_object_arena() are allocated from an arena of their own.
+ * Releasing it frees them all at once and removes them from the object
+ * hash, after which lookup_object() no longer finds them.  Arenas nest
+ * and must be released innermost first.
+ *
+ * Older objects that were parsed meanwhile and point at objects of the
+ * arena are made unparsed again, but any other pointer into the arena
+ * (rev_info, object_array, ->util) dangles once it is released.
+ * GIT_TRACE_ALLOC shows how much each arena used.
+ */
+struct object_arena;
+extern struct object_arena *begin_object_arena(void);
+extern void release_object_arena(struct object_arena *);
 extern unsigned int alloc_commit_index(void);
 
 /* pkt-line.c */
@@ -1675,6 +1952,13 @@ int try_merge_command(const char *strategy, size_t xopts_nr,
 int checkout_fast_forward(const unsigned char *from,
 			  const unsigned char *to,
 			  int overwrite_ignore);
+/*
+ * Like checkout_fast_forward(), but when the work tree or the index is
+ * in the way, quietly fail without touching either.
+ */
+int checkout_fast_forward_gently(const unsigned char *from,
+				 const unsigned char *to,
+				 int overwrite_ignore);
 
 
 int sane_execvp(const char *file, char *const argv[]);
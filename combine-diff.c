@@ -95,27 +95,35 @@ struct lline {
 	char line[FLEX_ARRAY];
 };
 
-/* Lines lost from current parent (before coalescing) */
+/*
+ * Lines lost from current parent (before coalescing), hanging to
+ * sline[lno].  The diff against each parent yields them in the order
+ * of the result, so they are kept in an array of runs rather than in
+ * every sline.
+ */
 struct plost {
+	unsigned long lno;
 	struct lline *lost_head, *lost_tail;
 	int len;
 };
 
-/* Lines surviving in the merge result */
+/*
+ * Lines surviving in the merge result.  There is one for each line
+ * of the result of a merge being shown, so keep it small: nothing in
+ * it grows with the number of parents beyond the bits of "flag".
+ */
 struct sline {
 	/* Accumulated and coalesced lost lines */
 	struct lline *lost;
 	int lenlost;
-	struct plost plost;
-	char *bol;
 	int len;
+	char *bol;
 	/* bit 0 up to (N-1) are on if the parent has this line (i.e.
 	 * we did not change it).
 	 * bit N is used for "interesting" lines, including context.
 	 * bit (N+1) is used for "do not show deletion before this".
 	 */
 	unsigned long flag;
-	unsigned long *p_lno;
 };
 
 static int match_string_spaces(const char *line1, int len1,
@@ -165,8 +173,8 @@ static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 				    struct lline *new, int lennew,
 				    unsigned long parent, long flags)
 {
-	int **lcs;
-	enum coalesce_direction **directions;
+	int *lcs, *prev_lcs;
+	unsigned char **directions;
 	struct lline *baseend, *newend = NULL;
 	int i, j, origbaselen = *lenbase;
 
@@ -180,7 +188,9 @@ static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 
 	/*
 	 * Coalesce new lines into base by finding the LCS
-	 * - Create the table to run dynamic programming
+	 * - Create the table to run dynamic programming; only the
+	 *   directions are kept for all cells, the lengths of the
+	 *   LCS just for the previous and the current row
 	 * - Compute the LCS
 	 * - Then reverse read the direction structure:
 	 *   - If we have MATCH, assign parent to base flag, and consume
@@ -189,27 +199,30 @@ static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 	 *   - Else if we have NEW, insert newend lline into base and
 	 *   consume newend
 	 */
-	lcs = xcalloc(origbaselen + 1, sizeof(int*));
-	directions = xcalloc(origbaselen + 1, sizeof(enum coalesce_direction*));
+	lcs = xcalloc(lennew + 1, sizeof(int));
+	prev_lcs = xcalloc(lennew + 1, sizeof(int));
+	directions = xcalloc(origbaselen + 1, sizeof(*directions));
 	for (i = 0; i < origbaselen + 1; i++) {
-		lcs[i] = xcalloc(lennew + 1, sizeof(int));
-		directions[i] = xcalloc(lennew + 1, sizeof(enum coalesce_direction));
+		directions[i] = xcalloc(lennew + 1, sizeof(**directions));
 		directions[i][0] = BASE;
 	}
 	for (j = 1; j < lennew + 1; j++)
 		directions[0][j] = NEW;
 
 	for (i = 1, baseend = base; i < origbaselen + 1; i++) {
+		int *tmp = prev_lcs;
+		prev_lcs = lcs;
+		lcs = tmp;
 		for (j = 1, newend = new; j < lennew + 1; j++) {
 			if (match_string_spaces(baseend->line, baseend->len,
 						newend->line, newend->len, flags)) {
-				lcs[i][j] = lcs[i - 1][j - 1] + 1;
+				lcs[j] = prev_lcs[j - 1] + 1;
 				directions[i][j] = MATCH;
-			} else if (lcs[i][j - 1] >= lcs[i - 1][j]) {
-				lcs[i][j] = lcs[i][j - 1];
+			} else if (lcs[j - 1] >= prev_lcs[j]) {
+				lcs[j] = lcs[j - 1];
 				directions[i][j] = NEW;
 			} else {
-				lcs[i][j] = lcs[i - 1][j];
+				lcs[j] = prev_lcs[j];
 				directions[i][j] = BASE;
 			}
 			if (newend->next)
@@ -219,9 +232,8 @@ static struct lline *coalesce_lines(struct lline *base, int *lenbase,
 			baseend = baseend->next;
 	}
 
-	for (i = 0; i < origbaselen + 1; i++)
-		free(lcs[i]);
 	free(lcs);
+	free(prev_lcs);
 
 	/* At this point, baseend and newend point to the end of each lists */
 	i--;
@@ -312,38 +324,52 @@ static char *grab_blob(const struct object_id *oid, unsigned int mode,
 	return blob;
 }
 
-static void append_lost(struct sline *sline, int n, const char *line, int len)
+struct combine_diff_state {
+	unsigned int lno;
+	int ob, on, nb, nn;
+	unsigned long nmask;
+	int num_parent;
+	int n;
+	struct sline *sline;
+	unsigned long lost_bucket;
+	int in_hunk;
+	struct plost *plost;
+	int plost_nr, plost_alloc;
+};
+
+static void append_lost(struct combine_diff_state *state, int n,
+			const char *line, int len)
 {
 	struct lline *lline;
+	struct plost *plost;
 	unsigned long this_mask = (1UL<<n);
 	if (line[len-1] == '\n')
 		len--;
 
+	plost = state->plost_nr ? &state->plost[state->plost_nr - 1] : NULL;
+	if (!plost || plost->lno != state->lost_bucket) {
+		ALLOC_GROW(state->plost, state->plost_nr + 1,
+			   state->plost_alloc);
+		plost = &state->plost[state->plost_nr++];
+		memset(plost, 0, sizeof(*plost));
+		plost->lno = state->lost_bucket;
+	}
+
 	lline = xmalloc(sizeof(*lline) + len + 1);
 	lline->len = len;
 	lline->next = NULL;
-	lline->prev = sline->plost.lost_tail;
+	lline->prev = plost->lost_tail;
 	if (lline->prev)
 		lline->prev->next = lline;
 	else
-		sline->plost.lost_head = lline;
-	sline->plost.lost_tail = lline;
-	sline->plost.len++;
+		plost->lost_head = lline;
+	plost->lost_tail = lline;
+	plost->len++;
 	lline->parent_map = this_mask;
 	memcpy(lline->line, line, len);
 	lline->line[len] = 0;
 }
 
-struct combine_diff_state {
-	unsigned int lno;
-	int ob, on, nb, nn;
-	unsigned long nmask;
-	int num_parent;
-	int n;
-	struct sline *sline;
-	struct sline *lost_bucket;
-};
-
 static void consume_line(void *state_, char *line, unsigned long len)
 {
 	struct combine_diff_state *state = state_;
@@ -363,24 +389,18 @@ static void consume_line(void *state_, char *line, unsigned long len)
 			 * in which case the hunk removes the first
 			 * line in the file.
 			 */
-			state->lost_bucket = &state->sline[state->nb];
-			if (!state->nb)
-				state->nb = 1;
+			state->lost_bucket = state->nb;
 		} else {
-			state->lost_bucket = &state->sline[state->nb-1];
+			state->lost_bucket = state->nb-1;
 		}
-		if (!state->sline[state->nb-1].p_lno)
-			state->sline[state->nb-1].p_lno =
-				xcalloc(state->num_parent,
-					sizeof(unsigned long));
-		state->sline[state->nb-1].p_lno[state->n] = state->ob;
+		state->in_hunk = 1;
 		return;
 	}
-	if (!state->lost_bucket)
+	if (!state->in_hunk)
 		return; /* not in any hunk yet */
 	switch (line[0]) {
 	case '-':
-		append_lost(state->lost_bucket, state->n, line+1, len-1);
+		append_lost(state, state->n, line+1, len-1);
 		break;
 	case '+':
 		state->sline[state->lno-1].flag |= state->nmask;
@@ -396,8 +416,7 @@ static void combine_diff(const struct object_id *parent, unsigned int mode,
 			 struct userdiff_driver *textconv,
 			 const char *path, long flags)
 {
-	unsigned int p_lno, lno;
-	unsigned long nmask = (1UL << n);
+	int i;
 	xpparam_t xpp;
 	xdemitconf_t xecfg;
 	mmfile_t parent_file;
@@ -413,7 +432,7 @@ static void combine_diff(const struct object_id *parent, unsigned int mode,
 	xpp.flags = flags;
 	memset(&xecfg, 0, sizeof(xecfg));
 	memset(&state, 0, sizeof(state));
-	state.nmask = nmask;
+	state.nmask = (1UL << n);
 	state.sline = sline;
 	state.lno = 1;
 	state.num_parent = num_parent;
@@ -423,38 +442,15 @@ static void combine_diff(const struct object_id *parent, unsigned int mode,
 		      &xpp, &xecfg);
 	free(parent_file.ptr);
 
-	/* Assign line numbers for this parent.
-	 *
-	 * sline[lno].p_lno[n] records the first line number
-	 * (counting from 1) for parent N if the final hunk display
-	 * started by showing sline[lno] (possibly showing the lost
-	 * lines attached to it first).
-	 */
-	for (lno = 0,  p_lno = 1; lno <= cnt; lno++) {
-		struct lline *ll;
-		sline[lno].p_lno[n] = p_lno;
-
-		/* Coalesce new lines */
-		if (sline[lno].plost.lost_head) {
-			struct sline *sl = &sline[lno];
-			sl->lost = coalesce_lines(sl->lost, &sl->lenlost,
-						  sl->plost.lost_head,
-						  sl->plost.len, n, flags);
-			sl->plost.lost_head = sl->plost.lost_tail = NULL;
-			sl->plost.len = 0;
-		}
-
-		/* How many lines would this sline advance the p_lno? */
-		ll = sline[lno].lost;
-		while (ll) {
-			if (ll->parent_map & nmask)
-				p_lno++; /* '-' means parent had it */
-			ll = ll->next;
-		}
-		if (lno < cnt && !(sline[lno].flag & nmask))
-			p_lno++; /* no '+' means parent had it */
+	/* Coalesce new lines */
+	for (i = 0; i < state.plost_nr; i++) {
+		struct plost *plost = &state.plost[i];
+		struct sline *sl = &sline[plost->lno];
+		sl->lost = coalesce_lines(sl->lost, &sl->lenlost,
+					  plost->lost_head, plost->len,
+					  n, flags);
 	}
-	sline[lno].p_lno[n] = p_lno; /* trailer */
+	free(state.plost);
 }
 
 static unsigned long context = 3;
@@ -689,10 +685,34 @@ static int make_hunks(struct sline *sline, unsigned long cnt,
 	return has_interesting;
 }
 
-static void show_parent_lno(struct sline *sline, unsigned long l0, unsigned long l1, int n, unsigned long null_context)
+/*
+ * Advance p_lno[], the line number in each parent of the first line
+ * shown for sline[lno] (the lines it lost, or the line itself), past
+ * the slines from *lno up to "end".
+ */
+static void advance_p_lno(struct sline *sline, unsigned long *lno,
+			  unsigned long end, unsigned long cnt,
+			  int num_parent, unsigned long *p_lno)
+{
+	int n;
+
+	for (; *lno < end; (*lno)++) {
+		struct sline *sl = &sline[*lno];
+		struct lline *ll;
+
+		for (ll = sl->lost; ll; ll = ll->next)
+			for (n = 0; n < num_parent; n++)
+				if (ll->parent_map & (1UL<<n))
+					p_lno[n]++; /* '-' means parent had it */
+		if (*lno < cnt)
+			for (n = 0; n < num_parent; n++)
+				if (!(sl->flag & (1UL<<n)))
+					p_lno[n]++; /* no '+' means parent had it */
+	}
+}
+
+static void show_parent_lno(unsigned long l0, unsigned long l1, unsigned long null_context)
 {
-	l0 = sline[l0].p_lno[n];
-	l1 = sline[l1].p_lno[n];
 	printf(" -%lu,%lu", l0, l1-l0-null_context);
 }
 
@@ -725,7 +745,8 @@ static void dump_sline(struct sline *sline, const char *line_prefix,
 	unsigned long mark = (1UL<<num_parent);
 	unsigned long no_pre_delete = (2UL<<num_parent);
 	int i;
-	unsigned long lno = 0;
+	unsigned long lno = 0, p_lno_at = 0;
+	unsigned long *p_lno, *p_lno_end;
 	const char *c_frag = diff_get_color(use_color, DIFF_FRAGINFO);
 	const char *c_func = diff_get_color(use_color, DIFF_FUNCINFO);
 	const char *c_new = diff_get_color(use_color, DIFF_FILE_NEW);
@@ -736,6 +757,12 @@ static void dump_sline(struct sline *sline, const char *line_prefix,
 	if (result_deleted)
 		return; /* result deleted */
 
+	/* line numbers in each parent at sline[p_lno_at] and at hunk_end */
+	p_lno = xmalloc(num_parent * sizeof(*p_lno));
+	p_lno_end = xmalloc(num_parent * sizeof(*p_lno_end));
+	for (i = 0; i < num_parent; i++)
+		p_lno[i] = 1;
+
 	while (1) {
 		unsigned long hunk_end;
 		unsigned long rlines;
@@ -777,8 +804,14 @@ static void dump_sline(struct sline *sline, const char *line_prefix,
 
 		printf("%s%s", line_prefix, c_frag);
 		for (i = 0; i <= num_parent; i++) putchar(combine_marker);
+		advance_p_lno(sline, &p_lno_at, lno, cnt, num_parent, p_lno);
+		memcpy(p_lno_end, p_lno, num_parent * sizeof(*p_lno));
+		advance_p_lno(sline, &p_lno_at, hunk_end, cnt, num_parent,
+			      p_lno_end);
 		for (i = 0; i < num_parent; i++)
-			show_parent_lno(sline, lno, hunk_end, i, null_context);
+			show_parent_lno(p_lno[i], p_lno_end[i], null_context);
+		for (i = 0; i < num_parent; i++)
+			p_lno[i] = p_lno_end[i];
 		printf(" +%lu,%lu ", lno+1, rlines);
 		for (i = 0; i <= num_parent; i++) putchar(combine_marker);
 
@@ -842,6 +875,8 @@ static void dump_sline(struct sline *sline, const char *line_prefix,
 			show_line_to_eol(sl->bol, sl->len, c_reset);
 		}
 	}
+	free(p_lno);
+	free(p_lno_end);
 }
 
 static void reuse_combine_diff(struct sline *sline, unsigned long cnt,
@@ -857,7 +892,6 @@ static void reuse_combine_diff(struct sline *sline, unsigned long cnt,
 
 	for (lno = 0; lno <= cnt; lno++) {
 		struct lline *ll = sline->lost;
-		sline->p_lno[i] = sline->p_lno[j];
 		while (ll) {
 			if (ll->parent_map & jmask)
 				ll->parent_map |= imask;
@@ -867,8 +901,6 @@ static void reuse_combine_diff(struct sline *sline, unsigned long cnt,
 			sline->flag |= imask;
 		sline++;
 	}
-	/* the overall size of the file (sline[cnt]) */
-	sline->p_lno[i] = sline->p_lno[j];
 }
 
 static void dump_quoted_path(const char *head,
@@ -1129,13 +1161,6 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	result_file.ptr = result;
 	result_file.size = result_size;
 
-	/* Even p_lno[cnt+1] is valid -- that is for the end line number
-	 * for deletion hunk at the end.
-	 */
-	sline[0].p_lno = xcalloc((cnt+2) * num_parent, sizeof(unsigned long));
-	for (lno = 0; lno <= cnt; lno++)
-		sline[lno+1].p_lno = sline[lno].p_lno + num_parent;
-
 	for (i = 0; i < num_parent; i++) {
 		int j;
 		for (j = 0; j < i; j++) {
@@ -1173,7 +1198,6 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 			}
 		}
 	}
-	free(sline[0].p_lno);
 	free(sline);
 }
 
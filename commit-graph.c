@@ -0,0 +1,737 @@
+#include "cache.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "lockfile.h"
+#include "refs.h"
+#include "sha1-lookup.h"
+#include "tag.h"
+#include "tree.h"
+#include "commit-graph.h"
+
+/* used by write_commit_graph() to collect each commit once */
+#define GRAPH_SEEN (1u<<15)
+
+static struct commit_graph *commit_graph;
+
+char *get_commit_graph_filename(const char *object_dir)
+{
+	return xstrfmt("%s/info/commit-graph", object_dir);
+}
+
+struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	struct commit_graph *g;
+	const unsigned char *data;
+	uint32_t version, num_commits, num_extra_edges, bloom_data_len = 0;
+	uint64_t base_len;
+	size_t data_len;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = git_open_noatime(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	data_len = xsize_t(st.st_size);
+	if (data_len < GRAPH_HEADER_SIZE + 256 * 4 + 20) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+	map = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != GRAPH_SIGNATURE) {
+		error("commit-graph file %s has a bad signature", graph_file);
+		goto bad;
+	}
+	version = get_be32(data + 4);
+	if (version != GRAPH_VERSION && version != GRAPH_VERSION_CHANGED_PATHS) {
+		error("commit-graph file %s has unsupported version %"PRIu32,
+		      graph_file, version);
+		goto bad;
+	}
+	num_commits = get_be32(data + 8);
+	num_extra_edges = get_be32(data + 12);
+	base_len = GRAPH_HEADER_SIZE + 256 * 4 +
+		(uint64_t)num_commits * (20 + GRAPH_DATA_WIDTH) +
+		(uint64_t)num_extra_edges * 4;
+	if (version == GRAPH_VERSION_CHANGED_PATHS) {
+		/* the filters end where the last one does */
+		uint64_t indexes_end = base_len + 8 + (uint64_t)num_commits * 4;
+		if (data_len < indexes_end + 20) {
+			error("commit-graph file %s is truncated or corrupt",
+			      graph_file);
+			goto bad;
+		}
+		bloom_data_len = num_commits ?
+			get_be32(data + indexes_end - 4) : 0;
+		base_len = indexes_end + bloom_data_len;
+	}
+	if (data_len != base_len + 20) {
+		error("commit-graph file %s is truncated or corrupt", graph_file);
+		goto bad;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = data;
+	g->data_len = data_len;
+	g->num_commits = num_commits;
+	g->num_extra_edges = num_extra_edges;
+	g->chunk_fanout = (const uint32_t *)(data + GRAPH_HEADER_SIZE);
+	g->chunk_oids = (const unsigned char *)(g->chunk_fanout + 256);
+	g->chunk_data = g->chunk_oids + (size_t)num_commits * 20;
+	g->chunk_extra_edges = g->chunk_data +
+		(size_t)num_commits * GRAPH_DATA_WIDTH;
+
+	if (version == GRAPH_VERSION_CHANGED_PATHS) {
+		const unsigned char *bloom = g->chunk_extra_edges +
+			(size_t)num_extra_edges * 4;
+		g->bloom_settings.num_hashes = get_be32(bloom);
+		g->bloom_settings.bits_per_entry = get_be32(bloom + 4);
+		g->chunk_bloom_indexes = bloom + 8;
+		g->chunk_bloom_data = g->chunk_bloom_indexes + (size_t)num_commits * 4;
+		g->bloom_data_len = bloom_data_len;
+		if (!g->bloom_settings.num_hashes ||
+		    g->bloom_settings.num_hashes > 64 ||
+		    !g->bloom_settings.bits_per_entry) {
+			error("commit-graph file %s has bad changed-path filter settings",
+			      graph_file);
+			free(g);
+			goto bad;
+		}
+	}
+
+	if (ntohl(g->chunk_fanout[255]) != num_commits) {
+		error("commit-graph file %s has a bad fanout table", graph_file);
+		free(g);
+		goto bad;
+	}
+	return g;
+
+bad:
+	munmap(map, data_len);
+	return NULL;
+}
+
+void free_commit_graph(struct commit_graph *g)
+{
+	if (!g)
+		return;
+	munmap((void *)g->data, g->data_len);
+	free(g);
+}
+
+void close_commit_graph(void)
+{
+	free_commit_graph(commit_graph);
+	commit_graph = NULL;
+}
+
+static int has_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+int commit_graph_compatible(void)
+{
+	lookup_commit_graft(null_sha1);
+	if (for_each_commit_graft(has_graft, NULL))
+		return 0;
+	lookup_replace_object(null_sha1);
+	if (check_replace_refs)
+		return 0;
+	return 1;
+}
+
+static int prepare_commit_graph(void)
+{
+	static int prepared;
+	char *graph_name;
+
+	if (prepared)
+		return !!commit_graph;
+	prepared = 1;
+
+	if (!core_commit_graph || !commit_graph_compatible())
+		return 0;
+
+	graph_name = get_commit_graph_filename(get_object_directory());
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+	return !!commit_graph;
+}
+
+static int bsearch_graph(const struct commit_graph *g,
+			 const unsigned char *sha1, uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(g->chunk_fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(g->chunk_fanout[sha1[0]]);
+	for (; lo < hi; ) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->chunk_oids + (size_t)mi * 20);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_graph_parent(const struct commit_graph *g,
+						uint32_t pos,
+						struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		return NULL;
+	c = lookup_commit(g->chunk_oids + (size_t)pos * 20);
+	if (!c)
+		return NULL;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static int fill_commit_in_graph(struct commit *item,
+				const struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *data = g->chunk_data + (size_t)pos * GRAPH_DATA_WIDTH;
+	struct commit_list **pptr = &item->parents;
+	uint32_t edge;
+
+	edge = get_be32(data + 20);
+	if (edge != GRAPH_PARENT_NONE) {
+		pptr = insert_graph_parent(g, edge, pptr);
+		if (!pptr)
+			goto bad;
+	}
+	edge = get_be32(data + 24);
+	if (edge != GRAPH_PARENT_NONE && !(edge & GRAPH_EXTRA_EDGES)) {
+		pptr = insert_graph_parent(g, edge, pptr);
+		if (!pptr)
+			goto bad;
+	} else if (edge != GRAPH_PARENT_NONE) {
+		uint32_t i = edge & ~GRAPH_EXTRA_EDGES;
+		do {
+			if (i >= g->num_extra_edges)
+				goto bad;
+			edge = get_be32(g->chunk_extra_edges + (size_t)i++ * 4);
+			pptr = insert_graph_parent(g, edge & ~GRAPH_LAST_EDGE, pptr);
+			if (!pptr)
+				goto bad;
+		} while (!(edge & GRAPH_LAST_EDGE));
+	}
+
+	item->generation = get_be32(data + 28);
+	item->date = (unsigned long)(((uint64_t)get_be32(data + 32) << 32) |
+				     get_be32(data + 36));
+	item->object.parsed = 1;
+	return 1;
+
+bad:
+	error("commit-graph has bad parents for commit %s",
+	      sha1_to_hex(item->object.sha1));
+	free_commit_list(item->parents);
+	item->parents = NULL;
+	return 0;
+}
+
+static int find_commit_in_graph(const struct commit *item, uint32_t *pos)
+{
+	if (!prepare_commit_graph())
+		return 0;
+	/* grafts and replace refs can appear after the graph was loaded */
+	if (lookup_commit_graft(item->object.sha1) ||
+	    lookup_replace_object(item->object.sha1) != item->object.sha1)
+		return 0;
+	return bsearch_graph(commit_graph, item->object.sha1, pos);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	if (!find_commit_in_graph(item, &pos))
+		return 0;
+	return fill_commit_in_graph(item, commit_graph, pos);
+}
+
+struct tree *get_commit_tree_in_graph(const struct commit *item)
+{
+	uint32_t pos;
+
+	if (!find_commit_in_graph(item, &pos))
+		return NULL;
+	return lookup_tree(commit_graph->chunk_data +
+			   (size_t)pos * GRAPH_DATA_WIDTH);
+}
+
+int generation_numbers_enabled(void)
+{
+	return prepare_commit_graph() && commit_graph->num_commits;
+}
+
+uint32_t commit_graph_generation(const struct commit *item)
+{
+	uint32_t pos;
+
+	if (!find_commit_in_graph(item, &pos))
+		return GENERATION_NUMBER_INFINITY;
+	return get_be32(commit_graph->chunk_data +
+			(size_t)pos * GRAPH_DATA_WIDTH + 28);
+}
+
+static int load_bloom_filter(const struct commit_graph *g, uint32_t pos,
+			     struct bloom_filter *filter)
+{
+	uint32_t start, end;
+
+	if (!g->chunk_bloom_indexes)
+		return 0;
+	start = pos ? get_be32(g->chunk_bloom_indexes + (size_t)(pos - 1) * 4) : 0;
+	end = get_be32(g->chunk_bloom_indexes + (size_t)pos * 4);
+	if (start > end || end > g->bloom_data_len)
+		return 0;
+	filter->data = (unsigned char *)g->chunk_bloom_data + start;
+	filter->len = end - start;
+	return 1;
+}
+
+const struct bloom_filter_settings *get_changed_paths_filter(
+	const struct commit *item, const struct commit *parent,
+	struct bloom_filter *filter)
+{
+	uint32_t pos, parent_pos;
+
+	if (!find_commit_in_graph(item, &pos) || !commit_graph->chunk_bloom_indexes)
+		return NULL;
+	/* the filter is relative to the first parent only */
+	parent_pos = get_be32(commit_graph->chunk_data +
+			      (size_t)pos * GRAPH_DATA_WIDTH + 20);
+	if (parent_pos >= commit_graph->num_commits ||
+	    hashcmp(commit_graph->chunk_oids + (size_t)parent_pos * 20,
+		    parent->object.sha1))
+		return NULL;
+	if (!load_bloom_filter(commit_graph, pos, filter))
+		return NULL;
+	return &commit_graph->bloom_settings;
+}
+
+int commit_graph_has_changed_paths(const char *object_dir)
+{
+	char *graph_name = get_commit_graph_filename(object_dir);
+	struct commit_graph *g = load_commit_graph_one(graph_name);
+	int ret = g && g->chunk_bloom_indexes;
+
+	free_commit_graph(g);
+	free(graph_name);
+	return ret;
+}
+
+struct graph_commit_list {
+	struct commit **list;
+	uint32_t nr, alloc;
+};
+
+static void add_graph_commit(struct graph_commit_list *commits,
+			     struct commit *c)
+{
+	if (c->object.flags & GRAPH_SEEN)
+		return;
+	c->object.flags |= GRAPH_SEEN;
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = c;
+}
+
+static int add_ref_to_graph(const char *refname, const struct object_id *oid,
+			    int flags, void *cb_data)
+{
+	struct object *o = parse_object(oid->hash);
+
+	o = deref_tag(o, refname, 0);
+	if (o && o->type == OBJ_COMMIT)
+		add_graph_commit(cb_data, (struct commit *)o);
+	return 0;
+}
+
+static int graph_commit_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static const unsigned char *graph_commit_access(size_t index, void *table)
+{
+	struct commit **list = table;
+	return list[index]->object.sha1;
+}
+
+static uint32_t graph_pos(struct graph_commit_list *commits, struct commit *c)
+{
+	int pos = sha1_pos(c->object.sha1, commits->list, commits->nr,
+			   graph_commit_access);
+	if (pos < 0)
+		die("BUG: commit %s missing from commit-graph",
+		    sha1_to_hex(c->object.sha1));
+	return pos;
+}
+
+/*
+ * A commit's generation number is one more than the largest generation
+ * of its parents; root commits have generation 1.  Computed without
+ * recursion, as histories can be very deep.
+ */
+static void compute_generations(struct graph_commit_list *commits,
+				uint32_t *generation)
+{
+	struct commit **stack = NULL;
+	uint32_t i, nr = 0, alloc = 0;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (generation[i])
+			continue;
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr++] = commits->list[i];
+		while (nr) {
+			struct commit *c = stack[nr - 1];
+			struct commit_list *p;
+			uint32_t max = 0, pos;
+			int all_known = 1;
+
+			for (p = c->parents; p; p = p->next) {
+				uint32_t g = generation[graph_pos(commits, p->item)];
+				if (!g) {
+					all_known = 0;
+					ALLOC_GROW(stack, nr + 1, alloc);
+					stack[nr++] = p->item;
+				} else if (g > max)
+					max = g;
+			}
+			if (!all_known)
+				continue;
+			pos = graph_pos(commits, c);
+			generation[pos] = max < GENERATION_NUMBER_MAX ?
+				max + 1 : GENERATION_NUMBER_MAX;
+			nr--;
+		}
+	}
+	free(stack);
+}
+
+/*
+ * Compute the changed-path filters of all commits, one after another
+ * into a single buffer, with index[i] pointing past the end of the
+ * filter of commits->list[i].  Filters a previous commit-graph file
+ * "old" has for the same commit are copied instead.
+ */
+static void compute_bloom_filters(struct graph_commit_list *commits,
+				  const struct commit_graph *old,
+				  const struct bloom_filter_settings *settings,
+				  uint32_t *index, struct strbuf *data)
+{
+	uint32_t i, pos;
+
+	if (old && (old->bloom_settings.num_hashes != settings->num_hashes ||
+		    old->bloom_settings.bits_per_entry != settings->bits_per_entry))
+		old = NULL;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct bloom_filter filter;
+
+		if (old && bsearch_graph(old, c->object.sha1, &pos) &&
+		    load_bloom_filter(old, pos, &filter)) {
+			strbuf_add(data, filter.data, filter.len);
+		} else {
+			compute_bloom_filter(c, &filter, settings);
+			strbuf_add(data, filter.data, filter.len);
+			free(filter.data);
+		}
+		if (data->len > 0xffffffff)
+			die("too much changed-path filter data for a commit-graph");
+		index[i] = data->len;
+	}
+}
+
+int write_commit_graph(const char *object_dir, unsigned flags)
+{
+	static struct lock_file lock;
+	struct graph_commit_list commits = { NULL, 0, 0 };
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct strbuf bloom_data = STRBUF_INIT;
+	uint32_t *bloom_index = NULL;
+	uint32_t *generation;
+	uint32_t fanout[256];
+	uint32_t i, num_extra_edges = 0;
+	char *graph_name;
+	struct sha1file *f;
+	int ret = 0;
+
+	if (!commit_graph_compatible())
+		return error("cannot write a commit-graph in a repository "
+			     "with grafts, replace refs or shallow history");
+
+	head_ref(add_ref_to_graph, &commits);
+	for_each_ref(add_ref_to_graph, &commits);
+	for (i = 0; i < commits.nr; i++) {
+		struct commit *c = commits.list[i];
+		struct commit_list *p;
+		int nr_parents = 0;
+
+		if (parse_commit(c)) {
+			ret = error("unable to parse commit %s",
+				    sha1_to_hex(c->object.sha1));
+			goto out;
+		}
+		for (p = c->parents; p; p = p->next) {
+			add_graph_commit(&commits, p->item);
+			nr_parents++;
+		}
+		if (nr_parents > 2)
+			num_extra_edges += nr_parents - 1;
+	}
+	qsort(commits.list, commits.nr, sizeof(*commits.list), graph_commit_cmp);
+
+	generation = xcalloc(commits.nr ? commits.nr : 1, sizeof(*generation));
+	compute_generations(&commits, generation);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < commits.nr; i++)
+		fanout[commits.list[i]->object.sha1[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	graph_name = get_commit_graph_filename(object_dir);
+	if (flags & COMMIT_GRAPH_CHANGED_PATHS) {
+		struct commit_graph *old = load_commit_graph_one(graph_name);
+
+		bloom_index = xcalloc(commits.nr ? commits.nr : 1,
+				      sizeof(*bloom_index));
+		compute_bloom_filters(&commits, old, &bloom_settings,
+				      bloom_index, &bloom_data);
+		free_commit_graph(old);
+	}
+	if (safe_create_leading_directories(graph_name)) {
+		ret = error("unable to create leading directories of %s",
+			    graph_name);
+		goto out_free;
+	}
+	hold_lock_file_for_update(&lock, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lock.fd, lock.filename.buf);
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+	sha1write_be32(f, bloom_index ? GRAPH_VERSION_CHANGED_PATHS : GRAPH_VERSION);
+	sha1write_be32(f, commits.nr);
+	sha1write_be32(f, num_extra_edges);
+
+	for (i = 0; i < 256; i++)
+		sha1write_be32(f, fanout[i]);
+	for (i = 0; i < commits.nr; i++)
+		sha1write(f, commits.list[i]->object.sha1, 20);
+
+	num_extra_edges = 0;
+	for (i = 0; i < commits.nr; i++) {
+		struct commit *c = commits.list[i];
+		struct commit_list *p = c->parents;
+		uint64_t date = c->date;
+
+		sha1write(f, get_commit_tree_sha1(c), 20);
+		sha1write_be32(f, p ? graph_pos(&commits, p->item) : GRAPH_PARENT_NONE);
+		if (!p || !p->next)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else if (!p->next->next)
+			sha1write_be32(f, graph_pos(&commits, p->next->item));
+		else {
+			sha1write_be32(f, GRAPH_EXTRA_EDGES | num_extra_edges);
+			for (p = p->next; p; p = p->next)
+				num_extra_edges++;
+		}
+		sha1write_be32(f, generation[i]);
+		sha1write_be32(f, date >> 32);
+		sha1write_be32(f, date & 0xffffffff);
+	}
+
+	for (i = 0; i < commits.nr; i++) {
+		struct commit_list *p = commits.list[i]->parents;
+
+		if (!p || !p->next || !p->next->next)
+			continue;
+		for (p = p->next; p; p = p->next) {
+			uint32_t edge = graph_pos(&commits, p->item);
+			if (!p->next)
+				edge |= GRAPH_LAST_EDGE;
+			sha1write_be32(f, edge);
+		}
+	}
+
+	if (bloom_index) {
+		sha1write_be32(f, bloom_settings.num_hashes);
+		sha1write_be32(f, bloom_settings.bits_per_entry);
+		for (i = 0; i < commits.nr; i++)
+			sha1write_be32(f, bloom_index[i]);
+		sha1write(f, bloom_data.buf, bloom_data.len);
+	}
+
+	close_commit_graph();
+	if (sha1close_commit_lock(f, &lock))
+		ret = error("unable to write %s: %s", graph_name, strerror(errno));
+
+out_free:
+	free(graph_name);
+	free(generation);
+	free(bloom_index);
+	strbuf_release(&bloom_data);
+out:
+	for (i = 0; i < commits.nr; i++)
+		commits.list[i]->object.flags &= ~GRAPH_SEEN;
+	free(commits.list);
+	return ret;
+}
+
+void clear_commit_graph(const char *object_dir)
+{
+	char *graph_name = get_commit_graph_filename(object_dir);
+
+	close_commit_graph();
+	unlink_or_warn(graph_name);
+	free(graph_name);
+}
+
+static int verify_graph_parent(const struct commit_graph *g, uint32_t edge,
+			       struct commit_list **parents, uint32_t *max_gen)
+{
+	const unsigned char *data;
+	uint32_t gen;
+
+	if (edge >= g->num_commits || !*parents ||
+	    hashcmp(g->chunk_oids + (size_t)edge * 20,
+		    (*parents)->item->object.sha1))
+		return -1;
+	data = g->chunk_data + (size_t)edge * GRAPH_DATA_WIDTH;
+	gen = get_be32(data + 28);
+	if (gen > *max_gen)
+		*max_gen = gen;
+	*parents = (*parents)->next;
+	return 0;
+}
+
+int verify_commit_graph(const char *object_dir)
+{
+	struct commit_graph *g;
+	char *graph_name = get_commit_graph_filename(object_dir);
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t i, errors = 0;
+
+	g = load_commit_graph_one(graph_name);
+	free(graph_name);
+	if (!g)
+		return 0;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, g->data + g->data_len - 20)) {
+		error("commit-graph checksum mismatch");
+		errors++;
+	}
+
+	for (i = 0; i < g->num_commits; i++) {
+		const unsigned char *oid = g->chunk_oids + (size_t)i * 20;
+		const unsigned char *data = g->chunk_data + (size_t)i * GRAPH_DATA_WIDTH;
+		struct commit *c;
+		struct commit_list *parents;
+		uint32_t edge, max_gen = 0, gen;
+		int bad = 0, bad_parents = 0;
+
+		if (i && hashcmp(oid - 20, oid) >= 0) {
+			error("commit-graph is not sorted at %s", sha1_to_hex(oid));
+			errors++;
+			continue;
+		}
+
+		c = lookup_commit(oid);
+		if (!c || parse_commit(c)) {
+			error("commit %s in commit-graph cannot be read",
+			      sha1_to_hex(oid));
+			errors++;
+			continue;
+		}
+		if (hashcmp(data, get_commit_tree_sha1(c)))
+			bad = error("commit-graph has wrong tree for %s",
+				    sha1_to_hex(oid));
+		if (((uint64_t)get_be32(data + 32) << 32 | get_be32(data + 36)) !=
+		    (uint64_t)c->date)
+			bad = error("commit-graph has wrong date for %s",
+				    sha1_to_hex(oid));
+
+		parents = c->parents;
+		edge = get_be32(data + 20);
+		if (edge != GRAPH_PARENT_NONE &&
+		    verify_graph_parent(g, edge, &parents, &max_gen))
+			bad_parents = 1;
+		edge = get_be32(data + 24);
+		if (bad_parents || edge == GRAPH_PARENT_NONE)
+			;
+		else if (!(edge & GRAPH_EXTRA_EDGES)) {
+			if (verify_graph_parent(g, edge, &parents, &max_gen))
+				bad_parents = 1;
+		} else {
+			uint32_t j = edge & ~GRAPH_EXTRA_EDGES;
+			do {
+				if (j >= g->num_extra_edges) {
+					bad_parents = 1;
+					break;
+				}
+				edge = get_be32(g->chunk_extra_edges + (size_t)j++ * 4);
+				if (verify_graph_parent(g, edge & ~GRAPH_LAST_EDGE,
+							&parents, &max_gen)) {
+					bad_parents = 1;
+					break;
+				}
+			} while (!(edge & GRAPH_LAST_EDGE));
+		}
+		if (bad_parents || parents)
+			bad = error("commit-graph has wrong parents for %s",
+				    sha1_to_hex(oid));
+
+		gen = get_be32(data + 28);
+		if (gen != (max_gen < GENERATION_NUMBER_MAX ?
+			    max_gen + 1 : GENERATION_NUMBER_MAX)) {
+			bad = error("commit-graph has wrong generation for %s",
+				    sha1_to_hex(oid));
+		}
+		if (g->chunk_bloom_indexes) {
+			struct bloom_filter stored, computed;
+
+			if (!load_bloom_filter(g, i, &stored))
+				bad = error("commit-graph has a bad changed-path filter index for %s",
+					    sha1_to_hex(oid));
+			else {
+				compute_bloom_filter(c, &computed, &g->bloom_settings);
+				if (stored.len != computed.len ||
+				    memcmp(stored.data, computed.data, stored.len))
+					bad = error("commit-graph has wrong changed-path filter for %s",
+						    sha1_to_hex(oid));
+				free(computed.data);
+			}
+		}
+		if (bad)
+			errors++;
+	}
+
+	free_commit_graph(g);
+	return errors;
+}
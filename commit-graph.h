@@ -0,0 +1,128 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * A commit-graph file records, for every commit reachable from the refs
+ * at the time it was written, the commit's root tree, parents,
+ * committer date and generation number.  parse_commit() fills a struct
+ * commit from it without inflating the commit object.  See
+ * Documentation/technical/commit-graph-format.txt for the format.
+ */
+
+#include "bloom.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_VERSION_CHANGED_PATHS 2 /* v1 plus changed-path filters */
+#define GRAPH_HEADER_SIZE 16
+#define GRAPH_DATA_WIDTH 40 /* tree, two parents, generation, date */
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES 0x80000000
+#define GRAPH_LAST_EDGE 0x80000000
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_commits;
+	uint32_t num_extra_edges;
+
+	const uint32_t *chunk_fanout;
+	const unsigned char *chunk_oids;
+	const unsigned char *chunk_data;
+	const unsigned char *chunk_extra_edges;
+
+	/* only in GRAPH_VERSION_CHANGED_PATHS files */
+	struct bloom_filter_settings bloom_settings;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t bloom_data_len;
+};
+
+extern char *get_commit_graph_filename(const char *object_dir);
+
+/*
+ * Grafts, shallow boundaries and replacement objects all change the
+ * parents a commit appears to have, and the graph only knows about the
+ * real ones; do not use it at all when any of them are in effect.  The
+ * same holds for anything else recorded about the commit history.
+ */
+extern int commit_graph_compatible(void);
+
+/*
+ * Load and sanity-check the commit-graph file "graph_file"; returns
+ * NULL if there is none or it is unusable.
+ */
+extern struct commit_graph *load_commit_graph_one(const char *graph_file);
+extern void free_commit_graph(struct commit_graph *g);
+
+/*
+ * If core.commitGraph is set and the repository's commit-graph file
+ * knows about "item", fill in its parents, date and generation and
+ * mark it parsed.  The tree is left for get_commit_tree() to look up,
+ * so that walks that never look at trees do not allocate them.  Returns 1 if it did, 0 if the caller has to
+ * parse the commit object itself.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Return the tree the commit-graph file records for "item", or NULL if
+ * the file does not know about it.
+ */
+extern struct tree *get_commit_tree_in_graph(const struct commit *item);
+
+/*
+ * Return the generation number the commit-graph file records for
+ * "item", or GENERATION_NUMBER_INFINITY if it has none.  Used for
+ * commits parsed from the object store, so that the generation numbers
+ * of all commits stay consistent with each other.
+ */
+extern uint32_t commit_graph_generation(const struct commit *item);
+
+/*
+ * Is there a usable commit-graph file, i.e. can the generation numbers
+ * of commits be trusted to be finite for most of the history?
+ */
+extern int generation_numbers_enabled(void);
+
+/*
+ * If the commit-graph file has a changed-path filter for "item"
+ * relative to "parent", its first parent, point "filter" at it and
+ * return the settings it was written with; otherwise return NULL.
+ */
+extern const struct bloom_filter_settings *get_changed_paths_filter(
+	const struct commit *item, const struct commit *parent,
+	struct bloom_filter *filter);
+
+/*
+ * Forget about the commit-graph file loaded by parse_commit_in_graph(),
+ * e.g. because it is about to be replaced.
+ */
+extern void close_commit_graph(void);
+
+#define COMMIT_GRAPH_CHANGED_PATHS (1 << 0)
+
+/*
+ * Write a commit-graph file for all commits reachable from the refs of
+ * the current repository into "object_dir"/info/commit-graph, with
+ * changed-path filters if COMMIT_GRAPH_CHANGED_PATHS is in "flags".
+ * Returns 0 on success.
+ */
+extern int write_commit_graph(const char *object_dir, unsigned flags);
+
+/*
+ * Does the commit-graph file in "object_dir" have changed-path
+ * filters?
+ */
+extern int commit_graph_has_changed_paths(const char *object_dir);
+
+/*
+ * Check the commit-graph file of "object_dir" against the commit
+ * objects it describes; returns the number of problems found.
+ */
+extern int verify_commit_graph(const char *object_dir);
+
+extern void clear_commit_graph(const char *object_dir);
+
+#endif
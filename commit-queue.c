@@ -0,0 +1,74 @@
+#include "cache.h"
+#include "commit.h"
+#include "commit-queue.h"
+
+/* Whether the entry a comes out of the queue before b. */
+static inline int comes_first(const struct commit_queue_entry *a,
+			      const struct commit_queue_entry *b)
+{
+	if (a->date != b->date)
+		return a->date > b->date;
+	return a->ctr < b->ctr;
+}
+
+void commit_queue_put(struct commit_queue *queue, struct commit *commit)
+{
+	struct commit_queue_entry entry;
+	int ix, parent;
+
+	entry.date = commit->date;
+	entry.ctr = queue->insertion_ctr++;
+	entry.commit = commit;
+
+	/* Move parents down until the slot for the new one is found */
+	ALLOC_GROW(queue->array, queue->nr + 1, queue->alloc);
+	for (ix = queue->nr++; ix; ix = parent) {
+		parent = (ix - 1) / 4;
+		if (!comes_first(&entry, &queue->array[parent]))
+			break;
+		queue->array[ix] = queue->array[parent];
+	}
+	queue->array[ix] = entry;
+}
+
+struct commit *commit_queue_get(struct commit_queue *queue)
+{
+	struct commit *result;
+	struct commit_queue_entry last;
+	int ix, child, i, end;
+
+	if (!queue->nr)
+		return NULL;
+
+	result = queue->array[0].commit;
+	if (!--queue->nr)
+		return result;
+
+	/* Move the first of the children up until "last" fits */
+	last = queue->array[queue->nr];
+	for (ix = 0; (child = ix * 4 + 1) < queue->nr; ix = child) {
+		end = child + 4 < queue->nr ? child + 4 : queue->nr;
+		for (i = child + 1; i < end; i++)
+			if (comes_first(&queue->array[i], &queue->array[child]))
+				child = i;
+		if (!comes_first(&queue->array[child], &last))
+			break;
+		queue->array[ix] = queue->array[child];
+	}
+	queue->array[ix] = last;
+	return result;
+}
+
+struct commit *commit_queue_peek(struct commit_queue *queue)
+{
+	return queue->nr ? queue->array[0].commit : NULL;
+}
+
+void clear_commit_queue(struct commit_queue *queue)
+{
+	free(queue->array);
+	queue->nr = 0;
+	queue->alloc = 0;
+	queue->array = NULL;
+	queue->insertion_ctr = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef COMMIT_QUEUE_H
+#define COMMIT_QUEUE_H
+
+/*
+ * A priority queue of commits, newest committer date first and, among
+ * commits with the same date, first in first out, i.e. the order in
+ * which commit_list_insert_by_date() keeps a list.  Unlike struct
+ * prio_queue, the dates are kept inline in the queue, so that ordering
+ * the queue never looks at the commits themselves, and the heap is
+ * 4-ary, which halves its depth and keeps the children of a node in a
+ * single cache line or two.
+ */
+
+struct commit;
+
+struct commit_queue_entry {
+	unsigned long date;
+	unsigned ctr;
+	struct commit *commit;
+};
+
+struct commit_queue {
+	int nr, alloc;
+	unsigned insertion_ctr;
+	/* in heap order; callers may scan it, in no particular order */
+	struct commit_queue_entry *array;
+};
+
+#define COMMIT_QUEUE_INIT { 0, 0, 0, NULL }
+
+extern void commit_queue_put(struct commit_queue *, struct commit *);
+
+/* Remove and return the newest commit, or NULL if the queue is empty. */
+extern struct commit *commit_queue_get(struct commit_queue *);
+
+/* Return what commit_queue_get() would return, without removing it. */
+extern struct commit *commit_queue_peek(struct commit_queue *);
+
+extern void clear_commit_queue(struct commit_queue *);
+
+#endif /* COMMIT_QUEUE_H */
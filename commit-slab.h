@@ -17,6 +17,11 @@
  *   This function locates the data associated with the given commit in
  *   the indegree slab, and returns the pointer to it.
  *
+ * - int *indegree_peek(struct indegree *, struct commit *);
+ *
+ *   Like indegree_at(), but returns NULL instead of allocating when
+ *   nothing has been stored for the commit yet.
+ *
  * - void init_indegree(struct indegree *);
  *   void init_indegree_with_stride(struct indegree *, int);
  *
@@ -42,7 +47,14 @@
 
 #define MAYBE_UNUSED __attribute__((__unused__))
 
-#define define_commit_slab(slabname, elemtype) 				\
+#define define_commit_slab(slabname, elemtype) \
+	define_indexed_slab(slabname, elemtype, struct commit)
+
+/*
+ * The slab machinery works for any type of item that has an "index"
+ * member; see object-slab.h for slabs indexed by struct object.
+ */
+#define define_indexed_slab(slabname, elemtype, itemtype)		\
 									\
 struct slabname {							\
 	unsigned slab_size;						\
@@ -81,7 +93,7 @@ static MAYBE_UNUSED void clear_ ##slabname(struct slabname *s)		\
 }									\
 									\
 static MAYBE_UNUSED elemtype *slabname## _at(struct slabname *s,	\
-				       const struct commit *c)		\
+				       const itemtype *c)		\
 {									\
 	int nth_slab, nth_slot;						\
 									\
@@ -102,6 +114,19 @@ static MAYBE_UNUSED elemtype *slabname## _at(struct slabname *s,	\
 	return &s->slab[nth_slab][nth_slot * s->stride];				\
 }									\
 									\
+static MAYBE_UNUSED elemtype *slabname## _peek(struct slabname *s,	\
+					 const itemtype *c)	\
+{									\
+	int nth_slab, nth_slot;						\
+									\
+	nth_slab = c->index / s->slab_size;				\
+	nth_slot = c->index % s->slab_size;				\
+									\
+	if (s->slab_count <= nth_slab || !s->slab[nth_slab])		\
+		return NULL;						\
+	return &s->slab[nth_slab][nth_slot * s->stride];		\
+}									\
+									\
 static int stat_ ##slabname## realloc
 
 /*
@@ -11,6 +11,10 @@
 #include "commit-slab.h"
 #include "prio-queue.h"
 #include "sha1-lookup.h"
+#include "commit-graph.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+#include "merge-base-cache.h"
 
 static struct commit_extra_header *read_commit_extra_header_lines(const char *buf, size_t len, const char **);
 
@@ -277,6 +281,41 @@ void unuse_commit_buffer(const struct commit *commit, const void *buffer)
 		free((void *)buffer);
 }
 
+static struct tree *read_commit_tree(const struct commit *commit)
+{
+	unsigned long size;
+	const char *buffer = get_commit_buffer(commit, &size);
+	unsigned char sha1[20];
+	struct tree *tree = NULL;
+
+	if (size > 45 && starts_with(buffer, "tree ") &&
+	    !get_sha1_hex(buffer + 5, sha1))
+		tree = lookup_tree(sha1);
+	unuse_commit_buffer(commit, buffer);
+	return tree;
+}
+
+struct tree *get_commit_tree(const struct commit *commit)
+{
+	struct tree *tree;
+
+	if (commit->maybe_tree || !commit->object.parsed)
+		return commit->maybe_tree;
+
+	/* parsed from the commit-graph, which does not fill in the tree */
+	tree = get_commit_tree_in_graph(commit);
+	if (!tree)
+		tree = read_commit_tree(commit);
+	((struct commit *)commit)->maybe_tree = tree;
+	return tree;
+}
+
+const unsigned char *get_commit_tree_sha1(const struct commit *commit)
+{
+	struct tree *tree = get_commit_tree(commit);
+	return tree ? tree->object.sha1 : NULL;
+}
+
 void free_commit_buffer(struct commit *commit)
 {
 	struct commit_buffer *v = buffer_slab_at(&buffer_slab, commit);
@@ -319,7 +358,7 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 	if (get_sha1_hex(bufptr + 5, parent.hash) < 0)
 		return error("bad tree pointer in commit %s",
 			     sha1_to_hex(item->object.sha1));
-	item->tree = lookup_tree(parent.hash);
+	item->maybe_tree = lookup_tree(parent.hash);
 	bufptr += tree_entry_len + 1; /* "tree " + "hex sha1" + "\n" */
 	pptr = &item->parents;
 
@@ -353,6 +392,7 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 		}
 	}
 	item->date = parse_commit_date(bufptr, tail);
+	item->generation = commit_graph_generation(item);
 
 	return 0;
 }
@@ -368,6 +408,8 @@ int parse_commit_gently(struct commit *item, int quiet_on_missing)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	if (parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return quiet_on_missing ? -1 :
@@ -586,8 +628,8 @@ define_commit_slab(indegree_slab, int);
 /* record author-date for each commit object */
 define_commit_slab(author_date_slab, unsigned long);
 
-static void record_author_date(struct author_date_slab *author_date,
-			       struct commit *commit)
+void record_author_date(struct author_date_slab *author_date,
+			struct commit *commit)
 {
 	const char *buffer = get_commit_buffer(commit, NULL);
 	struct ident_split ident;
@@ -612,8 +654,8 @@ fail_exit:
 	unuse_commit_buffer(commit, buffer);
 }
 
-static int compare_commits_by_author_date(const void *a_, const void *b_,
-					  void *cb_data)
+int compare_commits_by_author_date(const void *a_, const void *b_,
+				   void *cb_data)
 {
 	const struct commit *a = a_, *b = b_;
 	struct author_date_slab *author_date = cb_data;
@@ -774,13 +816,37 @@ static int queue_has_nonstale(struct prio_queue *queue)
 	return 0;
 }
 
-/* all input commits in one and twos[] must have been parsed! */
-static struct commit_list *paint_down_to_common(struct commit *one, int n, struct commit **twos)
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused)
+{
+	const struct commit *a = a_, *b = b_;
+
+	/* higher generation (i.e. closer to the tips) first */
+	if (a->generation < b->generation)
+		return 1;
+	else if (a->generation > b->generation)
+		return -1;
+	return compare_commits_by_commit_date(a_, b_, unused);
+}
+
+/*
+ * all input commits in one and twos[] must have been parsed!
+ *
+ * With a non-zero "min_generation", commits are visited in generation
+ * order and the walk stops at the first one whose generation is below
+ * it; only callers that do not need the full set of merge bases (e.g.
+ * a reachability test for a commit of that generation) may ask for it.
+ */
+static struct commit_list *paint_down_to_common(struct commit *one, int n,
+						struct commit **twos,
+						uint32_t min_generation)
 {
 	struct prio_queue queue = { compare_commits_by_commit_date };
 	struct commit_list *result = NULL;
 	int i;
 
+	if (min_generation)
+		queue.compare = compare_commits_by_gen_then_commit_date;
+
 	one->object.flags |= PARENT1;
 	if (!n) {
 		commit_list_append(one, &result);
@@ -798,6 +864,9 @@ static struct commit_list *paint_down_to_common(struct commit *one, int n, struc
 		struct commit_list *parents;
 		int flags;
 
+		if (commit->generation < min_generation)
+			break;
+
 		flags = commit->object.flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->object.flags & RESULT)) {
@@ -846,7 +915,7 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 			return NULL;
 	}
 
-	list = paint_down_to_common(one, n, twos);
+	list = paint_down_to_common(one, n, twos, 0);
 
 	while (list) {
 		struct commit_list *next = list->next;
@@ -885,6 +954,15 @@ struct commit_list *get_octopus_merge_bases(struct commit_list *in)
 	return ret;
 }
 
+/*
+ * For remove_redundant(): which of the input commits reach a commit,
+ * one bit for each of them.
+ */
+define_commit_slab(reach_bits_slab, uint32_t);
+
+#define REACH_QUEUED PARENT1 /* in the queue of remove_redundant() */
+#define REACH_SEEN   PARENT2 /* has reach bits */
+
 static int remove_redundant(struct commit **array, int cnt)
 {
 	/*
@@ -892,42 +970,109 @@ static int remove_redundant(struct commit **array, int cnt)
 	 * another commit.  Move such commit to the end of
 	 * the array, and return the number of commits that
 	 * are independent from each other.
+	 *
+	 * This is done in a single walk down from all of them, in
+	 * which every commit collects the bits of the input commits
+	 * that reach it: an input commit that collects a bit other
+	 * than its own is redundant.  The parents of a commit that
+	 * all of the input reaches cannot be in the input, so the
+	 * walk can stop once only such commits are left, or once it
+	 * gets below the lowest generation in the input.
 	 */
+	struct reach_bits_slab reach;
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
 	struct commit **work;
 	unsigned char *redundant;
-	int *filled_index;
-	int i, j, filled;
-
-	work = xcalloc(cnt, sizeof(*work));
-	redundant = xcalloc(cnt, 1);
-	filled_index = xmalloc(sizeof(*filled_index) * (cnt - 1));
+	int words = (cnt + 31) / 32;
+	uint32_t *all, min_generation = GENERATION_NUMBER_INFINITY;
+	int i, j, filled, nonfull = 0;
 
+	init_reach_bits_slab_with_stride(&reach, words);
+	all = xcalloc(words, sizeof(*all));
 	for (i = 0; i < cnt; i++)
-		parse_commit(array[i]);
-	for (i = 0; i < cnt; i++) {
-		struct commit_list *common;
+		all[i / 32] |= 1u << (i % 32);
 
-		if (redundant[i])
+	for (i = 0; i < cnt; i++) {
+		struct commit *c = array[i];
+
+		parse_commit(c);
+		reach_bits_slab_at(&reach, c)[i / 32] |= 1u << (i % 32);
+		c->object.flags |= REACH_SEEN;
+		if (c->generation < min_generation)
+			min_generation = c->generation;
+		if (c->object.flags & REACH_QUEUED)
 			continue;
-		for (j = filled = 0; j < cnt; j++) {
-			if (i == j || redundant[j])
+		c->object.flags |= REACH_QUEUED;
+		prio_queue_put(&queue, c);
+		nonfull++;
+	}
+	/* the same commit given twice is queued once, and may be full */
+	for (i = 0; i < queue.nr; i++) {
+		struct commit *c = queue.array[i].data;
+		if (!memcmp(reach_bits_slab_at(&reach, c), all,
+			    words * sizeof(*all)))
+			nonfull--;
+	}
+
+	while (nonfull) {
+		struct commit *commit = prio_queue_get(&queue);
+		uint32_t *bits = reach_bits_slab_at(&reach, commit);
+		struct commit_list *parents;
+
+		commit->object.flags &= ~REACH_QUEUED;
+		if (memcmp(bits, all, words * sizeof(*all)))
+			nonfull--;
+		if (commit->generation < min_generation)
+			break;
+
+		for (parents = commit->parents; parents; parents = parents->next) {
+			struct commit *p = parents->item;
+			uint32_t *pbits;
+			int changed = 0, was_full;
+
+			if (parse_commit(p))
+				continue;
+			pbits = reach_bits_slab_at(&reach, p);
+			was_full = !memcmp(pbits, all, words * sizeof(*all));
+			for (j = 0; j < words; j++) {
+				if (bits[j] & ~pbits[j]) {
+					pbits[j] |= bits[j];
+					changed = 1;
+				}
+			}
+			if (!changed)
 				continue;
-			filled_index[filled] = j;
-			work[filled++] = array[j];
+			p->object.flags |= REACH_SEEN;
+			if (p->object.flags & REACH_QUEUED) {
+				if (!was_full &&
+				    !memcmp(pbits, all, words * sizeof(*all)))
+					nonfull--;
+				continue;
+			}
+			p->object.flags |= REACH_QUEUED;
+			prio_queue_put(&queue, p);
+			if (memcmp(pbits, all, words * sizeof(*all)))
+				nonfull++;
 		}
-		common = paint_down_to_common(array[i], filled, work);
-		if (array[i]->object.flags & PARENT2)
-			redundant[i] = 1;
-		for (j = 0; j < filled; j++)
-			if (work[j]->object.flags & PARENT1)
-				redundant[filled_index[j]] = 1;
-		clear_commit_marks(array[i], all_flags);
-		for (j = 0; j < filled; j++)
-			clear_commit_marks(work[j], all_flags);
-		free_commit_list(common);
 	}
 
+	redundant = xcalloc(cnt, 1);
+	for (i = 0; i < cnt; i++) {
+		uint32_t *bits = reach_bits_slab_at(&reach, array[i]);
+		for (j = 0; j < words; j++) {
+			uint32_t own = (j == i / 32) ? 1u << (i % 32) : 0;
+			if (bits[j] & ~own)
+				redundant[i] = 1;
+		}
+	}
+
+	clear_commit_marks_many(cnt, array, REACH_QUEUED | REACH_SEEN);
+	clear_prio_queue(&queue);
+	clear_reach_bits_slab(&reach);
+	free(all);
+
 	/* Now collect the result */
+	work = xmalloc(cnt * sizeof(*work));
 	memcpy(work, array, sizeof(*array) * cnt);
 	for (i = filled = 0; i < cnt; i++)
 		if (!redundant[i])
@@ -937,14 +1082,13 @@ static int remove_redundant(struct commit **array, int cnt)
 			array[j++] = work[i];
 	free(work);
 	free(redundant);
-	free(filled_index);
 	return filled;
 }
 
-static struct commit_list *get_merge_bases_many_0(struct commit *one,
-						  int n,
-						  struct commit **twos,
-						  int cleanup)
+static struct commit_list *compute_merge_bases(struct commit *one,
+					       int n,
+					       struct commit **twos,
+					       int cleanup)
 {
 	struct commit_list *list;
 	struct commit **rslt;
@@ -982,6 +1126,21 @@ static struct commit_list *get_merge_bases_many_0(struct commit *one,
 	return result;
 }
 
+static struct commit_list *get_merge_bases_many_0(struct commit *one,
+						  int n,
+						  struct commit **twos,
+						  int cleanup)
+{
+	struct commit_list *result;
+
+	if (n == 1 && merge_base_cache_lookup(one, twos[0], &result))
+		return result;
+	result = compute_merge_bases(one, n, twos, cleanup);
+	if (n == 1)
+		merge_base_cache_store(one, twos[0], result);
+	return result;
+}
+
 struct commit_list *get_merge_bases_many(struct commit *one,
 					 int n,
 					 struct commit **twos)
@@ -1019,6 +1178,117 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	return 0;
 }
 
+/*
+ * Is the candidate one of the wanted commits, or does what is already
+ * known answer the question?  Return CONTAINS_UNKNOWN if its parents
+ * have to be looked at.  A candidate whose generation is below "cutoff"
+ * cannot reach any of the wanted commits.
+ */
+static enum contains_result contains_test(struct commit *candidate,
+					  const struct commit_list *want,
+					  struct contains_cache *cache,
+					  uint32_t cutoff)
+{
+	enum contains_result *cached = contains_cache_at(cache, candidate);
+	const struct commit_list *w;
+	int unknown = 0;
+
+	if (*cached)
+		return *cached;
+
+	for (w = want; w; w = w->next)
+		if (w->item == candidate)
+			return *cached = CONTAINS_YES;
+
+	if (parse_commit(candidate) < 0 || candidate->generation < cutoff)
+		return *cached = CONTAINS_NO;
+
+	for (w = want; w; w = w->next) {
+		int reaches = bitmap_commit_reaches(candidate->object.sha1,
+						    w->item->object.sha1);
+		if (reaches > 0)
+			return *cached = CONTAINS_YES;
+		if (reaches < 0)
+			unknown = 1;
+	}
+	if (!unknown)
+		return *cached = CONTAINS_NO;
+
+	return CONTAINS_UNKNOWN;
+}
+
+/*
+ * Mimicking the real stack, this stack lives on the heap, avoiding stack
+ * overflows.
+ *
+ * At each recursion step, the stack items points to the commits whose
+ * ancestors are to be inspected.
+ */
+struct contains_stack {
+	int nr, alloc;
+	struct contains_stack_entry {
+		struct commit *commit;
+		struct commit_list *parents;
+	} *contains_stack;
+};
+
+static void push_to_contains_stack(struct commit *candidate,
+				   struct contains_stack *stack)
+{
+	ALLOC_GROW(stack->contains_stack, stack->nr + 1, stack->alloc);
+	stack->contains_stack[stack->nr].commit = candidate;
+	stack->contains_stack[stack->nr++].parents = candidate->parents;
+}
+
+int commit_contains(struct commit *candidate, const struct commit_list *want,
+		    struct contains_cache *cache)
+{
+	struct contains_stack stack = { 0, 0, NULL };
+	const struct commit_list *c;
+	uint32_t cutoff = GENERATION_NUMBER_INFINITY;
+	enum contains_result result;
+
+	for (c = want; c; c = c->next) {
+		parse_commit(c->item);
+		if (c->item->generation < cutoff)
+			cutoff = c->item->generation;
+	}
+
+	result = contains_test(candidate, want, cache, cutoff);
+	if (result != CONTAINS_UNKNOWN)
+		return result == CONTAINS_YES;
+
+	push_to_contains_stack(candidate, &stack);
+	while (stack.nr) {
+		struct contains_stack_entry *entry = &stack.contains_stack[stack.nr - 1];
+		struct commit *commit = entry->commit;
+		struct commit_list *parents = entry->parents;
+
+		if (!parents) {
+			*contains_cache_at(cache, commit) = CONTAINS_NO;
+			stack.nr--;
+		}
+		/*
+		 * If we just popped the stack, parents->item has been marked,
+		 * therefore contains_test will return a meaningful yes or no.
+		 */
+		else switch (contains_test(parents->item, want, cache, cutoff)) {
+		case CONTAINS_YES:
+			*contains_cache_at(cache, commit) = CONTAINS_YES;
+			stack.nr--;
+			break;
+		case CONTAINS_NO:
+			entry->parents = parents->next;
+			break;
+		case CONTAINS_UNKNOWN:
+			push_to_contains_stack(parents->item, &stack);
+			break;
+		}
+	}
+	free(stack.contains_stack);
+	return contains_test(candidate, want, cache, cutoff) == CONTAINS_YES;
+}
+
 /*
  * Is "commit" an ancestor of one of the "references"?
  */
@@ -1026,19 +1296,41 @@ int in_merge_bases_many(struct commit *commit, int nr_reference, struct commit *
 {
 	struct commit_list *bases;
 	int ret = 0, i;
+	uint32_t max_generation = 0;
 
 	if (parse_commit(commit))
 		return ret;
-	for (i = 0; i < nr_reference; i++)
+	for (i = 0; i < nr_reference; i++) {
 		if (parse_commit(reference[i]))
 			return ret;
+		if (reference[i]->generation > max_generation)
+			max_generation = reference[i]->generation;
+	}
+
+	/* an ancestor never has a higher generation than its descendants */
+	if (commit->generation > max_generation)
+		return ret;
 
-	bases = paint_down_to_common(commit, nr_reference, reference);
+	/* an ancestor is the only merge base it has with a descendant */
+	if (nr_reference == 1 &&
+	    merge_base_cache_lookup(commit, reference[0], &bases)) {
+		ret = bases && !bases->next && bases->item == commit;
+		free_commit_list(bases);
+		return ret;
+	}
+
+	bases = paint_down_to_common(commit, nr_reference, reference,
+				     commit->generation);
 	if (commit->object.flags & PARENT2)
 		ret = 1;
 	clear_commit_marks(commit, all_flags);
 	clear_commit_marks_many(nr_reference, reference, all_flags);
 	free_commit_list(bases);
+
+	if (ret && nr_reference == 1) {
+		struct commit_list self = { commit, NULL };
+		merge_base_cache_store(commit, reference[0], &self);
+	}
 	return ret;
 }
 
@@ -1050,6 +1342,306 @@ int in_merge_bases(struct commit *commit, struct commit *reference)
 	return in_merge_bases_many(commit, 1, &reference);
 }
 
+/*
+ * For in_merge_bases_batch(): two rows of bits per queued commit, the
+ * pairs whose reference reaches it and the pairs whose commit does,
+ * and whether it is the commit of any pair.
+ */
+struct batch_bits {
+	uint32_t *bits;
+	int target;
+};
+define_commit_slab(batch_bits_slab, struct batch_bits);
+
+static int batch_bits_empty(const uint32_t *bits, int words)
+{
+	int j;
+
+	for (j = 0; j < words; j++)
+		if (bits[j])
+			return 0;
+	return 1;
+}
+
+static uint32_t *batch_bits_get(struct batch_bits_slab *slab,
+				struct prio_queue *queue,
+				struct commit *commit, int words)
+{
+	struct batch_bits *b = batch_bits_slab_at(slab, commit);
+
+	if (!b->bits) {
+		b->bits = xcalloc(2 * words, sizeof(*b->bits));
+		prio_queue_put(queue, commit);
+	}
+	return b->bits;
+}
+
+/*
+ * Set result[i] to in_merge_bases(commit[i], reference[i]) for each of
+ * the nr pairs, walking the history once for all of them instead of
+ * once per pair.  Each pair gets a bit that is carried down from its
+ * reference, and another carried down from its commit; the pair is a
+ * fast-forward if the first bit arrives at the commit itself.  Below a
+ * commit that has both bits the first one is dropped: such a commit is
+ * an ancestor of the commit of the pair, which it therefore cannot
+ * lead to.  The walk ends when no commit in the queue carries a bit of
+ * the first kind, or all pairs are answered.
+ */
+void in_merge_bases_batch(int nr, struct commit **commit,
+			  struct commit **reference, int *result)
+{
+	struct batch_bits_slab slab;
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	int words = (nr + 31) / 32;
+	uint32_t *done, *bits;
+	int i, j, left = 0, live = 0;
+
+	init_batch_bits_slab(&slab);
+	done = xcalloc(words, sizeof(*done));
+
+	for (i = 0; i < nr; i++) {
+		result[i] = -1;
+		if (parse_commit(commit[i]) || parse_commit(reference[i]))
+			result[i] = 0;
+		else if (commit[i] == reference[i])
+			result[i] = 1;
+		/* an ancestor never has a higher generation than its descendants */
+		else if (commit[i]->generation > reference[i]->generation)
+			result[i] = 0;
+		else
+			result[i] = bitmap_commit_reaches(reference[i]->object.sha1,
+							  commit[i]->object.sha1);
+		if (result[i] >= 0) {
+			done[i / 32] |= 1u << (i % 32);
+			continue;
+		}
+
+		left++;
+		bits = batch_bits_get(&slab, &queue, reference[i], words);
+		if (batch_bits_empty(bits, words))
+			live++;
+		bits[i / 32] |= 1u << (i % 32);
+		bits = batch_bits_get(&slab, &queue, commit[i], words);
+		bits[words + i / 32] |= 1u << (i % 32);
+		batch_bits_slab_at(&slab, commit[i])->target = 1;
+	}
+
+	while (live && left) {
+		struct commit *c = prio_queue_get(&queue);
+		struct batch_bits *b = batch_bits_slab_at(&slab, c);
+		struct commit_list *parents;
+		uint32_t *down, *up;
+		int any = 0;
+
+		bits = b->bits;
+		b->bits = NULL;
+		down = bits;
+		up = bits + words;
+		if (!batch_bits_empty(down, words))
+			live--;
+
+		for (j = 0; j < words; j++) {
+			uint32_t word;
+
+			down[j] &= ~done[j];
+			for (word = b->target ? down[j] : 0; word; word &= word - 1) {
+				i = j * 32 + ewah_bit_ctz64(word);
+				if (commit[i] == c) {
+					result[i] = 1;
+					done[j] |= 1u << (i % 32);
+					left--;
+				}
+			}
+			up[j] &= ~done[j];
+			down[j] &= ~(done[j] | up[j]);
+			if (c->generation != GENERATION_NUMBER_INFINITY) {
+				for (word = down[j]; word; word &= word - 1) {
+					i = j * 32 + ewah_bit_ctz64(word);
+					if (c->generation < commit[i]->generation)
+						down[j] &= ~(1u << (i % 32));
+				}
+			}
+			if (down[j] || up[j])
+				any = 1;
+		}
+
+		for (parents = any ? c->parents : NULL; parents; parents = parents->next) {
+			struct commit *p = parents->item;
+			uint32_t *pbits;
+			int was_live;
+
+			if (parse_commit(p))
+				continue;
+			pbits = batch_bits_get(&slab, &queue, p, words);
+			was_live = !batch_bits_empty(pbits, words);
+			for (j = 0; j < 2 * words; j++)
+				pbits[j] |= bits[j];
+			if (!was_live && !batch_bits_empty(pbits, words))
+				live++;
+		}
+		free(bits);
+	}
+
+	while (queue.nr) {
+		struct commit *c = prio_queue_get(&queue);
+		free(batch_bits_slab_at(&slab, c)->bits);
+	}
+	clear_prio_queue(&queue);
+	clear_batch_bits_slab(&slab);
+	free(done);
+
+	for (i = 0; i < nr; i++)
+		if (result[i] < 0)
+			result[i] = 0;
+}
+
+/*
+ * count_ahead_behind() needs the commits in strict generation order,
+ * also those made since the commit-graph was written; these get one
+ * more than their highest parent here, as the graph would give them.
+ */
+define_commit_slab(walk_generation_slab, uint32_t);
+
+static uint32_t walk_generation(struct walk_generation_slab *slab,
+				const struct commit *c)
+{
+	if (c->generation != GENERATION_NUMBER_INFINITY)
+		return c->generation;
+	return *walk_generation_slab_at(slab, c);
+}
+
+static int compute_walk_generations(struct walk_generation_slab *slab,
+				    struct commit *tip)
+{
+	struct commit_list *stack = NULL;
+
+	commit_list_insert(tip, &stack);
+	while (stack) {
+		struct commit *c = stack->item;
+		struct commit_list *p;
+		uint32_t max = 0;
+		int missing = 0;
+
+		if (walk_generation(slab, c)) {
+			pop_commit(&stack);
+			continue;
+		}
+		for (p = c->parents; p; p = p->next) {
+			uint32_t gen;
+
+			if (parse_commit(p->item)) {
+				free_commit_list(stack);
+				return -1;
+			}
+			gen = walk_generation(slab, p->item);
+			if (!gen) {
+				commit_list_insert(p->item, &stack);
+				missing = 1;
+			} else if (gen > max)
+				max = gen;
+		}
+		if (missing)
+			continue;
+		pop_commit(&stack);
+		*walk_generation_slab_at(slab, c) =
+			max < GENERATION_NUMBER_MAX ? max + 1 : GENERATION_NUMBER_MAX;
+	}
+	return 0;
+}
+
+static int compare_commits_by_walk_generation(const void *a_, const void *b_,
+					      void *slab)
+{
+	uint32_t a = walk_generation(slab, a_), b = walk_generation(slab, b_);
+
+	if (a < b)
+		return 1;
+	else if (a > b)
+		return -1;
+	return compare_commits_by_commit_date(a_, b_, NULL);
+}
+
+static int queue_tips(struct prio_queue *queue, int nr, struct commit **tips,
+		      unsigned flag)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (parse_commit(tips[i]) ||
+		    compute_walk_generations(queue->cb_data, tips[i]))
+			return -1;
+		tips[i]->object.flags |= flag;
+		prio_queue_put(queue, tips[i]);
+	}
+	return 0;
+}
+
+int count_ahead_behind(int nr_one, struct commit **one,
+		       int nr_two, struct commit **two,
+		       int *num_one, int *num_two)
+{
+	struct walk_generation_slab slab;
+	struct prio_queue queue = { compare_commits_by_walk_generation };
+	int ret = 0;
+
+	if (nr_one == 1 && nr_two == 1 &&
+	    !bitmap_ahead_behind(one[0]->object.sha1, two[0]->object.sha1,
+				 num_one, num_two))
+		return 0;
+	if (!generation_numbers_enabled())
+		return -1;
+
+	init_walk_generation_slab(&slab);
+	queue.cb_data = &slab;
+	*num_one = *num_two = 0;
+	if (queue_tips(&queue, nr_one, one, PARENT1) ||
+	    queue_tips(&queue, nr_two, two, PARENT2))
+		ret = -1;
+
+	/*
+	 * Going by generation, every descendant of a commit is done
+	 * before it, so its flags are final by the time it comes out
+	 * of the queue; once only commits reachable from both sides
+	 * are left, nothing more can be counted.
+	 */
+	while (!ret && queue_has_nonstale(&queue)) {
+		struct commit *commit = prio_queue_get(&queue);
+		struct commit_list *parents;
+		unsigned flags;
+
+		if (commit->object.flags & RESULT)
+			continue; /* queued again with more flags */
+		commit->object.flags |= RESULT;
+
+		flags = commit->object.flags & (PARENT1 | PARENT2 | STALE);
+		if (flags == PARENT1)
+			(*num_one)++;
+		else if (flags == PARENT2)
+			(*num_two)++;
+		else
+			flags |= STALE;
+
+		for (parents = commit->parents; parents; parents = parents->next) {
+			struct commit *p = parents->item;
+
+			if ((p->object.flags & flags) == flags)
+				continue;
+			if (parse_commit(p)) {
+				ret = -1;
+				break;
+			}
+			p->object.flags |= flags;
+			prio_queue_put(&queue, p);
+		}
+	}
+
+	clear_prio_queue(&queue);
+	clear_commit_marks_many(nr_one, one, all_flags);
+	clear_commit_marks_many(nr_two, two, all_flags);
+	clear_walk_generation_slab(&slab);
+	return ret;
+}
+
 struct commit_list *reduce_heads(struct commit_list *heads)
 {
 	struct commit_list *p;
@@ -7,19 +7,35 @@
 #include "decorate.h"
 #include "gpg-interface.h"
 #include "string-list.h"
+#include "commit-slab.h"
 
 struct commit_list {
 	struct commit *item;
 	struct commit_list *next;
 };
 
+/*
+ * Generation numbers come from the commit-graph file: roots have
+ * generation 1 and every other commit one more than its highest parent.
+ * Commits parsed from the object store get GENERATION_NUMBER_INFINITY.
+ */
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0xFFFFFFFE
+
 struct commit {
 	struct object object;
 	void *util;
 	unsigned int index;
+	uint32_t generation;
 	unsigned long date;
 	struct commit_list *parents;
-	struct tree *tree;
+
+	/*
+	 * The root tree, or NULL for a commit parsed from the commit-graph
+	 * whose tree has not been asked for yet; do not access it
+	 * directly, but use get_commit_tree().
+	 */
+	struct tree *maybe_tree;
 };
 
 extern int save_commit_buffer;
@@ -66,6 +82,13 @@ static inline int parse_commit(struct commit *item)
 }
 void parse_commit_or_die(struct commit *item);
 
+/*
+ * Return the root tree of a parsed commit, loading it from the
+ * commit-graph or the commit object if it has not been looked up yet.
+ */
+struct tree *get_commit_tree(const struct commit *);
+const unsigned char *get_commit_tree_sha1(const struct commit *);
+
 /*
  * Associate an object buffer with the commit. The ownership of the
  * memory is handed over to the commit, and must be free()-able.
@@ -295,6 +318,40 @@ extern struct trace_key trace_shallow;
 int is_descendant_of(struct commit *, struct commit_list *);
 int in_merge_bases(struct commit *, struct commit *);
 int in_merge_bases_many(struct commit *, int, struct commit **);
+void in_merge_bases_batch(int nr, struct commit **commit,
+			 struct commit **reference, int *result);
+
+/*
+ * Count the commits reachable from one of the "one" commits but from
+ * none of the "two" commits into "num_one", and the other way around
+ * into "num_two".  This only walks from the tips down to where the two
+ * sides meet, in generation order, or takes the counts from stored
+ * reachability bitmaps.  Returns -1 if neither a commit-graph file nor
+ * bitmaps are there to do this with, and the caller has to do the full
+ * symmetric difference walk itself.
+ */
+int count_ahead_behind(int nr_one, struct commit **one,
+		       int nr_two, struct commit **two,
+		       int *num_one, int *num_two);
+
+enum contains_result {
+	CONTAINS_UNKNOWN = 0,
+	CONTAINS_NO,
+	CONTAINS_YES
+};
+
+define_commit_slab(contains_cache, enum contains_result);
+
+/*
+ * Can one of the commits in "want" be reached from "candidate"?  Meant
+ * for filtering many refs by --contains: what is learned about the
+ * commits walked is remembered in "cache" (see commit-slab.h), which
+ * must only ever be used with the same "want" list.  Generation numbers
+ * from the commit-graph stop the walk early, and commits with a stored
+ * reachability bitmap answer without walking at all.
+ */
+int commit_contains(struct commit *candidate, const struct commit_list *want,
+		    struct contains_cache *cache);
 
 extern int interactive_add(int argc, const char **argv, const char *prefix, int patch);
 extern int run_add_interactive(const char *revision, const char *patch_mode,
@@ -382,6 +439,16 @@ extern void print_commit_list(struct commit_list *list,
 extern void check_commit_signature(const struct commit *commit, struct signature_check *sigc);
 
 int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused);
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused);
+
+/*
+ * Author dates are kept in a commit slab (see commit-slab.h); users
+ * define "author_date_slab" with an unsigned long element themselves.
+ */
+struct author_date_slab;
+void record_author_date(struct author_date_slab *author_date,
+			struct commit *commit);
+int compare_commits_by_author_date(const void *a_, const void *b_, void *author_date);
 
 LAST_ARG_MUST_BE_NULL
 extern int run_commit_hook(int editor_is_used, const char *index_file, const char *name, ...);
@@ -48,6 +48,8 @@ static int zlib_compression_seen;
  */
 static struct config_set the_config_set;
 
+static void record_config_source(const char *path);
+
 static int config_file_fgetc(struct config_source *conf)
 {
 	return getc_unlocked(conf->u.file);
@@ -127,6 +129,7 @@ static int handle_path_include(const char *path, struct config_include_data *inc
 		path = buf.buf;
 	}
 
+	record_config_source(path);
 	if (!access_or_die(path, R_OK, 0)) {
 		if (++inc->depth > MAX_INCLUDE_DEPTH)
 			die(include_depth_advice, MAX_INCLUDE_DEPTH, path,
@@ -790,6 +793,14 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.bigfilethreads")) {
+		big_file_threads = git_config_int(var, value);
+		if (big_file_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    big_file_threads);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.packedgitlimit")) {
 		packed_git_limit = git_config_ulong(var, value);
 		return 0;
@@ -800,6 +811,16 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.deltacomposedepth")) {
+		delta_compose_depth = git_config_int(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.treecachelimit")) {
+		tree_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.autocrlf")) {
 		if (value && !strcasecmp(value, "input")) {
 			if (core_eol == EOL_CRLF)
@@ -872,7 +893,10 @@ static int git_default_core_config(const char *var, const char *value)
 	}
 
 	if (!strcmp(var, "core.fsyncobjectfiles")) {
-		fsync_object_files = git_config_bool(var, value);
+		if (value && !strcasecmp(value, "batch"))
+			fsync_object_files = FSYNC_OBJECT_FILES_BATCH;
+		else
+			fsync_object_files = git_config_bool(var, value);
 		return 0;
 	}
 
@@ -881,6 +905,26 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.multipackindex")) {
+		core_multi_pack_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.commitgraph")) {
+		core_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.looseobjectcache")) {
+		core_loose_object_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.alternatescache")) {
+		core_alternates_cache = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!strcmp(value, "rename"))
 			object_creation_mode = OBJECT_CREATION_USES_RENAMES;
@@ -1184,33 +1228,54 @@ int git_config_system(void)
 	return !git_env_bool("GIT_CONFIG_NOSYSTEM", 0);
 }
 
-int git_config_early(config_fn_t fn, void *data, const char *repo_config)
+static int do_git_config_sequence(config_fn_t fn, void *data,
+				  const char *repo_config, int *found)
 {
-	int ret = 0, found = 0;
+	int ret = 0;
 	char *xdg_config = xdg_config_home("config");
 	char *user_config = expand_user_path("~/.gitconfig");
 
-	if (git_config_system() && !access_or_die(git_etc_gitconfig(), R_OK, 0)) {
-		ret += git_config_from_file(fn, git_etc_gitconfig(),
-					    data);
-		found += 1;
+	if (git_config_system()) {
+		record_config_source(git_etc_gitconfig());
+		if (!access_or_die(git_etc_gitconfig(), R_OK, 0)) {
+			ret += git_config_from_file(fn, git_etc_gitconfig(),
+						    data);
+			*found += 1;
+		}
 	}
 
+	if (xdg_config)
+		record_config_source(xdg_config);
 	if (xdg_config && !access_or_die(xdg_config, R_OK, ACCESS_EACCES_OK)) {
 		ret += git_config_from_file(fn, xdg_config, data);
-		found += 1;
+		*found += 1;
 	}
 
+	if (user_config)
+		record_config_source(user_config);
 	if (user_config && !access_or_die(user_config, R_OK, ACCESS_EACCES_OK)) {
 		ret += git_config_from_file(fn, user_config, data);
-		found += 1;
+		*found += 1;
 	}
 
+	if (repo_config)
+		record_config_source(repo_config);
 	if (repo_config && !access_or_die(repo_config, R_OK, 0)) {
 		ret += git_config_from_file(fn, repo_config, data);
-		found += 1;
+		*found += 1;
 	}
 
+	free(xdg_config);
+	free(user_config);
+	return ret;
+}
+
+int git_config_early(config_fn_t fn, void *data, const char *repo_config)
+{
+	int ret, found = 0;
+
+	ret = do_git_config_sequence(fn, data, repo_config, &found);
+
 	switch (git_config_from_parameters(fn, data)) {
 	case -1: /* error */
 		die(_("unable to parse command-line config"));
@@ -1222,8 +1287,6 @@ int git_config_early(config_fn_t fn, void *data, const char *repo_config)
 		break;
 	}
 
-	free(xdg_config);
-	free(user_config);
 	return ret == 0 ? found : ret;
 }
 
@@ -1306,7 +1369,6 @@ void git_config(config_fn_t fn, void *data)
 
 static struct config_set_element *configset_find_element(struct config_set *cs, const char *key)
 {
-	struct config_set_element k;
 	struct config_set_element *found_entry;
 	char *normalized_key;
 	int ret;
@@ -1319,14 +1381,15 @@ static struct config_set_element *configset_find_element(struct config_set *cs,
 	if (ret)
 		return NULL;
 
-	hashmap_entry_init(&k, strhash(normalized_key));
-	k.key = normalized_key;
-	found_entry = hashmap_get(&cs->config_hash, &k, NULL);
+	found_entry = oahashmap_get(&cs->config_hash, strhash(normalized_key),
+				    NULL, normalized_key);
 	free(normalized_key);
 	return found_entry;
 }
 
-static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+static int configset_add_value_info(struct config_set *cs, const char *key,
+				    const char *value, const char *filename,
+				    int linenr)
 {
 	struct config_set_element *e;
 	struct string_list_item *si;
@@ -1340,10 +1403,9 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 	 */
 	if (!e) {
 		e = xmalloc(sizeof(*e));
-		hashmap_entry_init(e, strhash(key));
 		e->key = xstrdup(key);
 		string_list_init(&e->value_list, 1);
-		hashmap_add(&cs->config_hash, e);
+		oahashmap_add(&cs->config_hash, strhash(key), e);
 	}
 	si = string_list_append_nodup(&e->value_list, xstrdup_or_null(value));
 
@@ -1352,28 +1414,31 @@ static int configset_add_value(struct config_set *cs, const char *key, const cha
 	l_item->e = e;
 	l_item->value_index = e->value_list.nr - 1;
 
-	if (cf) {
-		kv_info->filename = strintern(cf->name);
-		kv_info->linenr = cf->linenr;
-	} else {
-		/* for values read from `git_config_from_parameters()` */
-		kv_info->filename = NULL;
-		kv_info->linenr = -1;
-	}
+	kv_info->filename = filename ? strintern(filename) : NULL;
+	kv_info->linenr = linenr;
 	si->util = kv_info;
 
 	return 0;
 }
 
+static int configset_add_value(struct config_set *cs, const char *key, const char *value)
+{
+	if (cf)
+		return configset_add_value_info(cs, key, value,
+						cf->name, cf->linenr);
+	/* for values read from `git_config_from_parameters()` */
+	return configset_add_value_info(cs, key, value, NULL, -1);
+}
+
 static int config_set_element_cmp(const struct config_set_element *e1,
-				 const struct config_set_element *e2, const void *unused)
+				 const struct config_set_element *e2, const char *key)
 {
-	return strcmp(e1->key, e2->key);
+	return strcmp(e1->key, key ? key : e2->key);
 }
 
 void git_configset_init(struct config_set *cs)
 {
-	hashmap_init(&cs->config_hash, (hashmap_cmp_fn)config_set_element_cmp, 0);
+	oahashmap_init(&cs->config_hash, (hashmap_cmp_fn)config_set_element_cmp, 0);
 	cs->hash_initialized = 1;
 	cs->list.nr = 0;
 	cs->list.alloc = 0;
@@ -1383,16 +1448,16 @@ void git_configset_init(struct config_set *cs)
 void git_configset_clear(struct config_set *cs)
 {
 	struct config_set_element *entry;
-	struct hashmap_iter iter;
+	struct oahashmap_iter iter;
 	if (!cs->hash_initialized)
 		return;
 
-	hashmap_iter_init(&cs->config_hash, &iter);
-	while ((entry = hashmap_iter_next(&iter))) {
+	oahashmap_iter_init(&cs->config_hash, &iter);
+	while ((entry = oahashmap_iter_next(&iter))) {
 		free(entry->key);
 		string_list_clear(&entry->value_list, 1);
 	}
-	hashmap_free(&cs->config_hash, 1);
+	oahashmap_free(&cs->config_hash, 1);
 	cs->hash_initialized = 0;
 	free(cs->list.items);
 	cs->list.nr = 0;
@@ -1511,12 +1576,350 @@ int git_configset_get_pathname(struct config_set *cs, const char *key, const cha
 		return 1;
 }
 
+/*
+ * The configuration read from files can be kept in a snapshot,
+ * $GIT_DIR/config-cache, so that later processes do not have to parse
+ * all of the files again.  The snapshot records the stat data of every
+ * file that was consulted (including those that did not exist, and
+ * included files) and is only used while all of them are unchanged.
+ * Which files are consulted at the top level depends on the
+ * environment ($HOME, $XDG_CONFIG_HOME, GIT_CONFIG_NOSYSTEM), so the
+ * snapshot also records that list and is only used by processes that
+ * would read the very same files.  Values given on the command line
+ * are never stored in it.
+ *
+ * The file is a header (signature, version, number of sources and of
+ * entries), the top-level list (its length, then whether the system
+ * file is read and the NUL-terminated paths), the sources (stat data,
+ * a "missing" flag and the path),
+ * the entries (line number, flags, key, value and file name) and a
+ * trailing SHA-1 over everything before it.  All numbers are 32-bit
+ * in network byte order.
+ */
+#define CONFIG_SNAPSHOT_SIGNATURE 0x47435348 /* "GCSH" */
+#define CONFIG_SNAPSHOT_VERSION 2
+
+#define SNAPSHOT_NO_VALUE (1u << 0)
+#define SNAPSHOT_NO_FILENAME (1u << 1)
+
+struct config_snapshot_source {
+	struct stat_data sd;
+	int missing;
+	char *path;
+};
+
+static struct config_snapshot_sources {
+	struct config_snapshot_source *items;
+	int nr, alloc;
+} *recorded_sources;
+
+static void record_config_source(const char *path)
+{
+	struct config_snapshot_source *src;
+	struct stat st;
+
+	if (!recorded_sources)
+		return;
+	ALLOC_GROW(recorded_sources->items, recorded_sources->nr + 1,
+		   recorded_sources->alloc);
+	src = &recorded_sources->items[recorded_sources->nr++];
+	memset(src, 0, sizeof(*src));
+	src->path = xstrdup(path);
+	if (stat(path, &st))
+		src->missing = 1;
+	else
+		fill_stat_data(&src->sd, &st);
+}
+
+/* The top-level files do_git_config_sequence() reads, in order */
+static void config_snapshot_toplevel(struct strbuf *sb,
+				     const char *repo_config)
+{
+	char *xdg_config = xdg_config_home("config");
+	char *user_config = expand_user_path("~/.gitconfig");
+	int use_system = git_config_system();
+
+	strbuf_addch(sb, use_system ? 's' : 'n');
+	if (use_system)
+		strbuf_addstr(sb, git_etc_gitconfig());
+	strbuf_addch(sb, '\0');
+	strbuf_addstr(sb, xdg_config ? xdg_config : "");
+	strbuf_addch(sb, '\0');
+	strbuf_addstr(sb, user_config ? user_config : "");
+	strbuf_addch(sb, '\0');
+	strbuf_addstr(sb, repo_config ? repo_config : "");
+	strbuf_addch(sb, '\0');
+	free(xdg_config);
+	free(user_config);
+}
+
+static int config_snapshot_possible(void)
+{
+	return startup_info && startup_info->have_repository;
+}
+
+static const char *snapshot_string(const char **p, const char *end)
+{
+	const char *s = *p;
+	const char *nul = memchr(s, '\0', end - s);
+
+	if (!nul)
+		return NULL;
+	*p = nul + 1;
+	return s;
+}
+
+static int snapshot_source_unchanged(const char **p, const char *end)
+{
+	struct stat_data sd;
+	const unsigned char *u = (const unsigned char *)*p;
+	const char *path;
+	struct stat st;
+	int missing;
+
+	if (end - *p < 10 * 4)
+		return 0;
+	sd.sd_ctime.sec = get_be32(u);
+	sd.sd_ctime.nsec = get_be32(u + 4);
+	sd.sd_mtime.sec = get_be32(u + 8);
+	sd.sd_mtime.nsec = get_be32(u + 12);
+	sd.sd_dev = get_be32(u + 16);
+	sd.sd_ino = get_be32(u + 20);
+	sd.sd_uid = get_be32(u + 24);
+	sd.sd_gid = get_be32(u + 28);
+	sd.sd_size = get_be32(u + 32);
+	missing = get_be32(u + 36);
+	*p += 10 * 4;
+	path = snapshot_string(p, end);
+	if (!path)
+		return 0;
+
+	if (stat(path, &st))
+		return missing && errno == ENOENT;
+	return !missing && !match_stat_data(&sd, &st);
+}
+
+/*
+ * Fill "cs" from the snapshot if there is one that is still valid.
+ * Returns 0 on success; on failure "cs" is left untouched.
+ */
+static int read_config_snapshot(struct config_set *cs, const char *repo_config)
+{
+	const char *path = git_path("config-cache");
+	struct strbuf toplevel = STRBUF_INIT;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	const char *map, *p, *end;
+	uint32_t nr_sources, nr_entries, toplevel_len, i;
+	struct stat st;
+	size_t size;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < 16 + 20) {
+		close(fd);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	end = map + size - 20;
+	if (get_be32(map) != CONFIG_SNAPSHOT_SIGNATURE ||
+	    get_be32(map + 4) != CONFIG_SNAPSHOT_VERSION)
+		goto out;
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, map, end - map);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, (const unsigned char *)end))
+		goto out;
+
+	nr_sources = get_be32(map + 8);
+	nr_entries = get_be32(map + 12);
+	p = map + 16;
+
+	/* made by a process that would have read other files? */
+	if (end - p < 4)
+		goto out;
+	toplevel_len = get_be32(p);
+	p += 4;
+	config_snapshot_toplevel(&toplevel, repo_config);
+	if (toplevel_len != toplevel.len || end - p < toplevel_len ||
+	    memcmp(p, toplevel.buf, toplevel_len))
+		goto out;
+	p += toplevel_len;
+
+	for (i = 0; i < nr_sources; i++)
+		if (!snapshot_source_unchanged(&p, end))
+			goto out;
+
+	for (i = 0; i < nr_entries; i++) {
+		const char *key, *value, *filename;
+		uint32_t linenr, flags;
+
+		if (end - p < 8)
+			break;
+		linenr = get_be32(p);
+		flags = get_be32(p + 4);
+		p += 8;
+		key = snapshot_string(&p, end);
+		value = key ? snapshot_string(&p, end) : NULL;
+		filename = value ? snapshot_string(&p, end) : NULL;
+		if (!filename)
+			break;
+		configset_add_value_info(cs, key,
+					 (flags & SNAPSHOT_NO_VALUE) ? NULL : value,
+					 (flags & SNAPSHOT_NO_FILENAME) ? NULL : filename,
+					 (int)linenr - 1);
+	}
+	if (i < nr_entries) {
+		/* checksummed, so this is a bug in whoever wrote it */
+		git_configset_clear(cs);
+		git_configset_init(cs);
+		goto out;
+	}
+	ret = 0;
+out:
+	munmap((void *)map, size);
+	strbuf_release(&toplevel);
+	return ret;
+}
+
+static void snapshot_add_be32(struct strbuf *sb, uint32_t v)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, v);
+	strbuf_add(sb, buf, 4);
+}
+
+/*
+ * Write the first "nr" entries of "cs", which were read from the
+ * recorded sources, to the snapshot.  This is only a cache, so any
+ * failure is silently ignored.
+ */
+static void write_config_snapshot(struct config_set *cs, int nr,
+				  struct config_snapshot_sources *sources,
+				  const char *repo_config)
+{
+	static struct lock_file lock;
+	struct strbuf sb = STRBUF_INIT, toplevel = STRBUF_INIT;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	time_t now = time(NULL);
+	int i;
+
+	for (i = 0; i < sources->nr; i++) {
+		/*
+		 * A file modified within the current second could change
+		 * again without its stat data changing; do not trust a
+		 * snapshot of it.
+		 */
+		if (!sources->items[i].missing &&
+		    sources->items[i].sd.sd_mtime.sec >= (unsigned int)now)
+			return;
+	}
+
+	if (hold_lock_file_for_update(&lock, git_path("config-cache"), 0) < 0)
+		return;
+
+	snapshot_add_be32(&sb, CONFIG_SNAPSHOT_SIGNATURE);
+	snapshot_add_be32(&sb, CONFIG_SNAPSHOT_VERSION);
+	snapshot_add_be32(&sb, sources->nr);
+	snapshot_add_be32(&sb, nr);
+	config_snapshot_toplevel(&toplevel, repo_config);
+	snapshot_add_be32(&sb, toplevel.len);
+	strbuf_addbuf(&sb, &toplevel);
+	strbuf_release(&toplevel);
+	for (i = 0; i < sources->nr; i++) {
+		struct config_snapshot_source *src = &sources->items[i];
+		snapshot_add_be32(&sb, src->sd.sd_ctime.sec);
+		snapshot_add_be32(&sb, src->sd.sd_ctime.nsec);
+		snapshot_add_be32(&sb, src->sd.sd_mtime.sec);
+		snapshot_add_be32(&sb, src->sd.sd_mtime.nsec);
+		snapshot_add_be32(&sb, src->sd.sd_dev);
+		snapshot_add_be32(&sb, src->sd.sd_ino);
+		snapshot_add_be32(&sb, src->sd.sd_uid);
+		snapshot_add_be32(&sb, src->sd.sd_gid);
+		snapshot_add_be32(&sb, src->sd.sd_size);
+		snapshot_add_be32(&sb, src->missing);
+		strbuf_add(&sb, src->path, strlen(src->path) + 1);
+	}
+	for (i = 0; i < nr; i++) {
+		struct configset_list_item *item = &cs->list.items[i];
+		struct string_list_item *si =
+			&item->e->value_list.items[item->value_index];
+		struct key_value_info *kv_info = si->util;
+		uint32_t flags = 0;
+
+		if (!si->string)
+			flags |= SNAPSHOT_NO_VALUE;
+		if (!kv_info->filename)
+			flags |= SNAPSHOT_NO_FILENAME;
+		snapshot_add_be32(&sb, kv_info->linenr + 1);
+		snapshot_add_be32(&sb, flags);
+		strbuf_add(&sb, item->e->key, strlen(item->e->key) + 1);
+		strbuf_addstr(&sb, si->string ? si->string : "");
+		strbuf_addch(&sb, '\0');
+		strbuf_addstr(&sb, kv_info->filename ? kv_info->filename : "");
+		strbuf_addch(&sb, '\0');
+	}
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, sb.buf, sb.len);
+	git_SHA1_Final(sha1, &ctx);
+	strbuf_add(&sb, sha1, 20);
+
+	if (write_in_full(lock.fd, sb.buf, sb.len) != sb.len ||
+	    commit_lock_file(&lock))
+		rollback_lock_file(&lock);
+	strbuf_release(&sb);
+}
+
+static void git_config_from_snapshot_or_files(struct config_set *cs)
+{
+	struct config_snapshot_sources sources = { NULL, 0, 0 };
+	struct config_include_data inc = CONFIG_INCLUDE_INIT;
+	char *repo_config = git_pathdup("config");
+	int found = 0, enabled = 0, i;
+
+	if (read_config_snapshot(cs, repo_config)) {
+		inc.fn = config_set_callback;
+		inc.data = cs;
+		recorded_sources = &sources;
+		if (do_git_config_sequence(git_config_include, &inc,
+					   repo_config, &found) < 0)
+			die(_("unknown error occured while reading the configuration files"));
+		recorded_sources = NULL;
+
+		if (!git_configset_get_bool(cs, "core.configcache", &enabled) &&
+		    enabled)
+			write_config_snapshot(cs, cs->list.nr, &sources,
+					      repo_config);
+		for (i = 0; i < sources.nr; i++)
+			free(sources.items[i].path);
+		free(sources.items);
+	}
+	free(repo_config);
+
+	if (git_config_from_parameters(config_set_callback, cs) < 0)
+		die(_("unable to parse command-line config"));
+}
+
 static void git_config_check_init(void)
 {
+	uint64_t start;
+
 	if (the_config_set.hash_initialized)
 		return;
+	start = getnanotime();
 	git_configset_init(&the_config_set);
-	git_config_raw(config_set_callback, &the_config_set);
+	if (config_snapshot_possible())
+		git_config_from_snapshot_or_files(&the_config_set);
+	else
+		git_config_raw(config_set_callback, &the_config_set);
+	trace_performance_since(start, "read configuration");
 }
 
 void git_config_clear(void)
@@ -0,0 +1,5 @@
+NO_GETTEXT=1
+NO_TCLTK=1
+NO_OPENSSL=1
+NO_PERL=
+CFLAGS=-O1 -g -Wall
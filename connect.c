@@ -9,8 +9,12 @@
 #include "url.h"
 #include "string-list.h"
 #include "sha1-array.h"
+#include "version.h"
+#include "protocol.h"
 
 static char *server_capabilities;
+static enum protocol_version server_protocol = protocol_v0;
+static struct string_list bundle_uris = STRING_LIST_INIT_DUP;
 static const char *parse_feature_value(const char *, const char *, int *);
 
 static int check_ref(const char *name, unsigned int flags)
@@ -105,6 +109,61 @@ static void annotate_refs_with_symref_info(struct ref *ref)
 	string_list_clear(&symref, 0);
 }
 
+/*
+ * Read the rest of a protocol v2 capability advertisement, whose
+ * "version 2" line has been consumed.  What matters to us is what the
+ * "fetch" command can do, so that is what server_supports() looks at.
+ */
+static void read_capabilities_v2(int in, char **src_buf, size_t *src_len)
+{
+	struct strbuf caps = STRBUF_INIT;
+	char *agent = NULL;
+	int ls_refs = 0, fetch = 0;
+
+	for (;;) {
+		const char *arg;
+		int len = packet_read(in, src_buf, src_len,
+				      packet_buffer, sizeof(packet_buffer),
+				      PACKET_READ_GENTLE_ON_EOF |
+				      PACKET_READ_CHOMP_NEWLINE);
+		if (len < 0)
+			die_initial_contact(0);
+		if (!len)
+			break;
+		if (!strcmp(packet_buffer, "ls-refs"))
+			ls_refs = 1;
+		else if (skip_prefix(packet_buffer, "fetch=", &arg)) {
+			strbuf_addstr(&caps, arg);
+			fetch = 1;
+		} else if (!strcmp(packet_buffer, "fetch"))
+			fetch = 1;
+		else if (skip_prefix(packet_buffer, "agent=", &arg)) {
+			free(agent);
+			agent = xstrdup(arg);
+		} else if (skip_prefix(packet_buffer, "bundle-uri=", &arg))
+			string_list_append(&bundle_uris, arg);
+	}
+	if (!ls_refs || !fetch)
+		die("protocol error: server does not support ls-refs and fetch");
+
+	if (agent)
+		strbuf_addf(&caps, "%sagent=%s", caps.len ? " " : "", agent);
+	free(agent);
+	free(server_capabilities);
+	server_capabilities = strbuf_detach(&caps, NULL);
+	server_protocol = protocol_v2;
+}
+
+enum protocol_version server_protocol_version(void)
+{
+	return server_protocol;
+}
+
+const struct string_list *server_bundle_uris(void)
+{
+	return &bundle_uris;
+}
+
 /*
  * Read all the refs from the other end
  */
@@ -115,8 +174,10 @@ struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 {
 	struct ref **orig_list = list;
 	int got_at_least_one_head = 0;
+	int first = 1;
 
 	*list = NULL;
+	server_protocol = protocol_v0;
 	for (;;) {
 		struct ref *ref;
 		unsigned char old_sha1[20];
@@ -138,6 +199,12 @@ struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 		if (len > 4 && skip_prefix(buffer, "ERR ", &arg))
 			die("remote error: %s", arg);
 
+		if (first && !strcmp(buffer, "version 2")) {
+			read_capabilities_v2(in, &src_buf, &src_len);
+			return list;
+		}
+		first = 0;
+
 		if (len == 48 && skip_prefix(buffer, "shallow ", &arg)) {
 			if (get_sha1_hex(arg, old_sha1))
 				die("protocol error: expected shallow sha-1, got '%s'", arg);
@@ -176,6 +243,108 @@ struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 	return list;
 }
 
+void write_ls_refs_request(struct strbuf *req,
+			   const struct argv_array *ref_prefixes)
+{
+	int i;
+
+	packet_buf_write(req, "command=ls-refs\n");
+	packet_buf_write(req, "agent=%s\n", git_user_agent_sanitized());
+	packet_buf_delim(req);
+	packet_buf_write(req, "peel\n");
+	packet_buf_write(req, "symrefs\n");
+	for (i = 0; ref_prefixes && i < ref_prefixes->argc; i++)
+		packet_buf_write(req, "ref-prefix %s\n", ref_prefixes->argv[i]);
+	packet_buf_flush(req);
+}
+
+static struct ref **append_ref(struct ref **list, const char *name,
+			       const unsigned char *sha1, unsigned int flags)
+{
+	struct ref *ref;
+
+	if (!check_ref(name, flags))
+		return list;
+	ref = alloc_ref(name);
+	hashcpy(ref->old_sha1, sha1);
+	*list = ref;
+	return &ref->next;
+}
+
+struct ref **read_ls_refs_v2(int in, char *src_buf, size_t src_len,
+			     struct ref **list, unsigned int flags,
+			     struct sha1_array *shallow_points)
+{
+	*list = NULL;
+	for (;;) {
+		unsigned char sha1[20], peeled[20];
+		struct ref **this;
+		char *name, *attr;
+		const char *symref = NULL;
+		int has_peeled = 0;
+		const char *arg;
+		int len = packet_read(in, &src_buf, &src_len,
+				      packet_buffer, sizeof(packet_buffer),
+				      PACKET_READ_GENTLE_ON_EOF |
+				      PACKET_READ_CHOMP_NEWLINE);
+		if (len < 0)
+			die("The remote end hung up while listing refs");
+		if (!len)
+			break;
+
+		if (len > 4 && skip_prefix(packet_buffer, "ERR ", &arg))
+			die("remote error: %s", arg);
+
+		if (len == 48 && skip_prefix(packet_buffer, "shallow ", &arg)) {
+			if (get_sha1_hex(arg, sha1))
+				die("protocol error: expected shallow sha-1, got '%s'", arg);
+			if (!shallow_points)
+				die("repository on the other end cannot be shallow");
+			sha1_array_append(shallow_points, sha1);
+			continue;
+		}
+
+		if (len < 42 || get_sha1_hex(packet_buffer, sha1) ||
+		    packet_buffer[40] != ' ')
+			die("protocol error: expected sha/ref, got '%s'",
+			    packet_buffer);
+		name = packet_buffer + 41;
+		for (attr = strchr(name, ' '); attr; attr = strchr(attr, ' ')) {
+			*attr++ = '\0';
+			if (skip_prefix(attr, "symref-target:", &arg))
+				symref = arg;
+			else if (skip_prefix(attr, "peeled:", &arg)) {
+				if (get_sha1_hex(arg, peeled))
+					die("protocol error: expected peeled sha-1, got '%s'", arg);
+				has_peeled = 1;
+			}
+		}
+
+		this = list;
+		list = append_ref(list, name, sha1, flags);
+		if (this != list && symref)
+			(*this)->symref = xstrdup(symref);
+		if (has_peeled) {
+			char *peeled_name = xstrfmt("%s^{}", name);
+			list = append_ref(list, peeled_name, peeled, flags);
+			free(peeled_name);
+		}
+	}
+	return list;
+}
+
+struct ref **ls_refs_v2(int fd[2], struct ref **list, unsigned int flags,
+			const struct argv_array *ref_prefixes,
+			struct sha1_array *shallow_points)
+{
+	struct strbuf req = STRBUF_INIT;
+
+	write_ls_refs_request(&req, ref_prefixes);
+	write_or_die(fd[1], req.buf, req.len);
+	strbuf_release(&req);
+	return read_ls_refs_v2(fd[0], NULL, 0, list, flags, shallow_points);
+}
+
 static const char *parse_feature_value(const char *feature_list, const char *feature, int *lenp)
 {
 	int len;
@@ -706,12 +875,20 @@ struct child_process *git_connect(int fd[2], const char *url,
 		 * from extended host header with a NUL byte.
 		 *
 		 * Note: Do not add any other headers here!  Doing so
-		 * will cause older git-daemon servers to crash.
+		 * will cause older git-daemon servers to crash.  The
+		 * protocol version goes after an empty header instead,
+		 * where they do not look.
 		 */
-		packet_write(fd[1],
-			     "%s %s%chost=%s%c",
-			     prog, path, 0,
-			     target_host, 0);
+		if (flags & CONNECT_PROTOCOL_V2)
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c%cversion=2%c",
+				     prog, path, 0,
+				     target_host, 0, 0, 0);
+		else
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c",
+				     prog, path, 0,
+				     target_host, 0);
 		free(target_host);
 	} else {
 		conn = xmalloc(sizeof(*conn));
@@ -771,6 +948,15 @@ struct child_process *git_connect(int fd[2], const char *url,
 			argv_array_push(&conn->args, ssh);
 			if (tortoiseplink)
 				argv_array_push(&conn->args, "-batch");
+			if (flags & CONNECT_PROTOCOL_V2) {
+				/* the server's sshd has to accept it, too */
+				if (!putty)
+					argv_array_pushl(&conn->args, "-o",
+						"SendEnv=" GIT_PROTOCOL_ENVIRONMENT,
+						NULL);
+				argv_array_push(&conn->env_array,
+					GIT_PROTOCOL_ENVIRONMENT "=version=2");
+			}
 			if (port) {
 				/* P is for PuTTY, p is for OpenSSH */
 				argv_array_push(&conn->args, putty ? "-P" : "-p");
@@ -779,7 +965,14 @@ struct child_process *git_connect(int fd[2], const char *url,
 			argv_array_push(&conn->args, ssh_host);
 		} else {
 			/* remove repo-local variables from the environment */
-			conn->env = local_repo_env;
+			if (flags & CONNECT_PROTOCOL_V2) {
+				const char * const *var;
+				for (var = local_repo_env; *var; var++)
+					argv_array_push(&conn->env_array, *var);
+				argv_array_push(&conn->env_array,
+					GIT_PROTOCOL_ENVIRONMENT "=version=2");
+			} else
+				conn->env = local_repo_env;
 			conn->use_shell = 1;
 		}
 		argv_array_push(&conn->args, cmd.buf);
@@ -1,12 +1,21 @@
 #ifndef CONNECT_H
 #define CONNECT_H
 
+#include "protocol.h"
+
 #define CONNECT_VERBOSE       (1u << 0)
 #define CONNECT_DIAG_URL      (1u << 1)
+/* Ask the server to speak protocol v2; only upload-pack does. */
+#define CONNECT_PROTOCOL_V2   (1u << 2)
 extern struct child_process *git_connect(int fd[2], const char *url, const char *prog, int flags);
 extern int finish_connect(struct child_process *conn);
 extern int git_connection_is_socket(struct child_process *conn);
 extern int server_supports(const char *feature);
+/* The protocol the last get_remote_heads() found the server to speak. */
+extern enum protocol_version server_protocol_version(void);
+/* The "bundle-uri" lines of the last protocol v2 advertisement read. */
+struct string_list;
+extern const struct string_list *server_bundle_uris(void);
 extern int parse_feature_request(const char *features, const char *feature);
 extern const char *server_feature_value(const char *feature, int *len_ret);
 extern int url_is_local_not_ssh(const char *url);
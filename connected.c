@@ -3,11 +3,177 @@
 #include "sigchain.h"
 #include "connected.h"
 #include "transport.h"
+#include "sha1-array.h"
+#include "commit.h"
+#include "tree-walk.h"
+#include "revision.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+#include "ewah/ewok.h"
+
+#define CONNECTED_SEEN (1u<<21)
 
 int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
 {
 	return check_everything_connected_with_transport(fn, quiet, cb_data, NULL);
 }
+struct connected_entry {
+	unsigned char sha1[20];
+	enum object_type type;
+};
+
+struct connected_walk {
+	struct connected_entry *stack;
+	int nr, alloc;
+	struct bitmap *refs;
+	int quiet;
+};
+
+static void connected_push(struct connected_walk *walk,
+			   const unsigned char *sha1, enum object_type type)
+{
+	struct object *obj;
+
+	if (bitmap_has_sha1(walk->refs, sha1))
+		return;
+	obj = lookup_unknown_object(sha1);
+	if (obj->flags & CONNECTED_SEEN)
+		return;
+	obj->flags |= CONNECTED_SEEN;
+
+	ALLOC_GROW(walk->stack, walk->nr + 1, walk->alloc);
+	hashcpy(walk->stack[walk->nr].sha1, sha1);
+	walk->stack[walk->nr].type = type;
+	walk->nr++;
+}
+
+static int connected_bad(struct connected_walk *walk,
+			 const char *fmt, const unsigned char *sha1)
+{
+	if (!walk->quiet)
+		error(fmt, sha1_to_hex(sha1));
+	return -1;
+}
+
+static int connected_parse_commit(struct connected_walk *walk,
+				  const unsigned char *sha1,
+				  const char *buf, unsigned long size)
+{
+	const char *end = buf + size, *p;
+	unsigned char child[20];
+
+	if (!skip_prefix(buf, "tree ", &p) || end - p < 41 ||
+	    get_sha1_hex(p, child) || p[40] != '\n')
+		return connected_bad(walk, _("bad commit %s"), sha1);
+	connected_push(walk, child, OBJ_TREE);
+	p += 41;
+	while (end - p >= 48 && starts_with(p, "parent ")) {
+		if (get_sha1_hex(p + 7, child) || p[47] != '\n')
+			return connected_bad(walk, _("bad commit %s"), sha1);
+		connected_push(walk, child, OBJ_COMMIT);
+		p += 48;
+	}
+	return 0;
+}
+
+static int connected_parse_tree(struct connected_walk *walk,
+				void *buf, unsigned long size)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		connected_push(walk, entry.sha1,
+			       S_ISDIR(entry.mode) ? OBJ_TREE : OBJ_BLOB);
+	}
+	return 0;
+}
+
+static int connected_parse_tag(struct connected_walk *walk,
+			       const unsigned char *sha1,
+			       const char *buf, unsigned long size)
+{
+	const char *end = buf + size, *p, *eol;
+	unsigned char child[20];
+	enum object_type type;
+
+	if (!skip_prefix(buf, "object ", &p) || end - p < 41 ||
+	    get_sha1_hex(p, child) || p[40] != '\n' ||
+	    !skip_prefix(p + 41, "type ", &p) ||
+	    !(eol = memchr(p, '\n', end - p)))
+		return connected_bad(walk, _("bad tag %s"), sha1);
+	type = type_from_string_gently(p, eol - p, 1);
+	if (type < 0)
+		return connected_bad(walk, _("bad tag %s"), sha1);
+	connected_push(walk, child, type);
+	return 0;
+}
+
+/*
+ * Walk everything reachable from "tips", stopping at objects the
+ * bitmap says are reachable from our refs.  This is what
+ * "rev-list --objects --stdin --not --all" below does, without
+ * starting a process and without a commit walk over all of our
+ * refs.
+ *
+ * Returns 0 if connected, -1 if not, and 1 if we could not tell
+ * because there is no bitmap index.
+ */
+static int check_connected_in_process(struct sha1_array *tips, int quiet,
+				      struct packed_git *new_pack)
+{
+	struct connected_walk walk = { NULL, 0, 0, NULL, quiet };
+	int i, err = 0;
+
+	walk.refs = bitmap_for_refs();
+	if (!walk.refs)
+		return 1;
+
+	for (i = 0; i < tips->nr; i++) {
+		if (new_pack && find_pack_entry_one(tips->sha1[i], new_pack))
+			continue;
+		connected_push(&walk, tips->sha1[i], OBJ_ANY);
+	}
+
+	while (!err && walk.nr) {
+		struct connected_entry *e = &walk.stack[--walk.nr];
+		unsigned char sha1[20];
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		hashcpy(sha1, e->sha1);
+		if (e->type == OBJ_BLOB) {
+			if (sha1_object_info(sha1, NULL) != OBJ_BLOB)
+				err = connected_bad(&walk, _("missing blob %s"), sha1);
+			continue;
+		}
+
+		buf = read_sha1_file(sha1, &type, &size);
+		if (!buf) {
+			err = connected_bad(&walk, _("missing object %s"), sha1);
+			continue;
+		}
+		if (e->type != OBJ_ANY && e->type != type)
+			err = connected_bad(&walk, _("object %s has the wrong type"), sha1);
+		else if (type == OBJ_COMMIT)
+			err = connected_parse_commit(&walk, sha1, buf, size);
+		else if (type == OBJ_TREE)
+			err = connected_parse_tree(&walk, buf, size);
+		else if (type == OBJ_TAG)
+			err = connected_parse_tag(&walk, sha1, buf, size);
+		free(buf);
+	}
+
+	clear_object_flags(CONNECTED_SEEN);
+	free(walk.stack);
+	bitmap_free(walk.refs);
+	return err;
+}
+
 /*
  * If we feed all the commits we want to verify to this command
  *
@@ -15,25 +181,33 @@ int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
  *
  * and if it does not error out, that means everything reachable from
  * these commits locally exists and is connected to our existing refs.
- * Note that this does _not_ validate the individual objects.
+ * Note that this does _not_ validate the individual objects.  In a
+ * partial clone, the trees and blobs left out by the filter are
+ * expected to be missing and are not fetched.
+ *
+ * When there is a bitmap index, check_connected_in_process() does the
+ * same walk without running rev-list.
  *
  * Returns 0 if everything is connected, non-zero otherwise.
  */
-static int check_everything_connected_real(sha1_iterate_fn fn,
-					   int quiet,
-					   void *cb_data,
-					   struct transport *transport,
-					   const char *shallow_file)
+static int check_everything_connected_1(sha1_iterate_fn fn,
+					int quiet,
+					void *cb_data,
+					struct transport *transport,
+					const char *shallow_file)
 {
 	struct child_process rev_list = CHILD_PROCESS_INIT;
-	const char *argv[9];
+	const char *argv[10];
 	char commit[41];
 	unsigned char sha1[20];
-	int err = 0, ac = 0;
+	struct sha1_array tips = SHA1_ARRAY_INIT;
+	int err = 0, ac = 0, i;
 	struct packed_git *new_pack = NULL;
 	size_t base_len;
 
-	if (fn(cb_data, sha1))
+	while (!fn(cb_data, sha1))
+		sha1_array_append(&tips, sha1);
+	if (!tips.nr)
 		return err;
 
 	if (transport && transport->smart_options &&
@@ -47,6 +221,22 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 		strbuf_release(&idx_file);
 	}
 
+	/*
+	 * With a bitmap index we can do without the rev-list process.
+	 * It does not know about grafted history or objects left out
+	 * on purpose, though, so leave shallow repositories and partial
+	 * clones to rev-list.
+	 */
+	if (!shallow_file && !is_repository_shallow() &&
+	    !repository_format_partial_clone) {
+		err = check_connected_in_process(&tips, quiet, new_pack);
+		if (err <= 0) {
+			sha1_array_clear(&tips);
+			return err;
+		}
+		err = 0;
+	}
+
 	if (shallow_file) {
 		argv[ac++] = "--shallow-file";
 		argv[ac++] = shallow_file;
@@ -58,6 +248,8 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 	argv[ac++] = "--all";
 	if (quiet)
 		argv[ac++] = "--quiet";
+	if (repository_format_partial_clone)
+		argv[ac++] = "--missing=allow-any";
 	argv[ac] = NULL;
 
 	rev_list.argv = argv;
@@ -65,13 +257,15 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 	rev_list.in = -1;
 	rev_list.no_stdout = 1;
 	rev_list.no_stderr = quiet;
-	if (start_command(&rev_list))
+	if (start_command(&rev_list)) {
+		sha1_array_clear(&tips);
 		return error(_("Could not run 'git rev-list'"));
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
 	commit[40] = '\n';
-	do {
+	for (i = 0; i < tips.nr; i++) {
 		/*
 		 * If index-pack already checked that:
 		 * - there are no dangling pointers in the new pack
@@ -80,10 +274,10 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 		 * are sure the ref is good and not sending it to
 		 * rev-list for verification.
 		 */
-		if (new_pack && find_pack_entry_one(sha1, new_pack))
+		if (new_pack && find_pack_entry_one(tips.sha1[i], new_pack))
 			continue;
 
-		memcpy(commit, sha1_to_hex(sha1), 40);
+		memcpy(commit, sha1_to_hex(tips.sha1[i]), 40);
 		if (write_in_full(rev_list.in, commit, 41) < 0) {
 			if (errno != EPIPE && errno != EINVAL)
 				error(_("failed write to rev-list: %s"),
@@ -91,7 +285,7 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 			err = -1;
 			break;
 		}
-	} while (!fn(cb_data, sha1));
+	}
 
 	if (close(rev_list.in)) {
 		error(_("failed to close rev-list's stdin: %s"), strerror(errno));
@@ -99,9 +293,25 @@ static int check_everything_connected_real(sha1_iterate_fn fn,
 	}
 
 	sigchain_pop(SIGPIPE);
+	sha1_array_clear(&tips);
 	return finish_command(&rev_list) || err;
 }
 
+static int check_everything_connected_real(sha1_iterate_fn fn,
+					   int quiet,
+					   void *cb_data,
+					   struct transport *transport,
+					   const char *shallow_file)
+{
+	int ret;
+
+	trace_region_enter("connected", "check");
+	ret = check_everything_connected_1(fn, quiet, cb_data,
+					   transport, shallow_file);
+	trace_region_leave("connected", "check");
+	return ret;
+}
+
 int check_everything_connected_with_transport(sha1_iterate_fn fn,
 					      int quiet,
 					      void *cb_data,
@@ -4,10 +4,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "svndump.h"
 
 int main(int argc, char **argv)
 {
+	if (argc > 1 && !strncmp(argv[1], "--pipeline=", strlen("--pipeline="))) {
+		svndump_pipeline(atoi(argv[1] + strlen("--pipeline=")));
+		argc--;
+		argv++;
+	}
 	if (svndump_init(NULL))
 		return 1;
 	svndump_read((argc > 1) ? argv[1] : NULL, "refs/heads/master",
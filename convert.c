@@ -3,6 +3,7 @@
 #include "run-command.h"
 #include "quote.h"
 #include "sigchain.h"
+#include "pkt-line.h"
 
 /*
  * convert.c - convert a file when checking it out and checking it in.
@@ -381,8 +382,9 @@ static int filter_buffer_or_fd(int in, int out, void *data)
 	return (write_err || status);
 }
 
-static int apply_filter(const char *path, const char *src, size_t len, int fd,
-                        struct strbuf *dst, const char *cmd)
+static int apply_single_file_filter(const char *path, const char *src,
+				   size_t len, int fd, struct strbuf *dst,
+				   const char *cmd)
 {
 	/*
 	 * Create a pipeline to have the command filter the buffer's
@@ -395,12 +397,6 @@ static int apply_filter(const char *path, const char *src, size_t len, int fd,
 	struct async async;
 	struct filter_params params;
 
-	if (!cmd)
-		return 0;
-
-	if (!dst)
-		return 1;
-
 	memset(&async, 0, sizeof(async));
 	async.proc = filter_buffer_or_fd;
 	async.data = &params;
@@ -440,9 +436,315 @@ static struct convert_driver {
 	struct convert_driver *next;
 	const char *smudge;
 	const char *clean;
+	const char *process;
 	int required;
 } *user_convert, **user_convert_tail;
 
+/*
+ * Long-running filter processes, configured with filter.<driver>.process.
+ * Each is started the first time it is needed and serves every
+ * clean and smudge request of this git process over the same pair of
+ * pipes; see "Long Running Filter Process" in gitattributes(5).
+ */
+#define CAP_CLEAN	(1u << 0)
+#define CAP_SMUDGE	(1u << 1)
+#define CAP_DELAY	(1u << 2)
+
+struct filter_process {
+	struct filter_process *next;
+	char *cmd;
+	unsigned int supported;
+	struct child_process process;
+};
+
+static struct filter_process *filter_processes;
+
+/*
+ * Read one packet into packet_buffer.  Returns its length (0 for a
+ * flush packet) or -1 if the filter hung up.
+ */
+static int read_filter_line(int fd, char **line)
+{
+	int len = packet_read(fd, NULL, NULL, packet_buffer,
+			      sizeof(packet_buffer),
+			      PACKET_READ_GENTLE_ON_EOF |
+			      PACKET_READ_CHOMP_NEWLINE);
+	*line = packet_buffer;
+	return len;
+}
+
+/*
+ * Read a list of "key=value" packets up to a flush, remembering the
+ * last "status=" seen.  An empty list leaves *status alone.
+ */
+static int read_filter_status(int fd, struct strbuf *status)
+{
+	char *line;
+	const char *value;
+	int len;
+
+	while ((len = read_filter_line(fd, &line)) > 0) {
+		if (skip_prefix(line, "status=", &value)) {
+			strbuf_reset(status);
+			strbuf_addstr(status, value);
+		}
+	}
+	return len < 0 ? -1 : 0;
+}
+
+static int filter_handshake(struct filter_process *entry)
+{
+	int in = entry->process.in, out = entry->process.out;
+	const char *value;
+	char *line;
+	int len;
+
+	if (packet_write_fmt_gently(in, "git-filter-client\n") ||
+	    packet_write_fmt_gently(in, "version=2\n") ||
+	    packet_flush_gently(in))
+		return -1;
+
+	if (read_filter_line(out, &line) <= 0 ||
+	    strcmp(line, "git-filter-server"))
+		return error("unexpected welcome message from filter process");
+	if (read_filter_line(out, &line) <= 0 || strcmp(line, "version=2"))
+		return error("unsupported filter process protocol version");
+	if (read_filter_line(out, &line))
+		return error("expected flush after filter process version");
+
+	if (packet_write_fmt_gently(in, "capability=clean\n") ||
+	    packet_write_fmt_gently(in, "capability=smudge\n") ||
+	    packet_write_fmt_gently(in, "capability=delay\n") ||
+	    packet_flush_gently(in))
+		return -1;
+
+	while ((len = read_filter_line(out, &line)) > 0) {
+		if (!skip_prefix(line, "capability=", &value))
+			continue;
+		if (!strcmp(value, "clean"))
+			entry->supported |= CAP_CLEAN;
+		else if (!strcmp(value, "smudge"))
+			entry->supported |= CAP_SMUDGE;
+		else if (!strcmp(value, "delay"))
+			entry->supported |= CAP_DELAY;
+		else
+			warning("filter process '%s' announced unknown capability '%s'",
+				entry->cmd, value);
+	}
+	return len < 0 ? -1 : 0;
+}
+
+static void stop_filter_process(struct filter_process *entry, int force)
+{
+	struct filter_process **pp;
+
+	for (pp = &filter_processes; *pp; pp = &(*pp)->next)
+		if (*pp == entry) {
+			*pp = entry->next;
+			break;
+		}
+
+	/*
+	 * Closing its stdin tells the filter that we are done; it may
+	 * still be busy, so only kill it when the protocol broke down.
+	 */
+	close(entry->process.in);
+	close(entry->process.out);
+	if (force)
+		kill(entry->process.pid, SIGTERM);
+	finish_command(&entry->process);
+	free(entry->cmd);
+	free(entry);
+}
+
+static void stop_filter_processes(void)
+{
+	while (filter_processes)
+		stop_filter_process(filter_processes, 0);
+}
+
+static struct filter_process *find_filter_process(const char *cmd)
+{
+	struct filter_process *entry;
+
+	for (entry = filter_processes; entry; entry = entry->next)
+		if (!strcmp(entry->cmd, cmd))
+			return entry;
+	return NULL;
+}
+
+static struct filter_process *start_filter_process(const char *cmd)
+{
+	static int atexit_registered;
+	struct filter_process *entry;
+	struct child_process *process;
+	int err;
+
+	entry = xcalloc(1, sizeof(*entry));
+	entry->cmd = xstrdup(cmd);
+	process = &entry->process;
+	child_process_init(process);
+	argv_array_push(&process->args, cmd);
+	process->use_shell = 1;
+	process->in = -1;
+	process->out = -1;
+	process->clean_on_exit = 1;
+
+	fflush(NULL);
+	if (start_command(process)) {
+		error("cannot fork to run filter process '%s'", cmd);
+		free(entry->cmd);
+		free(entry);
+		return NULL;
+	}
+
+	entry->next = filter_processes;
+	filter_processes = entry;
+	if (!atexit_registered) {
+		atexit(stop_filter_processes);
+		atexit_registered = 1;
+	}
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = filter_handshake(entry);
+	sigchain_pop(SIGPIPE);
+	if (err) {
+		error("initialization for filter process '%s' failed", cmd);
+		stop_filter_process(entry, 1);
+		return NULL;
+	}
+	return entry;
+}
+
+static int apply_process_filter(const char *path, const char *src, size_t len,
+				int fd, struct strbuf *dst, const char *cmd,
+				unsigned int wanted_cap,
+				struct delayed_checkout *dco)
+{
+	struct filter_process *entry;
+	struct strbuf nbuf = STRBUF_INIT;
+	struct strbuf status = STRBUF_INIT;
+	int in, out, err, can_delay = 0, ret = 0;
+
+	entry = find_filter_process(cmd);
+	if (!entry) {
+		entry = start_filter_process(cmd);
+		if (!entry)
+			return 0;
+	}
+	if (!(entry->supported & wanted_cap))
+		return 0;
+	in = entry->process.in;
+	out = entry->process.out;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = packet_write_fmt_gently(in, "command=%s\n",
+				      wanted_cap & CAP_CLEAN ? "clean" : "smudge");
+	if (!err)
+		err = packet_write_fmt_gently(in, "pathname=%s\n", path);
+	if (!err && dco && dco->state == CE_CAN_DELAY &&
+	    (entry->supported & CAP_DELAY)) {
+		can_delay = 1;
+		err = packet_write_fmt_gently(in, "can-delay=1\n");
+	}
+	if (!err)
+		err = packet_flush_gently(in);
+	if (!err)
+		err = fd >= 0 ? write_packetized_from_fd(fd, in) :
+				write_packetized_from_buf(src, len, in);
+	if (!err)
+		err = read_filter_status(out, &status);
+	if (!err && can_delay && !strcmp(status.buf, "delayed")) {
+		string_list_insert(&dco->filters, cmd);
+		string_list_insert(&dco->paths, path);
+		ret = 1;
+	} else if (!err && !strcmp(status.buf, "success")) {
+		err = read_packetized_to_strbuf(out, &nbuf) < 0;
+		if (!err)
+			err = read_filter_status(out, &status);
+		if (!err && !strcmp(status.buf, "success")) {
+			strbuf_swap(dst, &nbuf);
+			ret = 1;
+		}
+	}
+	sigchain_pop(SIGPIPE);
+
+	if (err) {
+		error("filter process '%s' failed to %s '%s'", cmd,
+		      wanted_cap & CAP_CLEAN ? "clean" : "smudge", path);
+		stop_filter_process(entry, 1);
+	} else if (!strcmp(status.buf, "abort")) {
+		/* the filter wants no more requests of this kind */
+		entry->supported &= ~wanted_cap;
+	}
+	strbuf_release(&nbuf);
+	strbuf_release(&status);
+	return ret;
+}
+
+int async_query_available_blobs(const char *cmd,
+				struct string_list *available_paths)
+{
+	struct filter_process *entry;
+	struct strbuf status = STRBUF_INIT;
+	const char *value;
+	char *line;
+	int in, out, err, len;
+
+	entry = find_filter_process(cmd);
+	if (!entry || !(entry->supported & CAP_DELAY))
+		return 0;
+	in = entry->process.in;
+	out = entry->process.out;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = packet_write_fmt_gently(in, "command=list_available_blobs\n");
+	if (!err)
+		err = packet_flush_gently(in);
+	while (!err && (len = read_filter_line(out, &line)) > 0)
+		if (skip_prefix(line, "pathname=", &value))
+			string_list_insert(available_paths, value);
+	if (!err && len < 0)
+		err = -1;
+	if (!err)
+		err = read_filter_status(out, &status);
+	sigchain_pop(SIGPIPE);
+
+	if (err) {
+		error("filter process '%s' failed to list available blobs", cmd);
+		stop_filter_process(entry, 1);
+		strbuf_release(&status);
+		return 0;
+	}
+	err = strcmp(status.buf, "success");
+	strbuf_release(&status);
+	return !err;
+}
+
+static int apply_filter(const char *path, const char *src, size_t len, int fd,
+			struct strbuf *dst, struct convert_driver *drv,
+			unsigned int wanted_cap, struct delayed_checkout *dco)
+{
+	const char *cmd;
+
+	if (!drv)
+		return 0;
+	if (drv->process)
+		cmd = drv->process;
+	else
+		cmd = wanted_cap & CAP_CLEAN ? drv->clean : drv->smudge;
+	if (!cmd)
+		return 0;
+
+	if (!dst)
+		return 1;
+
+	if (drv->process)
+		return apply_process_filter(path, src, len, fd, dst, cmd,
+					    wanted_cap, dco);
+	return apply_single_file_filter(path, src, len, fd, dst, cmd);
+}
+
 static int read_convert_config(const char *var, const char *value, void *cb)
 {
 	const char *key, *name;
@@ -480,6 +782,9 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 	if (!strcmp("clean", key))
 		return git_config_string(&drv->clean, var, value);
 
+	if (!strcmp("process", key))
+		return git_config_string(&drv->process, var, value);
+
 	if (!strcmp("required", key)) {
 		drv->required = git_config_bool(var, value);
 		return 0;
@@ -774,25 +1079,19 @@ int would_convert_to_git_filter_fd(const char *path)
 	if (!ca.drv->required)
 		return 0;
 
-	return apply_filter(path, NULL, 0, -1, NULL, ca.drv->clean);
+	return apply_filter(path, NULL, 0, -1, NULL, ca.drv, CAP_CLEAN, NULL);
 }
 
 int convert_to_git(const char *path, const char *src, size_t len,
                    struct strbuf *dst, enum safe_crlf checksafe)
 {
 	int ret = 0;
-	const char *filter = NULL;
-	int required = 0;
 	struct conv_attrs ca;
 
 	convert_attrs(&ca, path);
-	if (ca.drv) {
-		filter = ca.drv->clean;
-		required = ca.drv->required;
-	}
 
-	ret |= apply_filter(path, src, len, -1, dst, filter);
-	if (!ret && required)
+	ret |= apply_filter(path, src, len, -1, dst, ca.drv, CAP_CLEAN, NULL);
+	if (!ret && ca.drv && ca.drv->required)
 		die("%s: clean filter '%s' failed", path, ca.drv->name);
 
 	if (ret && dst) {
@@ -815,9 +1114,9 @@ void convert_to_git_filter_fd(const char *path, int fd, struct strbuf *dst,
 	convert_attrs(&ca, path);
 
 	assert(ca.drv);
-	assert(ca.drv->clean);
+	assert(ca.drv->clean || ca.drv->process);
 
-	if (!apply_filter(path, NULL, 0, fd, dst, ca.drv->clean))
+	if (!apply_filter(path, NULL, 0, fd, dst, ca.drv, CAP_CLEAN, NULL))
 		die("%s: clean filter '%s' failed", path, ca.drv->name);
 
 	ca.crlf_action = input_crlf_action(ca.crlf_action, ca.eol_attr);
@@ -827,18 +1126,16 @@ void convert_to_git_filter_fd(const char *path, int fd, struct strbuf *dst,
 
 static int convert_to_working_tree_internal(const char *path, const char *src,
 					    size_t len, struct strbuf *dst,
-					    int normalizing)
+					    int normalizing,
+					    struct delayed_checkout *dco)
 {
 	int ret = 0, ret_filter = 0;
-	const char *filter = NULL;
-	int required = 0;
+	int filter = 0;
 	struct conv_attrs ca;
 
 	convert_attrs(&ca, path);
-	if (ca.drv) {
-		filter = ca.drv->smudge;
-		required = ca.drv->required;
-	}
+	if (ca.drv)
+		filter = ca.drv->smudge || ca.drv->process;
 
 	ret |= ident_to_worktree(path, src, len, dst, ca.ident);
 	if (ret) {
@@ -858,8 +1155,8 @@ static int convert_to_working_tree_internal(const char *path, const char *src,
 		}
 	}
 
-	ret_filter = apply_filter(path, src, len, -1, dst, filter);
-	if (!ret_filter && required)
+	ret_filter = apply_filter(path, src, len, -1, dst, ca.drv, CAP_SMUDGE, dco);
+	if (!ret_filter && ca.drv && ca.drv->required)
 		die("%s: smudge filter %s failed", path, ca.drv->name);
 
 	return ret | ret_filter;
@@ -867,12 +1164,19 @@ static int convert_to_working_tree_internal(const char *path, const char *src,
 
 int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst)
 {
-	return convert_to_working_tree_internal(path, src, len, dst, 0);
+	return convert_to_working_tree_internal(path, src, len, dst, 0, NULL);
+}
+
+int async_convert_to_working_tree(const char *path, const char *src,
+				  size_t len, struct strbuf *dst,
+				  struct delayed_checkout *dco)
+{
+	return convert_to_working_tree_internal(path, src, len, dst, 0, dco);
 }
 
 int renormalize_buffer(const char *path, const char *src, size_t len, struct strbuf *dst)
 {
-	int ret = convert_to_working_tree_internal(path, src, len, dst, 1);
+	int ret = convert_to_working_tree_internal(path, src, len, dst, 1, NULL);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -1312,7 +1616,7 @@ struct stream_filter *get_stream_filter(const char *path, const unsigned char *s
 
 	convert_attrs(&ca, path);
 
-	if (ca.drv && (ca.drv->smudge || ca.drv->clean))
+	if (ca.drv && (ca.drv->process || ca.drv->smudge || ca.drv->clean))
 		return filter;
 
 	if (ca.ident)
@@ -4,6 +4,8 @@
 #ifndef CONVERT_H
 #define CONVERT_H
 
+#include "string-list.h"
+
 enum safe_crlf {
 	SAFE_CRLF_FALSE = 0,
 	SAFE_CRLF_FAIL = 1,
@@ -33,11 +35,38 @@ enum eol {
 
 extern enum eol core_eol;
 
+enum ce_delay_state {
+	CE_NO_DELAY = 0,
+	CE_CAN_DELAY = 1,
+	CE_RETRY = 2
+};
+
+/*
+ * State of a checkout whose filter processes may answer a smudge
+ * request with "delayed" and deliver the content later.
+ */
+struct delayed_checkout {
+	enum ce_delay_state state;
+	/* filter process commands that have delayed paths */
+	struct string_list filters;
+	/* paths that still need to be written out */
+	struct string_list paths;
+};
+
 /* returns 1 if *dst was used */
 extern int convert_to_git(const char *path, const char *src, size_t len,
 			  struct strbuf *dst, enum safe_crlf checksafe);
 extern int convert_to_working_tree(const char *path, const char *src,
 				   size_t len, struct strbuf *dst);
+extern int async_convert_to_working_tree(const char *path, const char *src,
+					 size_t len, struct strbuf *dst,
+					 struct delayed_checkout *dco);
+/*
+ * Ask the filter process cmd which of its delayed paths are ready and
+ * add them to available_paths.  Returns 1 on success, 0 on error.
+ */
+extern int async_query_available_blobs(const char *cmd,
+				       struct string_list *available_paths);
 extern int renormalize_buffer(const char *path, const char *src, size_t len,
 			      struct strbuf *dst);
 static inline int would_convert_to_git(const char *path)
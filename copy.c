@@ -2,6 +2,18 @@
 
 int copy_fd(int ifd, int ofd)
 {
+#ifdef HAVE_SENDFILE
+	/* let the kernel copy it, if it can do that for these two */
+	while (1) {
+		ssize_t len = sendfile(ofd, ifd, NULL, 1 << 30);
+		if (!len)
+			return 0;
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			break;
+	}
+#endif
 	while (1) {
 		char buffer[8192];
 		ssize_t len = xread(ifd, buffer, sizeof(buffer));
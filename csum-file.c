@@ -9,7 +9,26 @@
  */
 #include "cache.h"
 #include "progress.h"
+#include "lockfile.h"
 #include "csum-file.h"
+#include "thread-utils.h"
+
+static void write_out(struct sha1file *f, const void *buf, unsigned int count)
+{
+	for (;;) {
+		int ret = xwrite(f->fd, buf, count);
+		if (ret > 0) {
+			buf = (char *) buf + ret;
+			count -= ret;
+			if (count)
+				continue;
+			return;
+		}
+		if (!ret)
+			die("sha1 file '%s' write error. Out of diskspace", f->name);
+		die_errno("sha1 file '%s' write error", f->name);
+	}
+}
 
 static void flush(struct sha1file *f, const void *buf, unsigned int count)
 {
@@ -25,27 +44,199 @@ static void flush(struct sha1file *f, const void *buf, unsigned int count)
 			die("sha1 file '%s' validation error", f->name);
 	}
 
-	for (;;) {
-		int ret = xwrite(f->fd, buf, count);
-		if (ret > 0) {
-			f->total += ret;
-			display_throughput(f->tp, f->total);
-			buf = (char *) buf + ret;
-			count -= ret;
-			if (count)
-				continue;
-			return;
-		}
-		if (!ret)
-			die("sha1 file '%s' write error. Out of diskspace", f->name);
-		die_errno("sha1 file '%s' write error", f->name);
+	write_out(f, buf, count);
+	f->total += count;
+	display_throughput(f->tp, f->total);
+}
+
+#ifndef NO_PTHREADS
+/*
+ * The data of a pipelined sha1file goes through a ring of buffers.  The
+ * caller fills them in turn; the hasher and the writer thread each
+ * take them in the same order, and a buffer is filled again once both
+ * are done with it.  The counters only ever grow, so that buffer
+ * number n is in slot n % PIPELINE_SLOTS.
+ */
+#define PIPELINE_SLOTS 4
+#define PIPELINE_SLOT_SIZE (1024 * 1024)
+
+struct sha1file_pipeline {
+	pthread_t hasher, writer;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned char *buf[PIPELINE_SLOTS];
+	unsigned int len[PIPELINE_SLOTS];
+	unsigned long queued, hashed, written;
+	int done;
+};
+
+/*
+ * Wait for a buffer that "*count" has not got to yet.  Returns its
+ * slot, or -1 once there are no more and will not be.
+ */
+static int pipeline_next(struct sha1file_pipeline *p, unsigned long *count)
+{
+	int slot = -1;
+
+	pthread_mutex_lock(&p->mutex);
+	while (*count == p->queued && !p->done)
+		pthread_cond_wait(&p->cond, &p->mutex);
+	if (*count < p->queued)
+		slot = *count % PIPELINE_SLOTS;
+	pthread_mutex_unlock(&p->mutex);
+	return slot;
+}
+
+static void pipeline_done(struct sha1file_pipeline *p, unsigned long *count)
+{
+	pthread_mutex_lock(&p->mutex);
+	(*count)++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static void *pipeline_hash(void *data)
+{
+	struct sha1file *f = data;
+	struct sha1file_pipeline *p = f->pipeline;
+	int slot;
+
+	while ((slot = pipeline_next(p, &p->hashed)) >= 0) {
+		git_SHA1_Update(&f->ctx, p->buf[slot], p->len[slot]);
+		pipeline_done(p, &p->hashed);
+	}
+	return NULL;
+}
+
+static void *pipeline_write(void *data)
+{
+	struct sha1file *f = data;
+	struct sha1file_pipeline *p = f->pipeline;
+	int slot;
+
+	while ((slot = pipeline_next(p, &p->written)) >= 0) {
+		write_out(f, p->buf[slot], p->len[slot]);
+		pipeline_done(p, &p->written);
+	}
+	return NULL;
+}
+
+/* Hand the buffer being filled over to the threads */
+static void pipeline_queue(struct sha1file *f)
+{
+	struct sha1file_pipeline *p = f->pipeline;
+
+	pthread_mutex_lock(&p->mutex);
+	p->len[p->queued % PIPELINE_SLOTS] = f->offset;
+	p->queued++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	f->total += f->offset;
+	f->offset = 0;
+	display_throughput(f->tp, f->total);
+}
+
+/* Wait until fewer than "busy" buffers are still being worked on */
+static void pipeline_wait(struct sha1file_pipeline *p, unsigned long busy)
+{
+	pthread_mutex_lock(&p->mutex);
+	while (p->queued - (p->hashed < p->written ? p->hashed : p->written) >= busy)
+		pthread_cond_wait(&p->cond, &p->mutex);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static void pipeline_sha1write(struct sha1file *f, const void *buf,
+			       unsigned int count)
+{
+	struct sha1file_pipeline *p = f->pipeline;
+
+	while (count) {
+		unsigned char *slot_buf;
+		unsigned left, nr;
+
+		if (!f->offset)
+			pipeline_wait(p, PIPELINE_SLOTS);
+		slot_buf = p->buf[p->queued % PIPELINE_SLOTS];
+		left = PIPELINE_SLOT_SIZE - f->offset;
+		nr = count > left ? left : count;
+
+		if (f->do_crc)
+			f->crc32 = crc32(f->crc32, buf, nr);
+		memcpy(slot_buf + f->offset, buf, nr);
+		f->offset += nr;
+		buf = (char *) buf + nr;
+		count -= nr;
+		if (f->offset == PIPELINE_SLOT_SIZE)
+			pipeline_queue(f);
 	}
 }
 
+void sha1file_pipeline(struct sha1file *f)
+{
+	struct sha1file_pipeline *p;
+	int i, ret;
+
+	if (f->pipeline || 0 <= f->check_fd)
+		return;
+	sha1flush(f);
+
+	p = xcalloc(1, sizeof(*p));
+	for (i = 0; i < PIPELINE_SLOTS; i++)
+		p->buf[i] = xmalloc(PIPELINE_SLOT_SIZE);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	f->pipeline = p;
+
+	ret = pthread_create(&p->hasher, NULL, pipeline_hash, f);
+	if (ret)
+		die(_("unable to create thread: %s"), strerror(ret));
+	ret = pthread_create(&p->writer, NULL, pipeline_write, f);
+	if (ret)
+		die(_("unable to create thread: %s"), strerror(ret));
+}
+
+static void pipeline_stop(struct sha1file *f)
+{
+	struct sha1file_pipeline *p = f->pipeline;
+	int i;
+
+	pthread_mutex_lock(&p->mutex);
+	p->done = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	pthread_join(p->hasher, NULL);
+	pthread_join(p->writer, NULL);
+
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+	for (i = 0; i < PIPELINE_SLOTS; i++)
+		free(p->buf[i]);
+	free(p);
+	f->pipeline = NULL;
+}
+#else
+void sha1file_pipeline(struct sha1file *f)
+{
+}
+
+#define pipeline_queue(f) (void)0
+#define pipeline_wait(p, busy) (void)0
+#define pipeline_sha1write(f, buf, count) (void)0
+#define pipeline_stop(f) (void)0
+#endif
+
 void sha1flush(struct sha1file *f)
 {
 	unsigned offset = f->offset;
 
+	if (f->pipeline) {
+		if (offset)
+			pipeline_queue(f);
+		pipeline_wait(f->pipeline, 1);
+		return;
+	}
+
 	if (offset) {
 		git_SHA1_Update(&f->ctx, f->buffer, offset);
 		flush(f, f->buffer, offset);
@@ -58,6 +249,8 @@ int sha1close(struct sha1file *f, unsigned char *result, unsigned int flags)
 	int fd;
 
 	sha1flush(f);
+	if (f->pipeline)
+		pipeline_stop(f);
 	git_SHA1_Final(f->buffer, &f->ctx);
 	if (result)
 		hashcpy(result, f->buffer);
@@ -86,8 +279,20 @@ int sha1close(struct sha1file *f, unsigned char *result, unsigned int flags)
 	return fd;
 }
 
+int sha1close_commit_lock(struct sha1file *f, struct lock_file *lk)
+{
+	sha1close(f, NULL, CSUM_FSYNC);
+	/* sha1close() closed the fd; keep commit_lock_file() from retrying */
+	lk->fd = -1;
+	return commit_lock_file(lk);
+}
+
 void sha1write(struct sha1file *f, const void *buf, unsigned int count)
 {
+	if (f->pipeline) {
+		pipeline_sha1write(f, buf, count);
+		return;
+	}
 	while (count) {
 		unsigned offset = f->offset;
 		unsigned left = sizeof(f->buffer) - offset;
@@ -149,6 +354,7 @@ struct sha1file *sha1fd_throughput(int fd, const char *name, struct progress *tp
 	f->tp = tp;
 	f->name = name;
 	f->do_crc = 0;
+	f->pipeline = NULL;
 	git_SHA1_Init(&f->ctx);
 	return f;
 }
@@ -164,6 +370,8 @@ int sha1file_truncate(struct sha1file *f, struct sha1file_checkpoint *checkpoint
 {
 	off_t offset = checkpoint->offset;
 
+	if (f->pipeline)
+		pipeline_wait(f->pipeline, 1);
 	if (ftruncate(f->fd, offset) ||
 	    lseek(f->fd, offset, SEEK_SET) != offset)
 		return -1;
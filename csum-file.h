@@ -2,6 +2,8 @@
 #define CSUM_FILE_H
 
 struct progress;
+struct sha1file_pipeline;
+struct lock_file;
 
 /* A SHA1-protected file */
 struct sha1file {
@@ -14,6 +16,7 @@ struct sha1file {
 	const char *name;
 	int do_crc;
 	uint32_t crc32;
+	struct sha1file_pipeline *pipeline;
 	unsigned char buffer[8192];
 };
 
@@ -33,7 +36,19 @@ extern int sha1file_truncate(struct sha1file *, struct sha1file_checkpoint *);
 extern struct sha1file *sha1fd(int fd, const char *name);
 extern struct sha1file *sha1fd_check(const char *name);
 extern struct sha1file *sha1fd_throughput(int fd, const char *name, struct progress *tp);
+/*
+ * From now on, hash and write the data in two helper threads, in large
+ * buffers, so that the caller, the hashing and the disk all work at the
+ * same time.  sha1flush() waits for them to catch up, sha1close() stops
+ * them.  Does nothing without threads, or for sha1fd_check().
+ */
+extern void sha1file_pipeline(struct sha1file *);
 extern int sha1close(struct sha1file *, unsigned char *, unsigned int);
+/*
+ * Finish and fsync "f", which sha1fd() opened on the fd of "lk", and
+ * commit the lock file.  Returns what commit_lock_file() does.
+ */
+extern int sha1close_commit_lock(struct sha1file *, struct lock_file *);
 extern void sha1write(struct sha1file *, const void *, unsigned int);
 extern void sha1flush(struct sha1file *f);
 extern void crc32_begin(struct sha1file *);
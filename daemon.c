@@ -4,6 +4,7 @@
 #include "run-command.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "protocol.h"
 
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 256
@@ -21,6 +22,7 @@ static int informative_errors;
 static const char daemon_usage[] =
 "git daemon [--verbose] [--syslog] [--export-all]\n"
 "           [--timeout=<n>] [--init-timeout=<n>] [--max-connections=<n>]\n"
+"           [--max-client-connections=<n>] [--max-queued=<n>] [--workers=<n>]\n"
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
@@ -58,6 +60,7 @@ struct hostinfo {
 	struct strbuf canon_hostname;
 	struct strbuf ip_address;
 	struct strbuf tcp_port;
+	struct strbuf protocol;
 	unsigned int hostname_lookup_done:1;
 	unsigned int saw_extended_args:1;
 };
@@ -115,6 +118,16 @@ static void loginfo(const char *err, ...)
 	va_end(params);
 }
 
+/* The audit lines of the services are logged even when not verbose. */
+__attribute__((format (printf, 1, 2)))
+static void logaudit(const char *err, ...)
+{
+	va_list params;
+	va_start(params, err);
+	logreport(LOG_INFO, err, params);
+	va_end(params);
+}
+
 static void NORETURN daemon_die(const char *err, va_list params)
 {
 	logreport(LOG_ERR, err, params);
@@ -269,7 +282,7 @@ static const char *path_ok(const char *directory, struct hostinfo *hi)
 	return NULL;		/* Fallthrough. Deny by default */
 }
 
-typedef int (*daemon_service_fn)(void);
+typedef int (*daemon_service_fn)(const char **env);
 struct daemon_service {
 	const char *name;
 	const char *config_name;
@@ -409,7 +422,17 @@ static int run_service(const char *dir, struct daemon_service *service,
 	 */
 	signal(SIGTERM, SIG_IGN);
 
-	return service->fn();
+	if (hi->protocol.len) {
+		struct argv_array env = ARGV_ARRAY_INIT;
+		int rc;
+
+		argv_array_pushf(&env, "%s=%s",
+				 GIT_PROTOCOL_ENVIRONMENT, hi->protocol.buf);
+		rc = service->fn(env.argv);
+		argv_array_clear(&env);
+		return rc;
+	}
+	return service->fn(NULL);
 }
 
 static void copy_to_log(int fd)
@@ -425,7 +448,10 @@ static void copy_to_log(int fd)
 	}
 
 	while (strbuf_getline(&line, fp, '\n') != EOF) {
-		logerror("%s", line.buf);
+		if (starts_with(line.buf, "audit "))
+			logaudit("%s", line.buf);
+		else
+			logerror("%s", line.buf);
 		strbuf_setlen(&line, 0);
 	}
 
@@ -433,11 +459,12 @@ static void copy_to_log(int fd)
 	fclose(fp);
 }
 
-static int run_service_command(const char **argv)
+static int run_service_command(const char **argv, const char **env)
 {
 	struct child_process cld = CHILD_PROCESS_INIT;
 
 	cld.argv = argv;
+	cld.env = env;
 	cld.git_cmd = 1;
 	cld.err = -1;
 	if (start_command(&cld))
@@ -451,7 +478,7 @@ static int run_service_command(const char **argv)
 	return finish_command(&cld);
 }
 
-static int upload_pack(void)
+static int upload_pack(const char **env)
 {
 	/* Timeout as string */
 	char timeout_buf[64];
@@ -460,19 +487,19 @@ static int upload_pack(void)
 	argv[2] = timeout_buf;
 
 	snprintf(timeout_buf, sizeof timeout_buf, "--timeout=%u", timeout);
-	return run_service_command(argv);
+	return run_service_command(argv, env);
 }
 
-static int upload_archive(void)
+static int upload_archive(const char **env)
 {
 	static const char *argv[] = { "upload-archive", ".", NULL };
-	return run_service_command(argv);
+	return run_service_command(argv, env);
 }
 
-static int receive_pack(void)
+static int receive_pack(const char **env)
 {
 	static const char *argv[] = { "receive-pack", ".", NULL };
-	return run_service_command(argv);
+	return run_service_command(argv, env);
 }
 
 static struct daemon_service daemon_service[] = {
@@ -562,6 +589,28 @@ static void canonicalize_client(struct strbuf *out, const char *in)
 	strbuf_tolower(out);
 }
 
+/*
+ * Read the parameters the client sends after the host, separated from
+ * it by an empty one so that older daemons ignore them.  Only the
+ * protocol version is understood, and passed on to the service in
+ * GIT_PROTOCOL.
+ */
+static void parse_extra_args(struct hostinfo *hi, char *extra_args, int buflen)
+{
+	char *end = extra_args + buflen;
+
+	for (; extra_args < end; extra_args += strlen(extra_args) + 1) {
+		const char *value;
+
+		if (!skip_prefix(extra_args, "version=", &value) ||
+		    !*value || strspn(value, "0123456789") != strlen(value))
+			continue;
+		if (hi->protocol.len)
+			strbuf_addch(&hi->protocol, ':');
+		strbuf_addf(&hi->protocol, "version=%s", value);
+	}
+}
+
 /*
  * Read the host as supplied by the client connection.
  */
@@ -593,6 +642,9 @@ static void parse_host_arg(struct hostinfo *hi, char *extra_args, int buflen)
 		if (extra_args < end && *extra_args)
 			die("Invalid request");
 	}
+
+	if (extra_args < end && !*extra_args)
+		parse_extra_args(hi, extra_args + 1, end - extra_args - 1);
 }
 
 /*
@@ -659,6 +711,7 @@ static void hostinfo_init(struct hostinfo *hi)
 	strbuf_init(&hi->canon_hostname, 0);
 	strbuf_init(&hi->ip_address, 0);
 	strbuf_init(&hi->tcp_port, 0);
+	strbuf_init(&hi->protocol, 0);
 }
 
 static void hostinfo_clear(struct hostinfo *hi)
@@ -667,6 +720,7 @@ static void hostinfo_clear(struct hostinfo *hi)
 	strbuf_release(&hi->canon_hostname);
 	strbuf_release(&hi->ip_address);
 	strbuf_release(&hi->tcp_port);
+	strbuf_release(&hi->protocol);
 }
 
 static int execute(void)
@@ -742,6 +796,8 @@ static int addrcmp(const struct sockaddr_storage *s1,
 }
 
 static int max_connections = 32;
+static int max_client_connections;
+static int max_queued = 32;
 
 static unsigned int live_children;
 
@@ -766,26 +822,6 @@ static void add_child(struct child_process *cld, struct sockaddr *addr, socklen_
 	*cradle = newborn;
 }
 
-/*
- * This gets called if the number of connections grows
- * past "max_connections".
- *
- * We kill the newest connection from a duplicate IP.
- */
-static void kill_some_child(void)
-{
-	const struct child *blanket, *next;
-
-	if (!(blanket = firstborn))
-		return;
-
-	for (; (next = blanket->next); blanket = next)
-		if (!addrcmp(&blanket->address, &next->address)) {
-			kill(blanket->cld.pid, SIGTERM);
-			break;
-		}
-}
-
 static void check_dead_children(void)
 {
 	int status;
@@ -807,29 +843,22 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
-static char **cld_argv;
-static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
-{
-	struct child_process cld = CHILD_PROCESS_INIT;
-	char addrbuf[300] = "REMOTE_ADDR=", portbuf[300];
-	char *env[] = { addrbuf, portbuf, NULL };
-
-	if (max_connections && live_children >= max_connections) {
-		kill_some_child();
-		sleep(1);  /* give it some time to die */
-		check_dead_children();
-		if (live_children >= max_connections) {
-			close(incoming);
-			logerror("Too many children, dropping connection");
-			return;
-		}
-	}
+#define REMOTE_ENV_MAX 300
 
+/*
+ * Fill addrbuf and portbuf, REMOTE_ENV_MAX bytes each, with the
+ * REMOTE_ADDR and REMOTE_PORT environment settings for addr.
+ */
+static void format_remote_env(const struct sockaddr *addr,
+			      char *addrbuf, char *portbuf)
+{
+	strcpy(addrbuf, "REMOTE_ADDR=");
+	*portbuf = '\0';
 	if (addr->sa_family == AF_INET) {
 		struct sockaddr_in *sin_addr = (void *) addr;
 		inet_ntop(addr->sa_family, &sin_addr->sin_addr, addrbuf + 12,
-		    sizeof(addrbuf) - 12);
-		snprintf(portbuf, sizeof(portbuf), "REMOTE_PORT=%d",
+		    REMOTE_ENV_MAX - 12);
+		snprintf(portbuf, REMOTE_ENV_MAX, "REMOTE_PORT=%d",
 		    ntohs(sin_addr->sin_port));
 #ifndef NO_IPV6
 	} else if (addr->sa_family == AF_INET6) {
@@ -838,13 +867,23 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 		char *buf = addrbuf + 12;
 		*buf++ = '['; *buf = '\0'; /* stpcpy() is cool */
 		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf,
-		    sizeof(addrbuf) - 13);
+		    REMOTE_ENV_MAX - 13);
 		strcat(buf, "]");
 
-		snprintf(portbuf, sizeof(portbuf), "REMOTE_PORT=%d",
+		snprintf(portbuf, REMOTE_ENV_MAX, "REMOTE_PORT=%d",
 		    ntohs(sin6_addr->sin6_port));
 #endif
 	}
+}
+
+static char **cld_argv;
+static void spawn_child(int incoming, struct sockaddr *addr, socklen_t addrlen)
+{
+	struct child_process cld = CHILD_PROCESS_INIT;
+	char addrbuf[REMOTE_ENV_MAX], portbuf[REMOTE_ENV_MAX];
+	char *env[] = { addrbuf, portbuf, NULL };
+
+	format_remote_env(addr, addrbuf, portbuf);
 
 	cld.env = (const char **)env;
 	cld.argv = (const char **)cld_argv;
@@ -857,6 +896,322 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 		add_child(&cld, addr, addrlen);
 }
 
+/*
+ * With --workers, connections are not served by a "git daemon --serve"
+ * started for each of them, but handed to one of a pool of processes
+ * forked up front.  Each worker serves one connection at a time and
+ * reports back when it is done with it.
+ */
+static int nr_workers;
+
+static struct worker {
+	pid_t pid;
+	int fd;		/* our end of the socketpair to the worker */
+	int busy;
+	struct sockaddr_storage address;
+} *workers;
+
+struct worker_request {
+	struct sockaddr_storage address;
+	socklen_t addrlen;
+};
+
+struct socketlist {
+	int *list;
+	size_t nr;
+	size_t alloc;
+};
+
+static struct socketlist *listen_sockets;
+
+#if defined(NO_POSIX_GOODIES) || defined(NO_UNIX_SOCKETS)
+
+static void start_worker(struct worker *w)
+{
+	die("--workers not supported on this platform");
+}
+
+static int send_connection(struct worker *w, int fd,
+			   struct sockaddr *addr, socklen_t addrlen)
+{
+	return -1;
+}
+
+#else
+
+static int send_connection(struct worker *w, int fd,
+			   struct sockaddr *addr, socklen_t addrlen)
+{
+	struct worker_request req;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	memset(&req, 0, sizeof(req));
+	memcpy(&req.address, addr, addrlen);
+	req.addrlen = addrlen;
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(w->fd, &msg, 0) != sizeof(req))
+		return -1;
+	return 0;
+}
+
+/*
+ * Returns the connection the parent handed us, or -1 when it has
+ * gone away.
+ */
+static int receive_connection(int sock, struct worker_request *req)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	ssize_t n;
+	int fd;
+
+	iov.iov_base = req;
+	iov.iov_len = sizeof(*req);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		n = recvmsg(sock, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n != sizeof(*req))
+		return -1;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+static void NORETURN worker_loop(int sock)
+{
+	static char addrbuf[REMOTE_ENV_MAX], portbuf[REMOTE_ENV_MAX];
+	struct strbuf cwd = STRBUF_INIT;
+	struct worker_request req;
+	int fd, null_fd, rc;
+
+	signal(SIGCHLD, SIG_DFL);
+	if (strbuf_getcwd(&cwd))
+		die_errno("unable to get current working directory");
+
+	while ((fd = receive_connection(sock, &req)) >= 0) {
+		format_remote_env((struct sockaddr *)&req.address,
+				  addrbuf, portbuf);
+		putenv(addrbuf);
+		putenv(portbuf);
+		if (dup2(fd, 0) < 0 || dup2(fd, 1) < 0)
+			die_errno("unable to set up connection");
+		close(fd);
+
+		rc = execute();
+		loginfo("Disconnected%s", rc ? " (with error)" : "");
+
+		/* forget what serving this repository left behind */
+		signal(SIGTERM, SIG_DFL);
+		if (chdir(cwd.buf))
+			die_errno("unable to go back to '%s'", cwd.buf);
+		git_config_clear();
+		null_fd = open("/dev/null", O_RDWR);
+		if (null_fd < 0 || dup2(null_fd, 0) < 0 || dup2(null_fd, 1) < 0)
+			die_errno("unable to close connection");
+		if (null_fd > 1)
+			close(null_fd);
+
+		if (write_in_full(sock, "", 1) != 1)
+			break;
+	}
+	exit(0);
+}
+
+static void start_worker(struct worker *w)
+{
+	int sv[2], i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		die_errno("unable to create socketpair for worker");
+	w->pid = fork();
+	if (w->pid < 0)
+		die_errno("unable to fork worker");
+	if (!w->pid) {
+		close(sv[0]);
+		for (i = 0; i < listen_sockets->nr; i++)
+			close(listen_sockets->list[i]);
+		for (i = 0; i < nr_workers; i++)
+			if (&workers[i] != w && workers[i].pid > 0)
+				close(workers[i].fd);
+		worker_loop(sv[1]);
+	}
+	close(sv[1]);
+	w->fd = sv[0];
+	w->busy = 0;
+}
+
+#endif
+
+static struct worker *idle_worker(void)
+{
+	int i;
+
+	for (i = 0; i < nr_workers; i++)
+		if (!workers[i].busy)
+			return &workers[i];
+	return NULL;
+}
+
+static void worker_done(struct worker *w)
+{
+	char c;
+	ssize_t n = xread(w->fd, &c, 1);
+
+	if (w->busy) {
+		w->busy = 0;
+		live_children--;
+	}
+	if (n == 1)
+		return;
+
+	/* the worker died, most likely while serving a connection */
+	close(w->fd);
+	waitpid(w->pid, NULL, 0);
+	loginfo("[%"PRIuMAX"] Worker exited", (uintmax_t)w->pid);
+	start_worker(w);
+}
+
+static int client_connections(const struct sockaddr_storage *addr)
+{
+	const struct child *blanket;
+	int i, nr = 0;
+
+	for (blanket = firstborn; blanket; blanket = blanket->next)
+		if (!addrcmp(&blanket->address, addr))
+			nr++;
+	for (i = 0; i < nr_workers; i++)
+		if (workers[i].busy && !addrcmp(&workers[i].address, addr))
+			nr++;
+	return nr;
+}
+
+static int can_serve(const struct sockaddr_storage *addr)
+{
+	if (max_connections && live_children >= max_connections)
+		return 0;
+	if (nr_workers && !idle_worker())
+		return 0;
+	if (max_client_connections &&
+	    client_connections(addr) >= max_client_connections)
+		return 0;
+	return 1;
+}
+
+static void dispatch(int incoming, struct sockaddr *addr, socklen_t addrlen)
+{
+	struct worker *w;
+
+	if (!nr_workers) {
+		spawn_child(incoming, addr, addrlen);
+		return;
+	}
+
+	w = idle_worker();
+	if (send_connection(w, incoming, addr, addrlen))
+		logerror("unable to hand connection to worker: %s",
+			 strerror(errno));
+	else {
+		w->busy = 1;
+		memcpy(&w->address, addr, addrlen);
+		live_children++;
+	}
+	close(incoming);
+}
+
+/*
+ * Connections that arrive while we are at --max-connections, or while
+ * their client is at --max-client-connections, wait here in the order
+ * they came in instead of being dropped.
+ */
+static struct pending {
+	struct pending *next;
+	int fd;
+	struct sockaddr_storage address;
+	socklen_t addrlen;
+} *pending, **pending_tail = &pending;
+static int nr_pending;
+
+static void run_queue(void)
+{
+	struct pending **pp = &pending, *p;
+
+	while ((p = *pp)) {
+		if (!can_serve(&p->address)) {
+			/* later ones from other clients may still go */
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		if (pending_tail == &p->next)
+			pending_tail = pp;
+		nr_pending--;
+		dispatch(p->fd, (struct sockaddr *)&p->address, p->addrlen);
+		free(p);
+	}
+}
+
+static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
+{
+	struct sockaddr_storage ss;
+	struct pending *p;
+
+	memset(&ss, 0, sizeof(ss));
+	memcpy(&ss, addr, addrlen);
+
+	run_queue();
+	if (can_serve(&ss)) {
+		dispatch(incoming, addr, addrlen);
+		return;
+	}
+
+	if (nr_pending >= max_queued) {
+		close(incoming);
+		logerror("Too many connections waiting, dropping connection");
+		return;
+	}
+	p = xcalloc(1, sizeof(*p));
+	p->fd = incoming;
+	p->address = ss;
+	p->addrlen = addrlen;
+	*pending_tail = p;
+	pending_tail = &p->next;
+	nr_pending++;
+}
+
 static void child_handler(int signo)
 {
 	/*
@@ -877,12 +1232,6 @@ static int set_reuse_addr(int sockfd)
 			  &on, sizeof(on));
 }
 
-struct socketlist {
-	int *list;
-	size_t nr;
-	size_t alloc;
-};
-
 static const char *ip2str(int family, struct sockaddr *sin, socklen_t len)
 {
 #ifdef NO_IPV6
@@ -1062,9 +1411,9 @@ static void socksetup(struct string_list *listen_addr, int listen_port, struct s
 static int service_loop(struct socketlist *socklist)
 {
 	struct pollfd *pfd;
-	int i;
+	int i, nr_pfd = socklist->nr + nr_workers;
 
-	pfd = xcalloc(socklist->nr, sizeof(struct pollfd));
+	pfd = xcalloc(nr_pfd, sizeof(struct pollfd));
 
 	for (i = 0; i < socklist->nr; i++) {
 		pfd[i].fd = socklist->list[i];
@@ -1077,8 +1426,14 @@ static int service_loop(struct socketlist *socklist)
 		int i;
 
 		check_dead_children();
+		run_queue();
+
+		for (i = 0; i < nr_workers; i++) {
+			pfd[socklist->nr + i].fd = workers[i].fd;
+			pfd[socklist->nr + i].events = POLLIN;
+		}
 
-		if (poll(pfd, socklist->nr, -1) < 0) {
+		if (poll(pfd, nr_pfd, -1) < 0) {
 			if (errno != EINTR) {
 				logerror("Poll failed, resuming: %s",
 				      strerror(errno));
@@ -1087,6 +1442,10 @@ static int service_loop(struct socketlist *socklist)
 			continue;
 		}
 
+		for (i = 0; i < nr_workers; i++)
+			if (pfd[socklist->nr + i].revents & (POLLIN | POLLHUP))
+				worker_done(&workers[i]);
+
 		for (i = 0; i < socklist->nr; i++) {
 			if (pfd[i].revents & POLLIN) {
 				union {
@@ -1178,6 +1537,15 @@ static int serve(struct string_list *listen_addr, int listen_port,
 
 	drop_privileges(cred);
 
+	if (nr_workers) {
+		int i;
+
+		listen_sockets = &socklist;
+		workers = xcalloc(nr_workers, sizeof(*workers));
+		for (i = 0; i < nr_workers; i++)
+			start_worker(&workers[i]);
+	}
+
 	loginfo("Ready to rumble");
 
 	return service_loop(&socklist);
@@ -1253,6 +1621,24 @@ int main(int argc, char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (skip_prefix(arg, "--max-client-connections=", &v)) {
+			max_client_connections = atoi(v);
+			if (max_client_connections < 0)
+				max_client_connections = 0;	/* unlimited */
+			continue;
+		}
+		if (skip_prefix(arg, "--max-queued=", &v)) {
+			max_queued = atoi(v);
+			if (max_queued < 0)
+				max_queued = 0;
+			continue;
+		}
+		if (skip_prefix(arg, "--workers=", &v)) {
+			nr_workers = atoi(v);
+			if (nr_workers < 0)
+				nr_workers = 0;
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
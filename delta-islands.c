@@ -0,0 +1,337 @@
+#include "cache.h"
+#include "blob.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "diff.h"
+#include "revision.h"
+#include "progress.h"
+#include "string-list.h"
+#include "sha1-array.h"
+#include "khash.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "delta-islands.h"
+
+/*
+ * The islands an object is reachable from, one bit per island.  Objects
+ * usually have the same marks as the commit or tree they were reached
+ * from, so bitmaps are shared copy-on-write, counted by "refcount".
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static uint32_t island_bitmap_size;
+static khash_sha1 *island_marks;
+static unsigned int island_counter;
+
+static regex_t *island_regexes;
+static unsigned int island_regexes_nr, island_regexes_alloc;
+static struct string_list remote_islands = STRING_LIST_INIT_DUP;
+
+#define ISLAND_BITMAP_BLOCK(x) ((x) / 32)
+#define ISLAND_BITMAP_MASK(x) (1u << ((x) % 32))
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) + island_bitmap_size * 4;
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b, old, size);
+	b->refcount = 1;
+	return b;
+}
+
+static void island_bitmap_or(struct island_bitmap *a,
+			     const struct island_bitmap *b)
+{
+	uint32_t i;
+
+	for (i = 0; i < island_bitmap_size; i++)
+		a->bits[i] |= b->bits[i];
+}
+
+/* Is every island of "self" also an island of "super"? */
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	uint32_t i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static void island_bitmap_set(struct island_bitmap *self, uint32_t i)
+{
+	self->bits[ISLAND_BITMAP_BLOCK(i)] |= ISLAND_BITMAP_MASK(i);
+}
+
+int in_same_island(const unsigned char *trg, const unsigned char *src)
+{
+	khiter_t trg_pos, src_pos;
+
+	if (!island_marks)
+		return 1;
+
+	/*
+	 * An object no island reaches is not worth protecting; it can be
+	 * a delta against anything.
+	 */
+	trg_pos = kh_get_sha1(island_marks, trg);
+	if (trg_pos >= kh_end(island_marks))
+		return 1;
+
+	/* ...but nothing in an island may be based on such an object */
+	src_pos = kh_get_sha1(island_marks, src);
+	if (src_pos >= kh_end(island_marks))
+		return 0;
+
+	return island_bitmap_is_subset(kh_value(island_marks, trg_pos),
+				       kh_value(island_marks, src_pos));
+}
+
+int island_delta_cmp(const unsigned char *a, const unsigned char *b)
+{
+	int a_can_use_b, b_can_use_a;
+
+	if (!island_marks)
+		return 0;
+
+	/*
+	 * Sort an object in more islands first, so that it comes early
+	 * enough in the delta window to serve as a base for the other.
+	 */
+	a_can_use_b = in_same_island(a, b);
+	b_can_use_a = in_same_island(b, a);
+	if (a_can_use_b == b_can_use_a)
+		return 0;
+	return a_can_use_b ? 1 : -1;
+}
+
+static struct island_bitmap *create_or_get_island_marks(struct object *obj)
+{
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->sha1, &hash_ret);
+	if (hash_ret)
+		kh_value(island_marks, pos) = island_bitmap_new(NULL);
+	return kh_value(island_marks, pos);
+}
+
+/*
+ * Add the islands in "marks" to those of "obj".  Returns 1 if that
+ * gave "obj" any island it did not have yet.
+ */
+static int set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b;
+	khiter_t pos;
+	int hash_ret;
+
+	pos = kh_put_sha1(island_marks, obj->sha1, &hash_ret);
+	if (hash_ret) {
+		/* no marks yet; share those of the parent */
+		marks->refcount++;
+		kh_value(island_marks, pos) = marks;
+		return 1;
+	}
+
+	b = kh_value(island_marks, pos);
+	if (island_bitmap_is_subset(marks, b))
+		return 0;
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = kh_value(island_marks, pos) = island_bitmap_new(b);
+	}
+	island_bitmap_or(b, marks);
+	return 1;
+}
+
+static int island_config_callback(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.island")) {
+		int ret;
+
+		if (!v)
+			return config_error_nonbool(k);
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1,
+			   island_regexes_alloc);
+		ret = regcomp(&island_regexes[island_regexes_nr], v,
+			      REG_EXTENDED);
+		if (ret)
+			die("failed to load island regex for '%s': %s", k, v);
+		island_regexes_nr++;
+		return 0;
+	}
+	return 0;
+}
+
+/*
+ * The island of a ref is named by the groups captured by the first
+ * "pack.island" regex it matches, joined by '-'; a regex without groups
+ * puts every ref it matches into the same island.
+ */
+static int find_island_for_ref(const char *refname, const struct object_id *oid,
+			       int flags, void *data)
+{
+	regmatch_t matches[16];
+	struct strbuf island_name = STRBUF_INIT;
+	struct string_list_item *item;
+	unsigned int i;
+	int m;
+
+	for (i = 0; i < island_regexes_nr; i++)
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	if (i == island_regexes_nr)
+		return 0;
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (island_name.len)
+			strbuf_addch(&island_name, '-');
+		strbuf_add(&island_name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	item = string_list_insert(&remote_islands, island_name.buf);
+	if (!item->util)
+		item->util = xcalloc(1, sizeof(struct sha1_array));
+	sha1_array_append(item->util, oid->hash);
+	strbuf_release(&island_name);
+	return 0;
+}
+
+static void mark_remote_island(struct sha1_array *tips)
+{
+	int i;
+
+	for (i = 0; i < tips->nr; i++) {
+		struct object *obj = parse_object(tips->sha1[i]);
+
+		/* mark tags and the commits they point at alike */
+		while (obj) {
+			island_bitmap_set(create_or_get_island_marks(obj),
+					  island_counter);
+			if (obj->type != OBJ_TAG)
+				break;
+			obj = ((struct tag *)obj)->tagged;
+			if (obj)
+				obj = parse_object(obj->sha1);
+		}
+	}
+	island_counter++;
+}
+
+void load_delta_islands(void)
+{
+	int i;
+
+	island_marks = kh_init_sha1();
+
+	git_config(island_config_callback, NULL);
+	for_each_ref(find_island_for_ref, NULL);
+	island_bitmap_size = remote_islands.nr / 32 + 1;
+
+	for (i = 0; i < remote_islands.nr; i++)
+		mark_remote_island(remote_islands.items[i].util);
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	khiter_t pos = kh_get_sha1(island_marks, commit->object.sha1);
+	struct island_bitmap *root_marks;
+	struct commit_list *p;
+
+	if (pos >= kh_end(island_marks))
+		return;
+	root_marks = kh_value(island_marks, pos);
+
+	if (parse_commit(commit))
+		return;
+	set_island_marks(&get_commit_tree(commit)->object, root_marks);
+	for (p = commit->parents; p; p = p->next) {
+		if (p->item->object.flags & UNINTERESTING)
+			continue;
+		set_island_marks(&p->item->object, root_marks);
+	}
+}
+
+/*
+ * A tree can be shared by trees with different marks, and we cannot
+ * cheaply visit the trees parents first, so revisit a tree whenever it
+ * gains an island until nothing changes any more.
+ */
+void resolve_tree_islands(int progress, struct packing_data *to_pack)
+{
+	struct progress *progress_state = NULL;
+	struct tree **todo = NULL;
+	unsigned int nr = 0, alloc = 0, done = 0;
+	uint32_t i;
+
+	if (!island_marks)
+		return;
+
+	for (i = 0; i < to_pack->nr_objects; i++) {
+		struct object_entry *e = &to_pack->objects[i];
+		if (oe_type(e) != OBJ_TREE ||
+		    kh_get_sha1(island_marks, e->idx.sha1) >= kh_end(island_marks))
+			continue;
+		ALLOC_GROW(todo, nr + 1, alloc);
+		todo[nr++] = lookup_tree(e->idx.sha1);
+	}
+
+	if (progress)
+		progress_state = start_progress(_("Propagating island marks"), 0);
+
+	while (nr) {
+		struct tree *tree = todo[--nr];
+		struct island_bitmap *marks;
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		display_progress(progress_state, ++done);
+		if (!tree || parse_tree(tree))
+			continue;
+		marks = kh_value(island_marks,
+				 kh_get_sha1(island_marks, tree->object.sha1));
+
+		init_tree_desc(&desc, tree->buffer, tree->size);
+		while (tree_entry(&desc, &entry)) {
+			struct tree *subtree;
+			struct blob *blob;
+
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			if (!S_ISDIR(entry.mode)) {
+				blob = lookup_blob(entry.sha1);
+				if (blob)
+					set_island_marks(&blob->object, marks);
+				continue;
+			}
+			subtree = lookup_tree(entry.sha1);
+			if (subtree && set_island_marks(&subtree->object, marks)) {
+				ALLOC_GROW(todo, nr + 1, alloc);
+				todo[nr++] = subtree;
+			}
+		}
+		free_tree_buffer(tree);
+	}
+
+	stop_progress(&progress_state);
+	free(todo);
+}
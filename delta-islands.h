@@ -0,0 +1,41 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+/*
+ * Delta islands group the refs of a repository (e.g. the refs of each
+ * fork in a shared object store) with the regular expressions given in
+ * the "pack.island" configuration.  pack-objects then only makes an
+ * object a delta against a base that is reachable from every island
+ * the object itself is reachable from, so that a pack served for any
+ * one island can reuse those deltas as they are.
+ */
+
+struct commit;
+struct packing_data;
+
+/* Read "pack.island" and mark the tips of every island. */
+extern void load_delta_islands(void);
+
+/*
+ * Pass the island marks of "commit" on to its tree and parents.  Call
+ * it for each commit during the traversal, children before parents.
+ */
+extern void propagate_island_marks(struct commit *commit);
+
+/* Pass the island marks of the trees in "to_pack" down to their entries. */
+extern void resolve_tree_islands(int progress, struct packing_data *to_pack);
+
+/*
+ * Can the object "trg" be stored as a delta against "src" without
+ * crossing an island boundary?  Always true when islands are not in use.
+ */
+extern int in_same_island(const unsigned char *trg, const unsigned char *src);
+
+/*
+ * qsort-style comparison that orders the object reachable from more
+ * islands first, and returns 0 when each (or neither) could be a base
+ * for the other.
+ */
+extern int island_delta_cmp(const unsigned char *a, const unsigned char *b);
+
+#endif
@@ -79,6 +79,19 @@ extern void *patch_delta(const void *src_buf, unsigned long src_size,
 			 const void *delta_buf, unsigned long delta_size,
 			 unsigned long *dst_size);
 
+/*
+ * patch_delta_chain: recreate the target of a chain of "nr" deltas,
+ * deltas[0] applying to the source buffer and each of the others to
+ * the result of the one before it
+ *
+ * The deltas are composed, so that the target is written in one pass
+ * over the source, without the intermediate results of the chain.
+ * Returns NULL, without a word, if any of the deltas is bad.
+ */
+extern void *patch_delta_chain(const void *src_buf, unsigned long src_size,
+			       void **deltas, const unsigned long *delta_sizes,
+			       int nr, unsigned long *dst_size);
+
 /* the smallest possible delta size is 4 bytes */
 #define DELTA_SIZE_MIN	4
 
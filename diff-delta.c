@@ -112,32 +112,31 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * The index is a flat array of entries grouped by hash bucket, with
+ * 32-bit offsets into the source buffer (the delta format cannot
+ * address more than that anyway), and the start of each bucket in it.
+ */
 struct index_entry {
-	const unsigned char *ptr;
+	unsigned int offset;
 	unsigned int val;
 };
 
-struct unpacked_index_entry {
-	struct index_entry entry;
-	struct unpacked_index_entry *next;
-};
-
 struct delta_index {
 	unsigned long memsize;
 	const void *src_buf;
 	unsigned long src_size;
 	unsigned int hash_mask;
-	struct index_entry *hash[FLEX_ARRAY];
+	struct index_entry *entries;
+	unsigned int hash[FLEX_ARRAY];
 };
 
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 {
-	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
+	unsigned int i, hsize, hmask, entries, prev_val, *hash_count, *pos;
 	const unsigned char *data, *buffer = buf;
 	struct delta_index *index;
-	struct unpacked_index_entry *entry, **hash;
-	struct index_entry *packed_entry, **packed_hash;
-	void *mem;
+	struct index_entry *entry, *block, *sorted, *packed_entry;
 	unsigned long memsize;
 
 	if (!buf || !bufsize)
@@ -159,27 +158,18 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	hsize = 1 << i;
 	hmask = hsize - 1;
 
-	/* allocate lookup index */
-	memsize = sizeof(*hash) * hsize +
-		  sizeof(*entry) * entries;
-	mem = malloc(memsize);
-	if (!mem)
+	/* fingerprint the blocks, from the end of the buffer */
+	block = malloc(sizeof(*block) * (entries ? entries : 1));
+	if (!block)
 		return NULL;
-	hash = mem;
-	mem = hash + hsize;
-	entry = mem;
-
-	memset(hash, 0, hsize * sizeof(*hash));
-
-	/* allocate an array to count hash entries */
-	hash_count = calloc(hsize, sizeof(*hash_count));
+	hash_count = calloc(hsize + 1, sizeof(*hash_count));
 	if (!hash_count) {
-		free(hash);
+		free(block);
 		return NULL;
 	}
 
-	/* then populate the index */
 	prev_val = ~0;
+	entry = block;
 	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
 	     data >= buffer;
 	     data -= RABIN_WINDOW) {
@@ -188,19 +178,40 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
-			entry[-1].entry.ptr = data + RABIN_WINDOW;
+			entry[-1].offset = data + RABIN_WINDOW - buffer;
 			--entries;
 		} else {
 			prev_val = val;
-			i = val & hmask;
-			entry->entry.ptr = data + RABIN_WINDOW;
-			entry->entry.val = val;
-			entry->next = hash[i];
-			hash[i] = entry++;
-			hash_count[i]++;
+			entry->offset = data + RABIN_WINDOW - buffer;
+			entry->val = val;
+			entry++;
+			hash_count[val & hmask]++;
 		}
 	}
 
+	/*
+	 * Sort the blocks by bucket, each bucket in the order of their
+	 * offsets (we fingerprinted them backwards).
+	 */
+	sorted = malloc(sizeof(*sorted) * (entries ? entries : 1));
+	pos = malloc(sizeof(*pos) * hsize);
+	if (!sorted || !pos) {
+		free(sorted);
+		free(pos);
+		free(hash_count);
+		free(block);
+		return NULL;
+	}
+	for (i = 0, prev_val = 0; i < hsize; i++) {
+		pos[i] = prev_val;
+		prev_val += hash_count[i];
+	}
+	while (entry > block) {
+		entry--;
+		sorted[pos[entry->val & hmask]++] = *entry;
+	}
+	free(block);
+
 	/*
 	 * Determine a limit on the number of entries in the same hash
 	 * bucket.  This guards us against pathological data sets causing
@@ -213,84 +224,61 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	 * uniformly to still preserve a good repartition across
 	 * the reference buffer.
 	 */
-	for (i = 0; i < hsize; i++) {
-		int acc;
+	for (i = 0; i < hsize; i++)
+		if (hash_count[i] > HASH_LIMIT)
+			entries -= hash_count[i] - HASH_LIMIT;
 
-		if (hash_count[i] <= HASH_LIMIT)
-			continue;
-
-		/* We leave exactly HASH_LIMIT entries in the bucket */
-		entries -= hash_count[i] - HASH_LIMIT;
-
-		entry = hash[i];
-		acc = 0;
-
-		/*
-		 * Assume that this loop is gone through exactly
-		 * HASH_LIMIT times and is entered and left with
-		 * acc==0.  So the first statement in the loop
-		 * contributes (hash_count[i]-HASH_LIMIT)*HASH_LIMIT
-		 * to the accumulator, and the inner loop consequently
-		 * is run (hash_count[i]-HASH_LIMIT) times, removing
-		 * one element from the list each time.  Since acc
-		 * balances out to 0 at the final run, the inner loop
-		 * body can't be left with entry==NULL.  So we indeed
-		 * encounter entry==NULL in the outer loop only.
-		 */
-		do {
-			acc += hash_count[i] - HASH_LIMIT;
-			if (acc > 0) {
-				struct unpacked_index_entry *keep = entry;
-				do {
-					entry = entry->next;
-					acc -= HASH_LIMIT;
-				} while (acc > 0);
-				keep->next = entry->next;
-			}
-			entry = entry->next;
-		} while (entry);
-	}
-	free(hash_count);
-
-	/*
-	 * Now create the packed index in array form
-	 * rather than linked lists.
-	 */
 	memsize = sizeof(*index)
-		+ sizeof(*packed_hash) * (hsize+1)
+		+ sizeof(*index->hash) * (hsize+1)
 		+ sizeof(*packed_entry) * entries;
-	mem = malloc(memsize);
-	if (!mem) {
-		free(hash);
+	index = malloc(memsize);
+	if (!index) {
+		free(sorted);
+		free(pos);
+		free(hash_count);
 		return NULL;
 	}
-
-	index = mem;
 	index->memsize = memsize;
 	index->src_buf = buf;
 	index->src_size = bufsize;
 	index->hash_mask = hmask;
+	index->entries = (struct index_entry *)(index->hash + hsize + 1);
 
-	mem = index->hash;
-	packed_hash = mem;
-	mem = packed_hash + (hsize+1);
-	packed_entry = mem;
-
+	packed_entry = index->entries;
+	entry = sorted;
 	for (i = 0; i < hsize; i++) {
+		struct index_entry *end = entry + hash_count[i];
+		int acc = 0;
+
+		index->hash[i] = packed_entry - index->entries;
+		if (hash_count[i] <= HASH_LIMIT) {
+			while (entry < end)
+				*packed_entry++ = *entry++;
+			continue;
+		}
+
 		/*
-		 * Coalesce all entries belonging to one linked list
-		 * into consecutive array entries.
+		 * Keep exactly HASH_LIMIT entries: after each kept one,
+		 * drop as many as the accumulated excess asks for, so
+		 * that acc balances out to 0 at the end of the bucket.
 		 */
-		packed_hash[i] = packed_entry;
-		for (entry = hash[i]; entry; entry = entry->next)
-			*packed_entry++ = entry->entry;
+		while (entry < end) {
+			*packed_entry++ = *entry++;
+			acc += hash_count[i] - HASH_LIMIT;
+			while (acc > 0) {
+				entry++;
+				acc -= HASH_LIMIT;
+			}
+		}
 	}
 
 	/* Sentinel value to indicate the length of the last hash bucket */
-	packed_hash[hsize] = packed_entry;
+	index->hash[hsize] = packed_entry - index->entries;
 
-	assert(packed_entry - (struct index_entry *)mem == entries);
-	free(hash);
+	assert(packed_entry - index->entries == entries);
+	free(sorted);
+	free(pos);
+	free(hash_count);
 
 	return index;
 }
@@ -368,12 +356,14 @@ create_delta(const struct delta_index *index,
 	msize = 0;
 	while (data < top) {
 		if (msize < 4096) {
-			struct index_entry *entry;
+			const struct index_entry *entry, *end;
 			val ^= U[data[-RABIN_WINDOW]];
 			val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
 			i = val & index->hash_mask;
-			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
-				const unsigned char *ref = entry->ptr;
+			entry = index->entries + index->hash[i];
+			end = index->entries + index->hash[i+1];
+			for (; entry < end; entry++) {
+				const unsigned char *ref = ref_data + entry->offset;
 				const unsigned char *src = data;
 				unsigned int ref_size = ref_top - ref;
 				if (entry->val != val)
@@ -384,10 +374,10 @@ create_delta(const struct delta_index *index,
 					break;
 				while (ref_size-- && *src++ == *ref)
 					ref++;
-				if (msize < ref - entry->ptr) {
+				if (msize < ref - ref_data - entry->offset) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
-					moff = entry->ptr - ref_data;
+					msize = ref - ref_data - entry->offset;
+					moff = entry->offset;
 					if (msize >= 4096) /* good enough */
 						break;
 				}
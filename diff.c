@@ -17,6 +17,9 @@
 #include "ll-merge.h"
 #include "string-list.h"
 #include "argv-array.h"
+#include "diffstat-pipeline.h"
+#include "patch-pipeline.h"
+#include "thread-utils.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -26,6 +29,8 @@
 
 static int diff_detect_rename_default;
 static int diff_rename_limit_default = 400;
+static int diff_large_renames_default;
+static int diff_threads = 1;
 static int diff_suppress_blank_empty;
 static int diff_use_color_default = -1;
 static int diff_context_default = 3;
@@ -237,6 +242,17 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.largerenames")) {
+		diff_large_renames_default = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "diff.threads")) {
+		diff_threads = git_config_int(var, value);
+		if (diff_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    diff_threads, var);
+		return 0;
+	}
 
 	if (userdiff_config(var, value) < 0)
 		return -1;
@@ -1419,17 +1435,6 @@ static struct diffstat_file *diffstat_add(struct diffstat_t *diffstat,
 	return x;
 }
 
-static void diffstat_consume(void *priv, char *line, unsigned long len)
-{
-	struct diffstat_t *diffstat = priv;
-	struct diffstat_file *x = diffstat->files[diffstat->nr - 1];
-
-	if (line[0] == '+')
-		x->added++;
-	else if (line[0] == '-')
-		x->deleted++;
-}
-
 const char mime_boundary_leader[] = "------------";
 
 static int scale_linear(int it, int width, int max_change)
@@ -2261,6 +2266,38 @@ struct userdiff_driver *get_textconv(struct diff_filespec *one)
 	return userdiff_get_textconv(one->driver);
 }
 
+/* Crazy xdl interfaces.. */
+static void setup_patch_xdl(struct diff_options *o,
+			    struct diff_filespec *one,
+			    struct diff_filespec *two,
+			    xpparam_t *xpp, xdemitconf_t *xecfg)
+{
+	const char *diffopts = getenv("GIT_DIFF_OPTS");
+	const char *v;
+	const struct userdiff_funcname *pe;
+
+	pe = diff_funcname_pattern(one);
+	if (!pe)
+		pe = diff_funcname_pattern(two);
+
+	memset(xpp, 0, sizeof(*xpp));
+	memset(xecfg, 0, sizeof(*xecfg));
+	xpp->flags = o->xdl_opts;
+	xecfg->ctxlen = o->context;
+	xecfg->interhunkctxlen = o->interhunkcontext;
+	xecfg->flags = XDL_EMIT_FUNCNAMES;
+	if (DIFF_OPT_TST(o, FUNCCONTEXT))
+		xecfg->flags |= XDL_EMIT_FUNCCONTEXT;
+	if (pe)
+		xdiff_set_find_func(xecfg, pe->pattern, pe->cflags);
+	if (!diffopts)
+		;
+	else if (skip_prefix(diffopts, "--unified=", &v))
+		xecfg->ctxlen = strtoul(v, NULL, 10);
+	else if (skip_prefix(diffopts, "-u", &v))
+		xecfg->ctxlen = strtoul(v, NULL, 10);
+}
+
 static void builtin_diff(const char *name_a,
 			 const char *name_b,
 			 struct diff_filespec *one,
@@ -2394,13 +2431,9 @@ static void builtin_diff(const char *name_a,
 				line_prefix, lbl[0], lbl[1]);
 		o->found_changes = 1;
 	} else {
-		/* Crazy xdl interfaces.. */
-		const char *diffopts = getenv("GIT_DIFF_OPTS");
-		const char *v;
 		xpparam_t xpp;
 		xdemitconf_t xecfg;
 		struct emit_callback ecbdata;
-		const struct userdiff_funcname *pe;
 
 		if (must_show_header) {
 			fprintf(o->file, "%s", header.buf);
@@ -2410,12 +2443,6 @@ static void builtin_diff(const char *name_a,
 		mf1.size = fill_textconv(textconv_one, one, &mf1.ptr);
 		mf2.size = fill_textconv(textconv_two, two, &mf2.ptr);
 
-		pe = diff_funcname_pattern(one);
-		if (!pe)
-			pe = diff_funcname_pattern(two);
-
-		memset(&xpp, 0, sizeof(xpp));
-		memset(&xecfg, 0, sizeof(xecfg));
 		memset(&ecbdata, 0, sizeof(ecbdata));
 		ecbdata.label_path = lbl;
 		ecbdata.color_diff = want_color(o->use_color);
@@ -2425,35 +2452,25 @@ static void builtin_diff(const char *name_a,
 			check_blank_at_eof(&mf1, &mf2, &ecbdata);
 		ecbdata.opt = o;
 		ecbdata.header = header.len ? &header : NULL;
-		xpp.flags = o->xdl_opts;
-		xecfg.ctxlen = o->context;
-		xecfg.interhunkctxlen = o->interhunkcontext;
-		xecfg.flags = XDL_EMIT_FUNCNAMES;
-		if (DIFF_OPT_TST(o, FUNCCONTEXT))
-			xecfg.flags |= XDL_EMIT_FUNCCONTEXT;
-		if (pe)
-			xdiff_set_find_func(&xecfg, pe->pattern, pe->cflags);
-		if (!diffopts)
-			;
-		else if (skip_prefix(diffopts, "--unified=", &v))
-			xecfg.ctxlen = strtoul(v, NULL, 10);
-		else if (skip_prefix(diffopts, "-u", &v))
-			xecfg.ctxlen = strtoul(v, NULL, 10);
 		if (o->word_diff)
 			init_diff_words_data(&ecbdata, o, one, two);
-		xdi_diff_outf(&mf1, &mf2, fn_out_consume, &ecbdata,
-			      &xpp, &xecfg);
+		if (!patch_pipeline_replay(one, two, fn_out_consume, &ecbdata)) {
+			setup_patch_xdl(o, one, two, &xpp, &xecfg);
+			xdi_diff_outf(&mf1, &mf2, fn_out_consume, &ecbdata,
+				      &xpp, &xecfg);
+			xdiff_clear_find_func(&xecfg);
+		}
 		if (o->word_diff)
 			free_diff_words_data(&ecbdata);
 		if (textconv_one)
 			free(mf1.ptr);
 		if (textconv_two)
 			free(mf2.ptr);
-		xdiff_clear_find_func(&xecfg);
 	}
 
  free_ab_and_return:
 	strbuf_release(&header);
+	patch_pipeline_discard(one, two);
 	diff_free_filespec_data(one);
 	diff_free_filespec_data(two);
 	free(a_one);
@@ -2461,6 +2478,69 @@ static void builtin_diff(const char *name_a,
 	return;
 }
 
+/*
+ * Only blobs named by their object name can be matched up with what
+ * diff_prefetch_diffstat() handed to the pipeline.
+ */
+static int diffstat_pipeline_can_count(const struct diff_filespec *one)
+{
+	if (!DIFF_FILE_VALID(one))
+		return is_null_sha1(one->sha1);
+	return one->sha1_valid && S_ISREG(one->mode);
+}
+
+static int take_mmfile(mmfile_t *mf, struct diff_filespec *one)
+{
+	if (!DIFF_FILE_VALID(one)) {
+		mf->ptr = xstrdup("");
+		mf->size = 0;
+		return 0;
+	}
+	if (diff_populate_filespec(one, 0))
+		return -1;
+	if (one->should_free) {
+		mf->ptr = one->data;
+		one->data = NULL;
+		one->should_free = 0;
+	} else
+		mf->ptr = xmemdupz(one->data, one->size);
+	mf->size = one->size;
+	return 0;
+}
+
+void diff_prefetch_diffstat(struct diff_options *o, unsigned seq)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	int i;
+
+	if (!diffstat_pipeline_active())
+		return;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		mmfile_t mf1, mf2;
+
+		/* the same checks builtin_diffstat() makes before xdiff */
+		if (DIFF_PAIR_UNMERGED(p) ||
+		    !diffstat_pipeline_can_count(p->one) ||
+		    !diffstat_pipeline_can_count(p->two) ||
+		    !hashcmp(p->one->sha1, p->two->sha1) ||
+		    diff_filespec_is_binary(p->one) ||
+		    diff_filespec_is_binary(p->two))
+			continue;
+		if (take_mmfile(&mf1, p->one) < 0)
+			continue;
+		if (take_mmfile(&mf2, p->two) < 0) {
+			free(mf1.ptr);
+			continue;
+		}
+		diffstat_pipeline_add(p->one->sha1, p->two->sha1,
+				      &mf1, &mf2, seq);
+		diff_free_filespec_data(p->one);
+		diff_free_filespec_data(p->two);
+	}
+}
+
 static void builtin_diffstat(const char *name_a, const char *name_b,
 			     struct diff_filespec *one,
 			     struct diff_filespec *two,
@@ -2506,6 +2586,14 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		data->added = count_lines(two->data, two->size);
 	}
 
+	else if (!same_contents &&
+		 diffstat_pipeline_active() &&
+		 diffstat_pipeline_can_count(one) &&
+		 diffstat_pipeline_can_count(two) &&
+		 diffstat_pipeline_lookup(one->sha1, two->sha1, o->xdl_opts,
+					  &data->added, &data->deleted))
+		; /* counted by diff_prefetch_diffstat() */
+
 	else if (!same_contents) {
 		/* Crazy xdl interfaces.. */
 		xpparam_t xpp;
@@ -2519,8 +2607,8 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		xpp.flags = o->xdl_opts;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
-		xdi_diff_outf(&mf1, &mf2, diffstat_consume, diffstat,
-			      &xpp, &xecfg);
+		xdi_diff_count(&mf1, &mf2, &xpp, &xecfg,
+			       &data->added, &data->deleted);
 	}
 
 	diff_free_filespec_data(one);
@@ -3262,6 +3350,7 @@ void diff_setup(struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->large_renames = diff_large_renames_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = diff_context_default;
 	options->ws_error_highlight = WSEH_NEW;
@@ -4421,7 +4510,8 @@ static void patch_id_consume(void *priv, char *line, unsigned long len)
 }
 
 /* returns 0 upon success, and writes result into sha1 */
-static int diff_get_patch_id(struct diff_options *options, unsigned char *sha1)
+static int diff_get_patch_id(struct diff_options *options, unsigned char *sha1,
+			     int diff_header_only)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
 	int i;
@@ -4456,9 +4546,6 @@ static int diff_get_patch_id(struct diff_options *options, unsigned char *sha1)
 
 		diff_fill_sha1_info(p->one);
 		diff_fill_sha1_info(p->two);
-		if (fill_mmfile(&mf1, p->one) < 0 ||
-				fill_mmfile(&mf2, p->two) < 0)
-			return error("unable to read files to diff");
 
 		len1 = remove_space(p->one->path, strlen(p->one->path));
 		len2 = remove_space(p->two->path, strlen(p->two->path));
@@ -4493,6 +4580,13 @@ static int diff_get_patch_id(struct diff_options *options, unsigned char *sha1)
 					len2, p->two->path);
 		git_SHA1_Update(&ctx, buffer, len1);
 
+		if (diff_header_only)
+			continue;
+
+		if (fill_mmfile(&mf1, p->one) < 0 ||
+		    fill_mmfile(&mf2, p->two) < 0)
+			return error("unable to read files to diff");
+
 		if (diff_filespec_is_binary(p->one) ||
 		    diff_filespec_is_binary(p->two)) {
 			git_SHA1_Update(&ctx, sha1_to_hex(p->one->sha1), 40);
@@ -4511,11 +4605,12 @@ static int diff_get_patch_id(struct diff_options *options, unsigned char *sha1)
 	return 0;
 }
 
-int diff_flush_patch_id(struct diff_options *options, unsigned char *sha1)
+int diff_flush_patch_id(struct diff_options *options, unsigned char *sha1,
+			int diff_header_only)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
 	int i;
-	int result = diff_get_patch_id(options, sha1);
+	int result = diff_get_patch_id(options, sha1, diff_header_only);
 
 	for (i = 0; i < q->nr; i++)
 		diff_free_filepair(q->queue[i]);
@@ -4573,6 +4668,58 @@ void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc)
 		warning(rename_limit_advice, varname, needed);
 }
 
+/*
+ * With diff.threads, diff_flush() hands the pairs up to
+ * PATCH_LOOKAHEAD_PAIRS (or PATCH_LOOKAHEAD_BYTES of contents) ahead of
+ * the one it is showing to the patch pipeline.
+ */
+#define PATCH_LOOKAHEAD_PAIRS 64
+#define PATCH_LOOKAHEAD_BYTES (64 * 1024 * 1024)
+
+/*
+ * Hand the pair over if builtin_diff() is going to run xdiff over the
+ * contents as they are: two regular files of the same kind, neither
+ * binary nor textconv'ed nor shown by an external diff, not a complete
+ * rewrite, and not shared with another pair that might free the
+ * contents under the workers.
+ */
+static void prefetch_patch(struct diff_filepair *p, struct diff_options *o)
+{
+	struct diff_filespec *one = p->one, *two = p->two;
+	mmfile_t mf1, mf2;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+
+	if (!check_pair_status(p) || diff_unmodified_pair(p) ||
+	    DIFF_PAIR_UNMERGED(p))
+		return;
+	if (!DIFF_FILE_VALID(one) || !DIFF_FILE_VALID(two) ||
+	    !S_ISREG(one->mode) || !S_ISREG(two->mode) ||
+	    one->count > 1 || two->count > 1)
+		return;
+	if (one->sha1_valid && two->sha1_valid &&
+	    !hashcmp(one->sha1, two->sha1))
+		return;
+	if (p->status == DIFF_STATUS_MODIFIED && p->score)
+		return;
+	if (DIFF_OPT_TST(o, ALLOW_EXTERNAL)) {
+		struct userdiff_driver *drv = userdiff_find_by_path(one->path);
+		if (external_diff() || (drv && drv->external))
+			return;
+	}
+	if (DIFF_OPT_TST(o, ALLOW_TEXTCONV) &&
+	    (get_textconv(one) || get_textconv(two)))
+		return;
+	if (!DIFF_OPT_TST(o, TEXT) &&
+	    (diff_filespec_is_binary(one) || diff_filespec_is_binary(two)))
+		return;
+	if (fill_mmfile(&mf1, one) < 0 || fill_mmfile(&mf2, two) < 0)
+		return;
+
+	setup_patch_xdl(o, one, two, &xpp, &xecfg);
+	patch_pipeline_add(one, two, &mf1, &mf2, &xpp, &xecfg);
+}
+
 void diff_flush(struct diff_options *options)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
@@ -4657,6 +4804,8 @@ void diff_flush(struct diff_options *options)
 	}
 
 	if (output_format & DIFF_FORMAT_PATCH) {
+		int ahead = 0;
+
 		if (separator) {
 			fprintf(options->file, "%s%c",
 				diff_line_prefix(options),
@@ -4667,11 +4816,21 @@ void diff_flush(struct diff_options *options)
 			}
 		}
 
+		if (diff_nr_threads() > 1 && q->nr > 1)
+			start_patch_pipeline(diff_nr_threads());
 		for (i = 0; i < q->nr; i++) {
 			struct diff_filepair *p = q->queue[i];
+
+			if (ahead <= i)
+				ahead = i + 1;
+			while (patch_pipeline_active() && ahead < q->nr &&
+			       ahead - i <= PATCH_LOOKAHEAD_PAIRS &&
+			       patch_pipeline_pending() < PATCH_LOOKAHEAD_BYTES)
+				prefetch_patch(q->queue[ahead++], options);
 			if (check_pair_status(p))
 				diff_flush_patch(p, options);
 		}
+		patch_pipeline_discard_all();
 	}
 
 	if (output_format & DIFF_FORMAT_CALLBACK)
@@ -4751,12 +4910,38 @@ static void diffcore_apply_filter(struct diff_options *options)
 	*q = outq;
 }
 
+/*
+ * Name the contents of a large regular file by hashing the working
+ * tree file as a stream, as "git add" would, instead of reading it.
+ */
+static int diff_filespec_stream_sha1(struct diff_filespec *s,
+				     unsigned char *sha1)
+{
+	struct stat st;
+
+	if (s->sha1_valid) {
+		hashcpy(sha1, s->sha1);
+		return 0;
+	}
+	if (lstat(s->path, &st) || !S_ISREG(st.st_mode))
+		return -1;
+	return index_path(sha1, s->path, &st, 0);
+}
+
 /* Check whether two filespecs with the same mode and size are identical */
 static int diff_filespec_is_identical(struct diff_filespec *one,
 				      struct diff_filespec *two)
 {
 	if (S_ISGITLINK(one->mode))
 		return 0;
+	if (S_ISREG(one->mode) && one->size > big_file_threshold &&
+	    !one->data && !two->data) {
+		unsigned char sha1_one[20], sha1_two[20];
+
+		if (!diff_filespec_stream_sha1(one, sha1_one) &&
+		    !diff_filespec_stream_sha1(two, sha1_two))
+			return !hashcmp(sha1_one, sha1_two);
+	}
 	if (diff_populate_filespec(one, 0))
 		return 0;
 	if (diff_populate_filespec(two, 0))
@@ -4890,6 +5075,11 @@ int diff_result_code(struct diff_options *opt, int status)
 	return result;
 }
 
+int diff_nr_threads(void)
+{
+	return diff_threads ? diff_threads : online_cpus();
+}
+
 int diff_can_quit_early(struct diff_options *opt)
 {
 	return (DIFF_OPT_TST(opt, QUICK) &&
@@ -132,6 +132,7 @@ struct diff_options {
 	int pickaxe_opts;
 	int rename_score;
 	int rename_limit;
+	int large_renames;
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
@@ -235,6 +236,9 @@ void diff_set_mnemonic_prefix(struct diff_options *options, const char *a, const
 
 extern int diff_can_quit_early(struct diff_options *);
 
+/* The number of threads diff.threads asks for. */
+extern int diff_nr_threads(void);
+
 extern void diff_addremove(struct diff_options *,
 			   int addremove,
 			   unsigned mode,
@@ -278,6 +282,7 @@ extern void diff_setup_done(struct diff_options *);
 
 #define DIFF_PICKAXE_KIND_S	4 /* traditional plumbing counter */
 #define DIFF_PICKAXE_KIND_G	8 /* grep in the patch */
+#define DIFF_PICKAXE_PERL	16 /* the regex is Perl-compatible */
 
 extern void diffcore_std(struct diff_options *);
 extern void diffcore_fix_diff_index(struct diff_options *);
@@ -312,6 +317,12 @@ extern void diffcore_fix_diff_index(struct diff_options *);
 
 extern int diff_queue_is_empty(void);
 extern void diff_flush(struct diff_options*);
+
+/*
+ * Hand the blob pairs in the queue whose lines --stat would count over
+ * to the diffstat pipeline (see diffstat-pipeline.h), tagged with "seq".
+ */
+extern void diff_prefetch_diffstat(struct diff_options *, unsigned seq);
 extern void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc);
 
 /* diff-raw status letters */
@@ -340,7 +351,12 @@ extern int run_diff_files(struct rev_info *revs, unsigned int option);
 extern int run_diff_index(struct rev_info *revs, int cached);
 
 extern int do_diff_cache(const unsigned char *, struct diff_options *);
-extern int diff_flush_patch_id(struct diff_options *, unsigned char *);
+/*
+ * With diff_header_only, only the names and modes of the paths go
+ * into the id, which is much cheaper to compute than the full one.
+ */
+extern int diff_flush_patch_id(struct diff_options *, unsigned char *,
+			       int diff_header_only);
 
 extern int diff_result_code(struct diff_options *, int);
 
@@ -111,19 +111,22 @@ static int spanhash_cmp(const void *a_, const void *b_)
 	const struct spanhash *a = a_;
 	const struct spanhash *b = b_;
 
-	/* A count of zero compares at the end.. */
-	if (!a->cnt)
-		return !b->cnt ? 0 : 1;
-	if (!b->cnt)
-		return -1;
 	return a->hashval < b->hashval ? -1 :
 		a->hashval > b->hashval ? 1 : 0;
 }
 
+/*
+ * The result is not a hash table anymore but the sorted array of the
+ * chunks found, terminated by an entry with a zero count; it is
+ * compared with other such arrays by walking both in step, and may be
+ * kept around for a long time by rename detection, so it is shrunk to
+ * fit.
+ */
 static struct spanhash_top *hash_chars(struct diff_filespec *one)
 {
-	int i, n;
-	unsigned int accum1, accum2, hashval;
+	int i, n, nr;
+	uint64_t accum;
+	unsigned int hashval;
 	struct spanhash_top *hash;
 	unsigned char *buf = one->data;
 	unsigned int sz = one->size;
@@ -135,31 +138,39 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	hash->free = INITIAL_FREE(i);
 	memset(hash->data, 0, sizeof(struct spanhash) * (1<<i));
 
+	/*
+	 * The two 32-bit accumulators of the hash, each shifted left by
+	 * 7 bits and receiving the 7 bits shifted out of the other, are
+	 * the two halves of a 64-bit one rotated by 7 bits; the new byte
+	 * is only added to the lower half, without a carry.
+	 */
 	n = 0;
-	accum1 = accum2 = 0;
+	accum = 0;
 	while (sz) {
 		unsigned int c = *buf++;
-		unsigned int old_1 = accum1;
 		sz--;
 
 		/* Ignore CR in CRLF sequence if text */
 		if (is_text && c == '\r' && sz && *buf == '\n')
 			continue;
 
-		accum1 = (accum1 << 7) ^ (accum2 >> 25);
-		accum2 = (accum2 << 7) ^ (old_1 >> 25);
-		accum1 += c;
+		accum = (accum << 7) | (accum >> 57);
+		accum = (accum & ~(uint64_t)0xffffffff) | (uint32_t)(accum + c);
 		if (++n < 64 && c != '\n')
 			continue;
-		hashval = (accum1 + accum2 * 0x61) % HASHBASE;
+		hashval = ((uint32_t)accum + (uint32_t)(accum >> 32) * 0x61) % HASHBASE;
 		hash = add_spanhash(hash, hashval, n);
 		n = 0;
-		accum1 = accum2 = 0;
+		accum = 0;
 	}
-	qsort(hash->data,
-		1ul << hash->alloc_log2,
-		sizeof(hash->data[0]),
-		spanhash_cmp);
+
+	for (i = nr = 0; i < (1 << hash->alloc_log2); i++)
+		if (hash->data[i].cnt)
+			hash->data[nr++] = hash->data[i];
+	qsort(hash->data, nr, sizeof(hash->data[0]), spanhash_cmp);
+	hash = xrealloc(hash, sizeof(*hash) + sizeof(struct spanhash) * (nr + 1));
+	hash->data[nr].hashval = 0;
+	hash->data[nr].cnt = 0;
 	return hash;
 }
 
@@ -173,7 +184,7 @@ int diffcore_count_changes(struct diff_filespec *src,
 {
 	struct spanhash *s, *d;
 	struct spanhash_top *src_count, *dst_count;
-	unsigned long sc, la;
+	unsigned long sc, la, removed;
 
 	src_count = dst_count = NULL;
 	if (src_count_p)
@@ -190,7 +201,7 @@ int diffcore_count_changes(struct diff_filespec *src,
 		if (dst_count_p)
 			*dst_count_p = dst_count;
 	}
-	sc = la = 0;
+	sc = la = removed = 0;
 
 	s = src_count->data;
 	d = dst_count->data;
@@ -214,8 +225,12 @@ int diffcore_count_changes(struct diff_filespec *src,
 			la += dst_cnt - src_cnt;
 			sc += src_cnt;
 		}
-		else
+		else {
 			sc += dst_cnt;
+			removed += src_cnt - dst_cnt;
+			if (delta_limit && delta_limit < removed)
+				break; /* the caller is not interested */
+		}
 		s++;
 	}
 	while (d->cnt) {
@@ -231,3 +246,45 @@ int diffcore_count_changes(struct diff_filespec *src,
 	*literal_added = la;
 	return 0;
 }
+
+/*
+ * One-permutation MinHash: a single hash of each distinct chunk picks
+ * the entry of the signature it competes for, and the rest of its bits
+ * the value that has to be the smallest there.
+ */
+int diffcore_minhash(struct diff_filespec *one, void **count_p, uint32_t *sig)
+{
+	struct spanhash_top *count = NULL;
+	struct spanhash *s;
+	int i, nr = 0;
+
+	if (count_p)
+		count = *count_p;
+	if (!count) {
+		count = hash_chars(one);
+		if (count_p)
+			*count_p = count;
+	}
+
+	for (i = 0; i < MINHASH_SIZE; i++)
+		sig[i] = MINHASH_EMPTY;
+	for (s = count->data; s->cnt; s++) {
+		/* the finalizer of MurmurHash3 spreads the bits well */
+		uint32_t h = s->hashval;
+
+		h ^= h >> 16;
+		h *= 0x85ebca6b;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35;
+		h ^= h >> 16;
+		i = h % MINHASH_SIZE;
+		h /= MINHASH_SIZE;
+		if (h < sig[i])
+			sig[i] = h;
+		nr++;
+	}
+
+	if (!count_p)
+		free(count);
+	return nr;
+}
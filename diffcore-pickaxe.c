@@ -7,13 +7,26 @@
 #include "diffcore.h"
 #include "xdiff-interface.h"
 #include "kwset.h"
+#include "thread-utils.h"
+#include "grep.h"
 
-typedef int (*pickaxe_fn)(mmfile_t *one, mmfile_t *two,
-			  struct diff_options *o,
-			  regex_t *regexp, kwset_t kws);
+struct pickaxe_needle {
+	regex_t regex, *regexp;
+	struct grep_pat *perl;
+	kwset_t kws;
+};
+
+/* Match like regexec() against the bytes from "line" up to "eol". */
+static int needle_regexec(struct pickaxe_needle *n, const char *line,
+			  const char *eol, regmatch_t *match, int eflags)
+{
+	if (n->perl)
+		return perl_regexec(n->perl, line, eol, match, eflags);
+	return regexec(n->regexp, line, 1, match, eflags);
+}
 
 struct diffgrep_cb {
-	regex_t *regexp;
+	struct pickaxe_needle *needle;
 	int hit;
 };
 
@@ -34,13 +47,14 @@ static void diffgrep_consume(void *priv, char *line, unsigned long len)
 	/* Yuck -- line ought to be "const char *"! */
 	hold = line[len];
 	line[len] = '\0';
-	data->hit = !regexec(data->regexp, line + 1, 1, &regmatch, 0);
+	data->hit = !needle_regexec(data->needle, line + 1, line + len,
+				    &regmatch, 0);
 	line[len] = hold;
 }
 
 static int diff_grep(mmfile_t *one, mmfile_t *two,
 		     struct diff_options *o,
-		     regex_t *regexp, kwset_t kws)
+		     struct pickaxe_needle *n)
 {
 	regmatch_t regmatch;
 	struct diffgrep_cb ecbdata;
@@ -48,9 +62,11 @@ static int diff_grep(mmfile_t *one, mmfile_t *two,
 	xdemitconf_t xecfg;
 
 	if (!one)
-		return !regexec(regexp, two->ptr, 1, &regmatch, 0);
+		return !needle_regexec(n, two->ptr, two->ptr + two->size,
+				       &regmatch, 0);
 	if (!two)
-		return !regexec(regexp, one->ptr, 1, &regmatch, 0);
+		return !needle_regexec(n, one->ptr, one->ptr + one->size,
+				       &regmatch, 0);
 
 	/*
 	 * We have both sides; need to run textual diff and see if
@@ -58,7 +74,7 @@ static int diff_grep(mmfile_t *one, mmfile_t *two,
 	 */
 	memset(&xpp, 0, sizeof(xpp));
 	memset(&xecfg, 0, sizeof(xecfg));
-	ecbdata.regexp = regexp;
+	ecbdata.needle = n;
 	ecbdata.hit = 0;
 	xecfg.ctxlen = o->context;
 	xecfg.interhunkctxlen = o->interhunkcontext;
@@ -67,7 +83,7 @@ static int diff_grep(mmfile_t *one, mmfile_t *two,
 	return ecbdata.hit;
 }
 
-static unsigned int contains(mmfile_t *mf, regex_t *regexp, kwset_t kws)
+static unsigned int contains(mmfile_t *mf, struct pickaxe_needle *n)
 {
 	unsigned int cnt;
 	unsigned long sz;
@@ -77,12 +93,14 @@ static unsigned int contains(mmfile_t *mf, regex_t *regexp, kwset_t kws)
 	data = mf->ptr;
 	cnt = 0;
 
-	if (regexp) {
+	if (n->regexp || n->perl) {
 		regmatch_t regmatch;
 		int flags = 0;
+		const char *end = data + strlen(data);
 
 		assert(data[sz] == '\0');
-		while (*data && !regexec(regexp, data, 1, &regmatch, flags)) {
+		while (*data &&
+		       !needle_regexec(n, data, end, &regmatch, flags)) {
 			flags |= REG_NOTBOL;
 			data += regmatch.rm_eo;
 			if (*data && regmatch.rm_so == regmatch.rm_eo)
@@ -93,7 +111,7 @@ static unsigned int contains(mmfile_t *mf, regex_t *regexp, kwset_t kws)
 	} else { /* Classic exact string match */
 		while (sz) {
 			struct kwsmatch kwsm;
-			size_t offset = kwsexec(kws, data, sz, &kwsm);
+			size_t offset = kwsexec(n->kws, data, sz, &kwsm);
 			if (offset == -1)
 				break;
 			sz -= offset + kwsm.size[0];
@@ -104,23 +122,393 @@ static unsigned int contains(mmfile_t *mf, regex_t *regexp, kwset_t kws)
 	return cnt;
 }
 
-static int has_changes(mmfile_t *one, mmfile_t *two,
-		       struct diff_options *o,
-		       regex_t *regexp, kwset_t kws)
+static void compile_needle(struct pickaxe_needle *n, struct diff_options *o)
+{
+	const char *needle = o->pickaxe;
+	int opts = o->pickaxe_opts;
+
+	n->regexp = NULL;
+	n->perl = NULL;
+	n->kws = NULL;
+	if ((opts & DIFF_PICKAXE_PERL) &&
+	    (opts & (DIFF_PICKAXE_REGEX | DIFF_PICKAXE_KIND_G))) {
+		n->perl = compile_perl_regexp(needle,
+				DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE));
+	} else if (opts & (DIFF_PICKAXE_REGEX | DIFF_PICKAXE_KIND_G)) {
+		int err;
+		int cflags = REG_EXTENDED | REG_NEWLINE;
+		if (DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE))
+			cflags |= REG_ICASE;
+		err = regcomp(&n->regex, needle, cflags);
+		if (err) {
+			/* The POSIX.2 people are surely sick */
+			char errbuf[1024];
+			regerror(err, &n->regex, errbuf, 1024);
+			regfree(&n->regex);
+			die("invalid regex: %s", errbuf);
+		}
+		n->regexp = &n->regex;
+	} else {
+		n->kws = kwsalloc(DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE)
+				  ? tolower_trans_tbl : NULL);
+		kwsincr(n->kws, needle, strlen(needle));
+		kwsprep(n->kws);
+	}
+}
+
+static void free_needle(struct pickaxe_needle *n)
+{
+	if (n->perl)
+		free_perl_regexp(n->perl);
+	else if (n->regexp)
+		regfree(n->regexp);
+	else
+		kwsfree(n->kws);
+}
+
+/*
+ * With -S, whether a pair is interesting only depends on how many
+ * times the needle appears on either side, and in "log -S" most blobs
+ * are the postimage of one commit and the preimage of a later one.
+ * Remember the counts by blob name, for the needle they were made
+ * with, so that every blob is read and searched only once.
+ */
+#define PICKAXE_COUNT_CACHE_MAX (1 << 20)
+
+struct count_entry {
+	struct hashmap_entry ent;
+	unsigned char sha1[20];
+	unsigned int count;
+};
+
+static struct count_cache {
+	struct hashmap map;
+	char *needle;
+	int regex, perl, icase;
+} count_cache;
+
+static int count_entry_cmp(const struct count_entry *e1,
+			   const struct count_entry *e2, const void *unused)
+{
+	return hashcmp(e1->sha1, e2->sha1);
+}
+
+static void prepare_count_cache(struct diff_options *o)
+{
+	int regex = !!(o->pickaxe_opts & DIFF_PICKAXE_REGEX);
+	int perl = !!(o->pickaxe_opts & DIFF_PICKAXE_PERL);
+	int icase = !!DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE);
+
+	if (count_cache.needle && !strcmp(count_cache.needle, o->pickaxe) &&
+	    count_cache.regex == regex && count_cache.perl == perl &&
+	    count_cache.icase == icase)
+		return;
+
+	if (count_cache.needle)
+		hashmap_free(&count_cache.map, 1);
+	free(count_cache.needle);
+	hashmap_init(&count_cache.map, (hashmap_cmp_fn)count_entry_cmp, 0);
+	count_cache.needle = xstrdup(o->pickaxe);
+	count_cache.regex = regex;
+	count_cache.perl = perl;
+	count_cache.icase = icase;
+}
+
+/*
+ * Only the contents of regular files and symlinks without textconv
+ * are named by their sha1.
+ */
+static int count_cacheable(struct diff_filespec *spec,
+			   struct userdiff_driver *textconv)
+{
+	return !textconv && spec->sha1_valid && !is_null_sha1(spec->sha1) &&
+		(S_ISREG(spec->mode) || S_ISLNK(spec->mode));
+}
+
+static int get_cached_count(const unsigned char *sha1, unsigned int *count)
+{
+	struct count_entry k, *e;
+
+	hashcpy(k.sha1, sha1);
+	hashmap_entry_init(&k, sha1hash(sha1));
+	e = hashmap_get(&count_cache.map, &k, NULL);
+	if (!e)
+		return 0;
+	*count = e->count;
+	return 1;
+}
+
+static void put_cached_count(const unsigned char *sha1, unsigned int count)
+{
+	struct count_entry *e;
+
+	if (count_cache.map.size >= PICKAXE_COUNT_CACHE_MAX) {
+		hashmap_free(&count_cache.map, 1);
+		hashmap_init(&count_cache.map,
+			     (hashmap_cmp_fn)count_entry_cmp, 0);
+	}
+	e = xmalloc(sizeof(*e));
+	hashcpy(e->sha1, sha1);
+	hashmap_entry_init(e, sha1hash(sha1));
+	e->count = count;
+	free(hashmap_put(&count_cache.map, e));
+}
+
+struct pickaxe_side {
+	struct diff_filespec *spec;
+	struct userdiff_driver *textconv;
+	mmfile_t mf;
+	unsigned int count;
+	unsigned valid:1,
+		 loaded:1,
+		 counted:1;
+};
+
+struct pickaxe_job {
+	struct pickaxe_side one, two;
+	char *hit;
+};
+
+/*
+ * The main thread reads the blobs (reading objects is not thread
+ * safe) and queues a job for every pair it could not decide from the
+ * count cache; with diff.threads, worker threads search the contents
+ * of the queued jobs while the main thread reads the next ones.  The
+ * contents stay around until the whole batch is done, as a filespec
+ * can be shared by several pairs.
+ */
+#define PICKAXE_BATCH_BYTES (32 * 1024 * 1024)
+
+struct pickaxe_batch {
+	struct diff_options *o;
+	struct pickaxe_needle *needle;
+	struct pickaxe_job **jobs;
+	int nr, alloc;
+	unsigned long size;	/* of the contents the jobs hold */
+	int nr_threads;
+#ifndef NO_PTHREADS
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;	/* a job was added */
+	pthread_cond_t done_cond;	/* a job was finished */
+	int next, done;
+	int closed;
+#endif
+};
+
+static void run_job(struct pickaxe_job *job, struct diff_options *o,
+		    struct pickaxe_needle *n)
+{
+	if (o->pickaxe_opts & DIFF_PICKAXE_KIND_G) {
+		*job->hit = diff_grep(job->one.valid ? &job->one.mf : NULL,
+				      job->two.valid ? &job->two.mf : NULL,
+				      o, n);
+		return;
+	}
+	if (!job->one.counted)
+		job->one.count = contains(&job->one.mf, n);
+	if (!job->two.counted)
+		job->two.count = contains(&job->two.mf, n);
+}
+
+#ifndef NO_PTHREADS
+
+static void *run_jobs(void *data)
+{
+	struct pickaxe_batch *batch = data;
+	struct pickaxe_needle needle;
+
+	/* like grep, every thread gets a needle of its own */
+	compile_needle(&needle, batch->o);
+	pthread_mutex_lock(&batch->mutex);
+	for (;;) {
+		struct pickaxe_job *job;
+
+		while (batch->next >= batch->nr && !batch->closed)
+			pthread_cond_wait(&batch->work_cond, &batch->mutex);
+		if (batch->next >= batch->nr)
+			break;
+		job = batch->jobs[batch->next++];
+		pthread_mutex_unlock(&batch->mutex);
+
+		run_job(job, batch->o, &needle);
+
+		pthread_mutex_lock(&batch->mutex);
+		batch->done++;
+		pthread_cond_signal(&batch->done_cond);
+	}
+	pthread_mutex_unlock(&batch->mutex);
+	free_needle(&needle);
+	return NULL;
+}
+
+static void start_workers(struct pickaxe_batch *batch, int nr_threads)
 {
-	unsigned int one_contains = one ? contains(one, regexp, kws) : 0;
-	unsigned int two_contains = two ? contains(two, regexp, kws) : 0;
-	return one_contains != two_contains;
+	int i;
+
+	pthread_mutex_init(&batch->mutex, NULL);
+	pthread_cond_init(&batch->work_cond, NULL);
+	pthread_cond_init(&batch->done_cond, NULL);
+	batch->next = batch->done = batch->closed = 0;
+
+	batch->threads = xcalloc(nr_threads, sizeof(*batch->threads));
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&batch->threads[i], NULL, run_jobs, batch)) {
+			warning(_("unable to create thread: %s"),
+				strerror(errno));
+			break;
+		}
+	}
+	batch->nr_threads = i;
+	if (!i) {
+		free(batch->threads);
+		pthread_mutex_destroy(&batch->mutex);
+		pthread_cond_destroy(&batch->work_cond);
+		pthread_cond_destroy(&batch->done_cond);
+	}
+}
+
+static void stop_workers(struct pickaxe_batch *batch)
+{
+	int i;
+
+	if (!batch->nr_threads)
+		return;
+	pthread_mutex_lock(&batch->mutex);
+	batch->closed = 1;
+	pthread_cond_broadcast(&batch->work_cond);
+	pthread_mutex_unlock(&batch->mutex);
+	for (i = 0; i < batch->nr_threads; i++)
+		pthread_join(batch->threads[i], NULL);
+	free(batch->threads);
+	pthread_mutex_destroy(&batch->mutex);
+	pthread_cond_destroy(&batch->work_cond);
+	pthread_cond_destroy(&batch->done_cond);
+}
+
+#else
+
+static void start_workers(struct pickaxe_batch *batch, int nr_threads)
+{
+	batch->nr_threads = 0;
+}
+
+static void stop_workers(struct pickaxe_batch *batch)
+{
+	; /* nothing */
+}
+
+#endif
+
+static void add_job(struct pickaxe_batch *batch, struct pickaxe_job *job)
+{
+#ifndef NO_PTHREADS
+	if (batch->nr_threads) {
+		pthread_mutex_lock(&batch->mutex);
+		ALLOC_GROW(batch->jobs, batch->nr + 1, batch->alloc);
+		batch->jobs[batch->nr++] = job;
+		pthread_cond_signal(&batch->work_cond);
+		pthread_mutex_unlock(&batch->mutex);
+		return;
+	}
+#endif
+	ALLOC_GROW(batch->jobs, batch->nr + 1, batch->alloc);
+	batch->jobs[batch->nr++] = job;
+}
+
+static void release_side(struct pickaxe_side *side)
+{
+	if (side->loaded && side->textconv)
+		free(side->mf.ptr);
+	diff_free_filespec_data(side->spec);
+}
+
+/*
+ * Wait for (or run) the jobs of the batch, remember the counts they
+ * made and drop the contents.  Returns whether any pair was a hit.
+ */
+static int finish_batch(struct pickaxe_batch *batch)
+{
+	int i, found = 0;
+
+#ifndef NO_PTHREADS
+	if (batch->nr_threads) {
+		pthread_mutex_lock(&batch->mutex);
+		while (batch->done < batch->nr)
+			pthread_cond_wait(&batch->done_cond, &batch->mutex);
+		batch->next = batch->done = 0;
+		pthread_mutex_unlock(&batch->mutex);
+	} else
+#endif
+	for (i = 0; i < batch->nr; i++)
+		run_job(batch->jobs[i], batch->o, batch->needle);
+
+	for (i = 0; i < batch->nr; i++) {
+		struct pickaxe_job *job = batch->jobs[i];
+
+		if (!(batch->o->pickaxe_opts & DIFF_PICKAXE_KIND_G)) {
+			if (!job->one.counted && job->one.loaded &&
+			    count_cacheable(job->one.spec, job->one.textconv))
+				put_cached_count(job->one.spec->sha1,
+						 job->one.count);
+			if (!job->two.counted && job->two.loaded &&
+			    count_cacheable(job->two.spec, job->two.textconv))
+				put_cached_count(job->two.spec->sha1,
+						 job->two.count);
+			*job->hit = job->one.count != job->two.count;
+		}
+		found |= *job->hit;
+		release_side(&job->one);
+		release_side(&job->two);
+		free(job);
+	}
+	batch->nr = 0;
+	batch->size = 0;
+	return found;
+}
+
+static void init_side(struct pickaxe_side *side, struct diff_filespec *spec,
+		      struct diff_options *o)
+{
+	memset(side, 0, sizeof(*side));
+	side->spec = spec;
+	side->valid = DIFF_FILE_VALID(spec);
+	if (DIFF_OPT_TST(o, ALLOW_TEXTCONV))
+		side->textconv = get_textconv(spec);
+}
+
+/*
+ * Can the count be had without reading the contents?  A missing
+ * side has none.
+ */
+static void count_side(struct pickaxe_side *side)
+{
+	if (!side->valid)
+		side->counted = 1;
+	else if (count_cacheable(side->spec, side->textconv))
+		side->counted = get_cached_count(side->spec->sha1,
+						 &side->count);
+}
+
+static void load_side(struct pickaxe_batch *batch, struct pickaxe_side *side)
+{
+	side->mf.size = fill_textconv(side->textconv, side->spec,
+				      &side->mf.ptr);
+	side->loaded = 1;
+	batch->size += side->mf.size;
 }
 
-static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
-			 regex_t *regexp, kwset_t kws, pickaxe_fn fn)
+/*
+ * Decide whether the pair is interesting right away, setting "*hit"
+ * and returning 0, or queue a job that will.
+ */
+static int pickaxe_match(struct pickaxe_batch *batch,
+			 struct diff_filepair *p, char *hit)
 {
-	struct userdiff_driver *textconv_one = NULL;
-	struct userdiff_driver *textconv_two = NULL;
-	mmfile_t mf1, mf2;
-	int ret;
+	struct diff_options *o = batch->o;
+	struct pickaxe_job *job;
 
+	*hit = 0;
 	if (!o->pickaxe[0])
 		return 0;
 
@@ -128,10 +516,10 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	if (!DIFF_FILE_VALID(p->one) && !DIFF_FILE_VALID(p->two))
 		return 0;
 
-	if (DIFF_OPT_TST(o, ALLOW_TEXTCONV)) {
-		textconv_one = get_textconv(p->one);
-		textconv_two = get_textconv(p->two);
-	}
+	job = xcalloc(1, sizeof(*job));
+	init_side(&job->one, p->one, o);
+	init_side(&job->two, p->two, o);
+	job->hit = hit;
 
 	/*
 	 * If we have an unmodified pair, we know that the count will be the
@@ -140,40 +528,68 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	 * because a pair is an exact rename with different textconv attributes
 	 * for each side, which might generate different content).
 	 */
-	if (textconv_one == textconv_two && diff_unmodified_pair(p))
+	if (job->one.textconv == job->two.textconv && diff_unmodified_pair(p)) {
+		free(job);
 		return 0;
+	}
 
-	mf1.size = fill_textconv(textconv_one, p->one, &mf1.ptr);
-	mf2.size = fill_textconv(textconv_two, p->two, &mf2.ptr);
-
-	ret = fn(DIFF_FILE_VALID(p->one) ? &mf1 : NULL,
-		 DIFF_FILE_VALID(p->two) ? &mf2 : NULL,
-		 o, regexp, kws);
-
-	if (textconv_one)
-		free(mf1.ptr);
-	if (textconv_two)
-		free(mf2.ptr);
-	diff_free_filespec_data(p->one);
-	diff_free_filespec_data(p->two);
-
-	return ret;
+	if (o->pickaxe_opts & DIFF_PICKAXE_KIND_G) {
+		if (job->one.valid)
+			load_side(batch, &job->one);
+		if (job->two.valid)
+			load_side(batch, &job->two);
+	} else {
+		count_side(&job->one);
+		count_side(&job->two);
+		if (job->one.counted && job->two.counted) {
+			*hit = job->one.count != job->two.count;
+			free(job);
+			return 0;
+		}
+		if (!job->one.counted)
+			load_side(batch, &job->one);
+		if (!job->two.counted)
+			load_side(batch, &job->two);
+	}
+	add_job(batch, job);
+	return 1;
 }
 
 static void pickaxe(struct diff_queue_struct *q, struct diff_options *o,
-		    regex_t *regexp, kwset_t kws, pickaxe_fn fn)
+		    struct pickaxe_needle *needle)
 {
-	int i;
+	int i, found = 0;
+	int all = o->pickaxe_opts & DIFF_PICKAXE_ALL;
 	struct diff_queue_struct outq;
+	struct pickaxe_batch batch;
+	char *hit;
 
 	DIFF_QUEUE_CLEAR(&outq);
+	memset(&batch, 0, sizeof(batch));
+	batch.o = o;
+	batch.needle = needle;
+	if (diff_nr_threads() > 1 && q->nr > 1)
+		start_workers(&batch, diff_nr_threads() < q->nr ?
+			      diff_nr_threads() : q->nr);
+
+	hit = xcalloc(q->nr, 1);
+	for (i = 0; i < q->nr && !(all && found); i++) {
+		if (!pickaxe_match(&batch, q->queue[i], &hit[i]))
+			found |= hit[i];
+		/* without workers, run every job right away */
+		else if (!batch.nr_threads ||
+			 batch.size >= PICKAXE_BATCH_BYTES)
+			found |= finish_batch(&batch);
+	}
+	found |= finish_batch(&batch);
+	stop_workers(&batch);
+	free(batch.jobs);
 
-	if (o->pickaxe_opts & DIFF_PICKAXE_ALL) {
+	if (all) {
 		/* Showing the whole changeset if needle exists */
-		for (i = 0; i < q->nr; i++) {
-			struct diff_filepair *p = q->queue[i];
-			if (pickaxe_match(p, o, regexp, kws, fn))
-				return; /* do not munge the queue */
+		if (found) {
+			free(hit);
+			return; /* do not munge the queue */
 		}
 
 		/*
@@ -187,52 +603,29 @@ static void pickaxe(struct diff_queue_struct *q, struct diff_options *o,
 		/* Showing only the filepairs that has the needle */
 		for (i = 0; i < q->nr; i++) {
 			struct diff_filepair *p = q->queue[i];
-			if (pickaxe_match(p, o, regexp, kws, fn))
+			if (hit[i])
 				diff_q(&outq, p);
 			else
 				diff_free_filepair(p);
 		}
 	}
 
+	free(hit);
 	free(q->queue);
 	*q = outq;
 }
 
 void diffcore_pickaxe(struct diff_options *o)
 {
-	const char *needle = o->pickaxe;
-	int opts = o->pickaxe_opts;
-	regex_t regex, *regexp = NULL;
-	kwset_t kws = NULL;
+	struct pickaxe_needle needle;
 
-	if (opts & (DIFF_PICKAXE_REGEX | DIFF_PICKAXE_KIND_G)) {
-		int err;
-		int cflags = REG_EXTENDED | REG_NEWLINE;
-		if (DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE))
-			cflags |= REG_ICASE;
-		err = regcomp(&regex, needle, cflags);
-		if (err) {
-			/* The POSIX.2 people are surely sick */
-			char errbuf[1024];
-			regerror(err, &regex, errbuf, 1024);
-			regfree(&regex);
-			die("invalid regex: %s", errbuf);
-		}
-		regexp = &regex;
-	} else {
-		kws = kwsalloc(DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE)
-			       ? tolower_trans_tbl : NULL);
-		kwsincr(kws, needle, strlen(needle));
-		kwsprep(kws);
-	}
+	compile_needle(&needle, o);
+	if (!(o->pickaxe_opts & DIFF_PICKAXE_KIND_G))
+		prepare_count_cache(o);
 
 	/* Might want to warn when both S and G are on; I don't care... */
-	pickaxe(&diff_queued_diff, o, regexp, kws,
-		(opts & DIFF_PICKAXE_KIND_G) ? diff_grep : has_changes);
+	pickaxe(&diff_queued_diff, o, &needle);
 
-	if (regexp)
-		regfree(regexp);
-	else
-		kwsfree(kws);
+	free_needle(&needle);
 	return;
 }
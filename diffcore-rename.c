@@ -6,6 +6,7 @@
 #include "diffcore.h"
 #include "hashmap.h"
 #include "progress.h"
+#include "rename-cache.h"
 
 /* Table of rename/copy destinations */
 
@@ -190,8 +191,14 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
 		return 0;
 
-	delta_limit = (unsigned long)
-		(base_size * (MAX_SCORE-minimum_score) / MAX_SCORE);
+	/*
+	 * The score is below minimum_score once more than this many
+	 * bytes of src are known not to have been copied to dst.
+	 */
+	delta_limit = src->size -
+		(unsigned long)((double)max_size * minimum_score / MAX_SCORE);
+	if (!delta_limit)
+		delta_limit = 1;
 	if (diffcore_count_changes(src, dst,
 				   &src->cnt_data, &dst->cnt_data,
 				   delta_limit,
@@ -253,7 +260,6 @@ static int score_compare(const void *a_, const void *b_)
 }
 
 struct file_similarity {
-	struct hashmap_entry entry;
 	int index;
 	struct diff_filespec *filespec;
 };
@@ -268,7 +274,7 @@ static unsigned int hash_filespec(struct diff_filespec *filespec)
 	return sha1hash(filespec->sha1);
 }
 
-static int find_identical_files(struct hashmap *srcs,
+static int find_identical_files(struct oahashmap *srcs,
 				int dst_index,
 				struct diff_options *options)
 {
@@ -277,12 +283,13 @@ static int find_identical_files(struct hashmap *srcs,
 	struct diff_filespec *target = rename_dst[dst_index].two;
 	struct file_similarity *p, *best = NULL;
 	int i = 100, best_score = -1;
+	unsigned int hash = hash_filespec(target);
 
 	/*
 	 * Find the best source match for specified destination.
 	 */
-	p = hashmap_get_from_hash(srcs, hash_filespec(target), NULL);
-	for (; p; p = hashmap_get_next(srcs, p)) {
+	p = oahashmap_get(srcs, hash, NULL, NULL);
+	for (; p; p = oahashmap_get_next(srcs, hash, p)) {
 		int score;
 		struct diff_filespec *source = p->filespec;
 
@@ -317,15 +324,14 @@ static int find_identical_files(struct hashmap *srcs,
 	return renames;
 }
 
-static void insert_file_table(struct hashmap *table, int index, struct diff_filespec *filespec)
+static void insert_file_table(struct oahashmap *table, int index, struct diff_filespec *filespec)
 {
 	struct file_similarity *entry = xmalloc(sizeof(*entry));
 
 	entry->index = index;
 	entry->filespec = filespec;
 
-	hashmap_entry_init(entry, hash_filespec(filespec));
-	hashmap_add(table, entry);
+	oahashmap_add(table, hash_filespec(filespec), entry);
 }
 
 /*
@@ -338,10 +344,10 @@ static void insert_file_table(struct hashmap *table, int index, struct diff_file
 static int find_exact_renames(struct diff_options *options)
 {
 	int i, renames = 0;
-	struct hashmap file_table;
+	struct oahashmap file_table;
 
 	/* Add all sources to the hash table */
-	hashmap_init(&file_table, NULL, rename_src_nr);
+	oahashmap_init(&file_table, NULL, rename_src_nr);
 	for (i = 0; i < rename_src_nr; i++)
 		insert_file_table(&file_table, i, rename_src[i].p->one);
 
@@ -350,7 +356,7 @@ static int find_exact_renames(struct diff_options *options)
 		renames += find_identical_files(&file_table, i, options);
 
 	/* Free the hash data structure and entries */
-	hashmap_free(&file_table, 1);
+	oahashmap_free(&file_table, 1);
 
 	return renames;
 }
@@ -371,6 +377,269 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * Compare every destination with every source, and remember the best
+ * NUM_CANDIDATE_PER_DST sources of each in "mx"; returns the number of
+ * destinations.
+ */
+static int find_all_renames(struct diff_score *mx, int minimum_score,
+			    int skip_unmodified, struct progress *progress)
+{
+	int i, j, dst_cnt;
+
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+		struct diff_score *m;
+
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+
+		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].p->one;
+			struct diff_score this_src;
+
+			if (skip_unmodified &&
+			    diff_unmodified_pair(rename_src[j].p))
+				continue;
+
+			this_src.score = estimate_similarity(one, two,
+							     minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = i;
+			this_src.src = j;
+			record_if_better(m, &this_src);
+			/*
+			 * Once we run estimate_similarity,
+			 * We do not need the text anymore.
+			 */
+			diff_free_filespec_blob(one);
+			diff_free_filespec_blob(two);
+		}
+		dst_cnt++;
+		display_progress(progress, (i+1)*rename_src_nr);
+	}
+	return dst_cnt;
+}
+
+/*
+ * Past the rename limit, comparing every source with every destination
+ * is out of the question.  With diff.largeRenames we still look for
+ * renames, but only among a few likely sources for each destination:
+ * those with the same basename, unless it is a common one, and those
+ * whose MinHash signatures agree with that of the destination in all
+ * the entries of some band (locality-sensitive hashing), best
+ * estimated similarity first.  Only these candidates are compared
+ * with estimate_similarity(), so the cost grows with the number of
+ * files rather than with its square.
+ */
+#define SKETCH_BANDS 16
+#define SKETCH_ROWS (MINHASH_SIZE / SKETCH_BANDS)
+#define SKETCH_CANDIDATES 8
+#define SKETCH_BASENAME_MAX 4	/* more sources than this: too common */
+#define SKETCH_BUCKET_MAX 256	/* more sources than this: boilerplate */
+
+struct sketch_bucket {
+	struct hashmap_entry entry;
+	const char *basename;	/* NULL for the buckets of bands */
+	uint32_t key;
+	int nr, alloc;
+	int *src;
+};
+
+static int sketch_bucket_cmp(const struct sketch_bucket *a,
+			     const struct sketch_bucket *b,
+			     const void *unused)
+{
+	if (a->key != b->key || !a->basename != !b->basename)
+		return 1;
+	return a->basename && strcmp(a->basename, b->basename);
+}
+
+static const char *basename_of(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static int band_key(const uint32_t *sig, int band, uint32_t *key)
+{
+	uint32_t h = 0x811c9dc5 ^ band;
+	int i;
+
+	for (i = band * SKETCH_ROWS; i < (band + 1) * SKETCH_ROWS; i++) {
+		if (sig[i] == MINHASH_EMPTY)
+			return 0;
+		h = (h ^ sig[i]) * 0x01000193;
+	}
+	*key = h;
+	return 1;
+}
+
+static struct sketch_bucket *find_sketch_bucket(struct hashmap *buckets,
+						const char *basename,
+						uint32_t key)
+{
+	struct sketch_bucket k;
+
+	hashmap_entry_init(&k, key);
+	k.basename = basename;
+	k.key = key;
+	return hashmap_get(buckets, &k, NULL);
+}
+
+static void add_to_sketch_bucket(struct hashmap *buckets, const char *basename,
+				 uint32_t key, int src)
+{
+	struct sketch_bucket *b = find_sketch_bucket(buckets, basename, key);
+
+	if (!b) {
+		b = xcalloc(1, sizeof(*b));
+		hashmap_entry_init(b, key);
+		b->basename = basename;
+		b->key = key;
+		hashmap_add(buckets, b);
+	}
+	ALLOC_GROW(b->src, b->nr + 1, b->alloc);
+	b->src[b->nr++] = src;
+}
+
+static int sketch_signature(struct diff_filespec *one, void **count_p,
+			    uint32_t *sig)
+{
+	if (!S_ISREG(one->mode))
+		return 0;
+	if (!(count_p && *count_p) && diff_populate_filespec(one, 0))
+		return 0;
+	return diffcore_minhash(one, count_p, sig) > 0;
+}
+
+static int sketch_agreement(const uint32_t *a, const uint32_t *b)
+{
+	int i, agree = 0;
+
+	for (i = 0; i < MINHASH_SIZE; i++)
+		if (a[i] == b[i] && a[i] != MINHASH_EMPTY)
+			agree++;
+	return agree;
+}
+
+/*
+ * Fill "mx" like the exhaustive loop in diffcore_rename() does, but
+ * from the candidates only; returns the number of destinations.
+ */
+static int find_sketch_renames(struct diff_score *mx, int minimum_score,
+			       struct progress *progress)
+{
+	uint32_t (*sig)[MINHASH_SIZE], dst_sig[MINHASH_SIZE];
+	int *seen, cand[SKETCH_BASENAME_MAX + SKETCH_CANDIDATES];
+	int best[SKETCH_CANDIDATES], agree[SKETCH_CANDIDATES];
+	struct hashmap buckets;
+	struct hashmap_iter iter;
+	struct sketch_bucket *b;
+	int i, j, band, dst_cnt;
+
+	sig = xmalloc(rename_src_nr * sizeof(*sig));
+	seen = xmalloc(rename_src_nr * sizeof(*seen));
+	hashmap_init(&buckets, (hashmap_cmp_fn)sketch_bucket_cmp, 0);
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		const char *base = basename_of(one->path);
+		uint32_t key;
+
+		seen[j] = -1;
+		add_to_sketch_bucket(&buckets, base, strhash(base), j);
+		if (sketch_signature(one, NULL, sig[j]))
+			for (band = 0; band < SKETCH_BANDS; band++)
+				if (band_key(sig[j], band, &key))
+					add_to_sketch_bucket(&buckets, NULL, key, j);
+		diff_free_filespec_blob(one);
+	}
+
+	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+		const char *base = basename_of(two->path);
+		struct diff_score *m;
+		int cand_nr = 0, best_nr = 0;
+		uint32_t key;
+
+		if (rename_dst[i].pair)
+			continue; /* dealt with exact match already. */
+
+		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		b = find_sketch_bucket(&buckets, base, strhash(base));
+		if (b && b->nr <= SKETCH_BASENAME_MAX)
+			for (j = 0; j < b->nr; j++) {
+				seen[b->src[j]] = i;
+				cand[cand_nr++] = b->src[j];
+			}
+
+		if (!sketch_signature(two, &two->cnt_data, dst_sig))
+			band = SKETCH_BANDS;
+		else
+			band = 0;
+		for (; band < SKETCH_BANDS; band++) {
+			if (!band_key(dst_sig, band, &key))
+				continue;
+			b = find_sketch_bucket(&buckets, NULL, key);
+			if (!b || SKETCH_BUCKET_MAX < b->nr)
+				continue;
+			for (j = 0; j < b->nr; j++) {
+				int src = b->src[j], a, k;
+
+				if (seen[src] == i)
+					continue;
+				seen[src] = i;
+				a = sketch_agreement(sig[src], dst_sig);
+				if (best_nr == SKETCH_CANDIDATES &&
+				    a <= agree[best_nr - 1])
+					continue;
+				if (best_nr < SKETCH_CANDIDATES)
+					best_nr++;
+				for (k = best_nr - 1; k && agree[k - 1] < a; k--) {
+					agree[k] = agree[k - 1];
+					best[k] = best[k - 1];
+				}
+				agree[k] = a;
+				best[k] = src;
+			}
+		}
+		for (j = 0; j < best_nr; j++)
+			cand[cand_nr++] = best[j];
+
+		for (j = 0; j < cand_nr; j++) {
+			struct diff_filespec *one = rename_src[cand[j]].p->one;
+			struct diff_score this_src;
+
+			this_src.score = estimate_similarity(one, two,
+							     minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = i;
+			this_src.src = cand[j];
+			record_if_better(m, &this_src);
+			diff_free_filespec_blob(one);
+		}
+		diff_free_filespec_data(two);
+		dst_cnt++;
+		display_progress(progress, i + 1);
+	}
+
+	for (b = hashmap_iter_first(&buckets, &iter); b;
+	     b = hashmap_iter_next(&iter))
+		free(b->src);
+	hashmap_free(&buckets, 1);
+	free(seen);
+	free(sig);
+	return dst_cnt;
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -441,6 +710,134 @@ static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, i
 	return count;
 }
 
+/*
+ * Smaller inexact rename detections are cheaper to redo than to look
+ * up in the rename cache.
+ */
+#define RENAME_CACHE_MIN_COMPARISONS 1024
+
+/*
+ * Name everything the inexact rename detection depends on: the options
+ * and the sources and destinations with their contents, as they are
+ * left after the exact renames.  Returns -1 if some of the contents
+ * are not known by their object names.
+ */
+static int rename_cache_key(unsigned char *key, int minimum_score,
+			    int detect_rename, int skip_unmodified,
+			    int use_sketches)
+{
+	struct strbuf buf = STRBUF_INIT;
+	git_SHA_CTX ctx;
+	int i;
+
+	strbuf_addf(&buf, "renames %d %d %d %d\n", minimum_score,
+		    detect_rename, skip_unmodified, use_sketches);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filepair *p = rename_src[i].p;
+
+		if (!p->one->sha1_valid)
+			goto invalid;
+		strbuf_addf(&buf, "src %s %06o %d %d %d %d %s%c",
+			    sha1_to_hex(p->one->sha1), p->one->mode,
+			    rename_src[i].score, p->broken_pair,
+			    diff_unmodified_pair(p), p->one->rename_used,
+			    p->one->path, '\0');
+	}
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].two;
+
+		if (!two->sha1_valid)
+			goto invalid;
+		strbuf_addf(&buf, "dst %s %06o %d %s%c",
+			    sha1_to_hex(two->sha1), two->mode,
+			    !!rename_dst[i].pair, two->path, '\0');
+	}
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, buf.buf, buf.len);
+	git_SHA1_Final(key, &ctx);
+	strbuf_release(&buf);
+	return 0;
+
+invalid:
+	strbuf_release(&buf);
+	return -1;
+}
+
+/*
+ * Record the renames remembered for the key; returns the number of
+ * them, or -1 (recording nothing) if they do not fit the candidates.
+ */
+static int use_cached_renames(const unsigned char *key)
+{
+	struct rename_cache_pair *pairs;
+	int i, nr;
+
+	if (!rename_cache_lookup(key, &pairs, &nr))
+		return -1;
+	for (i = 0; i < nr; i++) {
+		int j;
+
+		if (pairs[i].dst < 0 || pairs[i].dst >= rename_dst_nr ||
+		    pairs[i].src < 0 || pairs[i].src >= rename_src_nr ||
+		    rename_dst[pairs[i].dst].pair ||
+		    pairs[i].score < 0 || pairs[i].score > MAX_SCORE)
+			goto invalid;
+		for (j = 0; j < i; j++)
+			if (pairs[j].dst == pairs[i].dst)
+				goto invalid;
+	}
+	for (i = 0; i < nr; i++)
+		record_rename_pair(pairs[i].dst, pairs[i].src, pairs[i].score);
+	free(pairs);
+	return nr;
+
+invalid:
+	free(pairs);
+	return -1;
+}
+
+static int find_rename_src(struct diff_filespec *one)
+{
+	int first = 0, last = rename_src_nr;
+
+	while (last > first) {
+		int next = (last + first) >> 1;
+		int cmp = strcmp(one->path, rename_src[next].p->one->path);
+		if (!cmp)
+			return next;
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return -1;
+}
+
+/* Remember the renames found for the destinations not in "matched". */
+static void store_renames(const unsigned char *key, const char *matched)
+{
+	struct rename_cache_pair *pairs = NULL;
+	int i, nr = 0, alloc = 0;
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *dp = rename_dst[i].pair;
+
+		if (!dp || matched[i])
+			continue;
+		ALLOC_GROW(pairs, nr + 1, alloc);
+		pairs[nr].dst = i;
+		pairs[nr].src = find_rename_src(dp->one);
+		pairs[nr].score = dp->score;
+		if (pairs[nr].src < 0)
+			goto out; /* should not happen */
+		nr++;
+	}
+	rename_cache_store(key, pairs, nr);
+out:
+	free(pairs);
+}
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -448,9 +845,11 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
+	int i, rename_count, skip_unmodified = 0, use_sketches = 0;
+	int num_create, dst_cnt, cached;
 	struct progress *progress = NULL;
+	unsigned char cache_key[20];
+	char *matched = NULL;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
@@ -522,7 +921,12 @@ void diffcore_rename(struct diff_options *options)
 
 	switch (too_many_rename_candidates(num_create, options)) {
 	case 1:
-		goto cleanup;
+		if (!options->large_renames)
+			goto cleanup;
+		/* we are not skipping it after all */
+		options->needed_rename_limit = 0;
+		use_sketches = 1;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
 		skip_unmodified = 1;
@@ -531,48 +935,32 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
+	if ((double)num_create * rename_src_nr < RENAME_CACHE_MIN_COMPARISONS ||
+	    rename_cache_key(cache_key, minimum_score, detect_rename,
+			     skip_unmodified, use_sketches))
+		;
+	else if ((cached = use_cached_renames(cache_key)) >= 0) {
+		rename_count += cached;
+		goto cleanup;
+	} else {
+		matched = xcalloc(rename_dst_nr, 1);
+		for (i = 0; i < rename_dst_nr; i++)
+			matched[i] = !!rename_dst[i].pair;
+	}
+
 	if (options->show_rename_progress) {
 		progress = start_progress_delay(
 				_("Performing inexact rename detection"),
+				use_sketches ? rename_dst_nr :
 				rename_dst_nr * rename_src_nr, 50, 1);
 	}
 
 	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (i+1)*rename_src_nr);
-	}
+	if (use_sketches)
+		dst_cnt = find_sketch_renames(mx, minimum_score, progress);
+	else
+		dst_cnt = find_all_renames(mx, minimum_score, skip_unmodified,
+					   progress);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
@@ -582,6 +970,10 @@ void diffcore_rename(struct diff_options *options)
 	if (detect_rename == DIFF_DETECT_COPY)
 		rename_count += find_renames(mx, dst_cnt, minimum_score, 1);
 	free(mx);
+	if (matched) {
+		store_renames(cache_key, matched);
+		free(matched);
+	}
 
  cleanup:
 	/* At this point, we have found some renames and copies and they
@@ -138,6 +138,12 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Count the bytes of "dst" that were copied from "src" and those that
+ * were added.  With a non-zero "delta_limit", counting may stop early
+ * once more than that many bytes of "src" are known not to have been
+ * copied, leaving both counts short.
+ */
 extern int diffcore_count_changes(struct diff_filespec *src,
 				  struct diff_filespec *dst,
 				  void **src_count_p,
@@ -146,4 +152,17 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
 
+/*
+ * A MinHash signature of the chunks diffcore_count_changes() works
+ * with: two files agree on an entry with a probability of about the
+ * fraction of distinct chunks they have in common.  Entries no chunk
+ * fell into are MINHASH_EMPTY, and never count as an agreement.
+ * Returns the number of distinct chunks.
+ */
+#define MINHASH_SIZE 32
+#define MINHASH_EMPTY 0xffffffff
+
+extern int diffcore_minhash(struct diff_filespec *one, void **count_p,
+			    uint32_t *sig);
+
 #endif
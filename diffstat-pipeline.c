@@ -0,0 +1,312 @@
+#include "cache.h"
+#include "hashmap.h"
+#include "thread-utils.h"
+#include "diffstat-pipeline.h"
+
+#ifdef NO_PTHREADS
+
+void start_diffstat_pipeline(int nr_threads, unsigned long xdl_opts,
+			     int context, int interhunkcontext)
+{
+	; /* nothing */
+}
+
+void finish_diffstat_pipeline(void)
+{
+	; /* nothing */
+}
+
+void diffstat_pipeline_add(const unsigned char *one, const unsigned char *two,
+			   mmfile_t *mf1, mmfile_t *mf2, unsigned seq)
+{
+	free(mf1->ptr);
+	free(mf2->ptr);
+}
+
+int diffstat_pipeline_lookup(const unsigned char *one, const unsigned char *two,
+			     unsigned long xdl_opts,
+			     uintmax_t *added, uintmax_t *deleted)
+{
+	return 0;
+}
+
+void diffstat_pipeline_retire(unsigned seq)
+{
+	; /* nothing */
+}
+
+int diffstat_pipeline_active(void)
+{
+	return 0;
+}
+
+unsigned long diffstat_pipeline_pending(void)
+{
+	return 0;
+}
+
+#else
+
+struct diffstat_job {
+	struct hashmap_entry ent;
+	unsigned char pair[40];
+	mmfile_t mf1, mf2;
+	unsigned seq;
+	uintmax_t added, deleted;
+	unsigned done:1,
+		 abandoned:1;
+	struct diffstat_job *next;	/* in the queue of jobs to run */
+};
+
+static struct diffstat_pipeline {
+	int nr_threads;
+	pthread_t *threads;
+	unsigned long xdl_opts;
+	int context, interhunkcontext;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;	/* a job was queued, or stop */
+	pthread_cond_t done_cond;	/* a job was finished */
+	struct hashmap jobs;		/* not yet looked up nor retired */
+	struct diffstat_job *queue, **queue_tail;
+	unsigned long pending;
+	int stop;
+} pipeline;
+
+static int diffstat_job_cmp(const struct diffstat_job *a,
+			    const struct diffstat_job *b,
+			    const void *unused)
+{
+	return memcmp(a->pair, b->pair, sizeof(a->pair));
+}
+
+static void fill_job_key(struct diffstat_job *job, const unsigned char *one,
+			 const unsigned char *two)
+{
+	hashcpy(job->pair, one);
+	hashcpy(job->pair + 20, two);
+	hashmap_entry_init(job, memhash(job->pair, sizeof(job->pair)));
+}
+
+static void free_job(struct diffstat_job *job)
+{
+	free(job->mf1.ptr);
+	free(job->mf2.ptr);
+	free(job);
+}
+
+static void *run_jobs(void *unused)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	for (;;) {
+		struct diffstat_job *job;
+		xpparam_t xpp;
+		xdemitconf_t xecfg;
+
+		while (!pipeline.queue && !pipeline.stop)
+			pthread_cond_wait(&pipeline.work_cond, &pipeline.mutex);
+		if (!pipeline.queue)
+			break;
+		job = pipeline.queue;
+		pipeline.queue = job->next;
+		if (!pipeline.queue)
+			pipeline.queue_tail = &pipeline.queue;
+		pipeline.pending -= job->mf1.size + job->mf2.size;
+		if (job->abandoned) {
+			free_job(job);
+			continue;
+		}
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		memset(&xpp, 0, sizeof(xpp));
+		memset(&xecfg, 0, sizeof(xecfg));
+		xpp.flags = pipeline.xdl_opts;
+		xecfg.ctxlen = pipeline.context;
+		xecfg.interhunkctxlen = pipeline.interhunkcontext;
+		xdi_diff_count(&job->mf1, &job->mf2, &xpp, &xecfg,
+			       &job->added, &job->deleted);
+
+		pthread_mutex_lock(&pipeline.mutex);
+		free(job->mf1.ptr);
+		free(job->mf2.ptr);
+		job->mf1.ptr = job->mf2.ptr = NULL;
+		if (job->abandoned)
+			free_job(job);
+		else {
+			job->done = 1;
+			pthread_cond_broadcast(&pipeline.done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pipeline.mutex);
+	return NULL;
+}
+
+void start_diffstat_pipeline(int nr_threads, unsigned long xdl_opts,
+			     int context, int interhunkcontext)
+{
+	int i;
+
+	if (pipeline.nr_threads || nr_threads < 1)
+		return;
+
+	pthread_mutex_init(&pipeline.mutex, NULL);
+	pthread_cond_init(&pipeline.work_cond, NULL);
+	pthread_cond_init(&pipeline.done_cond, NULL);
+	hashmap_init(&pipeline.jobs, (hashmap_cmp_fn)diffstat_job_cmp, 0);
+	pipeline.queue = NULL;
+	pipeline.queue_tail = &pipeline.queue;
+	pipeline.xdl_opts = xdl_opts;
+	pipeline.context = context;
+	pipeline.interhunkcontext = interhunkcontext;
+	pipeline.pending = 0;
+	pipeline.stop = 0;
+
+	pipeline.threads = xcalloc(nr_threads, sizeof(*pipeline.threads));
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&pipeline.threads[i], NULL, run_jobs, NULL)) {
+			warning(_("unable to create thread: %s"), strerror(errno));
+			break;
+		}
+	}
+	pipeline.nr_threads = i;
+	if (!i) {
+		free(pipeline.threads);
+		hashmap_free(&pipeline.jobs, 0);
+	}
+}
+
+void finish_diffstat_pipeline(void)
+{
+	struct hashmap_iter iter;
+	struct diffstat_job *job;
+	int i;
+
+	if (!pipeline.nr_threads)
+		return;
+
+	/* nobody will look at what is left */
+	diffstat_pipeline_retire(UINT_MAX);
+	pthread_mutex_lock(&pipeline.mutex);
+	pipeline.stop = 1;
+	pthread_cond_broadcast(&pipeline.work_cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+	for (i = 0; i < pipeline.nr_threads; i++)
+		pthread_join(pipeline.threads[i], NULL);
+
+	for (job = hashmap_iter_first(&pipeline.jobs, &iter); job;
+	     job = hashmap_iter_next(&iter))
+		free_job(job);
+	hashmap_free(&pipeline.jobs, 0);
+	free(pipeline.threads);
+	pipeline.threads = NULL;
+	pipeline.nr_threads = 0;
+	pthread_cond_destroy(&pipeline.done_cond);
+	pthread_cond_destroy(&pipeline.work_cond);
+	pthread_mutex_destroy(&pipeline.mutex);
+}
+
+void diffstat_pipeline_add(const unsigned char *one, const unsigned char *two,
+			   mmfile_t *mf1, mmfile_t *mf2, unsigned seq)
+{
+	struct diffstat_job *job;
+
+	if (!pipeline.nr_threads) {
+		free(mf1->ptr);
+		free(mf2->ptr);
+		return;
+	}
+
+	job = xcalloc(1, sizeof(*job));
+	fill_job_key(job, one, two);
+	job->mf1 = *mf1;
+	job->mf2 = *mf2;
+	job->seq = seq;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	if (hashmap_get(&pipeline.jobs, job, NULL)) {
+		/* the same change, seen earlier in the history */
+		pthread_mutex_unlock(&pipeline.mutex);
+		free_job(job);
+		return;
+	}
+	hashmap_add(&pipeline.jobs, job);
+	*pipeline.queue_tail = job;
+	pipeline.queue_tail = &job->next;
+	pipeline.pending += job->mf1.size + job->mf2.size;
+	pthread_cond_signal(&pipeline.work_cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+int diffstat_pipeline_lookup(const unsigned char *one, const unsigned char *two,
+			     unsigned long xdl_opts,
+			     uintmax_t *added, uintmax_t *deleted)
+{
+	struct diffstat_job key, *job;
+
+	if (!pipeline.nr_threads || xdl_opts != pipeline.xdl_opts)
+		return 0;
+
+	fill_job_key(&key, one, two);
+	pthread_mutex_lock(&pipeline.mutex);
+	job = hashmap_remove(&pipeline.jobs, &key, NULL);
+	if (!job) {
+		pthread_mutex_unlock(&pipeline.mutex);
+		return 0;
+	}
+	while (!job->done)
+		pthread_cond_wait(&pipeline.done_cond, &pipeline.mutex);
+	pthread_mutex_unlock(&pipeline.mutex);
+
+	*added = job->added;
+	*deleted = job->deleted;
+	free_job(job);
+	return 1;
+}
+
+void diffstat_pipeline_retire(unsigned seq)
+{
+	struct hashmap_iter iter;
+	struct diffstat_job *job, **retired = NULL;
+	int i, nr = 0, alloc = 0;
+
+	if (!pipeline.nr_threads)
+		return;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	for (job = hashmap_iter_first(&pipeline.jobs, &iter); job;
+	     job = hashmap_iter_next(&iter)) {
+		if (job->seq > seq)
+			continue;
+		ALLOC_GROW(retired, nr + 1, alloc);
+		retired[nr++] = job;
+	}
+	for (i = 0; i < nr; i++) {
+		job = retired[i];
+		hashmap_remove(&pipeline.jobs, job, NULL);
+		/* a worker still holds the others, and frees them */
+		if (job->done)
+			free_job(job);
+		else
+			job->abandoned = 1;
+	}
+	pthread_mutex_unlock(&pipeline.mutex);
+	free(retired);
+}
+
+int diffstat_pipeline_active(void)
+{
+	return pipeline.nr_threads;
+}
+
+unsigned long diffstat_pipeline_pending(void)
+{
+	unsigned long pending;
+
+	if (!pipeline.nr_threads)
+		return 0;
+	pthread_mutex_lock(&pipeline.mutex);
+	pending = pipeline.pending;
+	pthread_mutex_unlock(&pipeline.mutex);
+	return pending;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef DIFFSTAT_PIPELINE_H
+#define DIFFSTAT_PIPELINE_H
+
+#include "xdiff-interface.h"
+
+/*
+ * Counting the lines a commit adds and removes for "git log --stat"
+ * means running xdiff over every modified blob, which is where most of
+ * the time goes.  The revision walk, the tree diffs and reading the
+ * blobs have to stay on the main thread, but xdiff does not: the
+ * caller runs ahead of the commit it is showing, hands the blob pairs
+ * of upcoming commits over with diffstat_pipeline_add(), and the
+ * worker threads count their lines while the main thread formats the
+ * output.  builtin_diffstat() then picks the counts up with
+ * diffstat_pipeline_lookup(), or computes them itself if the pair was
+ * never handed over.
+ *
+ * Every pair is tagged with a sequence number, normally that of the
+ * commit it was found in; diffstat_pipeline_retire() forgets the pairs
+ * nobody asked for once their commit has been shown.
+ */
+
+/*
+ * Start "nr_threads" workers counting lines with the given xdiff
+ * flags and context, which must be those builtin_diffstat() uses.
+ * Does nothing when built without threads.
+ */
+extern void start_diffstat_pipeline(int nr_threads, unsigned long xdl_opts,
+				    int context, int interhunkcontext);
+extern void finish_diffstat_pipeline(void);
+
+/*
+ * Count the lines between "mf1" and "mf2", the contents of the blobs
+ * "one" and "two" (the null sha1 stands for a missing side).  The
+ * pipeline takes over the buffers and free()s them.
+ */
+extern void diffstat_pipeline_add(const unsigned char *one,
+				  const unsigned char *two,
+				  mmfile_t *mf1, mmfile_t *mf2,
+				  unsigned seq);
+
+/*
+ * If the pair was handed over with the same xdiff flags, wait for its
+ * counts and return 1; otherwise return 0.
+ */
+extern int diffstat_pipeline_lookup(const unsigned char *one,
+				    const unsigned char *two,
+				    unsigned long xdl_opts,
+				    uintmax_t *added, uintmax_t *deleted);
+
+/* Forget the pairs with sequence numbers up to "seq". */
+extern void diffstat_pipeline_retire(unsigned seq);
+
+/*
+ * Is the pipeline running, and how many bytes of blob contents are
+ * waiting for a worker?
+ */
+extern int diffstat_pipeline_active(void);
+extern unsigned long diffstat_pipeline_pending(void);
+
+#endif
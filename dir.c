@@ -13,8 +13,10 @@
 #include "wildmatch.h"
 #include "pathspec.h"
 #include "utf8.h"
+#include "fsmonitor.h"
 #include "varint.h"
 #include "ewah/ewok.h"
+#include "thread-utils.h"
 
 struct path_simplify {
 	int len;
@@ -294,6 +296,74 @@ static int match_pathspec_item(const struct pathspec_item *item, int prefix,
 	return 0;
 }
 
+/*
+ * Match the i-th item of ps against name (with prefix already cut
+ * off), recording the result in seen[]; returns the closer of that
+ * result and retval.
+ */
+static int match_one_pathspec(const struct pathspec *ps, int i,
+			      const char *name, int namelen,
+			      int prefix, char *seen,
+			      unsigned flags, int retval)
+{
+	int how, exclude = flags & DO_MATCH_EXCLUDE;
+
+	if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
+	    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
+		return retval;
+
+	if (seen && seen[i] == MATCHED_EXACTLY)
+		return retval;
+	/*
+	 * Make exclude patterns optional and never report
+	 * "pathspec ':(exclude)foo' matches no files"
+	 */
+	if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
+		seen[i] = MATCHED_FNMATCH;
+	how = match_pathspec_item(ps->items+i, prefix, name,
+				  namelen, flags);
+	if (ps->recursive &&
+	    (ps->magic & PATHSPEC_MAXDEPTH) &&
+	    ps->max_depth != -1 &&
+	    how && how != MATCHED_FNMATCH) {
+		int len = ps->items[i].len;
+		if (name[len] == '/')
+			len++;
+		if (within_depth(name+len, namelen-len, 0, ps->max_depth))
+			how = MATCHED_EXACTLY;
+		else
+			how = 0;
+	}
+	if (how) {
+		if (retval < how)
+			retval = how;
+		if (seen && seen[i] < how)
+			seen[i] = how;
+	}
+	return retval;
+}
+
+/* Match the literal items that are key[0..keylen], plus '/' if slash. */
+static int match_pathspec_literals(const struct pathspec *ps,
+				   const char *key, int keylen, int slash,
+				   const char *name, int namelen,
+				   int prefix, char *seen,
+				   unsigned flags, int retval)
+{
+	const struct pathspec_literals *lit = ps->literals;
+	int j = find_pathspec_literal(ps, prefix, key, keylen, slash);
+
+	if (j < 0)
+		return retval;
+	do {
+		retval = match_one_pathspec(ps, lit->item[j], name, namelen,
+					    prefix, seen, flags, retval);
+	} while (++j < lit->nr &&
+		 !pathspec_literal_cmp(ps->items + lit->item[j], prefix,
+				       key, keylen, slash));
+	return retval;
+}
+
 /*
  * Given a name and a list of pathspecs, returns the nature of the
  * closest (i.e. most specific) match of the name to any of the
@@ -339,42 +409,44 @@ static int do_match_pathspec(const struct pathspec *ps,
 	name += prefix;
 	namelen -= prefix;
 
-	for (i = ps->nr - 1; i >= 0; i--) {
-		int how;
+	if (!ps->literals || ps->literals->common < prefix) {
+		for (i = ps->nr - 1; i >= 0; i--)
+			retval = match_one_pathspec(ps, i, name, namelen,
+						    prefix, seen, flags, retval);
+		return retval;
+	}
 
-		if ((!exclude &&   ps->items[i].magic & PATHSPEC_EXCLUDE) ||
-		    ( exclude && !(ps->items[i].magic & PATHSPEC_EXCLUDE)))
-			continue;
+	/*
+	 * Of the literal items, only those that spell a leading
+	 * directory of the name, the name itself or, for a directory,
+	 * the name with a slash can match.
+	 */
+	if (!exclude) {
+		const char *cp;
 
-		if (seen && seen[i] == MATCHED_EXACTLY)
-			continue;
-		/*
-		 * Make exclude patterns optional and never report
-		 * "pathspec ':(exclude)foo' matches no files"
-		 */
-		if (seen && ps->items[i].magic & PATHSPEC_EXCLUDE)
-			seen[i] = MATCHED_FNMATCH;
-		how = match_pathspec_item(ps->items+i, prefix, name,
-					  namelen, flags);
-		if (ps->recursive &&
-		    (ps->magic & PATHSPEC_MAXDEPTH) &&
-		    ps->max_depth != -1 &&
-		    how && how != MATCHED_FNMATCH) {
-			int len = ps->items[i].len;
-			if (name[len] == '/')
-				len++;
-			if (within_depth(name+len, namelen-len, 0, ps->max_depth))
-				how = MATCHED_EXACTLY;
-			else
-				how = 0;
-		}
-		if (how) {
-			if (retval < how)
-				retval = how;
-			if (seen && seen[i] < how)
-				seen[i] = how;
+		retval = match_pathspec_literals(ps, name, 0, 0,
+						 name, namelen, prefix,
+						 seen, flags, retval);
+		for (cp = name; (cp = memchr(cp, '/', name + namelen - cp)); cp++) {
+			retval = match_pathspec_literals(ps, name, cp - name, 0,
+							 name, namelen, prefix,
+							 seen, flags, retval);
+			retval = match_pathspec_literals(ps, name, cp - name, 1,
+							 name, namelen, prefix,
+							 seen, flags, retval);
 		}
-	}
+		retval = match_pathspec_literals(ps, name, namelen, 0,
+						 name, namelen, prefix,
+						 seen, flags, retval);
+		if (flags & DO_MATCH_DIRECTORY)
+			retval = match_pathspec_literals(ps, name, namelen, 1,
+							 name, namelen, prefix,
+							 seen, flags, retval);
+	}
+	for (i = ps->literals->other_nr - 1; i >= 0; i--)
+		retval = match_one_pathspec(ps, ps->literals->other[i],
+					    name, namelen, prefix, seen,
+					    flags, retval);
 	return retval;
 }
 
@@ -493,6 +565,243 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+/*
+ * Huge exclude and attribute lists are mostly literal names, "*.ext"
+ * suffixes and paths below some directory.  A pattern_index files each
+ * pattern under one of these, so that finding the patterns that may
+ * match a path costs a few hash lookups plus going through the patterns
+ * with real wildcards in them, instead of a match attempt against every
+ * pattern of the list.
+ */
+struct pattern_bucket {
+	struct hashmap_entry ent;
+	int nr, alloc;
+	int *pos;	/* as given to add_pattern_to_index(), ascending */
+	int len;
+	char key[FLEX_ARRAY];
+};
+
+struct pattern_index {
+	int ignore_case;	/* the keys were hashed with this */
+	struct hashmap literal;	/* basename patterns without wildcards */
+	struct hashmap suffix;	/* "*literal" basename patterns */
+	struct hashmap paths;	/* path patterns without wildcards */
+	struct hashmap dirs;	/* other path patterns, by leading directories */
+	int *suffix_len, suffix_len_nr, suffix_len_alloc;
+	int *wild, wild_nr, wild_alloc;	/* everything else */
+};
+
+static int pattern_bucket_cmp(const struct pattern_bucket *b1,
+			      const struct pattern_bucket *b2,
+			      const char *key)
+{
+	return b1->len != b2->len ||
+		strncmp_icase(b1->key, key ? key : b2->key, b1->len);
+}
+
+static unsigned int pattern_hash(const char *key, int len)
+{
+	return ignore_case ? memihash(key, len) : memhash(key, len);
+}
+
+static struct pattern_bucket *find_pattern_bucket(const struct hashmap *map,
+						  const char *key, int len)
+{
+	struct pattern_bucket k;
+	hashmap_entry_init(&k, pattern_hash(key, len));
+	k.len = len;
+	return hashmap_get(map, &k, key);
+}
+
+static void add_to_pattern_bucket(struct hashmap *map,
+				  const char *key, int len, int pos)
+{
+	struct pattern_bucket *b = find_pattern_bucket(map, key, len);
+
+	if (!b) {
+		b = xcalloc(1, sizeof(*b) + len + 1);
+		hashmap_entry_init(b, pattern_hash(key, len));
+		b->len = len;
+		memcpy(b->key, key, len);
+		hashmap_add(map, b);
+	}
+	ALLOC_GROW(b->pos, b->nr + 1, b->alloc);
+	b->pos[b->nr++] = pos;
+}
+
+void add_pattern_to_index(struct pattern_index **idx_p, int pos,
+			  const char *pattern, int patternlen,
+			  int nowildcardlen, int flags,
+			  const char *base, int baselen)
+{
+	struct pattern_index *idx = *idx_p;
+
+	if (!idx) {
+		idx = *idx_p = xcalloc(1, sizeof(*idx));
+		idx->ignore_case = ignore_case;
+		hashmap_init(&idx->literal, (hashmap_cmp_fn)pattern_bucket_cmp, 0);
+		hashmap_init(&idx->suffix, (hashmap_cmp_fn)pattern_bucket_cmp, 0);
+		hashmap_init(&idx->paths, (hashmap_cmp_fn)pattern_bucket_cmp, 0);
+		hashmap_init(&idx->dirs, (hashmap_cmp_fn)pattern_bucket_cmp, 0);
+	}
+
+	if (flags & EXC_FLAG_NODIR) {
+		if (nowildcardlen == patternlen) {
+			add_to_pattern_bucket(&idx->literal, pattern,
+					      patternlen, pos);
+			return;
+		}
+		if (flags & EXC_FLAG_ENDSWITH) {
+			int i, len = patternlen - 1;
+
+			add_to_pattern_bucket(&idx->suffix, pattern + 1,
+					      len, pos);
+			for (i = 0; i < idx->suffix_len_nr; i++)
+				if (idx->suffix_len[i] == len)
+					return;
+			ALLOC_GROW(idx->suffix_len, idx->suffix_len_nr + 1,
+				   idx->suffix_len_alloc);
+			idx->suffix_len[idx->suffix_len_nr++] = len;
+			return;
+		}
+	} else {
+		/* the key is the path from the top, like in match_pathname() */
+		int prefix = nowildcardlen;
+		int dirlen;
+
+		if (*pattern == '/') {
+			pattern++;
+			prefix--;
+			patternlen--;
+		}
+		for (dirlen = prefix; dirlen; dirlen--)
+			if (pattern[dirlen - 1] == '/')
+				break;
+		if (prefix == patternlen || baselen + dirlen) {
+			struct strbuf key = STRBUF_INIT;
+
+			if (baselen) {
+				strbuf_add(&key, base, baselen);
+				strbuf_addch(&key, '/');
+			}
+			if (prefix == patternlen) {
+				strbuf_add(&key, pattern, patternlen);
+				add_to_pattern_bucket(&idx->paths, key.buf,
+						      key.len, pos);
+			} else {
+				strbuf_add(&key, pattern, dirlen);
+				add_to_pattern_bucket(&idx->dirs, key.buf,
+						      key.len, pos);
+			}
+			strbuf_release(&key);
+			return;
+		}
+	}
+
+	ALLOC_GROW(idx->wild, idx->wild_nr + 1, idx->wild_alloc);
+	idx->wild[idx->wild_nr++] = pos;
+}
+
+static void free_pattern_buckets(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_bucket *b;
+
+	for (b = hashmap_iter_first(map, &iter); b; b = hashmap_iter_next(&iter))
+		free(b->pos);
+	hashmap_free(map, 1);
+}
+
+void free_pattern_index(struct pattern_index *idx)
+{
+	if (!idx)
+		return;
+	free_pattern_buckets(&idx->literal);
+	free_pattern_buckets(&idx->suffix);
+	free_pattern_buckets(&idx->paths);
+	free_pattern_buckets(&idx->dirs);
+	free(idx->suffix_len);
+	free(idx->wild);
+	free(idx);
+}
+
+static void add_pattern_candidates(struct pattern_candidates *c,
+				   const struct pattern_bucket *b)
+{
+	if (!b)
+		return;
+	if (c->pos == c->inline_pos && c->alloc < c->nr + b->nr) {
+		c->alloc = alloc_nr(c->nr + b->nr);
+		c->pos = xmalloc(c->alloc * sizeof(*c->pos));
+		memcpy(c->pos, c->inline_pos, c->nr * sizeof(*c->pos));
+	} else {
+		ALLOC_GROW(c->pos, c->nr + b->nr, c->alloc);
+	}
+	memcpy(c->pos + c->nr, b->pos, b->nr * sizeof(*c->pos));
+	c->nr += b->nr;
+}
+
+static int pattern_pos_cmp(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+int start_pattern_candidates(struct pattern_candidates *c,
+			     const struct pattern_index *idx,
+			     const char *pathname, int pathlen,
+			     int basenamelen)
+{
+	const char *basename = pathname + pathlen - basenamelen;
+	const char *cp;
+	int i;
+
+	if (!idx || idx->ignore_case != ignore_case)
+		return -1;
+
+	c->idx = idx;
+	c->pos = c->inline_pos;
+	c->nr = 0;
+	c->alloc = ARRAY_SIZE(c->inline_pos);
+	c->next = 0;
+	c->wild = idx->wild_nr - 1;
+
+	add_pattern_candidates(c, find_pattern_bucket(&idx->literal,
+						      basename, basenamelen));
+	for (i = 0; i < idx->suffix_len_nr; i++) {
+		int len = idx->suffix_len[i];
+		if (basenamelen < len)
+			continue;
+		add_pattern_candidates(c, find_pattern_bucket(&idx->suffix,
+				basename + basenamelen - len, len));
+	}
+	add_pattern_candidates(c, find_pattern_bucket(&idx->paths,
+						      pathname, pathlen));
+	for (cp = pathname; (cp = memchr(cp, '/', pathname + pathlen - cp)); cp++)
+		add_pattern_candidates(c, find_pattern_bucket(&idx->dirs,
+				pathname, cp - pathname + 1));
+	if (c->nr > 1)
+		qsort(c->pos, c->nr, sizeof(*c->pos), pattern_pos_cmp);
+	return 0;
+}
+
+int next_pattern_candidate(struct pattern_candidates *c)
+{
+	int wild = 0 <= c->wild ? c->idx->wild[c->wild] : -1;
+
+	if (c->next < c->nr && wild < c->pos[c->next])
+		return c->pos[c->next++];
+	if (0 <= wild)
+		c->wild--;
+	return wild;
+}
+
+void end_pattern_candidates(struct pattern_candidates *c)
+{
+	if (c->pos != c->inline_pos)
+		free(c->pos);
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
@@ -522,6 +831,44 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+	add_pattern_to_index(&el->index, el->nr - 1,
+			     x->pattern, x->patternlen, x->nowildcardlen,
+			     x->flags, x->base, baselen ? baselen - 1 : 0);
+}
+
+#ifndef NO_PTHREADS
+/*
+ * Taken by the threads of read_directory() around what they share
+ * beyond the read-only index: the object store, the attributes and the
+ * submodule ref caches.
+ */
+static pthread_mutex_t dir_mutex;
+static int dir_use_locks;
+
+static inline void dir_lock(void)
+{
+	if (dir_use_locks)
+		pthread_mutex_lock(&dir_mutex);
+}
+
+static inline void dir_unlock(void)
+{
+	if (dir_use_locks)
+		pthread_mutex_unlock(&dir_mutex);
+}
+#else
+#define dir_lock()
+#define dir_unlock()
+#endif
+
+static int locked_would_convert_to_git(const char *path)
+{
+	int ret;
+
+	dir_lock();
+	ret = would_convert_to_git(path);
+	dir_unlock();
+	return ret;
 }
 
 static void *read_skip_worktree_file_from_index(const char *path, size_t *size,
@@ -538,7 +885,9 @@ static void *read_skip_worktree_file_from_index(const char *path, size_t *size,
 		return NULL;
 	if (!ce_skip_worktree(active_cache[pos]))
 		return NULL;
+	dir_lock();
 	data = read_sha1_file(active_cache[pos]->sha1, &type, &sz);
+	dir_unlock();
 	if (!data || type != OBJ_BLOB) {
 		free(data);
 		return NULL;
@@ -563,10 +912,12 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	free_pattern_index(el->index);
 
 	el->nr = 0;
 	el->excludes = NULL;
 	el->filebuf = NULL;
+	el->index = NULL;
 }
 
 static void trim_trailing_spaces(char *buf)
@@ -730,7 +1081,7 @@ static int add_excludes(const char *fname, const char *base, int baselen,
 				 (pos = cache_name_pos(fname, strlen(fname))) >= 0 &&
 				 !ce_stage(active_cache[pos]) &&
 				 ce_uptodate(active_cache[pos]) &&
-				 !would_convert_to_git(fname))
+				 !locked_would_convert_to_git(fname))
 				hashcpy(sha1_stat->sha1, active_cache[pos]->sha1);
 			else
 				hash_sha1_file(buf, size, "blob", sha1_stat->sha1);
@@ -889,6 +1240,30 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int exclude_matches(struct exclude *x,
+			   const char *pathname, int pathlen,
+			   const char *basename, int *dtype)
+{
+	if (x->flags & EXC_FLAG_MUSTBEDIR) {
+		if (*dtype == DT_UNKNOWN)
+			*dtype = get_dtype(NULL, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (x->flags & EXC_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      x->pattern, x->nowildcardlen,
+				      x->patternlen, x->flags);
+
+	assert(x->baselen == 0 || x->base[x->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      x->base, x->baselen ? x->baselen - 1 : 0,
+			      x->pattern, x->nowildcardlen, x->patternlen,
+			      x->flags);
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -901,39 +1276,30 @@ static struct exclude *last_exclude_matching_from_list(const char *pathname,
 						       int *dtype,
 						       struct exclude_list *el)
 {
+	struct pattern_candidates c;
+	struct exclude *x = NULL;
 	int i;
 
 	if (!el->nr)
 		return NULL;	/* undefined */
 
-	for (i = el->nr - 1; 0 <= i; i--) {
-		struct exclude *x = el->excludes[i];
-		const char *exclude = x->pattern;
-		int prefix = x->nowildcardlen;
-
-		if (x->flags & EXC_FLAG_MUSTBEDIR) {
-			if (*dtype == DT_UNKNOWN)
-				*dtype = get_dtype(NULL, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (x->flags & EXC_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, x->patternlen,
-					   x->flags))
-				return x;
-			continue;
+	if (start_pattern_candidates(&c, el->index, pathname, pathlen,
+				     pathlen - (basename - pathname))) {
+		for (i = el->nr - 1; 0 <= i; i--)
+			if (exclude_matches(el->excludes[i], pathname, pathlen,
+					    basename, dtype))
+				return el->excludes[i];
+		return NULL; /* undecided */
+	}
+	while (0 <= (i = next_pattern_candidate(&c))) {
+		if (exclude_matches(el->excludes[i], pathname, pathlen,
+				    basename, dtype)) {
+			x = el->excludes[i];
+			break;
 		}
-
-		assert(x->baselen == 0 || x->base[x->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   x->base, x->baselen ? x->baselen - 1 : 0,
-				   exclude, prefix, x->patternlen, x->flags))
-			return x;
 	}
-	return NULL; /* undecided */
+	end_pattern_candidates(&c);
+	return x; /* or undecided */
 }
 
 /*
@@ -1314,7 +1680,12 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 			break;
 		if (!(dir->flags & DIR_NO_GITLINKS)) {
 			unsigned char sha1[20];
-			if (resolve_gitlink_ref(dirname, "HEAD", sha1) == 0)
+			int is_gitlink;
+
+			dir_lock();
+			is_gitlink = !resolve_gitlink_ref(dirname, "HEAD", sha1);
+			dir_unlock();
+			if (is_gitlink)
 				return path_untracked;
 		}
 		return path_recurse;
@@ -1580,17 +1951,24 @@ static int valid_cached_dir(struct dir_struct *dir,
 	if (!untracked)
 		return 0;
 
-	if (stat(path->len ? path->buf : ".", &st)) {
-		invalidate_directory(dir->untracked, untracked);
-		memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
-		return 0;
-	}
-	if (!untracked->valid ||
-	    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
-		if (untracked->valid)
+	/*
+	 * With a filesystem monitor, a directory is still valid unless
+	 * refresh_fsmonitor() invalidated it; no need to stat it.
+	 */
+	if (!dir->untracked->use_fsmonitor || !untracked->valid) {
+		if (stat(path->len ? path->buf : ".", &st)) {
 			invalidate_directory(dir->untracked, untracked);
-		fill_stat_data(&untracked->stat_data, &st);
-		return 0;
+			memset(&untracked->stat_data, 0,
+			       sizeof(untracked->stat_data));
+			return 0;
+		}
+		if (!untracked->valid ||
+		    match_stat_data_racy(&the_index, &untracked->stat_data, &st)) {
+			if (untracked->valid)
+				invalidate_directory(dir->untracked, untracked);
+			fill_stat_data(&untracked->stat_data, &st);
+			return 0;
+		}
 	}
 
 	if (untracked->check_only != !!check_only) {
@@ -1675,6 +2053,61 @@ static void close_cached_dir(struct cached_dir *cdir)
 	}
 }
 
+#ifndef NO_PTHREADS
+/*
+ * The directories waiting for a thread of read_directory_threaded().
+ * A thread only hands over a subdirectory when another one is idle;
+ * otherwise it reads it itself, which keeps its exclude stack warm.
+ */
+struct dir_task {
+	struct dir_task *next;
+	int len;
+	char path[FLEX_ARRAY];
+};
+
+struct dir_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct dir_task *tasks;
+	int nr_tasks, idle, busy;
+	const struct path_simplify *simplify;
+};
+
+static void add_dir_task(struct dir_pool *pool, const char *path, int len)
+{
+	struct dir_task *task = xmalloc(sizeof(*task) + len + 1);
+
+	memcpy(task->path, path, len);
+	task->path[len] = '\0';
+	task->len = len;
+	task->next = pool->tasks;
+	pool->tasks = task;
+	pool->nr_tasks++;
+}
+#endif
+
+/* Returns 1 if another thread will read the directory "path". */
+static int offer_directory(struct dir_struct *dir, const char *path, int len)
+{
+#ifndef NO_PTHREADS
+	struct dir_pool *pool = dir->pool;
+	int offered = 0;
+
+	if (!pool)
+		return 0;
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->nr_tasks < pool->idle) {
+		add_dir_task(pool, path, len);
+		pthread_cond_signal(&pool->cond);
+		offered = 1;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return offered;
+#else
+	return 0;
+#endif
+}
+
 /*
  * Read a directory tree. We currently ignore anything but
  * directories, regular files and symlinks. That's because git
@@ -1716,11 +2149,19 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 			ud = lookup_untracked(dir->untracked, untracked,
 					      path.buf + baselen,
 					      path.len - baselen);
-			subdir_state =
-				read_directory_recursive(dir, path.buf, path.len,
-							 ud, check_only, simplify);
-			if (subdir_state > dir_state)
-				dir_state = subdir_state;
+			/*
+			 * Only a check_only scan looks at what it finds
+			 * below, so any other can be left to another
+			 * thread.
+			 */
+			if (check_only ||
+			    !offer_directory(dir, path.buf, path.len)) {
+				subdir_state =
+					read_directory_recursive(dir, path.buf, path.len,
+								 ud, check_only, simplify);
+				if (subdir_state > dir_state)
+					dir_state = subdir_state;
+			}
 		}
 
 		if (check_only) {
@@ -1765,6 +2206,149 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 	return dir_state;
 }
 
+#ifndef NO_PTHREADS
+static void *read_directory_thread(void *data)
+{
+	struct dir_struct *dir = data;
+	struct dir_pool *pool = dir->pool;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		struct dir_task *task;
+
+		/* wait while whoever is busy may still hand us something */
+		while (!pool->tasks && pool->busy) {
+			pool->idle++;
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			pool->idle--;
+		}
+		task = pool->tasks;
+		if (!task)
+			break;
+		pool->tasks = task->next;
+		pool->nr_tasks--;
+		pool->busy++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		read_directory_recursive(dir, task->path, task->len,
+					 NULL, 0, pool->simplify);
+		free(task);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (!--pool->busy && !pool->tasks)
+			pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/* Free the per-directory exclude lists of a thread's dir_struct. */
+static void clear_exclude_stack(struct dir_struct *dir)
+{
+	struct exclude_list_group *group = &dir->exclude_list_group[EXC_DIRS];
+	struct exclude_stack *stk = dir->exclude_stack;
+	int i;
+
+	for (i = 0; i < group->nr; i++) {
+		free((char *)group->el[i].src);
+		clear_exclude_list(&group->el[i]);
+	}
+	free(group->el);
+	while (stk) {
+		struct exclude_stack *prev = stk->prev;
+		free(stk);
+		stk = prev;
+	}
+	strbuf_release(&dir->basebuf);
+}
+
+/*
+ * Like read_directory_recursive(), but with several threads reading
+ * subdirectories at the same time, each with its own copy of "dir" to
+ * collect what it finds and to keep its own exclude stack.
+ */
+static void read_directory_threaded(struct dir_struct *dir,
+				    const char *path, int len,
+				    const struct path_simplify *simplify,
+				    int nr_threads)
+{
+	struct dir_pool pool;
+	struct dir_struct *dirs;
+	pthread_t *threads;
+	int i;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+	pool.simplify = simplify;
+	add_dir_task(&pool, path, len);
+
+	/* the threads only ever look things up in the index */
+	lazy_init_name_hash(&the_index);
+	pthread_mutex_init(&dir_mutex, NULL);
+	dir_use_locks = 1;
+
+	dirs = xcalloc(nr_threads, sizeof(*dirs));
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++) {
+		struct dir_struct *d = &dirs[i];
+
+		*d = *dir;
+		d->nr = d->alloc = 0;
+		d->entries = NULL;
+		d->ignored_nr = d->ignored_alloc = 0;
+		d->ignored = NULL;
+		memset(&d->exclude_list_group[EXC_DIRS], 0,
+		       sizeof(d->exclude_list_group[EXC_DIRS]));
+		d->exclude_stack = NULL;
+		d->exclude = NULL;
+		strbuf_init(&d->basebuf, PATH_MAX);
+		d->pool = &pool;
+		if (pthread_create(&threads[i], NULL, read_directory_thread, d))
+			die("unable to create read_directory thread");
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct dir_struct *d = &dirs[i];
+
+		if (pthread_join(threads[i], NULL))
+			die("unable to join read_directory thread");
+		ALLOC_GROW(dir->entries, dir->nr + d->nr, dir->alloc);
+		memcpy(dir->entries + dir->nr, d->entries,
+		       d->nr * sizeof(*d->entries));
+		dir->nr += d->nr;
+		ALLOC_GROW(dir->ignored, dir->ignored_nr + d->ignored_nr,
+			   dir->ignored_alloc);
+		memcpy(dir->ignored + dir->ignored_nr, d->ignored,
+		       d->ignored_nr * sizeof(*d->ignored));
+		dir->ignored_nr += d->ignored_nr;
+		free(d->entries);
+		free(d->ignored);
+		clear_exclude_stack(d);
+	}
+
+	dir_use_locks = 0;
+	pthread_mutex_destroy(&dir_mutex);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	free(threads);
+	free(dirs);
+}
+
+static int untracked_threads(void)
+{
+	int is_bool, val;
+
+	if (git_config_get_bool_or_int("core.untrackedthreads", &is_bool, &val))
+		return 1;
+	if (is_bool)
+		return val ? online_cpus() : 1;
+	if (val < 0)
+		die(_("core.untrackedThreads must be non-negative"));
+	return val ? val : online_cpus();
+}
+#endif
+
 static int cmp_name(const void *p1, const void *p2)
 {
 	const struct dir_entry *e1 = *(const struct dir_entry **)p1;
@@ -1997,6 +2581,8 @@ int read_directory(struct dir_struct *dir, const char *path, int len, const stru
 	 * create_simplify().
 	 */
 	simplify = create_simplify(pathspec ? pathspec->_raw : NULL);
+	if (dir->untracked)
+		refresh_fsmonitor(&the_index);
 	untracked = validate_untracked_cache(dir, len, pathspec);
 	if (!untracked)
 		/*
@@ -2004,8 +2590,22 @@ int read_directory(struct dir_struct *dir, const char *path, int len, const stru
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
-	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, untracked, 0, simplify);
+	if (!len || treat_leading_path(dir, path, len, simplify)) {
+#ifndef NO_PTHREADS
+		/*
+		 * The untracked cache is shared between the directories
+		 * and their parents; keep reading it with one thread.
+		 */
+		int nr_threads = dir->untracked ? 1 : untracked_threads();
+
+		if (nr_threads > 1)
+			read_directory_threaded(dir, path, len, simplify,
+						nr_threads);
+		else
+#endif
+			read_directory_recursive(dir, path, len, untracked, 0,
+						 simplify);
+	}
 	free_simplify(simplify);
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
@@ -2625,23 +3225,48 @@ done2:
 	return uc;
 }
 
+static void invalidate_one_directory(struct untracked_cache *uc,
+				     struct untracked_cache_dir *ucd)
+{
+	uc->dir_invalidated++;
+	ucd->valid = 0;
+	ucd->untracked_nr = 0;
+}
+
+/*
+ * Invalidate the directory containing "path", looking it up one
+ * component at a time.  When untracked directories are listed as a
+ * whole, their parents have to be invalidated too; returns whether
+ * that is the case.
+ */
+static int invalidate_one_component(struct untracked_cache *uc,
+				    struct untracked_cache_dir *dir,
+				    const char *path, int len)
+{
+	const char *rest = memchr(path, '/', len);
+
+	if (rest) {
+		int component_len = rest - path;
+		struct untracked_cache_dir *d =
+			lookup_untracked(uc, dir, path, component_len);
+		int ret = invalidate_one_component(uc, d, rest + 1,
+						   len - (component_len + 1));
+		if (ret)
+			invalidate_one_directory(uc, dir);
+		return ret;
+	}
+
+	invalidate_one_directory(uc, dir);
+	return uc->dir_flags & DIR_SHOW_OTHER_DIRECTORIES;
+}
+
 void untracked_cache_invalidate_path(struct index_state *istate,
 				     const char *path)
 {
-	const char *sep;
-	struct untracked_cache_dir *d;
 	if (!istate->untracked || !istate->untracked->root)
 		return;
-	sep = strrchr(path, '/');
-	if (sep)
-		d = lookup_untracked(istate->untracked,
-				     istate->untracked->root,
-				     path, sep - path);
-	else
-		d = istate->untracked->root;
-	istate->untracked->dir_invalidated++;
-	d->valid = 0;
-	d->untracked_nr = 0;
+	invalidate_one_component(istate->untracked, istate->untracked->root,
+				 path, strlen(path));
 }
 
 void untracked_cache_remove_from_index(struct index_state *istate,
@@ -54,6 +54,9 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/* kept up to date by add_exclude() */
+	struct pattern_index *index;
 };
 
 /*
@@ -139,6 +142,8 @@ struct untracked_cache {
 	int gitignore_invalidated;
 	int dir_invalidated;
 	int dir_opened;
+	/* refresh_fsmonitor() invalidated whatever changed */
+	int use_fsmonitor;
 };
 
 struct dir_struct {
@@ -189,6 +194,9 @@ struct dir_struct {
 	struct exclude *exclude;
 	struct strbuf basebuf;
 
+	/* Set while several threads read the directory; see dir.c */
+	struct dir_pool *pool;
+
 	/* Enable untracked file cache if set */
 	struct untracked_cache *untracked;
 	struct sha1_stat ss_info_exclude;
@@ -231,6 +239,40 @@ extern int match_pathname(const char *, int,
 			  const char *, int,
 			  const char *, int, int, int);
 
+/*
+ * A pattern_index narrows down which patterns of an exclude or
+ * attribute list may match a path.  The patterns are added in list
+ * order, with "pos" counting up; "base" is the directory they are
+ * relative to, without a trailing slash.
+ */
+struct pattern_index;
+extern void add_pattern_to_index(struct pattern_index **, int pos,
+				 const char *pattern, int patternlen,
+				 int nowildcardlen, int flags,
+				 const char *base, int baselen);
+extern void free_pattern_index(struct pattern_index *);
+
+/*
+ * start_pattern_candidates() looks up a path (without a trailing
+ * slash); next_pattern_candidate() then returns the positions of the
+ * patterns that may match it, the last one first, and -1 at the end.
+ * They still have to be matched for real.  start_pattern_candidates()
+ * returns -1 if the index cannot be used (e.g. core.ignorecase changed
+ * since it was built) and the whole list has to be scanned.
+ */
+struct pattern_candidates {
+	const struct pattern_index *idx;
+	int *pos, nr, alloc, next;
+	int wild;
+	int inline_pos[16];
+};
+extern int start_pattern_candidates(struct pattern_candidates *,
+				    const struct pattern_index *,
+				    const char *pathname, int pathlen,
+				    int basenamelen);
+extern int next_pattern_candidate(struct pattern_candidates *);
+extern void end_pattern_candidates(struct pattern_candidates *);
+
 extern struct exclude *last_exclude_matching(struct dir_struct *dir,
 					     const char *name, int *dtype);
 
@@ -2,6 +2,7 @@
 #include "blob.h"
 #include "dir.h"
 #include "streaming.h"
+#include "parallel-checkout.h"
 
 static void create_directories(const char *path, int path_len,
 			       const struct checkout *state)
@@ -146,6 +147,7 @@ static int write_entry(struct cache_entry *ce,
 	unsigned long size;
 	size_t wrote, newsize = 0;
 	struct stat st;
+	struct delayed_checkout *dco = state->delayed_checkout;
 
 	if (ce_mode_s_ifmt == S_IFREG) {
 		struct stream_filter *filter = get_stream_filter(ce->name, ce->sha1);
@@ -159,10 +161,19 @@ static int write_entry(struct cache_entry *ce,
 	switch (ce_mode_s_ifmt) {
 	case S_IFREG:
 	case S_IFLNK:
-		new = read_blob_entry(ce, &size);
-		if (!new)
-			return error("unable to read sha1 file of %s (%s)",
-				path, sha1_to_hex(ce->sha1));
+		/*
+		 * A filter process that delayed this path already has
+		 * its content; ask again for the result only.
+		 */
+		if (dco && dco->state == CE_RETRY) {
+			new = NULL;
+			size = 0;
+		} else {
+			new = read_blob_entry(ce, &size);
+			if (!new)
+				return error("unable to read sha1 file of %s (%s)",
+					path, sha1_to_hex(ce->sha1));
+		}
 
 		if (ce_mode_s_ifmt == S_IFLNK && has_symlinks && !to_tempfile) {
 			ret = symlink(new, path);
@@ -177,8 +188,14 @@ static int write_entry(struct cache_entry *ce,
 		 * Convert from git internal format to working tree format
 		 */
 		if (ce_mode_s_ifmt == S_IFREG &&
-		    convert_to_working_tree(ce->name, new, size, &buf)) {
+		    async_convert_to_working_tree(ce->name, new, size,
+						  &buf, dco)) {
 			free(new);
+			if (dco && dco->state != CE_NO_DELAY &&
+			    string_list_has_string(&dco->paths, ce->name)) {
+				strbuf_release(&buf);
+				return 0;
+			}
 			new = strbuf_detach(&buf, &newsize);
 			size = newsize;
 		}
@@ -220,6 +237,96 @@ finish:
 	return 0;
 }
 
+void enable_delayed_checkout(struct checkout *state)
+{
+	if (!state->delayed_checkout) {
+		state->delayed_checkout = xcalloc(1, sizeof(*state->delayed_checkout));
+		state->delayed_checkout->state = CE_CAN_DELAY;
+		string_list_init(&state->delayed_checkout->filters, 0);
+		string_list_init(&state->delayed_checkout->paths, 1);
+	}
+}
+
+static int remove_available_paths(struct string_list_item *item, void *cb_data)
+{
+	struct string_list *available_paths = cb_data;
+	struct string_list_item *available;
+
+	available = string_list_lookup(available_paths, item->string);
+	if (available)
+		available->util = (void *)1;
+	return !available;
+}
+
+int finish_delayed_checkout(struct checkout *state)
+{
+	struct delayed_checkout *dco = state->delayed_checkout;
+	struct string_list_item *filter, *path;
+	int errs = 0;
+
+	if (!dco)
+		return 0;
+
+	dco->state = CE_RETRY;
+	while (dco->filters.nr > 0) {
+		for_each_string_list_item(filter, &dco->filters) {
+			struct string_list available_paths = STRING_LIST_INIT_DUP;
+
+			if (!async_query_available_blobs(filter->string,
+							 &available_paths)) {
+				errs |= 1;
+				filter->string = "";
+				continue;
+			}
+			if (!available_paths.nr) {
+				/*
+				 * The filter blocks until some of its
+				 * paths are ready, so an empty list
+				 * means it has delivered all of them.
+				 */
+				filter->string = "";
+				continue;
+			}
+
+			/* claim the paths we are waiting for */
+			filter_string_list(&dco->paths, 0,
+					   remove_available_paths,
+					   &available_paths);
+
+			for_each_string_list_item(path, &available_paths) {
+				struct cache_entry *ce;
+
+				if (!path->util) {
+					error("external filter '%s' signaled that '%s' "
+					      "is now available although it has not been "
+					      "delayed earlier",
+					      filter->string, path->string);
+					errs |= 1;
+					/* stop asking this filter */
+					filter->string = "";
+					continue;
+				}
+				ce = index_file_exists(state->istate, path->string,
+						       strlen(path->string), 0);
+				if (ce)
+					errs |= checkout_entry(ce, state, NULL);
+			}
+			string_list_clear(&available_paths, 0);
+		}
+		string_list_remove_empty_items(&dco->filters, 0);
+	}
+
+	for_each_string_list_item(path, &dco->paths) {
+		error("'%s' was not filtered properly", path->string);
+		errs |= 1;
+	}
+	string_list_clear(&dco->filters, 0);
+	string_list_clear(&dco->paths, 0);
+	free(dco);
+	state->delayed_checkout = NULL;
+	return errs;
+}
+
 /*
  * This is like 'lstat()', except it refuses to follow symlinks
  * in the path, after skipping "skiplen".
@@ -290,5 +397,7 @@ int checkout_entry(struct cache_entry *ce,
 		return 0;
 
 	create_directories(path.buf, path.len, state);
+	if (!enqueue_checkout(ce, state))
+		return 0;
 	return write_entry(ce, path.buf, state, 0);
 }
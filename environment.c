@@ -11,6 +11,7 @@
 #include "refs.h"
 #include "fmt-merge-msg.h"
 #include "commit.h"
+#include "protocol.h"
 
 int trust_executable_bit = 1;
 int trust_ctime = 1;
@@ -26,6 +27,9 @@ int warn_ambiguous_refs = 1;
 int warn_on_object_refname_ambiguity = 1;
 int ref_paranoia = -1;
 int repository_format_version;
+char *repository_format_partial_clone;
+int repository_format_reftable;
+int fetch_if_missing = 1;
 const char *git_commit_encoding;
 const char *git_log_output_encoding;
 int shared_repository = PERM_UMASK;
@@ -39,7 +43,10 @@ int fsync_object_files;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 96 * 1024 * 1024;
+int delta_compose_depth;
+size_t tree_cache_limit = 16 * 1024 * 1024;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
+int big_file_threads;
 const char *pager_program;
 int pager_use_color = 1;
 const char *editor_program;
@@ -60,6 +67,7 @@ enum object_creation_mode object_creation_mode = OBJECT_CREATION_MODE;
 char *notes_ref_name;
 int grafts_replace_parents = 1;
 int core_apply_sparse_checkout;
+int command_requires_full_index = 1;
 int merge_log_config = -1;
 int precomposed_unicode = -1; /* see probe_utf8_pathname_composition() */
 struct startup_info *startup_info;
@@ -85,6 +93,18 @@ int auto_comment_line_char;
 /* Parallel index stat data preload? */
 int core_preload_index = 1;
 
+/* Consult objects/pack/multi-pack-index for packed object lookups? */
+int core_multi_pack_index;
+
+/* Parse commits from objects/info/commit-graph when possible? */
+int core_commit_graph;
+
+/* Answer quick loose object lookups from cached directory listings? */
+int core_loose_object_cache;
+
+/* Look up loose objects of alternates in cached directory listings? */
+int core_alternates_cache;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
@@ -113,6 +133,7 @@ const char * const local_repo_env[] = {
 	GIT_PREFIX_ENVIRONMENT,
 	GIT_SHALLOW_FILE_ENVIRONMENT,
 	GIT_COMMON_DIR_ENVIRONMENT,
+	GIT_PROTOCOL_ENVIRONMENT,
 	NULL
 };
 
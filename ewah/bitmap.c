@@ -128,7 +128,7 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 {
 	size_t original_size = self->word_alloc;
 	size_t other_final = (other->bit_size / BITS_IN_EWORD) + 1;
-	size_t i = 0;
+	size_t i = 0, len;
 	struct ewah_iterator it;
 	eword_t word;
 
@@ -142,8 +142,15 @@ void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
 
 	ewah_iterator_init(&it, other);
 
-	while (ewah_iterator_next(&word, &it))
-		self->words[i++] |= word;
+	while (ewah_iterator_next_run(&word, &len, &it)) {
+		if (!word)
+			i += len;
+		else if (len == 1)
+			self->words[i++] |= word;
+		else
+			while (len--)
+				self->words[i++] = word;
+	}
 }
 
 void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data)
@@ -158,13 +165,11 @@ void bitmap_each_bit(struct bitmap *self, ewah_callback callback, void *data)
 			for (offset = 0; offset < BITS_IN_EWORD; ++offset)
 				callback(pos++, data);
 		} else {
-			for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-				if ((word >> offset) == 0)
-					break;
+			size_t bits[BITS_IN_EWORD];
+			unsigned nr = ewah_word_positions(word, pos, bits);
 
-				offset += ewah_bit_ctz64(word >> offset);
-				callback(pos + offset, data);
-			}
+			for (offset = 0; offset < nr; offset++)
+				callback(bits[offset], data);
 			pos += BITS_IN_EWORD;
 		}
 	}
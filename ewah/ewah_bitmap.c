@@ -265,14 +265,14 @@ void ewah_each_bit(struct ewah_bitmap *self, void (*callback)(size_t, void*), vo
 		++pointer;
 
 		for (k = 0; k < rlw_get_literal_words(word); ++k) {
-			int c;
+			size_t bits[BITS_IN_EWORD];
+			unsigned c, nr;
 
-			/* todo: zero count optimization */
-			for (c = 0; c < BITS_IN_EWORD; ++c, ++pos) {
-				if ((self->buffer[pointer] & ((eword_t)1 << c)) != 0)
-					callback(pos, payload);
-			}
+			nr = ewah_word_positions(self->buffer[pointer], pos, bits);
+			for (c = 0; c < nr; c++)
+				callback(bits[c], payload);
 
+			pos += BITS_IN_EWORD;
 			++pointer;
 		}
 	}
@@ -365,6 +365,35 @@ int ewah_iterator_next(eword_t *next, struct ewah_iterator *it)
 	return 1;
 }
 
+int ewah_iterator_next_run(eword_t *next, size_t *len, struct ewah_iterator *it)
+{
+	if (it->pointer >= it->buffer_size)
+		return 0;
+
+	if (it->compressed < it->rl) {
+		*len = it->rl - it->compressed;
+		it->compressed = it->rl;
+		*next = it->b ? (eword_t)(~0) : 0;
+	} else {
+		assert(it->literals < it->lw);
+
+		it->literals++;
+		it->pointer++;
+
+		assert(it->pointer < it->buffer_size);
+
+		*len = 1;
+		*next = it->buffer[it->pointer];
+	}
+
+	if (it->compressed == it->rl && it->literals == it->lw) {
+		if (++it->pointer < it->buffer_size)
+			read_new_rlw(it);
+	}
+
+	return 1;
+}
+
 void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
 {
 	it->buffer = parent->buffer;
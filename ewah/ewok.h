@@ -175,6 +175,36 @@ void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
  */
 int ewah_iterator_next(eword_t *next, struct ewah_iterator *it);
 
+/**
+ * Like `ewah_iterator_next`, but yield a run of clean words at once:
+ * `*next` is then the fill word (all zeroes or all ones) and `*len`
+ * the number of words in the run.  Literal words are yielded one by
+ * one, with `*len` set to 1.  This lets callers skip over long runs
+ * without expanding them word by word.
+ *
+ * Return: true if a run or word was yielded, false if there are none left
+ */
+int ewah_iterator_next_run(eword_t *next, size_t *len, struct ewah_iterator *it);
+
+/**
+ * Store the positions of the bits set in `word` into `pos`, offset by
+ * `base`, and return how many there are.  `pos` must have room for
+ * BITS_IN_EWORD entries.  Decoding a whole word in one tight loop
+ * before acting on the positions keeps the bit scanning out of the
+ * (usually much heavier) per-position work.
+ */
+static inline unsigned ewah_word_positions(eword_t word, size_t base,
+					   size_t *pos)
+{
+	unsigned nr = 0;
+
+	while (word) {
+		pos[nr++] = base + ewah_bit_ctz64(word);
+		word &= word - 1;
+	}
+	return nr;
+}
+
 void ewah_or(
 	struct ewah_bitmap *ewah_i,
 	struct ewah_bitmap *ewah_j,
@@ -165,6 +165,7 @@ Format of STDIN stream:
 #include "quote.h"
 #include "exec_cmd.h"
 #include "dir.h"
+#include "thread-utils.h"
 
 #define PACK_ID_BITS 16
 #define MAX_PACK_ID ((1<<PACK_ID_BITS)-1)
@@ -182,6 +183,7 @@ struct object_entry {
 	uint32_t type : TYPE_BITS,
 		pack_id : PACK_ID_BITS,
 		depth : DEPTH_BITS;
+	unsigned pending : 1; /* queued for a blob worker, not yet written */
 };
 
 struct object_entry_pool {
@@ -199,6 +201,16 @@ struct mark_set {
 	unsigned int shift;
 };
 
+/*
+ * Marks moved out of core when over --memory-limit; kept sorted by
+ * mark in a temporary file that only this process reads.
+ */
+struct spilled_mark {
+	uintmax_t mark;
+	uint32_t type;
+	unsigned char sha1[20];
+};
+
 struct last_object {
 	struct strbuf data;
 	off_t offset;
@@ -284,6 +296,7 @@ static off_t max_packsize;
 static int force_update;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 static int pack_compression_seen;
+static uintmax_t memory_limit;
 
 /* Stats and misc. counters */
 static uintmax_t alloc_count;
@@ -306,6 +319,12 @@ static size_t mem_pool_alloc = 2*1024*1024 - sizeof(struct mem_pool);
 static size_t total_allocd;
 static struct mem_pool *mem_pool;
 
+/* Memory not taken from the pools, so that it can be given back */
+static size_t object_entry_allocd;
+static size_t marks_allocd;
+static size_t tree_content_allocd;
+static size_t tree_content_avail;
+
 /* Atom management */
 static unsigned int atom_table_sz = 4451;
 static unsigned int atom_cnt;
@@ -324,6 +343,9 @@ static unsigned int object_entry_alloc = 5000;
 static struct object_entry_pool *blocks;
 static struct object_entry *object_table[1 << 16];
 static struct mark_set *marks;
+static struct spilled_mark *spilled_marks;
+static size_t spilled_marks_nr;
+static char spilled_marks_file[PATH_MAX];
 static const char *export_marks_file;
 static const char *import_marks_file;
 static int import_marks_file_from_stream;
@@ -333,6 +355,9 @@ static int relative_marks_paths;
 /* Our last blob */
 static struct last_object last_blob = { STRBUF_INIT, 0, 0, 0 };
 
+/* Threads deltifying and deflating blobs; 1 does it all in line */
+static int blob_threads = 1;
+
 /* Tree management */
 static unsigned int tree_entry_alloc = 1000;
 static void *avail_tree_entry;
@@ -401,7 +426,19 @@ static void write_branch_report(FILE *rpt, struct branch *b)
 	fputc('\n', rpt);
 }
 
-static void dump_marks_helper(FILE *, uintmax_t, struct mark_set *);
+static void dump_all_marks(FILE *);
+
+static void write_memory_report(FILE *f)
+{
+	uintmax_t total = total_allocd + object_entry_allocd
+		+ marks_allocd + tree_content_allocd;
+
+	fprintf(f, "Memory total:    %10" PRIuMAX " KiB\n", total/1024);
+	fprintf(f, "       pools:    %10lu KiB\n", (unsigned long)(total_allocd/1024));
+	fprintf(f, "     objects:    %10lu KiB\n", (unsigned long)(object_entry_allocd/1024));
+	fprintf(f, "       marks:    %10lu KiB (%10lu on disk   )\n", (unsigned long)(marks_allocd/1024), (unsigned long)spilled_marks_nr);
+	fprintf(f, "       trees:    %10lu KiB (%10lu KiB unused)\n", (unsigned long)(tree_content_allocd/1024), (unsigned long)(tree_content_avail/1024));
+}
 
 static void write_crash_report(const char *err)
 {
@@ -480,7 +517,12 @@ static void write_crash_report(const char *err)
 	if (export_marks_file)
 		fprintf(rpt, "  exported to %s\n", export_marks_file);
 	else
-		dump_marks_helper(rpt, 0, marks);
+		dump_all_marks(rpt);
+
+	fputc('\n', rpt);
+	fputs("Memory\n", rpt);
+	fputs("------\n", rpt);
+	write_memory_report(rpt);
 
 	fputc('\n', rpt);
 	fputs("-------------------\n", rpt);
@@ -489,6 +531,7 @@ static void write_crash_report(const char *err)
 }
 
 static void end_packfile(void);
+static void finish_queued_blobs(void);
 static void unkeep_all_packs(void);
 static void dump_marks(void);
 
@@ -549,6 +592,8 @@ static void alloc_objects(unsigned int cnt)
 	b->end = b->entries + cnt;
 	blocks = b;
 	alloc_count += cnt;
+	object_entry_allocd += sizeof(struct object_entry_pool)
+		+ cnt * sizeof(struct object_entry);
 }
 
 static struct object_entry *new_object(unsigned char *sha1)
@@ -560,6 +605,7 @@ static struct object_entry *new_object(unsigned char *sha1)
 
 	e = blocks->next_free++;
 	hashcpy(e->idx.sha1, sha1);
+	e->pending = 0;
 	return e;
 }
 
@@ -645,45 +691,96 @@ static char *pool_strdup(const char *s)
 	return r;
 }
 
+static struct mark_set *new_mark_set(unsigned int shift)
+{
+	struct mark_set *s = xcalloc(1, sizeof(struct mark_set));
+	s->shift = shift;
+	marks_allocd += sizeof(struct mark_set);
+	return s;
+}
+
+static void free_mark_set(struct mark_set *s)
+{
+	unsigned int k;
+	if (s->shift) {
+		for (k = 0; k < 1024; k++)
+			if (s->data.sets[k])
+				free_mark_set(s->data.sets[k]);
+	}
+	marks_allocd -= sizeof(struct mark_set);
+	free(s);
+}
+
+static struct spilled_mark *find_spilled_mark(uintmax_t idnum)
+{
+	size_t lo = 0, hi = spilled_marks_nr;
+
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		struct spilled_mark *m = &spilled_marks[mi];
+		if (m->mark == idnum)
+			return m;
+		if (m->mark < idnum)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
 static void insert_mark(uintmax_t idnum, struct object_entry *oe)
 {
+	uintmax_t orig_idnum = idnum;
 	struct mark_set *s = marks;
 	while ((idnum >> s->shift) >= 1024) {
-		s = pool_calloc(1, sizeof(struct mark_set));
-		s->shift = marks->shift + 10;
+		s = new_mark_set(marks->shift + 10);
 		s->data.sets[0] = marks;
 		marks = s;
 	}
 	while (s->shift) {
 		uintmax_t i = idnum >> s->shift;
 		idnum -= i << s->shift;
-		if (!s->data.sets[i]) {
-			s->data.sets[i] = pool_calloc(1, sizeof(struct mark_set));
-			s->data.sets[i]->shift = s->shift - 10;
-		}
+		if (!s->data.sets[i])
+			s->data.sets[i] = new_mark_set(s->shift - 10);
 		s = s->data.sets[i];
 	}
-	if (!s->data.marked[idnum])
+	if (!s->data.marked[idnum] && !find_spilled_mark(orig_idnum))
 		marks_set_count++;
 	s->data.marked[idnum] = oe;
 }
 
-static struct object_entry *find_mark(uintmax_t idnum)
+static struct object_entry *find_mark_in_core(uintmax_t idnum)
 {
-	uintmax_t orig_idnum = idnum;
 	struct mark_set *s = marks;
-	struct object_entry *oe = NULL;
-	if ((idnum >> s->shift) < 1024) {
-		while (s && s->shift) {
-			uintmax_t i = idnum >> s->shift;
-			idnum -= i << s->shift;
-			s = s->data.sets[i];
-		}
-		if (s)
-			oe = s->data.marked[idnum];
+	if ((idnum >> s->shift) >= 1024)
+		return NULL;
+	while (s && s->shift) {
+		uintmax_t i = idnum >> s->shift;
+		idnum -= i << s->shift;
+		s = s->data.sets[i];
+	}
+	return s ? s->data.marked[idnum] : NULL;
+}
+
+static struct object_entry *find_mark(uintmax_t idnum)
+{
+	struct object_entry *oe = find_mark_in_core(idnum);
+	struct spilled_mark *m;
+
+	if (oe)
+		return oe;
+	m = find_spilled_mark(idnum);
+	if (!m)
+		die("mark :%" PRIuMAX " not declared", idnum);
+
+	/* Its object is in a finished pack; bring the mark back in. */
+	oe = insert_object(m->sha1);
+	if (!oe->idx.offset) {
+		oe->type = m->type;
+		oe->pack_id = MAX_PACK_ID;
+		oe->idx.offset = 1; /* just not zero! */
 	}
-	if (!oe)
-		die("mark :%" PRIuMAX " not declared", orig_idnum);
+	insert_mark(idnum, oe);
 	return oe;
 }
 
@@ -746,6 +843,11 @@ static unsigned int hc_entries(unsigned int cnt)
 	return cnt < avail_tree_table_sz ? cnt : avail_tree_table_sz - 1;
 }
 
+static size_t tree_content_size(unsigned int cnt)
+{
+	return sizeof(struct tree_content) + sizeof(struct tree_entry *) * cnt;
+}
+
 static struct tree_content *new_tree_content(unsigned int cnt)
 {
 	struct avail_tree_content *f, *l = NULL;
@@ -761,10 +863,12 @@ static struct tree_content *new_tree_content(unsigned int cnt)
 			l->next_avail = f->next_avail;
 		else
 			avail_tree_table[hc] = f->next_avail;
+		tree_content_avail -= tree_content_size(f->entry_capacity);
 	} else {
 		cnt = cnt & 7 ? ((cnt / 8) + 1) * 8 : cnt;
-		f = pool_alloc(sizeof(*t) + sizeof(t->entries[0]) * cnt);
+		f = xmalloc(tree_content_size(cnt));
 		f->entry_capacity = cnt;
+		tree_content_allocd += tree_content_size(cnt);
 	}
 
 	t = (struct tree_content*)f;
@@ -780,6 +884,22 @@ static void release_tree_content(struct tree_content *t)
 	unsigned int hc = hc_entries(f->entry_capacity);
 	f->next_avail = avail_tree_table[hc];
 	avail_tree_table[hc] = f;
+	tree_content_avail += tree_content_size(f->entry_capacity);
+}
+
+static void free_avail_tree_contents(void)
+{
+	unsigned int hc;
+
+	for (hc = 0; hc < avail_tree_table_sz; hc++) {
+		while (avail_tree_table[hc]) {
+			struct avail_tree_content *f = avail_tree_table[hc];
+			avail_tree_table[hc] = f->next_avail;
+			tree_content_allocd -= tree_content_size(f->entry_capacity);
+			free(f);
+		}
+	}
+	tree_content_avail = 0;
 }
 
 static void release_tree_content_recursive(struct tree_content *t)
@@ -895,7 +1015,7 @@ static const char *create_index(void)
 	c = idx;
 	for (o = blocks; o; o = o->next_pool)
 		for (e = o->next_free; e-- != o->entries;)
-			if (pack_id == e->pack_id)
+			if (pack_id == e->pack_id && !e->pending)
 				*c++ = &e->idx;
 	last = idx + object_count;
 	if (c != last)
@@ -952,6 +1072,8 @@ static void end_packfile(void)
 	if (running || !pack_data)
 		return;
 
+	/* writing them may cycle the pack itself */
+	finish_queued_blobs();
 	running = 1;
 	clear_delta_base_cache();
 	if (object_count) {
@@ -1016,6 +1138,373 @@ static void cycle_packfile(void)
 	start_packfile();
 }
 
+static void *deflate_object(const void *buf, unsigned long len,
+			    unsigned long *out_len)
+{
+	git_zstream s;
+	void *out;
+
+	git_deflate_init(&s, pack_compression_level);
+	s.next_in = (void *)buf;
+	s.avail_in = len;
+	s.avail_out = git_deflate_bound(&s, s.avail_in);
+	s.next_out = out = xmalloc(s.avail_out);
+	while (git_deflate(&s, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&s);
+	*out_len = s.total_out;
+	return out;
+}
+
+/*
+ * Append the deflated data "out" of "e" to the pack, as a delta of
+ * "deltalen" bytes against "last" if "delta" is set.
+ */
+static void write_object_data(struct object_entry *e, enum object_type type,
+			      unsigned long size, struct last_object *last,
+			      int delta, unsigned long deltalen,
+			      const void *out, unsigned long out_len)
+{
+	unsigned char hdr[96];
+	unsigned long hdrlen;
+
+	e->type = type;
+	e->pack_id = pack_id;
+	e->idx.offset = pack_size;
+	object_count++;
+	object_count_by_type[type]++;
+
+	crc32_begin(pack_file);
+
+	if (delta) {
+		off_t ofs = e->idx.offset - last->offset;
+		unsigned pos = sizeof(hdr) - 1;
+
+		delta_count_by_type[type]++;
+		e->depth = last->depth + 1;
+
+		hdrlen = encode_in_pack_object_header(OBJ_OFS_DELTA, deltalen, hdr);
+		sha1write(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+
+		hdr[pos] = ofs & 127;
+		while (ofs >>= 7)
+			hdr[--pos] = 128 | (--ofs & 127);
+		sha1write(pack_file, hdr + pos, sizeof(hdr) - pos);
+		pack_size += sizeof(hdr) - pos;
+	} else {
+		e->depth = 0;
+		hdrlen = encode_in_pack_object_header(type, size, hdr);
+		sha1write(pack_file, hdr, hdrlen);
+		pack_size += hdrlen;
+	}
+
+	sha1write(pack_file, out, out_len);
+	pack_size += out_len;
+
+	e->idx.crc32 = crc32_end(pack_file);
+}
+
+#ifndef NO_PTHREADS
+/*
+ * With more than one blob thread, store_object() only hashes a new
+ * blob and enters it into the object table, and queues it.  Threads
+ * then deltify it against the blob queued before it and deflate it,
+ * while the command stream is parsed further.  Only the main thread
+ * writes to the pack, taking the blobs in the order they came in, so
+ * that a delta is written right after its base; other objects may go
+ * to the pack in between.  Anything that reads back from the pack, or
+ * finishes it, writes all queued blobs first.
+ *
+ * A blob is deltified when the blob before it could be, assuming
+ * that one became a delta; when it did not, the chain just ends
+ * early, never too late.
+ */
+struct blob_job {
+	struct object_entry *e;
+	struct strbuf data;
+	const struct strbuf *base;
+	struct strbuf own_base; /* the base, when it came from last_blob */
+	unsigned int depth; /* if all blobs before became deltas */
+	void *out;
+	unsigned long out_len, delta_len;
+	int delta;
+	int done;
+};
+
+struct blob_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t main_thread;
+	pthread_t *threads;
+	struct blob_job *job;
+	unsigned int nr_slots;
+	/* job n is in slot n % nr_slots */
+	unsigned long queued, taken, written;
+	/* the data of job written - 1 is still in its slot */
+	int last_in_slot;
+	int writing;
+	int stop;
+};
+
+static struct blob_pool *blob_pool;
+
+static void compress_blob(struct blob_job *job)
+{
+	void *delta = NULL;
+
+	if (job->base)
+		delta = diff_delta(job->base->buf, job->base->len,
+				   job->data.buf, job->data.len,
+				   &job->delta_len, job->data.len - 20);
+	job->delta = !!delta;
+	if (delta) {
+		job->out = deflate_object(delta, job->delta_len, &job->out_len);
+		free(delta);
+	} else
+		job->out = deflate_object(job->data.buf, job->data.len,
+					  &job->out_len);
+}
+
+static void *blob_worker(void *data)
+{
+	struct blob_pool *pool = data;
+
+	for (;;) {
+		struct blob_job *job;
+
+		pthread_mutex_lock(&pool->mutex);
+		while (pool->taken == pool->queued && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->taken == pool->queued) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		job = &pool->job[pool->taken++ % pool->nr_slots];
+		pthread_mutex_unlock(&pool->mutex);
+
+		compress_blob(job);
+
+		pthread_mutex_lock(&pool->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+static void start_blob_pool(void)
+{
+	struct blob_pool *pool = xcalloc(1, sizeof(*pool));
+	int i;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->main_thread = pthread_self();
+	pool->nr_slots = 4 * blob_threads + 1;
+	pool->job = xcalloc(pool->nr_slots, sizeof(*pool->job));
+	for (i = 0; i < pool->nr_slots; i++) {
+		strbuf_init(&pool->job[i].data, 0);
+		strbuf_init(&pool->job[i].own_base, 0);
+	}
+	pool->threads = xcalloc(blob_threads, sizeof(*pool->threads));
+	for (i = 0; i < blob_threads; i++) {
+		int err = pthread_create(&pool->threads[i], NULL,
+					 blob_worker, pool);
+		if (err)
+			die("unable to create thread: %s", strerror(err));
+	}
+	blob_pool = pool;
+}
+
+static void write_blob_job(struct blob_pool *pool, struct blob_job *job)
+{
+	struct object_entry *e = job->e;
+	/* the base was written right before, unless the pack changed */
+	int delta = job->delta && last_blob.offset &&
+		last_blob.depth < max_depth;
+
+	if (job->delta && !delta) {
+		free(job->out);
+		job->out = deflate_object(job->data.buf, job->data.len,
+					  &job->out_len);
+	}
+
+	/* Determine if we should auto-checkpoint. */
+	if ((max_packsize && (pack_size + 60 + job->out_len) > max_packsize)
+		|| (pack_size + 60 + job->out_len) < pack_size) {
+
+		/* This new object needs to *not* have the current pack_id. */
+		e->pack_id = pack_id + 1;
+		cycle_packfile();
+
+		/* We cannot carry a delta into the new pack. */
+		if (delta) {
+			delta = 0;
+			free(job->out);
+			job->out = deflate_object(job->data.buf, job->data.len,
+						  &job->out_len);
+		}
+	}
+
+	write_object_data(e, OBJ_BLOB, job->data.len, &last_blob,
+			  delta, job->delta_len, job->out, job->out_len);
+	e->pending = 0;
+	last_blob.offset = e->idx.offset;
+	last_blob.depth = e->depth;
+
+	free(job->out);
+	job->out = NULL;
+	if (job->base == &job->own_base)
+		strbuf_release(&job->own_base);
+	else if (job->base)
+		strbuf_release(&pool->job[(pool->written - 1) % pool->nr_slots].data);
+}
+
+/*
+ * Write the queued blobs that are done, in order; with "all", wait
+ * for the rest, and leave the last one in last_blob.
+ */
+static void write_queued_blobs(int all)
+{
+	struct blob_pool *pool = blob_pool;
+
+	/* a thread that dies must not wait for itself */
+	if (!pool || pool->writing ||
+	    !pthread_equal(pthread_self(), pool->main_thread))
+		return;
+	pool->writing = 1;
+	while (pool->written < pool->queued) {
+		struct blob_job *job = &pool->job[pool->written % pool->nr_slots];
+
+		pthread_mutex_lock(&pool->mutex);
+		while (all && !job->done)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		pthread_mutex_unlock(&pool->mutex);
+		if (!job->done)
+			break;
+
+		/*
+		 * write_blob_job() releases the base of a job; without
+		 * one, the data of the job before is not needed either.
+		 */
+		if (pool->written && pool->last_in_slot && !job->base)
+			strbuf_release(&pool->job[(pool->written - 1) % pool->nr_slots].data);
+		write_blob_job(pool, job);
+		pool->written++;
+		pool->last_in_slot = 1;
+	}
+	if (all && pool->last_in_slot) {
+		struct blob_job *job = &pool->job[(pool->written - 1) % pool->nr_slots];
+
+		strbuf_swap(&last_blob.data, &job->data);
+		strbuf_release(&job->data);
+		pool->last_in_slot = 0;
+	}
+	pool->writing = 0;
+}
+
+static void queue_blob(struct object_entry *e, struct strbuf *dat)
+{
+	struct blob_pool *pool;
+	struct blob_job *job;
+	unsigned int prev_depth;
+
+	e->type = OBJ_BLOB;
+	e->pack_id = pack_id;
+	e->pending = 1;
+
+	if (!blob_pool)
+		start_blob_pool();
+	pool = blob_pool;
+
+	/* keep the slot of the last written job, whose data is a base */
+	while (pool->queued - pool->written + 1 >= pool->nr_slots) {
+		pthread_mutex_lock(&pool->mutex);
+		while (!pool->job[pool->written % pool->nr_slots].done)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		pthread_mutex_unlock(&pool->mutex);
+		write_queued_blobs(0);
+	}
+
+	job = &pool->job[pool->queued % pool->nr_slots];
+	job->e = e;
+	job->base = NULL;
+	job->done = 0;
+	strbuf_swap(&job->data, dat);
+
+	if (pool->queued > pool->written || pool->last_in_slot) {
+		struct blob_job *prev = &pool->job[(pool->queued - 1) % pool->nr_slots];
+		job->base = &prev->data;
+		prev_depth = prev->depth;
+	} else {
+		if (last_blob.data.buf && last_blob.data.len) {
+			strbuf_swap(&job->own_base, &last_blob.data);
+			job->base = &job->own_base;
+		}
+		prev_depth = last_blob.depth;
+	}
+	if (job->base && (prev_depth >= max_depth || job->data.len <= 20)) {
+		if (job->base == &job->own_base)
+			strbuf_swap(&job->own_base, &last_blob.data);
+		job->base = NULL;
+	}
+	if (job->base)
+		delta_count_attempts_by_type[OBJ_BLOB]++;
+	job->depth = job->base ? prev_depth + 1 : 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->queued++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	write_queued_blobs(0);
+}
+
+static void finish_queued_blobs(void)
+{
+	write_queued_blobs(1);
+}
+
+static void stop_blob_pool(void)
+{
+	struct blob_pool *pool = blob_pool;
+	int i;
+
+	if (!pool)
+		return;
+	finish_queued_blobs();
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 0; i < blob_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+	for (i = 0; i < pool->nr_slots; i++) {
+		strbuf_release(&pool->job[i].data);
+		strbuf_release(&pool->job[i].own_base);
+	}
+	free(pool->threads);
+	free(pool->job);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+	blob_pool = NULL;
+}
+#else
+static void queue_blob(struct object_entry *e, struct strbuf *dat)
+{
+	die("BUG: no threads to queue blobs for");
+}
+
+static void finish_queued_blobs(void)
+{
+}
+
+static void stop_blob_pool(void)
+{
+}
+#endif
+
 static int store_object(
 	enum object_type type,
 	struct strbuf *dat,
@@ -1027,9 +1516,8 @@ static int store_object(
 	struct object_entry *e;
 	unsigned char hdr[96];
 	unsigned char sha1[20];
-	unsigned long hdrlen, deltalen;
+	unsigned long hdrlen, deltalen, out_len;
 	git_SHA_CTX c;
-	git_zstream s;
 
 	hdrlen = sprintf((char *)hdr,"%s %lu", typename(type),
 		(unsigned long)dat->len) + 1;
@@ -1043,7 +1531,7 @@ static int store_object(
 	e = insert_object(sha1);
 	if (mark)
 		insert_mark(mark, e);
-	if (e->idx.offset) {
+	if (e->idx.offset || e->pending) {
 		duplicate_count_by_type[type]++;
 		return 1;
 	} else if (find_sha1_pack(sha1, packed_git)) {
@@ -1054,6 +1542,11 @@ static int store_object(
 		return 1;
 	}
 
+	if (blob_threads > 1 && last == &last_blob) {
+		queue_blob(e, dat);
+		return 0;
+	}
+
 	if (last && last->data.buf && last->depth < max_depth && dat->len > 20) {
 		delta_count_attempts_by_type[type]++;
 		delta = diff_delta(last->data.buf, last->data.len,
@@ -1062,79 +1555,39 @@ static int store_object(
 	} else
 		delta = NULL;
 
-	git_deflate_init(&s, pack_compression_level);
-	if (delta) {
-		s.next_in = delta;
-		s.avail_in = deltalen;
-	} else {
-		s.next_in = (void *)dat->buf;
-		s.avail_in = dat->len;
-	}
-	s.avail_out = git_deflate_bound(&s, s.avail_in);
-	s.next_out = out = xmalloc(s.avail_out);
-	while (git_deflate(&s, Z_FINISH) == Z_OK)
-		; /* nothing */
-	git_deflate_end(&s);
+	if (delta)
+		out = deflate_object(delta, deltalen, &out_len);
+	else
+		out = deflate_object(dat->buf, dat->len, &out_len);
 
 	/* Determine if we should auto-checkpoint. */
-	if ((max_packsize && (pack_size + 60 + s.total_out) > max_packsize)
-		|| (pack_size + 60 + s.total_out) < pack_size) {
+	if ((max_packsize && (pack_size + 60 + out_len) > max_packsize)
+		|| (pack_size + 60 + out_len) < pack_size) {
+		unsigned int old_pack_id = pack_id;
 
-		/* This new object needs to *not* have the current pack_id. */
-		e->pack_id = pack_id + 1;
-		cycle_packfile();
+		/*
+		 * Queued blobs go first, and may start a new pack
+		 * themselves; keep this object out of their index.
+		 */
+		e->pack_id = MAX_PACK_ID;
+		finish_queued_blobs();
+		if (pack_id == old_pack_id) {
+			/* This new object needs to *not* have the current pack_id. */
+			e->pack_id = pack_id + 1;
+			cycle_packfile();
+		}
 
 		/* We cannot carry a delta into the new pack. */
 		if (delta) {
 			free(delta);
 			delta = NULL;
-
-			git_deflate_init(&s, pack_compression_level);
-			s.next_in = (void *)dat->buf;
-			s.avail_in = dat->len;
-			s.avail_out = git_deflate_bound(&s, s.avail_in);
-			s.next_out = out = xrealloc(out, s.avail_out);
-			while (git_deflate(&s, Z_FINISH) == Z_OK)
-				; /* nothing */
-			git_deflate_end(&s);
+			free(out);
+			out = deflate_object(dat->buf, dat->len, &out_len);
 		}
 	}
 
-	e->type = type;
-	e->pack_id = pack_id;
-	e->idx.offset = pack_size;
-	object_count++;
-	object_count_by_type[type]++;
-
-	crc32_begin(pack_file);
-
-	if (delta) {
-		off_t ofs = e->idx.offset - last->offset;
-		unsigned pos = sizeof(hdr) - 1;
-
-		delta_count_by_type[type]++;
-		e->depth = last->depth + 1;
-
-		hdrlen = encode_in_pack_object_header(OBJ_OFS_DELTA, deltalen, hdr);
-		sha1write(pack_file, hdr, hdrlen);
-		pack_size += hdrlen;
-
-		hdr[pos] = ofs & 127;
-		while (ofs >>= 7)
-			hdr[--pos] = 128 | (--ofs & 127);
-		sha1write(pack_file, hdr + pos, sizeof(hdr) - pos);
-		pack_size += sizeof(hdr) - pos;
-	} else {
-		e->depth = 0;
-		hdrlen = encode_in_pack_object_header(type, dat->len, hdr);
-		sha1write(pack_file, hdr, hdrlen);
-		pack_size += hdrlen;
-	}
-
-	sha1write(pack_file, out, s.total_out);
-	pack_size += s.total_out;
-
-	e->idx.crc32 = crc32_end(pack_file);
+	write_object_data(e, type, dat->len, last, !!delta, deltalen,
+			  out, out_len);
 
 	free(out);
 	free(delta);
@@ -1240,7 +1693,7 @@ static void stream_blob(uintmax_t len, unsigned char *sha1out, uintmax_t mark)
 	if (mark)
 		insert_mark(mark, e);
 
-	if (e->idx.offset) {
+	if (e->idx.offset || e->pending) {
 		duplicate_count_by_type[OBJ_BLOB]++;
 		truncate_pack(&checkpoint);
 
@@ -1288,7 +1741,10 @@ static void *gfi_unpack_entry(
 	unsigned long *sizep)
 {
 	enum object_type type;
-	struct packed_git *p = all_packs[oe->pack_id];
+	struct packed_git *p;
+
+	finish_queued_blobs();
+	p = all_packs[oe->pack_id];
 	if (p == pack_data && p->pack_size < (pack_size + 20)) {
 		/* The object is stored in the packfile we are writing to
 		 * and we have modified it since the last time we scanned
@@ -1792,6 +2248,19 @@ static void dump_marks_helper(FILE *f,
 	}
 }
 
+static void dump_all_marks(FILE *f)
+{
+	size_t i;
+
+	dump_marks_helper(f, 0, marks);
+	for (i = 0; i < spilled_marks_nr; i++) {
+		struct spilled_mark *m = &spilled_marks[i];
+		if (!find_mark_in_core(m->mark))
+			fprintf(f, ":%" PRIuMAX " %s\n", m->mark,
+				sha1_to_hex(m->sha1));
+	}
+}
+
 static void dump_marks(void)
 {
 	static struct lock_file mark_lock;
@@ -1815,7 +2284,7 @@ static void dump_marks(void)
 		return;
 	}
 
-	dump_marks_helper(f, 0, marks);
+	dump_all_marks(f);
 	if (commit_lock_file(&mark_lock)) {
 		failure |= error("Unable to commit marks file %s: %s",
 			export_marks_file, strerror(errno));
@@ -2064,6 +2533,7 @@ static void parse_and_store_blob(
 		store_object(OBJ_BLOB, &buf, last, sha1out, mark);
 	else {
 		if (last) {
+			finish_queued_blobs();
 			strbuf_release(&last->data);
 			last->offset = 0;
 			last->depth = 0;
@@ -3089,6 +3559,7 @@ static void parse_ls(const char *p, struct branch *b)
 static void checkpoint(void)
 {
 	checkpoint_requested = 0;
+	finish_queued_blobs();
 	if (object_count) {
 		cycle_packfile();
 		dump_branches();
@@ -3097,6 +3568,125 @@ static void checkpoint(void)
 	}
 }
 
+static void write_spilled_mark(FILE *f, uintmax_t mark,
+			       struct object_entry *oe)
+{
+	struct spilled_mark m;
+
+	memset(&m, 0, sizeof(m));
+	m.mark = mark;
+	m.type = oe->type;
+	hashcpy(m.sha1, oe->idx.sha1);
+	fwrite(&m, sizeof(m), 1, f);
+}
+
+/*
+ * Write the in-core marks below m to f, merged with the marks
+ * already on disk; *pos walks the latter, which lose on a tie.
+ */
+static void spill_marks_helper(FILE *f, uintmax_t base,
+			       struct mark_set *m, size_t *pos)
+{
+	uintmax_t k;
+
+	for (k = 0; k < 1024; k++) {
+		if (m->shift) {
+			if (m->data.sets[k])
+				spill_marks_helper(f, base + (k << m->shift),
+						   m->data.sets[k], pos);
+			continue;
+		}
+		if (!m->data.marked[k])
+			continue;
+		while (*pos < spilled_marks_nr &&
+		       spilled_marks[*pos].mark <= base + k) {
+			if (spilled_marks[*pos].mark < base + k)
+				fwrite(&spilled_marks[*pos],
+				       sizeof(struct spilled_mark), 1, f);
+			(*pos)++;
+		}
+		write_spilled_mark(f, base + k, m->data.marked[k]);
+	}
+}
+
+/*
+ * Move every mark to disk and forget the objects we know of.  Only
+ * safe when nothing refers to the object table, and when every entry
+ * in it is in a finished pack, which the loaders find on their own.
+ */
+static void spill_marks(void)
+{
+	char tmpfile[PATH_MAX];
+	struct object_entry_pool *o;
+	size_t pos = 0;
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	fd = odb_mkstemp(tmpfile, sizeof(tmpfile), "pack/tmp_marks_XXXXXX");
+	f = xfdopen(fd, "w");
+	spill_marks_helper(f, 0, marks, &pos);
+	if (pos < spilled_marks_nr)
+		fwrite(spilled_marks + pos, sizeof(struct spilled_mark),
+		       spilled_marks_nr - pos, f);
+	if (fflush(f) || ferror(f))
+		die_errno("cannot write '%s'", tmpfile);
+
+	if (spilled_marks) {
+		munmap(spilled_marks,
+		       spilled_marks_nr * sizeof(struct spilled_mark));
+		unlink_or_warn(spilled_marks_file);
+	}
+	strlcpy(spilled_marks_file, tmpfile, sizeof(spilled_marks_file));
+	if (fstat(fd, &st))
+		die_errno("cannot stat '%s'", tmpfile);
+	spilled_marks_nr = xsize_t(st.st_size) / sizeof(struct spilled_mark);
+	spilled_marks = NULL;
+	if (spilled_marks_nr)
+		spilled_marks = xmmap(NULL, xsize_t(st.st_size), PROT_READ,
+				      MAP_PRIVATE, fd, 0);
+	fclose(f);
+
+	free_mark_set(marks);
+	marks = new_mark_set(0);
+
+	while (blocks) {
+		o = blocks->next_pool;
+		free(blocks);
+		blocks = o;
+	}
+	object_entry_allocd = 0;
+	memset(object_table, 0, sizeof(object_table));
+	alloc_objects(object_entry_alloc);
+}
+
+static void remove_spilled_marks(void)
+{
+	if (spilled_marks_file[0])
+		unlink(spilled_marks_file);
+}
+
+/*
+ * Called between commands when --memory-limit is in effect.  Once the
+ * object table, marks and unused tree buffers outgrow the limit, the
+ * current pack is finished so that everything in the object table can
+ * be found in a pack again, and the marks go to disk.
+ */
+static void trim_memory(void)
+{
+	if (object_entry_allocd + marks_allocd + tree_content_avail
+	    <= memory_limit)
+		return;
+
+	finish_queued_blobs();
+	if (object_count)
+		cycle_packfile();
+	free_avail_tree_contents();
+	if (!spilled_marks_file[0])
+		atexit(remove_spilled_marks);
+	spill_marks();
+}
+
 static void parse_checkpoint(void)
 {
 	checkpoint_requested = 1;
@@ -3164,6 +3754,30 @@ static void option_depth(const char *depth)
 		die("--depth cannot exceed %u", MAX_DEPTH);
 }
 
+static void option_threads(const char *threads)
+{
+	blob_threads = strtoul(threads, NULL, 0);
+	if (!blob_threads)
+		blob_threads = online_cpus();
+#ifdef NO_PTHREADS
+	if (blob_threads != 1)
+		warning("no threads support, ignoring --threads");
+	blob_threads = 1;
+#endif
+}
+
+static void option_memory_limit(const char *limit)
+{
+	unsigned long v;
+	if (!git_parse_ulong(limit, &v))
+		die("invalid --memory-limit: %s", limit);
+	if (v && v < 1024 * 1024) {
+		warning("minimum memory-limit is 1 MiB");
+		v = 1024 * 1024;
+	}
+	memory_limit = v;
+}
+
 static void option_active_branches(const char *branches)
 {
 	max_active_branches = ulong_arg("--active-branches", branches);
@@ -3217,6 +3831,10 @@ static int parse_one_option(const char *option)
 		option_active_branches(option);
 	} else if (skip_prefix(option, "export-pack-edges=", &option)) {
 		option_export_pack_edges(option);
+	} else if (skip_prefix(option, "threads=", &option)) {
+		option_threads(option);
+	} else if (skip_prefix(option, "memory-limit=", &option)) {
+		option_memory_limit(option);
 	} else if (starts_with(option, "quiet")) {
 		show_stats = 0;
 	} else if (starts_with(option, "stats")) {
@@ -3312,7 +3930,7 @@ static void git_pack_config(void)
 }
 
 static const char fast_import_usage[] =
-"git fast-import [--date-format=<f>] [--max-pack-size=<n>] [--big-file-threshold=<n>] [--depth=<n>] [--active-branches=<n>] [--export-marks=<marks.file>]";
+"git fast-import [--date-format=<f>] [--max-pack-size=<n>] [--big-file-threshold=<n>] [--depth=<n>] [--threads=<n>] [--memory-limit=<n>] [--active-branches=<n>] [--export-marks=<marks.file>]";
 
 static void parse_argv(void)
 {
@@ -3370,7 +3988,7 @@ int main(int argc, char **argv)
 	atom_table = xcalloc(atom_table_sz, sizeof(struct atom_str*));
 	branch_table = xcalloc(branch_table_sz, sizeof(struct branch*));
 	avail_tree_table = xcalloc(avail_tree_table_sz, sizeof(struct avail_tree_content*));
-	marks = pool_calloc(1, sizeof(struct mark_set));
+	marks = new_mark_set(0);
 
 	global_argc = argc;
 	global_argv = argv;
@@ -3413,6 +4031,8 @@ int main(int argc, char **argv)
 
 		if (checkpoint_requested)
 			checkpoint();
+		if (memory_limit)
+			trim_memory();
 	}
 
 	/* argv hasn't been parsed yet, do so */
@@ -3422,6 +4042,7 @@ int main(int argc, char **argv)
 	if (require_explicit_termination && feof(stdin))
 		die("stream ends early");
 
+	stop_blob_pool();
 	end_packfile();
 
 	dump_branches();
@@ -3450,9 +4071,7 @@ int main(int argc, char **argv)
 		fprintf(stderr, "Total branches:  %10lu (%10lu loads     )\n", branch_count, branch_load_count);
 		fprintf(stderr, "      marks:     %10" PRIuMAX " (%10" PRIuMAX " unique    )\n", (((uintmax_t)1) << marks->shift) * 1024, marks_set_count);
 		fprintf(stderr, "      atoms:     %10u\n", atom_cnt);
-		fprintf(stderr, "Memory total:    %10" PRIuMAX " KiB\n", (total_allocd + alloc_count*sizeof(struct object_entry))/1024);
-		fprintf(stderr, "       pools:    %10lu KiB\n", (unsigned long)(total_allocd/1024));
-		fprintf(stderr, "     objects:    %10" PRIuMAX " KiB\n", (alloc_count*sizeof(struct object_entry))/1024);
+		write_memory_report(stderr);
 		fprintf(stderr, "---------------------------------------------------------------------\n");
 		pack_report();
 		fprintf(stderr, "---------------------------------------------------------------------\n");
@@ -0,0 +1,60 @@
+#include "cache.h"
+#include "remote.h"
+#include "transport.h"
+#include "sha1-array.h"
+#include "fetch-object.h"
+
+static void fetch_refs(const char *remote_name, struct ref *ref)
+{
+	struct remote *remote;
+	struct transport *transport;
+	int original_fetch_if_missing = fetch_if_missing;
+
+	/* whatever the fetch itself reads has to be here already */
+	fetch_if_missing = 0;
+	remote = remote_get(remote_name);
+	if (!remote || !remote->url_nr)
+		die(_("partial clone remote '%s' has no URL"), remote_name);
+	transport = transport_get(remote, remote->url[0]);
+	transport_set_verbosity(transport, -1, 0);
+	transport_set_option(transport, TRANS_OPT_NO_DEPENDENTS, "1");
+	if (transport_fetch_refs(transport, ref))
+		die(_("unable to fetch missing objects from '%s'"),
+		    remote_name);
+	transport_unlock_pack(transport);
+	transport_disconnect(transport);
+	reprepare_packed_git();
+	fetch_if_missing = original_fetch_if_missing;
+}
+
+static struct ref *missing_object_ref(const unsigned char *sha1)
+{
+	struct ref *ref = alloc_ref(sha1_to_hex(sha1));
+
+	hashcpy(ref->old_sha1, sha1);
+	return ref;
+}
+
+void fetch_object(const char *remote_name, const unsigned char *sha1)
+{
+	struct ref *ref = missing_object_ref(sha1);
+
+	fetch_refs(remote_name, ref);
+	free_refs(ref);
+}
+
+void fetch_objects(const char *remote_name, const struct sha1_array *to_fetch)
+{
+	struct ref *ref = NULL;
+	int i;
+
+	if (!to_fetch->nr)
+		return;
+	for (i = 0; i < to_fetch->nr; i++) {
+		struct ref *new_ref = missing_object_ref(to_fetch->sha1[i]);
+		new_ref->next = ref;
+		ref = new_ref;
+	}
+	fetch_refs(remote_name, ref);
+	free_refs(ref);
+}
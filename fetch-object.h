@@ -0,0 +1,15 @@
+#ifndef FETCH_OBJECT_H
+#define FETCH_OBJECT_H
+
+struct sha1_array;
+
+/*
+ * Fetch the given objects (and, for trees and commits, whatever they
+ * reference) from the partial clone remote, without negotiating
+ * what we already have.  Dies if the fetch fails.
+ */
+extern void fetch_object(const char *remote_name, const unsigned char *sha1);
+extern void fetch_objects(const char *remote_name,
+			  const struct sha1_array *to_fetch);
+
+#endif
@@ -15,17 +15,25 @@
 #include "version.h"
 #include "prio-queue.h"
 #include "sha1-array.h"
+#include "string-list.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
 static int unpack_limit = 100;
 static int prefer_ofs_delta = 1;
 static int no_done;
+static enum {
+	NEGOTIATION_DEFAULT,
+	NEGOTIATION_SKIPPING
+} negotiation_algorithm;
 static int fetch_fsck_objects = -1;
 static int transfer_fsck_objects = -1;
 static int agent_supported;
 static struct lock_file shallow_lock;
 static const char *alternate_shallow_file;
+/* fetch.uriProtocols, and whether the server will send packfile URIs */
+static const char *uri_protocols;
+static int use_packfile_uris;
 
 /* Remember to update object flag allocation in object.h */
 #define COMPLETE	(1U << 0)
@@ -43,7 +51,7 @@ static int marked;
 #define MAX_IN_VAIN 256
 
 static struct prio_queue rev_list = { compare_commits_by_commit_date };
-static int non_common_revs, multi_ack, use_sideband;
+static int non_common_revs, multi_ack, use_sideband, use_sideband_bulk;
 /* Allow specifying sha1 if it is a ref tip. */
 #define ALLOW_TIP_SHA1	01
 /* Allow request of a sha1 if it is reachable from a ref (possibly hidden ref). */
@@ -65,11 +73,159 @@ static void rev_list_push(struct commit *commit, int mark)
 	}
 }
 
+/*
+ * The "skipping" negotiator (fetch.negotiationAlgorithm=skipping).
+ *
+ * Instead of sending a "have" for every commit it walks, it sends one
+ * for each tip and then skips ever more commits (1, 2, 4, 8... growing
+ * by about 1.5 each time) along each line of history, so that history
+ * the server does not have costs few round trips.  An ACKed commit
+ * makes everything we have seen behind it common, which stops the
+ * skipping there.  The server may therefore end up sending some
+ * objects we already have, between the last "have" it did not know
+ * and the first one it did.
+ *
+ * It shares the object flags and non_common_revs with the default
+ * negotiator; COMMON_REF marks commits the server advertised.
+ */
+struct skip_entry {
+	struct commit *commit;
+	uint16_t original_ttl;
+	uint16_t ttl;
+};
+
+static int compare_skip_entries(const void *a_, const void *b_, void *unused)
+{
+	const struct skip_entry *a = a_, *b = b_;
+	return compare_commits_by_commit_date(a->commit, b->commit, NULL);
+}
+
+static struct prio_queue skip_queue = { compare_skip_entries };
+
+static struct skip_entry *skip_push(struct commit *commit, int mark)
+{
+	struct skip_entry *entry = xcalloc(1, sizeof(*entry));
+
+	commit->object.flags |= mark | SEEN;
+	entry->commit = commit;
+	prio_queue_put(&skip_queue, entry);
+	if (!(mark & COMMON))
+		non_common_revs++;
+	return entry;
+}
+
+/* Mark this SEEN commit and all its SEEN ancestors as COMMON. */
+static void skip_mark_common(struct commit *commit)
+{
+	struct commit_list *p;
+
+	if (commit->object.flags & COMMON)
+		return;
+	commit->object.flags |= COMMON;
+	if (!(commit->object.flags & POPPED))
+		non_common_revs--;
+	if (!commit->object.parsed)
+		return;
+	for (p = commit->parents; p; p = p->next)
+		if (p->item->object.flags & SEEN)
+			skip_mark_common(p->item);
+}
+
+/*
+ * Make sure "parent" is queued, and passes on what "entry" knows:
+ * either that it is common, or how many commits are left to skip.
+ * Returns 0 if the parent was already popped (clock skew), so that
+ * it is as good as not being there.
+ */
+static int skip_push_parent(struct skip_entry *entry, struct commit *parent)
+{
+	struct skip_entry *parent_entry = NULL;
+
+	if (parent->object.flags & SEEN) {
+		int i;
+
+		if (parent->object.flags & POPPED)
+			return 0;
+		for (i = 0; i < skip_queue.nr; i++) {
+			parent_entry = skip_queue.array[i].data;
+			if (parent_entry->commit == parent)
+				break;
+		}
+		if (i == skip_queue.nr)
+			die("BUG: parent %s is not queued",
+			    sha1_to_hex(parent->object.sha1));
+	} else
+		parent_entry = skip_push(parent, 0);
+
+	if (entry->commit->object.flags & (COMMON | COMMON_REF)) {
+		skip_mark_common(parent);
+	} else {
+		uint16_t new_original_ttl = entry->ttl
+			? entry->original_ttl : entry->original_ttl * 3 / 2 + 1;
+		uint16_t new_ttl = entry->ttl
+			? entry->ttl - 1 : new_original_ttl;
+
+		if (parent_entry->original_ttl < new_original_ttl) {
+			parent_entry->original_ttl = new_original_ttl;
+			parent_entry->ttl = new_ttl;
+		}
+	}
+	return 1;
+}
+
+static const unsigned char *skip_get_rev(void)
+{
+	struct commit *to_send = NULL;
+
+	while (!to_send) {
+		struct skip_entry *entry;
+		struct commit *commit;
+		struct commit_list *p;
+		int parent_pushed = 0;
+
+		if (!skip_queue.nr || !non_common_revs)
+			return NULL;
+
+		entry = prio_queue_get(&skip_queue);
+		commit = entry->commit;
+		commit->object.flags |= POPPED;
+		if (!(commit->object.flags & COMMON))
+			non_common_revs--;
+
+		if (!(commit->object.flags & COMMON) && !entry->ttl)
+			to_send = commit;
+
+		parse_commit(commit);
+		for (p = commit->parents; p; p = p->next)
+			parent_pushed |= skip_push_parent(entry, p->item);
+
+		/* a root (or as good as one) is always worth sending */
+		if (!(commit->object.flags & COMMON) && !parent_pushed)
+			to_send = commit;
+
+		free(entry);
+	}
+	return to_send->object.sha1;
+}
+
+static void skip_clear(void)
+{
+	struct skip_entry *entry;
+
+	while ((entry = prio_queue_get(&skip_queue)))
+		free(entry);
+}
+
 static int rev_list_insert_ref(const char *refname, const unsigned char *sha1)
 {
 	struct object *o = deref_tag(parse_object(sha1), refname, 0);
 
-	if (o && o->type == OBJ_COMMIT)
+	if (!o || o->type != OBJ_COMMIT)
+		return 0;
+	if (negotiation_algorithm == NEGOTIATION_SKIPPING) {
+		if (!(o->flags & SEEN))
+			skip_push((struct commit *)o, 0);
+	} else
 		rev_list_push((struct commit *)o, SEEN);
 
 	return 0;
@@ -275,8 +431,15 @@ static int find_common(struct fetch_pack_args *args,
 		for_each_ref(clear_marks, NULL);
 	marked = 1;
 
-	for_each_ref(rev_list_insert_ref_oid, NULL);
-	for_each_alternate_ref(insert_one_alternate_ref, NULL);
+	if (args->negotiate_only) {
+		int i;
+
+		for (i = 0; i < args->negotiation_tips->nr; i++)
+			rev_list_insert_ref(NULL, args->negotiation_tips->sha1[i]);
+	} else if (!args->no_dependents) {
+		for_each_ref(rev_list_insert_ref_oid, NULL);
+		for_each_alternate_ref(insert_one_alternate_ref, NULL);
+	}
 
 	fetching = 0;
 	for ( ; refs ; refs = refs->next) {
@@ -300,17 +463,30 @@ static int find_common(struct fetch_pack_args *args,
 		}
 
 		remote_hex = sha1_to_hex(remote);
+		if (!fetching && args->protocol_v2) {
+			/*
+			 * The wants and what follows them are the
+			 * arguments of a "fetch" command; a stateless
+			 * server needs it with every request.
+			 */
+			packet_buf_write(&req_buf, "command=fetch\n");
+			packet_buf_write(&req_buf, "agent=%s\n",
+					 git_user_agent_sanitized());
+			packet_buf_delim(&req_buf);
+		}
 		if (!fetching) {
 			struct strbuf c = STRBUF_INIT;
 			if (multi_ack == 2)     strbuf_addstr(&c, " multi_ack_detailed");
 			if (multi_ack == 1)     strbuf_addstr(&c, " multi_ack");
 			if (no_done)            strbuf_addstr(&c, " no-done");
 			if (use_sideband == 2)  strbuf_addstr(&c, " side-band-64k");
+			if (use_sideband_bulk)  strbuf_addstr(&c, " side-band-bulk");
 			if (use_sideband == 1)  strbuf_addstr(&c, " side-band");
 			if (args->use_thin_pack) strbuf_addstr(&c, " thin-pack");
 			if (args->no_progress)   strbuf_addstr(&c, " no-progress");
 			if (args->include_tag)   strbuf_addstr(&c, " include-tag");
 			if (prefer_ofs_delta)   strbuf_addstr(&c, " ofs-delta");
+			if (args->negotiate_only) strbuf_addstr(&c, " negotiate-only");
 			if (agent_supported)    strbuf_addf(&c, " agent=%s",
 							    git_user_agent_sanitized());
 			packet_buf_write(&req_buf, "want %s%s\n", remote_hex, c.buf);
@@ -318,6 +494,9 @@ static int find_common(struct fetch_pack_args *args,
 		} else
 			packet_buf_write(&req_buf, "want %s\n", remote_hex);
 		fetching++;
+		/* one want is enough to be allowed to negotiate */
+		if (args->negotiate_only)
+			break;
 	}
 
 	if (!fetching) {
@@ -330,6 +509,11 @@ static int find_common(struct fetch_pack_args *args,
 		write_shallow_commits(&req_buf, 1, NULL);
 	if (args->depth > 0)
 		packet_buf_write(&req_buf, "deepen %d", args->depth);
+	if (args->filter_options.choice)
+		packet_buf_write(&req_buf, "filter %s",
+				 args->filter_options.filter_spec);
+	if (use_packfile_uris)
+		packet_buf_write(&req_buf, "packfile-uris %s", uri_protocols);
 	packet_buf_flush(&req_buf);
 	state_len = req_buf.len;
 
@@ -373,7 +557,8 @@ static int find_common(struct fetch_pack_args *args,
 
 	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
+	while ((sha1 = negotiation_algorithm == NEGOTIATION_SKIPPING
+		? skip_get_rev() : get_rev())) {
 		packet_buf_write(&req_buf, "have %s\n", sha1_to_hex(sha1));
 		if (args->verbose)
 			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
@@ -424,12 +609,23 @@ static int find_common(struct fetch_pack_args *args,
 						packet_buf_write(&req_buf, "have %s\n", hex);
 						state_len = req_buf.len;
 					}
-					mark_common(commit, 0, 1);
+					if (negotiation_algorithm == NEGOTIATION_SKIPPING)
+						skip_mark_common(commit);
+					else
+						mark_common(commit, 0, 1);
+					if (args->negotiate_only && ack == ACK_common)
+						sha1_array_append(args->common, result_sha1);
 					retval = 0;
 					in_vain = 0;
 					got_continue = 1;
-					if (ack == ACK_ready) {
+					/*
+					 * "ready" is about the pack we are not
+					 * going to ask for; keep looking for
+					 * more common commits.
+					 */
+					if (ack == ACK_ready && !args->negotiate_only) {
 						clear_prio_queue(&rev_list);
+						skip_clear();
 						got_ready = 1;
 					}
 					break;
@@ -445,6 +641,28 @@ static int find_common(struct fetch_pack_args *args,
 		}
 	}
 done:
+	skip_clear();
+	if (args->negotiate_only) {
+		/*
+		 * Hear the server out on the haves we sent, then hang up
+		 * instead of saying "done", which would get us a pack.
+		 */
+		if (req_buf.len) {
+			packet_buf_flush(&req_buf);
+			send_request(args, fd[1], &req_buf);
+			flushes++;
+		}
+		strbuf_release(&req_buf);
+		while (flushes) {
+			int ack = get_ack(fd[0], result_sha1);
+			if (!ack)
+				flushes--;
+			else if (ack == ACK_common)
+				sha1_array_append(args->common, result_sha1);
+		}
+		trace_counter("fetch-pack", "haves", count);
+		return retval;
+	}
 	if (!got_ready || !no_done) {
 		packet_buf_write(&req_buf, "done\n");
 		send_request(args, fd[1], &req_buf);
@@ -472,6 +690,7 @@ done:
 		}
 		flushes--;
 	}
+	trace_counter("fetch-pack", "haves", count);
 	/* it is no error to fetch into a completely empty repo */
 	return count ? retval : 0;
 }
@@ -599,7 +818,7 @@ static int everything_local(struct fetch_pack_args *args,
 	for (ref = *refs; ref; ref = ref->next) {
 		struct object *o;
 
-		if (!has_sha1_file(ref->old_sha1))
+		if (!has_sha1_file_with_flags(ref->old_sha1, HAS_SHA1_QUICK))
 			continue;
 
 		o = parse_object(ref->old_sha1);
@@ -636,11 +855,14 @@ static int everything_local(struct fetch_pack_args *args,
 		if (!o || o->type != OBJ_COMMIT || !(o->flags & COMPLETE))
 			continue;
 
-		if (!(o->flags & SEEN)) {
-			rev_list_push((struct commit *)o, COMMON_REF | SEEN);
-
-			mark_common((struct commit *)o, 1, 1);
+		if (o->flags & SEEN)
+			continue;
+		if (negotiation_algorithm == NEGOTIATION_SKIPPING) {
+			skip_push((struct commit *)o, COMMON_REF);
+			continue;
 		}
+		rev_list_push((struct commit *)o, COMMON_REF | SEEN);
+		mark_common((struct commit *)o, 1, 1);
 	}
 
 	filter_refs(args, refs, sought, nr_sought);
@@ -677,6 +899,42 @@ static int sideband_demux(int in, int out, void *data)
 	return ret;
 }
 
+/*
+ * With "packfile-uris", the pack data starts with the "<pack-hash> <uri>"
+ * of each pack we are to download, as pkt-lines ending with a flush-pkt.
+ */
+static void read_packfile_uris(int fd, struct string_list *uris)
+{
+	char *line;
+	unsigned char sha1[20];
+
+	while ((line = packet_read_line(fd, NULL))) {
+		if (get_sha1_hex(line, sha1) || line[40] != ' ')
+			die("fetch-pack: invalid packfile URI line: %s", line);
+		string_list_append(uris, line);
+	}
+}
+
+static void fetch_packfile_uris(struct string_list *uris, int fsck_objects)
+{
+	int i;
+
+	for (i = 0; i < uris->nr; i++) {
+		const char *line = uris->items[i].string;
+		struct child_process cmd = CHILD_PROCESS_INIT;
+
+		argv_array_push(&cmd.args, "http-fetch");
+		argv_array_pushf(&cmd.args, "--packfile=%.40s", line);
+		if (fsck_objects)
+			argv_array_push(&cmd.args, "--index-pack-arg=--fsck-objects");
+		argv_array_push(&cmd.args, line + 41);
+		cmd.git_cmd = 1;
+		if (run_command(&cmd))
+			die("fetch-pack: unable to download pack %.40s from %s",
+			    line, line + 41);
+	}
+}
+
 static int get_pack(struct fetch_pack_args *args,
 		    int xd[2], char **pack_lockfile)
 {
@@ -687,6 +945,8 @@ static int get_pack(struct fetch_pack_args *args,
 	const char **av, *cmd_name;
 	int do_keep = args->keep_pack;
 	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
+	int fsck_objects;
 	int ret;
 
 	memset(&demux, 0, sizeof(demux));
@@ -705,6 +965,22 @@ static int get_pack(struct fetch_pack_args *args,
 	else
 		demux.out = xd[0];
 
+	if (use_packfile_uris)
+		read_packfile_uris(demux.out, &packfile_uris);
+	/*
+	 * Our pack may then refer to objects in the packs we have yet
+	 * to download, so it can be neither self-contained nor checked
+	 * for connectivity on its own; the caller checks connectivity
+	 * once everything is here.
+	 */
+	if (packfile_uris.nr)
+		args->check_self_contained_and_connected = 0;
+	fsck_objects = fetch_fsck_objects >= 0
+		? fetch_fsck_objects
+		: transfer_fsck_objects >= 0
+		? transfer_fsck_objects
+		: 0;
+
 	cmd.argv = argv;
 	av = argv;
 	*hdr_arg = 0;
@@ -716,7 +992,8 @@ static int get_pack(struct fetch_pack_args *args,
 		snprintf(hdr_arg, sizeof(hdr_arg),
 			 "--pack_header=%"PRIu32",%"PRIu32,
 			 ntohl(header.hdr_version), ntohl(header.hdr_entries));
-		if (ntohl(header.hdr_entries) < unpack_limit)
+		if (ntohl(header.hdr_entries) < unpack_limit &&
+		    !packfile_uris.nr)
 			do_keep = 0;
 		else
 			do_keep = 1;
@@ -754,12 +1031,8 @@ static int get_pack(struct fetch_pack_args *args,
 	}
 	if (*hdr_arg)
 		*av++ = hdr_arg;
-	if (fetch_fsck_objects >= 0
-	    ? fetch_fsck_objects
-	    : transfer_fsck_objects >= 0
-	    ? transfer_fsck_objects
-	    : 0)
-		*av++ = "--strict";
+	if (fsck_objects)
+		*av++ = packfile_uris.nr ? "--fsck-objects" : "--strict";
 	*av++ = NULL;
 
 	cmd.in = demux.out;
@@ -784,6 +1057,10 @@ static int get_pack(struct fetch_pack_args *args,
 		die("%s failed", cmd_name);
 	if (use_sideband && finish_async(&demux))
 		die("error in sideband demultiplexer");
+
+	if (packfile_uris.nr)
+		fetch_packfile_uris(&packfile_uris, fsck_objects);
+	string_list_clear(&packfile_uris, 0);
 	return 0;
 }
 
@@ -837,6 +1114,17 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 			fprintf(stderr, "Server supports side-band\n");
 		use_sideband = 1;
 	}
+	/*
+	 * Over smart HTTP the response goes through remote-curl, which
+	 * may look at it as pkt-lines; only use bulk frames on a
+	 * connection we read ourselves.
+	 */
+	if (use_sideband == 2 && !args->stateless_rpc &&
+	    server_supports("side-band-bulk")) {
+		if (args->verbose)
+			fprintf(stderr, "Server supports side-band-bulk\n");
+		use_sideband_bulk = 1;
+	}
 	if (server_supports("allow-tip-sha1-in-want")) {
 		if (args->verbose)
 			fprintf(stderr, "Server supports allow-tip-sha1-in-want\n");
@@ -847,6 +1135,14 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 			fprintf(stderr, "Server supports allow-reachable-sha1-in-want\n");
 		allow_unadvertised_object_request |= ALLOW_REACHABLE_SHA1;
 	}
+	use_packfile_uris = uri_protocols && *uri_protocols &&
+		server_supports("packfile-uris");
+	if (use_packfile_uris && args->verbose)
+		fprintf(stderr, "Server supports packfile-uris\n");
+	if (args->filter_options.choice && !server_supports("filter")) {
+		warning("filtering not recognized by server, ignoring");
+		args->filter_options.choice = LOFC_DISABLED;
+	}
 	if (!server_supports("thin-pack"))
 		args->use_thin_pack = 0;
 	if (!server_supports("no-progress"))
@@ -866,16 +1162,28 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 				agent_len, agent_feature);
 	}
 
+	if (args->negotiate_only) {
+		if (multi_ack != 2 || !server_supports("negotiate-only"))
+			die("server does not support negotiate-only");
+		filter_refs(args, &ref, sought, nr_sought);
+		trace_region_enter("fetch-pack", "negotiation");
+		find_common(args, fd, sha1, ref);
+		trace_region_leave("fetch-pack", "negotiation");
+		goto all_done;
+	}
+
 	if (everything_local(args, &ref, sought, nr_sought)) {
 		packet_flush(fd[1]);
 		goto all_done;
 	}
+	trace_region_enter("fetch-pack", "negotiation");
 	if (find_common(args, fd, sha1, ref) < 0)
-		if (!args->keep_pack)
+		if (!args->keep_pack && !args->no_dependents)
 			/* When cloning, it is not unusual to have
 			 * no common commit.
 			 */
 			warning("no common commits");
+	trace_region_leave("fetch-pack", "negotiation");
 
 	if (args->stateless_rpc)
 		packet_flush(fd[1]);
@@ -886,8 +1194,10 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 		alternate_shallow_file = setup_temporary_shallow(si->shallow);
 	else
 		alternate_shallow_file = NULL;
+	trace_region_enter("fetch-pack", "receive pack");
 	if (get_pack(args, fd, pack_lockfile))
 		die("git fetch-pack: fetch failed.");
+	trace_region_leave("fetch-pack", "receive pack");
 
  all_done:
 	return ref;
@@ -895,11 +1205,24 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 
 static void fetch_pack_config(void)
 {
+	const char *algorithm;
+
+	if (!git_config_get_string_const("fetch.negotiationalgorithm",
+					 &algorithm)) {
+		if (!strcmp(algorithm, "skipping"))
+			negotiation_algorithm = NEGOTIATION_SKIPPING;
+		else if (!strcmp(algorithm, "default"))
+			negotiation_algorithm = NEGOTIATION_DEFAULT;
+		else
+			die("invalid fetch.negotiationAlgorithm: %s", algorithm);
+	}
+
 	git_config_get_int("fetch.unpacklimit", &fetch_unpack_limit);
 	git_config_get_int("transfer.unpacklimit", &transfer_unpack_limit);
 	git_config_get_bool("repack.usedeltabaseoffset", &prefer_ofs_delta);
 	git_config_get_bool("fetch.fsckobjects", &fetch_fsck_objects);
 	git_config_get_bool("transfer.fsckobjects", &transfer_fsck_objects);
+	git_config_get_string_const("fetch.uriprotocols", &uri_protocols);
 
 	git_config(git_default_config, NULL);
 }
@@ -1049,6 +1372,9 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 
 	if (!ref) {
 		packet_flush(fd[1]);
+		/* an empty repository has nothing in common with us */
+		if (args->negotiate_only)
+			return NULL;
 		die("no matching remote head");
 	}
 	prepare_shallow_info(&si, shallow);
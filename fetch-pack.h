@@ -3,6 +3,7 @@
 
 #include "string-list.h"
 #include "run-command.h"
+#include "list-objects-filter.h"
 
 struct sha1_array;
 
@@ -25,6 +26,21 @@ struct fetch_pack_args {
 	unsigned self_contained_and_connected:1;
 	unsigned cloning:1;
 	unsigned update_shallow:1;
+	unsigned protocol_v2:1;
+	/*
+	 * Ask for the wanted objects alone, without telling the server
+	 * what we have: used to fetch objects missing from a partial
+	 * clone, which are reachable from our own refs.
+	 */
+	unsigned no_dependents:1;
+	/*
+	 * Only find out which of the commits behind negotiation_tips the
+	 * server has, putting them into "common"; nothing is fetched.
+	 */
+	unsigned negotiate_only:1;
+	struct sha1_array *negotiation_tips;
+	struct sha1_array *common;
+	struct list_objects_filter_options filter_options;
 };
 
 /*
@@ -0,0 +1,287 @@
+#include "cache.h"
+#include "dir.h"
+#include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "strbuf.h"
+
+#define INDEX_EXTENSION_VERSION	(1)
+#define HOOK_INTERFACE_VERSION	(1)
+
+static const char *fsmonitor_hook(void)
+{
+	static const char *hook;
+	static int initialized;
+
+	if (!initialized) {
+		if (git_config_get_pathname("core.fsmonitor", &hook) ||
+		    !*hook)
+			hook = NULL;
+		initialized = 1;
+	}
+	return hook;
+}
+
+static void fsmonitor_ewah_callback(size_t pos, void *is)
+{
+	struct index_state *istate = is;
+
+	if (pos < istate->cache_nr)
+		istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data, unsigned long sz)
+{
+	const char *index = data;
+	uint32_t hdr_version, ewah_size;
+	struct ewah_bitmap *dirty;
+	int ret;
+
+	if (sz < sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+		return error("corrupt fsmonitor extension (too short)");
+
+	hdr_version = get_be32(index);
+	index += sizeof(uint32_t);
+	if (hdr_version != INDEX_EXTENSION_VERSION)
+		return error("bad fsmonitor version %d", hdr_version);
+
+	istate->fsmonitor_last_update = ((uint64_t)get_be32(index) << 32) |
+					get_be32(index + 4);
+	index += sizeof(uint64_t);
+
+	ewah_size = get_be32(index);
+	index += sizeof(uint32_t);
+
+	dirty = ewah_new();
+	ret = ewah_read_mmap(dirty, index, ewah_size);
+	if (ret != ewah_size) {
+		ewah_free(dirty);
+		return error("failed to parse ewah bitmap reading fsmonitor index extension");
+	}
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = dirty;
+	return 0;
+}
+
+void fill_fsmonitor_bitmap(struct index_state *istate)
+{
+	int i;
+
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	if (!istate->fsmonitor_last_update)
+		return;
+
+	istate->fsmonitor_dirty = ewah_new();
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_FSMONITOR_VALID))
+			ewah_set(istate->fsmonitor_dirty, i);
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t hdr_version;
+	uint32_t tm[2];
+	uint32_t ewah_start;
+	uint32_t ewah_size = 0;
+	int fixup = 0;
+
+	hdr_version = htonl(INDEX_EXTENSION_VERSION);
+	strbuf_add(sb, &hdr_version, sizeof(uint32_t));
+
+	tm[0] = htonl((uint32_t)(istate->fsmonitor_last_update >> 32));
+	tm[1] = htonl((uint32_t)istate->fsmonitor_last_update);
+	strbuf_add(sb, tm, sizeof(tm));
+
+	/* reserve space for the size of the bitmap */
+	fixup = sb->len;
+	strbuf_add(sb, &ewah_size, sizeof(uint32_t));
+
+	ewah_start = sb->len;
+	ewah_serialize_strbuf(istate->fsmonitor_dirty, sb);
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+
+	ewah_size = htonl(sb->len - ewah_start);
+	memcpy(sb->buf + fixup, &ewah_size, sizeof(uint32_t));
+}
+
+/*
+ * Run the hook to get the NUL separated list of paths that changed
+ * since "last_update", in nanoseconds since the epoch.
+ */
+static int query_fsmonitor(const char *hook, uint64_t last_update,
+			   struct strbuf *query_result)
+{
+	struct child_process cp = CHILD_PROCESS_INIT;
+	char ver[64], date[64];
+	const char *argv[4];
+
+	snprintf(ver, sizeof(ver), "%d", HOOK_INTERFACE_VERSION);
+	snprintf(date, sizeof(date), "%" PRIuMAX, (uintmax_t)last_update);
+	argv[0] = hook;
+	argv[1] = ver;
+	argv[2] = date;
+	argv[3] = NULL;
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.dir = get_git_work_tree();
+
+	return capture_command(&cp, query_result, 1024);
+}
+
+static void fsmonitor_refresh_callback(struct index_state *istate,
+				       const char *name)
+{
+	struct strbuf dirname = STRBUF_INIT;
+	int len = strlen(name);
+	int pos;
+
+	/* the monitor may report a directory with a trailing slash */
+	if (len && name[len - 1] == '/')
+		len--;
+	if (!len)
+		return;
+
+	pos = index_name_pos(istate, name, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+		if (ce_namelen(ce) != len || strncmp(ce->name, name, len))
+			break;
+		mark_fsmonitor_invalid(istate, ce);
+	}
+
+	/* everything beneath a reported directory may have changed */
+	strbuf_add(&dirname, name, len);
+	strbuf_addch(&dirname, '/');
+	pos = index_name_pos(istate, dirname.buf, dirname.len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+		if (!starts_with(ce->name, dirname.buf))
+			break;
+		mark_fsmonitor_invalid(istate, ce);
+	}
+
+	strbuf_setlen(&dirname, len);
+	untracked_cache_invalidate_path(istate, dirname.buf);
+	strbuf_release(&dirname);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	const char *hook = fsmonitor_hook();
+	struct strbuf query_result = STRBUF_INIT;
+	int query_success = 0;
+	size_t bol, i;
+	uint64_t last_update;
+
+	if (!hook || !istate->fsmonitor_last_update ||
+	    istate->fsmonitor_has_run_once)
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	/*
+	 * Take the new timestamp before running the hook, so that what
+	 * changes while it runs is reported again the next time.
+	 */
+	last_update = getnanotime();
+	query_success = !query_fsmonitor(hook, istate->fsmonitor_last_update,
+					 &query_result);
+
+	if (query_success) {
+		bol = 0;
+		for (i = 0; i < query_result.len; i++) {
+			if (query_result.buf[i] != '\0')
+				continue;
+			fsmonitor_refresh_callback(istate, query_result.buf + bol);
+			bol = i + 1;
+		}
+		if (bol < query_result.len) {
+			strbuf_addch(&query_result, '\0');
+			fsmonitor_refresh_callback(istate, query_result.buf + bol);
+		}
+	} else {
+		/* the hook failed; trust nothing it reported before */
+		for (i = 0; i < istate->cache_nr; i++)
+			mark_fsmonitor_invalid(istate, istate->cache[i]);
+		if (istate->untracked && istate->untracked->root)
+			untracked_cache_invalidate_path(istate, "");
+	}
+	strbuf_release(&query_result);
+
+	if (istate->untracked)
+		istate->untracked->use_fsmonitor = query_success;
+
+	istate->fsmonitor_last_update = last_update;
+	istate->cache_changed |= FSMONITOR_CHANGED;
+}
+
+static void add_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	if (istate->fsmonitor_last_update)
+		return;
+
+	/* nothing is known to be clean until it is checked once */
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+	istate->fsmonitor_last_update = getnanotime();
+	istate->fsmonitor_has_run_once = 1;
+	istate->cache_changed |= FSMONITOR_CHANGED;
+}
+
+static void remove_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	if (!istate->fsmonitor_last_update)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+	if (istate->untracked)
+		istate->untracked->use_fsmonitor = 0;
+	istate->fsmonitor_last_update = 0;
+	istate->cache_changed |= FSMONITOR_CHANGED;
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	int i;
+
+	if (!fsmonitor_hook()) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+		remove_fsmonitor(istate);
+		return;
+	}
+
+	if (istate->fsmonitor_dirty) {
+		if (istate->fsmonitor_dirty->bit_size > istate->cache_nr) {
+			/* does not describe this index; start over */
+			istate->fsmonitor_last_update = 0;
+		} else {
+			for (i = 0; i < istate->cache_nr; i++)
+				istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+			ewah_each_bit(istate->fsmonitor_dirty,
+				      fsmonitor_ewah_callback, istate);
+		}
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+	add_fsmonitor(istate);
+}
+
+void discard_fsmonitor(struct index_state *istate)
+{
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_last_update = 0;
+	istate->fsmonitor_has_run_once = 0;
+}
@@ -0,0 +1,81 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+struct index_state;
+struct cache_entry;
+struct strbuf;
+
+/*
+ * A filesystem monitor is a hook, configured with "core.fsmonitor",
+ * that lists the paths which changed since a point in time.  The last
+ * such point is saved in the index (see the "FSMN" extension in
+ * Documentation/technical/index-format.txt), together with which
+ * entries were known to be clean then.  Entries the monitor does not
+ * report are marked CE_FSMONITOR_VALID and need not be lstat()ed; the
+ * untracked cache likewise trusts directories nothing changed in.
+ */
+
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data, unsigned long sz);
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate);
+
+/*
+ * Record which entries are not CE_FSMONITOR_VALID, to be written out
+ * by write_fsmonitor_extension().  Called before the index is split
+ * for writing, as the extension describes the whole index.
+ */
+void fill_fsmonitor_bitmap(struct index_state *istate);
+
+/*
+ * Apply the state read from the index once all of it is loaded, and
+ * start or stop tracking it as "core.fsmonitor" says.
+ */
+void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Ask the monitor what changed since the index last recorded, and
+ * invalidate the entries and untracked cache directories it lists.
+ * Only runs the hook once per index; callers cheaply call it before
+ * they would trust CE_FSMONITOR_VALID.
+ */
+void refresh_fsmonitor(struct index_state *istate);
+
+void discard_fsmonitor(struct index_state *istate);
+
+/*
+ * CE_FSMONITOR_VALID can only be believed once the monitor was asked
+ * what changed since the index recorded it.
+ */
+static inline int fsmonitor_trusts(const struct index_state *istate,
+				   const struct cache_entry *ce)
+{
+	return istate->fsmonitor_has_run_once &&
+		istate->fsmonitor_last_update &&
+		(ce->ce_flags & CE_FSMONITOR_VALID);
+}
+
+/*
+ * The entry matches the work tree, e.g. because it was just written
+ * out or refreshed; nothing needs to check it again until the monitor
+ * reports the path.
+ */
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (istate->fsmonitor_last_update &&
+	    !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+}
+
+static inline void mark_fsmonitor_invalid(struct index_state *istate,
+					  struct cache_entry *ce)
+{
+	if (ce->ce_flags & CE_FSMONITOR_VALID) {
+		ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->cache_changed |= FSMONITOR_CHANGED;
+	}
+}
+
+#endif
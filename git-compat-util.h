@@ -158,6 +158,9 @@
 #ifdef HAVE_STRINGS_H
 #include <strings.h> /* for strcasecmp() */
 #endif
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 #include <errno.h>
 #include <limits.h>
 #ifdef NEEDS_SYS_PARAM_H
@@ -48,6 +48,7 @@ do
 		fi
 		test -n "$GIT_REMOTE_TESTGIT_SIGNED_TAGS" && echo "signed-tags"
 		test -n "$GIT_REMOTE_TESTGIT_NO_PRIVATE_UPDATE" && echo "no-private-update"
+		test -n "$GIT_REMOTE_TESTGIT_PIPELINE" && echo "pipeline"
 		echo 'option'
 		echo
 		;;
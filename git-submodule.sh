@@ -9,7 +9,7 @@ USAGE="[--quiet] add [-b <branch>] [-f|--force] [--name <name>] [--reference <re
    or: $dashless [--quiet] status [--cached] [--recursive] [--] [<path>...]
    or: $dashless [--quiet] init [--] [<path>...]
    or: $dashless [--quiet] deinit [-f|--force] [--] <path>...
-   or: $dashless [--quiet] update [--init] [--remote] [-N|--no-fetch] [-f|--force] [--checkout|--merge|--rebase] [--reference <repository>] [--recursive] [--] [<path>...]
+   or: $dashless [--quiet] update [--init] [--remote] [-N|--no-fetch] [-f|--force] [--checkout|--merge|--rebase] [--reference <repository>] [--recursive] [--jobs <n>] [--] [<path>...]
    or: $dashless [--quiet] summary [--cached|--files] [--summary-limit <n>] [commit] [--] [<path>...]
    or: $dashless [--quiet] foreach [--recursive] <command>
    or: $dashless [--quiet] sync [--recursive] [--] [<path>...]"
@@ -36,6 +36,7 @@ update=
 prefix=
 custom_name=
 depth=
+jobs=
 
 # The function takes at most 2 arguments. The first argument is the
 # URL that navigates to the submodule origin repo. When relative, this URL
@@ -317,6 +318,42 @@ isnumber()
 	n=$(($1 + 0)) 2>/dev/null && test "$n" = "$1"
 }
 
+#
+# Update each submodule in a "git submodule update" of its own, with
+# up to $jobs of them cloning and fetching at the same time.
+#
+update_in_parallel()
+{
+	args=
+	test -n "$GIT_QUIET" && args="$args --quiet"
+	test -n "$remote" && args="$args --remote"
+	test -n "$nofetch" && args="$args --no-fetch"
+	test -n "$force" && args="$args --force"
+	test -n "$update" && args="$args --$update"
+	test -n "$reference" && args="$args $(git rev-parse --sq-quote "$reference")"
+	test -n "$depth" && args="$args $(git rev-parse --sq-quote "$depth")"
+	test -n "$recursive" && args="$args --recursive"
+
+	cmds=$(module_list "$@" |
+	while read mode sha1 stage sm_path
+	do
+		die_if_unmatched "$mode"
+		if test "$stage" = U
+		then
+			echo >&2 "Skipping unmerged submodule $prefix$sm_path"
+			continue
+		fi
+		name=$(module_name "$sm_path") || exit
+		# leave uninitialized ones alone unless asked for by name
+		if test "$#" = 0 && test -z "$(git config submodule."$name".url)"
+		then
+			continue
+		fi
+		echo "git submodule update --jobs=1$args -- $(git rev-parse --sq-quote "$sm_path")"
+	done) || exit
+	echo "$cmds" | git submodule--helper run-jobs --jobs="$jobs"
+}
+
 #
 # Add a new submodule to the working tree, .gitmodules and the index
 #
@@ -770,6 +807,14 @@ cmd_update()
 		--depth=*)
 			depth=$1
 			;;
+		-j|--jobs)
+			case "$2" in '') usage ;; esac
+			jobs=$2
+			shift
+			;;
+		--jobs=*)
+			jobs=${1#--jobs=}
+			;;
 		--)
 			shift
 			break
@@ -789,6 +834,16 @@ cmd_update()
 		cmd_init "--" "$@" || return
 	fi
 
+	if test -z "$jobs"
+	then
+		jobs=$(git config submodule.fetchJobs)
+	fi
+	if test -n "$jobs" && test "$jobs" != 1
+	then
+		update_in_parallel "$@"
+		return
+	fi
+
 	cloned_modules=
 	module_list "$@" | {
 	err=
@@ -315,24 +315,46 @@ struct cmd_struct {
 	int option;
 };
 
+static const char *builtin_name;
+static uint64_t builtin_start;
+
+/* also report builtins that exit() or die() instead of returning */
+static void trace_builtin_performance_atexit(void)
+{
+	trace_performance_since(builtin_start, "builtin: git %s", builtin_name);
+}
+
 static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 {
 	int status, help;
 	struct stat st;
 	const char *prefix;
+	uint64_t start;
 
 	prefix = NULL;
 	help = argc == 2 && !strcmp(argv[1], "-h");
 	if (!help) {
+		start = getnanotime();
 		if (p->option & RUN_SETUP)
 			prefix = setup_git_directory();
 		else if (p->option & RUN_SETUP_GENTLY) {
 			int nongit_ok;
 			prefix = setup_git_directory_gently(&nongit_ok);
 		}
+		if (p->option & (RUN_SETUP | RUN_SETUP_GENTLY))
+			trace_performance_since(start, "startup: repository setup");
 
-		if (use_pager == -1 && p->option & (RUN_SETUP | RUN_SETUP_GENTLY))
+		/*
+		 * Without a terminal there is no pager to configure, so do
+		 * not make commands that never look at the configuration
+		 * read it just for this.
+		 */
+		if (use_pager == -1 && p->option & (RUN_SETUP | RUN_SETUP_GENTLY) &&
+		    isatty(1)) {
+			start = getnanotime();
 			use_pager = check_pager_config(p->cmd);
+			trace_performance_since(start, "startup: pager config");
+		}
 		if (use_pager == -1 && p->option & USE_PAGER)
 			use_pager = 1;
 
@@ -347,6 +369,9 @@ static int run_builtin(struct cmd_struct *p, int argc, const char **argv)
 
 	trace_argv_printf(argv, "trace: built-in: git");
 
+	builtin_name = p->cmd;
+	builtin_start = getnanotime();
+	atexit(trace_builtin_performance_atexit);
 	status = p->fn(argc, argv, prefix);
 	if (status)
 		return status;
@@ -383,6 +408,7 @@ static struct cmd_struct commands[] = {
 	{ "check-mailmap", cmd_check_mailmap, RUN_SETUP },
 	{ "check-ref-format", cmd_check_ref_format },
 	{ "checkout", cmd_checkout, RUN_SETUP },
+	{ "checkout--worker", cmd_checkout__worker, RUN_SETUP | NEED_WORK_TREE },
 	{ "checkout-index", cmd_checkout_index,
 		RUN_SETUP | NEED_WORK_TREE},
 	{ "cherry", cmd_cherry, RUN_SETUP },
@@ -391,6 +417,7 @@ static struct cmd_struct commands[] = {
 	{ "clone", cmd_clone, NO_SETUP },
 	{ "column", cmd_column, RUN_SETUP_GENTLY },
 	{ "commit", cmd_commit, RUN_SETUP | NEED_WORK_TREE },
+	{ "commit-graph", cmd_commit_graph, RUN_SETUP },
 	{ "commit-tree", cmd_commit_tree, RUN_SETUP },
 	{ "config", cmd_config, RUN_SETUP_GENTLY },
 	{ "count-objects", cmd_count_objects, RUN_SETUP },
@@ -411,6 +438,7 @@ static struct cmd_struct commands[] = {
 	{ "gc", cmd_gc, RUN_SETUP },
 	{ "get-tar-commit-id", cmd_get_tar_commit_id },
 	{ "grep", cmd_grep, RUN_SETUP_GENTLY },
+	{ "grep-index", cmd_grep_index, RUN_SETUP },
 	{ "hash-object", cmd_hash_object },
 	{ "help", cmd_help },
 	{ "index-pack", cmd_index_pack, RUN_SETUP_GENTLY },
@@ -423,6 +451,7 @@ static struct cmd_struct commands[] = {
 	{ "ls-tree", cmd_ls_tree, RUN_SETUP },
 	{ "mailinfo", cmd_mailinfo },
 	{ "mailsplit", cmd_mailsplit },
+	{ "maintenance", cmd_maintenance, RUN_SETUP },
 	{ "merge", cmd_merge, RUN_SETUP | NEED_WORK_TREE },
 	{ "merge-base", cmd_merge_base, RUN_SETUP },
 	{ "merge-file", cmd_merge_file, RUN_SETUP_GENTLY },
@@ -435,6 +464,7 @@ static struct cmd_struct commands[] = {
 	{ "merge-tree", cmd_merge_tree, RUN_SETUP },
 	{ "mktag", cmd_mktag, RUN_SETUP },
 	{ "mktree", cmd_mktree, RUN_SETUP },
+	{ "multi-pack-index", cmd_multi_pack_index, RUN_SETUP_GENTLY },
 	{ "mv", cmd_mv, RUN_SETUP | NEED_WORK_TREE },
 	{ "name-rev", cmd_name_rev, RUN_SETUP },
 	{ "notes", cmd_notes, RUN_SETUP },
@@ -468,6 +498,7 @@ static struct cmd_struct commands[] = {
 	{ "stage", cmd_add, RUN_SETUP | NEED_WORK_TREE },
 	{ "status", cmd_status, RUN_SETUP | NEED_WORK_TREE },
 	{ "stripspace", cmd_stripspace },
+	{ "submodule--helper", cmd_submodule__helper },
 	{ "symbolic-ref", cmd_symbolic_ref, RUN_SETUP },
 	{ "tag", cmd_tag, RUN_SETUP },
 	{ "unpack-file", cmd_unpack_file, RUN_SETUP },
@@ -539,7 +570,7 @@ static void execv_dashed_external(const char **argv)
 	const char *tmp;
 	int status;
 
-	if (use_pager == -1)
+	if (use_pager == -1 && isatty(1))
 		use_pager = check_pager_config(argv[0]);
 	commit_pager_choice();
 
@@ -640,6 +671,10 @@ int main(int argc, char **av)
 	git_setup_gettext();
 
 	trace_command_performance(argv);
+	trace_event_command(argv);
+	if (trace_event_want())
+		atexit(trace_object_access_stats);
+	trace_memory_setup();
 
 	/*
 	 * "git-xxxx" is the same as "git xxxx", but we obviously:
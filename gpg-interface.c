@@ -3,9 +3,11 @@
 #include "strbuf.h"
 #include "gpg-interface.h"
 #include "sigchain.h"
+#include "append-cache.h"
 
 static char *configured_signing_key;
 static const char *gpg_program = "gpg";
+static int gpg_verify_cache;
 
 #define PGP_SIGNATURE "-----BEGIN PGP SIGNATURE-----"
 #define PGP_MESSAGE "-----BEGIN PGP MESSAGE-----"
@@ -94,6 +96,8 @@ int git_gpg_config(const char *var, const char *value, void *cb)
 			return config_error_nonbool(var);
 		gpg_program = xstrdup(value);
 	}
+	if (!strcmp(var, "gpg.verifycache"))
+		gpg_verify_cache = git_config_bool(var, value);
 	return 0;
 }
 
@@ -163,14 +167,112 @@ int sign_buffer(struct strbuf *buffer, struct strbuf *signature, const char *sig
 	return 0;
 }
 
+/*
+ * With gpg.verifyCache, what "gpg --verify" said about a payload and
+ * its signature is remembered in $GIT_DIR/gpg-verify-cache, so that
+ * the signatures of the same commits and tags are not checked by a
+ * new gpg process each time they are shown.  The key is the SHA-1 of
+ * the payload and the signature, together with the program used and
+ * the size and mtime of the keyring and trust database: importing or
+ * revoking keys or changing their trust gives all signatures new keys.
+ *
+ * The value is the exit code and the length of the output, a newline,
+ * and the output followed by the status.
+ */
+static struct append_cache gpg_verify_results;
+
+static void prepare_gpg_verify_cache(void)
+{
+	static int prepared;
+
+	if (prepared)
+		return;
+	prepared = 1;
+	append_cache_init(&gpg_verify_results, git_path("gpg-verify-cache"),
+			  "gpg-verify cache version 1");
+}
+
+static int gpg_verify_cache_lookup(const char *key, int *ret,
+				   struct strbuf *output, struct strbuf *status)
+{
+	const char *value = append_cache_get(&gpg_verify_results, key);
+	unsigned long outlen;
+	char *p;
+
+	if (!value)
+		return -1;
+	*ret = strtol(value, &p, 10);
+	if (*p != ' ')
+		return -1;
+	outlen = strtoul(p + 1, &p, 10);
+	if (*p++ != '\n' || outlen > strlen(p))
+		return -1;
+	strbuf_add(output, p, outlen);
+	strbuf_addstr(status, p + outlen);
+	return 0;
+}
+
+static void add_keyring_stamp(git_SHA_CTX *ctx, const char *dir,
+			      const char *name)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct stat st;
+
+	strbuf_addf(&buf, "%s/%s", dir, name);
+	if (!stat(buf.buf, &st))
+		strbuf_addf(&buf, " %"PRIuMAX" %"PRIuMAX".%u",
+			    (uintmax_t)st.st_size, (uintmax_t)st.st_mtime,
+			    ST_MTIME_NSEC(st));
+	git_SHA1_Update(ctx, buf.buf, buf.len + 1);
+	strbuf_release(&buf);
+}
+
+static void gpg_verify_key(unsigned char *key,
+			   const char *payload, size_t payload_size,
+			   const char *signature, size_t signature_size)
+{
+	const char *home = getenv("GNUPGHOME");
+	struct strbuf dir = STRBUF_INIT;
+	git_SHA_CTX ctx;
+
+	if (home)
+		strbuf_addstr(&dir, home);
+	else if ((home = getenv("HOME")))
+		strbuf_addf(&dir, "%s/.gnupg", home);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, gpg_program, strlen(gpg_program) + 1);
+	add_keyring_stamp(&ctx, dir.buf, "pubring.gpg");
+	add_keyring_stamp(&ctx, dir.buf, "pubring.kbx");
+	add_keyring_stamp(&ctx, dir.buf, "trustdb.gpg");
+	git_SHA1_Update(&ctx, &payload_size, sizeof(payload_size));
+	git_SHA1_Update(&ctx, payload, payload_size);
+	git_SHA1_Update(&ctx, signature, signature_size);
+	git_SHA1_Final(key, &ctx);
+	strbuf_release(&dir);
+}
+
+static void gpg_verify_cache_store(const char *key, int ret,
+				   const struct strbuf *output,
+				   const struct strbuf *status)
+{
+	struct strbuf value = STRBUF_INIT;
+
+	strbuf_addf(&value, "%d %"PRIuMAX"\n", ret, (uintmax_t)output->len);
+	strbuf_addbuf(&value, output);
+	strbuf_addbuf(&value, status);
+	append_cache_put(&gpg_verify_results, key, value.buf);
+	strbuf_release(&value);
+}
+
 /*
  * Run "gpg" to see if the payload matches the detached signature.
  * gpg_output, when set, receives the diagnostic output from GPG.
  * gpg_status, when set, receives the status output from GPG.
  */
-int verify_signed_buffer(const char *payload, size_t payload_size,
-			 const char *signature, size_t signature_size,
-			 struct strbuf *gpg_output, struct strbuf *gpg_status)
+static int run_gpg_verify(const char *payload, size_t payload_size,
+			  const char *signature, size_t signature_size,
+			  struct strbuf *gpg_output, struct strbuf *gpg_status)
 {
 	struct child_process gpg = CHILD_PROCESS_INIT;
 	const char *args_gpg[] = {NULL, "--status-fd=1", "--verify", "FILE", "-", NULL};
@@ -221,3 +323,39 @@ int verify_signed_buffer(const char *payload, size_t payload_size,
 
 	return ret;
 }
+
+int verify_signed_buffer(const char *payload, size_t payload_size,
+			 const char *signature, size_t signature_size,
+			 struct strbuf *gpg_output, struct strbuf *gpg_status)
+{
+	struct strbuf output = STRBUF_INIT, status = STRBUF_INIT;
+	unsigned char key[20];
+	char hex[41];
+	int ret;
+
+	if (!gpg_verify_cache ||
+	    !startup_info || !startup_info->have_repository)
+		return run_gpg_verify(payload, payload_size,
+				      signature, signature_size,
+				      gpg_output, gpg_status);
+
+	prepare_gpg_verify_cache();
+	gpg_verify_key(key, payload, payload_size,
+		       signature, signature_size);
+	memcpy(hex, sha1_to_hex(key), sizeof(hex));
+	if (gpg_verify_cache_lookup(hex, &ret, &output, &status)) {
+		ret = run_gpg_verify(payload, payload_size,
+				     signature, signature_size,
+				     &output, &status);
+		/* a failure to run gpg at all is not worth remembering */
+		if (ret >= 0 && status.len)
+			gpg_verify_cache_store(hex, ret, &output, &status);
+	}
+	if (gpg_output)
+		strbuf_addbuf(gpg_output, &output);
+	if (gpg_status)
+		strbuf_addbuf(gpg_status, &status);
+	strbuf_release(&output);
+	strbuf_release(&status);
+	return ret;
+}
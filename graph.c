@@ -4,6 +4,7 @@
 #include "graph.h"
 #include "diff.h"
 #include "revision.h"
+#include "commit-slab.h"
 
 /* Internal API */
 
@@ -83,6 +84,14 @@ static void strbuf_write_column(struct strbuf *sb, const struct column *c,
 		strbuf_addstr(sb, column_get_color_code(column_colors_max));
 }
 
+/*
+ * Where each commit was last put in new_columns.  The entry is only
+ * believed if that column still holds the commit, so it never has to
+ * be cleared; as new_columns becomes columns for the next commit, it
+ * also finds the commits in columns.
+ */
+define_commit_slab(graph_column_slab, int);
+
 struct git_graph {
 	/*
 	 * The commit currently being processed
@@ -98,6 +107,12 @@ struct git_graph {
 	 * output, as determined by graph_is_interesting().
 	 */
 	int num_parents;
+	/*
+	 * The interesting parents themselves, in order, so that each
+	 * is only checked once per commit.
+	 */
+	struct commit **parents;
+	int parents_alloc;
 	/*
 	 * The width of the graph output for this commit.
 	 * All rows for this commit are padded to this width, so that
@@ -187,6 +202,16 @@ struct git_graph {
 	 * stored as an index into the array column_colors.
 	 */
 	unsigned short default_column_color;
+	/*
+	 * The column of each commit in new_columns (and columns); see
+	 * graph_column_slab above.
+	 */
+	struct graph_column_slab column_of;
+	/*
+	 * The buffer the graph_show_*() functions build their lines in,
+	 * kept so that it does not have to be allocated for every line.
+	 */
+	struct strbuf line;
 };
 
 static struct strbuf *diff_output_prefix_callback(struct diff_options *opt, void *data)
@@ -214,6 +239,10 @@ struct git_graph *graph_init(struct rev_info *opt)
 	graph->commit = NULL;
 	graph->revs = opt;
 	graph->num_parents = 0;
+	graph->parents = NULL;
+	graph->parents_alloc = 0;
+	init_graph_column_slab(&graph->column_of);
+	strbuf_init(&graph->line, 0);
 	graph->expansion_row = 0;
 	graph->state = GRAPH_PADDING;
 	graph->prev_state = GRAPH_PADDING;
@@ -358,14 +387,14 @@ static void graph_increment_column_color(struct git_graph *graph)
 		column_colors_max;
 }
 
-static unsigned short graph_find_commit_color(const struct git_graph *graph,
-					      const struct commit *commit)
+static unsigned short graph_find_commit_color(struct git_graph *graph,
+					      struct commit *commit)
 {
-	int i;
-	for (i = 0; i < graph->num_columns; i++) {
-		if (graph->columns[i].commit == commit)
-			return graph->columns[i].color;
-	}
+	int i = *graph_column_slab_at(&graph->column_of, commit);
+
+	/* not in new_columns yet, so the slab still points into columns */
+	if (i < graph->num_columns && graph->columns[i].commit == commit)
+		return graph->columns[i].color;
 	return graph_get_current_column_color(graph);
 }
 
@@ -373,18 +402,17 @@ static void graph_insert_into_new_columns(struct git_graph *graph,
 					  struct commit *commit,
 					  int *mapping_index)
 {
-	int i;
+	int *column = graph_column_slab_at(&graph->column_of, commit);
 
 	/*
 	 * If the commit is already in the new_columns list, we don't need to
 	 * add it.  Just update the mapping correctly.
 	 */
-	for (i = 0; i < graph->num_new_columns; i++) {
-		if (graph->new_columns[i].commit == commit) {
-			graph->mapping[*mapping_index] = i;
-			*mapping_index += 2;
-			return;
-		}
+	if (*column < graph->num_new_columns &&
+	    graph->new_columns[*column].commit == commit) {
+		graph->mapping[*mapping_index] = *column;
+		*mapping_index += 2;
+		return;
 	}
 
 	/*
@@ -392,6 +420,7 @@ static void graph_insert_into_new_columns(struct git_graph *graph,
 	 */
 	graph->new_columns[graph->num_new_columns].commit = commit;
 	graph->new_columns[graph->num_new_columns].color = graph_find_commit_color(graph, commit);
+	*column = graph->num_new_columns;
 	graph->mapping[*mapping_index] = graph->num_new_columns;
 	*mapping_index += 2;
 	graph->num_new_columns++;
@@ -434,7 +463,6 @@ static void graph_update_width(struct git_graph *graph,
 
 static void graph_update_columns(struct git_graph *graph)
 {
-	struct commit_list *parent;
 	struct column *tmp_columns;
 	int max_new_columns;
 	int mapping_idx;
@@ -498,11 +526,10 @@ static void graph_update_columns(struct git_graph *graph)
 
 		if (col_commit == graph->commit) {
 			int old_mapping_idx = mapping_idx;
+			int j;
 			seen_this = 1;
 			graph->commit_index = i;
-			for (parent = first_interesting_parent(graph);
-			     parent;
-			     parent = next_interesting_parent(graph, parent)) {
+			for (j = 0; j < graph->num_parents; j++) {
 				/*
 				 * If this is a merge, or the start of a new
 				 * childless column, increment the current
@@ -513,7 +540,7 @@ static void graph_update_columns(struct git_graph *graph)
 					graph_increment_column_color(graph);
 				}
 				graph_insert_into_new_columns(graph,
-							      parent->item,
+							      graph->parents[j],
 							      &mapping_idx);
 			}
 			/*
@@ -553,14 +580,16 @@ void graph_update(struct git_graph *graph, struct commit *commit)
 	graph->commit = commit;
 
 	/*
-	 * Count how many interesting parents this commit has
+	 * Collect the interesting parents of this commit
 	 */
 	graph->num_parents = 0;
 	for (parent = first_interesting_parent(graph);
 	     parent;
 	     parent = next_interesting_parent(graph, parent))
 	{
-		graph->num_parents++;
+		ALLOC_GROW(graph->parents, graph->num_parents + 1,
+			   graph->parents_alloc);
+		graph->parents[graph->num_parents++] = parent->item;
 	}
 
 	/*
@@ -883,11 +912,11 @@ static void graph_output_commit_line(struct git_graph *graph, struct strbuf *sb)
 static struct column *find_new_column_by_commit(struct git_graph *graph,
 						struct commit *commit)
 {
-	int i;
-	for (i = 0; i < graph->num_new_columns; i++) {
-		if (graph->new_columns[i].commit == commit)
-			return &graph->new_columns[i];
-	}
+	int i = *graph_column_slab_at(&graph->column_of, commit);
+
+	if (i < graph->num_new_columns &&
+	    graph->new_columns[i].commit == commit)
+		return &graph->new_columns[i];
 	return NULL;
 }
 
@@ -918,20 +947,16 @@ static void graph_output_post_merge_line(struct git_graph *graph, struct strbuf
 			 * new_columns and use those to format the
 			 * edges.
 			 */
-			struct commit_list *parents = NULL;
 			struct column *par_column;
 			seen_this = 1;
-			parents = first_interesting_parent(graph);
-			assert(parents);
-			par_column = find_new_column_by_commit(graph, parents->item);
+			assert(graph->num_parents);
+			par_column = find_new_column_by_commit(graph, graph->parents[0]);
 			assert(par_column);
 
 			strbuf_write_column(sb, par_column, '|');
 			chars_written++;
 			for (j = 0; j < graph->num_parents - 1; j++) {
-				parents = next_interesting_parent(graph, parents);
-				assert(parents);
-				par_column = find_new_column_by_commit(graph, parents->item);
+				par_column = find_new_column_by_commit(graph, graph->parents[j + 1]);
 				assert(par_column);
 				strbuf_write_column(sb, par_column, '\\');
 				strbuf_addch(sb, ' ');
@@ -1177,7 +1202,7 @@ int graph_is_commit_finished(struct git_graph const *graph)
 
 void graph_show_commit(struct git_graph *graph)
 {
-	struct strbuf msgbuf = STRBUF_INIT;
+	struct strbuf *msgbuf;
 	int shown_commit_line = 0;
 
 	if (!graph)
@@ -1193,44 +1218,38 @@ void graph_show_commit(struct git_graph *graph)
 		shown_commit_line = 1;
 	}
 
+	msgbuf = &graph->line;
 	while (!shown_commit_line && !graph_is_commit_finished(graph)) {
-		shown_commit_line = graph_next_line(graph, &msgbuf);
-		fwrite(msgbuf.buf, sizeof(char), msgbuf.len, stdout);
+		strbuf_reset(msgbuf);
+		shown_commit_line = graph_next_line(graph, msgbuf);
+		fwrite(msgbuf->buf, sizeof(char), msgbuf->len, stdout);
 		if (!shown_commit_line)
 			putchar('\n');
-		strbuf_setlen(&msgbuf, 0);
 	}
-
-	strbuf_release(&msgbuf);
 }
 
 void graph_show_oneline(struct git_graph *graph)
 {
-	struct strbuf msgbuf = STRBUF_INIT;
-
 	if (!graph)
 		return;
 
-	graph_next_line(graph, &msgbuf);
-	fwrite(msgbuf.buf, sizeof(char), msgbuf.len, stdout);
-	strbuf_release(&msgbuf);
+	strbuf_reset(&graph->line);
+	graph_next_line(graph, &graph->line);
+	fwrite(graph->line.buf, sizeof(char), graph->line.len, stdout);
 }
 
 void graph_show_padding(struct git_graph *graph)
 {
-	struct strbuf msgbuf = STRBUF_INIT;
-
 	if (!graph)
 		return;
 
-	graph_padding_line(graph, &msgbuf);
-	fwrite(msgbuf.buf, sizeof(char), msgbuf.len, stdout);
-	strbuf_release(&msgbuf);
+	strbuf_reset(&graph->line);
+	graph_padding_line(graph, &graph->line);
+	fwrite(graph->line.buf, sizeof(char), graph->line.len, stdout);
 }
 
 int graph_show_remainder(struct git_graph *graph)
 {
-	struct strbuf msgbuf = STRBUF_INIT;
 	int shown = 0;
 
 	if (!graph)
@@ -1240,9 +1259,9 @@ int graph_show_remainder(struct git_graph *graph)
 		return 0;
 
 	for (;;) {
-		graph_next_line(graph, &msgbuf);
-		fwrite(msgbuf.buf, sizeof(char), msgbuf.len, stdout);
-		strbuf_setlen(&msgbuf, 0);
+		strbuf_reset(&graph->line);
+		graph_next_line(graph, &graph->line);
+		fwrite(graph->line.buf, sizeof(char), graph->line.len, stdout);
 		shown = 1;
 
 		if (!graph_is_commit_finished(graph))
@@ -1250,7 +1269,6 @@ int graph_show_remainder(struct git_graph *graph)
 		else
 			break;
 	}
-	strbuf_release(&msgbuf);
 
 	return shown;
 }
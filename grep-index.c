@@ -0,0 +1,597 @@
+#include "cache.h"
+#include "grep-index.h"
+#include "grep.h"
+#include "lockfile.h"
+#include "csum-file.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "refs.h"
+#include "sha1-lookup.h"
+#include "string-list.h"
+
+static const struct bloom_filter_settings default_settings =
+	DEFAULT_BLOOM_FILTER_SETTINGS;
+
+char *get_grep_index_filename(const char *object_dir)
+{
+	return xstrfmt("%s/info/grep-index", object_dir);
+}
+
+struct grep_index *load_grep_index(const char *object_dir)
+{
+	struct grep_index *gi = NULL;
+	const unsigned char *data;
+	uint32_t num_blobs, filters_len;
+	uint64_t base_len;
+	char *name = get_grep_index_filename(object_dir);
+	size_t data_len;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = git_open_noatime(name);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	data_len = xsize_t(st.st_size);
+	if (data_len < GREP_INDEX_HEADER_SIZE + 256 * 4 + 20) {
+		close(fd);
+		error("grep index %s is too small", name);
+		goto out;
+	}
+	map = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != GREP_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != GREP_INDEX_VERSION) {
+		error("grep index %s has a bad header", name);
+		munmap(map, data_len);
+		goto out;
+	}
+	num_blobs = get_be32(data + 8);
+	base_len = GREP_INDEX_HEADER_SIZE + 256 * 4 + (uint64_t)num_blobs * 24;
+	if (data_len < base_len + 20) {
+		error("grep index %s is truncated or corrupt", name);
+		munmap(map, data_len);
+		goto out;
+	}
+	filters_len = num_blobs ? get_be32(data + base_len - 4) : 0;
+	if (data_len != base_len + filters_len + 20) {
+		error("grep index %s is truncated or corrupt", name);
+		munmap(map, data_len);
+		goto out;
+	}
+
+	gi = xcalloc(1, sizeof(*gi));
+	gi->data = data;
+	gi->data_len = data_len;
+	gi->num_blobs = num_blobs;
+	gi->settings.num_hashes = get_be32(data + 12);
+	gi->settings.bits_per_entry = get_be32(data + 16);
+	gi->fanout = (const uint32_t *)(data + GREP_INDEX_HEADER_SIZE);
+	gi->oids = data + GREP_INDEX_HEADER_SIZE + 256 * 4;
+	gi->ends = gi->oids + (size_t)num_blobs * 20;
+	gi->filters = gi->ends + (size_t)num_blobs * 4;
+out:
+	free(name);
+	return gi;
+}
+
+void free_grep_index(struct grep_index *gi)
+{
+	if (!gi)
+		return;
+	munmap((void *)gi->data, gi->data_len);
+	free(gi);
+}
+
+static int find_blob(const struct grep_index *gi, const unsigned char *sha1,
+		     uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(gi->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(gi->fanout[sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, gi->oids + (size_t)mi * 20);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static void get_filter(const struct grep_index *gi, uint32_t pos,
+		       struct bloom_filter *filter)
+{
+	uint32_t start = pos ? get_be32(gi->ends + 4 * (pos - 1)) : 0;
+	uint32_t end = get_be32(gi->ends + 4 * pos);
+
+	filter->data = (unsigned char *)gi->filters + start;
+	filter->len = end - start;
+}
+
+int grep_index_may_match(const struct grep_index *gi,
+			 const struct grep_index_query *query,
+			 const unsigned char *sha1)
+{
+	struct bloom_filter filter;
+	uint32_t pos;
+	int i;
+
+	if (!find_blob(gi, sha1, &pos))
+		return 1;
+	get_filter(gi, pos, &filter);
+	for (i = 0; i < query->nr; i++)
+		if (!bloom_filter_contains(&filter, &query->keys[i],
+					   &gi->settings))
+			return 0;
+	return 1;
+}
+
+/*
+ * Finding literals in a pattern.
+ *
+ * We collect the runs of literal characters outside of any group, as
+ * long as there is no alternation outside of a group: every match has
+ * to contain each of them.  Anything we do not understand makes us
+ * give up on the whole pattern, or at least end the current run;
+ * finding too little only costs us some pruning, but finding too much
+ * would make "git grep" miss matches.
+ */
+enum literal_syntax {
+	LITERAL_FIXED,
+	LITERAL_BRE,
+	LITERAL_ERE,
+	LITERAL_PCRE
+};
+
+static void end_run(struct strbuf *run, struct string_list *literals)
+{
+	if (run->len >= 3)
+		string_list_append(literals, run->buf);
+	strbuf_reset(run);
+}
+
+/* A quantifier applies to the whole of a multi-byte character. */
+static void drop_last_char(struct strbuf *run)
+{
+	while (run->len && (run->buf[run->len - 1] & 0xc0) == 0x80)
+		strbuf_setlen(run, run->len - 1);
+	if (run->len)
+		strbuf_setlen(run, run->len - 1);
+}
+
+/* Skip a bracket expression; "p" points after the '['. */
+static const char *skip_class(const char *p, const char *end,
+			      enum literal_syntax syntax)
+{
+	if (p < end && *p == '^')
+		p++;
+	if (p < end && *p == ']')
+		p++;
+	while (p < end) {
+		if (*p == ']')
+			return p + 1;
+		if (*p == '[' && p + 1 < end && strchr(":.=", p[1])) {
+			char delim = p[1];
+			p += 2;
+			while (p + 1 < end && !(p[0] == delim && p[1] == ']'))
+				p++;
+			if (p + 1 >= end)
+				return NULL;
+			p += 2;
+			continue;
+		}
+		if (*p == '\\' && syntax == LITERAL_PCRE)
+			p++;
+		p++;
+	}
+	return NULL;
+}
+
+static int extract_literals(const char *p, size_t len,
+			    enum literal_syntax syntax,
+			    struct string_list *literals)
+{
+	struct strbuf run = STRBUF_INIT;
+	const char *end = p + len;
+	int depth = 0;
+
+	if (syntax == LITERAL_FIXED) {
+		strbuf_add(&run, p, len);
+		end_run(&run, literals);
+		strbuf_release(&run);
+		return 0;
+	}
+
+	while (p < end) {
+		char c = *p++;
+		int op = 0;
+
+		if (c == '\\') {
+			if (p == end)
+				goto give_up;
+			c = *p++;
+			if (isalnum(c)) {
+				/* back-references and classes like \w */
+				if ((isdigit(c) && c != '0') ||
+				    strchr("dDwWsSbBAzZ", c)) {
+					end_run(&run, literals);
+					continue;
+				}
+				goto give_up;
+			}
+			if (syntax == LITERAL_BRE && strchr("(){}|?+", c))
+				op = c;
+			else if (syntax != LITERAL_PCRE && strchr("<>`'", c))
+				op = '^';
+		} else if (syntax == LITERAL_BRE) {
+			if (strchr(".[*^$", c))
+				op = c;
+		} else if (strchr(".[*+?{()|^$", c)) {
+			op = c;
+		}
+
+		if (!op) {
+			if (!depth)
+				strbuf_addch(&run, c);
+			continue;
+		}
+
+		switch (op) {
+		case '*':
+		case '+':
+		case '?':
+			drop_last_char(&run);
+			end_run(&run, literals);
+			break;
+		case '{':
+			drop_last_char(&run);
+			end_run(&run, literals);
+			while (p < end && *p != '}')
+				p++;
+			if (p == end)
+				goto give_up;
+			p++;
+			break;
+		case '[':
+			end_run(&run, literals);
+			p = skip_class(p, end, syntax);
+			if (!p)
+				goto give_up;
+			break;
+		case '(':
+			/* inline options could change how the rest is read */
+			if (syntax != LITERAL_BRE && p < end && *p == '?')
+				goto give_up;
+			end_run(&run, literals);
+			depth++;
+			break;
+		case ')':
+			end_run(&run, literals);
+			if (depth)
+				depth--;
+			break;
+		case '|':
+			if (!depth)
+				goto give_up;
+			end_run(&run, literals);
+			break;
+		default:
+			end_run(&run, literals);
+			break;
+		}
+	}
+	end_run(&run, literals);
+	strbuf_release(&run);
+	return 0;
+
+give_up:
+	strbuf_release(&run);
+	string_list_clear(literals, 0);
+	return -1;
+}
+
+static inline unsigned char fold(unsigned char c)
+{
+	return tolower(c);
+}
+
+static void add_query_key(struct grep_index_query *query,
+			  const unsigned char *trigram,
+			  const struct bloom_filter_settings *settings)
+{
+	char folded[3];
+	int i;
+
+	for (i = 0; i < 3; i++)
+		folded[i] = fold(trigram[i]);
+	ALLOC_GROW(query->keys, query->nr + 1, query->alloc);
+	fill_bloom_key(folded, 3, &query->keys[query->nr++], settings);
+}
+
+int prepare_grep_index_query(struct grep_index_query *query,
+			     const struct grep_opt *opt,
+			     const struct grep_index *gi)
+{
+	struct string_list literals = STRING_LIST_INIT_DUP;
+	const struct grep_pat *p = opt->pattern_list;
+	enum literal_syntax syntax;
+	int i;
+
+	memset(query, 0, sizeof(*query));
+	if (!gi || !p || p->next || p->token != GREP_PATTERN)
+		return -1;
+	/* without a match, a file can still be shown or converted */
+	if (opt->invert || opt->unmatch_name_only || opt->allow_textconv)
+		return -1;
+
+	if (p->fixed)
+		syntax = LITERAL_FIXED;
+	else if (opt->pcre)
+		syntax = LITERAL_PCRE;
+	else if (opt->regflags & REG_EXTENDED)
+		syntax = LITERAL_ERE;
+	else
+		syntax = LITERAL_BRE;
+	if (extract_literals(p->pattern, p->patternlen, syntax, &literals))
+		return -1;
+
+	for (i = 0; i < literals.nr; i++) {
+		const unsigned char *lit =
+			(const unsigned char *)literals.items[i].string;
+		size_t j, len = strlen(literals.items[i].string);
+
+		/* we only fold ASCII */
+		if (opt->ignore_case) {
+			for (j = 0; j < len; j++)
+				if (lit[j] & 0x80)
+					break;
+			if (j < len)
+				continue;
+		}
+		for (j = 0; j + 3 <= len; j++)
+			add_query_key(query, lit + j, &gi->settings);
+	}
+	string_list_clear(&literals, 0);
+
+	if (!query->nr)
+		return -1;
+	return 0;
+}
+
+void clear_grep_index_query(struct grep_index_query *query)
+{
+	int i;
+
+	for (i = 0; i < query->nr; i++)
+		clear_bloom_key(&query->keys[i]);
+	free(query->keys);
+	memset(query, 0, sizeof(*query));
+}
+
+/*
+ * Writing.
+ */
+struct blob_list {
+	unsigned char (*sha1)[20];
+	uint32_t nr, alloc;
+};
+
+static void add_blob(struct blob_list *blobs, const unsigned char *sha1)
+{
+	ALLOC_GROW(blobs->sha1, blobs->nr + 1, blobs->alloc);
+	hashcpy(blobs->sha1[blobs->nr++], sha1);
+}
+
+static void show_commit(struct commit *commit, void *data)
+{
+}
+
+static void show_object(struct object *obj, const struct name_path *path,
+			const char *last, void *data)
+{
+	if (obj->type == OBJ_BLOB)
+		add_blob(data, obj->sha1);
+}
+
+static int add_ref_to_pending(const char *refname, const struct object_id *oid,
+			      int flags, void *cb_data)
+{
+	struct object *obj = parse_object(oid->hash);
+
+	if (obj)
+		add_pending_object(cb_data, obj, "");
+	return 0;
+}
+
+static int sha1_cmp(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static void collect_blobs(struct blob_list *blobs)
+{
+	struct rev_info revs;
+	uint32_t i, j;
+	int nr;
+
+	init_revisions(&revs, NULL);
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+	head_ref(add_ref_to_pending, &revs);
+	for_each_ref(add_ref_to_pending, &revs);
+	if (prepare_revision_walk(&revs))
+		die("revision walk setup failed");
+	traverse_commit_list(&revs, show_commit, show_object, blobs);
+	reset_revision_walk();
+
+	if (read_cache() > 0) {
+		for (nr = 0; nr < active_nr; nr++)
+			if (S_ISREG(active_cache[nr]->ce_mode))
+				add_blob(blobs, active_cache[nr]->sha1);
+	}
+
+	qsort(blobs->sha1, blobs->nr, 20, sha1_cmp);
+	for (i = j = 0; i < blobs->nr; i++) {
+		if (j && !hashcmp(blobs->sha1[j - 1], blobs->sha1[i]))
+			continue;
+		hashcpy(blobs->sha1[j++], blobs->sha1[i]);
+	}
+	blobs->nr = j;
+}
+
+/* one bit for each of the 2^24 trigrams, to count each only once */
+static unsigned char *seen_trigrams;
+
+static void compute_filter(const unsigned char *sha1, struct strbuf *out)
+{
+	static uint32_t *trigrams;
+	static size_t trigrams_alloc;
+	size_t nr = 0, i, filter_len;
+	enum object_type type;
+	unsigned long size;
+	struct bloom_filter filter;
+	unsigned char *buf;
+
+	if (sha1_object_info(sha1, &size) != OBJ_BLOB)
+		die("%s is not a blob", sha1_to_hex(sha1));
+	if (size > big_file_threshold)
+		goto saturate;
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		die("unable to read blob %s", sha1_to_hex(sha1));
+
+	if (!seen_trigrams)
+		seen_trigrams = xcalloc(1 << 21, 1);
+	for (i = 0; i + 3 <= size; i++) {
+		uint32_t t = (fold(buf[i]) << 16) | (fold(buf[i + 1]) << 8) |
+			fold(buf[i + 2]);
+
+		if (seen_trigrams[t >> 3] & (1 << (t & 7)))
+			continue;
+		seen_trigrams[t >> 3] |= 1 << (t & 7);
+		ALLOC_GROW(trigrams, nr + 1, trigrams_alloc);
+		trigrams[nr++] = t;
+	}
+	free(buf);
+	for (i = 0; i < nr; i++)
+		seen_trigrams[trigrams[i] >> 3] = 0;
+	if (nr > GREP_INDEX_MAX_TRIGRAMS)
+		goto saturate;
+
+	filter_len = (nr * default_settings.bits_per_entry + 7) / 8;
+	strbuf_grow(out, filter_len);
+	filter.data = (unsigned char *)out->buf + out->len;
+	filter.len = filter_len;
+	memset(filter.data, 0, filter_len);
+	for (i = 0; i < nr; i++) {
+		struct bloom_key key;
+		char t[3];
+
+		t[0] = trigrams[i] >> 16;
+		t[1] = trigrams[i] >> 8;
+		t[2] = trigrams[i];
+		fill_bloom_key(t, 3, &key, &default_settings);
+		add_key_to_filter(&key, &filter, &default_settings);
+		clear_bloom_key(&key);
+	}
+	strbuf_setlen(out, out->len + filter_len);
+	return;
+
+saturate:
+	/* a single byte with all bits set may contain anything */
+	strbuf_addch(out, 0xff);
+}
+
+int write_grep_index(const char *object_dir)
+{
+	static struct lock_file lock;
+	struct blob_list blobs = { NULL, 0, 0 };
+	struct strbuf filters = STRBUF_INIT;
+	struct grep_index *old;
+	uint32_t *ends, fanout[256];
+	uint32_t i;
+	char *name;
+	struct sha1file *f;
+	int ret = 0;
+
+	collect_blobs(&blobs);
+
+	old = load_grep_index(object_dir);
+	if (old && (old->settings.num_hashes != default_settings.num_hashes ||
+		    old->settings.bits_per_entry != default_settings.bits_per_entry)) {
+		free_grep_index(old);
+		old = NULL;
+	}
+
+	ends = xmalloc((blobs.nr ? blobs.nr : 1) * sizeof(*ends));
+	for (i = 0; i < blobs.nr; i++) {
+		uint32_t pos;
+
+		if (old && find_blob(old, blobs.sha1[i], &pos)) {
+			struct bloom_filter filter;
+			get_filter(old, pos, &filter);
+			strbuf_add(&filters, filter.data, filter.len);
+		} else {
+			compute_filter(blobs.sha1[i], &filters);
+		}
+		if (filters.len > 0xffffffff) {
+			ret = error("grep index would be too large");
+			goto out;
+		}
+		ends[i] = filters.len;
+	}
+	free_grep_index(old);
+	free(seen_trigrams);
+	seen_trigrams = NULL;
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < blobs.nr; i++)
+		fanout[blobs.sha1[i][0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	name = get_grep_index_filename(object_dir);
+	if (safe_create_leading_directories(name)) {
+		ret = error("unable to create leading directories of %s", name);
+		free(name);
+		goto out;
+	}
+	hold_lock_file_for_update(&lock, name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lock.fd, lock.filename.buf);
+
+	sha1write_be32(f, GREP_INDEX_SIGNATURE);
+	sha1write_be32(f, GREP_INDEX_VERSION);
+	sha1write_be32(f, blobs.nr);
+	sha1write_be32(f, default_settings.num_hashes);
+	sha1write_be32(f, default_settings.bits_per_entry);
+	for (i = 0; i < 256; i++)
+		sha1write_be32(f, fanout[i]);
+	for (i = 0; i < blobs.nr; i++)
+		sha1write(f, blobs.sha1[i], 20);
+	for (i = 0; i < blobs.nr; i++)
+		sha1write_be32(f, ends[i]);
+	sha1write(f, filters.buf, filters.len);
+
+	if (sha1close_commit_lock(f, &lock))
+		ret = error("unable to write %s: %s", name, strerror(errno));
+	free(name);
+
+out:
+	free(ends);
+	free(blobs.sha1);
+	strbuf_release(&filters);
+	return ret;
+}
@@ -0,0 +1,80 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+/*
+ * A grep index records, for blobs reachable from the refs or in the
+ * index at the time it was written, a Bloom filter of the trigrams
+ * (runs of three bytes, with ASCII letters folded to lower case) the
+ * blob contains.  "git grep" uses it to skip blobs that cannot contain
+ * a literal that every match of its pattern has to contain, without
+ * reading them.  See Documentation/technical/grep-index-format.txt for
+ * the format.
+ */
+
+#include "bloom.h"
+
+struct grep_opt;
+
+#define GREP_INDEX_SIGNATURE 0x47524958 /* "GRIX" */
+#define GREP_INDEX_VERSION 1
+#define GREP_INDEX_HEADER_SIZE 20
+
+/*
+ * Blobs with more distinct trigrams than this, or larger than
+ * core.bigFileThreshold, get a filter with all bits set.
+ */
+#define GREP_INDEX_MAX_TRIGRAMS 65536
+
+struct grep_index {
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_blobs;
+	struct bloom_filter_settings settings;
+
+	const uint32_t *fanout;
+	const unsigned char *oids;
+	const unsigned char *ends;
+	const unsigned char *filters;
+};
+
+/*
+ * The trigrams of the literals that every match of a pattern contains.
+ */
+struct grep_index_query {
+	struct bloom_key *keys;
+	int nr, alloc;
+};
+
+char *get_grep_index_filename(const char *object_dir);
+struct grep_index *load_grep_index(const char *object_dir);
+void free_grep_index(struct grep_index *gi);
+
+/*
+ * Fill "query" from the patterns of "opt".  Returns 0 if the index can
+ * be used to rule out blobs for this search, and -1 if it cannot (for
+ * example because the patterns are inverted, or no literal of at least
+ * three bytes can be found in them).
+ */
+int prepare_grep_index_query(struct grep_index_query *query,
+			     const struct grep_opt *opt,
+			     const struct grep_index *gi);
+void clear_grep_index_query(struct grep_index_query *query);
+
+/*
+ * Returns 0 if the blob "sha1" definitely does not contain the literals
+ * of "query", and 1 if it may (including when the blob is not in the
+ * index).
+ */
+int grep_index_may_match(const struct grep_index *gi,
+			 const struct grep_index_query *query,
+			 const unsigned char *sha1);
+
+/*
+ * Write a grep index for the blobs reachable from the refs and HEAD and
+ * those in the index, taking the filters of blobs that are already in
+ * the existing file from there.
+ */
+int write_grep_index(const char *object_dir);
+
+#endif
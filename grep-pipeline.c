@@ -0,0 +1,193 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "grep-pipeline.h"
+
+#ifdef NO_PTHREADS
+
+struct grep_pipeline *start_grep_pipeline(const struct grep_opt *opt,
+					  int nr_threads)
+{
+	return NULL;
+}
+
+void finish_grep_pipeline(struct grep_pipeline *pipeline)
+{
+	; /* nothing */
+}
+
+void grep_pipeline_add(struct grep_pipeline *pipeline, struct strbuf *text)
+{
+	die("BUG: grep_pipeline_add() without threads");
+}
+
+int grep_pipeline_next(struct grep_pipeline *pipeline)
+{
+	die("BUG: grep_pipeline_next() without threads");
+}
+
+#else
+
+struct grep_job {
+	struct strbuf text;
+	int match;
+	unsigned done:1;
+	struct grep_job *next;
+};
+
+struct grep_worker {
+	struct grep_pipeline *pipeline;
+	struct grep_opt *opt;
+	pthread_t thread;
+};
+
+struct grep_pipeline {
+	int nr_threads;
+	struct grep_worker *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;	/* a job was queued, or stop */
+	pthread_cond_t done_cond;	/* a job was finished */
+	/* jobs not yet asked about, oldest first; "todo" is the next to run */
+	struct grep_job *head, **tail, *todo;
+	int stop;
+};
+
+static void *run_jobs(void *data)
+{
+	struct grep_worker *worker = data;
+	struct grep_pipeline *pipeline = worker->pipeline;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	for (;;) {
+		struct grep_job *job;
+
+		while (!pipeline->todo && !pipeline->stop)
+			pthread_cond_wait(&pipeline->work_cond, &pipeline->mutex);
+		if (!pipeline->todo)
+			break;
+		job = pipeline->todo;
+		pipeline->todo = job->next;
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		job->match = grep_buffer(worker->opt, job->text.buf,
+					 job->text.len);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pipeline->done_cond);
+	}
+	pthread_mutex_unlock(&pipeline->mutex);
+	return NULL;
+}
+
+static void free_worker_opt(struct grep_opt *opt)
+{
+	free_grep_patterns(opt);
+	free(opt);
+}
+
+struct grep_pipeline *start_grep_pipeline(const struct grep_opt *opt,
+					  int nr_threads)
+{
+	struct grep_pipeline *pipeline;
+	int i;
+
+	if (nr_threads < 1)
+		return NULL;
+
+	pipeline = xcalloc(1, sizeof(*pipeline));
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->work_cond, NULL);
+	pthread_cond_init(&pipeline->done_cond, NULL);
+	pipeline->tail = &pipeline->head;
+
+	pipeline->workers = xcalloc(nr_threads, sizeof(*pipeline->workers));
+	for (i = 0; i < nr_threads; i++) {
+		struct grep_worker *worker = &pipeline->workers[i];
+
+		worker->pipeline = pipeline;
+		worker->opt = grep_opt_dup(opt);
+		worker->opt->debug = 0;
+		compile_grep_patterns(worker->opt);
+		if (pthread_create(&worker->thread, NULL, run_jobs, worker)) {
+			warning(_("unable to create thread: %s"), strerror(errno));
+			free_worker_opt(worker->opt);
+			break;
+		}
+	}
+	pipeline->nr_threads = i;
+	if (!i) {
+		finish_grep_pipeline(pipeline);
+		return NULL;
+	}
+	return pipeline;
+}
+
+void finish_grep_pipeline(struct grep_pipeline *pipeline)
+{
+	struct grep_job *job;
+	int i;
+
+	if (!pipeline)
+		return;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->stop = 1;
+	pipeline->todo = NULL;	/* nobody will ask about the rest */
+	pthread_cond_broadcast(&pipeline->work_cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+	for (i = 0; i < pipeline->nr_threads; i++) {
+		pthread_join(pipeline->workers[i].thread, NULL);
+		free_worker_opt(pipeline->workers[i].opt);
+	}
+
+	while ((job = pipeline->head)) {
+		pipeline->head = job->next;
+		strbuf_release(&job->text);
+		free(job);
+	}
+	free(pipeline->workers);
+	pthread_cond_destroy(&pipeline->done_cond);
+	pthread_cond_destroy(&pipeline->work_cond);
+	pthread_mutex_destroy(&pipeline->mutex);
+	free(pipeline);
+}
+
+void grep_pipeline_add(struct grep_pipeline *pipeline, struct strbuf *text)
+{
+	struct grep_job *job = xcalloc(1, sizeof(*job));
+
+	job->text = *text;
+	strbuf_init(text, 0);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	*pipeline->tail = job;
+	pipeline->tail = &job->next;
+	if (!pipeline->todo)
+		pipeline->todo = job;
+	pthread_cond_signal(&pipeline->work_cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+int grep_pipeline_next(struct grep_pipeline *pipeline)
+{
+	struct grep_job *job;
+	int match;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	job = pipeline->head;
+	if (!job)
+		die("BUG: grep_pipeline_next() with nothing queued");
+	while (!job->done)
+		pthread_cond_wait(&pipeline->done_cond, &pipeline->mutex);
+	pipeline->head = job->next;
+	if (!pipeline->head)
+		pipeline->tail = &pipeline->head;
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	match = job->match;
+	strbuf_release(&job->text);
+	free(job);
+	return match;
+}
+
+#endif
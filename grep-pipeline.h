@@ -0,0 +1,37 @@
+#ifndef GREP_PIPELINE_H
+#define GREP_PIPELINE_H
+
+#include "grep.h"
+
+/*
+ * Matching "git log --grep" and "--author" against every commit
+ * message can take longer than the walk that finds the commits.  The
+ * walk has to stay on the main thread, but the matching does not: the
+ * revision walk runs ahead of the commit it returns, hands the text of
+ * the upcoming commits over with grep_pipeline_add(), and the worker
+ * threads grep them while earlier commits are being shown.
+ * grep_pipeline_next() then hands the results back in the order the
+ * texts were added.
+ */
+struct grep_pipeline;
+
+/*
+ * Start "nr_threads" workers, each matching with its own copy of the
+ * compiled patterns in "opt".  Returns NULL when built without
+ * threads, or when no thread could be started.
+ */
+extern struct grep_pipeline *start_grep_pipeline(const struct grep_opt *opt,
+						 int nr_threads);
+extern void finish_grep_pipeline(struct grep_pipeline *pipeline);
+
+/* Queue "text" for matching; the pipeline takes over its buffer. */
+extern void grep_pipeline_add(struct grep_pipeline *pipeline,
+			      struct strbuf *text);
+
+/*
+ * Wait for the oldest text that has not been asked about yet, and
+ * return what grep_buffer() said about it.
+ */
+extern int grep_pipeline_next(struct grep_pipeline *pipeline);
+
+#endif
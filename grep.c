@@ -286,6 +286,7 @@ struct grep_opt *grep_opt_dup(const struct grep_opt *opt)
 
 	ret->pattern_list = NULL;
 	ret->pattern_tail = &ret->pattern_list;
+	ret->pattern_expression = NULL;
 
 	for(pat = opt->pattern_list; pat != NULL; pat = pat->next)
 	{
@@ -297,6 +298,11 @@ struct grep_opt *grep_opt_dup(const struct grep_opt *opt)
 					pat->origin, pat->no, pat->token);
 	}
 
+	ret->header_list = NULL;
+	ret->header_tail = &ret->header_list;
+	for (pat = opt->header_list; pat; pat = pat->next)
+		append_header_grep_pattern(ret, pat->field, pat->pattern);
+
 	return ret;
 }
 
@@ -315,14 +321,100 @@ static NORETURN void compile_regexp_failed(const struct grep_pat *p,
 	die("%s'%s': %s", where, p->pattern, error);
 }
 
-#ifdef USE_LIBPCRE
-static void compile_pcre_regexp(struct grep_pat *p, const struct grep_opt *opt)
+/* The JIT stacks start small and grow up to this size. */
+#define PCRE_JIT_STACK_MAX (1024 * 1024)
+
+#if defined(USE_LIBPCRE2)
+static void compile_pcre_regexp(struct grep_pat *p, int ignore_case)
+{
+	int error;
+	PCRE2_UCHAR errbuf[256];
+	PCRE2_SIZE erroffset;
+	uint32_t options = PCRE2_MULTILINE;
+
+	if (ignore_case)
+		options |= PCRE2_CASELESS;
+
+	p->pcre2_pattern = pcre2_compile((PCRE2_SPTR)p->pattern,
+					 p->patternlen, options, &error,
+					 &erroffset, NULL);
+	if (!p->pcre2_pattern) {
+		pcre2_get_error_message(error, errbuf, sizeof(errbuf));
+		compile_regexp_failed(p, (const char *)errbuf);
+	}
+
+	p->pcre2_match_data =
+		pcre2_match_data_create_from_pattern(p->pcre2_pattern, NULL);
+	if (!p->pcre2_match_data)
+		die("unable to allocate PCRE2 match data");
+
+	/* without a usable JIT we still match, only more slowly */
+	pcre2_config(PCRE2_CONFIG_JIT, &p->pcre_jit_on);
+	if (p->pcre_jit_on &&
+	    pcre2_jit_compile(p->pcre2_pattern, PCRE2_JIT_COMPLETE))
+		p->pcre_jit_on = 0;
+	if (p->pcre_jit_on) {
+		p->pcre2_jit_stack = pcre2_jit_stack_create(32 * 1024,
+							    PCRE_JIT_STACK_MAX,
+							    NULL);
+		p->pcre2_match_context = pcre2_match_context_create(NULL);
+		if (!p->pcre2_jit_stack || !p->pcre2_match_context)
+			die("unable to allocate the PCRE2 JIT stack");
+		pcre2_jit_stack_assign(p->pcre2_match_context, NULL,
+				       p->pcre2_jit_stack);
+	}
+}
+
+static int pcrematch(struct grep_pat *p, const char *line, const char *eol,
+		regmatch_t *match, int eflags)
+{
+	int ret;
+	uint32_t flags = 0;
+
+	if (eflags & REG_NOTBOL)
+		flags |= PCRE2_NOTBOL;
+
+	if (p->pcre_jit_on)
+		ret = pcre2_jit_match(p->pcre2_pattern, (PCRE2_SPTR)line,
+				      eol - line, 0, flags,
+				      p->pcre2_match_data,
+				      p->pcre2_match_context);
+	else
+		ret = pcre2_match(p->pcre2_pattern, (PCRE2_SPTR)line,
+				  eol - line, 0, flags,
+				  p->pcre2_match_data, NULL);
+	if (ret < 0 && ret != PCRE2_ERROR_NOMATCH) {
+		PCRE2_UCHAR errbuf[256];
+		pcre2_get_error_message(ret, errbuf, sizeof(errbuf));
+		die("pcre2_match failed with error code %d: %s", ret, errbuf);
+	}
+	if (ret > 0) {
+		PCRE2_SIZE *ovector =
+			pcre2_get_ovector_pointer(p->pcre2_match_data);
+		ret = 0;
+		match->rm_so = ovector[0];
+		match->rm_eo = ovector[1];
+	}
+
+	return ret;
+}
+
+static void free_pcre_regexp(struct grep_pat *p)
+{
+	pcre2_code_free(p->pcre2_pattern);
+	pcre2_match_data_free(p->pcre2_match_data);
+	pcre2_match_context_free(p->pcre2_match_context);
+	pcre2_jit_stack_free(p->pcre2_jit_stack);
+}
+#elif defined(USE_LIBPCRE)
+static void compile_pcre_regexp(struct grep_pat *p, int ignore_case)
 {
 	const char *error;
 	int erroffset;
 	int options = PCRE_MULTILINE;
+	int study_options = 0;
 
-	if (opt->ignore_case)
+	if (ignore_case)
 		options |= PCRE_CASELESS;
 
 	p->pcre_regexp = pcre_compile(p->pattern, options, &error, &erroffset,
@@ -330,9 +422,25 @@ static void compile_pcre_regexp(struct grep_pat *p, const struct grep_opt *opt)
 	if (!p->pcre_regexp)
 		compile_regexp_failed(p, error);
 
-	p->pcre_extra_info = pcre_study(p->pcre_regexp, 0, &error);
+#ifdef GIT_PCRE1_USE_JIT
+	pcre_config(PCRE_CONFIG_JIT, &p->pcre_jit_on);
+	if (p->pcre_jit_on)
+		study_options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+	p->pcre_extra_info = pcre_study(p->pcre_regexp, study_options, &error);
 	if (!p->pcre_extra_info && error)
 		die("%s", error);
+
+#ifdef GIT_PCRE1_USE_JIT
+	if (p->pcre_jit_on && p->pcre_extra_info) {
+		p->pcre_jit_stack = pcre_jit_stack_alloc(32 * 1024,
+							 PCRE_JIT_STACK_MAX);
+		if (!p->pcre_jit_stack)
+			die("unable to allocate the PCRE JIT stack");
+		pcre_assign_jit_stack(p->pcre_extra_info, NULL,
+				      p->pcre_jit_stack);
+	}
+#endif
 }
 
 static int pcrematch(struct grep_pat *p, const char *line, const char *eol,
@@ -359,10 +467,16 @@ static int pcrematch(struct grep_pat *p, const char *line, const char *eol,
 static void free_pcre_regexp(struct grep_pat *p)
 {
 	pcre_free(p->pcre_regexp);
+#ifdef GIT_PCRE1_USE_JIT
+	pcre_free_study(p->pcre_extra_info);
+	if (p->pcre_jit_stack)
+		pcre_jit_stack_free(p->pcre_jit_stack);
+#else
 	pcre_free(p->pcre_extra_info);
+#endif
 }
-#else /* !USE_LIBPCRE */
-static void compile_pcre_regexp(struct grep_pat *p, const struct grep_opt *opt)
+#else /* !USE_LIBPCRE && !USE_LIBPCRE2 */
+static void compile_pcre_regexp(struct grep_pat *p, int ignore_case)
 {
 	die("cannot use Perl-compatible regexes when not compiled with USE_LIBPCRE");
 }
@@ -376,7 +490,34 @@ static int pcrematch(struct grep_pat *p, const char *line, const char *eol,
 static void free_pcre_regexp(struct grep_pat *p)
 {
 }
-#endif /* !USE_LIBPCRE */
+#endif /* !USE_LIBPCRE && !USE_LIBPCRE2 */
+
+struct grep_pat *compile_perl_regexp(const char *pattern, int ignore_case)
+{
+	struct grep_pat *p = xcalloc(1, sizeof(*p));
+
+	p->pattern = xstrdup(pattern);
+	p->patternlen = strlen(pattern);
+	p->token = GREP_PATTERN;
+	p->perl = 1;
+	compile_pcre_regexp(p, ignore_case);
+	return p;
+}
+
+int perl_regexec(struct grep_pat *p, const char *line, const char *eol,
+		 regmatch_t *match, int eflags)
+{
+	return pcrematch(p, line, eol, match, eflags);
+}
+
+void free_perl_regexp(struct grep_pat *p)
+{
+	if (!p)
+		return;
+	free_pcre_regexp(p);
+	free(p->pattern);
+	free(p);
+}
 
 static int is_fixed(const char *s, size_t len)
 {
@@ -419,7 +560,8 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 	}
 
 	if (opt->pcre) {
-		compile_pcre_regexp(p, opt);
+		p->perl = 1;
+		compile_pcre_regexp(p, opt->ignore_case);
 		return;
 	}
 
@@ -775,7 +917,7 @@ void free_grep_patterns(struct grep_opt *opt)
 		case GREP_PATTERN_BODY:
 			if (p->kws)
 				kwsfree(p->kws);
-			else if (p->pcre_regexp)
+			else if (p->perl)
 				free_pcre_regexp(p);
 			else
 				regfree(&p->regexp);
@@ -866,7 +1008,7 @@ static int patmatch(struct grep_pat *p, char *line, char *eol,
 
 	if (p->fixed)
 		hit = !fixmatch(p, line, eol, match);
-	else if (p->pcre_regexp)
+	else if (p->perl)
 		hit = !pcrematch(p, line, eol, match, eflags);
 	else
 		hit = !regmatch(&p->regexp, line, eol, match, eflags);
@@ -1166,7 +1308,7 @@ static void show_line(struct grep_opt *opt, char *bol, char *eol,
 int grep_use_locks;
 
 /*
- * This lock protects access to the gitattributes machinery, which is
+ * This lock protects the userdiff drivers' textconv caches, which are
  * not thread-safe.
  */
 pthread_mutex_t grep_attr_mutex;
@@ -1183,11 +1325,6 @@ static inline void grep_attr_unlock(void)
 		pthread_mutex_unlock(&grep_attr_mutex);
 }
 
-/*
- * Same as git_attr_mutex, but protecting the thread-unsafe object db access.
- */
-pthread_mutex_t grep_read_mutex;
-
 #else
 #define grep_attr_lock()
 #define grep_attr_unlock()
@@ -1710,9 +1847,7 @@ static int grep_source_load_sha1(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
 	gs->buf = read_sha1_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
@@ -1777,20 +1912,58 @@ void grep_source_load_driver(struct grep_source *gs)
 	if (gs->driver)
 		return;
 
-	grep_attr_lock();
 	if (gs->path)
 		gs->driver = userdiff_find_by_path(gs->path);
 	if (!gs->driver)
 		gs->driver = userdiff_find_by_name("default");
-	grep_attr_unlock();
+}
+
+/*
+ * Whether a large source that has not been loaded yet is binary can
+ * be told from its first few bytes; a binary one may then never need
+ * to be read whole (e.g. with "-I").  Returns -1 when the source has
+ * to be loaded to find out.
+ */
+static int grep_source_is_binary_unloaded(struct grep_source *gs)
+{
+	unsigned long size;
+	struct stat st;
+	int ret = -1;
+
+	if (gs->buf)
+		return -1;
+
+	switch (gs->type) {
+	case GREP_SOURCE_SHA1:
+		grep_read_lock();
+		if (sha1_object_info(gs->identifier, &size) == OBJ_BLOB &&
+		    size > big_file_threshold)
+			ret = blob_is_binary(gs->identifier);
+		grep_read_unlock();
+		break;
+	case GREP_SOURCE_FILE:
+		if (!lstat(gs->identifier, &st) && S_ISREG(st.st_mode) &&
+		    st.st_size > big_file_threshold)
+			ret = file_is_binary(gs->identifier);
+		break;
+	default:
+		break;
+	}
+	return ret;
 }
 
 static int grep_source_is_binary(struct grep_source *gs)
 {
+	int ret;
+
 	grep_source_load_driver(gs);
 	if (gs->driver->binary != -1)
 		return gs->driver->binary;
 
+	ret = grep_source_is_binary_unloaded(gs);
+	if (ret >= 0)
+		return ret;
+
 	if (!grep_source_load(gs))
 		return buffer_is_binary(gs->buf, gs->size);
 
@@ -3,10 +3,25 @@
 #include "color.h"
 #ifdef USE_LIBPCRE
 #include <pcre.h>
+#ifdef PCRE_CONFIG_JIT
+#define GIT_PCRE1_USE_JIT
+#endif
 #else
 typedef int pcre;
 typedef int pcre_extra;
 #endif
+#ifndef GIT_PCRE1_USE_JIT
+typedef int pcre_jit_stack;
+#endif
+#ifdef USE_LIBPCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#else
+typedef int pcre2_code;
+typedef int pcre2_match_data;
+typedef int pcre2_match_context;
+typedef int pcre2_jit_stack;
+#endif
 #include "kwset.h"
 #include "thread-utils.h"
 #include "userdiff.h"
@@ -46,10 +61,21 @@ struct grep_pat {
 	size_t patternlen;
 	enum grep_header_field field;
 	regex_t regexp;
+	/*
+	 * Every thread compiles the patterns for itself, so the JIT
+	 * stacks and match data below are never shared.
+	 */
 	pcre *pcre_regexp;
 	pcre_extra *pcre_extra_info;
+	pcre_jit_stack *pcre_jit_stack;
+	pcre2_code *pcre2_pattern;
+	pcre2_match_data *pcre2_match_data;
+	pcre2_match_context *pcre2_match_context;
+	pcre2_jit_stack *pcre2_jit_stack;
+	int pcre_jit_on;
 	kwset_t kws;
 	unsigned fixed:1;
+	unsigned perl:1;
 	unsigned ignore_case:1;
 	unsigned word_regexp:1;
 };
@@ -182,27 +208,40 @@ void grep_source_load_driver(struct grep_source *gs);
 int grep_source(struct grep_opt *opt, struct grep_source *gs);
 
 extern struct grep_opt *grep_opt_dup(const struct grep_opt *opt);
+
+/*
+ * A single Perl-compatible regular expression for other users than grep,
+ * e.g. pickaxe, matched like regexec() would match it against the bytes
+ * from "line" up to "eol".  Returns 0 on a match.
+ */
+extern struct grep_pat *compile_perl_regexp(const char *pattern, int ignore_case);
+extern int perl_regexec(struct grep_pat *p, const char *line, const char *eol,
+			regmatch_t *match, int eflags);
+extern void free_perl_regexp(struct grep_pat *p);
 extern int grep_threads_ok(const struct grep_opt *opt);
 
 #ifndef NO_PTHREADS
 /*
- * Mutex used around access to the attributes machinery if
+ * Mutex used around access to the textconv caches if
  * opt->use_threads.  Must be initialized/destroyed by callers!
  */
 extern int grep_use_locks;
 extern pthread_mutex_t grep_attr_mutex;
-extern pthread_mutex_t grep_read_mutex;
 
+/*
+ * Protects the parts of the object store that read_sha1_file() does
+ * not lock by itself; see enable_obj_read_lock().
+ */
 static inline void grep_read_lock(void)
 {
 	if (grep_use_locks)
-		pthread_mutex_lock(&grep_read_mutex);
+		obj_read_lock();
 }
 
 static inline void grep_read_unlock(void)
 {
 	if (grep_use_locks)
-		pthread_mutex_unlock(&grep_read_mutex);
+		obj_read_unlock();
 }
 
 #else
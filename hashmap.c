@@ -125,6 +125,7 @@ void hashmap_init(struct hashmap *map, hashmap_cmp_fn equals_function,
 {
 	unsigned int size = HASHMAP_INITIAL_SIZE;
 	map->size = 0;
+	map->disallow_rehash = 0;
 	map->cmpfn = equals_function ? equals_function : always_equal;
 
 	/* calculate initial table size and allocate the table */
@@ -173,6 +174,8 @@ void hashmap_add(struct hashmap *map, void *entry)
 	map->table[b] = entry;
 
 	/* fix size and rehash if appropriate */
+	if (map->disallow_rehash)
+		return;
 	map->size++;
 	if (map->size > map->grow_at)
 		rehash(map, map->tablesize << HASHMAP_RESIZE_BITS);
@@ -191,12 +194,33 @@ void *hashmap_remove(struct hashmap *map, const void *key, const void *keydata)
 	old->next = NULL;
 
 	/* fix size and rehash if appropriate */
+	if (map->disallow_rehash)
+		return old;
 	map->size--;
 	if (map->size < map->shrink_at)
 		rehash(map, map->tablesize >> HASHMAP_RESIZE_BITS);
 	return old;
 }
 
+void hashmap_disallow_rehash(struct hashmap *map, unsigned value)
+{
+	unsigned int i, size = 0;
+
+	map->disallow_rehash = value;
+	if (value)
+		return;
+
+	/* recount what was added or removed meanwhile */
+	for (i = 0; i < map->tablesize; i++) {
+		struct hashmap_entry *e;
+		for (e = map->table[i]; e; e = e->next)
+			size++;
+	}
+	map->size = size;
+	if (map->size > map->grow_at)
+		rehash(map, map->tablesize << HASHMAP_RESIZE_BITS);
+}
+
 void *hashmap_put(struct hashmap *map, void *entry)
 {
 	struct hashmap_entry *old = hashmap_remove(map, entry, NULL);
@@ -227,6 +251,177 @@ void *hashmap_iter_next(struct hashmap_iter *iter)
 	}
 }
 
+#define OAHASHMAP_INITIAL_SIZE 64
+/* linear probing degrades quickly above this load factor (in percent) */
+#define OAHASHMAP_LOAD_FACTOR 70
+
+static void oa_alloc_table(struct oahashmap *map, unsigned int size)
+{
+	map->tablesize = size;
+	map->table = xcalloc(size, sizeof(struct oahashmap_slot));
+
+	map->grow_at = (unsigned int) ((uint64_t) size * OAHASHMAP_LOAD_FACTOR / 100);
+	if (size <= OAHASHMAP_INITIAL_SIZE)
+		map->shrink_at = 0;
+	else
+		/* see alloc_table() */
+		map->shrink_at = map->grow_at / ((1 << HASHMAP_RESIZE_BITS) + 1);
+}
+
+static void oa_insert(struct oahashmap *map, unsigned int hash, void *entry)
+{
+	unsigned int mask = map->tablesize - 1;
+	unsigned int i = hash & mask;
+
+	while (map->table[i].entry)
+		i = (i + 1) & mask;
+	map->table[i].hash = hash;
+	map->table[i].entry = entry;
+}
+
+static void oa_rehash(struct oahashmap *map, unsigned int newsize)
+{
+	unsigned int i, oldsize = map->tablesize;
+	struct oahashmap_slot *oldtable = map->table;
+
+	oa_alloc_table(map, newsize);
+	for (i = 0; i < oldsize; i++)
+		if (oldtable[i].entry)
+			oa_insert(map, oldtable[i].hash, oldtable[i].entry);
+	free(oldtable);
+}
+
+/* Return the slot of the matching entry, or tablesize if there is none. */
+static unsigned int oa_find_slot(const struct oahashmap *map, unsigned int hash,
+		const void *key, const void *keydata)
+{
+	unsigned int mask = map->tablesize - 1;
+	unsigned int i = hash & mask;
+	const struct oahashmap_slot *slot;
+
+	for (slot = &map->table[i]; slot->entry; slot = &map->table[i]) {
+		if (slot->hash == hash &&
+		    (slot->entry == key || !map->cmpfn(slot->entry, key, keydata)))
+			return i;
+		i = (i + 1) & mask;
+	}
+	return map->tablesize;
+}
+
+void oahashmap_init(struct oahashmap *map, hashmap_cmp_fn equals_function,
+		size_t initial_size)
+{
+	unsigned int size = OAHASHMAP_INITIAL_SIZE;
+	map->size = 0;
+	map->cmpfn = equals_function ? equals_function : always_equal;
+
+	initial_size = (unsigned int) ((uint64_t) initial_size * 100
+			/ OAHASHMAP_LOAD_FACTOR);
+	while (initial_size > size)
+		size <<= HASHMAP_RESIZE_BITS;
+	oa_alloc_table(map, size);
+}
+
+void oahashmap_free(struct oahashmap *map, int free_entries)
+{
+	unsigned int i;
+
+	if (!map || !map->table)
+		return;
+	if (free_entries)
+		for (i = 0; i < map->tablesize; i++)
+			free(map->table[i].entry);
+	free(map->table);
+	memset(map, 0, sizeof(*map));
+}
+
+void *oahashmap_get(const struct oahashmap *map, unsigned int hash,
+		const void *key, const void *keydata)
+{
+	unsigned int i = oa_find_slot(map, hash, key, keydata);
+	return i < map->tablesize ? map->table[i].entry : NULL;
+}
+
+void *oahashmap_get_next(const struct oahashmap *map, unsigned int hash,
+		const void *entry)
+{
+	unsigned int mask = map->tablesize - 1;
+	unsigned int i = hash & mask;
+
+	/* find the slot of "entry" itself, then look past it */
+	while (map->table[i].entry && map->table[i].entry != entry)
+		i = (i + 1) & mask;
+	if (!map->table[i].entry)
+		return NULL;
+	for (i = (i + 1) & mask; map->table[i].entry; i = (i + 1) & mask)
+		if (map->table[i].hash == hash &&
+		    !map->cmpfn(map->table[i].entry, entry, NULL))
+			return map->table[i].entry;
+	return NULL;
+}
+
+void oahashmap_add(struct oahashmap *map, unsigned int hash, void *entry)
+{
+	oa_insert(map, hash, entry);
+	map->size++;
+	if (map->size > map->grow_at)
+		oa_rehash(map, map->tablesize << HASHMAP_RESIZE_BITS);
+}
+
+void *oahashmap_remove(struct oahashmap *map, unsigned int hash,
+		const void *key, const void *keydata)
+{
+	unsigned int mask = map->tablesize - 1;
+	unsigned int i = oa_find_slot(map, hash, key, keydata), j;
+	void *old;
+
+	if (i >= map->tablesize)
+		return NULL;
+	old = map->table[i].entry;
+
+	/*
+	 * Shift back the entries of the cluster that would no longer be
+	 * found once slot i is empty, i.e. those whose home slot is not
+	 * cyclically within (i, j].
+	 */
+	for (j = (i + 1) & mask; map->table[j].entry; j = (j + 1) & mask) {
+		unsigned int home = map->table[j].hash & mask;
+		if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+			map->table[i] = map->table[j];
+			i = j;
+		}
+	}
+	map->table[i].entry = NULL;
+
+	map->size--;
+	if (map->size < map->shrink_at)
+		oa_rehash(map, map->tablesize >> HASHMAP_RESIZE_BITS);
+	return old;
+}
+
+void *oahashmap_put(struct oahashmap *map, unsigned int hash, void *entry)
+{
+	void *old = oahashmap_remove(map, hash, entry, NULL);
+	oahashmap_add(map, hash, entry);
+	return old;
+}
+
+void oahashmap_iter_init(struct oahashmap *map, struct oahashmap_iter *iter)
+{
+	iter->map = map;
+	iter->tablepos = 0;
+}
+
+void *oahashmap_iter_next(struct oahashmap_iter *iter)
+{
+	while (iter->tablepos < iter->map->tablesize) {
+		void *entry = iter->map->table[iter->tablepos++].entry;
+		if (entry)
+			return entry;
+	}
+	return NULL;
+}
+
 struct pool_entry {
 	struct hashmap_entry ent;
 	size_t len;
@@ -38,6 +38,7 @@ struct hashmap {
 	struct hashmap_entry **table;
 	hashmap_cmp_fn cmpfn;
 	unsigned int size, tablesize, grow_at, shrink_at;
+	unsigned disallow_rehash : 1;
 };
 
 struct hashmap_iter {
@@ -67,6 +68,7 @@ extern void hashmap_add(struct hashmap *map, void *entry);
 extern void *hashmap_put(struct hashmap *map, void *entry);
 extern void *hashmap_remove(struct hashmap *map, const void *key,
 		const void *keydata);
+extern void hashmap_disallow_rehash(struct hashmap *map, unsigned value);
 
 static inline void *hashmap_get_from_hash(const struct hashmap *map,
 		unsigned int hash, const void *keydata)
@@ -87,6 +89,52 @@ static inline void *hashmap_iter_first(struct hashmap *map,
 	return hashmap_iter_next(iter);
 }
 
+/*
+ * Open-addressing variant: the table holds the hash codes next to the
+ * entry pointers and is probed linearly, so that a lookup touches the
+ * entries only for candidates whose full hash matches.  Entries need
+ * no embedded struct hashmap_entry; the hash is passed along instead.
+ * Comparison functions are called as cmpfn(entry, key, keydata).
+ */
+
+struct oahashmap_slot {
+	unsigned int hash;
+	void *entry;
+};
+
+struct oahashmap {
+	struct oahashmap_slot *table;
+	hashmap_cmp_fn cmpfn;
+	unsigned int size, tablesize, grow_at, shrink_at;
+};
+
+struct oahashmap_iter {
+	struct oahashmap *map;
+	unsigned int tablepos;
+};
+
+extern void oahashmap_init(struct oahashmap *map, hashmap_cmp_fn equals_function,
+		size_t initial_size);
+extern void oahashmap_free(struct oahashmap *map, int free_entries);
+
+extern void *oahashmap_get(const struct oahashmap *map, unsigned int hash,
+		const void *key, const void *keydata);
+extern void *oahashmap_get_next(const struct oahashmap *map, unsigned int hash,
+		const void *entry);
+extern void oahashmap_add(struct oahashmap *map, unsigned int hash, void *entry);
+extern void *oahashmap_put(struct oahashmap *map, unsigned int hash, void *entry);
+extern void *oahashmap_remove(struct oahashmap *map, unsigned int hash,
+		const void *key, const void *keydata);
+
+extern void oahashmap_iter_init(struct oahashmap *map, struct oahashmap_iter *iter);
+extern void *oahashmap_iter_next(struct oahashmap_iter *iter);
+static inline void *oahashmap_iter_first(struct oahashmap *map,
+		struct oahashmap_iter *iter)
+{
+	oahashmap_iter_init(map, iter);
+	return oahashmap_iter_next(iter);
+}
+
 /* string interning */
 
 extern const void *memintern(const void *data, size_t len);
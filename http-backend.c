@@ -8,6 +8,7 @@
 #include "string-list.h"
 #include "url.h"
 #include "argv-array.h"
+#include "protocol.h"
 
 static const char content_type[] = "Content-Type";
 static const char content_length[] = "Content-Length";
@@ -162,13 +163,101 @@ static void send_strbuf(const char *type, struct strbuf *buf)
 	write_or_die(1, buf->buf, buf->len);
 }
 
+/*
+ * Look at the Range header for a single "bytes=<first>-<last>" range
+ * of a file of "size" bytes last modified at "mtime".  Returns 1 and
+ * fills in the range if one applies, 0 if the whole file should be
+ * sent, and -1 if the requested range cannot be satisfied.
+ */
+static int parse_range(uintmax_t size, unsigned long mtime,
+		       uintmax_t *first, uintmax_t *last)
+{
+	const char *range = getenv("HTTP_RANGE");
+	const char *if_range = getenv("HTTP_IF_RANGE");
+	char *end;
+
+	if (!range || !skip_prefix(range, "bytes=", &range))
+		return 0;
+	if (strchr(range, ','))
+		return 0; /* multiple ranges; just send the whole thing */
+	if (if_range && *if_range &&
+	    strcmp(if_range, show_date(mtime, 0, DATE_RFC2822)))
+		return 0; /* the file changed since the client saw it */
+
+	if (*range == '-') {
+		uintmax_t n = strtoumax(range + 1, &end, 10);
+		if (end == range + 1 || *end)
+			return 0;
+		if (!n || !size)
+			return -1;
+		*first = n < size ? size - n : 0;
+		*last = size - 1;
+		return 1;
+	}
+
+	*first = strtoumax(range, &end, 10);
+	if (end == range || *end != '-')
+		return 0;
+	range = end + 1;
+	if (!*range)
+		*last = size - 1;
+	else {
+		*last = strtoumax(range, &end, 10);
+		if (*end || *last < *first)
+			return 0;
+		if (*last >= size)
+			*last = size - 1;
+	}
+	if (*first >= size)
+		return -1;
+	return 1;
+}
+
+/*
+ * Copy "len" bytes starting at "offset" of the file "fd" to stdout,
+ * letting the kernel do it when it can.
+ */
+static void send_file_data(int fd, const char *p, off_t offset, uintmax_t len)
+{
+	char buf[8192];
+
+#ifdef HAVE_SENDFILE
+	while (len) {
+		size_t chunk = len < (1 << 30) ? len : (1 << 30);
+		ssize_t n = sendfile(1, fd, &offset, chunk);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+			break; /* stdout cannot take it; copy it ourselves */
+		if (n < 0)
+			die_errno("Cannot send '%s'", p);
+		if (!n)
+			die("Cannot read '%s': unexpected end of file", p);
+		len -= n;
+	}
+	if (!len)
+		return;
+#endif
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		die_errno("Cannot seek in '%s'", p);
+	while (len) {
+		ssize_t n = xread(fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n < 0)
+			die_errno("Cannot read '%s'", p);
+		if (!n)
+			die("Cannot read '%s': unexpected end of file", p);
+		write_or_die(1, buf, n);
+		len -= n;
+	}
+}
+
 static void send_local_file(const char *the_type, const char *name)
 {
 	const char *p = git_path("%s", name);
-	size_t buf_alloc = 8192;
-	char *buf = xmalloc(buf_alloc);
 	int fd;
 	struct stat sb;
+	uintmax_t first = 0, last = 0;
+	int range;
 
 	fd = open(p, O_RDONLY);
 	if (fd < 0)
@@ -176,21 +265,34 @@ static void send_local_file(const char *the_type, const char *name)
 	if (fstat(fd, &sb) < 0)
 		die_errno("Cannot stat '%s'", p);
 
-	hdr_int(content_length, sb.st_size);
+	range = parse_range(sb.st_size, sb.st_mtime, &first, &last);
+	if (range < 0) {
+		http_status(416, "Requested Range Not Satisfiable");
+		format_write(1, "Content-Range: bytes */%" PRIuMAX "\r\n",
+			     (uintmax_t)sb.st_size);
+		end_headers();
+		close(fd);
+		return;
+	}
+	if (!range) {
+		first = 0;
+		last = sb.st_size - 1;
+	} else {
+		http_status(206, "Partial Content");
+		format_write(1, "Content-Range: bytes %" PRIuMAX "-%" PRIuMAX
+			     "/%" PRIuMAX "\r\n",
+			     first, last, (uintmax_t)sb.st_size);
+	}
+
+	hdr_str("Accept-Ranges", "bytes");
+	hdr_int(content_length, sb.st_size ? last - first + 1 : 0);
 	hdr_str(content_type, the_type);
 	hdr_date(last_modified, sb.st_mtime);
 	end_headers();
 
-	for (;;) {
-		ssize_t n = xread(fd, buf, buf_alloc);
-		if (n < 0)
-			die_errno("Cannot read '%s'", p);
-		if (!n)
-			break;
-		write_or_die(1, buf, n);
-	}
+	if (sb.st_size)
+		send_file_data(fd, p, first, last - first + 1);
 	close(fd);
-	free(buf);
 }
 
 static void get_text_file(char *name)
@@ -383,6 +485,7 @@ static void run_service(const char **argv, int buffer_input)
 	const char *encoding = getenv("HTTP_CONTENT_ENCODING");
 	const char *user = getenv("REMOTE_USER");
 	const char *host = getenv("REMOTE_ADDR");
+	const char *git_protocol = getenv("HTTP_GIT_PROTOCOL");
 	int gzipped_request = 0;
 	struct child_process cld = CHILD_PROCESS_INIT;
 
@@ -401,6 +504,10 @@ static void run_service(const char **argv, int buffer_input)
 	if (!getenv("GIT_COMMITTER_EMAIL"))
 		argv_array_pushf(&cld.env_array,
 				 "GIT_COMMITTER_EMAIL=%s@http.%s", user, host);
+	/* the client's "Git-Protocol" header */
+	if (git_protocol && *git_protocol)
+		argv_array_pushf(&cld.env_array, "%s=%s",
+				 GIT_PROTOCOL_ENVIRONMENT, git_protocol);
 
 	cld.argv = argv;
 	if (buffer_input || gzipped_request)
@@ -2,9 +2,98 @@
 #include "exec_cmd.h"
 #include "http.h"
 #include "walker.h"
+#include "run-command.h"
 
 static const char http_fetch_usage[] = "git http-fetch "
-"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url";
+"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url\n"
+"   or: git http-fetch --packfile=<pack-hash> [--index-pack-arg=<arg>...] url\n"
+"   or: git http-fetch --bundle=<file> url";
+
+/* How often to pick a bundle download up again after it broke off. */
+#define BUNDLE_RETRIES 5
+
+/*
+ * Download a bundle, as used by "clone --bundle-uri", to "path".  A
+ * download that breaks off is resumed where it stopped, as long as
+ * each attempt gets further than the last.
+ */
+static int fetch_bundle(const char *path, const char *url)
+{
+	struct strbuf tmp = STRBUF_INIT;
+	off_t got = 0;
+	int tries, ret;
+
+	strbuf_addf(&tmp, "%s.temp", path);
+	http_init(NULL, url, 0);
+	for (tries = 0; ; tries++) {
+		struct stat st;
+
+		ret = http_get_file(url, path, NULL);
+		if (ret == HTTP_OK || ret != HTTP_ERROR || tries >= BUNDLE_RETRIES)
+			break;
+		if (stat(tmp.buf, &st) || st.st_size <= got)
+			break;
+		got = st.st_size;
+		warning("download of %s broke off, resuming at byte %"PRIuMAX,
+			url, (uintmax_t)got);
+	}
+	if (ret != HTTP_OK)
+		ret = error("unable to get bundle %s", url);
+	http_cleanup();
+	strbuf_release(&tmp);
+	return ret;
+}
+
+/*
+ * Download a whole pack, as offered by upload-pack's "packfile-uris",
+ * and make sure it is the pack we were promised before using it.
+ */
+static int fetch_packfile(const char *hex, const char **index_pack_args,
+			  const char *url)
+{
+	struct child_process ip = CHILD_PROCESS_INIT;
+	struct strbuf tmp = STRBUF_INIT;
+	struct strbuf out = STRBUF_INIT;
+	unsigned char sha1[20];
+	const char *got;
+	int ret = 0;
+
+	if (get_sha1_hex(hex, sha1) || hex[40])
+		die("invalid pack hash '%s'", hex);
+
+	strbuf_addf(&tmp, "%s/pack/tmp_uri_pack_%s",
+		    get_object_directory(), hex);
+	http_init(NULL, url, 0);
+	if (http_get_file(url, tmp.buf, NULL) != HTTP_OK) {
+		ret = error("unable to get pack %s", url);
+		goto cleanup;
+	}
+
+	argv_array_pushl(&ip.args, "index-pack", "--stdin", NULL);
+	for (; *index_pack_args; index_pack_args++)
+		argv_array_push(&ip.args, *index_pack_args);
+	ip.git_cmd = 1;
+	ip.in = open(tmp.buf, O_RDONLY);
+	if (ip.in < 0) {
+		ret = error("unable to open %s: %s", tmp.buf, strerror(errno));
+		goto cleanup;
+	}
+	if (capture_command(&ip, &out, 0)) {
+		ret = error("unable to index pack %s", url);
+		goto cleanup;
+	}
+	strbuf_rtrim(&out);
+	if (!skip_prefix(out.buf, "pack\t", &got) || strcmp(got, sha1_to_hex(sha1)))
+		ret = error("pack downloaded from %s is not pack %s",
+			    url, sha1_to_hex(sha1));
+
+cleanup:
+	unlink(tmp.buf);
+	http_cleanup();
+	strbuf_release(&tmp);
+	strbuf_release(&out);
+	return ret;
+}
 
 int main(int argc, const char **argv)
 {
@@ -26,6 +115,28 @@ int main(int argc, const char **argv)
 
 	git_extract_argv0_path(argv[0]);
 
+	if (argc > 2 && skip_prefix(argv[1], "--packfile=", &argv[1])) {
+		struct argv_array index_pack_args = ARGV_ARRAY_INIT;
+		const char *v;
+
+		for (arg = 2; arg < argc - 1; arg++) {
+			if (!skip_prefix(argv[arg], "--index-pack-arg=", &v))
+				usage(http_fetch_usage);
+			argv_array_push(&index_pack_args, v);
+		}
+		setup_git_directory();
+		git_config(git_default_config, NULL);
+		rc = fetch_packfile(argv[1], index_pack_args.argv, argv[arg]);
+		argv_array_clear(&index_pack_args);
+		return !!rc;
+	}
+
+	if (argc == 3 && skip_prefix(argv[1], "--bundle=", &argv[1])) {
+		setup_git_directory_gently(NULL);
+		git_config(git_default_config, NULL);
+		return !!fetch_bundle(argv[1], argv[2]);
+	}
+
 	while (arg < argc && argv[arg][0] == '-') {
 		if (argv[arg][1] == 't') {
 			get_tree = 1;
@@ -26,6 +26,20 @@ struct object_request {
 	struct object_request *next;
 };
 
+/*
+ * Packs are downloaded in the background as soon as we know we need
+ * them, so that several can be in flight at once, next to the loose
+ * objects.
+ */
+struct pack_request {
+	struct walker *walker;
+	struct http_pack_request *preq;
+	struct slot_results results;
+	int done;
+	int ret;
+	struct pack_request *next;
+};
+
 struct alternates_request {
 	struct walker *walker;
 	const char *base;
@@ -42,11 +56,111 @@ struct walker_data {
 };
 
 static struct object_request *object_queue_head;
+static struct pack_request *pack_queue_head;
 
 static void fetch_alternates(struct walker *walker, const char *base);
 
 static void process_object_response(void *callback_data);
 
+static void process_pack_response(void *callback_data)
+{
+	struct pack_request *pack_req = callback_data;
+	struct http_pack_request *preq = pack_req->preq;
+
+	pack_req->done = 1;
+	if (pack_req->results.curl_result != CURLE_OK) {
+		pack_req->ret = error("Unable to get pack file %s\n%s",
+				      preq->url, curl_errorstr);
+		return;
+	}
+	pack_req->ret = finish_http_pack_request(preq);
+	if (!pack_req->ret)
+		walker_say(pack_req->walker, "got pack %s\n",
+			   sha1_to_hex(preq->target->sha1));
+}
+
+static struct pack_request *find_pack_request(struct packed_git *target)
+{
+	struct pack_request *pack_req;
+
+	for (pack_req = pack_queue_head; pack_req; pack_req = pack_req->next)
+		if (pack_req->preq->target == target)
+			return pack_req;
+	return NULL;
+}
+
+static struct pack_request *start_pack_request(struct walker *walker,
+					       struct alt_base *repo,
+					       struct packed_git *target,
+					       const unsigned char *sha1)
+{
+	struct pack_request *pack_req;
+	struct http_pack_request *preq;
+
+	if (walker->get_verbosely) {
+		fprintf(stderr, "Getting pack %s\n",
+			sha1_to_hex(target->sha1));
+		fprintf(stderr, " which contains %s\n",
+			sha1_to_hex(sha1));
+	}
+
+	preq = new_http_pack_request(target, repo->base);
+	if (!preq)
+		return NULL;
+	preq->lst = &repo->packs;
+
+	pack_req = xcalloc(1, sizeof(*pack_req));
+	pack_req->walker = walker;
+	pack_req->preq = preq;
+	preq->slot->results = &pack_req->results;
+	preq->slot->callback_func = process_pack_response;
+	preq->slot->callback_data = pack_req;
+	pack_req->next = pack_queue_head;
+	pack_queue_head = pack_req;
+
+	if (!start_active_slot(preq->slot)) {
+		pack_req->done = 1;
+		pack_req->ret = error("Unable to start request");
+	}
+	return pack_req;
+}
+
+static void release_pack_request(struct pack_request *pack_req)
+{
+	struct pack_request **p;
+
+	for (p = &pack_queue_head; *p; p = &(*p)->next)
+		if (*p == pack_req) {
+			*p = pack_req->next;
+			break;
+		}
+	release_http_pack_request(pack_req->preq);
+	free(pack_req);
+}
+
+/*
+ * If "sha1" is in a pack of a repository whose pack list we already
+ * have, start downloading that pack unless that is already under way.
+ */
+static void prefetch_pack(struct walker *walker, const unsigned char *sha1)
+{
+	struct walker_data *data = walker->data;
+	struct alt_base *repo;
+
+	for (repo = data->alt; repo; repo = repo->next) {
+		struct packed_git *target;
+
+		if (!repo->got_indices)
+			continue;
+		target = find_sha1_pack(sha1, repo->packs);
+		if (!target)
+			continue;
+		if (!find_pack_request(target))
+			start_pack_request(walker, repo, target, sha1);
+		return;
+	}
+}
+
 static void start_object_request(struct walker *walker,
 				 struct object_request *obj_req)
 {
@@ -103,6 +217,7 @@ static void process_object_response(void *callback_data)
 			start_object_request(walker, obj_req);
 			return;
 		}
+		prefetch_pack(walker, obj_req->sha1);
 	}
 
 	finish_object_request(obj_req);
@@ -395,50 +510,42 @@ static int fetch_indices(struct walker *walker, struct alt_base *repo)
 static int http_fetch_pack(struct walker *walker, struct alt_base *repo, unsigned char *sha1)
 {
 	struct packed_git *target;
+	struct pack_request *pack_req;
 	int ret;
-	struct slot_results results;
-	struct http_pack_request *preq;
 
-	if (fetch_indices(walker, repo))
-		return -1;
+	if (!repo->got_indices) {
+		struct object_request *obj_req;
+
+		if (fetch_indices(walker, repo))
+			return -1;
+		/*
+		 * Queued objects we already failed to find loose are
+		 * probably in a pack, too; get those going now.
+		 */
+		for (obj_req = object_queue_head; obj_req; obj_req = obj_req->next)
+			if (obj_req->state == COMPLETE && obj_req->req &&
+			    missing_target(obj_req->req))
+				prefetch_pack(walker, obj_req->sha1);
+	}
+
+	/* a pack we were already downloading may have brought it */
+	if (has_sha1_file(sha1))
+		return 0;
 	target = find_sha1_pack(sha1, repo->packs);
 	if (!target)
 		return -1;
 
-	if (walker->get_verbosely) {
-		fprintf(stderr, "Getting pack %s\n",
-			sha1_to_hex(target->sha1));
-		fprintf(stderr, " which contains %s\n",
-			sha1_to_hex(sha1));
-	}
-
-	preq = new_http_pack_request(target, repo->base);
-	if (preq == NULL)
-		goto abort;
-	preq->lst = &repo->packs;
-	preq->slot->results = &results;
-
-	if (start_active_slot(preq->slot)) {
-		run_active_slot(preq->slot);
-		if (results.curl_result != CURLE_OK) {
-			error("Unable to get pack file %s\n%s", preq->url,
-			      curl_errorstr);
-			goto abort;
-		}
-	} else {
-		error("Unable to start request");
-		goto abort;
-	}
-
-	ret = finish_http_pack_request(preq);
-	release_http_pack_request(preq);
-	if (ret)
-		return ret;
-
-	return 0;
+	pack_req = find_pack_request(target);
+	if (!pack_req)
+		pack_req = start_pack_request(walker, repo, target, sha1);
+	if (!pack_req)
+		return -1;
+	if (!pack_req->done)
+		run_active_slot(pack_req->preq->slot);
 
-abort:
-	return -1;
+	ret = pack_req->ret;
+	release_pack_request(pack_req);
+	return ret;
 }
 
 static void abort_object_request(struct object_request *obj_req)
@@ -540,6 +647,14 @@ static void cleanup(struct walker *walker)
 	struct walker_data *data = walker->data;
 	struct alt_base *alt, *alt_next;
 
+	while (pack_queue_head) {
+		struct pack_request *pack_req = pack_queue_head;
+
+		if (!pack_req->done)
+			run_active_slot(pack_req->preq->slot);
+		release_pack_request(pack_req);
+	}
+
 	if (data) {
 		alt = data->alt;
 		while (alt) {
@@ -53,6 +53,7 @@ static int curl_save_cookies;
 struct credential http_auth = CREDENTIAL_INIT;
 static int http_proactive_auth;
 static const char *user_agent;
+static const char *curl_http_version;
 
 #if LIBCURL_VERSION_NUM >= 0x071700
 /* Use CURLOPT_KEYPASSWD as is */
@@ -257,6 +258,9 @@ static int http_options(const char *var, const char *value, void *cb)
 	if (!strcmp("http.useragent", var))
 		return git_config_string(&user_agent, var, value);
 
+	if (!strcmp("http.version", var))
+		return git_config_string(&curl_http_version, var, value);
+
 	/* Fall back on the default ones */
 	return git_default_config(var, value, cb);
 }
@@ -337,6 +341,33 @@ static void set_curl_keepalive(CURL *c)
 }
 #endif
 
+static void set_curl_http_version(CURL *c)
+{
+	if (!curl_http_version)
+		return;
+	if (!strcmp(curl_http_version, "HTTP/1.1")) {
+		curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+		return;
+	}
+	if (!strcmp(curl_http_version, "HTTP/2")) {
+#if LIBCURL_VERSION_NUM >= 0x072100
+		curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+		/*
+		 * Rather than opening a connection of its own, wait for
+		 * an existing one to tell whether it can multiplex.
+		 */
+		curl_easy_setopt(c, CURLOPT_PIPEWAIT, 1);
+#endif
+#else
+		warning("HTTP/2 needs curl 7.33.0 or later; using HTTP/1.1");
+#endif
+		return;
+	}
+	warning("unknown value given to http.version: '%s'",
+		curl_http_version);
+}
+
 static CURL *get_curl_handle(void)
 {
 	CURL *result = curl_easy_init();
@@ -422,6 +453,7 @@ static CURL *get_curl_handle(void)
 	}
 
 	set_curl_keepalive(result);
+	set_curl_http_version(result);
 
 	return result;
 }
@@ -473,6 +505,10 @@ void http_init(struct remote *remote, const char *url, int proactive_auth)
 	curlm = curl_multi_init();
 	if (!curlm)
 		die("curl_multi_init failed");
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* let concurrent requests share one HTTP/2 connection */
+	curl_multi_setopt(curlm, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #endif
 
 	if (getenv("GIT_SSL_NO_VERIFY"))
@@ -1175,6 +1211,12 @@ static int http_request(const char *url,
 
 	headers = curl_slist_append(headers, buf.buf);
 
+	if (options && options->extra_headers) {
+		struct string_list_item *item;
+		for_each_string_list_item(item, options->extra_headers)
+			headers = curl_slist_append(headers, item->string);
+	}
+
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
 	curl_easy_setopt(slot->curl, CURLOPT_ENCODING, "gzip");
@@ -1300,8 +1342,8 @@ int http_get_strbuf(const char *url,
  * If a previous interrupted download is detected (i.e. a previous temporary
  * file is still around) the download is resumed.
  */
-static int http_get_file(const char *url, const char *filename,
-			 struct http_get_options *options)
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options)
 {
 	int ret;
 	struct strbuf tmpfile = STRBUF_INIT;
@@ -1417,6 +1459,124 @@ add_pack:
 	return 0;
 }
 
+/*
+ * The indices of the packs listed in objects/info/packs are all
+ * downloaded at once, so that a repository with many packs does not
+ * cost one round trip per pack.
+ */
+struct pack_index_request {
+	unsigned char sha1[20];
+	char *tmpfile;
+	FILE *file;
+	struct curl_slist *range_header;
+	struct active_request_slot *slot;
+	struct slot_results results;
+	int done;
+};
+
+static void process_pack_index_response(void *callback_data)
+{
+	struct pack_index_request *req = callback_data;
+
+	req->done = 1;
+}
+
+static void start_pack_index_request(struct pack_index_request *req,
+				     const char *base_url)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *url;
+	long posn;
+
+	end_url_with_slash(&buf, base_url);
+	strbuf_addf(&buf, "objects/pack/pack-%s.idx", sha1_to_hex(req->sha1));
+	url = strbuf_detach(&buf, NULL);
+
+	req->tmpfile = xstrfmt("%s.temp", sha1_pack_index_name(req->sha1));
+	req->file = fopen(req->tmpfile, "a");
+	if (!req->file) {
+		req->done = 1;
+		req->results.curl_result = CURLE_WRITE_ERROR;
+		free(url);
+		return;
+	}
+
+	if (http_is_verbose)
+		fprintf(stderr, "Getting index for pack %s\n",
+			sha1_to_hex(req->sha1));
+
+	req->slot = get_active_slot();
+	req->slot->results = &req->results;
+	req->slot->callback_func = process_pack_index_response;
+	req->slot->callback_data = req;
+	curl_easy_setopt(req->slot->curl, CURLOPT_FILE, req->file);
+	curl_easy_setopt(req->slot->curl, CURLOPT_WRITEFUNCTION, fwrite);
+	curl_easy_setopt(req->slot->curl, CURLOPT_URL, url);
+	curl_easy_setopt(req->slot->curl, CURLOPT_HTTPHEADER,
+			 no_pragma_header);
+
+	/* resume an earlier, interrupted download */
+	posn = ftell(req->file);
+	if (posn > 0) {
+		strbuf_addf(&buf, "Range: bytes=%ld-", posn);
+		req->range_header = curl_slist_append(NULL, buf.buf);
+		curl_easy_setopt(req->slot->curl, CURLOPT_HTTPHEADER,
+				 req->range_header);
+		strbuf_release(&buf);
+	}
+
+	if (!start_active_slot(req->slot)) {
+		req->done = 1;
+		req->results.curl_result = CURLE_FAILED_INIT;
+	}
+	free(url);
+}
+
+static int finish_pack_index_request(struct pack_index_request *req,
+				     struct packed_git **packs_head,
+				     const char *base_url)
+{
+	struct packed_git *new_pack;
+	int ret;
+
+	if (!req->done)
+		run_active_slot(req->slot);
+	if (req->file)
+		fclose(req->file);
+	curl_slist_free_all(req->range_header);
+
+	/*
+	 * Let the one-at-a-time code path deal with failures, as it
+	 * knows how to ask for credentials.
+	 */
+	if (req->results.curl_result != CURLE_OK) {
+		unlink(req->tmpfile);
+		free(req->tmpfile);
+		return fetch_and_setup_pack_index(packs_head, req->sha1,
+						  base_url);
+	}
+
+	new_pack = parse_pack_index(req->sha1, req->tmpfile);
+	if (!new_pack) {
+		unlink(req->tmpfile);
+		free(req->tmpfile);
+		return -1; /* parse_pack_index() already issued error message */
+	}
+	ret = verify_pack_index(new_pack);
+	if (!ret) {
+		close_pack_index(new_pack);
+		ret = move_temp_to_file(req->tmpfile,
+					sha1_pack_index_name(req->sha1));
+	}
+	free(req->tmpfile);
+	if (ret)
+		return -1;
+
+	new_pack->next = *packs_head;
+	*packs_head = new_pack;
+	return 0;
+}
+
 int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 {
 	struct http_get_options options = {0};
@@ -1424,6 +1584,8 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 	char *url, *data;
 	struct strbuf buf = STRBUF_INIT;
 	unsigned char sha1[20];
+	struct pack_index_request *reqs = NULL;
+	int nr = 0, alloc = 0;
 
 	end_url_with_slash(&buf, base_url);
 	strbuf_addstr(&buf, "objects/info/packs");
@@ -1443,8 +1605,14 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 			    starts_with(data + i, " pack-") &&
 			    starts_with(data + i + 46, ".pack\n")) {
 				get_sha1_hex(data + i + 6, sha1);
-				fetch_and_setup_pack_index(packs_head, sha1,
-						      base_url);
+				if (has_pack_index(sha1))
+					fetch_and_setup_pack_index(packs_head,
+							sha1, base_url);
+				else {
+					ALLOC_GROW(reqs, nr + 1, alloc);
+					memset(&reqs[nr], 0, sizeof(*reqs));
+					hashcpy(reqs[nr++].sha1, sha1);
+				}
 				i += 51;
 				break;
 			}
@@ -1455,6 +1623,16 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 		i++;
 	}
 
+	/*
+	 * get_active_slot() waits for a free slot, so that no more
+	 * than http.maxRequests of these are in flight.
+	 */
+	for (i = 0; i < nr; i++)
+		start_pack_index_request(&reqs[i], base_url);
+	for (i = 0; i < nr; i++)
+		finish_pack_index_request(&reqs[i], packs_head, base_url);
+	free(reqs);
+
 cleanup:
 	free(url);
 	return ret;
@@ -161,6 +161,12 @@ struct http_get_options {
 	 * for details.
 	 */
 	struct strbuf *base_url;
+
+	/*
+	 * If non-NULL, the headers (e.g., "Git-Protocol: version=2") to
+	 * send with the request.
+	 */
+	struct string_list *extra_headers;
 };
 
 /* Return values for http_get_*() */
@@ -178,6 +184,12 @@ struct http_get_options {
  */
 int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_options *options);
 
+/*
+ * Downloads a URL into the given file, resuming an earlier download
+ * left behind in "<filename>.temp".
+ */
+int http_get_file(const char *url, const char *filename, struct http_get_options *options);
+
 extern int http_fetch_ref(const char *base, struct ref *ref);
 
 /* Helpers for fetching packs */
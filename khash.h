@@ -324,4 +324,9 @@ typedef kh_sha1_t khash_sha1;
 KHASH_INIT(sha1_pos, const unsigned char *, int, 1, sha1hash, __kh_oid_cmp)
 typedef kh_sha1_pos_t khash_sha1_pos;
 
+#define __kh_oid_hash(oid) sha1hash((oid).hash)
+#define __kh_oid_equal(a, b) (!oidcmp(&(a), &(b)))
+
+KHASH_INIT(oid_set, struct object_id, int, 0, __kh_oid_hash, __kh_oid_equal)
+
 #endif /* __AC_KHASH_H */
@@ -39,6 +39,17 @@
 #include "kwset.h"
 #include "compat/obstack.h"
 
+/* Vector units every CPU of the architecture has; see pairexec(). */
+#ifndef NO_KWSET_SIMD
+# if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#  include <emmintrin.h>
+#  define KWSET_SSE2
+# elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define KWSET_NEON
+# endif
+#endif
+
 #define NCHAR (UCHAR_MAX + 1)
 #define obstack_chunk_alloc xmalloc
 #define obstack_chunk_free free
@@ -81,6 +92,11 @@ struct kwset
   char *target;			/* Target string if there's only one. */
   int mind2;			/* Used in Boyer-Moore search for one string. */
   unsigned char const *trans;  /* Character translation table. */
+#if defined(KWSET_SSE2) || defined(KWSET_NEON)
+  int pair;			/* Use pairexec() for the single keyword. */
+  unsigned char first[2];	/* Bytes that translate to its first... */
+  unsigned char last[2];	/* ...and its last character. */
+#endif
 };
 
 /* Allocate and initialize a keyword set object, returning an opaque
@@ -112,6 +128,9 @@ kwsalloc (unsigned char const *trans)
   kwset->maxd = -1;
   kwset->target = NULL;
   kwset->trans = trans;
+#if defined(KWSET_SSE2) || defined(KWSET_NEON)
+  kwset->pair = 0;
+#endif
 
   return (kwset_t) kwset;
 }
@@ -373,6 +392,150 @@ treenext (struct tree const *tree, struct trie *next[])
   next[tree->label] = tree->trie;
 }
 
+#if defined(KWSET_SSE2) || defined(KWSET_NEON)
+/* Store in V the (at most two) bytes that translate to C, and return
+   their number, or 0 if there are more. */
+static int
+pairbytes (struct kwset const *kwset, unsigned char c, unsigned char *v)
+{
+  int i, n = 0;
+
+  if (!kwset->trans)
+    {
+      v[0] = v[1] = c;
+      return 1;
+    }
+  for (i = 0; i < NCHAR; ++i)
+    if (U(kwset->trans[i]) == c)
+      {
+	if (n == 2)
+	  return 0;
+	v[n++] = i;
+      }
+  if (n == 1)
+    v[1] = v[0];
+  return n;
+}
+
+/* Set up pairexec() for a set with only one keyword. */
+static const char *
+pairprep (struct kwset *kwset)
+{
+  struct trie *curr;
+  int i;
+
+  if (!kwset->target)
+    {
+      kwset->target = obstack_alloc(&kwset->obstack, kwset->mind);
+      if (!kwset->target)
+	return "memory exhausted";
+      for (i = kwset->mind - 1, curr = kwset->trie; i >= 0; --i)
+	{
+	  kwset->target[i] = curr->links->label;
+	  curr = curr->links->trie;
+	}
+    }
+  if (pairbytes(kwset, U(kwset->target[0]), kwset->first) &&
+      pairbytes(kwset, U(kwset->target[kwset->mind - 1]), kwset->last))
+    kwset->pair = 1;
+  return NULL;
+}
+
+/* Whether the keyword is at TP, given that its first and last
+   characters are. */
+static inline int
+pairverify (struct kwset const *kwset, unsigned char const *tp)
+{
+  unsigned char const *trans = kwset->trans;
+  int i, len = kwset->mind;
+
+  if (!trans)
+    return len < 3 || !memcmp(tp + 1, kwset->target + 1, len - 2);
+  for (i = 1; i < len - 1; ++i)
+    if (U(trans[tp[i]]) != U(kwset->target[i]))
+      return 0;
+  return 1;
+}
+
+/* Search for a single keyword by looking at 16 possible starting
+   positions at once, keeping those where both the first and the last
+   byte can belong to a match, and comparing the rest only there.
+   Unlike Boyer-Moore, this never looks at a byte twice, and case
+   insensitive searches take the same path. */
+static size_t
+pairexec (kwset_t kws, char const *text, size_t size)
+{
+  struct kwset const *kwset = (struct kwset const *) kws;
+  unsigned char const *tp = (unsigned char const *) text;
+  unsigned char const *f = kwset->first, *l = kwset->last;
+  size_t i = 0, end, len = kwset->mind;
+
+  if (len > size)
+    return -1;
+  /* the last possible start of a match, plus one */
+  end = size - len + 1;
+
+#ifdef KWSET_SSE2
+  {
+    __m128i f0 = _mm_set1_epi8(f[0]), f1 = _mm_set1_epi8(f[1]);
+    __m128i l0 = _mm_set1_epi8(l[0]), l1 = _mm_set1_epi8(l[1]);
+
+    for (; i + 16 <= end; i += 16)
+      {
+	__m128i a = _mm_loadu_si128((const __m128i *) (tp + i));
+	__m128i b = _mm_loadu_si128((const __m128i *) (tp + i + len - 1));
+	__m128i m = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(a, f0),
+					       _mm_cmpeq_epi8(a, f1)),
+				  _mm_or_si128(_mm_cmpeq_epi8(b, l0),
+					       _mm_cmpeq_epi8(b, l1)));
+	unsigned int mask = _mm_movemask_epi8(m);
+
+	while (mask)
+	  {
+	    size_t pos = i + __builtin_ctz(mask);
+	    if (pairverify(kwset, tp + pos))
+	      return pos;
+	    mask &= mask - 1;
+	  }
+      }
+  }
+#endif
+#ifdef KWSET_NEON
+  {
+    uint8x16_t f0 = vdupq_n_u8(f[0]), f1 = vdupq_n_u8(f[1]);
+    uint8x16_t l0 = vdupq_n_u8(l[0]), l1 = vdupq_n_u8(l[1]);
+
+    for (; i + 16 <= end; i += 16)
+      {
+	uint8x16_t a = vld1q_u8(tp + i);
+	uint8x16_t b = vld1q_u8(tp + i + len - 1);
+	uint8x16_t m = vandq_u8(vorrq_u8(vceqq_u8(a, f0), vceqq_u8(a, f1)),
+				vorrq_u8(vceqq_u8(b, l0), vceqq_u8(b, l1)));
+	/* four bits for each of the 16 positions */
+	uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+		vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+	while (mask)
+	  {
+	    int bit = __builtin_ctzll(mask);
+	    size_t pos = i + bit / 4;
+	    if (pairverify(kwset, tp + pos))
+	      return pos;
+	    mask &= ~((uint64_t) 0xf << (bit & ~3));
+	  }
+      }
+  }
+#endif
+
+  for (; i < end; ++i)
+    if ((tp[i] == f[0] || tp[i] == f[1])
+	&& (tp[i + len - 1] == l[0] || tp[i + len - 1] == l[1])
+	&& pairverify(kwset, tp + i))
+      return i;
+  return -1;
+}
+#endif
+
 /* Compute the shift for each trie node, as well as the delta
    table and next cache for the given keyword set. */
 const char *
@@ -487,6 +650,12 @@ kwsprep (kwset_t kws)
   else
     memcpy(kwset->delta, delta, NCHAR);
 
+#if defined(KWSET_SSE2) || defined(KWSET_NEON)
+  /* memchr() already is as fast as it gets for a single byte. */
+  if (kwset->words == 1 && (kwset->mind > 1 || kwset->trans))
+    return pairprep(kwset);
+#endif
+
   return NULL;
 }
 
@@ -744,6 +913,19 @@ kwsexec (kwset_t kws, char const *text, size_t size,
 	 struct kwsmatch *kwsmatch)
 {
   struct kwset const *kwset = (struct kwset *) kws;
+#if defined(KWSET_SSE2) || defined(KWSET_NEON)
+  if (kwset->pair)
+    {
+      size_t ret = pairexec (kws, text, size);
+      if (kwsmatch != NULL && ret != (size_t) -1)
+	{
+	  kwsmatch->index = 0;
+	  kwsmatch->offset[0] = ret;
+	  kwsmatch->size[0] = kwset->mind;
+	}
+      return ret;
+    }
+#endif
   if (kwset->words == 1 && kwset->trans == NULL)
     {
       size_t ret = bmexec (kws, text, size);
@@ -25,6 +25,9 @@
    The author may be reached (Email) at the address mike@ai.mit.edu,
    or (US mail) as Mike Haertel c/o Free Software Foundation. */
 
+#ifndef KWSET_H
+#define KWSET_H
+
 struct kwsmatch
 {
   int index;			/* Index number of matching keyword. */
@@ -61,3 +64,4 @@ extern size_t kwsexec(kwset_t, char const *, size_t, struct kwsmatch *);
 /* Deallocate the given keyword set and all its associated storage. */
 extern void kwsfree(kwset_t);
 
+#endif /* KWSET_H */
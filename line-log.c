@@ -14,6 +14,7 @@
 #include "graph.h"
 #include "userdiff.h"
 #include "line-log.h"
+#include "commit-graph.h"
 
 static void range_set_grow(struct range_set *rs, size_t extra)
 {
@@ -824,8 +825,8 @@ static void queue_diffs(struct line_log_data *range,
 	assert(commit);
 
 	DIFF_QUEUE_CLEAR(&diff_queued_diff);
-	diff_tree_sha1(parent ? parent->tree->object.sha1 : NULL,
-			commit->tree->object.sha1, "", opt);
+	diff_tree_sha1(parent ? get_commit_tree_sha1(parent) : NULL,
+			get_commit_tree_sha1(commit), "", opt);
 	if (opt->detect_rename) {
 		filter_diffs_for_paths(range, 1);
 		if (diff_might_be_rename())
@@ -835,6 +836,58 @@ static void queue_diffs(struct line_log_data *range,
 	move_diff_queue(queue, &diff_queued_diff);
 }
 
+static int same_tree_entry(struct commit *commit, struct commit *parent,
+			   const char *path)
+{
+	unsigned char sha1[20], psha1[20];
+	unsigned mode, pmode;
+	int missing, pmissing;
+
+	missing = get_tree_entry(get_commit_tree_sha1(commit), path,
+				 sha1, &mode);
+	pmissing = get_tree_entry(get_commit_tree_sha1(parent), path,
+				  psha1, &pmode);
+	if (missing || pmissing)
+		return missing && pmissing;
+	return !hashcmp(sha1, psha1) && mode == pmode;
+}
+
+/*
+ * Can we tell without diffing the trees that "commit" leaves all the
+ * paths of "range" as they are in "parent"?  Then there is nothing to
+ * queue, and the ranges pass to the parent unchanged.  Most commits
+ * do not touch the file being followed, and for the first parent a
+ * changed-path filter usually says so outright; failing that, looking
+ * up the paths in both trees is still much cheaper than a tree diff,
+ * let alone one with rename detection.
+ */
+static int range_paths_unchanged(struct line_log_data *range,
+				 struct commit *commit, struct commit *parent)
+{
+	const struct bloom_filter_settings *settings = NULL;
+	struct bloom_filter filter;
+	struct line_log_data *rg;
+
+	if (commit->parents && commit->parents->item == parent)
+		settings = get_changed_paths_filter(commit, parent, &filter);
+
+	for (rg = range; rg; rg = rg->next) {
+		if (settings) {
+			struct bloom_key key;
+			int maybe;
+
+			fill_bloom_key(rg->path, strlen(rg->path), &key, settings);
+			maybe = bloom_filter_contains(&filter, &key, settings);
+			clear_bloom_key(&key);
+			if (!maybe)
+				continue;
+		}
+		if (!same_tree_entry(commit, parent, rg->path))
+			return 0;
+	}
+	return 1;
+}
+
 static char *get_nth_line(long line, unsigned long *ends, void *data)
 {
 	if (line == 0)
@@ -1125,6 +1178,11 @@ static int process_ranges_ordinary_commit(struct rev_info *rev, struct commit *c
 	if (commit->parents)
 		parent = commit->parents->item;
 
+	if (parent && range_paths_unchanged(range, commit, parent)) {
+		add_line_range(rev, parent, line_log_data_copy(range));
+		return 0;
+	}
+
 	queue_diffs(range, &rev->diffopt, &queue, commit, parent);
 	changed = process_all_files(&parent_range, rev, &queue, range);
 	if (parent)
@@ -1145,7 +1203,7 @@ static int process_ranges_merge_commit(struct rev_info *rev, struct commit *comm
 	if (nparents > 1 && rev->first_parent_only)
 		nparents = 1;
 
-	diffqueues = xmalloc(nparents * sizeof(*diffqueues));
+	diffqueues = xcalloc(nparents, sizeof(*diffqueues));
 	cand = xmalloc(nparents * sizeof(*cand));
 	parents = xmalloc(nparents * sizeof(*parents));
 
@@ -1153,13 +1211,21 @@ static int process_ranges_merge_commit(struct rev_info *rev, struct commit *comm
 	for (i = 0; i < nparents; i++) {
 		parents[i] = p->item;
 		p = p->next;
-		queue_diffs(range, &rev->diffopt, &diffqueues[i], commit, parents[i]);
 	}
 
 	for (i = 0; i < nparents; i++) {
 		int changed;
 		cand[i] = NULL;
-		changed = process_all_files(&cand[i], rev, &diffqueues[i], range);
+		/* the diffs to later parents are not needed if this one takes all */
+		if (range_paths_unchanged(range, commit, parents[i])) {
+			cand[i] = line_log_data_copy(range);
+			changed = 0;
+		} else {
+			queue_diffs(range, &rev->diffopt, &diffqueues[i],
+				    commit, parents[i]);
+			changed = process_all_files(&cand[i], rev,
+						    &diffqueues[i], range);
+		}
 		if (!changed) {
 			/*
 			 * This parent can take all the blame, so we
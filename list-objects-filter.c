@@ -0,0 +1,53 @@
+#include "cache.h"
+#include "parse-options.h"
+#include "list-objects-filter.h"
+
+int parse_list_objects_filter(struct list_objects_filter_options *filter_options,
+			      const char *arg)
+{
+	const char *v0;
+
+	list_objects_filter_release(filter_options);
+
+	if (!strcmp(arg, "blob:none")) {
+		filter_options->choice = LOFC_BLOB_NONE;
+	} else if (skip_prefix(arg, "blob:limit=", &v0)) {
+		if (!git_parse_ulong(v0, &filter_options->blob_limit_value))
+			return error(_("invalid blob size limit in filter '%s'"),
+				     arg);
+		filter_options->choice = LOFC_BLOB_LIMIT;
+	} else if (skip_prefix(arg, "tree:", &v0)) {
+		char *end;
+
+		if (!isdigit(*v0))
+			return error(_("invalid tree depth in filter '%s'"), arg);
+		errno = 0;
+		filter_options->tree_exclude_depth = strtoul(v0, &end, 10);
+		if (*end || errno)
+			return error(_("invalid tree depth in filter '%s'"), arg);
+		filter_options->choice = LOFC_TREE_DEPTH;
+	} else {
+		return error(_("invalid filter-spec '%s'"), arg);
+	}
+
+	filter_options->filter_spec = xstrdup(arg);
+	return 0;
+}
+
+void list_objects_filter_release(struct list_objects_filter_options *filter_options)
+{
+	free(filter_options->filter_spec);
+	memset(filter_options, 0, sizeof(*filter_options));
+}
+
+int opt_parse_list_objects_filter(const struct option *opt,
+				  const char *arg, int unset)
+{
+	struct list_objects_filter_options *filter_options = opt->value;
+
+	if (unset || !arg) {
+		list_objects_filter_release(filter_options);
+		return 0;
+	}
+	return parse_list_objects_filter(filter_options, arg);
+}
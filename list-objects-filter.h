@@ -0,0 +1,60 @@
+#ifndef LIST_OBJECTS_FILTER_H
+#define LIST_OBJECTS_FILTER_H
+
+/*
+ * Object filters let "rev-list --objects" and pack-objects leave out
+ * trees and blobs, so that a client can ask for the history of a
+ * repository without (all of) its contents.  The filter is given as a
+ * <filter-spec> string, which is passed on unchanged between client
+ * and server:
+ *
+ *   blob:none         omit all blobs
+ *   blob:limit=<n>    omit blobs of <n> bytes or more (<n> may end
+ *                     in "k", "m" or "g")
+ *   tree:<depth>      omit trees and blobs <depth> or more levels
+ *                     below the root tree; "tree:0" omits all of them
+ *
+ * Blobs named directly (rather than reached from a tree) are never
+ * filtered out.
+ */
+
+struct option;
+
+enum list_objects_filter_choice {
+	LOFC_DISABLED = 0,
+	LOFC_BLOB_NONE,
+	LOFC_BLOB_LIMIT,
+	LOFC_TREE_DEPTH
+};
+
+struct list_objects_filter_options {
+	/*
+	 * The <filter-spec> as given by the user, to be passed on to
+	 * the server or to pack-objects; NULL when filtering is off.
+	 */
+	char *filter_spec;
+
+	enum list_objects_filter_choice choice;
+	unsigned long blob_limit_value;
+	unsigned long tree_exclude_depth;
+};
+
+/*
+ * Parse a <filter-spec> into "filter_options"; returns -1 with an
+ * error message if it is not understood.
+ */
+extern int parse_list_objects_filter(struct list_objects_filter_options *filter_options,
+				     const char *arg);
+
+extern void list_objects_filter_release(struct list_objects_filter_options *filter_options);
+
+/* parse-options callback for "--filter=<filter-spec>" and "--no-filter" */
+extern int opt_parse_list_objects_filter(const struct option *opt,
+					 const char *arg, int unset);
+
+#define OPT_PARSE_LIST_OBJECTS_FILTER(fo) \
+	{ OPTION_CALLBACK, 0, "filter", (fo), N_("filter-spec"), \
+	  N_("omit objects from the transfer"), 0, \
+	  opt_parse_list_objects_filter }
+
+#endif
@@ -7,24 +7,104 @@
 #include "tree-walk.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
+#include "hashmap.h"
 
-static void process_blob(struct rev_info *revs,
+struct traversal_context {
+	struct rev_info *revs;
+	show_object_fn show_object;
+	void *show_data;
+	struct list_objects_filter_options *filter;
+	/* for "tree:<depth>", the shallowest depth each tree was seen at */
+	struct hashmap tree_depth;
+};
+
+struct tree_depth_entry {
+	struct hashmap_entry ent;
+	unsigned char sha1[20];
+	unsigned long depth;
+};
+
+static int tree_depth_entry_cmp(const struct tree_depth_entry *a,
+				const struct tree_depth_entry *b,
+				const void *unused)
+{
+	return hashcmp(a->sha1, b->sha1);
+}
+
+/*
+ * Should the blob, "depth" levels below the root tree, be left out
+ * of the traversal?  Blobs named on the command line (depth 0) never
+ * are.
+ */
+static int filter_omits_blob(struct traversal_context *ctx,
+			     struct blob *blob, unsigned long depth)
+{
+	unsigned long size;
+
+	if (!ctx->filter || !depth)
+		return 0;
+
+	switch (ctx->filter->choice) {
+	case LOFC_BLOB_NONE:
+		return 1;
+	case LOFC_BLOB_LIMIT:
+		/* a blob we cannot size is left for the caller to find */
+		if (sha1_object_info(blob->object.sha1, &size) < 0)
+			return 0;
+		return size >= ctx->filter->blob_limit_value;
+	case LOFC_TREE_DEPTH:
+		return depth >= ctx->filter->tree_exclude_depth;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * With a "tree:<depth>" filter, a tree may first be reached too deep
+ * for some of its entries to be shown, and later again closer to the
+ * root.  Return 1 if the tree has to be walked (again) at "depth".
+ */
+static int tree_depth_needs_walk(struct traversal_context *ctx,
+				 struct tree *tree, unsigned long depth)
+{
+	struct tree_depth_entry key, *e;
+
+	hashcpy(key.sha1, tree->object.sha1);
+	hashmap_entry_init(&key, sha1hash(key.sha1));
+	e = hashmap_get(&ctx->tree_depth, &key, NULL);
+	if (e) {
+		if (e->depth <= depth)
+			return 0;
+		e->depth = depth;
+		return 1;
+	}
+	e = xmalloc(sizeof(*e));
+	hashcpy(e->sha1, tree->object.sha1);
+	hashmap_entry_init(e, sha1hash(e->sha1));
+	e->depth = depth;
+	hashmap_add(&ctx->tree_depth, e);
+	return 1;
+}
+
+static void process_blob(struct traversal_context *ctx,
 			 struct blob *blob,
-			 show_object_fn show,
 			 struct name_path *path,
 			 const char *name,
-			 void *cb_data)
+			 unsigned long depth)
 {
 	struct object *obj = &blob->object;
 
-	if (!revs->blob_objects)
+	if (!ctx->revs->blob_objects)
 		return;
 	if (!obj)
 		die("bad blob object");
 	if (obj->flags & (UNINTERESTING | SEEN))
 		return;
+	if (filter_omits_blob(ctx, blob, depth))
+		return;
 	obj->flags |= SEEN;
-	show(obj, path, name, cb_data);
+	ctx->show_object(obj, path, name, ctx->show_data);
 }
 
 /*
@@ -49,24 +129,24 @@ static void process_blob(struct rev_info *revs,
  * the link, and how to do it. Whether it necessarily makes
  * any sense what-so-ever to ever do that is another issue.
  */
-static void process_gitlink(struct rev_info *revs,
+static void process_gitlink(struct traversal_context *ctx,
 			    const unsigned char *sha1,
-			    show_object_fn show,
 			    struct name_path *path,
-			    const char *name,
-			    void *cb_data)
+			    const char *name)
 {
 	/* Nothing to do */
 }
 
-static void process_tree(struct rev_info *revs,
+#define LOOKUP_BATCH 16
+
+static void process_tree(struct traversal_context *ctx,
 			 struct tree *tree,
-			 show_object_fn show,
 			 struct name_path *path,
 			 struct strbuf *base,
 			 const char *name,
-			 void *cb_data)
+			 unsigned long depth)
 {
+	struct rev_info *revs = ctx->revs;
 	struct object *obj = &tree->object;
 	struct tree_desc desc;
 	struct name_entry entry;
@@ -74,20 +154,38 @@ static void process_tree(struct rev_info *revs,
 	enum interesting match = revs->diffopt.pathspec.nr == 0 ?
 		all_entries_interesting: entry_not_interesting;
 	int baselen = base->len;
+	int by_depth = ctx->filter &&
+		ctx->filter->choice == LOFC_TREE_DEPTH;
 
 	if (!revs->tree_objects)
 		return;
 	if (!obj)
 		die("bad tree object");
-	if (obj->flags & (UNINTERESTING | SEEN))
+	if (obj->flags & UNINTERESTING)
+		return;
+	if (by_depth) {
+		if (depth >= ctx->filter->tree_exclude_depth ||
+		    !tree_depth_needs_walk(ctx, tree, depth))
+			return;
+	} else if (obj->flags & SEEN)
 		return;
-	if (parse_tree_gently(tree, revs->ignore_missing_links) < 0) {
+	if (parse_tree_gently(tree, revs->ignore_missing_links ||
+				    revs->do_not_die_on_missing_tree) < 0) {
 		if (revs->ignore_missing_links)
 			return;
-		die("bad tree object %s", sha1_to_hex(obj->sha1));
+		if (!revs->do_not_die_on_missing_tree)
+			die("bad tree object %s", sha1_to_hex(obj->sha1));
+		/* let the caller decide what a missing tree means */
+		if (!(obj->flags & SEEN)) {
+			obj->flags |= SEEN;
+			ctx->show_object(obj, path, name, ctx->show_data);
+		}
+		return;
+	}
+	if (!(obj->flags & SEEN)) {
+		obj->flags |= SEEN;
+		ctx->show_object(obj, path, name, ctx->show_data);
 	}
-	obj->flags |= SEEN;
-	show(obj, path, name, cb_data);
 	me.up = path;
 	me.elem = name;
 	me.elem_len = strlen(name);
@@ -100,31 +198,57 @@ static void process_tree(struct rev_info *revs,
 
 	init_tree_desc(&desc, tree->buffer, tree->size);
 
-	while (tree_entry(&desc, &entry)) {
-		if (match != all_entries_interesting) {
-			match = tree_entry_interesting(&entry, base, 0,
-						       &revs->diffopt.pathspec);
-			if (match == all_entries_not_interesting)
-				break;
-			if (match == entry_not_interesting)
-				continue;
+	/*
+	 * Look the entries up in batches, so that the cache misses in
+	 * the object hash overlap.
+	 */
+	do {
+		struct name_entry batch[LOOKUP_BATCH];
+		const unsigned char *sha1[LOOKUP_BATCH];
+		struct object *found[LOOKUP_BATCH];
+		int i, nr = 0;
+
+		while (nr < LOOKUP_BATCH && tree_entry(&desc, &entry)) {
+			if (match != all_entries_interesting) {
+				match = tree_entry_interesting(&entry, base, 0,
+							       &revs->diffopt.pathspec);
+				if (match == all_entries_not_interesting)
+					break;
+				if (match == entry_not_interesting)
+					continue;
+			}
+			batch[nr] = entry;
+			sha1[nr++] = entry.sha1;
 		}
+		lookup_object_batch(sha1, found, nr);
 
-		if (S_ISDIR(entry.mode))
-			process_tree(revs,
-				     lookup_tree(entry.sha1),
-				     show, &me, base, entry.path,
-				     cb_data);
-		else if (S_ISGITLINK(entry.mode))
-			process_gitlink(revs, entry.sha1,
-					show, &me, entry.path,
-					cb_data);
-		else
-			process_blob(revs,
-				     lookup_blob(entry.sha1),
-				     show, &me, entry.path,
-				     cb_data);
-	}
+		for (i = 0; i < nr; i++) {
+			struct name_entry *e = &batch[i];
+
+			/*
+			 * What was not found may have been created by
+			 * the walk since; lookup_tree() and lookup_blob()
+			 * look again.
+			 */
+			if (S_ISDIR(e->mode))
+				process_tree(ctx,
+					     found[i] ?
+					     object_as_type(found[i], OBJ_TREE, 0) :
+					     lookup_tree(e->sha1),
+					     &me, base, e->path, depth + 1);
+			else if (S_ISGITLINK(e->mode))
+				process_gitlink(ctx, e->sha1,
+						&me, e->path);
+			else
+				process_blob(ctx,
+					     found[i] ?
+					     object_as_type(found[i], OBJ_BLOB, 0) :
+					     lookup_blob(e->sha1),
+					     &me, e->path, depth + 1);
+		}
+		if (nr < LOOKUP_BATCH)
+			break;
+	} while (match != all_entries_not_interesting);
 	strbuf_setlen(base, baselen);
 	free_tree_buffer(tree);
 }
@@ -139,7 +263,7 @@ static void mark_edge_parents_uninteresting(struct commit *commit,
 		struct commit *parent = parents->item;
 		if (!(parent->object.flags & UNINTERESTING))
 			continue;
-		mark_tree_uninteresting(parent->tree);
+		mark_tree_uninteresting(get_commit_tree(parent));
 		if (revs->edge_hint && !(parent->object.flags & SHOWN)) {
 			parent->object.flags |= SHOWN;
 			show_edge(parent);
@@ -156,7 +280,7 @@ void mark_edges_uninteresting(struct rev_info *revs, show_edge_fn show_edge)
 		struct commit *commit = list->item;
 
 		if (commit->object.flags & UNINTERESTING) {
-			mark_tree_uninteresting(commit->tree);
+			mark_tree_uninteresting(get_commit_tree(commit));
 			if (revs->edge_hint_aggressive && !(commit->object.flags & SHOWN)) {
 				commit->object.flags |= SHOWN;
 				show_edge(commit);
@@ -171,7 +295,7 @@ void mark_edges_uninteresting(struct rev_info *revs, show_edge_fn show_edge)
 			struct commit *commit = (struct commit *)obj;
 			if (obj->type != OBJ_COMMIT || !(obj->flags & UNINTERESTING))
 				continue;
-			mark_tree_uninteresting(commit->tree);
+			mark_tree_uninteresting(get_commit_tree(commit));
 			if (!(obj->flags & SHOWN)) {
 				obj->flags |= SHOWN;
 				show_edge(commit);
@@ -185,14 +309,22 @@ static void add_pending_tree(struct rev_info *revs, struct tree *tree)
 	add_pending_object(revs, &tree->object, "");
 }
 
-void traverse_commit_list(struct rev_info *revs,
-			  show_commit_fn show_commit,
-			  show_object_fn show_object,
-			  void *data)
+void traverse_commit_list_filtered(struct list_objects_filter_options *filter,
+				   struct rev_info *revs,
+				   show_commit_fn show_commit,
+				   show_object_fn show_object,
+				   void *data)
 {
 	int i;
 	struct commit *commit;
 	struct strbuf base;
+	struct traversal_context ctx;
+
+	ctx.revs = revs;
+	ctx.show_object = show_object;
+	ctx.show_data = data;
+	ctx.filter = filter && filter->choice ? filter : NULL;
+	hashmap_init(&ctx.tree_depth, (hashmap_cmp_fn)tree_depth_entry_cmp, 0);
 
 	strbuf_init(&base, PATH_MAX);
 	while ((commit = get_revision(revs)) != NULL) {
@@ -200,8 +332,8 @@ void traverse_commit_list(struct rev_info *revs,
 		 * an uninteresting boundary commit may not have its tree
 		 * parsed yet, but we are not going to show them anyway
 		 */
-		if (commit->tree)
-			add_pending_tree(revs, commit->tree);
+		if (get_commit_tree(commit))
+			add_pending_tree(revs, get_commit_tree(commit));
 		show_commit(commit, data);
 	}
 	for (i = 0; i < revs->pending.nr; i++) {
@@ -209,7 +341,9 @@ void traverse_commit_list(struct rev_info *revs,
 		struct object *obj = pending->item;
 		const char *name = pending->name;
 		const char *path = pending->path;
-		if (obj->flags & (UNINTERESTING | SEEN))
+		if (obj->flags & (UNINTERESTING | SEEN) &&
+		    !(obj->type == OBJ_TREE && ctx.filter &&
+		      ctx.filter->choice == LOFC_TREE_DEPTH))
 			continue;
 		if (obj->type == OBJ_TAG) {
 			obj->flags |= SEEN;
@@ -219,13 +353,13 @@ void traverse_commit_list(struct rev_info *revs,
 		if (!path)
 			path = "";
 		if (obj->type == OBJ_TREE) {
-			process_tree(revs, (struct tree *)obj, show_object,
-				     NULL, &base, path, data);
+			process_tree(&ctx, (struct tree *)obj,
+				     NULL, &base, path, 0);
 			continue;
 		}
 		if (obj->type == OBJ_BLOB) {
-			process_blob(revs, (struct blob *)obj, show_object,
-				     NULL, path, data);
+			process_blob(&ctx, (struct blob *)obj,
+				     NULL, path, 0);
 			continue;
 		}
 		die("unknown pending object %s (%s)",
@@ -233,4 +367,14 @@ void traverse_commit_list(struct rev_info *revs,
 	}
 	object_array_clear(&revs->pending);
 	strbuf_release(&base);
+	hashmap_free(&ctx.tree_depth, 1);
+}
+
+void traverse_commit_list(struct rev_info *revs,
+			  show_commit_fn show_commit,
+			  show_object_fn show_object,
+			  void *data)
+{
+	traverse_commit_list_filtered(NULL, revs, show_commit,
+				      show_object, data);
 }
@@ -5,6 +5,15 @@ typedef void (*show_commit_fn)(struct commit *, void *);
 typedef void (*show_object_fn)(struct object *, const struct name_path *, const char *, void *);
 void traverse_commit_list(struct rev_info *, show_commit_fn, show_object_fn, void *);
 
+/*
+ * Like traverse_commit_list(), but leave out the trees and blobs the
+ * filter (if any) says to omit; see list-objects-filter.h.
+ */
+struct list_objects_filter_options;
+void traverse_commit_list_filtered(struct list_objects_filter_options *,
+				   struct rev_info *, show_commit_fn,
+				   show_object_fn, void *);
+
 typedef void (*show_edge_fn)(struct commit *);
 void mark_edges_uninteresting(struct rev_info *, show_edge_fn);
 
@@ -34,6 +34,33 @@ struct ll_merge_driver {
 /*
  * Built-in low-levels
  */
+
+/*
+ * Which side a binary merge takes as its result: 0 for the common
+ * ancestor, 1 for ours, 2 for theirs.
+ */
+static int binary_merge_pick(const char *path,
+			     const char *name1, const char *name2,
+			     const struct ll_merge_options *opts)
+{
+	/*
+	 * The tentative merge result is the or common ancestor for an internal merge.
+	 */
+	if (opts->virtual_ancestor)
+		return 0;
+
+	switch (opts->variant) {
+	default:
+		warning("Cannot merge binary files: %s (%s vs. %s)",
+			path, name1, name2);
+		/* fallthru */
+	case XDL_MERGE_FAVOR_OURS:
+		return 1;
+	case XDL_MERGE_FAVOR_THEIRS:
+		return 2;
+	}
+}
+
 static int ll_binary_merge(const struct ll_merge_driver *drv_unused,
 			   mmbuffer_t *result,
 			   const char *path,
@@ -43,28 +70,14 @@ static int ll_binary_merge(const struct ll_merge_driver *drv_unused,
 			   const struct ll_merge_options *opts,
 			   int marker_size)
 {
+	mmfile_t *side[3];
 	mmfile_t *stolen;
 	assert(opts);
 
-	/*
-	 * The tentative merge result is the or common ancestor for an internal merge.
-	 */
-	if (opts->virtual_ancestor) {
-		stolen = orig;
-	} else {
-		switch (opts->variant) {
-		default:
-			warning("Cannot merge binary files: %s (%s vs. %s)",
-				path, name1, name2);
-			/* fallthru */
-		case XDL_MERGE_FAVOR_OURS:
-			stolen = src1;
-			break;
-		case XDL_MERGE_FAVOR_THEIRS:
-			stolen = src2;
-			break;
-		}
-	}
+	side[0] = orig;
+	side[1] = src1;
+	side[2] = src2;
+	stolen = side[binary_merge_pick(path, name1, name2, opts)];
 
 	result->ptr = stolen->ptr;
 	result->size = stolen->size;
@@ -350,6 +363,78 @@ static void normalize_file(mmfile_t *mm, const char *path)
 	}
 }
 
+static const struct ll_merge_driver *find_ll_merge_driver_for_path(
+		const char *path, const struct ll_merge_options *opts,
+		int *marker_size)
+{
+	static struct git_attr_check check[2];
+	const char *ll_driver_name = NULL;
+	const struct ll_merge_driver *driver;
+
+	*marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	if (!git_path_check_merge(path, check)) {
+		ll_driver_name = check[0].value;
+		if (check[1].value) {
+			*marker_size = atoi(check[1].value);
+			if (*marker_size <= 0)
+				*marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+		}
+	}
+	driver = find_ll_merge_driver(ll_driver_name);
+	if (opts->virtual_ancestor && driver->recursive)
+		driver = find_ll_merge_driver(driver->recursive);
+	return driver;
+}
+
+static int large_blob_is_binary(const unsigned char *sha1, int *large)
+{
+	unsigned long size;
+
+	if (sha1_object_info(sha1, &size) != OBJ_BLOB ||
+	    size <= big_file_threshold)
+		return 0;
+	*large = 1;
+	return blob_is_binary(sha1);
+}
+
+int ll_merge_binary_sha1(unsigned char *result,
+			 const char *path,
+			 const unsigned char *ancestor,
+			 const unsigned char *ours, const char *our_label,
+			 const unsigned char *theirs, const char *their_label,
+			 const struct ll_merge_options *opts)
+{
+	const struct ll_merge_driver *driver;
+	const unsigned char *side[3];
+	int marker_size, large = 0;
+
+	/* a missing side reads as an empty blob, which may not exist yet */
+	if (opts->renormalize ||
+	    is_null_sha1(ancestor) || is_null_sha1(ours) || is_null_sha1(theirs))
+		return -1;
+	driver = find_ll_merge_driver_for_path(path, opts, &marker_size);
+	if (driver->fn == ll_xdl_merge) {
+		/*
+		 * The text driver falls back to a binary merge when any
+		 * side looks binary; peek at the sides only when one of
+		 * them is too large to be worth reading in the first place.
+		 */
+		int binary = large_blob_is_binary(ancestor, &large);
+		binary |= large_blob_is_binary(ours, &large);
+		binary |= large_blob_is_binary(theirs, &large);
+		if (!large || !binary)
+			return -1;
+	} else if (driver->fn != ll_binary_merge)
+		return -1;
+
+	side[0] = ancestor;
+	side[1] = ours;
+	side[2] = theirs;
+	hashcpy(result, side[binary_merge_pick(path, our_label, their_label,
+					       opts)]);
+	return opts->variant ? 0 : 1;
+}
+
 int ll_merge(mmbuffer_t *result_buf,
 	     const char *path,
 	     mmfile_t *ancestor, const char *ancestor_label,
@@ -357,10 +442,8 @@ int ll_merge(mmbuffer_t *result_buf,
 	     mmfile_t *theirs, const char *their_label,
 	     const struct ll_merge_options *opts)
 {
-	static struct git_attr_check check[2];
 	static const struct ll_merge_options default_opts;
-	const char *ll_driver_name = NULL;
-	int marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
+	int marker_size;
 	const struct ll_merge_driver *driver;
 
 	if (!opts)
@@ -371,17 +454,7 @@ int ll_merge(mmbuffer_t *result_buf,
 		normalize_file(ours, path);
 		normalize_file(theirs, path);
 	}
-	if (!git_path_check_merge(path, check)) {
-		ll_driver_name = check[0].value;
-		if (check[1].value) {
-			marker_size = atoi(check[1].value);
-			if (marker_size <= 0)
-				marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
-		}
-	}
-	driver = find_ll_merge_driver(ll_driver_name);
-	if (opts->virtual_ancestor && driver->recursive)
-		driver = find_ll_merge_driver(driver->recursive);
+	driver = find_ll_merge_driver_for_path(path, opts, &marker_size);
 	return driver->fn(driver, result_buf, path, ancestor, ancestor_label,
 			  ours, our_label, theirs, their_label,
 			  opts, marker_size);
@@ -19,6 +19,20 @@ int ll_merge(mmbuffer_t *result_buf,
 	     mmfile_t *theirs, const char *their_label,
 	     const struct ll_merge_options *opts);
 
+/*
+ * When ll_merge() of these blobs would take one side of them whole,
+ * as a binary merge does, store the object name of that side in
+ * "result" and return what ll_merge() would, without reading the
+ * blobs; otherwise return -1.  Large blobs are only peeked at to
+ * tell whether they are binary.
+ */
+int ll_merge_binary_sha1(unsigned char *result,
+			 const char *path,
+			 const unsigned char *ancestor,
+			 const unsigned char *ours, const char *our_label,
+			 const unsigned char *theirs, const char *their_label,
+			 const struct ll_merge_options *opts);
+
 int ll_merge_marker_size(const char *path);
 
 #endif
@@ -11,8 +11,12 @@
 #include "gpg-interface.h"
 #include "sequencer.h"
 #include "line-log.h"
+#include "diffstat-pipeline.h"
+#include "object-slab.h"
 
-static struct decoration name_decoration = { "object names" };
+define_object_slab(name_decorations, struct name_decoration *);
+static struct name_decorations name_decorations =
+	OBJECT_SLAB_INIT(1, name_decorations);
 static int decoration_loaded;
 static int decoration_flags;
 
@@ -79,14 +83,20 @@ void add_name_decoration(enum decoration_type type, const char *name, struct obj
 {
 	int nlen = strlen(name);
 	struct name_decoration *res = xmalloc(sizeof(*res) + nlen + 1);
+	struct name_decoration **head;
+
 	memcpy(res->name, name, nlen + 1);
 	res->type = type;
-	res->next = add_decoration(&name_decoration, obj, res);
+	head = name_decorations_at(&name_decorations, obj);
+	res->next = *head;
+	*head = res;
 }
 
 const struct name_decoration *get_name_decoration(const struct object *obj)
 {
-	return lookup_decoration(&name_decoration, obj);
+	struct name_decoration **head =
+		name_decorations_peek(&name_decorations, obj);
+	return head ? *head : NULL;
 }
 
 static int add_ref_decoration(const char *refname, const struct object_id *oid,
@@ -651,7 +661,11 @@ void show_log(struct rev_info *opt)
 		show_mergetag(opt, commit);
 	}
 
-	if (!get_cached_commit_buffer(commit, NULL))
+	/*
+	 * Commits parsed from the commit-graph have no cached buffer yet;
+	 * only bail out if the buffer was deliberately not kept.
+	 */
+	if (!save_commit_buffer && !get_cached_commit_buffer(commit, NULL))
 		return;
 
 	if (opt->show_notes) {
@@ -801,7 +815,7 @@ static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log
 		return 0;
 
 	parse_commit_or_die(commit);
-	sha1 = commit->tree->object.sha1;
+	sha1 = get_commit_tree_sha1(commit);
 
 	/* Root commit? */
 	parents = get_saved_parents(opt, commit);
@@ -826,7 +840,7 @@ static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log
 			 * we merged _in_.
 			 */
 			parse_commit_or_die(parents->item);
-			diff_tree_sha1(parents->item->tree->object.sha1,
+			diff_tree_sha1(get_commit_tree_sha1(parents->item),
 				       sha1, "", &opt->diffopt);
 			log_tree_diff_flush(opt);
 			return !opt->loginfo;
@@ -841,7 +855,7 @@ static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log
 		struct commit *parent = parents->item;
 
 		parse_commit_or_die(parent);
-		diff_tree_sha1(parent->tree->object.sha1,
+		diff_tree_sha1(get_commit_tree_sha1(parent),
 			       sha1, "", &opt->diffopt);
 		log_tree_diff_flush(opt);
 
@@ -857,6 +871,56 @@ static int log_tree_diff(struct rev_info *opt, struct commit *commit, struct log
 	return showed_log;
 }
 
+static void prefetch_tree_diffstat(const unsigned char *old,
+				   const unsigned char *new,
+				   struct diff_options *diffopt, unsigned seq)
+{
+	if (old)
+		diff_tree_sha1(old, new, "", diffopt);
+	else
+		diff_root_tree_sha1(new, "", diffopt);
+	diff_prefetch_diffstat(diffopt, seq);
+	diff_flush(diffopt);
+}
+
+void prefetch_log_tree_diffstat(struct rev_info *opt, struct commit *commit,
+				unsigned seq)
+{
+	struct diff_options diffopt;
+	struct commit_list *parents;
+	const unsigned char *sha1;
+
+	if (!opt->diff || !diffstat_pipeline_active())
+		return;
+
+	/*
+	 * Find the same tree changes log_tree_diff() will, but without
+	 * any output nor diffcore transformations; pairs that renames or
+	 * breaks change are simply counted when they are shown.
+	 */
+	diffopt = opt->diffopt;
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diffopt.close_file = 0;
+
+	parse_commit_or_die(commit);
+	sha1 = get_commit_tree_sha1(commit);
+	parents = get_saved_parents(opt, commit);
+	if (!parents) {
+		if (opt->show_root_diff)
+			prefetch_tree_diffstat(NULL, sha1, &diffopt, seq);
+		return;
+	}
+	if (parents->next && (opt->ignore_merges || opt->combine_merges))
+		return;
+	for (; parents; parents = parents->next) {
+		parse_commit_or_die(parents->item);
+		prefetch_tree_diffstat(get_commit_tree_sha1(parents->item),
+				       sha1, &diffopt, seq);
+		if (opt->first_parent_only)
+			break;
+	}
+}
+
 int log_tree_commit(struct rev_info *opt, struct commit *commit)
 {
 	struct log_info log;
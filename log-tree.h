@@ -11,6 +11,12 @@ int parse_decorate_color_config(const char *var, const char *slot_name, const ch
 void init_log_tree_opt(struct rev_info *);
 int log_tree_diff_flush(struct rev_info *);
 int log_tree_commit(struct rev_info *, struct commit *);
+/*
+ * Let the diffstat pipeline start counting the lines log_tree_commit()
+ * will need for "commit", which is going to be shown as the "seq"-th
+ * commit.
+ */
+void prefetch_log_tree_diffstat(struct rev_info *, struct commit *, unsigned seq);
 int log_tree_opt_parse(struct rev_info *, const char **, int);
 void show_log(struct rev_info *opt);
 void format_decorations_extended(struct strbuf *sb, const struct commit *commit,
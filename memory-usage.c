@@ -0,0 +1,163 @@
+/*
+ * Accounting of the memory held by the larger in-core structures:
+ * object nodes, the object hash, pack windows, the delta base cache,
+ * the index and the ref cache.  With GIT_TRACE_MEMORY set, the usage
+ * and high-water mark of each is traced when the process exits and,
+ * with GIT_TRACE_MEMORY_INTERVAL=<seconds>, periodically while it runs.
+ * Samples are taken when a new object slab or pack window is allocated,
+ * i.e. while memory usage grows, and at most once per interval.
+ */
+#include "cache.h"
+#include "object.h"
+#include "refs.h"
+
+static struct trace_key trace_memory = TRACE_KEY_INIT(MEMORY);
+
+enum memory_subsystem {
+	MEM_OBJECTS,
+	MEM_OBJ_HASH,
+	MEM_PACK_WINDOWS,
+	MEM_DELTA_BASE_CACHE,
+	MEM_INDEX,
+	MEM_REF_CACHE,
+	MEM_NR
+};
+
+static const char *subsystem_name[MEM_NR] = {
+	"objects",
+	"obj_hash",
+	"pack_windows",
+	"delta_base_cache",
+	"index",
+	"ref_cache",
+};
+
+/*
+ * Peaks of the subsystems that do not track their own; they are only
+ * as accurate as the sampling.
+ */
+static size_t sampled_peak[MEM_NR];
+
+static int sample_interval = -1;
+static uint64_t next_sample;
+
+static size_t index_memory_usage(const struct index_state *istate)
+{
+	size_t size = istate->cache_alloc * sizeof(*istate->cache);
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		size += ce_size(istate->cache[i]);
+	return size;
+}
+
+static void get_memory_usage(size_t *cur, size_t *peak)
+{
+	struct delta_base_cache_stats dbc;
+	int i;
+
+	cur[MEM_OBJECTS] = alloc_memory_usage(&peak[MEM_OBJECTS]);
+	cur[MEM_OBJ_HASH] = get_max_object_index() * sizeof(struct object *);
+	cur[MEM_PACK_WINDOWS] = pack_window_usage(&peak[MEM_PACK_WINDOWS]);
+	get_delta_base_cache_stats(&dbc);
+	cur[MEM_DELTA_BASE_CACHE] = dbc.cached;
+	cur[MEM_INDEX] = index_memory_usage(&the_index);
+	cur[MEM_REF_CACHE] = ref_cache_memory_usage(&peak[MEM_REF_CACHE]);
+
+	for (i = 0; i < MEM_NR; i++) {
+		if (sampled_peak[i] < cur[i])
+			sampled_peak[i] = cur[i];
+		if (i == MEM_OBJ_HASH || i == MEM_DELTA_BASE_CACHE ||
+		    i == MEM_INDEX)
+			peak[i] = sampled_peak[i];
+	}
+}
+
+/*
+ * Read the resident set size and its high-water mark of the whole
+ * process, in kB.  Only Linux exposes them this way; elsewhere they
+ * are simply not reported.
+ */
+static int get_process_rss(uintmax_t *rss, uintmax_t *hwm)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *p;
+	int found = 0;
+
+	if (strbuf_read_file(&buf, "/proc/self/status", 0) < 0) {
+		strbuf_release(&buf);
+		return -1;
+	}
+	p = strstr(buf.buf, "\nVmRSS:");
+	if (p) {
+		*rss = strtoumax(p + strlen("\nVmRSS:"), NULL, 10);
+		found++;
+	}
+	p = strstr(buf.buf, "\nVmHWM:");
+	if (p) {
+		*hwm = strtoumax(p + strlen("\nVmHWM:"), NULL, 10);
+		found++;
+	}
+	strbuf_release(&buf);
+	return found == 2 ? 0 : -1;
+}
+
+void trace_memory_usage(const char *when)
+{
+	size_t cur[MEM_NR], peak[MEM_NR];
+	uintmax_t rss, hwm;
+	int i;
+
+	if (!trace_want(&trace_memory))
+		return;
+
+	get_memory_usage(cur, peak);
+	for (i = 0; i < MEM_NR; i++) {
+		trace_printf_key(&trace_memory,
+				 "memory: %s: %-16s %10"PRIuMAX" kB"
+				 " (peak %"PRIuMAX" kB)\n",
+				 when, subsystem_name[i],
+				 (uintmax_t)cur[i] >> 10,
+				 (uintmax_t)peak[i] >> 10);
+		trace_counter("memory", subsystem_name[i], cur[i]);
+	}
+	if (!get_process_rss(&rss, &hwm)) {
+		trace_printf_key(&trace_memory,
+				 "memory: %s: %-16s %10"PRIuMAX" kB"
+				 " (peak %"PRIuMAX" kB)\n",
+				 when, "process_rss", rss, hwm);
+		trace_counter("memory", "process_rss", rss << 10);
+		trace_counter("memory", "process_rss_peak", hwm << 10);
+	}
+}
+
+void trace_memory_sample(void)
+{
+	uint64_t now;
+
+	if (sample_interval < 0)
+		sample_interval = trace_want(&trace_memory) ?
+			git_env_ulong("GIT_TRACE_MEMORY_INTERVAL", 0) : 0;
+	if (!sample_interval)
+		return;
+
+	now = getnanotime();
+	if (now < next_sample)
+		return;
+	if (next_sample)
+		trace_memory_usage("sample");
+	next_sample = now + (uint64_t)sample_interval * 1000000000;
+}
+
+static void trace_memory_atexit(void)
+{
+	trace_memory_usage("exit");
+}
+
+void trace_memory_setup(void)
+{
+	if (!trace_want(&trace_memory))
+		return;
+	atexit(trace_memory_atexit);
+	trace_memory_sample();
+}
@@ -0,0 +1,103 @@
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "append-cache.h"
+#include "merge-base-cache.h"
+
+/*
+ * The key is the names of the two commits, the smaller one first,
+ * joined by a dash; the value is the names of their merge bases,
+ * separated by single spaces.
+ */
+
+static struct append_cache merge_base_cache;
+
+static void merge_base_key(struct strbuf *key, const struct commit *one,
+			   const struct commit *two)
+{
+	if (hashcmp(one->object.sha1, two->object.sha1) > 0) {
+		const struct commit *tmp = one;
+		one = two;
+		two = tmp;
+	}
+	strbuf_addstr(key, sha1_to_hex(one->object.sha1));
+	strbuf_addch(key, '-');
+	strbuf_addstr(key, sha1_to_hex(two->object.sha1));
+}
+
+static int prepare_merge_base_cache(void)
+{
+	static int prepared, enabled;
+	char *path;
+
+	if (prepared)
+		return enabled;
+	prepared = 1;
+
+	if (git_config_get_bool("core.mergebasecache", &enabled) || !enabled)
+		return enabled = 0;
+	if (!commit_graph_compatible())
+		return enabled = 0;
+
+	path = xstrfmt("%s/info/merge-base-cache", get_object_directory());
+	append_cache_init(&merge_base_cache, path, "merge-base cache version 1");
+	free(path);
+	return enabled;
+}
+
+int merge_base_cache_lookup(struct commit *one, struct commit *two,
+			    struct commit_list **bases)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct commit_list **tail = bases;
+	const char *value;
+	unsigned char sha1[20];
+
+	if (!prepare_merge_base_cache())
+		return 0;
+
+	merge_base_key(&key, one, two);
+	value = append_cache_get(&merge_base_cache, key.buf);
+	strbuf_release(&key);
+	if (!value)
+		return 0;
+
+	*bases = NULL;
+	while (*value) {
+		struct commit *c;
+
+		if (get_sha1_hex(value, sha1) ||
+		    (value[40] && value[40] != ' '))
+			goto malformed;
+		c = lookup_commit(sha1);
+		if (!c || parse_commit_gently(c, 1) < 0)
+			goto malformed;
+		tail = &commit_list_insert(c, tail)->next;
+		value += value[40] ? 41 : 40;
+	}
+	return 1;
+
+malformed:
+	free_commit_list(*bases);
+	*bases = NULL;
+	return 0;
+}
+
+void merge_base_cache_store(struct commit *one, struct commit *two,
+			    const struct commit_list *bases)
+{
+	struct strbuf key = STRBUF_INIT, value = STRBUF_INIT;
+
+	if (!prepare_merge_base_cache())
+		return;
+
+	merge_base_key(&key, one, two);
+	for (; bases; bases = bases->next) {
+		if (value.len)
+			strbuf_addch(&value, ' ');
+		strbuf_addstr(&value, sha1_to_hex(bases->item->object.sha1));
+	}
+	append_cache_put(&merge_base_cache, key.buf, value.buf);
+	strbuf_release(&key);
+	strbuf_release(&value);
+}
@@ -0,0 +1,28 @@
+#ifndef MERGE_BASE_CACHE_H
+#define MERGE_BASE_CACHE_H
+
+/*
+ * With core.mergeBaseCache, the merge bases of pairs of commits are
+ * remembered in $GIT_OBJECT_DIRECTORY/info/merge-base-cache, so that
+ * asking about the same pair again does not walk the history.  Commits
+ * never change, so the entries stay valid as long as no grafts,
+ * shallow boundaries or replacement objects change what the history
+ * looks like; while any of them are in effect, the cache is not used.
+ */
+
+struct commit;
+struct commit_list;
+
+/*
+ * If the merge bases of "one" and "two" are known, set "*bases" to a
+ * new list of them, in the order they were computed in, and return 1.
+ * Return 0 if they have to be computed.
+ */
+extern int merge_base_cache_lookup(struct commit *one, struct commit *two,
+				   struct commit_list **bases);
+
+/* Remember "bases" as the merge bases of "one" and "two". */
+extern void merge_base_cache_store(struct commit *one, struct commit *two,
+				   const struct commit_list *bases);
+
+#endif
@@ -22,6 +22,7 @@
 #include "merge-recursive.h"
 #include "dir.h"
 #include "submodule.h"
+#include "streaming.h"
 
 static struct tree *shift_tree_object(struct tree *one, struct tree *two,
 				      const char *subtree_shift)
@@ -46,7 +47,7 @@ static struct commit *make_virtual_commit(struct tree *tree, const char *comment
 
 	desc->name = comment;
 	desc->obj = (struct object *)commit;
-	commit->tree = tree;
+	commit->maybe_tree = tree;
 	commit->util = desc;
 	commit->object.parsed = 1;
 	return commit;
@@ -150,7 +151,7 @@ static int show(struct merge_options *o, int v)
 
 static void flush_output(struct merge_options *o)
 {
-	if (o->obuf.len) {
+	if (o->buffer_output < 2 && o->obuf.len) {
 		fputs(o->obuf.buf, stdout);
 		strbuf_reset(&o->obuf);
 	}
@@ -177,25 +178,25 @@ static void output(struct merge_options *o, int v, const char *fmt, ...)
 
 static void output_commit_title(struct merge_options *o, struct commit *commit)
 {
-	int i;
-	flush_output(o);
-	for (i = o->call_depth; i--;)
-		fputs("  ", stdout);
+	strbuf_addchars(&o->obuf, ' ', o->call_depth * 2);
 	if (commit->util)
-		printf("virtual %s\n", merge_remote_util(commit)->name);
+		strbuf_addf(&o->obuf, "virtual %s\n",
+			    merge_remote_util(commit)->name);
 	else {
-		printf("%s ", find_unique_abbrev(commit->object.sha1, DEFAULT_ABBREV));
+		strbuf_addf(&o->obuf, "%s ",
+			    find_unique_abbrev(commit->object.sha1, DEFAULT_ABBREV));
 		if (parse_commit(commit) != 0)
-			printf(_("(bad commit)\n"));
+			strbuf_addstr(&o->obuf, _("(bad commit)\n"));
 		else {
 			const char *title;
 			const char *msg = get_commit_buffer(commit, NULL);
 			int len = find_commit_subject(msg, &title);
 			if (len)
-				printf("%.*s\n", len, title);
+				strbuf_addf(&o->obuf, "%.*s\n", len, title);
 			unuse_commit_buffer(commit, msg);
 		}
 	}
+	flush_output(o);
 }
 
 static int add_cacheinfo(unsigned int mode, const unsigned char *sha1,
@@ -284,9 +285,9 @@ static int save_files_dirs(const unsigned char *sha1,
 	strbuf_addstr(base, path);
 
 	if (S_ISDIR(mode))
-		string_list_insert(&o->current_directory_set, base->buf);
+		strset_add(&o->current_directory_set, base->buf);
 	else
-		string_list_insert(&o->current_file_set, base->buf);
+		strset_add(&o->current_file_set, base->buf);
 
 	strbuf_setlen(base, baselen);
 	return (S_ISDIR(mode) ? READ_TREE_RECURSIVE : 0);
@@ -299,7 +300,8 @@ static int get_files_dirs(struct merge_options *o, struct tree *tree)
 	memset(&match_all, 0, sizeof(match_all));
 	if (read_tree_recursive(tree, "", 0, 0, &match_all, save_files_dirs, o))
 		return 0;
-	n = o->current_file_set.nr + o->current_directory_set.nr;
+	n = strset_get_size(&o->current_file_set) +
+	    strset_get_size(&o->current_directory_set);
 	return n;
 }
 
@@ -574,6 +576,82 @@ static void update_entry(struct stage_data *entry,
 	hashcpy(entry->stages[3].sha, b->sha1);
 }
 
+/*
+ * With o->in_memory, o->worktree stands in for the work tree: it holds
+ * what a merge that touches the work tree would leave checked out.
+ * It starts out as the result of the trivial merge, with the version
+ * from HEAD where that conflicted.
+ */
+static void init_worktree(struct merge_options *o)
+{
+	int i;
+
+	if (o->worktree)
+		discard_index(o->worktree);
+	else
+		o->worktree = xcalloc(1, sizeof(*o->worktree));
+
+	for (i = 0; i < active_nr; i++) {
+		const struct cache_entry *ce = active_cache[i];
+		struct cache_entry *copy;
+
+		if (ce_stage(ce) != 0 && ce_stage(ce) != 2)
+			continue;
+		copy = make_cache_entry(ce->ce_mode, ce->sha1, ce->name, 0, 0);
+		if (!copy)
+			die(_("addinfo_cache failed for path '%s'"), ce->name);
+		add_index_entry(o->worktree, copy, ADD_CACHE_JUST_APPEND);
+	}
+}
+
+static void worktree_add(struct merge_options *o, unsigned mode,
+			 const unsigned char *sha, const char *path)
+{
+	struct cache_entry *ce = make_cache_entry(mode, sha, path, 0, 0);
+
+	if (!ce)
+		die(_("addinfo_cache failed for path '%s'"), path);
+	/* files in the way of a new directory and vice versa go */
+	add_index_entry(o->worktree, ce,
+			ADD_CACHE_OK_TO_ADD | ADD_CACHE_OK_TO_REPLACE);
+}
+
+static int worktree_has_file(struct merge_options *o, const char *path)
+{
+	return index_name_pos(o->worktree, path, strlen(path)) >= 0;
+}
+
+static int worktree_has_dir(struct merge_options *o, const char *path)
+{
+	int len = strlen(path);
+	int pos = index_name_pos(o->worktree, path, len);
+
+	if (pos >= 0)
+		return 0;
+	pos = -pos - 1;
+	return pos < o->worktree->cache_nr &&
+		!strncmp(o->worktree->cache[pos]->name, path, len) &&
+		o->worktree->cache[pos]->name[len] == '/';
+}
+
+static struct tree *write_worktree(struct merge_options *o)
+{
+	struct index_state *istate = o->worktree;
+
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, 0) < 0)
+		die(_("error building trees"));
+	return lookup_tree(istate->cache_tree->sha1);
+}
+
+static int path_exists(struct merge_options *o, const char *path)
+{
+	if (o->in_memory)
+		return worktree_has_file(o, path) || worktree_has_dir(o, path);
+	return file_exists(path);
+}
+
 static int remove_file(struct merge_options *o, int clean,
 		       const char *path, int no_wd)
 {
@@ -584,6 +662,10 @@ static int remove_file(struct merge_options *o, int clean,
 		if (remove_file_from_cache(path))
 			return -1;
 	}
+	if (update_working_directory && o->in_memory) {
+		remove_file_from_index(o->worktree, path);
+		return 0;
+	}
 	if (update_working_directory) {
 		if (ignore_case) {
 			struct cache_entry *ce;
@@ -617,18 +699,19 @@ static char *unique_path(struct merge_options *o, const char *path, const char *
 	add_flattened_path(&newpath, branch);
 
 	base_len = newpath.len;
-	while (string_list_has_string(&o->current_file_set, newpath.buf) ||
-	       string_list_has_string(&o->current_directory_set, newpath.buf) ||
-	       file_exists(newpath.buf)) {
+	while (strset_contains(&o->current_file_set, newpath.buf) ||
+	       strset_contains(&o->current_directory_set, newpath.buf) ||
+	       path_exists(o, newpath.buf)) {
 		strbuf_setlen(&newpath, base_len);
 		strbuf_addf(&newpath, "_%d", suffix++);
 	}
 
-	string_list_insert(&o->current_file_set, newpath.buf);
+	strset_add(&o->current_file_set, newpath.buf);
 	return strbuf_detach(&newpath, NULL);
 }
 
-static int dir_in_way(const char *path, int check_working_copy)
+static int dir_in_way(struct merge_options *o, const char *path,
+		      int check_working_copy)
 {
 	int pos, pathlen = strlen(path);
 	char *dirpath = xmalloc(pathlen + 2);
@@ -649,6 +732,8 @@ static int dir_in_way(const char *path, int check_working_copy)
 	}
 
 	free(dirpath);
+	if (check_working_copy && o->in_memory)
+		return worktree_has_dir(o, path);
 	return check_working_copy && !lstat(path, &st) && S_ISDIR(st.st_mode);
 }
 
@@ -676,9 +761,10 @@ static int was_tracked(const char *path)
 	return 0;
 }
 
-static int would_lose_untracked(const char *path)
+static int would_lose_untracked(struct merge_options *o, const char *path)
 {
-	return !was_tracked(path) && file_exists(path);
+	/* there are no untracked files in memory */
+	return !o->in_memory && !was_tracked(path) && file_exists(path);
 }
 
 static int make_room_for_path(struct merge_options *o, const char *path)
@@ -719,7 +805,7 @@ static int make_room_for_path(struct merge_options *o, const char *path)
 	 * Do not unlink a file in the work tree if we are not
 	 * tracking it.
 	 */
-	if (would_lose_untracked(path))
+	if (would_lose_untracked(o, path))
 		return error(_("refusing to lose untracked file at '%s'"),
 			     path);
 
@@ -743,6 +829,11 @@ static void update_file_flags(struct merge_options *o,
 	if (o->call_depth)
 		update_wd = 0;
 
+	if (update_wd && o->in_memory) {
+		worktree_add(o, mode, sha, path);
+		update_wd = 0;
+	}
+
 	if (update_wd) {
 		enum object_type type;
 		void *buf;
@@ -758,6 +849,29 @@ static void update_file_flags(struct merge_options *o,
 			goto update_index;
 		}
 
+		if (S_ISREG(mode)) {
+			struct stream_filter *filter = get_stream_filter(path, sha);
+			if (filter) {
+				/* large blobs are written without reading them whole */
+				int fd;
+
+				if (make_room_for_path(o, path) < 0) {
+					free_stream_filter(filter);
+					update_wd = 0;
+					goto update_index;
+				}
+				fd = open(path, O_WRONLY | O_TRUNC | O_CREAT,
+					  (mode & 0100) ? 0777 : 0666);
+				if (fd < 0)
+					die_errno(_("failed to open '%s'"), path);
+				if (stream_blob_to_fd(fd, sha, filter, 1))
+					die(_("cannot read object %s '%s'"),
+					    sha1_to_hex(sha), path);
+				close(fd);
+				goto update_index;
+			}
+		}
+
 		buf = read_sha1_file(sha, &type, &size);
 		if (!buf)
 			die(_("cannot read object %s '%s'"), sha1_to_hex(sha), path);
@@ -824,7 +938,7 @@ struct merge_file_info {
 };
 
 static int merge_3way(struct merge_options *o,
-		      mmbuffer_t *result_buf,
+		      unsigned char *result_sha,
 		      const struct diff_filespec *one,
 		      const struct diff_filespec *a,
 		      const struct diff_filespec *b,
@@ -832,6 +946,7 @@ static int merge_3way(struct merge_options *o,
 		      const char *branch2)
 {
 	mmfile_t orig, src1, src2;
+	mmbuffer_t result_buf;
 	struct ll_merge_options ll_opts = {0};
 	char *base_name, *name1, *name2;
 	int merge_status;
@@ -869,19 +984,35 @@ static int merge_3way(struct merge_options *o,
 		name2 = mkpathdup("%s", branch2);
 	}
 
-	read_mmblob(&orig, one->sha1);
-	read_mmblob(&src1, a->sha1);
-	read_mmblob(&src2, b->sha1);
-
-	merge_status = ll_merge(result_buf, a->path, &orig, base_name,
-				&src1, name1, &src2, name2, &ll_opts);
+	/* a binary merge takes one side whole; do not read them */
+	merge_status = ll_merge_binary_sha1(result_sha, a->path, one->sha1,
+					    a->sha1, name1, b->sha1, name2,
+					    &ll_opts);
+	if (merge_status < 0) {
+		read_mmblob(&orig, one->sha1);
+		read_mmblob(&src1, a->sha1);
+		read_mmblob(&src2, b->sha1);
+
+		merge_status = ll_merge(&result_buf, a->path, &orig, base_name,
+					&src1, name1, &src2, name2, &ll_opts);
+
+		if ((merge_status < 0) || !result_buf.ptr)
+			die(_("Failed to execute internal merge"));
+
+		if (write_sha1_file(result_buf.ptr, result_buf.size,
+				    blob_type, result_sha))
+			die(_("Unable to add %s to database"),
+			    a->path);
+
+		free(result_buf.ptr);
+		free(orig.ptr);
+		free(src1.ptr);
+		free(src2.ptr);
+	}
 
 	free(base_name);
 	free(name1);
 	free(name2);
-	free(orig.ptr);
-	free(src1.ptr);
-	free(src2.ptr);
 	return merge_status;
 }
 
@@ -927,21 +1058,10 @@ static struct merge_file_info merge_file_1(struct merge_options *o,
 		else if (sha_eq(b->sha1, one->sha1))
 			hashcpy(result.sha, a->sha1);
 		else if (S_ISREG(a->mode)) {
-			mmbuffer_t result_buf;
 			int merge_status;
 
-			merge_status = merge_3way(o, &result_buf, one, a, b,
+			merge_status = merge_3way(o, result.sha, one, a, b,
 						  branch1, branch2);
-
-			if ((merge_status < 0) || !result_buf.ptr)
-				die(_("Failed to execute internal merge"));
-
-			if (write_sha1_file(result_buf.ptr, result_buf.size,
-					    blob_type, result.sha))
-				die(_("Unable to add %s to database"),
-				    a->path);
-
-			free(result_buf.ptr);
 			result.clean = (merge_status == 0);
 		} else if (S_ISGITLINK(a->mode)) {
 			result.clean = merge_submodule(result.sha,
@@ -1015,7 +1135,7 @@ static void handle_change_delete(struct merge_options *o,
 				 const char *change, const char *change_past)
 {
 	char *renamed = NULL;
-	if (dir_in_way(path, !o->call_depth)) {
+	if (dir_in_way(o, path, !o->call_depth)) {
 		renamed = unique_path(o, path, a_sha ? o->branch1 : o->branch2);
 	}
 
@@ -1143,7 +1263,7 @@ static void handle_file(struct merge_options *o,
 		remove_file(o, 0, rename->path, 0);
 		dst_name = unique_path(o, rename->path, cur_branch);
 	} else {
-		if (dir_in_way(rename->path, !o->call_depth)) {
+		if (dir_in_way(o, rename->path, !o->call_depth)) {
 			dst_name = unique_path(o, rename->path, cur_branch);
 			output(o, 1, _("%s is a directory in %s adding as %s instead"),
 			       rename->path, other_branch, dst_name);
@@ -1232,8 +1352,8 @@ static void conflict_rename_rename_2to1(struct merge_options *o,
 	       a->path, c1->path, ci->branch1,
 	       b->path, c2->path, ci->branch2);
 
-	remove_file(o, 1, a->path, would_lose_untracked(a->path));
-	remove_file(o, 1, b->path, would_lose_untracked(b->path));
+	remove_file(o, 1, a->path, would_lose_untracked(o, a->path));
+	remove_file(o, 1, b->path, would_lose_untracked(o, b->path));
 
 	mfi_c1 = merge_file_special_markers(o, a, c1, &ci->ren1_other,
 					    o->branch1, c1->path,
@@ -1271,27 +1391,30 @@ static int process_renames(struct merge_options *o,
 			   struct string_list *b_renames)
 {
 	int clean_merge = 1, i, j;
-	struct string_list a_by_dst = STRING_LIST_INIT_NODUP;
-	struct string_list b_by_dst = STRING_LIST_INIT_NODUP;
+	struct strmap a_by_dst, b_by_dst;
 	const struct rename *sre;
 
+	strmap_init(&a_by_dst, 0);
+	strmap_init(&b_by_dst, 0);
 	for (i = 0; i < a_renames->nr; i++) {
 		sre = a_renames->items[i].util;
-		string_list_insert(&a_by_dst, sre->pair->two->path)->util
-			= (void *)sre;
+		if (!strmap_contains(&a_by_dst, sre->pair->two->path))
+			strmap_put(&a_by_dst, sre->pair->two->path,
+				   (void *)sre);
 	}
 	for (i = 0; i < b_renames->nr; i++) {
 		sre = b_renames->items[i].util;
-		string_list_insert(&b_by_dst, sre->pair->two->path)->util
-			= (void *)sre;
+		if (!strmap_contains(&b_by_dst, sre->pair->two->path))
+			strmap_put(&b_by_dst, sre->pair->two->path,
+				   (void *)sre);
 	}
 
 	for (i = 0, j = 0; i < a_renames->nr || j < b_renames->nr;) {
-		struct string_list *renames1, *renames2Dst;
+		struct string_list *renames1;
+		struct strmap *renames2Dst;
 		struct rename *ren1 = NULL, *ren2 = NULL;
 		const char *branch1, *branch2;
 		const char *ren1_src, *ren1_dst;
-		struct string_list_item *lookup;
 
 		if (i >= a_renames->nr) {
 			ren2 = b_renames->items[j++].util;
@@ -1369,10 +1492,9 @@ static int process_renames(struct merge_options *o,
 						   o,
 						   NULL,
 						   NULL);
-		} else if ((lookup = string_list_lookup(renames2Dst, ren1_dst))) {
+		} else if ((ren2 = strmap_get(renames2Dst, ren1_dst))) {
 			/* Two different files renamed to the same thing */
 			char *ren2_dst;
-			ren2 = lookup->util;
 			ren2_dst = ren2->pair->two->path;
 			if (strcmp(ren1_dst, ren2_dst) != 0)
 				die("ren1_dst != ren2_dst");
@@ -1503,8 +1625,8 @@ static int process_renames(struct merge_options *o,
 			}
 		}
 	}
-	string_list_clear(&a_by_dst, 0);
-	string_list_clear(&b_by_dst, 0);
+	strmap_clear(&a_by_dst, 0);
+	strmap_clear(&b_by_dst, 0);
 
 	return clean_merge;
 }
@@ -1613,7 +1735,7 @@ static int merge_content(struct merge_options *o,
 			 o->branch2 == rename_conflict_info->branch1) ?
 			pair1->two->path : pair1->one->path;
 
-		if (dir_in_way(path, !o->call_depth))
+		if (dir_in_way(o, path, !o->call_depth))
 			df_conflict_remains = 1;
 	}
 	mfi = merge_file_special_markers(o, &one, &a, &b,
@@ -1761,7 +1883,7 @@ static int process_entry(struct merge_options *o,
 			sha = b_sha;
 			conf = _("directory/file");
 		}
-		if (dir_in_way(path, !o->call_depth)) {
+		if (dir_in_way(o, path, !o->call_depth)) {
 			char *new_path = unique_path(o, path, add_branch);
 			clean_merge = 0;
 			output(o, 1, _("CONFLICT (%s): There is a directory with name %s in %s. "
@@ -1815,7 +1937,8 @@ int merge_trees(struct merge_options *o,
 		return 1;
 	}
 
-	code = git_merge_trees(o->call_depth, common, head, merge);
+	code = git_merge_trees(o->call_depth || o->in_memory,
+			       common, head, merge);
 
 	if (code != 0) {
 		if (show(o, 4) || o->call_depth)
@@ -1826,11 +1949,16 @@ int merge_trees(struct merge_options *o,
 			exit(128);
 	}
 
+	if (o->in_memory && !o->call_depth)
+		init_worktree(o);
+
 	if (unmerged_cache()) {
 		struct string_list *entries, *re_head, *re_merge;
 		int i;
-		string_list_clear(&o->current_file_set, 1);
-		string_list_clear(&o->current_directory_set, 1);
+		strset_clear(&o->current_file_set);
+		strset_clear(&o->current_directory_set);
+		strset_init(&o->current_file_set, 1);
+		strset_init(&o->current_directory_set, 1);
 		get_files_dirs(o, head);
 		get_files_dirs(o, merge);
 
@@ -1866,6 +1994,8 @@ int merge_trees(struct merge_options *o,
 
 	if (o->call_depth)
 		*result = write_tree_from_memory(o);
+	else if (o->in_memory)
+		*result = write_worktree(o);
 
 	return clean;
 }
@@ -1951,14 +2081,14 @@ int merge_recursive(struct merge_options *o,
 	}
 
 	discard_cache();
-	if (!o->call_depth)
+	if (!o->call_depth && !o->in_memory)
 		read_cache();
 
 	o->ancestor = "merged common ancestors";
-	clean = merge_trees(o, h1->tree, h2->tree, merged_common_ancestors->tree,
+	clean = merge_trees(o, get_commit_tree(h1), get_commit_tree(h2), get_commit_tree(merged_common_ancestors),
 			    &mrtree);
 
-	if (o->call_depth) {
+	if (o->call_depth || o->in_memory) {
 		*result = make_virtual_commit(mrtree, "merged tree");
 		commit_list_insert(h1, &(*result)->parents);
 		commit_list_insert(h2, &(*result)->parents->next);
@@ -2043,8 +2173,8 @@ void init_merge_options(struct merge_options *o)
 	if (o->verbosity >= 5)
 		o->buffer_output = 0;
 	strbuf_init(&o->obuf, 0);
-	string_list_init(&o->current_file_set, 1);
-	string_list_init(&o->current_directory_set, 1);
+	strset_init(&o->current_file_set, 1);
+	strset_init(&o->current_directory_set, 1);
 	string_list_init(&o->df_conflict_file_set, 1);
 }
 
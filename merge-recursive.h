@@ -2,6 +2,9 @@
 #define MERGE_RECURSIVE_H
 
 #include "string-list.h"
+#include "strmap.h"
+
+struct index_state;
 
 struct merge_options {
 	const char *ancestor;
@@ -13,8 +16,9 @@ struct merge_options {
 		MERGE_RECURSIVE_THEIRS
 	} recursive_variant;
 	const char *subtree_shift;
-	unsigned buffer_output : 1;
+	unsigned buffer_output : 2; /* 1: buffer, 2: leave it to the caller */
 	unsigned renormalize : 1;
+	unsigned in_memory : 1;
 	long xdl_opts;
 	int verbosity;
 	int diff_rename_limit;
@@ -24,12 +28,27 @@ struct merge_options {
 	int show_rename_progress;
 	int call_depth;
 	struct strbuf obuf;
-	struct string_list current_file_set;
-	struct string_list current_directory_set;
+	struct strset current_file_set;
+	struct strset current_directory_set;
 	struct string_list df_conflict_file_set;
+	/*
+	 * With in_memory, the merge never looks at or touches the work
+	 * tree, and the index only in core; it only writes objects.
+	 * This then holds what the work tree would look like after the
+	 * merge, conflict markers and all.
+	 */
+	struct index_state *worktree;
 };
 
-/* merge_trees() but with recursive ancestor consolidation */
+/*
+ * merge_trees() but with recursive ancestor consolidation.
+ *
+ * With o->in_memory, "*result" is set to a virtual commit whose tree
+ * is what the work tree would hold after the merge, and the index in
+ * core, which starts out empty, holds the stages of the paths that
+ * conflicted.  Nothing is written but objects; the caller decides
+ * whether to write the index or check out the result.
+ */
 int merge_recursive(struct merge_options *o,
 		    struct commit *h1,
 		    struct commit *h2,
@@ -44,9 +44,9 @@ int try_merge_command(const char *strategy, size_t xopts_nr,
 	return ret;
 }
 
-int checkout_fast_forward(const unsigned char *head,
-			  const unsigned char *remote,
-			  int overwrite_ignore)
+static int do_checkout_fast_forward(const unsigned char *head,
+				    const unsigned char *remote,
+				    int overwrite_ignore, int gently)
 {
 	struct tree *trees[MAX_UNPACK_TREES];
 	struct unpack_trees_options opts;
@@ -76,6 +76,7 @@ int checkout_fast_forward(const unsigned char *head,
 	opts.verbose_update = 1;
 	opts.merge = 1;
 	opts.fn = twoway_merge;
+	opts.gently = gently;
 	setup_unpack_trees_porcelain(&opts, "merge");
 
 	trees[nr_trees] = parse_tree_indirect(head);
@@ -88,9 +89,26 @@ int checkout_fast_forward(const unsigned char *head,
 		parse_tree(trees[i]);
 		init_tree_desc(t+i, trees[i]->buffer, trees[i]->size);
 	}
-	if (unpack_trees(nr_trees, t, &opts))
+	if (unpack_trees(nr_trees, t, &opts)) {
+		if (gently)
+			rollback_lock_file(lock_file);
 		return -1;
+	}
 	if (write_locked_index(&the_index, lock_file, COMMIT_LOCK))
 		die(_("unable to write new index file"));
 	return 0;
 }
+
+int checkout_fast_forward(const unsigned char *head,
+			  const unsigned char *remote,
+			  int overwrite_ignore)
+{
+	return do_checkout_fast_forward(head, remote, overwrite_ignore, 0);
+}
+
+int checkout_fast_forward_gently(const unsigned char *head,
+				 const unsigned char *remote,
+				 int overwrite_ignore)
+{
+	return do_checkout_fast_forward(head, remote, overwrite_ignore, 1);
+}
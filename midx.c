@@ -0,0 +1,532 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "lockfile.h"
+#include "midx.h"
+
+struct multi_pack_index *multi_pack_index;
+
+static char *get_midx_filename(const char *object_dir)
+{
+	return xstrfmt("%s/pack/multi-pack-index", object_dir);
+}
+
+struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
+{
+	struct multi_pack_index *m = NULL;
+	char *midx_name = get_midx_filename(object_dir);
+	const unsigned char *data, *names, *end;
+	uint32_t num_packs, num_objects, names_len, i;
+	size_t data_len;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = git_open_noatime(midx_name);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	data_len = xsize_t(st.st_size);
+	if (data_len < MIDX_HEADER_SIZE + 256 * 4 + 20) {
+		close(fd);
+		error("multi-pack index %s is too small", midx_name);
+		goto out;
+	}
+	map = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != MIDX_SIGNATURE) {
+		error("multi-pack index %s has a bad signature", midx_name);
+		goto bad;
+	}
+	if (get_be32(data + 4) != MIDX_VERSION) {
+		error("multi-pack index %s has unsupported version %"PRIu32,
+		      midx_name, get_be32(data + 4));
+		goto bad;
+	}
+	num_packs = get_be32(data + 8);
+	num_objects = get_be32(data + 12);
+	names_len = get_be32(data + 16);
+
+	if ((names_len & 3) ||
+	    data_len != MIDX_HEADER_SIZE + (uint64_t)names_len + 256 * 4 +
+			(uint64_t)num_objects * (20 + MIDX_ENTRY_SIZE) + 20) {
+		error("multi-pack index %s is truncated or corrupt", midx_name);
+		goto bad;
+	}
+
+	m = xcalloc(1, sizeof(*m) + strlen(object_dir) + 1);
+	strcpy(m->object_dir, object_dir);
+	m->data = data;
+	m->data_len = data_len;
+	m->num_packs = num_packs;
+	m->num_objects = num_objects;
+	m->local = !!local;
+	m->chunk_pack_names = data + MIDX_HEADER_SIZE;
+	m->chunk_fanout = (const uint32_t *)(m->chunk_pack_names + names_len);
+	m->chunk_oids = (const unsigned char *)(m->chunk_fanout + 256);
+	m->chunk_entries = m->chunk_oids + (size_t)num_objects * 20;
+
+	if (ntohl(m->chunk_fanout[255]) != num_objects) {
+		error("multi-pack index %s has a bad fanout table", midx_name);
+		goto bad;
+	}
+
+	m->pack_names = xcalloc(num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(num_packs, sizeof(*m->packs));
+	names = m->chunk_pack_names;
+	end = names + names_len;
+	for (i = 0; i < num_packs; i++) {
+		const unsigned char *nul = memchr(names, '\0', end - names);
+
+		if (!nul || !ends_with((const char *)names, ".idx") ||
+		    (i && strcmp(m->pack_names[i - 1], (const char *)names) >= 0)) {
+			error("multi-pack index %s has a bad pack name table",
+			      midx_name);
+			goto bad;
+		}
+		m->pack_names[i] = (const char *)names;
+		names = nul + 1;
+	}
+
+	free(midx_name);
+	return m;
+
+bad:
+	if (m) {
+		free(m->pack_names);
+		free(m->packs);
+		free(m);
+	}
+	munmap(map, data_len);
+	m = NULL;
+out:
+	free(midx_name);
+	return m;
+}
+
+void close_multi_pack_index(struct multi_pack_index *m)
+{
+	uint32_t i;
+
+	if (!m)
+		return;
+	for (i = 0; i < m->num_packs; i++)
+		if (m->packs[i])
+			m->packs[i]->multi_pack_index = 0;
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+static void unlink_multi_pack_index(struct multi_pack_index *m)
+{
+	struct multi_pack_index **mp;
+
+	for (mp = &multi_pack_index; *mp; mp = &(*mp)->next) {
+		if (*mp == m) {
+			*mp = m->next;
+			break;
+		}
+	}
+	close_multi_pack_index(m);
+}
+
+static struct multi_pack_index *find_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m;
+
+	for (m = multi_pack_index; m; m = m->next)
+		if (!strcmp(m->object_dir, object_dir))
+			return m;
+	return NULL;
+}
+
+void prepare_multi_pack_index_one(const char *object_dir, int local)
+{
+	struct multi_pack_index *m;
+
+	if (!core_multi_pack_index || find_multi_pack_index(object_dir))
+		return;
+	m = load_multi_pack_index(object_dir, local);
+	if (m) {
+		m->next = multi_pack_index;
+		multi_pack_index = m;
+	}
+}
+
+void link_multi_pack_index_packs(const char *object_dir)
+{
+	struct multi_pack_index *m = find_multi_pack_index(object_dir);
+	struct strbuf pack_name = STRBUF_INIT;
+	size_t dirlen;
+	uint32_t i;
+
+	if (!m)
+		return;
+
+	strbuf_addf(&pack_name, "%s/pack/", object_dir);
+	dirlen = pack_name.len;
+	for (i = 0; i < m->num_packs; i++) {
+		struct packed_git *p;
+
+		if (m->packs[i])
+			continue;
+		strbuf_setlen(&pack_name, dirlen);
+		strbuf_addstr(&pack_name, m->pack_names[i]);
+		strbuf_setlen(&pack_name, pack_name.len - strlen(".idx"));
+		strbuf_addstr(&pack_name, ".pack");
+		for (p = packed_git; p; p = p->next)
+			if (!strcmp(p->pack_name, pack_name.buf))
+				break;
+		if (!p) {
+			/*
+			 * The index refers to a pack that has gone away
+			 * (e.g. a concurrent repack); it can no longer
+			 * be trusted to be complete, so do not use it.
+			 */
+			unlink_multi_pack_index(m);
+			break;
+		}
+		m->packs[i] = p;
+		p->multi_pack_index = 1;
+	}
+	strbuf_release(&pack_name);
+}
+
+void drop_multi_pack_index_for(struct packed_git *p)
+{
+	struct multi_pack_index *m, *next;
+	uint32_t i;
+
+	if (!p->multi_pack_index)
+		return;
+	for (m = multi_pack_index; m; m = next) {
+		next = m->next;
+		for (i = 0; i < m->num_packs; i++)
+			if (m->packs[i] == p)
+				break;
+		if (i < m->num_packs)
+			unlink_multi_pack_index(m);
+	}
+}
+
+int bsearch_midx(const struct multi_pack_index *m, const unsigned char *sha1,
+		 uint32_t *result)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(m->chunk_fanout[*sha1]);
+	lo = *sha1 ? ntohl(m->chunk_fanout[*sha1 - 1]) : 0;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(m->chunk_oids + (size_t)mi * 20, sha1);
+
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	*result = lo;
+	return 0;
+}
+
+const unsigned char *nth_midxed_object_sha1(const struct multi_pack_index *m,
+					    uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+	return m->chunk_oids + (size_t)n * 20;
+}
+
+struct packed_git *nth_midxed_pack(const struct multi_pack_index *m, uint32_t n)
+{
+	uint32_t pack_id = get_be32(m->chunk_entries + (size_t)n * MIDX_ENTRY_SIZE);
+
+	if (pack_id >= m->num_packs)
+		return NULL;
+	return m->packs[pack_id];
+}
+
+uint32_t nth_midxed_pack_pos(const struct multi_pack_index *m, uint32_t n)
+{
+	return get_be32(m->chunk_entries + (size_t)n * MIDX_ENTRY_SIZE + 4);
+}
+
+struct midx_pack {
+	struct packed_git *p;
+	char *name;
+};
+
+struct midx_pack_list {
+	struct midx_pack *packs;
+	uint32_t nr, alloc;
+};
+
+static int add_packs_to_list(const char *object_dir, struct midx_pack_list *list)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirlen;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_addf(&path, "%s/pack", object_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		int ret = errno == ENOENT ? 0 :
+			error("unable to open object pack directory: %s: %s",
+			      path.buf, strerror(errno));
+		strbuf_release(&path);
+		return ret;
+	}
+	strbuf_addch(&path, '/');
+	dirlen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+
+		if (!ends_with(de->d_name, ".idx"))
+			continue;
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, de->d_name);
+		p = add_packed_git(path.buf, path.len, 1);
+		if (!p)
+			continue;
+		if (open_pack_index(p)) {
+			free(p);
+			continue;
+		}
+		ALLOC_GROW(list->packs, list->nr + 1, list->alloc);
+		list->packs[list->nr].p = p;
+		list->packs[list->nr].name = xstrdup(de->d_name);
+		list->nr++;
+	}
+	closedir(dir);
+	strbuf_release(&path);
+	return 0;
+}
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+struct midx_entry {
+	const unsigned char *sha1;
+	uint32_t pack_id;
+	uint32_t pack_pos;
+	time_t mtime;
+};
+
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	/*
+	 * Among several copies of the same object, prefer the one in
+	 * the youngest pack, like the order prepare_packed_git()
+	 * searches packs in.
+	 */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return a->pack_id < b->pack_id ? -1 : a->pack_id != b->pack_id;
+}
+
+int write_multi_pack_index(const char *object_dir)
+{
+	static struct lock_file lock;
+	struct midx_pack_list list = { NULL, 0, 0 };
+	struct midx_entry *entries;
+	char *midx_name;
+	struct sha1file *f;
+	uint32_t fanout[256];
+	uint32_t i, j, nr_entries = 0, nr_unique, names_len = 0;
+	uint64_t total = 0;
+	int ret = 0;
+
+	if (add_packs_to_list(object_dir, &list))
+		return -1;
+	qsort(list.packs, list.nr, sizeof(*list.packs), midx_pack_cmp);
+
+	for (i = 0; i < list.nr; i++) {
+		total += list.packs[i].p->num_objects;
+		names_len += strlen(list.packs[i].name) + 1;
+	}
+	if (total > 0xffffffffu)
+		return error("too many packed objects for a multi-pack index");
+	names_len = (names_len + 3) & ~3u;
+
+	entries = xmalloc(sizeof(*entries) * (size_t)(total ? total : 1));
+	for (i = 0; i < list.nr; i++) {
+		struct packed_git *p = list.packs[i].p;
+
+		for (j = 0; j < p->num_objects; j++) {
+			struct midx_entry *e = &entries[nr_entries++];
+			e->sha1 = nth_packed_object_sha1(p, j);
+			e->pack_id = i;
+			e->pack_pos = j;
+			e->mtime = p->mtime;
+		}
+	}
+	qsort(entries, nr_entries, sizeof(*entries), midx_entry_cmp);
+
+	/* drop duplicates, keeping the preferred copy sorted first */
+	for (i = nr_unique = 0; i < nr_entries; i++) {
+		if (nr_unique &&
+		    !hashcmp(entries[nr_unique - 1].sha1, entries[i].sha1))
+			continue;
+		entries[nr_unique++] = entries[i];
+	}
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nr_unique; i++)
+		fanout[entries[i].sha1[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	midx_name = get_midx_filename(object_dir);
+	hold_lock_file_for_update(&lock, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(lock.fd, lock.filename.buf);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_be32(f, MIDX_VERSION);
+	sha1write_be32(f, list.nr);
+	sha1write_be32(f, nr_unique);
+	sha1write_be32(f, names_len);
+
+	for (i = j = 0; i < list.nr; i++) {
+		size_t len = strlen(list.packs[i].name) + 1;
+		sha1write(f, list.packs[i].name, len);
+		j += len;
+	}
+	for (; j < names_len; j++)
+		sha1write_u8(f, 0);
+
+	for (i = 0; i < 256; i++)
+		sha1write_be32(f, fanout[i]);
+	for (i = 0; i < nr_unique; i++)
+		sha1write(f, entries[i].sha1, 20);
+	for (i = 0; i < nr_unique; i++) {
+		sha1write_be32(f, entries[i].pack_id);
+		sha1write_be32(f, entries[i].pack_pos);
+	}
+
+	if (sha1close_commit_lock(f, &lock))
+		ret = error("unable to write %s: %s", midx_name, strerror(errno));
+
+	for (i = 0; i < list.nr; i++) {
+		close_pack_index(list.packs[i].p);
+		free(list.packs[i].p);
+		free(list.packs[i].name);
+	}
+	free(list.packs);
+	free(entries);
+	free(midx_name);
+	return ret;
+}
+
+void clear_multi_pack_index(const char *object_dir)
+{
+	char *midx_name = get_midx_filename(object_dir);
+	struct multi_pack_index *m = find_multi_pack_index(object_dir);
+
+	if (m)
+		unlink_multi_pack_index(m);
+	unlink_or_warn(midx_name);
+	free(midx_name);
+}
+
+int verify_multi_pack_index(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	struct strbuf path = STRBUF_INIT;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	size_t dirlen;
+	uint32_t i, errors = 0;
+
+	m = load_multi_pack_index(object_dir, 1);
+	if (!m)
+		return 0;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, m->data + m->data_len - 20)) {
+		error("multi-pack index checksum mismatch");
+		errors++;
+	}
+
+	strbuf_addf(&path, "%s/pack/", object_dir);
+	dirlen = path.len;
+	for (i = 0; i < m->num_packs; i++) {
+		strbuf_setlen(&path, dirlen);
+		strbuf_addstr(&path, m->pack_names[i]);
+		m->packs[i] = add_packed_git(path.buf, path.len, 1);
+		if (!m->packs[i] || open_pack_index(m->packs[i])) {
+			error("multi-pack index refers to missing pack %s",
+			      m->pack_names[i]);
+			errors++;
+			free(m->packs[i]);
+			m->packs[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < 255; i++) {
+		if (ntohl(m->chunk_fanout[i]) > ntohl(m->chunk_fanout[i + 1])) {
+			error("multi-pack index fanout is not monotonic at %"PRIu32, i);
+			errors++;
+		}
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *oid = nth_midxed_object_sha1(m, i);
+		uint32_t pack_id = get_be32(m->chunk_entries + (size_t)i * MIDX_ENTRY_SIZE);
+		uint32_t pos = nth_midxed_pack_pos(m, i);
+		struct packed_git *p;
+		const unsigned char *found;
+
+		if (i && hashcmp(nth_midxed_object_sha1(m, i - 1), oid) >= 0) {
+			error("multi-pack index object names out of order at %"PRIu32, i);
+			errors++;
+		}
+		if (pack_id >= m->num_packs) {
+			error("object %s refers to bad pack id %"PRIu32,
+			      sha1_to_hex(oid), pack_id);
+			errors++;
+			continue;
+		}
+		p = m->packs[pack_id];
+		if (!p)
+			continue;
+		found = nth_packed_object_sha1(p, pos);
+		if (!found || hashcmp(found, oid)) {
+			error("object %s is not at position %"PRIu32" of %s",
+			      sha1_to_hex(oid), pos, m->pack_names[pack_id]);
+			errors++;
+		}
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (!m->packs[i])
+			continue;
+		close_pack_index(m->packs[i]);
+		free(m->packs[i]);
+		m->packs[i] = NULL;
+	}
+	close_multi_pack_index(m);
+	strbuf_release(&path);
+	return errors;
+}
@@ -0,0 +1,86 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * A multi-pack index covers all packfiles in an object directory's
+ * "pack" subdirectory with a single sorted table of object names, so
+ * that looking up an object costs one binary search no matter how many
+ * packs there are.  See Documentation/technical/pack-format.txt for the
+ * on-disk format.
+ */
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_HEADER_SIZE 20
+#define MIDX_ENTRY_SIZE 8 /* pack id, position within that pack */
+
+struct multi_pack_index {
+	struct multi_pack_index *next;
+
+	const unsigned char *data;
+	size_t data_len;
+
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const uint32_t *chunk_fanout;
+	const unsigned char *chunk_oids;
+	const unsigned char *chunk_entries;
+
+	const char **pack_names;
+	struct packed_git **packs;
+
+	unsigned local:1;
+	char object_dir[FLEX_ARRAY];
+};
+
+extern struct multi_pack_index *multi_pack_index;
+
+/*
+ * Load the multi-pack index of "object_dir", if there is one and it
+ * looks sane.  The packs it names are not opened; see
+ * link_multi_pack_index_packs().
+ */
+extern struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
+extern void close_multi_pack_index(struct multi_pack_index *m);
+
+/*
+ * Called by prepare_packed_git() for each object directory: load the
+ * multi-pack index (once) and link it to the packs already installed
+ * in the packed_git list, setting their multi_pack_index bit.  An index
+ * that names a pack which is no longer there is dropped.
+ */
+extern void prepare_multi_pack_index_one(const char *object_dir, int local);
+extern void link_multi_pack_index_packs(const char *object_dir);
+
+/*
+ * Forget about every multi-pack index that covers "p", e.g. because
+ * the pack is being freed.
+ */
+extern void drop_multi_pack_index_for(struct packed_git *p);
+
+extern int bsearch_midx(const struct multi_pack_index *m, const unsigned char *sha1, uint32_t *result);
+extern const unsigned char *nth_midxed_object_sha1(const struct multi_pack_index *m, uint32_t n);
+extern struct packed_git *nth_midxed_pack(const struct multi_pack_index *m, uint32_t n);
+extern uint32_t nth_midxed_pack_pos(const struct multi_pack_index *m, uint32_t n);
+
+/*
+ * Write a multi-pack index covering every pack in "object_dir"/pack,
+ * replacing any existing one.  Returns 0 on success.
+ */
+extern int write_multi_pack_index(const char *object_dir);
+
+/*
+ * Remove the multi-pack index of "object_dir", if any.
+ */
+extern void clear_multi_pack_index(const char *object_dir);
+
+/*
+ * Check that every object in the multi-pack index of "object_dir"
+ * can be found at the recorded location; returns the number of
+ * problems found.
+ */
+extern int verify_multi_pack_index(const char *object_dir);
+
+#endif
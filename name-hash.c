@@ -7,6 +7,7 @@
  */
 #define NO_THE_INDEX_COMPATIBILITY_MACROS
 #include "cache.h"
+#include "thread-utils.h"
 
 struct dir_entry {
 	struct hashmap_entry ent;
@@ -121,7 +122,181 @@ static int cache_entry_cmp(const struct cache_entry *ce1,
 	return remove ? !(ce1 == ce2) : 0;
 }
 
-static void lazy_init_name_hash(struct index_state *istate)
+#ifndef NO_PTHREADS
+/* Entries it takes for an extra thread to be worth it. */
+#define LAZY_THREAD_COST (2000)
+
+/*
+ * Number of mutexes guarding dir_hash while threads fill it.  It must
+ * divide the (power of two) table size, so that entries in the same
+ * bucket are always covered by the same mutex.
+ */
+#define LAZY_MAX_MUTEX (32)
+
+/*
+ * With core.ignorecase, lazy_init_name_hash() splits the index into
+ * chunks, and threads case-fold hash every entry of theirs and find
+ * or create its directory in dir_hash.  The main thread then adds the
+ * entries to name_hash and counts the directory references, which is
+ * cheap once the hashing is done.
+ */
+struct lazy_entry {
+	struct dir_entry *dir;
+	unsigned int hash_name;
+};
+
+struct lazy_dir_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct lazy_entry *lazy_entries;
+	int k_start, k_end;
+};
+
+static pthread_mutex_t lazy_dir_mutex[LAZY_MAX_MUTEX];
+
+/*
+ * Like hash_dir_entry(), but safe to call from several threads while
+ * rehashing of dir_hash is disallowed.  Only the thread that creates a
+ * dir_entry sets its parent, which nobody looks at before the join.
+ */
+static struct dir_entry *hash_dir_entry_threaded(struct index_state *istate,
+		struct cache_entry *ce, int namelen)
+{
+	struct dir_entry key, *dir;
+	pthread_mutex_t *mutex;
+
+	while (namelen > 0 && !is_dir_sep(ce->name[namelen - 1]))
+		namelen--;
+	if (namelen <= 0)
+		return NULL;
+	namelen--;
+
+	hashmap_entry_init(&key, memihash(ce->name, namelen));
+	key.namelen = namelen;
+	mutex = &lazy_dir_mutex[key.ent.hash % LAZY_MAX_MUTEX];
+
+	pthread_mutex_lock(mutex);
+	dir = hashmap_get(&istate->dir_hash, &key, ce->name);
+	if (dir) {
+		pthread_mutex_unlock(mutex);
+		return dir;
+	}
+	dir = xcalloc(1, sizeof(struct dir_entry));
+	hashmap_entry_init(dir, key.ent.hash);
+	dir->namelen = namelen;
+	dir->ce = ce;
+	hashmap_add(&istate->dir_hash, dir);
+	pthread_mutex_unlock(mutex);
+
+	/* the parent may be guarded by another mutex, so do not hold ours */
+	dir->parent = hash_dir_entry_threaded(istate, ce, namelen);
+	return dir;
+}
+
+static void *lazy_dir_thread_proc(void *_data)
+{
+	struct lazy_dir_thread_data *d = _data;
+	struct cache_entry *prev = NULL;
+	struct dir_entry *prev_dir = NULL;
+	int k;
+
+	for (k = d->k_start; k < d->k_end; k++) {
+		struct cache_entry *ce = d->istate->cache[k];
+		int len = ce_namelen(ce);
+		int dirlen = len;
+
+		d->lazy_entries[k].hash_name = memihash(ce->name, len);
+
+		/* neighbours in the sorted index mostly share a directory */
+		while (dirlen > 0 && !is_dir_sep(ce->name[dirlen - 1]))
+			dirlen--;
+		if (prev_dir && prev_dir->namelen + 1 == dirlen &&
+		    !memcmp(prev->name, ce->name, dirlen)) {
+			d->lazy_entries[k].dir = prev_dir;
+			continue;
+		}
+		prev = ce;
+		prev_dir = hash_dir_entry_threaded(d->istate, ce, len);
+		d->lazy_entries[k].dir = prev_dir;
+	}
+	return NULL;
+}
+
+static int name_hash_threads(struct index_state *istate)
+{
+	int is_bool, val;
+
+	if (!ignore_case)
+		return 1;
+	if (git_config_get_bool_or_int("core.namehashthreads", &is_bool, &val))
+		val = 0;
+	else if (is_bool)
+		val = !val;
+	else if (val < 0)
+		die(_("core.nameHashThreads must be non-negative"));
+	if (!val) {
+		val = online_cpus();
+		if (val > istate->cache_nr / LAZY_THREAD_COST)
+			val = istate->cache_nr / LAZY_THREAD_COST;
+	}
+	if (val > istate->cache_nr)
+		val = istate->cache_nr;
+	return val;
+}
+
+static void threaded_lazy_init_name_hash(struct index_state *istate,
+					 int nr_threads)
+{
+	struct lazy_dir_thread_data *td;
+	struct lazy_entry *lazy_entries;
+	int k, nr_each;
+
+	lazy_entries = xcalloc(istate->cache_nr, sizeof(*lazy_entries));
+	td = xcalloc(nr_threads, sizeof(*td));
+	nr_each = DIV_ROUND_UP(istate->cache_nr, nr_threads);
+
+	for (k = 0; k < LAZY_MAX_MUTEX; k++)
+		pthread_mutex_init(&lazy_dir_mutex[k], NULL);
+	hashmap_disallow_rehash(&istate->dir_hash, 1);
+
+	for (k = 0; k < nr_threads; k++) {
+		struct lazy_dir_thread_data *d = &td[k];
+		d->istate = istate;
+		d->lazy_entries = lazy_entries;
+		d->k_start = k * nr_each;
+		d->k_end = d->k_start + nr_each;
+		if (d->k_end > istate->cache_nr)
+			d->k_end = istate->cache_nr;
+		if (pthread_create(&d->pthread, NULL, lazy_dir_thread_proc, d))
+			die("unable to create lazy_dir_thread");
+	}
+	for (k = 0; k < nr_threads; k++)
+		if (pthread_join(td[k].pthread, NULL))
+			die("unable to join lazy_dir_thread");
+
+	hashmap_disallow_rehash(&istate->dir_hash, 0);
+	for (k = 0; k < LAZY_MAX_MUTEX; k++)
+		pthread_mutex_destroy(&lazy_dir_mutex[k]);
+
+	for (k = 0; k < istate->cache_nr; k++) {
+		struct cache_entry *ce = istate->cache[k];
+		struct dir_entry *dir = lazy_entries[k].dir;
+
+		if (ce->ce_flags & CE_HASHED)
+			continue;
+		ce->ce_flags |= CE_HASHED;
+		hashmap_entry_init(ce, lazy_entries[k].hash_name);
+		hashmap_add(&istate->name_hash, ce);
+		while (dir && !(dir->nr++))
+			dir = dir->parent;
+	}
+
+	free(td);
+	free(lazy_entries);
+}
+#endif
+
+void lazy_init_name_hash(struct index_state *istate)
 {
 	int nr;
 
@@ -129,6 +304,17 @@ static void lazy_init_name_hash(struct index_state *istate)
 		return;
 	hashmap_init(&istate->name_hash, (hashmap_cmp_fn) cache_entry_cmp,
 			istate->cache_nr);
+#ifndef NO_PTHREADS
+	nr = name_hash_threads(istate);
+	if (nr > 1) {
+		/* size dir_hash up front, as it cannot grow meanwhile */
+		hashmap_init(&istate->dir_hash, (hashmap_cmp_fn) dir_entry_cmp,
+				istate->cache_nr);
+		threaded_lazy_init_name_hash(istate, nr);
+		istate->name_hash_initialized = 1;
+		return;
+	}
+#endif
 	hashmap_init(&istate->dir_hash, (hashmap_cmp_fn) dir_entry_cmp, 0);
 	for (nr = 0; nr < istate->cache_nr; nr++)
 		hash_index_entry(istate, istate->cache[nr]);
@@ -0,0 +1,160 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "lockfile.h"
+#include "notes-index.h"
+
+/*
+ * The file starts with a header of 32 bytes: the signature "NIDX",
+ * the version (1), the number of notes, both as network-order 32-bit
+ * integers, and the name of the notes tree it was made from.  A
+ * fanout table of 256 network-order 32-bit integers follows, where
+ * entry N is the number of notes for objects whose name starts with a
+ * byte of at most N, and then one 40-byte record per note: the name
+ * of the annotated object and that of the note, sorted by the former.
+ * The file ends with the SHA-1 of everything before it.
+ */
+#define NOTES_INDEX_SIGNATURE 0x4e494458 /* "NIDX" */
+#define NOTES_INDEX_VERSION 1
+#define NOTES_INDEX_HEADER_SIZE 32
+
+struct notes_index {
+	const unsigned char *data;
+	size_t data_len;
+	const uint32_t *fanout;
+	const unsigned char *records;
+	uint32_t nr;
+};
+
+int notes_index_enabled(void)
+{
+	static int enabled = -1;
+
+	if (enabled < 0 &&
+	    git_config_get_bool("core.notesindex", &enabled))
+		enabled = 0;
+	return enabled;
+}
+
+static char *notes_index_filename(const char *notes_ref)
+{
+	return git_pathdup("notes-index/%s", notes_ref);
+}
+
+struct notes_index *notes_index_load(const char *notes_ref,
+				     const unsigned char *tree_sha1)
+{
+	struct notes_index *index;
+	const unsigned char *data;
+	struct stat st;
+	size_t data_len;
+	char *filename;
+	void *map;
+	uint32_t nr;
+	int fd;
+
+	filename = notes_index_filename(notes_ref);
+	fd = git_open_noatime(filename);
+	free(filename);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	data_len = xsize_t(st.st_size);
+	if (data_len < NOTES_INDEX_HEADER_SIZE + 256 * 4 + 20) {
+		close(fd);
+		return NULL;
+	}
+	map = xmmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	nr = get_be32(data + 8);
+	if (get_be32(data) != NOTES_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != NOTES_INDEX_VERSION ||
+	    data_len != NOTES_INDEX_HEADER_SIZE + 256 * 4 +
+			(uint64_t)nr * 40 + 20 ||
+	    hashcmp(data + 12, tree_sha1) ||
+	    get_be32(data + NOTES_INDEX_HEADER_SIZE + 255 * 4) != nr) {
+		munmap(map, data_len);
+		return NULL;
+	}
+
+	index = xcalloc(1, sizeof(*index));
+	index->data = data;
+	index->data_len = data_len;
+	index->fanout = (const uint32_t *)(data + NOTES_INDEX_HEADER_SIZE);
+	index->records = data + NOTES_INDEX_HEADER_SIZE + 256 * 4;
+	index->nr = nr;
+	return index;
+}
+
+const unsigned char *notes_index_lookup(const struct notes_index *index,
+					const unsigned char *object_sha1)
+{
+	uint32_t lo, hi;
+
+	lo = object_sha1[0] ? ntohl(index->fanout[object_sha1[0] - 1]) : 0;
+	hi = ntohl(index->fanout[object_sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *rec = index->records + (size_t)mi * 40;
+		int cmp = hashcmp(object_sha1, rec);
+		if (!cmp)
+			return rec + 20;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return NULL;
+}
+
+void notes_index_free(struct notes_index *index)
+{
+	if (!index)
+		return;
+	munmap((void *)index->data, index->data_len);
+	free(index);
+}
+
+int notes_index_write(const char *notes_ref, const unsigned char *tree_sha1,
+		      const unsigned char (*pairs)[40], uint32_t nr)
+{
+	static struct lock_file lock;
+	struct sha1file *f;
+	char *filename;
+	uint32_t i, j;
+	int fd, ret = 0;
+
+	filename = notes_index_filename(notes_ref);
+	if (safe_create_leading_directories(filename)) {
+		ret = error("unable to create leading directories of %s",
+			    filename);
+		goto out;
+	}
+	/* somebody else is at it; they will write the same thing */
+	fd = hold_lock_file_for_update(&lock, filename, 0);
+	if (fd < 0)
+		goto out;
+
+	f = sha1fd(fd, lock.filename.buf);
+	sha1write_be32(f, NOTES_INDEX_SIGNATURE);
+	sha1write_be32(f, NOTES_INDEX_VERSION);
+	sha1write_be32(f, nr);
+	sha1write(f, tree_sha1, 20);
+	for (i = j = 0; i < 256; i++) {
+		while (j < nr && pairs[j][0] <= i)
+			j++;
+		sha1write_be32(f, j);
+	}
+	for (i = 0; i < nr; i++)
+		sha1write(f, pairs[i], 40);
+
+	if (sha1close_commit_lock(f, &lock))
+		ret = error("unable to write %s: %s", filename, strerror(errno));
+out:
+	free(filename);
+	return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef NOTES_INDEX_H
+#define NOTES_INDEX_H
+
+/*
+ * With core.notesIndex, the notes shown by "git log" and friends are
+ * looked up in $GIT_DIR/notes-index/<notes ref>, a sorted table of
+ * annotated object names and their notes, instead of unpacking the
+ * fanout trees of the notes tree.  The table records the notes tree
+ * it was made from, and is made again when the notes ref has moved.
+ */
+
+struct notes_index;
+
+/* Whether core.notesIndex is set */
+extern int notes_index_enabled(void);
+
+/*
+ * Map the index of "notes_ref", if it was made from the notes tree
+ * "tree_sha1"; return NULL if there is none or it is out of date.
+ */
+extern struct notes_index *notes_index_load(const char *notes_ref,
+					    const unsigned char *tree_sha1);
+
+/* Return the note of "object_sha1" in "index", or NULL */
+extern const unsigned char *notes_index_lookup(const struct notes_index *index,
+					       const unsigned char *object_sha1);
+
+extern void notes_index_free(struct notes_index *index);
+
+/*
+ * Write the index of "notes_ref" for the notes tree "tree_sha1", whose
+ * notes are "nr" pairs of object and note names, sorted by object name.
+ */
+extern int notes_index_write(const char *notes_ref,
+			     const unsigned char *tree_sha1,
+			     const unsigned char (*pairs)[40], uint32_t nr);
+
+#endif
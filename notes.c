@@ -7,6 +7,7 @@
 #include "tree-walk.h"
 #include "string-list.h"
 #include "refs.h"
+#include "notes-index.h"
 
 /*
  * Use a non-balancing simple 16-tree structure with struct int_node as
@@ -986,6 +987,55 @@ const char *default_notes_ref(void)
 	return notes_ref;
 }
 
+/* Load the notes tree that was left for the index to look up in */
+static void load_pending_tree(struct notes_tree *t)
+{
+	struct leaf_node root_tree;
+
+	if (is_null_sha1(t->pending_tree))
+		return;
+	hashclr(root_tree.key_sha1);
+	hashcpy(root_tree.val_sha1, t->pending_tree);
+	hashclr(t->pending_tree);
+	load_subtree(t, &root_tree, t->root, 0);
+}
+
+struct notes_index_data {
+	unsigned char (*pairs)[40];
+	uint32_t nr, alloc;
+};
+
+static int add_to_notes_index(const unsigned char *object_sha1,
+			      const unsigned char *note_sha1, char *note_path,
+			      void *cb_data)
+{
+	struct notes_index_data *d = cb_data;
+
+	ALLOC_GROW(d->pairs, d->nr + 1, d->alloc);
+	hashcpy(d->pairs[d->nr], object_sha1);
+	hashcpy(d->pairs[d->nr] + 20, note_sha1);
+	d->nr++;
+	return 0;
+}
+
+static int pairs_cmp(const void *a, const void *b)
+{
+	return hashcmp(a, b);
+}
+
+static void write_notes_index(struct notes_tree *t,
+			      const unsigned char *tree_sha1)
+{
+	struct notes_index_data d = { NULL, 0, 0 };
+
+	for_each_note(t, 0, add_to_notes_index, &d);
+	/* the trie hands them out in order, but make sure */
+	qsort(d.pairs, d.nr, sizeof(*d.pairs), pairs_cmp);
+	notes_index_write(t->ref, tree_sha1,
+			  (const unsigned char (*)[40])d.pairs, d.nr);
+	free(d.pairs);
+}
+
 void init_notes(struct notes_tree *t, const char *notes_ref,
 		combine_notes_fn combine_notes, int flags)
 {
@@ -1018,9 +1068,20 @@ void init_notes(struct notes_tree *t, const char *notes_ref,
 		die("Failed to read notes tree referenced by %s (%s)",
 		    notes_ref, sha1_to_hex(object_sha1));
 
+	if (flags & NOTES_INIT_INDEX && notes_index_enabled()) {
+		t->index = notes_index_load(notes_ref, sha1);
+		if (t->index) {
+			hashcpy(t->pending_tree, sha1);
+			return;
+		}
+	}
+
 	hashclr(root_tree.key_sha1);
 	hashcpy(root_tree.val_sha1, sha1);
 	load_subtree(t, &root_tree, t->root, 0);
+
+	if (flags & NOTES_INIT_INDEX && notes_index_enabled())
+		write_notes_index(t, sha1);
 }
 
 struct notes_tree **load_notes_trees(struct string_list *refs)
@@ -1031,7 +1092,8 @@ struct notes_tree **load_notes_trees(struct string_list *refs)
 	trees = xmalloc((refs->nr+1) * sizeof(struct notes_tree *));
 	for_each_string_list_item(item, refs) {
 		struct notes_tree *t = xcalloc(1, sizeof(struct notes_tree));
-		init_notes(t, item->string, combine_notes_ignore, 0);
+		init_notes(t, item->string, combine_notes_ignore,
+			   NOTES_INIT_INDEX);
 		trees[counter++] = t;
 	}
 	trees[counter] = NULL;
@@ -1079,6 +1141,7 @@ int add_note(struct notes_tree *t, const unsigned char *object_sha1,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	load_pending_tree(t);
 	t->dirty = 1;
 	if (!combine_notes)
 		combine_notes = t->combine_notes;
@@ -1095,6 +1158,7 @@ int remove_note(struct notes_tree *t, const unsigned char *object_sha1)
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	load_pending_tree(t);
 	hashcpy(l.key_sha1, object_sha1);
 	hashclr(l.val_sha1);
 	note_tree_remove(t, t->root, 0, &l);
@@ -1112,6 +1176,8 @@ const unsigned char *get_note(struct notes_tree *t,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	if (t->index && !t->dirty)
+		return notes_index_lookup(t->index, object_sha1);
 	found = note_tree_find(t, t->root, 0, object_sha1);
 	return found ? found->val_sha1 : NULL;
 }
@@ -1122,6 +1188,7 @@ int for_each_note(struct notes_tree *t, int flags, each_note_fn fn,
 	if (!t)
 		t = &default_notes_tree;
 	assert(t->initialized);
+	load_pending_tree(t);
 	return for_each_note_helper(t, t->root, 0, 0, flags, fn, cb_data);
 }
 
@@ -1186,6 +1253,7 @@ void free_notes(struct notes_tree *t)
 		t->first_non_note = t->prev_non_note;
 	}
 	free(t->ref);
+	notes_index_free(t->index);
 	memset(t, 0, sizeof(struct notes_tree));
 }
 
@@ -1212,7 +1280,7 @@ static void format_note(struct notes_tree *t, const unsigned char *object_sha1,
 	if (!t)
 		t = &default_notes_tree;
 	if (!t->initialized)
-		init_notes(t, NULL, NULL, 0);
+		init_notes(t, NULL, NULL, NOTES_INIT_INDEX);
 
 	sha1 = get_note(t, object_sha1);
 	if (!sha1)
@@ -45,6 +45,8 @@ extern struct notes_tree {
 	struct non_note *first_non_note, *prev_non_note;
 	char *ref;
 	combine_notes_fn combine_notes;
+	struct notes_index *index;
+	unsigned char pending_tree[20]; /* not yet loaded into root, if set */
 	int initialized;
 	int dirty;
 } default_notes_tree;
@@ -70,6 +72,12 @@ const char *default_notes_ref(void);
  * specified by the given (or default) notes ref.
  */
 #define NOTES_INIT_EMPTY 1
+/*
+ * Look notes up through the notes index of the ref if core.notesIndex
+ * is set, making it if it is out of date; for notes trees that are
+ * only read from, such as those for displaying notes.
+ */
+#define NOTES_INIT_INDEX 2
 
 /*
  * Initialize the given notes_tree with the notes tree structure at the given
@@ -0,0 +1,28 @@
+#ifndef OBJECT_SLAB_H
+#define OBJECT_SLAB_H
+
+#include "commit-slab.h"
+
+/*
+ * define_object_slab(slabname, elemtype) is the same as
+ * define_commit_slab() (see commit-slab.h), but associates data with
+ * objects of any type, by the index each object is given when it is
+ * allocated.  It defines
+ *
+ *   elemtype *slabname_at(struct slabname *, struct object *);
+ *   elemtype *slabname_peek(struct slabname *, struct object *);
+ *   void init_slabname(struct slabname *);
+ *   void init_slabname_with_stride(struct slabname *, int);
+ *   void clear_slabname(struct slabname *);
+ *
+ * Looking up the data of an object is an array access, where a
+ * "struct decoration" has to hash the object pointer.  The indices
+ * are shared by all objects, though, so prefer a commit slab for data
+ * that only commits carry: it is denser.
+ */
+#define define_object_slab(slabname, elemtype) \
+	define_indexed_slab(slabname, elemtype, struct object)
+
+#define OBJECT_SLAB_INIT(stride, var) COMMIT_SLAB_INIT(stride, var)
+
+#endif /* OBJECT_SLAB_H */
@@ -5,9 +5,24 @@
 #include "commit.h"
 #include "tag.h"
 
-static struct object **obj_hash;
+/*
+ * Each slot keeps the hash of its object next to the pointer, so that
+ * probing past other objects rarely has to dereference them.
+ */
+struct obj_hash_slot {
+	struct object *obj;
+	unsigned int hash;
+};
+
+static struct obj_hash_slot *obj_hash;
 static int nr_objs, obj_hash_size;
 
+#ifdef __GNUC__
+#define prefetch_slot(slot) __builtin_prefetch((slot), 0)
+#else
+#define prefetch_slot(slot) do { } while (0)
+#endif
+
 unsigned int get_max_object_index(void)
 {
 	return obj_hash_size;
@@ -15,7 +30,7 @@ unsigned int get_max_object_index(void)
 
 struct object *get_indexed_object(unsigned int idx)
 {
-	return obj_hash[idx];
+	return obj_hash[idx].obj;
 }
 
 static const char *object_type_strings[] = {
@@ -52,30 +67,22 @@ int type_from_string_gently(const char *str, ssize_t len, int gentle)
 }
 
 /*
- * Return a numerical hash value between 0 and n-1 for the object with
- * the specified sha1.  n must be a power of 2.  Please note that the
- * return value is *not* consistent across computer architectures.
+ * Insert obj, whose sha1hash() is "hash", into the hash table hash,
+ * which has length size (which must be a power of 2).  On collisions,
+ * simply overflow to the next empty bucket.
  */
-static unsigned int hash_obj(const unsigned char *sha1, unsigned int n)
+static void insert_obj_hash(struct object *obj, unsigned int hash,
+			    struct obj_hash_slot *table, unsigned int size)
 {
-	return sha1hash(sha1) & (n - 1);
-}
+	unsigned int j = hash & (size - 1);
 
-/*
- * Insert obj into the hash table hash, which has length size (which
- * must be a power of 2).  On collisions, simply overflow to the next
- * empty bucket.
- */
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
-{
-	unsigned int j = hash_obj(obj->sha1, size);
-
-	while (hash[j]) {
+	while (table[j].obj) {
 		j++;
 		if (j >= size)
 			j = 0;
 	}
-	hash[j] = obj;
+	table[j].obj = obj;
+	table[j].hash = hash;
 }
 
 /*
@@ -84,15 +91,16 @@ static void insert_obj_hash(struct object *obj, struct object **hash, unsigned i
  */
 struct object *lookup_object(const unsigned char *sha1)
 {
-	unsigned int i, first;
+	unsigned int i, first, hash;
 	struct object *obj;
 
 	if (!obj_hash)
 		return NULL;
 
-	first = i = hash_obj(sha1, obj_hash_size);
-	while ((obj = obj_hash[i]) != NULL) {
-		if (!hashcmp(sha1, obj->sha1))
+	hash = sha1hash(sha1);
+	first = i = hash & (obj_hash_size - 1);
+	while ((obj = obj_hash[i].obj) != NULL) {
+		if (obj_hash[i].hash == hash && !hashcmp(sha1, obj->sha1))
 			break;
 		i++;
 		if (i == obj_hash_size)
@@ -104,13 +112,29 @@ struct object *lookup_object(const unsigned char *sha1)
 		 * that we do not need to walk the hash table the next
 		 * time we look for it.
 		 */
-		struct object *tmp = obj_hash[i];
+		struct obj_hash_slot tmp = obj_hash[i];
 		obj_hash[i] = obj_hash[first];
 		obj_hash[first] = tmp;
 	}
 	return obj;
 }
 
+void lookup_object_batch(const unsigned char **sha1, struct object **obj,
+			 unsigned int nr)
+{
+	unsigned int i;
+
+	if (!obj_hash) {
+		for (i = 0; i < nr; i++)
+			obj[i] = NULL;
+		return;
+	}
+	for (i = 0; i < nr; i++)
+		prefetch_slot(&obj_hash[sha1hash(sha1[i]) & (obj_hash_size - 1)]);
+	for (i = 0; i < nr; i++)
+		obj[i] = lookup_object(sha1[i]);
+}
+
 /*
  * Increase the size of the hash map stored in obj_hash to the next
  * power of 2 (but at least 32).  Copy the existing values to the new
@@ -120,24 +144,49 @@ static void grow_object_hash(void)
 {
 	int i;
 	/*
-	 * Note that this size must always be power-of-2 to match hash_obj
-	 * above.
+	 * Note that this size must always be power-of-2 to match the
+	 * masking in lookup_object() above.
 	 */
 	int new_hash_size = obj_hash_size < 32 ? 32 : 2 * obj_hash_size;
-	struct object **new_hash;
+	struct obj_hash_slot *new_hash;
 
-	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
+	new_hash = xcalloc(new_hash_size, sizeof(*new_hash));
 	for (i = 0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
-		if (!obj)
+		if (!obj_hash[i].obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(obj_hash[i].obj, obj_hash[i].hash,
+				new_hash, new_hash_size);
 	}
 	free(obj_hash);
 	obj_hash = new_hash;
 	obj_hash_size = new_hash_size;
 }
 
+void remove_objects(int (*fn)(struct object *, void *), void *data)
+{
+	struct obj_hash_slot *old_hash = obj_hash;
+	int i, old_size = obj_hash_size;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_hash[i].obj && fn(old_hash[i].obj, data)) {
+			old_hash[i].obj = NULL;
+			nr_objs--;
+		}
+	}
+
+	obj_hash_size = 32;
+	while (obj_hash_size - 1 <= nr_objs * 2)
+		obj_hash_size *= 2;
+	obj_hash = xcalloc(obj_hash_size, sizeof(*obj_hash));
+	for (i = 0; i < old_size; i++) {
+		if (!old_hash[i].obj)
+			continue;
+		insert_obj_hash(old_hash[i].obj, old_hash[i].hash,
+				obj_hash, obj_hash_size);
+	}
+	free(old_hash);
+}
+
 void *create_object(const unsigned char *sha1, void *o)
 {
 	struct object *obj = o;
@@ -150,7 +199,7 @@ void *create_object(const unsigned char *sha1, void *o)
 	if (obj_hash_size - 1 <= nr_objs * 2)
 		grow_object_hash();
 
-	insert_obj_hash(obj, obj_hash, obj_hash_size);
+	insert_obj_hash(obj, sha1hash(sha1), obj_hash, obj_hash_size);
 	nr_objs++;
 	return obj;
 }
@@ -420,7 +469,7 @@ void clear_object_flags(unsigned flags)
 	int i;
 
 	for (i=0; i < obj_hash_size; i++) {
-		struct object *obj = obj_hash[i];
+		struct object *obj = obj_hash[i].obj;
 		if (obj)
 			obj->flags &= ~flags;
 	}
@@ -28,16 +28,18 @@ struct object_array {
 #define TYPE_BITS   3
 /*
  * object flag allocation:
- * revision.h:      0---------10                                26
+ * revision.h:      0---------10                            24-26
  * fetch-pack.c:    0---4
  * walker.c:        0-2
  * upload-pack.c:               11----------------19
  * builtin/blame.c:               12-13
+ * commit-graph.c:                    15
  * bisect.c:                               16
  * bundle.c:                               16
  * http-push.c:                            16-----19
  * commit.c:                               16-----19
  * sha1_name.c:                                     20
+ * connected.c:                                       21
  */
 #define FLAG_BITS  27
 
@@ -50,6 +52,7 @@ struct object {
 	unsigned type : TYPE_BITS;
 	unsigned flags : FLAG_BITS;
 	unsigned char sha1[20];
+	unsigned int index; /* for object slabs; see object-slab.h */
 };
 
 extern const char *typename(unsigned int type);
@@ -80,8 +83,22 @@ extern struct object *get_indexed_object(unsigned int);
  */
 struct object *lookup_object(const unsigned char *sha1);
 
+/*
+ * Look up "nr" objects at once, storing what lookup_object() would
+ * return for each into "obj".  The hash buckets of all of them are
+ * fetched into the CPU cache first, so that the misses overlap.
+ */
+void lookup_object_batch(const unsigned char **sha1, struct object **obj,
+			 unsigned int nr);
+
 extern void *create_object(const unsigned char *sha1, void *obj);
 
+/*
+ * Remove every object for which "fn" returns non-zero from the object
+ * hash, shrinking it to fit what is left.
+ */
+void remove_objects(int (*fn)(struct object *, void *), void *data);
+
 void *object_as_type(struct object *obj, enum object_type type, int quiet);
 
 /*
@@ -0,0 +1,39 @@
+#include "cache.h"
+#include "oidset.h"
+
+void oidset_init(struct oidset *set, size_t initial_size)
+{
+	memset(&set->set, 0, sizeof(set->set));
+	if (initial_size)
+		kh_resize_oid_set(&set->set, initial_size);
+}
+
+int oidset_contains(const struct oidset *set, const struct object_id *oid)
+{
+	khiter_t pos = kh_get_oid_set(&set->set, *oid);
+	return pos != kh_end(&set->set);
+}
+
+int oidset_add(struct oidset *set, const struct object_id *oid)
+{
+	int added;
+	kh_put_oid_set(&set->set, *oid, &added);
+	return !!added;
+}
+
+int oidset_remove(struct oidset *set, const struct object_id *oid)
+{
+	khiter_t pos = kh_get_oid_set(&set->set, *oid);
+	if (pos == kh_end(&set->set))
+		return 0;
+	kh_del_oid_set(&set->set, pos);
+	return 1;
+}
+
+void oidset_clear(struct oidset *set)
+{
+	free(set->set.keys);
+	free(set->set.flags);
+	free(set->set.vals);
+	oidset_init(set, 0);
+}
@@ -0,0 +1,56 @@
+#ifndef OIDSET_H
+#define OIDSET_H
+
+#include "khash.h"
+
+/*
+ * A set of object names in an open-addressing hash table.  Unlike a
+ * sha1_array, adding to it and looking it up can be interleaved freely:
+ * both take constant time and nothing ever needs sorting.  Objects
+ * come back from the iterator in no particular order.
+ */
+struct oidset {
+	kh_oid_set_t set;
+};
+
+#define OIDSET_INIT { { 0 } }
+
+/* Presize the set for about initial_size objects */
+extern void oidset_init(struct oidset *set, size_t initial_size);
+
+extern int oidset_contains(const struct oidset *set, const struct object_id *oid);
+
+/* Returns 1 if oid was added, 0 if it was already in the set */
+extern int oidset_add(struct oidset *set, const struct object_id *oid);
+
+/* Returns 1 if oid was removed, 0 if it was not in the set */
+extern int oidset_remove(struct oidset *set, const struct object_id *oid);
+
+extern void oidset_clear(struct oidset *set);
+
+static inline unsigned int oidset_size(const struct oidset *set)
+{
+	return kh_size(&set->set);
+}
+
+struct oidset_iter {
+	kh_oid_set_t *set;
+	khiter_t iter;
+};
+
+static inline void oidset_iter_init(struct oidset *set,
+				    struct oidset_iter *iter)
+{
+	iter->set = &set->set;
+	iter->iter = kh_begin(iter->set);
+}
+
+static inline const struct object_id *oidset_iter_next(struct oidset_iter *iter)
+{
+	for (; iter->iter != kh_end(iter->set); iter->iter++)
+		if (kh_exist(iter->set, iter->iter))
+			return &kh_key(iter->set, iter->iter++);
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include "cache.h"
+#include "pack-bases.h"
+
+static char *pack_bases_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		die("BUG: pack name '%s' does not end in .pack", p->pack_name);
+	return xstrfmt("%.*s.bases", (int)len, p->pack_name);
+}
+
+int load_pack_bases(struct packed_git *p)
+{
+	char *bases_name;
+	const unsigned char *data;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd, ret = -1;
+
+	if (p->bases_map)
+		return 0;
+	if (p->no_bases)
+		return -1;
+	p->no_bases = 1;
+	if (open_pack_index(p))
+		return -1;
+
+	bases_name = pack_bases_filename(p);
+	fd = git_open_noatime(bases_name);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	size = xsize_t(st.st_size);
+	if (size != DBAS_HEADER_SIZE + (size_t)p->num_objects * 8 + 40) {
+		close(fd);
+		error("delta base table %s has the wrong size", bases_name);
+		goto out;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != DBAS_SIGNATURE ||
+	    get_be32(data + 4) != DBAS_VERSION ||
+	    get_be32(data + 8) != 1 /* SHA-1 */) {
+		error("delta base table %s has a bad header", bases_name);
+		munmap(map, size);
+		goto out;
+	}
+	if (hashcmp(data + size - 40,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		error("delta base table %s does not match its pack", bases_name);
+		munmap(map, size);
+		goto out;
+	}
+
+	p->bases_map = map;
+	p->bases_size = size;
+	p->no_bases = 0;
+	ret = 0;
+out:
+	free(bases_name);
+	return ret;
+}
+
+void pack_bases_params(struct packed_git *p, uint32_t *window, uint32_t *depth)
+{
+	const unsigned char *data = p->bases_map;
+
+	*window = get_be32(data + 12);
+	*depth = get_be32(data + 16);
+}
+
+int pack_bases_lookup(struct packed_git *p, uint32_t pos,
+		      uint32_t *base_pos, unsigned long *delta_size)
+{
+	const unsigned char *entry = (const unsigned char *)p->bases_map +
+		DBAS_HEADER_SIZE + (size_t)pos * 8;
+	uint32_t base;
+
+	if (pos >= p->num_objects)
+		die("BUG: object position %"PRIu32" out of range", pos);
+
+	base = get_be32(entry);
+	if (base == DBAS_NO_BASE)
+		return 0;
+	if (base >= p->num_objects || base == pos)
+		return -1;
+	*base_pos = base;
+	*delta_size = get_be32(entry + 4);
+	return 1;
+}
+
+void close_pack_bases(struct packed_git *p)
+{
+	if (p->bases_map) {
+		munmap((void *)p->bases_map, p->bases_size);
+		p->bases_map = NULL;
+		p->bases_size = 0;
+	}
+	p->no_bases = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef PACK_BASES_H
+#define PACK_BASES_H
+
+/*
+ * A delta base table records, for the objects of a pack, what the
+ * delta search that wrote it decided: the object it picked as the delta
+ * base and the size of the delta, or that no base in the window was
+ * good enough.  A later pack-objects with a window no larger and a
+ * depth no smaller can take those decisions instead of searching again.
+ *
+ * It is written next to the .idx as a .bases file by pack-objects with
+ * pack.recordDeltaSearch (see Documentation/technical/pack-format.txt).
+ */
+
+#define DBAS_SIGNATURE 0x44424153 /* "DBAS" */
+#define DBAS_VERSION 1
+#define DBAS_HEADER_SIZE 20
+
+/* base positions that are not positions */
+#define DBAS_UNKNOWN 0xffffffff
+#define DBAS_NO_BASE 0xfffffffe
+
+/*
+ * mmap the .bases file of "p".  Returns 0 if it exists and is usable;
+ * a pack without one is only looked at once.
+ */
+int load_pack_bases(struct packed_git *p);
+
+/* The window and depth of the search a loaded table records. */
+void pack_bases_params(struct packed_git *p, uint32_t *window, uint32_t *depth);
+
+/*
+ * Look up the object at .idx position "pos" of "p", whose table must
+ * have been loaded.  Returns -1 if nothing is known about it, 0 if the
+ * search found no base for it, and 1 if it found the object at .idx
+ * position "*base_pos", with a delta of "*delta_size" bytes.
+ */
+int pack_bases_lookup(struct packed_git *p, uint32_t pos,
+		      uint32_t *base_pos, unsigned long *delta_size);
+
+/*
+ * Release the table of "p", if one was loaded.
+ */
+void close_pack_bases(struct packed_git *p);
+
+#endif
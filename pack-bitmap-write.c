@@ -10,6 +10,8 @@
 #include "pack-bitmap.h"
 #include "sha1-lookup.h"
 #include "pack-objects.h"
+#include "tree-walk.h"
+#include "thread-utils.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -35,6 +37,7 @@ struct bitmap_writer {
 
 	struct progress *progress;
 	int show_progress;
+	int nr_threads;
 	unsigned char pack_checksum[20];
 };
 
@@ -45,14 +48,25 @@ void bitmap_writer_show_progress(int show)
 	writer.show_progress = show;
 }
 
+void bitmap_writer_set_threads(int nr_threads)
+{
+	writer.nr_threads = nr_threads;
+}
+
 /**
  * Build the initial type index for the packfile
  */
-void bitmap_writer_build_type_index(struct pack_idx_entry **index,
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
 				    uint32_t index_nr)
 {
 	uint32_t i;
 
+	writer.to_pack = to_pack;
+	free(to_pack->in_pack_pos);
+	to_pack->in_pack_pos = xcalloc(to_pack->nr_objects,
+				       sizeof(*to_pack->in_pack_pos));
+
 	writer.commits = ewah_new();
 	writer.trees = ewah_new();
 	writer.blobs = ewah_new();
@@ -62,14 +76,14 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 		struct object_entry *entry = (struct object_entry *)index[i];
 		enum object_type real_type;
 
-		entry->in_pack_pos = i;
+		oe_set_in_pack_pos(to_pack, entry, i);
 
-		switch (entry->type) {
+		switch (oe_type(entry)) {
 		case OBJ_COMMIT:
 		case OBJ_TREE:
 		case OBJ_BLOB:
 		case OBJ_TAG:
-			real_type = entry->type;
+			real_type = oe_type(entry);
 			break;
 
 		default:
@@ -96,7 +110,7 @@ void bitmap_writer_build_type_index(struct pack_idx_entry **index,
 
 		default:
 			die("Missing type information for %s (%d/%d)",
-			    sha1_to_hex(entry->idx.sha1), real_type, entry->type);
+			    sha1_to_hex(entry->idx.sha1), real_type, oe_type(entry));
 		}
 	}
 }
@@ -145,62 +159,260 @@ static uint32_t find_object_pos(const unsigned char *sha1)
 			"(object %s is missing)", sha1_to_hex(sha1));
 	}
 
-	return entry->in_pack_pos;
+	return oe_in_pack_pos(writer.to_pack, entry);
 }
 
-static void show_object(struct object *object, const struct name_path *path,
-			const char *last, void *data)
+static struct bitmapped_commit *find_selected(const unsigned char *sha1)
 {
-	struct bitmap *base = data;
-	bitmap_set(base, find_object_pos(object->sha1));
-	mark_as_seen(object);
+	khiter_t hash_pos = kh_get_sha1(writer.bitmaps, sha1);
+
+	if (hash_pos >= kh_end(writer.bitmaps))
+		return NULL;
+	return kh_value(writer.bitmaps, hash_pos);
 }
 
-static void show_commit(struct commit *commit, void *data)
+/*
+ * One selected commit whose bitmap has to be computed: it is the OR of
+ * the bitmaps of the nearest selected ancestors ("bases"), plus the
+ * commits between them and the selected one together with their trees.
+ * Jobs whose bases are all done can be computed in parallel.
+ */
+struct bitmap_job {
+	struct bitmapped_commit *stored;
+
+	struct commit **commits;
+	unsigned int commits_nr, commits_alloc;
+
+	struct bitmapped_commit **bases;
+	unsigned int bases_nr, bases_alloc;
+
+	/* jobs that wait for this one, and how many bases we wait for */
+	unsigned int *dependents;
+	unsigned int dependents_nr, dependents_alloc;
+	unsigned int waiting;
+};
+
+static struct bitmap_job *jobs;
+static unsigned int jobs_nr;
+static unsigned int *ready, ready_nr, done_nr, built_nr;
+
+#ifndef NO_PTHREADS
+
+static int threads_active;
+
+static pthread_mutex_t read_mutex;
+#define read_lock()		lock_mutex(&read_mutex)
+#define read_unlock()		unlock_mutex(&read_mutex)
+
+static pthread_mutex_t jobs_mutex;
+static pthread_cond_t jobs_cond;
+#define jobs_lock()		lock_mutex(&jobs_mutex)
+#define jobs_unlock()		unlock_mutex(&jobs_mutex)
+
+static inline void lock_mutex(pthread_mutex_t *mutex)
 {
-	mark_as_seen((struct object *)commit);
+	if (threads_active)
+		pthread_mutex_lock(mutex);
 }
 
-static int
-add_to_include_set(struct bitmap *base, struct commit *commit)
+static inline void unlock_mutex(pthread_mutex_t *mutex)
 {
-	khiter_t hash_pos;
-	uint32_t bitmap_pos = find_object_pos(commit->object.sha1);
+	if (threads_active)
+		pthread_mutex_unlock(mutex);
+}
 
-	if (bitmap_get(base, bitmap_pos))
-		return 0;
+static void jobs_wait(void)
+{
+	if (!threads_active)
+		die("BUG: waiting for bitmap jobs without threads");
+	pthread_cond_wait(&jobs_cond, &jobs_mutex);
+}
 
-	hash_pos = kh_get_sha1(writer.bitmaps, commit->object.sha1);
-	if (hash_pos < kh_end(writer.bitmaps)) {
-		struct bitmapped_commit *bc = kh_value(writer.bitmaps, hash_pos);
-		bitmap_or_ewah(base, bc->bitmap);
-		return 0;
+static void jobs_signal(void)
+{
+	if (threads_active)
+		pthread_cond_broadcast(&jobs_cond);
+}
+
+static try_to_free_t old_try_to_free_routine;
+
+static void try_to_free_from_threads(size_t size)
+{
+	read_lock();
+	release_pack_memory(size);
+	read_unlock();
+}
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define jobs_lock()		(void)0
+#define jobs_unlock()		(void)0
+#define jobs_wait()		die("BUG: waiting for bitmap jobs without threads")
+#define jobs_signal()		(void)0
+
+#endif
+
+/*
+ * Walk the commits of a job up to the nearest selected ancestors.
+ */
+static void prepare_job(struct bitmap_job *job)
+{
+	struct commit_list *todo = NULL;
+	struct commit *tip = job->stored->commit;
+
+	tip->object.flags |= SEEN;
+	mark_as_seen(&tip->object);
+	commit_list_insert(tip, &todo);
+
+	while (todo) {
+		struct commit *commit = pop_commit(&todo);
+		struct commit_list *parent;
+
+		parse_commit_or_die(commit);
+		if (!get_commit_tree(commit))
+			die("unable to read tree of commit %s",
+			    sha1_to_hex(commit->object.sha1));
+		ALLOC_GROW(job->commits, job->commits_nr + 1, job->commits_alloc);
+		job->commits[job->commits_nr++] = commit;
+
+		for (parent = commit->parents; parent; parent = parent->next) {
+			struct commit *p = parent->item;
+			struct bitmapped_commit *bc;
+
+			if (p->object.flags & SEEN)
+				continue;
+			p->object.flags |= SEEN;
+			mark_as_seen(&p->object);
+
+			bc = find_selected(p->object.sha1);
+			if (bc) {
+				ALLOC_GROW(job->bases, job->bases_nr + 1,
+					   job->bases_alloc);
+				job->bases[job->bases_nr++] = bc;
+			} else {
+				commit_list_insert(p, &todo);
+			}
+		}
 	}
+	reset_all_seen();
+}
 
-	bitmap_set(base, bitmap_pos);
-	return 1;
+static void add_tree_to_bitmap(struct bitmap *base, const unsigned char *sha1)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	uint32_t pos = find_object_pos(sha1);
+	void *buf;
+
+	if (bitmap_get(base, pos))
+		return;
+	bitmap_set(base, pos);
+
+	read_lock();
+	buf = read_sha1_file(sha1, &type, &size);
+	read_unlock();
+	if (!buf || type != OBJ_TREE)
+		die("unable to read tree %s", sha1_to_hex(sha1));
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		if (S_ISDIR(entry.mode))
+			add_tree_to_bitmap(base, entry.sha1);
+		else
+			bitmap_set(base, find_object_pos(entry.sha1));
+	}
+	free(buf);
 }
 
-static int
-should_include(struct commit *commit, void *_data)
+static void build_job(struct bitmap_job *job)
 {
-	struct bitmap *base = _data;
+	struct bitmap *base = bitmap_new();
+	unsigned int i;
 
-	if (!add_to_include_set(base, commit)) {
-		struct commit_list *parent = commit->parents;
+	for (i = 0; i < job->bases_nr; i++)
+		bitmap_or_ewah(base, job->bases[i]->bitmap);
 
-		mark_as_seen((struct object *)commit);
+	for (i = 0; i < job->commits_nr; i++) {
+		struct commit *commit = job->commits[i];
 
-		while (parent) {
-			parent->item->object.flags |= SEEN;
-			mark_as_seen((struct object *)parent->item);
-			parent = parent->next;
-		}
+		bitmap_set(base, find_object_pos(commit->object.sha1));
+		add_tree_to_bitmap(base, get_commit_tree_sha1(commit));
+	}
 
-		return 0;
+	job->stored->bitmap = bitmap_to_ewah(base);
+	bitmap_free(base);
+}
+
+static void *build_jobs(void *data)
+{
+	jobs_lock();
+	for (;;) {
+		struct bitmap_job *job;
+		unsigned int i;
+
+		while (!ready_nr && done_nr < jobs_nr)
+			jobs_wait();
+		if (!ready_nr)
+			break;
+		job = &jobs[ready[--ready_nr]];
+		jobs_unlock();
+
+		build_job(job);
+
+		jobs_lock();
+		done_nr++;
+		for (i = 0; i < job->dependents_nr; i++) {
+			struct bitmap_job *next = &jobs[job->dependents[i]];
+			if (!--next->waiting)
+				ready[ready_nr++] = job->dependents[i];
+		}
+		jobs_signal();
+		display_progress(writer.progress, ++built_nr);
 	}
+	jobs_unlock();
+	return NULL;
+}
 
-	return 1;
+static void run_jobs(int nr_threads)
+{
+#ifndef NO_PTHREADS
+	pthread_t *threads;
+	int i, ret;
+
+	if (nr_threads > jobs_nr)
+		nr_threads = jobs_nr;
+	if (nr_threads > 1) {
+		init_recursive_mutex(&read_mutex);
+		pthread_mutex_init(&jobs_mutex, NULL);
+		pthread_cond_init(&jobs_cond, NULL);
+		old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+		threads_active = 1;
+
+		threads = xcalloc(nr_threads, sizeof(*threads));
+		for (i = 0; i < nr_threads; i++) {
+			ret = pthread_create(&threads[i], NULL, build_jobs, NULL);
+			if (ret)
+				die("unable to create thread: %s", strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+
+		threads_active = 0;
+		set_try_to_free_routine(old_try_to_free_routine);
+		pthread_cond_destroy(&jobs_cond);
+		pthread_mutex_destroy(&jobs_mutex);
+		pthread_mutex_destroy(&read_mutex);
+		return;
+	}
+#endif
+	build_jobs(NULL);
 }
 
 static void compute_xor_offsets(void)
@@ -247,9 +459,8 @@ void bitmap_writer_build(struct packing_data *to_pack)
 {
 	static const double REUSE_BITMAP_THRESHOLD = 0.2;
 
-	int i, reuse_after, need_reset;
-	struct bitmap *base = bitmap_new();
-	struct rev_info revs;
+	int i, reuse_after;
+	unsigned int j, *job_of;
 
 	writer.bitmaps = kh_init_sha1();
 	writer.to_pack = to_pack;
@@ -257,67 +468,84 @@ void bitmap_writer_build(struct packing_data *to_pack)
 	if (writer.show_progress)
 		writer.progress = start_progress("Building bitmaps", writer.selected_nr);
 
-	init_revisions(&revs, NULL);
-	revs.tag_objects = 1;
-	revs.tree_objects = 1;
-	revs.blob_objects = 1;
-	revs.no_walk = 0;
-
-	revs.include_check = should_include;
-	reset_revision_walk();
-
 	reuse_after = writer.selected_nr * REUSE_BITMAP_THRESHOLD;
-	need_reset = 0;
-
-	for (i = writer.selected_nr - 1; i >= 0; --i) {
-		struct bitmapped_commit *stored;
-		struct object *object;
 
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[i];
 		khiter_t hash_pos;
 		int hash_ret;
 
-		stored = &writer.selected[i];
-		object = (struct object *)stored->commit;
-
-		if (stored->bitmap == NULL) {
-			if (i < writer.selected_nr - 1 &&
-			    (need_reset ||
-			     !in_merge_bases(writer.selected[i + 1].commit,
-					     stored->commit))) {
-			    bitmap_reset(base);
-			    reset_all_seen();
-			}
-
-			add_pending_object(&revs, object, "");
-			revs.include_check_data = base;
-
-			if (prepare_revision_walk(&revs))
-				die("revision walk setup failed");
-
-			traverse_commit_list(&revs, show_commit, show_object, base);
-
-			revs.pending.nr = 0;
-			revs.pending.alloc = 0;
-			revs.pending.objects = NULL;
-
-			stored->bitmap = bitmap_to_ewah(base);
-			need_reset = 0;
-		} else
-			need_reset = 1;
-
 		if (i >= reuse_after)
 			stored->flags |= BITMAP_FLAG_REUSE;
 
-		hash_pos = kh_put_sha1(writer.bitmaps, object->sha1, &hash_ret);
+		hash_pos = kh_put_sha1(writer.bitmaps, stored->commit->object.sha1,
+				       &hash_ret);
 		if (hash_ret == 0)
 			die("Duplicate entry when writing index: %s",
-			    sha1_to_hex(object->sha1));
+			    sha1_to_hex(stored->commit->object.sha1));
 
 		kh_value(writer.bitmaps, hash_pos) = stored;
-		display_progress(writer.progress, writer.selected_nr - i);
 	}
 
-	bitmap_free(base);
+	jobs = xcalloc(writer.selected_nr, sizeof(*jobs));
+	job_of = xmalloc(writer.selected_nr * sizeof(*job_of));
+	ready = xmalloc(writer.selected_nr * sizeof(*ready));
+	jobs_nr = ready_nr = done_nr = built_nr = 0;
+
+	/*
+	 * Bitmaps that we carried over from the old index count as done
+	 * from the start.
+	 */
+	for (i = 0; i < writer.selected_nr; i++) {
+		if (writer.selected[i].bitmap) {
+			display_progress(writer.progress, ++built_nr);
+			continue;
+		}
+		job_of[i] = jobs_nr;
+		jobs[jobs_nr++].stored = &writer.selected[i];
+	}
+
+	reset_revision_walk();
+	for (j = 0; j < jobs_nr; j++)
+		prepare_job(&jobs[j]);
+
+	/*
+	 * Let every job wait for the jobs of the bases it has to OR in.
+	 * The bases are ancestors, so there cannot be a cycle.
+	 */
+	for (j = 0; j < jobs_nr; j++) {
+		struct bitmap_job *job = &jobs[j];
+		unsigned int k;
+
+		for (k = 0; k < job->bases_nr; k++) {
+			struct bitmapped_commit *bc = job->bases[k];
+			struct bitmap_job *base_job;
+
+			if (bc->bitmap)
+				continue;
+			base_job = &jobs[job_of[bc - writer.selected]];
+			ALLOC_GROW(base_job->dependents,
+				   base_job->dependents_nr + 1,
+				   base_job->dependents_alloc);
+			base_job->dependents[base_job->dependents_nr++] = j;
+			job->waiting++;
+		}
+		if (!job->waiting)
+			ready[ready_nr++] = j;
+	}
+
+	run_jobs(writer.nr_threads);
+
+	for (j = 0; j < jobs_nr; j++) {
+		free(jobs[j].commits);
+		free(jobs[j].bases);
+		free(jobs[j].dependents);
+	}
+	free(jobs);
+	free(job_of);
+	free(ready);
+	jobs = NULL;
+
 	stop_progress(&writer.progress);
 
 	compute_xor_offsets();
@@ -354,7 +582,11 @@ static int date_compare(const void *_a, const void *_b)
 {
 	struct commit *a = *(struct commit **)_a;
 	struct commit *b = *(struct commit **)_b;
-	return (long)b->date - (long)a->date;
+
+	/* break ties by name, so that the selection is stable */
+	if (a->date != b->date)
+		return a->date < b->date ? 1 : -1;
+	return hashcmp(a->object.sha1, b->object.sha1);
 }
 
 void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack)
@@ -430,6 +662,16 @@ void bitmap_writer_select_commits(struct commit **indexed_commits,
 				if (cm->parents && cm->parents->next)
 					chosen = cm;
 			}
+
+			/*
+			 * Start the next window right after a commit that
+			 * had a bitmap already, so that the windows line up
+			 * with the previous selection and we find its next
+			 * commit too, instead of drifting by the number of
+			 * new commits.
+			 */
+			if (reused_bitmap)
+				next = j;
 		}
 
 		push_bitmapped_commit(chosen, reused_bitmap);
@@ -466,7 +708,8 @@ static const unsigned char *sha1_access(size_t pos, void *table)
 
 static void write_selected_commits_v1(struct sha1file *f,
 				      struct pack_idx_entry **index,
-				      uint32_t index_nr)
+				      uint32_t index_nr,
+				      off_t *offsets)
 {
 	int i;
 
@@ -479,6 +722,10 @@ static void write_selected_commits_v1(struct sha1file *f,
 		if (commit_pos < 0)
 			die("BUG: trying to write commit not in index");
 
+		stored->commit_pos = commit_pos;
+		if (offsets)
+			offsets[i] = f->total + f->offset;
+
 		sha1write_be32(f, commit_pos);
 		sha1write_u8(f, stored->xor_offset);
 		sha1write_u8(f, stored->flags);
@@ -487,6 +734,50 @@ static void write_selected_commits_v1(struct sha1file *f,
 	}
 }
 
+static int table_cmp(const void *_a, const void *_b)
+{
+	uint32_t a = writer.selected[*(uint32_t *)_a].commit_pos;
+	uint32_t b = writer.selected[*(uint32_t *)_b].commit_pos;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Write one row per bitmapped commit, sorted by the index position of
+ * the commit, so that readers can find and decode the bitmaps they
+ * need without reading all the others.
+ */
+static void write_lookup_table(struct sha1file *f, off_t *offsets)
+{
+	uint32_t *table, *row_of;
+	uint32_t i;
+
+	table = xmalloc(writer.selected_nr * sizeof(*table));
+	row_of = xmalloc(writer.selected_nr * sizeof(*row_of));
+
+	for (i = 0; i < writer.selected_nr; i++)
+		table[i] = i;
+	qsort(table, writer.selected_nr, sizeof(*table), table_cmp);
+	for (i = 0; i < writer.selected_nr; i++)
+		row_of[table[i]] = i;
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[table[i]];
+		uint64_t offset = offsets[table[i]];
+
+		sha1write_be32(f, stored->commit_pos);
+		sha1write_be32(f, offset >> 32);
+		sha1write_be32(f, offset & 0xffffffff);
+		if (stored->xor_offset)
+			sha1write_be32(f, row_of[table[i] - stored->xor_offset]);
+		else
+			sha1write_be32(f, BITMAP_NO_XOR_ROW);
+	}
+
+	free(table);
+	free(row_of);
+}
+
 static void write_hash_cache(struct sha1file *f,
 			     struct pack_idx_entry **index,
 			     uint32_t index_nr)
@@ -514,6 +805,7 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	static uint16_t default_version = 1;
 	static uint16_t flags = BITMAP_OPT_FULL_DAG;
 	struct sha1file *f;
+	off_t *offsets = NULL;
 
 	struct bitmap_disk_header header;
 
@@ -534,7 +826,14 @@ void bitmap_writer_finish(struct pack_idx_entry **index,
 	dump_bitmap(f, writer.trees);
 	dump_bitmap(f, writer.blobs);
 	dump_bitmap(f, writer.tags);
-	write_selected_commits_v1(f, index, index_nr);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		offsets = xcalloc(writer.selected_nr, sizeof(*offsets));
+	write_selected_commits_v1(f, index, index_nr, offsets);
+
+	if (options & BITMAP_OPT_LOOKUP_TABLE)
+		write_lookup_table(f, offsets);
+	free(offsets);
 
 	if (options & BITMAP_OPT_HASH_CACHE)
 		write_hash_cache(f, index, index_nr);
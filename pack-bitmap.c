@@ -9,6 +9,8 @@
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
 #include "pack-objects.h"
+#include "refs.h"
+#include "commit-graph.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -33,16 +35,6 @@ static struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
 	struct packed_git *pack;
 
-	/* reverse index for the packfile */
-	struct pack_revindex *reverse_index;
-
-	/*
-	 * Mark the first `reuse_objects` in the packfile as reused:
-	 * they will be sent as-is without using them for repacking
-	 * calculations
-	 */
-	uint32_t reuse_objects;
-
 	/* mmapped buffer of the whole bitmap index */
 	unsigned char *map;
 	size_t map_size; /* size of the mmaped buffer */
@@ -69,6 +61,13 @@ static struct bitmap_index {
 	/* Name-hash cache (or NULL if not present). */
 	uint32_t *hashes;
 
+	/*
+	 * Commit lookup table (or NULL if not present), and the bitmaps
+	 * loaded so far from each of its rows.
+	 */
+	const unsigned char *table;
+	struct stored_bitmap **table_bitmaps;
+
 	/*
 	 * Extended index.
 	 *
@@ -156,13 +155,26 @@ static int load_bitmap_header(struct bitmap_index *index)
 			return error("Unsupported options for bitmap index file "
 				"(Git requires BITMAP_OPT_FULL_DAG)");
 
+		index->entry_count = ntohl(header->entry_count);
+
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
 			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
 		}
+
+		if (flags & BITMAP_OPT_LOOKUP_TABLE) {
+			unsigned char *end = index->hashes ?
+				(unsigned char *)index->hashes :
+				index->map + index->map_size - 20;
+			size_t avail = end - (index->map + sizeof(*header));
+
+			if (index->entry_count > avail / BITMAP_LOOKUP_TABLE_ROW)
+				return error("Corrupted bitmap index file (lookup table too large)");
+			index->table = end - (size_t)index->entry_count *
+					     BITMAP_LOOKUP_TABLE_ROW;
+		}
 	}
 
-	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header);
 	return 0;
 }
@@ -250,6 +262,100 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 	return 0;
 }
 
+static uint64_t table_row_offset(struct bitmap_index *index, uint32_t row)
+{
+	const unsigned char *p = index->table + (size_t)row * BITMAP_LOOKUP_TABLE_ROW;
+	return ((uint64_t)get_be32(p + 4) << 32) | get_be32(p + 8);
+}
+
+/*
+ * Decode the bitmap in row "row" of the lookup table, along with the
+ * bitmaps it is XORed against, and remember it in index->bitmaps.
+ */
+static struct stored_bitmap *load_table_bitmap(struct bitmap_index *index,
+					       uint32_t row)
+{
+	const unsigned char *p = index->table + (size_t)row * BITMAP_LOOKUP_TABLE_ROW;
+	uint32_t commit_idx_pos = get_be32(p);
+	uint64_t offset = table_row_offset(index, row);
+	uint32_t xor_row = get_be32(p + 12);
+	struct stored_bitmap *xor_bitmap = NULL;
+	struct ewah_bitmap *bitmap;
+	int flags;
+
+	if (index->table_bitmaps[row])
+		return index->table_bitmaps[row];
+
+	if (xor_row != BITMAP_NO_XOR_ROW) {
+		/* the writer only XORs against bitmaps stored earlier */
+		if (xor_row >= index->entry_count ||
+		    table_row_offset(index, xor_row) >= offset) {
+			error("Corrupted bitmap lookup table (bad XOR row)");
+			return NULL;
+		}
+		xor_bitmap = load_table_bitmap(index, xor_row);
+		if (!xor_bitmap)
+			return NULL;
+	}
+
+	if (offset < sizeof(struct bitmap_disk_header) ||
+	    offset + 6 > index->table - index->map) {
+		error("Corrupted bitmap lookup table (bad offset)");
+		return NULL;
+	}
+	index->map_pos = offset;
+	if (read_be32(index->map, &index->map_pos) != commit_idx_pos) {
+		error("Corrupted bitmap lookup table (wrong commit)");
+		return NULL;
+	}
+	read_u8(index->map, &index->map_pos); /* xor offset, see xor_row */
+	flags = read_u8(index->map, &index->map_pos);
+
+	bitmap = read_bitmap_1(index);
+	if (!bitmap)
+		return NULL;
+
+	index->table_bitmaps[row] = store_bitmap(index, bitmap,
+		nth_packed_object_sha1(index->pack, commit_idx_pos),
+		xor_bitmap, flags);
+	return index->table_bitmaps[row];
+}
+
+/*
+ * Find the bitmap of the commit "sha1", decoding it from the lookup
+ * table on first use.  Returns NULL if the commit has no bitmap.
+ */
+static struct stored_bitmap *find_stored_bitmap(const unsigned char *sha1)
+{
+	khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
+	uint32_t lo = 0, hi = bitmap_git.entry_count;
+
+	if (pos < kh_end(bitmap_git.bitmaps))
+		return kh_value(bitmap_git.bitmaps, pos);
+	if (!bitmap_git.table)
+		return NULL;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *row = bitmap_git.table +
+			(size_t)mi * BITMAP_LOOKUP_TABLE_ROW;
+		uint32_t commit_idx_pos = get_be32(row);
+		int cmp;
+
+		if (commit_idx_pos >= bitmap_git.pack->num_objects)
+			break;
+		cmp = hashcmp(sha1, nth_packed_object_sha1(bitmap_git.pack,
+							   commit_idx_pos));
+		if (!cmp)
+			return load_table_bitmap(&bitmap_git, mi);
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return NULL;
+}
+
 static char *pack_bitmap_filename(struct packed_git *p)
 {
 	char *idx_name;
@@ -313,7 +419,8 @@ static int load_pack_bitmap(void)
 
 	bitmap_git.bitmaps = kh_init_sha1();
 	bitmap_git.ext_index.positions = kh_init_sha1_pos();
-	bitmap_git.reverse_index = revindex_for_pack(bitmap_git.pack);
+	if (load_pack_revindex(bitmap_git.pack))
+		goto failed;
 
 	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
 		!(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
@@ -321,7 +428,14 @@ static int load_pack_bitmap(void)
 		!(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
 		goto failed;
 
-	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+	/*
+	 * With a lookup table, the bitmaps of the commits are only read
+	 * when find_stored_bitmap() asks for them.
+	 */
+	if (bitmap_git.table)
+		bitmap_git.table_bitmaps = xcalloc(bitmap_git.entry_count,
+						   sizeof(*bitmap_git.table_bitmaps));
+	else if (load_bitmap_entries_v1(&bitmap_git) < 0)
 		goto failed;
 
 	bitmap_git.loaded = 1;
@@ -355,7 +469,8 @@ int prepare_bitmap_git(void)
 	if (bitmap_git.loaded)
 		return 0;
 
-	if (!open_pack_bitmap())
+	/* prepare_bitmap_walk() may have opened it without loading it */
+	if (bitmap_git.map || !open_pack_bitmap())
 		return load_pack_bitmap();
 
 	return -1;
@@ -382,10 +497,11 @@ static inline int bitmap_position_extended(const unsigned char *sha1)
 static inline int bitmap_position_packfile(const unsigned char *sha1)
 {
 	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
-	if (!offset)
-		return -1;
+	uint32_t pos;
 
-	return find_revindex_position(bitmap_git.reverse_index, offset);
+	if (!offset || offset_to_pack_pos(bitmap_git.pack, offset, &pos) < 0)
+		return -1;
+	return pos;
 }
 
 static int bitmap_position(const unsigned char *sha1)
@@ -447,7 +563,7 @@ static int add_to_include_set(struct include_data *data,
 			      const unsigned char *sha1,
 			      int bitmap_pos)
 {
-	khiter_t hash_pos;
+	struct stored_bitmap *st;
 
 	if (data->seen && bitmap_get(data->seen, bitmap_pos))
 		return 0;
@@ -455,9 +571,8 @@ static int add_to_include_set(struct include_data *data,
 	if (bitmap_get(data->base, bitmap_pos))
 		return 0;
 
-	hash_pos = kh_get_sha1(bitmap_git.bitmaps, sha1);
-	if (hash_pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, hash_pos);
+	st = find_stored_bitmap(sha1);
+	if (st) {
 		bitmap_or_ewah(data->base, lookup_stored_bitmap(st));
 		return 0;
 	}
@@ -511,10 +626,9 @@ static struct bitmap *find_objects(struct rev_info *revs,
 		roots = roots->next;
 
 		if (object->type == OBJ_COMMIT) {
-			khiter_t pos = kh_get_sha1(bitmap_git.bitmaps, object->sha1);
+			struct stored_bitmap *st = find_stored_bitmap(object->sha1);
 
-			if (pos < kh_end(bitmap_git.bitmaps)) {
-				struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+			if (st) {
 				struct ewah_bitmap *or_with = lookup_stored_bitmap(st);
 
 				if (base == NULL)
@@ -585,6 +699,209 @@ static struct bitmap *find_objects(struct rev_info *revs,
 	return base;
 }
 
+int bitmap_usable(void)
+{
+	/* like pack-objects, do not trust bitmaps in a shallow repository */
+	return !is_repository_shallow() && prepare_bitmap_git() >= 0;
+}
+
+struct bitmap *bitmap_for_reachable(struct object *obj)
+{
+	struct rev_info revs;
+	struct object_list *roots = NULL;
+	struct bitmap *result;
+
+	if (prepare_bitmap_git() < 0)
+		return NULL;
+
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	object_list_insert(obj, &roots);
+	result = find_objects(&revs, roots, NULL);
+	free(roots);
+	reset_revision_walk();
+
+	return result;
+}
+
+static int add_ref_root(const char *refname, const struct object_id *oid,
+			int flags, void *cb_data)
+{
+	struct object_list **roots = cb_data;
+	struct object *obj = parse_object(oid->hash);
+
+	if (obj)
+		object_list_insert(obj, roots);
+	return 0;
+}
+
+struct bitmap *bitmap_for_refs(void)
+{
+	struct rev_info revs;
+	struct object_list *roots = NULL;
+	struct bitmap *result;
+
+	if (!bitmap_usable())
+		return NULL;
+
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	head_ref(add_ref_root, &roots);
+	for_each_ref(add_ref_root, &roots);
+	result = find_objects(&revs, roots, NULL);
+	while (roots) {
+		struct object_list *next = roots->next;
+		free(roots);
+		roots = next;
+	}
+	reset_revision_walk();
+
+	return result;
+}
+
+static int has_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+struct bitmap *bitmap_for_commits(struct commit_list *list)
+{
+	struct rev_info revs;
+	struct object_list *roots = NULL;
+	struct bitmap *result;
+
+	lookup_commit_graft(null_sha1);
+	if (for_each_commit_graft(has_graft, NULL) || !bitmap_usable())
+		return NULL;
+
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	for (; list; list = list->next)
+		object_list_insert(&list->item->object, &roots);
+	if (!roots)
+		return bitmap_new();
+	result = find_objects(&revs, roots, NULL);
+	while (roots) {
+		struct object_list *next = roots->next;
+		free(roots);
+		roots = next;
+	}
+	reset_revision_walk();
+
+	return result;
+}
+
+int bitmap_mark_reachable(struct rev_info *pending)
+{
+	struct rev_info revs;
+	struct object_list *roots = NULL;
+	struct bitmap *result;
+	struct eindex *eindex = &bitmap_git.ext_index;
+	uint32_t i, nr = 0;
+
+	/*
+	 * The bitmaps record the true parents, so they would miss what
+	 * only a graft (or a shallow boundary) makes reachable.
+	 */
+	lookup_commit_graft(null_sha1);
+	if (for_each_commit_graft(has_graft, NULL) || prepare_bitmap_git() < 0)
+		return -1;
+
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	for (i = 0; i < pending->pending.nr; i++)
+		object_list_insert(pending->pending.objects[i].item, &roots);
+	object_array_clear(&pending->pending);
+
+	result = find_objects(&revs, roots, NULL);
+	while (roots) {
+		struct object_list *next = roots->next;
+		free(roots);
+		roots = next;
+	}
+	if (!result)
+		return 0;
+
+	/*
+	 * What was walked is SEEN already; the objects that came from
+	 * stored bitmaps still need the flag.
+	 */
+	for (i = 0; i < bitmap_git.pack->num_objects; i++) {
+		const unsigned char *sha1;
+
+		if (!bitmap_get(result, i))
+			continue;
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+					      pack_pos_to_index(bitmap_git.pack, i));
+		lookup_unknown_object(sha1)->flags |= SEEN;
+		nr++;
+	}
+	for (i = 0; i < eindex->count; i++) {
+		if (!bitmap_get(result, bitmap_git.pack->num_objects + i))
+			continue;
+		eindex->objects[i]->flags |= SEEN;
+		nr++;
+	}
+	bitmap_free(result);
+
+	return nr;
+}
+
+int bitmap_has_sha1(struct bitmap *bitmap, const unsigned char *sha1)
+{
+	int pos = bitmap_position(sha1);
+	return pos >= 0 && bitmap_get(bitmap, pos);
+}
+
+static int ewah_bit_is_set(struct ewah_bitmap *ewah, size_t pos)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t block = 0, len;
+
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next_run(&word, &len, &it)) {
+		block += len;
+		if (block > pos / BITS_IN_EWORD)
+			return !!(word & ((eword_t)1 << (pos % BITS_IN_EWORD)));
+	}
+	return 0;
+}
+
+int bitmap_commit_reaches(const unsigned char *sha1, const unsigned char *want)
+{
+	static int unusable;
+	struct stored_bitmap *st;
+	int pos;
+
+	if (unusable)
+		return -1;
+	if (!bitmap_usable()) {
+		unusable = 1;
+		return -1;
+	}
+
+	pos = bitmap_position_packfile(want);
+	if (pos < 0)
+		return -1;
+	st = find_stored_bitmap(sha1);
+	if (!st)
+		return -1;
+	return ewah_bit_is_set(lookup_stored_bitmap(st), pos);
+}
+
 static void show_extended_objects(struct bitmap *objects,
 				  show_reachable_fn show_reach)
 {
@@ -608,44 +925,52 @@ static void show_objects_for_type(
 	enum object_type object_type,
 	show_reachable_fn show_reach)
 {
-	size_t pos = 0, i = 0;
-	uint32_t offset;
+	size_t i = 0, len, end;
+	size_t positions[BITS_IN_EWORD];
+	unsigned nr, k;
 
 	struct ewah_iterator it;
 	eword_t filter;
 
-	if (bitmap_git.reuse_objects == bitmap_git.pack->num_objects)
-		return;
-
 	ewah_iterator_init(&it, type_filter);
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i] & filter;
-
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			const unsigned char *sha1;
-			struct revindex_entry *entry;
-			uint32_t hash = 0;
-
-			if ((word >> offset) == 0)
-				break;
-
-			offset += ewah_bit_ctz64(word >> offset);
-
-			if (pos + offset < bitmap_git.reuse_objects)
-				continue;
-
-			entry = &bitmap_git.reverse_index->revindex[pos + offset];
-			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
-
-			if (bitmap_git.hashes)
-				hash = ntohl(bitmap_git.hashes[entry->nr]);
-
-			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+	/*
+	 * The pack is sorted by type, so the filter is mostly long runs
+	 * of zeroes, which we skip without looking at the objects.
+	 */
+	while (i < objects->word_alloc &&
+	       ewah_iterator_next_run(&filter, &len, &it)) {
+		if (!filter) {
+			i += len;
+			continue;
 		}
 
-		pos += BITS_IN_EWORD;
-		i++;
+		end = i + len;
+		if (end > objects->word_alloc)
+			end = objects->word_alloc;
+		for (; i < end; i++) {
+			nr = ewah_word_positions(objects->words[i] & filter,
+						 i * BITS_IN_EWORD, positions);
+
+			for (k = 0; k < nr; k++) {
+				const unsigned char *sha1;
+				uint32_t index_pos;
+				uint32_t hash = 0;
+
+				index_pos = pack_pos_to_index(bitmap_git.pack,
+							      positions[k]);
+				sha1 = nth_packed_object_sha1(bitmap_git.pack,
+							      index_pos);
+
+				if (bitmap_git.hashes)
+					hash = ntohl(bitmap_git.hashes[index_pos]);
+
+				show_reach(sha1, object_type, 0, hash,
+					   bitmap_git.pack,
+					   pack_pos_to_offset(bitmap_git.pack,
+							      positions[k]));
+			}
+		}
 	}
 }
 
@@ -754,64 +1079,100 @@ int prepare_bitmap_walk(struct rev_info *revs)
 	return 0;
 }
 
+/*
+ * Mark the object at bit position "pos" in "reuse" if it can be copied
+ * verbatim: it has to be in the pack, and if it is a delta, its base has
+ * to be sent verbatim as well.  Bases come first in the pack, so they
+ * have already been looked at.
+ */
+static void try_partial_reuse(struct packed_git *p, size_t pos,
+			      struct bitmap *reuse,
+			      struct pack_window **w_curs)
+{
+	off_t offset, header;
+	unsigned long size;
+	int type;
+
+	if (pos >= p->num_objects)
+		return; /* in the extended index */
+
+	offset = header = pack_pos_to_offset(p, pos);
+	type = unpack_object_header(p, w_curs, &offset, &size);
+	if (type < 0)
+		return; /* broken pack; let the caller find out */
+
+	if (type == OBJ_REF_DELTA || type == OBJ_OFS_DELTA) {
+		off_t base_offset;
+		uint32_t base_pos;
+
+		base_offset = get_delta_base(p, w_curs, &offset, type, header);
+		if (!base_offset)
+			return;
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
+			return;
+		if (!bitmap_get(reuse, base_pos))
+			return;
+	}
+
+	bitmap_set(reuse, pos);
+}
+
 int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
 				       uint32_t *entries,
-				       off_t *up_to)
+				       struct bitmap **reuse_out)
 {
-	/*
-	 * Reuse the packfile content if we need more than
-	 * 90% of its objects
-	 */
-	static const double REUSE_PERCENT = 0.9;
-
+	struct packed_git *p = bitmap_git.pack;
 	struct bitmap *result = bitmap_git.result;
-	uint32_t reuse_threshold;
-	uint32_t i, reuse_objects = 0;
+	struct bitmap *reuse;
+	struct pack_window *w_curs = NULL;
+	size_t i = 0;
 
 	assert(result);
 
-	for (i = 0; i < result->word_alloc; ++i) {
-		if (result->words[i] != (eword_t)~0) {
-			reuse_objects += ewah_bit_ctz64(~result->words[i]);
-			break;
-		}
+	/*
+	 * Whole words of wanted objects at the start of the pack are
+	 * reused without looking at them, like the pack itself is when
+	 * everything in it is wanted.
+	 */
+	while (i < result->word_alloc && result->words[i] == (eword_t)~0)
+		i++;
+	if (i > p->num_objects / BITS_IN_EWORD)
+		i = p->num_objects / BITS_IN_EWORD;
 
-		reuse_objects += BITS_IN_EWORD;
+	reuse = bitmap_new();
+	if (i > reuse->word_alloc) {
+		reuse->words = ewah_realloc(reuse->words, i * sizeof(eword_t));
+		reuse->word_alloc = i;
 	}
+	memset(reuse->words, 0xff, i * sizeof(eword_t));
 
-#ifdef GIT_BITMAP_DEBUG
-	{
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
+	for (; i < result->word_alloc; i++) {
+		eword_t word = result->words[i];
+		size_t pos = i * BITS_IN_EWORD;
+		size_t offset;
 
-		entry = &bitmap_git.reverse_index->revindex[reuse_objects];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		if (pos >= p->num_objects)
+			break;
 
-		fprintf(stderr, "Failed to reuse at %d (%016llx)\n",
-			reuse_objects, result->words[i]);
-		fprintf(stderr, " %s\n", sha1_to_hex(sha1));
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			if ((word >> offset) == 0)
+				break;
+			offset += ewah_bit_ctz64(word >> offset);
+			try_partial_reuse(p, pos + offset, reuse, &w_curs);
+		}
 	}
-#endif
+	unuse_pack(&w_curs);
 
-	if (!reuse_objects)
+	*entries = bitmap_popcount(reuse);
+	if (!*entries) {
+		bitmap_free(reuse);
 		return -1;
-
-	if (reuse_objects >= bitmap_git.pack->num_objects) {
-		bitmap_git.reuse_objects = *entries = bitmap_git.pack->num_objects;
-		*up_to = -1; /* reuse the full pack */
-		*packfile = bitmap_git.pack;
-		return 0;
 	}
 
-	reuse_threshold = bitmap_popcount(bitmap_git.result) * REUSE_PERCENT;
-
-	if (reuse_objects < reuse_threshold)
-		return -1;
-
-	bitmap_git.reuse_objects = *entries = reuse_objects;
-	*up_to = bitmap_git.reverse_index->revindex[reuse_objects].offset;
-	*packfile = bitmap_git.pack;
-
+	/* the reused objects are no longer for the caller to send */
+	bitmap_and_not(result, reuse);
+	*packfile = p;
+	*reuse_out = reuse;
 	return 0;
 }
 
@@ -840,6 +1201,7 @@ static uint32_t count_object_type(struct bitmap *objects,
 	struct eindex *eindex = &bitmap_git.ext_index;
 
 	uint32_t i = 0, count = 0;
+	size_t len;
 	struct ewah_iterator it;
 	eword_t filter;
 
@@ -864,9 +1226,14 @@ static uint32_t count_object_type(struct bitmap *objects,
 		return 0;
 	}
 
-	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
-		eword_t word = objects->words[i++] & filter;
-		count += ewah_bit_popcount64(word);
+	while (i < objects->word_alloc &&
+	       ewah_iterator_next_run(&filter, &len, &it)) {
+		if (!filter) {
+			i += len;
+			continue;
+		}
+		while (len-- && i < objects->word_alloc)
+			count += ewah_bit_popcount64(objects->words[i++] & filter);
 	}
 
 	for (i = 0; i < eindex->count; ++i) {
@@ -896,6 +1263,39 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
 		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
 }
 
+int bitmap_ahead_behind(const unsigned char *one, const unsigned char *two,
+			int *num_one, int *num_two)
+{
+	static int unusable;
+	struct stored_bitmap *st_one, *st_two;
+	struct bitmap *reach_one, *reach_two;
+	uint32_t all_one, both;
+
+	if (unusable)
+		return -1;
+	/* the bitmaps record the true parents */
+	if (!commit_graph_compatible() || !bitmap_usable()) {
+		unusable = 1;
+		return -1;
+	}
+
+	st_one = find_stored_bitmap(one);
+	st_two = find_stored_bitmap(two);
+	if (!st_one || !st_two)
+		return -1;
+
+	reach_one = ewah_to_bitmap(lookup_stored_bitmap(st_one));
+	reach_two = ewah_to_bitmap(lookup_stored_bitmap(st_two));
+	all_one = count_object_type(reach_one, OBJ_COMMIT);
+	bitmap_and_not(reach_one, reach_two);
+	*num_one = count_object_type(reach_one, OBJ_COMMIT);
+	both = all_one - *num_one;
+	*num_two = count_object_type(reach_two, OBJ_COMMIT) - both;
+	bitmap_free(reach_one);
+	bitmap_free(reach_two);
+	return 0;
+}
+
 struct bitmap_test_data {
 	struct bitmap *base;
 	struct progress *prg;
@@ -934,7 +1334,7 @@ void test_bitmap_walk(struct rev_info *revs)
 {
 	struct object *root;
 	struct bitmap *result = NULL;
-	khiter_t pos;
+	struct stored_bitmap *st;
 	size_t result_popcnt;
 	struct bitmap_test_data tdata;
 
@@ -948,10 +1348,9 @@ void test_bitmap_walk(struct rev_info *revs)
 		bitmap_git.version, bitmap_git.entry_count);
 
 	root = revs->pending.objects[0].item;
-	pos = kh_get_sha1(bitmap_git.bitmaps, root->sha1);
+	st = find_stored_bitmap(root->sha1);
 
-	if (pos < kh_end(bitmap_git.bitmaps)) {
-		struct stored_bitmap *st = kh_value(bitmap_git.bitmaps, pos);
+	if (st) {
 		struct ewah_bitmap *bm = lookup_stored_bitmap(st);
 
 		fprintf(stderr, "Found bitmap for %s. %d bits / %08x checksum\n",
@@ -992,29 +1391,31 @@ static int rebuild_bitmap(uint32_t *reposition,
 			  struct ewah_bitmap *source,
 			  struct bitmap *dest)
 {
-	uint32_t pos = 0;
+	size_t pos = 0, len;
+	size_t positions[BITS_IN_EWORD];
 	struct ewah_iterator it;
 	eword_t word;
 
 	ewah_iterator_init(&it, source);
 
-	while (ewah_iterator_next(&word, &it)) {
-		uint32_t offset, bit_pos;
-
-		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
-			if ((word >> offset) == 0)
-				break;
+	while (ewah_iterator_next_run(&word, &len, &it)) {
+		if (!word) {
+			pos += len * BITS_IN_EWORD;
+			continue;
+		}
 
-			offset += ewah_bit_ctz64(word >> offset);
+		while (len--) {
+			unsigned k, nr = ewah_word_positions(word, pos, positions);
 
-			bit_pos = reposition[pos + offset];
-			if (bit_pos > 0)
-				bitmap_set(dest, bit_pos - 1);
-			else /* can't reuse, we don't have the object */
-				return -1;
+			for (k = 0; k < nr; k++) {
+				uint32_t bit_pos = reposition[positions[k]];
+				if (bit_pos > 0)
+					bitmap_set(dest, bit_pos - 1);
+				else /* can't reuse, we don't have the object */
+					return -1;
+			}
+			pos += BITS_IN_EWORD;
 		}
-
-		pos += BITS_IN_EWORD;
 	}
 	return 0;
 }
@@ -1035,20 +1436,24 @@ int rebuild_existing_bitmaps(struct packing_data *mapping,
 	if (prepare_bitmap_git() < 0)
 		return -1;
 
+	/* we want all of them; decode whatever the lookup table has left */
+	for (i = 0; bitmap_git.table && i < bitmap_git.entry_count; i++)
+		if (!load_table_bitmap(&bitmap_git, i))
+			return -1;
+
 	num_objects = bitmap_git.pack->num_objects;
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
 		const unsigned char *sha1;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git.reverse_index->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+		sha1 = nth_packed_object_sha1(bitmap_git.pack,
+					      pack_pos_to_index(bitmap_git.pack, i));
 		oe = packlist_find(mapping, sha1, NULL);
 
 		if (oe)
-			reposition[i] = oe->in_pack_pos + 1;
+			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
 	}
 
 	rebuild = bitmap_new();
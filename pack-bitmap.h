@@ -20,8 +20,13 @@ static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
 enum pack_bitmap_opts {
 	BITMAP_OPT_FULL_DAG = 1,
 	BITMAP_OPT_HASH_CACHE = 4,
+	BITMAP_OPT_LOOKUP_TABLE = 0x10,
 };
 
+/* Size of one row of the BITMAP_OPT_LOOKUP_TABLE extension */
+#define BITMAP_LOOKUP_TABLE_ROW 16
+#define BITMAP_NO_XOR_ROW 0xffffffff
+
 enum pack_bitmap_flags {
 	BITMAP_FLAG_REUSE = 0x1
 };
@@ -39,12 +44,69 @@ void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees, uint32_t *blob
 void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
 int prepare_bitmap_walk(struct rev_info *revs);
-int reuse_partial_packfile_from_bitmap(struct packed_git **packfile, uint32_t *entries, off_t *up_to);
+/*
+ * Is there a bitmap index that can answer reachability questions?
+ * Not in a shallow repository, where it would see past the boundary.
+ */
+int bitmap_usable(void);
+/*
+ * Return the set of objects reachable from "obj", or NULL if there is no
+ * usable bitmap index.  Commits without a stored bitmap are walked until
+ * the walk meets bitmapped ones.  Test membership with bitmap_has_sha1().
+ */
+struct bitmap *bitmap_for_reachable(struct object *obj);
+int bitmap_has_sha1(struct bitmap *bitmap, const unsigned char *sha1);
+/*
+ * Like bitmap_for_reachable(), but for everything reachable from any
+ * of our refs (and HEAD).  Also NULL in a shallow repository.
+ */
+struct bitmap *bitmap_for_refs(void);
+/*
+ * Like bitmap_for_reachable(), but for everything reachable from any
+ * of the commits in "list" (an empty bitmap if there are none).  NULL
+ * also in a shallow repository or when grafts change the history.
+ */
+struct bitmap *bitmap_for_commits(struct commit_list *list);
+/*
+ * Mark everything reachable from the pending objects of "pending" SEEN
+ * and empty its pending list.  What the bitmap index covers is taken
+ * from the stored bitmaps instead of being walked.  Returns the number
+ * of reachable objects, or -1 (marking nothing) if there
+ * is no usable bitmap index or grafts change the history.
+ */
+int bitmap_mark_reachable(struct rev_info *pending);
+/*
+ * Does the stored bitmap of commit "sha1" say that "want" is reachable
+ * from it?  Returns -1 if there is no usable bitmap index, "sha1" has
+ * no bitmap of its own or "want" is not in the bitmapped pack; unlike
+ * bitmap_for_reachable(), this never walks.
+ */
+int bitmap_commit_reaches(const unsigned char *sha1, const unsigned char *want);
+/*
+ * If commits "one" and "two" both have a stored bitmap, count the
+ * commits reachable from each of them but not from the other and
+ * return 0; return -1 (without walking) otherwise.
+ */
+int bitmap_ahead_behind(const unsigned char *one, const unsigned char *two,
+			int *num_one, int *num_two);
+/*
+ * Pick the objects of the bitmapped pack that can be sent verbatim: the
+ * wanted ones whose delta base, if any, is sent verbatim too.  They are
+ * marked by pack position in "*reuse_out" and left out of the objects
+ * traverse_bitmap_commit_list() shows.  Returns -1 if there are none.
+ */
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       struct bitmap **reuse_out);
 int rebuild_existing_bitmaps(struct packing_data *mapping, khash_sha1 *reused_bitmaps, int show_progress);
 
 void bitmap_writer_show_progress(int show);
+/* Compute the bitmaps with up to "nr_threads" threads. */
+void bitmap_writer_set_threads(int nr_threads);
 void bitmap_writer_set_checksum(unsigned char *sha1);
-void bitmap_writer_build_type_index(struct pack_idx_entry **index, uint32_t index_nr);
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
+				    uint32_t index_nr);
 void bitmap_writer_reuse_bitmaps(struct packing_data *to_pack);
 void bitmap_writer_select_commits(struct commit **indexed_commits,
 		unsigned int indexed_commits_nr, int max_bitmaps);
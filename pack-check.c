@@ -1,7 +1,10 @@
 #include "cache.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-sizes.h"
 #include "progress.h"
+#include "thread-utils.h"
+#include "delta.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -42,20 +45,447 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * Unpacked objects waiting to be hashed.  They are hashed in batches
+ * with hash_sha1_files(), which is faster than one at a time for small
+ * objects.
+ */
+struct verify_job {
+	const struct idx_entry *entry;
+	void *data;
+	enum object_type type;
+	unsigned long size;
+	unsigned char sha1[20];
+};
+
+#define VERIFY_BATCH 16
+#define VERIFY_BATCH_BYTES (1024 * 1024)
+
+static void hash_jobs(struct verify_job *job, int nr)
+{
+	struct hash_object_job hash[VERIFY_BATCH];
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		hash[i].buf = job[i].data;
+		hash[i].len = job[i].size;
+		hash[i].type = typename(job[i].type);
+		hash[i].sha1 = job[i].sha1;
+	}
+	hash_sha1_files(hash, nr);
+}
+
+static int check_jobs(struct packed_git *p, struct verify_job *job, int nr,
+		      verify_fn fn)
+{
+	int i, err = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (hashcmp(job[i].sha1, job[i].entry->sha1))
+			err = error("packed %s from %s is corrupt",
+				    sha1_to_hex(job[i].entry->sha1), p->pack_name);
+		else if (fn) {
+			int eaten = 0;
+			fn(job[i].entry->sha1, job[i].type, job[i].size,
+			   job[i].data, &eaten);
+			if (eaten)
+				job[i].data = NULL;
+		}
+		free(job[i].data);
+	}
+	return err;
+}
+
+static int verify_objects(struct packed_git *p, struct verify_job *job, int nr,
+			  verify_fn fn)
+{
+	hash_jobs(job, nr);
+	return check_jobs(p, job, nr, fn);
+}
+
+static int check_object_size(struct packed_git *p, const struct idx_entry *entry,
+			     enum object_type type, unsigned long size)
+{
+	enum object_type stype;
+	unsigned long ssize;
+
+	if (pack_sizes_lookup(p, entry->nr, &stype, NULL, &ssize) ||
+	    stype != type || ssize != size)
+		return error("object size table for %s is wrong about %s",
+			     p->pack_name, sha1_to_hex(entry->sha1));
+	return 0;
+}
+
+#ifndef NO_PTHREADS
+
+/*
+ * With more than one thread, each thread verifies a range of the
+ * objects sorted by offset.  Reading from the pack and the delta base
+ * cache, and calling "fn", which is free to look at other objects, all
+ * happen under verify_mutex; the threads inflate, apply deltas, check
+ * CRCs and hash on their own.
+ */
+static pthread_mutex_t verify_mutex;
+#define verify_lock()		pthread_mutex_lock(&verify_mutex)
+#define verify_unlock()		pthread_mutex_unlock(&verify_mutex)
+
+/* do not bother with a thread for fewer objects */
+#define VERIFY_THREAD_MIN_OBJECTS VERIFY_BATCH
+
+struct verify_thread {
+	pthread_t thread;
+	struct packed_git *p;
+	const struct idx_entry *entries;
+	uint32_t start, end;
+	verify_fn fn;
+	int has_sizes;
+	int err;
+};
+
+static struct progress *verify_progress;
+static uint32_t verify_progress_count;
+
+static void *inflate_raw(unsigned char *in, unsigned long len, unsigned long size)
+{
+	git_zstream stream;
+	unsigned char *out = xmallocz_gently(size);
+	int st;
+
+	if (!out)
+		return NULL;
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = in;
+	stream.avail_in = len;
+	stream.next_out = out;
+	stream.avail_out = size + 1;
+	git_inflate_init(&stream);
+	st = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	if (st != Z_STREAM_END || stream.total_out != size) {
+		free(out);
+		return NULL;
+	}
+	return out;
+}
+
+/* Copy the bytes of "entry" out of the pack; call with verify_mutex held. */
+static unsigned char *read_raw_entry(struct packed_git *p,
+				     struct pack_window **w_curs,
+				     const struct idx_entry *entry,
+				     unsigned long len)
+{
+	unsigned char *raw = xmalloc(len);
+	off_t offset = entry->offset;
+	unsigned long done = 0;
+
+	while (done < len) {
+		unsigned long avail;
+		unsigned char *data = use_pack(p, w_curs, offset + done, &avail);
+		if (avail > len - done)
+			avail = len - done;
+		memcpy(raw + done, data, avail);
+		done += avail;
+	}
+	unuse_pack(w_curs);
+	return raw;
+}
+
+static int check_raw_crc(struct packed_git *p, const unsigned char *raw,
+			 unsigned long len, unsigned int nr)
+{
+	const uint32_t *index_crc = p->index_data;
+
+	index_crc += 2 + 256 + p->num_objects * (20/4) + nr;
+	return crc32(crc32(0, NULL, 0), raw, len) != ntohl(*index_crc);
+}
+
+/*
+ * Unpack the object at "entry" from the raw bytes "raw" of its entry.
+ * Only fetching the base of a delta needs the lock.
+ */
+static void *unpack_raw_entry(struct packed_git *p, const struct idx_entry *entry,
+			      unsigned char *raw, unsigned long len,
+			      enum object_type *type, unsigned long *size)
+{
+	unsigned long used, delta_size, base_size;
+	unsigned char *pos;
+	void *delta, *base, *data = NULL;
+	enum object_type base_type;
+
+	used = unpack_object_header_buffer(raw, len, type, size);
+	if (!used)
+		return NULL;
+	pos = raw + used;
+	len -= used;
+
+	switch (*type) {
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		return inflate_raw(pos, len, *size);
+	case OBJ_OFS_DELTA:
+	case OBJ_REF_DELTA:
+		break;
+	default:
+		return NULL;
+	}
+
+	delta_size = *size;
+	verify_lock();
+	if (*type == OBJ_OFS_DELTA) {
+		off_t ofs;
+		unsigned char c = *pos++;
+
+		len--;
+		ofs = c & 127;
+		while ((c & 128) && len) {
+			ofs += 1;
+			if (!ofs || MSB(ofs, 7)) {
+				ofs = 0;
+				break;
+			}
+			c = *pos++;
+			len--;
+			ofs = (ofs << 7) + (c & 127);
+		}
+		if (!ofs || ofs >= entry->offset)
+			base = NULL;
+		else
+			base = unpack_delta_base(p, entry->offset - ofs,
+						 &base_type, &base_size);
+	} else if (len > 20) {
+		off_t base_offset = find_pack_entry_one(pos, p);
+
+		if (base_offset)
+			base = unpack_delta_base(p, base_offset,
+						 &base_type, &base_size);
+		else
+			base = read_sha1_file(pos, &base_type, &base_size);
+		pos += 20;
+		len -= 20;
+	} else
+		base = NULL;
+	verify_unlock();
+	if (!base)
+		return NULL;
+
+	delta = inflate_raw(pos, len, delta_size);
+	if (delta)
+		data = patch_delta(base, base_size, delta, delta_size, size);
+	free(delta);
+	free(base);
+	*type = base_type;
+	return data;
+}
+
+static int verify_thread_batch(struct verify_thread *t, struct verify_job *job,
+			       int nr)
+{
+	int err;
+
+	hash_jobs(job, nr);
+	verify_lock();
+	err = check_jobs(t->p, job, nr, t->fn);
+	verify_progress_count += nr;
+	if (((verify_progress_count - nr) >> 10) != (verify_progress_count >> 10))
+		display_progress(verify_progress, verify_progress_count);
+	verify_unlock();
+	return err;
+}
+
+static void *verify_thread_main(void *data)
+{
+	struct verify_thread *t = data;
+	struct packed_git *p = t->p;
+	struct pack_window *w_curs = NULL;
+	struct verify_job job[VERIFY_BATCH];
+	unsigned long job_bytes = 0;
+	int job_nr = 0;
+	uint32_t i;
+
+	for (i = t->start; i < t->end; i++) {
+		const struct idx_entry *entry = &t->entries[i];
+		unsigned long len = entry[1].offset - entry->offset;
+		unsigned char *raw;
+		enum object_type type;
+		unsigned long size;
+		void *obj;
+
+		verify_lock();
+		raw = read_raw_entry(p, &w_curs, entry, len);
+		verify_unlock();
+
+		if (p->index_version > 1 && check_raw_crc(p, raw, len, entry->nr))
+			t->err = error("index CRC mismatch for object %s "
+				       "from %s at offset %"PRIuMAX"",
+				       sha1_to_hex(entry->sha1),
+				       p->pack_name, (uintmax_t)entry->offset);
+		obj = unpack_raw_entry(p, entry, raw, len, &type, &size);
+		free(raw);
+
+		if (!obj || job_nr == VERIFY_BATCH ||
+		    job_bytes >= VERIFY_BATCH_BYTES) {
+			t->err |= verify_thread_batch(t, job, job_nr);
+			job_nr = 0;
+			job_bytes = 0;
+		}
+		if (!obj) {
+			t->err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+				       sha1_to_hex(entry->sha1), p->pack_name,
+				       (uintmax_t)entry->offset);
+			continue;
+		}
+		if (t->has_sizes && check_object_size(p, entry, type, size))
+			t->err = -1;
+		job[job_nr].entry = entry;
+		job[job_nr].data = obj;
+		job[job_nr].type = type;
+		job[job_nr++].size = size;
+		job_bytes += size;
+	}
+	t->err |= verify_thread_batch(t, job, job_nr);
+	return NULL;
+}
+
+/*
+ * The checksum of the whole pack is computed by a thread of its own,
+ * reading the pack sequentially through a file descriptor of its own
+ * while the other threads check the objects.
+ */
+struct pack_hash_thread {
+	pthread_t thread;
+	struct packed_git *p;
+	off_t len;
+	unsigned char sha1[20];
+	int err;
+};
+
+#define PACK_HASH_CHUNK (1024 * 1024)
+
+static void *pack_hash_thread_main(void *data)
+{
+	struct pack_hash_thread *t = data;
+	unsigned char *buf = xmalloc(PACK_HASH_CHUNK);
+	git_SHA_CTX ctx;
+	off_t done = 0;
+	int fd;
+
+	fd = git_open_noatime(t->p->pack_name);
+	if (fd < 0) {
+		t->err = error("unable to open %s: %s", t->p->pack_name,
+			       strerror(errno));
+		free(buf);
+		return NULL;
+	}
+	git_SHA1_Init(&ctx);
+	while (done < t->len) {
+		size_t want = PACK_HASH_CHUNK;
+		ssize_t got;
+
+		if (want > t->len - done)
+			want = t->len - done;
+		got = read_in_full(fd, buf, want);
+		if (got <= 0) {
+			t->err = error("unable to read %s", t->p->pack_name);
+			break;
+		}
+		git_SHA1_Update(&ctx, buf, got);
+		done += got;
+	}
+	git_SHA1_Final(t->sha1, &ctx);
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void start_pack_hash_thread(struct pack_hash_thread *t,
+				   struct packed_git *p, off_t len)
+{
+	memset(t, 0, sizeof(*t));
+	t->p = p;
+	t->len = len;
+	if (pthread_create(&t->thread, NULL, pack_hash_thread_main, t))
+		die("unable to create pack hash thread");
+}
+
+static int finish_pack_hash_thread(struct pack_hash_thread *t,
+				   unsigned char *sha1)
+{
+	if (pthread_join(t->thread, NULL))
+		die("unable to join pack hash thread");
+	hashcpy(sha1, t->sha1);
+	return t->err;
+}
+
+static int verify_objects_threaded(struct packed_git *p,
+				   const struct idx_entry *entries,
+				   uint32_t nr_objects, int has_sizes,
+				   verify_fn fn, int nr_threads,
+				   struct progress *progress, uint32_t base_count)
+{
+	struct verify_thread *threads;
+	uint32_t start = 0;
+	int i, err = 0;
+
+	threads = xcalloc(nr_threads, sizeof(*threads));
+	pthread_mutex_init(&verify_mutex, NULL);
+	verify_progress = progress;
+	verify_progress_count = base_count;
+
+	for (i = 0; i < nr_threads; i++) {
+		struct verify_thread *t = &threads[i];
+
+		t->p = p;
+		t->entries = entries;
+		t->start = start;
+		t->end = start + (nr_objects - start) / (nr_threads - i);
+		t->fn = fn;
+		t->has_sizes = has_sizes;
+		start = t->end;
+		if (pthread_create(&t->thread, NULL, verify_thread_main, t))
+			die("unable to create verify thread");
+	}
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_join(threads[i].thread, NULL))
+			die("unable to join verify thread");
+		err |= threads[i].err;
+	}
+
+	display_progress(progress, base_count + nr_objects);
+	pthread_mutex_destroy(&verify_mutex);
+	free(threads);
+	return err;
+}
+
+#endif
+
 static int verify_packfile(struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
 	const unsigned char *index_base = p->index_data;
 	git_SHA_CTX ctx;
-	unsigned char sha1[20], *pack_sig;
+	unsigned char sha1[20], pack_sig[20];
 	off_t offset = 0, pack_sig_ofs = 0;
 	uint32_t nr_objects, i;
-	int err = 0;
+	int err = 0, has_sizes;
 	struct idx_entry *entries;
+	struct verify_job job[VERIFY_BATCH];
+	unsigned long job_bytes = 0;
+	int job_nr = 0;
+#ifndef NO_PTHREADS
+	struct pack_hash_thread hash_thread;
+
+	if (nr_threads > p->num_objects / VERIFY_THREAD_MIN_OBJECTS)
+		nr_threads = p->num_objects / VERIFY_THREAD_MIN_OBJECTS;
+#else
+	nr_threads = 1;
+#endif
 
 	/* Note that the pack header checks are actually performed by
 	 * use_pack when it first opens the pack file.  If anything
@@ -63,26 +493,34 @@ static int verify_packfile(struct packed_git *p,
 	 * immediately.
 	 */
 
-	git_SHA1_Init(&ctx);
-	do {
-		unsigned long remaining;
-		unsigned char *in = use_pack(p, w_curs, offset, &remaining);
-		offset += remaining;
-		if (!pack_sig_ofs)
-			pack_sig_ofs = p->pack_size - 20;
-		if (offset > pack_sig_ofs)
-			remaining -= (unsigned int)(offset - pack_sig_ofs);
-		git_SHA1_Update(&ctx, in, remaining);
-	} while (offset < pack_sig_ofs);
-	git_SHA1_Final(sha1, &ctx);
-	pack_sig = use_pack(p, w_curs, pack_sig_ofs, NULL);
-	if (hashcmp(sha1, pack_sig))
+	if (nr_threads > 1) {
+#ifndef NO_PTHREADS
+		use_pack(p, w_curs, 0, NULL);
+		pack_sig_ofs = p->pack_size - 20;
+		start_pack_hash_thread(&hash_thread, p, pack_sig_ofs);
+#endif
+	} else {
+		git_SHA1_Init(&ctx);
+		do {
+			unsigned long remaining;
+			unsigned char *in = use_pack(p, w_curs, offset, &remaining);
+			offset += remaining;
+			if (!pack_sig_ofs)
+				pack_sig_ofs = p->pack_size - 20;
+			if (offset > pack_sig_ofs)
+				remaining -= (unsigned int)(offset - pack_sig_ofs);
+			git_SHA1_Update(&ctx, in, remaining);
+		} while (offset < pack_sig_ofs);
+		git_SHA1_Final(sha1, &ctx);
+	}
+	hashcpy(pack_sig, use_pack(p, w_curs, pack_sig_ofs, NULL));
+	unuse_pack(w_curs);
+	if (nr_threads <= 1 && hashcmp(sha1, pack_sig))
 		err = error("%s SHA1 checksum mismatch",
 			    p->pack_name);
 	if (hashcmp(index_base + index_size - 40, pack_sig))
 		err = error("%s SHA1 does not match its index",
 			    p->pack_name);
-	unuse_pack(w_curs);
 
 	/* Make sure everything reachable from idx is valid.  Since we
 	 * have verified that nr_objects matches between idx and pack,
@@ -100,6 +538,21 @@ static int verify_packfile(struct packed_git *p,
 		entries[i].nr = i;
 	}
 	qsort(entries, nr_objects, sizeof(*entries), compare_entries);
+	has_sizes = !load_pack_sizes(p);
+
+#ifndef NO_PTHREADS
+	if (nr_threads > 1) {
+		err |= verify_objects_threaded(p, entries, nr_objects, has_sizes,
+					       fn, nr_threads, progress, base_count);
+		free(entries);
+		if (finish_pack_hash_thread(&hash_thread, sha1))
+			return -1;
+		if (hashcmp(sha1, pack_sig))
+			err = error("%s SHA1 checksum mismatch",
+				    p->pack_name);
+		return err;
+	}
+#endif
 
 	for (i = 0; i < nr_objects; i++) {
 		void *data;
@@ -117,24 +570,30 @@ static int verify_packfile(struct packed_git *p,
 					    p->pack_name, (uintmax_t)offset);
 		}
 		data = unpack_entry(p, entries[i].offset, &type, &size);
+		if (!data || job_nr == VERIFY_BATCH ||
+		    job_bytes >= VERIFY_BATCH_BYTES) {
+			err |= verify_objects(p, job, job_nr, fn);
+			job_nr = 0;
+			job_bytes = 0;
+		}
 		if (!data)
 			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
 				    sha1_to_hex(entries[i].sha1), p->pack_name,
 				    (uintmax_t)entries[i].offset);
-		else if (check_sha1_signature(entries[i].sha1, data, size, typename(type)))
-			err = error("packed %s from %s is corrupt",
-				    sha1_to_hex(entries[i].sha1), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			fn(entries[i].sha1, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+		else {
+			if (has_sizes && check_object_size(p, &entries[i], type, size))
+				err = -1;
+			job[job_nr].entry = &entries[i];
+			job[job_nr].data = data;
+			job[job_nr].type = type;
+			job[job_nr++].size = size;
+			job_bytes += size;
 		}
 		if (((base_count + i) & 1023) == 0)
 			display_progress(progress, base_count + i);
-		free(data);
 
 	}
+	err |= verify_objects(p, job, job_nr, fn);
 	display_progress(progress, base_count + i);
 	free(entries);
 
@@ -164,8 +623,44 @@ int verify_pack_index(struct packed_git *p)
 	return err;
 }
 
+/*
+ * Check that an on-disk reverse index, if the pack has one, lists each
+ * object exactly once and in increasing offset order.
+ */
+static int verify_pack_revindex(struct packed_git *p)
+{
+	unsigned char *seen;
+	uint32_t i;
+	int err = 0;
+
+	if (!p->revindex && load_pack_revindex_from_disk(p))
+		return 0; /* no .rev file: nothing on disk to check */
+	if (!p->revindex_data)
+		return 0;
+
+	seen = xcalloc(p->num_objects, 1);
+	for (i = 0; i < p->num_objects; i++) {
+		uint32_t nr = get_be32(p->revindex_data + i);
+
+		if (nr >= p->num_objects || seen[nr]) {
+			err = error("reverse index for %s has a bad entry at %"PRIu32,
+				    p->pack_name, i);
+			break;
+		}
+		seen[nr] = 1;
+		if (i && pack_pos_to_offset(p, i - 1) >= pack_pos_to_offset(p, i)) {
+			err = error("reverse index for %s is out of order at %"PRIu32,
+				    p->pack_name, i);
+			break;
+		}
+	}
+	free(seen);
+	return err;
+}
+
 int verify_pack(struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count,
+		int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -174,8 +669,9 @@ int verify_pack(struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(p, &w_curs, fn, progress, base_count, nr_threads);
 	unuse_pack(&w_curs);
+	err |= verify_pack_revindex(p);
 
 	return err;
 }
@@ -95,10 +95,17 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 		REALLOC_ARRAY(pdata->objects, pdata->nr_alloc);
 	}
 
+	if (pdata->in_pack && pdata->nr_objects >= pdata->in_pack_alloc) {
+		pdata->in_pack_alloc = pdata->nr_alloc;
+		REALLOC_ARRAY(pdata->in_pack, pdata->in_pack_alloc);
+	}
+
 	new_entry = pdata->objects + pdata->nr_objects++;
 
 	memset(new_entry, 0, sizeof(*new_entry));
 	hashcpy(new_entry->idx.sha1, sha1);
+	if (pdata->in_pack)
+		pdata->in_pack[pdata->nr_objects - 1] = NULL;
 
 	if (pdata->index_size * 3 <= pdata->nr_objects * 4)
 		rehash_objects(pdata);
@@ -107,3 +114,103 @@ struct object_entry *packlist_alloc(struct packing_data *pdata,
 
 	return new_entry;
 }
+
+#ifndef NO_PTHREADS
+#define packing_data_lock(pdata)	pthread_mutex_lock(&(pdata)->lock)
+#define packing_data_unlock(pdata)	pthread_mutex_unlock(&(pdata)->lock)
+#else
+#define packing_data_lock(pdata)	(void)0
+#define packing_data_unlock(pdata)	(void)0
+#endif
+
+static void use_in_pack_array(struct packing_data *pdata)
+{
+	uint32_t i;
+
+	pdata->in_pack_alloc = pdata->nr_alloc;
+	pdata->in_pack = xcalloc(pdata->in_pack_alloc, sizeof(*pdata->in_pack));
+	for (i = 0; i < pdata->nr_objects; i++)
+		pdata->in_pack[i] =
+			pdata->in_pack_by_idx[pdata->objects[i].in_pack_idx];
+	free(pdata->in_pack_by_idx);
+	pdata->in_pack_by_idx = NULL;
+}
+
+void prepare_packing_data(struct packing_data *pdata)
+{
+	/* slot 0 is for objects not in any pack */
+	pdata->in_pack_by_idx = xcalloc(1U << OE_IN_PACK_BITS,
+					sizeof(*pdata->in_pack_by_idx));
+	pdata->in_pack_by_idx_nr = 1;
+	if (git_env_bool("GIT_TEST_FULL_IN_PACK_ARRAY", 0))
+		use_in_pack_array(pdata);
+
+	pdata->oe_size_limit = git_env_ulong("GIT_TEST_OE_SIZE",
+					     1UL << OE_SIZE_BITS);
+	pdata->oe_delta_size_limit = git_env_ulong("GIT_TEST_OE_DELTA_SIZE",
+						   1UL << OE_DELTA_SIZE_BITS);
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&pdata->lock, NULL);
+#endif
+}
+
+void oe_set_in_pack(struct packing_data *pdata, struct object_entry *e,
+		    struct packed_git *p)
+{
+	if (pdata->in_pack_by_idx) {
+		if (!p) {
+			e->in_pack_idx = 0;
+			return;
+		}
+		if (!p->index &&
+		    pdata->in_pack_by_idx_nr < (1U << OE_IN_PACK_BITS)) {
+			p->index = pdata->in_pack_by_idx_nr++;
+			pdata->in_pack_by_idx[p->index] = p;
+		}
+		if (p->index) {
+			e->in_pack_idx = p->index;
+			return;
+		}
+		use_in_pack_array(pdata);
+	}
+	pdata->in_pack[oe_index(pdata, e)] = p;
+}
+
+unsigned long oe_get_big_size(struct packing_data *pdata,
+			      const struct object_entry *e, int delta)
+{
+	kh_oe_big_size_t *sizes = delta ? pdata->big_delta_sizes : pdata->big_sizes;
+	unsigned long size = 0;
+	khint_t pos;
+
+	if (delta)
+		packing_data_lock(pdata);
+	if (sizes) {
+		pos = kh_get_oe_big_size(sizes, oe_index(pdata, e));
+		if (pos != kh_end(sizes))
+			size = kh_value(sizes, pos);
+	}
+	if (delta)
+		packing_data_unlock(pdata);
+	return size;
+}
+
+void oe_set_big_size(struct packing_data *pdata,
+		     struct object_entry *e, int delta, unsigned long size)
+{
+	kh_oe_big_size_t **sizes = delta ? &pdata->big_delta_sizes : &pdata->big_sizes;
+	khint_t pos;
+	int hash_ret;
+
+	if (delta) {
+		packing_data_lock(pdata);
+		e->delta_size_valid = 0;
+	} else
+		e->size_valid = 0;
+	if (!*sizes)
+		*sizes = kh_init_oe_big_size();
+	pos = kh_put_oe_big_size(*sizes, oe_index(pdata, e), &hash_ret);
+	kh_value(*sizes, pos) = size;
+	if (delta)
+		packing_data_unlock(pdata);
+}
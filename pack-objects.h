@@ -1,42 +1,91 @@
 #ifndef PACK_OBJECTS_H
 #define PACK_OBJECTS_H
 
+#include "khash.h"
+#include "thread-utils.h"
+
+/*
+ * Packing a repository holds one of these for every object, so they are
+ * kept small: links to other entries and the pack an object is in are
+ * small indices, and sizes that do not fit in their fields live in side
+ * tables of the packing_data (see the accessors below).
+ */
+#define OE_SIZE_BITS		31
+#define OE_DELTA_SIZE_BITS	21
+#define OE_Z_DELTA_BITS		20
+#define OE_IN_PACK_BITS		10
+#define OE_HEADER_SIZE_BITS	5
+
 struct object_entry {
 	struct pack_idx_entry idx;
-	unsigned long size;	/* uncompressed size */
-	struct packed_git *in_pack;	/* already in pack */
-	off_t in_pack_offset;
-	struct object_entry *delta;	/* delta base object */
-	struct object_entry *delta_child; /* deltified objects who bases me */
-	struct object_entry *delta_sibling; /* other deltified objects who
-					     * uses the same base as me
-					     */
 	void *delta_data;	/* cached delta (uncompressed) */
-	unsigned long delta_size;	/* delta data size (uncompressed) */
-	unsigned long z_delta_size;	/* delta data size (compressed) */
-	enum object_type type;
-	enum object_type in_pack_type;	/* could be delta */
+	off_t in_pack_offset;
+	uint32_t delta_idx;	/* delta base object */
+	uint32_t delta_child_idx; /* deltified objects who bases me */
+	uint32_t delta_sibling_idx; /* other deltified objects who
+				     * uses the same base as me
+				     */
 	uint32_t hash;			/* name hint hash */
-	unsigned int in_pack_pos;
-	unsigned char in_pack_header_size;
+	unsigned size_:OE_SIZE_BITS;	/* uncompressed size */
+	unsigned size_valid:1;
+	unsigned delta_size_:OE_DELTA_SIZE_BITS; /* delta data size (uncompressed) */
+	unsigned delta_size_valid:1;
+	unsigned type_:TYPE_BITS;
+	unsigned type_valid:1;
+	unsigned in_pack_type:TYPE_BITS;	/* could be delta */
 	unsigned preferred_base:1; /*
 				    * we do not pack this, but is available
 				    * to be used as the base object to delta
 				    * objects against.
 				    */
 	unsigned no_try_delta:1;
+	unsigned z_delta_size:OE_Z_DELTA_BITS;	/* delta data size (compressed) */
+	unsigned in_pack_idx:OE_IN_PACK_BITS;	/* already in pack */
 	unsigned tagged:1; /* near the very tip of refs */
 	unsigned filled:1; /* assigned write-order */
+	unsigned delta_searched:1; /* DELTA() is what a delta search decided */
+	unsigned written_type:TYPE_BITS;	/* could be delta */
+	unsigned in_pack_header_size:OE_HEADER_SIZE_BITS;
 };
 
+#define oe_idx_hash(key) ((khint_t)(key))
+#define oe_idx_equal(a, b) ((a) == (b))
+KHASH_INIT(oe_big_size, uint32_t, unsigned long, 1, oe_idx_hash, oe_idx_equal)
+
 struct packing_data {
 	struct object_entry *objects;
 	uint32_t nr_objects, nr_alloc;
 
 	int32_t *index;
 	uint32_t index_size;
+
+	/*
+	 * The packs objects are in, by in_pack_idx.  With too many packs
+	 * for that field, in_pack has the pack of every object instead.
+	 */
+	struct packed_git **in_pack_by_idx;
+	unsigned int in_pack_by_idx_nr;
+	struct packed_git **in_pack;
+	uint32_t in_pack_alloc;
+
+	/*
+	 * Sizes too big for their fields, by position in "objects".  The
+	 * limits are only lowered by tests, to exercise these tables.
+	 */
+	kh_oe_big_size_t *big_sizes;
+	kh_oe_big_size_t *big_delta_sizes;
+	unsigned long oe_size_limit;
+	unsigned long oe_delta_size_limit;
+#ifndef NO_PTHREADS
+	pthread_mutex_t lock;	/* for big_delta_sizes */
+#endif
+
+	/* position of each object in the pack being written */
+	uint32_t *in_pack_pos;
 };
 
+void prepare_packing_data(struct packing_data *pdata);
+
 struct object_entry *packlist_alloc(struct packing_data *pdata,
 				    const unsigned char *sha1,
 				    uint32_t index_pos);
@@ -45,6 +94,146 @@ struct object_entry *packlist_find(struct packing_data *pdata,
 				   const unsigned char *sha1,
 				   uint32_t *index_pos);
 
+static inline uint32_t oe_index(const struct packing_data *pdata,
+				const struct object_entry *e)
+{
+	return e - pdata->objects;
+}
+
+static inline enum object_type oe_type(const struct object_entry *e)
+{
+	return e->type_valid ? e->type_ : OBJ_BAD;
+}
+
+static inline void oe_set_type(struct object_entry *e, enum object_type type)
+{
+	if (type >= OBJ_ANY)
+		die("BUG: unexpected object type %d", type);
+	e->type_valid = type >= OBJ_NONE;
+	e->type_ = (unsigned)type;
+}
+
+static inline struct packed_git *oe_in_pack(const struct packing_data *pdata,
+					    const struct object_entry *e)
+{
+	if (pdata->in_pack_by_idx)
+		return pdata->in_pack_by_idx[e->in_pack_idx];
+	return pdata->in_pack[oe_index(pdata, e)];
+}
+
+void oe_set_in_pack(struct packing_data *pdata, struct object_entry *e,
+		    struct packed_git *p);
+
+static inline struct object_entry *oe_link(const struct packing_data *pdata,
+					   uint32_t idx)
+{
+	return idx ? &pdata->objects[idx - 1] : NULL;
+}
+
+static inline uint32_t oe_link_idx(const struct packing_data *pdata,
+				   const struct object_entry *e)
+{
+	return e ? oe_index(pdata, e) + 1 : 0;
+}
+
+static inline struct object_entry *oe_delta(const struct packing_data *pdata,
+					    const struct object_entry *e)
+{
+	return oe_link(pdata, e->delta_idx);
+}
+
+static inline void oe_set_delta(const struct packing_data *pdata,
+				struct object_entry *e,
+				struct object_entry *delta)
+{
+	e->delta_idx = oe_link_idx(pdata, delta);
+}
+
+static inline struct object_entry *oe_delta_child(const struct packing_data *pdata,
+						  const struct object_entry *e)
+{
+	return oe_link(pdata, e->delta_child_idx);
+}
+
+static inline void oe_set_delta_child(const struct packing_data *pdata,
+				      struct object_entry *e,
+				      struct object_entry *child)
+{
+	e->delta_child_idx = oe_link_idx(pdata, child);
+}
+
+static inline struct object_entry *oe_delta_sibling(const struct packing_data *pdata,
+						    const struct object_entry *e)
+{
+	return oe_link(pdata, e->delta_sibling_idx);
+}
+
+static inline void oe_set_delta_sibling(const struct packing_data *pdata,
+					struct object_entry *e,
+					struct object_entry *sibling)
+{
+	e->delta_sibling_idx = oe_link_idx(pdata, sibling);
+}
+
+unsigned long oe_get_big_size(struct packing_data *pdata,
+			      const struct object_entry *e, int delta);
+void oe_set_big_size(struct packing_data *pdata,
+		     struct object_entry *e, int delta, unsigned long size);
+
+static inline unsigned long oe_size(struct packing_data *pdata,
+				    const struct object_entry *e)
+{
+	if (e->size_valid)
+		return e->size_;
+	return oe_get_big_size(pdata, e, 0);
+}
+
+static inline void oe_set_size(struct packing_data *pdata,
+			       struct object_entry *e, unsigned long size)
+{
+	if (size < pdata->oe_size_limit) {
+		e->size_ = size;
+		e->size_valid = 1;
+	} else
+		oe_set_big_size(pdata, e, 0, size);
+}
+
+/*
+ * Unlike the size, the delta size is looked at and changed by the
+ * delta search threads; the side table of big ones takes a lock.
+ */
+static inline unsigned long oe_delta_size(struct packing_data *pdata,
+					  const struct object_entry *e)
+{
+	if (e->delta_size_valid)
+		return e->delta_size_;
+	return oe_get_big_size(pdata, e, 1);
+}
+
+static inline void oe_set_delta_size(struct packing_data *pdata,
+				     struct object_entry *e,
+				     unsigned long size)
+{
+	if (size < pdata->oe_delta_size_limit) {
+		e->delta_size_ = size;
+		e->delta_size_valid = 1;
+	} else
+		oe_set_big_size(pdata, e, 1, size);
+}
+
+static inline uint32_t oe_in_pack_pos(const struct packing_data *pdata,
+				      const struct object_entry *e)
+{
+	return pdata->in_pack_pos[oe_index(pdata, e)];
+}
+
+static inline void oe_set_in_pack_pos(const struct packing_data *pdata,
+				      const struct object_entry *e,
+				      uint32_t pos)
+{
+	pdata->in_pack_pos[oe_index(pdata, e)] = pos;
+}
+
 static inline uint32_t pack_name_hash(const char *name)
 {
 	uint32_t c, hash = 0;
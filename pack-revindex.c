@@ -8,52 +8,17 @@
  * size is easily available by examining the pack entry header).  It is
  * also rather expensive to find the sha1 for an object given its offset.
  *
- * We build a hashtable of existing packs (pack_revindex), and keep reverse
- * index here -- pack index file is sorted by object name mapping to offset;
- * this pack_revindex[].revindex array is a list of offset/index_nr pairs
- * ordered by offset, so if you know the offset of an object, next offset
- * is where its packed representation ends and the index_nr can be used to
- * get the object sha1 from the main index.
+ * We keep a reverse index here -- pack index file is sorted by object
+ * name mapping to offset; the reverse index lists the index_nr of each
+ * object ordered by offset, so if you know the offset of an object, next
+ * offset is where its packed representation ends and the index_nr can be
+ * used to get the object sha1 from the main index.
+ *
+ * index-pack and pack-objects can store the reverse index next to the
+ * .idx file as a .rev file, which we simply mmap.  For packs without
+ * one we compute it as an array of offset/index_nr pairs.
  */
 
-static struct pack_revindex *pack_revindex;
-static int pack_revindex_hashsz;
-
-static int pack_revindex_ix(struct packed_git *p)
-{
-	unsigned long ui = (unsigned long)p;
-	int i;
-
-	ui = ui ^ (ui >> 16); /* defeat structure alignment */
-	i = (int)(ui % pack_revindex_hashsz);
-	while (pack_revindex[i].p) {
-		if (pack_revindex[i].p == p)
-			return i;
-		if (++i == pack_revindex_hashsz)
-			i = 0;
-	}
-	return -1 - i;
-}
-
-static void init_pack_revindex(void)
-{
-	int num;
-	struct packed_git *p;
-
-	for (num = 0, p = packed_git; p; p = p->next)
-		num++;
-	if (!num)
-		return;
-	pack_revindex_hashsz = num * 11;
-	pack_revindex = xcalloc(pack_revindex_hashsz, sizeof(*pack_revindex));
-	for (p = packed_git; p; p = p->next) {
-		num = pack_revindex_ix(p);
-		num = - 1 - num;
-		pack_revindex[num].p = p;
-	}
-	/* revindex elements are lazily initialized */
-}
-
 /*
  * This is a least-significant-digit radix sort.
  *
@@ -154,14 +119,13 @@ static void sort_revindex(struct revindex_entry *entries, unsigned n, off_t max)
 /*
  * Ordered list of offsets of objects in the pack.
  */
-static void create_pack_revindex(struct pack_revindex *rix)
+static void create_pack_revindex(struct packed_git *p)
 {
-	struct packed_git *p = rix->p;
 	unsigned num_ent = p->num_objects;
 	unsigned i;
 	const char *index = p->index_data;
 
-	rix->revindex = xmalloc(sizeof(*rix->revindex) * (num_ent + 1));
+	p->revindex = xmalloc(sizeof(*p->revindex) * (num_ent + 1));
 	index += 4 * 256;
 
 	if (p->index_version > 1) {
@@ -171,77 +135,169 @@ static void create_pack_revindex(struct pack_revindex *rix)
 		for (i = 0; i < num_ent; i++) {
 			uint32_t off = ntohl(*off_32++);
 			if (!(off & 0x80000000)) {
-				rix->revindex[i].offset = off;
+				p->revindex[i].offset = off;
 			} else {
-				rix->revindex[i].offset =
+				p->revindex[i].offset =
 					((uint64_t)ntohl(*off_64++)) << 32;
-				rix->revindex[i].offset |=
+				p->revindex[i].offset |=
 					ntohl(*off_64++);
 			}
-			rix->revindex[i].nr = i;
+			p->revindex[i].nr = i;
 		}
 	} else {
 		for (i = 0; i < num_ent; i++) {
 			uint32_t hl = *((uint32_t *)(index + 24 * i));
-			rix->revindex[i].offset = ntohl(hl);
-			rix->revindex[i].nr = i;
+			p->revindex[i].offset = ntohl(hl);
+			p->revindex[i].nr = i;
 		}
 	}
 
 	/* This knows the pack format -- the 20-byte trailer
 	 * follows immediately after the last object data.
 	 */
-	rix->revindex[num_ent].offset = p->pack_size - 20;
-	rix->revindex[num_ent].nr = -1;
-	sort_revindex(rix->revindex, num_ent, p->pack_size);
+	p->revindex[num_ent].offset = p->pack_size - 20;
+	p->revindex[num_ent].nr = -1;
+	sort_revindex(p->revindex, num_ent, p->pack_size);
+}
+
+static char *pack_revindex_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		die("BUG: pack name '%s' does not end in .pack", p->pack_name);
+	return xstrfmt("%.*s.rev", (int)len, p->pack_name);
 }
 
-struct pack_revindex *revindex_for_pack(struct packed_git *p)
+int load_pack_revindex_from_disk(struct packed_git *p)
 {
-	int num;
-	struct pack_revindex *rix;
+	char *rev_name = pack_revindex_filename(p);
+	const unsigned char *data;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd, ret = -1;
+
+	if (p->revindex_data)
+		goto out_ok;
+	if (open_pack_index(p))
+		goto out;
+	fd = git_open_noatime(rev_name);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	size = xsize_t(st.st_size);
+	if (size != RIDX_HEADER_SIZE + (uint64_t)p->num_objects * 4 + 40) {
+		close(fd);
+		error("reverse index %s has the wrong size", rev_name);
+		goto out;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != RIDX_SIGNATURE ||
+	    get_be32(data + 4) != RIDX_VERSION ||
+	    get_be32(data + 8) != 1 /* SHA-1 */) {
+		error("reverse index %s has a bad header", rev_name);
+		munmap(map, size);
+		goto out;
+	}
+	/*
+	 * Both the .idx and the .rev file record the checksum of the
+	 * pack they describe; make sure they agree.
+	 */
+	if (hashcmp(data + size - 40,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		error("reverse index %s does not match its pack", rev_name);
+		munmap(map, size);
+		goto out;
+	}
 
-	if (!pack_revindex_hashsz)
-		init_pack_revindex();
+	p->revindex_map = map;
+	p->revindex_size = size;
+	p->revindex_data = (const uint32_t *)(data + RIDX_HEADER_SIZE);
+out_ok:
+	ret = 0;
+out:
+	free(rev_name);
+	return ret;
+}
 
-	num = pack_revindex_ix(p);
-	if (num < 0)
-		die("internal error: pack revindex fubar");
+int load_pack_revindex(struct packed_git *p)
+{
+	if (p->revindex || p->revindex_data)
+		return 0;
+	if (open_pack_index(p))
+		return -1;
+	if (load_pack_revindex_from_disk(p))
+		create_pack_revindex(p);
+	return 0;
+}
+
+static void prepare_revindex(struct packed_git *p)
+{
+	if (load_pack_revindex(p))
+		die("unable to load reverse index of %s", p->pack_name);
+}
 
-	rix = &pack_revindex[num];
-	if (!rix->revindex)
-		create_pack_revindex(rix);
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
+{
+	prepare_revindex(p);
+	if (pos >= p->num_objects)
+		die("BUG: pack position %"PRIu32" out of range", pos);
+	if (p->revindex_data)
+		return get_be32(p->revindex_data + pos);
+	return p->revindex[pos].nr;
+}
 
-	return rix;
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	prepare_revindex(p);
+	if (pos > p->num_objects)
+		die("BUG: pack position %"PRIu32" out of range", pos);
+	if (p->revindex_data) {
+		/* the 20-byte trailer follows the last object */
+		if (pos == p->num_objects)
+			return p->pack_size - 20;
+		return nth_packed_object_offset(p, get_be32(p->revindex_data + pos));
+	}
+	return p->revindex[pos].offset;
 }
 
-int find_revindex_position(struct pack_revindex *pridx, off_t ofs)
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos)
 {
-	int lo = 0;
-	int hi = pridx->p->num_objects + 1;
-	struct revindex_entry *revindex = pridx->revindex;
+	uint32_t lo = 0;
+	uint32_t hi = p->num_objects + 1;
 
+	prepare_revindex(p);
 	do {
-		unsigned mi = lo + (hi - lo) / 2;
-		if (revindex[mi].offset == ofs) {
-			return mi;
-		} else if (ofs < revindex[mi].offset)
+		uint32_t mi = lo + (hi - lo) / 2;
+		off_t mi_ofs = pack_pos_to_offset(p, mi);
+
+		if (mi_ofs == ofs) {
+			*pos = mi;
+			return 0;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
 
-	error("bad offset for revindex");
-	return -1;
+	return error("bad offset for revindex");
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+void close_pack_revindex(struct packed_git *p)
 {
-	struct pack_revindex *pridx = revindex_for_pack(p);
-	int pos = find_revindex_position(pridx, ofs);
-
-	if (pos < 0)
-		return NULL;
-
-	return pridx->revindex + pos;
+	if (p->revindex_map) {
+		munmap((void *)p->revindex_map, p->revindex_size);
+		p->revindex_map = NULL;
+		p->revindex_data = NULL;
+		p->revindex_size = 0;
+	}
+	free(p->revindex);
+	p->revindex = NULL;
 }
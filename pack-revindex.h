@@ -1,19 +1,63 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
+/*
+ * A reverse index lists the objects of a pack in the order they appear
+ * in the packfile ("pack order"), as opposed to the .idx file which
+ * lists them by object name ("index order").
+ *
+ * It is read from the pack's .rev file when there is one (see
+ * Documentation/technical/pack-format.txt), and otherwise computed in
+ * memory the first time it is needed.
+ */
+
+#define RIDX_SIGNATURE 0x52494458 /* "RIDX" */
+#define RIDX_VERSION 1
+#define RIDX_HEADER_SIZE 12
+
 struct revindex_entry {
 	off_t offset;
 	unsigned int nr;
 };
 
-struct pack_revindex {
-	struct packed_git *p;
-	struct revindex_entry *revindex;
-};
+/*
+ * Make sure the reverse index of "p" is available.  Returns 0 on
+ * success; the other functions below call it on demand and die if it
+ * fails.
+ */
+int load_pack_revindex(struct packed_git *p);
+
+/*
+ * Like load_pack_revindex(), but only mmap the pack's .rev file and
+ * never compute the reverse index in memory.  Returns 0 if the .rev
+ * file exists and is usable.
+ */
+int load_pack_revindex_from_disk(struct packed_git *p);
+
+/*
+ * Find the pack-order position of the object starting at offset "ofs"
+ * in "p" and store it in *pos.  Returns 0 on success and -1 (after
+ * reporting an error) if no object starts at "ofs".
+ */
+int offset_to_pack_pos(struct packed_git *p, off_t ofs, uint32_t *pos);
+
+/*
+ * Return the index-order position of the object at pack-order
+ * position "pos", suitable for nth_packed_object_sha1().
+ */
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
 
-struct pack_revindex *revindex_for_pack(struct packed_git *p);
-int find_revindex_position(struct pack_revindex *pridx, off_t ofs);
+/*
+ * Return the offset of the object at pack-order position "pos".
+ * Passing p->num_objects yields the offset where the last object
+ * ends, so that pack_pos_to_offset(p, pos + 1) - pack_pos_to_offset(p,
+ * pos) is the size of an object's packed representation.
+ */
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+/*
+ * Release the reverse index of "p", if one was loaded.
+ */
+void close_pack_revindex(struct packed_git *p);
 
 #endif
@@ -0,0 +1,132 @@
+#include "cache.h"
+#include "pack-sizes.h"
+
+/*
+ * The type table has one byte per object, padded to a multiple of 4
+ * bytes; the size table that follows it one 4-byte entry.
+ */
+static size_t type_table_size(uint32_t nr)
+{
+	return ((size_t)nr + 3) & ~(size_t)3;
+}
+
+static char *pack_sizes_filename(struct packed_git *p)
+{
+	size_t len;
+
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		die("BUG: pack name '%s' does not end in .pack", p->pack_name);
+	return xstrfmt("%.*s.sizes", (int)len, p->pack_name);
+}
+
+int load_pack_sizes(struct packed_git *p)
+{
+	char *sizes_name;
+	const unsigned char *data;
+	struct stat st;
+	size_t size, min_size;
+	void *map;
+	int fd, ret = -1;
+
+	if (p->sizes_map)
+		return 0;
+	if (p->no_sizes)
+		return -1;
+	p->no_sizes = 1;
+	if (open_pack_index(p))
+		return -1;
+
+	sizes_name = pack_sizes_filename(p);
+	fd = git_open_noatime(sizes_name);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	size = xsize_t(st.st_size);
+	min_size = OSIZ_HEADER_SIZE + type_table_size(p->num_objects) +
+		(size_t)p->num_objects * 4 + 40;
+	if (size < min_size || (size - min_size) % 8) {
+		close(fd);
+		error("object size table %s has the wrong size", sizes_name);
+		goto out;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (get_be32(data) != OSIZ_SIGNATURE ||
+	    get_be32(data + 4) != OSIZ_VERSION ||
+	    get_be32(data + 8) != 1 /* SHA-1 */) {
+		error("object size table %s has a bad header", sizes_name);
+		munmap(map, size);
+		goto out;
+	}
+	if (hashcmp(data + size - 40,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		error("object size table %s does not match its pack", sizes_name);
+		munmap(map, size);
+		goto out;
+	}
+
+	p->sizes_map = map;
+	p->sizes_size = size;
+	p->no_sizes = 0;
+	ret = 0;
+out:
+	free(sizes_name);
+	return ret;
+}
+
+int pack_sizes_lookup(struct packed_git *p, uint32_t pos,
+		      enum object_type *type, enum object_type *in_pack_type,
+		      unsigned long *size)
+{
+	const unsigned char *types = (const unsigned char *)p->sizes_map +
+		OSIZ_HEADER_SIZE;
+	const unsigned char *sizes = types + type_table_size(p->num_objects);
+	const unsigned char *large = sizes + (size_t)p->num_objects * 4;
+	uint32_t nr_large = (p->sizes_size - 40 - (large - types) -
+			     OSIZ_HEADER_SIZE) / 8;
+	unsigned char t;
+
+	if (pos >= p->num_objects)
+		die("BUG: object position %"PRIu32" out of range", pos);
+
+	t = types[pos];
+	if ((t & 7) < OBJ_COMMIT || (t & 7) > OBJ_TAG)
+		return -1;
+	if (type)
+		*type = t & 7;
+	if (in_pack_type)
+		*in_pack_type = t >> 4;
+	if (size) {
+		uint32_t s = get_be32(sizes + 4 * pos);
+		uint64_t s64;
+
+		if (!(s & 0x80000000)) {
+			*size = s;
+			return 0;
+		}
+		s &= 0x7fffffff;
+		if (s >= nr_large)
+			return -1;
+		s64 = ((uint64_t)get_be32(large + 8 * s) << 32) |
+			get_be32(large + 8 * s + 4);
+		if (s64 != (unsigned long)s64)
+			return -1;
+		*size = s64;
+	}
+	return 0;
+}
+
+void close_pack_sizes(struct packed_git *p)
+{
+	if (p->sizes_map) {
+		munmap((void *)p->sizes_map, p->sizes_size);
+		p->sizes_map = NULL;
+		p->sizes_size = 0;
+	}
+	p->no_sizes = 0;
+}
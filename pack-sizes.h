@@ -0,0 +1,40 @@
+#ifndef PACK_SIZES_H
+#define PACK_SIZES_H
+
+/*
+ * An object size table records, for every object of a pack, its type,
+ * the type it is stored as (which may be a delta) and its size, so that
+ * sha1_object_info() does not have to walk delta chains and inflate
+ * delta headers to find them out.
+ *
+ * It is written next to the .idx as a .sizes file by index-pack and
+ * pack-objects with pack.writeObjectSizes (see
+ * Documentation/technical/pack-format.txt), and simply mmapped.
+ */
+
+#define OSIZ_SIGNATURE 0x4f53495a /* "OSIZ" */
+#define OSIZ_VERSION 1
+#define OSIZ_HEADER_SIZE 12
+
+/*
+ * mmap the .sizes file of "p".  Returns 0 if it exists and is usable;
+ * a pack without one is only looked at once.
+ */
+int load_pack_sizes(struct packed_git *p);
+
+/*
+ * Look up the object at index-order position "pos" of "p", whose size
+ * table must have been loaded.  Stores its type, the type it is stored
+ * as and its size wherever the pointers are not NULL.  Returns -1 if
+ * the entry is malformed.
+ */
+int pack_sizes_lookup(struct packed_git *p, uint32_t pos,
+		      enum object_type *type, enum object_type *in_pack_type,
+		      unsigned long *size);
+
+/*
+ * Release the size table of "p", if one was loaded.
+ */
+void close_pack_sizes(struct packed_git *p);
+
+#endif
@@ -1,6 +1,9 @@
 #include "cache.h"
 #include "pack.h"
 #include "csum-file.h"
+#include "pack-revindex.h"
+#include "pack-sizes.h"
+#include "pack-bases.h"
 
 void reset_pack_idx_option(struct pack_idx_option *opts)
 {
@@ -176,6 +179,200 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+static struct pack_idx_entry **rev_order_objects;
+
+static int pack_order_cmp(const void *a_, const void *b_)
+{
+	off_t a = rev_order_objects[*(uint32_t *)a_]->offset;
+	off_t b = rev_order_objects[*(uint32_t *)b_]->offset;
+
+	return (a < b) ? -1 : (a != b);
+}
+
+/*
+ * "objects" must be sorted by SHA-1 as write_idx_file() leaves it, so
+ * that the position of an entry in it is its position in the .idx.
+ */
+const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects,
+			   uint32_t nr_objects, const unsigned char *sha1)
+{
+	struct sha1file *f;
+	uint32_t *pack_order;
+	uint32_t i;
+	int fd;
+
+	if (!rev_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmp_file);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", rev_name);
+	f = sha1fd(fd, rev_name);
+
+	pack_order = xmalloc(sizeof(*pack_order) * (nr_objects ? nr_objects : 1));
+	for (i = 0; i < nr_objects; i++)
+		pack_order[i] = i;
+	rev_order_objects = objects;
+	qsort(pack_order, nr_objects, sizeof(*pack_order), pack_order_cmp);
+	rev_order_objects = NULL;
+
+	sha1write_be32(f, RIDX_SIGNATURE);
+	sha1write_be32(f, RIDX_VERSION);
+	sha1write_be32(f, 1); /* SHA-1 */
+	for (i = 0; i < nr_objects; i++)
+		sha1write_be32(f, pack_order[i]);
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free(pack_order);
+	return rev_name;
+}
+
+/*
+ * "objects" must be sorted by SHA-1 as write_idx_file() leaves it, so
+ * that the position of an entry in it is its position in the .idx.
+ */
+const char *write_sizes_file(const char *sizes_name,
+			     struct pack_idx_entry **objects,
+			     uint32_t nr_objects,
+			     pack_object_info_fn object_info,
+			     const unsigned char *sha1)
+{
+	struct sha1file *f;
+	unsigned char *types;
+	uint32_t *sizes;
+	uint64_t *large = NULL;
+	uint32_t i, nr_large = 0, alloc_large = 0;
+	size_t types_len = ((size_t)nr_objects + 3) & ~(size_t)3;
+	int fd;
+
+	if (!sizes_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_sizes_XXXXXX");
+		sizes_name = xstrdup(tmp_file);
+	} else {
+		unlink(sizes_name);
+		fd = open(sizes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", sizes_name);
+	f = sha1fd(fd, sizes_name);
+
+	types = xcalloc(types_len ? types_len : 1, 1);
+	sizes = xmalloc(sizeof(*sizes) * (nr_objects ? nr_objects : 1));
+	for (i = 0; i < nr_objects; i++) {
+		enum object_type type, in_pack_type;
+		unsigned long size;
+
+		object_info(objects[i], &type, &in_pack_type, &size);
+		types[i] = (in_pack_type << 4) | type;
+		if (size < 0x80000000) {
+			sizes[i] = htonl(size);
+			continue;
+		}
+		ALLOC_GROW(large, nr_large + 1, alloc_large);
+		sizes[i] = htonl(0x80000000 | nr_large);
+		large[nr_large++] = size;
+	}
+
+	sha1write_be32(f, OSIZ_SIGNATURE);
+	sha1write_be32(f, OSIZ_VERSION);
+	sha1write_be32(f, 1); /* SHA-1 */
+	sha1write(f, types, types_len);
+	sha1write(f, sizes, sizeof(*sizes) * nr_objects);
+	for (i = 0; i < nr_large; i++) {
+		sha1write_be32(f, large[i] >> 32);
+		sha1write_be32(f, large[i] & 0xffffffff);
+	}
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free(types);
+	free(sizes);
+	free(large);
+	return sizes_name;
+}
+
+static int sorted_entry_pos(struct pack_idx_entry **objects, uint32_t nr,
+			    const unsigned char *sha1)
+{
+	uint32_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(objects[mi]->sha1, sha1);
+
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+/*
+ * Like write_sizes_file(), "objects" must be in .idx order.  Bases that
+ * did not end up in this pack are recorded as unknown.
+ */
+const char *write_bases_file(const char *bases_name,
+			     struct pack_idx_entry **objects,
+			     uint32_t nr_objects,
+			     const struct pack_idx_option *opts,
+			     const unsigned char *sha1)
+{
+	struct sha1file *f;
+	uint32_t i;
+	int fd;
+
+	if (!bases_name) {
+		static char tmp_file[PATH_MAX];
+		fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_bases_XXXXXX");
+		bases_name = xstrdup(tmp_file);
+	} else {
+		unlink(bases_name);
+		fd = open(bases_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", bases_name);
+	f = sha1fd(fd, bases_name);
+
+	sha1write_be32(f, DBAS_SIGNATURE);
+	sha1write_be32(f, DBAS_VERSION);
+	sha1write_be32(f, 1); /* SHA-1 */
+	sha1write_be32(f, opts->search_window);
+	sha1write_be32(f, opts->search_depth);
+	for (i = 0; i < nr_objects; i++) {
+		struct pack_idx_entry *base;
+		unsigned long delta_size;
+		uint32_t base_pos = DBAS_UNKNOWN, size = 0;
+		int pos;
+
+		switch (opts->delta_base(objects[i], &base, &delta_size)) {
+		case 0:
+			base_pos = DBAS_NO_BASE;
+			break;
+		case 1:
+			pos = sorted_entry_pos(objects, nr_objects, base->sha1);
+			if (pos >= 0 && delta_size <= 0xffffffff) {
+				base_pos = pos;
+				size = delta_size;
+			}
+			break;
+		}
+		sha1write_be32(f, base_pos);
+		sha1write_be32(f, size);
+	}
+	sha1write(f, sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+	return bases_name;
+}
+
 off_t write_pack_header(struct sha1file *f, uint32_t nr_entries)
 {
 	struct pack_header hdr;
@@ -342,7 +539,8 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 			 struct pack_idx_option *pack_idx_opts,
 			 unsigned char sha1[])
 {
-	const char *idx_tmp_name;
+	const char *idx_tmp_name, *rev_tmp_name = NULL, *sizes_tmp_name = NULL;
+	const char *bases_tmp_name = NULL;
 	int basename_len = name_buffer->len;
 
 	if (adjust_shared_perm(pack_tmp_name))
@@ -353,6 +551,26 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	if (adjust_shared_perm(idx_tmp_name))
 		die_errno("unable to make temporary index file readable");
 
+	if (pack_idx_opts->flags & WRITE_REV) {
+		rev_tmp_name = write_rev_file(NULL, written_list, nr_written, sha1);
+		if (adjust_shared_perm(rev_tmp_name))
+			die_errno("unable to make temporary reverse index file readable");
+	}
+
+	if (pack_idx_opts->flags & WRITE_SIZES) {
+		sizes_tmp_name = write_sizes_file(NULL, written_list, nr_written,
+						  pack_idx_opts->object_info, sha1);
+		if (adjust_shared_perm(sizes_tmp_name))
+			die_errno("unable to make temporary object size table readable");
+	}
+
+	if (pack_idx_opts->flags & WRITE_BASES) {
+		bases_tmp_name = write_bases_file(NULL, written_list, nr_written,
+						  pack_idx_opts, sha1);
+		if (adjust_shared_perm(bases_tmp_name))
+			die_errno("unable to make temporary delta base table readable");
+	}
+
 	strbuf_addf(name_buffer, "%s.pack", sha1_to_hex(sha1));
 	free_pack_by_name(name_buffer->buf);
 
@@ -361,6 +579,26 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 
 	strbuf_setlen(name_buffer, basename_len);
 
+	/* readers find packs by their .idx; put the others in place first */
+	if (rev_tmp_name) {
+		strbuf_addf(name_buffer, "%s.rev", sha1_to_hex(sha1));
+		if (rename(rev_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary reverse index file");
+		strbuf_setlen(name_buffer, basename_len);
+	}
+	if (sizes_tmp_name) {
+		strbuf_addf(name_buffer, "%s.sizes", sha1_to_hex(sha1));
+		if (rename(sizes_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary object size table");
+		strbuf_setlen(name_buffer, basename_len);
+	}
+	if (bases_tmp_name) {
+		strbuf_addf(name_buffer, "%s.bases", sha1_to_hex(sha1));
+		if (rename(bases_tmp_name, name_buffer->buf))
+			die_errno("unable to rename temporary delta base table");
+		strbuf_setlen(name_buffer, basename_len);
+	}
+
 	strbuf_addf(name_buffer, "%s.idx", sha1_to_hex(sha1));
 	if (rename(idx_tmp_name, name_buffer->buf))
 		die_errno("unable to rename temporary index file");
@@ -368,4 +606,7 @@ void finish_tmp_packfile(struct strbuf *name_buffer,
 	strbuf_setlen(name_buffer, basename_len);
 
 	free((void *)idx_tmp_name);
+	free((void *)rev_tmp_name);
+	free((void *)sizes_tmp_name);
+	free((void *)bases_tmp_name);
 }
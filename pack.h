@@ -35,11 +35,28 @@ struct pack_header {
  */
 #define PACK_IDX_SIGNATURE 0xff744f63	/* "\377tOc" */
 
+struct pack_idx_entry;
+typedef void (*pack_object_info_fn)(struct pack_idx_entry *,
+				    enum object_type *type,
+				    enum object_type *in_pack_type,
+				    unsigned long *size);
+/*
+ * What the delta search decided for an object: -1 if it was not
+ * searched, 0 if no base was found, 1 if "*base" was, with a delta of
+ * "*delta_size" bytes.
+ */
+typedef int (*pack_delta_base_fn)(struct pack_idx_entry *,
+				  struct pack_idx_entry **base,
+				  unsigned long *delta_size);
+
 struct pack_idx_option {
 	unsigned flags;
 	/* flag bits */
 #define WRITE_IDX_VERIFY 01 /* verify only, do not write the idx file */
 #define WRITE_IDX_STRICT 02
+#define WRITE_REV 04 /* also write a .rev reverse index */
+#define WRITE_SIZES 010 /* also write a .sizes object size table */
+#define WRITE_BASES 020 /* also write a .bases delta base table */
 
 	uint32_t version;
 	uint32_t off32_limit;
@@ -51,6 +68,19 @@ struct pack_idx_option {
 	 */
 	int anomaly_alloc, anomaly_nr;
 	uint32_t *anomaly;
+
+	/*
+	 * With WRITE_SIZES, tells finish_tmp_packfile() the type, the
+	 * type it is stored as, and the size of each object.
+	 */
+	pack_object_info_fn object_info;
+
+	/*
+	 * With WRITE_BASES, tells finish_tmp_packfile() what the delta
+	 * search with this window and depth decided for each object.
+	 */
+	pack_delta_base_fn delta_base;
+	uint32_t search_window, search_depth;
 };
 
 extern void reset_pack_idx_option(struct pack_idx_option *);
@@ -77,9 +107,12 @@ struct progress;
 typedef int (*verify_fn)(const unsigned char*, enum object_type, unsigned long, void*, int*);
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, const unsigned char *sha1);
+extern const char *write_sizes_file(const char *sizes_name, struct pack_idx_entry **objects, uint32_t nr_objects, pack_object_info_fn object_info, const unsigned char *sha1);
+extern const char *write_bases_file(const char *bases_name, struct pack_idx_entry **objects, uint32_t nr_objects, const struct pack_idx_option *opts, const unsigned char *sha1);
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *sha1);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
-extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t);
+extern int verify_pack(struct packed_git *, verify_fn fn, struct progress *, uint32_t, int nr_threads);
 extern off_t write_pack_header(struct sha1file *f, uint32_t);
 extern void fixup_pack_header_footer(int, unsigned char *, const char *, uint32_t, unsigned char *, off_t);
 extern char *index_pack_lockfile(int fd);
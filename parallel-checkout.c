@@ -0,0 +1,206 @@
+#include "cache.h"
+#include "parallel-checkout.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	PC_ITEM_FAILED
+};
+
+struct parallel_checkout_item {
+	struct cache_entry *ce;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+static struct parallel_checkout {
+	int enabled;
+	int num_workers;
+	int threshold;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+} parallel_checkout;
+
+void init_parallel_checkout(void)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+
+	if (git_config_get_int("checkout.workers", &pc->num_workers))
+		pc->num_workers = 1;
+	else if (pc->num_workers < 1)
+		pc->num_workers = online_cpus();
+	if (git_config_get_int("checkout.thresholdforparallelism",
+			       &pc->threshold))
+		pc->threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+
+	pc->enabled = pc->num_workers > 1;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	struct parallel_checkout_item *item;
+	struct stream_filter *filter;
+	int needs_conversion;
+
+	if (!pc->enabled || !S_ISREG(ce->ce_mode) || state->base_dir_len)
+		return -1;
+
+	/*
+	 * The workers do not know the attributes, which may come from
+	 * the index being checked out; leave anything they would have
+	 * to convert to the caller.
+	 */
+	filter = get_stream_filter(ce->name, ce->sha1);
+	if (!filter)
+		return -1;
+	needs_conversion = !is_null_stream_filter(filter);
+	free_stream_filter(filter);
+	if (needs_conversion)
+		return -1;
+
+	ALLOC_GROW(pc->items, pc->nr + 1, pc->alloc);
+	item = &pc->items[pc->nr++];
+	memset(item, 0, sizeof(*item));
+	item->ce = ce;
+	return 0;
+}
+
+struct pc_worker {
+	struct child_process cp;
+	size_t start, end;
+	int started;
+};
+
+static void send_items(struct pc_worker *worker)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+
+	for (i = worker->start; i < worker->end; i++) {
+		struct cache_entry *ce = pc->items[i].ce;
+
+		strbuf_addf(&buf, "%"PRIuMAX" %o %s %s",
+			    (uintmax_t)i, ce->ce_mode,
+			    sha1_to_hex(ce->sha1), ce->name);
+		strbuf_addch(&buf, '\0');
+	}
+	/* a worker that died is noticed when its results are missing */
+	write_in_full(worker->cp.in, buf.buf, buf.len);
+	close(worker->cp.in);
+	strbuf_release(&buf);
+}
+
+static void receive_results(struct pc_worker *worker)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	struct parallel_checkout_result res;
+
+	while (read_in_full(worker->cp.out, &res, sizeof(res)) == sizeof(res)) {
+		struct parallel_checkout_item *item;
+
+		if (res.id < worker->start || worker->end <= res.id) {
+			error("checkout worker sent a bad result");
+			break;
+		}
+		item = &pc->items[res.id];
+		if (res.status) {
+			item->status = PC_ITEM_FAILED;
+		} else {
+			item->status = PC_ITEM_WRITTEN;
+			item->st = res.st;
+		}
+	}
+	close(worker->cp.out);
+	finish_command(&worker->cp);
+}
+
+static void run_workers(int num_workers)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	struct pc_worker *workers;
+	size_t start = 0;
+	int i;
+
+	workers = xcalloc(num_workers, sizeof(*workers));
+	sigchain_push(SIGPIPE, SIG_IGN);
+	for (i = 0; i < num_workers; i++) {
+		struct pc_worker *worker = &workers[i];
+
+		worker->start = start;
+		worker->end = start + (pc->nr - start) / (num_workers - i);
+		start = worker->end;
+
+		child_process_init(&worker->cp);
+		argv_array_push(&worker->cp.args, "checkout--worker");
+		worker->cp.git_cmd = 1;
+		worker->cp.in = -1;
+		worker->cp.out = -1;
+		worker->cp.clean_on_exit = 1;
+		if (start_command(&worker->cp))
+			continue;
+		worker->started = 1;
+		send_items(worker);
+	}
+	for (i = 0; i < num_workers; i++)
+		if (workers[i].started)
+			receive_results(&workers[i]);
+	sigchain_pop(SIGPIPE);
+	free(workers);
+}
+
+int run_parallel_checkout(const struct checkout *state)
+{
+	struct parallel_checkout *pc = &parallel_checkout;
+	int num_workers = pc->num_workers;
+	int errs = 0;
+	size_t i;
+
+	if (!pc->enabled)
+		return 0;
+	pc->enabled = 0;
+
+	if (num_workers > pc->nr)
+		num_workers = pc->nr;
+	if (pc->nr >= pc->threshold && num_workers > 1)
+		run_workers(num_workers);
+
+	for (i = 0; i < pc->nr; i++) {
+		struct parallel_checkout_item *item = &pc->items[i];
+		struct cache_entry *ce = item->ce;
+
+		switch (item->status) {
+		case PC_ITEM_PENDING:
+			/*
+			 * Not handed to (or not answered by) a worker;
+			 * write it out here, after removing whatever a
+			 * worker that died may have left.
+			 */
+			unlink(ce->name);
+			errs |= checkout_entry(ce, state, NULL);
+			break;
+		case PC_ITEM_FAILED:
+			errs = 1;
+			break;
+		case PC_ITEM_WRITTEN:
+			if (state->refresh_cache) {
+				fill_stat_cache_info(ce, &item->st);
+				ce->ce_flags |= CE_UPDATE_IN_BASE;
+				state->istate->cache_changed |= CE_ENTRY_CHANGED;
+			}
+			break;
+		}
+	}
+
+	free(pc->items);
+	pc->items = NULL;
+	pc->nr = pc->alloc = 0;
+	return errs ? -1 : 0;
+}
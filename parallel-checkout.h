@@ -0,0 +1,40 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct cache_entry;
+struct checkout;
+
+/*
+ * Parallel checkout lets checkout_entry() queue regular files that need
+ * no conversion, after it cleared their paths; run_parallel_checkout()
+ * then has "checkout.workers" "git checkout--worker" processes write
+ * them out, each reading the objects on its own.
+ */
+
+/* Start queueing entries in checkout_entry(), if configured to. */
+void init_parallel_checkout(void);
+
+/*
+ * Queue "ce" to be written out later.  Returns 0 if it was queued and
+ * -1 if the caller has to write it out itself.
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct checkout *state);
+
+/*
+ * Write out the queued entries and stop queueing.  Returns 0 on
+ * success and -1 if any of them could not be written.
+ */
+int run_parallel_checkout(const struct checkout *state);
+
+/*
+ * A worker reads NUL-terminated "<id> <octal mode> <sha1> <path>"
+ * records from its standard input, and once it has read all of them,
+ * answers each with one of these.
+ */
+struct parallel_checkout_result {
+	size_t id;
+	int status;
+	struct stat st;
+};
+
+#endif
@@ -12,13 +12,57 @@
 #include "git-compat-util.h"
 #include "delta.h"
 
+/*
+ * Decode the opcode of a delta at *datap: a copy of *size bytes from
+ * offset *off of the source (returns 1), or an insertion of the *size
+ * bytes that *datap then points at (returns 0).  Returns -1 for the
+ * reserved opcode 0, or an opcode running past the end of the delta.
+ */
+static inline int decode_delta_op(const unsigned char **datap,
+				  const unsigned char *top,
+				  unsigned long *off, unsigned long *size)
+{
+	const unsigned char *data = *datap;
+	unsigned char cmd = *data++;
+
+	if (cmd & 0x80) {
+		unsigned long cp_off = 0, cp_size = 0;
+
+		if (top - data < 7 &&
+		    top - data < !!(cmd & 0x01) + !!(cmd & 0x02) +
+				 !!(cmd & 0x04) + !!(cmd & 0x08) +
+				 !!(cmd & 0x10) + !!(cmd & 0x20) +
+				 !!(cmd & 0x40))
+			return -1;
+		if (cmd & 0x01) cp_off = *data++;
+		if (cmd & 0x02) cp_off |= (*data++ << 8);
+		if (cmd & 0x04) cp_off |= (*data++ << 16);
+		if (cmd & 0x08) cp_off |= ((unsigned) *data++ << 24);
+		if (cmd & 0x10) cp_size = *data++;
+		if (cmd & 0x20) cp_size |= (*data++ << 8);
+		if (cmd & 0x40) cp_size |= (*data++ << 16);
+		if (cp_size == 0) cp_size = 0x10000;
+		*off = cp_off;
+		*size = cp_size;
+		*datap = data;
+		return 1;
+	}
+	if (!cmd)
+		return -1;
+	if (cmd > top - data)
+		return -1;
+	*size = cmd;
+	*datap = data;
+	return 0;
+}
+
 void *patch_delta(const void *src_buf, unsigned long src_size,
 		  const void *delta_buf, unsigned long delta_size,
 		  unsigned long *dst_size)
 {
 	const unsigned char *data, *top;
-	unsigned char *dst_buf, *out, cmd;
-	unsigned long size;
+	unsigned char *dst_buf, *out;
+	unsigned long size, cp_off = 0, cp_size = 0;
 
 	if (delta_size < DELTA_SIZE_MIN)
 		return NULL;
@@ -35,34 +79,16 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 	size = get_delta_hdr_size(&data, top);
 	dst_buf = xmallocz(size);
 
+	/*
+	 * Copies that continue where the previous one stopped (as
+	 * copies longer than 64k are split into) are done at once.
+	 */
 	out = dst_buf;
 	while (data < top) {
-		cmd = *data++;
-		if (cmd & 0x80) {
-			unsigned long cp_off = 0, cp_size = 0;
-			if (cmd & 0x01) cp_off = *data++;
-			if (cmd & 0x02) cp_off |= (*data++ << 8);
-			if (cmd & 0x04) cp_off |= (*data++ << 16);
-			if (cmd & 0x08) cp_off |= ((unsigned) *data++ << 24);
-			if (cmd & 0x10) cp_size = *data++;
-			if (cmd & 0x20) cp_size |= (*data++ << 8);
-			if (cmd & 0x40) cp_size |= (*data++ << 16);
-			if (cp_size == 0) cp_size = 0x10000;
-			if (unsigned_add_overflows(cp_off, cp_size) ||
-			    cp_off + cp_size > src_size ||
-			    cp_size > size)
-				break;
-			memcpy(out, (char *) src_buf + cp_off, cp_size);
-			out += cp_size;
-			size -= cp_size;
-		} else if (cmd) {
-			if (cmd > size)
-				break;
-			memcpy(out, data, cmd);
-			out += cmd;
-			data += cmd;
-			size -= cmd;
-		} else {
+		unsigned long off, len;
+		int op;
+
+		if (!*data) {
 			/*
 			 * cmd == 0 is reserved for future encoding
 			 * extensions. In the mean time we must fail when
@@ -71,7 +97,37 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 			error("unexpected delta opcode 0");
 			goto bad;
 		}
+		op = decode_delta_op(&data, top, &off, &len);
+		if (op < 0)
+			break;
+		if (op) {
+			if (unsigned_add_overflows(off, len) ||
+			    off + len > src_size ||
+			    len > size)
+				break;
+			size -= len;
+			if (cp_size && cp_off + cp_size == off) {
+				cp_size += len;
+				continue;
+			}
+			memcpy(out, (char *) src_buf + cp_off, cp_size);
+			out += cp_size;
+			cp_off = off;
+			cp_size = len;
+		} else {
+			if (len > size)
+				break;
+			memcpy(out, (char *) src_buf + cp_off, cp_size);
+			out += cp_size;
+			cp_size = 0;
+			memcpy(out, data, len);
+			out += len;
+			data += len;
+			size -= len;
+		}
 	}
+	memcpy(out, (char *) src_buf + cp_off, cp_size);
+	out += cp_size;
 
 	/* sanity check */
 	if (data != top || size != 0) {
@@ -84,3 +140,149 @@ void *patch_delta(const void *src_buf, unsigned long src_size,
 	*dst_size = out - dst_buf;
 	return dst_buf;
 }
+
+/*
+ * The result of applying a chain of deltas, as a list of fragments
+ * that are either copied from the base of the chain or inserted from
+ * one of the deltas.
+ */
+struct delta_frag {
+	unsigned long end;		/* offset in the result just past it */
+	const unsigned char *lit;	/* data to insert, or NULL */
+	unsigned long off;		/* where to copy from in the base */
+};
+
+struct delta_frags {
+	struct delta_frag *frag;
+	unsigned long nr, alloc;
+};
+
+static void add_delta_frag(struct delta_frags *f, const unsigned char *lit,
+			   unsigned long off, unsigned long size)
+{
+	struct delta_frag *last = f->nr ? &f->frag[f->nr - 1] : NULL;
+
+	if (last) {
+		unsigned long last_size = last->end -
+			(f->nr > 1 ? f->frag[f->nr - 2].end : 0);
+
+		if (lit ? last->lit && last->lit + last_size == lit
+			: !last->lit && last->off + last_size == off) {
+			last->end += size;
+			return;
+		}
+	}
+	if (f->nr == f->alloc) {
+		f->alloc = f->alloc ? f->alloc * 2 : 64;
+		f->frag = xrealloc(f->frag, f->alloc * sizeof(*f->frag));
+	}
+	last = &f->frag[f->nr++];
+	last->end = (f->nr > 1 ? f->frag[f->nr - 2].end : 0) + size;
+	last->lit = lit;
+	last->off = off;
+}
+
+/* the fragment that covers offset "pos" of the result */
+static unsigned long find_delta_frag(const struct delta_frags *f,
+				     unsigned long pos)
+{
+	unsigned long lo = 0, hi = f->nr;
+
+	while (lo < hi) {
+		unsigned long mi = lo + (hi - lo) / 2;
+		if (f->frag[mi].end <= pos)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * Apply "delta" to the result described by "cur", describing what we
+ * get in "out" in terms of the same base.
+ */
+static int compose_delta(const struct delta_frags *cur, unsigned long cur_size,
+			 const void *delta_buf, unsigned long delta_size,
+			 struct delta_frags *out, unsigned long *out_size)
+{
+	const unsigned char *data = delta_buf;
+	const unsigned char *top = data + delta_size;
+	unsigned long size;
+
+	if (delta_size < DELTA_SIZE_MIN ||
+	    get_delta_hdr_size(&data, top) != cur_size)
+		return -1;
+	size = *out_size = get_delta_hdr_size(&data, top);
+
+	while (data < top) {
+		unsigned long off, len, i;
+		int op = decode_delta_op(&data, top, &off, &len);
+
+		if (op < 0 || len > size)
+			return -1;
+		size -= len;
+		if (!op) {
+			add_delta_frag(out, data, 0, len);
+			data += len;
+			continue;
+		}
+		if (unsigned_add_overflows(off, len) || off + len > cur_size)
+			return -1;
+		for (i = find_delta_frag(cur, off); len; i++) {
+			const struct delta_frag *f = &cur->frag[i];
+			unsigned long skip = off - (i ? cur->frag[i - 1].end : 0);
+			unsigned long n = f->end - off;
+
+			if (n > len)
+				n = len;
+			if (f->lit)
+				add_delta_frag(out, f->lit + skip, 0, n);
+			else
+				add_delta_frag(out, NULL, f->off + skip, n);
+			off += n;
+			len -= n;
+		}
+	}
+	return data == top && !size ? 0 : -1;
+}
+
+void *patch_delta_chain(const void *src_buf, unsigned long src_size,
+			void **deltas, const unsigned long *delta_sizes,
+			int nr, unsigned long *dst_size)
+{
+	struct delta_frags cur = { NULL, 0, 0 }, next = { NULL, 0, 0 };
+	unsigned long size = src_size, i;
+	unsigned char *dst_buf = NULL;
+	int d;
+
+	if (src_size)
+		add_delta_frag(&cur, NULL, 0, src_size);
+	for (d = 0; d < nr; d++) {
+		struct delta_frags tmp;
+
+		next.nr = 0;
+		if (compose_delta(&cur, size, deltas[d], delta_sizes[d],
+				  &next, &size))
+			goto out;
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	/* one pass over the base and the deltas for the whole chain */
+	dst_buf = xmallocz(size);
+	for (i = 0; i < cur.nr; i++) {
+		const struct delta_frag *f = &cur.frag[i];
+		unsigned long start = i ? cur.frag[i - 1].end : 0;
+
+		memcpy(dst_buf + start,
+		       f->lit ? f->lit : (const unsigned char *)src_buf + f->off,
+		       f->end - start);
+	}
+	*dst_size = size;
+out:
+	free(cur.frag);
+	free(next.frag);
+	return dst_buf;
+}
@@ -1,11 +1,103 @@
 #include "cache.h"
 #include "diff.h"
 #include "commit.h"
-#include "sha1-lookup.h"
 #include "patch-ids.h"
+#include "append-cache.h"
+
+/*
+ * With diff.patchIdCache, the patch ids of commits are remembered in
+ * $GIT_OBJECT_DIRECTORY/info/patch-id-cache, so that running "git
+ * cherry" or "log --cherry-pick" over the same commits again does not
+ * diff them again.  The key covers the commit and the diff options the
+ * ids depend on; the value is the header-only id followed by the full
+ * id, if it was ever needed.
+ */
+
+static struct append_cache patch_id_cache;
+
+static int prepare_patch_id_cache(void)
+{
+	static int prepared, enabled;
+	char *path;
+
+	if (prepared)
+		return enabled;
+	prepared = 1;
+
+	if (git_config_get_bool("diff.patchidcache", &enabled) || !enabled)
+		return enabled = 0;
+
+	path = xstrfmt("%s/info/patch-id-cache", get_object_directory());
+	append_cache_init(&patch_id_cache, path, "patch-id cache version 1");
+	free(path);
+	return enabled;
+}
+
+/*
+ * Compute the cache key of "commit" under the options in "ids", or
+ * return -1 if the cache is not to be used.  Pathspec-limited ids are
+ * not cached.
+ */
+static int patch_id_cache_key(struct commit *commit, struct patch_ids *ids,
+			      unsigned char *key)
+{
+	struct diff_options *opt = &ids->diffopts;
+	git_SHA_CTX ctx;
+
+	if (opt->pathspec.nr || !prepare_patch_id_cache())
+		return -1;
+	if (!ids->cache_key_ready) {
+		struct strbuf sig = STRBUF_INIT;
+
+		strbuf_addf(&sig, "patch-id %x %d %d %d",
+			    opt->flags, opt->detect_rename,
+			    opt->rename_score, opt->rename_limit);
+		git_SHA1_Init(&ctx);
+		git_SHA1_Update(&ctx, sig.buf, sig.len);
+		git_SHA1_Final(ids->cache_key, &ctx);
+		strbuf_release(&sig);
+		ids->cache_key_ready = 1;
+	}
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, ids->cache_key, 20);
+	git_SHA1_Update(&ctx, commit->object.sha1, 20);
+	git_SHA1_Final(key, &ctx);
+	return 0;
+}
+
+/*
+ * Look up the ids remembered for "key".  Returns 0 if there are none,
+ * 1 if only the header-only id is known and 2 if the full one is, too.
+ */
+static int patch_id_cache_get(const unsigned char *key,
+			      unsigned char *header_id, unsigned char *full_id)
+{
+	const char *value = append_cache_get(&patch_id_cache, sha1_to_hex(key));
+
+	if (!value || get_sha1_hex(value, header_id))
+		return 0;
+	if (!value[40])
+		return 1;
+	if (value[40] != ' ' || get_sha1_hex(value + 41, full_id) || value[81])
+		return 0;
+	return 2;
+}
+
+static void patch_id_cache_put(const unsigned char *key,
+			       const unsigned char *header_id,
+			       const unsigned char *full_id)
+{
+	struct strbuf value = STRBUF_INIT;
+
+	strbuf_addstr(&value, sha1_to_hex(header_id));
+	if (full_id)
+		strbuf_addf(&value, " %s", sha1_to_hex(full_id));
+	append_cache_put(&patch_id_cache, sha1_to_hex(key), value.buf);
+	strbuf_release(&value);
+}
 
 static int commit_patch_id(struct commit *commit, struct diff_options *options,
-		    unsigned char *sha1)
+			   unsigned char *sha1, int diff_header_only)
 {
 	if (commit->parents)
 		diff_tree_sha1(commit->parents->item->object.sha1,
@@ -13,93 +105,113 @@ static int commit_patch_id(struct commit *commit, struct diff_options *options,
 	else
 		diff_root_tree_sha1(commit->object.sha1, "", options);
 	diffcore_std(options);
-	return diff_flush_patch_id(options, sha1);
+	return diff_flush_patch_id(options, sha1, diff_header_only);
 }
 
-static const unsigned char *patch_id_access(size_t index, void *table)
+/*
+ * Fill in the full patch id of "p" if we have not done so yet.  Only
+ * commits whose header-only ids collide ever need it.
+ */
+static int full_patch_id(struct patch_id *p, struct patch_ids *ids)
 {
-	struct patch_id **id_table = table;
-	return id_table[index]->patch_id;
+	unsigned char key[20], header_id[20], full_id[20];
+	int cached = 0;
+
+	if (p->has_full_id)
+		return 0;
+	if (!patch_id_cache_key(p->commit, ids, key))
+		cached = patch_id_cache_get(key, header_id, full_id);
+	if (cached == 2) {
+		hashcpy(p->patch_id, full_id);
+		p->has_full_id = 1;
+		return 0;
+	}
+	if (commit_patch_id(p->commit, &ids->diffopts, p->patch_id, 0))
+		return error("Could not get patch ID for %s",
+			     sha1_to_hex(p->commit->object.sha1));
+	p->has_full_id = 1;
+	if (cached)
+		patch_id_cache_put(key, header_id, p->patch_id);
+	return 0;
 }
 
-static int patch_pos(struct patch_id **table, int nr, const unsigned char *id)
+static int patch_id_cmp(struct patch_id *a, struct patch_id *b,
+			struct patch_ids *ids)
 {
-	return sha1_pos(id, table, nr, patch_id_access);
+	if (full_patch_id(a, ids) || full_patch_id(b, ids))
+		return -1;
+	return hashcmp(a->patch_id, b->patch_id);
 }
 
-#define BUCKET_SIZE 190 /* 190 * 21 = 3990, with slop close enough to 4K */
-struct patch_id_bucket {
-	struct patch_id_bucket *next;
-	int nr;
-	struct patch_id bucket[BUCKET_SIZE];
-};
-
 int init_patch_ids(struct patch_ids *ids)
 {
 	memset(ids, 0, sizeof(*ids));
 	diff_setup(&ids->diffopts);
 	DIFF_OPT_SET(&ids->diffopts, RECURSIVE);
 	diff_setup_done(&ids->diffopts);
+	hashmap_init(&ids->patches, (hashmap_cmp_fn)patch_id_cmp, 256);
 	return 0;
 }
 
 int free_patch_ids(struct patch_ids *ids)
 {
-	struct patch_id_bucket *next, *patches;
-
-	free(ids->table);
-	for (patches = ids->patches; patches; patches = next) {
-		next = patches->next;
-		free(patches);
-	}
+	hashmap_free(&ids->patches, 1);
 	return 0;
 }
 
-static struct patch_id *add_commit(struct commit *commit,
-				   struct patch_ids *ids,
-				   int no_add)
+/*
+ * Patches are hashed by their header-only id, which only needs a
+ * tree diff; the full id is computed lazily when two of them land on
+ * the same header-only id.
+ */
+static int init_patch_id_entry(struct patch_id *patch,
+			       struct commit *commit,
+			       struct patch_ids *ids)
 {
-	struct patch_id_bucket *bucket;
-	struct patch_id *ent;
-	unsigned char sha1[20];
-	int pos;
+	unsigned char header_only_patch_id[20], key[20], full_id[20];
+	int use_cache;
 
-	if (commit_patch_id(commit, &ids->diffopts, sha1))
-		return NULL;
-	pos = patch_pos(ids->table, ids->nr, sha1);
-	if (0 <= pos)
-		return ids->table[pos];
-	if (no_add)
-		return NULL;
-
-	pos = -1 - pos;
-
-	bucket = ids->patches;
-	if (!bucket || (BUCKET_SIZE <= bucket->nr)) {
-		bucket = xcalloc(1, sizeof(*bucket));
-		bucket->next = ids->patches;
-		ids->patches = bucket;
+	patch->commit = commit;
+	use_cache = !patch_id_cache_key(commit, ids, key);
+	if (!use_cache ||
+	    !patch_id_cache_get(key, header_only_patch_id, full_id)) {
+		if (commit_patch_id(commit, &ids->diffopts,
+				    header_only_patch_id, 1))
+			return -1;
+		if (use_cache)
+			patch_id_cache_put(key, header_only_patch_id, NULL);
 	}
-	ent = &bucket->bucket[bucket->nr++];
-	hashcpy(ent->patch_id, sha1);
-
-	ALLOC_GROW(ids->table, ids->nr + 1, ids->alloc);
-	if (pos < ids->nr)
-		memmove(ids->table + pos + 1, ids->table + pos,
-			sizeof(ent) * (ids->nr - pos));
-	ids->nr++;
-	ids->table[pos] = ent;
-	return ids->table[pos];
+	hashmap_entry_init(patch, sha1hash(header_only_patch_id));
+	return 0;
 }
 
 struct patch_id *has_commit_patch_id(struct commit *commit,
 				     struct patch_ids *ids)
 {
-	return add_commit(commit, ids, 1);
+	struct patch_id patch;
+
+	memset(&patch, 0, sizeof(patch));
+	if (init_patch_id_entry(&patch, commit, ids))
+		return NULL;
+	return hashmap_get(&ids->patches, &patch, ids);
 }
 
 struct patch_id *add_commit_patch_id(struct commit *commit,
 				     struct patch_ids *ids)
 {
-	return add_commit(commit, ids, 0);
+	struct patch_id *key = xcalloc(1, sizeof(*key));
+	struct patch_id *ent;
+
+	if (init_patch_id_entry(key, commit, ids)) {
+		free(key);
+		return NULL;
+	}
+	/* commits with the same patch share the entry */
+	ent = hashmap_get(&ids->patches, key, ids);
+	if (ent) {
+		free(key);
+		return ent;
+	}
+	hashmap_add(&ids->patches, key);
+	return key;
 }
@@ -2,15 +2,19 @@
 #define PATCH_IDS_H
 
 struct patch_id {
+	struct hashmap_entry ent;
 	unsigned char patch_id[20];
+	struct commit *commit;
+	char has_full_id;
 	char seen;
 };
 
 struct patch_ids {
+	struct hashmap patches;
 	struct diff_options diffopts;
-	int nr, alloc;
-	struct patch_id **table;
-	struct patch_id_bucket *patches;
+	/* hashes the diffopts for diff.patchIdCache */
+	unsigned char cache_key[20];
+	int cache_key_ready;
 };
 
 int init_patch_ids(struct patch_ids *);
@@ -0,0 +1,281 @@
+#include "cache.h"
+#include "thread-utils.h"
+#include "patch-pipeline.h"
+
+#ifdef NO_PTHREADS
+
+void start_patch_pipeline(int nr_threads)
+{
+	; /* nothing */
+}
+
+void patch_pipeline_add(const void *one, const void *two,
+			mmfile_t *mf1, mmfile_t *mf2,
+			xpparam_t const *xpp, xdemitconf_t const *xecfg)
+{
+	xdemitconf_t copy = *xecfg;
+
+	xdiff_clear_find_func(&copy);
+}
+
+int patch_pipeline_replay(const void *one, const void *two,
+			  xdiff_emit_consume_fn fn, void *priv)
+{
+	return 0;
+}
+
+void patch_pipeline_discard(const void *one, const void *two)
+{
+	; /* nothing */
+}
+
+void patch_pipeline_discard_all(void)
+{
+	; /* nothing */
+}
+
+int patch_pipeline_active(void)
+{
+	return 0;
+}
+
+unsigned long patch_pipeline_pending(void)
+{
+	return 0;
+}
+
+#else
+
+struct patch_job {
+	const void *one, *two;
+	mmfile_t mf1, mf2;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	struct strbuf out;	/* length and contents of each line */
+	unsigned started:1,
+		 done:1;
+	struct patch_job *next;
+};
+
+static struct patch_pipeline {
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;	/* a job was added */
+	pthread_cond_t done_cond;	/* a job was finished */
+	struct patch_job *jobs, **jobs_tail;	/* in the order they were added */
+	unsigned long pending;
+} pipeline;
+
+static void record_line(void *priv, char *line, unsigned long len)
+{
+	struct strbuf *out = priv;
+
+	strbuf_add(out, &len, sizeof(len));
+	strbuf_add(out, line, len);
+}
+
+static struct patch_job *next_job(void)
+{
+	struct patch_job *job;
+
+	for (job = pipeline.jobs; job; job = job->next)
+		if (!job->started)
+			return job;
+	return NULL;
+}
+
+static void *run_jobs(void *unused)
+{
+	pthread_mutex_lock(&pipeline.mutex);
+	for (;;) {
+		struct patch_job *job;
+
+		while (!(job = next_job()))
+			pthread_cond_wait(&pipeline.work_cond, &pipeline.mutex);
+		job->started = 1;
+		pipeline.pending -= job->mf1.size + job->mf2.size;
+		pthread_mutex_unlock(&pipeline.mutex);
+
+		xdi_diff_outf(&job->mf1, &job->mf2, record_line, &job->out,
+			      &job->xpp, &job->xecfg);
+
+		pthread_mutex_lock(&pipeline.mutex);
+		job->done = 1;
+		pthread_cond_broadcast(&pipeline.done_cond);
+	}
+	return NULL;
+}
+
+void start_patch_pipeline(int nr_threads)
+{
+	int i;
+
+	if (pipeline.nr_threads || nr_threads < 1)
+		return;
+
+	pthread_mutex_init(&pipeline.mutex, NULL);
+	pthread_cond_init(&pipeline.work_cond, NULL);
+	pthread_cond_init(&pipeline.done_cond, NULL);
+	pipeline.jobs = NULL;
+	pipeline.jobs_tail = &pipeline.jobs;
+	pipeline.pending = 0;
+
+	pipeline.threads = xcalloc(nr_threads, sizeof(*pipeline.threads));
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&pipeline.threads[i], NULL, run_jobs, NULL)) {
+			warning(_("unable to create thread: %s"), strerror(errno));
+			break;
+		}
+	}
+	pipeline.nr_threads = i;
+	if (!i)
+		free(pipeline.threads);
+}
+
+void patch_pipeline_add(const void *one, const void *two,
+			mmfile_t *mf1, mmfile_t *mf2,
+			xpparam_t const *xpp, xdemitconf_t const *xecfg)
+{
+	struct patch_job *job;
+
+	if (!pipeline.nr_threads) {
+		xdemitconf_t copy = *xecfg;
+		xdiff_clear_find_func(&copy);
+		return;
+	}
+
+	job = xcalloc(1, sizeof(*job));
+	job->one = one;
+	job->two = two;
+	job->mf1 = *mf1;
+	job->mf2 = *mf2;
+	job->xpp = *xpp;
+	job->xecfg = *xecfg;
+	strbuf_init(&job->out, 0);
+
+	pthread_mutex_lock(&pipeline.mutex);
+	*pipeline.jobs_tail = job;
+	pipeline.jobs_tail = &job->next;
+	pipeline.pending += mf1->size + mf2->size;
+	pthread_cond_signal(&pipeline.work_cond);
+	pthread_mutex_unlock(&pipeline.mutex);
+}
+
+/*
+ * Unlink the job for the pair, once no worker is running it; called
+ * with the mutex held.
+ */
+static struct patch_job *take_job(const void *one, const void *two)
+{
+	struct patch_job **pp, *job;
+
+	for (pp = &pipeline.jobs; *pp; pp = &(*pp)->next)
+		if ((*pp)->one == one && (*pp)->two == two)
+			break;
+	job = *pp;
+	if (!job)
+		return NULL;
+	while (job->started && !job->done)
+		pthread_cond_wait(&pipeline.done_cond, &pipeline.mutex);
+
+	/* the list may have changed while we were waiting */
+	for (pp = &pipeline.jobs; *pp != job; pp = &(*pp)->next)
+		; /* nothing */
+	*pp = job->next;
+	if (!*pp)
+		pipeline.jobs_tail = pp;
+	if (!job->started)
+		pipeline.pending -= job->mf1.size + job->mf2.size;
+	return job;
+}
+
+static void free_job(struct patch_job *job)
+{
+	xdiff_clear_find_func(&job->xecfg);
+	strbuf_release(&job->out);
+	free(job);
+}
+
+int patch_pipeline_replay(const void *one, const void *two,
+			  xdiff_emit_consume_fn fn, void *priv)
+{
+	struct patch_job *job;
+	char *line, *end;
+	unsigned long len;
+
+	if (!pipeline.nr_threads)
+		return 0;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	job = take_job(one, two);
+	/* run it ourselves rather than wait for a worker to pick it up */
+	if (job && !job->started) {
+		pthread_mutex_unlock(&pipeline.mutex);
+		xdi_diff_outf(&job->mf1, &job->mf2, record_line, &job->out,
+			      &job->xpp, &job->xecfg);
+	} else
+		pthread_mutex_unlock(&pipeline.mutex);
+	if (!job)
+		return 0;
+
+	for (line = job->out.buf, end = line + job->out.len; line < end; ) {
+		memcpy(&len, line, sizeof(len));
+		line += sizeof(len);
+		fn(priv, line, len);
+		line += len;
+	}
+	free_job(job);
+	return 1;
+}
+
+void patch_pipeline_discard(const void *one, const void *two)
+{
+	struct patch_job *job;
+
+	if (!pipeline.nr_threads)
+		return;
+
+	pthread_mutex_lock(&pipeline.mutex);
+	job = take_job(one, two);
+	pthread_mutex_unlock(&pipeline.mutex);
+	if (job)
+		free_job(job);
+}
+
+void patch_pipeline_discard_all(void)
+{
+	if (!pipeline.nr_threads)
+		return;
+
+	for (;;) {
+		struct patch_job *job = NULL;
+
+		pthread_mutex_lock(&pipeline.mutex);
+		if (pipeline.jobs)
+			job = take_job(pipeline.jobs->one, pipeline.jobs->two);
+		pthread_mutex_unlock(&pipeline.mutex);
+		if (!job)
+			break;
+		free_job(job);
+	}
+}
+
+int patch_pipeline_active(void)
+{
+	return pipeline.nr_threads;
+}
+
+unsigned long patch_pipeline_pending(void)
+{
+	unsigned long pending;
+
+	if (!pipeline.nr_threads)
+		return 0;
+	pthread_mutex_lock(&pipeline.mutex);
+	pending = pipeline.pending;
+	pthread_mutex_unlock(&pipeline.mutex);
+	return pending;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef PATCH_PIPELINE_H
+#define PATCH_PIPELINE_H
+
+#include "xdiff-interface.h"
+
+/*
+ * Showing a patch for every file pair in the diff queue means running
+ * xdiff over each of them in turn.  Reading the blobs, looking up
+ * attributes, textconv and formatting the output all touch global
+ * state and stay on the main thread, but xdiff does not: diff_flush()
+ * hands the contents of the pairs it is about to show over with
+ * patch_pipeline_add(), the worker threads run xdiff over them and
+ * record the lines it emits, and builtin_diff() feeds those lines to
+ * its usual callback with patch_pipeline_replay() when it gets to the
+ * pair.  The pairs are identified by their two diff_filespecs.
+ */
+
+/*
+ * Start "nr_threads" workers, unless they are already running.  They
+ * are kept for the rest of the process.  Does nothing when built
+ * without threads.
+ */
+extern void start_patch_pipeline(int nr_threads);
+
+/*
+ * Run xdiff over "mf1" and "mf2", the contents of "one" and "two",
+ * with the given parameters.  The buffers stay with the caller, and
+ * must not go away before the pair is replayed or discarded.  The
+ * pipeline takes over the funcname matcher of "xecfg".
+ */
+extern void patch_pipeline_add(const void *one, const void *two,
+			       mmfile_t *mf1, mmfile_t *mf2,
+			       xpparam_t const *xpp, xdemitconf_t const *xecfg);
+
+/*
+ * If the pair was handed over, wait for it, feed the lines xdiff
+ * emitted to "fn" and return 1; otherwise return 0.
+ */
+extern int patch_pipeline_replay(const void *one, const void *two,
+				 xdiff_emit_consume_fn fn, void *priv);
+
+/*
+ * Forget about the pair (or all of them), waiting for the workers to
+ * finish with their buffers.
+ */
+extern void patch_pipeline_discard(const void *one, const void *two);
+extern void patch_pipeline_discard_all(void);
+
+/*
+ * Is the pipeline running, and how many bytes of contents are waiting
+ * for a worker?
+ */
+extern int patch_pipeline_active(void);
+extern unsigned long patch_pipeline_pending(void);
+
+#endif
@@ -93,7 +93,8 @@ static void replace_dir(struct strbuf *buf, int len, const char *newdir)
 
 static const char *common_list[] = {
 	"/branches", "/hooks", "/info", "!/logs", "/lost-found",
-	"/objects", "/refs", "/remotes", "/worktrees", "/rr-cache", "/svn",
+	"/notes-index", "/objects", "/reftable", "/refs", "/remotes", "/worktrees", "/rr-cache",
+	"/svn",
 	"config", "!gc.pid", "packed-refs", "shallow",
 	NULL
 };
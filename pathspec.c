@@ -2,6 +2,64 @@
 #include "dir.h"
 #include "pathspec.h"
 
+/* The position of the first index entry that sorts at or after name. */
+static int index_pos_from(const char *name, int namelen)
+{
+	int pos = index_name_pos(&the_index, name, namelen);
+	return pos < 0 ? -pos - 1 : pos;
+}
+
+static int index_has_name(int pos, const char *name, int namelen)
+{
+	return pos < active_nr && ce_namelen(active_cache[pos]) == namelen &&
+		!memcmp(active_cache[pos]->name, name, namelen);
+}
+
+static int index_has_below(int pos, const char *dir, int dirlen)
+{
+	return pos < active_nr && ce_namelen(active_cache[pos]) > dirlen &&
+		!memcmp(active_cache[pos]->name, dir, dirlen);
+}
+
+/*
+ * What ce_path_match() over the whole index would record in seen[] for
+ * a literal item, found by looking up the run of entries it covers.
+ */
+static int match_literal_against_index(const struct pathspec_item *item)
+{
+	const char *match = item->match;
+	int len = item->len, pos;
+
+	if (!len)
+		return active_nr ? MATCHED_RECURSIVELY : 0;
+
+	if (match[len - 1] == '/') {
+		/* a directory or submodule "foo" given as "foo/" */
+		pos = index_pos_from(match, len - 1);
+		for (; index_has_name(pos, match, len - 1); pos++) {
+			unsigned mode = active_cache[pos]->ce_mode;
+			if (S_ISDIR(mode) || S_ISGITLINK(mode))
+				return MATCHED_EXACTLY;
+		}
+		pos = index_pos_from(match, len);
+		return index_has_below(pos, match, len) ? MATCHED_RECURSIVELY : 0;
+	} else {
+		struct strbuf dir = STRBUF_INIT;
+		int how = 0;
+
+		pos = index_pos_from(match, len);
+		if (index_has_name(pos, match, len))
+			return MATCHED_EXACTLY;
+		strbuf_add(&dir, match, len);
+		strbuf_addch(&dir, '/');
+		pos = index_pos_from(dir.buf, dir.len);
+		if (index_has_below(pos, dir.buf, dir.len))
+			how = MATCHED_RECURSIVELY;
+		strbuf_release(&dir);
+		return how;
+	}
+}
+
 /*
  * Finds which of the given pathspecs match items in the index.
  *
@@ -31,6 +89,25 @@ void add_pathspec_matches_against_index(const struct pathspec *pathspec,
 			num_unmatched++;
 	if (!num_unmatched)
 		return;
+
+	/*
+	 * If every item is a literal path, look up the entries each one
+	 * covers instead of matching every entry against every item.
+	 */
+	if (pathspec->literals && !pathspec->literals->other_nr &&
+	    !(pathspec->magic & PATHSPEC_MAXDEPTH)) {
+		for (i = 0; i < pathspec->nr; i++) {
+			int how;
+
+			if (seen[i] == MATCHED_EXACTLY)
+				continue;
+			how = match_literal_against_index(pathspec->items + i);
+			if (seen[i] < how)
+				seen[i] = how;
+		}
+		return;
+	}
+
 	for (i = 0; i < active_nr; i++) {
 		const struct cache_entry *ce = active_cache[i];
 		ce_path_match(ce, pathspec, seen);
@@ -327,6 +404,94 @@ static int pathspec_item_cmp(const void *a_, const void *b_)
 	return strcmp(a->match, b->match);
 }
 
+static int literal_item_cmp(const void *a_, const void *b_)
+{
+	const struct pathspec_item *a = *(const struct pathspec_item **)a_;
+	const struct pathspec_item *b = *(const struct pathspec_item **)b_;
+	int cmp = memcmp(a->match, b->match, a->len < b->len ? a->len : b->len);
+
+	return cmp ? cmp : a->len - b->len;
+}
+
+static void prepare_pathspec_literals(struct pathspec *ps)
+{
+	struct pathspec_literals *lit;
+	const struct pathspec_item **sorted;
+	int i;
+
+	lit = xcalloc(1, sizeof(*lit));
+	lit->item = xmalloc(ps->nr * sizeof(*lit->item));
+	lit->other = xmalloc(ps->nr * sizeof(*lit->other));
+	for (i = 0; i < ps->nr; i++) {
+		const struct pathspec_item *item = ps->items + i;
+
+		if (item->nowildcard_len < item->len ||
+		    item->magic & (PATHSPEC_ICASE | PATHSPEC_EXCLUDE)) {
+			lit->other[lit->other_nr++] = i;
+			continue;
+		}
+		if (!lit->nr)
+			lit->common = item->len;
+		else {
+			const char *first = ps->items[lit->item[0]].match;
+			int len = 0;
+
+			while (len < lit->common && len < item->len &&
+			       item->match[len] == first[len])
+				len++;
+			lit->common = len;
+		}
+		lit->item[lit->nr++] = i;
+	}
+	sorted = xmalloc(lit->nr * sizeof(*sorted));
+	for (i = 0; i < lit->nr; i++)
+		sorted[i] = ps->items + lit->item[i];
+	qsort(sorted, lit->nr, sizeof(*sorted), literal_item_cmp);
+	for (i = 0; i < lit->nr; i++)
+		lit->item[i] = sorted[i] - ps->items;
+	free(sorted);
+	ps->literals = lit;
+}
+
+int pathspec_literal_cmp(const struct pathspec_item *item, int prefix,
+			 const char *key, int keylen, int slash)
+{
+	const char *match = item->match + prefix;
+	int matchlen = item->len - prefix;
+	int cmp = memcmp(match, key, matchlen < keylen ? matchlen : keylen);
+
+	if (cmp)
+		return cmp;
+	if (matchlen <= keylen)
+		return matchlen < keylen + slash ? -1 : 0;
+	if (!slash)
+		return 1;
+	if (match[keylen] != '/')
+		return (unsigned char)match[keylen] - '/';
+	return matchlen > keylen + 1;
+}
+
+int find_pathspec_literal(const struct pathspec *ps, int prefix,
+			  const char *key, int keylen, int slash)
+{
+	const struct pathspec_literals *lit = ps->literals;
+	int lo = 0, hi = lit->nr;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (pathspec_literal_cmp(ps->items + lit->item[mid], prefix,
+					 key, keylen, slash) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < lit->nr &&
+	    !pathspec_literal_cmp(ps->items + lit->item[lo], prefix,
+				  key, keylen, slash))
+		return lo;
+	return -1;
+}
+
 static void NORETURN unsupported_magic(const char *pattern,
 				       unsigned magic,
 				       unsigned short_magic)
@@ -398,6 +563,7 @@ void parse_pathspec(struct pathspec *pathspec,
 		raw[1] = NULL;
 		pathspec->nr = 1;
 		pathspec->_raw = raw;
+		prepare_pathspec_literals(pathspec);
 		return;
 	}
 
@@ -448,6 +614,7 @@ void parse_pathspec(struct pathspec *pathspec,
 		qsort(pathspec->items, pathspec->nr,
 		      sizeof(struct pathspec_item), pathspec_item_cmp);
 	}
+	prepare_pathspec_literals(pathspec);
 }
 
 /*
@@ -486,10 +653,65 @@ void copy_pathspec(struct pathspec *dst, const struct pathspec *src)
 	dst->items = xmalloc(sizeof(struct pathspec_item) * dst->nr);
 	memcpy(dst->items, src->items,
 	       sizeof(struct pathspec_item) * dst->nr);
+	dst->lookup = NULL;
+	dst->literals = NULL;
+	if (src->literals)
+		prepare_pathspec_literals(dst);
 }
 
+/* marks a pathspec that get_pathspec_lookup() cannot help with */
+static struct pathspec_lookup no_lookup;
+
 void free_pathspec(struct pathspec *pathspec)
 {
 	free(pathspec->items);
 	pathspec->items = NULL;
+	if (pathspec->literals) {
+		free(pathspec->literals->item);
+		free(pathspec->literals->other);
+		free(pathspec->literals);
+		pathspec->literals = NULL;
+	}
+	if (pathspec->lookup && pathspec->lookup != &no_lookup) {
+		free(pathspec->lookup->paths);
+		strbuf_release(&pathspec->lookup->base);
+		free(pathspec->lookup);
+	}
+	pathspec->lookup = NULL;
+}
+
+static int lookup_path_cmp(const void *a_, const void *b_)
+{
+	const struct pathspec_lookup_path *a = a_, *b = b_;
+	int cmp = memcmp(a->match, b->match, a->len < b->len ? a->len : b->len);
+
+	return cmp ? cmp : a->len - b->len;
+}
+
+struct pathspec_lookup *get_pathspec_lookup(const struct pathspec *ps)
+{
+	struct pathspec_lookup *lookup = ps->lookup;
+	int i;
+
+	if (lookup)
+		return lookup == &no_lookup ? NULL : lookup;
+
+	lookup = &no_lookup;
+	if (ps->nr && !ps->has_wildcard &&
+	    !(ps->magic & (PATHSPEC_ICASE | PATHSPEC_EXCLUDE))) {
+		lookup = xcalloc(1, sizeof(*lookup));
+		lookup->nr = ps->nr;
+		lookup->paths = xmalloc(ps->nr * sizeof(*lookup->paths));
+		for (i = 0; i < ps->nr; i++) {
+			lookup->paths[i].match = ps->items[i].match;
+			lookup->paths[i].len = ps->items[i].len;
+		}
+		qsort(lookup->paths, lookup->nr, sizeof(*lookup->paths),
+		      lookup_path_cmp);
+		strbuf_init(&lookup->base, 0);
+		lookup->begin = lookup->end = -1;
+	}
+	/* building it does not change what the pathspec matches */
+	((struct pathspec *)ps)->lookup = lookup;
+	return lookup == &no_lookup ? NULL : lookup;
 }
@@ -18,6 +18,38 @@
 
 #define PATHSPEC_ONESTAR 1	/* the pathspec pattern satisfies GFNM_ONESTAR */
 
+/*
+ * The paths of a pathspec without wildcards or magic, sorted, so that
+ * those in a directory form one run and can be found by bisection;
+ * see tree_entry_interesting().
+ */
+struct pathspec_lookup {
+	int nr;
+	struct pathspec_lookup_path {
+		const char *match;
+		int len;
+	} *paths;
+	/* the last directory looked at, and its run of paths */
+	struct strbuf base;
+	int base_has_parent;
+	int begin, end;
+};
+
+/*
+ * The items of a pathspec without wildcards or magic that changes how
+ * they match, sorted by path, and the positions of all the other ones.
+ * A name can only be matched by the literal items that spell one of
+ * its leading directories or the name itself, which can be found by
+ * bisection instead of trying every item; see match_pathspec().
+ */
+struct pathspec_literals {
+	int nr;
+	int *item;	/* positions in items[], sorted by match */
+	int common;	/* how many bytes all their matches share */
+	int other_nr;
+	int *other;	/* positions in items[] of the rest */
+};
+
 struct pathspec {
 	const char **_raw; /* get_pathspec() result, not freed by free_pathspec() */
 	int nr;
@@ -33,6 +65,8 @@ struct pathspec {
 		int nowildcard_len;
 		int flags;
 	} *items;
+	struct pathspec_lookup *lookup; /* see get_pathspec_lookup() */
+	struct pathspec_literals *literals; /* filled by parse_pathspec() */
 };
 
 #define GUARD_PATHSPEC(ps, mask) \
@@ -76,6 +110,13 @@ extern void parse_pathspec(struct pathspec *pathspec,
 extern void copy_pathspec(struct pathspec *dst, const struct pathspec *src);
 extern void free_pathspec(struct pathspec *);
 
+/*
+ * Return the sorted paths of a pathspec that has neither wildcards
+ * nor icase or exclude magic, building them on the first call, or
+ * NULL if the pathspec has any of those.
+ */
+extern struct pathspec_lookup *get_pathspec_lookup(const struct pathspec *);
+
 static inline int ps_strncmp(const struct pathspec_item *item,
 			     const char *s1, const char *s2, size_t n)
 {
@@ -94,6 +135,16 @@ static inline int ps_strcmp(const struct pathspec_item *item,
 		return strcmp(s1, s2);
 }
 
+/*
+ * Find the first literal item whose match, from "prefix" on, is "key"
+ * with a '/' appended if "slash" is set.  Returns its position in
+ * literals->item[] or -1.  Items with the same match follow it.
+ */
+extern int find_pathspec_literal(const struct pathspec *ps, int prefix,
+				 const char *key, int keylen, int slash);
+extern int pathspec_literal_cmp(const struct pathspec_item *item, int prefix,
+				const char *key, int keylen, int slash);
+
 extern char *find_pathspecs_matching_against_index(const struct pathspec *pathspec);
 extern void add_pathspec_matches_against_index(const struct pathspec *pathspec, char *seen);
 extern const char *check_path_for_gitlink(const char *path);
@@ -63,6 +63,18 @@ void packet_buf_flush(struct strbuf *buf)
 	strbuf_add(buf, "0000", 4);
 }
 
+void packet_delim(int fd)
+{
+	packet_trace("0001", 4, 1);
+	write_or_die(fd, "0001", 4);
+}
+
+void packet_buf_delim(struct strbuf *buf)
+{
+	packet_trace("0001", 4, 1);
+	strbuf_add(buf, "0001", 4);
+}
+
 #define hex(a) (hexchar[(a) & 15])
 static void format_packet(struct strbuf *out, const char *fmt, va_list args)
 {
@@ -105,6 +117,82 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...)
 	va_end(args);
 }
 
+int packet_flush_gently(int fd)
+{
+	packet_trace("0000", 4, 1);
+	if (write_in_full(fd, "0000", 4) != 4)
+		return error("flush packet write failed");
+	return 0;
+}
+
+int packet_write_fmt_gently(int fd, const char *fmt, ...)
+{
+	static struct strbuf buf = STRBUF_INIT;
+	va_list args;
+
+	strbuf_reset(&buf);
+	va_start(args, fmt);
+	format_packet(&buf, fmt, args);
+	va_end(args);
+	if (write_in_full(fd, buf.buf, buf.len) != buf.len)
+		return error("packet write failed");
+	return 0;
+}
+
+static int packet_write_data_gently(int fd, const char *data, size_t size)
+{
+	static char hexchar[] = "0123456789abcdef";
+	static char buf[LARGE_PACKET_MAX];
+	size_t n = size + 4;
+
+	if (size > sizeof(buf) - 4)
+		return error("packet write failed - data exceeds max packet size");
+	buf[0] = hex(n >> 12);
+	buf[1] = hex(n >> 8);
+	buf[2] = hex(n >> 4);
+	buf[3] = hex(n);
+	memcpy(buf + 4, data, size);
+	packet_trace(buf + 4, size, 1);
+	if (write_in_full(fd, buf, n) != n)
+		return error("packet write failed");
+	return 0;
+}
+
+int write_packetized_from_fd(int fd_in, int fd_out)
+{
+	static char buf[LARGE_PACKET_MAX - 4];
+	int err = 0;
+	ssize_t len;
+
+	for (;;) {
+		len = xread(fd_in, buf, sizeof(buf));
+		if (len < 0)
+			return error("read error: %s", strerror(errno));
+		if (!len)
+			break;
+		err = packet_write_data_gently(fd_out, buf, len);
+		if (err)
+			return err;
+	}
+	return packet_flush_gently(fd_out);
+}
+
+int write_packetized_from_buf(const char *src, size_t len, int fd_out)
+{
+	size_t chunk = LARGE_PACKET_MAX - 4;
+	int err;
+
+	while (len) {
+		size_t n = len < chunk ? len : chunk;
+		err = packet_write_data_gently(fd_out, src, n);
+		if (err)
+			return err;
+		src += n;
+		len -= n;
+	}
+	return packet_flush_gently(fd_out);
+}
+
 static int get_packet_data(int fd, char **src_buf, size_t *src_size,
 			   void *dst, unsigned size, int options)
 {
@@ -177,6 +265,10 @@ int packet_read(int fd, char **src_buf, size_t *src_len,
 		packet_trace("0000", 4, 0);
 		return 0;
 	}
+	if (len == 1 && (options & PACKET_READ_DELIM)) {
+		packet_trace("0001", 4, 0);
+		return PACKET_DELIM;
+	}
 	len -= 4;
 	if (len >= size)
 		die("protocol error: bad line length %d", len);
@@ -214,3 +306,24 @@ char *packet_read_line_buf(char **src, size_t *src_len, int *dst_len)
 {
 	return packet_read_line_generic(-1, src, src_len, dst_len);
 }
+
+ssize_t read_packetized_to_strbuf(int fd_in, struct strbuf *sb)
+{
+	size_t orig_len = sb->len;
+	int len;
+
+	for (;;) {
+		strbuf_grow(sb, LARGE_PACKET_MAX);
+		len = packet_read(fd_in, NULL, NULL, sb->buf + sb->len,
+				  LARGE_PACKET_MAX, PACKET_READ_GENTLE_ON_EOF);
+		if (len <= 0)
+			break;
+		sb->len += len;
+	}
+	if (len < 0) {
+		strbuf_setlen(sb, orig_len);
+		return len;
+	}
+	sb->buf[sb->len] = '\0';
+	return sb->len - orig_len;
+}
@@ -24,6 +24,28 @@ void packet_write(int fd, const char *fmt, ...) __attribute__((format (printf, 2
 void packet_buf_flush(struct strbuf *buf);
 void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
 
+/*
+ * Like packet_flush() and packet_write(), but report a write error
+ * and return -1 instead of dying.
+ */
+int packet_flush_gently(int fd);
+int packet_write_fmt_gently(int fd, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+
+/*
+ * Send all of the data from fd_in, or the buffer, as packets of at
+ * most LARGE_PACKET_MAX bytes followed by a flush packet.  Returns 0
+ * on success and -1 (after reporting an error) otherwise.
+ */
+int write_packetized_from_fd(int fd_in, int fd_out);
+int write_packetized_from_buf(const char *src, size_t len, int fd_out);
+
+/*
+ * A delim packet ("0001") separates the sections of a protocol v2
+ * request; see Documentation/technical/protocol-v2.txt.
+ */
+void packet_delim(int fd);
+void packet_buf_delim(struct strbuf *buf);
+
 /*
  * Read a packetized line into the buffer, which must be at least size bytes
  * long. The return value specifies the number of bytes read into the buffer.
@@ -54,9 +76,14 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((f
  *
  * If options contains PACKET_READ_CHOMP_NEWLINE, a trailing newline (if
  * present) is removed from the buffer before returning.
+ *
+ * If options contains PACKET_READ_DELIM, a delim packet is returned as
+ * PACKET_DELIM rather than treated as a protocol error.
  */
 #define PACKET_READ_GENTLE_ON_EOF (1u<<0)
 #define PACKET_READ_CHOMP_NEWLINE (1u<<1)
+#define PACKET_READ_DELIM         (1u<<2)
+#define PACKET_DELIM (-2)
 int packet_read(int fd, char **src_buffer, size_t *src_len, char
 		*buffer, unsigned size, int options);
 
@@ -75,6 +102,13 @@ char *packet_read_line(int fd, int *size);
  */
 char *packet_read_line_buf(char **src_buf, size_t *src_len, int *size);
 
+/*
+ * Append the data of all packets up to the next flush packet to sb.
+ * Returns the number of bytes read, or -1 (leaving sb as it was) if
+ * the stream ends early.
+ */
+ssize_t read_packetized_to_strbuf(int fd_in, struct strbuf *sb);
+
 #define DEFAULT_PACKET_MAX 1000
 #define LARGE_PACKET_MAX 65520
 extern char packet_buffer[LARGE_PACKET_MAX];
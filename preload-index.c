@@ -4,6 +4,7 @@
 #include "cache.h"
 #include "pathspec.h"
 #include "dir.h"
+#include "fsmonitor.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
@@ -16,34 +17,57 @@ static void preload_index(struct index_state *index,
 #include <pthread.h>
 
 /*
- * Mostly randomly chosen maximum thread counts: we
- * cap the parallelism to 20 threads, and we want
- * to have at least 500 lstat's per thread for it to
- * be worth starting a thread.
+ * Threads take CHUNK_SIZE entries at a time from a shared cursor, so
+ * that one landing on a slow directory does not hold up the others.
+ * How many threads to start is decided after timing the first
+ * SAMPLE_LSTATS lstat calls: roughly one per THREAD_WORK_NS of
+ * expected work, capped to MAX_PARALLEL.
  */
 #define MAX_PARALLEL (20)
-#define THREAD_COST (500)
+#define CHUNK_SIZE (64)
+#define SAMPLE_LSTATS (32)
+#define THREAD_WORK_NS (2000000)
+
+static struct trace_key trace_preload = TRACE_KEY_INIT(PRELOAD);
+
+struct preload_state {
+	struct index_state *index;
+	pthread_mutex_t mutex;
+	int next;
+};
 
 struct thread_data {
 	pthread_t pthread;
-	struct index_state *index;
+	struct preload_state *state;
 	struct pathspec pathspec;
-	int offset, nr;
+	int entries, lstats;
+	uint64_t nanos;
 };
 
-static void *preload_thread(void *_data)
+/* Take the next chunk of entries; returns how many were taken. */
+static int take_chunk(struct preload_state *state, int *offset)
 {
 	int nr;
-	struct thread_data *p = _data;
-	struct index_state *index = p->index;
-	struct cache_entry **cep = index->cache + p->offset;
-	struct cache_def cache = CACHE_DEF_INIT;
 
-	nr = p->nr;
-	if (nr + p->offset > index->cache_nr)
-		nr = index->cache_nr - p->offset;
+	pthread_mutex_lock(&state->mutex);
+	*offset = state->next;
+	nr = state->index->cache_nr - state->next;
+	if (nr > CHUNK_SIZE)
+		nr = CHUNK_SIZE;
+	state->next += nr;
+	pthread_mutex_unlock(&state->mutex);
+	return nr;
+}
+
+static void preload_chunk(struct thread_data *p, struct cache_def *cache,
+			  int offset, int nr)
+{
+	struct index_state *index = p->state->index;
+	struct cache_entry **cep = index->cache + offset;
+	uint64_t start = getnanotime();
 
-	do {
+	p->entries += nr;
+	while (nr-- > 0) {
 		struct cache_entry *ce = *cep++;
 		struct stat st;
 
@@ -53,16 +77,30 @@ static void *preload_thread(void *_data)
 			continue;
 		if (ce_uptodate(ce))
 			continue;
+		if (fsmonitor_trusts(index, ce))
+			continue;
 		if (!ce_path_match(ce, &p->pathspec, NULL))
 			continue;
-		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
+		if (threaded_has_symlink_leading_path(cache, ce->name, ce_namelen(ce)))
 			continue;
+		p->lstats++;
 		if (lstat(ce->name, &st))
 			continue;
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
 			continue;
 		ce_mark_uptodate(ce);
-	} while (--nr > 0);
+	}
+	p->nanos += getnanotime() - start;
+}
+
+static void *preload_thread(void *_data)
+{
+	struct thread_data *p = _data;
+	struct cache_def cache = CACHE_DEF_INIT;
+	int offset, nr;
+
+	while ((nr = take_chunk(p->state, &offset)) > 0)
+		preload_chunk(p, &cache, offset, nr);
 	cache_def_clear(&cache);
 	return NULL;
 }
@@ -70,36 +108,72 @@ static void *preload_thread(void *_data)
 static void preload_index(struct index_state *index,
 			  const struct pathspec *pathspec)
 {
-	int threads, i, work, offset;
+	int threads, i, offset, nr;
 	struct thread_data data[MAX_PARALLEL];
+	struct preload_state state;
+	struct cache_def cache = CACHE_DEF_INIT;
 
 	if (!core_preload_index)
 		return;
 
-	threads = index->cache_nr / THREAD_COST;
-	if (threads < 2)
-		return;
-	if (threads > MAX_PARALLEL)
-		threads = MAX_PARALLEL;
-	offset = 0;
-	work = DIV_ROUND_UP(index->cache_nr, threads);
+	refresh_fsmonitor(index);
 	memset(&data, 0, sizeof(data));
-	for (i = 0; i < threads; i++) {
+	state.index = index;
+	state.next = 0;
+	pthread_mutex_init(&state.mutex, NULL);
+
+	/*
+	 * This thread is the first worker; see how slow lstat is here
+	 * before deciding whether to start others.
+	 */
+	data[0].state = &state;
+	if (pathspec)
+		copy_pathspec(&data[0].pathspec, pathspec);
+	while (data[0].lstats < SAMPLE_LSTATS &&
+	       (nr = take_chunk(&state, &offset)) > 0)
+		preload_chunk(&data[0], &cache, offset, nr);
+
+	threads = 1;
+	if (state.next < index->cache_nr) {
+		uint64_t expected = data[0].nanos / data[0].entries *
+			(index->cache_nr - state.next);
+
+		threads = expected / THREAD_WORK_NS;
+		if (threads < 1)
+			threads = 1;
+		if (threads > MAX_PARALLEL)
+			threads = MAX_PARALLEL;
+	}
+
+	for (i = 1; i < threads; i++) {
 		struct thread_data *p = data+i;
-		p->index = index;
+		p->state = &state;
 		if (pathspec)
 			copy_pathspec(&p->pathspec, pathspec);
-		p->offset = offset;
-		p->nr = work;
-		offset += work;
 		if (pthread_create(&p->pthread, NULL, preload_thread, p))
 			die("unable to create threaded lstat");
 	}
-	for (i = 0; i < threads; i++) {
+	while ((nr = take_chunk(&state, &offset)) > 0)
+		preload_chunk(&data[0], &cache, offset, nr);
+	cache_def_clear(&cache);
+	for (i = 1; i < threads; i++) {
 		struct thread_data *p = data+i;
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 	}
+	pthread_mutex_destroy(&state.mutex);
+
+	if (trace_want(&trace_preload)) {
+		trace_printf_key(&trace_preload,
+				 "preload: %d threads for %u entries\n",
+				 threads, index->cache_nr);
+		for (i = 0; i < threads; i++)
+			trace_printf_key(&trace_preload,
+					 "preload: thread %d: %d entries, "
+					 "%d lstat, %"PRIuMAX" ns\n",
+					 i, data[i].entries, data[i].lstats,
+					 (uintmax_t)data[i].nanos);
+	}
 }
 #endif
 
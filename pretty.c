@@ -670,22 +670,23 @@ static int mailmap_name(const char **email, size_t *email_len,
 	return mail_map->nr && map_user(mail_map, email, email_len, name, name_len);
 }
 
+/* "s" is NULL when the ident line could not be split */
 static size_t format_person_part(struct strbuf *sb, char part,
-				 const char *msg, int len, enum date_mode dmode)
+				 const struct ident_split *s,
+				 enum date_mode dmode)
 {
 	/* currently all placeholders have same length */
 	const int placeholder_len = 2;
-	struct ident_split s;
 	const char *name, *mail;
 	size_t maillen, namelen;
 
-	if (split_ident_line(&s, msg, len) < 0)
+	if (!s)
 		goto skip;
 
-	name = s.name_begin;
-	namelen = s.name_end - s.name_begin;
-	mail = s.mail_begin;
-	maillen = s.mail_end - s.mail_begin;
+	name = s->name_begin;
+	namelen = s->name_end - s->name_begin;
+	mail = s->mail_begin;
+	maillen = s->mail_end - s->mail_begin;
 
 	if (part == 'N' || part == 'E') /* mailmap lookup */
 		mailmap_name(&mail, &maillen, &name, &namelen);
@@ -698,29 +699,29 @@ static size_t format_person_part(struct strbuf *sb, char part,
 		return placeholder_len;
 	}
 
-	if (!s.date_begin)
+	if (!s->date_begin)
 		goto skip;
 
 	if (part == 't') {	/* date, UNIX timestamp */
-		strbuf_add(sb, s.date_begin, s.date_end - s.date_begin);
+		strbuf_add(sb, s->date_begin, s->date_end - s->date_begin);
 		return placeholder_len;
 	}
 
 	switch (part) {
 	case 'd':	/* date */
-		strbuf_addstr(sb, show_ident_date(&s, dmode));
+		strbuf_addstr(sb, show_ident_date(s, dmode));
 		return placeholder_len;
 	case 'D':	/* date, RFC2822 style */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_RFC2822));
+		strbuf_addstr(sb, show_ident_date(s, DATE_RFC2822));
 		return placeholder_len;
 	case 'r':	/* date, relative */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_RELATIVE));
+		strbuf_addstr(sb, show_ident_date(s, DATE_RELATIVE));
 		return placeholder_len;
 	case 'i':	/* date, ISO 8601-like */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_ISO8601));
+		strbuf_addstr(sb, show_ident_date(s, DATE_ISO8601));
 		return placeholder_len;
 	case 'I':	/* date, ISO 8601 strict */
-		strbuf_addstr(sb, show_ident_date(&s, DATE_ISO8601_STRICT));
+		strbuf_addstr(sb, show_ident_date(s, DATE_ISO8601_STRICT));
 		return placeholder_len;
 	}
 
@@ -774,6 +775,10 @@ struct format_commit_context {
 	/* These offsets are relative to the start of the commit message. */
 	struct chunk author;
 	struct chunk committer;
+	/* ... and these are split on first use; see split_person(). */
+	struct ident_split author_ident;
+	struct ident_split committer_ident;
+	signed char author_split, committer_split;
 	size_t message_off;
 	size_t subject_off;
 	size_t body_off;
@@ -805,29 +810,43 @@ static int add_again(struct strbuf *sb, struct chunk *chunk)
 static void parse_commit_header(struct format_commit_context *context)
 {
 	const char *msg = context->message;
-	int i;
+	const char *line = msg;
 
-	for (i = 0; msg[i]; i++) {
-		const char *name;
-		int eol;
-		for (eol = i; msg[eol] && msg[eol] != '\n'; eol++)
-			; /* do nothing */
+	while (*line && *line != '\n') {
+		const char *name, *eol = strchrnul(line, '\n');
 
-		if (i == eol) {
-			break;
-		} else if (skip_prefix(msg + i, "author ", &name)) {
+		if (skip_prefix(line, "author ", &name)) {
 			context->author.off = name - msg;
-			context->author.len = msg + eol - name;
-		} else if (skip_prefix(msg + i, "committer ", &name)) {
+			context->author.len = eol - name;
+		} else if (skip_prefix(line, "committer ", &name)) {
 			context->committer.off = name - msg;
-			context->committer.len = msg + eol - name;
+			context->committer.len = eol - name;
+		}
+		if (!*eol) {
+			line = eol;
+			break;
 		}
-		i = eol;
+		line = eol + 1;
 	}
-	context->message_off = i;
+	context->message_off = line - msg;
 	context->commit_header_parsed = 1;
 }
 
+/*
+ * Split the author or committer line once, however many of its
+ * placeholders the format uses.  Returns NULL if it is bogus.
+ */
+static const struct ident_split *split_person(struct format_commit_context *c,
+					      const struct chunk *chunk,
+					      struct ident_split *ident,
+					      signed char *split)
+{
+	if (!*split)
+		*split = split_ident_line(ident, c->message + chunk->off,
+					  chunk->len) < 0 ? -1 : 1;
+	return *split > 0 ? ident : NULL;
+}
+
 static int istitlechar(char c)
 {
 	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
@@ -936,6 +955,7 @@ static int format_reflog_person(struct strbuf *sb,
 				enum date_mode dmode)
 {
 	const char *ident;
+	struct ident_split s;
 
 	if (!log)
 		return 2;
@@ -944,7 +964,9 @@ static int format_reflog_person(struct strbuf *sb,
 	if (!ident)
 		return 2;
 
-	return format_person_part(sb, part, ident, strlen(ident), dmode);
+	return format_person_part(sb, part,
+				  split_ident_line(&s, ident, strlen(ident)) < 0 ?
+				  NULL : &s, dmode);
 }
 
 static size_t parse_color(struct strbuf *sb, /* in UTF-8 */
@@ -1138,12 +1160,12 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 		c->abbrev_commit_hash.len = sb->len - c->abbrev_commit_hash.off;
 		return 1;
 	case 'T':		/* tree hash */
-		strbuf_addstr(sb, sha1_to_hex(commit->tree->object.sha1));
+		strbuf_addstr(sb, sha1_to_hex(get_commit_tree_sha1(commit)));
 		return 1;
 	case 't':		/* abbreviated tree hash */
 		if (add_again(sb, &c->abbrev_tree_hash))
 			return 1;
-		strbuf_addstr(sb, find_unique_abbrev(commit->tree->object.sha1,
+		strbuf_addstr(sb, find_unique_abbrev(get_commit_tree_sha1(commit),
 						     c->pretty_ctx->abbrev));
 		c->abbrev_tree_hash.len = sb->len - c->abbrev_tree_hash.off;
 		return 1;
@@ -1250,11 +1272,14 @@ static size_t format_commit_one(struct strbuf *sb, /* in UTF-8 */
 	switch (placeholder[0]) {
 	case 'a':	/* author ... */
 		return format_person_part(sb, placeholder[1],
-				   msg + c->author.off, c->author.len,
+				   split_person(c, &c->author, &c->author_ident,
+						&c->author_split),
 				   c->pretty_ctx->date_mode);
 	case 'c':	/* committer ... */
 		return format_person_part(sb, placeholder[1],
-				   msg + c->committer.off, c->committer.len,
+				   split_person(c, &c->committer,
+						&c->committer_ident,
+						&c->committer_split),
 				   c->pretty_ctx->date_mode);
 	case 'e':	/* encoding */
 		if (c->commit_encoding)
@@ -1463,6 +1488,112 @@ void userformat_find_requirements(const char *fmt, struct userformat_want *w)
 	strbuf_release(&dummy);
 }
 
+/*
+ * A user format, cut into the pieces strbuf_expand() would go through:
+ * literal text, and placeholders with the number of bytes
+ * format_commit_item() consumed for them when the format was first
+ * expanded.  Expanding the format for the next commit then does not
+ * have to scan it for '%' again.
+ */
+struct format_op {
+	const char *start;	/* just after the '%' for a placeholder */
+	size_t len;
+	unsigned placeholder:1;
+};
+
+struct format_template {
+	char *format;
+	struct format_op *ops;
+	int nr, alloc;
+};
+
+static struct format_template format_template;
+
+static void add_format_op(struct format_template *t, const char *start,
+			  size_t len, int placeholder)
+{
+	struct format_op *op;
+
+	ALLOC_GROW(t->ops, t->nr + 1, t->alloc);
+	op = &t->ops[t->nr++];
+	op->start = start;
+	op->len = len;
+	op->placeholder = placeholder;
+}
+
+/* strbuf_expand(), noting down the pieces of t->format on the way */
+static void compile_format(struct strbuf *sb, struct format_template *t,
+			   struct format_commit_context *c)
+{
+	const char *format = t->format;
+
+	t->nr = 0;
+	for (;;) {
+		const char *percent;
+		size_t consumed;
+
+		percent = strchrnul(format, '%');
+		if (percent != format) {
+			add_format_op(t, format, percent - format, 0);
+			strbuf_add(sb, format, percent - format);
+		}
+		if (!*percent)
+			break;
+		format = percent + 1;
+
+		if (*format == '%') {
+			add_format_op(t, format, 1, 0);
+			strbuf_addch(sb, '%');
+			format++;
+			continue;
+		}
+
+		consumed = format_commit_item(sb, format, c);
+		add_format_op(t, format, consumed, 1);
+		if (consumed)
+			format += consumed;
+		else
+			strbuf_addch(sb, '%');
+	}
+}
+
+static void expand_format(struct strbuf *sb, const char *format,
+			  struct format_commit_context *c)
+{
+	struct format_template *t = &format_template;
+	int i;
+
+	if (!t->format || strcmp(t->format, format)) {
+		free(t->format);
+		t->format = xstrdup(format);
+		compile_format(sb, t, c);
+		return;
+	}
+
+	for (i = 0; i < t->nr; i++) {
+		const struct format_op *op = &t->ops[i];
+		size_t consumed;
+
+		if (!op->placeholder) {
+			strbuf_add(sb, op->start, op->len);
+			continue;
+		}
+		consumed = format_commit_item(sb, op->start, c);
+		if (!consumed)
+			strbuf_addch(sb, '%');
+		if (consumed != op->len) {
+			/*
+			 * This commit has no use for a placeholder the
+			 * first one had (or the other way around, e.g.
+			 * with %N); the rest is not cut the same way.
+			 */
+			strbuf_expand(sb, op->start + consumed,
+				      format_commit_item, c);
+			return;
+		}
+	}
+}
+
 void format_commit_message(const struct commit *commit,
 			   const char *format, struct strbuf *sb,
 			   const struct pretty_print_context *pretty_ctx)
@@ -1483,7 +1614,7 @@ void format_commit_message(const struct commit *commit,
 					  &context.commit_encoding,
 					  utf8);
 
-	strbuf_expand(sb, format, format_commit_item, &context);
+	expand_format(sb, format, &context);
 	rewrap_message_tail(sb, &context, 0, 0, 0);
 
 	/* then convert a commit message to an actual output encoding */
@@ -0,0 +1,51 @@
+#include "cache.h"
+#include "string-list.h"
+#include "protocol.h"
+
+static enum protocol_version parse_protocol_version(const char *value)
+{
+	if (!strcmp(value, "0"))
+		return protocol_v0;
+	if (!strcmp(value, "2"))
+		return protocol_v2;
+	return protocol_unknown_version;
+}
+
+enum protocol_version get_protocol_version_config(void)
+{
+	const char *value;
+	enum protocol_version version;
+
+	if (git_config_get_string_const("protocol.version", &value))
+		return protocol_v0;
+	version = parse_protocol_version(value);
+	if (version == protocol_unknown_version)
+		die(_("unknown value for config 'protocol.version': %s"), value);
+	return version;
+}
+
+enum protocol_version determine_protocol_version_server(void)
+{
+	const char *git_protocol = getenv(GIT_PROTOCOL_ENVIRONMENT);
+	enum protocol_version version = protocol_v0;
+	struct string_list list = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+
+	if (!git_protocol)
+		return version;
+
+	/* Ignore what we do not understand; the highest known version wins. */
+	string_list_split(&list, git_protocol, ':', -1);
+	for_each_string_list_item(item, &list) {
+		const char *value;
+		enum protocol_version v;
+
+		if (!skip_prefix(item->string, "version=", &value))
+			continue;
+		v = parse_protocol_version(value);
+		if (v > version)
+			version = v;
+	}
+	string_list_clear(&list, 0);
+	return version;
+}
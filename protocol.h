@@ -0,0 +1,33 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+ * The versions of the fetch protocol; see
+ * Documentation/technical/protocol-v2.txt for what version 2 changes.
+ */
+enum protocol_version {
+	protocol_unknown_version = -1,
+	protocol_v0 = 0,
+	protocol_v2 = 2,
+};
+
+/*
+ * The client passes the version it would like the server to speak in
+ * this variable, as "version=<n>" in a colon-separated list; the
+ * transports carry it over to the server's environment.
+ */
+#define GIT_PROTOCOL_ENVIRONMENT "GIT_PROTOCOL"
+
+/*
+ * The version the client should ask for, from the protocol.version
+ * configuration (v0 if unset).  Dies on a version we do not know.
+ */
+extern enum protocol_version get_protocol_version_config(void);
+
+/*
+ * The version the client asked the server to speak, from
+ * GIT_PROTOCOL; v0 if it did not ask or asked for none we know.
+ */
+extern enum protocol_version determine_protocol_version_server(void);
+
+#endif /* PROTOCOL_H */
@@ -9,6 +9,8 @@
 #include "cache-tree.h"
 #include "progress.h"
 #include "list-objects.h"
+#include "pack.h"
+#include "pack-bitmap.h"
 
 struct connectivity_progress {
 	struct progress *progress;
@@ -156,6 +158,7 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 			    struct progress *progress)
 {
 	struct connectivity_progress cp;
+	int nr;
 
 	/*
 	 * Set up revision parsing, and mark us as being interested
@@ -182,12 +185,22 @@ void mark_reachable_objects(struct rev_info *revs, int mark_reflog,
 	cp.count = 0;
 
 	/*
-	 * Set up the revision walk - this will move all commits
-	 * from the pending list to the commit walking list.
+	 * With a bitmap index, only the part of the history that it
+	 * does not cover needs to be walked.
 	 */
-	if (prepare_revision_walk(revs))
-		die("revision walk setup failed");
-	traverse_commit_list(revs, mark_commit, mark_object, &cp);
+	nr = bitmap_mark_reachable(revs);
+	if (nr >= 0) {
+		cp.count = nr;
+		display_progress(cp.progress, cp.count);
+	} else {
+		/*
+		 * Set up the revision walk - this will move all commits
+		 * from the pending list to the commit walking list.
+		 */
+		if (prepare_revision_walk(revs))
+			die("revision walk setup failed");
+		traverse_commit_list(revs, mark_commit, mark_object, &cp);
+	}
 
 	if (mark_recent) {
 		revs->ignore_missing_links = 1;
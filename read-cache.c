@@ -18,6 +18,9 @@
 #include "split-index.h"
 #include "sigchain.h"
 #include "utf8.h"
+#include "thread-utils.h"
+#include "fsmonitor.h"
+#include "sparse-index.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 					       unsigned int options);
@@ -40,11 +43,27 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce,
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
 #define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
 #define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+
+/* size of the EOIE extension, with and without its header */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+#define IEOT_VERSION 1
+
+/*
+ * Index entries are only worth loading in parallel in blocks of at
+ * least this many entries.
+ */
+#define THREAD_COST (10000)
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
 		 CE_ENTRY_ADDED | CE_ENTRY_REMOVED | CE_ENTRY_CHANGED | \
-		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED)
+		 SPLIT_INDEX_ORDERED | UNTRACKED_CHANGED | FSMONITOR_CHANGED)
 
 struct index_state the_index;
 static const char *alternate_index_output;
@@ -154,6 +173,9 @@ void fill_stat_cache_info(struct cache_entry *ce, struct stat *st)
 
 	if (S_ISREG(st->st_mode))
 		ce_mark_uptodate(ce);
+
+	/* we just looked at it; until the monitor says otherwise */
+	ce->ce_flags |= CE_FSMONITOR_VALID;
 }
 
 static int ce_compare_data(const struct cache_entry *ce, struct stat *st)
@@ -321,6 +343,8 @@ int ie_match_stat(const struct index_state *istate,
 		return 0;
 	if (!ignore_valid && (ce->ce_flags & CE_VALID))
 		return 0;
+	if (!ignore_valid && fsmonitor_trusts(istate, ce))
+		return 0;
 
 	/*
 	 * Intent-to-add entries have not been added, so the index entry
@@ -1098,6 +1122,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	if (!ignore_valid && fsmonitor_trusts(istate, ce)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (has_symlink_leading_path(ce->name, ce_namelen(ce))) {
 		if (ignore_missing)
@@ -1135,8 +1163,10 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1202,6 +1232,7 @@ int refresh_index(struct index_state *istate, unsigned int flags,
 	typechange_fmt = (in_porcelain ? "T\t%s\n" : "%s needs update\n");
 	added_fmt = (in_porcelain ? "A\t%s\n" : "%s needs update\n");
 	unmerged_fmt = (in_porcelain ? "U\t%s\n" : "%s: needs merge\n");
+	refresh_fsmonitor(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new;
 		int cache_errno = 0;
@@ -1395,6 +1426,18 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_UNTRACKED:
 		istate->untracked = read_untracked_extension(data, sz);
 		break;
+	case CACHE_EXT_FSMONITOR:
+		/* only an optimization; start over if it is unusable */
+		if (read_fsmonitor_extension(istate, data, sz))
+			istate->fsmonitor_last_update = 0;
+		break;
+	case CACHE_EXT_SPARSE_DIRECTORIES:
+		istate->sparse_index = 1;
+		break;
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+		/* already handled in do_read_index() */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1451,14 +1494,23 @@ static struct cache_entry *cache_entry_from_ondisk(struct ondisk_cache_entry *on
  * number of bytes to be stripped from the end of the previous name,
  * and the bytes to append to the result, to come up with its name.
  */
-static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       int block_start)
 {
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
+	/*
+	 * The first entry of a block in the offset table strips all of
+	 * the previous name, which a reader starting at the block does
+	 * not know.
+	 */
+	if (block_start)
+		strbuf_reset(name);
+	else if (name->len < len)
 		die("malformed name field in the index");
-	strbuf_remove(name, name->len - len, len);
+	else
+		strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
 	strbuf_add(name, cp, ep - cp);
@@ -1467,7 +1519,8 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 
 static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 					    unsigned long *ent_size,
-					    struct strbuf *previous_name)
+					    struct strbuf *previous_name,
+					    int block_start)
 {
 	struct cache_entry *ce;
 	size_t len;
@@ -1501,7 +1554,7 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 		*ent_size = ondisk_ce_size(ce);
 	} else {
 		unsigned long consumed;
-		consumed = expand_name_field(previous_name, name);
+		consumed = expand_name_field(previous_name, name, block_start);
 		ce = cache_entry_from_ondisk(ondisk, flags,
 					     previous_name->buf,
 					     previous_name->len);
@@ -1533,16 +1586,341 @@ static void check_ce_order(struct index_state *istate)
 	}
 }
 
+/*
+ * Number of threads to use for reading and writing the index, as set
+ * by "index.threads"; 0 means one per CPU.
+ */
+static int index_threads(void)
+{
+#ifdef NO_PTHREADS
+	return 1;
+#else
+	int is_bool, val;
+
+	if (git_config_get_bool_or_int("index.threads", &is_bool, &val))
+		return 0;
+	if (is_bool)
+		return val ? 0 : 1;
+	if (val < 0)
+		die(_("index.threads must be non-negative"));
+	return val;
+#endif
+}
+
+static int record_offset_table(void)
+{
+	int val;
+
+	if (git_config_get_bool("index.recordoffsettable", &val))
+		return 0;
+	return val;
+}
+
+struct index_entry_offset {
+	/* starting byte offset into the index file of the first entry */
+	uint32_t offset;
+	/* number of entries in the block */
+	uint32_t nr;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+/*
+ * The EOIE extension is always written last, right before the trailing
+ * checksum, so that it can be found without parsing the entries.  It
+ * records where the extensions start and a hash of their headers, which
+ * tells us that the offset is still valid.  Returns that offset, or 0
+ * if the index has no (usable) EOIE extension.
+ */
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie;
+	unsigned long offset, src_offset, end;
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	if (CACHE_EXT(eoie) != CACHE_EXT_ENDOFINDEXENTRIES ||
+	    get_be32(eoie + 4) != EOIE_SIZE)
+		return 0;
+	offset = get_be32(eoie + 8);
+	end = eoie - mmap;
+	if (offset < sizeof(struct cache_header) || offset > end)
+		return 0;
+
+	git_SHA1_Init(&c);
+	for (src_offset = offset; src_offset < end; ) {
+		uint32_t extsize;
+
+		if (end - src_offset < 8)
+			return 0;
+		extsize = get_be32(mmap + src_offset + 4);
+		if (end - src_offset - 8 < extsize)
+			return 0;
+		git_SHA1_Update(&c, mmap + src_offset, 8);
+		src_offset += 8 + extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)eoie + 12))
+		return 0;
+	return offset;
+}
+
+/*
+ * Find and parse the IEOT extension among those starting at "offset".
+ * A table that does not describe all "nr" entries is ignored.
+ */
+static struct index_entry_offset_table *read_ieot_extension(const char *mmap,
+							    size_t mmap_size,
+							    unsigned long offset,
+							    unsigned int nr)
+{
+	struct index_entry_offset_table *ieot;
+	const char *index = NULL;
+	uint32_t extsize = 0, total = 0, prev = 0;
+	int i, blocks;
+
+	while (offset <= mmap_size - 20 - 8) {
+		const char *ext = mmap + offset;
+
+		extsize = get_be32(ext + 4);
+		if (CACHE_EXT(ext) == CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			index = ext + 8;
+			break;
+		}
+		offset += 8;
+		offset += extsize;
+	}
+	if (!index || extsize < 4 || (extsize - 4) % 8 ||
+	    mmap_size - 20 - (index - mmap) < extsize)
+		return NULL;
+	if (get_be32(index) != IEOT_VERSION)
+		return NULL;
+	index += 4;
+
+	blocks = (extsize - 4) / 8;
+	if (!blocks)
+		return NULL;
+	ieot = xmalloc(sizeof(*ieot) + blocks * sizeof(struct index_entry_offset));
+	ieot->nr = blocks;
+	for (i = 0; i < blocks; i++) {
+		struct index_entry_offset *e = &ieot->entries[i];
+
+		e->offset = get_be32(index);
+		e->nr = get_be32(index + 4);
+		index += 8;
+		if (e->offset < sizeof(struct cache_header) || e->offset <= prev ||
+		    e->offset >= mmap_size - 20 || nr - total < e->nr)
+			break;
+		prev = e->offset;
+		total += e->nr;
+	}
+	if (i < blocks || total != nr) {
+		free(ieot);
+		return NULL;
+	}
+	return ieot;
+}
+
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
+{
+	uint32_t buffer;
+	int i;
+
+	buffer = htonl(IEOT_VERSION);
+	strbuf_add(sb, &buffer, sizeof(buffer));
+	for (i = 0; i < ieot->nr; i++) {
+		buffer = htonl(ieot->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(buffer));
+		buffer = htonl(ieot->entries[i].nr);
+		strbuf_add(sb, &buffer, sizeof(buffer));
+	}
+}
+
+static void write_eoie_extension(struct strbuf *sb, git_SHA_CTX *eoie_context,
+				 unsigned long offset)
+{
+	uint32_t buffer;
+	unsigned char sha1[20];
+
+	buffer = htonl(offset);
+	strbuf_add(sb, &buffer, sizeof(buffer));
+	git_SHA1_Final(sha1, eoie_context);
+	strbuf_add(sb, sha1, sizeof(sha1));
+}
+
+static int read_index_extensions(struct index_state *istate,
+				 const char *mmap, size_t mmap_size,
+				 unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		/* After an array of active_nr index entries,
+		 * there can be arbitrary number of extended
+		 * sections, each of which is prefixed with
+		 * extension name (4-byte) and section length
+		 * in 4-byte network byte order.
+		 */
+		uint32_t extsize;
+		memcpy(&extsize, mmap + src_offset + 4, 4);
+		extsize = ntohl(extsize);
+		if (read_index_extension(istate,
+					 mmap + src_offset,
+					 (char *) mmap + src_offset + 8,
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+/*
+ * Decode "nr" entries starting at byte "src_offset" of the mapped
+ * index into istate->cache[first...]; "block_start" says whether that
+ * is the start of a block in the offset table.  Returns the number of
+ * bytes consumed.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset,
+					    int first, int nr,
+					    struct strbuf *previous_name,
+					    int block_start)
+{
+	unsigned long start_offset = src_offset;
+	int i;
+
+	for (i = first; i < first + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + src_offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name,
+				      block_start && i == first);
+		set_index_entry(istate, i, ce);
+
+		src_offset += consumed;
+	}
+	return src_offset - start_offset;
+}
+
+static unsigned long load_all_cache_entries(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long src_offset)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	unsigned long consumed;
+
+	previous_name = (istate->version == 4) ? &previous_name_buf : NULL;
+	consumed = load_cache_entry_block(istate, mmap, src_offset,
+					  0, istate->cache_nr, previous_name, 0);
+	strbuf_release(&previous_name_buf);
+	return consumed;
+}
+
+#ifndef NO_PTHREADS
+struct load_index_extensions {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long src_offset;
+	int ret;
+};
+
+static void *load_index_extensions_thread(void *_data)
+{
+	struct load_index_extensions *p = _data;
+
+	p->ret = read_index_extensions(p->istate, p->mmap, p->mmap_size,
+				       p->src_offset);
+	return NULL;
+}
+
+struct load_cache_entries_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int ieot_start;		/* first block to load */
+	int ieot_blocks;	/* number of blocks to load */
+	int first;		/* position of the first entry in the cache */
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_cache_entries_thread_data *p = _data;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int i, first = p->first;
+
+	previous_name = (p->istate->version == 4) ? &previous_name_buf : NULL;
+	for (i = p->ieot_start; i < p->ieot_start + p->ieot_blocks; i++) {
+		struct index_entry_offset *e = &p->ieot->entries[i];
+
+		load_cache_entry_block(p->istate, p->mmap, e->offset,
+				       first, e->nr, previous_name, 1);
+		first += e->nr;
+	}
+	strbuf_release(&previous_name_buf);
+	return NULL;
+}
+
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap, int nr_threads,
+					struct index_entry_offset_table *ieot)
+{
+	struct load_cache_entries_thread_data *data;
+	int i, j, first = 0;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	data = xcalloc(nr_threads, sizeof(*data));
+
+	for (i = 0; i < nr_threads; i++) {
+		struct load_cache_entries_thread_data *p = &data[i];
+		int end = (i + 1) * ieot->nr / nr_threads;
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->ieot_start = i * ieot->nr / nr_threads;
+		p->ieot_blocks = end - p->ieot_start;
+		p->first = first;
+		for (j = p->ieot_start; j < end; j++)
+			first += ieot->entries[j].nr;
+
+		if (pthread_create(&p->pthread, NULL,
+				   load_cache_entries_thread, p))
+			die("unable to create load_cache_entries thread");
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join load_cache_entries thread");
+	free(data);
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int do_read_index(struct index_state *istate, const char *path, int must_exist)
 {
-	int fd, i;
+	int fd, nr_threads;
 	struct stat st;
 	unsigned long src_offset;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+#ifndef NO_PTHREADS
+	struct load_index_extensions p;
+	unsigned long extension_offset = 0;
+	struct index_entry_offset_table *ieot = NULL;
+#endif
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1579,45 +1957,49 @@ int do_read_index(struct index_state *istate, const char *path, int must_exist)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
-
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
 
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
+	nr_threads = index_threads();
+	if (!nr_threads)
+		nr_threads = online_cpus();
+
+#ifndef NO_PTHREADS
+	if (nr_threads > 1)
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (extension_offset) {
+		/* load the extensions while the entries are being decoded */
+		p.istate = istate;
+		p.mmap = mmap;
+		p.mmap_size = mmap_size;
+		p.src_offset = extension_offset;
+		if (pthread_create(&p.pthread, NULL,
+				   load_index_extensions_thread, &p))
+			die("unable to create load_index_extensions thread");
+		nr_threads--;
+	}
+	if (extension_offset && nr_threads > 1)
+		ieot = read_ieot_extension(mmap, mmap_size, extension_offset,
+					   istate->cache_nr);
+	if (ieot) {
+		load_cache_entries_threaded(istate, mmap, nr_threads, ieot);
+		free(ieot);
+	} else
+#endif
+		src_offset += load_all_cache_entries(istate, mmap, src_offset);
 
-		src_offset += consumed;
-	}
-	strbuf_release(&previous_name_buf);
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
+#ifndef NO_PTHREADS
+	if (extension_offset) {
+		if (pthread_join(p.pthread, NULL))
+			die("unable to join load_index_extensions thread");
+		if (p.ret)
 			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
-	}
+	} else
+#endif
+	if (read_index_extensions(istate, mmap, mmap_size, src_offset) < 0)
+		goto unmap;
 	munmap(mmap, mmap_size);
 	return istate->cache_nr;
 
@@ -1639,6 +2021,9 @@ int read_index_from(struct index_state *istate, const char *path)
 	split_index = istate->split_index;
 	if (!split_index || is_null_sha1(split_index->base_sha1)) {
 		check_ce_order(istate);
+		tweak_fsmonitor(istate);
+		if (command_requires_full_index)
+			ensure_full_index(istate);
 		return ret;
 	}
 
@@ -1657,9 +2042,313 @@ int read_index_from(struct index_state *istate, const char *path)
 		    sha1_to_hex(split_index->base->sha1));
 	merge_base_index(istate);
 	check_ce_order(istate);
+	tweak_fsmonitor(istate);
 	return ret;
 }
 
+static struct ondisk_cache_entry *view_ondisk(const struct index_view *view,
+					      int pos)
+{
+	return (struct ondisk_cache_entry *)((char *)view->mmap + view->offset[pos]);
+}
+
+static const char *ondisk_name(struct ondisk_cache_entry *ondisk,
+			       unsigned int flags, size_t *len)
+{
+	const char *name;
+
+	if (flags & CE_EXTENDED)
+		name = ((struct ondisk_cache_entry_extended *)ondisk)->name;
+	else
+		name = ondisk->name;
+	*len = flags & CE_NAMEMASK;
+	if (*len == CE_NAMEMASK)
+		*len = strlen(name);
+	return name;
+}
+
+struct index_view_dir {
+	struct hashmap_entry ent;
+	uint32_t id, parent;
+	unsigned int len;
+	char name[FLEX_ARRAY];
+};
+
+static int view_dir_cmp(const struct index_view_dir *a,
+			const struct index_view_dir *b, const char *name)
+{
+	return a->parent != b->parent || a->len != b->len ||
+		memcmp(a->name, name ? name : b->name, a->len);
+}
+
+/* Directory ids start at 1; 0 is the top level */
+static uint32_t view_dir_id(struct index_view *view, uint32_t parent,
+			    const char *name, unsigned int len)
+{
+	struct index_view_dir key, *dir;
+
+	hashmap_entry_init(&key, memhash(name, len) ^ (parent * 2654435761u));
+	key.parent = parent;
+	key.len = len;
+	dir = hashmap_get(&view->dir_hash, &key, name);
+	if (dir)
+		return dir->id;
+
+	dir = xmalloc(sizeof(*dir) + len + 1);
+	hashmap_entry_init(dir, key.ent.hash);
+	dir->parent = parent;
+	dir->len = len;
+	memcpy(dir->name, name, len);
+	dir->name[len] = '\0';
+	ALLOC_GROW(view->dir, view->dir_nr + 1, view->dir_alloc);
+	dir->id = view->dir_nr;
+	view->dir[view->dir_nr++] = dir;
+	hashmap_add(&view->dir_hash, dir);
+	return dir->id;
+}
+
+/*
+ * Record the name of entry "pos" as its directory and basename.  Runs
+ * of entries in the same directory only look their directory up once.
+ */
+static void view_add_name(struct index_view *view, unsigned int pos,
+			  const char *name, size_t len,
+			  struct strbuf *last_dir, uint32_t *last_id)
+{
+	const char *slash = strrchr(name, '/');
+	size_t dirlen = slash ? slash - name + 1 : 0;
+
+	if (dirlen != last_dir->len || memcmp(name, last_dir->buf, dirlen)) {
+		const char *cp = name, *end = name + dirlen;
+		uint32_t id = 0;
+
+		while (cp < end) {
+			const char *sep = memchr(cp, '/', end - cp);
+			id = view_dir_id(view, id, cp, sep - cp);
+			cp = sep + 1;
+		}
+		strbuf_reset(last_dir);
+		strbuf_add(last_dir, name, dirlen);
+		*last_id = id;
+	}
+	view->name_dir[pos] = *last_id;
+	view->basename[pos] = view->basenames.len;
+	strbuf_add(&view->basenames, name + dirlen, len - dirlen);
+	strbuf_addch(&view->basenames, '\0');
+}
+
+static void view_dir_path(struct index_view *view, uint32_t id,
+			  struct strbuf *sb)
+{
+	struct index_view_dir *dir;
+
+	if (!id)
+		return;
+	dir = view->dir[id];
+	view_dir_path(view, dir->parent, sb);
+	strbuf_add(sb, dir->name, dir->len);
+	strbuf_addch(sb, '/');
+}
+
+static const char *view_v4_name(struct index_view *view, int pos,
+				size_t *len)
+{
+	uint32_t id = view->name_dir[pos];
+
+	if (id != view->name_dir_id) {
+		strbuf_reset(&view->name);
+		view_dir_path(view, id, &view->name);
+		view->name_dir_id = id;
+		view->name_dir_len = view->name.len;
+	}
+	strbuf_setlen(&view->name, view->name_dir_len);
+	strbuf_addstr(&view->name, view->basenames.buf + view->basename[pos]);
+	*len = view->name.len;
+	return view->name.buf;
+}
+
+int index_view_open(struct index_view *view, const char *path)
+{
+	struct strbuf previous_name = STRBUF_INIT, last_dir = STRBUF_INIT;
+	uint32_t last_id = 0;
+	struct cache_header *hdr;
+	unsigned long src_offset;
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	memset(view, 0, sizeof(*view));
+	strbuf_init(&view->basenames, 0);
+	strbuf_init(&view->name, 0);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		die_errno("%s: index file open failed", path);
+	}
+	if (fstat(fd, &st))
+		die_errno("cannot stat the open index");
+	view->mmap_size = xsize_t(st.st_size);
+	if (view->mmap_size < sizeof(struct cache_header) + 20)
+		die("index file smaller than expected");
+	view->mmap = xmmap(NULL, view->mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view->mmap == MAP_FAILED)
+		die_errno("unable to map index file");
+	close(fd);
+
+	hdr = view->mmap;
+	if (verify_hdr(hdr, view->mmap_size) < 0)
+		die("index file corrupt");
+	view->version = ntohl(hdr->hdr_version);
+	view->nr = ntohl(hdr->hdr_entries);
+
+	/* Entries are not fixed-size, so note where each one starts */
+	view->offset = xcalloc(view->nr, sizeof(*view->offset));
+	if (view->version == 4) {
+		view->name_dir = xcalloc(view->nr, sizeof(*view->name_dir));
+		view->basename = xcalloc(view->nr, sizeof(*view->basename));
+		hashmap_init(&view->dir_hash, (hashmap_cmp_fn)view_dir_cmp, 0);
+		ALLOC_GROW(view->dir, 1, view->dir_alloc);
+		view->dir[view->dir_nr++] = NULL;
+		view->name_dir_id = -1;
+	}
+	src_offset = sizeof(*hdr);
+	for (i = 0; i < view->nr; i++) {
+		struct ondisk_cache_entry *ondisk;
+		const char *name;
+		unsigned int flags;
+		size_t len;
+
+		if (src_offset + sizeof(*ondisk) > view->mmap_size - 20)
+			die("index file corrupt");
+		view->offset[i] = src_offset;
+		ondisk = view_ondisk(view, i);
+		flags = get_be16(&ondisk->flags);
+		name = ondisk_name(ondisk, flags, &len);
+		if (view->version == 4) {
+			unsigned long consumed;
+
+			consumed = expand_name_field(&previous_name, name, 0);
+			view_add_name(view, i, previous_name.buf,
+				      previous_name.len, &last_dir, &last_id);
+			src_offset += (name - (char *)ondisk) + consumed;
+		} else if (flags & CE_EXTENDED)
+			src_offset += ondisk_cache_entry_extended_size(len);
+		else
+			src_offset += ondisk_cache_entry_size(len);
+	}
+
+	/* The split and sparse index need the full machinery */
+	while (src_offset <= view->mmap_size - 20 - 8) {
+		const char *ext = (char *)view->mmap + src_offset;
+		uint32_t extsize;
+
+		if (CACHE_EXT(ext) == CACHE_EXT_LINK ||
+		    CACHE_EXT(ext) == CACHE_EXT_SPARSE_DIRECTORIES)
+			goto unviewable;
+		memcpy(&extsize, ext + 4, 4);
+		src_offset += 8 + ntohl(extsize);
+	}
+	strbuf_release(&previous_name);
+	strbuf_release(&last_dir);
+	return 0;
+
+unviewable:
+	strbuf_release(&previous_name);
+	strbuf_release(&last_dir);
+	index_view_release(view);
+	return -1;
+}
+
+void index_view_release(struct index_view *view)
+{
+	if (view->mmap)
+		munmap(view->mmap, view->mmap_size);
+	free(view->offset);
+	free(view->ce);
+	hashmap_free(&view->dir_hash, 1);
+	free(view->dir);
+	free(view->name_dir);
+	free(view->basename);
+	strbuf_release(&view->basenames);
+	strbuf_release(&view->name);
+	memset(view, 0, sizeof(*view));
+}
+
+const char *index_view_name(struct index_view *view, int pos, int *namelen)
+{
+	struct ondisk_cache_entry *ondisk = view_ondisk(view, pos);
+	const char *name;
+	size_t len;
+
+	if (view->name_dir)
+		name = view_v4_name(view, pos, &len);
+	else
+		name = ondisk_name(ondisk, get_be16(&ondisk->flags), &len);
+	*namelen = len;
+	return name;
+}
+
+int index_view_stage(const struct index_view *view, int pos)
+{
+	return (get_be16(&view_ondisk(view, pos)->flags) & CE_STAGEMASK)
+		>> CE_STAGESHIFT;
+}
+
+int index_view_name_pos(struct index_view *view, const char *name,
+			int namelen)
+{
+	int first, last;
+
+	first = 0;
+	last = view->nr;
+	while (last > first) {
+		int next = (last + first) >> 1;
+		int len, cmp;
+		const char *ce_name = index_view_name(view, next, &len);
+
+		cmp = cache_name_stage_compare(name, namelen, 0, ce_name, len,
+					       index_view_stage(view, next));
+		if (!cmp)
+			return next;
+		if (cmp < 0) {
+			last = next;
+			continue;
+		}
+		first = next+1;
+	}
+	return -first-1;
+}
+
+const struct cache_entry *index_view_entry(struct index_view *view, int pos)
+{
+	struct ondisk_cache_entry *ondisk = view_ondisk(view, pos);
+	unsigned int flags = get_be16(&ondisk->flags);
+	struct cache_entry *ce;
+	const char *name;
+	size_t len;
+
+	if (flags & CE_EXTENDED) {
+		struct ondisk_cache_entry_extended *ondisk2;
+		int extended_flags;
+		ondisk2 = (struct ondisk_cache_entry_extended *)ondisk;
+		extended_flags = get_be16(&ondisk2->flags2) << 16;
+		if (extended_flags & ~CE_EXTENDED_FLAGS)
+			die("Unknown index entry format %08x", extended_flags);
+		flags |= extended_flags;
+	}
+	if (view->name_dir)
+		name = view_v4_name(view, pos, &len);
+	else
+		name = ondisk_name(ondisk, flags, &len);
+
+	/* Only one entry is kept decoded at a time */
+	ce = cache_entry_from_ondisk(ondisk, flags, name, len);
+	free(view->ce);
+	view->ce = ce;
+	return ce;
+}
+
 int is_index_unborn(struct index_state *istate)
 {
 	return (!istate->cache_nr && !istate->timestamp.sec);
@@ -1686,12 +2375,14 @@ int discard_index(struct index_state *istate)
 	free_name_hash(istate);
 	cache_tree_free(&(istate->cache_tree));
 	istate->initialized = 0;
+	istate->sparse_index = 0;
 	free(istate->cache);
 	istate->cache = NULL;
 	istate->cache_alloc = 0;
 	discard_split_index(istate);
 	free_untracked_cache(istate->untracked);
 	istate->untracked = NULL;
+	discard_fsmonitor(istate);
 	return 0;
 }
 
@@ -1743,11 +2434,16 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
@@ -1989,6 +2685,10 @@ static int do_write_index(struct index_state *istate, int newfd,
 	int entries = istate->cache_nr;
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	git_SHA_CTX eoie_context, *eoie_c = NULL;
+	struct index_entry_offset_table *ieot = NULL;
+	int ieot_entries = 0, nr = 0;
+	off_t offset;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2022,11 +2722,57 @@ static int do_write_index(struct index_state *istate, int newfd,
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
+	if (record_offset_table()) {
+		int ieot_blocks = index_threads();
+
+		/*
+		 * One block per thread that will decode them, leaving one
+		 * CPU for loading the extensions.
+		 */
+		if (!ieot_blocks) {
+			ieot_blocks = (entries - removed) / THREAD_COST;
+			if (ieot_blocks > online_cpus() - 1)
+				ieot_blocks = online_cpus() - 1;
+		}
+		if (ieot_blocks > 1 && entries - removed >= ieot_blocks) {
+			ieot = xcalloc(1, sizeof(*ieot) + ieot_blocks *
+				       sizeof(struct index_entry_offset));
+			ieot_entries = DIV_ROUND_UP(entries - removed,
+						    ieot_blocks);
+		}
+		git_SHA1_Init(&eoie_context);
+		eoie_c = &eoie_context;
+	}
+
+	offset = lseek(newfd, 0, SEEK_CUR);
+	if (offset < 0)
+		return -1;
+	offset += write_buffer_len;
+
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (ieot && nr == ieot_entries) {
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->entries[ieot->nr].nr = nr;
+			ieot->nr++;
+			nr = 0;
+
+			offset = lseek(newfd, 0, SEEK_CUR);
+			if (offset < 0) {
+				free(ieot);
+				return -1;
+			}
+			offset += write_buffer_len;
+			/*
+			 * Make the next entry share nothing with the previous
+			 * one, so that a reader can start at it.
+			 */
+			if (previous_name && previous_name->len)
+				previous_name->buf[0] = '\0';
+		}
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_sha1(ce->sha1)) {
@@ -2037,20 +2783,56 @@ static int do_write_index(struct index_state *istate, int newfd,
 				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
 			if (allow)
 				warning(msg, ce->name);
-			else
+			else {
+				free(ieot);
 				return error(msg, ce->name);
+			}
 		}
-		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
+		if (ce_write_entry(&c, newfd, ce, previous_name) < 0) {
+			free(ieot);
 			return -1;
+		}
+		nr++;
 	}
 	strbuf_release(&previous_name_buf);
+	if (ieot && nr) {
+		ieot->entries[ieot->nr].offset = offset;
+		ieot->entries[ieot->nr].nr = nr;
+		ieot->nr++;
+	}
+
+	offset = lseek(newfd, 0, SEEK_CUR);
+	if (offset < 0) {
+		free(ieot);
+		return -1;
+	}
+	offset += write_buffer_len;
+	/* the offsets we record only cover the first 4GB */
+	if ((uint32_t)offset != offset) {
+		free(ieot);
+		ieot = NULL;
+		eoie_c = NULL;
+	}
 
 	/* Write extension data here */
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		free(ieot);
+		if (err)
+			return -1;
+	}
 	if (!strip_extensions && istate->split_index) {
 		struct strbuf sb = STRBUF_INIT;
 
 		err = write_link_extension(&sb, istate) < 0 ||
-			write_index_ext_header(&c, newfd, CACHE_EXT_LINK,
+			write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_LINK,
 					       sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2061,7 +2843,8 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_TREE,
+					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -2071,7 +2854,7 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_RESOLVE_UNDO,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2082,7 +2865,39 @@ static int do_write_index(struct index_state *istate, int newfd,
 		struct strbuf sb = STRBUF_INIT;
 
 		write_untracked_extension(&sb, istate->untracked);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED,
+		err = write_index_ext_header(&c, eoie_c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->sparse_index) {
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_SPARSE_DIRECTORIES,
+					     0) < 0;
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->fsmonitor_last_update &&
+	    istate->fsmonitor_dirty) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, eoie_c, newfd,
+					     CACHE_EXT_FSMONITOR,
+					     sb.len) < 0 ||
+			ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (eoie_c) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_eoie_extension(&sb, eoie_c, offset);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
 					     sb.len) < 0 ||
 			ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -2113,7 +2928,14 @@ static int commit_locked_index(struct lock_file *lk)
 static int do_write_locked_index(struct index_state *istate, struct lock_file *lock,
 				 unsigned flags)
 {
-	int ret = do_write_index(istate, lock->fd, 0);
+	struct index_state sparse;
+	int ret;
+
+	if (!convert_to_sparse(istate, &sparse)) {
+		ret = do_write_index(&sparse, lock->fd, 0);
+		finish_sparse_write(istate, &sparse);
+	} else
+		ret = do_write_index(istate, lock->fd, 0);
 	if (ret)
 		return ret;
 	assert((flags & (COMMIT_LOCK | CLOSE_LOCK)) !=
@@ -2190,10 +3012,98 @@ static int write_shared_index(struct index_state *istate,
 	return ret;
 }
 
+static const int default_max_percent_split_change = 20;
+
+/*
+ * Has so much changed since the shared index was written that it is
+ * time to write a new one?
+ */
+static int too_many_not_shared_entries(struct index_state *istate)
+{
+	int i, not_shared = 0;
+	int max_split;
+
+	if (git_config_get_int("splitindex.maxpercentchange", &max_split))
+		max_split = default_max_percent_split_change;
+	else if (max_split < 0 || 100 < max_split) {
+		warning(_("splitIndex.maxPercentChange value '%d' "
+			  "should be between 0 and 100"), max_split);
+		max_split = default_max_percent_split_change;
+	}
+	if (!max_split)
+		return 1;
+	if (max_split == 100)
+		return 0;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!istate->cache[i]->index)
+			not_shared++;
+	return (int64_t)istate->cache_nr * max_split < (int64_t)not_shared * 100;
+}
+
+static unsigned long shared_index_expire_date(void)
+{
+	static unsigned long expire_date;
+	static int prepared;
+
+	if (!prepared) {
+		const char *expire = "2.weeks.ago";
+
+		git_config_get_string_const("splitindex.sharedindexexpire",
+					    &expire);
+		expire_date = approxidate(expire);
+		prepared = 1;
+	}
+	return expire_date;
+}
+
+/*
+ * Every split index written refreshes the mtime of its shared index,
+ * so that an old mtime means no index below $GIT_DIR has used it for
+ * a while.
+ */
+static void freshen_shared_index(const char *path)
+{
+	if (utime(path, NULL))
+		warning(_("could not freshen shared index '%s'"), path);
+}
+
+static void clean_shared_index_files(const char *current_hex)
+{
+	unsigned long expire_date = shared_index_expire_date();
+	struct dirent *de;
+	DIR *dir;
+
+	if (!expire_date)
+		return;
+	dir = opendir(get_git_dir());
+	if (!dir) {
+		warning(_("unable to open git dir: %s"), get_git_dir());
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		const char *hex, *path;
+		struct stat st;
+
+		if (!skip_prefix(de->d_name, "sharedindex.", &hex) ||
+		    !strcmp(hex, current_hex))
+			continue;
+		path = git_path("%s", de->d_name);
+		if (stat(path, &st) || st.st_mtime > expire_date)
+			continue;
+		if (unlink(path))
+			warning(_("unable to unlink: %s"), path);
+	}
+	closedir(dir);
+}
+
 int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		       unsigned flags)
 {
 	struct split_index *si = istate->split_index;
+	int new_shared_index, ret;
+
+	fill_fsmonitor_bitmap(istate);
 
 	if (!si || alternate_index_output ||
 	    (istate->cache_changed & ~EXTMASK)) {
@@ -2207,13 +3117,25 @@ int write_locked_index(struct index_state *istate, struct lock_file *lock,
 		if ((v & 15) < 6)
 			istate->cache_changed |= SPLIT_INDEX_ORDERED;
 	}
-	if (istate->cache_changed & SPLIT_INDEX_ORDERED) {
-		int ret = write_shared_index(istate, lock, flags);
+	if (too_many_not_shared_entries(istate))
+		istate->cache_changed |= SPLIT_INDEX_ORDERED;
+
+	new_shared_index = istate->cache_changed & SPLIT_INDEX_ORDERED;
+	if (new_shared_index) {
+		ret = write_shared_index(istate, lock, flags);
 		if (ret)
 			return ret;
 	}
 
-	return write_split_index(istate, lock, flags);
+	ret = write_split_index(istate, lock, flags);
+	if (ret || is_null_sha1(si->base_sha1))
+		return ret;
+	if (new_shared_index)
+		clean_shared_index_files(sha1_to_hex(si->base_sha1));
+	else
+		freshen_shared_index(git_path("sharedindex.%s",
+					      sha1_to_hex(si->base_sha1)));
+	return 0;
 }
 
 /*
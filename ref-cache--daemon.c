@@ -0,0 +1,141 @@
+#include "cache.h"
+#include "unix-socket.h"
+#include "sigchain.h"
+#include "parse-options.h"
+#include "ref-snapshot.h"
+
+/*
+ * Keep a snapshot of the refs of the repository in memory and hand it
+ * out to the clients connecting to the socket, so that they do not
+ * have to read all refs themselves.  The snapshot is checked against
+ * the stat data of the files it was read from for every request, and
+ * rebuilt if any of them changed.
+ *
+ * A client sends a single line with the action, "get" or "exit", and
+ * reads the snapshot (in the format of $GIT_DIR/ref-snapshot) in
+ * response to "get".
+ */
+
+static const char *socket_path;
+static struct strbuf snapshot = STRBUF_INIT;
+
+static void cleanup_socket(void)
+{
+	if (socket_path)
+		unlink(socket_path);
+}
+
+static void cleanup_socket_on_signal(int sig)
+{
+	cleanup_socket();
+	sigchain_pop(sig);
+	raise(sig);
+}
+
+static void serve_one_client(int fd)
+{
+	struct strbuf action = STRBUF_INIT;
+	FILE *in = xfdopen(dup(fd), "r");
+
+	if (strbuf_getline(&action, in, '\n'))
+		; /* ignore error */
+	else if (!strcmp(action.buf, "get")) {
+		refresh_ref_snapshot(&snapshot);
+		write_in_full(fd, snapshot.buf, snapshot.len);
+	}
+	else if (!strcmp(action.buf, "exit"))
+		exit(0);
+	else
+		warning("ref-cache client sent unknown action: %s", action.buf);
+
+	fclose(in);
+	strbuf_release(&action);
+}
+
+static int serve_cache_loop(int fd, int timeout)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, 1000 * timeout);
+	if (r < 0) {
+		if (errno != EINTR)
+			die_errno("poll failed");
+		return 1;
+	}
+	if (!r)
+		return 0; /* nobody asked for a while */
+
+	if (pfd.revents & POLLIN) {
+		int client = accept(fd, NULL, NULL);
+
+		if (client < 0) {
+			warning("accept failed: %s", strerror(errno));
+			return 1;
+		}
+		serve_one_client(client);
+		close(client);
+	}
+	return 1;
+}
+
+static void serve_cache(const char *socket_path, int timeout, int debug)
+{
+	int fd;
+
+	if (safe_create_leading_directories_const(socket_path) < 0)
+		die_errno("unable to create directories for '%s'", socket_path);
+	fd = unix_stream_listen(socket_path);
+	if (fd < 0)
+		die_errno("unable to bind to '%s'", socket_path);
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!debug) {
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+	}
+
+	while (serve_cache_loop(fd, timeout))
+		; /* nothing */
+
+	close(fd);
+	unlink(socket_path);
+}
+
+int main(int argc, const char **argv)
+{
+	static const char *usage[] = {
+		"git-ref-cache--daemon [opts] <socket_path>",
+		NULL
+	};
+	int debug = 0;
+	int timeout = 600;
+	const struct option options[] = {
+		OPT_INTEGER(0, "timeout", &timeout,
+			    N_("exit after this many seconds without a request")),
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	socket_path = argv[0];
+
+	if (!socket_path)
+		usage_with_options(usage, options);
+
+	atexit(cleanup_socket);
+	sigchain_push_common(cleanup_socket_on_signal);
+	/* a client going away must not take us down */
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	serve_cache(socket_path, timeout, debug);
+
+	return 0;
+}
@@ -0,0 +1,411 @@
+#include "cache.h"
+#include "dir.h"
+#include "refs.h"
+#include "lockfile.h"
+#include "run-command.h"
+#include "unix-socket.h"
+#include "ref-snapshot.h"
+
+/*
+ * The file starts with a header line with the time the snapshot was
+ * started, followed by one line for every file and directory the refs
+ * were read from:
+ *
+ *   # ref-snapshot v1 <time>
+ *   stat <ctime> <ctime-nsec> <mtime> <mtime-nsec> <dev> <ino> <uid> <gid> <size> <path>
+ *   missing <path>
+ *
+ * with paths relative to $GIT_DIR, and then by the refs in order, as in
+ * packed-refs, except that symbolic refs also name the ref they point
+ * to:
+ *
+ *   <sha1> <refname>[ <symref-target>]
+ *   ^<peeled-sha1>
+ *
+ * A file or directory that was modified during the second the snapshot
+ * was started in may have changed again without a visible change in
+ * its stat data, so a snapshot that recorded one is never used.
+ */
+
+#define REF_SNAPSHOT_HEADER "# ref-snapshot v1 "
+
+struct ref_snapshot_entry {
+	const char *name;
+	const char *symref_target;
+	struct object_id oid;
+	struct object_id peeled;
+	int has_peeled;
+};
+
+struct ref_snapshot {
+	struct strbuf buf;
+	int nr, alloc;
+	struct ref_snapshot_entry *entries;
+};
+
+static void add_path_stat(struct strbuf *out, const char *path);
+
+static void add_dir_stats(struct strbuf *out, const char *dirname)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir = opendir(git_path("%s", dirname));
+	size_t len;
+
+	if (!dir)
+		return;
+	strbuf_addf(&path, "%s/", dirname);
+	len = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_setlen(&path, len);
+		strbuf_addstr(&path, de->d_name);
+		add_path_stat(out, path.buf);
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+static void add_path_stat(struct strbuf *out, const char *path)
+{
+	struct stat st;
+	struct stat_data sd;
+
+	if (lstat(git_path("%s", path), &st)) {
+		strbuf_addf(out, "missing %s\n", path);
+		return;
+	}
+	fill_stat_data(&sd, &st);
+	strbuf_addf(out, "stat %u %u %u %u %u %u %u %u %u %s\n",
+		    sd.sd_ctime.sec, sd.sd_ctime.nsec,
+		    sd.sd_mtime.sec, sd.sd_mtime.nsec,
+		    sd.sd_dev, sd.sd_ino, sd.sd_uid, sd.sd_gid, sd.sd_size,
+		    path);
+	if (S_ISDIR(st.st_mode))
+		add_dir_stats(out, path);
+}
+
+static int add_ref_line(const char *refname, const struct object_id *oid,
+			int flag, void *cb_data)
+{
+	struct strbuf *out = cb_data;
+	unsigned char peeled[20];
+
+	strbuf_addf(out, "%s %s", oid_to_hex(oid), refname);
+	if (flag & REF_ISSYMREF) {
+		unsigned char unused[20];
+		const char *target = resolve_ref_unsafe(refname, 0, unused, NULL);
+
+		if (target)
+			strbuf_addf(out, " %s", target);
+	}
+	strbuf_addch(out, '\n');
+	if (!peel_ref(refname, peeled))
+		strbuf_addf(out, "^%s\n", sha1_to_hex(peeled));
+	return 0;
+}
+
+/*
+ * Write a snapshot of the refs to "out".  The stat data are recorded
+ * before the refs are read, so that a ref that changes in between
+ * makes the snapshot look out of date rather than up to date.
+ */
+static void build_ref_snapshot(struct strbuf *out)
+{
+	strbuf_addf(out, "%s%lu\n", REF_SNAPSHOT_HEADER,
+		    (unsigned long)time(NULL));
+	add_path_stat(out, "HEAD");
+	add_path_stat(out, repository_format_reftable ?
+		      "reftable/tables.list" : "packed-refs");
+	add_path_stat(out, "refs");
+
+	head_ref(add_ref_line, out);
+	for_each_ref(add_ref_line, out);
+}
+
+static int path_unchanged(const char *line, unsigned long timestamp,
+			  const char **path)
+{
+	struct stat_data sd;
+	struct stat st;
+	char *end;
+
+	if (skip_prefix(line, "missing ", path))
+		return lstat(git_path("%s", *path), &st) && errno == ENOENT;
+	if (!skip_prefix(line, "stat ", &line))
+		return 0;
+	sd.sd_ctime.sec = strtoul(line, &end, 10);
+	sd.sd_ctime.nsec = strtoul(end, &end, 10);
+	sd.sd_mtime.sec = strtoul(end, &end, 10);
+	sd.sd_mtime.nsec = strtoul(end, &end, 10);
+	sd.sd_dev = strtoul(end, &end, 10);
+	sd.sd_ino = strtoul(end, &end, 10);
+	sd.sd_uid = strtoul(end, &end, 10);
+	sd.sd_gid = strtoul(end, &end, 10);
+	sd.sd_size = strtoul(end, &end, 10);
+	if (*end != ' ')
+		return 0;
+	*path = end + 1;
+
+	if (sd.sd_mtime.sec >= timestamp)
+		return 0; /* racily clean */
+	return !lstat(git_path("%s", *path), &st) && !match_stat_data(&sd, &st);
+}
+
+/*
+ * Check that the files the snapshot in "buf" was read from are
+ * unchanged.
+ */
+static int ref_snapshot_is_current(const struct strbuf *buf)
+{
+	const char *p = buf->buf, *eof = buf->buf + buf->len;
+	struct strbuf line = STRBUF_INIT;
+	unsigned long timestamp;
+	const char *path;
+	char *end;
+	int ret = 0;
+
+	if (!buf->len || eof[-1] != '\n' ||
+	    !skip_prefix(p, REF_SNAPSHOT_HEADER, &p))
+		return 0;
+	timestamp = strtoul(p, &end, 10);
+	if (*end != '\n')
+		return 0;
+
+	for (p = end + 1; p < eof && !isxdigit(*p); p = strchr(p, '\n') + 1) {
+		strbuf_reset(&line);
+		strbuf_add(&line, p, strchr(p, '\n') - p);
+		if (!path_unchanged(line.buf, timestamp, &path))
+			goto out;
+	}
+	ret = 1;
+out:
+	strbuf_release(&line);
+	return ret;
+}
+
+/*
+ * Parse the snapshot in snapshot->buf.  Returns -1 if it is malformed.
+ */
+static int parse_ref_snapshot(struct ref_snapshot *snapshot)
+{
+	char *p = snapshot->buf.buf;
+	char *eof = p + snapshot->buf.len;
+
+	if (!snapshot->buf.len || eof[-1] != '\n' ||
+	    !skip_prefix(p, REF_SNAPSHOT_HEADER, (const char **)&p))
+		return -1;
+	strtoul(p, &p, 10);
+	if (*p++ != '\n')
+		return -1;
+
+	/* skip the stat data */
+	while (p < eof && !isxdigit(*p))
+		p = strchr(p, '\n') + 1;
+
+	while (p < eof) {
+		char *eol = strchr(p, '\n');
+		struct ref_snapshot_entry *entry;
+		char *target;
+
+		*eol = '\0';
+		if (*p == '^') {
+			if (!snapshot->nr)
+				return -1;
+			entry = &snapshot->entries[snapshot->nr - 1];
+			if (get_oid_hex(p + 1, &entry->peeled))
+				return -1;
+			entry->has_peeled = 1;
+			p = eol + 1;
+			continue;
+		}
+		ALLOC_GROW(snapshot->entries, snapshot->nr + 1, snapshot->alloc);
+		entry = &snapshot->entries[snapshot->nr++];
+		if (get_oid_hex(p, &entry->oid) || p[GIT_SHA1_HEXSZ] != ' ')
+			return -1;
+		entry->name = p + GIT_SHA1_HEXSZ + 1;
+		target = strchr(entry->name, ' ');
+		if (target)
+			*target++ = '\0';
+		entry->symref_target = target;
+		entry->has_peeled = 0;
+		p = eol + 1;
+	}
+	return 0;
+}
+
+static void clear_ref_snapshot(struct ref_snapshot *snapshot)
+{
+	strbuf_reset(&snapshot->buf);
+	snapshot->nr = 0;
+}
+
+void refresh_ref_snapshot(struct strbuf *buf)
+{
+	if (ref_snapshot_is_current(buf))
+		return;
+	invalidate_ref_cache();
+	strbuf_reset(buf);
+	build_ref_snapshot(buf);
+}
+
+#ifndef NO_UNIX_SOCKETS
+static int request_ref_snapshot(const char *socket, struct strbuf *buf)
+{
+	int fd = unix_stream_connect(socket);
+
+	if (fd < 0)
+		return -1;
+	if (write_in_full(fd, "get\n", 4) != 4 ||
+	    shutdown(fd, SHUT_WR) ||
+	    strbuf_read(buf, fd, 0) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static int spawn_ref_cache_daemon(const char *socket)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	const char *argv[] = { "ref-cache--daemon", NULL, NULL };
+	char buf[3];
+	int r;
+
+	argv[1] = socket;
+	daemon.argv = argv;
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		return -1;
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	close(daemon.out);
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return -1;
+	return 0;
+}
+
+/*
+ * Get the snapshot from the ref-cache daemon of this repository,
+ * starting one if there is none.
+ */
+static int read_ref_snapshot_from_daemon(struct strbuf *buf)
+{
+	char *socket = xstrdup(absolute_path(git_path("ref-cache/socket")));
+	int ret = request_ref_snapshot(socket, buf);
+
+	if (ret && (errno == ENOENT || errno == ECONNREFUSED) &&
+	    !spawn_ref_cache_daemon(socket))
+		ret = request_ref_snapshot(socket, buf);
+	free(socket);
+	return ret;
+}
+#else
+static int read_ref_snapshot_from_daemon(struct strbuf *buf)
+{
+	return -1;
+}
+#endif
+
+struct ref_snapshot *get_ref_snapshot(void)
+{
+	static struct ref_snapshot *snapshot;
+	static struct lock_file lock;
+	char *filename;
+	int use_daemon = 0;
+
+	if (snapshot)
+		return snapshot;
+	snapshot = xcalloc(1, sizeof(*snapshot));
+	strbuf_init(&snapshot->buf, 0);
+
+	/* the daemon checks that the snapshot is up to date itself */
+	git_config_get_bool("transfer.refsnapshotdaemon", &use_daemon);
+	if (use_daemon &&
+	    !read_ref_snapshot_from_daemon(&snapshot->buf) &&
+	    !parse_ref_snapshot(snapshot))
+		return snapshot;
+	clear_ref_snapshot(snapshot);
+
+	filename = git_pathdup("ref-snapshot");
+	if (strbuf_read_file(&snapshot->buf, filename, 0) >= 0 &&
+	    ref_snapshot_is_current(&snapshot->buf) &&
+	    !parse_ref_snapshot(snapshot)) {
+		free(filename);
+		return snapshot;
+	}
+
+	clear_ref_snapshot(snapshot);
+	build_ref_snapshot(&snapshot->buf);
+
+	/*
+	 * Another process may be writing a snapshot, or the repository
+	 * may not be writable by us; serve this one from memory then.
+	 */
+	if (hold_lock_file_for_update(&lock, filename, 0) >= 0) {
+		if (write_in_full(lock.fd, snapshot->buf.buf,
+				  snapshot->buf.len) != snapshot->buf.len ||
+		    commit_lock_file(&lock))
+			rollback_lock_file(&lock);
+	}
+	free(filename);
+
+	if (parse_ref_snapshot(snapshot))
+		die("BUG: cannot parse the ref snapshot we just built");
+	return snapshot;
+}
+
+static int call_ref_snapshot_fn(struct ref_snapshot_entry *entry,
+				ref_snapshot_fn fn, void *cb_data)
+{
+	return fn(entry->name, &entry->oid,
+		  entry->has_peeled ? &entry->peeled : NULL,
+		  entry->symref_target, cb_data);
+}
+
+int ref_snapshot_head(struct ref_snapshot *snapshot,
+		      ref_snapshot_fn fn, void *cb_data)
+{
+	struct strbuf head = STRBUF_INIT;
+	int lo = 0, hi = snapshot->nr, ret = 0;
+
+	strbuf_addf(&head, "%sHEAD", get_git_namespace());
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		int cmp = strcmp(head.buf, snapshot->entries[mi].name);
+
+		if (!cmp) {
+			ret = call_ref_snapshot_fn(&snapshot->entries[mi],
+						   fn, cb_data);
+			break;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	strbuf_release(&head);
+	return ret;
+}
+
+int ref_snapshot_for_each(struct ref_snapshot *snapshot, const char *prefix,
+			  ref_snapshot_fn fn, void *cb_data)
+{
+	int i, ret;
+
+	for (i = 0; i < snapshot->nr; i++) {
+		struct ref_snapshot_entry *entry = &snapshot->entries[i];
+
+		if (!starts_with(entry->name, "refs/") ||
+		    !starts_with(entry->name, prefix))
+			continue;
+		ret = call_ref_snapshot_fn(entry, fn, cb_data);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef REF_SNAPSHOT_H
+#define REF_SNAPSHOT_H
+
+/*
+ * With transfer.refSnapshot, upload-pack and receive-pack advertise the
+ * refs from $GIT_DIR/ref-snapshot, which holds every ref with the
+ * object it peels to, instead of reading and peeling every ref on every
+ * connection.  Along with the refs, the snapshot records the stat data
+ * of everything they were read from: HEAD, packed-refs (or the reftable
+ * stack) and every directory and loose ref under refs/.  Every ref
+ * update changes one of them, so a snapshot is only used while all of
+ * them are unchanged; otherwise it is rebuilt from the refs.
+ *
+ * With transfer.refSnapshotDaemon, the snapshot is kept in the memory
+ * of git-ref-cache--daemon instead, which is started on demand and
+ * listens on $GIT_DIR/ref-cache/socket.
+ */
+
+struct object_id;
+struct strbuf;
+struct ref_snapshot;
+
+/*
+ * The refs of the repository: from $GIT_DIR/ref-snapshot if it is up
+ * to date, otherwise read from the refs and written there for the
+ * next connection.
+ */
+extern struct ref_snapshot *get_ref_snapshot(void);
+
+/*
+ * Make "buf" hold an up-to-date snapshot of the refs, keeping its
+ * contents if they still are.  For the ref-cache daemon.
+ */
+extern void refresh_ref_snapshot(struct strbuf *buf);
+
+/*
+ * Called with the name and value of a ref, the object it peels to if
+ * it points at a tag (NULL otherwise), and the ref it points to if it
+ * is a symbolic ref (NULL otherwise).
+ */
+typedef int ref_snapshot_fn(const char *refname, const struct object_id *oid,
+			    const struct object_id *peeled,
+			    const char *symref_target, void *cb_data);
+
+/*
+ * Call "fn" for HEAD of the current namespace, like
+ * head_ref_namespaced(), if it exists.
+ */
+extern int ref_snapshot_head(struct ref_snapshot *snapshot,
+			     ref_snapshot_fn fn, void *cb_data);
+
+/*
+ * Call "fn" for every ref under refs/ starting with "prefix" in order,
+ * like for_each_ref_in() but without stripping the prefix.  Stops and
+ * returns the value "fn" returns if it is non-zero.
+ */
+extern int ref_snapshot_for_each(struct ref_snapshot *snapshot,
+				 const char *prefix,
+				 ref_snapshot_fn fn, void *cb_data);
+
+#endif
@@ -5,6 +5,8 @@
 #include "tag.h"
 #include "dir.h"
 #include "string-list.h"
+#include "argv-array.h"
+#include "reftable.h"
 
 struct ref_lock {
 	char *ref_name;
@@ -62,6 +64,18 @@ static unsigned char refname_disposition[256] = {
  */
 #define REF_NEEDS_COMMIT 0x20
 
+/*
+ * Used as a flag in ref_update::flags when the new value has been
+ * written to the reftable rather than to the lockfile.
+ */
+#define REF_IN_REFTABLE 0x40
+
+/*
+ * Used as a flag in ref_update::flags when the new value has been
+ * written to packed-refs rather than to the lockfile.
+ */
+#define REF_IN_PACKED_REFS 0x80
+
 /*
  * Try to read one refname component from the front of refname.
  * Return the length of the component found, or -1 if the component is
@@ -339,6 +353,23 @@ static int refname_is_safe(const char *refname)
 	return 1;
 }
 
+/* bytes held by ref_entry structures, and the most ever held at once */
+static size_t ref_entry_bytes, peak_ref_entry_bytes;
+
+static void account_ref_entry(size_t size)
+{
+	ref_entry_bytes += size;
+	if (peak_ref_entry_bytes < ref_entry_bytes)
+		peak_ref_entry_bytes = ref_entry_bytes;
+}
+
+size_t ref_cache_memory_usage(size_t *peak)
+{
+	if (peak)
+		*peak = peak_ref_entry_bytes;
+	return ref_entry_bytes;
+}
+
 static struct ref_entry *create_ref_entry(const char *refname,
 					  const unsigned char *sha1, int flag,
 					  int check_name)
@@ -351,6 +382,7 @@ static struct ref_entry *create_ref_entry(const char *refname,
 		die("Reference has invalid format: '%s'", refname);
 	len = strlen(refname) + 1;
 	ref = xmalloc(sizeof(struct ref_entry) + len);
+	account_ref_entry(sizeof(struct ref_entry) + len);
 	hashcpy(ref->u.value.oid.hash, sha1);
 	oidclr(&ref->u.value.peeled);
 	memcpy(ref->name, refname, len);
@@ -369,6 +401,7 @@ static void free_ref_entry(struct ref_entry *entry)
 		 */
 		clear_ref_dir(&entry->u.subdir);
 	}
+	ref_entry_bytes -= sizeof(struct ref_entry) + strlen(entry->name) + 1;
 	free(entry);
 }
 
@@ -413,6 +446,7 @@ static struct ref_entry *create_dir_entry(struct ref_cache *ref_cache,
 {
 	struct ref_entry *direntry;
 	direntry = xcalloc(1, sizeof(struct ref_entry) + len + 1);
+	account_ref_entry(sizeof(struct ref_entry) + len + 1);
 	memcpy(direntry->name, dirname, len);
 	direntry->name[len] = '\0';
 	direntry->u.subdir.ref_cache = ref_cache;
@@ -1021,9 +1055,34 @@ cleanup:
 	return ret;
 }
 
+enum packed_refs_peeled {
+	PEELED_NONE,
+	PEELED_TAGS,
+	PEELED_FULLY
+};
+
 struct packed_ref_cache {
+	struct ref_cache *ref_cache;
+
+	/*
+	 * The refs, once they have been read; see get_packed_ref_dir().
+	 */
 	struct ref_entry *root;
 
+	/*
+	 * The contents of the packed-refs file, mmapped (or read into
+	 * memory if the platform cannot replace a mapped file), and
+	 * what its header line says about them.  If the file is
+	 * sorted, single refs and prefixes are looked up in it by
+	 * binary search, and root is only filled in when all of the
+	 * refs are needed.
+	 */
+	char *buf, *eof;
+	const char *records;
+	int mmapped;
+	enum packed_refs_peeled peeled;
+	int sorted;
+
 	/*
 	 * Count of references to the data structure in this instance,
 	 * including the pointer from ref_cache::packed if any.  The
@@ -1043,6 +1102,12 @@ struct packed_ref_cache {
 
 	/* The metadata from when this packed-refs cache was read */
 	struct stat_validity validity;
+
+	/*
+	 * In a reftable repository, the reftable_stack_generation()
+	 * of the stack this cache was read from.
+	 */
+	unsigned reftable_generation;
 };
 
 /*
@@ -1079,7 +1144,12 @@ static void acquire_packed_ref_cache(struct packed_ref_cache *packed_refs)
 static int release_packed_ref_cache(struct packed_ref_cache *packed_refs)
 {
 	if (!--packed_refs->referrers) {
-		free_ref_entry(packed_refs->root);
+		if (packed_refs->root)
+			free_ref_entry(packed_refs->root);
+		if (packed_refs->mmapped)
+			munmap(packed_refs->buf, packed_refs->eof - packed_refs->buf);
+		else
+			free(packed_refs->buf);
 		stat_validity_clear(&packed_refs->validity);
 		free(packed_refs);
 		return 1;
@@ -1108,6 +1178,13 @@ static void clear_loose_ref_cache(struct ref_cache *refs)
 	}
 }
 
+void invalidate_ref_cache(void)
+{
+	clear_loose_ref_cache(&ref_cache);
+	if (ref_cache.packed && !ref_cache.packed->lock)
+		clear_packed_ref_cache(&ref_cache);
+}
+
 static struct ref_cache *create_ref_cache(const char *submodule)
 {
 	int len;
@@ -1151,46 +1228,11 @@ static struct ref_cache *get_ref_cache(const char *submodule)
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
-
-/*
- * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
- * Return a pointer to the refname within the line (null-terminated),
- * or NULL if there was a problem.
- */
-static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
-{
-	const char *ref;
-
-	/*
-	 * 42: the answer to everything.
-	 *
-	 * In this case, it happens to be the answer to
-	 *  40 (length of sha1 hex representation)
-	 *  +1 (space in between hex and name)
-	 *  +1 (newline at the end of the line)
-	 */
-	if (line->len <= 42)
-		return NULL;
-
-	if (get_sha1_hex(line->buf, sha1) < 0)
-		return NULL;
-	if (!isspace(line->buf[40]))
-		return NULL;
-
-	ref = line->buf + 41;
-	if (isspace(*ref))
-		return NULL;
-
-	if (line->buf[line->len - 1] != '\n')
-		return NULL;
-	line->buf[--line->len] = 0;
-
-	return ref;
-}
+	"# pack-refs with: peeled fully-peeled sorted \n";
 
 /*
- * Read f, which is a packed-refs file, into dir.
+ * Parse the header of the packed-refs file in packed_refs->buf, if it
+ * has one, and point packed_refs->records past it.
  *
  * A comment line of the form "# pack-refs with: " may contain zero or
  * more traits. We interpret the traits as follows:
@@ -1215,60 +1257,302 @@ static const char *parse_ref_line(struct strbuf *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are sorted by refname (as by strcmp()), so
+ *      single references and prefixes can be found by binary search
+ *      without reading the whole file.
  */
-static void read_packed_refs(FILE *f, struct ref_dir *dir)
+static void read_packed_refs_header(struct packed_ref_cache *packed_refs)
 {
-	struct ref_entry *last = NULL;
-	struct strbuf line = STRBUF_INIT;
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
+	const char *p = packed_refs->buf, *eol;
+	struct strbuf traits = STRBUF_INIT;
 
-	while (strbuf_getwholeline(&line, f, '\n') != EOF) {
-		unsigned char sha1[20];
-		const char *refname;
-		const char *traits;
-
-		if (skip_prefix(line.buf, "# pack-refs with:", &traits)) {
-			if (strstr(traits, " fully-peeled "))
-				peeled = PEELED_FULLY;
-			else if (strstr(traits, " peeled "))
-				peeled = PEELED_TAGS;
-			/* perhaps other traits later as well */
-			continue;
-		}
+	packed_refs->records = p;
+	if (!skip_prefix(p, "# pack-refs with:", &p))
+		return;
+	eol = memchr(p, '\n', packed_refs->eof - p);
+	if (!eol)
+		eol = packed_refs->eof;
+	strbuf_add(&traits, p, eol - p);
+	strbuf_addch(&traits, ' ');
 
-		refname = parse_ref_line(&line, sha1);
-		if (refname) {
-			int flag = REF_ISPACKED;
+	if (strstr(traits.buf, " fully-peeled "))
+		packed_refs->peeled = PEELED_FULLY;
+	else if (strstr(traits.buf, " peeled "))
+		packed_refs->peeled = PEELED_TAGS;
+	packed_refs->sorted = !!strstr(traits.buf, " sorted ");
+	/* perhaps other traits later as well */
 
-			if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
-				if (!refname_is_safe(refname))
-					die("packed refname is dangerous: %s", refname);
-				hashclr(sha1);
-				flag |= REF_BAD_NAME | REF_ISBROKEN;
-			}
-			last = create_ref_entry(refname, sha1, flag, 0);
-			if (peeled == PEELED_FULLY ||
-			    (peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
-				last->flag |= REF_KNOWS_PEELED;
-			add_ref(dir, last);
-			continue;
-		}
-		if (last &&
-		    line.buf[0] == '^' &&
-		    line.len == PEELED_LINE_LENGTH &&
-		    line.buf[PEELED_LINE_LENGTH - 1] == '\n' &&
-		    !get_sha1_hex(line.buf + 1, sha1)) {
-			hashcpy(last->u.value.peeled.hash, sha1);
-			/*
-			 * Regardless of what the file header said,
-			 * we definitely know the value of *this*
-			 * reference:
-			 */
-			last->flag |= REF_KNOWS_PEELED;
-		}
+	packed_refs->records = eol < packed_refs->eof ? eol + 1 : eol;
+	strbuf_release(&traits);
+}
+
+/*
+ * Parse the record at *pos in the packed-refs buffer: a line of the
+ * form "<sha1> <refname>\n", optionally followed by a "^<sha1>\n"
+ * line with its peeled value.  Advance *pos past the record, and
+ * return the new ref_entry, or NULL if the line did not parse.
+ */
+static struct ref_entry *read_packed_ref_record(struct packed_ref_cache *packed_refs,
+						const char **pos)
+{
+	const char *p = *pos, *end = packed_refs->eof, *eol;
+	unsigned char sha1[20];
+	struct ref_entry *entry;
+	char *refname;
+	int flag = REF_ISPACKED;
+
+	eol = memchr(p, '\n', end - p);
+	if (!eol) {
+		/* an incomplete last line */
+		*pos = end;
+		return NULL;
+	}
+	*pos = eol + 1;
+
+	/*
+	 * 41: the length of the sha1 hex representation, plus the space
+	 * in between hex and name; the name must not be empty.
+	 */
+	if (eol - p <= 41 || get_sha1_hex(p, sha1) < 0 ||
+	    !isspace(p[40]) || isspace(p[41]))
+		return NULL;
+
+	refname = xmemdupz(p + 41, eol - p - 41);
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname))
+			die("packed refname is dangerous: %s", refname);
+		hashclr(sha1);
+		flag |= REF_BAD_NAME | REF_ISBROKEN;
+	}
+	entry = create_ref_entry(refname, sha1, flag, 0);
+	if (packed_refs->peeled == PEELED_FULLY ||
+	    (packed_refs->peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
+		entry->flag |= REF_KNOWS_PEELED;
+	free(refname);
+
+	p = *pos;
+	if (end - p >= PEELED_LINE_LENGTH &&
+	    p[0] == '^' &&
+	    p[PEELED_LINE_LENGTH - 1] == '\n' &&
+	    !get_sha1_hex(p + 1, sha1)) {
+		hashcpy(entry->u.value.peeled.hash, sha1);
+		/*
+		 * Regardless of what the file header said,
+		 * we definitely know the value of *this*
+		 * reference:
+		 */
+		entry->flag |= REF_KNOWS_PEELED;
+		*pos = p + PEELED_LINE_LENGTH;
+	}
+	return entry;
+}
+
+/*
+ * Read the records of the packed-refs buffer from pos up to end into
+ * dir.
+ */
+static void read_packed_refs(struct packed_ref_cache *packed_refs,
+			     const char *pos, const char *end,
+			     struct ref_dir *dir)
+{
+	while (pos < end) {
+		struct ref_entry *entry = read_packed_ref_record(packed_refs, &pos);
+		if (entry)
+			add_ref(dir, entry);
+	}
+}
+
+/* Return the start of the record containing the line at p. */
+static const char *packed_record_start(const char *lo, const char *p)
+{
+	while (p > lo && p[-1] != '\n')
+		p--;
+	if (*p == '^' && p > lo) {
+		/* a peeled line belongs to the record before it */
+		p--;
+		while (p > lo && p[-1] != '\n')
+			p--;
+	}
+	return p;
+}
+
+/* Return the end of the record starting at rec. */
+static const char *packed_record_end(const char *rec, const char *end)
+{
+	const char *eol = memchr(rec, '\n', end - rec);
+
+	if (!eol)
+		return end;
+	rec = eol + 1;
+	if (rec < end && *rec == '^') {
+		eol = memchr(rec, '\n', end - rec);
+		rec = eol ? eol + 1 : end;
+	}
+	return rec;
+}
+
+/*
+ * Compare the refname of the record at rec to key, looking at only
+ * the first len bytes of the refname if len is non-negative.
+ */
+static int packed_record_cmp(const char *rec, const char *end,
+			     const char *key, int len)
+{
+	const char *eol = memchr(rec, '\n', end - rec);
+	const char *name = rec + 41;
+	size_t namelen, keylen = len < 0 ? strlen(key) : len;
+	int cmp;
+
+	if (!eol)
+		eol = end;
+	if (eol - rec <= 41)
+		name = eol;
+	namelen = eol - name;
+	if (len >= 0 && namelen > keylen)
+		namelen = keylen;
+	cmp = memcmp(name, key, namelen < keylen ? namelen : keylen);
+	if (cmp)
+		return cmp;
+	return namelen < keylen ? -1 : namelen > keylen;
+}
+
+/*
+ * In a sorted packed-refs buffer, find the first record whose refname
+ * is not less than key (with len as for packed_record_cmp()).
+ */
+static const char *find_packed_record(struct packed_ref_cache *packed_refs,
+				      const char *key, int len)
+{
+	const char *lo = packed_refs->records, *hi = packed_refs->eof;
+
+	while (lo < hi) {
+		const char *rec = packed_record_start(lo, lo + (hi - lo) / 2);
+
+		if (packed_record_cmp(rec, packed_refs->eof, key, len) < 0)
+			lo = packed_record_end(rec, packed_refs->eof);
+		else
+			hi = rec;
+	}
+	return lo;
+}
+
+/*
+ * Read the records of a sorted packed-refs buffer whose refnames
+ * start with prefix into dir.
+ */
+static void read_packed_refs_prefix(struct packed_ref_cache *packed_refs,
+				    const char *prefix, struct ref_dir *dir)
+{
+	int len = strlen(prefix);
+	const char *start = find_packed_record(packed_refs, prefix, len);
+	const char *end = start;
+
+	while (end < packed_refs->eof &&
+	       !packed_record_cmp(end, packed_refs->eof, prefix, len)) {
+		struct ref_entry *entry = read_packed_ref_record(packed_refs, &end);
+		if (entry)
+			add_ref(dir, entry);
+	}
+}
+
+/*
+ * Map the packed-refs file open as fd into memory.
+ */
+static void load_packed_refs(struct packed_ref_cache *packed_refs, int fd)
+{
+	struct stat st;
+	size_t size;
+
+	if (fstat(fd, &st) < 0)
+		die_errno("unable to stat packed-refs");
+	size = xsize_t(st.st_size);
+	if (!size)
+		return;
+#ifdef MMAP_PREVENTS_DELETE
+	/*
+	 * We could not replace the file while we have it mapped, and we
+	 * might want to do that ourselves.
+	 */
+	packed_refs->buf = xmalloc(size);
+	if (read_in_full(fd, packed_refs->buf, size) != size)
+		die_errno("unable to read packed-refs");
+#else
+	packed_refs->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	packed_refs->mmapped = 1;
+#endif
+	packed_refs->eof = packed_refs->buf + size;
+	read_packed_refs_header(packed_refs);
+}
+
+/*
+ * In a repository with "extensions.refStorage = reftable", the refs
+ * under "refs/" are kept in a reftable stack, which takes the place
+ * of packed-refs: it is read into the packed ref cache for iteration,
+ * and updates that would be written to loose refs go to the stack
+ * instead.  HEAD and the other pseudorefs, per-worktree refs and
+ * symbolic refs remain loose files.
+ */
+static int refs_use_reftable(struct ref_cache *refs)
+{
+	if (!*refs->name)
+		return repository_format_reftable;
+	return file_exists(git_path_submodule(refs->name, "reftable/tables.list"));
+}
+
+static int is_reftable_ref(const char *refname)
+{
+	return starts_with(refname, "refs/") && !starts_with(refname, "refs/bisect/");
+}
+
+static struct reftable_stack *get_reftable_stack(struct ref_cache *refs)
+{
+	if (*refs->name)
+		return reftable_stack_get(git_path_submodule(refs->name, "reftable"));
+	return reftable_stack_get(git_path("reftable"));
+}
+
+static int read_reftable_entry(const char *refname, const unsigned char *sha1,
+			       const unsigned char *peeled, void *cb_data)
+{
+	struct ref_dir *dir = cb_data;
+	struct ref_entry *entry;
+	int flag = REF_ISPACKED | REF_KNOWS_PEELED;
+
+	if (check_refname_format(refname, REFNAME_ALLOW_ONELEVEL)) {
+		if (!refname_is_safe(refname))
+			die("reftable refname is dangerous: %s", refname);
+		sha1 = null_sha1;
+		peeled = NULL;
+		flag |= REF_BAD_NAME | REF_ISBROKEN;
 	}
+	entry = create_ref_entry(refname, sha1, flag, 0);
+	if (peeled)
+		hashcpy(entry->u.value.peeled.hash, peeled);
+	add_ref(dir, entry);
+	return 0;
+}
+
+static struct packed_ref_cache *get_reftable_ref_cache(struct ref_cache *refs)
+{
+	struct reftable_stack *stack = get_reftable_stack(refs);
+	unsigned generation = reftable_stack_generation(stack);
+
+	if (refs->packed && refs->packed->reftable_generation != generation)
+		clear_packed_ref_cache(refs);
 
-	strbuf_release(&line);
+	if (!refs->packed) {
+		refs->packed = xcalloc(1, sizeof(*refs->packed));
+		acquire_packed_ref_cache(refs->packed);
+		refs->packed->ref_cache = refs;
+		refs->packed->root = create_dir_entry(refs, "", 0, 0);
+		refs->packed->reftable_generation = generation;
+		reftable_for_each_ref(stack, "", read_reftable_entry,
+				      get_ref_dir(refs->packed->root));
+	}
+	return refs->packed;
 }
 
 /*
@@ -1279,6 +1563,9 @@ static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 {
 	const char *packed_refs_file;
 
+	if (refs_use_reftable(refs))
+		return get_reftable_ref_cache(refs);
+
 	if (*refs->name)
 		packed_refs_file = git_path_submodule(refs->name, "packed-refs");
 	else
@@ -1289,23 +1576,35 @@ static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 		clear_packed_ref_cache(refs);
 
 	if (!refs->packed) {
-		FILE *f;
+		int fd;
 
 		refs->packed = xcalloc(1, sizeof(*refs->packed));
 		acquire_packed_ref_cache(refs->packed);
-		refs->packed->root = create_dir_entry(refs, "", 0, 0);
-		f = fopen(packed_refs_file, "r");
-		if (f) {
-			stat_validity_update(&refs->packed->validity, fileno(f));
-			read_packed_refs(f, get_ref_dir(refs->packed->root));
-			fclose(f);
+		refs->packed->ref_cache = refs;
+		fd = open(packed_refs_file, O_RDONLY);
+		if (fd >= 0) {
+			stat_validity_update(&refs->packed->validity, fd);
+			load_packed_refs(refs->packed, fd);
+			close(fd);
 		}
 	}
 	return refs->packed;
 }
 
+/*
+ * Return the ref_dir holding all of the packed refs, reading them
+ * if that has not been done yet.
+ */
 static struct ref_dir *get_packed_ref_dir(struct packed_ref_cache *packed_ref_cache)
 {
+	if (!packed_ref_cache->root) {
+		packed_ref_cache->root =
+			create_dir_entry(packed_ref_cache->ref_cache, "", 0, 0);
+		if (packed_ref_cache->buf)
+			read_packed_refs(packed_ref_cache, packed_ref_cache->records,
+					 packed_ref_cache->eof,
+					 get_ref_dir(packed_ref_cache->root));
+	}
 	return get_ref_dir(packed_ref_cache->root);
 }
 
@@ -1521,7 +1820,155 @@ int resolve_gitlink_ref(const char *path, const char *refname, unsigned char *sh
  */
 static struct ref_entry *get_packed_ref(const char *refname)
 {
-	return find_ref(get_packed_refs(&ref_cache), refname);
+	struct packed_ref_cache *packed_refs;
+
+	if (repository_format_reftable) {
+		/* look it up in the tables rather than reading all of them */
+		static struct ref_entry *entry;
+		unsigned char sha1[20], peeled[20];
+
+		if (entry) {
+			free_ref_entry(entry);
+			entry = NULL;
+		}
+		if (!is_reftable_ref(refname) ||
+		    reftable_read_ref(get_reftable_stack(&ref_cache), refname,
+				      sha1, peeled))
+			return NULL;
+		entry = create_ref_entry(refname, sha1,
+					 REF_ISPACKED | REF_KNOWS_PEELED, 0);
+		hashcpy(entry->u.value.peeled.hash, peeled);
+		return entry;
+	}
+
+	packed_refs = get_packed_ref_cache(&ref_cache);
+	if (!packed_refs->root && packed_refs->sorted) {
+		/* look it up in the file rather than reading all of it */
+		static struct ref_entry *entry;
+		const char *rec = find_packed_record(packed_refs, refname, -1);
+
+		if (entry) {
+			free_ref_entry(entry);
+			entry = NULL;
+		}
+		if (rec < packed_refs->eof &&
+		    !packed_record_cmp(rec, packed_refs->eof, refname, -1))
+			entry = read_packed_ref_record(packed_refs, &rec);
+		return entry;
+	}
+	return find_ref(get_packed_ref_dir(packed_refs), refname);
+}
+
+static int reftable_conflict_fn(const char *refname, const unsigned char *sha1,
+				const unsigned char *peeled, void *cb_data)
+{
+	struct nonmatching_ref_data *data = cb_data;
+
+	if (data->skip && string_list_has_string(data->skip, refname))
+		return 0;
+	data->conflicting_refname = xstrdup(refname);
+	return 1;
+}
+
+/*
+ * Find a packed ref under the directory "dirname" (ending with '/')
+ * that is not in skip, in a sorted packed-refs file that has not been
+ * read into the cache.  Store its name in data->conflicting_refname
+ * and return 1 if there is one.
+ */
+static int packed_refs_conflict(struct packed_ref_cache *packed_refs,
+				const char *dirname,
+				struct nonmatching_ref_data *data)
+{
+	int len = strlen(dirname);
+	const char *rec = find_packed_record(packed_refs, dirname, len);
+
+	while (rec < packed_refs->eof &&
+	       !packed_record_cmp(rec, packed_refs->eof, dirname, len)) {
+		struct ref_entry *entry = read_packed_ref_record(packed_refs, &rec);
+
+		if (!entry)
+			continue;
+		if (!data->skip || !string_list_has_string(data->skip, entry->name)) {
+			data->conflicting_refname = xstrdup(entry->name);
+			free_ref_entry(entry);
+			return 1;
+		}
+		free_ref_entry(entry);
+	}
+	return 0;
+}
+
+/*
+ * verify_refname_available() against the packed refs.  In a reftable
+ * repository, or with a sorted packed-refs file, only the names that
+ * could conflict are looked up rather than reading all packed refs.
+ */
+static int verify_refname_available_packed(const char *refname,
+					   const struct string_list *extras,
+					   const struct string_list *skip,
+					   struct strbuf *err)
+{
+	struct reftable_stack *stack = NULL;
+	struct packed_ref_cache *packed_refs = NULL;
+	struct nonmatching_ref_data data;
+	struct strbuf dirname = STRBUF_INIT;
+	const char *slash;
+	int conflict, ret = -1;
+
+	if (repository_format_reftable) {
+		stack = get_reftable_stack(&ref_cache);
+	} else {
+		packed_refs = get_packed_ref_cache(&ref_cache);
+		if (packed_refs->root || !packed_refs->sorted)
+			return verify_refname_available(refname, extras, skip,
+							get_packed_refs(&ref_cache),
+							err);
+		acquire_packed_ref_cache(packed_refs);
+	}
+
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		unsigned char sha1[20], peeled[20];
+
+		strbuf_reset(&dirname);
+		strbuf_add(&dirname, refname, slash - refname);
+		if (stack)
+			conflict = !reftable_read_ref(stack, dirname.buf,
+						      sha1, peeled);
+		else
+			conflict = !!get_packed_ref(dirname.buf);
+		if (conflict &&
+		    (!skip || !string_list_has_string(skip, dirname.buf))) {
+			strbuf_addf(err, "'%s' exists; cannot create '%s'",
+				    dirname.buf, refname);
+			goto cleanup;
+		}
+	}
+
+	strbuf_reset(&dirname);
+	strbuf_addf(&dirname, "%s/", refname);
+	data.skip = skip;
+	data.conflicting_refname = NULL;
+	if (stack)
+		conflict = reftable_for_each_ref(stack, dirname.buf,
+						 reftable_conflict_fn, &data);
+	else
+		conflict = packed_refs_conflict(packed_refs, dirname.buf, &data);
+	if (conflict) {
+		strbuf_addf(err, "'%s' exists; cannot create '%s'",
+			    data.conflicting_refname, refname);
+		free((char *)data.conflicting_refname);
+		goto cleanup;
+	}
+
+	/* Only the conflicts with extras are left to check */
+	ret = verify_refname_available(refname, extras, skip, NULL, err);
+
+cleanup:
+	if (packed_refs)
+		release_packed_ref_cache(packed_refs);
+	strbuf_release(&dirname);
+	return ret;
 }
 
 /*
@@ -1807,29 +2254,193 @@ enum peel_status {
 };
 
 /*
- * Peel the named object; i.e., if the object is a tag, resolve the
- * tag recursively until a non-tag is found.  If successful, store the
- * result to sha1 and return PEEL_PEELED.  If the object is not a tag
- * or is not valid, return PEEL_NON_TAG or PEEL_INVALID, respectively,
- * and leave sha1 unchanged.
+ * With core.peeledRefCache, the objects that loose refs (which, unlike
+ * packed refs, have no place to record it) peel to are remembered in
+ * $GIT_DIR/peeled-refs, so that they are not read again by every
+ * process that peels the refs.  An object always peels to the same
+ * object, so the file is keyed by object name, and needs no checks
+ * against the refs.  It is a sorted list of lines of the form
+ *
+ *   <object-sha1> <peeled-sha1>\n
+ *
+ * where the peeled name is all zeros for objects that are not tags.
+ * It is rewritten with the values found by a process when it exits,
+ * and removed by pack-refs, which records the values it reads from the
+ * objects in packed-refs.
  */
-static enum peel_status peel_object(const unsigned char *name, unsigned char *sha1)
+#define PEELED_REF_RECORD_LEN 82
+
+struct peeled_ref_value {
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+static struct peeled_ref_cache {
+	int loaded, enabled;
+	const char *map;
+	size_t len;
+	struct peeled_ref_value *added;
+	int added_nr, added_alloc;
+} peeled_ref_cache;
+
+static void load_peeled_ref_cache(struct peeled_ref_cache *cache)
 {
-	struct object *o = lookup_unknown_object(name);
+	int fd;
+	struct stat st;
 
-	if (o->type == OBJ_NONE) {
-		int type = sha1_object_info(name, NULL);
-		if (type < 0 || !object_as_type(o, type, 0))
-			return PEEL_INVALID;
+	cache->loaded = 1;
+	git_config_get_bool("core.peeledrefcache", &cache->enabled);
+	if (!cache->enabled)
+		return;
+	fd = open(git_path("peeled-refs"), O_RDONLY);
+	if (fd < 0)
+		return;
+	if (!fstat(fd, &st) && st.st_size &&
+	    !(st.st_size % PEELED_REF_RECORD_LEN)) {
+		cache->len = xsize_t(st.st_size);
+		cache->map = xmmap(NULL, cache->len, PROT_READ, MAP_PRIVATE, fd, 0);
 	}
+	close(fd);
+}
 
-	if (o->type != OBJ_TAG)
-		return PEEL_NON_TAG;
+static int lookup_peeled_ref_cache(const unsigned char *sha1, unsigned char *peeled)
+{
+	struct peeled_ref_cache *cache = &peeled_ref_cache;
+	const char *hex = sha1_to_hex(sha1);
+	size_t lo = 0, hi;
 
-	o = deref_tag_noverify(o);
-	if (!o)
-		return PEEL_INVALID;
+	if (!cache->loaded)
+		load_peeled_ref_cache(cache);
+	hi = cache->len / PEELED_REF_RECORD_LEN;
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+		const char *rec = cache->map + mi * PEELED_REF_RECORD_LEN;
+		int cmp = memcmp(hex, rec, 40);
 
+		if (!cmp)
+			return get_sha1_hex(rec + 41, peeled);
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+static int peeled_ref_value_cmp(const void *a_, const void *b_)
+{
+	const struct peeled_ref_value *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static void write_peeled_ref_cache(void)
+{
+	static struct lock_file lock;
+	struct peeled_ref_cache *cache = &peeled_ref_cache;
+	const char *rec = cache->map, *end = cache->map + cache->len;
+	struct strbuf buf = STRBUF_INIT;
+	int i, new_nr = 0;
+
+	if (!cache->added_nr)
+		return;
+	if (hold_lock_file_for_update(&lock, git_path("peeled-refs"), 0) < 0)
+		return; /* somebody else is writing it */
+
+	qsort(cache->added, cache->added_nr, sizeof(*cache->added),
+	      peeled_ref_value_cmp);
+	for (i = 0; i < cache->added_nr; i++) {
+		const char *hex = sha1_to_hex(cache->added[i].sha1);
+		int cmp = -1;
+
+		while (rec < end && (cmp = memcmp(rec, hex, 40)) < 0) {
+			strbuf_add(&buf, rec, PEELED_REF_RECORD_LEN);
+			rec += PEELED_REF_RECORD_LEN;
+		}
+		if (!cmp || (i && !hashcmp(cache->added[i - 1].sha1,
+					   cache->added[i].sha1)))
+			continue;
+		strbuf_addf(&buf, "%s ", hex);
+		strbuf_addf(&buf, "%s\n", sha1_to_hex(cache->added[i].peeled));
+		new_nr++;
+	}
+	strbuf_add(&buf, rec, end - rec);
+
+	if (!new_nr ||
+	    write_in_full(lock.fd, buf.buf, buf.len) != buf.len ||
+	    commit_lock_file(&lock))
+		rollback_lock_file(&lock);
+	strbuf_release(&buf);
+}
+
+static void disable_peeled_ref_cache(void)
+{
+	struct peeled_ref_cache *cache = &peeled_ref_cache;
+
+	if (cache->map)
+		munmap((void *)cache->map, cache->len);
+	cache->map = NULL;
+	cache->len = 0;
+	cache->added_nr = 0;
+	cache->loaded = 1;
+	cache->enabled = 0;
+}
+
+static void add_peeled_ref_cache(const unsigned char *sha1, const unsigned char *peeled)
+{
+	struct peeled_ref_cache *cache = &peeled_ref_cache;
+	struct peeled_ref_value *value;
+	static int registered;
+
+	if (!cache->loaded)
+		load_peeled_ref_cache(cache);
+	if (!cache->enabled)
+		return;
+	if (!registered) {
+		atexit(write_peeled_ref_cache);
+		registered = 1;
+	}
+	ALLOC_GROW(cache->added, cache->added_nr + 1, cache->added_alloc);
+	value = &cache->added[cache->added_nr++];
+	hashcpy(value->sha1, sha1);
+	hashcpy(value->peeled, peeled);
+}
+
+/*
+ * Peel the named object; i.e., if the object is a tag, resolve the
+ * tag recursively until a non-tag is found.  If successful, store the
+ * result to sha1 and return PEEL_PEELED.  If the object is not a tag
+ * or is not valid, return PEEL_NON_TAG or PEEL_INVALID, respectively,
+ * and leave sha1 unchanged.
+ */
+static enum peel_status peel_object(const unsigned char *name, unsigned char *sha1)
+{
+	struct object *o = lookup_unknown_object(name);
+	unsigned char peeled[20];
+
+	if (o->type == OBJ_NONE) {
+		int type;
+
+		if (!lookup_peeled_ref_cache(name, peeled)) {
+			if (is_null_sha1(peeled))
+				return PEEL_NON_TAG;
+			hashcpy(sha1, peeled);
+			return PEEL_PEELED;
+		}
+		type = sha1_object_info(name, NULL);
+		if (type < 0 || !object_as_type(o, type, 0))
+			return PEEL_INVALID;
+	}
+
+	if (o->type != OBJ_TAG) {
+		add_peeled_ref_cache(name, null_sha1);
+		return PEEL_NON_TAG;
+	}
+
+	o = deref_tag_noverify(o);
+	if (!o)
+		return PEEL_INVALID;
+
+	add_peeled_ref_cache(name, o->sha1);
 	hashcpy(sha1, o->sha1);
 	return PEEL_PEELED;
 }
@@ -1958,9 +2569,47 @@ void warn_dangling_symrefs(FILE *fp, const char *msg_fmt, const struct string_li
 	for_each_rawref(warn_if_dangling_symref, &data);
 }
 
+/*
+ * dir is the containing_dir of base.  If base ends in the middle of a
+ * path component (e.g., "refs/heads/ma"), set up view as a read-only
+ * window onto the entries of dir whose names begin with base and
+ * return it, so that the sibling directories are neither read nor
+ * walked; otherwise return dir itself.  dir is sorted as a side
+ * effect.
+ */
+static struct ref_dir *narrow_ref_dir(struct ref_dir *dir, const char *base,
+				      struct ref_dir *view)
+{
+	size_t len = strlen(base);
+	int lo, hi;
+
+	sort_ref_dir(dir);
+	if (!len || base[len - 1] == '/')
+		return dir;
+
+	lo = 0;
+	hi = dir->nr;
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (strcmp(dir->entries[mi]->name, base) < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	for (hi = lo; hi < dir->nr; hi++)
+		if (!starts_with(dir->entries[hi]->name, base))
+			break;
+
+	*view = *dir;
+	view->entries = dir->entries + lo;
+	view->nr = view->sorted = view->alloc = hi - lo;
+	return view;
+}
+
 /*
  * Call fn for each reference in the specified ref_cache, omitting
- * references not in the containing_dir of base.  fn is called for all
+ * references not in the containing_dir of base, and, within it, the
+ * entries that cannot begin with base.  fn is called for all
  * references, including broken ones.  If fn ever returns a non-zero
  * value, stop the iteration and return that value; otherwise, return
  * 0.
@@ -1969,8 +2618,10 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 			     each_ref_entry_fn fn, void *cb_data)
 {
 	struct packed_ref_cache *packed_ref_cache;
+	struct ref_entry *packed_subset = NULL;
 	struct ref_dir *loose_dir;
 	struct ref_dir *packed_dir;
+	struct ref_dir loose_view, packed_view;
 	int retval = 0;
 
 	/*
@@ -1984,15 +2635,27 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 	loose_dir = get_loose_refs(refs);
 	if (base && *base) {
 		loose_dir = find_containing_dir(loose_dir, base, 0);
+		if (loose_dir)
+			loose_dir = narrow_ref_dir(loose_dir, base, &loose_view);
 	}
 	if (loose_dir)
 		prime_ref_dir(loose_dir);
 
 	packed_ref_cache = get_packed_ref_cache(refs);
 	acquire_packed_ref_cache(packed_ref_cache);
-	packed_dir = get_packed_ref_dir(packed_ref_cache);
+	if (base && *base && !packed_ref_cache->root && packed_ref_cache->sorted) {
+		/* only read the refs under base */
+		packed_subset = create_dir_entry(refs, "", 0, 0);
+		read_packed_refs_prefix(packed_ref_cache, base,
+					get_ref_dir(packed_subset));
+		packed_dir = get_ref_dir(packed_subset);
+	} else {
+		packed_dir = get_packed_ref_dir(packed_ref_cache);
+	}
 	if (base && *base) {
 		packed_dir = find_containing_dir(packed_dir, base, 0);
+		if (packed_dir)
+			packed_dir = narrow_ref_dir(packed_dir, base, &packed_view);
 	}
 
 	if (packed_dir && loose_dir) {
@@ -2010,6 +2673,8 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 				loose_dir, 0, fn, cb_data);
 	}
 
+	if (packed_subset)
+		free_ref_entry(packed_subset);
 	release_packed_ref_cache(packed_ref_cache);
 	return retval;
 }
@@ -2084,6 +2749,16 @@ int for_each_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
 	return do_for_each_ref(&ref_cache, prefix, fn, strlen(prefix), 0, cb_data);
 }
 
+int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data,
+			unsigned int broken)
+{
+	unsigned int flag = 0;
+
+	if (broken)
+		flag = DO_FOR_EACH_INCLUDE_BROKEN;
+	return do_for_each_ref(&ref_cache, prefix, fn, 0, flag, cb_data);
+}
+
 int for_each_ref_in_submodule(const char *submodule, const char *prefix,
 		each_ref_fn fn, void *cb_data)
 {
@@ -2150,11 +2825,23 @@ int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
 	return ret;
 }
 
+int for_each_namespaced_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+	strbuf_addf(&buf, "%s%s", get_git_namespace(), prefix);
+	ret = do_for_each_ref(&ref_cache, buf.buf, fn, 0, 0, cb_data);
+	strbuf_release(&buf);
+	return ret;
+}
+
 int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 	const char *prefix, void *cb_data)
 {
 	struct strbuf real_pattern = STRBUF_INIT;
 	struct ref_filter filter;
+	const char *glob;
+	char *base, *slash;
 	int ret;
 
 	if (!prefix && !starts_with(pattern, "refs/"))
@@ -2171,11 +2858,22 @@ int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 		strbuf_addch(&real_pattern, '*');
 	}
 
+	/*
+	 * Only the refs in the directory before the first glob special
+	 * can match, so do not look at the others.
+	 */
+	glob = has_glob_specials(real_pattern.buf);
+	base = xmemdupz(real_pattern.buf,
+			glob ? glob - real_pattern.buf : real_pattern.len);
+	slash = strrchr(base, '/');
+	base[slash ? slash - base + 1 : 0] = '\0';
+
 	filter.pattern = real_pattern.buf;
 	filter.fn = fn;
 	filter.cb_data = cb_data;
-	ret = for_each_ref(filter_refs, &filter);
+	ret = do_for_each_ref(&ref_cache, base, filter_refs, 0, 0, &filter);
 
+	free(base);
 	strbuf_release(&real_pattern);
 	return ret;
 }
@@ -2224,6 +2922,15 @@ int refname_match(const char *abbrev_name, const char *full_name)
 	return 0;
 }
 
+void expand_ref_prefix(struct argv_array *prefixes, const char *abbrev_name)
+{
+	const char **p;
+	const int abbrev_name_len = strlen(abbrev_name);
+
+	for (p = ref_rev_parse_rules; *p; p++)
+		argv_array_pushf(prefixes, *p, abbrev_name_len, abbrev_name);
+}
+
 static void unlock_ref(struct ref_lock *lock)
 {
 	/* Do not free lock->lk -- atexit() still looks at them */
@@ -2445,8 +3152,7 @@ static struct ref_lock *lock_ref_sha1_basic(const char *refname,
 	 * our refname.
 	 */
 	if (is_null_oid(&lock->old_oid) &&
-	    verify_refname_available(refname, extras, skip,
-				     get_packed_refs(&ref_cache), err)) {
+	    verify_refname_available_packed(refname, extras, skip, err)) {
 		last_errno = ENOTDIR;
 		goto error_return;
 	}
@@ -2530,22 +3236,52 @@ static int write_packed_entry_fn(struct ref_entry *entry, void *cb_data)
 	return 0;
 }
 
-/* This should return a meaningful errno on failure */
-int lock_packed_refs(int flags)
+/*
+ * An each_ref_entry_fn that adds the entry to a reftable_addition.
+ */
+static int add_reftable_entry_fn(struct ref_entry *entry, void *cb_data)
+{
+	enum peel_status peel_status = peel_entry(entry, 0);
+
+	if (peel_status != PEEL_PEELED && peel_status != PEEL_NON_TAG)
+		error("internal error: %s is not a valid packed reference!",
+		      entry->name);
+	reftable_add_ref(cb_data, entry->name, entry->u.value.oid.hash,
+			 peel_status == PEEL_PEELED ?
+			 entry->u.value.peeled.hash : NULL);
+	return 0;
+}
+
+/*
+ * The file that packlock protects: packed-refs, or the list of tables
+ * in a reftable repository.
+ */
+static const char *packed_refs_path(void)
+{
+	return repository_format_reftable ?
+		git_path("reftable/tables.list") : git_path("packed-refs");
+}
+
+static int hold_packlock(int flags)
 {
 	static int timeout_configured = 0;
 	static int timeout_value = 1000;
 
-	struct packed_ref_cache *packed_ref_cache;
-
 	if (!timeout_configured) {
 		git_config_get_int("core.packedrefstimeout", &timeout_value);
 		timeout_configured = 1;
 	}
 
-	if (hold_lock_file_for_update_timeout(
-			    &packlock, git_path("packed-refs"),
-			    flags, timeout_value) < 0)
+	return hold_lock_file_for_update_timeout(&packlock, packed_refs_path(),
+						 flags, timeout_value);
+}
+
+/* This should return a meaningful errno on failure */
+int lock_packed_refs(int flags)
+{
+	struct packed_ref_cache *packed_ref_cache;
+
+	if (hold_packlock(flags) < 0)
 		return -1;
 	/*
 	 * Get the current packed-refs while holding the lock.  If the
@@ -2560,6 +3296,26 @@ int lock_packed_refs(int flags)
 	return 0;
 }
 
+/*
+ * Write all of the packed refs as one table that replaces the whole
+ * reftable stack.
+ */
+static int commit_packed_reftable(struct packed_ref_cache *packed_ref_cache)
+{
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_addition *add =
+		reftable_addition_begin(get_reftable_stack(&ref_cache), 1);
+	int ret;
+
+	do_for_each_entry_in_dir(get_packed_ref_dir(packed_ref_cache),
+				 0, add_reftable_entry_fn, add);
+	ret = reftable_addition_commit(add, packed_ref_cache->lock, &err);
+	if (ret)
+		error("%s", err.buf);
+	strbuf_release(&err);
+	return ret;
+}
+
 /*
  * Commit the packed refs changes.
  * On error we must make sure that errno contains a meaningful value.
@@ -2575,6 +3331,17 @@ int commit_packed_refs(void)
 	if (!packed_ref_cache->lock)
 		die("internal error: packed-refs not locked");
 
+	if (repository_format_reftable) {
+		if (commit_packed_reftable(packed_ref_cache)) {
+			save_errno = errno;
+			error = -1;
+		}
+		packed_ref_cache->lock = NULL;
+		release_packed_ref_cache(packed_ref_cache);
+		errno = save_errno;
+		return error;
+	}
+
 	out = fdopen_lock_file(packed_ref_cache->lock, "w");
 	if (!out)
 		die_errno("unable to fdopen packed-refs descriptor");
@@ -2639,6 +3406,10 @@ static int pack_if_possible_fn(struct ref_entry *entry, void *cb_data)
 	if ((entry->flag & REF_ISSYMREF) || !ref_resolves_to_object(entry))
 		return 0;
 
+	/* Nor refs that a reftable repository keeps loose */
+	if (repository_format_reftable && !is_reftable_ref(entry->name))
+		return 0;
+
 	/* Add a packed ref cache entry equivalent to the loose entry. */
 	peel_status = peel_entry(entry, 1);
 	if (peel_status != PEEL_PEELED && peel_status != PEEL_NON_TAG)
@@ -2738,6 +3509,8 @@ int pack_refs(unsigned int flags)
 	memset(&cbdata, 0, sizeof(cbdata));
 	cbdata.flags = flags;
 
+	/* peel the refs we pack from the objects themselves */
+	disable_peeled_ref_cache();
 	lock_packed_refs(LOCK_DIE_ON_ERROR);
 	cbdata.packed_refs = get_packed_refs(&ref_cache);
 
@@ -2748,9 +3521,36 @@ int pack_refs(unsigned int flags)
 		die_errno("unable to overwrite old ref-pack file");
 
 	prune_refs(cbdata.ref_to_prune);
+	/* the packed refs know their peeled values now */
+	unlink(git_path("peeled-refs"));
 	return 0;
 }
 
+/*
+ * Record the deletion of those of refnames that exist in a new table
+ * on top of the reftable stack.
+ */
+static int delete_reftable_refs(struct string_list *refnames, struct strbuf *err)
+{
+	struct reftable_stack *stack;
+	struct reftable_addition *add;
+	struct string_list_item *refname;
+
+	if (hold_packlock(0) < 0) {
+		unable_to_lock_message(packed_refs_path(), errno, err);
+		return -1;
+	}
+	stack = get_reftable_stack(&ref_cache);
+	add = reftable_addition_begin(stack, 0);
+	for_each_string_list_item(refname, refnames) {
+		unsigned char sha1[20], peeled[20];
+
+		if (!reftable_read_ref(stack, refname->string, sha1, peeled))
+			reftable_add_deletion(add, refname->string);
+	}
+	return reftable_addition_commit(add, &packlock, err);
+}
+
 int repack_without_refs(struct string_list *refnames, struct strbuf *err)
 {
 	struct ref_dir *packed;
@@ -2759,6 +3559,9 @@ int repack_without_refs(struct string_list *refnames, struct strbuf *err)
 
 	assert(err);
 
+	if (repository_format_reftable)
+		return delete_reftable_refs(refnames, err);
+
 	/* Look for a packed ref */
 	for_each_string_list_item(refname, refnames) {
 		if (get_packed_ref(refname->string)) {
@@ -2898,8 +3701,7 @@ static int rename_ref_available(const char *oldname, const char *newname)
 	int ret;
 
 	string_list_insert(&skip, oldname);
-	ret = !verify_refname_available(newname, NULL, &skip,
-					get_packed_refs(&ref_cache), &err)
+	ret = !verify_refname_available_packed(newname, NULL, &skip, &err)
 		&& !verify_refname_available(newname, NULL, &skip,
 					     get_loose_refs(&ref_cache), &err);
 	if (!ret)
@@ -3015,8 +3817,45 @@ static int close_ref(struct ref_lock *lock)
 	return 0;
 }
 
-static int commit_ref(struct ref_lock *lock)
+static void reftable_add_ref_peeled(struct reftable_addition *add,
+				    const char *refname, const unsigned char *sha1)
+{
+	unsigned char peeled[20];
+
+	if (peel_object(sha1, peeled) != PEEL_PEELED)
+		hashclr(peeled);
+	reftable_add_ref(add, refname, sha1, peeled);
+}
+
+/*
+ * Set the locked ref to sha1, which has already been written to the
+ * lockfile.  In a reftable repository the lockfile only serves to
+ * keep others away from the ref, whose value goes into a new table.
+ */
+static int commit_ref(struct ref_lock *lock, const unsigned char *sha1)
 {
+	if (repository_format_reftable && is_reftable_ref(lock->ref_name)) {
+		struct strbuf err = STRBUF_INIT;
+		struct reftable_addition *add;
+
+		if (hold_packlock(0) < 0) {
+			unable_to_lock_message(packed_refs_path(), errno, &err);
+			error("%s", err.buf);
+			strbuf_release(&err);
+			return -1;
+		}
+		add = reftable_addition_begin(get_reftable_stack(&ref_cache), 0);
+		reftable_add_ref_peeled(add, lock->ref_name, sha1);
+		if (reftable_addition_commit(add, &packlock, &err)) {
+			error("%s", err.buf);
+			strbuf_release(&err);
+			return -1;
+		}
+		/* a loose (symbolic) ref of the same name would hide it */
+		unlink_or_warn(git_path("%s", lock->ref_name));
+		rollback_lock_file(lock->lk);
+		return 0;
+	}
 	if (commit_lock_file(lock->lk))
 		return -1;
 	return 0;
@@ -3218,20 +4057,16 @@ static int write_ref_to_lockfile(struct ref_lock *lock,
 }
 
 /*
- * Commit a change to a loose reference that has already been written
- * to the loose reference lockfile. Also update the reflogs if
- * necessary, using the specified lockmsg (which can be NULL).
+ * Update the reflogs for setting the locked ref to sha1, using the
+ * specified logmsg (which can be NULL).
  */
-static int commit_ref_update(struct ref_lock *lock,
-			     const unsigned char *sha1, const char *logmsg)
+static int log_ref_update(struct ref_lock *lock,
+			  const unsigned char *sha1, const char *logmsg)
 {
-	clear_loose_ref_cache(&ref_cache);
 	if (log_ref_write(lock->ref_name, lock->old_oid.hash, sha1, logmsg) < 0 ||
 	    (strcmp(lock->ref_name, lock->orig_ref_name) &&
-	     log_ref_write(lock->orig_ref_name, lock->old_oid.hash, sha1, logmsg) < 0)) {
-		unlock_ref(lock);
+	     log_ref_write(lock->orig_ref_name, lock->old_oid.hash, sha1, logmsg) < 0))
 		return -1;
-	}
 	if (strcmp(lock->orig_ref_name, "HEAD") != 0) {
 		/*
 		 * Special hack: If a branch is updated directly and HEAD
@@ -3254,7 +4089,23 @@ static int commit_ref_update(struct ref_lock *lock,
 		    !strcmp(head_ref, lock->ref_name))
 			log_ref_write("HEAD", lock->old_oid.hash, sha1, logmsg);
 	}
-	if (commit_ref(lock)) {
+	return 0;
+}
+
+/*
+ * Commit a change to a loose reference that has already been written
+ * to the loose reference lockfile. Also update the reflogs if
+ * necessary, using the specified lockmsg (which can be NULL).
+ */
+static int commit_ref_update(struct ref_lock *lock,
+			     const unsigned char *sha1, const char *logmsg)
+{
+	clear_loose_ref_cache(&ref_cache);
+	if (log_ref_update(lock, sha1, logmsg)) {
+		unlock_ref(lock);
+		return -1;
+	}
+	if (commit_ref(lock, sha1)) {
 		error("Couldn't set %s", lock->ref_name);
 		unlock_ref(lock);
 		return -1;
@@ -3326,6 +4177,12 @@ int create_symref(const char *ref_target, const char *refs_heads_master,
 	return 0;
 }
 
+static long reflog_index_skip(const char *refname, unsigned long at_time,
+			      int cnt, long *end);
+static int for_each_reflog_ent_reverse_before(const char *refname, long end,
+					      each_reflog_ent_fn fn,
+					      void *cb_data);
+
 struct read_ref_at_cb {
 	const char *refname;
 	unsigned long at_time;
@@ -3428,7 +4285,16 @@ int read_ref_at(const char *refname, unsigned int flags, unsigned long at_time,
 	cb.cutoff_cnt = cutoff_cnt;
 	cb.sha1 = sha1;
 
-	for_each_reflog_ent_reverse(refname, read_ref_at_ent, &cb);
+	{
+		long end = -1;
+
+		/* the skipped entries are all newer than what we look for */
+		cb.reccnt = reflog_index_skip(refname, at_time, cnt, &end);
+		if (cb.cnt > 0)
+			cb.cnt -= cb.reccnt;
+		for_each_reflog_ent_reverse_before(refname, end,
+						   read_ref_at_ent, &cb);
+	}
 
 	if (!cb.reccnt) {
 		if (flags & GET_SHA1_QUIETLY)
@@ -3454,6 +4320,7 @@ int reflog_exists(const char *refname)
 
 int delete_reflog(const char *refname)
 {
+	remove_path(git_path("reflog-index/%s", refname));
 	return remove_path(git_path("logs/%s", refname));
 }
 
@@ -3496,7 +4363,14 @@ static char *find_beginning_of_line(char *bob, char *scan)
 	return scan;
 }
 
-int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+/*
+ * Call fn for the entries of the reflog that start before offset "end"
+ * (the whole reflog if it is negative), newest first.  "end" has to be
+ * the start of a line.
+ */
+static int for_each_reflog_ent_reverse_before(const char *refname, long end,
+					      each_reflog_ent_fn fn,
+					      void *cb_data)
 {
 	struct strbuf sb = STRBUF_INIT;
 	FILE *logfp;
@@ -3507,11 +4381,14 @@ int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void
 	if (!logfp)
 		return -1;
 
-	/* Jump to the end */
-	if (fseek(logfp, 0, SEEK_END) < 0)
-		return error("cannot seek back reflog for %s: %s",
-			     refname, strerror(errno));
-	pos = ftell(logfp);
+	if (end < 0) {
+		/* Jump to the end */
+		if (fseek(logfp, 0, SEEK_END) < 0)
+			return error("cannot seek back reflog for %s: %s",
+				     refname, strerror(errno));
+		pos = ftell(logfp);
+	} else
+		pos = end;
 	while (!ret && 0 < pos) {
 		int cnt;
 		size_t nread;
@@ -3598,6 +4475,244 @@ int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void
 	return ret;
 }
 
+int for_each_reflog_ent_reverse(const char *refname, each_reflog_ent_fn fn, void *cb_data)
+{
+	return for_each_reflog_ent_reverse_before(refname, -1, fn, cb_data);
+}
+
+/*
+ * Long reflogs get an index in $GIT_DIR/reflog-index/<refname>, so that
+ * looking up "ref@{N}" or "ref@{date}" does not have to read all the
+ * entries newer than the one asked for.  It cuts the reflog into blocks
+ * of REFLOG_INDEX_BLOCK entries, and records where each block starts
+ * and the oldest timestamp in it:
+ *
+ *   "# reflog index v1" LF
+ *   <size> SP <entries> SP <last line offset> SP <sha1 of last line> LF
+ *   (<block offset> SP <oldest timestamp> LF)*
+ *
+ * The index is good for the first <size> bytes of the reflog as long as
+ * its last line there still hashes the same.  Entries appended since
+ * then are indexed by the next lookup, which writes the index back.
+ * Timestamps in a reflog need not grow, so lookups by date still look
+ * at every block, but only in the index.
+ */
+#define REFLOG_INDEX_BLOCK 64
+#define REFLOG_INDEX_MIN_SIZE (64 * 1024)
+static const char reflog_index_header[] = "# reflog index v1\n";
+
+struct reflog_index {
+	long size;
+	int nr;
+	long last_line;
+	unsigned char last_sha1[20];
+	struct reflog_index_block {
+		long offset;
+		unsigned long oldest;
+	} *blocks;
+	int nr_blocks, alloc_blocks;
+};
+
+static int read_reflog_index(const char *refname, struct reflog_index *ix)
+{
+	struct strbuf sb = STRBUF_INIT;
+	FILE *fp = fopen(git_path("reflog-index/%s", refname), "r");
+	char *p;
+	int ret = -1;
+
+	if (!fp)
+		return -1;
+	if (strbuf_getline(&sb, fp, '\n') ||
+	    strcmp(sb.buf, "# reflog index v1") ||
+	    strbuf_getline(&sb, fp, '\n'))
+		goto out;
+	ix->size = strtol(sb.buf, &p, 10);
+	if (*p != ' ')
+		goto out;
+	ix->nr = strtol(p + 1, &p, 10);
+	if (*p != ' ')
+		goto out;
+	ix->last_line = strtol(p + 1, &p, 10);
+	if (*p != ' ' || get_sha1_hex(p + 1, ix->last_sha1) || p[41])
+		goto out;
+
+	while (!strbuf_getline(&sb, fp, '\n')) {
+		struct reflog_index_block *b;
+
+		ALLOC_GROW(ix->blocks, ix->nr_blocks + 1, ix->alloc_blocks);
+		b = &ix->blocks[ix->nr_blocks++];
+		b->offset = strtol(sb.buf, &p, 10);
+		if (*p != ' ')
+			goto out;
+		b->oldest = strtoul(p + 1, &p, 10);
+		if (*p)
+			goto out;
+	}
+	if (ix->nr_blocks != (ix->nr + REFLOG_INDEX_BLOCK - 1) / REFLOG_INDEX_BLOCK ||
+	    ix->size < ix->last_line)
+		goto out;
+	ret = 0;
+out:
+	if (ret)
+		ix->nr_blocks = 0;
+	fclose(fp);
+	strbuf_release(&sb);
+	return ret;
+}
+
+static void write_reflog_index(const char *refname, struct reflog_index *ix)
+{
+	static struct lock_file lock;
+	struct strbuf sb = STRBUF_INIT;
+	const char *path = git_path("reflog-index/%s", refname);
+	int i;
+
+	if (safe_create_leading_directories_const(path) < 0 ||
+	    hold_lock_file_for_update(&lock, path, 0) < 0)
+		return; /* it is only an index */
+
+	strbuf_addstr(&sb, reflog_index_header);
+	strbuf_addf(&sb, "%ld %d %ld %s\n", ix->size, ix->nr, ix->last_line,
+		    sha1_to_hex(ix->last_sha1));
+	for (i = 0; i < ix->nr_blocks; i++)
+		strbuf_addf(&sb, "%ld %lu\n", ix->blocks[i].offset,
+			    ix->blocks[i].oldest);
+	if (write_in_full(lock.fd, sb.buf, sb.len) != sb.len ||
+	    commit_lock_file(&lock))
+		rollback_lock_file(&lock);
+	strbuf_release(&sb);
+}
+
+static int reflog_ent_timestamp(unsigned char *osha1, unsigned char *nsha1,
+				const char *email, unsigned long timestamp,
+				int tz, const char *message, void *cb_data)
+{
+	*(unsigned long *)cb_data = timestamp;
+	return 0;
+}
+
+/*
+ * Index the entries from the start of the last block of "ix" to the end
+ * of "logfp"; everything before that is still good.  Returns 1 if the
+ * index changed.
+ */
+static int extend_reflog_index(FILE *logfp, struct reflog_index *ix)
+{
+	struct strbuf sb = STRBUF_INIT;
+	long pos = 0, old_size = ix->size;
+	int nr = 0;
+
+	if (ix->nr_blocks) {
+		ix->nr_blocks--;
+		pos = ix->blocks[ix->nr_blocks].offset;
+		nr = ix->nr_blocks * REFLOG_INDEX_BLOCK;
+	}
+	if (fseek(logfp, pos, SEEK_SET) < 0)
+		return -1;
+
+	while (!strbuf_getwholeline(&sb, logfp, '\n')) {
+		unsigned long timestamp = 0;
+		long line = pos;
+
+		pos += sb.len;
+		if (sb.buf[sb.len - 1] != '\n')
+			break; /* being written */
+		show_one_reflog_ent(&sb, reflog_ent_timestamp, &timestamp);
+		if (!timestamp)
+			continue; /* not an entry */
+		if (!(nr % REFLOG_INDEX_BLOCK)) {
+			ALLOC_GROW(ix->blocks, ix->nr_blocks + 1,
+				   ix->alloc_blocks);
+			ix->blocks[ix->nr_blocks].offset = line;
+			ix->blocks[ix->nr_blocks].oldest = timestamp;
+			ix->nr_blocks++;
+		} else if (timestamp < ix->blocks[ix->nr_blocks - 1].oldest)
+			ix->blocks[ix->nr_blocks - 1].oldest = timestamp;
+		nr++;
+		ix->last_line = line;
+		ix->size = pos;
+	}
+	ix->nr = nr;
+	strbuf_release(&sb);
+	return ix->size != old_size;
+}
+
+static int hash_reflog_line(FILE *logfp, struct reflog_index *ix,
+			    unsigned char *sha1)
+{
+	git_SHA_CTX ctx;
+	long len = ix->size - ix->last_line;
+	char *buf = xmalloc(len + 1);
+	int ret = -1;
+
+	if (!fseek(logfp, ix->last_line, SEEK_SET) &&
+	    fread(buf, 1, len, logfp) == len) {
+		git_SHA1_Init(&ctx);
+		git_SHA1_Update(&ctx, buf, len);
+		git_SHA1_Final(sha1, &ctx);
+		ret = 0;
+	}
+	free(buf);
+	return ret;
+}
+
+/*
+ * How many of the newest entries of the reflog a reverse walk looking
+ * for the newest entry at or before "at_time", or for the "cnt"-th
+ * newest one, can skip without changing what it finds.  The walk then
+ * starts at offset "end".  The entry just newer than the one found is
+ * never skipped, as read_ref_at_ent() looks at it.
+ */
+static long reflog_index_skip(const char *refname, unsigned long at_time,
+			      int cnt, long *end)
+{
+	struct reflog_index ix;
+	unsigned char sha1[20];
+	struct stat st;
+	FILE *logfp;
+	long skip = 0;
+	int j;
+
+	if (stat(git_path("logs/%s", refname), &st) ||
+	    st.st_size < REFLOG_INDEX_MIN_SIZE)
+		return 0;
+	logfp = fopen(git_path("logs/%s", refname), "r");
+	if (!logfp)
+		return 0;
+
+	memset(&ix, 0, sizeof(ix));
+	if (read_reflog_index(refname, &ix) || ix.size > st.st_size ||
+	    hash_reflog_line(logfp, &ix, sha1) || hashcmp(sha1, ix.last_sha1)) {
+		/* start over */
+		ix.size = ix.nr = ix.nr_blocks = 0;
+		ix.last_line = 0;
+	}
+	if (ix.size != st.st_size) {
+		int changed = extend_reflog_index(logfp, &ix);
+
+		if (changed < 0)
+			ix.nr_blocks = 0;
+		else if (changed && ix.nr &&
+			 !hash_reflog_line(logfp, &ix, ix.last_sha1))
+			write_reflog_index(refname, &ix);
+	}
+	fclose(logfp);
+
+	/* the newest block that may hold the entry we look for */
+	for (j = ix.nr_blocks - 1; j >= 0; j--)
+		if (ix.blocks[j].oldest <= at_time ||
+		    (cnt >= 0 && ix.nr - j * REFLOG_INDEX_BLOCK > cnt))
+			break;
+	/* the block after it holds the entry just newer than that one */
+	j += 2;
+	if (j < ix.nr_blocks) {
+		*end = ix.blocks[j].offset;
+		skip = ix.nr - j * REFLOG_INDEX_BLOCK;
+	}
+	free(ix.blocks);
+	return skip;
+}
+
 int for_each_reflog_ent(const char *refname, each_reflog_ent_fn fn, void *cb_data)
 {
 	FILE *logfp;
@@ -3883,6 +4998,243 @@ static int ref_update_reject_duplicates(struct string_list *refnames,
 	return 0;
 }
 
+/*
+ * The second half of ref_transaction_commit() in a reftable
+ * repository, once all refs are locked: write the updates and
+ * deletions of the refs that live in the reftable as one new table,
+ * so that they all take effect at once, and deal with loose refs like
+ * HEAD as usual.
+ */
+static int reftable_transaction_commit(struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct ref_update **updates = transaction->updates;
+	struct reftable_stack *stack;
+	struct reftable_addition *add;
+	struct string_list refs_to_delete = STRING_LIST_INIT_NODUP;
+	struct string_list_item *ref_to_delete;
+	int i, ret = 0;
+
+	if (hold_packlock(0) < 0) {
+		unable_to_lock_message(packed_refs_path(), errno, err);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+	stack = get_reftable_stack(&ref_cache);
+	add = reftable_addition_begin(stack, 0);
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+		const char *refname = update->lock->ref_name;
+		unsigned char sha1[20], peeled[20];
+
+		if (!is_reftable_ref(refname))
+			continue;
+		if (update->flags & REF_NEEDS_COMMIT) {
+			if (log_ref_update(update->lock, update->new_sha1,
+					   update->msg)) {
+				strbuf_addf(err, "Cannot update the ref '%s'.",
+					    update->refname);
+				reftable_addition_free(add);
+				rollback_lock_file(&packlock);
+				return TRANSACTION_GENERIC_ERROR;
+			}
+			reftable_add_ref_peeled(add, refname, update->new_sha1);
+			update->flags |= REF_IN_REFTABLE;
+		} else if ((update->flags & REF_DELETING) &&
+			   !(update->flags & REF_ISPRUNING) &&
+			   !reftable_read_ref(stack, refname, sha1, peeled)) {
+			reftable_add_deletion(add, refname);
+		}
+	}
+	if (reftable_addition_commit(add, &packlock, err))
+		return TRANSACTION_GENERIC_ERROR;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+
+		if (update->flags & REF_IN_REFTABLE) {
+			char *refname = xstrdup(update->lock->ref_name);
+
+			/* a loose (symbolic) ref of the same name would hide it */
+			unlink_or_warn(git_path("%s", refname));
+			unlock_ref(update->lock);
+			update->lock = NULL;
+			try_remove_empty_parents(refname);
+			free(refname);
+		} else if (update->flags & REF_NEEDS_COMMIT) {
+			if (commit_ref_update(update->lock,
+					      update->new_sha1, update->msg)) {
+				strbuf_addf(err, "Cannot update the ref '%s'.",
+					    update->refname);
+				ret = TRANSACTION_GENERIC_ERROR;
+			}
+			/* freed by commit_ref_update(): */
+			update->lock = NULL;
+			if (ret)
+				goto cleanup;
+		}
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+
+		if (update->flags & REF_DELETING) {
+			if (delete_ref_loose(update->lock, update->type, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto cleanup;
+			}
+			if (!(update->flags & REF_ISPRUNING))
+				string_list_append(&refs_to_delete,
+						   update->lock->ref_name);
+		}
+	}
+	for_each_string_list_item(ref_to_delete, &refs_to_delete)
+		unlink_or_warn(git_path("logs/%s", ref_to_delete->string));
+
+cleanup:
+	clear_loose_ref_cache(&ref_cache);
+	string_list_clear(&refs_to_delete, 0);
+	return ret;
+}
+
+/*
+ * Transactions that update at least this many refs write them all to
+ * packed-refs at once, instead of renaming one lockfile into place
+ * per ref.
+ */
+#define PACKED_TRANSACTION_MIN_UPDATES 100
+
+/*
+ * The second half of ref_transaction_commit() for a large transaction,
+ * once all refs are locked: write the new values of the refs under
+ * refs/ and drop the deleted refs in a single rewrite of packed-refs,
+ * then remove the loose files that would shadow them.  Symbolic refs
+ * and refs outside refs/ (like HEAD) are updated as usual.  The
+ * lockfiles of the individual refs are still held throughout, so that
+ * this is atomic in the same way as the loose update.
+ */
+static int packed_transaction_commit(struct ref_transaction *transaction,
+				     struct strbuf *err)
+{
+	struct ref_update **updates = transaction->updates;
+	struct string_list refs_to_delete = STRING_LIST_INIT_NODUP;
+	struct string_list_item *ref_to_delete;
+	struct ref_dir *packed;
+	struct ref_entry **new_entries = NULL;
+	int i, new_nr = 0, new_alloc = 0, ret = 0;
+
+	if (lock_packed_refs(0)) {
+		unable_to_lock_message(git_path("packed-refs"), errno, err);
+		return TRANSACTION_GENERIC_ERROR;
+	}
+	packed = get_packed_refs(&ref_cache);
+
+	/* Remove deleted refs first, as a new ref may take their place */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+
+		if ((update->flags & REF_DELETING) &&
+		    !(update->flags & REF_ISPRUNING))
+			remove_entry(packed, update->lock->ref_name);
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+		const char *refname = update->lock->ref_name;
+		struct ref_entry *entry;
+
+		if (!(update->flags & REF_NEEDS_COMMIT) ||
+		    !starts_with(refname, "refs/") ||
+		    ((update->type & REF_ISSYMREF) &&
+		     (update->flags & REF_NODEREF)))
+			continue;
+		if (log_ref_update(update->lock, update->new_sha1,
+				   update->msg)) {
+			strbuf_addf(err, "Cannot update the ref '%s'.",
+				    update->refname);
+			for (i = 0; i < new_nr; i++)
+				free_ref_entry(new_entries[i]);
+			free(new_entries);
+			rollback_packed_refs();
+			return TRANSACTION_GENERIC_ERROR;
+		}
+		entry = find_ref(packed, refname);
+		if (entry) {
+			/* peeled again when packed-refs is written */
+			entry->flag = REF_ISPACKED;
+			hashcpy(entry->u.value.oid.hash, update->new_sha1);
+			oidclr(&entry->u.value.peeled);
+		} else {
+			ALLOC_GROW(new_entries, new_nr + 1, new_alloc);
+			new_entries[new_nr++] = create_ref_entry(refname,
+								 update->new_sha1,
+								 REF_ISPACKED, 0);
+		}
+		update->flags |= REF_IN_PACKED_REFS;
+	}
+
+	/*
+	 * Only add the new refs once all lookups are done: adding a ref
+	 * leaves its directory unsorted, and looking up the next ref
+	 * would sort it again, which is quadratic for big transactions.
+	 */
+	for (i = 0; i < new_nr; i++)
+		add_ref(packed, new_entries[i]);
+	free(new_entries);
+
+	if (commit_packed_refs()) {
+		strbuf_addf(err, "unable to overwrite old ref-pack file: %s",
+			    strerror(errno));
+		return TRANSACTION_GENERIC_ERROR;
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+
+		if (update->flags & REF_IN_PACKED_REFS) {
+			/* the loose file name is the lockfile name minus ".lock" */
+			char *loose_filename = get_locked_file_path(update->lock->lk);
+
+			unlink_or_warn(loose_filename);
+			free(loose_filename);
+			unlock_ref(update->lock);
+			update->lock = NULL;
+		} else if (update->flags & REF_NEEDS_COMMIT) {
+			if (commit_ref_update(update->lock,
+					      update->new_sha1, update->msg)) {
+				strbuf_addf(err, "Cannot update the ref '%s'.",
+					    update->refname);
+				ret = TRANSACTION_GENERIC_ERROR;
+			}
+			/* freed by commit_ref_update(): */
+			update->lock = NULL;
+			if (ret)
+				goto cleanup;
+		}
+	}
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = updates[i];
+
+		if (update->flags & REF_DELETING) {
+			if (delete_ref_loose(update->lock, update->type, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto cleanup;
+			}
+			if (!(update->flags & REF_ISPRUNING))
+				string_list_append(&refs_to_delete,
+						   update->lock->ref_name);
+		}
+	}
+	for_each_string_list_item(ref_to_delete, &refs_to_delete)
+		unlink_or_warn(git_path("logs/%s", ref_to_delete->string));
+
+cleanup:
+	clear_loose_ref_cache(&ref_cache);
+	string_list_clear(&refs_to_delete, 0);
+	return ret;
+}
+
 int ref_transaction_commit(struct ref_transaction *transaction,
 			   struct strbuf *err)
 {
@@ -3983,6 +5335,15 @@ int ref_transaction_commit(struct ref_transaction *transaction,
 		}
 	}
 
+	if (repository_format_reftable) {
+		ret = reftable_transaction_commit(transaction, err);
+		goto cleanup;
+	}
+	if (n >= PACKED_TRANSACTION_MIN_UPDATES) {
+		ret = packed_transaction_commit(transaction, err);
+		goto cleanup;
+	}
+
 	/* Perform updates first so live commits remain referenced */
 	for (i = 0; i < n; i++) {
 		struct ref_update *update = updates[i];
@@ -4301,9 +5662,11 @@ int reflog_expire(const char *refname, const unsigned char *sha1,
 		} else if (commit_lock_file(&reflog_lock)) {
 			status |= error("unable to commit reflog '%s' (%s)",
 					log_file, strerror(errno));
-		} else if (update && commit_ref(lock)) {
+		} else if (update && commit_ref(lock, cb.last_kept_sha1)) {
 			status |= error("couldn't set %s", lock->ref_name);
 		}
+		/* the entries moved */
+		remove_path(git_path("reflog-index/%s", refname));
 	}
 	free(log_file);
 	unlock_ref(lock);
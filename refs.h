@@ -81,6 +81,12 @@ typedef int each_ref_fn(const char *refname,
 extern int head_ref(each_ref_fn, void *);
 extern int for_each_ref(each_ref_fn, void *);
 extern int for_each_ref_in(const char *, each_ref_fn, void *);
+/*
+ * Like for_each_ref_in(), but without stripping the prefix from the
+ * names passed to fn, and including broken refs if "broken" is set.
+ */
+extern int for_each_fullref_in(const char *prefix, each_ref_fn fn, void *cb_data,
+			       unsigned int broken);
 extern int for_each_tag_ref(each_ref_fn, void *);
 extern int for_each_branch_ref(each_ref_fn, void *);
 extern int for_each_remote_ref(each_ref_fn, void *);
@@ -98,6 +104,12 @@ extern int for_each_remote_ref_submodule(const char *submodule, each_ref_fn fn,
 
 extern int head_ref_namespaced(each_ref_fn fn, void *cb_data);
 extern int for_each_namespaced_ref(each_ref_fn fn, void *cb_data);
+/*
+ * Like for_each_namespaced_ref(), but only for the references whose
+ * names, with the namespace stripped, begin with prefix (which need not
+ * end at a '/'); the other references are not even looked at.
+ */
+extern int for_each_namespaced_ref_in(const char *prefix, each_ref_fn fn, void *cb_data);
 
 static inline const char *has_glob_specials(const char *pattern)
 {
@@ -179,6 +191,14 @@ extern int is_branch(const char *refname);
  */
 extern int peel_ref(const char *refname, unsigned char *sha1);
 
+/*
+ * Forget the refs of the repository read so far, so that they are read
+ * from disk again when they are next needed.  Loose refs are otherwise
+ * only read once per process, which is not good enough for processes
+ * that run for a long time.
+ */
+extern void invalidate_ref_cache(void);
+
 /*
  * Flags controlling ref_transaction_update(), ref_transaction_create(), etc.
  * REF_NODEREF: act on the ref directly, instead of dereferencing
@@ -425,4 +445,10 @@ extern int reflog_expire(const char *refname, const unsigned char *sha1,
 			 reflog_expiry_cleanup_fn cleanup_fn,
 			 void *policy_cb_data);
 
+/*
+ * Return the number of bytes currently held by cached ref entries and
+ * store the most ever held at once in *peak, if non-NULL.
+ */
+extern size_t ref_cache_memory_usage(size_t *peak);
+
 #endif /* REFS_H */
@@ -0,0 +1,961 @@
+#include "cache.h"
+#include "lockfile.h"
+#include "varint.h"
+#include "reftable.h"
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 8
+#define REFTABLE_FOOTER_SIZE 24
+#define REFTABLE_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_INDEX 'i'
+
+/* value types of the records in a ref block */
+#define REF_VALUE_DELETION 0
+#define REF_VALUE_SHA1 1
+#define REF_VALUE_PEELED 2
+
+static uint32_t get_be24(const unsigned char *p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 16;
+	p[1] = v >> 8;
+	p[2] = v;
+}
+
+static void put_be16(unsigned char *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+	put_be32(p, v >> 32);
+	put_be32(p + 4, v & 0xffffffff);
+}
+
+struct reftable {
+	char *name;
+	const unsigned char *data;
+	size_t size;
+	size_t blocks_end;	/* where the ref blocks end */
+	size_t index_offset;	/* 0 if there is no index block */
+	uintmax_t min_index, max_index;
+};
+
+static void close_table(struct reftable *t)
+{
+	munmap((void *)t->data, t->size);
+	free(t->name);
+	free(t);
+}
+
+static NORETURN void die_corrupt(const struct reftable *t)
+{
+	die("reftable %s is corrupt", t->name);
+}
+
+/*
+ * Open the table "name" in "dir".  Returns NULL with errno set if it
+ * cannot be opened (it may have been merged into another table and
+ * removed since tables.list was read).
+ */
+static struct reftable *open_table(const char *dir, const char *name)
+{
+	struct reftable *t;
+	struct stat st;
+	const unsigned char *footer;
+	char *path = xstrfmt("%s/%s", dir, name);
+	char *end;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	t = xcalloc(1, sizeof(*t));
+	t->name = xstrdup(name);
+	t->size = xsize_t(st.st_size);
+	if (t->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE)
+		die_corrupt(t);
+	t->data = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	footer = t->data + t->size - REFTABLE_FOOTER_SIZE;
+	if (get_be32(t->data) != REFTABLE_SIGNATURE ||
+	    t->data[4] != REFTABLE_VERSION ||
+	    get_be32(footer) != REFTABLE_SIGNATURE ||
+	    footer[4] != REFTABLE_VERSION ||
+	    get_be32(footer + 20) != crc32(0, footer, 20))
+		die_corrupt(t);
+
+	t->index_offset = get_be64(footer + 8);
+	t->blocks_end = t->index_offset ?
+		t->index_offset : t->size - REFTABLE_FOOTER_SIZE;
+	if (t->blocks_end < REFTABLE_HEADER_SIZE ||
+	    t->blocks_end > t->size - REFTABLE_FOOTER_SIZE)
+		die_corrupt(t);
+
+	t->min_index = strtoumax(name, &end, 16);
+	if (*end != '-')
+		die_corrupt(t);
+	t->max_index = strtoumax(end + 1, &end, 16);
+	if (strcmp(end, ".ref") || t->max_index < t->min_index)
+		die_corrupt(t);
+	return t;
+}
+
+/*
+ * Reading the records of one block.  Keys are prefix-compressed
+ * against the previous record, except at restart points, whose
+ * offsets are listed at the end of the block.
+ */
+struct block_iter {
+	const struct reftable *t;
+	const unsigned char *block;
+	size_t len;
+	size_t records_end;
+	unsigned restart_count;
+	size_t pos;
+	int peeked;
+
+	/* the current record */
+	struct strbuf key;
+	int type;
+	const unsigned char *value;
+	uintmax_t offset;
+};
+
+static void block_iter_init(struct block_iter *it, const struct reftable *t,
+			    size_t offset, int block_type)
+{
+	const unsigned char *block = t->data + offset;
+	size_t avail = t->size - REFTABLE_FOOTER_SIZE - offset;
+
+	if (avail < 6 || block[0] != block_type)
+		die_corrupt(t);
+	it->t = t;
+	it->block = block;
+	it->len = get_be24(block + 1);
+	if (it->len < 6 || it->len > avail)
+		die_corrupt(t);
+	it->restart_count = get_be16(block + it->len - 2);
+	if (4 + 3 * it->restart_count + 2 > it->len)
+		die_corrupt(t);
+	it->records_end = it->len - 2 - 3 * it->restart_count;
+	it->pos = 4;
+	it->peeked = 0;
+	strbuf_reset(&it->key);
+}
+
+static int block_iter_next(struct block_iter *it)
+{
+	const unsigned char *p, *end;
+	uintmax_t prefix, suffix;
+
+	if (it->peeked) {
+		it->peeked = 0;
+		return 0;
+	}
+	if (it->pos >= it->records_end)
+		return 1;
+
+	p = it->block + it->pos;
+	end = it->block + it->records_end;
+	prefix = decode_varint(&p);
+	suffix = decode_varint(&p);
+	it->type = suffix & 7;
+	suffix >>= 3;
+	if (prefix > it->key.len || suffix > end - p)
+		die_corrupt(it->t);
+	strbuf_setlen(&it->key, prefix);
+	strbuf_add(&it->key, p, suffix);
+	p += suffix;
+
+	if (it->block[0] == BLOCK_TYPE_INDEX) {
+		it->offset = decode_varint(&p);
+	} else {
+		it->value = p;
+		if (it->type == REF_VALUE_SHA1)
+			p += 20;
+		else if (it->type == REF_VALUE_PEELED)
+			p += 40;
+		else if (it->type != REF_VALUE_DELETION)
+			die_corrupt(it->t);
+	}
+	if (p > end)
+		die_corrupt(it->t);
+	it->pos = p - it->block;
+	return 0;
+}
+
+static size_t restart_offset(struct block_iter *it, unsigned i)
+{
+	size_t offset = get_be24(it->block + it->records_end + 3 * i);
+	if (offset < 4 || offset >= it->records_end)
+		die_corrupt(it->t);
+	return offset;
+}
+
+/*
+ * Position "it" so that the next record it returns is the first one
+ * whose key is not less than "key".
+ */
+static void block_iter_seek(struct block_iter *it, const char *key)
+{
+	unsigned lo = 0, hi = it->restart_count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		it->pos = restart_offset(it, mid);
+		strbuf_reset(&it->key);
+		it->peeked = 0;
+		if (block_iter_next(it))
+			die_corrupt(it->t);
+		if (strcmp(it->key.buf, key) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	it->pos = lo ? restart_offset(it, lo - 1) : 4;
+	it->peeked = 0;
+	strbuf_reset(&it->key);
+	while (!block_iter_next(it)) {
+		if (strcmp(it->key.buf, key) >= 0) {
+			it->peeked = 1;
+			return;
+		}
+	}
+}
+
+/* Reading the ref records of one table, across its blocks. */
+struct table_iter {
+	const struct reftable *t;
+	size_t block_offset;
+	struct block_iter bi;
+	int done;
+};
+
+#define TABLE_ITER_INIT { NULL, 0, { NULL, NULL, 0, 0, 0, 0, 0, STRBUF_INIT } }
+
+static void table_iter_start(struct table_iter *ti, const struct reftable *t,
+			     size_t offset)
+{
+	ti->t = t;
+	ti->block_offset = offset;
+	ti->done = offset >= t->blocks_end;
+	if (!ti->done)
+		block_iter_init(&ti->bi, t, offset, BLOCK_TYPE_REF);
+}
+
+static int table_iter_next(struct table_iter *ti)
+{
+	while (!ti->done) {
+		if (!block_iter_next(&ti->bi))
+			return 0;
+		table_iter_start(ti, ti->t, ti->block_offset + ti->bi.len);
+	}
+	return 1;
+}
+
+static void table_iter_seek(struct table_iter *ti, const struct reftable *t,
+			    const char *key)
+{
+	size_t offset = REFTABLE_HEADER_SIZE;
+
+	if (t->index_offset) {
+		struct block_iter idx = { NULL };
+
+		strbuf_init(&idx.key, 0);
+		block_iter_init(&idx, t, t->index_offset, BLOCK_TYPE_INDEX);
+		block_iter_seek(&idx, key);
+		if (block_iter_next(&idx))
+			offset = t->blocks_end;
+		else
+			offset = idx.offset;
+		strbuf_release(&idx.key);
+		if (offset < REFTABLE_HEADER_SIZE || offset > t->blocks_end)
+			die_corrupt(t);
+	}
+
+	table_iter_start(ti, t, offset);
+	if (!ti->done)
+		block_iter_seek(&ti->bi, key);
+}
+
+static void table_iter_release(struct table_iter *ti)
+{
+	strbuf_release(&ti->bi.key);
+}
+
+/*
+ * Reading the refs of several tables at once, in order.  Where tables
+ * have a record for the same ref, the newest (last) one wins.
+ */
+struct merged_iter {
+	struct table_iter *its;
+	int *valid;
+	int nr;
+	int keep_deletions;
+
+	struct strbuf key;
+	int type;
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+static void merged_iter_init(struct merged_iter *mi, struct reftable **tables,
+			     int nr, const char *prefix, int keep_deletions)
+{
+	int i;
+
+	mi->nr = nr;
+	mi->keep_deletions = keep_deletions;
+	mi->its = xcalloc(nr, sizeof(*mi->its));
+	mi->valid = xcalloc(nr, sizeof(*mi->valid));
+	strbuf_init(&mi->key, 0);
+	for (i = 0; i < nr; i++) {
+		strbuf_init(&mi->its[i].bi.key, 0);
+		table_iter_seek(&mi->its[i], tables[i], prefix);
+		mi->valid[i] = !table_iter_next(&mi->its[i]);
+	}
+}
+
+static int merged_iter_next(struct merged_iter *mi)
+{
+	for (;;) {
+		struct block_iter *bi;
+		int i, best = -1;
+
+		for (i = 0; i < mi->nr; i++)
+			if (mi->valid[i] &&
+			    (best < 0 ||
+			     strcmp(mi->its[i].bi.key.buf,
+				    mi->its[best].bi.key.buf) <= 0))
+				best = i;
+		if (best < 0)
+			return 1;
+
+		bi = &mi->its[best].bi;
+		strbuf_reset(&mi->key);
+		strbuf_addbuf(&mi->key, &bi->key);
+		mi->type = bi->type;
+		if (bi->type != REF_VALUE_DELETION)
+			hashcpy(mi->sha1, bi->value);
+		if (bi->type == REF_VALUE_PEELED)
+			hashcpy(mi->peeled, bi->value + 20);
+		else
+			hashclr(mi->peeled);
+
+		for (i = 0; i < mi->nr; i++)
+			if (mi->valid[i] &&
+			    !strcmp(mi->its[i].bi.key.buf, mi->key.buf))
+				mi->valid[i] = !table_iter_next(&mi->its[i]);
+
+		if (mi->type != REF_VALUE_DELETION || mi->keep_deletions)
+			return 0;
+	}
+}
+
+static void merged_iter_release(struct merged_iter *mi)
+{
+	int i;
+
+	for (i = 0; i < mi->nr; i++)
+		table_iter_release(&mi->its[i]);
+	free(mi->its);
+	free(mi->valid);
+	strbuf_release(&mi->key);
+}
+
+struct reftable_stack {
+	struct reftable_stack *next;
+	char *dir;
+	struct strbuf list;
+	struct reftable **tables;
+	int nr;
+	unsigned generation;
+};
+
+static struct reftable_stack *stacks;
+static unsigned stack_generation;
+
+static void close_tables(struct reftable **tables, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		close_table(tables[i]);
+	free(tables);
+}
+
+static void reload_stack(struct reftable_stack *stack)
+{
+	char *path = xstrfmt("%s/tables.list", stack->dir);
+	int tries;
+
+	/*
+	 * A table we are about to open may be merged away by a concurrent
+	 * writer; it then has replaced tables.list before removing it, so
+	 * reading the list again gives us a consistent set.
+	 */
+	for (tries = 0; tries < 10; tries++) {
+		struct strbuf list = STRBUF_INIT;
+		struct reftable **tables = NULL;
+		int nr = 0, alloc = 0, missing = 0;
+		const char *p, *eol;
+
+		if (strbuf_read_file(&list, path, 0) < 0 && errno != ENOENT)
+			die_errno("unable to read %s", path);
+		if (stack->generation && !strbuf_cmp(&list, &stack->list)) {
+			strbuf_release(&list);
+			free(path);
+			return;
+		}
+
+		for (p = list.buf; *p; p = eol) {
+			eol = strchrnul(p, '\n');
+			if (eol > p) {
+				char *name = xmemdupz(p, eol - p);
+				struct reftable *t = open_table(stack->dir, name);
+
+				if (!t && errno != ENOENT)
+					die_errno("unable to open reftable %s/%s",
+						  stack->dir, name);
+				free(name);
+				if (!t) {
+					missing = 1;
+					break;
+				}
+				ALLOC_GROW(tables, nr + 1, alloc);
+				tables[nr++] = t;
+			}
+			if (*eol)
+				eol++;
+		}
+		if (missing) {
+			close_tables(tables, nr);
+			strbuf_release(&list);
+			continue;
+		}
+
+		close_tables(stack->tables, stack->nr);
+		stack->tables = tables;
+		stack->nr = nr;
+		strbuf_swap(&stack->list, &list);
+		strbuf_release(&list);
+		stack->generation = ++stack_generation;
+		free(path);
+		return;
+	}
+	die("unable to read a consistent set of reftables in %s", stack->dir);
+}
+
+struct reftable_stack *reftable_stack_get(const char *dir)
+{
+	struct reftable_stack *stack;
+
+	for (stack = stacks; stack; stack = stack->next)
+		if (!strcmp(stack->dir, dir))
+			break;
+	if (!stack) {
+		stack = xcalloc(1, sizeof(*stack));
+		stack->dir = xstrdup(dir);
+		strbuf_init(&stack->list, 0);
+		stack->next = stacks;
+		stacks = stack;
+	}
+	reload_stack(stack);
+	return stack;
+}
+
+unsigned reftable_stack_generation(struct reftable_stack *stack)
+{
+	return stack->generation;
+}
+
+int reftable_read_ref(struct reftable_stack *stack, const char *refname,
+		      unsigned char *sha1, unsigned char *peeled)
+{
+	int i;
+
+	for (i = stack->nr - 1; i >= 0; i--) {
+		struct table_iter ti = TABLE_ITER_INIT;
+		int ret = 1;
+
+		table_iter_seek(&ti, stack->tables[i], refname);
+		if (!table_iter_next(&ti) && !strcmp(ti.bi.key.buf, refname)) {
+			ret = -1;
+			if (ti.bi.type != REF_VALUE_DELETION) {
+				hashcpy(sha1, ti.bi.value);
+				if (ti.bi.type == REF_VALUE_PEELED)
+					hashcpy(peeled, ti.bi.value + 20);
+				else
+					hashclr(peeled);
+				ret = 0;
+			}
+		}
+		table_iter_release(&ti);
+		if (ret <= 0)
+			return ret;
+	}
+	return -1;
+}
+
+int reftable_for_each_ref(struct reftable_stack *stack, const char *prefix,
+			  reftable_ref_fn fn, void *cb_data)
+{
+	struct merged_iter mi;
+	int ret = 0;
+
+	merged_iter_init(&mi, stack->tables, stack->nr, prefix, 0);
+	while (!merged_iter_next(&mi)) {
+		if (!starts_with(mi.key.buf, prefix))
+			break;
+		ret = fn(mi.key.buf, mi.sha1,
+			 mi.type == REF_VALUE_PEELED ? mi.peeled : NULL,
+			 cb_data);
+		if (ret)
+			break;
+	}
+	merged_iter_release(&mi);
+	return ret;
+}
+
+struct table_writer {
+	int fd;
+	uint64_t offset;
+	int block_type;
+	size_t block_size;	/* 0 for no limit */
+	struct strbuf block;
+	struct strbuf last_key;
+	uint32_t *restarts;
+	int restarts_nr, restarts_alloc;
+	int block_records;
+
+	struct index_entry {
+		char *key;
+		uint64_t offset;
+	} *index;
+	int index_nr, index_alloc;
+	uint32_t records;
+};
+
+static void encode_record(struct strbuf *out, const char *prev, const char *key,
+			  int type, const unsigned char *value, size_t len)
+{
+	unsigned char varint[16];
+	size_t prefix = 0;
+
+	while (prev[prefix] && prev[prefix] == key[prefix])
+		prefix++;
+	strbuf_add(out, varint, encode_varint(prefix, varint));
+	strbuf_add(out, varint,
+		   encode_varint(((strlen(key) - prefix) << 3) | type, varint));
+	strbuf_addstr(out, key + prefix);
+	strbuf_add(out, value, len);
+}
+
+static void writer_flush_block(struct table_writer *w)
+{
+	unsigned char buf[3];
+	int i;
+
+	if (!w->block_records)
+		return;
+	for (i = 0; i < w->restarts_nr; i++) {
+		put_be24(buf, w->restarts[i]);
+		strbuf_add(&w->block, buf, 3);
+	}
+	put_be16(buf, w->restarts_nr);
+	strbuf_add(&w->block, buf, 2);
+	if (w->block.len > 0xffffff || w->restarts_nr > 0xffff)
+		die("BUG: reftable block too large");
+	put_be24((unsigned char *)w->block.buf + 1, w->block.len);
+
+	if (w->block_type == BLOCK_TYPE_REF) {
+		ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+		w->index[w->index_nr].key = xstrdup(w->last_key.buf);
+		w->index[w->index_nr].offset = w->offset;
+		w->index_nr++;
+	}
+
+	write_or_die(w->fd, w->block.buf, w->block.len);
+	w->offset += w->block.len;
+	strbuf_reset(&w->block);
+	strbuf_reset(&w->last_key);
+	w->restarts_nr = 0;
+	w->block_records = 0;
+}
+
+static void writer_add(struct table_writer *w, const char *key, int type,
+		       const unsigned char *value, size_t len)
+{
+	struct strbuf rec = STRBUF_INIT;
+	int restart = !(w->block_records % REFTABLE_RESTART_INTERVAL);
+
+	encode_record(&rec, restart ? "" : w->last_key.buf, key, type, value, len);
+	if (w->block_size && w->block_records &&
+	    w->block.len + rec.len + 3 * (w->restarts_nr + restart) + 2 > w->block_size) {
+		writer_flush_block(w);
+		restart = 1;
+		strbuf_reset(&rec);
+		encode_record(&rec, "", key, type, value, len);
+	}
+
+	if (!w->block.len) {
+		strbuf_addch(&w->block, w->block_type);
+		strbuf_add(&w->block, "\0\0\0", 3);
+	}
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->block.len;
+	}
+	strbuf_addbuf(&w->block, &rec);
+	strbuf_reset(&w->last_key);
+	strbuf_addstr(&w->last_key, key);
+	w->block_records++;
+	strbuf_release(&rec);
+}
+
+static void writer_add_ref(struct table_writer *w, const char *refname, int type,
+			   const unsigned char *sha1, const unsigned char *peeled)
+{
+	unsigned char value[40];
+	size_t len = 0;
+
+	if (type != REF_VALUE_DELETION) {
+		hashcpy(value, sha1);
+		len = 20;
+	}
+	if (type == REF_VALUE_PEELED) {
+		hashcpy(value + 20, peeled);
+		len = 40;
+	}
+	writer_add(w, refname, type, value, len);
+	w->records++;
+}
+
+static void writer_start(struct table_writer *w, int fd)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	w->fd = fd;
+	w->block_type = BLOCK_TYPE_REF;
+	w->block_size = REFTABLE_BLOCK_SIZE;
+	strbuf_init(&w->block, 0);
+	strbuf_init(&w->last_key, 0);
+
+	put_be32(header, REFTABLE_SIGNATURE);
+	header[4] = REFTABLE_VERSION;
+	put_be24(header + 5, REFTABLE_BLOCK_SIZE);
+	write_or_die(fd, header, sizeof(header));
+	w->offset = sizeof(header);
+}
+
+static void writer_finish(struct table_writer *w)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	uint64_t index_offset = 0;
+	int i;
+
+	writer_flush_block(w);
+	if (w->index_nr > 1) {
+		index_offset = w->offset;
+		w->block_type = BLOCK_TYPE_INDEX;
+		w->block_size = 0;
+		for (i = 0; i < w->index_nr; i++) {
+			unsigned char varint[16];
+			writer_add(w, w->index[i].key, 0, varint,
+				   encode_varint(w->index[i].offset, varint));
+		}
+		writer_flush_block(w);
+	}
+
+	memset(footer, 0, sizeof(footer));
+	put_be32(footer, REFTABLE_SIGNATURE);
+	footer[4] = REFTABLE_VERSION;
+	put_be64(footer + 8, index_offset);
+	put_be32(footer + 16, w->records);
+	put_be32(footer + 20, crc32(0, footer, 20));
+	write_or_die(w->fd, footer, sizeof(footer));
+
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].key);
+	free(w->index);
+	free(w->restarts);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+}
+
+struct reftable_addition {
+	struct reftable_stack *stack;
+	int replace;
+	struct string_list updates;
+};
+
+struct ref_update_value {
+	int type;
+	unsigned char sha1[20];
+	unsigned char peeled[20];
+};
+
+struct reftable_addition *reftable_addition_begin(struct reftable_stack *stack,
+						  int replace)
+{
+	struct reftable_addition *add = xcalloc(1, sizeof(*add));
+
+	add->stack = stack;
+	add->replace = replace;
+	add->updates.strdup_strings = 1;
+	return add;
+}
+
+void reftable_add_ref(struct reftable_addition *add, const char *refname,
+		      const unsigned char *sha1, const unsigned char *peeled)
+{
+	struct ref_update_value *v = xcalloc(1, sizeof(*v));
+
+	hashcpy(v->sha1, sha1);
+	if (peeled && !is_null_sha1(peeled)) {
+		v->type = REF_VALUE_PEELED;
+		hashcpy(v->peeled, peeled);
+	} else {
+		v->type = REF_VALUE_SHA1;
+	}
+	string_list_append(&add->updates, refname)->util = v;
+}
+
+void reftable_add_deletion(struct reftable_addition *add, const char *refname)
+{
+	struct ref_update_value *v = xcalloc(1, sizeof(*v));
+
+	v->type = REF_VALUE_DELETION;
+	string_list_append(&add->updates, refname)->util = v;
+}
+
+void reftable_addition_free(struct reftable_addition *add)
+{
+	if (!add)
+		return;
+	string_list_clear(&add->updates, 1);
+	free(add);
+}
+
+static char *table_name(uintmax_t min_index, uintmax_t max_index)
+{
+	return xstrfmt("%012"PRIxMAX"-%012"PRIxMAX".ref", min_index, max_index);
+}
+
+/*
+ * Create the table "name" in "dir" from a temporary file, and hand the
+ * file descriptor to "write_fn".
+ */
+static struct reftable *write_table(const char *dir, const char *name,
+				    void (*write_fn)(struct table_writer *, void *),
+				    void *data, struct strbuf *err)
+{
+	struct table_writer w;
+	struct strbuf tmp = STRBUF_INIT;
+	char *path = xstrfmt("%s/%s", dir, name);
+	struct reftable *t = NULL;
+	int fd;
+
+	strbuf_addf(&tmp, "%s/tmp_table_XXXXXX", dir);
+	fd = git_mkstemp_mode(tmp.buf, 0444);
+	if (fd < 0) {
+		strbuf_addf(err, "unable to create '%s': %s",
+			    tmp.buf, strerror(errno));
+		goto out;
+	}
+	writer_start(&w, fd);
+	write_fn(&w, data);
+	writer_finish(&w);
+	if (close(fd) < 0 || adjust_shared_perm(tmp.buf) ||
+	    rename(tmp.buf, path) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    path, strerror(errno));
+		unlink(tmp.buf);
+		goto out;
+	}
+	t = open_table(dir, name);
+	if (!t) {
+		strbuf_addf(err, "unable to open '%s': %s",
+			    path, strerror(errno));
+		unlink(path);
+	}
+out:
+	strbuf_release(&tmp);
+	free(path);
+	return t;
+}
+
+struct addition_data {
+	struct reftable_addition *add;
+	int drop_deletions;
+};
+
+static void write_addition(struct table_writer *w, void *data)
+{
+	struct addition_data *d = data;
+	struct string_list *updates = &d->add->updates;
+	int i;
+
+	for (i = 0; i < updates->nr; i++) {
+		struct ref_update_value *v = updates->items[i].util;
+
+		if (i && !strcmp(updates->items[i - 1].string,
+				 updates->items[i].string))
+			die("BUG: ref %s added to a reftable twice",
+			    updates->items[i].string);
+		if (v->type == REF_VALUE_DELETION && d->drop_deletions)
+			continue;
+		writer_add_ref(w, updates->items[i].string, v->type,
+			       v->sha1, v->peeled);
+	}
+}
+
+struct merge_data {
+	struct reftable **tables;
+	int nr;
+	int keep_deletions;
+};
+
+static void write_merged(struct table_writer *w, void *data)
+{
+	struct merge_data *d = data;
+	struct merged_iter mi;
+
+	merged_iter_init(&mi, d->tables, d->nr, "", d->keep_deletions);
+	while (!merged_iter_next(&mi))
+		writer_add_ref(w, mi.key.buf, mi.type, mi.sha1, mi.peeled);
+	merged_iter_release(&mi);
+}
+
+int reftable_addition_commit(struct reftable_addition *add,
+			     struct lock_file *lock, struct strbuf *err)
+{
+	struct reftable_stack *stack = add->stack;
+	struct reftable **tables, *t;
+	struct string_list obsolete = STRING_LIST_INIT_DUP;
+	struct strbuf list = STRBUF_INIT;
+	struct addition_data d;
+	uintmax_t next_index;
+	char *name;
+	int i, nr, keep, ret = -1;
+
+	if (!add->replace && !add->updates.nr) {
+		rollback_lock_file(lock);
+		reftable_addition_free(add);
+		return 0;
+	}
+
+	/* we hold the lock, so nobody can change the stack under us now */
+	reload_stack(stack);
+	next_index = stack->nr ? stack->tables[stack->nr - 1]->max_index + 1 : 1;
+	string_list_sort(&add->updates);
+
+	d.add = add;
+	d.drop_deletions = add->replace || !stack->nr;
+	name = table_name(next_index, next_index);
+	t = write_table(stack->dir, name, write_addition, &d, err);
+	free(name);
+	if (!t) {
+		rollback_lock_file(lock);
+		reftable_addition_free(add);
+		return -1;
+	}
+
+	keep = add->replace ? 0 : stack->nr;
+	tables = xcalloc(keep + 1, sizeof(*tables));
+	for (i = 0; i < keep; i++)
+		tables[i] = stack->tables[i];
+	tables[keep] = t;
+	nr = keep + 1;
+	for (i = keep; i < stack->nr; i++)
+		string_list_append(&obsolete, stack->tables[i]->name);
+
+	/*
+	 * Merge the tables at the top of the stack as long as the one
+	 * below them is less than twice their size, so that the sizes
+	 * grow geometrically towards the bottom.  If that fails, we
+	 * still have the unmerged stack to commit.
+	 */
+	if (nr > 1) {
+		size_t sum = t->size;
+		int j = nr - 1;
+
+		while (j > 0 && tables[j - 1]->size < 2 * sum)
+			sum += tables[--j]->size;
+		if (j < nr - 1) {
+			struct strbuf merge_err = STRBUF_INIT;
+			struct merge_data md;
+			struct reftable *merged;
+
+			md.tables = tables + j;
+			md.nr = nr - j;
+			md.keep_deletions = j > 0;
+			name = table_name(tables[j]->min_index, t->max_index);
+			merged = write_table(stack->dir, name, write_merged, &md,
+					     &merge_err);
+			free(name);
+			if (merged) {
+				for (i = j; i < nr; i++)
+					string_list_append(&obsolete, tables[i]->name);
+				close_table(t);
+				tables[j] = t = merged;
+				nr = j + 1;
+			} else {
+				warning("%s", merge_err.buf);
+			}
+			strbuf_release(&merge_err);
+		}
+	}
+
+	for (i = 0; i < nr; i++)
+		strbuf_addf(&list, "%s\n", tables[i]->name);
+	free(tables);
+
+	if (write_in_full(lock->fd, list.buf, list.len) != list.len ||
+	    commit_lock_file(lock) < 0) {
+		strbuf_addf(err, "unable to write '%s/tables.list': %s",
+			    stack->dir, strerror(errno));
+		rollback_lock_file(lock);
+		unlink_or_warn(mkpath("%s/%s", stack->dir, t->name));
+	} else {
+		for (i = 0; i < obsolete.nr; i++)
+			unlink_or_warn(mkpath("%s/%s", stack->dir,
+					      obsolete.items[i].string));
+		ret = 0;
+	}
+	close_table(t);
+	reload_stack(stack);
+
+	string_list_clear(&obsolete, 0);
+	strbuf_release(&list);
+	reftable_addition_free(add);
+	return ret;
+}
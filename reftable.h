@@ -0,0 +1,81 @@
+#ifndef REFTABLE_H
+#define REFTABLE_H
+
+/*
+ * A reftable holds references as sorted, prefix-compressed records in
+ * blocks, followed by an index of those blocks, so that one reference
+ * can be looked up without reading the whole table.  See
+ * Documentation/technical/reftable-format.txt for the format.
+ *
+ * A repository with "extensions.refStorage = reftable" keeps its refs
+ * in a stack of such tables in $GIT_DIR/reftable instead of in
+ * packed-refs and loose files.  "tables.list" names the tables, oldest
+ * first; each table records updates and deletions on top of the ones
+ * below it.  Every change adds one small table to the top, and tables
+ * at the top are merged as soon as one would be more than half the
+ * size of the table below it, which keeps the stack short.
+ */
+
+struct lock_file;
+struct strbuf;
+
+struct reftable_stack;
+
+/*
+ * The tables in "dir" (the "reftable" directory of a repository).  The
+ * stack is kept in memory, and re-read when tables.list has changed
+ * since.
+ */
+extern struct reftable_stack *reftable_stack_get(const char *dir);
+
+/*
+ * Changes every time the stack is re-read, so that a cache built from
+ * the stack can tell that it has become stale.
+ */
+extern unsigned reftable_stack_generation(struct reftable_stack *stack);
+
+/*
+ * Look up "refname".  Returns 0 and fills "sha1" (and "peeled", if the
+ * ref peels to something else; otherwise it is cleared) if it exists,
+ * -1 if it does not.
+ */
+extern int reftable_read_ref(struct reftable_stack *stack, const char *refname,
+			     unsigned char *sha1, unsigned char *peeled);
+
+typedef int reftable_ref_fn(const char *refname, const unsigned char *sha1,
+			    const unsigned char *peeled, void *cb_data);
+
+/*
+ * Call "fn" for every ref starting with "prefix", in order, with
+ * "peeled" NULL for refs that do not peel.  Stops and returns the
+ * value "fn" returns if it is non-zero.
+ */
+extern int reftable_for_each_ref(struct reftable_stack *stack, const char *prefix,
+				 reftable_ref_fn fn, void *cb_data);
+
+/*
+ * A set of changes to be written as a new table.  With "replace", the
+ * new table replaces the whole stack and holds exactly the refs added
+ * to it.
+ */
+struct reftable_addition;
+
+extern struct reftable_addition *reftable_addition_begin(struct reftable_stack *stack,
+							 int replace);
+extern void reftable_add_ref(struct reftable_addition *add, const char *refname,
+			     const unsigned char *sha1, const unsigned char *peeled);
+extern void reftable_add_deletion(struct reftable_addition *add,
+				  const char *refname);
+
+/*
+ * Write the table, merge it with the tables below it as needed, and
+ * commit the new tables.list through "lock", which the caller must
+ * have taken on "tables.list" in the stack's directory.  Frees "add";
+ * returns -1 with a message in "err" on failure, in which case the
+ * lock is rolled back.
+ */
+extern int reftable_addition_commit(struct reftable_addition *add,
+				    struct lock_file *lock, struct strbuf *err);
+extern void reftable_addition_free(struct reftable_addition *add);
+
+#endif
@@ -11,6 +11,8 @@
 #include "argv-array.h"
 #include "credential.h"
 #include "sha1-array.h"
+#include "quote.h"
+#include "connect.h"
 
 static struct remote *remote;
 /* always ends with a trailing slash */
@@ -26,10 +28,15 @@ struct options {
 		followtags : 1,
 		dry_run : 1,
 		thin : 1,
-		push_cert : 1;
+		push_cert : 1,
+		no_dependents : 1;
+	char *filter;
 };
 static struct options options;
 static struct string_list cas_options = STRING_LIST_INIT_DUP;
+static struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+
+static const char protocol_v2_header[] = "Git-Protocol: version=2";
 
 static int set_option(const char *name, const char *value)
 {
@@ -107,6 +114,16 @@ static int set_option(const char *name, const char *value)
 		else
 			return -1;
 		return 0;
+	} else if (!strcmp(name, "ref-prefix")) {
+		struct strbuf unquoted = STRBUF_INIT;
+		if (*value == '"') {
+			if (unquote_c_style(&unquoted, value, NULL))
+				return -1;
+			value = unquoted.buf;
+		}
+		argv_array_push(&ref_prefixes, value);
+		strbuf_release(&unquoted);
+		return 0;
 	} else if (!strcmp(name, "pushcert")) {
 		if (!strcmp(value, "true"))
 			options.push_cert = 1;
@@ -115,6 +132,25 @@ static int set_option(const char *name, const char *value)
 		else
 			return -1;
 		return 0;
+	} else if (!strcmp(name, "filter")) {
+		struct strbuf unquoted = STRBUF_INIT;
+		if (*value == '"') {
+			if (unquote_c_style(&unquoted, value, NULL))
+				return -1;
+			value = unquoted.buf;
+		}
+		free(options.filter);
+		options.filter = xstrdup(value);
+		strbuf_release(&unquoted);
+		return 0;
+	} else if (!strcmp(name, "no-dependents")) {
+		if (!strcmp(value, "true"))
+			options.no_dependents = 1;
+		else if (!strcmp(value, "false"))
+			options.no_dependents = 0;
+		else
+			return -1;
+		return 0;
 	} else {
 		return 1 /* unsupported */;
 	}
@@ -128,6 +164,7 @@ struct discovery {
 	struct ref *refs;
 	struct sha1_array shallow;
 	unsigned proto_git : 1;
+	unsigned protocol_v2 : 1;
 };
 static struct discovery *last_discovery;
 
@@ -230,6 +267,76 @@ static int show_http_message(struct strbuf *type, struct strbuf *charset,
 	return 0;
 }
 
+static int run_slot(struct active_request_slot *slot,
+		    struct slot_results *results);
+
+/*
+ * Protocol v2 lists the refs on request, so ask for the ones in
+ * ref_prefixes with a POST of its own, and append the answer to the
+ * advertisement for fetch-pack to read after it.
+ */
+static void ls_refs_v2_http(struct discovery *heads, int for_push)
+{
+	struct active_request_slot *slot;
+	struct curl_slist *headers = NULL;
+	struct strbuf request = STRBUF_INIT;
+	struct strbuf result = STRBUF_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct ref *list = NULL;
+	char *service_url;
+	int err;
+
+	write_ls_refs_request(&request, &ref_prefixes);
+	service_url = xstrfmt("%s%s", url.buf, heads->service);
+	strbuf_addf(&buf, "Content-Type: application/x-%s-request",
+		    heads->service);
+	headers = curl_slist_append(headers, buf.buf);
+	strbuf_reset(&buf);
+	strbuf_addf(&buf, "Accept: application/x-%s-result", heads->service);
+	headers = curl_slist_append(headers, buf.buf);
+	headers = curl_slist_append(headers, "Expect:");
+	headers = curl_slist_append(headers, protocol_v2_header);
+
+	do {
+		strbuf_reset(&result);
+		slot = get_active_slot();
+		curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 0);
+		curl_easy_setopt(slot->curl, CURLOPT_POST, 1);
+		curl_easy_setopt(slot->curl, CURLOPT_URL, service_url);
+		curl_easy_setopt(slot->curl, CURLOPT_ENCODING, "gzip");
+		curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDS, request.buf);
+		curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDSIZE, request.len);
+		curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
+		curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
+		curl_easy_setopt(slot->curl, CURLOPT_FILE, &result);
+		if (options.verbosity > 1) {
+			fprintf(stderr, "POST %s (ls-refs)\n", heads->service);
+			fflush(stderr);
+		}
+		err = run_slot(slot, NULL);
+		if (err == HTTP_REAUTH)
+			credential_fill(&http_auth);
+	} while (err == HTTP_REAUTH);
+	if (err != HTTP_OK)
+		die("unable to list the refs of '%s'", url.buf);
+
+	read_ls_refs_v2(-1, result.buf, result.len, &list,
+			for_push ? REF_NORMAL : 0, &heads->shallow);
+	heads->refs = list;
+
+	strbuf_reset(&buf);
+	strbuf_add(&buf, heads->buf, heads->len);
+	strbuf_addbuf(&buf, &result);
+	free(heads->buf_alloc);
+	heads->buf_alloc = strbuf_detach(&buf, &heads->len);
+	heads->buf = heads->buf_alloc;
+
+	curl_slist_free_all(headers);
+	free(service_url);
+	strbuf_release(&request);
+	strbuf_release(&result);
+}
+
 static struct discovery *discover_refs(const char *service, int for_push)
 {
 	struct strbuf exp = STRBUF_INIT;
@@ -241,6 +348,7 @@ static struct discovery *discover_refs(const char *service, int for_push)
 	struct discovery *last = last_discovery;
 	int http_ret, maybe_smart = 0;
 	struct http_get_options options;
+	struct string_list extra_headers = STRING_LIST_INIT_NODUP;
 
 	if (last && !strcmp(service, last->service))
 		return last;
@@ -264,6 +372,11 @@ static struct discovery *discover_refs(const char *service, int for_push)
 	options.base_url = &url;
 	options.no_cache = 1;
 	options.keep_error = 1;
+	if (!strcmp(service, "git-upload-pack") &&
+	    get_protocol_version_config() == protocol_v2) {
+		string_list_append(&extra_headers, protocol_v2_header);
+		options.extra_headers = &extra_headers;
+	}
 
 	http_ret = http_get_strbuf(refs_url.buf, &buffer, &options);
 	switch (http_ret) {
@@ -313,9 +426,13 @@ static struct discovery *discover_refs(const char *service, int for_push)
 		last->proto_git = 1;
 	}
 
-	if (last->proto_git)
+	if (last->proto_git) {
 		last->refs = parse_git_refs(last, for_push);
-	else
+		if (server_protocol_version() == protocol_v2) {
+			last->protocol_v2 = 1;
+			ls_refs_v2_http(last, for_push);
+		}
+	} else
 		last->refs = parse_info_refs(last);
 
 	strbuf_release(&refs_url);
@@ -324,6 +441,7 @@ static struct discovery *discover_refs(const char *service, int for_push)
 	strbuf_release(&charset);
 	strbuf_release(&effective_url);
 	strbuf_release(&buffer);
+	string_list_clear(&extra_headers, 0);
 	last_discovery = last;
 	return last;
 }
@@ -369,6 +487,7 @@ struct rpc_state {
 	struct strbuf result;
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
+	unsigned protocol_v2 : 1;
 };
 
 static size_t rpc_out(void *ptr, size_t eltsize,
@@ -524,6 +643,8 @@ static int post_rpc(struct rpc_state *rpc)
 	headers = curl_slist_append(headers, rpc->hdr_accept);
 	headers = curl_slist_append(headers, needs_100_continue ?
 		"Expect: 100-continue" : "Expect:");
+	if (rpc->protocol_v2)
+		headers = curl_slist_append(headers, protocol_v2_header);
 
 retry:
 	slot = get_active_slot();
@@ -724,9 +845,9 @@ static int fetch_git(struct discovery *heads,
 {
 	struct rpc_state rpc;
 	struct strbuf preamble = STRBUF_INIT;
-	char *depth_arg = NULL;
+	char *depth_arg = NULL, *filter_arg = NULL;
 	int argc = 0, i, err;
-	const char *argv[17];
+	const char *argv[19];
 
 	argv[argc++] = "fetch-pack";
 	argv[argc++] = "--stateless-rpc";
@@ -754,6 +875,11 @@ static int fetch_git(struct discovery *heads,
 		depth_arg = strbuf_detach(&buf, NULL);
 		argv[argc++] = depth_arg;
 	}
+	if (options.filter)
+		argv[argc++] = filter_arg = xstrfmt("--filter=%s",
+						    options.filter);
+	if (options.no_dependents)
+		argv[argc++] = "--no-dependents";
 	argv[argc++] = url.buf;
 	argv[argc++] = NULL;
 
@@ -771,6 +897,7 @@ static int fetch_git(struct discovery *heads,
 	rpc.argv = argv;
 	rpc.stdin_preamble = &preamble;
 	rpc.gzip_request = 1;
+	rpc.protocol_v2 = heads->protocol_v2;
 
 	err = rpc_service(&rpc, heads);
 	if (rpc.result.len)
@@ -778,6 +905,7 @@ static int fetch_git(struct discovery *heads,
 	strbuf_release(&rpc.result);
 	strbuf_release(&preamble);
 	free(depth_arg);
+	free(filter_arg);
 	return err;
 }
 
@@ -1029,6 +1157,7 @@ int main(int argc, const char **argv)
 			printf("option\n");
 			printf("push\n");
 			printf("check-connectivity\n");
+			printf("pipeline\n");
 			printf("\n");
 			fflush(stdout);
 		} else {
@@ -8,8 +8,7 @@
 #include "tag.h"
 #include "string-list.h"
 #include "mergesort.h"
-
-enum map_direction { FROM_SRC, FROM_DST };
+#include "argv-array.h"
 
 static struct refspec s_tag_refspec = {
 	0,
@@ -884,32 +883,6 @@ static int match_name_with_pattern(const char *key, const char *name,
 	return ret;
 }
 
-static void query_refspecs_multiple(struct refspec *refs, int ref_count, struct refspec *query, struct string_list *results)
-{
-	int i;
-	int find_src = !query->src;
-
-	if (find_src && !query->dst)
-		error("query_refspecs_multiple: need either src or dst");
-
-	for (i = 0; i < ref_count; i++) {
-		struct refspec *refspec = &refs[i];
-		const char *key = find_src ? refspec->dst : refspec->src;
-		const char *value = find_src ? refspec->src : refspec->dst;
-		const char *needle = find_src ? query->dst : query->src;
-		char **result = find_src ? &query->src : &query->dst;
-
-		if (!refspec->dst)
-			continue;
-		if (refspec->pattern) {
-			if (match_name_with_pattern(key, needle, value, result))
-				string_list_append_nodup(results, *result);
-		} else if (!strcmp(needle, key)) {
-			string_list_append(results, value);
-		}
-	}
-}
-
 int query_refspecs(struct refspec *refs, int ref_count, struct refspec *query)
 {
 	int i;
@@ -955,6 +928,135 @@ char *apply_refspecs(struct refspec *refspecs, int nr_refspec,
 	return query.dst;
 }
 
+static const char *refspec_index_key(const struct refspec_index *idx,
+				     const struct refspec *rs)
+{
+	if (idx->from_dst)
+		return rs->dst ? rs->dst : rs->src;
+	return rs->src;
+}
+
+static void refspec_positions_add(struct strmap *map, const char *key, int pos)
+{
+	struct refspec_positions *p = strmap_get(map, key);
+
+	if (!p) {
+		p = xcalloc(1, sizeof(*p));
+		strmap_put(map, key, p);
+	}
+	ALLOC_GROW(p->pos, p->nr + 1, p->alloc);
+	p->pos[p->nr++] = pos;
+}
+
+void refspec_index_init(struct refspec_index *idx,
+			const struct refspec *refspecs, int nr, int from_dst)
+{
+	int i, j;
+
+	memset(idx, 0, sizeof(*idx));
+	idx->refspecs = refspecs;
+	idx->nr = nr;
+	idx->from_dst = from_dst;
+	strmap_init(&idx->exact, 0);
+	strmap_init(&idx->patterns, 1);
+	strbuf_init(&idx->buf, 0);
+
+	for (i = 0; i < nr; i++) {
+		const char *key = refspec_index_key(idx, &refspecs[i]);
+		const char *star;
+		size_t len;
+
+		if (!key || refspecs[i].matching)
+			continue;
+		if (!refspecs[i].pattern) {
+			refspec_positions_add(&idx->exact, key, i);
+			continue;
+		}
+
+		star = strchr(key, '*');
+		len = star ? star - key : strlen(key);
+		strbuf_reset(&idx->buf);
+		strbuf_add(&idx->buf, key, len);
+		refspec_positions_add(&idx->patterns, idx->buf.buf, i);
+
+		for (j = 0; j < idx->prefix_len_nr; j++)
+			if (idx->prefix_len[j] == len)
+				break;
+		if (j == idx->prefix_len_nr) {
+			ALLOC_GROW(idx->prefix_len, idx->prefix_len_nr + 1,
+				   idx->prefix_len_alloc);
+			idx->prefix_len[idx->prefix_len_nr++] = len;
+		}
+	}
+}
+
+static void free_refspec_positions(struct strmap *map)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	strmap_for_each_entry(map, &iter, e) {
+		struct refspec_positions *p = e->value;
+		free(p->pos);
+	}
+	strmap_clear(map, 1);
+}
+
+void refspec_index_clear(struct refspec_index *idx)
+{
+	free_refspec_positions(&idx->exact);
+	free_refspec_positions(&idx->patterns);
+	free(idx->prefix_len);
+	strbuf_release(&idx->buf);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+void refspec_index_lookup(struct refspec_index *idx, const char *name,
+			  struct refspec_positions *out)
+{
+	size_t namelen = strlen(name);
+	struct refspec_positions *p;
+	int i, j;
+
+	out->nr = 0;
+	p = strmap_get(&idx->exact, name);
+	if (p) {
+		ALLOC_GROW(out->pos, out->nr + p->nr, out->alloc);
+		memcpy(out->pos + out->nr, p->pos, p->nr * sizeof(*p->pos));
+		out->nr += p->nr;
+	}
+
+	for (i = 0; i < idx->prefix_len_nr; i++) {
+		size_t len = idx->prefix_len[i];
+
+		if (len > namelen)
+			continue;
+		strbuf_reset(&idx->buf);
+		strbuf_add(&idx->buf, name, len);
+		p = strmap_get(&idx->patterns, idx->buf.buf);
+		if (!p)
+			continue;
+		for (j = 0; j < p->nr; j++) {
+			const struct refspec *rs = &idx->refspecs[p->pos[j]];
+
+			/* the prefix matches; the part after '*' may not */
+			if (!match_name_with_pattern(refspec_index_key(idx, rs),
+						     name, NULL, NULL))
+				continue;
+			ALLOC_GROW(out->pos, out->nr + 1, out->alloc);
+			out->pos[out->nr++] = p->pos[j];
+		}
+	}
+
+	if (out->nr > 1)
+		qsort(out->pos, out->nr, sizeof(*out->pos), cmp_int);
+}
+
 int remote_find_tracking(struct remote *remote, struct refspec *refspec)
 {
 	return query_refspecs(remote->fetch, remote->fetch_refspec_nr, refspec);
@@ -1269,33 +1371,38 @@ static int match_explicit_refs(struct ref *src, struct ref *dst,
 	return errs;
 }
 
-static char *get_ref_match(const struct refspec *rs, int rs_nr, const struct ref *ref,
-		int send_mirror, int direction, const struct refspec **ret_pat)
+/*
+ * The refspec of pushing "matching" refs that get_ref_match() falls
+ * back to: the first one, or a later one that forces the update.
+ */
+static int find_matching_refspec(const struct refspec *rs, int rs_nr)
 {
+	int i, matching_refs = -1;
+
+	for (i = 0; i < rs_nr; i++)
+		if (rs[i].matching &&
+		    (matching_refs == -1 || rs[i].force))
+			matching_refs = i;
+	return matching_refs;
+}
+
+static char *get_ref_match(struct refspec_index *idx, int matching_refs,
+			   struct refspec_positions *matches,
+			   const struct ref *ref, int send_mirror,
+			   const struct refspec **ret_pat)
+{
+	const struct refspec *rs = idx->refspecs;
 	const struct refspec *pat;
 	char *name;
 	int i;
-	int matching_refs = -1;
-	for (i = 0; i < rs_nr; i++) {
-		if (rs[i].matching &&
-		    (matching_refs == -1 || rs[i].force)) {
-			matching_refs = i;
-			continue;
-		}
 
-		if (rs[i].pattern) {
-			const char *dst_side = rs[i].dst ? rs[i].dst : rs[i].src;
-			int match;
-			if (direction == FROM_SRC)
-				match = match_name_with_pattern(rs[i].src, ref->name, dst_side, &name);
-			else
-				match = match_name_with_pattern(dst_side, ref->name, rs[i].src, &name);
-			if (match) {
-				matching_refs = i;
-				break;
-			}
+	/* The first pattern that matches wins over "matching refs" */
+	refspec_index_lookup(idx, ref->name, matches);
+	for (i = 0; i < matches->nr; i++)
+		if (rs[matches->pos[i]].pattern) {
+			matching_refs = matches->pos[i];
+			break;
 		}
-	}
 	if (matching_refs == -1)
 		return NULL;
 
@@ -1309,6 +1416,13 @@ static char *get_ref_match(const struct refspec *rs, int rs_nr, const struct ref
 		if (!send_mirror && !starts_with(ref->name, "refs/heads/"))
 			return NULL;
 		name = xstrdup(ref->name);
+	} else {
+		const char *dst_side = pat->dst ? pat->dst : pat->src;
+
+		if (idx->from_dst)
+			match_name_with_pattern(dst_side, ref->name, pat->src, &name);
+		else
+			match_name_with_pattern(pat->src, ref->name, dst_side, &name);
 	}
 	if (ret_pat)
 		*ret_pat = pat;
@@ -1478,6 +1592,9 @@ int match_push_refs(struct ref *src, struct ref **dst,
 	static const char *default_refspec[] = { ":", NULL };
 	struct ref *ref, **dst_tail = tail_ref(dst);
 	struct string_list dst_ref_index = STRING_LIST_INIT_NODUP;
+	struct refspec_index rs_index;
+	struct refspec_positions matches = { NULL, 0, 0 };
+	int matching_refs;
 
 	if (!nr_refspec) {
 		nr_refspec = 1;
@@ -1485,6 +1602,8 @@ int match_push_refs(struct ref *src, struct ref **dst,
 	}
 	rs = parse_push_refspec(nr_refspec, (const char **) refspec);
 	errs = match_explicit_refs(src, *dst, &dst_tail, rs, nr_refspec);
+	matching_refs = find_matching_refspec(rs, nr_refspec);
+	refspec_index_init(&rs_index, rs, nr_refspec, 0);
 
 	/* pick the remainder */
 	for (ref = src; ref; ref = ref->next) {
@@ -1493,7 +1612,8 @@ int match_push_refs(struct ref *src, struct ref **dst,
 		const struct refspec *pat = NULL;
 		char *dst_name;
 
-		dst_name = get_ref_match(rs, nr_refspec, ref, send_mirror, FROM_SRC, &pat);
+		dst_name = get_ref_match(&rs_index, matching_refs, &matches,
+					 ref, send_mirror, &pat);
 		if (!dst_name)
 			continue;
 
@@ -1528,12 +1648,15 @@ int match_push_refs(struct ref *src, struct ref **dst,
 	}
 
 	string_list_clear(&dst_ref_index, 0);
+	refspec_index_clear(&rs_index);
 
 	if (flags & MATCH_REFS_FOLLOW_TAGS)
 		add_missing_tags(src, dst, &dst_tail);
 
 	if (send_prune) {
 		struct string_list src_ref_index = STRING_LIST_INIT_NODUP;
+
+		refspec_index_init(&rs_index, rs, nr_refspec, 1);
 		/* check for missing refs on the remote */
 		for (ref = *dst; ref; ref = ref->next) {
 			char *src_name;
@@ -1542,7 +1665,8 @@ int match_push_refs(struct ref *src, struct ref **dst,
 				/* We're already sending something to this ref. */
 				continue;
 
-			src_name = get_ref_match(rs, nr_refspec, ref, send_mirror, FROM_DST, NULL);
+			src_name = get_ref_match(&rs_index, matching_refs, &matches,
+						 ref, send_mirror, NULL);
 			if (src_name) {
 				if (!src_ref_index.nr)
 					prepare_ref_index(&src_ref_index, src);
@@ -1553,7 +1677,9 @@ int match_push_refs(struct ref *src, struct ref **dst,
 			}
 		}
 		string_list_clear(&src_ref_index, 0);
+		refspec_index_clear(&rs_index);
 	}
+	free(matches.pos);
 	if (errs)
 		return -1;
 	return 0;
@@ -1839,6 +1965,29 @@ static int ignore_symref_update(const char *refname)
 	return (flag & REF_ISSYMREF);
 }
 
+/*
+ * Append to *tail a copy of ref mapped through the pattern refspec,
+ * unless it does not match or would map to a local symbolic ref.
+ */
+static void expand_ref(const struct ref *ref, const struct refspec *refspec,
+		       struct ref ***tail)
+{
+	char *expn_name = NULL;
+
+	if (match_name_with_pattern(refspec->src, ref->name,
+				    refspec->dst, &expn_name) &&
+	    !ignore_symref_update(expn_name)) {
+		struct ref *cpy = copy_ref(ref);
+
+		cpy->peer_ref = alloc_ref(expn_name);
+		if (refspec->force)
+			cpy->peer_ref->force = 1;
+		**tail = cpy;
+		*tail = &cpy->next;
+	}
+	free(expn_name);
+}
+
 /*
  * Create and return a list of (struct ref) consisting of copies of
  * each remote_ref that matches refspec.  refspec must be a pattern.
@@ -1854,22 +2003,9 @@ static struct ref *get_expanded_map(const struct ref *remote_refs,
 	struct ref **tail = &ret;
 
 	for (ref = remote_refs; ref; ref = ref->next) {
-		char *expn_name = NULL;
-
 		if (strchr(ref->name, '^'))
 			continue; /* a dereference item */
-		if (match_name_with_pattern(refspec->src, ref->name,
-					    refspec->dst, &expn_name) &&
-		    !ignore_symref_update(expn_name)) {
-			struct ref *cpy = copy_ref(ref);
-
-			cpy->peer_ref = alloc_ref(expn_name);
-			if (refspec->force)
-				cpy->peer_ref->force = 1;
-			*tail = cpy;
-			tail = &cpy->next;
-		}
-		free(expn_name);
+		expand_ref(ref, refspec, &tail);
 	}
 
 	return ret;
@@ -1911,32 +2047,46 @@ static struct ref *get_local_ref(const char *name)
 	return alloc_ref_with_prefix("refs/heads/", 11, name);
 }
 
-int get_fetch_map(const struct ref *remote_refs,
-		  const struct refspec *refspec,
-		  struct ref ***tail,
-		  int missing_ok)
+void refspec_ref_prefixes(const struct refspec *refspec,
+			  struct argv_array *ref_prefixes)
 {
-	struct ref *ref_map, **rmp;
-
+	if (refspec->exact_sha1)
+		return;
 	if (refspec->pattern) {
-		ref_map = get_expanded_map(remote_refs, refspec);
-	} else {
-		const char *name = refspec->src[0] ? refspec->src : "HEAD";
+		const char *glob = strchr(refspec->src, '*');
+		argv_array_pushf(ref_prefixes, "%.*s",
+				 (int)(glob - refspec->src), refspec->src);
+	} else
+		expand_ref_prefix(ref_prefixes,
+				  refspec->src[0] ? refspec->src : "HEAD");
+}
 
-		if (refspec->exact_sha1) {
-			ref_map = alloc_ref(name);
-			get_sha1_hex(name, ref_map->old_sha1);
-		} else {
-			ref_map = get_remote_ref(remote_refs, name);
-		}
-		if (!missing_ok && !ref_map)
-			die("Couldn't find remote ref %s", name);
-		if (ref_map) {
-			ref_map->peer_ref = get_local_ref(refspec->dst);
-			if (ref_map->peer_ref && refspec->force)
-				ref_map->peer_ref->force = 1;
-		}
+static struct ref *get_single_map(const struct refspec *refspec,
+				  const struct ref *remote_ref,
+				  int missing_ok)
+{
+	const char *name = refspec->src[0] ? refspec->src : "HEAD";
+	struct ref *ref_map;
+
+	if (refspec->exact_sha1) {
+		ref_map = alloc_ref(name);
+		get_sha1_hex(name, ref_map->old_sha1);
+	} else {
+		ref_map = remote_ref ? copy_ref(remote_ref) : NULL;
+	}
+	if (!missing_ok && !ref_map)
+		die("Couldn't find remote ref %s", name);
+	if (ref_map) {
+		ref_map->peer_ref = get_local_ref(refspec->dst);
+		if (ref_map->peer_ref && refspec->force)
+			ref_map->peer_ref->force = 1;
 	}
+	return ref_map;
+}
+
+static void link_fetch_map(struct ref *ref_map, struct ref ***tail)
+{
+	struct ref **rmp;
 
 	for (rmp = &ref_map; *rmp; ) {
 		if ((*rmp)->peer_ref) {
@@ -1956,7 +2106,127 @@ int get_fetch_map(const struct ref *remote_refs,
 
 	if (ref_map)
 		tail_link_ref(ref_map, tail);
+}
+
+int get_fetch_map(const struct ref *remote_refs,
+		  const struct refspec *refspec,
+		  struct ref ***tail,
+		  int missing_ok)
+{
+	struct ref *ref_map;
+
+	if (refspec->pattern) {
+		ref_map = get_expanded_map(remote_refs, refspec);
+	} else {
+		const struct ref *ref = NULL;
+
+		if (!refspec->exact_sha1)
+			ref = find_ref_by_name_abbrev(remote_refs,
+				refspec->src[0] ? refspec->src : "HEAD");
+		ref_map = get_single_map(refspec, ref, missing_ok);
+	}
+	link_fetch_map(ref_map, tail);
+	return 0;
+}
+
+void fetch_map_index_init(struct fetch_map_index *idx,
+			  const struct ref *remote_refs,
+			  const struct refspec *refspecs, int nr)
+{
+	struct refspec_index rs_index;
+	struct refspec_positions pos = { NULL, 0, 0 };
+	const struct ref *ref;
+	int i, nr_refs = 0;
+
+	idx->remote_refs = remote_refs;
+	idx->refspecs = refspecs;
+	idx->nr = nr;
+	idx->matches = xcalloc(nr, sizeof(*idx->matches));
+
+	for (ref = remote_refs; ref; ref = ref->next)
+		nr_refs++;
+	idx->refs = xmalloc(nr_refs * sizeof(*idx->refs));
+	strmap_init(&idx->by_name, 0);
+
+	refspec_index_init(&rs_index, refspecs, nr, 0);
+	for (ref = remote_refs, nr_refs = 0; ref; ref = ref->next) {
+		idx->refs[nr_refs] = ref;
+		if (!strmap_contains(&idx->by_name, ref->name))
+			strmap_put(&idx->by_name, ref->name,
+				   &idx->refs[nr_refs]);
+		nr_refs++;
+
+		if (strchr(ref->name, '^'))
+			continue; /* a dereference item */
+		refspec_index_lookup(&rs_index, ref->name, &pos);
+		for (i = 0; i < pos.nr; i++) {
+			struct fetch_map_matches *m = &idx->matches[pos.pos[i]];
+
+			if (!refspecs[pos.pos[i]].pattern)
+				continue;
+			ALLOC_GROW(m->ref, m->nr + 1, m->alloc);
+			m->ref[m->nr++] = ref;
+		}
+	}
+	refspec_index_clear(&rs_index);
+	free(pos.pos);
+}
+
+void fetch_map_index_clear(struct fetch_map_index *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->nr; i++)
+		free(idx->matches[i].ref);
+	free(idx->matches);
+	free(idx->refs);
+	strmap_clear(&idx->by_name, 0);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Like find_ref_by_name_abbrev(): the first remote ref, in list order,
+ * that the abbreviated name can stand for.
+ */
+static const struct ref *find_indexed_ref_abbrev(struct fetch_map_index *idx,
+						  const char *name)
+{
+	struct argv_array full = ARGV_ARRAY_INIT;
+	const struct ref **found = NULL;
+	int i;
+
+	expand_ref_prefix(&full, name);
+	for (i = 0; i < full.argc; i++) {
+		const struct ref **r = strmap_get(&idx->by_name, full.argv[i]);
+		if (r && (!found || r < found))
+			found = r;
+	}
+	argv_array_clear(&full);
+	return found ? *found : NULL;
+}
+
+int get_fetch_map_indexed(struct fetch_map_index *idx, int n,
+			  struct ref ***tail, int missing_ok)
+{
+	const struct refspec *refspec = &idx->refspecs[n];
+	struct ref *ref_map = NULL;
+
+	if (refspec->pattern) {
+		struct fetch_map_matches *m = &idx->matches[n];
+		struct ref **map_tail = &ref_map;
+		int i;
 
+		for (i = 0; i < m->nr; i++)
+			expand_ref(m->ref[i], refspec, &map_tail);
+	} else {
+		const struct ref *ref = NULL;
+
+		if (!refspec->exact_sha1)
+			ref = find_indexed_ref_abbrev(idx,
+				refspec->src[0] ? refspec->src : "HEAD");
+		ref_map = get_single_map(refspec, ref, missing_ok);
+	}
+	link_fetch_map(ref_map, tail);
 	return 0;
 }
 
@@ -2066,6 +2336,9 @@ int stat_tracking_info(struct branch *branch, int *num_ours, int *num_theirs,
 		return 0;
 	}
 
+	if (!count_ahead_behind(1, &ours, 1, &theirs, num_ours, num_theirs))
+		return 0;
+
 	/* Run "rev-list --left-right ours...theirs" internally... */
 	rev_argc = 0;
 	rev_argv[rev_argc++] = NULL;
@@ -2241,7 +2514,8 @@ struct stale_heads_info {
 	struct string_list *ref_names;
 	struct ref **stale_refs_tail;
 	struct refspec *refs;
-	int ref_count;
+	struct refspec_index index;
+	struct refspec_positions matches;
 };
 
 static int get_stale_heads_cb(const char *refname, const struct object_id *oid,
@@ -2249,12 +2523,21 @@ static int get_stale_heads_cb(const char *refname, const struct object_id *oid,
 {
 	struct stale_heads_info *info = cb_data;
 	struct string_list matches = STRING_LIST_INIT_DUP;
-	struct refspec query;
 	int i, stale = 1;
-	memset(&query, 0, sizeof(struct refspec));
-	query.dst = (char *)refname;
 
-	query_refspecs_multiple(info->refs, info->ref_count, &query, &matches);
+	refspec_index_lookup(&info->index, refname, &info->matches);
+	for (i = 0; i < info->matches.nr; i++) {
+		struct refspec *refspec = &info->refs[info->matches.pos[i]];
+		char *src;
+
+		if (!refspec->dst)
+			continue;
+		if (!refspec->pattern)
+			string_list_append(&matches, refspec->src);
+		else if (match_name_with_pattern(refspec->dst, refname,
+						 refspec->src, &src))
+			string_list_append_nodup(&matches, src);
+	}
 	if (matches.nr == 0)
 		goto clean_exit; /* No matches */
 
@@ -2291,12 +2574,15 @@ struct ref *get_stale_heads(struct refspec *refs, int ref_count, struct ref *fet
 	info.ref_names = &ref_names;
 	info.stale_refs_tail = &stale_refs;
 	info.refs = refs;
-	info.ref_count = ref_count;
+	refspec_index_init(&info.index, refs, ref_count, 1);
+	memset(&info.matches, 0, sizeof(info.matches));
 	for (ref = fetch_map; ref; ref = ref->next)
 		string_list_append(&ref_names, ref->name);
 	string_list_sort(&ref_names);
 	for_each_ref(get_stale_heads_cb, &info);
 	string_list_clear(&ref_names, 0);
+	refspec_index_clear(&info.index);
+	free(info.matches.pos);
 	return stale_refs;
 }
 
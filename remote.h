@@ -3,6 +3,7 @@
 
 #include "parse-options.h"
 #include "hashmap.h"
+#include "strmap.h"
 
 enum {
 	REMOTE_CONFIG,
@@ -149,6 +150,26 @@ extern struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 				     struct sha1_array *extra_have,
 				     struct sha1_array *shallow);
 
+/*
+ * Protocol v2: a server that speaks it answers get_remote_heads() with
+ * its capabilities only (see server_protocol_version()), and lists
+ * its refs on request.  The request asks for the refs whose names
+ * begin with one of ref_prefixes (all of them if NULL or empty), with
+ * their peeled values and symref targets; ls_refs_v2() sends it over
+ * fd[1] and reads the answer from fd[0], while read_ls_refs_v2() reads
+ * an answer obtained otherwise, like get_remote_heads() does the
+ * advertisement.  Peeled values come back as "<name>^{}" refs.
+ */
+struct argv_array;
+extern void write_ls_refs_request(struct strbuf *req,
+				  const struct argv_array *ref_prefixes);
+extern struct ref **read_ls_refs_v2(int in, char *src_buf, size_t src_len,
+				    struct ref **list, unsigned int flags,
+				    struct sha1_array *shallow);
+extern struct ref **ls_refs_v2(int fd[2], struct ref **list, unsigned int flags,
+			       const struct argv_array *ref_prefixes,
+			       struct sha1_array *shallow);
+
 int resolve_remote_symref(struct ref *ref, struct ref *list);
 int ref_newer(const unsigned char *new_sha1, const unsigned char *old_sha1);
 
@@ -170,6 +191,43 @@ extern int query_refspecs(struct refspec *specs, int nr, struct refspec *query);
 char *apply_refspecs(struct refspec *refspecs, int nr_refspec,
 		     const char *name);
 
+/*
+ * An index of an array of refspecs by the names they match, so that
+ * finding the refspecs that match a ref costs a few hash lookups
+ * instead of a match attempt per refspec.  The key side is the source,
+ * or with from_dst the destination (the source if there is none).
+ * Exact keys are hashed whole and patterns by the part before the '*';
+ * a lookup tries one prefix of the name per distinct pattern prefix
+ * length.
+ */
+struct refspec_positions {
+	int *pos;
+	int nr, alloc;
+};
+
+struct refspec_index {
+	const struct refspec *refspecs;
+	int nr;
+	unsigned from_dst : 1;
+	struct strmap exact;
+	struct strmap patterns;
+	size_t *prefix_len;
+	int prefix_len_nr, prefix_len_alloc;
+	struct strbuf buf;
+};
+
+void refspec_index_init(struct refspec_index *idx,
+			const struct refspec *refspecs, int nr, int from_dst);
+void refspec_index_clear(struct refspec_index *idx);
+
+/*
+ * Fill "out" with the positions of the refspecs whose key side matches
+ * name, in increasing order.  Refspecs of pushing "matching" refs are
+ * not in the index.
+ */
+void refspec_index_lookup(struct refspec_index *idx, const char *name,
+			  struct refspec_positions *out);
+
 int check_push_refs(struct ref *src, int nr_refspec, const char **refspec);
 int match_push_refs(struct ref *src, struct ref **dst,
 		    int nr_refspec, const char **refspec, int all);
@@ -191,6 +249,40 @@ void set_ref_status_for_push(struct ref *remote_refs, int send_mirror,
 int get_fetch_map(const struct ref *remote_refs, const struct refspec *refspec,
 		  struct ref ***tail, int missing_ok);
 
+/*
+ * Calling get_fetch_map() for each of many refspecs walks all remote
+ * refs each time.  A fetch_map_index matches every remote ref against
+ * the refspecs once, up front; get_fetch_map_indexed(idx, n, ...) then
+ * gives the same result as get_fetch_map() for the n-th refspec.
+ */
+struct fetch_map_index {
+	const struct ref *remote_refs;
+	const struct refspec *refspecs;
+	int nr;
+	/* for each pattern refspec, the remote refs it matches, in order */
+	struct fetch_map_matches {
+		const struct ref **ref;
+		int nr, alloc;
+	} *matches;
+	/* the remote refs in order, and their positions there by name */
+	const struct ref **refs;
+	struct strmap by_name;
+};
+
+void fetch_map_index_init(struct fetch_map_index *idx,
+			  const struct ref *remote_refs,
+			  const struct refspec *refspecs, int nr);
+void fetch_map_index_clear(struct fetch_map_index *idx);
+int get_fetch_map_indexed(struct fetch_map_index *idx, int n,
+			  struct ref ***tail, int missing_ok);
+
+/*
+ * Add to ref_prefixes what the remote refs that get_fetch_map() could
+ * match for refspec begin with; nothing for an exact sha1.
+ */
+void refspec_ref_prefixes(const struct refspec *refspec,
+			  struct argv_array *ref_prefixes);
+
 struct ref *get_remote_ref(const struct ref *remote_refs, const char *name);
 
 /*
@@ -0,0 +1,87 @@
+#include "cache.h"
+#include "append-cache.h"
+#include "rename-cache.h"
+
+/*
+ * The value for each key is a "dst:src:score" triplet for each pair
+ * found, separated by single spaces.
+ */
+
+static struct append_cache rename_cache;
+
+static int parse_rename_cache_pair(const char *p, const char *end,
+				   struct rename_cache_pair *pair)
+{
+	char buf[64], c;
+
+	if (end - p >= sizeof(buf))
+		return -1;
+	memcpy(buf, p, end - p);
+	buf[end - p] = '\0';
+	if (sscanf(buf, "%d:%d:%d%c",
+		   &pair->dst, &pair->src, &pair->score, &c) != 3)
+		return -1;
+	return 0;
+}
+
+static int prepare_rename_cache(void)
+{
+	static int prepared, enabled;
+	char *path;
+
+	if (prepared)
+		return enabled;
+	prepared = 1;
+
+	if (git_config_get_bool("diff.renamecache", &enabled) || !enabled)
+		return enabled = 0;
+
+	path = xstrfmt("%s/info/rename-cache", get_object_directory());
+	append_cache_init(&rename_cache, path, "rename cache version 1");
+	free(path);
+	return enabled;
+}
+
+int rename_cache_lookup(const unsigned char *key,
+			struct rename_cache_pair **pairs, int *nr)
+{
+	const char *value, *next;
+	int alloc = 0;
+
+	if (!prepare_rename_cache())
+		return 0;
+	value = append_cache_get(&rename_cache, sha1_to_hex(key));
+	if (!value)
+		return 0;
+
+	*pairs = NULL;
+	*nr = 0;
+	for (; *value; value = next) {
+		next = strchrnul(value, ' ');
+		ALLOC_GROW(*pairs, *nr + 1, alloc);
+		if (parse_rename_cache_pair(value, next, &(*pairs)[*nr])) {
+			free(*pairs);
+			return 0;
+		}
+		(*nr)++;
+		if (*next)
+			next++;
+	}
+	return 1;
+}
+
+void rename_cache_store(const unsigned char *key,
+			const struct rename_cache_pair *pairs, int nr)
+{
+	struct strbuf value = STRBUF_INIT;
+	int i;
+
+	if (!prepare_rename_cache())
+		return;
+
+	for (i = 0; i < nr; i++)
+		strbuf_addf(&value, "%s%d:%d:%d", i ? " " : "",
+			    pairs[i].dst, pairs[i].src, pairs[i].score);
+	append_cache_put(&rename_cache, sha1_to_hex(key), value.buf);
+	strbuf_release(&value);
+}
@@ -0,0 +1,31 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+/*
+ * With diff.renameCache, the renames and copies that inexact rename
+ * detection finds are remembered in
+ * $GIT_OBJECT_DIRECTORY/info/rename-cache, so that detecting renames
+ * between the same sets of files again (the same two trees in a
+ * merge, "log -M" run over the same history, "status" against the
+ * same HEAD) does not compare their contents again.  The key, which
+ * diffcore_rename() computes, names everything the result depends on:
+ * the sources and destinations left over after exact renames, with
+ * their paths, modes and blob names, and the options in effect.
+ */
+
+struct rename_cache_pair {
+	int dst, src, score;
+};
+
+/*
+ * If the result for "key" is known, set "*pairs" to a new array of
+ * its "*nr" pairs and return 1; otherwise return 0.
+ */
+extern int rename_cache_lookup(const unsigned char *key,
+			       struct rename_cache_pair **pairs, int *nr);
+
+/* Remember "pairs" as the result for "key". */
+extern void rename_cache_store(const unsigned char *key,
+			       const struct rename_cache_pair *pairs, int nr);
+
+#endif
@@ -1,54 +1,64 @@
 #include "cache.h"
-#include "sha1-lookup.h"
+#include "khash.h"
 #include "refs.h"
 #include "commit.h"
 
 /*
- * An array of replacements.  The array is kept sorted by the original
- * sha1.
+ * The replacements, hashed by the original sha1.  Nearly every object
+ * read asks for a replacement, and nearly always there is none, so a
+ * filter of one bit per value of the first 16 bits of a sha1 answers
+ * most lookups before the hash table is probed at all.
  */
-static struct replace_object {
+struct replace_object {
 	unsigned char original[20];
 	unsigned char replacement[20];
-} **replace_object;
+};
 
-static int replace_object_alloc, replace_object_nr;
+static kh_sha1_t *replace_map;
 
-static const unsigned char *replace_sha1_access(size_t index, void *table)
+#define REPLACE_FILTER_BITS (1 << 16)
+static uint32_t replace_filter[REPLACE_FILTER_BITS / 32];
+
+static inline unsigned replace_filter_pos(const unsigned char *sha1)
 {
-	struct replace_object **replace = table;
-	return replace[index]->original;
+	return (sha1[0] << 8) | sha1[1];
 }
 
-static int replace_object_pos(const unsigned char *sha1)
+static struct replace_object *find_replace_object(const unsigned char *sha1)
 {
-	return sha1_pos(sha1, replace_object, replace_object_nr,
-			replace_sha1_access);
+	unsigned pos = replace_filter_pos(sha1);
+	khiter_t it;
+
+	if (!(replace_filter[pos / 32] & (1u << (pos % 32))))
+		return NULL;
+	it = kh_get_sha1(replace_map, sha1);
+	if (it == kh_end(replace_map))
+		return NULL;
+	return kh_value(replace_map, it);
 }
 
 static int register_replace_object(struct replace_object *replace,
 				   int ignore_dups)
 {
-	int pos = replace_object_pos(replace->original);
-
-	if (0 <= pos) {
+	unsigned pos = replace_filter_pos(replace->original);
+	khiter_t it;
+	int added;
+
+	if (!replace_map)
+		replace_map = kh_init_sha1();
+	it = kh_put_sha1(replace_map, replace->original, &added);
+	if (!added) {
 		if (ignore_dups)
 			free(replace);
 		else {
-			free(replace_object[pos]);
-			replace_object[pos] = replace;
+			free(kh_value(replace_map, it));
+			kh_key(replace_map, it) = replace->original;
+			kh_value(replace_map, it) = replace;
 		}
 		return 1;
 	}
-	pos = -pos - 1;
-	ALLOC_GROW(replace_object, replace_object_nr + 1, replace_object_alloc);
-	replace_object_nr++;
-	if (pos < replace_object_nr)
-		memmove(replace_object + pos + 1,
-			replace_object + pos,
-			(replace_object_nr - pos - 1) *
-			sizeof(*replace_object));
-	replace_object[pos] = replace;
+	kh_value(replace_map, it) = replace;
+	replace_filter[pos / 32] |= 1u << (pos % 32);
 	return 0;
 }
 
@@ -84,10 +94,15 @@ static void prepare_replace_object(void)
 	if (replace_object_prepared)
 		return;
 
-	for_each_replace_ref(register_replace_ref, NULL);
-	replace_object_prepared = 1;
-	if (!replace_object_nr)
-		check_replace_refs = 0;
+	/* threads reading objects may all get here for the first time */
+	obj_read_lock();
+	if (!replace_object_prepared) {
+		for_each_replace_ref(register_replace_ref, NULL);
+		replace_object_prepared = 1;
+		if (!replace_map || !kh_size(replace_map))
+			check_replace_refs = 0;
+	}
+	obj_read_unlock();
 }
 
 /* We allow "recursive" replacement. Only within reason, though */
@@ -102,8 +117,9 @@ static void prepare_replace_object(void)
  */
 const unsigned char *do_lookup_replace_object(const unsigned char *sha1)
 {
-	int pos, depth = MAXREPLACEDEPTH;
+	int depth = MAXREPLACEDEPTH;
 	const unsigned char *cur = sha1;
+	struct replace_object *repl;
 
 	prepare_replace_object();
 
@@ -113,10 +129,10 @@ const unsigned char *do_lookup_replace_object(const unsigned char *sha1)
 			die("replace depth too high for object %s",
 			    sha1_to_hex(sha1));
 
-		pos = replace_object_pos(cur);
-		if (0 <= pos)
-			cur = replace_object[pos]->replacement;
-	} while (0 <= pos);
+		repl = find_replace_object(cur);
+		if (repl)
+			cur = repl->replacement;
+	} while (repl);
 
 	return cur;
 }
@@ -102,13 +102,16 @@ static inline void ferr_puts(const char *s, FILE *fp, int *err)
 struct rerere_io {
 	int (*getline)(struct strbuf *, struct rerere_io *);
 	FILE *output;
+	struct strbuf *output_buf;	/* used instead of "output" if set */
 	int wrerror;
 	/* some more stuff */
 };
 
 static void rerere_io_putstr(const char *str, struct rerere_io *io)
 {
-	if (io->output)
+	if (io->output_buf)
+		strbuf_addstr(io->output_buf, str);
+	else if (io->output)
 		ferr_puts(str, io->output, &io->wrerror);
 }
 
@@ -136,7 +139,9 @@ static void rerere_io_putconflict(int ch, int size, struct rerere_io *io)
 
 static void rerere_io_putmem(const char *mem, size_t sz, struct rerere_io *io)
 {
-	if (io->output)
+	if (io->output_buf)
+		strbuf_add(io->output_buf, mem, sz);
+	else if (io->output)
 		ferr_write(mem, sz, io->output, &io->wrerror);
 }
 
@@ -272,28 +277,172 @@ static int handle_file(const char *path, unsigned char *sha1, const char *output
 	return hunk_no;
 }
 
+/*
+ * A path that has newly become conflicted.  Its conflict hunks are
+ * normalized into "image" and hashed into "sha1", and the image is
+ * then written out as the preimage from memory, so that the path is
+ * read only once.
+ */
+struct rerere_preimage {
+	struct hashmap_entry ent;	/* keyed by sha1 */
+	const char *path;
+	char *dir;		/* rr-cache/<sha1>, if we are to record it */
+	int marker_size;
+	int hunk_no;		/* from handle_path(), or -1 */
+	int unreadable;
+	int write_error;
+	unsigned char sha1[20];
+	struct strbuf image;
+};
+
+static int preimage_cmp(const struct rerere_preimage *a,
+			const struct rerere_preimage *b, const void *unused)
+{
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static void normalize_preimage(struct rerere_preimage *pre)
+{
+	struct rerere_io_file io;
+
+	memset(&io, 0, sizeof(io));
+	io.io.getline = rerere_file_getline;
+	io.io.output_buf = &pre->image;
+	io.input = fopen(pre->path, "r");
+	if (!io.input) {
+		pre->unreadable = 1;
+		pre->hunk_no = -1;
+		return;
+	}
+	pre->hunk_no = handle_path(pre->sha1, (struct rerere_io *)&io,
+				   pre->marker_size);
+	fclose(io.input);
+}
+
+/*
+ * Create the directory for the conflict and write its preimage;
+ * errors are left for the caller to report, as this may run in a
+ * thread.
+ */
+static void record_preimage(struct rerere_preimage *pre)
+{
+	struct strbuf path = STRBUF_INIT;
+	FILE *f;
+
+	if (!pre->dir)
+		return;
+	if (mkdir_in_gitdir(pre->dir)) {
+		/* already there, or unwritable */
+		free(pre->dir);
+		pre->dir = NULL;
+		return;
+	}
+	strbuf_addf(&path, "%s/preimage", pre->dir);
+	f = fopen(path.buf, "w");
+	if (!f)
+		pre->write_error = 1;
+	else {
+		if (pre->image.len &&
+		    fwrite(pre->image.buf, pre->image.len, 1, f) != 1)
+			pre->write_error = 1;
+		if (fclose(f))
+			pre->write_error = 1;
+	}
+	strbuf_release(&path);
+}
+
+typedef void (*preimage_fn)(struct rerere_preimage *);
+
+#ifdef NO_PTHREADS
+static void for_each_preimage(struct rerere_preimage *pre, int nr,
+			      preimage_fn fn)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		fn(&pre[i]);
+}
+#else
+
+#include <pthread.h>
+
+/*
+ * Reading the conflicted files and creating their preimages is
+ * mostly waiting for the filesystem, so it pays to have a few
+ * threads at it even on a single core.
+ */
+#define MAX_PREIMAGE_THREADS (8)
+#define PATHS_PER_THREAD (64)
+
+struct preimage_thread {
+	pthread_t pthread;
+	struct rerere_preimage *pre;
+	int nr, step;
+	preimage_fn fn;
+};
+
+static void *run_preimage_thread(void *data)
+{
+	struct preimage_thread *p = data;
+	int i;
+
+	for (i = 0; i < p->nr; i += p->step)
+		p->fn(&p->pre[i]);
+	return NULL;
+}
+
+static void for_each_preimage(struct rerere_preimage *pre, int nr,
+			      preimage_fn fn)
+{
+	struct preimage_thread data[MAX_PREIMAGE_THREADS];
+	int i, threads = nr / PATHS_PER_THREAD;
+
+	if (threads > MAX_PREIMAGE_THREADS)
+		threads = MAX_PREIMAGE_THREADS;
+	if (threads < 2) {
+		for (i = 0; i < nr; i++)
+			fn(&pre[i]);
+		return;
+	}
+	for (i = 0; i < threads; i++) {
+		struct preimage_thread *p = &data[i];
+		p->pre = pre + i;
+		p->nr = nr - i;
+		p->step = threads;
+		p->fn = fn;
+		if (pthread_create(&p->pthread, NULL, run_preimage_thread, p))
+			die("unable to create threaded rerere");
+	}
+	for (i = 0; i < threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join threaded rerere");
+}
+#endif
+
 struct rerere_io_mem {
 	struct rerere_io io;
 	struct strbuf input;
+	size_t pos;
 };
 
 static int rerere_mem_getline(struct strbuf *sb, struct rerere_io *io_)
 {
 	struct rerere_io_mem *io = (struct rerere_io_mem *)io_;
-	char *ep;
+	char *bp, *ep;
 	size_t len;
 
-	strbuf_release(sb);
-	if (!io->input.len)
+	strbuf_reset(sb);
+	if (io->pos >= io->input.len)
 		return -1;
-	ep = memchr(io->input.buf, '\n', io->input.len);
+	bp = io->input.buf + io->pos;
+	ep = memchr(bp, '\n', io->input.len - io->pos);
 	if (!ep)
 		ep = io->input.buf + io->input.len;
 	else if (*ep == '\n')
 		ep++;
-	len = ep - io->input.buf;
-	strbuf_add(sb, io->input.buf, len);
-	strbuf_remove(&io->input, 0, len);
+	len = ep - bp;
+	strbuf_add(sb, bp, len);
+	io->pos += len;
 	return 0;
 }
 
@@ -500,7 +649,10 @@ static int do_plain_rerere(struct string_list *rr, int fd)
 {
 	struct string_list conflict = STRING_LIST_INIT_DUP;
 	struct string_list update = STRING_LIST_INIT_DUP;
-	int i;
+	struct string_list recorded = STRING_LIST_INIT_NODUP;
+	struct rerere_preimage *pre = NULL;
+	struct hashmap seen;
+	int i, pre_nr = 0, pre_alloc = 0;
 
 	find_conflict(&conflict);
 
@@ -513,21 +665,59 @@ static int do_plain_rerere(struct string_list *rr, int fd)
 
 	for (i = 0; i < conflict.nr; i++) {
 		const char *path = conflict.items[i].string;
-		if (!string_list_has_string(rr, path)) {
-			unsigned char sha1[20];
-			char *hex;
-			int ret;
-			ret = handle_file(path, sha1, NULL);
-			if (ret < 1)
-				continue;
-			hex = xstrdup(sha1_to_hex(sha1));
-			string_list_insert(rr, path)->util = hex;
-			if (mkdir_in_gitdir(git_path("rr-cache/%s", hex)))
-				continue;
-			handle_file(path, NULL, rerere_path(hex, "preimage"));
+		if (string_list_has_string(rr, path))
+			continue;
+		ALLOC_GROW(pre, pre_nr + 1, pre_alloc);
+		memset(&pre[pre_nr], 0, sizeof(*pre));
+		pre[pre_nr].path = path;
+		pre[pre_nr].marker_size = ll_merge_marker_size(path);
+		strbuf_init(&pre[pre_nr].image, 0);
+		pre_nr++;
+	}
+	for_each_preimage(pre, pre_nr, normalize_preimage);
+
+	/*
+	 * Paths with the same conflict share its rr-cache entry; the
+	 * first of them gets to record the preimage.
+	 */
+	hashmap_init(&seen, (hashmap_cmp_fn)preimage_cmp, pre_nr);
+	for (i = 0; i < pre_nr; i++) {
+		if (pre[i].unreadable)
+			error("Could not open %s", pre[i].path);
+		else if (pre[i].hunk_no < 0)
+			error("Could not parse conflict hunks in %s",
+			      pre[i].path);
+		if (pre[i].hunk_no < 1)
+			continue;
+		hashmap_entry_init(&pre[i], sha1hash(pre[i].sha1));
+		if (hashmap_get(&seen, &pre[i], NULL))
+			continue;
+		hashmap_add(&seen, &pre[i]);
+		pre[i].dir = xstrdup(git_path("rr-cache/%s",
+					      sha1_to_hex(pre[i].sha1)));
+	}
+	hashmap_free(&seen, 0);
+	for_each_preimage(pre, pre_nr, record_preimage);
+
+	for (i = 0; i < pre_nr; i++) {
+		const char *path = pre[i].path;
+
+		if (pre[i].hunk_no >= 1)
+			string_list_insert(rr, path)->util =
+				xstrdup(sha1_to_hex(pre[i].sha1));
+		if (pre[i].dir) {
+			if (pre[i].write_error)
+				error("Could not write %s/preimage",
+				      pre[i].dir);
+			else
+				/* no resolution can be there yet */
+				string_list_append(&recorded, path);
 			fprintf(stderr, "Recorded preimage for '%s'\n", path);
 		}
+		free(pre[i].dir);
+		strbuf_release(&pre[i].image);
 	}
+	free(pre);
 
 	/*
 	 * Now some of the paths that had conflicts earlier might have been
@@ -540,6 +730,10 @@ static int do_plain_rerere(struct string_list *rr, int fd)
 		const char *path = rr->items[i].string;
 		const char *name = (const char *)rr->items[i].util;
 
+		/* We have just seen it still has conflicts. */
+		if (string_list_has_string(&recorded, path))
+			continue;
+
 		if (has_rerere_resolution(name)) {
 			if (!merge(name, path)) {
 				const char *msg;
@@ -566,6 +760,7 @@ static int do_plain_rerere(struct string_list *rr, int fd)
 
 	if (update.nr)
 		update_paths(&update);
+	string_list_clear(&recorded, 0);
 
 	return write_rr(rr, fd);
 }
@@ -8,6 +8,7 @@
 #include "revision.h"
 #include "graph.h"
 #include "grep.h"
+#include "grep-pipeline.h"
 #include "reflog-walk.h"
 #include "patch-ids.h"
 #include "decorate.h"
@@ -18,6 +19,9 @@
 #include "commit-slab.h"
 #include "dir.h"
 #include "cache-tree.h"
+#include "bloom.h"
+#include "commit-graph.h"
+#include "prio-queue.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -345,10 +349,10 @@ static struct commit *handle_commit(struct rev_info *revs,
 	die("%s is unknown object", name);
 }
 
-static int everybody_uninteresting(struct commit_list *orig,
+static int everybody_uninteresting(struct commit_queue *queue,
 				   struct commit **interesting_cache)
 {
-	struct commit_list *list = orig;
+	int i;
 
 	if (*interesting_cache) {
 		struct commit *commit = *interesting_cache;
@@ -356,9 +360,8 @@ static int everybody_uninteresting(struct commit_list *orig,
 			return 0;
 	}
 
-	while (list) {
-		struct commit *commit = list->item;
-		list = list->next;
+	for (i = 0; i < queue->nr; i++) {
+		struct commit *commit = queue->array[i].commit;
 		if (commit->object.flags & UNINTERESTING)
 			continue;
 		if (interesting_cache)
@@ -478,11 +481,97 @@ static void file_change(struct diff_options *options,
 	DIFF_OPT_SET(options, HAS_CHANGES);
 }
 
+static struct trace_key trace_changed_paths = TRACE_KEY_INIT(CHANGED_PATHS);
+
+/*
+ * Prepare the keys to look up the pathspec in changed-path filters.
+ * Only literal paths can be looked up; a filter records a change to
+ * "a/b/c" as changes to "a/b/c", "a/b" and "a", so every leading
+ * directory of an item gives another chance to rule it out.
+ */
+static void prepare_to_use_bloom_filters(struct rev_info *revs)
+{
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	int i, keys_alloc = 0, items_alloc = 0;
+
+	if (!revs->prune || !revs->prune_data.nr || !core_commit_graph ||
+	    revs->bloom_keys_nr)
+		return;
+	for (i = 0; i < revs->prune_data.nr; i++) {
+		const struct pathspec_item *item = &revs->prune_data.items[i];
+		const char *p = item->match;
+
+		if ((item->magic & ~(PATHSPEC_FROMTOP | PATHSPEC_LITERAL)) ||
+		    item->nowildcard_len < item->len)
+			return;
+		/* an item that matches everything cannot be ruled out */
+		while (*p == '/')
+			p++;
+		if (!*p)
+			return;
+	}
+
+	for (i = 0; i < revs->prune_data.nr; i++) {
+		const char *path = revs->prune_data.items[i].match;
+		int len = revs->prune_data.items[i].len;
+
+		while (len && path[len - 1] == '/')
+			len--;
+		while (len) {
+			ALLOC_GROW(revs->bloom_keys, revs->bloom_keys_nr + 1,
+				   keys_alloc);
+			ALLOC_GROW(revs->bloom_key_item, revs->bloom_keys_nr + 1,
+				   items_alloc);
+			fill_bloom_key(path, len, &revs->bloom_keys[revs->bloom_keys_nr],
+				       &settings);
+			revs->bloom_key_item[revs->bloom_keys_nr++] = i;
+			while (len && path[--len] != '/')
+				;
+		}
+	}
+}
+
+/*
+ * Can the changed-path filter of "commit" tell that it touches none of
+ * the pathspec relative to "parent", its first parent?
+ */
+static int bloom_filter_says_treesame(struct rev_info *revs,
+				      struct commit *parent,
+				      struct commit *commit)
+{
+	struct bloom_filter_settings defaults = DEFAULT_BLOOM_FILTER_SETTINGS;
+	const struct bloom_filter_settings *settings;
+	struct bloom_filter filter;
+	int i, item = -1, maybe = 0;
+
+	settings = get_changed_paths_filter(commit, parent, &filter);
+	if (!settings || settings->num_hashes != defaults.num_hashes)
+		return 0;
+
+	for (i = 0; i < revs->bloom_keys_nr; i++) {
+		if (revs->bloom_key_item[i] != item) {
+			if (maybe)
+				return 0;
+			item = revs->bloom_key_item[i];
+			maybe = 1;
+		}
+		if (maybe &&
+		    !bloom_filter_contains(&filter, &revs->bloom_keys[i], settings))
+			maybe = 0;
+	}
+	if (maybe)
+		return 0;
+	trace_printf_key(&trace_changed_paths, "definitely treesame: %s\n",
+			 sha1_to_hex(commit->object.sha1));
+	return 1;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
-	struct tree *t1 = parent->tree;
-	struct tree *t2 = commit->tree;
+	struct tree *t1 = get_commit_tree(parent);
+	struct tree *t2 = get_commit_tree(commit);
 
 	if (!t1)
 		return REV_TREE_NEW;
@@ -507,6 +596,10 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	if (revs->bloom_keys_nr && !nth_parent &&
+	    bloom_filter_says_treesame(revs, parent, commit))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.sha1, t2->object.sha1, "",
@@ -518,7 +611,7 @@ static int rev_compare_tree(struct rev_info *revs,
 static int rev_same_tree_as_empty(struct rev_info *revs, struct commit *commit)
 {
 	int retval;
-	struct tree *t1 = commit->tree;
+	struct tree *t1 = get_commit_tree(commit);
 
 	if (!t1)
 		return 0;
@@ -656,7 +749,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 	if (!revs->prune)
 		return;
 
-	if (!commit->tree)
+	if (!get_commit_tree(commit))
 		return;
 
 	if (!commit->parents) {
@@ -709,7 +802,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    sha1_to_hex(commit->object.sha1),
 			    sha1_to_hex(p->object.sha1));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -770,26 +863,11 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 		commit->object.flags |= TREESAME;
 }
 
-static void commit_list_insert_by_date_cached(struct commit *p, struct commit_list **head,
-		    struct commit_list *cached_base, struct commit_list **cache)
-{
-	struct commit_list *new_entry;
-
-	if (cached_base && p->date < cached_base->item->date)
-		new_entry = commit_list_insert_by_date(p, &cached_base->next);
-	else
-		new_entry = commit_list_insert_by_date(p, head);
-
-	if (cache && (!*cache || p->date < (*cache)->item->date))
-		*cache = new_entry;
-}
-
 static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
-		    struct commit_list **list, struct commit_list **cache_ptr)
+			       struct commit_queue *queue)
 {
 	struct commit_list *parent = commit->parents;
 	unsigned left_flag;
-	struct commit_list *cached_base = cache_ptr ? *cache_ptr : NULL;
 
 	if (commit->object.flags & ADDED)
 		return 0;
@@ -824,7 +902,8 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 			if (p->object.flags & SEEN)
 				continue;
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (queue)
+				commit_queue_put(queue, p);
 		}
 		return 0;
 	}
@@ -851,7 +930,8 @@ static int add_parents_to_list(struct rev_info *revs, struct commit *commit,
 		p->object.flags |= left_flag;
 		if (!(p->object.flags & SEEN)) {
 			p->object.flags |= SEEN;
-			commit_list_insert_by_date_cached(p, list, cached_base, cache_ptr);
+			if (queue)
+				commit_queue_put(queue, p);
 		}
 		if (revs->first_parent_only)
 			break;
@@ -950,20 +1030,20 @@ static void cherry_pick_list(struct commit_list *list, struct rev_info *revs)
 /* How many extra uninteresting commits we want to see.. */
 #define SLOP 5
 
-static int still_interesting(struct commit_list *src, unsigned long date, int slop,
+static int still_interesting(struct commit_queue *src, unsigned long date, int slop,
 			     struct commit **interesting_cache)
 {
 	/*
 	 * No source list at all? We're definitely done..
 	 */
-	if (!src)
+	if (!src->nr)
 		return 0;
 
 	/*
 	 * Does the destination list contain entries with a date
 	 * before the source list? Definitely _not_ done.
 	 */
-	if (date <= src->item->date)
+	if (date <= commit_queue_peek(src)->date)
 		return SLOP;
 
 	/*
@@ -1085,44 +1165,46 @@ static int limit_list(struct rev_info *revs)
 {
 	int slop = SLOP;
 	unsigned long date = ~0ul;
-	struct commit_list *list = revs->commits;
+	struct commit_list *list;
 	struct commit_list *newlist = NULL;
 	struct commit_list **p = &newlist;
 	struct commit_list *bottom = NULL;
-	struct commit *interesting_cache = NULL;
+	struct commit_queue queue = COMMIT_QUEUE_INIT;
+	struct commit *commit, *interesting_cache = NULL;
 
 	if (revs->ancestry_path) {
-		bottom = collect_bottom_commits(list);
+		bottom = collect_bottom_commits(revs->commits);
 		if (!bottom)
 			die("--ancestry-path given but there are no bottom commits");
 	}
 
-	while (list) {
-		struct commit_list *entry = list;
-		struct commit *commit = list->item;
+	while (revs->commits)
+		commit_queue_put(&queue, pop_commit(&revs->commits));
+
+	while ((commit = commit_queue_get(&queue))) {
 		struct object *obj = &commit->object;
 		show_early_output_fn_t show;
 
-		list = list->next;
-		free(entry);
-
 		if (commit == interesting_cache)
 			interesting_cache = NULL;
 
 		if (revs->max_age != -1 && (commit->date < revs->max_age))
 			obj->flags |= UNINTERESTING;
-		if (add_parents_to_list(revs, commit, &list, NULL) < 0)
+		if (add_parents_to_list(revs, commit, &queue) < 0) {
+			clear_commit_queue(&queue);
 			return -1;
+		}
 		if (obj->flags & UNINTERESTING) {
 			mark_parents_uninteresting(commit);
 			if (revs->show_all)
 				p = &commit_list_insert(commit, p)->next;
-			slop = still_interesting(list, date, slop, &interesting_cache);
+			slop = still_interesting(&queue, date, slop, &interesting_cache);
 			if (slop)
 				continue;
 			/* If showing all, add the whole pending list to the end */
 			if (revs->show_all)
-				*p = list;
+				while ((commit = commit_queue_get(&queue)))
+					p = &commit_list_insert(commit, p)->next;
 			break;
 		}
 		if (revs->min_age != -1 && (commit->date > revs->min_age))
@@ -1137,6 +1219,7 @@ static int limit_list(struct rev_info *revs)
 		show(revs, newlist);
 		show_early_output = NULL;
 	}
+	clear_commit_queue(&queue);
 	if (revs->cherry_pick || revs->cherry_mark)
 		cherry_pick_list(newlist, revs);
 
@@ -2024,15 +2107,19 @@ static int handle_revision_opt(struct rev_info *revs, int argc, const char **arg
 		revs->grep_filter.debug = 1;
 	} else if (!strcmp(arg, "--basic-regexp")) {
 		grep_set_pattern_type_option(GREP_PATTERN_TYPE_BRE, &revs->grep_filter);
+		revs->diffopt.pickaxe_opts &= ~DIFF_PICKAXE_PERL;
 	} else if (!strcmp(arg, "--extended-regexp") || !strcmp(arg, "-E")) {
 		grep_set_pattern_type_option(GREP_PATTERN_TYPE_ERE, &revs->grep_filter);
+		revs->diffopt.pickaxe_opts &= ~DIFF_PICKAXE_PERL;
 	} else if (!strcmp(arg, "--regexp-ignore-case") || !strcmp(arg, "-i")) {
 		revs->grep_filter.regflags |= REG_ICASE;
 		DIFF_OPT_SET(&revs->diffopt, PICKAXE_IGNORE_CASE);
 	} else if (!strcmp(arg, "--fixed-strings") || !strcmp(arg, "-F")) {
 		grep_set_pattern_type_option(GREP_PATTERN_TYPE_FIXED, &revs->grep_filter);
+		revs->diffopt.pickaxe_opts &= ~DIFF_PICKAXE_PERL;
 	} else if (!strcmp(arg, "--perl-regexp")) {
 		grep_set_pattern_type_option(GREP_PATTERN_TYPE_PCRE, &revs->grep_filter);
+		revs->diffopt.pickaxe_opts |= DIFF_PICKAXE_PERL;
 	} else if (!strcmp(arg, "--all-match")) {
 		revs->grep_filter.all_match = 1;
 	} else if (!strcmp(arg, "--invert-grep")) {
@@ -2317,7 +2404,16 @@ int setup_revisions(int argc, const char **argv, struct rev_info *revs, struct s
 	    DIFF_OPT_TST(&revs->diffopt, FOLLOW_RENAMES))
 		revs->diff = 1;
 
-	if (revs->topo_order)
+	/*
+	 * With generation numbers, --topo-order can be produced while
+	 * walking (see init_topo_walk()) instead of in limit_list().
+	 * With --first-parent, sort_in_topological_order() still orders
+	 * the commits it shows by all of their parents, which the
+	 * incremental walk cannot know about.
+	 */
+	if (revs->topo_order &&
+	    (revs->reflog_info || revs->first_parent_only ||
+	     !generation_numbers_enabled()))
 		revs->limited = 1;
 
 	if (revs->prune_data.nr) {
@@ -2746,6 +2842,228 @@ void reset_revision_walk(void)
 	clear_object_flags(SEEN | ADDED | SHOWN);
 }
 
+/*
+ * Incremental topological walk.  Instead of walking the whole history
+ * in limit_list() before showing anything, keep three queues ordered
+ * by generation number:
+ *
+ *  - explore_queue walks ahead to apply the --max-age cutoff and to
+ *    propagate UNINTERESTING before an in-degree is counted;
+ *  - indegree_queue counts, for each commit, how many of the children
+ *    reachable from the tips still have to be shown;
+ *  - topo_queue holds the commits whose children have all been shown.
+ *
+ * A commit can only have children of a higher generation, so once the
+ * indegree walk has gone down to generation N, the in-degrees of all
+ * commits at generation N and above are final and the walk can stop
+ * there until a commit below it is about to be shown.
+ */
+define_commit_slab(indegree_slab, int);
+define_commit_slab(author_date_slab, unsigned long);
+
+struct topo_walk_info {
+	uint32_t min_generation;
+	struct prio_queue explore_queue;
+	struct prio_queue indegree_queue;
+	struct prio_queue topo_queue;
+	struct indegree_slab indegree;
+	struct author_date_slab author_date;
+};
+
+static inline void test_flag_and_insert(struct prio_queue *q,
+					struct commit *c, int flag)
+{
+	if (c->object.flags & flag)
+		return;
+	c->object.flags |= flag;
+	prio_queue_put(q, c);
+}
+
+static void explore_walk_step(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *p;
+	struct commit *c = prio_queue_get(&info->explore_queue);
+
+	if (!c)
+		return;
+	if (parse_commit_gently(c, 1) < 0)
+		return;
+
+	if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
+		record_author_date(&info->author_date, c);
+
+	if (revs->max_age != -1 && c->date < revs->max_age)
+		c->object.flags |= UNINTERESTING;
+
+	if (add_parents_to_list(revs, c, NULL) < 0)
+		return;
+
+	if (c->object.flags & UNINTERESTING)
+		mark_parents_uninteresting(c);
+
+	for (p = c->parents; p; p = p->next)
+		test_flag_and_insert(&info->explore_queue, p->item,
+				     TOPO_WALK_EXPLORED);
+}
+
+static void explore_to_depth(struct rev_info *revs, uint32_t gen_cutoff)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c;
+
+	while ((c = prio_queue_peek(&info->explore_queue)) &&
+	       c->generation >= gen_cutoff)
+		explore_walk_step(revs);
+}
+
+static void indegree_walk_step(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *p;
+	struct commit *c = prio_queue_get(&info->indegree_queue);
+
+	if (!c)
+		return;
+	if (parse_commit_gently(c, 1) < 0)
+		return;
+
+	explore_to_depth(revs, c->generation);
+
+	for (p = c->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+		int *pi = indegree_slab_at(&info->indegree, parent);
+
+		/* an in-degree of 1 means "no children left to show" */
+		if (*pi)
+			(*pi)++;
+		else
+			*pi = 2;
+
+		test_flag_and_insert(&info->indegree_queue, parent,
+				     TOPO_WALK_INDEGREE);
+	}
+}
+
+static void compute_indegrees_to_depth(struct rev_info *revs,
+				       uint32_t gen_cutoff)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c;
+
+	while ((c = prio_queue_peek(&info->indegree_queue)) &&
+	       c->generation >= gen_cutoff)
+		indegree_walk_step(revs);
+}
+
+static void init_topo_walk(struct rev_info *revs)
+{
+	struct topo_walk_info *info;
+	struct commit_list *list;
+
+	info = revs->topo_walk_info = xcalloc(1, sizeof(*info));
+	init_indegree_slab(&info->indegree);
+
+	switch (revs->sort_order) {
+	default: /* REV_SORT_IN_GRAPH_ORDER */
+		info->topo_queue.compare = NULL;
+		break;
+	case REV_SORT_BY_COMMIT_DATE:
+		info->topo_queue.compare = compare_commits_by_commit_date;
+		break;
+	case REV_SORT_BY_AUTHOR_DATE:
+		init_author_date_slab(&info->author_date);
+		info->topo_queue.compare = compare_commits_by_author_date;
+		info->topo_queue.cb_data = &info->author_date;
+		break;
+	}
+
+	info->explore_queue.compare = compare_commits_by_gen_then_commit_date;
+	info->indegree_queue.compare = compare_commits_by_gen_then_commit_date;
+
+	info->min_generation = GENERATION_NUMBER_INFINITY;
+	for (list = revs->commits; list; list = list->next) {
+		struct commit *c = list->item;
+
+		if (parse_commit_gently(c, 1))
+			continue;
+
+		test_flag_and_insert(&info->explore_queue, c, TOPO_WALK_EXPLORED);
+		test_flag_and_insert(&info->indegree_queue, c, TOPO_WALK_INDEGREE);
+
+		if (c->generation < info->min_generation)
+			info->min_generation = c->generation;
+
+		*(indegree_slab_at(&info->indegree, c)) = 1;
+
+		if (revs->sort_order == REV_SORT_BY_AUTHOR_DATE)
+			record_author_date(&info->author_date, c);
+	}
+	compute_indegrees_to_depth(revs, info->min_generation);
+
+	for (list = revs->commits; list; list = list->next) {
+		struct commit *c = list->item;
+
+		if (*(indegree_slab_at(&info->indegree, c)) == 1)
+			prio_queue_put(&info->topo_queue, c);
+	}
+
+	/*
+	 * The tips are shown in the order the command line gave them,
+	 * and the LIFO queue of the graph order would reverse them.
+	 */
+	if (revs->sort_order == REV_SORT_IN_GRAPH_ORDER)
+		prio_queue_reverse(&info->topo_queue);
+
+	/* everything the walk needs is in the queues from now on */
+	free_commit_list(revs->commits);
+	revs->commits = NULL;
+}
+
+static struct commit *next_topo_commit(struct rev_info *revs)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit *c = prio_queue_get(&info->topo_queue);
+
+	if (c)
+		*(indegree_slab_at(&info->indegree, c)) = 0;
+	return c;
+}
+
+static void expand_topo_walk(struct rev_info *revs, struct commit *commit)
+{
+	struct topo_walk_info *info = revs->topo_walk_info;
+	struct commit_list *p;
+
+	if (add_parents_to_list(revs, commit, NULL) < 0) {
+		if (!revs->ignore_missing_links)
+			die("Failed to traverse parents of commit %s",
+			    sha1_to_hex(commit->object.sha1));
+	}
+
+	for (p = commit->parents; p; p = p->next) {
+		struct commit *parent = p->item;
+		int *pi;
+
+		if (parent->object.flags & UNINTERESTING)
+			continue;
+		if (parse_commit_gently(parent, 1) < 0)
+			continue;
+
+		if (parent->generation < info->min_generation) {
+			info->min_generation = parent->generation;
+			compute_indegrees_to_depth(revs, info->min_generation);
+		}
+
+		pi = indegree_slab_at(&info->indegree, parent);
+		(*pi)--;
+		if (*pi == 1)
+			prio_queue_put(&info->topo_queue, parent);
+	}
+}
+
+static void start_grep_ahead(struct rev_info *revs);
+
 int prepare_revision_walk(struct rev_info *revs)
 {
 	int i;
@@ -2769,6 +3087,8 @@ int prepare_revision_walk(struct rev_info *revs)
 	if (!revs->leak_pending)
 		object_array_clear(&old_pending);
 
+	prepare_to_use_bloom_filters(revs);
+
 	/* Signal whether we need per-parent treesame decoration */
 	if (revs->simplify_merges ||
 	    (revs->limited && limiting_can_increase_treesame(revs)))
@@ -2781,25 +3101,29 @@ int prepare_revision_walk(struct rev_info *revs)
 	if (revs->limited)
 		if (limit_list(revs) < 0)
 			return -1;
-	if (revs->topo_order)
-		sort_in_topological_order(&revs->commits, revs->sort_order);
+	if (revs->topo_order) {
+		if (revs->limited)
+			sort_in_topological_order(&revs->commits, revs->sort_order);
+		else
+			init_topo_walk(revs);
+	}
 	if (revs->line_level_traverse)
 		line_log_filter(revs);
 	if (revs->simplify_merges)
 		simplify_merges(revs);
 	if (revs->children.name)
 		set_children(revs);
+	start_grep_ahead(revs);
 	return 0;
 }
 
 static enum rewrite_result rewrite_one(struct rev_info *revs, struct commit **pp)
 {
-	struct commit_list *cache = NULL;
-
 	for (;;) {
 		struct commit *p = *pp;
 		if (!revs->limited)
-			if (add_parents_to_list(revs, p, &revs->commits, &cache) < 0)
+			if (add_parents_to_list(revs, p,
+						revs->topo_walk_info ? NULL : &revs->queue) < 0)
 				return rewrite_one_error;
 		if (p->object.flags & UNINTERESTING)
 			return rewrite_one_ok;
@@ -2879,21 +3203,40 @@ static int commit_rewrite_person(struct strbuf *buf, const char *what, struct st
 	return 0;
 }
 
-static int commit_match(struct commit *commit, struct rev_info *opt)
+/*
+ * With revs->grep_threads, the walk runs up to GREP_AHEAD_COMMITS
+ * commits ahead of the one get_revision_1() returns, and the grep
+ * pipeline matches their messages in the background.
+ */
+#define GREP_AHEAD_COMMITS 64
+
+struct grep_ahead {
+	struct grep_pipeline *pipeline;
+	struct commit *commits[GREP_AHEAD_COMMITS];
+	int first, nr;
+	int done;
+	/* the commit last returned, and whether its message matched */
+	struct commit *current;
+	int current_match;
+};
+
+/*
+ * The text commit_match() greps: the commit message in the output
+ * encoding, with "fake" headers and notes added as needed.  Returns
+ * either "buf", or the message itself when nothing had to be added;
+ * the caller releases both "buf" and "*message", the latter with
+ * unuse_commit_buffer().
+ */
+static const char *commit_grep_text(struct commit *commit, struct rev_info *opt,
+				    struct strbuf *buf, const char **message)
 {
-	int retval;
 	const char *encoding;
-	const char *message;
-	struct strbuf buf = STRBUF_INIT;
-
-	if (!opt->grep_filter.pattern_list && !opt->grep_filter.header_list)
-		return 1;
 
 	/* Prepend "fake" headers as needed */
 	if (opt->grep_filter.use_reflog_filter) {
-		strbuf_addstr(&buf, "reflog ");
-		get_reflog_message(&buf, opt->reflog_info);
-		strbuf_addch(&buf, '\n');
+		strbuf_addstr(buf, "reflog ");
+		get_reflog_message(buf, opt->reflog_info);
+		strbuf_addch(buf, '\n');
 	}
 
 	/*
@@ -2904,25 +3247,42 @@ static int commit_match(struct commit *commit, struct rev_info *opt)
 	 * in it.
 	 */
 	encoding = get_log_output_encoding();
-	message = logmsg_reencode(commit, NULL, encoding);
+	*message = logmsg_reencode(commit, NULL, encoding);
 
 	/* Copy the commit to temporary if we are using "fake" headers */
-	if (buf.len)
-		strbuf_addstr(&buf, message);
+	if (buf->len)
+		strbuf_addstr(buf, *message);
 
 	if (opt->grep_filter.header_list && opt->mailmap) {
-		if (!buf.len)
-			strbuf_addstr(&buf, message);
+		if (!buf->len)
+			strbuf_addstr(buf, *message);
 
-		commit_rewrite_person(&buf, "\nauthor ", opt->mailmap);
-		commit_rewrite_person(&buf, "\ncommitter ", opt->mailmap);
+		commit_rewrite_person(buf, "\nauthor ", opt->mailmap);
+		commit_rewrite_person(buf, "\ncommitter ", opt->mailmap);
 	}
 
 	/* Append "fake" message parts as needed */
 	if (opt->show_notes) {
-		if (!buf.len)
-			strbuf_addstr(&buf, message);
-		format_display_notes(commit->object.sha1, &buf, encoding, 1);
+		if (!buf->len)
+			strbuf_addstr(buf, *message);
+		format_display_notes(commit->object.sha1, buf, encoding, 1);
+	}
+
+	return buf->len ? buf->buf : *message;
+}
+
+static int commit_match(struct commit *commit, struct rev_info *opt)
+{
+	int retval;
+	const char *message, *text;
+	struct strbuf buf = STRBUF_INIT;
+
+	if (!opt->grep_filter.pattern_list && !opt->grep_filter.header_list)
+		return 1;
+
+	if (opt->grep_ahead && opt->grep_ahead->current == commit) {
+		retval = opt->grep_ahead->current_match;
+		return opt->invert_grep ? !retval : retval;
 	}
 
 	/*
@@ -2933,11 +3293,9 @@ static int commit_match(struct commit *commit, struct rev_info *opt)
 	 * grep_buffer may modify it for speed, it will restore any
 	 * changes before returning.
 	 */
-	if (buf.len)
-		retval = grep_buffer(&opt->grep_filter, buf.buf, buf.len);
-	else
-		retval = grep_buffer(&opt->grep_filter,
-				     (char *)message, strlen(message));
+	text = commit_grep_text(commit, opt, &buf, &message);
+	retval = grep_buffer(&opt->grep_filter, (char *)text,
+			     text == buf.buf ? buf.len : strlen(text));
 	strbuf_release(&buf);
 	unuse_commit_buffer(commit, message);
 	return opt->invert_grep ? !retval : retval;
@@ -3090,17 +3448,29 @@ static void track_linear(struct rev_info *revs, struct commit *commit)
 	revs->previous_parents = copy_commit_list(commit->parents);
 }
 
-static struct commit *get_revision_1(struct rev_info *revs)
+/*
+ * The next commit the walk comes to, before simplify_commit() has had
+ * a say on whether to show it.
+ */
+static struct commit *next_walk_commit(struct rev_info *revs)
 {
-	if (!revs->commits)
-		return NULL;
-
-	do {
-		struct commit_list *entry = revs->commits;
-		struct commit *commit = entry->item;
-
-		revs->commits = entry->next;
-		free(entry);
+	for (;;) {
+		struct commit *commit;
+
+		if (revs->topo_walk_info)
+			commit = next_topo_commit(revs);
+		else if (revs->limited || revs->no_walk)
+			commit = pop_commit(&revs->commits);
+		else {
+			while (revs->commits)
+				commit_queue_put(&revs->queue,
+						 pop_commit(&revs->commits));
+			commit = commit_queue_get(&revs->queue);
+			if (!commit)
+				clear_commit_queue(&revs->queue);
+		}
+		if (!commit)
+			return NULL;
 
 		if (revs->reflog_info) {
 			save_parents(revs, commit);
@@ -3117,12 +3487,107 @@ static struct commit *get_revision_1(struct rev_info *revs)
 			if (revs->max_age != -1 &&
 			    (commit->date < revs->max_age))
 				continue;
-			if (add_parents_to_list(revs, commit, &revs->commits, NULL) < 0) {
+			if (revs->topo_walk_info)
+				expand_topo_walk(revs, commit);
+			else if (add_parents_to_list(revs, commit, &revs->queue) < 0) {
 				if (!revs->ignore_missing_links)
 					die("Failed to traverse parents of commit %s",
 						sha1_to_hex(commit->object.sha1));
 			}
 		}
+		return commit;
+	}
+}
+
+/*
+ * Walking ahead is only safe when nothing that happens to a commit
+ * after the walk comes to it, up to the caller showing it, changes
+ * how the walk goes on.  Rewriting parents walks further from
+ * within simplify_commit(), --follow changes the pathspec while the
+ * commits are shown, a reflog walk comes to the same commit more than
+ * once, and the boundary is whatever the walk has not come to yet.
+ */
+static int want_grep_ahead(struct rev_info *revs)
+{
+	if (revs->grep_threads <= 1 || revs->no_walk)
+		return 0;
+	if (!revs->grep_filter.pattern_list && !revs->grep_filter.header_list)
+		return 0;
+	if (want_ancestry(revs) || revs->reflog_info || revs->boundary ||
+	    revs->early_output || revs->line_level_traverse ||
+	    DIFF_OPT_TST(&revs->diffopt, FOLLOW_RENAMES))
+		return 0;
+	return 1;
+}
+
+static void finish_grep_ahead(struct rev_info *revs)
+{
+	finish_grep_pipeline(revs->grep_ahead->pipeline);
+	free(revs->grep_ahead);
+	revs->grep_ahead = NULL;
+}
+
+static void start_grep_ahead(struct rev_info *revs)
+{
+	struct grep_pipeline *pipeline;
+
+	if (revs->grep_ahead)
+		finish_grep_ahead(revs);
+	if (!want_grep_ahead(revs))
+		return;
+	pipeline = start_grep_pipeline(&revs->grep_filter, revs->grep_threads);
+	if (!pipeline)
+		return;
+	revs->grep_ahead = xcalloc(1, sizeof(*revs->grep_ahead));
+	revs->grep_ahead->pipeline = pipeline;
+}
+
+static struct commit *next_grep_ahead_commit(struct rev_info *revs)
+{
+	struct grep_ahead *ahead = revs->grep_ahead;
+	struct commit *commit;
+
+	while (!ahead->done && ahead->nr < GREP_AHEAD_COMMITS) {
+		struct strbuf buf = STRBUF_INIT;
+		const char *message, *text;
+
+		commit = next_walk_commit(revs);
+		if (!commit) {
+			ahead->done = 1;
+			break;
+		}
+		ahead->commits[(ahead->first + ahead->nr++) % GREP_AHEAD_COMMITS] = commit;
+
+		/* the workers must not touch the cached commit buffer */
+		text = commit_grep_text(commit, revs, &buf, &message);
+		if (text != buf.buf)
+			strbuf_addstr(&buf, text);
+		unuse_commit_buffer(commit, message);
+		grep_pipeline_add(ahead->pipeline, &buf);
+	}
+	if (!ahead->nr) {
+		finish_grep_ahead(revs);
+		return NULL;
+	}
+	commit = ahead->commits[ahead->first];
+	ahead->first = (ahead->first + 1) % GREP_AHEAD_COMMITS;
+	ahead->nr--;
+	ahead->current = commit;
+	ahead->current_match = grep_pipeline_next(ahead->pipeline);
+	return commit;
+}
+
+static struct commit *get_revision_1(struct rev_info *revs)
+{
+	for (;;) {
+		struct commit *commit;
+
+		if (revs->grep_ahead)
+			commit = next_grep_ahead_commit(revs);
+		else
+			commit = next_walk_commit(revs);
+		if (!commit)
+			return NULL;
 
 		switch (simplify_commit(revs, commit)) {
 		case commit_ignore:
@@ -3135,8 +3600,7 @@ static struct commit *get_revision_1(struct rev_info *revs)
 				track_linear(revs, commit);
 			return commit;
 		}
-	} while (revs->commits);
-	return NULL;
+	}
 }
 
 /*
@@ -6,6 +6,7 @@
 #include "notes.h"
 #include "commit.h"
 #include "diff.h"
+#include "commit-queue.h"
 
 /* Remember to update object flag allocation in object.h */
 #define SEEN		(1u<<0)
@@ -19,8 +20,11 @@
 #define SYMMETRIC_LEFT	(1u<<8)
 #define PATCHSAME	(1u<<9)
 #define BOTTOM		(1u<<10)
+#define TOPO_WALK_EXPLORED	(1u<<24)
+#define TOPO_WALK_INDEGREE	(1u<<25)
 #define TRACK_LINEAR	(1u<<26)
-#define ALL_REV_FLAGS	(((1u<<11)-1) | TRACK_LINEAR)
+#define ALL_REV_FLAGS	(((1u<<11)-1) | TOPO_WALK_EXPLORED | TOPO_WALK_INDEGREE | \
+			 TRACK_LINEAR)
 
 #define DECORATE_SHORT_REFS	1
 #define DECORATE_FULL_REFS	2
@@ -29,6 +33,9 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct bloom_key;
+struct topo_walk_info;
+struct grep_ahead;
 
 struct rev_cmdline_info {
 	unsigned int nr;
@@ -57,6 +64,13 @@ struct rev_info {
 	struct commit_list *commits;
 	struct object_array pending;
 
+	/*
+	 * Commits still to be walked, newest first, when the walk is
+	 * neither limited nor topo-ordered; "commits" moves in here
+	 * when the walk starts.
+	 */
+	struct commit_queue queue;
+
 	/* Parents of shown commits */
 	struct object_array boundary_commits;
 
@@ -74,9 +88,21 @@ struct rev_info {
 	/* topo-sort */
 	enum rev_sort_order sort_order;
 
+	/*
+	 * Set by prepare_revision_walk() when --topo-order output is
+	 * produced incrementally instead of by limit_list().
+	 */
+	struct topo_walk_info *topo_walk_info;
+
 	unsigned int	early_output:1,
 			ignore_missing:1,
-			ignore_missing_links:1;
+			ignore_missing_links:1,
+			/*
+			 * Show trees that cannot be read to the
+			 * show_object callback (unparsed), instead
+			 * of dying; see --missing in rev-list.
+			 */
+			do_not_die_on_missing_tree:1;
 
 	/* Traversal flags */
 	unsigned int	dense:1,
@@ -171,6 +197,12 @@ struct rev_info {
 	struct grep_opt	grep_filter;
 	/* Negate the match of grep_filter */
 	int invert_grep;
+	/*
+	 * Number of threads to match grep_filter in, while the walk
+	 * runs ahead of the commit last returned.
+	 */
+	int grep_threads;
+	struct grep_ahead *grep_ahead;
 
 	/* Display history graph */
 	struct git_graph *graph;
@@ -189,6 +221,14 @@ struct rev_info {
 	struct diff_options diffopt;
 	struct diff_options pruning;
 
+	/*
+	 * Changed-path filter keys of the pathspec items and of their
+	 * leading directories; bloom_key_item[i] is the item of key i.
+	 */
+	struct bloom_key *bloom_keys;
+	int *bloom_key_item;
+	int bloom_keys_nr;
+
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
 	struct decoration merge_simplification;
@@ -3,6 +3,7 @@
 #include "exec_cmd.h"
 #include "sigchain.h"
 #include "argv-array.h"
+#include "thread-utils.h"
 
 void child_process_init(struct child_process *child)
 {
@@ -544,12 +545,14 @@ fail_pipe:
 	else if (cmd->err)
 		close(cmd->err);
 
+	trace_child_start(cmd);
 	return 0;
 }
 
 int finish_command(struct child_process *cmd)
 {
 	int ret = wait_or_whine(cmd->pid, cmd->argv[0]);
+	trace_child_exit(cmd, ret);
 	argv_array_clear(&cmd->args);
 	argv_array_clear(&cmd->env_array);
 	return ret;
@@ -600,7 +603,9 @@ static void *run_thread(void *data)
 	intptr_t ret;
 
 	pthread_setspecific(async_key, async);
+	trace_thread_start("async");
 	ret = async->proc(async->proc_in, async->proc_out, async->data);
+	trace_thread_exit();
 	return (void *)ret;
 }
 
@@ -850,3 +855,261 @@ int capture_command(struct child_process *cmd, struct strbuf *buf, size_t hint)
 	close(cmd->out);
 	return finish_command(cmd);
 }
+
+enum child_state {
+	CHILD_FREE,
+	CHILD_WORKING,
+	CHILD_WAIT_CLEANUP
+};
+
+struct parallel_processes {
+	void *data;
+
+	int max_processes;
+	int nr_processes;
+
+	get_next_task_fn get_next_task;
+	start_failure_fn start_failure;
+	task_finished_fn task_finished;
+
+	struct {
+		enum child_state state;
+		struct child_process process;
+		struct strbuf err;
+		void *data;
+	} *children;
+	/* the stderr pipes of the children, indexed like children[] */
+	struct pollfd *pfd;
+
+	/* do not start any more tasks */
+	unsigned shutdown:1;
+
+	/* the child whose stderr is copied through as it arrives */
+	int output_owner;
+	/* stderr of the children that finished while another owned it */
+	struct strbuf buffered_output;
+};
+
+static int default_start_failure(struct strbuf *err, void *pp_cb,
+				 void *pp_task_cb)
+{
+	return 0;
+}
+
+static int default_task_finished(int result, struct strbuf *err,
+				 void *pp_cb, void *pp_task_cb)
+{
+	return 0;
+}
+
+static void kill_children(struct parallel_processes *pp, int signo)
+{
+	int i;
+
+	for (i = 0; i < pp->max_processes; i++)
+		if (pp->children[i].state == CHILD_WORKING)
+			kill(pp->children[i].process.pid, signo);
+}
+
+static void pp_init(struct parallel_processes *pp, int n,
+		    get_next_task_fn get_next_task,
+		    start_failure_fn start_failure,
+		    task_finished_fn task_finished, void *data)
+{
+	int i;
+
+	if (n < 1)
+		n = online_cpus();
+
+	pp->data = data;
+	pp->max_processes = n;
+	pp->nr_processes = 0;
+	pp->get_next_task = get_next_task;
+	pp->start_failure = start_failure ? start_failure : default_start_failure;
+	pp->task_finished = task_finished ? task_finished : default_task_finished;
+	pp->shutdown = 0;
+	pp->output_owner = 0;
+	strbuf_init(&pp->buffered_output, 0);
+
+	pp->children = xcalloc(n, sizeof(*pp->children));
+	pp->pfd = xcalloc(n, sizeof(*pp->pfd));
+	for (i = 0; i < n; i++) {
+		strbuf_init(&pp->children[i].err, 0);
+		child_process_init(&pp->children[i].process);
+		pp->pfd[i].events = POLLIN | POLLHUP;
+		pp->pfd[i].fd = -1;
+	}
+}
+
+static void pp_cleanup(struct parallel_processes *pp)
+{
+	int i;
+
+	for (i = 0; i < pp->max_processes; i++)
+		strbuf_release(&pp->children[i].err);
+	free(pp->children);
+	free(pp->pfd);
+
+	/* whatever finished last may still be waiting to be shown */
+	fputs(pp->buffered_output.buf, stderr);
+	strbuf_release(&pp->buffered_output);
+}
+
+/*
+ * Returns 0 if a new task was started, 1 if there are no more tasks
+ * and a negative value if the processing should stop.
+ */
+static int pp_start_one(struct parallel_processes *pp)
+{
+	int i, code;
+
+	for (i = 0; i < pp->max_processes; i++)
+		if (pp->children[i].state == CHILD_FREE)
+			break;
+	if (i == pp->max_processes)
+		die("BUG: no free slot for a parallel process");
+
+	code = pp->get_next_task(&pp->children[i].process,
+				 &pp->children[i].err,
+				 pp->data, &pp->children[i].data);
+	if (!code) {
+		strbuf_addbuf(&pp->buffered_output, &pp->children[i].err);
+		strbuf_reset(&pp->children[i].err);
+		return 1;
+	}
+	pp->children[i].process.err = -1;
+	pp->children[i].process.no_stdin = 1;
+	pp->children[i].process.clean_on_exit = 1;
+
+	if (start_command(&pp->children[i].process)) {
+		code = pp->start_failure(&pp->children[i].err, pp->data,
+					 pp->children[i].data);
+		strbuf_addbuf(&pp->buffered_output, &pp->children[i].err);
+		strbuf_reset(&pp->children[i].err);
+		child_process_init(&pp->children[i].process);
+		return code < 0 ? code : 0;
+	}
+
+	pp->nr_processes++;
+	pp->children[i].state = CHILD_WORKING;
+	pp->pfd[i].fd = pp->children[i].process.err;
+	return 0;
+}
+
+static void pp_buffer_stderr(struct parallel_processes *pp, int timeout)
+{
+	int i;
+
+	while (poll(pp->pfd, pp->max_processes, timeout) < 0) {
+		if (errno == EINTR)
+			continue;
+		die_errno("poll");
+	}
+
+	for (i = 0; i < pp->max_processes; i++) {
+		struct strbuf *err = &pp->children[i].err;
+		ssize_t n;
+
+		if (pp->children[i].state != CHILD_WORKING ||
+		    !(pp->pfd[i].revents & (POLLIN | POLLHUP)))
+			continue;
+		strbuf_grow(err, 8192);
+		n = xread(pp->children[i].process.err, err->buf + err->len,
+			  err->alloc - err->len - 1);
+		if (n > 0) {
+			strbuf_setlen(err, err->len + n);
+		} else if (!n || errno != EAGAIN) {
+			close(pp->children[i].process.err);
+			pp->pfd[i].fd = -1;
+			pp->children[i].state = CHILD_WAIT_CLEANUP;
+		}
+	}
+}
+
+static void pp_output(struct parallel_processes *pp)
+{
+	int i = pp->output_owner;
+
+	if (pp->children[i].state == CHILD_WORKING &&
+	    pp->children[i].err.len) {
+		fputs(pp->children[i].err.buf, stderr);
+		strbuf_reset(&pp->children[i].err);
+	}
+}
+
+static int pp_collect_finished(struct parallel_processes *pp)
+{
+	int i, j, code, result = 0;
+	int n = pp->max_processes;
+
+	while (pp->nr_processes > 0) {
+		for (i = 0; i < n; i++)
+			if (pp->children[i].state == CHILD_WAIT_CLEANUP)
+				break;
+		if (i == n)
+			break;
+
+		code = finish_command(&pp->children[i].process);
+		code = pp->task_finished(code, &pp->children[i].err,
+					 pp->data, pp->children[i].data);
+		if (code)
+			result = code;
+
+		pp->nr_processes--;
+		pp->children[i].state = CHILD_FREE;
+		pp->children[i].data = NULL;
+		child_process_init(&pp->children[i].process);
+
+		if (i != pp->output_owner) {
+			strbuf_addbuf(&pp->buffered_output, &pp->children[i].err);
+			strbuf_reset(&pp->children[i].err);
+		} else {
+			fputs(pp->children[i].err.buf, stderr);
+			strbuf_reset(&pp->children[i].err);
+
+			/* show the ones that finished in the meantime */
+			fputs(pp->buffered_output.buf, stderr);
+			strbuf_reset(&pp->buffered_output);
+
+			/* and let the next running child take over */
+			for (j = 0; j < n; j++)
+				if (pp->children[(pp->output_owner + j) % n].state == CHILD_WORKING)
+					break;
+			pp->output_owner = (pp->output_owner + j) % n;
+		}
+	}
+	return result;
+}
+
+int run_processes_parallel(int n,
+			   get_next_task_fn get_next_task,
+			   start_failure_fn start_failure,
+			   task_finished_fn task_finished,
+			   void *pp_cb)
+{
+	int code;
+	struct parallel_processes pp;
+
+	pp_init(&pp, n, get_next_task, start_failure, task_finished, pp_cb);
+	for (;;) {
+		while (!pp.shutdown && pp.nr_processes < pp.max_processes) {
+			code = pp_start_one(&pp);
+			if (!code)
+				continue;
+			pp.shutdown = 1;
+			if (code < 0)
+				kill_children(&pp, SIGTERM);
+		}
+		if (!pp.nr_processes)
+			break;
+		pp_buffer_stderr(&pp, 100);
+		pp_output(&pp);
+		code = pp_collect_finished(&pp);
+		if (code < 0) {
+			pp.shutdown = 1;
+			kill_children(&pp, SIGTERM);
+		}
+	}
+	pp_cleanup(&pp);
+	return 0;
+}
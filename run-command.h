@@ -43,6 +43,9 @@ struct child_process {
 	unsigned stdout_to_stderr:1;
 	unsigned use_shell:1;
 	unsigned clean_on_exit:1;
+	/* set by start_command() while GIT_TRACE_EVENT is enabled */
+	int trace_id;
+	uint64_t trace_start;
 };
 
 #define CHILD_PROCESS_INIT { NULL, ARGV_ARRAY_INIT, ARGV_ARRAY_INIT }
@@ -114,4 +117,66 @@ struct async {
 int start_async(struct async *async);
 int finish_async(struct async *async);
 
+/**
+ * This callback should initialize the child process and preload the
+ * error channel if desired.  Preloading is useful if you want to
+ * have a message printed directly before the output of the child process.
+ * pp_cb is the callback cookie as passed to run_processes_parallel.
+ * You can store a child process specific callback cookie in pp_task_cb.
+ *
+ * Return 1 if the next child is ready to run.
+ * Return 0 if there are currently no more tasks to be processed.
+ */
+typedef int (*get_next_task_fn)(struct child_process *cp,
+				 struct strbuf *err,
+				 void *pp_cb,
+				 void **pp_task_cb);
+
+/**
+ * This callback is called whenever there are problems starting
+ * a new process.
+ *
+ * You must not write to stdout or stderr in this function.  Add your
+ * message to the strbuf err instead, which will be printed without
+ * messing up the output of the other parallel processes.
+ *
+ * Return 0 to continue the parallel processing.  To abort, return a
+ * negative value; the running children are then killed.
+ */
+typedef int (*start_failure_fn)(struct strbuf *err,
+				void *pp_cb,
+				void *pp_task_cb);
+
+/**
+ * This callback is called on every child process that finished
+ * processing, with the exit code of the child in result.
+ *
+ * The same rules as for start_failure_fn apply to err.
+ *
+ * Return 0 to continue the parallel processing.  A positive value
+ * stops starting new tasks but waits for the running ones; a negative
+ * value kills them.
+ */
+typedef int (*task_finished_fn)(int result,
+				struct strbuf *err,
+				void *pp_cb,
+				void *pp_task_cb);
+
+/**
+ * Runs up to n processes at the same time (online_cpus() if n < 1),
+ * as long as get_next_task gives new tasks.  The standard error of
+ * each child is buffered and shown in one piece when it finishes, so
+ * that the output of different children does not interleave; only
+ * one child at a time has its stderr copied through as it arrives.
+ * Standard output is left alone; set stdout_to_stderr in
+ * get_next_task to have it buffered, too.
+ *
+ * start_failure and task_finished may be NULL to ignore failures.
+ */
+int run_processes_parallel(int n,
+			   get_next_task_fn get_next_task,
+			   start_failure_fn start_failure,
+			   task_finished_fn task_finished,
+			   void *pp_cb);
+
 #endif
@@ -27,6 +27,66 @@ static int feed_object(const unsigned char *sha1, int fd, int negative)
 	return write_or_whine(fd, buf, 41 + negative, "send-pack: send refs");
 }
 
+static int ref_is_sent(const struct ref *ref)
+{
+	return !is_null_sha1(ref->new_sha1) &&
+		(ref->status == REF_STATUS_OK ||
+		 ref->status == REF_STATUS_EXPECTING_REPORT);
+}
+
+/*
+ * The refs the receiving end advertises are often not the only
+ * history it has: a fork's branches, or the commits of a branch we
+ * rebased, may be there under refs it does not show us.  Ask its
+ * upload-pack, the way a fetch would, which of the commits behind the
+ * refs we push it has, so that they need not be sent again.
+ */
+static void get_commons_through_negotiation(const char *url,
+					    const struct ref *remote_refs,
+					    struct sha1_array *commons)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+	const struct ref *ref;
+	struct strbuf line = STRBUF_INIT;
+	int nr_tips = 0;
+	FILE *out;
+
+	argv_array_pushl(&child.args, "fetch-pack", "--negotiate-only", NULL);
+	for (ref = remote_refs; ref; ref = ref->next) {
+		if (!ref_is_sent(ref))
+			continue;
+		argv_array_pushf(&child.args, "--negotiation-tip=%s",
+				 sha1_to_hex(ref->new_sha1));
+		nr_tips++;
+	}
+	if (!nr_tips)
+		return;
+	argv_array_push(&child.args, url);
+	child.git_cmd = 1;
+	child.no_stdin = 1;
+	child.out = -1;
+	if (start_command(&child))
+		die("send-pack: unable to fork off fetch-pack");
+
+	out = xfdopen(child.out, "r");
+	while (strbuf_getline(&line, out, '\n') != EOF) {
+		unsigned char sha1[20];
+
+		if (get_sha1_hex(line.buf, sha1))
+			die("send-pack: unexpected output from fetch-pack: %s",
+			    line.buf);
+		sha1_array_append(commons, sha1);
+	}
+	fclose(out);
+	strbuf_release(&line);
+
+	/* what the negotiation finds helps, but is not needed */
+	if (finish_command(&child)) {
+		warning("push negotiation failed; proceeding anyway with push");
+		sha1_array_clear(commons);
+	}
+}
+
 /*
  * Make a pack stream and spit it out into file descriptor fd
  */
@@ -50,8 +110,12 @@ static int pack_objects(int fd, struct ref *refs, struct sha1_array *extra, stru
 		NULL,
 	};
 	struct child_process po = CHILD_PROCESS_INIT;
+	struct sha1_array commons = SHA1_ARRAY_INIT;
 	int i;
 
+	if (args->push_negotiate && !args->stateless_rpc)
+		get_commons_through_negotiation(args->url, refs, &commons);
+
 	i = 4;
 	if (args->use_thin_pack)
 		argv[i++] = "--thin";
@@ -77,6 +141,10 @@ static int pack_objects(int fd, struct ref *refs, struct sha1_array *extra, stru
 	for (i = 0; i < extra->nr; i++)
 		if (!feed_object(extra->sha1[i], po.in, 1))
 			break;
+	for (i = 0; i < commons.nr; i++)
+		if (!feed_object(commons.sha1[i], po.in, 1))
+			break;
+	sha1_array_clear(&commons);
 
 	while (refs) {
 		if (!is_null_sha1(refs->old_sha1) &&
@@ -495,7 +563,12 @@ int send_pack(struct send_pack_args *args,
 	}
 
 	if (need_pack_data && cmds_sent) {
-		if (pack_objects(out, remote_refs, extra_have, args) < 0) {
+		int err;
+
+		trace_region_enter("send-pack", "send pack");
+		err = pack_objects(out, remote_refs, extra_have, args);
+		trace_region_leave("send-pack", "send pack");
+		if (err < 0) {
 			for (ref = remote_refs; ref; ref = ref->next)
 				ref->status = REF_STATUS_NONE;
 			if (args->stateless_rpc)
@@ -514,9 +587,11 @@ int send_pack(struct send_pack_args *args,
 	if (args->stateless_rpc && cmds_sent)
 		packet_flush(out);
 
-	if (status_report && cmds_sent)
+	if (status_report && cmds_sent) {
+		trace_region_enter("send-pack", "receive status");
 		ret = receive_status(in, remote_refs);
-	else
+		trace_region_leave("send-pack", "receive status");
+	} else
 		ret = 0;
 	if (args->stateless_rpc)
 		packet_flush(out);
@@ -14,7 +14,8 @@ struct send_pack_args {
 		dry_run:1,
 		push_cert:1,
 		stateless_rpc:1,
-		atomic:1;
+		atomic:1,
+		push_negotiate:1;
 };
 
 int send_pack(struct send_pack_args *args,
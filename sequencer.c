@@ -11,6 +11,7 @@
 #include "cache-tree.h"
 #include "diff.h"
 #include "revision.h"
+#include "log-tree.h"
 #include "rerere.h"
 #include "merge-recursive.h"
 #include "refs.h"
@@ -305,8 +306,8 @@ static int do_recursive_merge(struct commit *base, struct commit *next,
 	o.branch2 = next ? next_label : "(empty tree)";
 
 	head_tree = parse_tree_indirect(head);
-	next_tree = next ? next->tree : empty_tree();
-	base_tree = base ? base->tree : empty_tree();
+	next_tree = next ? get_commit_tree(next) : empty_tree();
+	base_tree = base ? get_commit_tree(base) : empty_tree();
 
 	for (xopt = opts->xopts; xopt != opts->xopts + opts->xopts_nr; xopt++)
 		parse_merge_opt(&o, *xopt);
@@ -358,7 +359,7 @@ static int is_index_unchanged(void)
 		if (cache_tree_update(&the_index, 0))
 			return error(_("Unable to update cache tree\n"));
 
-	return !hashcmp(active_cache_tree->sha1, head_commit->tree->object.sha1);
+	return !hashcmp(active_cache_tree->sha1, get_commit_tree_sha1(head_commit));
 }
 
 /*
@@ -415,12 +416,12 @@ static int is_original_commit_empty(struct commit *commit)
 		if (parse_commit(parent))
 			return error(_("Could not parse parent commit %s\n"),
 				sha1_to_hex(parent->object.sha1));
-		ptree_sha1 = parent->tree->object.sha1;
+		ptree_sha1 = get_commit_tree_sha1(parent);
 	} else {
 		ptree_sha1 = EMPTY_TREE_SHA1_BIN; /* commit is root */
 	}
 
-	return !hashcmp(ptree_sha1, commit->tree->object.sha1);
+	return !hashcmp(ptree_sha1, get_commit_tree_sha1(commit));
 }
 
 /*
@@ -461,6 +462,49 @@ static int allow_empty(struct replay_opts *opts, struct commit *commit)
 		return 1;
 }
 
+/*
+ * The message for picking (or reverting) "commit", whose "parent" is
+ * the one we apply the difference from.
+ */
+static void add_pick_message(struct strbuf *msgbuf, struct commit *commit,
+			     struct commit *parent, struct commit_message *msg,
+			     struct replay_opts *opts)
+{
+	if (opts->action == REPLAY_REVERT) {
+		strbuf_addstr(msgbuf, "Revert \"");
+		strbuf_addstr(msgbuf, msg->subject);
+		strbuf_addstr(msgbuf, "\"\n\nThis reverts commit ");
+		strbuf_addstr(msgbuf, sha1_to_hex(commit->object.sha1));
+
+		if (commit->parents && commit->parents->next) {
+			strbuf_addstr(msgbuf, ", reversing\nchanges made to ");
+			strbuf_addstr(msgbuf, sha1_to_hex(parent->object.sha1));
+		}
+		strbuf_addstr(msgbuf, ".\n");
+	} else {
+		const char *p;
+
+		/*
+		 * Append the commit log message to msgbuf; it starts
+		 * after the tree, parent, author, committer
+		 * information followed by "\n\n".
+		 */
+		p = strstr(msg->message, "\n\n");
+		if (p) {
+			p += 2;
+			strbuf_addstr(msgbuf, p);
+		}
+
+		if (opts->record_origin) {
+			if (!has_conforming_footer(msgbuf, NULL, 0))
+				strbuf_addch(msgbuf, '\n');
+			strbuf_addstr(msgbuf, cherry_picked_prefix);
+			strbuf_addstr(msgbuf, sha1_to_hex(commit->object.sha1));
+			strbuf_addstr(msgbuf, ")\n");
+		}
+	}
+}
+
 static int do_pick_commit(struct commit *commit, struct replay_opts *opts)
 {
 	unsigned char head[20];
@@ -544,43 +588,13 @@ static int do_pick_commit(struct commit *commit, struct replay_opts *opts)
 		base_label = msg.label;
 		next = parent;
 		next_label = msg.parent_label;
-		strbuf_addstr(&msgbuf, "Revert \"");
-		strbuf_addstr(&msgbuf, msg.subject);
-		strbuf_addstr(&msgbuf, "\"\n\nThis reverts commit ");
-		strbuf_addstr(&msgbuf, sha1_to_hex(commit->object.sha1));
-
-		if (commit->parents && commit->parents->next) {
-			strbuf_addstr(&msgbuf, ", reversing\nchanges made to ");
-			strbuf_addstr(&msgbuf, sha1_to_hex(parent->object.sha1));
-		}
-		strbuf_addstr(&msgbuf, ".\n");
 	} else {
-		const char *p;
-
 		base = parent;
 		base_label = msg.parent_label;
 		next = commit;
 		next_label = msg.label;
-
-		/*
-		 * Append the commit log message to msgbuf; it starts
-		 * after the tree, parent, author, committer
-		 * information followed by "\n\n".
-		 */
-		p = strstr(msg.message, "\n\n");
-		if (p) {
-			p += 2;
-			strbuf_addstr(&msgbuf, p);
-		}
-
-		if (opts->record_origin) {
-			if (!has_conforming_footer(&msgbuf, NULL, 0))
-				strbuf_addch(&msgbuf, '\n');
-			strbuf_addstr(&msgbuf, cherry_picked_prefix);
-			strbuf_addstr(&msgbuf, sha1_to_hex(commit->object.sha1));
-			strbuf_addstr(&msgbuf, ")\n");
-		}
 	}
+	add_pick_message(&msgbuf, commit, parent, &msg, opts);
 
 	if (!opts->strategy || !strcmp(opts->strategy, "recursive") || opts->action == REPLAY_REVERT) {
 		res = do_recursive_merge(base, next, base_label, next_label,
@@ -983,23 +997,337 @@ static void save_opts(struct replay_opts *opts)
 	}
 }
 
+/*
+ * Picking a range through the work tree costs a checkout, an index
+ * write and a "git commit" process for every commit.  As long as a
+ * pick merges cleanly and "git commit" would do nothing but write the
+ * commit, do it in core instead: merge with merge-recursive's
+ * in_memory mode and write the commit directly.  HEAD, the index and
+ * the work tree are brought up to date once, at the end or just before
+ * the first pick that has to go the slow way (a conflict, an empty
+ * result, a merge commit, ...).
+ */
+struct in_core_picks {
+	unsigned char orig_head[20];	/* what HEAD and the work tree are at */
+	unsigned char head[20];		/* the last commit picked in core */
+	struct commit_list *first;	/* todo entry of the first of those */
+	struct in_core_pick {
+		unsigned char sha1[20];
+		char *reflog_msg;
+		char *output;		/* what merge-recursive had to say */
+		int summary;		/* -1: none, or flags for the summary */
+	} *pick;
+	int nr, alloc;
+	enum {
+		PICK_CLEANUP_NONE,
+		PICK_CLEANUP_SPACE,
+		PICK_CLEANUP_ALL
+	} cleanup;
+};
+
+static int start_in_core_picks(struct in_core_picks *picks,
+			       struct replay_opts *opts)
+{
+	const char *value;
+	int i, sign;
+
+	memset(picks, 0, sizeof(*picks));
+
+	/* things only "git commit" or the work tree can do */
+	if (opts->no_commit || opts->edit || opts->signoff || opts->gpg_sign)
+		return 0;
+	if (opts->action == REPLAY_PICK && opts->strategy &&
+	    strcmp(opts->strategy, "recursive"))
+		return 0;
+	if ((!git_config_get_bool("commit.gpgsign", &sign) && sign) ||
+	    !git_config_get_value("commit.template", &value))
+		return 0;
+	if (find_hook("prepare-commit-msg") || find_hook("post-commit"))
+		return 0;
+
+	/* the cleanup run_git_commit() ends up asking for */
+	if (git_config_get_value("commit.cleanup", &value))
+		picks->cleanup = opts->record_origin ?
+			PICK_CLEANUP_SPACE : PICK_CLEANUP_NONE;
+	else if (!value)
+		return 0;
+	else if (!strcmp(value, "verbatim"))
+		picks->cleanup = PICK_CLEANUP_NONE;
+	else if (!strcmp(value, "strip"))
+		picks->cleanup = PICK_CLEANUP_ALL;
+	else if (!strcmp(value, "default") || !strcmp(value, "whitespace") ||
+		 !strcmp(value, "scissors"))
+		picks->cleanup = PICK_CLEANUP_SPACE;
+	else
+		return 0;
+
+	/* and the checkout at the end must not run into local changes */
+	if (get_sha1("HEAD", picks->head) || index_differs_from("HEAD", 0))
+		return 0;
+	for (i = 0; i < active_nr; i++)
+		if (!ce_uptodate(active_cache[i]))
+			return 0;
+	hashcpy(picks->orig_head, picks->head);
+	return 1;
+}
+
+static void add_in_core_pick(struct in_core_picks *picks,
+			     struct commit_list *todo,
+			     const unsigned char *sha1, struct strbuf *reflog_msg,
+			     struct strbuf *output, int summary)
+{
+	struct in_core_pick *pick;
+
+	if (!picks->nr)
+		picks->first = todo;
+	ALLOC_GROW(picks->pick, picks->nr + 1, picks->alloc);
+	pick = &picks->pick[picks->nr++];
+	hashcpy(pick->sha1, sha1);
+	pick->reflog_msg = strbuf_detach(reflog_msg, NULL);
+	pick->output = strbuf_detach(output, NULL);
+	pick->summary = summary;
+	hashcpy(picks->head, sha1);
+}
+
+static int pick_message_is_empty(struct strbuf *sb, struct in_core_picks *picks)
+{
+	const char *bol, *eol, *end = sb->buf + sb->len;
+
+	if (picks->cleanup == PICK_CLEANUP_NONE && sb->len)
+		return 0;
+	/* as "git commit" sees it: whitespace and sign-offs only */
+	for (bol = sb->buf; bol < end; bol = eol + 1) {
+		eol = memchr(bol, '\n', end - bol);
+		if (!eol)
+			eol = end;
+		if (starts_with(bol, sign_off_header) &&
+		    strlen(sign_off_header) <= eol - bol)
+			continue;
+		for (; bol < eol; bol++)
+			if (!isspace(*bol))
+				return 0;
+	}
+	return 1;
+}
+
+/* The author "git commit" takes from CHERRY_PICK_HEAD. */
+static char *pick_author(const char *message)
+{
+	struct ident_split ident;
+	const char *a;
+	size_t len;
+	char *name, *email, *date, *author;
+
+	a = find_commit_header(message, "author", &len);
+	if (!a || split_ident_line(&ident, a, len) < 0)
+		return NULL;
+	name = xmemdupz(ident.name_begin, ident.name_end - ident.name_begin);
+	email = xmemdupz(ident.mail_begin, ident.mail_end - ident.mail_begin);
+	if (ident.date_begin)
+		date = xstrfmt("@%.*s %.*s",
+			       (int)(ident.date_end - ident.date_begin),
+			       ident.date_begin,
+			       (int)(ident.tz_end - ident.tz_begin),
+			       ident.tz_begin);
+	else
+		date = xstrdup_or_null(getenv("GIT_AUTHOR_DATE"));
+	author = xstrdup(fmt_ident(name, email, date, IDENT_STRICT));
+	free(name);
+	free(email);
+	free(date);
+	return author;
+}
+
+/*
+ * Pick "todo->item" on top of the commits picked in core so far.
+ * Returns 1, having changed nothing, if it has to go the slow way.
+ */
+static int pick_in_core(struct in_core_picks *picks, struct commit_list *todo,
+			struct replay_opts *opts)
+{
+	struct commit *commit = todo->item, *parent, *head, *base, *next;
+	const char *base_label, *next_label;
+	struct commit_message msg = { NULL, NULL, NULL, NULL };
+	struct merge_options o;
+	struct tree *result;
+	struct strbuf msgbuf = STRBUF_INIT, reflog_msg = STRBUF_INIT;
+	struct commit_list *parents = NULL;
+	unsigned char sha1[20];
+	char *author = NULL;
+	const char **xopt;
+	int clean, keep_output, ret = 1;
+
+	if (!commit->parents || commit->parents->next || opts->mainline)
+		return 1;
+	parent = commit->parents->item;
+
+	init_merge_options(&o);
+	if (opts->allow_ff && !hashcmp(parent->object.sha1, picks->head)) {
+		strbuf_addf(&reflog_msg, "%s: fast-forward", action_name(opts));
+		add_in_core_pick(picks, todo, commit->object.sha1,
+				 &reflog_msg, &o.obuf, -1);
+		return 0;
+	}
+
+	head = lookup_commit(picks->head);
+	if (!head || parse_commit(head) || parse_commit(parent) ||
+	    get_message(commit, &msg))
+		goto leave;
+
+	if (opts->action == REPLAY_REVERT) {
+		base = commit;
+		base_label = msg.label;
+		next = parent;
+		next_label = msg.parent_label;
+	} else {
+		base = parent;
+		base_label = msg.parent_label;
+		next = commit;
+		next_label = msg.label;
+	}
+
+	o.ancestor = base_label;
+	o.branch1 = "HEAD";
+	o.branch2 = next_label;
+	o.in_memory = 1;
+	/* do_recursive_merge() only lets unbuffered output through */
+	keep_output = !o.buffer_output;
+	o.buffer_output = 2;
+	for (xopt = opts->xopts; xopt != opts->xopts + opts->xopts_nr; xopt++)
+		parse_merge_opt(&o, *xopt);
+
+	discard_cache();
+	clean = merge_trees(&o, get_commit_tree(head), get_commit_tree(next),
+			    get_commit_tree(base), &result);
+	discard_cache();
+	if (o.worktree) {
+		discard_index(o.worktree);
+		free(o.worktree);
+	}
+	if (!clean || !hashcmp(result->object.sha1, get_commit_tree_sha1(head)))
+		goto leave;
+	if (!keep_output)
+		strbuf_reset(&o.obuf);
+
+	add_pick_message(&msgbuf, commit, parent, &msg, opts);
+	if (picks->cleanup != PICK_CLEANUP_NONE)
+		stripspace(&msgbuf, picks->cleanup == PICK_CLEANUP_ALL);
+	if (!opts->allow_empty_message && pick_message_is_empty(&msgbuf, picks))
+		goto leave;
+
+	if (opts->action == REPLAY_PICK) {
+		author = pick_author(msg.message);
+		if (!author)
+			goto leave;
+	}
+	commit_list_insert(head, &parents);
+	if (commit_tree(msgbuf.buf, msgbuf.len, result->object.sha1, parents,
+			sha1, author, NULL))
+		goto leave;
+
+	strbuf_addf(&reflog_msg, "%s: %.*s", getenv(GIT_REFLOG_ACTION),
+		    (int)(strchrnul(msgbuf.buf, '\n') - msgbuf.buf), msgbuf.buf);
+	add_in_core_pick(picks, todo, sha1, &reflog_msg, &o.obuf,
+			 opts->action == REPLAY_PICK ? SUMMARY_SHOW_AUTHOR_DATE : 0);
+	ret = 0;
+
+leave:
+	free(author);
+	strbuf_release(&msgbuf);
+	strbuf_release(&reflog_msg);
+	strbuf_release(&o.obuf);
+	free_message(commit, &msg);
+	return ret;
+}
+
+/*
+ * Bring HEAD, the index and the work tree up to the commits picked in
+ * core, and say what "git commit" would have said about each.  Returns
+ * -1 without touching any of them if something is in the way, in which
+ * case the commits from picks->first on have to be picked again the
+ * slow way.
+ */
+static int flush_in_core_picks(struct in_core_picks *picks)
+{
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	read_cache();
+	if (!picks->nr)
+		return 0;
+	if (checkout_fast_forward_gently(picks->orig_head, picks->head, 1)) {
+		ret = -1;
+		goto leave;
+	}
+
+	for (i = 0; i < picks->nr; i++) {
+		struct in_core_pick *pick = &picks->pick[i];
+		struct ref_transaction *transaction;
+
+		transaction = ref_transaction_begin(&err);
+		if (!transaction ||
+		    ref_transaction_update(transaction, "HEAD", pick->sha1,
+					   i ? pick[-1].sha1 : picks->orig_head,
+					   0, pick->reflog_msg, &err) ||
+		    ref_transaction_commit(transaction, &err))
+			die("%s", err.buf);
+		ref_transaction_free(transaction);
+
+		fputs(pick->output, stdout);
+		if (pick->summary >= 0)
+			print_commit_summary(NULL, pick->sha1, pick->summary);
+	}
+	fflush(stdout);
+	hashcpy(picks->orig_head, picks->head);
+
+leave:
+	for (i = 0; i < picks->nr; i++) {
+		free(picks->pick[i].reflog_msg);
+		free(picks->pick[i].output);
+	}
+	picks->nr = 0;
+	strbuf_release(&err);
+	return ret;
+}
+
 static int pick_commits(struct commit_list *todo_list, struct replay_opts *opts)
 {
 	struct commit_list *cur;
-	int res;
+	struct in_core_picks picks;
+	int in_core, res = 0;
 
 	setenv(GIT_REFLOG_ACTION, action_name(opts), 0);
 	if (opts->allow_ff)
 		assert(!(opts->signoff || opts->no_commit ||
 				opts->record_origin || opts->edit));
 	read_and_refresh_cache(opts);
+	in_core = start_in_core_picks(&picks, opts);
 
 	for (cur = todo_list; cur; cur = cur->next) {
+		if (in_core) {
+			int slow = pick_in_core(&picks, cur, opts);
+
+			if (!slow && cur->next)
+				continue;
+			if (flush_in_core_picks(&picks)) {
+				/* redo them through the work tree, which says why */
+				in_core = 0;
+				cur = picks.first;
+			} else if (!slow)
+				continue;
+		}
 		save_todo(cur, opts);
 		res = do_pick_commit(cur->item, opts);
 		if (res)
-			return res;
+			break;
+		/* carry on in core from the commit just made */
+		if (in_core && get_sha1("HEAD", picks.head))
+			in_core = 0;
+		hashcpy(picks.orig_head, picks.head);
 	}
+	free(picks.pick);
+	if (res)
+		return res;
 
 	/*
 	 * Sequence of picks finished successfully; cleanup by
@@ -1128,6 +1456,123 @@ int sequencer_pick_revisions(struct replay_opts *opts)
 	return pick_commits(todo_list, opts);
 }
 
+static const char implicit_ident_advice_noconfig[] =
+N_("Your name and email address were configured automatically based\n"
+"on your username and hostname. Please check that they are accurate.\n"
+"You can suppress this message by setting them explicitly. Run the\n"
+"following command and follow the instructions in your editor to edit\n"
+"your configuration file:\n"
+"\n"
+"    git config --global --edit\n"
+"\n"
+"After doing this, you may fix the identity used for this commit with:\n"
+"\n"
+"    git commit --amend --reset-author\n");
+
+static const char implicit_ident_advice_config[] =
+N_("Your name and email address were configured automatically based\n"
+"on your username and hostname. Please check that they are accurate.\n"
+"You can suppress this message by setting them explicitly:\n"
+"\n"
+"    git config --global user.name \"Your Name\"\n"
+"    git config --global user.email you@example.com\n"
+"\n"
+"After doing this, you may fix the identity used for this commit with:\n"
+"\n"
+"    git commit --amend --reset-author\n");
+
+static const char *implicit_ident_advice(void)
+{
+	char *user_config = expand_user_path("~/.gitconfig");
+	char *xdg_config = xdg_config_home("config");
+	int config_exists = file_exists(user_config) || file_exists(xdg_config);
+
+	free(user_config);
+	free(xdg_config);
+
+	if (config_exists)
+		return _(implicit_ident_advice_config);
+	else
+		return _(implicit_ident_advice_noconfig);
+
+}
+
+void print_commit_summary(const char *prefix, const unsigned char *sha1,
+			  unsigned int flags)
+{
+	struct rev_info rev;
+	struct commit *commit;
+	struct strbuf format = STRBUF_INIT;
+	unsigned char junk_sha1[20];
+	const char *head;
+	struct pretty_print_context pctx = {0};
+	struct strbuf author_ident = STRBUF_INIT;
+	struct strbuf committer_ident = STRBUF_INIT;
+
+	commit = lookup_commit(sha1);
+	if (!commit)
+		die(_("couldn't look up newly created commit"));
+	if (parse_commit(commit))
+		die(_("could not parse newly created commit"));
+
+	strbuf_addstr(&format, "format:%h] %s");
+
+	format_commit_message(commit, "%an <%ae>", &author_ident, &pctx);
+	format_commit_message(commit, "%cn <%ce>", &committer_ident, &pctx);
+	if (strbuf_cmp(&author_ident, &committer_ident)) {
+		strbuf_addstr(&format, "\n Author: ");
+		strbuf_addbuf_percentquote(&format, &author_ident);
+	}
+	if (flags & SUMMARY_SHOW_AUTHOR_DATE) {
+		struct strbuf date = STRBUF_INIT;
+		format_commit_message(commit, "%ad", &date, &pctx);
+		strbuf_addstr(&format, "\n Date: ");
+		strbuf_addbuf_percentquote(&format, &date);
+		strbuf_release(&date);
+	}
+	if (!committer_ident_sufficiently_given()) {
+		strbuf_addstr(&format, "\n Committer: ");
+		strbuf_addbuf_percentquote(&format, &committer_ident);
+		if (advice_implicit_identity) {
+			strbuf_addch(&format, '\n');
+			strbuf_addstr(&format, implicit_ident_advice());
+		}
+	}
+	strbuf_release(&author_ident);
+	strbuf_release(&committer_ident);
+
+	init_revisions(&rev, prefix);
+	setup_revisions(0, NULL, &rev, NULL);
+
+	rev.diff = 1;
+	rev.diffopt.output_format =
+		DIFF_FORMAT_SHORTSTAT | DIFF_FORMAT_SUMMARY;
+
+	rev.verbose_header = 1;
+	rev.show_root_diff = 1;
+	get_commit_format(format.buf, &rev);
+	rev.always_show_header = 0;
+	rev.diffopt.detect_rename = 1;
+	rev.diffopt.break_opt = 0;
+	diff_setup_done(&rev.diffopt);
+
+	head = resolve_ref_unsafe("HEAD", 0, junk_sha1, NULL);
+	if (!strcmp(head, "HEAD"))
+		head = _("detached HEAD");
+	else
+		skip_prefix(head, "refs/heads/", &head);
+	printf("[%s%s ", head,
+	       (flags & SUMMARY_INITIAL_COMMIT) ? _(" (root-commit)") : "");
+
+	if (!log_tree_commit(&rev, commit)) {
+		rev.always_show_header = 1;
+		rev.use_terminator = 1;
+		log_tree_commit(&rev, commit);
+	}
+
+	strbuf_release(&format);
+}
+
 void append_signoff(struct strbuf *msgbuf, int ignore_footer, unsigned flag)
 {
 	unsigned no_dup_sob = flag & APPEND_SIGNOFF_DEDUP;
@@ -55,4 +55,14 @@ extern const char sign_off_header[];
 void append_signoff(struct strbuf *msgbuf, int ignore_footer, unsigned flag);
 void append_conflicts_hint(struct strbuf *msgbuf);
 
+#define SUMMARY_INITIAL_COMMIT   (1u << 0)
+#define SUMMARY_SHOW_AUTHOR_DATE (1u << 1)
+
+/*
+ * Print the "[branch abbrev] subject" line and the diffstat summary
+ * that "git commit" shows after making a commit.
+ */
+void print_commit_summary(const char *prefix, const unsigned char *sha1,
+			  unsigned int flags);
+
 #endif
@@ -350,12 +350,39 @@ void setup_work_tree(void)
 	initialized = 1;
 }
 
+static struct string_list unknown_extensions = STRING_LIST_INIT_DUP;
+
 static int check_repo_format(const char *var, const char *value, void *cb)
 {
+	const char *ext;
+
 	if (strcmp(var, "core.repositoryformatversion") == 0)
 		repository_format_version = git_config_int(var, value);
 	else if (strcmp(var, "core.sharedrepository") == 0)
 		shared_repository = git_config_perm(var, value);
+	else if (skip_prefix(var, "extensions.", &ext)) {
+		/*
+		 * Extensions only take effect in format version 1 and
+		 * later, where a version that does not know one of them
+		 * must refuse to touch the repository.
+		 */
+		if (!strcmp(ext, "partialclone")) {
+			if (!value)
+				return config_error_nonbool(var);
+			free(repository_format_partial_clone);
+			repository_format_partial_clone = xstrdup(value);
+		} else if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			if (!strcmp(value, "reftable"))
+				repository_format_reftable = 1;
+			else if (!strcmp(value, "files"))
+				repository_format_reftable = 0;
+			else
+				string_list_append(&unknown_extensions, ext);
+		} else
+			string_list_append(&unknown_extensions, ext);
+	}
 	return 0;
 }
 
@@ -382,16 +409,37 @@ static int check_repository_format_gently(const char *gitdir, int *nongit_ok)
 	 * Use a gentler version of git_config() to check if this repo
 	 * is a good one.
 	 */
+	string_list_clear(&unknown_extensions, 0);
+	free(repository_format_partial_clone);
+	repository_format_partial_clone = NULL;
+	repository_format_reftable = 0;
 	git_config_early(fn, NULL, repo_config);
-	if (GIT_REPO_VERSION < repository_format_version) {
+	if (GIT_REPO_VERSION_READ < repository_format_version) {
 		if (!nongit_ok)
 			die ("Expected git repo version <= %d, found %d",
-			     GIT_REPO_VERSION, repository_format_version);
+			     GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Expected git repo version <= %d, found %d",
-			GIT_REPO_VERSION, repository_format_version);
+			GIT_REPO_VERSION_READ, repository_format_version);
 		warning("Please upgrade Git");
 		*nongit_ok = -1;
 		ret = -1;
+	} else if (repository_format_version >= 1 && unknown_extensions.nr) {
+		int i;
+
+		if (!nongit_ok)
+			die("unknown repository extension found: %s",
+			    unknown_extensions.items[0].string);
+		for (i = 0; i < unknown_extensions.nr; i++)
+			warning("unknown repository extension found: %s",
+				unknown_extensions.items[i].string);
+		*nongit_ok = -1;
+		ret = -1;
+	}
+	if (repository_format_version < 1) {
+		/* extensions mean nothing to a version 0 repository */
+		free(repository_format_partial_clone);
+		repository_format_partial_clone = NULL;
+		repository_format_reftable = 0;
 	}
 	strbuf_release(&sb);
 	return ret;
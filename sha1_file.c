@@ -19,10 +19,17 @@
 #include "tree-walk.h"
 #include "refs.h"
 #include "pack-revindex.h"
+#include "pack-sizes.h"
+#include "pack-bases.h"
 #include "sha1-lookup.h"
 #include "bulk-checkin.h"
 #include "streaming.h"
+#include "fetch-object.h"
 #include "dir.h"
+#include "midx.h"
+#include "thread-utils.h"
+#include "oidset.h"
+#include "sha1-array.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -66,6 +73,47 @@ static struct cached_object empty_tree = {
  */
 static struct packed_git *last_found_pack;
 
+#ifndef NO_PTHREADS
+/*
+ * While enabled, read_sha1_file() and sha1_object_info_extended() take
+ * this lock, so that threads can call them without a lock of their
+ * own.  The lock is dropped while inflating and applying deltas, which
+ * only touch the object's own buffers and a pack window that use_pack()
+ * has pinned, so that most of the work of reading objects can run in
+ * parallel.  It is recursive, as reading an object can look at others.
+ */
+static pthread_mutex_t obj_read_mutex;
+static int obj_read_use_lock;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock++)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		die("BUG: unbalanced disable_obj_read_lock()");
+	if (--obj_read_use_lock)
+		return;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#endif
+
 static struct cached_object *find_cached_object(const unsigned char *sha1)
 {
 	int i;
@@ -464,9 +512,20 @@ static int check_and_freshen_local(const unsigned char *sha1, int freshen)
 	return check_and_freshen_file(sha1_file_name(sha1), freshen);
 }
 
+static struct alternate_object_database *find_alt_loose_object(const unsigned char *sha1);
+
 static int check_and_freshen_nonlocal(const unsigned char *sha1, int freshen)
 {
 	struct alternate_object_database *alt;
+
+	if (core_alternates_cache) {
+		alt = find_alt_loose_object(sha1);
+		if (!alt)
+			return 0;
+		fill_sha1_path(alt->name, sha1);
+		return check_and_freshen_file(alt->base, freshen);
+	}
+
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
 		fill_sha1_path(alt->name, sha1);
@@ -492,18 +551,262 @@ static int has_loose_object(const unsigned char *sha1)
 	return check_and_freshen(sha1, 0);
 }
 
+/*
+ * With core.looseObjectCache, quick existence checks (HAS_SHA1_QUICK)
+ * read each objects/xx/ directory once and answer from that listing
+ * instead of calling access() for every candidate, which is much
+ * cheaper where negative lookups are slow (e.g. NFS).  With
+ * core.alternatesCache, all lookups in alternates are answered that
+ * way.  reprepare_packed_git() drops the listings of directories whose
+ * mtime changed since they were read.
+ */
+struct loose_object_cache {
+	struct loose_object_cache *next;
+	uint32_t subdir_seen[256 / 32];
+	/* listed in the second their directory was last modified */
+	uint32_t subdir_racy[256 / 32];
+	struct cache_time subdir_mtime[256];
+	struct oidset subdir[256];
+	char dir[FLEX_ARRAY];
+};
+
+static struct loose_object_cache *loose_object_caches;
+
+static int for_each_file_in_obj_subdir(int subdir_nr,
+				       struct strbuf *path,
+				       each_loose_object_fn obj_cb,
+				       each_loose_cruft_fn cruft_cb,
+				       each_loose_subdir_fn subdir_cb,
+				       void *data);
+
+static int append_loose_object(const unsigned char *sha1, const char *path,
+			       void *data)
+{
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	oidset_add(data, &oid);
+	return 0;
+}
+
+static struct oidset *loose_object_subdir(const char *dir, size_t dirlen,
+					      int subdir_nr)
+{
+	struct loose_object_cache *c;
+
+	for (c = loose_object_caches; c; c = c->next)
+		if (!strncmp(c->dir, dir, dirlen) && !c->dir[dirlen])
+			break;
+	if (!c) {
+		c = xcalloc(1, sizeof(*c) + dirlen + 1);
+		memcpy(c->dir, dir, dirlen);
+		c->next = loose_object_caches;
+		loose_object_caches = c;
+	}
+
+	if (!(c->subdir_seen[subdir_nr / 32] & (1u << (subdir_nr % 32)))) {
+		struct strbuf path = STRBUF_INIT;
+		struct cache_time *mtime = &c->subdir_mtime[subdir_nr];
+		struct stat st;
+
+		strbuf_addf(&path, "%s/%02x", c->dir, subdir_nr);
+		/* take the mtime first, so that we miss no later change */
+		if (stat(path.buf, &st)) {
+			mtime->sec = mtime->nsec = 0;
+		} else {
+			mtime->sec = st.st_mtime;
+			mtime->nsec = ST_MTIME_NSEC(st);
+			if (st.st_mtime >= time(NULL))
+				c->subdir_racy[subdir_nr / 32] |=
+					1u << (subdir_nr % 32);
+		}
+		for_each_file_in_obj_subdir(subdir_nr, &path,
+					    append_loose_object, NULL, NULL,
+					    &c->subdir[subdir_nr]);
+		strbuf_release(&path);
+		c->subdir_seen[subdir_nr / 32] |= 1u << (subdir_nr % 32);
+	}
+	return &c->subdir[subdir_nr];
+}
+
+/*
+ * Is the listing of objects/xx/ still what the directory holds?  A
+ * directory that was modified in the same second as we read it may
+ * have changed again without its mtime telling us.
+ */
+static int loose_object_subdir_valid(struct loose_object_cache *c,
+				     int subdir_nr)
+{
+	struct cache_time *mtime = &c->subdir_mtime[subdir_nr];
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	int ret;
+
+	if (c->subdir_racy[subdir_nr / 32] & (1u << (subdir_nr % 32)))
+		return 0;
+	strbuf_addf(&path, "%s/%02x", c->dir, subdir_nr);
+	if (stat(path.buf, &st))
+		ret = !mtime->sec && !mtime->nsec;
+	else
+		ret = mtime->sec == (uint32_t)st.st_mtime &&
+		      mtime->nsec == ST_MTIME_NSEC(st);
+	strbuf_release(&path);
+	return ret;
+}
+
+static int has_cached_loose_object(const unsigned char *sha1)
+{
+	struct alternate_object_database *alt;
+	const char *objdir = get_object_directory();
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	if (oidset_contains(loose_object_subdir(objdir, strlen(objdir),
+						sha1[0]), &oid))
+		return 1;
+	prepare_alt_odb();
+	for (alt = alt_odb_list; alt; alt = alt->next) {
+		size_t len = alt->name - alt->base - 1;
+		if (oidset_contains(loose_object_subdir(alt->base, len,
+							sha1[0]), &oid))
+			return 1;
+	}
+	return 0;
+}
+
+static int is_loose_object_batch(struct alternate_object_database *alt);
+
+/*
+ * With core.alternatesCache, find the alternate that has "sha1" as a
+ * loose object from the listings of their directories, without
+ * looking at the files themselves.
+ */
+static struct alternate_object_database *find_alt_loose_object(const unsigned char *sha1)
+{
+	struct alternate_object_database *alt;
+	struct object_id oid;
+
+	hashcpy(oid.hash, sha1);
+	prepare_alt_odb();
+	for (alt = alt_odb_list; alt; alt = alt->next) {
+		size_t len = alt->name - alt->base - 1;
+
+		/* the objects of a batch are written as we go */
+		if (is_loose_object_batch(alt)) {
+			fill_sha1_path(alt->name, sha1);
+			if (!access(alt->base, F_OK))
+				return alt;
+			continue;
+		}
+		if (oidset_contains(loose_object_subdir(alt->base, len,
+							sha1[0]), &oid))
+			return alt;
+	}
+	return NULL;
+}
+
+/*
+ * For loose_objects_with_prefix(): the loose objects of all object
+ * directories, one sorted array per first byte of their names.
+ */
+static struct sha1_array loose_objects_by_prefix[256];
+static uint32_t loose_objects_by_prefix_seen[256 / 32];
+
+static int append_loose_sha1(const unsigned char *sha1, const char *path,
+			     void *data)
+{
+	sha1_array_append(data, sha1);
+	return 0;
+}
+
+struct sha1_array *loose_objects_with_prefix(unsigned char first, int refresh)
+{
+	struct sha1_array *array = &loose_objects_by_prefix[first];
+	uint32_t bit = 1u << (first % 32);
+	struct alternate_object_database *alt;
+	struct strbuf path = STRBUF_INIT;
+
+	if (!refresh && (loose_objects_by_prefix_seen[first / 32] & bit))
+		return array;
+
+	sha1_array_clear(array);
+	strbuf_addf(&path, "%s/%02x", get_object_directory(), first);
+	for_each_file_in_obj_subdir(first, &path, append_loose_sha1,
+				    NULL, NULL, array);
+	prepare_alt_odb();
+	for (alt = alt_odb_list; alt; alt = alt->next) {
+		strbuf_reset(&path);
+		strbuf_add(&path, alt->base, alt->name - alt->base - 1);
+		strbuf_addf(&path, "/%02x", first);
+		for_each_file_in_obj_subdir(first, &path, append_loose_sha1,
+					    NULL, NULL, array);
+	}
+	strbuf_release(&path);
+	loose_objects_by_prefix_seen[first / 32] |= bit;
+	return array;
+}
+
+/* Record a loose object we just wrote, if its directory was listed. */
+static void add_to_loose_object_cache(const unsigned char *sha1)
+{
+	const char *objdir = get_object_directory();
+	struct loose_object_cache *c;
+
+	if (loose_objects_by_prefix_seen[sha1[0] / 32] & (1u << (sha1[0] % 32)))
+		sha1_array_append(&loose_objects_by_prefix[sha1[0]], sha1);
+
+	for (c = loose_object_caches; c; c = c->next) {
+		if (strcmp(c->dir, objdir))
+			continue;
+		if (c->subdir_seen[sha1[0] / 32] & (1u << (sha1[0] % 32))) {
+			struct object_id oid;
+
+			hashcpy(oid.hash, sha1);
+			oidset_add(&c->subdir[sha1[0]], &oid);
+		}
+		break;
+	}
+}
+
+static void revalidate_loose_object_cache(void)
+{
+	struct loose_object_cache *c;
+	int i;
+
+	for (c = loose_object_caches; c; c = c->next) {
+		for (i = 0; i < 256; i++) {
+			uint32_t bit = 1u << (i % 32);
+
+			if (!(c->subdir_seen[i / 32] & bit) ||
+			    loose_object_subdir_valid(c, i))
+				continue;
+			oidset_clear(&c->subdir[i]);
+			c->subdir_seen[i / 32] &= ~bit;
+			c->subdir_racy[i / 32] &= ~bit;
+		}
+	}
+	for (i = 0; i < 256; i++)
+		sha1_array_clear(&loose_objects_by_prefix[i]);
+	memset(loose_objects_by_prefix_seen, 0,
+	       sizeof(loose_objects_by_prefix_seen));
+}
+
 static unsigned int pack_used_ctr;
 static unsigned int pack_mmap_calls;
+static unsigned int pack_munmap_calls;
 static unsigned int peak_pack_open_windows;
 static unsigned int pack_open_windows;
 static unsigned int pack_open_fds;
 static unsigned int pack_max_fds;
 static size_t peak_pack_mapped;
 static size_t pack_mapped;
+static struct object_access_stats object_access;
 struct packed_git *packed_git;
 
 void pack_report(void)
 {
+	struct delta_base_cache_stats dbc;
+
 	fprintf(stderr,
 		"pack_report: getpagesize()            = %10" SZ_FMT "\n"
 		"pack_report: core.packedGitWindowSize = %10" SZ_FMT "\n"
@@ -514,13 +817,82 @@ void pack_report(void)
 	fprintf(stderr,
 		"pack_report: pack_used_ctr            = %10u\n"
 		"pack_report: pack_mmap_calls          = %10u\n"
+		"pack_report: pack_munmap_calls        = %10u\n"
 		"pack_report: pack_open_windows        = %10u / %10u\n"
 		"pack_report: pack_mapped              = "
 			"%10" SZ_FMT " / %10" SZ_FMT "\n",
 		pack_used_ctr,
 		pack_mmap_calls,
+		pack_munmap_calls,
 		pack_open_windows, peak_pack_open_windows,
 		sz_fmt(pack_mapped), sz_fmt(peak_pack_mapped));
+	get_delta_base_cache_stats(&dbc);
+	fprintf(stderr,
+		"pack_report: delta_base_cache_slots   = %10lu\n"
+		"pack_report: delta_base_cached        = "
+			"%10" SZ_FMT " / %10" SZ_FMT "\n"
+		"pack_report: delta_base_cache_hits    = %10lu\n"
+		"pack_report: delta_base_cache_misses  = %10lu\n"
+		"pack_report: delta_base_cache_evicted = %10lu\n",
+		dbc.slots,
+		sz_fmt(dbc.cached), sz_fmt(delta_base_cache_limit),
+		dbc.hits, dbc.misses, dbc.evictions);
+}
+
+void get_object_access_stats(struct object_access_stats *stats)
+{
+	*stats = object_access;
+	stats->inflated_bytes = git_inflated_bytes();
+}
+
+/*
+ * Emit the object access, pack window and delta base cache counters
+ * as structured trace events (GIT_TRACE_EVENT).
+ */
+void trace_object_access_stats(void)
+{
+	static const char *chain_name[DELTA_CHAIN_BUCKETS] = {
+		"delta_chain_0", "delta_chain_1", "delta_chain_2-3",
+		"delta_chain_4-7", "delta_chain_8-15", "delta_chain_16-31",
+		"delta_chain_32-63", "delta_chain_64+"
+	};
+	struct object_access_stats oa;
+	struct delta_base_cache_stats dbc;
+	int i;
+
+	if (!trace_event_want())
+		return;
+
+	get_object_access_stats(&oa);
+	trace_counter("objects", "info_cached", oa.info_cached);
+	trace_counter("objects", "info_loose", oa.info_loose);
+	trace_counter("objects", "info_packed", oa.info_packed);
+	trace_counter("objects", "read_loose", oa.read_loose);
+	trace_counter("objects", "read_packed", oa.read_packed);
+	trace_counter("objects", "missing", oa.missing);
+	trace_counter("objects", "unpacked_entries", oa.unpacked_entries);
+	trace_counter("objects", "deltas_applied", oa.deltas_applied);
+	for (i = 0; i < DELTA_CHAIN_BUCKETS; i++)
+		trace_counter("objects", chain_name[i], oa.delta_chain[i]);
+	trace_counter("objects", "delta_chain_max", oa.delta_chain_max);
+	trace_counter("objects", "inflated_bytes", oa.inflated_bytes);
+
+	trace_counter("pack", "mmap_calls", pack_mmap_calls);
+	trace_counter("pack", "munmap_calls", pack_munmap_calls);
+	trace_counter("pack", "open_windows_peak", peak_pack_open_windows);
+	trace_counter("pack", "mapped_peak", peak_pack_mapped);
+
+	get_delta_base_cache_stats(&dbc);
+	trace_counter("delta_base_cache", "hits", dbc.hits);
+	trace_counter("delta_base_cache", "misses", dbc.misses);
+	trace_counter("delta_base_cache", "evictions", dbc.evictions);
+}
+
+size_t pack_window_usage(size_t *peak)
+{
+	if (peak)
+		*peak = peak_pack_mapped;
+	return pack_mapped;
 }
 
 /*
@@ -654,7 +1026,14 @@ static void scan_windows(struct packed_git *p,
 
 	for (w_l = NULL, w = p->windows; w; w = w->next) {
 		if (!w->inuse_cnt) {
-			if (!*lru_w || w->last_used < (*lru_w)->last_used) {
+			/*
+			 * The least used window goes first, so that a scan
+			 * through cold history does not push out the windows
+			 * everybody keeps coming back to.
+			 */
+			if (!*lru_w || w->hits < (*lru_w)->hits ||
+			    (w->hits == (*lru_w)->hits &&
+			     w->last_used < (*lru_w)->last_used)) {
 				*lru_p = p;
 				*lru_w = w;
 				*lru_l = w_l;
@@ -675,6 +1054,7 @@ static int unuse_one_window(struct packed_git *current)
 		scan_windows(p, &lru_p, &lru_w, &lru_l);
 	if (lru_p) {
 		munmap(lru_w->base, lru_w->len);
+		pack_munmap_calls++;
 		pack_mapped -= lru_w->len;
 		if (lru_l)
 			lru_l->next = lru_w->next;
@@ -682,6 +1062,13 @@ static int unuse_one_window(struct packed_git *current)
 			lru_p->windows = lru_w->next;
 		free(lru_w);
 		pack_open_windows--;
+
+		/* let windows that were hot long ago cool down */
+		for (p = packed_git; p; p = p->next) {
+			struct pack_window *w;
+			for (w = p->windows; w; w = w->next)
+				w->hits >>= 1;
+		}
 		return 1;
 	}
 	return 0;
@@ -741,6 +1128,7 @@ void close_pack_windows(struct packed_git *p)
 			die("pack '%s' still has open windows to it",
 			    p->pack_name);
 		munmap(w->base, w->len);
+		pack_munmap_calls++;
 		pack_mapped -= w->len;
 		pack_open_windows--;
 		p->windows = w->next;
@@ -865,7 +1253,11 @@ void free_pack_by_name(const char *pack_name)
 				close(p->pack_fd);
 				pack_open_fds--;
 			}
+			close_pack_revindex(p);
+			close_pack_sizes(p);
+			close_pack_bases(p);
 			close_pack_index(p);
+			drop_multi_pack_index_for(p);
 			free(p->bad_object_sha1);
 			*pp = p->next;
 			if (last_found_pack == p)
@@ -1020,6 +1412,77 @@ static int in_window(struct pack_window *win, off_t offset)
 		&& (offset + 20) <= (win_off + win->len);
 }
 
+/*
+ * On 64-bit, map a pack that takes no more than a quarter of
+ * core.packedGitLimit whole, whatever core.packedGitWindowSize says:
+ * there is address space to spare, and one mapping never needs to
+ * slide.
+ */
+static int map_whole_pack(struct packed_git *p)
+{
+#ifdef NO_MMAP
+	return 0;
+#else
+	return sizeof(void *) >= 8 &&
+		p->pack_size > packed_git_window_size &&
+		p->pack_size <= packed_git_limit / 4;
+#endif
+}
+
+#if !defined(NO_MMAP) && defined(MADV_SEQUENTIAL) && defined(MADV_WILLNEED)
+#define PACK_SEQUENTIAL_RUN 16
+#define PACK_SEQUENTIAL_GAP (64 * 1024)
+#define PACK_READAHEAD (4 * 1024 * 1024)
+
+static void advise_window(struct pack_window *win, off_t start, off_t end,
+			  int advice)
+{
+	size_t pagesize = getpagesize();
+
+	start -= start % pagesize;
+	if (end > win->len)
+		end = win->len;
+	if (start < end)
+		madvise(win->base + start, end - start, advice);
+}
+
+/*
+ * Tell the kernel when somebody reads through a window in order
+ * (verify-pack, index-pack, pack-objects reusing data), so that it
+ * reads ahead and drops what was read; and when it stops doing so.
+ */
+static void note_window_access(struct pack_window *win, off_t offset)
+{
+	if (offset >= win->last_access &&
+	    offset - win->last_access <= PACK_SEQUENTIAL_GAP)
+		win->forward_run++;
+	else
+		win->forward_run = 0;
+	win->last_access = offset;
+
+	if (win->forward_run < PACK_SEQUENTIAL_RUN) {
+		if (win->sequential) {
+			advise_window(win, 0, win->len, MADV_NORMAL);
+			win->sequential = 0;
+		}
+		return;
+	}
+	if (!win->sequential) {
+		advise_window(win, 0, win->len, MADV_SEQUENTIAL);
+		win->sequential = 1;
+		win->readahead = offset;
+	}
+	if (win->readahead < offset + PACK_READAHEAD / 2 &&
+	    win->readahead < win->len) {
+		off_t start = win->readahead > offset ? win->readahead : offset;
+		win->readahead = offset + PACK_READAHEAD;
+		advise_window(win, start, win->readahead, MADV_WILLNEED);
+	}
+}
+#else
+#define note_window_access(win, offset) do { } while (0)
+#endif
+
 unsigned char *use_pack(struct packed_git *p,
 		struct pack_window **w_cursor,
 		off_t offset,
@@ -1052,10 +1515,15 @@ unsigned char *use_pack(struct packed_git *p,
 				die("packfile %s cannot be accessed", p->pack_name);
 
 			win = xcalloc(1, sizeof(*win));
-			win->offset = (offset / window_align) * window_align;
-			len = p->pack_size - win->offset;
-			if (len > packed_git_window_size)
-				len = packed_git_window_size;
+			if (map_whole_pack(p)) {
+				win->offset = 0;
+				len = p->pack_size;
+			} else {
+				win->offset = (offset / window_align) * window_align;
+				len = p->pack_size - win->offset;
+				if (len > packed_git_window_size)
+					len = packed_git_window_size;
+			}
 			win->len = (size_t)len;
 			pack_mapped += win->len;
 			while (packed_git_limit < pack_mapped
@@ -1082,14 +1550,17 @@ unsigned char *use_pack(struct packed_git *p,
 				peak_pack_open_windows = pack_open_windows;
 			win->next = p->windows;
 			p->windows = win;
+			trace_memory_sample();
 		}
 	}
 	if (win != *w_cursor) {
 		win->last_used = pack_used_ctr++;
 		win->inuse_cnt++;
+		win->hits++;
 		*w_cursor = win;
 	}
 	offset -= win->offset;
+	note_window_access(win, offset);
 	if (left)
 		*left = win->len - xsize_t(offset);
 	return win->base + offset;
@@ -1105,7 +1576,9 @@ static struct packed_git *alloc_packed_git(int extra)
 
 static void try_to_free_pack_memory(size_t size)
 {
+	obj_read_lock();
 	release_pack_memory(size);
+	obj_read_unlock();
 }
 
 struct packed_git *add_packed_git(const char *path, int path_len, int local)
@@ -1252,11 +1725,13 @@ static void prepare_packed_git_one(char *objdir, int local)
 	}
 	strbuf_addch(&path, '/');
 	dirnamelen = path.len;
+	prepare_multi_pack_index_one(objdir, local);
 	while ((de = readdir(dir)) != NULL) {
 		struct packed_git *p;
 		size_t base_len;
 
-		if (is_dot_or_dotdot(de->d_name))
+		if (is_dot_or_dotdot(de->d_name) ||
+		    !strcmp(de->d_name, "multi-pack-index"))
 			continue;
 
 		strbuf_setlen(&path, dirnamelen);
@@ -1287,12 +1762,16 @@ static void prepare_packed_git_one(char *objdir, int local)
 		if (ends_with(de->d_name, ".idx") ||
 		    ends_with(de->d_name, ".pack") ||
 		    ends_with(de->d_name, ".bitmap") ||
+		    ends_with(de->d_name, ".rev") ||
+		    ends_with(de->d_name, ".sizes") ||
+		    ends_with(de->d_name, ".bases") ||
 		    ends_with(de->d_name, ".keep"))
 			string_list_append(&garbage, path.buf);
 		else
 			report_garbage("garbage found", path.buf);
 	}
 	closedir(dir);
+	link_multi_pack_index_packs(objdir);
 	report_pack_garbage(&garbage);
 	string_list_clear(&garbage, 0);
 	strbuf_release(&path);
@@ -1352,6 +1831,22 @@ static void rearrange_packed_git(void)
 	free(ary);
 }
 
+/*
+ * Object stores of submodules are kept off alt_odb_list and packed_git,
+ * so that lookups in the superproject do not have to go through every
+ * submodule that was inspected by this process.  While a submodule is
+ * active, its object directories are linked after our own alternates
+ * and its packs after our own packs.
+ */
+struct submodule_odb {
+	struct submodule_odb *next;
+	struct alternate_object_database *alt;
+	struct packed_git *packs;
+	char objdir[FLEX_ARRAY];
+};
+static struct submodule_odb *submodule_odb_list;
+static struct submodule_odb *active_submodule_odb;
+
 static int prepare_packed_git_run_once = 0;
 void prepare_packed_git(void)
 {
@@ -1362,6 +1857,8 @@ void prepare_packed_git(void)
 	prepare_packed_git_one(get_object_directory(), 1);
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
+		if (active_submodule_odb && alt == active_submodule_odb->alt)
+			break; /* its packs are not ours to install */
 		alt->name[-1] = 0;
 		prepare_packed_git_one(alt->base, 0);
 		alt->name[-1] = '/';
@@ -1372,10 +1869,146 @@ void prepare_packed_git(void)
 
 void reprepare_packed_git(void)
 {
+	revalidate_loose_object_cache();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
 
+static void prepare_submodule_packs(struct submodule_odb *sub,
+				    const char *objdir)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t dirnamelen;
+	DIR *dir;
+	struct dirent *de;
+
+	strbuf_addf(&path, "%s/pack/", objdir);
+	dirnamelen = path.len;
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		struct packed_git *p;
+		size_t base_len;
+
+		strbuf_setlen(&path, dirnamelen);
+		strbuf_addstr(&path, de->d_name);
+		base_len = path.len;
+		if (!strip_suffix_mem(path.buf, &base_len, ".idx"))
+			continue;
+		p = add_packed_git(path.buf, path.len, 0);
+		if (!p)
+			continue;
+		p->pack_submodule = 1;
+		p->next = sub->packs;
+		sub->packs = p;
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+static struct submodule_odb *lookup_submodule_odb(const char *objdir)
+{
+	struct submodule_odb *sub;
+	struct alternate_object_database *alt, *saved_list, **saved_tail;
+	struct strbuf our_objdir = STRBUF_INIT;
+
+	for (sub = submodule_odb_list; sub; sub = sub->next)
+		if (!strcmp(sub->objdir, objdir))
+			return sub;
+
+	sub = xcalloc(1, sizeof(*sub) + strlen(objdir) + 1);
+	strcpy(sub->objdir, objdir);
+
+	/*
+	 * Let link_alt_odb_entry() collect the submodule and its own
+	 * alternates on a list of their own.
+	 */
+	prepare_alt_odb();
+	strbuf_add_absolute_path(&our_objdir, get_object_directory());
+	normalize_path_copy(our_objdir.buf, our_objdir.buf);
+	saved_list = alt_odb_list;
+	saved_tail = alt_odb_tail;
+	alt_odb_list = NULL;
+	alt_odb_tail = &alt_odb_list;
+	link_alt_odb_entry(objdir, NULL, 0, our_objdir.buf);
+	sub->alt = alt_odb_list;
+	alt_odb_list = saved_list;
+	alt_odb_tail = saved_tail;
+	strbuf_release(&our_objdir);
+
+	for (alt = sub->alt; alt; alt = alt->next) {
+		alt->name[-1] = 0;
+		prepare_submodule_packs(sub, alt->base);
+		alt->name[-1] = '/';
+	}
+
+	sub->next = submodule_odb_list;
+	submodule_odb_list = sub;
+	return sub;
+}
+
+void activate_submodule_odb(const char *objdir)
+{
+	struct submodule_odb *sub = lookup_submodule_odb(objdir);
+	struct packed_git **tail;
+
+	if (sub == active_submodule_odb)
+		return;
+	deactivate_submodule_odb();
+
+	prepare_packed_git();
+	*alt_odb_tail = sub->alt;
+	for (tail = &packed_git; *tail; tail = &(*tail)->next)
+		; /* nothing */
+	*tail = sub->packs;
+	active_submodule_odb = sub;
+}
+
+void deactivate_submodule_odb(void)
+{
+	struct submodule_odb *sub = active_submodule_odb;
+	struct packed_git *p, **pp, **tail;
+
+	if (!sub)
+		return;
+	*alt_odb_tail = NULL;
+
+	/*
+	 * Take the packs back off packed_git, wherever a reprepare may
+	 * have moved them, and give their windows and descriptors back.
+	 */
+	tail = &sub->packs;
+	for (pp = &packed_git; (p = *pp) != NULL; ) {
+		struct pack_window *w;
+
+		if (!p->pack_submodule) {
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		if (last_found_pack == p)
+			last_found_pack = NULL;
+		for (w = p->windows; w; w = w->next)
+			if (w->inuse_cnt)
+				break;
+		if (!w) {
+			close_pack_windows(p);
+			if (p->pack_fd != -1) {
+				close(p->pack_fd);
+				pack_open_fds--;
+				p->pack_fd = -1;
+			}
+		}
+		*tail = p;
+		tail = &p->next;
+	}
+	*tail = NULL;
+	active_submodule_odb = NULL;
+}
+
 static void mark_bad_packed_object(struct packed_git *p,
 				   const unsigned char *sha1)
 {
@@ -1474,8 +2107,18 @@ static int stat_sha1_file(const unsigned char *sha1, struct stat *st)
 	if (!lstat(sha1_file_name(sha1), st))
 		return 0;
 
-	prepare_alt_odb();
-	errno = ENOENT;
+	if (core_alternates_cache) {
+		alt = find_alt_loose_object(sha1);
+		if (!alt) {
+			errno = ENOENT;
+			return -1;
+		}
+		fill_sha1_path(alt->name, sha1);
+		return lstat(alt->base, st);
+	}
+
+	prepare_alt_odb();
+	errno = ENOENT;
 	for (alt = alt_odb_list; alt; alt = alt->next) {
 		fill_sha1_path(alt->name, sha1);
 		if (!lstat(alt->base, st))
@@ -1496,6 +2139,16 @@ static int open_sha1_file(const unsigned char *sha1)
 		return fd;
 	most_interesting_errno = errno;
 
+	if (core_alternates_cache) {
+		alt = find_alt_loose_object(sha1);
+		if (!alt) {
+			errno = most_interesting_errno;
+			return -1;
+		}
+		fill_sha1_path(alt->name, sha1);
+		return git_open_noatime(alt->base);
+	}
+
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
 		fill_sha1_path(alt->name, sha1);
@@ -1776,11 +2429,11 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	return get_delta_hdr_size(&data, delta_head+sizeof(delta_head));
 }
 
-static off_t get_delta_base(struct packed_git *p,
-				    struct pack_window **w_curs,
-				    off_t *curpos,
-				    enum object_type type,
-				    off_t delta_obj_offset)
+off_t get_delta_base(struct packed_git *p,
+		     struct pack_window **w_curs,
+		     off_t *curpos,
+		     enum object_type type,
+		     off_t delta_obj_offset)
 {
 	unsigned char *base_info = use_pack(p, w_curs, *curpos, NULL);
 	off_t base_offset;
@@ -1831,18 +2484,17 @@ static const unsigned char *get_delta_base_sha1(struct packed_git *p,
 		unsigned char *base = use_pack(p, w_curs, curpos, NULL);
 		return base;
 	} else if (type == OBJ_OFS_DELTA) {
-		struct revindex_entry *revidx;
+		uint32_t base_pos;
 		off_t base_offset = get_delta_base(p, w_curs, &curpos,
 						   type, delta_obj_offset);
 
 		if (!base_offset)
 			return NULL;
 
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		if (offset_to_pack_pos(p, base_offset, &base_pos) < 0)
 			return NULL;
 
-		return nth_packed_object_sha1(p, revidx->nr);
+		return nth_packed_object_sha1(p, pack_pos_to_index(p, base_pos));
 	} else
 		return NULL;
 }
@@ -1876,12 +2528,11 @@ int unpack_object_header(struct packed_git *p,
 static int retry_bad_packed_offset(struct packed_git *p, off_t obj_offset)
 {
 	int type;
-	struct revindex_entry *revidx;
+	uint32_t pos;
 	const unsigned char *sha1;
-	revidx = find_pack_revindex(p, obj_offset);
-	if (!revidx)
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
 		return OBJ_BAD;
-	sha1 = nth_packed_object_sha1(p, revidx->nr);
+	sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 	mark_bad_packed_object(p, sha1);
 	type = sha1_object_info(sha1, NULL);
 	if (type <= OBJ_NONE)
@@ -1958,14 +2609,49 @@ unwind:
 	goto out;
 }
 
-static int packed_object_info(struct packed_git *p, off_t obj_offset,
-			      struct object_info *oi)
+static int packed_disk_size(struct packed_git *p, off_t obj_offset,
+			    unsigned long *disk_sizep)
+{
+	uint32_t pos;
+
+	if (offset_to_pack_pos(p, obj_offset, &pos) < 0)
+		return -1;
+	*disk_sizep = pack_pos_to_offset(p, pos + 1) - obj_offset;
+	return 0;
+}
+
+/*
+ * Answer from the object size table of the pack, if it has one and we
+ * are not asked for the delta base.  Returns the type the object is
+ * stored as, or OBJ_BAD if the table cannot answer.
+ */
+static int packed_object_info_from_sizes(struct packed_git *p, uint32_t pos,
+					 off_t obj_offset,
+					 struct object_info *oi)
+{
+	enum object_type in_pack_type;
+
+	if (oi->delta_base_sha1 || load_pack_sizes(p))
+		return OBJ_BAD;
+	if (pack_sizes_lookup(p, pos, oi->typep, &in_pack_type, oi->sizep))
+		return OBJ_BAD;
+	if (oi->disk_sizep && packed_disk_size(p, obj_offset, oi->disk_sizep))
+		return OBJ_BAD;
+	return in_pack_type;
+}
+
+static int packed_object_info(struct packed_git *p, uint32_t pos,
+			      off_t obj_offset, struct object_info *oi)
 {
 	struct pack_window *w_curs = NULL;
 	unsigned long size;
 	off_t curpos = obj_offset;
 	enum object_type type;
 
+	type = packed_object_info_from_sizes(p, pos, obj_offset, oi);
+	if (type > OBJ_NONE)
+		return type;
+
 	/*
 	 * We always get the representation type, but only convert it to
 	 * a "real" type later if the caller is interested.
@@ -1991,9 +2677,9 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 		}
 	}
 
-	if (oi->disk_sizep) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		*oi->disk_sizep = revidx[1].offset - obj_offset;
+	if (oi->disk_sizep && packed_disk_size(p, obj_offset, oi->disk_sizep)) {
+		type = OBJ_BAD;
+		goto out;
 	}
 
 	if (oi->typep) {
@@ -2033,10 +2719,20 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	int st;
 	git_zstream stream;
 	unsigned char *buffer, *in;
+	unsigned long avail;
 
 	buffer = xmallocz_gently(size);
 	if (!buffer)
 		return NULL;
+
+	/* Most entries are within one window, and can go in one call */
+	in = use_pack(p, w_curs, curpos, &avail);
+	obj_read_unlock();
+	st = git_inflate_buffer(buffer, size, in, avail) >= 0;
+	obj_read_lock();
+	if (st)
+		return buffer;
+
 	memset(&stream, 0, sizeof(stream));
 	stream.next_out = buffer;
 	stream.avail_out = size + 1;
@@ -2045,7 +2741,9 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -2059,23 +2757,91 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into DELTA_BASE_CACHE_SHARDS shards,
+ * each with its own lock, LRU list and an equal share of
+ * core.deltaBaseCacheLimit, so that threads unpacking objects at the
+ * same time rarely contend for the same lock.  The number of slots is
+ * derived from the limit the first time the cache is used: a larger
+ * cache is of little use if all entries keep colliding in a handful of
+ * slots.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
+#define DELTA_BASE_CACHE_MIN_SLOTS 256
+#define DELTA_BASE_CACHE_MAX_SLOTS (64 * 1024)
+#define DELTA_BASE_CACHE_BYTES_PER_SLOT (16 * 1024)
 
-static struct delta_base_cache_lru_list {
+struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *prev;
 	struct delta_base_cache_lru_list *next;
-} delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
+};
 
-static struct delta_base_cache_entry {
+struct delta_base_cache_entry {
 	struct delta_base_cache_lru_list lru;
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct delta_base_cache_shard {
+#ifndef NO_PTHREADS
+	pthread_mutex_t mutex;
+#endif
+	struct delta_base_cache_lru_list lru;
+	struct delta_base_cache_entry *entries;
+	size_t cached;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+} delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+
+/* number of entries in each shard; a power of two */
+static unsigned long delta_base_cache_slots;
+static size_t delta_base_cache_shard_limit;
+
+#ifndef NO_PTHREADS
+#define lock_shard(s) pthread_mutex_lock(&(s)->mutex)
+#define unlock_shard(s) pthread_mutex_unlock(&(s)->mutex)
+#else
+#define lock_shard(s) (void)0
+#define unlock_shard(s) (void)0
+#endif
+
+/*
+ * Called on first use.  Threaded callers still serialize their first
+ * access to a pack (which needs the non-thread-safe window code anyway),
+ * so this cannot race with itself.
+ */
+static void init_delta_base_cache(void)
+{
+	size_t slots = delta_base_cache_limit / DELTA_BASE_CACHE_BYTES_PER_SLOT;
+	unsigned long per_shard = 1;
+	int i;
+
+	if (delta_base_cache_slots)
+		return;
+
+	if (slots < DELTA_BASE_CACHE_MIN_SLOTS)
+		slots = DELTA_BASE_CACHE_MIN_SLOTS;
+	if (slots > DELTA_BASE_CACHE_MAX_SLOTS)
+		slots = DELTA_BASE_CACHE_MAX_SLOTS;
+	while (per_shard * DELTA_BASE_CACHE_SHARDS < slots)
+		per_shard <<= 1;
+
+	delta_base_cache_shard_limit =
+		delta_base_cache_limit / DELTA_BASE_CACHE_SHARDS;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *s = &delta_base_cache[i];
+#ifndef NO_PTHREADS
+		pthread_mutex_init(&s->mutex, NULL);
+#endif
+		s->lru.prev = s->lru.next = &s->lru;
+		s->entries = xcalloc(per_shard, sizeof(*s->entries));
+	}
+	delta_base_cache_slots = per_shard;
+}
 
 static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
@@ -2083,14 +2849,25 @@ static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
 
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash;
+}
+
+static struct delta_base_cache_shard *
+get_delta_base_cache_shard(struct packed_git *p, off_t base_offset)
+{
+	unsigned long hash = pack_entry_hash(p, base_offset);
+	init_delta_base_cache();
+	return delta_base_cache + hash % DELTA_BASE_CACHE_SHARDS;
 }
 
+/* The caller must hold the lock of shard "s". */
 static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
+get_delta_base_cache_entry(struct delta_base_cache_shard *s,
+			   struct packed_git *p, off_t base_offset)
 {
 	unsigned long hash = pack_entry_hash(p, base_offset);
-	return delta_base_cache + hash;
+	hash /= DELTA_BASE_CACHE_SHARDS;
+	return s->entries + (hash & (delta_base_cache_slots - 1));
 }
 
 static int eq_delta_base_cache_entry(struct delta_base_cache_entry *ent,
@@ -2101,83 +2878,147 @@ static int eq_delta_base_cache_entry(struct delta_base_cache_entry *ent,
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
+	struct delta_base_cache_shard *s;
 	struct delta_base_cache_entry *ent;
-	ent = get_delta_base_cache_entry(p, base_offset);
-	return eq_delta_base_cache_entry(ent, p, base_offset);
+	int ret;
+
+	s = get_delta_base_cache_shard(p, base_offset);
+	lock_shard(s);
+	ent = get_delta_base_cache_entry(s, p, base_offset);
+	ret = eq_delta_base_cache_entry(ent, p, base_offset);
+	unlock_shard(s);
+	return ret;
 }
 
-static void clear_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void clear_delta_base_cache_entry(struct delta_base_cache_shard *s,
+					 struct delta_base_cache_entry *ent)
 {
 	ent->data = NULL;
 	ent->lru.next->prev = ent->lru.prev;
 	ent->lru.prev->next = ent->lru.next;
-	delta_base_cached -= ent->size;
+	s->cached -= ent->size;
+}
+
+/*
+ * Look up the object at "base_offset" in "p" and return its data, or
+ * NULL if it is not cached.  Unless "keep_cache" is set the entry is
+ * removed from the cache and the caller owns the returned buffer;
+ * otherwise the caller gets a copy.  Either way the lookup happens under
+ * the shard lock, so two threads can never take the same entry.
+ */
+static void *get_delta_base_cache_data(struct packed_git *p, off_t base_offset,
+				       unsigned long *base_size,
+				       enum object_type *type, int keep_cache)
+{
+	struct delta_base_cache_shard *s;
+	struct delta_base_cache_entry *ent;
+	void *ret = NULL;
+
+	s = get_delta_base_cache_shard(p, base_offset);
+	lock_shard(s);
+	ent = get_delta_base_cache_entry(s, p, base_offset);
+	if (eq_delta_base_cache_entry(ent, p, base_offset)) {
+		*type = ent->type;
+		*base_size = ent->size;
+		if (!keep_cache) {
+			ret = ent->data;
+			clear_delta_base_cache_entry(s, ent);
+		} else
+			ret = xmemdupz(ent->data, ent->size);
+		s->hits++;
+	} else
+		s->misses++;
+	unlock_shard(s);
+	return ret;
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
-	struct delta_base_cache_entry *ent;
 	void *ret;
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-
-	if (!eq_delta_base_cache_entry(ent, p, base_offset))
-		return unpack_entry(p, base_offset, type, base_size);
-
-	ret = ent->data;
-
-	if (!keep_cache)
-		clear_delta_base_cache_entry(ent);
-	else
-		ret = xmemdupz(ent->data, ent->size);
-	*type = ent->type;
-	*base_size = ent->size;
+	ret = get_delta_base_cache_data(p, base_offset, base_size, type,
+					keep_cache);
+	if (!ret)
+		ret = unpack_entry(p, base_offset, type, base_size);
 	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *s,
+					    struct delta_base_cache_entry *ent)
 {
 	if (ent->data) {
 		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+		clear_delta_base_cache_entry(s, ent);
 	}
 }
 
 void clear_delta_base_cache(void)
 {
+	int i;
 	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+
+	if (!delta_base_cache_slots)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *s = &delta_base_cache[i];
+		lock_shard(s);
+		for (p = 0; p < delta_base_cache_slots; p++)
+			release_delta_base_cache(s, &s->entries[p]);
+		unlock_shard(s);
+	}
+}
+
+void get_delta_base_cache_stats(struct delta_base_cache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->slots = delta_base_cache_slots * DELTA_BASE_CACHE_SHARDS;
+	if (!delta_base_cache_slots)
+		return;
+	for (i = 0; i < DELTA_BASE_CACHE_SHARDS; i++) {
+		struct delta_base_cache_shard *s = &delta_base_cache[i];
+		lock_shard(s);
+		stats->hits += s->hits;
+		stats->misses += s->misses;
+		stats->evictions += s->evictions;
+		stats->cached += s->cached;
+		unlock_shard(s);
+	}
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
+	struct delta_base_cache_shard *s;
+	struct delta_base_cache_entry *ent;
 	struct delta_base_cache_lru_list *lru;
 
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
+	s = get_delta_base_cache_shard(p, base_offset);
+	lock_shard(s);
+	ent = get_delta_base_cache_entry(s, p, base_offset);
 
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
+	if (ent->data)
+		s->evictions++;
+	release_delta_base_cache(s, ent);
+	s->cached += base_size;
+
+	for (lru = s->lru.next;
+	     s->cached > delta_base_cache_shard_limit && lru != &s->lru;
 	     lru = lru->next) {
 		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
+		if (f->type == OBJ_BLOB) {
+			release_delta_base_cache(s, f);
+			s->evictions++;
+		}
 	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
+	for (lru = s->lru.next;
+	     s->cached > delta_base_cache_shard_limit && lru != &s->lru;
 	     lru = lru->next) {
 		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
+		release_delta_base_cache(s, f);
+		s->evictions++;
 	}
 
 	ent->p = p;
@@ -2185,10 +3026,11 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	ent->lru.next = &s->lru;
+	ent->lru.prev = s->lru.prev;
+	s->lru.prev->next = &ent->lru;
+	s->lru.prev = &ent->lru;
+	unlock_shard(s);
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -2210,6 +3052,64 @@ struct unpack_entry_stack_ent {
 	unsigned long size;
 };
 
+static void account_delta_chain(int len)
+{
+	int bucket = 0;
+
+	while (len >> bucket && bucket < DELTA_CHAIN_BUCKETS - 1)
+		bucket++;
+	object_access.delta_chain[bucket]++;
+	if (object_access.delta_chain_max < len)
+		object_access.delta_chain_max = len;
+}
+
+/*
+ * Apply the whole chain of deltas on "stack" to "base" at once, with
+ * patch_delta_chain().  On success, "base" goes to the delta base cache
+ * and the result is returned; otherwise NULL, with "base" left as it
+ * was for applying the deltas one by one.
+ */
+static void *compose_delta_chain(struct packed_git *p,
+				 struct pack_window **w_curs,
+				 struct unpack_entry_stack_ent *stack, int nr,
+				 void *base, off_t base_offset,
+				 enum object_type base_type, unsigned long *size)
+{
+	void **deltas = xcalloc(nr, sizeof(*deltas));
+	unsigned long *delta_sizes = xcalloc(nr, sizeof(*delta_sizes));
+	unsigned long result_size;
+	void *data = NULL;
+	int i;
+
+	/* the bottom of the stack is the outermost delta */
+	for (i = 0; i < nr; i++) {
+		struct unpack_entry_stack_ent *ent = &stack[nr - 1 - i];
+
+		delta_sizes[i] = ent->size;
+		deltas[i] = unpack_compressed_entry(p, w_curs, ent->curpos,
+						    ent->size);
+		if (!deltas[i])
+			break;
+	}
+	if (i == nr) {
+		obj_read_unlock();
+		data = patch_delta_chain(base, *size, deltas, delta_sizes,
+					 nr, &result_size);
+		obj_read_lock();
+	}
+	for (i = 0; i < nr; i++)
+		free(deltas[i]);
+	free(deltas);
+	free(delta_sizes);
+
+	if (data) {
+		object_access.deltas_applied += nr;
+		add_delta_base_cache(p, base_offset, base, *size, base_type);
+		*size = result_size;
+	}
+	return data;
+}
+
 void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		   enum object_type *final_type, unsigned long *final_size)
 {
@@ -2224,29 +3124,32 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	int base_from_cache = 0;
 
 	write_pack_access_log(p, obj_offset);
+	object_access.unpacked_entries++;
 
 	/* PHASE 1: drill down to the innermost base object */
 	for (;;) {
 		off_t base_offset;
 		int i;
-		struct delta_base_cache_entry *ent;
-
-		ent = get_delta_base_cache_entry(p, curpos);
-		if (eq_delta_base_cache_entry(ent, p, curpos)) {
-			type = ent->type;
-			data = ent->data;
-			size = ent->size;
-			clear_delta_base_cache_entry(ent);
+
+		data = get_delta_base_cache_data(p, curpos, &size, &type, 0);
+		if (data) {
 			base_from_cache = 1;
 			break;
 		}
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
-			struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-			unsigned long len = revidx[1].offset - obj_offset;
-			if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
+			uint32_t pos, index_pos;
+			unsigned long len;
+
+			if (offset_to_pack_pos(p, obj_offset, &pos) < 0) {
+				unuse_pack(&w_curs);
+				return NULL;
+			}
+			len = pack_pos_to_offset(p, pos + 1) - obj_offset;
+			index_pos = pack_pos_to_index(p, pos);
+			if (check_pack_crc(p, &w_curs, obj_offset, len, index_pos)) {
 				const unsigned char *sha1 =
-					nth_packed_object_sha1(p, revidx->nr);
+					nth_packed_object_sha1(p, index_pos);
 				error("bad packed object CRC for %s",
 				      sha1_to_hex(sha1));
 				mark_bad_packed_object(p, sha1);
@@ -2287,6 +3190,8 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		curpos = obj_offset = base_offset;
 	}
 
+	account_delta_chain(delta_stack_nr);
+
 	/* PHASE 2: handle the base */
 	switch (type) {
 	case OBJ_OFS_DELTA:
@@ -2309,6 +3214,25 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 
 	/* PHASE 3: apply deltas in order */
 
+	/* a long chain is best applied at once, if it is sound */
+	if (data && delta_compose_depth > 0 &&
+	    delta_stack_nr >= delta_compose_depth) {
+		void *result = compose_delta_chain(p, &w_curs, delta_stack,
+						   delta_stack_nr, data,
+						   obj_offset, type, &size);
+		if (result) {
+			/*
+			 * Deltas against it are likely to come next, as
+			 * they would have found the bases in the middle
+			 * of the chain in the cache otherwise.
+			 */
+			add_delta_base_cache(p, delta_stack[0].obj_offset,
+					     xmemdupz(result, size), size, type);
+			data = result;
+			delta_stack_nr = 0;
+		}
+	}
+
 	/* invariants:
 	 *   'data' holds the base data, or NULL if there was corruption
 	 */
@@ -2316,13 +3240,13 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		void *delta_data;
 		void *base = data;
 		unsigned long delta_size, base_size = size;
+		off_t base_offset = obj_offset;
+		enum object_type base_type = type;
+		int cache_base = !!base;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -2330,11 +3254,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			 * This is costly but should happen only in the presence
 			 * of a corrupted pack, and is better than failing outright.
 			 */
-			struct revindex_entry *revidx;
+			uint32_t pos;
 			const unsigned char *base_sha1;
-			revidx = find_pack_revindex(p, obj_offset);
-			if (revidx) {
-				base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+			if (!offset_to_pack_pos(p, obj_offset, &pos)) {
+				base_sha1 = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 				error("failed to read delta base object %s"
 				      " at offset %"PRIuMAX" from %s",
 				      sha1_to_hex(base_sha1), (uintmax_t)obj_offset,
@@ -2358,13 +3282,31 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			error("failed to unpack compressed delta "
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
+			if (cache_base)
+				add_delta_base_cache(p, base_offset, base,
+						     base_size, base_type);
+			else
+				free(base);
 			data = NULL;
 			continue;
 		}
 
+		/*
+		 * Only hand the base to the cache once we are done with it;
+		 * with the object read lock dropped, another thread could
+		 * evict it from there in the meantime.
+		 */
+		obj_read_unlock();
 		data = patch_delta(base, base_size,
 				   delta_data, delta_size,
 				   &size);
+		obj_read_lock();
+		object_access.deltas_applied++;
+		if (cache_base)
+			add_delta_base_cache(p, base_offset, base, base_size,
+					     base_type);
+		else
+			free(base);
 
 		/*
 		 * We could not apply the delta; warn the user, but keep going.
@@ -2391,6 +3333,20 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 	return data;
 }
 
+void *unpack_delta_base(struct packed_git *p, off_t offset,
+			enum object_type *type, unsigned long *size)
+{
+	void *data = get_delta_base_cache_data(p, offset, size, type, 1);
+
+	if (!data) {
+		data = unpack_entry(p, offset, type, size);
+		if (data)
+			add_delta_base_cache(p, offset, xmemdupz(data, *size),
+					     *size, *type);
+	}
+	return data;
+}
+
 const unsigned char *nth_packed_object_sha1(struct packed_git *p,
 					    uint32_t n)
 {
@@ -2429,8 +3385,12 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 	}
 }
 
-off_t find_pack_entry_one(const unsigned char *sha1,
-				  struct packed_git *p)
+/*
+ * Like find_pack_entry_one(), also storing the position of the object
+ * in the .idx into *nth.
+ */
+static off_t find_pack_entry_nth(const unsigned char *sha1,
+				 struct packed_git *p, uint32_t *nth)
 {
 	const uint32_t *level1_ofs = p->index_data;
 	const unsigned char *index = p->index_data;
@@ -2472,6 +3432,7 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 					 lo, hi, p->num_objects, sha1);
 		if (pos < 0)
 			return 0;
+		*nth = pos;
 		return nth_packed_object_offset(p, pos);
 	}
 
@@ -2482,8 +3443,10 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 		if (debug_lookup)
 			printf("lo %u hi %u rg %u mi %u\n",
 			       lo, hi, hi - lo, mi);
-		if (!cmp)
+		if (!cmp) {
+			*nth = mi;
 			return nth_packed_object_offset(p, mi);
+		}
 		if (cmp > 0)
 			hi = mi;
 		else
@@ -2492,6 +3455,13 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 	return 0;
 }
 
+off_t find_pack_entry_one(const unsigned char *sha1,
+				  struct packed_git *p)
+{
+	uint32_t nth;
+	return find_pack_entry_nth(sha1, p, &nth);
+}
+
 int is_pack_valid(struct packed_git *p)
 {
 	/* An already open pack is known to be valid. */
@@ -2513,20 +3483,27 @@ int is_pack_valid(struct packed_git *p)
 	return !open_packed_git(p);
 }
 
+static int is_bad_packed_object(struct packed_git *p, const unsigned char *sha1)
+{
+	unsigned i;
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return 1;
+	return 0;
+}
+
 static int fill_pack_entry(const unsigned char *sha1,
 			   struct pack_entry *e,
 			   struct packed_git *p)
 {
 	off_t offset;
+	uint32_t pos;
 
-	if (p->num_bad_objects) {
-		unsigned i;
-		for (i = 0; i < p->num_bad_objects; i++)
-			if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
-				return 0;
-	}
+	if (p->num_bad_objects && is_bad_packed_object(p, sha1))
+		return 0;
 
-	offset = find_pack_entry_one(sha1, p);
+	offset = find_pack_entry_nth(sha1, p, &pos);
 	if (!offset)
 		return 0;
 
@@ -2540,6 +3517,36 @@ static int fill_pack_entry(const unsigned char *sha1,
 	if (!is_pack_valid(p))
 		return 0;
 	e->offset = offset;
+	e->pos = pos;
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+/*
+ * Look sha1 up in the multi-pack index m.  Returns 1 and fills e if the
+ * object was found in a usable pack, 0 if m does not know the object,
+ * and -1 if m knows it but the pack it points at cannot be used (the
+ * object may still be found in another pack).
+ */
+static int fill_midx_entry(const unsigned char *sha1,
+			   struct pack_entry *e,
+			   struct multi_pack_index *m)
+{
+	struct packed_git *p;
+	uint32_t pos;
+
+	if (!bsearch_midx(m, sha1, &pos))
+		return 0;
+	p = nth_midxed_pack(m, pos);
+	if (!p || (p->num_bad_objects && is_bad_packed_object(p, sha1)) ||
+	    open_pack_index(p) || !is_pack_valid(p))
+		return -1;
+	pos = nth_midxed_pack_pos(m, pos);
+	if (pos >= p->num_objects)
+		return -1;
+	e->offset = nth_packed_object_offset(p, pos);
+	e->pos = pos;
 	e->p = p;
 	hashcpy(e->sha1, sha1);
 	return 1;
@@ -2551,7 +3558,9 @@ static int fill_pack_entry(const unsigned char *sha1,
  */
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
+	int skip_midxed = 1;
 
 	prepare_packed_git();
 	if (!packed_git)
@@ -2560,9 +3569,21 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
+	for (m = multi_pack_index; m; m = m->next) {
+		int ret = fill_midx_entry(sha1, e, m);
+		if (ret > 0) {
+			last_found_pack = e->p;
+			return 1;
+		}
+		if (ret < 0)
+			skip_midxed = 0;
+	}
+
 	for (p = packed_git; p; p = p->next) {
 		if (p == last_found_pack)
 			continue; /* we already checked this one */
+		if (skip_midxed && p->multi_pack_index)
+			continue; /* the multi-pack index said it is not there */
 
 		if (fill_pack_entry(sha1, e, p)) {
 			last_found_pack = p;
@@ -2644,13 +3665,27 @@ static int sha1_loose_object_info(const unsigned char *sha1,
 	return 0;
 }
 
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+/*
+ * In a partial clone, fetch an object we do not have from the remote
+ * it was cloned from.  Returns 1 if it is worth looking for it again.
+ */
+static int fetch_missing_object(const unsigned char *sha1)
+{
+	if (!repository_format_partial_clone || !fetch_if_missing)
+		return 0;
+	fetch_object(repository_format_partial_clone, sha1);
+	return 1;
+}
+
+static int do_sha1_object_info_extended(const unsigned char *sha1,
+					struct object_info *oi, unsigned flags)
 {
 	struct cached_object *co;
 	struct pack_entry e;
 	int rtype;
 	enum object_type real_type;
 	const unsigned char *real = lookup_replace_object_extended(sha1, flags);
+	int already_fetched = 0;
 
 	co = find_cached_object(real);
 	if (co) {
@@ -2665,20 +3700,36 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 		if (oi->typename)
 			strbuf_addstr(oi->typename, typename(co->type));
 		oi->whence = OI_CACHED;
+		object_access.info_cached++;
 		return 0;
 	}
 
+retry:
 	if (!find_pack_entry(real, &e)) {
 		/* Most likely it's a loose object. */
 		if (!sha1_loose_object_info(real, oi, flags)) {
 			oi->whence = OI_LOOSE;
+			object_access.info_loose++;
 			return 0;
 		}
 
 		/* Not a loose object; someone else may have just packed it. */
 		reprepare_packed_git();
-		if (!find_pack_entry(real, &e))
-			return -1;
+		if (!find_pack_entry(real, &e)) {
+			/* or written it into an alternate after we listed it */
+			if (core_alternates_cache &&
+			    !sha1_loose_object_info(real, oi, flags)) {
+				oi->whence = OI_LOOSE;
+				object_access.info_loose++;
+				return 0;
+			}
+			if (already_fetched || !fetch_missing_object(real)) {
+				object_access.missing++;
+				return -1;
+			}
+			already_fetched = 1;
+			goto retry;
+		}
 	}
 
 	/*
@@ -2688,7 +3739,7 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 	if (oi->typename && !oi->typep)
 		oi->typep = &real_type;
 
-	rtype = packed_object_info(e.p, e.offset, oi);
+	rtype = packed_object_info(e.p, e.pos, e.offset, oi);
 	if (rtype < 0) {
 		mark_bad_packed_object(e.p, real);
 		if (oi->typep == &real_type)
@@ -2707,10 +3758,21 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi,
 		strbuf_addstr(oi->typename, typename(*oi->typep));
 	if (oi->typep == &real_type)
 		oi->typep = NULL;
+	object_access.info_packed++;
 
 	return 0;
 }
 
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_sha1_object_info_extended(sha1, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
@@ -2732,6 +3794,7 @@ static void *read_packed_sha1(const unsigned char *sha1,
 
 	if (!find_pack_entry(sha1, &e))
 		return NULL;
+	object_access.read_packed++;
 	data = cache_or_unpack_entry(e.p, e.offset, size, type, 1);
 	if (!data) {
 		/*
@@ -2766,31 +3829,55 @@ int pretend_sha1_file(void *buf, unsigned long len, enum object_type type,
 	return 0;
 }
 
-static void *read_object(const unsigned char *sha1, enum object_type *type,
-			 unsigned long *size)
+static void *read_local_object(const unsigned char *sha1,
+			       enum object_type *type, unsigned long *size)
 {
 	unsigned long mapsize;
 	void *map, *buf;
-	struct cached_object *co;
-
-	co = find_cached_object(sha1);
-	if (co) {
-		*type = co->type;
-		*size = co->size;
-		return xmemdupz(co->buf, co->size);
-	}
+	int retried = 0;
 
+retry:
 	buf = read_packed_sha1(sha1, type, size);
 	if (buf)
 		return buf;
 	map = map_sha1_file(sha1, &mapsize);
 	if (map) {
+		object_access.read_loose++;
+		obj_read_unlock();
 		buf = unpack_sha1_file(map, mapsize, type, size, sha1);
+		obj_read_lock();
 		munmap(map, mapsize);
 		return buf;
 	}
 	reprepare_packed_git();
-	return read_packed_sha1(sha1, type, size);
+	buf = read_packed_sha1(sha1, type, size);
+	if (!buf && core_alternates_cache && !retried) {
+		/* the listings of the alternates have just been refreshed */
+		retried = 1;
+		goto retry;
+	}
+	return buf;
+}
+
+static void *read_object(const unsigned char *sha1, enum object_type *type,
+			 unsigned long *size)
+{
+	void *buf;
+	struct cached_object *co;
+
+	co = find_cached_object(sha1);
+	if (co) {
+		*type = co->type;
+		*size = co->size;
+		return xmemdupz(co->buf, co->size);
+	}
+
+	buf = read_local_object(sha1, type, size);
+	if (!buf && !has_loose_object(sha1) && fetch_missing_object(sha1))
+		buf = read_local_object(sha1, type, size);
+	if (!buf)
+		object_access.missing++;
+	return buf;
 }
 
 /*
@@ -2805,10 +3892,13 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 {
 	void *data;
 	const struct packed_git *p;
-	const unsigned char *repl = lookup_replace_object_extended(sha1, flag);
+	const unsigned char *repl;
 
+	obj_read_lock();
+	repl = lookup_replace_object_extended(sha1, flag);
 	errno = 0;
 	data = read_object(repl, type, size);
+	obj_read_unlock();
 	if (data)
 		return data;
 
@@ -2960,10 +4050,221 @@ int hash_sha1_file(const void *buf, unsigned long len, const char *type,
 	return 0;
 }
 
+void hash_sha1_files(struct hash_object_job *jobs, int nr)
+{
+	git_SHA1_Job sha1_jobs[32];
+	char hdr[32];
+	int i, batch;
+
+	while (nr) {
+		batch = nr < ARRAY_SIZE(sha1_jobs) ? nr : ARRAY_SIZE(sha1_jobs);
+		for (i = 0; i < batch; i++) {
+			int hdrlen = sprintf(hdr, "%s %lu",
+					     jobs[i].type, jobs[i].len) + 1;
+			git_SHA1_Init(&sha1_jobs[i].ctx);
+			git_SHA1_Update(&sha1_jobs[i].ctx, hdr, hdrlen);
+			sha1_jobs[i].data = jobs[i].buf;
+			sha1_jobs[i].len = jobs[i].len;
+			sha1_jobs[i].hashout = jobs[i].sha1;
+		}
+		git_SHA1_Multi(sha1_jobs, batch);
+		jobs += batch;
+		nr -= batch;
+	}
+}
+
+/*
+ * With core.fsyncObjectFiles=batch, the loose objects written between
+ * begin_loose_object_batch() and end_loose_object_batch() go to a
+ * temporary object directory, which is an alternate meanwhile so that
+ * they can be read back.  At the end of the batch they are all flushed
+ * to disk at once, and only then moved into place, so that no object
+ * becomes visible before its contents are safe.
+ */
+static struct loose_object_batch {
+	int depth;
+	unsigned failed:1;
+	struct strbuf dir;
+	struct alternate_object_database *alt;
+	struct sha1_array written;
+} loose_batch = { 0, 0, STRBUF_INIT, NULL, SHA1_ARRAY_INIT };
+
+static void batch_object_name(struct strbuf *buf, const unsigned char *sha1)
+{
+	const char *hex = sha1_to_hex(sha1);
+
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%s/%.2s/%s", loose_batch.dir.buf, hex, hex + 2);
+}
+
+static int is_loose_object_batch(struct alternate_object_database *alt)
+{
+	return alt == loose_batch.alt;
+}
+
+static void remove_loose_object_batch(void)
+{
+	struct alternate_object_database *alt = loose_batch.alt;
+
+	if (!alt)
+		return;
+	/* begin_loose_object_batch() put it first */
+	alt_odb_list = alt->next;
+	if (alt_odb_tail == &alt->next)
+		alt_odb_tail = &alt_odb_list;
+	free(alt);
+	loose_batch.alt = NULL;
+
+	remove_dir_recursively(&loose_batch.dir, 0);
+	strbuf_reset(&loose_batch.dir);
+	sha1_array_clear(&loose_batch.written);
+}
+
+void begin_loose_object_batch(void)
+{
+	loose_batch.depth++;
+}
+
+/*
+ * Set up the temporary object directory of the batch, when the first
+ * object is written into it.
+ */
+static int start_loose_object_batch(void)
+{
+	static int cleanup_registered;
+	struct alternate_object_database *alt;
+	size_t len;
+
+	if (loose_batch.alt)
+		return 1;
+	if (!loose_batch.depth || loose_batch.failed ||
+	    fsync_object_files != FSYNC_OBJECT_FILES_BATCH)
+		return 0;
+
+	strbuf_addf(&loose_batch.dir, "%s/tmp_batch_XXXXXX",
+		    get_object_directory());
+	if (!mkdtemp(loose_batch.dir.buf)) {
+		/* sync every object on its own then */
+		warning("unable to create a temporary object directory: %s",
+			strerror(errno));
+		strbuf_reset(&loose_batch.dir);
+		loose_batch.failed = 1;
+		return 0;
+	}
+	if (!cleanup_registered) {
+		atexit(remove_loose_object_batch);
+		cleanup_registered = 1;
+	}
+
+	/* '/' + sha1(2) + '/' + sha1(38) + '\0', as in link_alt_odb_entry() */
+	len = loose_batch.dir.len;
+	alt = xmalloc(sizeof(*alt) + len + 43);
+	memcpy(alt->base, loose_batch.dir.buf, len);
+	alt->base[len] = '/';
+	alt->base[len + 3] = '/';
+	alt->base[len + 42] = '\0';
+	alt->name = alt->base + len + 1;
+
+	prepare_alt_odb();
+	alt->next = alt_odb_list;
+	alt_odb_list = alt;
+	if (alt_odb_tail == &alt_odb_list)
+		alt_odb_tail = &alt->next;
+	loose_batch.alt = alt;
+	return 1;
+}
+
+static void fsync_dir(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		die_errno("unable to open directory '%s'", path);
+	/* not every filesystem can sync a directory */
+	if (fsync(fd) < 0 && errno != EINVAL)
+		die_errno("unable to fsync directory '%s'", path);
+	close(fd);
+}
+
+/* Flush all the objects of the batch to disk. */
+static void sync_loose_object_batch(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+#ifdef HAVE_SYNCFS
+	int fd = open(loose_batch.dir.buf, O_RDONLY);
+
+	if (fd >= 0 && !syncfs(fd)) {
+		close(fd);
+		return;
+	}
+	if (fd >= 0)
+		close(fd);
+#endif
+	for (i = 0; i < loose_batch.written.nr; i++) {
+		int fd;
+
+		batch_object_name(&path, loose_batch.written.sha1[i]);
+		fd = open(path.buf, O_RDONLY);
+		if (fd < 0)
+			die_errno("unable to open '%s'", path.buf);
+		fsync_or_die(fd, path.buf);
+		close(fd);
+	}
+	strbuf_release(&path);
+}
+
+void end_loose_object_batch(void)
+{
+	struct strbuf src = STRBUF_INIT;
+	uint32_t moved[256 / 32] = { 0 };
+	const char *objdir = get_object_directory();
+	int i;
+
+	if (!loose_batch.depth || --loose_batch.depth)
+		return;
+	loose_batch.failed = 0;
+	if (!loose_batch.alt)
+		return;
+
+	sync_loose_object_batch();
+
+	for (i = 0; i < loose_batch.written.nr; i++) {
+		const unsigned char *sha1 = loose_batch.written.sha1[i];
+		const char *dst = sha1_file_name(sha1);
+		uint32_t bit = 1u << (sha1[0] % 32);
+
+		if (!(moved[sha1[0] / 32] & bit)) {
+			const char *dir = mkpath("%s/%02x", objdir, sha1[0]);
+
+			if (mkdir(dir, 0777) && errno != EEXIST)
+				die_errno("unable to create directory '%s'", dir);
+			if (adjust_shared_perm(dir))
+				die("unable to set permission to '%s'", dir);
+			moved[sha1[0] / 32] |= bit;
+		}
+		batch_object_name(&src, sha1);
+		if (move_temp_to_file(src.buf, dst))
+			die("unable to move object %s into place",
+			    sha1_to_hex(sha1));
+	}
+
+	/* make the new names as durable as the contents */
+	for (i = 0; i < 256; i++)
+		if (moved[i / 32] & (1u << (i % 32)))
+			fsync_dir(mkpath("%s/%02x", objdir, i));
+	fsync_dir(objdir);
+
+	strbuf_release(&src);
+	remove_loose_object_batch();
+}
+
 /* Finalize a file on disk, and close it. */
 static void close_sha1_file(int fd)
 {
-	if (fsync_object_files)
+	/* a batch is synced all at once when it ends */
+	if (fsync_object_files && !loose_batch.alt)
 		fsync_or_die(fd, "sha1 file");
 	if (close(fd) != 0)
 		die_errno("error when closing sha1 file");
@@ -3021,7 +4322,14 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 	git_SHA_CTX c;
 	unsigned char parano_sha1[20];
 	static char tmp_file[PATH_MAX];
-	const char *filename = sha1_file_name(sha1);
+	static struct strbuf batch_name = STRBUF_INIT;
+	const char *filename;
+
+	if (start_loose_object_batch()) {
+		batch_object_name(&batch_name, sha1);
+		filename = batch_name.buf;
+	} else
+		filename = sha1_file_name(sha1);
 
 	fd = create_tmpfile(tmp_file, sizeof(tmp_file), filename);
 	if (fd < 0) {
@@ -3077,7 +4385,12 @@ static int write_loose_object(const unsigned char *sha1, char *hdr, int hdrlen,
 				tmp_file, strerror(errno));
 	}
 
-	return move_temp_to_file(tmp_file, filename);
+	if (move_temp_to_file(tmp_file, filename))
+		return -1;
+	if (loose_batch.alt)
+		sha1_array_append(&loose_batch.written, sha1);
+	add_to_loose_object_cache(sha1);
+	return 0;
 }
 
 static int freshen_loose_object(const unsigned char *sha1)
@@ -3174,11 +4487,16 @@ int has_sha1_file_with_flags(const unsigned char *sha1, int flags)
 
 	if (find_pack_entry(sha1, &e))
 		return 1;
-	if (has_loose_object(sha1))
+	if ((flags & HAS_SHA1_QUICK) && core_loose_object_cache) {
+		if (has_cached_loose_object(sha1))
+			return 1;
+	} else if (has_loose_object(sha1))
 		return 1;
 	if (flags & HAS_SHA1_QUICK)
 		return 0;
 	reprepare_packed_git();
+	if (core_alternates_cache && has_loose_object_nonlocal(sha1))
+		return 1;
 	return find_pack_entry(sha1, &e);
 }
 
@@ -3571,15 +4889,49 @@ static int for_each_object_in_pack(struct packed_git *p, each_packed_object_fn c
 	return r;
 }
 
+static int for_each_object_in_midx(struct multi_pack_index *m,
+				   each_packed_object_fn cb, void *data)
+{
+	uint32_t i;
+	int r = 0;
+
+	for (i = 0; i < m->num_objects; i++) {
+		struct packed_git *p = nth_midxed_pack(m, i);
+
+		if (!p)
+			return error("bad pack id for object %u in %s/pack/multi-pack-index",
+				     i, m->object_dir);
+		r = cb(nth_midxed_object_sha1(m, i), p,
+		       nth_midxed_pack_pos(m, i), data);
+		if (r)
+			break;
+	}
+	return r;
+}
+
 int for_each_packed_object(each_packed_object_fn cb, void *data, unsigned flags)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
 	int r = 0;
 
 	prepare_packed_git();
+	for (m = multi_pack_index; m; m = m->next) {
+		if ((flags & FOR_EACH_OBJECT_LOCAL_ONLY) && !m->local)
+			continue;
+		r = for_each_object_in_midx(m, cb, data);
+		if (r)
+			return r;
+	}
 	for (p = packed_git; p; p = p->next) {
 		if ((flags & FOR_EACH_OBJECT_LOCAL_ONLY) && !p->pack_local)
 			continue;
+		if (p->multi_pack_index)
+			continue;
+		if (open_pack_index(p)) {
+			error("unable to open index of %s", p->pack_name);
+			continue;
+		}
 		r = for_each_object_in_pack(p, cb, data);
 		if (r)
 			break;
@@ -7,6 +7,9 @@
 #include "refs.h"
 #include "remote.h"
 #include "dir.h"
+#include "midx.h"
+#include "sha1-array.h"
+#include "sha1-lookup.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -72,54 +75,6 @@ static void update_candidates(struct disambiguate_state *ds, const unsigned char
 	/* otherwise, current can be discarded and candidate is still good */
 }
 
-static void find_short_object_filename(int len, const char *hex_pfx, struct disambiguate_state *ds)
-{
-	struct alternate_object_database *alt;
-	char hex[40];
-	static struct alternate_object_database *fakeent;
-
-	if (!fakeent) {
-		/*
-		 * Create a "fake" alternate object database that
-		 * points to our own object database, to make it
-		 * easier to get a temporary working space in
-		 * alt->name/alt->base while iterating over the
-		 * object databases including our own.
-		 */
-		const char *objdir = get_object_directory();
-		int objdir_len = strlen(objdir);
-		int entlen = objdir_len + 43;
-		fakeent = xmalloc(sizeof(*fakeent) + entlen);
-		memcpy(fakeent->base, objdir, objdir_len);
-		fakeent->name = fakeent->base + objdir_len + 1;
-		fakeent->name[-1] = '/';
-	}
-	fakeent->next = alt_odb_list;
-
-	sprintf(hex, "%.2s", hex_pfx);
-	for (alt = fakeent; alt && !ds->ambiguous; alt = alt->next) {
-		struct dirent *de;
-		DIR *dir;
-		sprintf(alt->name, "%.2s/", hex_pfx);
-		dir = opendir(alt->base);
-		if (!dir)
-			continue;
-
-		while (!ds->ambiguous && (de = readdir(dir)) != NULL) {
-			unsigned char sha1[20];
-
-			if (strlen(de->d_name) != 38)
-				continue;
-			if (memcmp(de->d_name, hex_pfx + 2, len - 2))
-				continue;
-			memcpy(hex + 2, de->d_name, 38);
-			if (!get_sha1_hex(hex, sha1))
-				update_candidates(ds, sha1);
-		}
-		closedir(dir);
-	}
-}
-
 static int match_sha(unsigned len, const unsigned char *a, const unsigned char *b)
 {
 	do {
@@ -135,26 +90,50 @@ static int match_sha(unsigned len, const unsigned char *a, const unsigned char *
 	return 1;
 }
 
-static void unique_in_pack(int len,
-			  const unsigned char *bin_pfx,
-			   struct packed_git *p,
-			   struct disambiguate_state *ds)
+static void find_short_object_filename(int len, const unsigned char *bin_pfx,
+				       struct disambiguate_state *ds)
 {
-	uint32_t num, last, i, first = 0;
-	const unsigned char *current = NULL;
+	struct sha1_array *loose = loose_objects_with_prefix(bin_pfx[0], 0);
+	int i;
+
+	/*
+	 * bin_pfx is padded with zeroes, so it sorts no later than any
+	 * name it is a prefix of; start at the first such position.
+	 */
+	i = sha1_array_lookup(loose, bin_pfx);
+	if (i < 0)
+		i = -1 - i;
+	while (i > 0 && !hashcmp(loose->sha1[i - 1], bin_pfx))
+		i--;
+	for (; i < loose->nr && !ds->ambiguous; i++) {
+		if (!match_sha(len, bin_pfx, loose->sha1[i]))
+			break;
+		update_candidates(ds, loose->sha1[i]);
+	}
+}
+
+/*
+ * Find the position of the lowest object in the index of "p" whose name
+ * is not smaller than "sha1", and tell whether it is "sha1" itself.
+ */
+static int bsearch_pack(const unsigned char *sha1, struct packed_git *p,
+			uint32_t *result)
+{
+	uint32_t first = 0, last;
+	int found = 0;
 
 	open_pack_index(p);
-	num = p->num_objects;
-	last = num;
+	last = p->num_objects;
 	while (first < last) {
 		uint32_t mid = (first + last) / 2;
 		const unsigned char *current;
 		int cmp;
 
 		current = nth_packed_object_sha1(p, mid);
-		cmp = hashcmp(bin_pfx, current);
+		cmp = hashcmp(sha1, current);
 		if (!cmp) {
 			first = mid;
+			found = 1;
 			break;
 		}
 		if (cmp > 0) {
@@ -163,6 +142,20 @@ static void unique_in_pack(int len,
 		}
 		last = mid;
 	}
+	*result = first;
+	return found;
+}
+
+static void unique_in_pack(int len,
+			  const unsigned char *bin_pfx,
+			   struct packed_git *p,
+			   struct disambiguate_state *ds)
+{
+	uint32_t num, i, first;
+	const unsigned char *current = NULL;
+
+	bsearch_pack(bin_pfx, p, &first);
+	num = p->num_objects;
 
 	/*
 	 * At this point, "first" is the location of the lowest object
@@ -177,14 +170,40 @@ static void unique_in_pack(int len,
 	}
 }
 
+static void unique_in_midx(int len,
+			   const unsigned char *bin_pfx,
+			   struct multi_pack_index *m,
+			   struct disambiguate_state *ds)
+{
+	uint32_t num = m->num_objects, i, first;
+	const unsigned char *current;
+
+	bsearch_midx(m, bin_pfx, &first);
+
+	/*
+	 * As in unique_in_pack(), "first" is now the lowest object
+	 * name that could match "bin_pfx".
+	 */
+	for (i = first; i < num && !ds->ambiguous; i++) {
+		current = nth_midxed_object_sha1(m, i);
+		if (!match_sha(len, bin_pfx, current))
+			break;
+		update_candidates(ds, current);
+	}
+}
+
 static void find_short_packed_object(int len, const unsigned char *bin_pfx,
 				     struct disambiguate_state *ds)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
 
 	prepare_packed_git();
+	for (m = multi_pack_index; m && !ds->ambiguous; m = m->next)
+		unique_in_midx(len, bin_pfx, m, ds);
 	for (p = packed_git; p && !ds->ambiguous; p = p->next)
-		unique_in_pack(len, bin_pfx, p, ds);
+		if (!p->multi_pack_index)
+			unique_in_pack(len, bin_pfx, p, ds);
 }
 
 #define SHORT_NAME_NOT_FOUND (-1)
@@ -335,8 +354,16 @@ static int get_short_sha1(const char *name, int len, unsigned char *sha1,
 	else if (flags & GET_SHA1_BLOB)
 		ds.fn = disambiguate_blob_only;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_object_filename(len, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
+	if (!ds.candidate_exists && !ds.ambiguous) {
+		/*
+		 * The listing of loose objects may predate an object
+		 * another process wrote since; look again before giving up.
+		 */
+		loose_objects_with_prefix(bin_pfx[0], 1);
+		find_short_object_filename(len, bin_pfx, &ds);
+	}
 	status = finish_object_disambiguation(&ds, sha1);
 
 	if (!quietly && (status == SHORT_NAME_AMBIGUOUS))
@@ -363,31 +390,134 @@ int for_each_abbrev(const char *prefix, each_abbrev_fn fn, void *cb_data)
 	ds.cb_data = cb_data;
 	ds.fn = fn;
 
-	find_short_object_filename(len, hex_pfx, &ds);
+	find_short_object_filename(len, bin_pfx, &ds);
 	find_short_packed_object(len, bin_pfx, &ds);
 	return ds.ambiguous;
 }
 
+/*
+ * The names closest to "sha1" in each sorted list of objects are the
+ * only ones that can share a longer prefix with it than the others do,
+ * so find_unique_abbrev() only needs to look at them: an abbreviation
+ * is unique when it is one hex digit longer than the longest prefix
+ * "sha1" shares with any of its neighbours.
+ */
+struct min_abbrev_data {
+	const unsigned char *sha1;
+	int len;
+	int found;
+};
+
+static void extend_abbrev_len(const unsigned char *a,
+			      struct min_abbrev_data *mad)
+{
+	const unsigned char *b = mad->sha1;
+	int i = 0;
+
+	while (i < 19 && a[i] == b[i])
+		i++;
+	i = 2 * i + ((a[i] & 0xf0) == (b[i] & 0xf0));
+	if (mad->len < i + 1)
+		mad->len = i + 1;
+}
+
+/*
+ * "first" is the position of the lowest name in "table" that is not
+ * smaller than mad->sha1; look at the distinct names on both sides.
+ */
+static void abbrev_neighbours(void *table, uint32_t nr, uint32_t first,
+			      sha1_access_fn fn, struct min_abbrev_data *mad)
+{
+	uint32_t i;
+
+	for (i = first; i < nr && !hashcmp(fn(i, table), mad->sha1); i++)
+		mad->found = 1;
+	if (i < nr)
+		extend_abbrev_len(fn(i, table), mad);
+	if (first)
+		extend_abbrev_len(fn(first - 1, table), mad);
+}
+
+static const unsigned char *midx_sha1_access(size_t index, void *table)
+{
+	return nth_midxed_object_sha1(table, index);
+}
+
+static const unsigned char *pack_sha1_access(size_t index, void *table)
+{
+	return nth_packed_object_sha1(table, index);
+}
+
+static const unsigned char *loose_sha1_access(size_t index, void *table)
+{
+	return ((struct sha1_array *)table)->sha1[index];
+}
+
+static void find_abbrev_len_packed(struct min_abbrev_data *mad)
+{
+	struct multi_pack_index *m;
+	struct packed_git *p;
+	uint32_t first;
+
+	prepare_packed_git();
+	for (m = multi_pack_index; m; m = m->next) {
+		bsearch_midx(m, mad->sha1, &first);
+		abbrev_neighbours(m, m->num_objects, first,
+				  midx_sha1_access, mad);
+	}
+	for (p = packed_git; p; p = p->next) {
+		if (p->multi_pack_index)
+			continue;
+		bsearch_pack(mad->sha1, p, &first);
+		abbrev_neighbours(p, p->num_objects, first,
+				  pack_sha1_access, mad);
+	}
+}
+
+static void find_abbrev_len_loose(struct min_abbrev_data *mad, int refresh)
+{
+	struct sha1_array *loose = loose_objects_with_prefix(mad->sha1[0], refresh);
+	int pos = sha1_array_lookup(loose, mad->sha1);
+
+	if (pos < 0)
+		pos = -1 - pos;
+	/* the lookup may land on any of several copies of the name */
+	while (pos > 0 && !hashcmp(loose->sha1[pos - 1], mad->sha1))
+		pos--;
+	abbrev_neighbours(loose, loose->nr, pos, loose_sha1_access, mad);
+}
+
 const char *find_unique_abbrev(const unsigned char *sha1, int len)
 {
-	int status, exists;
 	static char hex[41];
+	struct min_abbrev_data mad;
 
 	memcpy(hex, sha1_to_hex(sha1), 40);
 	if (len == 40 || !len)
 		return hex;
-	exists = has_sha1_file(sha1);
-	while (len < 40) {
-		unsigned char sha1_ret[20];
-		status = get_short_sha1(hex, len, sha1_ret, GET_SHA1_QUIETLY);
-		if (exists
-		    ? !status
-		    : status == SHORT_NAME_NOT_FOUND) {
-			hex[len] = 0;
-			return hex;
-		}
-		len++;
+
+	prepare_alt_odb();
+	mad.sha1 = sha1;
+	mad.len = len;
+	mad.found = 0;
+	find_abbrev_len_packed(&mad);
+	find_abbrev_len_loose(&mad, 0);
+	if (!mad.found) {
+		/* it may have been written since we listed the directory */
+		find_abbrev_len_loose(&mad, 1);
+		if (!mad.found && has_sha1_file(sha1))
+			/* ... or come in a pack we had not seen yet */
+			find_abbrev_len_packed(&mad);
 	}
+
+	if (!mad.found) {
+		/* any prefix no object starts with will do */
+		if (len < MINIMUM_ABBREV)
+			mad.len = len;
+	} else if (mad.len < MINIMUM_ABBREV)
+		mad.len = MINIMUM_ABBREV;
+	if (mad.len < 40)
+		hex[mad.len] = 0;
 	return hex;
 }
 
@@ -656,7 +786,7 @@ struct object *peel_to_type(const char *name, int namelen,
 		if (o->type == OBJ_TAG)
 			o = ((struct tag*) o)->tagged;
 		else if (o->type == OBJ_COMMIT)
-			o = &(((struct commit *) o)->tree->object);
+			o = &get_commit_tree((struct commit *)o)->object;
 		else {
 			if (name)
 				error("%.*s: expected %s type, but the object "
@@ -72,68 +72,79 @@ int is_repository_shallow(void)
 	return is_shallow;
 }
 
+define_commit_slab(commit_depth, int);
+
+/*
+ * The walk goes breadth-first, one depth at a time, so that every
+ * commit is first reached by (one of) its shortest paths from the
+ * heads and is expanded only once.  Walking depth-first, a commit
+ * first reached through a long path had to be walked again each time
+ * a shorter path to it turned up.
+ */
 struct commit_list *get_shallow_commits(struct object_array *heads, int depth,
 		int shallow_flag, int not_shallow_flag)
 {
-	int i = 0, cur_depth = 0;
+	int i, cur_depth = 0;
 	struct commit_list *result = NULL;
-	struct object_array stack = OBJECT_ARRAY_INIT;
-	struct commit *commit = NULL;
+	struct commit_depth depths;
+	struct commit **level = NULL, **next = NULL, **tmp;
+	int level_nr = 0, level_alloc = 0, next_nr = 0, next_alloc = 0;
 	struct commit_graft *graft;
 
-	while (commit || i < heads->nr || stack.nr) {
-		struct commit_list *p;
-		if (!commit) {
-			if (i < heads->nr) {
-				commit = (struct commit *)
-					deref_tag(heads->objects[i++].item, NULL, 0);
-				if (!commit || commit->object.type != OBJ_COMMIT) {
-					commit = NULL;
-					continue;
-				}
-				if (!commit->util)
-					commit->util = xmalloc(sizeof(int));
-				*(int *)commit->util = 0;
-				cur_depth = 0;
-			} else {
-				commit = (struct commit *)
-					stack.objects[--stack.nr].item;
-				cur_depth = *(int *)commit->util;
-			}
-		}
-		parse_commit_or_die(commit);
-		cur_depth++;
-		if ((depth != INFINITE_DEPTH && cur_depth >= depth) ||
-		    (is_repository_shallow() && !commit->parents &&
-		     (graft = lookup_commit_graft(commit->object.sha1)) != NULL &&
-		     graft->nr_parent < 0)) {
-			commit_list_insert(commit, &result);
-			commit->object.flags |= shallow_flag;
-			commit = NULL;
+	init_commit_depth(&depths);
+	for (i = 0; i < heads->nr; i++) {
+		struct commit *commit = (struct commit *)
+			deref_tag(heads->objects[i].item, NULL, 0);
+		int *d;
+
+		if (!commit || commit->object.type != OBJ_COMMIT)
 			continue;
-		}
-		commit->object.flags |= not_shallow_flag;
-		for (p = commit->parents, commit = NULL; p; p = p->next) {
-			if (!p->item->util) {
-				int *pointer = xmalloc(sizeof(int));
-				p->item->util = pointer;
-				*pointer =  cur_depth;
-			} else {
-				int *pointer = p->item->util;
-				if (cur_depth >= *pointer)
-					continue;
-				*pointer = cur_depth;
+		d = commit_depth_at(&depths, commit);
+		if (*d)
+			continue;
+		*d = 1;
+		ALLOC_GROW(level, level_nr + 1, level_alloc);
+		level[level_nr++] = commit;
+	}
+
+	while (level_nr) {
+		cur_depth++;
+		for (i = 0; i < level_nr; i++) {
+			struct commit *commit = level[i];
+			struct commit_list *p;
+
+			parse_commit_or_die(commit);
+			if ((depth != INFINITE_DEPTH && cur_depth >= depth) ||
+			    (is_repository_shallow() && !commit->parents &&
+			     (graft = lookup_commit_graft(commit->object.sha1)) != NULL &&
+			     graft->nr_parent < 0)) {
+				commit_list_insert(commit, &result);
+				commit->object.flags |= shallow_flag;
+				continue;
 			}
-			if (p->next)
-				add_object_array(&p->item->object,
-						NULL, &stack);
-			else {
-				commit = p->item;
-				cur_depth = *(int *)commit->util;
+			commit->object.flags |= not_shallow_flag;
+			for (p = commit->parents; p; p = p->next) {
+				int *d = commit_depth_at(&depths, p->item);
+				if (*d)
+					continue;
+				*d = cur_depth + 1;
+				ALLOC_GROW(next, next_nr + 1, next_alloc);
+				next[next_nr++] = p->item;
 			}
 		}
+		tmp = level;
+		level = next;
+		next = tmp;
+		i = level_alloc;
+		level_alloc = next_alloc;
+		next_alloc = i;
+		level_nr = next_nr;
+		next_nr = 0;
 	}
 
+	free(level);
+	free(next);
+	clear_commit_depth(&depths);
 	return result;
 }
 
@@ -381,8 +392,26 @@ struct paint_info {
 	char **slab;
 	char *free, *end;
 	unsigned slab_count;
+	/* every distinct bitmap handed out, so that equal ones are shared */
+	struct hashmap bitmaps;
+	/* the commits marked SEEN by the current paint_down() */
+	struct commit **seen;
+	int seen_nr, seen_alloc;
 };
 
+struct painted_bitmap {
+	struct hashmap_entry ent;
+	unsigned size;
+	uint32_t *bits;
+};
+
+static int painted_bitmap_cmp(const struct painted_bitmap *a,
+			      const struct painted_bitmap *b,
+			      const void *unused)
+{
+	return memcmp(a->bits, b->bits, a->size);
+}
+
 static uint32_t *paint_alloc(struct paint_info *info)
 {
 	unsigned nr = (info->nr_bits + 31) / 32;
@@ -400,6 +429,33 @@ static uint32_t *paint_alloc(struct paint_info *info)
 	return p;
 }
 
+/*
+ * Return a bitmap with the same bits as "bits" from the pool, adding
+ * it if there is none yet.  Most commits are reachable from the same
+ * few combinations of refs; this way each combination is stored once
+ * instead of once per commit where two paths merge.
+ */
+static uint32_t *paint_intern(struct paint_info *info, const uint32_t *bits)
+{
+	unsigned size = ((info->nr_bits + 31) / 32) * sizeof(uint32_t);
+	struct painted_bitmap key, *e;
+
+	hashmap_entry_init(&key, memhash(bits, size));
+	key.size = size;
+	key.bits = (uint32_t *)bits;
+	e = hashmap_get(&info->bitmaps, &key, NULL);
+	if (e)
+		return e->bits;
+
+	e = xmalloc(sizeof(*e));
+	hashmap_entry_init(e, key.ent.hash);
+	e->size = size;
+	e->bits = paint_alloc(info);
+	memcpy(e->bits, bits, size);
+	hashmap_add(&info->bitmaps, e);
+	return e->bits;
+}
+
 /*
  * Given a commit SHA-1, walk down to parents until either SEEN,
  * UNINTERESTING or BOTTOM is hit. Set the id-th bit in ref_bitmap for
@@ -408,17 +464,17 @@ static uint32_t *paint_alloc(struct paint_info *info)
 static void paint_down(struct paint_info *info, const unsigned char *sha1,
 		       int id)
 {
-	unsigned int i, nr;
+	unsigned int i;
 	struct commit_list *head = NULL;
 	int bitmap_nr = (info->nr_bits + 31) / 32;
 	int bitmap_size = bitmap_nr * sizeof(uint32_t);
-	uint32_t *tmp = xmalloc(bitmap_size); /* to be freed before return */
-	uint32_t *bitmap = paint_alloc(info);
+	uint32_t *tmp, *bitmap;
 	struct commit *c = lookup_commit_reference_gently(sha1, 1);
 	if (!c)
 		return;
-	memset(bitmap, 0, bitmap_size);
-	bitmap[id / 32] |= (1 << (id % 32));
+	tmp = xcalloc(bitmap_nr, sizeof(uint32_t));
+	tmp[id / 32] |= (1 << (id % 32));
+	bitmap = paint_intern(info, tmp);
 	commit_list_insert(c, &head);
 	while (head) {
 		struct commit_list *p;
@@ -432,19 +488,18 @@ static void paint_down(struct paint_info *info, const unsigned char *sha1,
 		/* XXX check "UNINTERESTING" from pack bitmaps if available */
 		if (c->object.flags & (SEEN | UNINTERESTING))
 			continue;
-		else
-			c->object.flags |= SEEN;
+		c->object.flags |= SEEN;
+		ALLOC_GROW(info->seen, info->seen_nr + 1, info->seen_alloc);
+		info->seen[info->seen_nr++] = c;
 
 		if (*refs == NULL)
 			*refs = bitmap;
-		else {
+		else if (*refs != bitmap) {
 			memcpy(tmp, *refs, bitmap_size);
 			for (i = 0; i < bitmap_nr; i++)
 				tmp[i] |= bitmap[i];
-			if (memcmp(tmp, *refs, bitmap_size)) {
-				*refs = paint_alloc(info);
-				memcpy(*refs, tmp, bitmap_size);
-			}
+			if (memcmp(tmp, *refs, bitmap_size))
+				*refs = paint_intern(info, tmp);
 		}
 
 		if (c->object.flags & BOTTOM)
@@ -465,12 +520,10 @@ static void paint_down(struct paint_info *info, const unsigned char *sha1,
 		}
 	}
 
-	nr = get_max_object_index();
-	for (i = 0; i < nr; i++) {
-		struct object *o = get_indexed_object(i);
-		if (o && o->type == OBJ_COMMIT)
-			o->flags &= ~SEEN;
-	}
+	/* only what this walk has seen, not every object in core */
+	for (i = 0; i < info->seen_nr; i++)
+		info->seen[i]->object.flags &= ~SEEN;
+	info->seen_nr = 0;
 
 	free(tmp);
 }
@@ -535,6 +588,7 @@ void assign_shallow_commits_to_refs(struct shallow_info *info,
 	memset(&pi, 0, sizeof(pi));
 	init_ref_bitmap(&pi.ref_bitmap);
 	pi.nr_bits = ref->nr;
+	hashmap_init(&pi.bitmaps, (hashmap_cmp_fn)painted_bitmap_cmp, 0);
 
 	/*
 	 * "--not --all" to cut short the traversal if new refs
@@ -572,6 +626,8 @@ void assign_shallow_commits_to_refs(struct shallow_info *info,
 		post_assign_shallow(info, &pi.ref_bitmap, ref_status);
 
 	clear_ref_bitmap(&pi.ref_bitmap);
+	hashmap_free(&pi.bitmaps, 1);
+	free(pi.seen);
 	for (i = 0; i < pi.slab_count; i++)
 		free(pi.slab[i]);
 	free(pi.slab);
@@ -2,9 +2,20 @@
 #define SHORTLOG_H
 
 #include "string-list.h"
+#include "strmap.h"
+
+/*
+ * The commits of one author: their subjects, in the order they were
+ * added, are only kept when the subjects are shown.
+ */
+struct shortlog_author {
+	int nr;
+	struct string_list onelines;
+};
 
 struct shortlog {
-	struct string_list list;
+	/* "name" or "name <email>" -> struct shortlog_author */
+	struct strmap authors;
 	int summary;
 	int wrap_lines;
 	int sort_by_number;
@@ -13,6 +24,7 @@ struct shortlog {
 	int in2;
 	int user_format;
 	int abbrev;
+	int threads;
 
 	char *common_repo_prefix;
 	int email;
@@ -10,7 +10,8 @@
  * primary payload.  Things coming over band #2 is not necessarily
  * error; they are usually informative message on the standard error
  * stream, aka "verbose").  A message over band #3 is a signal that
- * the remote died unexpectedly.  A flush() concludes the stream.
+ * the remote died unexpectedly.  Band #4 announces a bulk frame of
+ * band #1 data (see sideband.h).  A flush() concludes the stream.
  */
 
 #define PREFIX "remote:"
@@ -20,6 +21,40 @@
 
 #define FIX_SIZE 10  /* large enough for any of the above */
 
+/*
+ * Copy the "size" raw bytes of a bulk frame from "in" to "out".  When
+ * one of them is a pipe the kernel can move the data for us.
+ */
+static void copy_bulk_data(int in, int out, unsigned long size)
+{
+	static char buf[LARGE_PACKET_MAX];
+
+#ifdef HAVE_SPLICE
+	while (size) {
+		ssize_t n = splice(in, NULL, out, NULL, size,
+				   SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+			break; /* not a pipe; copy it ourselves */
+		if (n < 0)
+			die_errno("unable to copy bulk sideband data");
+		if (!n)
+			die("early EOF in bulk sideband data");
+		size -= n;
+	}
+#endif
+	while (size) {
+		ssize_t n = xread(in, buf, size < sizeof(buf) ? size : sizeof(buf));
+		if (n < 0)
+			die_errno("read error in bulk sideband data");
+		if (!n)
+			die("early EOF in bulk sideband data");
+		write_or_die(out, buf, n);
+		size -= n;
+	}
+}
+
 int recv_sideband(const char *me, int in_stream, int out)
 {
 	unsigned pf = strlen(PREFIX);
@@ -111,6 +146,20 @@ int recv_sideband(const char *me, int in_stream, int out)
 		case 1:
 			write_or_die(out, buf + pf+1, len);
 			continue;
+		case SIDEBAND_BULK: {
+			unsigned long size;
+			char *end;
+
+			buf[pf+1+len] = '\0';
+			size = strtoul(buf + pf+1, &end, 16);
+			if (len != 8 || *end) {
+				fprintf(stderr, "%s: protocol error: bad bulk frame\n",
+					me);
+				return SIDEBAND_PROTOCOL_ERROR;
+			}
+			copy_bulk_data(in_stream, out, size);
+			continue;
+		}
 		default:
 			fprintf(stderr, "%s: protocol error: bad band #%d\n",
 				me, band);
@@ -150,3 +199,24 @@ ssize_t send_sideband(int fd, int band, const char *data, ssize_t sz, int packet
 	}
 	return ssz;
 }
+
+/*
+ * Like send_sideband() for band #1, but as bulk frames of up to
+ * SIDEBAND_BULK_MAX bytes; only for "side-band-bulk" clients.
+ */
+ssize_t send_sideband_bulk(int fd, const char *data, ssize_t sz)
+{
+	ssize_t ssz = sz;
+
+	while (sz) {
+		unsigned n = sz < SIDEBAND_BULK_MAX ? sz : SIDEBAND_BULK_MAX;
+		char hdr[14];
+
+		sprintf(hdr, "000d%c%08x", SIDEBAND_BULK, n);
+		write_or_die(fd, hdr, 13);
+		write_or_die(fd, data, n);
+		data += n;
+		sz -= n;
+	}
+	return ssz;
+}
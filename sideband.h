@@ -4,7 +4,17 @@
 #define SIDEBAND_PROTOCOL_ERROR -2
 #define SIDEBAND_REMOTE_ERROR -1
 
+/*
+ * With the "side-band-bulk" capability, band #1 data may also be sent
+ * as a bulk frame: a pkt-line on band #4 whose payload is the size of
+ * the data as 8 hex digits, followed by that many bytes of raw data
+ * outside of any pkt-line.
+ */
+#define SIDEBAND_BULK 4
+#define SIDEBAND_BULK_MAX (1024 * 1024)
+
 int recv_sideband(const char *me, int in_stream, int out);
 ssize_t send_sideband(int fd, int band, const char *data, ssize_t sz, int packet_max);
+ssize_t send_sideband_bulk(int fd, const char *data, ssize_t sz);
 
 #endif
@@ -0,0 +1,306 @@
+#include "cache.h"
+#include "cache-tree.h"
+#include "tree-walk.h"
+#include "fsmonitor.h"
+#include "ewah/ewok.h"
+#include "sparse-index.h"
+
+struct entry_list {
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+	int collapsed;
+};
+
+static void add_entry(struct entry_list *list, struct cache_entry *ce)
+{
+	ALLOC_GROW(list->cache, list->nr + 1, list->alloc);
+	list->cache[list->nr++] = ce;
+}
+
+static struct cache_entry *new_skipped_entry(const struct strbuf *path,
+					     const unsigned char *sha1,
+					     unsigned int mode)
+{
+	struct cache_entry *ce = xcalloc(1, cache_entry_size(path->len));
+
+	memcpy(ce->name, path->buf, path->len);
+	ce->ce_namelen = path->len;
+	ce->ce_mode = mode;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	hashcpy(ce->sha1, sha1);
+	return ce;
+}
+
+static int want_sparse_index(void)
+{
+	int sparse;
+
+	if (git_config_get_bool("index.sparse", &sparse))
+		sparse = 0;
+	return sparse;
+}
+
+/* Can cache[start..end) be replaced by one sparse directory entry? */
+static int can_collapse(struct index_state *istate, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce_stage(ce) || S_ISGITLINK(ce->ce_mode) ||
+		    !ce_skip_worktree(ce))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Add the entries "it" covers for the directory "base", starting at
+ * istate->cache[start], to "list", collapsing the subdirectories that
+ * can be.  Returns the cache tree describing what was added, or NULL
+ * if "it" is not valid all the way down.
+ */
+static struct cache_tree *collapse_tree(struct index_state *istate,
+					struct entry_list *list, int start,
+					struct cache_tree *it,
+					struct strbuf *base)
+{
+	struct cache_tree *copy;
+	unsigned int first = list->nr;
+	int i = start, end = start + it->entry_count;
+
+	if (it->entry_count < 0)
+		return NULL;
+	copy = cache_tree();
+	hashcpy(copy->sha1, it->sha1);
+
+	while (i < end) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *name = ce->name + base->len;
+		const char *slash = strchr(name, '/');
+		struct cache_tree_sub *down, *sub;
+		size_t baselen = base->len;
+		int pos;
+
+		pos = slash ? cache_tree_subtree_pos(it, name, slash - name) : -1;
+		if (pos < 0 || !it->down[pos]->cache_tree) {
+			add_entry(list, ce);
+			i++;
+			continue;
+		}
+		down = it->down[pos];
+		if (down->cache_tree->entry_count <= 0) {
+			cache_tree_free(&copy);
+			return NULL;
+		}
+
+		strbuf_add(base, name, slash - name + 1);
+		sub = cache_tree_sub(copy, down->name);
+		if (can_collapse(istate, i, i + down->cache_tree->entry_count)) {
+			add_entry(list, new_skipped_entry(base,
+							  down->cache_tree->sha1,
+							  S_IFDIR));
+			list->collapsed++;
+			sub->cache_tree = cache_tree();
+			sub->cache_tree->entry_count = 1;
+			hashcpy(sub->cache_tree->sha1, down->cache_tree->sha1);
+		} else {
+			sub->cache_tree = collapse_tree(istate, list, i,
+							down->cache_tree, base);
+			if (!sub->cache_tree) {
+				cache_tree_free(&copy);
+				return NULL;
+			}
+		}
+		strbuf_setlen(base, baselen);
+		i += down->cache_tree->entry_count;
+	}
+
+	copy->entry_count = list->nr - first;
+	return copy;
+}
+
+static void free_sparse_entries(struct entry_list *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->nr; i++)
+		if (S_ISSPARSEDIR(list->cache[i]->ce_mode))
+			free(list->cache[i]);
+	free(list->cache);
+}
+
+int convert_to_sparse(struct index_state *istate, struct index_state *sparse)
+{
+	struct entry_list list = { NULL, 0, 0, 0 };
+	struct strbuf base = STRBUF_INIT;
+	struct cache_tree *it;
+	int i;
+
+	if (istate->sparse_index || istate->split_index || !istate->cache_nr ||
+	    !core_apply_sparse_checkout || !want_sparse_index())
+		return -1;
+
+	/* the cache tree counts neither of these */
+	for (i = 0; i < istate->cache_nr; i++)
+		if (istate->cache[i]->ce_flags & (CE_REMOVE | CE_INTENT_TO_ADD))
+			return -1;
+
+	/* the cache tree tells the extent and the tree of each directory */
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK))
+		return -1;
+
+	it = collapse_tree(istate, &list, 0, istate->cache_tree, &base);
+	strbuf_release(&base);
+	if (!it || !list.collapsed) {
+		cache_tree_free(&it);
+		free_sparse_entries(&list);
+		return -1;
+	}
+
+	*sparse = *istate;
+	sparse->cache = list.cache;
+	sparse->cache_nr = list.nr;
+	sparse->cache_alloc = list.alloc;
+	sparse->cache_tree = it;
+	sparse->sparse_index = 1;
+	sparse->fsmonitor_dirty = NULL;
+	if (istate->fsmonitor_dirty)
+		fill_fsmonitor_bitmap(sparse);
+	return 0;
+}
+
+void finish_sparse_write(struct index_state *istate,
+			 struct index_state *sparse)
+{
+	struct entry_list list = { sparse->cache, sparse->cache_nr };
+
+	free_sparse_entries(&list);
+	cache_tree_free(&sparse->cache_tree);
+	ewah_free(sparse->fsmonitor_dirty);
+	ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+
+	istate->version = sparse->version;
+	istate->split_index = sparse->split_index;
+	istate->timestamp = sparse->timestamp;
+	hashcpy(istate->sha1, sparse->sha1);
+}
+
+/*
+ * Add the entries of the tree "sha1" for the directory "base" to "list",
+ * recording its subtrees in "it".  Returns the number of entries added.
+ */
+static int expand_tree(struct entry_list *list, const unsigned char *sha1,
+		       struct strbuf *base, struct cache_tree *it)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int nr = 0, valid = 1;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to read tree %s for sparse directory '%s'",
+		    sha1_to_hex(sha1), base->buf);
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		size_t baselen = base->len;
+
+		strbuf_add(base, entry.path, tree_entry_len(&entry));
+		if (S_ISDIR(entry.mode)) {
+			struct cache_tree_sub *sub = cache_tree_sub(it, entry.path);
+
+			sub->cache_tree = cache_tree();
+			strbuf_addch(base, '/');
+			nr += expand_tree(list, entry.sha1, base, sub->cache_tree);
+			if (sub->cache_tree->entry_count < 0)
+				valid = 0;
+		} else {
+			add_entry(list, new_skipped_entry(base, entry.sha1,
+							  create_ce_mode(entry.mode)));
+			nr++;
+		}
+		strbuf_setlen(base, baselen);
+	}
+	free(buf);
+
+	/* an empty tree has no place in the index, nor in the cache tree */
+	if (valid && nr) {
+		it->entry_count = nr;
+		hashcpy(it->sha1, sha1);
+	}
+	return nr;
+}
+
+/*
+ * The sparse directory entry "path" has been replaced by "nr" entries,
+ * whose cache tree is "sub"; put "sub" in its place under "it".
+ */
+static void replace_subtree(struct cache_tree *it, const char *path,
+			    int nr, struct cache_tree *sub)
+{
+	while (it) {
+		const char *slash = strchr(path, '/');
+		int pos;
+
+		if (0 <= it->entry_count) {
+			if (0 <= sub->entry_count)
+				it->entry_count += nr - 1;
+			else
+				it->entry_count = -1;
+		}
+		pos = cache_tree_subtree_pos(it, path, slash - path);
+		if (pos < 0)
+			break;
+		path = slash + 1;
+		if (!*path) {
+			cache_tree_free(&it->down[pos]->cache_tree);
+			it->down[pos]->cache_tree = sub;
+			return;
+		}
+		it = it->down[pos]->cache_tree;
+	}
+	cache_tree_free(&sub);
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct entry_list list = { NULL, 0, 0, 0 };
+	struct strbuf base = STRBUF_INIT;
+	int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct cache_tree *sub;
+		int nr;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			add_entry(&list, ce);
+			continue;
+		}
+		strbuf_reset(&base);
+		strbuf_add(&base, ce->name, ce_namelen(ce));
+		sub = cache_tree();
+		nr = expand_tree(&list, ce->sha1, &base, sub);
+		replace_subtree(istate->cache_tree, ce->name, nr, sub);
+		free(ce);
+	}
+	strbuf_release(&base);
+
+	free_name_hash(istate);
+	free(istate->cache);
+	istate->cache = list.cache;
+	istate->cache_nr = list.nr;
+	istate->cache_alloc = list.alloc;
+	istate->sparse_index = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+
+/*
+ * With "index.sparse" and a sparse checkout, a directory none of whose
+ * entries are checked out is written to the index as a single "sparse
+ * directory" entry: its name ends in a slash, its mode is S_IFDIR, it
+ * has CE_SKIP_WORKTREE set and it names the tree object of the
+ * directory.  Such an index carries the "sdir" extension.
+ *
+ * Most code expects every path to have its own entry, so reading a
+ * sparse index expands it again unless the command cleared
+ * command_requires_full_index before reading it.
+ */
+
+/*
+ * Fill "sparse" with a view of the full index "istate" to be written
+ * out instead of it, in which the directories that can be are
+ * collapsed.  The view shares the other entries with "istate", which
+ * is not modified.  Returns 0 if anything was collapsed, and -1 (with
+ * "sparse" untouched) if "istate" should be written as it is.
+ */
+int convert_to_sparse(struct index_state *istate, struct index_state *sparse);
+
+/*
+ * Once "sparse" has been written out, carry what writing it recorded
+ * (the checksum, timestamp and format version) over to "istate", and
+ * free what convert_to_sparse() allocated.
+ */
+void finish_sparse_write(struct index_state *istate,
+			 struct index_state *sparse);
+
+/* Replace each sparse directory entry by the entries of its tree. */
+void ensure_full_index(struct index_state *istate);
+
+#endif
@@ -0,0 +1,226 @@
+#include "cache.h"
+#include "unix-socket.h"
+#include "sigchain.h"
+#include "parse-options.h"
+#include "diff.h"
+#include "submodule.h"
+#include "pathspec.h"
+#include "wt-status.h"
+#include "status-cache.h"
+
+/*
+ * Keep the index of the worktree in memory, and collect the status for
+ * the clients connecting to the socket from it, so that they do not
+ * have to read, refresh and hash the whole index themselves.  The index
+ * is read again only when the file changed; otherwise the entries that
+ * were refreshed for the last request stay refreshed, and with
+ * core.fsmonitor, only the paths the monitor reports since then are
+ * looked at again.
+ *
+ * The configuration is read once.  When the config file of the
+ * repository changes, the daemon stops answering and exits, and the
+ * next client starts a new one.
+ */
+
+static const char *socket_path;
+static struct stat_validity index_validity;
+static struct stat_validity config_validity;
+
+static void cleanup_socket(void)
+{
+	if (socket_path)
+		unlink(socket_path);
+}
+
+static void cleanup_socket_on_signal(int sig)
+{
+	cleanup_socket();
+	sigchain_pop(sig);
+	raise(sig);
+}
+
+static void record_validity(struct stat_validity *sv, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		stat_validity_clear(sv);
+		return;
+	}
+	stat_validity_update(sv, fd);
+	close(fd);
+}
+
+static void refresh_cached_index(void)
+{
+	const char *index_file = get_index_file();
+	int i;
+
+	if (the_index.initialized &&
+	    stat_validity_check(&index_validity, index_file)) {
+		/*
+		 * What the last refresh found up to date may have been
+		 * edited since; look again, or have the monitor report
+		 * what changed since last time.
+		 */
+		for (i = 0; i < the_index.cache_nr; i++)
+			the_index.cache[i]->ce_flags &= ~CE_UPTODATE;
+		the_index.fsmonitor_has_run_once = 0;
+	} else {
+		discard_index(&the_index);
+		/*
+		 * Take the stat data before reading, so that a concurrent
+		 * update makes us read the file again next time.
+		 */
+		record_validity(&index_validity, index_file);
+		read_index(&the_index);
+	}
+	refresh_index(&the_index, REFRESH_QUIET|REFRESH_UNMERGED,
+		      NULL, NULL, NULL);
+}
+
+static void clear_status(struct wt_status *s)
+{
+	int i;
+
+	for (i = 0; i < s->change.nr; i++) {
+		struct wt_status_change_data *d = s->change.items[i].util;
+		free(d->head_path);
+	}
+	free(s->branch);
+	free((char *)s->ignore_submodule_arg);
+	string_list_clear(&s->change, 1);
+	string_list_clear(&s->untracked, 0);
+	string_list_clear(&s->ignored, 0);
+}
+
+static void serve_status(int fd, struct wt_status *s)
+{
+	unsigned char sha1[20];
+	FILE *out;
+
+	if (!stat_validity_check(&config_validity, git_path("config")))
+		exit(0);
+
+	refresh_cached_index();
+	s->is_initial = get_sha1(s->reference, sha1) ? 1 : 0;
+	wt_status_collect(s);
+
+	out = xfdopen(dup(fd), "w");
+	s->fp = out;
+	fputs("ok\n", out);
+	wt_porcelain_print(s);
+	fclose(out);
+}
+
+static void serve_one_client(int fd)
+{
+	struct strbuf action = STRBUF_INIT;
+	struct wt_status s;
+	FILE *in = xfdopen(dup(fd), "r");
+
+	wt_status_prepare(&s);
+	if (read_status_request(in, &action, &s))
+		; /* ignore error */
+	else if (!strcmp(action.buf, "status"))
+		serve_status(fd, &s);
+	else if (!strcmp(action.buf, "exit"))
+		exit(0);
+	else
+		warning("status-cache client sent unknown action: %s", action.buf);
+
+	clear_status(&s);
+	fclose(in);
+	strbuf_release(&action);
+}
+
+static int serve_cache_loop(int fd, int timeout)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, 1000 * timeout);
+	if (r < 0) {
+		if (errno != EINTR)
+			die_errno("poll failed");
+		return 1;
+	}
+	if (!r)
+		return 0; /* nobody asked for a while */
+
+	if (pfd.revents & POLLIN) {
+		int client = accept(fd, NULL, NULL);
+
+		if (client < 0) {
+			warning("accept failed: %s", strerror(errno));
+			return 1;
+		}
+		serve_one_client(client);
+		close(client);
+	}
+	return 1;
+}
+
+static void serve_cache(const char *socket_path, int timeout, int debug)
+{
+	int fd;
+
+	if (safe_create_leading_directories_const(socket_path) < 0)
+		die_errno("unable to create directories for '%s'", socket_path);
+	fd = unix_stream_listen(socket_path);
+	if (fd < 0)
+		die_errno("unable to bind to '%s'", socket_path);
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!debug) {
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+	}
+
+	while (serve_cache_loop(fd, timeout))
+		; /* nothing */
+
+	close(fd);
+	unlink(socket_path);
+}
+
+int main(int argc, const char **argv)
+{
+	static const char *usage[] = {
+		"git-status-cache--daemon [opts] <socket_path>",
+		NULL
+	};
+	int debug = 0;
+	int timeout = 600;
+	const struct option options[] = {
+		OPT_INTEGER(0, "timeout", &timeout,
+			    N_("exit after this many seconds without a request")),
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	setup_git_directory();
+	setup_work_tree();
+	record_validity(&config_validity, git_path("config"));
+	gitmodules_config();
+	git_config(git_diff_ui_config, NULL);
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	socket_path = argv[0];
+
+	if (!socket_path)
+		usage_with_options(usage, options);
+
+	atexit(cleanup_socket);
+	sigchain_push_common(cleanup_socket_on_signal);
+	/* a client going away must not take us down */
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	serve_cache(socket_path, timeout, debug);
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include "cache.h"
+#include "pathspec.h"
+#include "wt-status.h"
+#include "status-cache.h"
+#include "run-command.h"
+#include "unix-socket.h"
+
+/*
+ * A client sends the action ("status" or "exit") on the first line,
+ * followed by one "<option>=<value>" line for every option of the
+ * status it wants, and closes its end for writing.  For "status", the
+ * daemon answers "ok" on a line of its own followed by the output of
+ * "git status --porcelain"; it closes the connection without a word
+ * if it cannot answer for this repository any more.
+ */
+
+static const char *untracked_modes[] = {
+	"no", "normal", "all"
+};
+
+static void write_status_request(struct strbuf *req, const struct wt_status *s)
+{
+	strbuf_addstr(req, "status\n");
+	strbuf_addf(req, "untracked=%s\n",
+		    untracked_modes[s->show_untracked_files]);
+	strbuf_addf(req, "ignored=%d\n", !!s->show_ignored_files);
+	strbuf_addf(req, "branch=%d\n", !!s->show_branch);
+	strbuf_addf(req, "null=%d\n", !!s->null_termination);
+	if (s->ignore_submodule_arg)
+		strbuf_addf(req, "ignore-submodules=%s\n",
+			    s->ignore_submodule_arg);
+}
+
+int read_status_request(FILE *in, struct strbuf *action, struct wt_status *s)
+{
+	struct strbuf line = STRBUF_INIT;
+
+	if (strbuf_getline(action, in, '\n'))
+		return -1;
+	while (!strbuf_getline(&line, in, '\n')) {
+		const char *v;
+		int i;
+
+		if (skip_prefix(line.buf, "untracked=", &v)) {
+			for (i = 0; i < ARRAY_SIZE(untracked_modes); i++)
+				if (!strcmp(v, untracked_modes[i]))
+					s->show_untracked_files = i;
+		} else if (skip_prefix(line.buf, "ignored=", &v))
+			s->show_ignored_files = atoi(v);
+		else if (skip_prefix(line.buf, "branch=", &v))
+			s->show_branch = atoi(v);
+		else if (skip_prefix(line.buf, "null=", &v))
+			s->null_termination = atoi(v);
+		else if (skip_prefix(line.buf, "ignore-submodules=", &v))
+			s->ignore_submodule_arg = xstrdup(v);
+		/* ignore what a newer client may send */
+	}
+	strbuf_release(&line);
+	return 0;
+}
+
+#ifndef NO_UNIX_SOCKETS
+static int request_status(const char *socket, const struct strbuf *req,
+			  struct strbuf *out)
+{
+	int fd = unix_stream_connect(socket);
+	int ret = -1;
+
+	if (fd < 0)
+		return -1;
+	if (write_in_full(fd, req->buf, req->len) == req->len &&
+	    !shutdown(fd, SHUT_WR) &&
+	    strbuf_read(out, fd, 0) >= 0 &&
+	    starts_with(out->buf, "ok\n")) {
+		strbuf_remove(out, 0, 3);
+		ret = 0;
+	}
+	close(fd);
+	return ret;
+}
+
+static int spawn_status_cache_daemon(const char *socket)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	const char *argv[] = { "status-cache--daemon", NULL, NULL };
+	char buf[3];
+	int r;
+
+	argv[1] = socket;
+	daemon.argv = argv;
+	daemon.git_cmd = 1;
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+
+	if (start_command(&daemon))
+		return -1;
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	close(daemon.out);
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return -1;
+	return 0;
+}
+
+int status_from_daemon(const struct wt_status *s, struct strbuf *out)
+{
+	struct strbuf req = STRBUF_INIT;
+	char *socket;
+	int ret;
+
+	/* the daemon only knows about the index of the worktree */
+	if (getenv(INDEX_ENVIRONMENT))
+		return -1;
+
+	socket = xstrdup(absolute_path(git_path("status-cache/socket")));
+	write_status_request(&req, s);
+	ret = request_status(socket, &req, out);
+	if (ret && (errno == ENOENT || errno == ECONNREFUSED) &&
+	    !spawn_status_cache_daemon(socket)) {
+		strbuf_reset(out);
+		ret = request_status(socket, &req, out);
+	}
+	if (ret)
+		strbuf_reset(out);
+	strbuf_release(&req);
+	free(socket);
+	return ret;
+}
+#else
+int status_from_daemon(const struct wt_status *s, struct strbuf *out)
+{
+	return -1;
+}
+#endif
@@ -0,0 +1,34 @@
+#ifndef STATUS_CACHE_H
+#define STATUS_CACHE_H
+
+/*
+ * With status.daemon, "git status --porcelain" asks the
+ * git-status-cache--daemon of the worktree for its output instead of
+ * reading and refreshing the index itself.  The daemon keeps the
+ * index, with its name hash and untracked cache, in memory between
+ * requests; it reads the index again only when the file changed, and
+ * with core.fsmonitor only looks at the paths the monitor reports.
+ * It is started on demand and listens on $GIT_DIR/status-cache/socket.
+ */
+
+struct wt_status;
+struct strbuf;
+
+/*
+ * Have the daemon collect the status with the options of "s" and put
+ * the output of wt_porcelain_print() into "out".  Returns 0 on
+ * success, or -1 if the daemon could not be reached or would not
+ * answer, in which case the caller collects the status itself.
+ */
+extern int status_from_daemon(const struct wt_status *s, struct strbuf *out);
+
+/*
+ * For the daemon: read the request of a client from "in", putting the
+ * action it asks for into "action" and its options into "s", which has
+ * been set up with wt_status_prepare().  Returns -1 if the client did
+ * not send an action.
+ */
+extern int read_status_request(FILE *in, struct strbuf *action,
+			       struct wt_status *s);
+
+#endif
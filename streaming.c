@@ -551,3 +551,28 @@ int stream_blob_to_fd(int fd, unsigned const char *sha1, struct stream_filter *f
 	close_istream(st);
 	return result;
 }
+
+ssize_t read_object_prefix(const unsigned char *sha1, void *buf, size_t len)
+{
+	struct git_istream *st;
+	enum object_type type;
+	unsigned long sz;
+	size_t total = 0;
+
+	st = open_istream(sha1, &type, &sz, NULL);
+	if (!st)
+		return -1;
+	while (total < len) {
+		ssize_t readlen = read_istream(st, (char *)buf + total,
+					       len - total);
+		if (readlen < 0) {
+			close_istream(st);
+			return -1;
+		}
+		if (!readlen)
+			break;
+		total += readlen;
+	}
+	close_istream(st);
+	return total;
+}
@@ -14,4 +14,11 @@ extern ssize_t read_istream(struct git_istream *, void *, size_t);
 
 extern int stream_blob_to_fd(int fd, const unsigned char *, struct stream_filter *, int can_seek);
 
+/*
+ * Read at most "len" bytes from the beginning of an object into "buf"
+ * without inflating the rest of it.  Returns the number of bytes
+ * read, or -1 if the object cannot be read.
+ */
+extern ssize_t read_object_prefix(const unsigned char *, void *buf, size_t len);
+
 #endif /* STREAMING_H */
@@ -0,0 +1,99 @@
+#include "cache.h"
+#include "strmap.h"
+
+static int cmp_strmap_entry(const struct strmap_entry *e1,
+			    const struct strmap_entry *e2,
+			    const char *key)
+{
+	return strcmp(e1->key, key ? key : e2->key);
+}
+
+void strmap_init(struct strmap *map, int strdup_strings)
+{
+	hashmap_init(&map->map, (hashmap_cmp_fn)cmp_strmap_entry, 0);
+	map->strdup_strings = strdup_strings;
+}
+
+void strmap_clear(struct strmap *map, int free_values)
+{
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+
+	/*
+	 * With strdup_strings the key lives in the same allocation as
+	 * its entry, so there is nothing more to free for it.
+	 */
+	strmap_for_each_entry(map, &iter, e) {
+		if (free_values)
+			free(e->value);
+		free(e);
+	}
+	hashmap_free(&map->map, 0);
+}
+
+struct strmap_entry *strmap_get_entry(struct strmap *map, const char *key)
+{
+	return hashmap_get_from_hash(&map->map, strhash(key), key);
+}
+
+void *strmap_put(struct strmap *map, const char *key, void *value)
+{
+	struct strmap_entry *e = strmap_get_entry(map, key);
+	void *old;
+
+	if (e) {
+		old = e->value;
+		e->value = value;
+		return old;
+	}
+
+	if (map->strdup_strings) {
+		size_t len = strlen(key);
+		char *copy;
+
+		e = xmalloc(sizeof(*e) + len + 1);
+		copy = (char *)(e + 1);
+		memcpy(copy, key, len + 1);
+		e->key = copy;
+	} else {
+		e = xmalloc(sizeof(*e));
+		e->key = key;
+	}
+	hashmap_entry_init(e, strhash(key));
+	e->value = value;
+	hashmap_add(&map->map, e);
+	return NULL;
+}
+
+void *strmap_get(struct strmap *map, const char *key)
+{
+	struct strmap_entry *e = strmap_get_entry(map, key);
+	return e ? e->value : NULL;
+}
+
+int strmap_contains(struct strmap *map, const char *key)
+{
+	return !!strmap_get_entry(map, key);
+}
+
+void strmap_remove(struct strmap *map, const char *key, int free_value)
+{
+	struct hashmap_entry k;
+	struct strmap_entry *e;
+
+	hashmap_entry_init(&k, strhash(key));
+	e = hashmap_remove(&map->map, &k, key);
+	if (!e)
+		return;
+	if (free_value)
+		free(e->value);
+	free(e);
+}
+
+int strset_add(struct strset *set, const char *str)
+{
+	if (strmap_contains(&set->map, str))
+		return 0;
+	strmap_put(&set->map, str, NULL);
+	return 1;
+}
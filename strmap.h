@@ -0,0 +1,84 @@
+#ifndef STRMAP_H
+#define STRMAP_H
+
+#include "hashmap.h"
+
+/*
+ * A map from strings to arbitrary pointers, and a set of strings, both
+ * backed by the hashmap.  Unlike a sorted string_list, insertion and
+ * lookup take constant time however large the collection grows, but
+ * the entries come back in no particular order.
+ */
+
+struct strmap_entry {
+	struct hashmap_entry ent;
+	const char *key;
+	void *value;
+};
+
+struct strmap {
+	struct hashmap map;
+	unsigned int strdup_strings:1;
+};
+
+extern void strmap_init(struct strmap *map, int strdup_strings);
+
+/*
+ * Free the entries, and their values too if free_values is set.  The
+ * map has to be initialized again before it can be reused.
+ */
+extern void strmap_clear(struct strmap *map, int free_values);
+
+/*
+ * Set the value of key to value, returning the value it replaced, or
+ * NULL if the key was not in the map yet.
+ */
+extern void *strmap_put(struct strmap *map, const char *key, void *value);
+extern struct strmap_entry *strmap_get_entry(struct strmap *map, const char *key);
+extern void *strmap_get(struct strmap *map, const char *key);
+extern int strmap_contains(struct strmap *map, const char *key);
+extern void strmap_remove(struct strmap *map, const char *key, int free_value);
+
+static inline unsigned int strmap_get_size(struct strmap *map)
+{
+	return map->map.size;
+}
+
+/* Visit every entry, in no particular order */
+#define strmap_for_each_entry(mystrmap, iter, var) \
+	for (hashmap_iter_init(&(mystrmap)->map, (iter)); \
+	     ((var) = hashmap_iter_next(iter)) != NULL; )
+
+struct strset {
+	struct strmap map;
+};
+
+static inline void strset_init(struct strset *set, int strdup_strings)
+{
+	strmap_init(&set->map, strdup_strings);
+}
+
+static inline void strset_clear(struct strset *set)
+{
+	strmap_clear(&set->map, 0);
+}
+
+/* Returns 1 if str was added, 0 if it was already in the set */
+extern int strset_add(struct strset *set, const char *str);
+
+static inline int strset_contains(struct strset *set, const char *str)
+{
+	return strmap_contains(&set->map, str);
+}
+
+static inline void strset_remove(struct strset *set, const char *str)
+{
+	strmap_remove(&set->map, str, 0);
+}
+
+static inline unsigned int strset_get_size(struct strset *set)
+{
+	return strmap_get_size(&set->map);
+}
+
+#endif
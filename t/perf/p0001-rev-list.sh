@@ -26,4 +26,24 @@ test_perf 'rev-list --objects $commit --not --all' '
 	git rev-list --objects $commit --not --all >/dev/null
 '
 
+test_expect_success 'create many short unrelated histories' '
+	for i in $(test_seq 2000)
+	do
+		for j in 1 2 3 4 5
+		do
+			echo "commit refs/side/$i" &&
+			echo "committer C O Mitter <committer@example.com> $((1112911993 + j * 100000 + i * 7919 % 100000)) +0000" &&
+			echo "data <<EOF" &&
+			echo "side $i.$j" &&
+			echo "EOF" &&
+			echo || return 1
+		done
+	done | git fast-import --quiet
+'
+
+# the walk has a commit of each history pending at all times
+test_perf 'rev-list --all with many tips' '
+	git rev-list --all >/dev/null
+'
+
 test_done
@@ -0,0 +1,17 @@
+#!/bin/sh
+
+test_description="Micro-benchmarks of core data structures
+
+Times single operations of hashmap.c, prio-queue.c, sha1-array.c,
+string-list.c, the object hash, kwset and xdiff on a generated corpus.
+Pass options such as --size, --iterations or --warmup to test-microbench
+in GIT_PERF_MICROBENCH_ARGS."
+
+. ./perf-lib.sh
+
+for bench in $(test-microbench --list)
+do
+	test_microbench $bench
+done
+
+test_done
@@ -0,0 +1,49 @@
+#!/bin/sh
+
+test_description="Tests performance with a large number of refs"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	test_perf_synthesize_history &&
+	test_perf_synthesize_refs refs/heads/branch- &&
+	test_perf_synthesize_refs refs/tags/tag- &&
+	last=refs/heads/branch-$GIT_PERF_SYNTH_REFS &&
+	export last
+'
+
+test_perf 'for-each-ref' '
+	git for-each-ref >/dev/null
+'
+
+test_perf 'for-each-ref --format, one prefix' '
+	git for-each-ref --format="%(refname:short) %(objectname)" \
+		refs/tags/ >/dev/null
+'
+
+test_perf 'show-ref --verify, one ref' '
+	git show-ref --verify -q $last
+'
+
+test_perf 'rev-parse, one ref' '
+	git rev-parse -q --verify $last >/dev/null
+'
+
+test_perf 'update-ref and delete, one loose ref' '
+	git update-ref refs/heads/perf-loose HEAD &&
+	git update-ref -d refs/heads/perf-loose
+'
+
+test_perf 'delete a packed ref' '
+	git pack-refs --all &&
+	git update-ref -d $last &&
+	git update-ref $last HEAD
+'
+
+test_perf 'pack-refs --all' '
+	git pack-refs --all
+'
+
+test_done
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+test_description="Tests checkout performance on a wide tree"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	test_perf_synthesize_history &&
+	git reset -q --hard master &&
+	git checkout -q -b tenth &&
+	for d in $(test_seq 1 $GIT_PERF_SYNTH_DIRS | awk "NR % 10 == 1")
+	do
+		echo changed >>dir$d/file1 || return 1
+	done &&
+	git commit -q -a -m tenth &&
+	git checkout -q --orphan empty &&
+	git rm -q -r --cached . &&
+	git clean -q -f -d &&
+	git commit -q --allow-empty -m empty &&
+	git checkout -q master
+'
+
+test_perf 'checkout between branches sharing most files' '
+	git checkout -q tenth &&
+	git checkout -q master
+'
+
+test_perf 'checkout of the whole tree from an empty one' '
+	git checkout -q empty &&
+	git checkout -q master
+'
+
+test_perf 'checkout -f of an unchanged tree' '
+	git checkout -q -f master
+'
+
+test_done
@@ -31,4 +31,17 @@ test_perf 'git log -M -L' '
 	git log -M -L 1:"$file" >/dev/null
 '
 
+test_expect_success 'write commit-graph with changed-path filters' '
+	git commit-graph write --changed-paths &&
+	git config core.commitGraph true
+'
+
+test_perf 'git log -L (changed-path filters)' '
+	git log -L 1:"$file" >/dev/null
+'
+
+test_perf 'git log -M -L (changed-path filters)' '
+	git log -M -L 1:"$file" >/dev/null
+'
+
 test_done
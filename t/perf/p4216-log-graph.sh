@@ -0,0 +1,33 @@
+#!/bin/sh
+
+test_description="Tests log --graph performance with many live branches"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_perf 'log --graph --all' '
+	git log --graph --all --oneline >/dev/null
+'
+
+test_expect_success 'create many branches growing side by side' '
+	for j in 1 2 3 4 5
+	do
+		for i in $(test_seq 500)
+		do
+			echo "commit refs/wide/$i" &&
+			echo "committer C O Mitter <committer@example.com> $((1112911993 + j * 1000 + i)) +0000" &&
+			echo "data <<EOF" &&
+			echo "wide $i.$j" &&
+			echo "EOF" &&
+			echo || return 1
+		done
+	done | git fast-import --quiet
+'
+
+# every branch keeps a column of its own while the dates interleave
+test_perf 'log --graph --date-order with many branches' '
+	git log --graph --date-order --oneline --glob=refs/wide/* >/dev/null
+'
+
+test_done
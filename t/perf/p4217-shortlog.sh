@@ -0,0 +1,21 @@
+#!/bin/sh
+
+test_description="Tests git shortlog performance"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_perf 'shortlog -sne --all' '
+	git shortlog -sne --all </dev/null >/dev/null
+'
+
+test_perf 'shortlog --all' '
+	git shortlog --all </dev/null >/dev/null
+'
+
+test_perf 'shortlog -sne --all, one thread' '
+	git -c shortlog.threads=1 shortlog -sne --all </dev/null >/dev/null
+'
+
+test_done
@@ -32,6 +32,10 @@ test_perf 'simulated fetch' '
 	} | git pack-objects --revs --stdout >/dev/null
 '
 
+test_perf 'incremental bundle' '
+	git bundle create incremental.bdl HEAD~100..HEAD
+'
+
 test_expect_success 'create partial bitmap state' '
 	# pick a commit to represent the repo tip in the past
 	cutoff=$(git rev-list HEAD~100 -1) &&
@@ -0,0 +1,34 @@
+#!/bin/sh
+
+test_description="Tests push performance into a repository with many refs"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	test_perf_synthesize_history &&
+	git clone -q --bare --no-local . remote.git &&
+	(
+		cd remote.git &&
+		test_perf_synthesize_refs refs/heads/branch-
+	) &&
+	git commit-tree -p master -m "new commit" master^{tree} >new-commit &&
+	git update-ref refs/heads/new $(cat new-commit)
+'
+
+test_perf 'push an existing commit to a new ref' '
+	git push -q remote.git master:refs/heads/perf-push &&
+	git push -q remote.git :refs/heads/perf-push
+'
+
+test_perf 'push a new commit' '
+	git push -q remote.git new:refs/heads/perf-new &&
+	git push -q remote.git :refs/heads/perf-new
+'
+
+test_perf 'push a no-op' '
+	git push -q remote.git master
+'
+
+test_done
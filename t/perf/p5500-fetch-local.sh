@@ -0,0 +1,47 @@
+#!/bin/sh
+
+test_description="Tests clone and fetch performance over a local transport"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup upstream and a diverged client' '
+	test_perf_synthesize_history &&
+	git clone -q --bare --no-local . "$TRASH_DIRECTORY/client.git" &&
+	test_perf_synthesize_history master &&
+	(
+		cd "$TRASH_DIRECTORY/client.git" &&
+		test_perf_synthesize_history local &&
+		test_perf_synthesize_refs refs/heads/local- local
+	)
+'
+
+test_perf 'clone --no-local --bare' '
+	rm -rf clone.git &&
+	git clone -q --bare --no-local . clone.git
+'
+
+test_perf 'clone --no-local --bare --depth=1' '
+	rm -rf clone.git &&
+	git clone -q --bare --no-local --depth=1 "file://$TRASH_DIRECTORY" clone.git
+'
+
+# The client keeps what it fetched in a scratch object directory, so that
+# every run has to negotiate and transfer the same objects again.
+test_perf 'fetch-pack, client with many refs' '
+	rm -rf scratch &&
+	mkdir scratch &&
+	(
+		cd client.git &&
+		GIT_OBJECT_DIRECTORY="$TRASH_DIRECTORY/scratch" \
+		GIT_ALTERNATE_OBJECT_DIRECTORIES="$TRASH_DIRECTORY/client.git/objects" \
+			git fetch-pack -q "$TRASH_DIRECTORY" refs/heads/master >/dev/null
+	)
+'
+
+test_perf 'ls-remote' '
+	git ls-remote client.git >/dev/null
+'
+
+test_done
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+test_description="Tests status performance on a wide tree"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	test_perf_synthesize_history &&
+	git reset -q --hard master &&
+	for d in $(test_seq 1 $GIT_PERF_SYNTH_DIRS)
+	do
+		>dir$d/untracked || return 1
+	done &&
+	mkdir untracked-dir &&
+	for f in $(test_seq 1 $GIT_PERF_SYNTH_FILES)
+	do
+		>untracked-dir/file$f || return 1
+	done
+'
+
+test_perf 'status' '
+	git status >/dev/null
+'
+
+test_perf 'status -uno' '
+	git status -uno >/dev/null
+'
+
+test_perf 'status --porcelain' '
+	git status --porcelain >/dev/null
+'
+
+test_expect_success 'enable the untracked cache' '
+	git update-index --untracked-cache &&
+	git status >/dev/null
+'
+
+test_perf 'status, untracked cache' '
+	git status >/dev/null
+'
+
+test_perf 'status --porcelain, untracked cache' '
+	git status --porcelain >/dev/null
+'
+
+test_done
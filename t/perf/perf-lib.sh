@@ -113,6 +113,95 @@ test_perf_large_repo () {
 	fi
 	test_perf_create_repo_from "${1:-$TRASH_DIRECTORY}" "$GIT_PERF_LARGE_REPO"
 }
+
+# Sizes of the synthesized repositories below; raise them to get
+# closer to the shape of a real server.
+: ${GIT_PERF_SYNTH_COMMITS=1000}
+: ${GIT_PERF_SYNTH_DIRS=100}
+: ${GIT_PERF_SYNTH_FILES=100}
+: ${GIT_PERF_SYNTH_REFS=100000}
+export GIT_PERF_SYNTH_COMMITS GIT_PERF_SYNTH_DIRS GIT_PERF_SYNTH_FILES \
+	GIT_PERF_SYNTH_REFS
+
+# Create an empty repository (in "$1", default the trash directory), for
+# scripts that synthesize the shape they measure instead of copying one.
+test_perf_fresh_repo () {
+	repo="${1:-$TRASH_DIRECTORY}"
+	git init -q "$repo" &&
+	{ mv "$repo/.git/hooks" "$repo/.git/hooks-disabled" 2>/dev/null || :; } ||
+	error "failed to create repository '$repo'"
+}
+
+# Add $GIT_PERF_SYNTH_COMMITS commits to the branch "$1" (default
+# master) of the current repository.  If the branch is new, its first
+# commit has a wide tree of $GIT_PERF_SYNTH_DIRS directories holding
+# $GIT_PERF_SYNTH_FILES files each; every other commit changes one file.
+test_perf_synthesize_history () {
+	branch=${1:-master} &&
+	if from=$(git rev-parse -q --verify "refs/heads/$branch")
+	then
+		start=$(git rev-list --count "$from")
+	else
+		from= &&
+		start=0
+	fi &&
+	"$PERL_PATH" -e '
+		my ($branch, $from, $start, $commits, $dirs, $files) = @ARGV;
+		my $time = 1112911993;
+		sub data { "data " . length($_[0]) . "\n$_[0]\n" }
+		for my $c ($start + 1..$start + $commits) {
+			print "commit refs/heads/$branch\n";
+			print "committer C O Mitter <committer\@example.com> ",
+			      $time + $c, " +0000\n";
+			print data("$branch $c");
+			print "from $from\n" if ($from && $c == $start + 1);
+			if ($c == 1) {
+				for my $d (1..$dirs) {
+					for my $f (1..$files) {
+						print "M 100644 inline dir$d/file$f\n",
+						      data("dir$d/file$f\n");
+					}
+				}
+			} else {
+				my $d = 1 + $c % $dirs;
+				my $f = 1 + int($c / $dirs) % $files;
+				print "M 100644 inline dir$d/file$f\n",
+				      data("dir$d/file$f $branch $c\n");
+			}
+		}
+	' "$branch" "$from" "$start" "$GIT_PERF_SYNTH_COMMITS" \
+		"$GIT_PERF_SYNTH_DIRS" "$GIT_PERF_SYNTH_FILES" |
+	git fast-import --quiet ||
+	error "failed to synthesize history"
+}
+
+# Write $GIT_PERF_SYNTH_REFS packed refs named "$1<n>" (default
+# refs/heads/branch-<n>), pointing in turn at the commits reachable
+# from "$2" (default HEAD).
+test_perf_synthesize_refs () {
+	git rev-list "${2:-HEAD}" >synth-commits &&
+	git for-each-ref --format="%(objectname) %(refname)" >synth-refs &&
+	"$PERL_PATH" -e '
+		my ($prefix, $count) = @ARGV;
+		my @commits = map { chomp; $_ } <STDIN>;
+		my %refs;
+		open(my $fh, "<", "synth-refs") or die;
+		while (<$fh>) {
+			chomp;
+			my ($sha1, $name) = split / /;
+			$refs{$name} = $sha1;
+		}
+		for my $i (1..$count) {
+			$refs{"$prefix$i"} = $commits[$i % @commits];
+		}
+		print "# pack-refs with: peeled fully-peeled \n";
+		print "$refs{$_} $_\n" for sort keys %refs;
+	' "${1:-refs/heads/branch-}" "$GIT_PERF_SYNTH_REFS" \
+		<synth-commits >"$(git rev-parse --git-dir)/packed-refs" &&
+	rm -f synth-commits synth-refs ||
+	error "failed to synthesize refs"
+}
+
 test_checkout_worktree () {
 	git checkout-index -u -a ||
 	error "git checkout-index failed"
@@ -193,6 +282,37 @@ test_perf () {
 	test_finish_
 }
 
+# Run one of the benchmarks of test-microbench (see "test-microbench
+# --list") and record the time it takes per operation, instead of the
+# run time of a command.  Further arguments, and those in
+# GIT_PERF_MICROBENCH_ARGS, are passed to test-microbench, e.g.
+# "--size=100000".
+test_microbench () {
+	test_start_
+	test "$#" -ge 1 ||
+	error "bug in the test script: no benchmark given to test_microbench"
+	test_prereq=
+	export test_prereq
+	bench_descr="microbench $*"
+	if ! test_skip "$bench_descr" "test-microbench $*"
+	then
+		base=$(basename "$0" .sh)
+		echo "$test_count" >>"$perf_results_dir"/$base.subtests
+		echo "$bench_descr" >"$perf_results_dir"/$base.$test_count.descr
+		base="$perf_results_dir"/"$perf_results_prefix$base"."$test_count"
+		say >&3 "running: test-microbench $*"
+		if test-microbench --porcelain $GIT_PERF_MICROBENCH_ARGS "$@" \
+			>test_microbench 2>&4 &&
+		   cut -d" " -f2- <test_microbench >"$base".ns
+		then
+			test_ok_ "$bench_descr"
+		else
+			test_failure_ "$bench_descr" "test-microbench $*"
+		fi
+	fi
+	test_finish_
+}
+
 # We extend test_done to print timings at the end (./run disables this
 # and does it after running everything)
 test_at_end_hook_ () {
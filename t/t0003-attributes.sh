@@ -297,4 +297,23 @@ test_expect_success 'bare repository: test info/attributes' '
 	)
 '
 
+test_expect_success 'directories visited again use the right .gitattributes' '
+	mkdir -p revisit/one revisit/two &&
+	echo "x test=one" >revisit/one/.gitattributes &&
+	echo "x test=two" >revisit/two/.gitattributes &&
+	git add revisit &&
+	echo "x test=changed" >revisit/one/.gitattributes &&
+	printf "%s\n" revisit/one/x revisit/two/x revisit/one/x >stdin-revisit &&
+	cat >expect <<-\EOF &&
+	revisit/one/x: test: changed
+	revisit/two/x: test: two
+	revisit/one/x: test: changed
+	EOF
+	git check-attr --stdin test <stdin-revisit >actual &&
+	test_cmp expect actual &&
+	sed s/changed/one/ expect >expect-cached &&
+	git check-attr --cached --stdin test <stdin-revisit >actual &&
+	test_cmp expect-cached actual
+'
+
 test_done
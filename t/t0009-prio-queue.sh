@@ -47,4 +47,19 @@ test_expect_success 'notice empty queue' '
 	test_cmp expect actual
 '
 
+cat >expect <<'EOF'
+NULL
+2
+2
+1
+1
+1
+3
+NULL
+EOF
+test_expect_success 'peek does not remove the item' '
+	test-prio-queue peek 3 2 peek get 1 peek peek get get peek >actual &&
+	test_cmp expect actual
+'
+
 test_done
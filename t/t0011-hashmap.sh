@@ -237,6 +237,118 @@ test_expect_success 'grow / shrink' '
 
 '
 
+test_expect_success 'open addressing: put, get and remove' '
+
+test_hashmap "put key1 value1
+put key2 value2
+put key1 value3
+get key1
+get key2
+get notInMap
+remove key2
+remove key2
+get key2
+size" "NULL
+NULL
+value1
+value3
+value2
+NULL
+value2
+NULL
+NULL
+64 1" open-addressing
+
+'
+
+test_expect_success 'open addressing: add duplicates (case insensitive)' '
+
+test_hashmap "add key1 value1
+add Key1 value2
+add fooBarFrotz value3
+get KEY1
+get foobarfrotz
+get notInMap" "value1
+value2
+value3
+NULL" "ignorecase open-addressing"
+
+'
+
+test_expect_success 'open addressing: iterate' '
+
+	cat >in <<-\EOF &&
+	put key1 value1
+	put key2 value2
+	put fooBarFrotz value3
+	iterate
+	EOF
+	cat >expect <<-\EOF &&
+	NULL
+	NULL
+	NULL
+	fooBarFrotz value3
+	key1 value1
+	key2 value2
+	EOF
+	test-hashmap open-addressing <in >out &&
+	sort out >actual &&
+	test_cmp expect actual
+
+'
+
+test_expect_success 'open addressing: grow / shrink' '
+
+	rm -f in &&
+	rm -f expect &&
+	for n in $(test_seq 44)
+	do
+		echo put key$n value$n >> in &&
+		echo NULL >> expect
+	done &&
+	echo size >> in &&
+	echo 64 44 >> expect &&
+	echo put key45 value45 >> in &&
+	echo NULL >> expect &&
+	echo size >> in &&
+	echo 256 45 >> expect &&
+	for n in $(test_seq 10)
+	do
+		echo remove key$n >> in &&
+		echo value$n >> expect
+	done &&
+	echo size >> in &&
+	echo 256 35 >> expect &&
+	echo remove key11 >> in &&
+	echo value11 >> expect &&
+	echo size >> in &&
+	echo 64 34 >> expect &&
+	cat in | test-hashmap open-addressing > out &&
+	test_cmp expect out
+
+'
+
+test_expect_success 'open addressing: removal keeps clusters intact' '
+
+	cat >in <<-\EOF &&
+	checkopen 0
+	checkopen 1
+	checkopen 2
+	checkopen 4
+	checkopen 6
+	EOF
+	cat >expect <<-\EOF &&
+	0 errors
+	0 errors
+	0 errors
+	0 errors
+	0 errors
+	EOF
+	test-hashmap <in >out &&
+	test_cmp expect out
+
+'
+
 test_expect_success 'string interning' '
 
 test_hashmap "intern value1
@@ -252,4 +252,190 @@ test_expect_success "filter: smudge empty file" '
 	test_cmp expected filtered-empty-in-repo
 '
 
+test_expect_success PERL 'set up process filter' '
+	write_script rot13-filter.pl "$PERL_PATH" <<-\EOF &&
+	use strict;
+	use warnings;
+	use IO::Handle;
+
+	open my $log, ">>", $ARGV[0] or die "cannot open log: $!";
+	$log->autoflush(1);
+	binmode STDIN;
+	binmode STDOUT;
+	print $log "START\n";
+
+	sub packet_read {
+		my $n = read STDIN, my $hex, 4;
+		return undef unless $n;
+		my $len = hex $hex;
+		return "" if $len == 0;
+		read STDIN, my $buf, $len - 4;
+		return $buf;
+	}
+	sub packet_txt_read {
+		my $buf = packet_read();
+		die "unexpected EOF" unless defined $buf;
+		$buf =~ s/\n$//;
+		return $buf;
+	}
+	sub packet_write {
+		my $buf = shift;
+		print STDOUT sprintf("%04x", length($buf) + 4), $buf;
+	}
+	sub packet_flush {
+		print STDOUT "0000";
+		STDOUT->flush;
+	}
+	sub rot13 {
+		my $s = shift;
+		$s =~ tr/A-Za-z/N-ZA-Mn-za-m/;
+		return $s;
+	}
+
+	packet_txt_read() eq "git-filter-client" or die "bad welcome";
+	packet_txt_read() eq "version=2" or die "bad version";
+	packet_txt_read() eq "" or die "expected flush";
+	packet_write("git-filter-server\n");
+	packet_write("version=2\n");
+	packet_flush();
+	while (packet_txt_read() ne "") {
+	}
+	packet_write("capability=clean\n");
+	packet_write("capability=smudge\n");
+	packet_write("capability=delay\n");
+	packet_flush();
+
+	my (%delayed, %listed);
+	while (defined(my $cmd = packet_read())) {
+		$cmd =~ s/^command=(.*)\n$/$1/ or die "bad command $cmd";
+		if ($cmd eq "list_available_blobs") {
+			packet_txt_read() eq "" or die "expected flush";
+			print $log "list_available_blobs\n";
+			packet_write("pathname=$_\n") for grep { !$listed{$_} } sort keys %delayed;
+			$listed{$_} = 1 for keys %delayed;
+			packet_flush();
+			packet_write("status=success\n");
+			packet_flush();
+			next;
+		}
+		my ($path, $can_delay, $line) = ("", 0);
+		while (($line = packet_txt_read()) ne "") {
+			$path = $1 if $line =~ /^pathname=(.*)/;
+			$can_delay = 1 if $line eq "can-delay=1";
+		}
+		my $input = "";
+		while ((my $buf = packet_read()) ne "") {
+			$input .= $buf;
+		}
+		print $log "$cmd $path\n";
+		if ($path =~ /error/) {
+			packet_write("status=error\n");
+			packet_flush();
+			next;
+		}
+		if ($can_delay && $path =~ /delay/) {
+			$delayed{$path} = rot13($input);
+			packet_write("status=delayed\n");
+			packet_flush();
+			next;
+		}
+		delete $listed{$path};
+		my $output = exists $delayed{$path} ? delete $delayed{$path} : rot13($input);
+		packet_write("status=success\n");
+		packet_flush();
+		packet_write(substr($output, 0, 65516, "")) while length $output;
+		packet_flush();
+		packet_flush();
+	}
+	EOF
+	git init process &&
+	(
+		cd process &&
+		git config filter.protocol.process \
+			"\"$TRASH_DIRECTORY/rot13-filter.pl\" \"$TRASH_DIRECTORY/rot13.log\"" &&
+		echo "*.r filter=protocol" >.gitattributes &&
+		git add .gitattributes &&
+		git commit -m attributes
+	)
+'
+
+test_expect_success PERL 'process filter cleans and smudges in one process' '
+	(
+		cd process &&
+		echo hello >a.r &&
+		echo world >b.r &&
+		test_seq 1 20000 >big.r &&
+		>"$TRASH_DIRECTORY/rot13.log" &&
+		git add a.r b.r big.r &&
+		grep -c START "$TRASH_DIRECTORY/rot13.log" >count &&
+		echo 1 >expect &&
+		test_cmp expect count &&
+		grep "^clean a.r$" "$TRASH_DIRECTORY/rot13.log" &&
+		grep "^clean b.r$" "$TRASH_DIRECTORY/rot13.log" &&
+		echo uryyb >expect &&
+		git cat-file blob :a.r >actual &&
+		test_cmp expect actual &&
+		git commit -m files &&
+
+		rm a.r b.r big.r &&
+		>"$TRASH_DIRECTORY/rot13.log" &&
+		git checkout -- . &&
+		grep -c START "$TRASH_DIRECTORY/rot13.log" >count &&
+		echo 1 >expect &&
+		test_cmp expect count &&
+		echo hello >expect &&
+		test_cmp expect a.r &&
+		test_seq 1 20000 >expect &&
+		test_cmp expect big.r &&
+		git diff --exit-code
+	)
+'
+
+test_expect_success PERL 'process filter may delay smudged content' '
+	(
+		cd process &&
+		git checkout -b delay &&
+		echo one >delay-1.r &&
+		echo two >delay-2.r &&
+		git add delay-1.r delay-2.r &&
+		git commit -m delay &&
+		git checkout master &&
+		test_path_is_missing delay-1.r &&
+
+		>"$TRASH_DIRECTORY/rot13.log" &&
+		git checkout delay &&
+		grep -c "^smudge delay-1.r$" "$TRASH_DIRECTORY/rot13.log" >count &&
+		echo 2 >expect &&
+		test_cmp expect count &&
+		grep list_available_blobs "$TRASH_DIRECTORY/rot13.log" &&
+		echo one >expect &&
+		test_cmp expect delay-1.r &&
+		echo two >expect &&
+		test_cmp expect delay-2.r &&
+		git diff --exit-code &&
+
+		rm delay-2.r &&
+		git checkout -- delay-2.r &&
+		test_cmp expect delay-2.r
+	)
+'
+
+test_expect_success PERL 'process filter reports errors per file' '
+	(
+		cd process &&
+		echo broken >error.r &&
+		git add error.r &&
+		echo broken >expect &&
+		git cat-file blob :error.r >actual &&
+		test_cmp expect actual &&
+		git rm --cached error.r &&
+		test_must_fail git -c filter.protocol.required=true add error.r &&
+		echo fine >c.r &&
+		git -c filter.protocol.required=true add c.r &&
+		echo svar >expect &&
+		git cat-file blob :c.r >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -30,4 +30,12 @@ test_expect_success 'revision walking can be done twice' '
 	test_cmp run_twice_expected run_twice_actual
 '
 
+test_expect_success 'revision walking can be done twice in released arenas' '
+	GIT_TRACE_ALLOC="$(pwd)/trace" \
+		test-revision-walking arena-twice >arena_twice_actual &&
+	test_cmp run_twice_expected arena_twice_actual &&
+	test $(grep -c "arena: releasing" trace) = 2 &&
+	test $(grep -c "arena: commit 2 " trace) = 2
+'
+
 test_done
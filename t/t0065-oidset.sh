@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='basic tests for the hashed object name set'
+. ./test-lib.sh
+
+echo20 () {
+	prefix="${1:+$1 }"
+	shift
+	while test $# -gt 0
+	do
+		echo "$prefix$1$1$1$1$1$1$1$1$1$1$1$1$1$1$1$1$1$1$1$1"
+		shift
+	done
+}
+
+test_expect_success 'add reports new entries only' '
+	cat >expect <<-\EOF &&
+	1
+	1
+	0
+	2
+	EOF
+	{
+		echo20 add 88 44 88 &&
+		echo size
+	} | test-oidset >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'contains' '
+	cat >expect <<-\EOF &&
+	1
+	0
+	EOF
+	{
+		echo20 add 88 44 aa 55 &&
+		echo20 contains 55 33
+	} | test-oidset >actual.raw &&
+	tail -n 2 actual.raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'contains with almost duplicate values' '
+	{
+		echo "add 5555555555555555555555555555555555555555" &&
+		echo "contains 555555555555555555555555555555555555555f"
+	} | test-oidset >actual.raw &&
+	echo 0 >expect &&
+	tail -n 1 actual.raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'adding while looking up' '
+	cat >expect <<-\EOF &&
+	1
+	0
+	1
+	1
+	1
+	EOF
+	{
+		echo20 add 88 &&
+		echo20 contains 44 &&
+		echo20 add 44 &&
+		echo20 contains 44 88
+	} | test-oidset >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'remove' '
+	cat >expect <<-\EOF &&
+	1
+	0
+	0
+	1
+	EOF
+	{
+		echo20 add 88 44 &&
+		echo20 remove 88 88 &&
+		echo20 contains 88 44
+	} | test-oidset >actual.raw &&
+	tail -n 4 actual.raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'iterate and clear' '
+	echo20 "" 44 55 88 aa >expect &&
+	echo 0 >>expect &&
+	{
+		echo20 add 88 44 aa 55 &&
+		echo iterate &&
+		echo clear &&
+		echo size
+	} | test-oidset >actual.raw &&
+	tail -n 5 actual.raw >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'many entries' '
+	for i in $(test_seq 1000)
+	do
+		printf "add %040d\n" $i
+	done >input &&
+	for i in $(test_seq 1000)
+	do
+		printf "contains %040d\n" $i
+	done >>input &&
+	echo size >>input &&
+	test-oidset <input >actual &&
+	test $(grep -c "^1$" actual) = 2000 &&
+	test $(tail -n 1 actual) = 1000
+'
+
+test_done
@@ -0,0 +1,59 @@
+#!/bin/sh
+
+test_description='computing the cache tree with several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for d in a b c d e f
+	do
+		for s in 1 2 3
+		do
+			mkdir -p $d/$s/deep &&
+			echo $d$s >$d/$s/file &&
+			echo $d$s >$d/$s/deep/file || return 1
+		done &&
+		echo $d >$d/file || return 1
+	done &&
+	echo top >top &&
+	git add . &&
+	git commit -q -m initial
+'
+
+test_expect_success 'threaded write-tree matches the serial one' '
+	for d in a b d f
+	do
+		echo changed >>$d/2/deep/file || return 1
+	done &&
+	echo new >c/new &&
+	git add . &&
+	cp .git/index index.orig &&
+	git -c core.cacheTreeThreads=1 write-tree >expect &&
+	test-dump-cache-tree >expect.tree &&
+	cp index.orig .git/index &&
+	git -c core.cacheTreeThreads=4 write-tree >actual &&
+	test-dump-cache-tree >actual.tree &&
+	test_cmp expect actual &&
+	test_cmp expect.tree actual.tree &&
+	git cat-file -e $(cat actual):a/2/deep
+'
+
+test_expect_success 'threaded write-tree from scratch' '
+	test-scrap-cache-tree &&
+	git -c core.cacheTreeThreads=4 write-tree >actual &&
+	test_cmp expect actual &&
+	test-dump-cache-tree >actual.tree &&
+	test_cmp expect.tree actual.tree
+'
+
+test_expect_success 'missing objects are still reported' '
+	test-scrap-cache-tree &&
+	git update-index --add --cacheinfo 100644,1111111111111111111111111111111111111111,b/3/missing &&
+	test_must_fail git -c core.cacheTreeThreads=4 write-tree 2>err &&
+	test_i18ngrep "invalid object.*b/3/missing" err &&
+	git -c core.cacheTreeThreads=4 write-tree --missing-ok >tree &&
+	git ls-tree -r $(cat tree) b/3 >actual &&
+	grep "b/3/missing" actual
+'
+
+test_done
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+test_description='hashing index names with several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git config core.ignorecase true &&
+	echo "/expect" >>.git/info/exclude &&
+	echo "/actual" >>.git/info/exclude &&
+	for d in a b c d e f
+	do
+		for s in one two three
+		do
+			mkdir -p $d/$s/deep &&
+			echo $d$s >$d/$s/file &&
+			echo $d$s >$d/$s/deep/file || return 1
+		done &&
+		echo $d >$d/file || return 1
+	done &&
+	echo top >top &&
+	git add . &&
+	git commit -q -m initial
+'
+
+for threads in 1 4
+do
+	test_expect_success "new files join existing directories ($threads threads)" '
+		git reset -q --hard &&
+		git clean -q -fdx &&
+		mkdir -p B/TWO/Deep F/New &&
+		echo new >B/TWO/Deep/new &&
+		echo new >F/New/new &&
+		git -c core.nameHashThreads=$threads add B/TWO/Deep/new F/New/new &&
+		git ls-files b/two/deep f/New >actual &&
+		cat >expect <<-\EOF &&
+		b/two/deep/file
+		b/two/deep/new
+		f/New/new
+		EOF
+		test_cmp expect actual
+	'
+
+done
+
+test_expect_success 'status agrees with the serial one' '
+	git reset -q --hard &&
+	git clean -q -fdx &&
+	mkdir -p A/ONE/Deep E/Other &&
+	echo new >A/ONE/Deep/new &&
+	echo new >E/Other/new &&
+	echo changed >>d/three/file &&
+	git -c core.nameHashThreads=1 status --porcelain -uall >expect &&
+	git -c core.nameHashThreads=4 status --porcelain -uall >actual &&
+	test_cmp expect actual
+'
+
+test_done
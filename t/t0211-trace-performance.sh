@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test_description='timing builtins with GIT_TRACE_PERFORMANCE'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one
+'
+
+test_expect_success 'a builtin that returns is timed' '
+	GIT_TRACE_PERFORMANCE="$(pwd)/perf" git rev-parse HEAD &&
+	grep "builtin: git rev-parse\$" perf
+'
+
+test_expect_success 'a builtin that dies is timed' '
+	rm -f perf &&
+	test_must_fail env GIT_TRACE_PERFORMANCE="$(pwd)/perf" \
+		git rev-parse --verify no-such-ref &&
+	grep "builtin: git rev-parse\$" perf
+'
+
+test_expect_success 'a builtin that exits is timed' '
+	rm -f perf &&
+	test_expect_code 129 env GIT_TRACE_PERFORMANCE="$(pwd)/perf" \
+		git tag --no-such-option &&
+	grep "builtin: git tag\$" perf
+'
+
+test_done
@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='structured trace events in GIT_TRACE_EVENT'
+
+. ./test-lib.sh
+
+# Print "<event> <category> <label>" for the region events in a trace.
+regions () {
+	sed -n 's/^{"event":"\(region_[a-z]*\)".*"category":"\([^"]*\)","label":"\([^"]*\)".*/\1 \2 \3/p' "$1"
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git clone -q . clone
+'
+
+test_expect_success 'no events unless enabled' '
+	git status >/dev/null &&
+	test_path_is_missing "$TRASH_DIRECTORY/trace.event"
+'
+
+test_expect_success 'status reports its phases' '
+	GIT_TRACE_EVENT="$TRASH_DIRECTORY/trace.event" git status >/dev/null &&
+	grep "^{\"event\":\"start\",.*\"argv\":\[\"[^\"]*git\",\"status\"\]}$" trace.event &&
+	grep "^{\"event\":\"exit\"," trace.event &&
+	regions trace.event >actual &&
+	cat >expect <<-\EOF &&
+	region_enter status worktree
+	region_leave status worktree
+	region_enter status index
+	region_leave status index
+	region_enter status untracked
+	region_leave status untracked
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch reports its phases and children' '
+	test_commit three &&
+	rm -f trace.event &&
+	(
+		cd clone &&
+		GIT_TRACE_EVENT="$TRASH_DIRECTORY/trace.event" git fetch -q
+	) &&
+	regions trace.event >actual &&
+	grep "^region_leave fetch transfer$" actual &&
+	grep "^region_leave fetch-pack negotiation$" actual &&
+	grep "^region_leave upload-pack send pack$" actual &&
+	grep "^region_leave connected check$" actual &&
+	grep "^region_leave fetch update refs$" actual &&
+	grep "\"event\":\"child_start\",.*\"argv\":\[\"unpack-objects\"" trace.event &&
+	grep "\"event\":\"child_exit\",.*\"code\":0," trace.event
+'
+
+test_expect_success 'child processes extend the session id of their parent' '
+	sid=$(sed -n "1s/.*\"sid\":\"\([^\"]*\)\".*/\1/p" trace.event) &&
+	test -n "$sid" &&
+	grep "\"event\":\"start\",\"sid\":\"$sid/[^\"]*\",.*\"argv\":\[\"[^\"]*git\",\"unpack-objects\"" trace.event
+'
+
+test_expect_success 'each region is left with its elapsed time' '
+	grep "\"event\":\"region_enter\"" trace.event >enter &&
+	grep "\"event\":\"region_leave\",.*\"elapsed\":[0-9.]*}$" trace.event >leave &&
+	test_line_count = $(wc -l <enter) leave
+'
+
+test_expect_success 'object access counters are reported at exit' '
+	rm -f trace.event &&
+	git repack -a -d -q &&
+	GIT_TRACE_EVENT="$TRASH_DIRECTORY/trace.event" git log -p >/dev/null &&
+	grep "\"category\":\"objects\",\"name\":\"read_packed\",\"value\":[1-9]" trace.event &&
+	grep "\"category\":\"objects\",\"name\":\"inflated_bytes\",\"value\":[1-9]" trace.event &&
+	grep "\"category\":\"objects\",\"name\":\"delta_chain_max\"," trace.event &&
+	grep "\"category\":\"pack\",\"name\":\"mmap_calls\",\"value\":[1-9]" trace.event &&
+	grep "\"category\":\"delta_base_cache\",\"name\":\"hits\"," trace.event &&
+	tail -n 1 trace.event | grep "^{\"event\":\"exit\","
+'
+
+test_done
@@ -0,0 +1,69 @@
+#!/bin/sh
+
+test_description='memory accounting in GIT_TRACE_MEMORY'
+
+. ./test-lib.sh
+
+# Print the subsystems reported at a given point of the run; the
+# process-wide figures depend on the platform and are left out.
+subsystems () {
+	sed -n "s/.*memory: $1: \([a-z_]*\)  *[0-9]* kB (peak [0-9]* kB)\$/\1/p" "$2" |
+	grep -v "^process_"
+}
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 50)
+	do
+		test_commit "c$i" || return 1
+	done &&
+	git repack -a -d
+'
+
+test_expect_success 'nothing is reported unless enabled' '
+	git rev-list --objects --all >/dev/null 2>err &&
+	! grep "memory:" err
+'
+
+test_expect_success 'every subsystem is reported at exit' '
+	rm -f trace.memory &&
+	GIT_TRACE_MEMORY="$TRASH_DIRECTORY/trace.memory" \
+		git rev-list --objects --all >/dev/null &&
+	subsystems exit trace.memory >actual &&
+	cat >expect <<-\EOF &&
+	objects
+	obj_hash
+	pack_windows
+	delta_base_cache
+	index
+	ref_cache
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'object nodes, pack windows and refs are accounted' '
+	rm -f trace.memory &&
+	GIT_TRACE_MEMORY="$TRASH_DIRECTORY/trace.memory" \
+		git rev-list --objects --all >/dev/null &&
+	! grep "exit: objects  *0 kB" trace.memory &&
+	! grep "exit: pack_windows  *0 kB" trace.memory &&
+	grep "exit: ref_cache " trace.memory
+'
+
+test_expect_success 'the index is accounted' '
+	rm -f trace.memory &&
+	GIT_TRACE_MEMORY="$TRASH_DIRECTORY/trace.memory" \
+		git status >/dev/null &&
+	grep "exit: index " trace.memory &&
+	! grep "exit: index  *0 kB" trace.memory
+'
+
+test_expect_success 'a sampling interval keeps the exit report' '
+	rm -f trace.memory &&
+	GIT_TRACE_MEMORY="$TRASH_DIRECTORY/trace.memory" \
+	GIT_TRACE_MEMORY_INTERVAL=1 \
+		git rev-list --objects --all >/dev/null &&
+	subsystems exit trace.memory >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -407,4 +407,30 @@ test_expect_success '-m references the correct modified tree' '
 	test_cmp expect actual
 '
 
+test_expect_success 'index is kept under a directory both trees share' '
+	git reset --hard initial-mod &&
+	mkdir -p shared/sub &&
+	echo one >shared/one &&
+	echo two >shared/sub/two &&
+	echo three >shared/sub/three &&
+	git add shared &&
+	git commit -m "add shared" &&
+	git branch shared-base &&
+	echo changed >file-a &&
+	git commit -a -m "change file-a" &&
+	git checkout shared-base &&
+	echo staged >shared/sub/two &&
+	echo new >shared/sub/new &&
+	git add shared/sub &&
+	git rm -q --cached shared/one &&
+	git ls-files --stage shared >expect &&
+	read_tree_u_must_succeed -m -u shared-base master &&
+	git ls-files --stage shared >actual &&
+	test_cmp expect actual &&
+	echo changed >expect &&
+	test_cmp expect file-a &&
+	echo staged >expect &&
+	test_cmp expect shared/sub/two
+'
+
 test_done
@@ -547,4 +547,61 @@ test_expect_success 'git cat-file --batch --follow-symlink returns correct sha a
 	test_cmp expect actual
 '
 
+test_expect_success 'set up packed and loose objects' '
+	git init all-objects &&
+	(
+		cd all-objects &&
+		echo one >one &&
+		git add one &&
+		git commit -m one &&
+		git repack -a -d &&
+		echo two >two &&
+		git add two &&
+		git commit -m two
+	)
+'
+
+test_expect_success 'cat-file --batch-all-objects shows all objects' '
+	(
+		cd all-objects &&
+		git rev-list --objects --all | cut -d" " -f1 >list &&
+		git cat-file --batch-check <list | sort >expect &&
+		git cat-file --batch-check --batch-all-objects >actual &&
+		test_cmp expect actual &&
+		git cat-file --batch-check --batch-all-objects --unordered >actual.raw &&
+		sort actual.raw >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'cat-file --unordered shows packed objects in pack order' '
+	(
+		cd all-objects &&
+		git show-index <$(ls .git/objects/pack/pack-*.idx) |
+			sort -n | cut -d" " -f2 >expect &&
+		git cat-file --batch-check="%(objectname)" \
+			--batch-all-objects --unordered >all &&
+		head -n $(wc -l <expect) all >actual &&
+		test_cmp expect actual &&
+		sort -r list |
+			git cat-file --batch-check="%(objectname)" --unordered >all &&
+		head -n $(wc -l <expect) all >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'cat-file --unordered keeps the rest of each line' '
+	(
+		cd all-objects &&
+		git rev-list --objects --all >list &&
+		echo "0000000000000000000000000000000000000000 gone" >>list &&
+		git cat-file --batch-check="%(objectname) %(rest)" <list |
+			sort >expect &&
+		git cat-file --batch-check="%(objectname) %(rest)" --unordered \
+			<list >actual.raw &&
+		sort actual.raw >actual &&
+		test_cmp expect actual
+	)
+'
+
 test_done
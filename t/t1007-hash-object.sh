@@ -188,6 +188,34 @@ for args in "-w --stdin-paths" "--stdin-paths -w"; do
 	pop_repo
 done
 
+test_expect_success 'hash files with names on stdin into a pack (--threads)' '
+	test_create_repo threads &&
+	(
+		cd threads &&
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+			echo "content $i" >file$i || return 1
+		done &&
+		echo "content 3" >dup &&
+		printf "a\r\nb\r\n" >crlf &&
+		echo "crlf text" >.gitattributes &&
+		ls >list &&
+		git hash-object --stdin-paths <list >expect &&
+		git hash-object -w --stdin-paths --threads=3 <list >actual &&
+		test_cmp expect actual &&
+		ls .git/objects/pack/pack-*.pack >packs &&
+		test_line_count = 1 packs &&
+		git count-objects -v >counts &&
+		grep "^count: 0" counts &&
+		printf "a\nb\n" >crlf.expect &&
+		git cat-file blob $(git hash-object --stdin-paths <<-\EOF
+		crlf
+		EOF
+		) >crlf.actual &&
+		test_cmp crlf.expect crlf.actual &&
+		git fsck >/dev/null
+	)
+'
+
 test_expect_success 'corrupt tree' '
 	echo abc >malformed-tree &&
 	test_must_fail git hash-object -t tree malformed-tree
@@ -104,6 +104,28 @@ test_expect_success 'packsize limit' '
 	)
 '
 
+test_expect_success 'add large files with several threads' '
+	test_create_repo threads &&
+	(
+		cd threads &&
+		git config core.bigfilethreshold 64k &&
+		git config core.bigfilethreads 4 &&
+		for i in $(test_seq 1 40000)
+		do
+			echo "line $i of a compressible file"
+		done >text &&
+		test-genrandom "d" $(( 3 * 1024 * 1024 + 17 )) >random &&
+		git add text random &&
+		test $(git count-objects -v | sed -n "s/^size-pack: //p") -lt 4096 &&
+		sane_unset GIT_ALLOC_LIMIT &&
+		git fsck --full --strict &&
+		git cat-file blob :text >actual &&
+		test_cmp text actual &&
+		git cat-file blob :random >actual &&
+		test_cmp random actual
+	)
+'
+
 test_expect_success 'diff --raw' '
 	git commit -q -m initial &&
 	echo modified >>large1 &&
@@ -177,6 +199,37 @@ test_expect_success 'zip achiving, deflate' '
 	git archive --format=zip HEAD >/dev/null
 '
 
+test_expect_success 'diff of a large file whose stat info changed' '
+	git reset -q --hard &&
+	test-chmtime +10 large2 &&
+	git diff --exit-code
+'
+
+test_expect_success 'grep -I skips large binary files without reading them' '
+	test-genrandom "e" 2000000 >binary &&
+	git add binary &&
+	git commit -q -m binary &&
+	test_expect_code 1 git grep -I -e foo -- binary &&
+	test_expect_code 1 git grep -I -e foo --cached -- binary &&
+	test_expect_code 1 git grep -I -e foo HEAD -- binary
+'
+
+test_expect_success 'merge with a conflicting large binary file' '
+	git checkout -q -b binary-theirs &&
+	test-genrandom "g" 2000000 >binary &&
+	git commit -q -a -m theirs &&
+	git checkout -q -b binary-ours HEAD^ &&
+	test-genrandom "f" 2000000 >binary &&
+	git commit -q -a -m ours &&
+	test_expect_code 1 git merge binary-theirs 2>err &&
+	grep "Cannot merge binary files: binary" err &&
+	git ls-files -u binary >unmerged &&
+	test_line_count = 3 unmerged &&
+	git cat-file blob HEAD:binary >expect &&
+	cmp expect binary &&
+	git reset -q --hard
+'
+
 test_expect_success 'fsck' '
 	test_must_fail git fsck 2>err &&
 	n=$(grep "error: attempting to allocate .* over limit" err | wc -l) &&
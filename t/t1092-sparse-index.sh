@@ -0,0 +1,130 @@
+#!/bin/sh
+
+test_description='sparse index with collapsed directory entries'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_SPLIT_INDEX
+
+test_expect_success 'setup' '
+	mkdir -p in out/deep/deeper out2 &&
+	for f in top in/a in/b out/a out/deep/a out/deep/deeper/a out2/a
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	git ls-files -s >full &&
+	git config core.sparseCheckout true &&
+	cat >.git/info/sparse-checkout <<-\EOF &&
+	/top
+	/in/
+	EOF
+	git read-tree -m -u HEAD &&
+	test_path_is_missing out &&
+	test_path_is_missing out2
+'
+
+test_expect_success 'without index.sparse every path has an entry' '
+	git ls-files --sparse >actual &&
+	git ls-files >expect &&
+	test_cmp expect actual &&
+	test_line_count = 7 actual
+'
+
+test_expect_success 'index.sparse collapses directories outside the checkout' '
+	git config index.sparse true &&
+	git read-tree -m -u HEAD &&
+	git ls-files -s --sparse >actual &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse HEAD:in/a) 0	in/a
+	100644 $(git rev-parse HEAD:in/b) 0	in/b
+	040000 $(git rev-parse HEAD:out) 0	out/
+	040000 $(git rev-parse HEAD:out2) 0	out2/
+	100644 $(git rev-parse HEAD:top) 0	top
+	EOF
+	test_cmp expect actual &&
+	git ls-files -t --sparse out >actual &&
+	echo "S out/" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'other commands see the full index' '
+	git ls-files -s >actual &&
+	test_cmp full actual &&
+	git write-tree >tree &&
+	git rev-parse HEAD^{tree} >expect &&
+	test_cmp expect tree &&
+	git status --porcelain --untracked-files=no >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'the cache tree survives expansion' '
+	test-dump-cache-tree >actual &&
+	! grep invalid actual &&
+	grep "out/deep/deeper/" actual
+'
+
+test_expect_success 'diff-files works on the sparse index' '
+	echo changed >in/a &&
+	git diff-files --name-only >actual &&
+	echo in/a >expect &&
+	test_cmp expect actual &&
+	git checkout in/a
+'
+
+test_expect_success 'commit and switch with a sparse index' '
+	echo more >>in/b &&
+	git commit -q -a -m second &&
+	git ls-files --sparse >actual &&
+	grep "^out/$" actual &&
+	git diff --name-only HEAD^ HEAD >actual &&
+	echo in/b >expect &&
+	test_cmp expect actual &&
+	git checkout -q HEAD^ &&
+	git ls-files --sparse >actual &&
+	grep "^out/$" actual &&
+	echo in/b >expect &&
+	test_cmp expect in/b &&
+	git checkout -q master
+'
+
+test_expect_success 'partly checked-out directories stay expanded' '
+	echo /out/deep/a >>.git/info/sparse-checkout &&
+	git read-tree -m -u HEAD &&
+	test_path_is_file out/deep/a &&
+	git ls-files --sparse out >actual &&
+	cat >expect <<-\EOF &&
+	out/a
+	out/deep/a
+	out/deep/deeper/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'unmerged entries are never collapsed' '
+	git ls-files -s --sparse out2 >before &&
+	git update-index --index-info <<-EOF &&
+	0 $_z40	out2/a
+	100644 $(git rev-parse HEAD:out2/a) 1	out2/a
+	100644 $(git rev-parse HEAD:top) 2	out2/a
+	EOF
+	git ls-files -s --sparse out2 >actual &&
+	test_line_count = 2 actual &&
+	git update-index --index-info <<-EOF &&
+	100644 $(git rev-parse HEAD:out2/a) 0	out2/a
+	EOF
+	git update-index --skip-worktree out2/a &&
+	git ls-files -s --sparse out2 >actual &&
+	test_cmp before actual
+'
+
+test_expect_success 'turning index.sparse off expands the index again' '
+	git config index.sparse false &&
+	git read-tree -m -u HEAD &&
+	git ls-files --sparse >actual &&
+	git ls-files >expect &&
+	test_cmp expect actual
+'
+
+test_done
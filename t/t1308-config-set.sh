@@ -218,4 +218,81 @@ test_expect_success 'check line errors for malformed values' '
 	test_i18ngrep "fatal: .*alias\.br.*\.git/config.*line 2" result
 '
 
+test_expect_success 'config snapshot is written and used' '
+	test_config core.configCache true &&
+	test_config snapshot.value original &&
+	test-chmtime =-60 .git/config &&
+	git var -l >expect &&
+	test -f .git/config-cache &&
+	"$PERL_PATH" -MDigest::SHA=sha1 -0777 -pe "
+		substr(\$_, -20) = q();
+		s/original/snapshot/;
+		\$_ .= sha1(\$_);
+	" .git/config-cache >config-cache.new &&
+	mv config-cache.new .git/config-cache &&
+	git var -l >actual &&
+	grep "^snapshot.value=snapshot$" actual
+'
+
+test_expect_success 'config snapshot notices changed files' '
+	test_config core.configCache true &&
+	test_config snapshot.value one &&
+	test-chmtime =-60 .git/config &&
+	git var -l >/dev/null &&
+	test -f .git/config-cache &&
+	git config snapshot.value two &&
+	git var -l >actual &&
+	grep "^snapshot.value=two$" actual
+'
+
+test_expect_success 'config snapshot notices new included files' '
+	rm -f snapshot-include &&
+	test_when_finished "rm -f snapshot-include" &&
+	test_config core.configCache true &&
+	test_config include.path "$(pwd)/snapshot-include" &&
+	test-chmtime =-60 .git/config &&
+	git var -l >/dev/null &&
+	test -f .git/config-cache &&
+	echo "[snapshot]included = yes" >snapshot-include &&
+	git var -l >actual &&
+	grep "^snapshot.included=yes$" actual
+'
+
+test_expect_success 'command-line config is not stored in the snapshot' '
+	test_config core.configCache true &&
+	test-chmtime =-60 .git/config &&
+	rm -f .git/config-cache &&
+	git -c snapshot.cmdline=yes var -l >actual &&
+	grep "^snapshot.cmdline=yes$" actual &&
+	test -f .git/config-cache &&
+	git var -l >actual &&
+	! grep "^snapshot.cmdline" actual
+'
+
+test_expect_success 'config snapshot is not used under another HOME' '
+	test_config core.configCache true &&
+	test-chmtime =-60 .git/config &&
+	rm -f .git/config-cache &&
+	mkdir -p h1 h2 &&
+	git config -f h1/.gitconfig snapshot.who alice &&
+	git config -f h2/.gitconfig snapshot.who bob &&
+	test-chmtime =-60 h1/.gitconfig h2/.gitconfig &&
+	HOME="$(pwd)/h2" git var -l >actual &&
+	grep "^snapshot.who=bob$" actual &&
+	test -f .git/config-cache &&
+	HOME="$(pwd)/h1" git var -l >actual &&
+	grep "^snapshot.who=alice$" actual &&
+	HOME="$(pwd)/h2" git var -l >actual &&
+	grep "^snapshot.who=bob$" actual
+'
+
+test_expect_success 'corrupt config snapshot is ignored' '
+	test_config core.configCache true &&
+	test_config snapshot.value kept &&
+	test-chmtime =-60 .git/config &&
+	echo garbage >.git/config-cache &&
+	git var -l >actual &&
+	grep "^snapshot.value=kept$" actual
+'
+
 test_done
@@ -1065,6 +1065,49 @@ test_expect_success 'stdin -z delete refs works with packed and loose refs' '
 	test_must_fail git rev-parse --verify -q $c
 '
 
+test_expect_success 'large transaction writes refs to packed-refs' '
+(
+	for i in $(test_seq 150)
+	do
+		echo "create refs/heads/packed$i HEAD"
+	done >large_input &&
+	git update-ref --stdin <large_input &&
+	test_path_is_missing .git/refs/heads/packed1 &&
+	grep "refs/heads/packed150$" .git/packed-refs &&
+	git rev-parse HEAD >expect &&
+	git rev-parse packed1 >actual &&
+	test_cmp expect actual &&
+	git reflog show packed150 >log &&
+	test_line_count = 1 log
+)
+'
+
+test_expect_success 'large transaction updates and deletes refs in packed-refs' '
+(
+	git update-ref refs/heads/packed1 HEAD^ &&
+	test_path_is_file .git/refs/heads/packed1 &&
+	for i in $(test_seq 150)
+	do
+		if test $i -le 75
+		then
+			echo "update refs/heads/packed$i HEAD"
+		else
+			echo "delete refs/heads/packed$i"
+		fi
+	done >large_input &&
+	git update-ref --stdin <large_input &&
+	test_path_is_missing .git/refs/heads/packed1 &&
+	git rev-parse HEAD >expect &&
+	git rev-parse packed1 >actual &&
+	test_cmp expect actual &&
+	git rev-parse packed75 >actual &&
+	test_cmp expect actual &&
+	test_must_fail git rev-parse --verify -q packed76 &&
+	git for-each-ref refs/heads/packed* >refs &&
+	test_line_count = 75 refs
+)
+'
+
 run_with_limited_open_files () {
 	(ulimit -n 32 && "$@")
 }
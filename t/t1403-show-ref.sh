@@ -164,4 +164,25 @@ test_expect_success 'show-ref --heads, --tags, --head, pattern' '
 	test_cmp expect actual
 '
 
+
+test_expect_success 'peeled values of loose refs are cached' '
+	test_config core.peeledRefCache true &&
+	git show-ref -d A >expect &&
+	tag=$(git rev-parse refs/tags/A) &&
+	grep "^$tag $(git rev-parse A^0)$" .git/peeled-refs &&
+	git show-ref -d A >actual &&
+	test_cmp expect actual &&
+
+	# the cache is trusted over the tag object
+	sed "s/^$tag .*/$tag $(git rev-parse C)/" .git/peeled-refs >cache &&
+	mv cache .git/peeled-refs &&
+	git show-ref -d refs/tags/A >actual &&
+	grep "^$(git rev-parse C) refs/tags/A^{}$" actual &&
+
+	git pack-refs --all &&
+	test_path_is_missing .git/peeled-refs &&
+	git show-ref -d refs/tags/A >actual &&
+	grep "^$(git rev-parse A^0) refs/tags/A^{}$" actual
+'
+
 test_done
@@ -287,6 +287,25 @@ test_expect_success 'stale dirs do not cause d/f conflicts (reflogs off)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'expire does not rewrite reflogs it keeps whole' '
+	git update-ref refs/heads/untouched HEAD &&
+	test-chmtime =-1000 .git/logs/refs/heads/untouched &&
+	test-chmtime -v +0 .git/logs/refs/heads/untouched >before &&
+	git reflog expire --all --expire=never --expire-unreachable=never &&
+	test-chmtime -v +0 .git/logs/refs/heads/untouched >after &&
+	test_cmp before after
+'
+
+test_expect_success 'expire drops unreachable entries of reflogs it rewrites' '
+	git checkout -b expiring master &&
+	test_commit expiring &&
+	git reset --hard HEAD^ &&
+	git reflog expire --expire=never --expire-unreachable=now refs/heads/expiring &&
+	git log -g --format="%gs" refs/heads/expiring >actual &&
+	test_line_count = 1 actual &&
+	git checkout master
+'
+
 # Triggering the bug detected by this test requires a newline to fall
 # exactly BUFSIZ-1 bytes from the end of the file. We don't know
 # what that value is, since it's platform dependent. However, if
@@ -0,0 +1,199 @@
+#!/bin/sh
+
+test_description='refs stored in a reftable'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init --ref-format=reftable repo &&
+	(
+		cd repo &&
+		test_commit one &&
+		test_commit two &&
+		git tag -a -m annotated annotated one
+	)
+'
+
+test_expect_success 'init records the ref storage format' '
+	echo reftable >expect &&
+	git -C repo config extensions.refStorage >actual &&
+	test_cmp expect actual &&
+	test 1 = $(git -C repo config core.repositoryFormatVersion) &&
+	test -f repo/.git/reftable/tables.list
+'
+
+test_expect_success 'unknown ref storage format is rejected' '
+	test_must_fail git init --ref-format=bogus bogus &&
+	git init other &&
+	git -C other config core.repositoryFormatVersion 1 &&
+	git -C other config extensions.refStorage bogus &&
+	test_must_fail git -C other rev-parse HEAD
+'
+
+test_expect_success 'refs are not stored as files' '
+	test_path_is_missing repo/.git/refs/heads/master &&
+	test_path_is_missing repo/.git/refs/tags/one &&
+	test_path_is_missing repo/.git/packed-refs &&
+	test_path_is_file repo/.git/HEAD
+'
+
+test_expect_success 'refs can be read back' '
+	(
+		cd repo &&
+		git rev-parse two >expect &&
+		git rev-parse master >actual &&
+		test_cmp expect actual &&
+		git rev-parse one >expect &&
+		git rev-parse annotated^{} >actual &&
+		test_cmp expect actual &&
+		cat >expect <<-EOF &&
+		$(git rev-parse annotated) refs/tags/annotated
+		$(git rev-parse one) refs/tags/annotated^{}
+		EOF
+		git show-ref -d annotated >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'many refs in one transaction' '
+	(
+		cd repo &&
+		for i in $(test_seq 1000)
+		do
+			echo "create refs/heads/branch$i HEAD"
+		done >input &&
+		git update-ref --stdin <input &&
+		git for-each-ref refs/heads/branch* >refs &&
+		test_line_count = 1000 refs &&
+		git rev-parse branch1 branch500 branch1000 >actual &&
+		git rev-parse HEAD HEAD HEAD >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'a failed transaction changes nothing' '
+	(
+		cd repo &&
+		git for-each-ref >before &&
+		cat >input <<-EOF &&
+		update refs/heads/branch1 $(git rev-parse one)
+		create refs/heads/branch2 HEAD
+		EOF
+		test_must_fail git update-ref --stdin <input &&
+		git for-each-ref >after &&
+		test_cmp before after
+	)
+'
+
+test_expect_success 'delete refs' '
+	(
+		cd repo &&
+		git branch -D branch2 &&
+		test_must_fail git rev-parse --verify branch2 &&
+		git update-ref -d refs/heads/branch3 &&
+		test_must_fail git show-ref --verify refs/heads/branch3 &&
+		git for-each-ref refs/heads/branch* >refs &&
+		test_line_count = 998 refs
+	)
+'
+
+test_expect_success 'directory/file conflicts are detected' '
+	(
+		cd repo &&
+		test_must_fail git branch branch1/sub 2>err &&
+		grep "refs/heads/branch1.* exists" err &&
+		git branch dir/sub &&
+		test_must_fail git branch dir 2>err &&
+		grep "refs/heads/dir/sub.* exists" err &&
+		git branch -D dir/sub &&
+		git branch dir
+	)
+'
+
+test_expect_success 'branch rename keeps the reflog' '
+	(
+		cd repo &&
+		git branch -m branch4 renamed &&
+		git rev-parse HEAD >expect &&
+		git rev-parse renamed >actual &&
+		test_cmp expect actual &&
+		test_must_fail git rev-parse --verify branch4 &&
+		git reflog show renamed >log &&
+		grep "renamed refs/heads/branch4 to refs/heads/renamed" log
+	)
+'
+
+test_expect_success 'symbolic refs stay loose' '
+	(
+		cd repo &&
+		git symbolic-ref refs/remotes/origin/HEAD refs/heads/master &&
+		test_path_is_file .git/refs/remotes/origin/HEAD &&
+		git rev-parse HEAD >expect &&
+		git rev-parse origin/HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'the stack of tables stays short' '
+	(
+		cd repo &&
+		for i in $(test_seq 20)
+		do
+			git update-ref refs/heads/branch1 HEAD~$((i % 2)) || return 1
+		done &&
+		test_line_count -lt 10 .git/reftable/tables.list &&
+		git rev-parse HEAD >expect &&
+		git rev-parse branch1 >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'pack-refs merges all tables into one' '
+	(
+		cd repo &&
+		git for-each-ref >expect &&
+		git pack-refs --all &&
+		test_line_count = 1 .git/reftable/tables.list &&
+		ls .git/reftable/*.ref >tables &&
+		test_line_count = 1 tables &&
+		git for-each-ref >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'clone into a reftable repository' '
+	git clone --ref-format=reftable repo clone &&
+	test_path_is_missing clone/.git/packed-refs &&
+	git -C repo rev-parse master >expect &&
+	git -C clone rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	git -C clone fsck
+'
+
+test_expect_success 'fetch and push update the reftable' '
+	(
+		cd clone &&
+		test_commit three &&
+		git push origin HEAD:refs/heads/pushed &&
+		git -C ../repo commit --allow-empty -m four &&
+		git fetch origin &&
+		git -C ../repo rev-parse master >expect &&
+		git rev-parse origin/master >actual &&
+		test_cmp expect actual &&
+		git rev-parse three >expect &&
+		git -C ../repo rev-parse pushed >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'gc keeps the refs' '
+	(
+		cd repo &&
+		git for-each-ref >expect &&
+		git gc &&
+		git for-each-ref >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_done
@@ -0,0 +1,95 @@
+#!/bin/sh
+
+test_description='looking up @{N} and @{date} in long reflogs with an index'
+. ./test-lib.sh
+
+# Write a reflog for refs/heads/long with $1 entries, one every 100
+# seconds, with every tenth entry dated a little back in time.
+write_long_reflog () {
+	mkdir -p .git/logs/refs/heads &&
+	awk -v n="$1" '
+	function id(i) { return sprintf("%040x", i) }
+	BEGIN {
+		for (i = 1; i <= n; i++) {
+			t = 1000000000 + 100 * i
+			if (i % 10 == 0)
+				t -= 250
+			printf "%s %s C O Mitter <c@example.com> %d +0000\tupdate %d\n",
+				id(i - 1), id(i), t, i
+		}
+	}' >.git/logs/refs/heads/long &&
+	printf "%040x\n" "$1" >.git/refs/heads/long
+}
+
+# What @{N} and @{date} of refs/heads/long should be, from the reflog
+expect_nth () {
+	awk -v n="$1" '{ line[NR] = $2 } END { print line[NR - n] }' \
+		.git/logs/refs/heads/long
+}
+
+expect_at () {
+	awk -v at="$1" '
+	{ split($0, f, ">"); split(f[2], d, " "); ts[NR] = d[1]; id[NR] = $2 }
+	END {
+		for (i = NR; i > 0; i--)
+			if (ts[i] <= at) { print id[i]; exit }
+	}' .git/logs/refs/heads/long
+}
+
+check_lookups () {
+	count=$(wc -l <.git/logs/refs/heads/long) &&
+	for n in 0 1 2 63 64 65 130 1000 $(($count - 2)) $(($count - 1))
+	do
+		expect_nth $n >expect &&
+		git rev-parse long@{$n} >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	for at in 1000199999 1000100000 1000099750 1000099760 1000050000 1000000300 1000000100
+	do
+		expect_at $at >expect &&
+		git rev-parse "long@{$at}" >actual 2>/dev/null &&
+		test_cmp expect actual || return 1
+	done
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	write_long_reflog 2000
+'
+
+test_expect_success 'lookups in a long reflog write an index' '
+	check_lookups &&
+	test -f .git/reflog-index/refs/heads/long
+'
+
+test_expect_success 'lookups use the index' '
+	check_lookups
+'
+
+test_expect_success 'entries appended later are indexed' '
+	cp .git/reflog-index/refs/heads/long index.old &&
+	git update-ref -m more refs/heads/long HEAD &&
+	check_lookups &&
+	! test_cmp index.old .git/reflog-index/refs/heads/long
+'
+
+test_expect_success 'a rewritten reflog is indexed again' '
+	write_long_reflog 1500 &&
+	check_lookups
+'
+
+test_expect_success 'deleting reflog entries drops the index' '
+	check_lookups &&
+	test -f .git/reflog-index/refs/heads/long &&
+	git reflog delete long@{5} &&
+	test_path_is_missing .git/reflog-index/refs/heads/long &&
+	check_lookups
+'
+
+test_expect_success 'short reflogs are not indexed' '
+	git commit --allow-empty -m two &&
+	git rev-parse master@{1} &&
+	test_path_is_missing .git/reflog-index/refs/heads/master
+'
+
+test_done
@@ -420,4 +420,38 @@ test_expect_success 'fsck notices ref pointing to missing tag' '
 	test_must_fail git -C missing fsck
 '
 
+test_expect_success 'fsck --threads checks packs with several threads' '
+	git init threads &&
+	(
+		cd threads &&
+		for i in $(test_seq 1 40)
+		do
+			test_seq 1 $((i * 20)) >file &&
+			echo $i >other &&
+			git add file other &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -a -d -q &&
+		git fsck --threads=1 --unreachable --root >expect 2>&1 &&
+		git fsck --threads=4 --unreachable --root >actual 2>&1 &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'fsck --threads notices a corrupt packed object' '
+	(
+		cd threads &&
+		pack=$(ls .git/objects/pack/*.pack) &&
+		chmod u+w $pack &&
+		git verify-pack -v $pack >verify &&
+		sed -n "s/^\([0-9a-f]\{40\}\) blob .* 1 [0-9a-f]\{40\}$/\1/p" verify |
+			head -n 1 >obj &&
+		set -- $(grep "^$(cat obj) " verify) &&
+		printf "\377\377" |
+			dd of=$pack bs=1 seek=$(($5 + $4 - 2)) conv=notrunc 2>/dev/null &&
+		test_must_fail git fsck --threads=4 2>err &&
+		grep "$(cat obj)" err
+	)
+'
+
 test_done
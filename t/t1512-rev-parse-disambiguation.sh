@@ -273,6 +273,21 @@ test_expect_success 'rev-parse --disambiguate' '
 	test "$(sed -e "s/^\(.........\).*/\1/" actual | sort -u)" = 000000000
 '
 
+test_expect_success 'abbreviations stay unique across packs and loose objects' '
+	git rev-parse --disambiguate=000000000 >all &&
+	head -n 8 all | git pack-objects .git/objects/pack/pack &&
+	git rev-parse --disambiguate=000000000 | sort -u >actual &&
+	sort all >expect &&
+	test_cmp expect actual &&
+	while read sha1
+	do
+		short=$(git rev-parse --short $sha1) &&
+		test $(printf %s "$short" | wc -c) -gt 9 &&
+		test "$(git rev-parse --verify $short)" = "$sha1" ||
+		return 1
+	done <all
+'
+
 test_expect_success 'ambiguous 40-hex ref' '
 	TREE=$(git mktree </dev/null) &&
 	REF=`git rev-parse HEAD` &&
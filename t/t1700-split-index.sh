@@ -8,6 +8,7 @@ test_description='split index mode tests'
 sane_unset GIT_TEST_SPLIT_INDEX
 
 test_expect_success 'enable split index' '
+	git config splitIndex.maxPercentChange 100 &&
 	git update-index --split-index &&
 	test-dump-split-index .git/index >actual &&
 	indexversion=$(test-index-version <.git/index) &&
@@ -200,4 +201,69 @@ EOF
 	test_cmp expect actual
 '
 
+test_expect_success 'shared index is rewritten once enough has changed' '
+	git config splitIndex.maxPercentChange 50 &&
+	git update-index --split-index &&
+	for i in 1 2 3
+	do
+		: >new$i &&
+		git update-index --add new$i &&
+		test-dump-split-index .git/index | sed -n "s/^base //p" >base$i ||
+		return 1
+	done &&
+	test_cmp base1 base2 &&
+	! test_cmp base2 base3 &&
+	test-dump-split-index .git/index | sed "/^own/d" >actual &&
+	cat >expect <<EOF &&
+base $(cat base3)
+replacements:
+deletions:
+EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'splitIndex.maxPercentChange=0 always rewrites it' '
+	git config splitIndex.maxPercentChange 0 &&
+	: >new4 &&
+	git update-index --add new4 &&
+	test-dump-split-index .git/index | sed -n "s/^base //p" >base4 &&
+	! test_cmp base3 base4 &&
+	test_path_is_file .git/sharedindex.$(cat base4)
+'
+
+test_expect_success 'writing the split index freshens its shared index' '
+	git config splitIndex.maxPercentChange 100 &&
+	shared=.git/sharedindex.$(cat base4) &&
+	test-chmtime =-1000 $shared &&
+	: >new5 &&
+	git update-index --add new5 &&
+	test-chmtime -v +0 $shared >mtime &&
+	test $(cut -f1 mtime) -gt $(($(date +%s) - 100))
+'
+
+test_expect_success 'old unused shared indexes expire' '
+	git config splitIndex.maxPercentChange 0 &&
+	git config splitIndex.sharedIndexExpire never &&
+	ls .git/sharedindex.* >before &&
+	test_line_count -gt 2 before &&
+	for f in $(cat before)
+	do
+		test-chmtime =-1500000 $f || return 1
+	done &&
+	: >new6 &&
+	git update-index --add new6 &&
+	ls .git/sharedindex.* >actual &&
+	test_line_count -gt $(wc -l <before) actual &&
+	git config splitIndex.sharedIndexExpire now &&
+	: >new7 &&
+	git update-index --add new7 &&
+	ls .git/sharedindex.* >actual &&
+	test_line_count = 1 actual &&
+	test-dump-split-index .git/index | sed -n "s/^base //p" >base &&
+	echo ".git/sharedindex.$(cat base)" >expect &&
+	test_cmp expect actual &&
+	git ls-files >actual &&
+	test_line_count = 9 actual
+'
+
 test_done
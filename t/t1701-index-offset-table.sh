@@ -0,0 +1,87 @@
+#!/bin/sh
+
+test_description='index entry offset table and parallel index loading'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_SPLIT_INDEX
+
+test_expect_success 'setup' '
+	for d in a b c d e
+	do
+		mkdir $d &&
+		for i in $(test_seq 1 40)
+		do
+			echo $d$i >$d/file$i || return 1
+		done
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	git ls-files --stage >expect
+'
+
+test_expect_success 'index without offset table has no such extensions' '
+	git update-index --index-version 2 &&
+	! grep IEOT .git/index &&
+	! grep EOIE .git/index
+'
+
+for version in 2 3 4
+do
+	test_expect_success "write offset table (v$version)" '
+		test_config index.recordOffsetTable true &&
+		test_config index.threads 4 &&
+		rm .git/index &&
+		git read-tree HEAD &&
+		if test $version = 3
+		then
+			git update-index --skip-worktree a/file1
+		fi &&
+		git update-index --index-version $version &&
+		git update-index --refresh &&
+		grep IEOT .git/index &&
+		grep EOIE .git/index
+	'
+
+	test_expect_success "read index in parallel (v$version)" '
+		git -c index.threads=1 ls-files --stage >serial &&
+		git -c index.threads=4 ls-files --stage >parallel 2>err &&
+		test_cmp serial parallel &&
+		test_must_be_empty err &&
+		test_cmp expect parallel &&
+		git -c index.threads=3 diff-index --cached --exit-code HEAD &&
+		git -c index.threads=4 diff-files --exit-code
+	'
+done
+
+test_expect_success 'cache-tree is read alongside the entries' '
+	test_config index.recordOffsetTable true &&
+	test_config index.threads 4 &&
+	git update-index --index-version 2 &&
+	git write-tree >tree.expect &&
+	test-dump-cache-tree >cache-tree.expect &&
+	git -c index.threads=4 write-tree >tree.actual &&
+	test_cmp tree.expect tree.actual &&
+	test-dump-cache-tree >cache-tree.actual &&
+	test_cmp cache-tree.expect cache-tree.actual
+'
+
+test_expect_success 'split index with offset table' '
+	test_config index.recordOffsetTable true &&
+	test_config index.threads 4 &&
+	git update-index --split-index &&
+	echo changed >a/file1 &&
+	git update-index a/file1 &&
+	git -c index.threads=1 ls-files --stage >serial &&
+	git -c index.threads=4 ls-files --stage >parallel &&
+	test_cmp serial parallel &&
+	git update-index --no-split-index
+'
+
+test_expect_success 'index.threads=false reads serially' '
+	git -c index.threads=false ls-files --stage >serial &&
+	git -c index.threads=true ls-files --stage >parallel &&
+	test_cmp serial parallel
+'
+
+test_done
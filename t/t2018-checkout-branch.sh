@@ -198,4 +198,33 @@ test_expect_success 'checkout -B to the current branch works' '
 	test_dirty_mergeable
 '
 
+test_expect_success 'checkout keeps changes in directories both branches share' '
+	git checkout -f -b shared-dir initial &&
+	mkdir -p shared/deep &&
+	echo one >shared/deep/file &&
+	echo two >shared/file &&
+	git add shared &&
+	git commit -m "add shared" &&
+	git checkout -b shared-dir-side &&
+	echo side >side-file &&
+	git add side-file &&
+	git commit -m side &&
+
+	echo changed >shared/deep/file &&
+	git checkout shared-dir &&
+	echo changed >expect &&
+	test_cmp expect shared/deep/file &&
+	test_path_is_missing side-file &&
+
+	echo staged >shared/file &&
+	git add shared/file &&
+	git checkout shared-dir-side &&
+	git diff --cached --name-only >actual &&
+	echo shared/file >expect &&
+	test_cmp expect actual &&
+	git diff --name-only >actual &&
+	echo shared/deep/file >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,97 @@
+#!/bin/sh
+
+test_description='parallel checkout'
+
+. ./test-lib.sh
+
+parallel="-c checkout.workers=4 -c checkout.thresholdForParallelism=0"
+
+test_expect_success 'setup' '
+	for d in a b c
+	do
+		mkdir $d &&
+		for i in $(test_seq 1 10)
+		do
+			echo $d$i >$d/file$i || return 1
+		done
+	done &&
+	echo "#!/bin/sh" >a/script &&
+	chmod +x a/script &&
+	printf "one\ntwo\n" >crlf.txt &&
+	echo "crlf.txt text eol=crlf" >.gitattributes &&
+	test-genrandom seed 100000 >big &&
+	git add . &&
+	git commit -q -m first &&
+	git checkout -q -b second &&
+	git rm -q -r b &&
+	for i in $(test_seq 1 10)
+	do
+		echo changed$i >a/file$i || return 1
+	done &&
+	mkdir b &&
+	echo new >b/new &&
+	git add . &&
+	git commit -q -m second &&
+	git checkout -q master
+'
+
+test_expect_success 'clone with parallel checkout' '
+	git clone -q . sequential &&
+	GIT_TRACE="$(pwd)/trace" git $parallel clone -q . parallel &&
+	grep "checkout--worker" trace &&
+	(cd parallel && git ls-files -s) >actual &&
+	(cd sequential && git ls-files -s) >expect &&
+	test_cmp expect actual &&
+	for f in $(git ls-files)
+	do
+		cmp sequential/$f parallel/$f || return 1
+	done &&
+	test -x parallel/a/script &&
+	printf "one\r\ntwo\r\n" >expect &&
+	test_cmp expect parallel/crlf.txt
+'
+
+test_expect_success 'index records the stat data of files workers wrote' '
+	(
+		cd parallel &&
+		git diff-files --name-only >../actual
+	) &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'switch branches with parallel checkout' '
+	(
+		cd parallel &&
+		git $parallel checkout -q second &&
+		git diff-files --name-only >../actual &&
+		test_must_be_empty ../actual &&
+		test_path_is_missing b/file1 &&
+		echo new >../expect &&
+		test_cmp ../expect b/new &&
+		echo changed1 >../expect &&
+		test_cmp ../expect a/file1 &&
+		git $parallel checkout -q master &&
+		git status --porcelain >../actual &&
+		test_must_be_empty ../actual
+	)
+'
+
+test_expect_success 'no workers for fewer entries than the threshold' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -c checkout.workers=4 clone -q . small &&
+	! grep "checkout--worker" trace &&
+	(cd small && git status --porcelain) >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'existing files block a parallel checkout' '
+	(
+		cd parallel &&
+		echo dirty >b/file1 &&
+		test_must_fail git $parallel checkout -q second 2>err &&
+		test_i18ngrep "b/file1" err &&
+		git checkout b/file1
+	)
+'
+
+test_done
@@ -305,4 +305,41 @@ test_expect_success 'ls-files with "**" patterns and no slashes' '
 	test_cmp expect actual
 '
 
+test_expect_success 'last match wins across literal, suffix, path and wildcard patterns' '
+	git init big &&
+	(
+		cd big &&
+		mkdir -p src/deep out &&
+		touch keep.c keep.o gen.out src/x.o src/x.tmp src/deep/y.tmp \
+			out/a out/b &&
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+		do
+			echo "gen$i.out" &&
+			echo "*.ext$i" &&
+			echo "/out/dir$i/" &&
+			echo "src/m$i/*.tmp" || return 1
+		done >.gitignore &&
+		cat >>.gitignore <<-\EOF &&
+		*.o
+		gen.out
+		src/**/*.tmp
+		/out/
+		!keep.o
+		!/src/x.tmp
+		!out/
+		out/a
+		!src/*.o
+		src/x.o
+		EOF
+		git ls-files -o -i --exclude-standard >../actual
+	) &&
+	cat >expect <<-\EOF &&
+	gen.out
+	out/a
+	src/deep/y.tmp
+	src/x.o
+	EOF
+	test_cmp expect actual
+'
+
 test_done
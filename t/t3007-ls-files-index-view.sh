@@ -0,0 +1,67 @@
+#!/bin/sh
+
+test_description='ls-files straight from the mmapped index file
+
+The index entries that ls-files shows are streamed out of the index
+file, in version 2 as well as in the prefix-compressed version 4.  A
+split index has to be read in full and so serves as the reference
+here.
+'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p sub/dir sub/dir.d other &&
+	for f in a b sub/c sub/dir/d sub/dir/e sub/dir.d/g sub/h other/f
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git update-index --assume-unchanged sub/c &&
+	git update-index --skip-worktree other/f &&
+	git update-index --index-info <<-EOF
+	100644 $(git hash-object a) 1	conflict
+	100644 $(git hash-object b) 2	conflict
+	100644 $(git hash-object sub/c) 3	conflict
+	EOF
+'
+
+compare_index_versions () {
+	test_expect_success "ls-files $* agrees with a full read" "
+		git update-index --split-index &&
+		(cd sub && git ls-files $*) >expect &&
+		git update-index --no-split-index --index-version 2 &&
+		(cd sub && git ls-files $*) >actual &&
+		test_cmp expect actual &&
+		git update-index --index-version 4 &&
+		(cd sub && git ls-files $*) >actual &&
+		test_cmp expect actual
+	"
+}
+
+compare_index_versions
+compare_index_versions --full-name
+compare_index_versions -s
+compare_index_versions -u
+compare_index_versions -t
+compare_index_versions -v
+compare_index_versions -z
+compare_index_versions --debug
+compare_index_versions dir
+compare_index_versions ../conflict ../other
+compare_index_versions -s -- ../sub/dir
+
+test_expect_success '--error-unmatch reports missing paths' '
+	git update-index --index-version 2 &&
+	git ls-files --error-unmatch a sub/c >actual &&
+	printf "%s\n" a sub/c >expect &&
+	test_cmp expect actual &&
+	test_must_fail git ls-files --error-unmatch a nothing
+'
+
+test_expect_success 'missing index shows nothing' '
+	GIT_INDEX_FILE=.git/no-such-index git ls-files >actual &&
+	test_must_be_empty actual
+'
+
+test_done
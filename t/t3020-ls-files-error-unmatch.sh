@@ -25,4 +25,36 @@ test_expect_success \
     'git ls-files --error-unmatch should succeed eith matched paths.' \
     'git ls-files --error-unmatch foo bar'
 
+test_expect_success 'many literal pathspecs match files, directories and leading paths' '
+	mkdir -p dir/sub dir-x &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		>dir/f$i &&
+		>dir/sub/g$i || return 1
+	done &&
+	>dir-x/h &&
+	git add dir dir-x &&
+	cat >expect <<-\EOF &&
+	dir-x/h
+	dir/f3
+	dir/sub/g0
+	dir/sub/g1
+	dir/sub/g2
+	dir/sub/g3
+	dir/sub/g4
+	dir/sub/g5
+	dir/sub/g6
+	dir/sub/g7
+	dir/sub/g8
+	dir/sub/g9
+	foo
+	EOF
+	git ls-files --error-unmatch dir/sub/ dir/f3 dir-x foo dir/sub/g4 >actual &&
+	test_cmp expect actual &&
+	test_must_fail git ls-files --error-unmatch dir/sub/ dir/f >actual 2>err &&
+	test_i18ngrep "dir/f" err &&
+	test_must_fail git ls-files --error-unmatch foo/ dir/f3 2>err &&
+	test_i18ngrep "foo/" err
+'
+
 test_done
@@ -187,6 +187,54 @@ test_expect_success 'notice d/f conflict with existing ref' '
 	test_must_fail git branch foo/bar/baz/lots/of/extra/components
 '
 
+test_expect_success 'packed-refs is written sorted' '
+	git pack-refs --all &&
+	head -n 1 .git/packed-refs >header &&
+	grep " sorted " header &&
+	sed -e 1d -e "/^\^/d" -e "s/^[^ ]* //" .git/packed-refs >names &&
+	LC_ALL=C sort names >sorted-names &&
+	test_cmp sorted-names names
+'
+
+test_expect_success 'refs are looked up in a sorted packed-refs' '
+	for i in $(test_seq 100)
+	do
+		echo "create refs/heads/sorted/b$i HEAD" &&
+		echo "create refs/tags/sorted-t$i HEAD"
+	done >input &&
+	git update-ref --stdin <input &&
+	git pack-refs --all --prune &&
+	git rev-parse HEAD >expect &&
+	for r in sorted/b1 sorted/b42 sorted/b100 sorted-t7 refs/tags/sorted-t99
+	do
+		git rev-parse $r >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	test_must_fail git rev-parse --verify sorted/b101 &&
+	test_must_fail git rev-parse --verify refs/heads/sorted &&
+	git for-each-ref --format="%(refname)" refs/heads/sorted/ >actual &&
+	sed -n "s|^[^ ]* \(refs/heads/sorted/.*\)|\1|p" .git/packed-refs >expect &&
+	test_line_count = 100 actual &&
+	test_cmp expect actual &&
+	git for-each-ref refs/tags/sorted-t1 >actual &&
+	test_line_count = 1 actual
+'
+
+test_expect_success 'an unsorted packed-refs is still read' '
+	{
+		echo "# pack-refs with: peeled fully-peeled " &&
+		sed -e 1d -e "/^\^/d" .git/packed-refs | sort -r
+	} >unsorted &&
+	mv unsorted .git/packed-refs &&
+	git rev-parse HEAD >expect &&
+	git rev-parse sorted/b42 >actual &&
+	test_cmp expect actual &&
+	git for-each-ref refs/heads/sorted/ >actual &&
+	test_line_count = 100 actual &&
+	git pack-refs --all &&
+	grep " sorted " .git/packed-refs
+'
+
 test_expect_success 'timeout if packed-refs.lock exists' '
 	LOCK=.git/packed-refs.lock &&
 	>"$LOCK" &&
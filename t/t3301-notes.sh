@@ -1188,4 +1188,27 @@ test_expect_success 'empty notes are displayed by git log' '
 	test_cmp expect actual
 '
 
+test_expect_success 'core.notesIndex shows the same notes' '
+	git log --format="%h %N" >expect &&
+	test_config core.notesIndex true &&
+	git log --format="%h %N" >actual &&
+	test_path_is_file .git/notes-index/refs/notes/commits &&
+	test_cmp expect actual &&
+	git log --format="%h %N" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.notesIndex follows the notes ref' '
+	test_config core.notesIndex true &&
+	git log -1 --format=%N >/dev/null &&
+	git notes add -f -m "changed note" &&
+	printf "changed note\n\n" >expect &&
+	git log -1 --format=%N >actual &&
+	test_cmp expect actual &&
+	git notes remove &&
+	echo >expect &&
+	git log -1 --format=%N >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -40,6 +40,38 @@ test_expect_success 'cherry-pick first..fourth works' '
 	check_head_differs_from fourth
 '
 
+test_expect_success 'cherry-pick first..fourth leaves a reflog entry per commit' '
+	git checkout -f master &&
+	git reset --hard first &&
+	test_tick &&
+	git cherry-pick first..fourth &&
+	cat >expect <<-\EOF &&
+	cherry-pick: fourth
+	cherry-pick: third
+	cherry-pick: second
+	EOF
+	git reflog -3 --format=%gs >actual &&
+	test_cmp expect actual &&
+	git diff --quiet &&
+	git diff --cached --quiet
+'
+
+test_expect_success 'cherry-pick range stops where an untracked file is in the way' '
+	git checkout -f -b in-the-way first &&
+	test_commit add-a a &&
+	test_commit add-b b &&
+	git checkout -f master &&
+	git reset --hard first &&
+	echo precious >b &&
+	test_must_fail git cherry-pick first..in-the-way &&
+	test "$(git log -1 --format=%s)" = add-a &&
+	test_path_is_file a &&
+	echo precious >expect &&
+	test_cmp expect b &&
+	git cherry-pick --quit &&
+	rm b
+'
+
 test_expect_success 'cherry-pick three one two works' '
 	git checkout -f first &&
 	test_commit one &&
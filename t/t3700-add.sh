@@ -332,4 +332,32 @@ test_expect_success 'git add --dry-run --ignore-missing of non-existing file out
 	test_i18ncmp expect.err actual.err
 '
 
+test_expect_success 'add and commit with core.fsyncObjectFiles=batch' '
+	git init batch &&
+	(
+		cd batch &&
+		git config core.fsyncObjectFiles batch &&
+		mkdir dir &&
+		for i in 1 2 3 4 5 6 7 8
+		do
+			echo "$i" >file$i &&
+			echo "sub $i" >dir/file$i || return 1
+		done &&
+		git add . &&
+		git ls-files -s >staged &&
+		while read mode sha1 stage path
+		do
+			loose=$(echo $sha1 | sed -e "s|^..|&/|") &&
+			test_path_is_file .git/objects/$loose ||
+			return 1
+		done <staged &&
+		test_tick &&
+		git commit -m batched &&
+		loose=$(git rev-parse HEAD:dir | sed -e "s|^..|&/|") &&
+		test_path_is_file .git/objects/$loose &&
+		git fsck &&
+		! ls -d .git/objects/tmp_batch_*
+	)
+'
+
 test_done
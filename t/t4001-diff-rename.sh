@@ -156,4 +156,31 @@ test_expect_success 'rename pretty print common prefix and suffix overlap' '
 	test_i18ngrep " d/f/{ => f}/e " output
 '
 
+test_expect_success 'diff.largeRenames looks for renames past the limit' '
+	mkdir big &&
+	for i in 1 2 3 4 5 6
+	do
+		test_write_lines "file $i" 1 2 3 4 5 6 7 8 9 >big/$i || return 1
+	done &&
+	git add big &&
+	git commit -m "add big/*" &&
+	mkdir moved &&
+	for i in 1 2 3 4 5 6
+	do
+		git mv big/$i moved/$i &&
+		echo "more $i" >>moved/$i || return 1
+	done &&
+	git commit -a -m "big -> moved" &&
+	git diff -M --name-status HEAD^ HEAD >expect &&
+	test_line_count = 6 expect &&
+	grep "^R" expect &&
+	git diff -l2 -M --name-status HEAD^ HEAD >output 2>err &&
+	! grep "^R" output &&
+	test_i18ngrep renameLimit err &&
+	git -c diff.largeRenames=true diff -l2 -M --name-status \
+		HEAD^ HEAD >output 2>err &&
+	test_cmp expect output &&
+	test_must_be_empty err
+'
+
 test_done
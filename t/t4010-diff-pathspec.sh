@@ -140,6 +140,17 @@ test_expect_success 'diff multiple wildcard pathspecs' '
 	test_cmp expect actual
 '
 
+test_expect_success 'diff-tree -r with many literal pathspecs' '
+	git diff-tree -r --name-only $EMPTY_TREE $tree3 -- \
+		path2/ path path1/file path1/file1/ file0/ path2/file1 \
+		path1/file10 file path3 file0 >actual &&
+	cat <<-\EOF >expect &&
+	file0
+	path2/file1
+	EOF
+	test_cmp expect actual
+'
+
 test_expect_success 'diff-cache ignores trailing slash on submodule path' '
 	git diff --name-only HEAD^ submod >expect &&
 	git diff --name-only HEAD^ submod/ >actual &&
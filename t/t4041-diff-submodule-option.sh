@@ -545,4 +545,25 @@ test_expect_success 'diff --submodule with objects referenced by alternates' '
 	test_cmp expected actual
 '
 
+test_expect_success 'diff --submodule shows the log of each of several submodules' '
+	mkdir multi &&
+	(cd multi &&
+		git init &&
+		for sm in one two
+		do
+			test_create_repo $sm &&
+			(cd $sm && test_commit $sm-a) &&
+			git add $sm || return 1
+		done &&
+		git commit -m "add submodules" &&
+		(cd one && test_commit one-b) &&
+		(cd two && test_commit two-b) &&
+		git diff --submodule=log >../actual
+	) &&
+	grep "^Submodule one .*:\$" actual &&
+	grep "^Submodule two .*:\$" actual &&
+	grep "^  > one-b\$" actual &&
+	grep "^  > two-b\$" actual
+'
+
 test_done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='patch output with diff.threads'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_write_lines "int f$i(void)" "{" a b c d e f g h "}" >file$i.c &&
+		printf "bin\0ary$i" >binary$i || return 1
+	done &&
+	test_write_lines a b c d e f >conv &&
+	test_write_lines one two three four five six seven eight >copy-source &&
+	echo "conv diff=upcase" >.gitattributes &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		sed -e "s/^d$/d changed $i/" -e "s/^h$/h  /" file$i.c >tmp &&
+		mv tmp file$i.c &&
+		printf "bin\0ary changed $i" >binary$i || return 1
+	done &&
+	git mv file8.c moved.c &&
+	test_write_lines a b c X e f >conv &&
+	test_write_lines one two three four five six seven EIGHT >copy &&
+	git add . &&
+	test_tick &&
+	git commit -m second
+'
+
+for opts in "" "--stat -M -C -C" "--binary" "--word-diff" "--color -W" \
+	"-w -U1 --function-context" "--textconv" "--no-textconv"
+do
+	test_expect_success "output with diff.threads is the same: $opts" '
+		git -c diff.upcase.textconv="tr a-z A-Z <" \
+			log -p $opts >expect &&
+		git -c diff.upcase.textconv="tr a-z A-Z <" -c diff.threads=4 \
+			log -p $opts >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'working tree diff with diff.threads' '
+	test_when_finished "git reset --hard" &&
+	for i in 1 2 3 4 5
+	do
+		echo more >>file$i.c || return 1
+	done &&
+	git diff >expect &&
+	git -c diff.threads=3 diff >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -c diff.threads=3 diff --exit-code -- file1.c file2.c
+'
+
+test_expect_success 'external diff with diff.threads' '
+	write_script ext <<-\EOF &&
+	echo "$1 $3 $6"
+	EOF
+	git -c diff.external=./ext diff HEAD^ >expect &&
+	git -c diff.external=./ext -c diff.threads=2 diff HEAD^ >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='remembering renames with diff.renameCache'
+. ./test-lib.sh
+
+cache=.git/objects/info/rename-cache
+
+test_expect_success 'setup' '
+	mkdir old &&
+	for i in $(test_seq 40)
+	do
+		test_write_lines "file $i" $(test_seq $i $((i + 20))) >old/$i || return 1
+	done &&
+	git add old &&
+	test_tick &&
+	git commit -m initial &&
+	git mv old new &&
+	for i in $(test_seq 40)
+	do
+		echo "edited $i" >>new/$i || return 1
+	done &&
+	git add new &&
+	test_tick &&
+	git commit -m moved
+'
+
+test_expect_success 'renames are remembered' '
+	git diff -M --name-status HEAD^ HEAD >expect &&
+	test_path_is_missing $cache &&
+	git -c diff.renameCache diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $cache &&
+	test_line_count = 2 $cache &&
+	grep "^R" actual >renames &&
+	test_line_count = 40 renames
+'
+
+test_expect_success 'remembered renames give the same output' '
+	git -c diff.renameCache diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	test_line_count = 2 $cache &&
+	git diff -M --stat HEAD^ HEAD >expect.stat &&
+	git -c diff.renameCache diff -M --stat HEAD^ HEAD >actual.stat &&
+	test_cmp expect.stat actual.stat
+'
+
+test_expect_success 'remembered renames are used' '
+	cp $cache saved &&
+	key=$(tail -n 1 saved | cut -d" " -f1) &&
+	echo "$key" >>$cache &&
+	git -c diff.renameCache diff -M --name-status HEAD^ HEAD >actual &&
+	! grep "^R" actual &&
+	cp saved $cache
+'
+
+test_expect_success 'malformed entries are ignored' '
+	key=$(tail -n 1 saved | cut -d" " -f1) &&
+	echo "$key 1:2:x" >>$cache &&
+	echo "$key 0:1000:1" >>$cache &&
+	printf "$key 0:0:1" >>$cache &&
+	git -c diff.renameCache diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	cp saved $cache
+'
+
+test_expect_success 'different options use different entries' '
+	git diff -M90% --name-status HEAD^ HEAD >expect.90 &&
+	git -c diff.renameCache diff -M90% --name-status HEAD^ HEAD >actual.90 &&
+	test_cmp expect.90 actual.90 &&
+	test_line_count = 3 $cache &&
+	git diff -C -C --name-status HEAD^ HEAD >expect.copies &&
+	git -c diff.renameCache diff -C -C --name-status HEAD^ HEAD >actual.copies &&
+	test_cmp expect.copies actual.copies &&
+	test_line_count = 4 $cache
+'
+
+test_expect_success 'small comparisons are not remembered' '
+	rm -f $cache &&
+	git -c diff.renameCache diff -M --name-status HEAD^ HEAD -- old/1 new/1 >actual &&
+	test_path_is_missing $cache
+'
+
+test_done
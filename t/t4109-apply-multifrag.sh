@@ -31,5 +31,27 @@ test_expect_success 'git apply (3)' '
 '
 mv main.c main.c.git
 
+test_expect_success 'a later hunk can apply before an earlier one' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 >file &&
+	cat >patch5.patch <<-\EOF &&
+	diff --git a/file b/file
+	--- a/file
+	+++ b/file
+	@@ -9,3 +9,3 @@
+	 9
+	-10
+	+ten
+	 11
+	@@ -15,3 +15,3 @@
+	 2
+	-3
+	+three
+	 4
+	EOF
+	git apply patch5.patch &&
+	test_write_lines 1 2 three 4 5 6 7 8 9 ten 11 12 13 14 15 16 17 18 19 20 >expect &&
+	test_cmp expect file
+'
+
 test_done
 
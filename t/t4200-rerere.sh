@@ -391,4 +391,55 @@ test_expect_success 'rerere -h' '
 	test_i18ngrep [Uu]sage help
 '
 
+test_expect_success 'many conflicts, some of them alike' '
+	git init many &&
+	(
+		cd many &&
+		git config rerere.enabled true &&
+		for i in $(test_seq 200)
+		do
+			test_seq 1 20 >f$i || return 1
+		done &&
+		git add . &&
+		test_tick &&
+		git commit -q -m base &&
+		git checkout -q -b side &&
+		for i in $(test_seq 200)
+		do
+			sed -e "s/^10\$/side$((i % 2))/" f$i >tmp &&
+			mv tmp f$i || return 1
+		done &&
+		test_tick &&
+		git commit -q -a -m side &&
+		git checkout -q master &&
+		for i in $(test_seq 200)
+		do
+			sed -e "s/^10\$/main/" f$i >tmp &&
+			mv tmp f$i || return 1
+		done &&
+		test_tick &&
+		git commit -q -a -m main &&
+		test_must_fail git merge side 2>err &&
+		grep "^Recorded preimage" err >actual &&
+		cat >expect <<-\EOF &&
+		Recorded preimage for '\''f1'\''
+		Recorded preimage for '\''f10'\''
+		EOF
+		test_cmp expect actual &&
+		test $(ls .git/rr-cache | wc -l) = 2 &&
+		for i in $(test_seq 200)
+		do
+			test_seq 1 20 >f$i || return 1
+		done &&
+		git rerere &&
+		git reset -q --hard &&
+		test_must_fail git merge side &&
+		test_seq 1 20 >expect &&
+		for i in $(test_seq 200)
+		do
+			test_cmp expect f$i || return 1
+		done
+	)
+'
+
 test_done
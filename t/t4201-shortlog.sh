@@ -194,4 +194,13 @@ test_expect_success 'shortlog with revision pseudo options' '
 	git shortlog --exclude=refs/heads/m* --all
 '
 
+test_expect_success 'shortlog gives the same output with several threads' '
+	for opts in "" -n -s -sne "-w --format=%s%n%b"
+	do
+		git -c shortlog.threads=1 shortlog $opts --all >expect &&
+		git -c shortlog.threads=3 shortlog $opts --all >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
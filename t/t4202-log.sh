@@ -871,4 +871,40 @@ test_expect_success 'log --graph --no-walk is forbidden' '
 	test_must_fail git log --graph --no-walk
 '
 
+test_expect_success 'log.threads does not change --stat output' '
+	for args in "--stat" "--numstat -w" "--shortstat --first-parent" \
+		    "-p --stat -m" "--stat --reverse" "--stat -M" "-3 --stat"
+	do
+		git log $args >expect &&
+		git -c log.threads=4 log $args >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'log.threads does not change --grep and --author output' '
+	for args in "--grep=e" "--grep=E -i --invert-grep" "--author=A" \
+		    "--author=Nobody" "--all-match --grep=o --author=A" \
+		    "--grep=s -2" "--grep=o --reverse --topo-order" \
+		    "--grep=o --parents" "--grep=e --boundary HEAD~2..HEAD"
+	do
+		git log $args >expect &&
+		git -c log.threads=4 log $args >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'log.threads counts --ignore-blank-lines with context' '
+	test_write_lines a b c d e f g h >blanks &&
+	git add blanks &&
+	test_tick &&
+	git commit -m "add blanks" &&
+	test_write_lines a "" b c X d e f "" g h >blanks &&
+	test_tick &&
+	git commit -a -m "blank lines around a change" &&
+	git log -2 --numstat --ignore-blank-lines >expect &&
+	git -c log.threads=4 log -2 --numstat --ignore-blank-lines >actual &&
+	test_cmp expect actual &&
+	grep "^2	0	blanks" actual
+'
+
 test_done
@@ -70,6 +70,21 @@ test_log	expect_second	-G Picked
 test_log_icase	expect_nomatch	-G pickle
 test_log_icase	expect_second	-G picked
 
+test_expect_success LIBPCRE 'log -G --perl-regexp' '
+	test_must_fail git log -G"P\w+(?=d$)" &&
+	git log -G"P\w+(?=d$)" --perl-regexp --format=%H >actual &&
+	test_cmp expect_second actual &&
+	git log -G"p\w+(?=d$)" --perl-regexp -i --format=%H >actual &&
+	test_cmp expect_second actual &&
+	test_must_fail git log -G"P\w+(?=d$)" --perl-regexp -E
+'
+
+test_expect_success LIBPCRE 'log -S --pickaxe-regex --perl-regexp' '
+	git log -S"\bPick(?!le)" --pickaxe-regex --perl-regexp \
+		--format=%H >actual &&
+	test_cmp expect_second actual
+'
+
 test_expect_success 'log -G --textconv (missing textconv tool)' '
 	echo "* diff=test" >.gitattributes &&
 	test_must_fail git -c diff.test.textconv=missing log -Gfoo &&
@@ -106,4 +121,49 @@ test_expect_success 'log -S --no-textconv (missing textconv tool)' '
 	rm .gitattributes
 '
 
+test_expect_success 'setup for pickaxe with diff.threads' '
+	git checkout -b threads &&
+	for i in 1 2 3 4 5
+	do
+		echo "needle $i" >threads-$i &&
+		echo hay >>threads-$i || return 1
+	done &&
+	git add threads-* &&
+	test_tick &&
+	git commit -m "add threads" &&
+	echo hay >threads-2 &&
+	echo needle >>threads-4 &&
+	git mv threads-5 threads-6 &&
+	git add threads-* &&
+	test_tick &&
+	git commit -m "move needles"
+'
+
+for opt in -Sneedle "-Sne+dle --pickaxe-regex" -Gneedle "-Sneedle --pickaxe-all"
+do
+	test_expect_success "log $opt with diff.threads" "
+		git log -M --name-status $opt threads >expect &&
+		git -c diff.threads=3 log -M --name-status $opt threads >actual &&
+		test_cmp expect actual
+	"
+done
+
+test_expect_success 'log -S does not share counts with a textconv side' '
+	test_when_finished "git checkout master" &&
+	echo "*.up diff=up" >.gitattributes &&
+	test_when_finished "rm .gitattributes" &&
+	git checkout -b up threads &&
+	echo hello >lower &&
+	git add lower &&
+	test_tick &&
+	git commit -m lower &&
+	git mv lower upper.up &&
+	test_tick &&
+	git commit -m upper &&
+	git -c diff.up.textconv="tr a-z A-Z <" log -SHELLO \
+		--format=%s --name-only >actual &&
+	printf "upper\n\nupper.up\n" >expect &&
+	test_cmp expect actual
+'
+
 test_done
@@ -99,4 +99,16 @@ test_expect_success '-L with --first-parent and a merge' '
 	git log --first-parent -L 1,1:b.c
 '
 
+test_expect_success 'changed-path filters do not change -L output' '
+	git checkout parallel-change &&
+	git log -L 1,1:b.c >expect.plain &&
+	git log -M -L :main:b.c >expect.rename &&
+	git commit-graph write --changed-paths &&
+	git -c core.commitGraph=true log -L 1,1:b.c >actual.plain &&
+	git -c core.commitGraph=true log -M -L :main:b.c >actual.rename &&
+	git commit-graph clear &&
+	test_cmp expect.plain actual.plain &&
+	test_cmp expect.rename actual.rename
+'
+
 test_done
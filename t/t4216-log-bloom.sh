@@ -0,0 +1,110 @@
+#!/bin/sh
+
+test_description='path-limited history with changed-path filters'
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+test_expect_success 'setup history' '
+	mkdir -p A/B/C deep/er/est &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 deep/er/est/file4 &&
+	test_commit c5 file5 &&
+	git checkout -b side c2 &&
+	test_commit s1 A/B/side &&
+	test_commit s2 other &&
+	git checkout master &&
+	git merge -m merge side &&
+	git rm -q -r A/B/C &&
+	test_tick &&
+	git commit -q -m "remove A/B/C" &&
+	mkdir many &&
+	for i in $(test_seq 600)
+	do
+		echo $i >many/$i || return 1
+	done &&
+	git add many &&
+	test_tick &&
+	git commit -q -m "many files" &&
+	test_commit c6 A/file1 again
+'
+
+test_expect_success 'write and verify a commit-graph with filters' '
+	git commit-graph write --changed-paths &&
+	git commit-graph verify
+'
+
+graph_git () {
+	git -c core.commitGraph=true "$@"
+}
+
+for path in A A/ A/B A/B/C A/B/C/file3 A/file1 deep/er deep/er/est/file4 \
+	    file5 other many many/17 nothing "A nothing" "A/B/side deep"
+do
+	test_expect_success "log -- $path agrees with the unfiltered walk" "
+		git log --format=%s --full-history -- $path >expect &&
+		graph_git log --format=%s --full-history -- $path >actual &&
+		test_cmp expect actual &&
+		git log --format=%s -- $path >expect &&
+		graph_git log --format=%s -- $path >actual &&
+		test_cmp expect actual &&
+		git rev-list --parents --all -- $path >expect &&
+		graph_git rev-list --parents --all -- $path >actual &&
+		test_cmp expect actual
+	"
+done
+
+test_expect_success 'filters rule out commits without opening trees' '
+	GIT_TRACE_CHANGED_PATHS="$(pwd)/trace" \
+		graph_git log --format=%s -- deep >actual &&
+	echo c4 >expect &&
+	test_cmp expect actual &&
+	grep "definitely treesame" trace >hits &&
+	test_line_count -gt 5 hits
+'
+
+test_expect_success 'wildcards and magic do not use the filters' '
+	rm -f trace &&
+	GIT_TRACE_CHANGED_PATHS="$(pwd)/trace" \
+		graph_git log --format=%s -- "deep/*" ":(icase)DEEP" >actual &&
+	echo c4 >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'rewriting the graph keeps the filters' '
+	test_commit c7 deep/er/file7 &&
+	git commit-graph write &&
+	git commit-graph verify &&
+	rm -f trace &&
+	GIT_TRACE_CHANGED_PATHS="$(pwd)/trace" \
+		graph_git log --format=%s -- deep >actual &&
+	printf "%s\n" c7 c4 >expect &&
+	test_cmp expect actual &&
+	test_path_is_file trace
+'
+
+test_expect_success '--no-changed-paths drops them' '
+	git commit-graph write --no-changed-paths &&
+	git commit-graph verify &&
+	rm -f trace &&
+	GIT_TRACE_CHANGED_PATHS="$(pwd)/trace" \
+		graph_git log --format=%s -- deep >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'verify notices a wrong filter' '
+	git commit-graph write --changed-paths &&
+	cp $graph graph.save &&
+	test_when_finished "mv graph.save $graph" &&
+	chmod u+w $graph &&
+	size=$(wc -c <$graph) &&
+	printf "\\377\\377" | dd of=$graph bs=1 seek=$(($size - 24)) conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify 2>err &&
+	test_i18ngrep "changed-path filter" err
+'
+
+test_done
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >numbers &&
+	echo hello >greeting &&
+	git add numbers greeting &&
+	test_tick &&
+	git commit -m initial &&
+
+	git checkout -b side1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	git mv greeting salutation &&
+	test_tick &&
+	git commit -a -m side1 &&
+
+	git checkout -b side2 master &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 >numbers &&
+	echo new >other &&
+	git add numbers other &&
+	test_tick &&
+	git commit -m side2 &&
+
+	git checkout -b side3 master &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 eleven >numbers &&
+	test_tick &&
+	git commit -a -m side3
+'
+
+test_expect_success 'clean merge' '
+	git merge-tree --write-tree side1 side2 >out &&
+	tree=$(head -n 1 out) &&
+	git ls-tree --name-only $tree >actual &&
+	test_write_lines numbers other salutation >expect &&
+	test_cmp expect actual &&
+	git cat-file blob $tree:numbers >actual &&
+	test_write_lines 0 1 2 3 4 5 6 7 8 9 10 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'conflicted merge' '
+	test_must_fail git merge-tree --write-tree side1 side3 >out &&
+	tree=$(head -n 1 out) &&
+	git cat-file blob $tree:numbers >actual &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 "<<<<<<< side1" 10 ======= eleven \
+		">>>>>>> side3" >expect &&
+	test_cmp expect actual &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse master:numbers) 1	numbers
+	100644 $(git rev-parse side1:numbers) 2	numbers
+	100644 $(git rev-parse side3:numbers) 3	numbers
+	EOF
+	sed -n "2,4p" out >actual &&
+	test_cmp expect actual &&
+	grep "^CONFLICT (content): Merge conflict in numbers" out
+'
+
+test_expect_success 'result matches what merge leaves in the work tree' '
+	git checkout -b check side1 &&
+	test_must_fail git merge-tree --write-tree HEAD side3 >out &&
+	test_must_fail git merge side3 &&
+	git add numbers &&
+	git write-tree >expect &&
+	head -n 1 out >actual &&
+	test_cmp expect actual &&
+	git reset --hard
+'
+
+test_expect_success 'index and work tree are left alone' '
+	git checkout side2 &&
+	echo dirty >>numbers &&
+	echo untracked >salutation &&
+	git diff >diff.expect &&
+	git merge-tree --write-tree side2 side1 >out &&
+	git diff >diff.actual &&
+	test_cmp diff.expect diff.actual &&
+	echo untracked >expect &&
+	test_cmp expect salutation &&
+	git diff --cached --exit-code &&
+	git checkout numbers &&
+	rm salutation
+'
+
+test_done
@@ -294,6 +294,20 @@ test_expect_success GZIP 'extract tgz file' '
 	test_cmp_bin b.tar j.tar
 '
 
+test_expect_success GZIP 'built-in gzip output does not depend on threads' '
+	git -c archive.threads=1 archive --format=tgz HEAD >j4.tgz &&
+	git -c archive.threads=3 archive --format=tgz HEAD >j5.tgz &&
+	test_cmp_bin j4.tgz j5.tgz &&
+	gzip -d -c <j5.tgz >j5.tar &&
+	test_cmp_bin b.tar j5.tar
+'
+
+test_expect_success GZIP 'tgz through an external gzip' '
+	git -c tar.tgz.command="gzip -cn" archive --format=tgz HEAD >j6.tgz &&
+	gzip -d -c <j6.tgz >j6.tar &&
+	test_cmp_bin b.tar j6.tar
+'
+
 test_expect_success GZIP 'remote tar.gz is allowed by default' '
 	git archive --remote=. --format=tar.gz HEAD >remote.tar.gz &&
 	test_cmp_bin j.tgz remote.tar.gz
@@ -140,6 +140,20 @@ test_expect_success \
     'git archive --format=zip vs. the same in a bare repo' \
     'test_cmp_bin d.zip d1.zip'
 
+test_expect_success 'git archive --format=zip does not depend on threads' '
+	git -c archive.threads=1 archive --format=zip HEAD >d4.zip &&
+	git -c archive.threads=3 archive --format=zip HEAD >d5.zip &&
+	test_cmp_bin d4.zip d5.zip
+'
+
+test_expect_success 'git archive --format=zip from packed objects' '
+	git clone --no-local --bare . packed.git &&
+	cp .git/info/attributes packed.git/info/attributes &&
+	(cd packed.git && git archive --format=zip HEAD) >f.zip
+'
+
+check_zip f
+
 test_expect_success 'git archive --format=zip with --output' \
     'git archive --format=zip --output=d2.zip HEAD &&
     test_cmp_bin d.zip d2.zip'
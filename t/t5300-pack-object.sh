@@ -7,6 +7,7 @@ test_description='git pack-object
 
 '
 . ./test-lib.sh
+. "$TEST_DIRECTORY"/lib-pack.sh
 
 TRASH=`pwd`
 
@@ -214,6 +215,14 @@ test_expect_success \
 			test-2-${packname_2}.idx \
 			test-3-${packname_3}.idx'
 
+test_expect_success 'verify pack --jobs keeps the output in order' '
+	git verify-pack -v test-1-${packname_1}.idx test-2-${packname_2}.idx \
+		test-3-${packname_3}.idx >expect &&
+	git verify-pack -v --jobs=3 test-1-${packname_1}.idx \
+		test-2-${packname_2}.idx test-3-${packname_3}.idx >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success \
     'verify-pack catches mismatched .idx and .pack files' \
     'cat test-1-${packname_1}.idx >test-3.idx &&
@@ -223,6 +232,14 @@ test_expect_success \
      else :;
      fi'
 
+test_expect_success 'verify-pack --jobs catches one bad pack among good ones' '
+	test_must_fail git verify-pack -v -j 2 test-1-${packname_1}.idx \
+		test-3.idx test-2-${packname_2}.idx >out &&
+	grep "^test-1-${packname_1}.pack: ok$" out &&
+	grep "^test-3.pack: bad$" out &&
+	grep "^test-2-${packname_2}.pack: ok$" out
+'
+
 test_expect_success \
     'verify-pack catches a corrupted pack signature' \
     'cat test-1-${packname_1}.pack >test-3.pack &&
@@ -333,6 +350,42 @@ test_expect_success 'unpacking with --strict' '
 	)
 '
 
+test_expect_success 'unpacking with --strict and a small unpack.spillLimit' '
+	test_create_repo test-7 &&
+	(
+		cd test-7 &&
+		test_must_fail git -c unpack.spillLimit=1 \
+			unpack-objects --strict <../test-6-$PACK6.pack &&
+		git -c unpack.spillLimit=1 \
+			unpack-objects --strict <../test-5-$PACK5.pack &&
+		git ls-tree -r $LIST &&
+		git ls-tree -r $LI &&
+		git ls-tree -r $ST &&
+		test_must_fail ls .git/objects/pack/tmp_unpack_*
+	)
+'
+
+test_expect_success 'unpacking spilled deltas whose base comes later' '
+	A=e68fe8129b546b101aee9510c5328e7f21ca1d18 &&
+	B=01d7713666f4de822776c7622c10f1b07de280dc &&
+	{
+		pack_header 2 &&
+		pack_obj $A $B &&
+		pack_obj $B
+	} >later-base.pack &&
+	pack_trailer later-base.pack &&
+	test_create_repo test-8 &&
+	(
+		cd test-8 &&
+		git -c unpack.spillLimit=1 unpack-objects <../later-base.pack &&
+		git cat-file blob $A >actual &&
+		printf "\7\76" >expect &&
+		test_cmp expect actual &&
+		git cat-file -e $B &&
+		test_must_fail ls .git/objects/pack/tmp_unpack_*
+	)
+'
+
 test_expect_success 'index-pack with --strict' '
 
 	for j in a b c d e f g
@@ -400,6 +453,97 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'packs written through the pipeline are the same' '
+	git -c pack.pipelineWrites=false pack-objects --threads=1 --stdout \
+		<obj-list >unpiped.pack &&
+	git -c pack.pipelineWrites=true pack-objects --threads=1 --stdout \
+		<obj-list >piped.pack &&
+	test_cmp unpiped.pack piped.pack &&
+	git -c pack.pipelineWrites=true pack-objects test-12 <obj-list &&
+	git verify-pack test-12-*.pack
+'
+
+test_expect_success 'deep delta chains read back with any delta base cache size' '
+	git init deep &&
+	(
+		cd deep &&
+		test-genrandom base 8192 >file &&
+		for i in $(test_seq 1 40)
+		do
+			echo $i >>file &&
+			git add file &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -a -d -q --depth=50 --window=50 &&
+		git rev-list --objects --all >objects.raw &&
+		cut -d" " -f1 objects.raw >objects &&
+		git cat-file --batch <objects >expect &&
+		git -c core.deltaBaseCacheLimit=1 cat-file --batch <objects >actual &&
+		test_cmp expect actual &&
+		git -c core.deltaBaseCacheLimit=1g cat-file --batch <objects >actual &&
+		test_cmp expect actual &&
+		git -c core.deltaBaseCacheLimit=1 log -p >log.small &&
+		git log -p >log.default &&
+		test_cmp log.default log.small
+	)
+'
+
+test_expect_success 'sizes and packs that overflow their fields pack the same' '
+	(
+		cd deep &&
+		git pack-objects --threads=1 --revs --all --stdout \
+			</dev/null >normal.pack &&
+		GIT_TEST_OE_SIZE=64 GIT_TEST_OE_DELTA_SIZE=16 \
+		GIT_TEST_FULL_IN_PACK_ARRAY=1 \
+			git pack-objects --threads=1 --revs --all --stdout \
+			</dev/null >small.pack &&
+		test_cmp normal.pack small.pack &&
+		git -c pack.threads=1 repack -a -d -f -q &&
+		GIT_TEST_OE_SIZE=64 GIT_TEST_OE_DELTA_SIZE=16 \
+			git -c pack.threads=4 repack -a -d -f -q &&
+		git fsck
+	)
+'
+
+test_expect_success PTHREADS 'lock statistics of threaded pack-objects and index-pack' '
+	(
+		cd deep &&
+		GIT_TRACE_LOCKS="$TRASH_DIRECTORY/deep/trace.locks" \
+			git pack-objects --threads=2 --no-reuse-delta \
+			--revs --all --stdout </dev/null >locks.pack &&
+		grep "lock pack-objects read: acquired [1-9][0-9]* times" trace.locks &&
+		grep "lock pack-objects progress: " trace.locks &&
+		grep "thread find-deltas/0: ran .* busy " trace.locks &&
+		rm trace.locks &&
+		GIT_TRACE_LOCKS="$TRASH_DIRECTORY/deep/trace.locks" \
+			git index-pack --threads=2 -o locks.idx locks.pack &&
+		grep "lock index-pack work: acquired" trace.locks &&
+		grep "thread resolve-deltas/[0-9]*: ran " trace.locks
+	)
+'
+
+test_expect_success 'deep delta chains read the same when composed' '
+	git init chain &&
+	(
+		cd chain &&
+		test_seq 1000 >file &&
+		for i in $(test_seq 30)
+		do
+			sed -e "s/^$((i * 31))\$/changed $i/" \
+			    -e "$((i * 17))d" file >file.new &&
+			mv file.new file &&
+			git add file &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -adf --window=50 --depth=50 &&
+		git rev-list --objects --all | cut -d" " -f1 | sort >objs &&
+		git -c core.deltaComposeDepth=0 cat-file --batch <objs >expect &&
+		git -c core.deltaComposeDepth=2 -c core.deltaBaseCacheLimit=0 \
+			cat-file --batch <objs >actual &&
+		test_cmp expect actual
+	)
+'
+
 #
 # WARNING!
 #
@@ -57,4 +57,20 @@ test_expect_success \
      git config --unset core.packedGitLimit &&
      git verify-pack -v "$pack2"'
 
+test_expect_success \
+    'cat-file --batch, packedGit{WindowSize,Limit} == 2 pages' \
+    'git rev-list --objects --all | sed -e "s/ .*//" >objects &&
+     git cat-file --batch <objects >expect &&
+     git config core.packedGitWindowSize 1k &&
+     git config core.packedGitLimit 2k &&
+     for i in 1 2 3
+     do
+         cat objects || return 1
+     done >objects3 &&
+     git cat-file --batch <objects3 >actual &&
+     cat expect expect expect >expect3 &&
+     test_cmp expect3 actual &&
+     git config --unset core.packedGitWindowSize &&
+     git config --unset core.packedGitLimit'
+
 test_done
@@ -65,6 +65,15 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'threaded index-pack gives the same result' '
+	git index-pack --threads=4 --strict --index-version=2 \
+		-o 2-threaded.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-threaded.idx &&
+	git index-pack --threads=4 --stdin --index-version=2 \
+		stdin-threaded.pack <"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" stdin-threaded.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -261,4 +261,28 @@ test_expect_success 'prune: handle alternate object database' '
 	git -C B prune
 '
 
+test_expect_success 'prune with a bitmap index keeps what is reachable' '
+	test_create_repo bitmap &&
+	(
+		cd bitmap &&
+		for i in 1 2 3 4 5
+		do
+			test_commit packed-$i || return 1
+		done &&
+		git repack -a -d -b -q &&
+		test_commit loose-1 &&
+		git branch side packed-3 &&
+		git checkout -q side &&
+		test_commit loose-2 &&
+		echo staged >staged &&
+		git add staged &&
+		STAGED=$(git rev-parse :staged) &&
+		GONE=$(echo gone | git hash-object -w --stdin) &&
+		git prune --expire=now &&
+		git cat-file -e $STAGED &&
+		test_must_fail git cat-file -e $GONE &&
+		git fsck --no-dangling
+	)
+'
+
 test_done
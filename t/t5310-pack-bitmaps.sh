@@ -32,6 +32,15 @@ test_expect_success 'rev-list --test-bitmap verifies bitmaps' '
 	git rev-list --test-bitmap HEAD
 '
 
+test_expect_success 'bitmaps built with several threads verify' '
+	git -c pack.threads=4 repack -adf &&
+	for c in $(git rev-list HEAD)
+	do
+		git rev-list --test-bitmap $c 2>err &&
+		! grep Mismatch err || return 1
+	done
+'
+
 rev_list_tests() {
 	state=$1
 
@@ -119,6 +128,103 @@ test_expect_success 'fetch (full bitmap)' '
 	test_cmp expect actual
 '
 
+test_expect_success 'setup a commit to negotiate for' '
+	git clone --no-local --bare . negotiate.git &&
+	# old commits the server does not have make the client send
+	# "have" lines after the common ones, for which upload-pack
+	# checks whether it can give up
+	tree=$(git --git-dir=negotiate.git mktree </dev/null) &&
+	local=$(echo local-1 | git --git-dir=negotiate.git commit-tree $tree) &&
+	for i in $(test_seq 2 20)
+	do
+		local=$(echo local-$i |
+			GIT_COMMITTER_DATE="$((1000000000 + $i)) +0000" \
+			git --git-dir=negotiate.git commit-tree $tree -p $local) ||
+		return 1
+	done &&
+	git --git-dir=negotiate.git update-ref refs/heads/local $local &&
+	blob=$(echo negotiate | git hash-object -w --stdin) &&
+	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
+	commit=$(echo negotiate | git commit-tree $tree -p master) &&
+	git update-ref refs/heads/negotiate $commit
+'
+
+for negotiation in true false
+do
+	test_expect_success "fetch negotiation (bitmapNegotiation=$negotiation)" '
+		test_when_finished "rm -fr negotiate-copy.git" &&
+		cp -R negotiate.git negotiate-copy.git &&
+		GIT_TRACE_PACKET="$(pwd)/trace" \
+		git --git-dir=negotiate-copy.git \
+			-c uploadpack.bitmapnegotiation=$negotiation \
+			fetch --no-tags origin negotiate:negotiate &&
+		grep "upload-pack> ACK [0-9a-f]* ready" trace &&
+		rm -f trace &&
+		git rev-parse negotiate >expect &&
+		git --git-dir=negotiate-copy.git rev-parse negotiate >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'bitmaps carry the name-hash cache by default' '
+	git -c pack.writebitmaphashcache=false repack -ad &&
+	without=$(cat .git/objects/pack/pack-*.bitmap | wc -c) &&
+	git config --unset pack.writebitmaphashcache &&
+	test_when_finished "git config pack.writebitmaphashcache true" &&
+	git repack -ad &&
+	with=$(cat .git/objects/pack/pack-*.bitmap | wc -c) &&
+	objects=$(cat .git/objects/pack/pack-*.idx | git show-index | wc -l) &&
+	test $with -eq $(($without + 4 * $objects))
+'
+
+test_expect_success 'bitmaps with a lookup table give the same answers' '
+	git rev-list --use-bitmap-index --objects master other >expect.raw &&
+	git -c pack.writebitmaplookuptable=true repack -ad &&
+	git rev-list --test-bitmap HEAD &&
+	git rev-list --test-bitmap other &&
+	git rev-list --use-bitmap-index --objects master other >actual.raw &&
+	sort expect.raw >expect &&
+	sort actual.raw >actual &&
+	test_cmp expect actual &&
+	git rev-list --use-bitmap-index --count other...master >actual &&
+	git rev-list --count other...master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'full repack reuses bitmaps from a lookup table' '
+	test_commit more-3 &&
+	git -c pack.writebitmaplookuptable=true repack -ad &&
+	git rev-list --test-bitmap HEAD &&
+	git repack -ad &&
+	git rev-list --test-bitmap HEAD
+'
+
+test_expect_success 'setup a bitmapped pack full of deltas' '
+	git init deltas &&
+	(
+		cd deltas &&
+		for i in $(test_seq 1 20)
+		do
+			test_seq 1 $((100 + $i)) >file &&
+			git add file &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -adq --write-bitmap-index
+	)
+'
+
+test_expect_success 'partial pack reuse skips objects and fixes delta offsets' '
+	printf "%s\n" HEAD~2 ^HEAD~12 >revs &&
+	git -C deltas pack-objects --stdout --revs --delta-base-offset \
+		--progress <revs >partial.pack 2>err &&
+	grep "pack-reused [1-9]" err &&
+	git -C deltas index-pack --strict -o ../partial.idx ../partial.pack &&
+	git -C deltas rev-list --objects HEAD~2 ^HEAD~12 >objects &&
+	cut -d" " -f1 objects | sort >expect &&
+	git show-index <partial.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'create objects for missing-HAVE tests' '
 	blob=$(echo "missing have" | git hash-object -w --stdin) &&
 	tree=$(printf "100644 blob $blob\tfile\n" | git mktree) &&
@@ -164,7 +270,7 @@ test_expect_success JGIT 'jgit can read our bitmaps' '
 	git clone . compat-us &&
 	(
 		cd compat-us &&
-		git repack -adb &&
+		git -c pack.writebitmaphashcache=false repack -adb &&
 		# jgit gc will barf if it does not like our bitmaps
 		jgit gc
 	)
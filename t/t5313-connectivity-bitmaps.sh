@@ -0,0 +1,62 @@
+#!/bin/sh
+
+test_description='connectivity check using bitmaps'
+
+. ./test-lib.sh
+
+test_expect_success 'setup repositories with bitmaps' '
+	test_commit one &&
+	test_commit two &&
+	git clone --bare . dst.git &&
+	git -C dst.git repack -adb &&
+	git clone . fetcher &&
+	git -C fetcher repack -adb
+'
+
+test_expect_success 'push is checked without rev-list' '
+	test_commit three &&
+	GIT_TRACE="$(pwd)/trace" git push dst.git master &&
+	! grep "rev-list" trace &&
+	git rev-parse master >expect &&
+	git -C dst.git rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C dst.git fsck
+'
+
+test_expect_success 'fetch is checked without rev-list' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C fetcher fetch origin &&
+	! grep "rev-list" trace &&
+	git rev-parse master >expect &&
+	git -C fetcher rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'setup commits with and without their tree' '
+	tree=$(git -C fetcher rev-parse HEAD^{tree}) &&
+	good=$(echo good | git -C fetcher commit-tree $tree -p HEAD) &&
+	missing=$(printf "tree %s\nauthor A U Thor <a@example.com> 0 +0000\ncommitter A U Thor <a@example.com> 0 +0000\n\nbroken\n" \
+		$(echo missing | git hash-object --stdin) |
+		git -C fetcher hash-object -t commit -w --stdin) &&
+	git init src &&
+	echo "$(pwd)/fetcher/.git/objects" >src/.git/objects/info/alternates &&
+	echo $good >src/.git/refs/heads/good &&
+	echo $missing >src/.git/refs/heads/missing
+'
+
+test_expect_success 'quickfetch of a complete commit succeeds' '
+	git -C fetcher fetch ../src good:refs/heads/good &&
+	echo $good >expect &&
+	git -C fetcher rev-parse good >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commit with a missing tree is not connected' '
+	rm -f trace &&
+	test_must_fail env GIT_TRACE="$(pwd)/trace" \
+		git -C fetcher fetch ../src missing:refs/heads/missing &&
+	! grep "rev-list" trace &&
+	test_must_fail git -C fetcher rev-parse --verify refs/heads/missing
+'
+
+test_done
@@ -0,0 +1,123 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+test_expect_success 'setup history with merges' '
+	test_commit one &&
+	test_commit two &&
+	git checkout -b side one &&
+	test_commit side1 &&
+	test_commit side2 &&
+	git checkout -b other one &&
+	test_commit other1 &&
+	git checkout master &&
+	git merge -m merge side &&
+	test_tick &&
+	git merge -m octopus other side2 &&
+	test_commit three &&
+	git tag -a -m annotated annotated two
+'
+
+test_expect_success 'write and verify commit-graph' '
+	git commit-graph write &&
+	test_path_is_file $graph &&
+	git commit-graph verify
+'
+
+graph_git () {
+	git -c core.commitGraph=true "$@"
+}
+
+test_expect_success 'history is the same with and without the graph' '
+	for cmd in "log --graph --oneline --all" \
+		   "rev-list --topo-order --parents --all" \
+		   "log --format=%H:%T:%P:%ct --all" \
+		   "rev-list --objects --all" \
+		   "log --stat --all" \
+		   "merge-base --all side other" \
+		   "merge-base --octopus side other three"
+	do
+		git $cmd >expect &&
+		graph_git $cmd >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'reachability queries use the graph' '
+	graph_git merge-base --is-ancestor one three &&
+	graph_git merge-base --is-ancestor side1 three &&
+	test_must_fail graph_git merge-base --is-ancestor three side1 &&
+	test_must_fail graph_git merge-base --is-ancestor side2 other1 &&
+	git tag -l --contains side1 >expect &&
+	graph_git tag -l --contains side1 >actual &&
+	test_cmp expect actual &&
+	git branch --contains other1 >expect &&
+	graph_git branch --contains other1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commits newer than the graph are still found' '
+	test_commit four &&
+	git checkout -b newer side1 &&
+	test_commit newer1 &&
+	git checkout master &&
+	graph_git merge-base --is-ancestor three four &&
+	test_must_fail graph_git merge-base --is-ancestor four three &&
+	test_must_fail graph_git merge-base --is-ancestor newer1 four &&
+	graph_git merge-base --is-ancestor side1 newer1 &&
+	git tag -l --contains side1 >expect &&
+	graph_git tag -l --contains side1 >actual &&
+	test_cmp expect actual &&
+	git log --format=%H:%P --all >expect &&
+	graph_git log --format=%H:%P --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'ahead/behind counts are the same with the graph' '
+	for range in "side...other" "master...newer" "newer...four" \
+		     "four...one" "one...four" "master ^side" \
+		     "newer four ^other ^side2"
+	do
+		git rev-list --count --left-right $range >expect &&
+		graph_git rev-list --count --left-right $range >actual &&
+		test_cmp expect actual &&
+		git rev-list --count $range >expect &&
+		graph_git rev-list --count $range >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	test_config branch.newer.remote . &&
+	test_config branch.newer.merge refs/heads/master &&
+	git branch -vv >expect &&
+	graph_git branch -vv >actual &&
+	test_cmp expect actual &&
+	grep "newer.*\[master: ahead 1, behind 7\]" actual
+'
+
+test_expect_success 'grafts disable the graph' '
+	git rev-parse three >.git/info/grafts &&
+	test_when_finished "rm -f .git/info/grafts" &&
+	git log --format=%H:%P >expect &&
+	graph_git log --format=%H:%P >actual &&
+	test_cmp expect actual &&
+	test_must_fail git commit-graph write
+'
+
+test_expect_success 'corrupt graph is caught by verify' '
+	git commit-graph write &&
+	cp $graph graph.save &&
+	test_when_finished "mv graph.save $graph" &&
+	chmod u+w $graph &&
+	printf "X" | dd of=$graph bs=1 seek=1500 conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify
+'
+
+test_expect_success 'clear removes the graph' '
+	git commit-graph clear &&
+	test_path_is_missing $graph &&
+	git -c core.commitGraph=true log --oneline >/dev/null
+'
+
+test_done
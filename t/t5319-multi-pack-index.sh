@@ -0,0 +1,86 @@
+#!/bin/sh
+
+test_description='multi-pack index'
+. ./test-lib.sh
+
+midx=.git/objects/pack/multi-pack-index
+
+test_expect_success 'setup many packs' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i &&
+		git repack -d -q || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 5 packs &&
+	git rev-list --objects --all >objects.raw &&
+	cut -d" " -f1 objects.raw | sort >objects
+'
+
+test_expect_success 'write multi-pack index' '
+	git multi-pack-index write &&
+	test_path_is_file $midx &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'count-objects does not report the index as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'objects are found through the multi-pack index' '
+	git -c core.multiPackIndex=true cat-file --batch-check="%(objectname)" \
+		<objects >actual &&
+	test_cmp objects actual &&
+	git -c core.multiPackIndex=true fsck &&
+	git -c core.multiPackIndex=true log --oneline >/dev/null
+'
+
+test_expect_success 'abbreviated names resolve through the index' '
+	head=$(git rev-parse HEAD) &&
+	short=$(git -c core.multiPackIndex=true rev-parse --short HEAD) &&
+	test "$(git -c core.multiPackIndex=true rev-parse $short)" = "$head"
+'
+
+test_expect_success 'packs added later are still searched' '
+	test_commit 6 &&
+	git repack -d -q &&
+	git -c core.multiPackIndex=true cat-file -e 6^{tree} &&
+	git -c core.multiPackIndex=true rev-parse --verify 6 >/dev/null
+'
+
+test_expect_success 'index naming a removed pack is ignored' '
+	cp $midx midx.save &&
+	git repack -a -d -q --no-write-midx &&
+	test_path_is_missing $midx &&
+	cp midx.save $midx &&
+	git -c core.multiPackIndex=true cat-file --batch-check="%(objectname)" \
+		<objects >actual &&
+	test_cmp objects actual &&
+	test_must_fail git multi-pack-index verify
+'
+
+test_expect_success 'repack writes index with core.multiPackIndex' '
+	rm -f $midx &&
+	test_commit 7 &&
+	git -c core.multiPackIndex=true repack -d -q &&
+	test_path_is_file $midx &&
+	git multi-pack-index verify &&
+	git -c core.multiPackIndex=true repack -a -d -q &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'corrupt index is rejected by verify' '
+	cp $midx midx.save &&
+	test_when_finished "mv midx.save $midx" &&
+	chmod u+w $midx &&
+	printf "X" | dd of=$midx bs=1 seek=60 conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify
+'
+
+test_expect_success 'clear removes the index' '
+	git multi-pack-index clear &&
+	test_path_is_missing $midx
+'
+
+test_done
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description='git pack-redundant'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+# make a pack of the objects of the given revision range
+make_pack () {
+	git rev-list --objects "$@" >objs &&
+	git pack-objects -q $packdir/pack <objs
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4
+	do
+		test_commit c$i || return 1
+	done &&
+	A=$(make_pack c1) &&
+	B=$(make_pack c2) &&
+	C=$(make_pack c2..c3) &&
+	D=$(make_pack c1..c4) &&
+	E=$(make_pack c3..c4)
+'
+
+pack_pair () {
+	for p in "$@"
+	do
+		echo $packdir/pack-$p.idx &&
+		echo $packdir/pack-$p.pack || return 1
+	done
+}
+
+test_expect_success 'packs covered by the others are redundant' '
+	git pack-redundant --all </dev/null >actual &&
+	# A and D have everything, and are smaller than B and D
+	pack_pair $B $C $E | sort >expect &&
+	sort actual >actual.sorted &&
+	test_cmp expect actual.sorted
+'
+
+test_expect_success 'only the packs given are considered' '
+	git pack-redundant pack-$A.pack pack-$B.pack </dev/null >actual &&
+	pack_pair $A >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects given on stdin are not needed' '
+	git rev-list --objects c1 | cut -d" " -f1 |
+		git pack-redundant --all >actual &&
+	pack_pair $A $B $C $E | sort >expect &&
+	sort actual >actual.sorted &&
+	test_cmp expect actual.sorted
+'
+
+test_expect_success 'removing the redundant packs keeps all objects' '
+	git pack-redundant --all </dev/null | xargs rm &&
+	git fsck
+'
+
+test_done
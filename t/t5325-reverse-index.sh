@@ -0,0 +1,89 @@
+#!/bin/sh
+
+test_description='on-disk reverse index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in $(test_seq 1 20)
+	do
+		echo "content $i" >file &&
+		test_seq 1 $i >>file &&
+		git add file &&
+		git commit -q -m "$i" || return 1
+	done &&
+	git repack -a -d -q &&
+	git rev-list --objects --all >objects.raw &&
+	cut -d" " -f1 objects.raw >objects
+'
+
+test_expect_success 'no .rev file by default' '
+	! ls $packdir/*.rev
+'
+
+test_expect_success 'pack.writeReverseIndex makes repack write one' '
+	git -c pack.writeReverseIndex=true repack -a -d -q -f &&
+	ls $packdir/*.rev >revs &&
+	test_line_count = 1 revs &&
+	ls $packdir/*.pack >packs &&
+	test "$(basename $(cat revs) .rev)" = "$(basename $(cat packs) .pack)"
+'
+
+test_expect_success 'disk sizes agree with the in-memory reverse index' '
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >with-rev &&
+	mv $(cat revs) saved.rev &&
+	git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >without-rev &&
+	mv saved.rev $(cat revs) &&
+	test_cmp without-rev with-rev
+'
+
+test_expect_success 'repacking with a .rev present reuses it correctly' '
+	git repack -a -d -q &&
+	git fsck &&
+	! ls $packdir/*.rev
+'
+
+test_expect_success 'index-pack writes a .rev file' '
+	pack=$(ls $packdir/*.pack) &&
+	rm -rf clone.git &&
+	git init --bare clone.git &&
+	git -C clone.git -c pack.writeReverseIndex=true index-pack --stdin \
+		<$pack &&
+	ls clone.git/objects/pack/*.rev >revs &&
+	test_line_count = 1 revs &&
+	git verify-pack clone.git/objects/pack/*.idx
+'
+
+test_expect_success 'index-pack writes .rev next to an explicit pack' '
+	cp $pack explicit.pack &&
+	git -c pack.writeReverseIndex=true index-pack explicit.pack &&
+	test_path_is_file explicit.rev &&
+	git verify-pack explicit.idx
+'
+
+test_expect_success 'fsck notices a corrupt .rev file' '
+	rev=$(cat revs) &&
+	cp $rev saved.rev &&
+	chmod u+w $rev &&
+	printf "\377\377\377\377" |
+		dd of=$rev bs=1 seek=12 conv=notrunc 2>/dev/null &&
+	test_must_fail git -C clone.git fsck 2>err &&
+	grep "bad entry" err &&
+	cp saved.rev $rev &&
+	git -C clone.git fsck
+'
+
+test_expect_success 'a .rev file of the wrong size is ignored' '
+	rev=$(cat revs) &&
+	echo garbage >>$rev &&
+	git -C clone.git cat-file --batch-check="%(objectname) %(objectsize:disk)" \
+		<objects >actual 2>err &&
+	test_cmp with-rev actual &&
+	grep "wrong size" err
+'
+
+test_done
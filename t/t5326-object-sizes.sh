@@ -0,0 +1,92 @@
+#!/bin/sh
+
+test_description='object size tables'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	test_commit base &&
+	for i in $(test_seq 1 20)
+	do
+		echo "content $i" >file &&
+		test_seq 1 $((100 + $i)) >>file &&
+		git add file &&
+		git commit -q -m "$i" || return 1
+	done &&
+	git repack -a -d -q &&
+	git rev-list --objects --all >objects.raw &&
+	cut -d" " -f1 objects.raw >objects &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >expect
+'
+
+test_expect_success 'no .sizes file by default' '
+	! ls $packdir/*.sizes
+'
+
+test_expect_success 'pack.writeObjectSizes makes repack write one' '
+	git -c pack.writeObjectSizes=true repack -a -d -q -f &&
+	ls $packdir/*.sizes >sizes &&
+	test_line_count = 1 sizes &&
+	ls $packdir/*.pack >packs &&
+	test "$(basename $(cat sizes) .sizes)" = "$(basename $(cat packs) .pack)"
+'
+
+test_expect_success 'types and sizes agree with the pack' '
+	git verify-pack -v $packdir/*.idx >verify &&
+	grep "^chain length" verify &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'repacking reuses deltas and writes a correct table' '
+	git -c pack.writeObjectSizes=true repack -a -d -q &&
+	ls $packdir/*.sizes >sizes &&
+	test_line_count = 1 sizes &&
+	git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'index-pack writes a .sizes file' '
+	pack=$(ls $packdir/*.pack) &&
+	rm -rf clone.git &&
+	git init --bare clone.git &&
+	git -C clone.git -c pack.writeObjectSizes=true index-pack --stdin \
+		<$pack &&
+	ls clone.git/objects/pack/*.sizes >sizes &&
+	test_line_count = 1 sizes &&
+	git -C clone.git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >actual &&
+	test_cmp expect actual &&
+	git -C clone.git fsck
+'
+
+test_expect_success 'fsck notices a wrong .sizes file' '
+	sizes=$(cat sizes) &&
+	cp $sizes saved.sizes &&
+	chmod u+w $sizes &&
+	nr=$(wc -l <objects) &&
+	table=$(( 12 + (nr + 3) / 4 * 4 )) &&
+	printf "\0\0\0\1" |
+		dd of=$sizes bs=1 seek=$table conv=notrunc 2>/dev/null &&
+	test_must_fail git -C clone.git fsck 2>err &&
+	grep "object size table .* is wrong" err &&
+	cp saved.sizes $sizes &&
+	git -C clone.git fsck
+'
+
+test_expect_success 'a .sizes file of the wrong size is ignored' '
+	sizes=$(cat sizes) &&
+	printf xyz >>$sizes &&
+	git -C clone.git cat-file --batch-check="%(objectname) %(objecttype) %(objectsize) %(objectsize:disk)" \
+		<objects >actual 2>err &&
+	test_cmp expect actual &&
+	grep "wrong size" err
+'
+
+test_done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='recording and reusing delta search results'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		echo "content $i" >file &&
+		test_seq 1 $((100 + $i)) >>file &&
+		test_seq $i >other &&
+		git add file other &&
+		git commit -q -m "$i" || return 1
+	done
+'
+
+test_expect_success 'no .bases file by default' '
+	git repack -a -d -q -f &&
+	! ls $packdir/*.bases
+'
+
+test_expect_success 'pack.recordDeltaSearch makes repack write one' '
+	git -c pack.recordDeltaSearch=true repack -a -d -q -f &&
+	ls $packdir/*.bases >bases &&
+	test_line_count = 1 bases &&
+	ls $packdir/*.pack >packs &&
+	test "$(basename $(cat bases) .bases)" = "$(basename $(cat packs) .pack)" &&
+	git verify-pack -v $packdir/*.idx >verify &&
+	grep "^chain length" verify &&
+	awk "/^[0-9a-f]{40} / { print \$1, \$2, \$3, \$6, \$7 }" verify | sort >expect
+'
+
+test_expect_success 'repack -f takes the recorded decisions' '
+	git rev-list --objects --all |
+	git -c pack.recordDeltaSearch=true pack-objects --no-reuse-delta \
+		--progress $packdir/pack 2>err >name &&
+	grep "Reusing [1-9][0-9]* delta search results" err &&
+	git verify-pack -v $packdir/pack-$(cat name).idx >verify &&
+	awk "/^[0-9a-f]{40} / { print \$1, \$2, \$3, \$6, \$7 }" verify | sort >actual &&
+	test_cmp expect actual &&
+	test -f $packdir/pack-$(cat name).bases &&
+	git fsck
+'
+
+test_expect_success 'a larger window searches again' '
+	git rev-list --objects --all |
+	git -c pack.recordDeltaSearch=true pack-objects --no-reuse-delta \
+		--window=20 --progress $packdir/pack 2>err >name &&
+	! grep "delta search results" err &&
+	git fsck
+'
+
+test_expect_success 'new objects are searched for' '
+	echo "content 21" >file &&
+	test_seq 1 121 >>file &&
+	git commit -q -a -m 21 &&
+	git -c pack.recordDeltaSearch=true repack -a -d -q -f &&
+	git verify-pack -v $packdir/*.idx >verify &&
+	grep "^chain length" verify &&
+	git fsck
+'
+
+test_done
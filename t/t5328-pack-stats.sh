@@ -0,0 +1,70 @@
+#!/bin/sh
+
+test_description='count-objects --pack-stats'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 20)
+	do
+		echo "content $i" >file &&
+		test_seq 1 $((100 + $i)) >>file &&
+		git add file &&
+		git commit -q -m "$i" || return 1
+	done &&
+	git tag -m tag v1 &&
+	git repack -a -d -q &&
+	git rev-list --objects --all | cut -d" " -f1 |
+		git cat-file --batch-check="%(objecttype) %(objectsize) %(objectsize:disk)" >info
+'
+
+test_expect_success 'counts and sizes by type agree with cat-file' '
+	git count-objects --pack-stats >stats &&
+	for type in commit tree blob tag
+	do
+		awk -v t=$type "
+			\$1 == t { n++; size += \$2; disk += \$3 }
+			END { printf \"%s %d %d %d\\n\", t, n, disk, size }
+		" info || return 1
+	done >expect &&
+	grep "^type total" stats | cut -d" " -f3,4,6,7 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'depths agree with verify-pack' '
+	git verify-pack -v $packdir/*.idx >verify &&
+	sed -n -e "s/^non delta: \([0-9]*\) objects*/0 \1/p" \
+	       -e "s/^chain length = \([0-9]*\): \([0-9]*\) objects*/\1 \2/p" \
+		verify >expect &&
+	grep "^depth total" stats | cut -d" " -f3,4 >actual &&
+	test_cmp expect actual &&
+	grep "^type total" stats | awk "{ n += \$5 } END { print n }" >deltas &&
+	awk "\$1 != 0 { n += \$2 } END { print n }" expect >expect.deltas &&
+	test_cmp expect.deltas deltas
+'
+
+test_expect_success 'the .sizes table gives the same numbers' '
+	git -c pack.writeObjectSizes=true repack -a -d -q &&
+	git count-objects --pack-stats >sizes.stats &&
+	grep "^type total" sizes.stats >actual &&
+	grep "^type total" stats >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects in several packs are duplicates' '
+	echo "duplicates 0 0" >expect &&
+	grep ^duplicates stats >actual &&
+	test_cmp expect actual &&
+	git rev-list --objects HEAD~1..HEAD >objs &&
+	git pack-objects -q $packdir/pack <objs &&
+	git count-objects --pack-stats >stats &&
+	grep -c "^pack " stats >packs &&
+	echo 2 >expect &&
+	test_cmp expect packs &&
+	set -- $(grep ^duplicates stats) &&
+	test $2 = $(wc -l <objs) &&
+	test $3 -gt 0
+'
+
+test_done
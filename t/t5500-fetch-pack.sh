@@ -630,6 +630,32 @@ do
 	done
 done
 
+test_expect_success 'fetch with core.looseObjectCache' '
+	git init loose-server &&
+	(
+		cd loose-server &&
+		test_commit one &&
+		test_commit two
+	) &&
+	git clone loose-server loose-client &&
+	(
+		cd loose-server &&
+		test_commit three
+	) &&
+	(
+		cd loose-client &&
+		echo three >three.t &&
+		git hash-object -w three.t >blob &&
+		test_path_is_file .git/objects/$(sed "s|^..|&/|" blob) &&
+		git -c core.looseObjectCache=true -c fetch.unpackLimit=1 \
+			-c transfer.fsckObjects=true fetch origin &&
+		git rev-parse origin/master >actual &&
+		git -C ../loose-server rev-parse master >expect &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
 test_expect_success MINGW 'fetch-pack --diag-url file://c:/repo' '
 	check_prot_path file://c:/repo file c:/repo
 '
@@ -708,4 +708,102 @@ test_expect_success 'fetching a one-level ref works' '
 	)
 '
 
+test_expect_success 'fetching many refs updates them all at once' '
+	for i in $(test_seq 120)
+	do
+		echo "create refs/heads/many$i HEAD"
+	done >input &&
+	git update-ref --stdin <input &&
+	git init many &&
+	(
+		cd many &&
+		git fetch .. "refs/heads/*:refs/remotes/origin/*" &&
+		test_path_is_missing .git/refs/remotes/origin/many1 &&
+		git for-each-ref refs/remotes/origin/many* >refs &&
+		test_line_count = 120 refs &&
+		git -C .. rev-parse HEAD >expect &&
+		git rev-parse origin/many120 >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'overlapping exact and pattern refspecs all apply' '
+	git init overlap &&
+	(
+		cd overlap &&
+		git fetch .. "refs/heads/*:refs/remotes/heads/*" \
+			many7:refs/remotes/seven \
+			"refs/*:refs/remotes/all/*" &&
+		git rev-parse --verify refs/remotes/seven &&
+		git rev-parse --verify refs/remotes/heads/many7 &&
+		git rev-parse --verify refs/remotes/all/heads/many7 &&
+		git rev-parse --verify refs/remotes/all/foo &&
+		test_must_fail git rev-parse --verify refs/remotes/heads/foo &&
+		git for-each-ref "refs/remotes/heads/many*" >refs &&
+		test_line_count = 120 refs
+	)
+'
+
+test_expect_success 'prune with overlapping refspecs' '
+	(
+		cd overlap &&
+		git config remote.origin.url .. &&
+		git config remote.origin.fetch "refs/heads/*:refs/remotes/heads/*" &&
+		git config --add remote.origin.fetch "refs/*:refs/remotes/all/*" &&
+		git update-ref refs/remotes/heads/gone refs/remotes/seven &&
+		git update-ref refs/remotes/all/heads/gone refs/remotes/seven &&
+		git update-ref refs/remotes/all/gone refs/remotes/seven &&
+		git fetch --prune origin &&
+		test_must_fail git rev-parse --verify refs/remotes/heads/gone &&
+		test_must_fail git rev-parse --verify refs/remotes/all/heads/gone &&
+		test_must_fail git rev-parse --verify refs/remotes/all/gone &&
+		git rev-parse --verify refs/remotes/heads/many11 &&
+		git rev-parse --verify refs/remotes/all/heads/many11
+	)
+'
+
+test_expect_success 'fetch tells fast-forwards from rewinds among many refs' '
+	git init ff-upstream &&
+	(
+		cd ff-upstream &&
+		test_commit base &&
+		test_commit middle &&
+		for i in $(test_seq 20)
+		do
+			echo "create refs/heads/ff$i HEAD" &&
+			echo "create refs/heads/rw$i HEAD" || return 1
+		done >input &&
+		git update-ref --stdin <input
+	) &&
+	git init ff-downstream &&
+	git -C ff-downstream fetch ../ff-upstream "refs/heads/*:refs/remotes/up/*" &&
+	(
+		cd ff-upstream &&
+		test_commit top &&
+		for i in $(test_seq 20)
+		do
+			echo "update refs/heads/ff$i HEAD" &&
+			echo "update refs/heads/rw$i base" || return 1
+		done >input &&
+		git update-ref --stdin <input
+	) &&
+	(
+		cd ff-downstream &&
+		test_must_fail git fetch ../ff-upstream "refs/heads/*:refs/remotes/up/*" 2>err &&
+		test_i18ngrep "rw7 .*non-fast-forward" err &&
+		! test_i18ngrep "ff7 .*non-fast-forward" err &&
+		git rev-parse up/ff7 >actual &&
+		git -C ../ff-upstream rev-parse top >expect &&
+		test_cmp expect actual &&
+		git rev-parse up/rw7 >actual &&
+		git -C ../ff-upstream rev-parse middle >expect &&
+		test_cmp expect actual &&
+		git fetch ../ff-upstream "+refs/heads/*:refs/remotes/up/*" 2>err &&
+		test_i18ngrep "rw7 .*forced update" err &&
+		git rev-parse up/rw7 >actual &&
+		git -C ../ff-upstream rev-parse base >expect &&
+		test_cmp expect actual
+	)
+'
+
 test_done
@@ -1612,4 +1612,33 @@ test_expect_success 'updateInstead with push-to-checkout hook' '
 	)
 '
 
+pushed_objects () {
+	sed -n -e "s/^Total \([0-9]*\) .*/\1/p" "$1"
+}
+
+test_expect_success 'push with negotiation' '
+	# the receiving end does not show the first commit, but has it
+	mk_empty testrepo &&
+	git push testrepo $the_first_commit:refs/remotes/origin/first_commit &&
+	git -C testrepo config receive.hideRefs refs/remotes/origin/first_commit &&
+	git push --progress testrepo master:refs/heads/without 2>err &&
+	git rev-list --objects master >expect &&
+	test $(pushed_objects err) = $(wc -l <expect) &&
+
+	mk_empty testrepo &&
+	git push testrepo $the_first_commit:refs/remotes/origin/first_commit &&
+	git -C testrepo config receive.hideRefs refs/remotes/origin/first_commit &&
+	git -c push.negotiate=true push --progress testrepo \
+		master:refs/heads/with 2>err &&
+	git rev-list --objects $the_first_commit..master >expect &&
+	test $(pushed_objects err) = $(wc -l <expect) &&
+	git -C testrepo fsck
+'
+
+test_expect_success 'fetch-pack --negotiate-only lists the common commits' '
+	git fetch-pack --negotiate-only --negotiation-tip=master \
+		testrepo >actual &&
+	grep $(git rev-parse master) actual
+'
+
 test_done
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+test_description='upload-pack serves repeated requests from its pack cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git config uploadpack.packCache pack-cache
+'
+
+test_expect_success 'first clone fills the cache' '
+	GIT_TRACE="$(pwd)/trace" git clone --no-local --bare . first.git &&
+	grep "pack-objects" trace &&
+	ls .git/pack-cache/*.pack >packs &&
+	test_line_count = 1 packs &&
+	git -C first.git fsck
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone --no-local --bare . second.git &&
+	! grep "pack-objects" trace &&
+	git -C second.git fsck &&
+	git rev-parse master >expect &&
+	git -C second.git rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'different request is not served from the cache' '
+	test_commit three &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git -C second.git fetch ../ \
+		master:refs/heads/master &&
+	grep "pack-objects" trace &&
+	ls .git/pack-cache/*.pack >packs &&
+	test_line_count = 2 packs &&
+	git rev-parse master >expect &&
+	git -C second.git rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'stale lock is ignored' '
+	test_commit four &&
+	git clone --no-local --bare . third.git &&
+	ls .git/pack-cache/*.pack >packs &&
+	test_line_count = 3 packs &&
+	for p in .git/pack-cache/*.pack
+	do
+		mv "$p" "$p.lock" || return 1
+	done &&
+	test-chmtime -120 .git/pack-cache/*.lock &&
+	git clone --no-local --bare . fourth.git &&
+	git -C fourth.git fsck
+'
+
+test_expect_success 'cache is kept within packCacheSize' '
+	rm -f .git/pack-cache/* &&
+	git config uploadpack.packCacheSize 1 &&
+	git clone --no-local --bare . fifth.git &&
+	ls .git/pack-cache >packs &&
+	test_line_count = 0 packs
+'
+
+test_done
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+test_description='sending pack data in bulk side-band frames'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-genrandom foo $((3 * 1024 * 1024)) >big &&
+	git add big &&
+	test_commit small &&
+	git repack -ad
+'
+
+test_expect_success 'clone asks for bulk frames' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git clone --no-local --progress \
+		. dst 2>err &&
+	grep "clone> want .* side-band-bulk" trace &&
+	grep "remote: Counting objects" err &&
+	git -C dst fsck &&
+	git -C dst cat-file blob HEAD:big >actual &&
+	test_cmp big actual
+'
+
+test_expect_success 'clone from the pack cache uses bulk frames' '
+	git config uploadpack.packCache "$(pwd)/pack-cache" &&
+	git clone --no-local . cache-fill &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git clone --no-local . cached &&
+	grep "clone< \\\\4" trace &&
+	git -C cached fsck &&
+	git -C cached cat-file blob HEAD:big >actual &&
+	test_cmp big actual
+'
+
+test_done
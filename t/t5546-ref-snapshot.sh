@@ -0,0 +1,129 @@
+#!/bin/sh
+
+test_description='advertising refs from a ref snapshot'
+
+. ./test-lib.sh
+
+# make the refs look old enough for a snapshot of them to be usable
+age_refs () {
+	find .git/HEAD .git/packed-refs .git/refs -print |
+	xargs test-chmtime -10
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated one &&
+	git branch side one &&
+	git update-ref refs/namespaces/ns/HEAD HEAD &&
+	git update-ref refs/namespaces/ns/refs/heads/master one &&
+	git pack-refs --all &&
+	git branch loose two &&
+	git config transfer.refSnapshot true
+'
+
+test_expect_success 'the advertisement does not change' '
+	git -c transfer.refSnapshot=false upload-pack --advertise-refs . >expect &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/ref-snapshot &&
+	grep "refs/tags/annotated$" .git/ref-snapshot &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	git -c transfer.refSnapshot=false receive-pack --advertise-refs . >expect &&
+	git receive-pack --advertise-refs . >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the advertisement comes from the snapshot' '
+	age_refs &&
+	git ls-remote . >expect &&
+	echo "$(git rev-parse one) refs/zzz" >>.git/ref-snapshot &&
+	echo "$(git rev-parse one)	refs/zzz" >>expect &&
+	git ls-remote . >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a ref update makes the snapshot stale' '
+	git update-ref refs/heads/new HEAD &&
+	git ls-remote . >actual &&
+	! grep refs/zzz actual &&
+	grep refs/heads/new actual
+'
+
+test_expect_success 'a loose ref written in place makes the snapshot stale' '
+	age_refs &&
+	git ls-remote . >/dev/null &&
+	git rev-parse one >.git/refs/heads/loose &&
+	git -c transfer.refSnapshot=false ls-remote . >expect &&
+	git ls-remote . >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'packing refs makes the snapshot stale' '
+	age_refs &&
+	git ls-remote . >/dev/null &&
+	git update-ref -d refs/heads/new &&
+	git pack-refs --all &&
+	git -c transfer.refSnapshot=false ls-remote . >expect &&
+	git ls-remote . >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'namespaced advertisement' '
+	GIT_NAMESPACE=ns git -c transfer.refSnapshot=false \
+		upload-pack --advertise-refs . >expect &&
+	GIT_NAMESPACE=ns git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	grep "refs/heads/master$" actual
+'
+
+test_expect_success 'fetch and push with a snapshot' '
+	git clone --no-local . dst &&
+	git -C dst rev-parse origin/side >actual &&
+	git rev-parse side >expect &&
+	test_cmp expect actual &&
+	(
+		cd dst &&
+		git config transfer.refSnapshot true &&
+		test_commit three &&
+		git push origin HEAD:refs/heads/pushed
+	) &&
+	git -C dst rev-parse HEAD >expect &&
+	git rev-parse pushed >actual &&
+	test_cmp expect actual &&
+	git ls-remote . refs/heads/pushed >actual &&
+	grep pushed actual
+'
+
+
+test -z "$NO_UNIX_SOCKETS" && test_set_prereq UNIX_SOCKETS
+
+stop_ref_cache_daemon () {
+	"$PERL_PATH" -MIO::Socket::UNIX -e '
+		my $s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or exit 0;
+		print $s "exit\n";
+	' "$(pwd)/.git/ref-cache/socket"
+}
+
+test_expect_success UNIX_SOCKETS 'advertise refs from the ref-cache daemon' '
+	test_when_finished stop_ref_cache_daemon &&
+	git config transfer.refSnapshotDaemon true &&
+	test_when_finished "git config --unset transfer.refSnapshotDaemon" &&
+	rm -f .git/ref-snapshot &&
+	git -c transfer.refSnapshot=false upload-pack --advertise-refs . >expect &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	test -S .git/ref-cache/socket &&
+	test_path_is_missing .git/ref-snapshot &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	git update-ref refs/heads/from-daemon HEAD &&
+	git -c transfer.refSnapshot=false upload-pack --advertise-refs . >expect &&
+	git upload-pack --advertise-refs . >actual &&
+	test_cmp expect actual &&
+	git ls-remote . refs/heads/from-daemon >actual &&
+	grep from-daemon actual
+'
+
+test_done
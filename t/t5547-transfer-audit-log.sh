@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description='upload-pack and receive-pack write an audit log line per request'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git init --bare remote.git &&
+	git -C remote.git config receive.unpackLimit 100
+'
+
+test_expect_success 'nothing is logged by default' '
+	git clone --no-local --bare . nolog.git &&
+	test_path_is_missing .git/audit.log
+'
+
+test_expect_success 'clone logs an upload-pack line' '
+	git config transfer.auditLog "$(pwd)/audit.log" &&
+	git clone --no-local --bare . clone.git &&
+	test_line_count = 1 audit.log &&
+	grep "^audit service=upload-pack .* status=ok " audit.log &&
+	grep " refs=4 wants=[1-9][0-9]* haves=0 rounds=0 " audit.log &&
+	grep " objects=6 " audit.log &&
+	grep " bitmap=0 " audit.log &&
+	grep " ms_advertise=[0-9]* ms_negotiation=[0-9]* ms_pack=[0-9]* ms_total=[0-9]*$" audit.log
+'
+
+test_expect_success 'fetch logs its haves and negotiation rounds' '
+	rm -f audit.log &&
+	test_commit three &&
+	git -C clone.git fetch ../ master:refs/heads/master &&
+	grep " wants=1 haves=[1-9][0-9]* rounds=[1-9][0-9]* " audit.log &&
+	grep " objects=3 " audit.log
+'
+
+test_expect_success 'bytes sent match the size of the pack' '
+	rm -f audit.log &&
+	git clone --no-local --bare . bytes.git &&
+	git pack-objects --revs --stdout >expect.pack <<-\EOF &&
+	master
+	EOF
+	sed -n "s/.* bytes=\([0-9]*\) .*/\1/p" audit.log >actual &&
+	wc -c <expect.pack | tr -d " " >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'push logs a receive-pack line' '
+	git -C remote.git config transfer.auditLog "$(pwd)/audit.log" &&
+	rm -f audit.log &&
+	git push remote.git master &&
+	test_line_count = 1 audit.log &&
+	grep "^audit service=receive-pack .* status=ok " audit.log &&
+	grep " refs=0 commands=1 updated=1 rejected=0 " audit.log &&
+	grep " objects=9 unpacker=unpack-objects unpack=ok " audit.log &&
+	grep " ms_unpack=[0-9]* ms_update=[0-9]* ms_hooks=[0-9]* " audit.log
+'
+
+test_expect_success 'rejected push is counted' '
+	rm -f audit.log &&
+	git -C remote.git config receive.denyNonFastForwards true &&
+	test_must_fail git push --force remote.git one^{}:refs/heads/master &&
+	grep " refs=1 commands=1 updated=0 rejected=1 " audit.log
+'
+
+test_expect_success 'audit line can go to stderr' '
+	git -C remote.git config transfer.auditLog stderr &&
+	test_commit four &&
+	git push remote.git master 2>err &&
+	grep "^audit service=receive-pack " err
+'
+
+test_done
@@ -177,6 +177,24 @@ test_expect_success 'fetch can handle previously-fetched .idx files' '
 	git --git-dir=clone_packed_branches.git fetch "$HTTPD_URL"/dumb/repo_packed_branches.git branch2:branch2
 '
 
+test_expect_success 'fetch several packs at once' '
+	git --bare init "$HTTPD_DOCUMENT_ROOT_PATH"/repo_many_packs.git &&
+	for i in 1 2 3 4
+	do
+		test_commit many-$i &&
+		git push "$HTTPD_DOCUMENT_ROOT_PATH"/repo_many_packs.git \
+			HEAD:refs/heads/master &&
+		git --git-dir="$HTTPD_DOCUMENT_ROOT_PATH"/repo_many_packs.git \
+			repack -d || return 1
+	done &&
+	git --bare init clone_many_packs.git &&
+	git --git-dir=clone_many_packs.git -c http.maxRequests=4 \
+		fetch "$HTTPD_URL"/dumb/repo_many_packs.git master:master &&
+	git --git-dir=clone_many_packs.git fsck &&
+	ls clone_many_packs.git/objects/pack/pack-*.pack >packs &&
+	test_line_count = 4 packs
+'
+
 test_expect_success 'did not use upload-pack service' '
 	test_might_fail grep '/git-upload-pack' <"$HTTPD_ROOT_PATH"/access.log >act &&
 	: >exp &&
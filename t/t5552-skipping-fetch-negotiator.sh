@@ -0,0 +1,63 @@
+#!/bin/sh
+
+test_description='test skipping fetch negotiator'
+. ./test-lib.sh
+
+have_count () {
+	grep "fetch> have " trace | wc -l
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	(cd server && test_commit base) &&
+	git clone server client &&
+	(
+		cd client &&
+		for i in $(test_seq 1 100)
+		do
+			test_commit local$i || return 1
+		done
+	) &&
+	(cd server && test_commit remote)
+'
+
+test_expect_success 'default negotiator sends a have for each local commit' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client fetch origin &&
+	test $(have_count) -gt 100 &&
+	git -C server rev-parse master >expect &&
+	git -C client rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'skipping negotiator sends far fewer haves' '
+	git -C client update-ref refs/remotes/origin/master base &&
+	git -C client tag -d remote &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		-c fetch.negotiationAlgorithm=skipping fetch origin &&
+	test $(have_count) -lt 30 &&
+	git -C server rev-parse master >expect &&
+	git -C client rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	git -C client fsck
+'
+
+test_expect_success 'skipping negotiator stops at a commit the server knows' '
+	(cd server && test_commit remote2) &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		-c fetch.negotiationAlgorithm=skipping fetch origin &&
+	grep "fetch< ACK $(git -C client rev-parse remote)" trace &&
+	git -C server rev-parse master >expect &&
+	git -C client rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown negotiation algorithm is an error' '
+	(cd server && test_commit remote3) &&
+	test_must_fail git -C client \
+		-c fetch.negotiationAlgorithm=bogus fetch origin
+'
+
+test_done
@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='clone starting from bundles'
+. ./test-lib.sh
+
+# curl wants the spaces of our trash directory escaped
+file_uri () {
+	echo "file://$(pwd)/$1" | sed -e "s/ /%20/g"
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	(
+		cd server &&
+		test_commit one &&
+		test_commit two &&
+		git bundle create ../base.bundle master &&
+		test_commit three &&
+		git bundle create ../incr.bundle master^..master &&
+		test_commit four
+	)
+'
+
+test_expect_success 'clone starts from a local bundle' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git clone --bundle-uri="$(pwd)/base.bundle" \
+		"file://$(pwd)/server" local-bundle &&
+	grep "clone> have $(git -C server rev-parse two)" trace &&
+	git -C server rev-parse master >expect &&
+	git -C local-bundle rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C local-bundle fsck &&
+	git -C local-bundle for-each-ref refs/bundles/ >refs &&
+	test_must_be_empty refs
+'
+
+test_expect_success 'clone downloads and applies several bundles' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git clone --bundle-uri="$(file_uri base.bundle)" \
+		--bundle-uri="$(file_uri incr.bundle)" \
+		"file://$(pwd)/server" two-bundles &&
+	grep "clone> have $(git -C server rev-parse three)" trace &&
+	git -C server rev-parse master >expect &&
+	git -C two-bundles rev-parse master >actual &&
+	test_cmp expect actual &&
+	git -C two-bundles fsck &&
+	! ls two-bundles/.git/bundle-* 2>/dev/null
+'
+
+test_expect_success 'unusable bundles are skipped' '
+	echo garbage >bad.bundle &&
+	git clone --bundle-uri="$(pwd)/bad.bundle" \
+		--bundle-uri="$(pwd)/incr.bundle" \
+		--bundle-uri="$(file_uri missing.bundle)" \
+		"file://$(pwd)/server" bad-bundles 2>err &&
+	grep "could not use bundle .*bad.bundle" err &&
+	grep "could not use bundle .*incr.bundle" err &&
+	grep "could not download bundle .*missing.bundle" err &&
+	git -C server rev-parse master >expect &&
+	git -C bad-bundles rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'advertised bundles are used only when asked for' '
+	git -C server config uploadpack.bundleURI "$(file_uri base.bundle)" &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		clone "file://$(pwd)/server" not-asked &&
+	grep "< bundle-uri=file://" trace &&
+	! grep "clone> have" trace &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		-c transfer.bundleURI=true \
+		clone "file://$(pwd)/server" asked &&
+	grep "clone> have $(git -C server rev-parse two)" trace &&
+	git -C server rev-parse master >expect &&
+	git -C asked rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_done
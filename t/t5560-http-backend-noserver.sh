@@ -75,4 +75,43 @@ test_expect_success 'http-backend blocks bad PATH_INFO' '
 	expect_aliased 1 //domain/data.txt
 '
 
+strip_headers() {
+	perl -0pe 's/.*?\r\n\r\n//s' "$@"
+}
+
+test_expect_success 'static file honors a byte range' '
+	HTTP_RANGE=bytes=0-3 && export HTTP_RANGE &&
+	GET $PACK_URL "206 Partial Content" &&
+	sane_unset HTTP_RANGE &&
+	grep "^Content-Range: bytes 0-3/" act.out &&
+	grep "^Content-Length: 4" act.out &&
+	printf PACK >expect &&
+	strip_headers act.out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'static file honors a suffix byte range' '
+	HTTP_RANGE=bytes=-20 && export HTTP_RANGE &&
+	GET $PACK_URL "206 Partial Content" &&
+	sane_unset HTTP_RANGE &&
+	tail -c 20 "$HTTPD_DOCUMENT_ROOT_PATH/repo.git/$PACK_URL" >expect &&
+	strip_headers act.out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unsatisfiable byte range is rejected' '
+	HTTP_RANGE=bytes=999999999- && export HTTP_RANGE &&
+	GET $PACK_URL "416 Requested Range Not Satisfiable" &&
+	sane_unset HTTP_RANGE
+'
+
+test_expect_success 'stale If-Range sends the whole file' '
+	HTTP_RANGE=bytes=0-3 && export HTTP_RANGE &&
+	HTTP_IF_RANGE="Thu, 01 Jan 1970 00:00:00 +0000" && export HTTP_IF_RANGE &&
+	GET $PACK_URL "200 OK" &&
+	sane_unset HTTP_RANGE HTTP_IF_RANGE &&
+	strip_headers act.out >actual &&
+	test_cmp "$HTTPD_DOCUMENT_ROOT_PATH/repo.git/$PACK_URL" actual
+'
+
 test_done
@@ -168,5 +168,33 @@ test_expect_success 'hostname cannot break out of directory' '
 		git clone --bare "$GIT_DAEMON_URL/escape.git" tmp.git
 '
 
+stop_git_daemon
+start_git_daemon --workers=2 --max-client-connections=1
+
+test_expect_success 'workers serve one connection after another' '
+	: >"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/git-daemon-export-ok" &&
+	rm -rf clone-w1 clone-w2 clone-w3 &&
+	git clone "$GIT_DAEMON_URL/repo.git" clone-w1 &&
+	git clone "$GIT_DAEMON_URL/repo.git" clone-w2 &&
+	git clone "$GIT_DAEMON_URL/repo.git" clone-w3 &&
+	test_cmp file clone-w3/file
+'
+
+test_expect_success 'workers forget the repository they served' '
+	test_remote_error "access denied or repository not exported" \
+		clone nowhere.git
+'
+
+test_expect_success 'connections over the per-client limit wait their turn' '
+	rm -rf clone-q1 clone-q2 &&
+	(
+		git clone "$GIT_DAEMON_URL/repo.git" clone-q1 >/dev/null 2>&1 &
+		git clone "$GIT_DAEMON_URL/repo.git" clone-q2 &&
+		wait $!
+	) &&
+	test_cmp file clone-q1/file &&
+	test_cmp file clone-q2/file
+'
+
 stop_git_daemon
 test_done
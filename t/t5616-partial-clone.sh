@@ -0,0 +1,120 @@
+#!/bin/sh
+
+test_description='partial clone and fetch with object filters'
+
+. ./test-lib.sh
+
+test_expect_success 'setup server' '
+	git init server &&
+	(
+		cd server &&
+		mkdir -p dir/sub &&
+		for i in 1 2 3
+		do
+			echo "file $i" >file.$i &&
+			echo "sub $i" >dir/sub/file.$i &&
+			git add . &&
+			git commit -m "commit $i" || return 1
+		done &&
+		git config uploadpack.allowFilter true &&
+		git config uploadpack.allowAnySHA1InWant true
+	) &&
+	SERVER="file://$(pwd)/server"
+'
+
+test_expect_success 'clone with blob:none records the filter' '
+	git clone --no-checkout --filter=blob:none "$SERVER" pc1 &&
+	test "$(git -C pc1 config core.repositoryformatversion)" = 1 &&
+	test "$(git -C pc1 config extensions.partialclone)" = origin &&
+	test "$(git -C pc1 config remote.origin.partialclonefilter)" = blob:none
+'
+
+test_expect_success 'the clone has no blobs' '
+	git -C pc1 rev-list --objects --missing=print HEAD >objects &&
+	grep "^?" objects >missing &&
+	test_line_count = 6 missing
+'
+
+test_expect_success 'fsck and connectivity checks accept missing blobs' '
+	git -C pc1 fsck
+'
+
+test_expect_success 'reading a missing blob fetches it' '
+	echo "file 1" >expect &&
+	git -C pc1 cat-file blob HEAD~2:file.1 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'checking out fetches missing blobs in one go' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C pc1 reset --hard &&
+	grep -c "> done$" trace >count &&
+	echo 1 >expect &&
+	test_cmp expect count &&
+	echo "sub 3" >expect &&
+	test_cmp expect pc1/dir/sub/file.3
+'
+
+test_expect_success 'fetch uses the recorded filter' '
+	(
+		cd server &&
+		echo "file 4" >file.4 &&
+		git add file.4 &&
+		git commit -m "commit 4"
+	) &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C pc1 fetch origin &&
+	grep "fetch> filter blob:none" trace &&
+	git -C pc1 rev-list --objects --missing=print origin/master >objects &&
+	grep "^?$(git -C server rev-parse master:file.4)" objects
+'
+
+test_expect_success 'fetch --filter only for the partial clone remote' '
+	git -C pc1 remote add other "$SERVER" &&
+	test_must_fail git -C pc1 fetch --filter=blob:none other
+'
+
+test_expect_success 'repack and gc keep working' '
+	git -C pc1 gc &&
+	git -C pc1 fsck &&
+	git -C pc1 log -p origin/master >/dev/null
+'
+
+test_expect_success 'clone with tree:0 fetches trees on demand' '
+	git clone --filter=tree:0 "$SERVER" pc2 &&
+	git -C pc2 fsck &&
+	git -C pc2 log --stat >/dev/null &&
+	git -C server ls-tree -r HEAD >expect &&
+	git -C pc2 ls-tree -r HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone with blob:limit' '
+	(
+		cd server &&
+		printf "%02000d\n" 0 >large &&
+		git add large &&
+		git commit -m large
+	) &&
+	git clone --no-checkout --filter=blob:limit=1k "$SERVER" pc3 &&
+	git -C pc3 rev-list --objects --missing=print HEAD >objects &&
+	grep "^?" objects >missing &&
+	echo "?$(git -C server rev-parse HEAD:large)" >expect &&
+	test_cmp expect missing
+'
+
+test_expect_success 'server without allowFilter sends everything' '
+	git -C server config uploadpack.allowFilter false &&
+	git clone --filter=blob:none "$SERVER" pc4 2>err &&
+	grep "filtering not recognized by server" err &&
+	git -C pc4 rev-list --objects --missing=print HEAD >objects &&
+	! grep "^?" objects
+'
+
+test_expect_success '--filter is ignored for local clones' '
+	git clone --filter=blob:none server pc5 2>err &&
+	grep "filter is ignored" err &&
+	test_must_fail git -C pc5 config extensions.partialclone
+'
+
+test_done
@@ -0,0 +1,110 @@
+#!/bin/sh
+
+test_description='offloading packs to packfile URIs'
+
+. ./test-lib.sh
+
+if test -n "$NO_CURL"
+then
+	skip_all='skipping test, git built without http support'
+	test_done
+fi
+
+# The packs are "downloaded" from file:// URIs, which http-fetch
+# handles through curl just like http:// or https:// ones.
+CDN="file://$(pwd | sed "s/ /%20/g")/cdn"
+
+test_expect_success 'setup server with an offloaded pack' '
+	git init server &&
+	(
+		cd server &&
+		test_commit one &&
+		test_commit two &&
+		git repack -a -d &&
+		git show-index <.git/objects/pack/pack-*.idx |
+		cut -d" " -f2 | sort >../offloaded-objects &&
+		mkdir ../cdn &&
+		cp .git/objects/pack/pack-*.pack ../cdn/base.pack &&
+		pack=$(ls .git/objects/pack/pack-*.pack) &&
+		pack=${pack##*/pack-} &&
+		echo ${pack%.pack} >../offloaded-pack &&
+		test_commit three &&
+		git config uploadpack.packfileURI \
+			"$(cat ../offloaded-pack) $CDN/base.pack"
+	)
+'
+
+test_expect_success 'clone downloads the offloaded pack' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c fetch.uriProtocols=file clone "file://$(pwd)/server" client &&
+	grep "packfile-uris file" trace &&
+	test -f client/.git/objects/pack/pack-$(cat offloaded-pack).pack &&
+	git -C client fsck &&
+	git -C server rev-parse three >expect &&
+	git -C client rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone with protocol v2 downloads the offloaded pack' '
+	git -c protocol.version=2 -c fetch.uriProtocols=file \
+		clone "file://$(pwd)/server" client-v2 &&
+	test -f client-v2/.git/objects/pack/pack-$(cat offloaded-pack).pack &&
+	git -C client-v2 fsck
+'
+
+test_expect_success 'offloaded objects are not sent inline' '
+	for p in client/.git/objects/pack/pack-*.idx
+	do
+		case "$p" in
+		*$(cat offloaded-pack)*) continue ;;
+		esac &&
+		git show-index <$p | cut -d" " -f2 || return 1
+	done | sort >inline &&
+	test_line_count = 3 inline &&
+	comm -12 inline offloaded-objects >common &&
+	test_must_be_empty common
+'
+
+test_expect_success 'clients that do not ask get one inline pack' '
+	git clone "file://$(pwd)/server" no-uris &&
+	ls no-uris/.git/objects/pack/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'uris over other protocols are not used' '
+	git -c fetch.uriProtocols=https clone "file://$(pwd)/server" https-only &&
+	ls https-only/.git/objects/pack/*.pack >packs &&
+	test_line_count = 1 packs
+'
+
+test_expect_success 'fetch does not download packs it does not need' '
+	git -C server commit --allow-empty -m four &&
+	git -C client -c fetch.uriProtocols=file fetch &&
+	ls client/.git/objects/pack/*.pack >packs &&
+	test_line_count = 2 packs
+'
+
+test_expect_success 'fetch with fsckObjects checks the downloaded pack' '
+	git -c fetch.uriProtocols=file -c transfer.fsckObjects=true \
+		clone "file://$(pwd)/server" fsck-client &&
+	git -C fsck-client fsck
+'
+
+test_expect_success 'a pack that does not match its hash is rejected' '
+	test_when_finished "git -C server config --unset-all uploadpack.packfileURI" &&
+	git init other &&
+	(
+		cd other &&
+		test_commit other &&
+		git repack -a -d
+	) &&
+	cp other/.git/objects/pack/pack-*.pack cdn/other.pack &&
+	git -C server config uploadpack.packfileURI \
+		"$(cat offloaded-pack) $CDN/other.pack" &&
+	test_must_fail git -c fetch.uriProtocols=file \
+		clone "file://$(pwd)/server" bad-client 2>err &&
+	grep "is not pack $(cat offloaded-pack)" err
+'
+
+test_done
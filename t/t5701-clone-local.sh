@@ -138,4 +138,32 @@ test_expect_success 'cloning locally respects "-u" for fetching refs' '
 	test_must_fail git clone --bare -u false a should_not_work.git
 '
 
+test_expect_success 'local clone leaves out loose objects that are packed' '
+	git init --bare loose.git &&
+	git push loose.git HEAD:refs/heads/master &&
+	(
+		cd loose.git &&
+		git repack -a &&
+		git count-objects -v >counts &&
+		! grep "^count: 0" counts
+	) &&
+	git clone --bare loose.git loose-clone.git &&
+	(
+		cd loose-clone.git &&
+		git count-objects -v >counts &&
+		grep "^count: 0" counts &&
+		git fsck
+	) &&
+	repo_is_hardlinked loose-clone.git
+'
+
+test_expect_success 'local copy of many files with --no-hardlinks' '
+	git clone --bare --no-hardlinks loose.git loose-copy.git &&
+	! repo_is_hardlinked loose-copy.git &&
+	(
+		cd loose-copy.git &&
+		git fsck
+	)
+'
+
 test_done
@@ -0,0 +1,181 @@
+#!/bin/sh
+
+test_description='fetching and listing refs with protocol v2'
+
+. ./test-lib.sh
+
+test_expect_success 'setup server repository' '
+	git init server &&
+	(
+		cd server &&
+		test_commit one &&
+		test_commit two &&
+		git tag -a -m "annotated" annotated &&
+		git branch side one &&
+		git symbolic-ref refs/remotes/origin/HEAD refs/heads/side &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "create refs/pull/$i/head HEAD" || return 1
+		done | git update-ref --stdin &&
+		git pack-refs --all &&
+		git update-ref refs/pull/11/head one
+	)
+'
+
+test_expect_success 'ls-remote lists the same refs with v0 and v2' '
+	git ls-remote server >expect &&
+	git -c protocol.version=2 ls-remote server >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'server speaks v2 when asked to' '
+	rm -f log &&
+	GIT_TRACE_PACKET="$(pwd)/log" git -c protocol.version=2 \
+		ls-remote server >/dev/null &&
+	grep "< version 2" log &&
+	grep "> command=ls-refs" log
+'
+
+test_expect_success 'ls-remote --heads only asks for and gets branches' '
+	git ls-remote --heads server >expect &&
+	rm -f log &&
+	GIT_TRACE_PACKET="$(pwd)/log" git -c protocol.version=2 \
+		ls-remote --heads server >actual &&
+	test_cmp expect actual &&
+	grep "> ref-prefix refs/heads/" log &&
+	! grep "refs/pull/" log &&
+	! grep "refs/tags/" log
+'
+
+test_expect_success 'ls-remote --tags shows peeled tags' '
+	git ls-remote --tags server >expect &&
+	git -c protocol.version=2 ls-remote --tags server >actual &&
+	test_cmp expect actual &&
+	grep "refs/tags/annotated^{}" actual
+'
+
+test_expect_success 'hidden refs are not listed' '
+	git -C server config uploadpack.hideRefs refs/pull &&
+	test_when_finished "git -C server config --unset uploadpack.hideRefs" &&
+	git -c protocol.version=2 ls-remote server >actual &&
+	! grep refs/pull/ actual
+'
+
+test_expect_success 'clone with v2 gets the same refs as v0' '
+	git clone server clone-v0 &&
+	git -c protocol.version=2 clone server clone-v2 &&
+	git -C clone-v0 for-each-ref >expect &&
+	git -C clone-v2 for-each-ref >actual &&
+	test_cmp expect actual &&
+	git -C clone-v2 fsck
+'
+
+test_expect_success 'clone with v2 follows the remote HEAD' '
+	git -C server checkout side &&
+	test_when_finished "git -C server checkout master" &&
+	git -c protocol.version=2 clone server clone-side &&
+	echo refs/heads/side >expect &&
+	git -C clone-side symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch with v2 only lists the refs it needs' '
+	(
+		cd server &&
+		test_commit three &&
+		git tag -a -m "new tag" new-tag
+	) &&
+	rm -f log &&
+	GIT_TRACE_PACKET="$(pwd)/log" git -C clone-v2 -c protocol.version=2 \
+		fetch origin master &&
+	git -C server rev-parse master >expect &&
+	git -C clone-v2 rev-parse FETCH_HEAD >actual &&
+	test_cmp expect actual &&
+	! grep "refs/pull/" log
+'
+
+test_expect_success 'fetch with v2 updates branches and follows tags' '
+	git -C clone-v2 -c protocol.version=2 fetch &&
+	git -C server rev-parse master new-tag >expect &&
+	git -C clone-v2 rev-parse origin/master new-tag >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch-pack with v2' '
+	git init fetch-pack &&
+	git -C fetch-pack -c protocol.version=2 fetch-pack ../server \
+		refs/heads/side >actual &&
+	echo "$(git -C server rev-parse side) refs/heads/side" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'shallow clone and deepen with v2' '
+	git -c protocol.version=2 clone --depth=1 "file://$(pwd)/server" shallow &&
+	test_line_count = 1 shallow/.git/shallow &&
+	git -C shallow log --oneline >actual &&
+	test_line_count = 1 actual &&
+	git -C shallow -c protocol.version=2 fetch --depth=2 &&
+	git -C shallow log --oneline >actual &&
+	test_line_count = 2 actual
+'
+
+test_expect_success 'v2 client falls back to v0 servers' '
+	rm -f log &&
+	GIT_TRACE_PACKET="$(pwd)/log" git -c protocol.version=2 ls-remote \
+		--upload-pack="unset GIT_PROTOCOL; git-upload-pack" \
+		server >actual &&
+	git ls-remote server >expect &&
+	test_cmp expect actual &&
+	! grep "version 2" log
+'
+
+test_expect_success 'unknown protocol.version is an error' '
+	test_must_fail git -c protocol.version=3 ls-remote server
+'
+
+test_expect_success 'setup fake ssh' '
+	write_script fake-ssh <<-\EOF &&
+	while test $# -gt 2
+	do
+		shift
+	done
+	echo "$GIT_PROTOCOL" >ssh-protocol &&
+	eval "$2"
+	EOF
+	GIT_SSH="$(pwd)/fake-ssh" &&
+	export GIT_SSH
+'
+
+test_expect_success 'ssh passes the version on to the server' '
+	git -c protocol.version=2 ls-remote --heads "myhost:server" >actual &&
+	echo version=2 >expect &&
+	test_cmp expect ssh-protocol &&
+	git ls-remote --heads server >expect &&
+	test_cmp expect actual
+'
+
+. "$TEST_DIRECTORY"/lib-git-daemon.sh
+start_git_daemon --export-all
+
+test_expect_success 'setup daemon repository' '
+	git clone --bare server "$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git"
+'
+
+test_expect_success 'ls-remote with v2 over git://' '
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >expect &&
+	rm -f log &&
+	GIT_TRACE_PACKET="$(pwd)/log" git -c protocol.version=2 \
+		ls-remote "$GIT_DAEMON_URL/repo.git" >actual &&
+	test_cmp expect actual &&
+	grep "< version 2" log
+'
+
+test_expect_success 'clone with v2 over git://' '
+	git -c protocol.version=2 clone "$GIT_DAEMON_URL/repo.git" daemon-clone &&
+	git -C daemon-clone rev-parse origin/master >actual &&
+	git -C server rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+stop_git_daemon
+test_done
@@ -71,4 +71,27 @@ test_expect_success 'prerequisites with an empty commit message' '
 	git bundle verify bundle
 '
 
+test_expect_success 'prerequisites do not depend on the bitmap index' '
+	git checkout -b side HEAD~3 &&
+	test_commit side1 &&
+	test_commit side2 &&
+	git checkout master &&
+	git merge -m merge side &&
+	test_commit after-merge &&
+	for args in "HEAD~2..HEAD" "master --not side~1" "side...master" \
+		"--all --not fifth" "side master~1 ^side1"
+	do
+		rm -f .git/objects/pack/*.bitmap &&
+		git repack -ad &&
+		git bundle create without.bdl $args 2>without.err &&
+		git repack -adb &&
+		git bundle create with.bdl $args 2>with.err &&
+		sed -e "/^\$/q" without.bdl | sort >expect &&
+		sed -e "/^\$/q" with.bdl | sort >actual &&
+		test_cmp expect actual &&
+		test_cmp without.err with.err &&
+		git bundle verify with.bdl || return 1
+	done
+'
+
 test_done
@@ -109,4 +109,20 @@ test_expect_success \
 
 cd "$base_dir"
 
+test_expect_success 'core.alternatesCache finds loose objects in alternates' '
+	(
+		cd C &&
+		echo "../../../B/.git/objects" >.git/objects/info/alternates &&
+		loose=$(cd ../B && echo loose-in-B | git hash-object -w --stdin) &&
+		git -c core.alternatesCache=true cat-file blob $loose >actual &&
+		echo loose-in-B >expect &&
+		test_cmp expect actual &&
+		test_must_fail git -c core.alternatesCache=true \
+			cat-file -e $_z40 &&
+		git -c core.alternatesCache=true fsck --full
+	)
+'
+
+cd "$base_dir"
+
 test_done
@@ -235,6 +235,19 @@ test_expect_success 'push update refs failure' '
 	)
 '
 
+test_expect_success 'pipelined option commands' '
+	(cd local &&
+	git checkout -b pipeline master &&
+	echo pipeline >>file &&
+	git commit -a -m pipeline &&
+	GIT_REMOTE_TESTGIT_PIPELINE=t GIT_TRANSPORT_HELPER_DEBUG=1 \
+		git push --force origin pipeline 2>debug &&
+	grep -A1 "^Debug: Remote helper: -> option progress" debug >options &&
+	grep "^option verbosity" options
+	) &&
+	compare_refs local pipeline server pipeline
+'
+
 clean_mark () {
 	cut -f 2 -d ' ' "$1" |
 	git cat-file --batch-check |
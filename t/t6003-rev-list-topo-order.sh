@@ -441,6 +441,44 @@ l0
 root
 EOF
 
+test_expect_success 'write a commit-graph' '
+	git commit-graph write
+'
+
+test_expect_success 'topological orders are the same when walking incrementally' '
+	for cmd in "rev-list --topo-order --all" \
+		   "rev-list --date-order --all" \
+		   "rev-list --author-date-order --all" \
+		   "rev-list --topo-order --first-parent --all" \
+		   "rev-list --topo-order --parents a4 l3" \
+		   "rev-list --topo-order --max-age=$(git log -1 --format=%ct b4) --all" \
+		   "rev-list --topo-order -n 5 --skip=2 --all" \
+		   "rev-list --topo-order --reverse c3 l5" \
+		   "log --graph --oneline --all" \
+		   "log --graph --oneline --boundary -3 c3"
+	do
+		git $cmd >expect &&
+		git -c core.commitGraph=true $cmd >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'commits newer than the commit-graph are walked, too' '
+	git checkout -b newer c3 &&
+	test_commit newer1 &&
+	git checkout -b newer2 b4 &&
+	test_commit newer2 &&
+	git merge -m merge newer &&
+	for cmd in "rev-list --topo-order --all" \
+		   "rev-list --date-order --parents HEAD l5" \
+		   "log --graph --oneline --all"
+	do
+		git $cmd >expect &&
+		git -c core.commitGraph=true $cmd >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 #
 #
 
@@ -207,4 +207,32 @@ test_expect_success '--count --left-right' '
 	test_cmp expect actual
 '
 
+cache=.git/objects/info/patch-id-cache
+
+test_expect_success '--cherry-mark with diff.patchIdCache' '
+	git rev-list --cherry-mark --left-right F...E >expect &&
+	test_path_is_missing $cache &&
+	git -c diff.patchIdCache rev-list --cherry-mark --left-right F...E >actual &&
+	test_cmp expect actual &&
+	test_path_is_file $cache
+'
+
+test_expect_success 'remembered patch ids give the same result' '
+	cp $cache cache.before &&
+	git -c diff.patchIdCache rev-list --cherry-mark --left-right F...E >actual &&
+	test_cmp expect actual &&
+	test_cmp cache.before $cache &&
+	git cherry E F >expect &&
+	git -c diff.patchIdCache cherry E F >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pathspec-limited patch ids are not remembered' '
+	cp $cache cache.before &&
+	git rev-list --cherry-mark --left-right F...E -- bar >expect &&
+	git -c diff.patchIdCache rev-list --cherry-mark --left-right F...E -- bar >actual &&
+	test_cmp expect actual &&
+	test_cmp cache.before $cache
+'
+
 test_done
@@ -162,6 +162,26 @@ test_expect_success '--independent with unsynchronized clocks' '
 	test_cmp expected actual
 '
 
+test_expect_success '--independent with many commits' '
+	tree=$(git mktree </dev/null) &&
+	parent= &&
+	>expect &&
+	>all &&
+	for i in $(test_seq 40)
+	do
+		l=$(echo "L$i" | git commit-tree $tree $parent) &&
+		s=$(echo "S$i" | git commit-tree $tree -p $l) &&
+		parent="-p $l" &&
+		echo $l >>all &&
+		echo $s >>all &&
+		echo $s >>expect || return 1
+	done &&
+	git merge-base --independent $(cat all) >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
 test_expect_success 'merge-base for octopus-step (setup)' '
 	# Another set to demonstrate base between one commit and a merge
 	# in the documentation.
@@ -297,4 +317,49 @@ test_expect_success 'merge-base --octopus --all for complex tree' '
 	test_cmp expected actual
 '
 
+cache=.git/objects/info/merge-base-cache
+
+test_expect_success 'merge bases are the same with core.mergeBaseCache' '
+	test_config core.mergeBaseCache true &&
+	rm -f $cache &&
+	for pair in "JAA JDD" "JDD JAA" "JE JDD" "J JE" "JE J"
+	do
+		git -c core.mergeBaseCache=false merge-base --all $pair >expect &&
+		git merge-base --all $pair >actual &&
+		test_cmp expect actual &&
+		git merge-base --all $pair >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	test_line_count = 4 $cache
+'
+
+test_expect_success 'merge bases are read from the cache' '
+	test_config core.mergeBaseCache true &&
+	pair=$(git rev-parse JB JC | sort | tr "\n" - | sed "s/-\$//") &&
+	echo "$pair $(git rev-parse JE)" >>$cache &&
+	git rev-parse JE >expect &&
+	git merge-base JC JB >actual &&
+	test_cmp expect actual &&
+	git rev-parse J >expect &&
+	git -c core.mergeBaseCache=false merge-base JC JB >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--is-ancestor answers are remembered' '
+	test_config core.mergeBaseCache true &&
+	git merge-base --is-ancestor J JB &&
+	test_must_fail git merge-base --is-ancestor JB J &&
+	grep "$(git rev-parse J)-.* $(git rev-parse J)\$" $cache &&
+	git merge-base --is-ancestor J JB
+'
+
+test_expect_success 'the cache is not used with grafts' '
+	test_config core.mergeBaseCache true &&
+	test_when_finished "rm -f .git/info/grafts" &&
+	git rev-parse JB >.git/info/grafts &&
+	test_must_fail git merge-base --all JC JB >actual &&
+	test_must_be_empty actual &&
+	test_must_fail git merge-base --is-ancestor J JB
+'
+
 test_done
@@ -346,4 +346,13 @@ test_expect_success 'conflict at EOF without LF resolved by --union' \
 	 printf "line1\nline2\nline3x\nline3y" >expect.txt &&
 	 test_cmp expect.txt output.txt'
 
+test_expect_success '--stdout writes the same as merging in place' '
+	cp new8.txt in-place.txt &&
+	test_must_fail git merge-file -p --diff3 -L in-place.txt \
+		new8.txt new5.txt new9.txt >stdout.txt &&
+	test_must_fail git merge-file --diff3 \
+		in-place.txt new5.txt new9.txt &&
+	test_cmp in-place.txt stdout.txt
+'
+
 test_done
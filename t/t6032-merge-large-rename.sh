@@ -70,6 +70,17 @@ test_expect_success 'set merge.renamelimit to 5' '
 test_rename 5 ok
 test_rename 6 fail
 
+test_expect_success 'set diff.largeRenames' '
+	git config diff.largerenames true
+'
+test_rename 6 ok
+test_rename 30 ok
+
+test_expect_success 'unset diff.largeRenames' '
+	git config --unset diff.largerenames
+'
+test_rename 6 fail
+
 test_expect_success 'setup large simple rename' '
 	git config --unset merge.renamelimit &&
 	git config --unset diff.renamelimit &&
@@ -440,4 +440,40 @@ test_expect_success GPG '--graft on a commit with a mergetag' '
 	git replace -d $HASH10
 '
 
+test_expect_success 'many replace refs, and chains of them' '
+	for i in $(test_seq 50)
+	do
+		echo "blob $i" | git hash-object -w --stdin >orig &&
+		echo "replaced $i" | git hash-object -w --stdin >repl &&
+		echo "create refs/replace/$(cat orig) $(cat repl)" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+	orig=$(echo "blob 17" | git hash-object --stdin) &&
+	echo "replaced 17" >expect &&
+	git cat-file blob $orig >actual &&
+	test_cmp expect actual &&
+	git --no-replace-objects cat-file blob $orig >actual &&
+	echo "blob 17" >expect &&
+	test_cmp expect actual &&
+	unrelated=$(echo "not replaced" | git hash-object -w --stdin) &&
+	git cat-file blob $unrelated >actual &&
+	echo "not replaced" >expect &&
+	test_cmp expect actual &&
+	for i in 1 2 3 4 5 6
+	do
+		echo "chain $i" | git hash-object -w --stdin >chain$i || return 1
+	done &&
+	for i in 1 2 3 4
+	do
+		git update-ref refs/replace/$(cat chain$i) \
+			$(cat chain$((i + 1))) || return 1
+	done &&
+	echo "chain 5" >expect &&
+	git cat-file blob $(cat chain1) >actual &&
+	test_cmp expect actual &&
+	git update-ref refs/replace/$(cat chain5) $(cat chain6) &&
+	test_must_fail git cat-file blob $(cat chain1) 2>err &&
+	grep "replace depth too high" err
+'
+
 test_done
@@ -0,0 +1,112 @@
+#!/bin/sh
+
+test_description='git rev-list --filter and --missing'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub &&
+	echo small >small &&
+	printf "%0500d\n" 0 >dir/large &&
+	echo deep >dir/sub/deep &&
+	git add . &&
+	git commit -m initial &&
+	git rev-list --objects HEAD >all
+'
+
+# object names only, sorted
+list_objects () {
+	git rev-list --objects "$@" | cut -d" " -f1 | sort
+}
+
+test_expect_success 'blob:none omits all blobs' '
+	list_objects --filter=blob:none HEAD >actual &&
+	git rev-list --objects HEAD |
+	while read sha1 path
+	do
+		test "$(git cat-file -t $sha1)" = blob || echo $sha1
+	done | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blob:limit omits only large blobs' '
+	list_objects --filter=blob:limit=100 HEAD >actual &&
+	list_objects HEAD | grep -v $(git rev-parse HEAD:dir/large) >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blob:limit takes a unit' '
+	list_objects --filter=blob:limit=1k HEAD >actual &&
+	list_objects HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tree:0 omits all trees and blobs' '
+	git rev-parse HEAD >expect &&
+	list_objects --filter=tree:0 HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tree:2 keeps the top two levels' '
+	git rev-parse HEAD HEAD^{tree} HEAD:small HEAD:dir |
+	sort >expect &&
+	list_objects --filter=tree:2 HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blobs named on the command line are not filtered' '
+	git rev-parse HEAD:small >expect &&
+	list_objects --filter=blob:none HEAD:small >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--no-filter cancels --filter' '
+	list_objects --filter=blob:none --no-filter HEAD >actual &&
+	list_objects HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'invalid filter-spec is an error' '
+	test_must_fail git rev-list --objects --filter=blob:some HEAD &&
+	test_must_fail git rev-list --objects --filter=tree:x HEAD
+'
+
+test_expect_success 'pack-objects --filter' '
+	git rev-parse HEAD >in &&
+	git pack-objects --revs --stdout --filter=blob:none <in >filtered.pack &&
+	git index-pack -o filtered.idx filtered.pack &&
+	git show-index <filtered.idx | cut -d" " -f2 | sort >actual &&
+	list_objects --filter=blob:none HEAD >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --filter needs --stdout' '
+	test_must_fail git pack-objects --revs --filter=blob:none pack <in
+'
+
+test_expect_success 'setup repository with missing blob' '
+	git init missing &&
+	git pack-objects --revs --stdout --filter=blob:limit=100 <in |
+	git -C missing index-pack --stdin &&
+	git -C missing update-ref refs/heads/master $(cat in) &&
+	test_must_fail git -C missing cat-file -e HEAD:dir/large
+'
+
+test_expect_success '--missing=error fails on a missing blob' '
+	test_must_fail git -C missing rev-list --objects HEAD
+'
+
+test_expect_success '--missing=allow-any skips a missing blob' '
+	git -C missing rev-list --objects --missing=allow-any HEAD >actual &&
+	! grep $(git rev-parse HEAD:dir/large) actual &&
+	test_line_count = $(($(wc -l <all) - 1)) actual
+'
+
+test_expect_success '--missing=print shows a missing blob' '
+	echo "?$(git rev-parse HEAD:dir/large)" >expect &&
+	git -C missing rev-list --objects --missing=print HEAD >actual &&
+	grep "^?" actual >missing-list &&
+	test_cmp expect missing-list
+'
+
+test_done
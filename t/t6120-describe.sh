@@ -198,4 +198,50 @@ test_expect_success 'describe --contains with the exact tags' '
 	test_cmp expect actual
 '
 
+test_expect_success 'generation numbers do not change the answers' '
+	git commit-graph write &&
+	for args in "HEAD" "HEAD~4" "HEAD~5" "HEAD~4^2" "--tags HEAD~4" \
+		    "--first-parent --tags HEAD~4" "--tags --match=e HEAD~4" \
+		    "--all HEAD~6" "--long --match=test1-* --tags" \
+		    "--always --match=none"
+	do
+		git describe $args >expect &&
+		git -c core.commitGraph=true describe $args >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	test_must_fail git -c core.commitGraph=true describe --match=none
+'
+
+test_expect_success 'name-rev with generation numbers' '
+	git rev-list --all >revs &&
+	git name-rev --tags $(cat revs) >expect &&
+	git -c core.commitGraph=true name-rev --tags $(cat revs) >actual &&
+	test_cmp expect actual &&
+	git describe --contains HEAD~5 HEAD~4^2 >expect &&
+	git -c core.commitGraph=true describe --contains HEAD~5 HEAD~4^2 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'describe.cache remembers answers' '
+	git describe --tags HEAD~4 >expect &&
+	git -c describe.cache=true describe --tags HEAD~4 >actual &&
+	test_cmp expect actual &&
+	test_path_is_file .git/describe-cache &&
+	git -c describe.cache=true describe --tags HEAD~4 >actual &&
+	test_cmp expect actual &&
+	commit=$(git rev-parse HEAD~4) &&
+	sed "s/^\($commit .*\) [0-9]*$/\1 42/" .git/describe-cache >cache.new &&
+	mv cache.new .git/describe-cache &&
+	git -c describe.cache=true describe --tags HEAD~4 >actual &&
+	grep -e "-42-g" actual
+'
+
+test_expect_success 'describe.cache is reset when the tags change' '
+	git tag newer-lightweight HEAD~5 &&
+	git describe --tags HEAD~4 >expect &&
+	git -c describe.cache=true describe --tags HEAD~4 >actual &&
+	test_cmp expect actual &&
+	git tag -d newer-lightweight
+'
+
 test_done
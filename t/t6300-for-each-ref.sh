@@ -537,4 +537,64 @@ test_expect_success 'Verify sort with multiple keys' '
 		refs/tags/bogo refs/tags/master > actual &&
 	test_cmp expected actual
 '
+
+test_expect_success 'setup for --contains' '
+	git checkout -b contains-side master &&
+	test_commit contains-one &&
+	git checkout master
+'
+
+test_expect_success '--contains shows only refs containing the commit' '
+	cat >expected <<-\EOF &&
+	refs/heads/contains-side
+	refs/tags/contains-one
+	EOF
+	git for-each-ref --format="%(refname)" --contains contains-one >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success '--no-contains leaves out refs containing the commit' '
+	cat >expected <<-\EOF &&
+	refs/heads/master
+	EOF
+	git for-each-ref --format="%(refname)" --no-contains contains-one \
+		refs/heads/master refs/heads/contains-side \
+		refs/tags/contains-one >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'refs outside the patterns are not read' '
+	mkdir -p .git/refs/pull/1 &&
+	echo broken >.git/refs/pull/1/head &&
+	test_when_finished "rm -rf .git/refs/pull" &&
+	git for-each-ref --format="%(refname)" refs/heads/ 2>err >actual &&
+	test_must_be_empty err &&
+	grep refs/heads/master actual &&
+	git for-each-ref "refs/tags/contains-*" 2>err &&
+	test_must_be_empty err &&
+	git branch -a 2>err &&
+	test_must_be_empty err &&
+	git rev-parse --branches 2>err &&
+	test_must_be_empty err &&
+	git for-each-ref 2>err &&
+	grep "ignoring broken ref refs/pull/1/head" err
+'
+
+test_expect_success 'header atoms of a commit with a long message' '
+	{
+		echo long subject &&
+		echo &&
+		test_seq 10000
+	} >long-message &&
+	git commit --allow-empty -q -F long-message &&
+	git update-ref refs/heads/long-message HEAD &&
+	git reset -q --hard HEAD^ &&
+	echo "$(git cat-file -s long-message) A U Thor 1" >expected &&
+	git for-each-ref --format="%(objectsize) %(authorname) %(numparent)" \
+		refs/heads/long-message >actual &&
+	test_cmp expected actual &&
+	echo "long subject" >expected &&
+	git for-each-ref --format="%(subject)" refs/heads/long-message >actual &&
+	test_cmp expected actual
+'
 test_done
@@ -30,4 +30,22 @@ test_expect_success 'gc -h with invalid configuration' '
 	test_i18ngrep "[Uu]sage" broken/usage
 '
 
+test_expect_success 'gc drops superseded cache entries' '
+	cache=.git/objects/info/rename-cache &&
+	test_write_lines "rename cache version 1" \
+		"k1 0:0:100" "k2 0:0:90" "k1 0:0:80" >$cache &&
+	git gc &&
+	test_write_lines "rename cache version 1" \
+		"k2 0:0:90" "k1 0:0:80" >expect &&
+	test_cmp expect $cache
+'
+
+test_expect_success 'gc trims caches to gc.cacheLimit' '
+	test_write_lines "describe cache" "k1 a" "k2 b" "k3 c" "k4 d" \
+		>.git/describe-cache &&
+	git -c gc.cacheLimit=15 gc &&
+	test_write_lines "describe cache" "k4 d" >expect &&
+	test_cmp expect .git/describe-cache
+'
+
 test_done
@@ -1330,6 +1330,48 @@ test_expect_success 'checking that initial commit is in all tags' "
 	test_cmp expected actual
 "
 
+cat > expected <<EOF
+v0.2.1
+v1.0
+v1.0.1
+v1.1.3
+v2.0
+EOF
+
+test_expect_success 'checking that only the old tags lack the branch head' "
+	git tag -l --no-contains $hash4 v* >actual &&
+	test_cmp expected actual
+"
+
+cat > expected <<EOF
+v2.0
+v3.0
+EOF
+
+test_expect_success '--contains and --no-contains together' "
+	git tag -l --contains $hash2 --no-contains $hash3 v* >actual &&
+	test_cmp expected actual
+"
+
+test_expect_success '--no-contains is only allowed when listing' '
+	test_must_fail git tag --no-contains HEAD newtag
+'
+
+test_expect_success '--contains and --no-contains with a commit-graph and bitmaps' '
+	git tag -l --contains $hash1 >expect.1 &&
+	git tag -l --contains $hash3 >expect.2 &&
+	git tag -l --contains $hash2 --no-contains $hash4 >expect.3 &&
+	git commit-graph write &&
+	git repack -adb &&
+	git -c core.commitGraph=true tag -l --contains $hash1 >actual &&
+	test_cmp expect.1 actual &&
+	git -c core.commitGraph=true tag -l --contains $hash3 >actual &&
+	test_cmp expect.2 actual &&
+	git -c core.commitGraph=true tag -l \
+		--contains $hash2 --no-contains $hash4 >actual &&
+	test_cmp expect.3 actual
+'
+
 # mixing modes and options:
 
 test_expect_success 'mixing incompatibles modes and options is forbidden' '
@@ -0,0 +1,66 @@
+#!/bin/sh
+
+test_description='looking for untracked files with several threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		for j in 1 2 3 4 5
+		do
+			mkdir -p dir$i/sub$j/deep &&
+			: >dir$i/sub$j/file &&
+			: >dir$i/sub$j/deep/file &&
+			: >dir$i/sub$j/deep/file.ign || return 1
+		done
+	done &&
+	echo "*.ign" >dir1/.gitignore &&
+	echo "deep/" >dir2/sub3/.gitignore &&
+	git add dir3 dir1/.gitignore dir2/sub3/.gitignore &&
+	git commit -q -m initial &&
+	: >dir3/sub1/untracked &&
+	mkdir empty &&
+	cat >.git/info/exclude <<-\EOF
+	expect*
+	actual*
+	EOF
+'
+
+for opts in "-uall" "-uall --ignored" "-unormal" "-unormal --ignored"
+do
+	test_expect_success "status $opts" '
+		git -c core.untrackedThreads=1 status --porcelain $opts >expect &&
+		git -c core.untrackedThreads=4 status --porcelain $opts >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'status with a pathspec' '
+	git -c core.untrackedThreads=1 status --porcelain -uall dir2 >expect &&
+	git -c core.untrackedThreads=4 status --porcelain -uall dir2 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clean -n' '
+	git -c core.untrackedThreads=1 clean -n -d -x >expect &&
+	git -c core.untrackedThreads=4 clean -n -d -x >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'ls-files -o --directory --no-empty-directory' '
+	git -c core.untrackedThreads=1 ls-files -o --exclude-standard \
+		--directory --no-empty-directory >expect &&
+	git -c core.untrackedThreads=4 ls-files -o --exclude-standard \
+		--directory --no-empty-directory >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'per-directory excludes apply in every thread' '
+	git -c core.untrackedThreads=4 status --porcelain -uall >actual &&
+	! grep "dir1/.*\.ign" actual &&
+	grep "dir2/sub1/deep/file.ign" actual &&
+	! grep "dir2/sub3/deep" actual
+'
+
+test_done
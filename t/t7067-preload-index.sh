@@ -0,0 +1,50 @@
+#!/bin/sh
+
+test_description='parallel index preload'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 300)
+	do
+		echo $i >file$i || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	test-chmtime =-600 file* &&
+	git update-index --refresh
+'
+
+test_expect_success 'preload looks at every entry once' '
+	rm -f trace &&
+	GIT_TRACE_PRELOAD="$(pwd)/trace" \
+		git -c core.preloadIndex=true diff --quiet &&
+	grep "^preload: [0-9]* threads for 300 entries$" trace &&
+	sed -n "s/^preload: thread [0-9]*: \([0-9]*\) entries.*/\1/p" trace >counts &&
+	total=0 &&
+	for n in $(cat counts)
+	do
+		total=$(($total + $n))
+	done &&
+	test $total = 300
+'
+
+test_expect_success 'preloaded entries are still compared' '
+	echo changed >file150 &&
+	echo changed >file299 &&
+	git -c core.preloadIndex=true diff --name-only >actual &&
+	cat >expect <<-\EOF &&
+	file150
+	file299
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'no preload when disabled' '
+	rm -f trace &&
+	GIT_TRACE_PRELOAD="$(pwd)/trace" \
+		git -c core.preloadIndex=false status >/dev/null &&
+	test_path_is_missing trace
+'
+
+test_done
@@ -774,4 +774,35 @@ test_expect_success 'submodule update --recursive drops module name before recur
 	 test_i18ngrep "Submodule path .deeper/submodule/subsubmodule.: checked out" actual
 	)
 '
+test_expect_success 'submodule update --jobs clones and checks out in parallel' '
+	mkdir parallel &&
+	(cd parallel &&
+	 git init &&
+	 for i in 1 2 3
+	 do
+		git submodule add ../submodule sub$i || exit 1
+	 done &&
+	 test_tick &&
+	 git commit -m "three submodules"
+	) &&
+	git clone parallel parallel-clone &&
+	(cd parallel-clone &&
+	 git submodule init &&
+	 git submodule update --jobs 3 >actual 2>err &&
+	 git submodule status >status &&
+	 test_line_count = 3 status &&
+	 ! grep "^[-+U]" status &&
+	 test_i18ngrep "Cloning into .*sub1" err &&
+	 test_i18ngrep "Submodule path .sub2.: checked out" actual
+	) &&
+	(cd parallel-clone/sub3 &&
+	 git checkout -q HEAD^
+	) &&
+	(cd parallel-clone &&
+	 git -c submodule.fetchJobs=2 submodule update >actual &&
+	 test_i18ngrep "Submodule path .sub3.: checked out" actual &&
+	 git submodule status >status &&
+	 ! grep "^[-+U]" status
+	)
+'
 test_done
@@ -1499,4 +1499,18 @@ test_expect_success 'git commit -m will commit a staged but ignored submodule' '
 	git config -f .gitmodules  --remove-section submodule.subname
 '
 
+test_expect_success 'status.parallel does not change the output' '
+	echo changed >>dir1/modified &&
+	git mv dir1/tracked dir1/renamed &&
+	>dir2/untracked-too &&
+	git -c status.parallel=false status --porcelain -uall >expect &&
+	git -c status.parallel=true status --porcelain -uall >actual &&
+	test_cmp expect actual &&
+	git -c status.parallel=false status --porcelain --ignored >expect &&
+	git -c status.parallel=true status --porcelain --ignored >actual &&
+	test_cmp expect actual &&
+	grep "^R  dir1/tracked -> dir1/renamed" actual &&
+	grep "^?? dir2/untracked-too" actual
+'
+
 test_done
@@ -165,4 +165,26 @@ test_expect_success GPG 'show lack of signature with custom format' '
 	test_cmp expect actual
 '
 
+test_expect_success GPG 'gpg.verifyCache remembers verification results' '
+	rm -f .git/gpg-verify-cache &&
+	git log --format="%G?%n%GK%n%GS" sixth-signed eighth-signed-alt \
+		$(cat forged1.commit) >expect &&
+	git -c gpg.verifyCache=true log --format="%G?%n%GK%n%GS" \
+		sixth-signed eighth-signed-alt $(cat forged1.commit) >actual &&
+	test_cmp expect actual &&
+	test -s .git/gpg-verify-cache &&
+	mkdir -p fake-bin &&
+	write_script fake-bin/gpg <<-\EOF &&
+	echo >&2 "gpg should not have been run"
+	exit 1
+	EOF
+	(
+		PATH="$(pwd)/fake-bin:$PATH" &&
+		git -c gpg.verifyCache=true log --format="%G?%n%GK%n%GS" \
+			sixth-signed eighth-signed-alt $(cat forged1.commit) \
+			>actual
+	) &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,112 @@
+#!/bin/sh
+
+test_description='git status with a filesystem monitor'
+
+. ./test-lib.sh
+
+sane_unset GIT_TEST_SPLIT_INDEX
+
+# The hook reports the paths listed in .git/fsmonitor-paths, and fails
+# if .git/fsmonitor-fail exists.
+test_expect_success 'setup' '
+	mkdir dir1 dir2 &&
+	for f in one two dir1/one dir1/two dir2/one dir2/two
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	: >.git/fsmonitor-paths &&
+	write_script .git/fsmonitor-hook <<-\EOF &&
+	echo "$*" >>.git/fsmonitor-args
+	test -f .git/fsmonitor-fail && exit 1
+	tr "\n" "\0" <.git/fsmonitor-paths
+	EOF
+	git config core.fsmonitor .git/fsmonitor-hook
+'
+
+test_expect_success 'enabling the monitor writes the extension' '
+	test-dump-fsmonitor >actual &&
+	cat >expect <<-\EOF &&
+	no fsmonitor
+	EOF
+	test_cmp expect actual &&
+	git update-index --refresh &&
+	test-dump-fsmonitor >actual &&
+	grep "^fsmonitor last update [0-9]" actual
+'
+
+test_expect_success 'refreshed entries are recorded as clean' '
+	git status >/dev/null &&
+	test-dump-fsmonitor >actual &&
+	grep "^dirty:$" actual &&
+	tail -n 1 .git/fsmonitor-args >args &&
+	grep "^1 [0-9][0-9]*$" args
+'
+
+test_expect_success 'paths the monitor does not report are not checked' '
+	echo changed >dir1/one &&
+	git diff-files --name-only >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'paths the monitor reports are checked' '
+	echo dir1/one >.git/fsmonitor-paths &&
+	git status --porcelain --untracked-files=no >actual &&
+	cat >expect <<-\EOF &&
+	 M dir1/one
+	EOF
+	test_cmp expect actual &&
+	test-dump-fsmonitor >actual &&
+	grep "^dirty: 0$" actual
+'
+
+test_expect_success 'reported directories invalidate what is beneath them' '
+	git checkout dir1/one &&
+	echo changed >dir2/two &&
+	echo dir2 >.git/fsmonitor-paths &&
+	git diff-files --name-only >actual &&
+	cat >expect <<-\EOF &&
+	dir2/two
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'everything is checked when the hook fails' '
+	git checkout dir2/two &&
+	git status >/dev/null &&
+	: >.git/fsmonitor-paths &&
+	git status >/dev/null &&
+	echo changed >two &&
+	test_when_finished "rm -f .git/fsmonitor-fail && git checkout two" &&
+	: >.git/fsmonitor-fail &&
+	git diff-files --name-only >actual &&
+	cat >expect <<-\EOF &&
+	two
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'the untracked cache trusts the monitor' '
+	git update-index --force-untracked-cache &&
+	: >.git/fsmonitor-paths &&
+	git status --porcelain >/dev/null &&
+	git status --porcelain >/dev/null &&
+	: >dir2/new &&
+	git status --porcelain >actual &&
+	! grep new actual &&
+	echo dir2/new >.git/fsmonitor-paths &&
+	git status --porcelain >actual &&
+	grep "^?? dir2/new$" actual
+'
+
+test_expect_success 'disabling the monitor drops the extension' '
+	git -c core.fsmonitor= status >/dev/null &&
+	test-dump-fsmonitor >actual &&
+	cat >expect <<-\EOF &&
+	no fsmonitor
+	EOF
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description='git status --porcelain answered by the status-cache daemon'
+. ./test-lib.sh
+
+if test -n "$NO_UNIX_SOCKETS"
+then
+	skip_all='skipping status daemon tests, unix sockets not available'
+	test_done
+fi
+
+stop_status_daemon () {
+	"$PERL_PATH" -MIO::Socket::UNIX -e '
+		my $s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or exit 0;
+		print $s "exit\n";
+	' "$(pwd)/.git/status-cache/socket"
+}
+
+# compare the output of the daemon with what git status says itself
+check_status () {
+	git -c status.daemon=false status "$@" >expect &&
+	git -c status.daemon=true status "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	echo modified >one.t &&
+	echo staged >two.t &&
+	git add two.t &&
+	echo untracked >untracked &&
+	mkdir dir &&
+	echo ignored >dir/ignored &&
+	echo untracked >dir/untracked &&
+	echo "*ignored" >.gitignore &&
+	cat >.git/info/exclude <<-\EOF &&
+	expect
+	actual
+	EOF
+	git config status.daemon true
+'
+
+test_expect_success 'status comes from the daemon' '
+	test_when_finished stop_status_daemon &&
+	check_status --porcelain &&
+	test -S .git/status-cache/socket &&
+	check_status --porcelain
+'
+
+test_expect_success 'options are passed to the daemon' '
+	test_when_finished stop_status_daemon &&
+	check_status --porcelain -b &&
+	check_status --porcelain -z &&
+	check_status --porcelain -uall &&
+	check_status --porcelain -uno &&
+	check_status --porcelain --ignored
+'
+
+test_expect_success 'changes to the work tree and the index are seen' '
+	test_when_finished stop_status_daemon &&
+	check_status --porcelain &&
+	echo more >>one.t &&
+	echo new >new &&
+	check_status --porcelain &&
+	git add new &&
+	check_status --porcelain &&
+	git rm --cached -q one.t &&
+	check_status --porcelain &&
+	git commit -q -m three &&
+	check_status --porcelain -b
+'
+
+test_expect_success 'edits to files that were clean are seen' '
+	test_when_finished stop_status_daemon &&
+	echo clean >clean &&
+	test-chmtime =-60 clean &&
+	git add clean &&
+	git commit -q -m clean &&
+	# the first one starts the daemon, the second is answered by it
+	git -c status.daemon=true status --porcelain &&
+	git -c status.daemon=true status --porcelain &&
+	echo edited >>clean &&
+	git -c status.daemon=true status --porcelain >actual &&
+	grep "^ M clean\$" actual &&
+	git -c status.daemon=false status --porcelain >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'daemon steps aside when the configuration changes' '
+	test_when_finished stop_status_daemon &&
+	check_status --porcelain &&
+	git config status.showUntrackedFiles no &&
+	test_when_finished "git config --unset status.showUntrackedFiles" &&
+	check_status --porcelain &&
+	check_status --porcelain
+'
+
+test_done
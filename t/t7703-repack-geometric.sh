@@ -0,0 +1,148 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+midx=$objdir/pack/multi-pack-index
+
+# create a pack holding the "$2" next commits on top of HEAD, named "$1-<n>"
+make_pack () {
+	for i in $(test_seq 1 $2)
+	do
+		test_commit "$1-$i" || return 1
+	done &&
+	git repack -q -d
+}
+
+count_packs () {
+	ls $objdir/pack/*.pack | wc -l
+}
+
+# print the object counts of all packs, smallest first
+pack_sizes () {
+	for idx in $objdir/pack/*.idx
+	do
+		git show-index <$idx | wc -l || return 1
+	done | sort -n
+}
+
+test_expect_success '--geometric with no packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		git repack --geometric 2 -d >out &&
+		grep "Nothing new to pack" out
+	)
+'
+
+test_expect_success '--geometric with an intact progression' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		# 3, 6 and 12 objects per pack
+		make_pack small 1 &&
+		make_pack medium 2 &&
+		make_pack large 4 &&
+		pack_sizes >expect &&
+		git repack --geometric 2 -d &&
+		pack_sizes >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric rolls up small packs' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack large 10 &&
+		make_pack one 1 &&
+		make_pack two 1 &&
+		make_pack three 1 &&
+		test $(count_packs) = 4 &&
+		git rev-list --objects --all | cut -d" " -f1 | sort >expect &&
+		git repack --geometric 2 -d &&
+		test $(count_packs) = 2 &&
+		test $(pack_sizes | head -n 1) = 9 &&
+		git cat-file --batch-check="%(objectname)" <expect >actual &&
+		test_cmp expect actual &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric rolls up packs the new pack outgrows' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		# 15, 3 and 3 objects: the two small packs break the
+		# progression, and together they are too big for 15
+		make_pack large 5 &&
+		make_pack one 1 &&
+		make_pack two 1 &&
+		git repack --geometric 4 -d &&
+		test $(count_packs) = 1 &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric includes loose objects' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack large 10 &&
+		test_commit loose &&
+		git repack --geometric 2 -d &&
+		test $(count_packs) = 2 &&
+		git count-objects -v >out &&
+		grep "^count: 0" out &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric leaves packs with .keep alone' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack large 10 &&
+		make_pack kept 1 &&
+		kept=$(ls -t $objdir/pack/*.pack | head -n 1) &&
+		touch ${kept%.pack}.keep &&
+		make_pack one 1 &&
+		make_pack two 1 &&
+		git repack --geometric 2 -d &&
+		test_path_is_file $kept &&
+		test $(count_packs) = 3 &&
+		git fsck
+	)
+'
+
+test_expect_success '--geometric writes a multi-pack index' '
+	git init geometric &&
+	test_when_finished "rm -fr geometric" &&
+	(
+		cd geometric &&
+		make_pack large 10 &&
+		make_pack one 1 &&
+		make_pack two 1 &&
+		git repack --geometric 2 -d &&
+		test_path_is_file $midx &&
+		git multi-pack-index verify &&
+		rm $midx &&
+		git repack --geometric 2 -d --no-write-midx &&
+		test_path_is_missing $midx
+	)
+'
+
+test_expect_success '--geometric rejects bad arguments' '
+	test_must_fail git repack --geometric 1 &&
+	test_must_fail git repack --geometric 2 -a
+'
+
+test_done
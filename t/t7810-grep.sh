@@ -780,6 +780,22 @@ test_expect_success 'grep -Fi' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -F finds matches at every offset of long lines' '
+	printf "%040d\n" 0 | sed "s/0/x/g" >base &&
+	for i in 0 1 7 15 16 17 31 32 33 36
+	do
+		sed -e "s/^\(x\{$i\}\)xxxx/\1AbC!/" base >line &&
+		echo "line:$(cat line)" >expect &&
+		git grep --no-index -F "AbC!" line >actual &&
+		test_cmp expect actual &&
+		git grep --no-index -F -i "aBc!" line >actual &&
+		test_cmp expect actual &&
+		test_must_fail git grep --no-index -F "AbCx" line ||
+		return 1
+	done &&
+	test_must_fail git grep --no-index -F -i "xxxa" base
+'
+
 test_expect_success 'outside of git repository' '
 	rm -fr non &&
 	mkdir -p non/git/sub &&
@@ -1296,4 +1312,19 @@ test_expect_success 'grep --color -e A --and -e B -p with context' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep with threads searches trees and the index the same' '
+	git grep --threads=1 -n -e o HEAD HEAD^ >expect &&
+	git grep --threads=4 -n -e o HEAD HEAD^ >actual &&
+	test_cmp expect actual &&
+	git grep --threads=1 --cached -c -e o >expect &&
+	test_config grep.threads 3 &&
+	git grep --cached -c -e o >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'grep rejects a negative number of threads' '
+	test_must_fail git grep --threads=-1 -e o &&
+	test_must_fail git -c grep.threads=-1 grep -e o
+'
+
 test_done
@@ -0,0 +1,98 @@
+#!/bin/sh
+
+test_description='git grep with a trigram index'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir dir &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo "line $i of file $i" >file$i &&
+		echo "nothing to see in $i" >dir/other$i || return 1
+	done &&
+	echo "Hello World" >hello &&
+	printf "caf\303\251 au lait\n" >cafe &&
+	echo "foo(bar)+baz" >code &&
+	echo "abc" >short &&
+	git add . &&
+	git commit -m initial &&
+	echo "Hello there" >hello &&
+	git commit -am second &&
+	echo "Goodbye World" >hello &&
+	git add hello &&
+	git grep-index write &&
+	test_path_is_file .git/objects/info/grep-index
+'
+
+test_grep_same () {
+	git -c grep.trigramIndex=false grep "$@" >expect
+	echo $? >>expect
+	git grep "$@" >actual
+	echo $? >>actual
+	test_cmp expect actual
+}
+
+for args in \
+	"-F file" \
+	"-F \"of file 3\"" \
+	"\"line [0-9] of\"" \
+	"\"fi*le\"" \
+	"-E \"(see|file) in\"" \
+	"-E \"see|file\"" \
+	"\"\\(of\\)* file\"" \
+	"-e Hello -e World" \
+	"-i \"hello world\"" \
+	"-i WORLD" \
+	"-F \"foo(bar)+\"" \
+	"-E \"foo\\(bar\\)\\+baz\"" \
+	"-v nothing" \
+	"-L nothing" \
+	"-i \"CAF$(printf "\303\251")\"" \
+	"\"caf$(printf "\303\251")\"" \
+	"-w abc" \
+	"World HEAD" \
+	"there HEAD^ HEAD" \
+	"--cached World" \
+	"World"
+do
+	test_expect_success "same results for grep $args" "
+		test_grep_same $args
+	"
+done
+
+test_expect_success 'modified worktree files are read' '
+	echo "Hello again" >hello &&
+	test_grep_same again &&
+	git grep again >actual &&
+	echo "hello:Hello again" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blobs not in the index are read' '
+	echo "a new file" >new &&
+	git add new &&
+	git commit -m new &&
+	git grep "new file" >actual &&
+	echo "new:a new file" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blobs are skipped by the index' '
+	git grep-index write &&
+	git grep -F "of file" HEAD >expect &&
+	blob=$(git rev-parse HEAD:dir/other1) &&
+	rm .git/objects/$(echo $blob | sed "s|^..|&/|") &&
+	git grep -F "of file" HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	test_must_be_empty err &&
+	git -c grep.trigramIndex=false grep -F "of file" HEAD 2>err &&
+	test_i18ngrep "unable to read" err
+'
+
+test_expect_success 'clear removes the index' '
+	git grep-index clear &&
+	test_path_is_missing .git/objects/info/grep-index
+'
+
+test_done
@@ -0,0 +1,129 @@
+#!/bin/sh
+
+test_description='git maintenance'
+
+. ./test-lib.sh
+
+test_expect_success 'run runs gc by default' '
+	test_commit base &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --quiet &&
+	grep "run_command: .gc. .--quiet." trace &&
+	test_path_is_file .git/maintenance/gc &&
+	test_path_is_missing .git/maintenance/gc.lock
+'
+
+test_expect_success 'run rejects unknown and repeated tasks' '
+	test_must_fail git maintenance run --task=nonsense 2>err &&
+	test_i18ngrep "is not a valid task" err &&
+	test_must_fail git maintenance run --task=gc --task=gc 2>err &&
+	test_i18ngrep "cannot be selected multiple times" err
+'
+
+test_expect_success 'run --task runs only those tasks' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --task=pack-refs &&
+	grep "run_command: .pack-refs." trace &&
+	! grep "run_command: .gc." trace
+'
+
+test_expect_success 'loose-objects packs loose objects and deletes them later' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit loose-$i || return 1
+	done &&
+	git maintenance run --task=loose-objects --quiet &&
+	git count-objects -v >after &&
+	grep "^count: 15$" after &&
+	grep "^prune-packable: 15$" after &&
+	ls .git/objects/pack/loose-*.pack &&
+	git maintenance run --task=loose-objects --quiet &&
+	git count-objects -v >after &&
+	grep "^count: 0$" after &&
+	git fsck
+'
+
+test_expect_success 'run --auto only runs tasks with work to do' '
+	test_config maintenance.loose-objects.enabled true &&
+	test_config maintenance.gc.enabled false &&
+	test_config maintenance.loose-objects.auto 3 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --auto --quiet &&
+	! grep "run_command: .prune-packed." trace &&
+	test_commit auto-1 &&
+	test_commit auto-2 &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --auto --quiet &&
+	grep "run_command: .prune-packed." trace
+'
+
+test_expect_success 'incremental-repack merges small packs' '
+	git repack -a -d -q &&
+	for i in $(test_seq 1 3)
+	do
+		test_commit repack-$i &&
+		git repack -d -q || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 4 packs &&
+	test_config maintenance.incremental-repack.auto 5 &&
+	git maintenance run --task=incremental-repack --auto --quiet &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 4 packs &&
+	git maintenance run --task=incremental-repack --quiet &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count -lt 4 packs &&
+	git fsck
+'
+
+test_expect_success 'commit-graph --auto writes a graph that is out of date' '
+	test_config core.commitGraph true &&
+	git maintenance run --task=commit-graph --auto &&
+	test_path_is_file .git/objects/info/commit-graph &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --task=commit-graph --auto &&
+	! grep "run_command: .commit-graph." trace &&
+	test_commit graph &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --task=commit-graph --auto &&
+	grep "run_command: .commit-graph." trace &&
+	git commit-graph verify
+'
+
+test_expect_success 'prefetch fetches into refs/prefetch' '
+	git clone . clone &&
+	(
+		cd clone &&
+		test_commit upstream-change
+	) &&
+	git remote add downstream clone &&
+	git maintenance run --task=prefetch --quiet &&
+	test "$(git rev-parse refs/prefetch/downstream/master)" = \
+		"$(git -C clone rev-parse master)" &&
+	test_must_fail git rev-parse --verify refs/remotes/downstream/master
+'
+
+test_expect_success 'run --scheduled only runs tasks that are due' '
+	test_config maintenance.pack-refs.enabled true &&
+	test_config maintenance.pack-refs.schedule daily &&
+	test_config maintenance.gc.enabled false &&
+	echo $(($(date +%s) - 3600)) >.git/maintenance/pack-refs &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --scheduled &&
+	! grep "run_command: .pack-refs." trace &&
+	echo $(($(date +%s) - 86400)) >.git/maintenance/pack-refs &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --scheduled &&
+	grep "run_command: .pack-refs." trace &&
+	test_config maintenance.pack-refs.schedule never &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run --scheduled &&
+	! grep "run_command: .pack-refs." trace
+'
+
+test_expect_success 'a task whose lock is taken is skipped' '
+	>.git/maintenance/gc.lock &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git maintenance run 2>err &&
+	test_i18ngrep "already running" err &&
+	! grep "run_command: .gc." trace &&
+	rm .git/maintenance/gc.lock
+'
+
+test_done
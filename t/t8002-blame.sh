@@ -81,4 +81,16 @@ test_expect_success 'blame with showEmail config true' '
 	test_cmp expected_n result
 '
 
+test_expect_success 'blame.threads does not change the answer' '
+	for opts in "" "-M" "-C -C -M" "-C -C -C"
+	do
+		git blame --porcelain $opts HEAD -- file >expect &&
+		git -c blame.threads=3 blame --porcelain $opts HEAD -- file >actual &&
+		test_cmp expect actual &&
+		git blame --incremental $opts HEAD -- file >expect &&
+		git -c blame.threads=3 blame --incremental $opts HEAD -- file >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_done
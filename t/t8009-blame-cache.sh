@@ -0,0 +1,85 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+	for i in 2 5 8
+	do
+		sed -e "s/^$i\$/$i changed/" file >file.new &&
+		mv file.new file &&
+		test_tick &&
+		git commit -a -m "change $i" || return 1
+	done &&
+	git checkout -b side HEAD~2 &&
+	echo side >>file &&
+	test_tick &&
+	git commit -a -m side &&
+	git checkout master &&
+	test_tick &&
+	git merge -m merge side &&
+	git mv file renamed &&
+	sed -e "s/^9\$/9 changed/" renamed >renamed.new &&
+	mv renamed.new renamed &&
+	test_tick &&
+	git commit -a -m "rename and change 9"
+'
+
+test_expect_success 'results are recorded and reused' '
+	git blame --porcelain HEAD~1 -- file >expect &&
+	git -c blame.cache=true blame --porcelain HEAD~1 -- file >actual &&
+	test_cmp expect actual &&
+	test_line_count = 2 .git/blame-cache &&
+	git -c blame.cache=true blame --porcelain HEAD~1 -- file >actual &&
+	test_cmp expect actual &&
+	git -c blame.cache=true blame --show-stats HEAD~1 -- file >stats &&
+	grep "^num commits: 0" stats
+'
+
+test_expect_success 'blame resumes from a cached ancestor' '
+	git -c blame.cache=true blame --show-stats HEAD -- renamed >stats &&
+	grep "^num commits: 1" stats &&
+	for opts in --porcelain --line-porcelain "-c" "-n -f" "--root -p"
+	do
+		git blame $opts HEAD -- renamed >expect &&
+		git -c blame.cache=true blame $opts HEAD -- renamed >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'working tree and -L use the cache' '
+	echo new >>renamed &&
+	git blame renamed >expect &&
+	git -c blame.cache=true blame renamed >actual &&
+	test_cmp expect actual &&
+	git checkout renamed &&
+	git blame -L 3,6 HEAD~2 -- file >expect &&
+	git -c blame.cache=true blame -L 3,6 HEAD~2 -- file >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'options that change the result bypass the cache' '
+	git -c blame.cache=true blame --show-stats -M HEAD -- renamed >stats &&
+	! grep "^num commits: 0" stats &&
+	git -c blame.cache=true blame --show-stats -w HEAD -- renamed >stats &&
+	! grep "^num commits: 0" stats &&
+	git blame -w --porcelain HEAD -- renamed >expect &&
+	git -c blame.cache=true blame -w --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a damaged entry is ignored' '
+	for key in $(sed -e 1d -e "s/ .*//" .git/blame-cache)
+	do
+		echo "$key 0 100 0 garbage" >>.git/blame-cache || return 1
+	done &&
+	git blame --porcelain HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_done
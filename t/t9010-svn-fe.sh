@@ -22,7 +22,7 @@ try_dump () {
 	maybe_fail_fi=${3:+test_$3} &&
 
 	{
-		$maybe_fail_svnfe test-svn-fe "$input" >stream 3<backflow &
+		$maybe_fail_svnfe test-svn-fe $svnfe_opts "$input" >stream 3<backflow &
 	} &&
 	$maybe_fail_fi git fast-import --cat-blob-fd=3 <stream 3>backflow &&
 	wait $!
@@ -1073,6 +1073,116 @@ test_expect_success PIPE 'no hang for delta trying to read past end of preimage'
 	try_dump greedydelta.dump must_fail might_fail
 '
 
+test_expect_success PIPE 'pipelined import of several deltas per revision' '
+	cat >expect <<-\EOF &&
+	c	hello
+	d/a	hello
+	d/b	hello
+	e/a	hello
+	e/b	hi
+	f	hello
+	EOF
+	{
+		cat <<-\EOF &&
+		SVN-fs-dump-format-version: 3
+
+		Revision-number: 1
+		Prop-content-length: 10
+		Content-length: 10
+
+		PROPS-END
+
+		Node-path: d
+		Node-kind: dir
+		Node-action: add
+		Prop-content-length: 10
+		Content-length: 10
+
+		PROPS-END
+
+		EOF
+		for path in d/a d/b c
+		do
+			printf "%s\n" "Node-path: $path" \
+				"Node-kind: file" "Node-action: add" &&
+			text_no_props hi &&
+			echo || return 1
+		done &&
+		cat <<-\EOF &&
+		Revision-number: 2
+		Prop-content-length: 10
+		Content-length: 10
+
+		PROPS-END
+
+		Node-path: e
+		Node-kind: dir
+		Node-action: add
+		Node-copyfrom-rev: 1
+		Node-copyfrom-path: d
+
+		Node-path: d/b
+		Node-action: delete
+
+		Node-path: d/b
+		Node-kind: file
+		Node-action: add
+		EOF
+		text_no_props hi &&
+		echo &&
+		for path in d/a c e/a d/b f
+		do
+			printf "%s\n" "Node-path: $path" "Node-kind: file" &&
+			if test $path = f
+			then
+				printf "%s\n" "Node-action: add" \
+					"Node-copyfrom-rev: 1" \
+					"Node-copyfrom-path: d/a"
+			else
+				echo "Node-action: change"
+			fi &&
+			echo "Text-delta: true" &&
+			echo "Prop-content-length: 10" &&
+			echo Text-content-length: $(wc -c <delta) &&
+			echo Content-length: $((10 + $(wc -c <delta))) &&
+			echo &&
+			echo PROPS-END &&
+			cat delta &&
+			echo || return 1
+		done
+	} >pipeline.dump &&
+	for threads in 0 1 3
+	do
+		reinit_git &&
+		svnfe_opts=--pipeline=$threads try_dump pipeline.dump &&
+		git ls-tree -r --name-only HEAD >paths &&
+		while read path
+		do
+			printf "%s\t%s\n" "$path" "$(git show HEAD:$path)" ||
+			return 1
+		done <paths >actual &&
+		test_cmp expect actual &&
+		git for-each-ref >refs.$threads || return 1
+	done &&
+	test_cmp refs.0 refs.1 &&
+	test_cmp refs.0 refs.3
+'
+
+test_expect_success PIPE 'pipelined import matches serial import' '
+	for dump in directory.dump branch.dump 8bitclean.dump filemode2.dump \
+		delta.dump propdelta.dump changeroot.dump deleteprop.dump \
+		deltapartial.dump
+	do
+		reinit_git &&
+		try_dump $dump &&
+		git for-each-ref >expect &&
+		reinit_git &&
+		svnfe_opts=--pipeline=2 try_dump $dump &&
+		git for-each-ref >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
 test_expect_success 'set up svn repo' '
 	svnconf=$PWD/svnconf &&
 	mkdir -p "$svnconf" &&
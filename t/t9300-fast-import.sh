@@ -3088,4 +3088,89 @@ test_expect_success 'U: validate root delete result' '
 	compare_diff_raw expect actual
 '
 
+
+###
+### series V (threads)
+###
+
+test_expect_success 'V: setup a stream with similar blobs' '
+	for i in $(test_seq 1 60)
+	do
+		test_seq $i 200 >file &&
+		echo "blob" &&
+		echo "mark :$i" &&
+		echo "data $(wc -c <file)" &&
+		cat file &&
+		echo "commit refs/heads/V" &&
+		echo "committer $GIT_COMMITTER_NAME <$GIT_COMMITTER_EMAIL> $GIT_COMMITTER_DATE" &&
+		echo "data 0" &&
+		echo "M 100644 :$i file" &&
+		echo &&
+		case $i in
+		*7)
+			echo "cat-blob :$((i - 1))"
+			;;
+		*3)
+			echo "checkpoint" &&
+			echo
+			;;
+		esac || return 1
+	done >input
+'
+
+test_expect_success 'V: blobs compressed by threads' '
+	rm -rf serial threaded &&
+	git init serial &&
+	git init threaded &&
+	(cd serial && git fast-import --depth=4 <../input >../expect.cat) &&
+	(cd threaded &&
+	 git fast-import --depth=4 --threads=3 <../input >../actual.cat) &&
+	test_cmp expect.cat actual.cat &&
+	git -C serial rev-list --objects V >expect &&
+	git -C threaded rev-list --objects V >actual &&
+	test_cmp expect actual &&
+	git -C threaded fsck --no-dangling
+'
+
+###
+### series W (memory limit)
+###
+
+test_expect_success 'W: setup a stream with many marks' '
+	perl -e "
+		for my \$i (1..25000) {
+			print qq(blob\nmark :\$i\ndata <<EOF\nblob \$i\nEOF\n);
+		}
+		print qq(commit refs/heads/W\nmark :25001\n);
+		print qq(committer C <c\\@example.com> 0 +0000\ndata 0\n);
+		print qq(M 100644 :\$_ f\$_\n) for (1, 12345, 25000);
+		print qq(\nblob\nmark :1\ndata <<EOF\nreused mark\nEOF\n);
+		print qq(commit refs/heads/W\ncommitter C <c\\@example.com> 0 +0000\n);
+		print qq(data 0\nfrom :25001\nM 100644 :1 reused\nM 100644 :2 two\n\n);
+		print qq(cat-blob :3\nls :25001 f12345\n);
+	" >input
+'
+
+test_expect_success 'W: marks spilled to disk under --memory-limit' '
+	rm -rf unlimited limited &&
+	git init unlimited &&
+	git init limited &&
+	(cd unlimited &&
+	 git fast-import --export-marks=../expect.marks <../input >../expect.out) &&
+	(cd limited &&
+	 git fast-import --memory-limit=1m --export-marks=../actual.marks \
+		<../input >../actual.out 2>../stats) &&
+	test_cmp expect.out actual.out &&
+	sort expect.marks >expect &&
+	sort actual.marks >actual &&
+	test_cmp expect actual &&
+	grep "on disk" stats &&
+	! grep " 0 on disk" stats &&
+	git -C unlimited rev-parse W >expect &&
+	git -C limited rev-parse W >actual &&
+	test_cmp expect actual &&
+	git -C limited fsck --no-dangling &&
+	! ls limited/.git/objects/pack/tmp_marks_*
+'
+
 test_done
@@ -0,0 +1,27 @@
+#include "cache.h"
+#include "ewah/ewok.h"
+
+static void show_bit(size_t pos, void *data)
+{
+	printf(" %d", (int)pos);
+}
+
+int main(int ac, char **av)
+{
+	struct index_state *istate = &the_index;
+
+	setup_git_directory();
+	if (do_read_index(istate, get_index_file(), 0) < 0)
+		die("unable to read index file");
+	if (!istate->fsmonitor_last_update) {
+		printf("no fsmonitor\n");
+		return 0;
+	}
+	printf("fsmonitor last update %"PRIuMAX"\n",
+	       (uintmax_t)istate->fsmonitor_last_update);
+	printf("dirty:");
+	if (istate->fsmonitor_dirty)
+		ewah_each_bit(istate->fsmonitor_dirty, show_bit, NULL);
+	printf("\n");
+	return 0;
+}
@@ -124,6 +124,50 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
 	}
 }
 
+/*
+ * Fill an open-addressing map with hashes chosen to make clusters,
+ * remove every third entry, and check that every entry is found, or
+ * not found, as it should.
+ * Usage: echo "checkopen method" | test-hashmap
+ */
+static void check_open_addressing(unsigned int method)
+{
+	struct oahashmap map;
+	struct oahashmap_iter iter;
+	char buf[16];
+	struct test_entry **entries;
+	unsigned int i, found = 0, errors = 0;
+
+	entries = malloc(TEST_SIZE * sizeof(struct test_entry *));
+	oahashmap_init(&map, (hashmap_cmp_fn) test_entry_cmp, 0);
+	for (i = 0; i < TEST_SIZE; i++) {
+		snprintf(buf, sizeof(buf), "%i", i);
+		entries[i] = alloc_test_entry(hash(method, i, buf), buf,
+					      strlen(buf), "", 0);
+		oahashmap_add(&map, entries[i]->ent.hash, entries[i]);
+	}
+	for (i = 0; i < TEST_SIZE; i += 3)
+		if (oahashmap_remove(&map, entries[i]->ent.hash, NULL,
+				     entries[i]->key) != entries[i])
+			errors++;
+	for (i = 0; i < TEST_SIZE; i++) {
+		void *e = oahashmap_get(&map, entries[i]->ent.hash, NULL,
+					entries[i]->key);
+		if (e != (i % 3 ? entries[i] : NULL))
+			errors++;
+	}
+	for (oahashmap_iter_init(&map, &iter); oahashmap_iter_next(&iter); )
+		found++;
+	if (found != map.size || found != TEST_SIZE - (TEST_SIZE + 2) / 3)
+		errors++;
+	printf("%u errors\n", errors);
+
+	oahashmap_free(&map, 0);
+	for (i = 0; i < TEST_SIZE; i++)
+		free(entries[i]);
+	free(entries);
+}
+
 #define DELIM " \t\r\n"
 
 /*
@@ -137,17 +181,32 @@ static void perf_hashmap(unsigned int method, unsigned int rounds)
  * size -> tablesize numentries
  *
  * perfhashmap method rounds -> test hashmap.[ch] performance
+ * checkopen method -> test the open-addressing map with collisions
+ *
+ * With "open-addressing" as argument, the commands work on a struct
+ * oahashmap instead.
  */
 int main(int argc, char *argv[])
 {
 	char line[1024];
 	struct hashmap map;
-	int icase;
+	struct oahashmap oamap;
+	hashmap_cmp_fn cmpfn;
+	int i, icase = 0, oa = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp("ignorecase", argv[i]))
+			icase = 1;
+		else if (!strcmp("open-addressing", argv[i]))
+			oa = 1;
+	}
 
 	/* init hash map */
-	icase = argc > 1 && !strcmp("ignorecase", argv[1]);
-	hashmap_init(&map, (hashmap_cmp_fn) (icase ? test_entry_cmp_icase
-			: test_entry_cmp), 0);
+	cmpfn = (hashmap_cmp_fn) (icase ? test_entry_cmp_icase : test_entry_cmp);
+	if (oa)
+		oahashmap_init(&oamap, cmpfn, 0);
+	else
+		hashmap_init(&map, cmpfn, 0);
 
 	/* process commands from stdin */
 	while (fgets(line, sizeof(line), stdin)) {
@@ -182,7 +241,10 @@ int main(int argc, char *argv[])
 			entry = alloc_test_entry(hash, p1, l1, p2, l2);
 
 			/* add to hashmap */
-			hashmap_add(&map, entry);
+			if (oa)
+				oahashmap_add(&oamap, hash, entry);
+			else
+				hashmap_add(&map, entry);
 
 		} else if (!strcmp("put", cmd) && l1 && l2) {
 
@@ -190,7 +252,10 @@ int main(int argc, char *argv[])
 			entry = alloc_test_entry(hash, p1, l1, p2, l2);
 
 			/* add / replace entry */
-			entry = hashmap_put(&map, entry);
+			if (oa)
+				entry = oahashmap_put(&oamap, hash, entry);
+			else
+				entry = hashmap_put(&map, entry);
 
 			/* print and free replaced entry, if any */
 			puts(entry ? get_value(entry) : "NULL");
@@ -199,14 +264,20 @@ int main(int argc, char *argv[])
 		} else if (!strcmp("get", cmd) && l1) {
 
 			/* lookup entry in hashmap */
-			entry = hashmap_get_from_hash(&map, hash, p1);
+			if (oa)
+				entry = oahashmap_get(&oamap, hash, NULL, p1);
+			else
+				entry = hashmap_get_from_hash(&map, hash, p1);
 
 			/* print result */
 			if (!entry)
 				puts("NULL");
 			while (entry) {
 				puts(get_value(entry));
-				entry = hashmap_get_next(&map, entry);
+				if (oa)
+					entry = oahashmap_get_next(&oamap, hash, entry);
+				else
+					entry = hashmap_get_next(&map, entry);
 			}
 
 		} else if (!strcmp("remove", cmd) && l1) {
@@ -216,7 +287,10 @@ int main(int argc, char *argv[])
 			hashmap_entry_init(&key, hash);
 
 			/* remove entry from hashmap */
-			entry = hashmap_remove(&map, &key, p1);
+			if (oa)
+				entry = oahashmap_remove(&oamap, hash, NULL, p1);
+			else
+				entry = hashmap_remove(&map, &key, p1);
 
 			/* print result and free entry*/
 			puts(entry ? get_value(entry) : "NULL");
@@ -225,14 +299,25 @@ int main(int argc, char *argv[])
 		} else if (!strcmp("iterate", cmd)) {
 
 			struct hashmap_iter iter;
-			hashmap_iter_init(&map, &iter);
-			while ((entry = hashmap_iter_next(&iter)))
-				printf("%s %s\n", entry->key, get_value(entry));
+			struct oahashmap_iter oaiter;
+
+			if (oa) {
+				oahashmap_iter_init(&oamap, &oaiter);
+				while ((entry = oahashmap_iter_next(&oaiter)))
+					printf("%s %s\n", entry->key, get_value(entry));
+			} else {
+				hashmap_iter_init(&map, &iter);
+				while ((entry = hashmap_iter_next(&iter)))
+					printf("%s %s\n", entry->key, get_value(entry));
+			}
 
 		} else if (!strcmp("size", cmd)) {
 
 			/* print table sizes */
-			printf("%u %u\n", map.tablesize, map.size);
+			if (oa)
+				printf("%u %u\n", oamap.tablesize, oamap.size);
+			else
+				printf("%u %u\n", map.tablesize, map.size);
 
 		} else if (!strcmp("intern", cmd) && l1) {
 
@@ -252,6 +337,10 @@ int main(int argc, char *argv[])
 
 			perf_hashmap(atoi(p1), atoi(p2));
 
+		} else if (!strcmp("checkopen", cmd) && l1) {
+
+			check_open_addressing(atoi(p1));
+
 		} else {
 
 			printf("Unknown command %s\n", cmd);
@@ -259,6 +348,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	hashmap_free(&map, 1);
+	if (oa)
+		oahashmap_free(&oamap, 1);
+	else
+		hashmap_free(&map, 1);
 	return 0;
 }
@@ -0,0 +1,457 @@
+/*
+ * Micro-benchmarks of core data structures.
+ *
+ * Each benchmark works on a corpus generated from a fixed seed, so
+ * that runs of different builds see the same input.  An iteration
+ * performs "size" operations; after the warm-up iterations, the time
+ * of each iteration is taken and the mean and percentiles of the time
+ * per operation over all iterations are reported.
+ *
+ * Usage: test-microbench [options] <benchmark>...
+ */
+#include "cache.h"
+#include "parse-options.h"
+#include "hashmap.h"
+#include "prio-queue.h"
+#include "sha1-array.h"
+#include "oidset.h"
+#include "string-list.h"
+#include "strmap.h"
+#include "object.h"
+#include "blob.h"
+#include "kwset.h"
+#include "xdiff-interface.h"
+
+static int size = 10000;
+static int iterations = 20;
+static int warmup = 3;
+static int seed = 1;
+static int porcelain;
+
+/*
+ * The corpus: "size" path-like strings, object names and integers, and
+ * two versions of a text of "size" lines that differ in about one line
+ * out of ten.
+ */
+static struct corpus {
+	char **strings;
+	unsigned char (*sha1s)[20];
+	int *ints;
+	struct strbuf text, text2;
+} corpus;
+
+static unsigned long next_random;
+
+static unsigned int corpus_random(void)
+{
+	/* the generator of test-genrandom */
+	next_random = next_random * 11 + 3;
+	return next_random >> 8;
+}
+
+static void generate_corpus(void)
+{
+	int i, j;
+
+	next_random = seed;
+	corpus.strings = xmalloc(size * sizeof(*corpus.strings));
+	corpus.sha1s = xmalloc(size * sizeof(*corpus.sha1s));
+	corpus.ints = xmalloc(size * sizeof(*corpus.ints));
+	strbuf_init(&corpus.text, 0);
+	strbuf_init(&corpus.text2, 0);
+
+	for (i = 0; i < size; i++) {
+		unsigned int r = corpus_random();
+
+		corpus.strings[i] = xstrfmt("dir%u/sub%u/file-%d.c",
+					    r % 97, (r >> 7) % 31, i);
+		for (j = 0; j < 20; j++)
+			corpus.sha1s[i][j] = corpus_random();
+		corpus.ints[i] = corpus_random();
+
+		strbuf_addf(&corpus.text, "line %u of %s\n",
+			    r, corpus.strings[i]);
+		if (r % 10)
+			strbuf_addf(&corpus.text2, "line %u of %s\n",
+				    r, corpus.strings[i]);
+		else
+			strbuf_addf(&corpus.text2, "changed %u\n", r);
+	}
+}
+
+/* hashmap.c */
+
+struct bench_entry {
+	struct hashmap_entry ent;
+	const char *key;
+};
+
+static int bench_entry_cmp(const struct bench_entry *e1,
+			   const struct bench_entry *e2, const char *key)
+{
+	return strcmp(e1->key, key ? key : e2->key);
+}
+
+static struct bench_entry *bench_entries;
+static struct hashmap bench_map;
+
+static void setup_hashmap(void)
+{
+	int i;
+
+	bench_entries = xcalloc(size, sizeof(*bench_entries));
+	for (i = 0; i < size; i++) {
+		hashmap_entry_init(&bench_entries[i],
+				   strhash(corpus.strings[i]));
+		bench_entries[i].key = corpus.strings[i];
+	}
+}
+
+static void run_hashmap_add(void)
+{
+	int i;
+
+	hashmap_init(&bench_map, (hashmap_cmp_fn)bench_entry_cmp, 0);
+	for (i = 0; i < size; i++)
+		hashmap_add(&bench_map, &bench_entries[i]);
+	hashmap_free(&bench_map, 0);
+}
+
+static void setup_hashmap_get(void)
+{
+	int i;
+
+	setup_hashmap();
+	hashmap_init(&bench_map, (hashmap_cmp_fn)bench_entry_cmp, 0);
+	for (i = 0; i < size; i++)
+		hashmap_add(&bench_map, &bench_entries[i]);
+}
+
+static void run_hashmap_get(void)
+{
+	struct bench_entry key;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		hashmap_entry_init(&key, bench_entries[i].ent.hash);
+		if (!hashmap_get(&bench_map, &key, corpus.strings[i]))
+			die("BUG: %s not found in the hashmap", corpus.strings[i]);
+	}
+}
+
+/* the open-addressing variant, on the same entries */
+
+static struct oahashmap bench_oamap;
+
+static void run_oahashmap_add(void)
+{
+	int i;
+
+	oahashmap_init(&bench_oamap, (hashmap_cmp_fn)bench_entry_cmp, 0);
+	for (i = 0; i < size; i++)
+		oahashmap_add(&bench_oamap, bench_entries[i].ent.hash,
+			      &bench_entries[i]);
+	oahashmap_free(&bench_oamap, 0);
+}
+
+static void setup_oahashmap_get(void)
+{
+	int i;
+
+	setup_hashmap();
+	oahashmap_init(&bench_oamap, (hashmap_cmp_fn)bench_entry_cmp, 0);
+	for (i = 0; i < size; i++)
+		oahashmap_add(&bench_oamap, bench_entries[i].ent.hash,
+			      &bench_entries[i]);
+}
+
+static void run_oahashmap_get(void)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		if (!oahashmap_get(&bench_oamap, bench_entries[i].ent.hash,
+				   NULL, corpus.strings[i]))
+			die("BUG: %s not found in the hashmap", corpus.strings[i]);
+}
+
+/* prio-queue.c */
+
+static int intcmp(const void *va, const void *vb, void *data)
+{
+	const int *a = va, *b = vb;
+	return *a < *b ? -1 : *a > *b;
+}
+
+static void run_prio_queue(void)
+{
+	struct prio_queue pq = { intcmp };
+	int i;
+
+	for (i = 0; i < size; i++)
+		prio_queue_put(&pq, &corpus.ints[i]);
+	while (prio_queue_get(&pq))
+		; /* nothing */
+	clear_prio_queue(&pq);
+}
+
+/* sha1-array.c */
+
+static struct sha1_array bench_array = SHA1_ARRAY_INIT;
+
+static void setup_sha1_array(void)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		sha1_array_append(&bench_array, corpus.sha1s[i]);
+}
+
+static void run_sha1_array_lookup(void)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		if (sha1_array_lookup(&bench_array, corpus.sha1s[i]) < 0)
+			die("BUG: %s not found in the array",
+			    sha1_to_hex(corpus.sha1s[i]));
+}
+
+/* oidset.c: add each name, then look it up, as the loose cache does */
+
+static void run_oidset_add_contains(void)
+{
+	struct oidset set = OIDSET_INIT;
+	struct object_id oid;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		hashcpy(oid.hash, corpus.sha1s[i]);
+		oidset_add(&set, &oid);
+		if (!oidset_contains(&set, &oid))
+			die("BUG: %s not found in the set", oid_to_hex(&oid));
+	}
+	oidset_clear(&set);
+}
+
+/* string-list.c */
+
+static void run_string_list_insert(void)
+{
+	struct string_list list = STRING_LIST_INIT_NODUP;
+	int i;
+
+	for (i = 0; i < size; i++)
+		string_list_insert(&list, corpus.strings[i]);
+	string_list_clear(&list, 0);
+}
+
+/* strmap.c */
+
+static void run_strset_add(void)
+{
+	struct strset set;
+	int i;
+
+	strset_init(&set, 0);
+	for (i = 0; i < size; i++)
+		strset_add(&set, corpus.strings[i]);
+	strset_clear(&set);
+}
+
+/* object.c */
+
+static void setup_lookup_object(void)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		lookup_blob(corpus.sha1s[i]);
+}
+
+static void run_lookup_object(void)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		if (!lookup_object(corpus.sha1s[i]))
+			die("BUG: %s not found in the object hash",
+			    sha1_to_hex(corpus.sha1s[i]));
+}
+
+/* kwset.c: look for ten of the strings in the text */
+
+static kwset_t bench_kwset;
+
+static void setup_kwset(void)
+{
+	int i;
+
+	bench_kwset = kwsalloc(NULL);
+	for (i = 0; i < 10; i++) {
+		const char *s = corpus.strings[(size - 1) * i / 9];
+		kwsincr(bench_kwset, s, strlen(s));
+	}
+	kwsprep(bench_kwset);
+}
+
+static void run_kwset(void)
+{
+	const char *buf = corpus.text.buf;
+	size_t len = corpus.text.len;
+	struct kwsmatch match;
+	int found = 0;
+
+	for (;;) {
+		size_t offset = kwsexec(bench_kwset, buf, len, &match);
+		if (offset == (size_t)-1)
+			break;
+		found++;
+		offset += match.size[0];
+		buf += offset;
+		len -= offset;
+	}
+	if (found < 10)
+		die("BUG: kwset found only %d of 10 keywords", found);
+}
+
+/* xdiff */
+
+static int discard_hunk(long ob, long on, long nb, long nn, void *data)
+{
+	return 0;
+}
+
+static void run_xdiff(void)
+{
+	mmfile_t a, b;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
+
+	a.ptr = corpus.text.buf;
+	a.size = corpus.text.len;
+	b.ptr = corpus.text2.buf;
+	b.size = corpus.text2.len;
+	memset(&xpp, 0, sizeof(xpp));
+	memset(&xecfg, 0, sizeof(xecfg));
+	memset(&ecb, 0, sizeof(ecb));
+	xecfg.hunk_func = discard_hunk;
+	if (xdi_diff(&a, &b, &xpp, &xecfg, &ecb))
+		die("BUG: xdiff failed");
+}
+
+static struct benchmark {
+	const char *name;
+	void (*setup)(void);
+	void (*run)(void);
+} benchmarks[] = {
+	{ "hashmap-add", setup_hashmap, run_hashmap_add },
+	{ "hashmap-get", setup_hashmap_get, run_hashmap_get },
+	{ "oahashmap-add", setup_hashmap, run_oahashmap_add },
+	{ "oahashmap-get", setup_oahashmap_get, run_oahashmap_get },
+	{ "prio-queue", NULL, run_prio_queue },
+	{ "sha1-array-lookup", setup_sha1_array, run_sha1_array_lookup },
+	{ "oidset-add-contains", NULL, run_oidset_add_contains },
+	{ "string-list-insert", NULL, run_string_list_insert },
+	{ "strset-add", NULL, run_strset_add },
+	{ "lookup-object", setup_lookup_object, run_lookup_object },
+	{ "kwset", setup_kwset, run_kwset },
+	{ "xdiff", NULL, run_xdiff },
+};
+
+static int double_cmp(const void *va, const void *vb)
+{
+	const double *a = va, *b = vb;
+	return *a < *b ? -1 : *a > *b;
+}
+
+static double percentile(const double *sorted, int nr, int p)
+{
+	return sorted[(nr - 1) * p / 100];
+}
+
+static void run_benchmark(const struct benchmark *b)
+{
+	double *ns_per_op = xmalloc(iterations * sizeof(*ns_per_op));
+	double total = 0;
+	int i;
+
+	if (b->setup)
+		b->setup();
+	for (i = 0; i < warmup; i++)
+		b->run();
+	for (i = 0; i < iterations; i++) {
+		uint64_t start = getnanotime();
+		b->run();
+		ns_per_op[i] = (double)(getnanotime() - start) / size;
+		total += ns_per_op[i];
+	}
+	qsort(ns_per_op, iterations, sizeof(*ns_per_op), double_cmp);
+
+	if (porcelain)
+		printf("%s %.2f %.2f %.2f %.2f\n", b->name,
+		       total / iterations,
+		       percentile(ns_per_op, iterations, 50),
+		       percentile(ns_per_op, iterations, 90),
+		       percentile(ns_per_op, iterations, 99));
+	else
+		printf("%-20s %10.2f ns/op  p50 %10.2f  p90 %10.2f  p99 %10.2f\n",
+		       b->name, total / iterations,
+		       percentile(ns_per_op, iterations, 50),
+		       percentile(ns_per_op, iterations, 90),
+		       percentile(ns_per_op, iterations, 99));
+	free(ns_per_op);
+}
+
+static const char * const microbench_usage[] = {
+	"test-microbench [<options>] (--list | --all | <benchmark>...)",
+	NULL
+};
+
+int main(int argc, const char **argv)
+{
+	int list = 0, all = 0;
+	int i, j;
+	struct option options[] = {
+		OPT_INTEGER(0, "size", &size, "operations per iteration"),
+		OPT_INTEGER(0, "iterations", &iterations, "timed iterations"),
+		OPT_INTEGER(0, "warmup", &warmup, "untimed iterations first"),
+		OPT_INTEGER(0, "seed", &seed, "seed of the corpus"),
+		OPT_BOOL(0, "porcelain", &porcelain,
+			 "print name, mean, p50, p90 and p99 in ns/op"),
+		OPT_BOOL(0, "list", &list, "list the benchmarks"),
+		OPT_BOOL(0, "all", &all, "run all benchmarks"),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL, options, microbench_usage, 0);
+	if (list) {
+		for (i = 0; i < ARRAY_SIZE(benchmarks); i++)
+			puts(benchmarks[i].name);
+		return 0;
+	}
+	if (size < 1 || iterations < 1 || warmup < 0 || (!all && !argc))
+		usage_with_options(microbench_usage, options);
+
+	for (i = 0; i < argc; i++) {
+		for (j = 0; j < ARRAY_SIZE(benchmarks); j++)
+			if (!strcmp(argv[i], benchmarks[j].name))
+				break;
+		if (j == ARRAY_SIZE(benchmarks))
+			die("unknown benchmark: %s", argv[i]);
+	}
+
+	generate_corpus();
+	for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		if (!all) {
+			for (j = 0; j < argc; j++)
+				if (!strcmp(argv[j], benchmarks[i].name))
+					break;
+			if (j == argc)
+				continue;
+		}
+		run_benchmark(&benchmarks[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include "cache.h"
+#include "oidset.h"
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return oidcmp(a, b);
+}
+
+int main(int argc, char **argv)
+{
+	struct oidset set = OIDSET_INIT;
+	struct strbuf line = STRBUF_INIT;
+
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		const char *arg;
+		struct object_id oid;
+
+		if (skip_prefix(line.buf, "add ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", oidset_add(&set, &oid));
+		} else if (skip_prefix(line.buf, "contains ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", oidset_contains(&set, &oid));
+		} else if (skip_prefix(line.buf, "remove ", &arg)) {
+			if (get_oid_hex(arg, &oid))
+				die("not a hexadecimal SHA1: %s", arg);
+			printf("%d\n", oidset_remove(&set, &oid));
+		} else if (!strcmp(line.buf, "size"))
+			printf("%u\n", oidset_size(&set));
+		else if (!strcmp(line.buf, "clear"))
+			oidset_clear(&set);
+		else if (!strcmp(line.buf, "iterate")) {
+			/* the order is unspecified; sort to compare */
+			struct oidset_iter iter;
+			const struct object_id *p;
+			struct object_id *all;
+			unsigned int i, nr = 0;
+
+			all = xmalloc(oidset_size(&set) * sizeof(*all));
+			oidset_iter_init(&set, &iter);
+			while ((p = oidset_iter_next(&iter)))
+				oidcpy(&all[nr++], p);
+			qsort(all, nr, sizeof(*all), oid_cmp);
+			for (i = 0; i < nr; i++)
+				puts(oid_to_hex(&all[i]));
+			free(all);
+		} else
+			die("unknown command: %s", line.buf);
+	}
+	oidset_clear(&set);
+	return 0;
+}
@@ -61,6 +61,30 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (!strcmp(argv[1], "arena-twice")) {
+		unsigned char head[20];
+		struct object_arena *arena;
+
+		if (get_sha1("HEAD", head))
+			return 1;
+		printf("1st\n");
+		arena = begin_object_arena();
+		if (!run_revision_walk())
+			return 1;
+		release_object_arena(arena);
+		if (lookup_object(head))
+			return 1;
+		printf("2nd\n");
+		arena = begin_object_arena();
+		if (!run_revision_walk())
+			return 1;
+		release_object_arena(arena);
+		if (lookup_object(head))
+			return 1;
+
+		return 0;
+	}
+
 	fprintf(stderr, "check usage\n");
 	return 1;
 }
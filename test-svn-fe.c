@@ -9,7 +9,7 @@
 #include "vcs-svn/line_buffer.h"
 
 static const char test_svnfe_usage[] =
-	"test-svn-fe (<dumpfile> | [-d] <preimage> <delta> <len>)";
+	"test-svn-fe ([--pipeline=<threads>] <dumpfile> | [-d] <preimage> <delta> <len>)";
 
 static int apply_delta(int argc, char *argv[])
 {
@@ -37,6 +37,13 @@ static int apply_delta(int argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
+	const char *arg;
+
+	if (argc == 3 && skip_prefix(argv[1], "--pipeline=", &arg)) {
+		svndump_pipeline(atoi(arg));
+		argc--;
+		argv++;
+	}
 	if (argc == 2) {
 		if (svndump_init(argv[1]))
 			return 1;
@@ -75,3 +75,154 @@ int init_recursive_mutex(pthread_mutex_t *m)
 	}
 	return ret;
 }
+
+static struct trace_key trace_locks = TRACE_KEY_INIT(LOCKS);
+static int lock_stats = -1;
+
+struct thread_stats {
+	const char *name;
+	int id;
+	uint64_t start;
+	uint64_t lock_wait_ns, idle_ns;
+};
+
+static pthread_key_t thread_stats_key;
+static pthread_once_t thread_stats_once = PTHREAD_ONCE_INIT;
+
+static void init_thread_stats_key(void)
+{
+	pthread_key_create(&thread_stats_key, NULL);
+}
+
+/* Decided by the main thread, before it starts any worker */
+static int want_lock_stats(void)
+{
+	if (lock_stats < 0) {
+		lock_stats = trace_want(&trace_locks);
+		if (lock_stats)
+			pthread_once(&thread_stats_once, init_thread_stats_key);
+	}
+	return lock_stats;
+}
+
+static void add_thread_wait(uint64_t lock_wait_ns, uint64_t idle_ns)
+{
+	struct thread_stats *ts = pthread_getspecific(thread_stats_key);
+
+	if (ts) {
+		ts->lock_wait_ns += lock_wait_ns;
+		ts->idle_ns += idle_ns;
+	}
+}
+
+int traced_mutex_init(struct traced_mutex *m, const char *name,
+		      int recursive)
+{
+	memset(m, 0, sizeof(*m));
+	m->name = name;
+	want_lock_stats();
+	if (recursive)
+		return init_recursive_mutex(&m->mutex);
+	return pthread_mutex_init(&m->mutex, NULL);
+}
+
+void traced_mutex_lock(struct traced_mutex *m)
+{
+	if (lock_stats <= 0) {
+		pthread_mutex_lock(&m->mutex);
+		return;
+	}
+	if (pthread_mutex_trylock(&m->mutex)) {
+		uint64_t start = getnanotime(), waited;
+
+		pthread_mutex_lock(&m->mutex);
+		waited = getnanotime() - start;
+		m->contended++;
+		m->wait_ns += waited;
+		add_thread_wait(waited, 0);
+	}
+	m->acquired++;
+	if (!m->depth++)
+		m->locked_at = getnanotime();
+}
+
+void traced_mutex_unlock(struct traced_mutex *m)
+{
+	if (lock_stats > 0 && !--m->depth)
+		m->hold_ns += getnanotime() - m->locked_at;
+	pthread_mutex_unlock(&m->mutex);
+}
+
+int traced_cond_wait(pthread_cond_t *cond, struct traced_mutex *m)
+{
+	uint64_t start;
+	int depth, ret;
+
+	if (lock_stats <= 0)
+		return pthread_cond_wait(cond, &m->mutex);
+
+	start = getnanotime();
+	m->hold_ns += start - m->locked_at;
+	depth = m->depth;
+	m->depth = 0;
+	ret = pthread_cond_wait(cond, &m->mutex);
+	m->depth = depth;
+	m->locked_at = getnanotime();
+	add_thread_wait(0, m->locked_at - start);
+	return ret;
+}
+
+static double ms(uint64_t ns)
+{
+	return ns / 1000000.0;
+}
+
+void traced_mutex_destroy(struct traced_mutex *m)
+{
+	if (lock_stats > 0)
+		trace_printf_key(&trace_locks,
+				 "lock %s: acquired %lu times, %lu contended,"
+				 " waited %.3f ms, held %.3f ms\n",
+				 m->name, m->acquired, m->contended,
+				 ms(m->wait_ns), ms(m->hold_ns));
+	pthread_mutex_destroy(&m->mutex);
+}
+
+void thread_stats_start(const char *name)
+{
+	static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static int next_id;
+	struct thread_stats *ts;
+
+	if (lock_stats <= 0)
+		return;
+	ts = xcalloc(1, sizeof(*ts));
+	ts->name = name;
+	pthread_mutex_lock(&id_mutex);
+	ts->id = next_id++;
+	pthread_mutex_unlock(&id_mutex);
+	ts->start = getnanotime();
+	pthread_setspecific(thread_stats_key, ts);
+}
+
+void thread_stats_exit(void)
+{
+	struct thread_stats *ts;
+	uint64_t ran, waited;
+
+	if (lock_stats <= 0)
+		return;
+	ts = pthread_getspecific(thread_stats_key);
+	if (!ts)
+		return;
+	ran = getnanotime() - ts->start;
+	waited = ts->lock_wait_ns + ts->idle_ns;
+	trace_printf_key(&trace_locks,
+			 "thread %s/%d: ran %.3f ms, busy %.3f ms,"
+			 " waited for locks %.3f ms, idle %.3f ms\n",
+			 ts->name, ts->id, ms(ran),
+			 ms(ran > waited ? ran - waited : 0),
+			 ms(ts->lock_wait_ns), ms(ts->idle_ns));
+	pthread_setspecific(thread_stats_key, NULL);
+	free(ts);
+}
@@ -7,6 +7,38 @@
 extern int online_cpus(void);
 extern int init_recursive_mutex(pthread_mutex_t*);
 
+/*
+ * A mutex that, when GIT_TRACE_LOCKS is set, counts how often it is
+ * taken and how long threads wait for it and hold it.  The counts are
+ * updated under the mutex itself, and traced_mutex_destroy() reports
+ * them.  Waiting on a condition with traced_cond_wait() is not counted
+ * as holding the mutex, but as idle time of the waiting thread.
+ */
+struct traced_mutex {
+	pthread_mutex_t mutex;
+	const char *name;
+	int depth;
+	uint64_t locked_at;
+	uint64_t wait_ns, hold_ns;
+	unsigned long acquired, contended;
+};
+
+extern int traced_mutex_init(struct traced_mutex *, const char *name,
+			     int recursive);
+extern void traced_mutex_lock(struct traced_mutex *);
+extern void traced_mutex_unlock(struct traced_mutex *);
+extern int traced_cond_wait(pthread_cond_t *, struct traced_mutex *);
+extern void traced_mutex_destroy(struct traced_mutex *);
+
+/*
+ * Called at the start and the end of a worker thread; with
+ * GIT_TRACE_LOCKS, the end reports how long the thread ran, and how
+ * much of that it was busy, waiting for traced mutexes, or idle in
+ * traced_cond_wait().
+ */
+extern void thread_stats_start(const char *name);
+extern void thread_stats_exit(void);
+
 #else
 
 #define online_cpus() 1
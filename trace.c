@@ -24,6 +24,8 @@
 
 #include "cache.h"
 #include "quote.h"
+#include "run-command.h"
+#include "unix-socket.h"
 
 /* Get a trace file descriptor from "key" env variable. */
 static int get_trace_fd(struct trace_key *key)
@@ -48,6 +50,21 @@ static int get_trace_fd(struct trace_key *key)
 		key->fd = STDERR_FILENO;
 	else if (strlen(trace) == 1 && isdigit(*trace))
 		key->fd = atoi(trace);
+#ifndef NO_UNIX_SOCKETS
+	else if (starts_with(trace, "af_unix:")) {
+		int fd = unix_stream_connect(trace + strlen("af_unix:"));
+		if (fd < 0) {
+			fprintf(stderr,
+				"Could not connect to '%s' for tracing: %s\n"
+				"Defaulting to tracing on stderr...\n",
+				trace + strlen("af_unix:"), strerror(errno));
+			key->fd = STDERR_FILENO;
+		} else {
+			key->fd = fd;
+			key->need_close = 1;
+		}
+	}
+#endif
 	else if (is_absolute_path(trace)) {
 		int fd = open(trace, O_WRONLY | O_APPEND | O_CREAT, 0666);
 		if (fd == -1) {
@@ -426,3 +443,335 @@ void trace_command_performance(const char **argv)
 	sq_quote_argv(&command_line, argv, 0);
 	command_start_time = getnanotime();
 }
+
+/*
+ * Structured event tracing.  Every event is written as one line holding
+ * a JSON object to the destination given by GIT_TRACE_EVENT; see
+ * Documentation/technical/api-trace.txt for the events and their fields.
+ */
+static struct trace_key trace_event_key = TRACE_KEY_INIT(EVENT);
+
+#define TRACE_EVENT_MAX_NESTING 32
+
+struct trace_event_context {
+	char name[32];
+	uint64_t start;
+	int nesting;
+	uint64_t region_start[TRACE_EVENT_MAX_NESTING];
+};
+
+static struct trace_event_context main_context = { "main" };
+static struct strbuf trace_event_sid = STRBUF_INIT;
+static uint64_t trace_event_start_time;
+static int trace_event_initialized;
+static int trace_event_child_nr;
+
+#ifndef NO_PTHREADS
+static pthread_key_t trace_event_context_key;
+static pthread_mutex_t trace_event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_event_thread_nr;
+#endif
+
+static void trace_event_exit_atexit(void);
+
+static int trace_event_init(void)
+{
+	const char *parent;
+
+	if (!trace_want(&trace_event_key))
+		return 0;
+	if (trace_event_initialized)
+		return 1;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&trace_event_mutex);
+	if (trace_event_initialized) {
+		pthread_mutex_unlock(&trace_event_mutex);
+		return 1;
+	}
+	pthread_key_create(&trace_event_context_key, NULL);
+#endif
+	trace_event_start_time = main_context.start = getnanotime();
+
+	/*
+	 * The session id of a child process starts with the one of its
+	 * parent, so that events of nested git commands can be grouped.
+	 */
+	parent = getenv("GIT_TRACE_EVENT_PARENT_SID");
+	if (parent && *parent)
+		strbuf_addf(&trace_event_sid, "%s/", parent);
+	strbuf_addf(&trace_event_sid, "%"PRIuMAX"-%"PRIuMAX,
+		    (uintmax_t)getpid(),
+		    (uintmax_t)(trace_event_start_time / 1000));
+	setenv("GIT_TRACE_EVENT_PARENT_SID", trace_event_sid.buf, 1);
+
+	atexit(trace_event_exit_atexit);
+	trace_event_initialized = 1;
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&trace_event_mutex);
+#endif
+	return 1;
+}
+
+static struct trace_event_context *trace_event_context(void)
+{
+#ifndef NO_PTHREADS
+	struct trace_event_context *ctx;
+
+	ctx = pthread_getspecific(trace_event_context_key);
+	if (ctx)
+		return ctx;
+#endif
+	return &main_context;
+}
+
+static void json_quote(struct strbuf *sb, const char *s)
+{
+	strbuf_addch(sb, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+		switch (c) {
+		case '"':
+		case '\\':
+			strbuf_addch(sb, '\\');
+			strbuf_addch(sb, c);
+			break;
+		case '\n':
+			strbuf_addstr(sb, "\\n");
+			break;
+		case '\t':
+			strbuf_addstr(sb, "\\t");
+			break;
+		default:
+			if (c < 0x20)
+				strbuf_addf(sb, "\\u%04x", c);
+			else
+				strbuf_addch(sb, c);
+		}
+	}
+	strbuf_addch(sb, '"');
+}
+
+static void json_quote_argv(struct strbuf *sb, const char **argv)
+{
+	int i;
+
+	strbuf_addch(sb, '[');
+	for (i = 0; argv[i]; i++) {
+		if (i)
+			strbuf_addch(sb, ',');
+		json_quote(sb, argv[i]);
+	}
+	strbuf_addch(sb, ']');
+}
+
+static double trace_event_seconds(uint64_t nanos)
+{
+	return (double)nanos / 1000000000;
+}
+
+/*
+ * Start an event line; the caller appends its own fields (each with a
+ * leading comma) and hands the buffer to trace_event_finish().
+ */
+static void trace_event_begin(struct strbuf *sb, const char *event,
+			      struct trace_event_context *ctx)
+{
+	strbuf_addstr(sb, "{\"event\":");
+	json_quote(sb, event);
+	strbuf_addstr(sb, ",\"sid\":");
+	json_quote(sb, trace_event_sid.buf);
+	strbuf_addstr(sb, ",\"thread\":");
+	json_quote(sb, ctx->name);
+	strbuf_addf(sb, ",\"t\":%.6f",
+		    trace_event_seconds(getnanotime() - trace_event_start_time));
+}
+
+static void trace_event_finish(struct strbuf *sb)
+{
+	strbuf_addstr(sb, "}\n");
+	/* a single write, so that lines from several threads do not mix */
+	write_or_whine_pipe(get_trace_fd(&trace_event_key), sb->buf, sb->len,
+			    "Could not trace into fd given by GIT_TRACE_EVENT");
+	strbuf_release(sb);
+}
+
+int trace_event_want(void)
+{
+	return trace_event_init();
+}
+
+void trace_event_command(const char **argv)
+{
+	struct strbuf sb = STRBUF_INIT;
+	struct timeval tv;
+	struct tm tm;
+	time_t secs;
+
+	if (!trace_event_init())
+		return;
+
+	gettimeofday(&tv, NULL);
+	secs = tv.tv_sec;
+	gmtime_r(&secs, &tm);
+
+	trace_event_begin(&sb, "start", &main_context);
+	strbuf_addf(&sb, ",\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ\"",
+		    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		    tm.tm_hour, tm.tm_min, tm.tm_sec, (long)tv.tv_usec);
+	strbuf_addf(&sb, ",\"pid\":%"PRIuMAX",\"argv\":", (uintmax_t)getpid());
+	json_quote_argv(&sb, argv);
+	trace_event_finish(&sb);
+}
+
+static void trace_event_exit_atexit(void)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	trace_event_begin(&sb, "exit", &main_context);
+	strbuf_addf(&sb, ",\"elapsed\":%.6f",
+		    trace_event_seconds(getnanotime() - trace_event_start_time));
+	trace_event_finish(&sb);
+}
+
+void trace_region_enter(const char *category, const char *label)
+{
+	struct trace_event_context *ctx;
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!trace_event_init())
+		return;
+	ctx = trace_event_context();
+
+	trace_event_begin(&sb, "region_enter", ctx);
+	strbuf_addf(&sb, ",\"nesting\":%d,\"category\":", ctx->nesting + 1);
+	json_quote(&sb, category);
+	strbuf_addstr(&sb, ",\"label\":");
+	json_quote(&sb, label);
+	trace_event_finish(&sb);
+
+	if (ctx->nesting < TRACE_EVENT_MAX_NESTING)
+		ctx->region_start[ctx->nesting] = getnanotime();
+	ctx->nesting++;
+}
+
+void trace_region_leave(const char *category, const char *label)
+{
+	struct trace_event_context *ctx;
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!trace_event_init())
+		return;
+	ctx = trace_event_context();
+	if (!ctx->nesting)
+		die("BUG: trace_region_leave(%s, %s) without a region",
+		    category, label);
+
+	trace_event_begin(&sb, "region_leave", ctx);
+	strbuf_addf(&sb, ",\"nesting\":%d,\"category\":", ctx->nesting);
+	json_quote(&sb, category);
+	strbuf_addstr(&sb, ",\"label\":");
+	json_quote(&sb, label);
+	ctx->nesting--;
+	if (ctx->nesting < TRACE_EVENT_MAX_NESTING)
+		strbuf_addf(&sb, ",\"elapsed\":%.6f",
+			    trace_event_seconds(getnanotime() -
+						ctx->region_start[ctx->nesting]));
+	trace_event_finish(&sb);
+}
+
+void trace_counter(const char *category, const char *name, intmax_t value)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!trace_event_init())
+		return;
+
+	trace_event_begin(&sb, "counter", trace_event_context());
+	strbuf_addstr(&sb, ",\"category\":");
+	json_quote(&sb, category);
+	strbuf_addstr(&sb, ",\"name\":");
+	json_quote(&sb, name);
+	strbuf_addf(&sb, ",\"value\":%"PRIdMAX, value);
+	trace_event_finish(&sb);
+}
+
+void trace_thread_start(const char *name)
+{
+#ifndef NO_PTHREADS
+	struct trace_event_context *ctx;
+	struct strbuf sb = STRBUF_INIT;
+	int nr;
+
+	if (!trace_event_init())
+		return;
+
+	pthread_mutex_lock(&trace_event_mutex);
+	nr = ++trace_event_thread_nr;
+	pthread_mutex_unlock(&trace_event_mutex);
+
+	ctx = xcalloc(1, sizeof(*ctx));
+	snprintf(ctx->name, sizeof(ctx->name), "%s/%d", name, nr);
+	ctx->start = getnanotime();
+	pthread_setspecific(trace_event_context_key, ctx);
+
+	trace_event_begin(&sb, "thread_start", ctx);
+	trace_event_finish(&sb);
+#endif
+}
+
+void trace_thread_exit(void)
+{
+#ifndef NO_PTHREADS
+	struct trace_event_context *ctx;
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!trace_event_init())
+		return;
+	ctx = pthread_getspecific(trace_event_context_key);
+	if (!ctx)
+		return;
+
+	trace_event_begin(&sb, "thread_exit", ctx);
+	strbuf_addf(&sb, ",\"elapsed\":%.6f",
+		    trace_event_seconds(getnanotime() - ctx->start));
+	trace_event_finish(&sb);
+
+	pthread_setspecific(trace_event_context_key, NULL);
+	free(ctx);
+#endif
+}
+
+void trace_child_start(struct child_process *cmd)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!trace_event_init())
+		return;
+
+	cmd->trace_id = ++trace_event_child_nr;
+	cmd->trace_start = getnanotime();
+
+	trace_event_begin(&sb, "child_start", trace_event_context());
+	strbuf_addf(&sb, ",\"child_id\":%d,\"pid\":%"PRIuMAX
+		    ",\"git_cmd\":%s,\"argv\":",
+		    cmd->trace_id, (uintmax_t)cmd->pid,
+		    cmd->git_cmd ? "true" : "false");
+	json_quote_argv(&sb, cmd->argv);
+	trace_event_finish(&sb);
+}
+
+void trace_child_exit(struct child_process *cmd, int code)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	if (!cmd->trace_id || !trace_event_init())
+		return;
+
+	trace_event_begin(&sb, "child_exit", trace_event_context());
+	strbuf_addf(&sb, ",\"child_id\":%d,\"pid\":%"PRIuMAX
+		    ",\"code\":%d,\"elapsed\":%.6f",
+		    cmd->trace_id, (uintmax_t)cmd->pid, code,
+		    trace_event_seconds(getnanotime() - cmd->trace_start));
+	trace_event_finish(&sb);
+}
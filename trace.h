@@ -19,6 +19,31 @@ extern void trace_disable(struct trace_key *key);
 extern uint64_t getnanotime(void);
 extern void trace_command_performance(const char **argv);
 
+/*
+ * Structured event tracing into GIT_TRACE_EVENT, see
+ * Documentation/technical/api-trace.txt.
+ */
+struct child_process;
+extern int trace_event_want(void);
+extern void trace_event_command(const char **argv);
+extern void trace_region_enter(const char *category, const char *label);
+extern void trace_region_leave(const char *category, const char *label);
+extern void trace_counter(const char *category, const char *name,
+			  intmax_t value);
+extern void trace_thread_start(const char *name);
+extern void trace_thread_exit(void);
+extern void trace_child_start(struct child_process *cmd);
+extern void trace_child_exit(struct child_process *cmd, int code);
+
+/*
+ * Memory held by the larger in-core structures, traced to
+ * GIT_TRACE_MEMORY at exit and every GIT_TRACE_MEMORY_INTERVAL seconds
+ * (see memory-usage.c).
+ */
+extern void trace_memory_setup(void);
+extern void trace_memory_sample(void);
+extern void trace_memory_usage(const char *when);
+
 #ifndef HAVE_VARIADIC_MACROS
 
 __attribute__((format (printf, 1, 2)))
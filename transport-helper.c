@@ -28,7 +28,8 @@ struct helper_data {
 		signed_tags : 1,
 		check_connectivity : 1,
 		no_disconnect_req : 1,
-		no_private_update : 1;
+		no_private_update : 1,
+		pipeline : 1;
 	char *export_marks;
 	char *import_marks;
 	/* These go from remote name (as in "list") to private name */
@@ -194,6 +195,8 @@ static struct child_process *get_helper(struct transport *transport)
 			data->import_marks = xstrdup(arg);
 		} else if (starts_with(capname, "no-private-update")) {
 			data->no_private_update = 1;
+		} else if (!strcmp(capname, "pipeline")) {
+			data->pipeline = 1;
 		} else if (mandatory) {
 			die("Unknown mandatory capability %s. This remote "
 			    "helper probably needs newer version of Git.",
@@ -257,15 +260,19 @@ static const char *boolean_options[] = {
 	TRANS_OPT_THIN,
 	TRANS_OPT_KEEP,
 	TRANS_OPT_FOLLOWTAGS,
-	TRANS_OPT_PUSH_CERT
+	TRANS_OPT_PUSH_CERT,
+	TRANS_OPT_NO_DEPENDENTS
 	};
 
-static int set_helper_option(struct transport *transport,
-			  const char *name, const char *value)
+/*
+ * Append the command setting an option to "buf", or return 1 if the
+ * helper cannot be told about it at all.
+ */
+static int add_helper_option(struct transport *transport, struct strbuf *buf,
+			     const char *name, const char *value)
 {
 	struct helper_data *data = transport->data;
-	struct strbuf buf = STRBUF_INIT;
-	int i, ret, is_bool = 0;
+	int i, is_bool = 0;
 
 	get_helper(transport);
 
@@ -284,14 +291,20 @@ static int set_helper_option(struct transport *transport,
 		}
 	}
 
-	strbuf_addf(&buf, "option %s ", name);
+	strbuf_addf(buf, "option %s ", name);
 	if (is_bool)
-		strbuf_addstr(&buf, value ? "true" : "false");
+		strbuf_addstr(buf, value ? "true" : "false");
 	else
-		quote_c_style(value, &buf, NULL, 0);
-	strbuf_addch(&buf, '\n');
+		quote_c_style(value, buf, NULL, 0);
+	strbuf_addch(buf, '\n');
+	return 0;
+}
+
+static int read_option_reply(struct helper_data *data)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
 
-	sendline(data, &buf);
 	if (recvline(data, &buf))
 		exit(128);
 
@@ -309,18 +322,95 @@ static int set_helper_option(struct transport *transport,
 	return ret;
 }
 
+static int set_helper_option(struct transport *transport,
+			  const char *name, const char *value)
+{
+	struct helper_data *data = transport->data;
+	struct strbuf buf = STRBUF_INIT;
+
+	if (add_helper_option(transport, &buf, name, value))
+		return 1;
+	sendline(data, &buf);
+	strbuf_release(&buf);
+	return read_option_reply(data);
+}
+
+struct helper_option {
+	const char *name;
+	const char *value;
+	int ret;	/* as set_helper_option() returns */
+};
+
+/*
+ * Keep the replies to a batch well within what a pipe holds, or the
+ * helper could block writing them while we block writing to it.
+ */
+#define OPTION_BATCH 32
+
+/*
+ * Set the options "opt[0..nr-1]" in order, and then send the command
+ * "then" (if not NULL), whose response is left for the caller to
+ * read.  A helper with the "pipeline" capability is sent the options
+ * in batches, and "then" with the last one, without waiting for the
+ * replies in between.
+ */
+static void set_helper_options(struct transport *transport,
+			       struct helper_option *opt, int nr,
+			       const char *then)
+{
+	struct helper_data *data = transport->data;
+	struct strbuf buf = STRBUF_INIT;
+	int i = 0;
+
+	get_helper(transport);
+	if (!data->pipeline) {
+		for (i = 0; i < nr; i++)
+			opt[i].ret = set_helper_option(transport,
+						       opt[i].name, opt[i].value);
+		if (then)
+			write_constant(data->helper->in, then);
+		return;
+	}
+
+	while (i < nr || then) {
+		int start = i, sent = 0;
+
+		strbuf_reset(&buf);
+		for (; i < nr && sent < OPTION_BATCH; i++) {
+			opt[i].ret = add_helper_option(transport, &buf,
+						       opt[i].name, opt[i].value);
+			if (!opt[i].ret)
+				sent++;
+		}
+		if (i == nr && then) {
+			strbuf_addstr(&buf, then);
+			then = NULL;
+		}
+		if (buf.len)
+			sendline(data, &buf);
+		for (; start < i; start++)
+			if (!opt[start].ret)
+				opt[start].ret = read_option_reply(data);
+	}
+	strbuf_release(&buf);
+}
+
 static void standard_options(struct transport *t)
 {
 	char buf[16];
 	int n;
 	int v = t->verbose;
-
-	set_helper_option(t, "progress", t->progress ? "true" : "false");
+	struct helper_option opt[2];
 
 	n = snprintf(buf, sizeof(buf), "%d", v + 1);
 	if (n >= sizeof(buf))
 		die("impossibly large verbosity value");
-	set_helper_option(t, "verbosity", buf);
+
+	opt[0].name = "progress";
+	opt[0].value = t->progress ? "true" : "false";
+	opt[1].name = "verbosity";
+	opt[1].value = buf;
+	set_helper_options(t, opt, ARRAY_SIZE(opt), NULL);
 }
 
 static int release_helper(struct transport *transport)
@@ -448,11 +538,11 @@ static int fetch_with_import(struct transport *transport,
 
 		strbuf_addf(&buf, "import %s\n",
 			    posn->symref ? posn->symref : posn->name);
-		sendline(data, &buf);
-		strbuf_reset(&buf);
 	}
 
-	write_constant(data->helper->in, "\n");
+	strbuf_addch(&buf, '\n');
+	sendline(data, &buf);
+	strbuf_reset(&buf);
 	/*
 	 * remote-helpers that advertise the bidi-import capability are required to
 	 * buffer the complete batch of import commands until this newline before
@@ -599,7 +689,8 @@ static int fetch(struct transport *transport,
 		 int nr_heads, struct ref **to_fetch)
 {
 	struct helper_data *data = transport->data;
-	int i, count;
+	struct helper_option opt[3];
+	int i, count, nr_opts;
 
 	if (process_connect(transport, 0)) {
 		do_take_over(transport);
@@ -614,15 +705,20 @@ static int fetch(struct transport *transport,
 	if (!count)
 		return 0;
 
+	nr_opts = 0;
 	if (data->check_connectivity &&
 	    data->transport_options.check_self_contained_and_connected)
-		set_helper_option(transport, "check-connectivity", "true");
+		opt[nr_opts++].name = "check-connectivity";
 
 	if (transport->cloning)
-		set_helper_option(transport, "cloning", "true");
+		opt[nr_opts++].name = "cloning";
 
 	if (data->transport_options.update_shallow)
-		set_helper_option(transport, "update-shallow", "true");
+		opt[nr_opts++].name = "update-shallow";
+
+	for (i = 0; i < nr_opts; i++)
+		opt[i].value = "true";
+	set_helper_options(transport, opt, nr_opts, NULL);
 
 	if (data->fetch)
 		return fetch_with_fetch(transport, nr_heads, to_fetch);
@@ -773,6 +869,8 @@ static int push_refs_with_push(struct transport *transport,
 	struct ref *ref;
 	struct string_list cas_options = STRING_LIST_INIT_DUP;
 	struct string_list_item *cas_option;
+	struct helper_option *opt;
+	int nr_opts = 0;
 
 	get_helper(transport);
 	if (!data->push)
@@ -828,16 +926,26 @@ static int push_refs_with_push(struct transport *transport,
 		return 0;
 	}
 
-	for_each_string_list_item(cas_option, &cas_options)
-		set_helper_option(transport, "cas", cas_option->string);
-
-	if (flags & TRANSPORT_PUSH_DRY_RUN) {
-		if (set_helper_option(transport, "dry-run", "true") != 0)
+	opt = xcalloc(cas_options.nr + 1, sizeof(*opt));
+	for_each_string_list_item(cas_option, &cas_options) {
+		opt[nr_opts].name = "cas";
+		opt[nr_opts++].value = cas_option->string;
+	}
+	if (flags & TRANSPORT_PUSH_DRY_RUN)
+		opt[nr_opts++].name = "dry-run";
+	else if (flags & TRANSPORT_PUSH_CERT)
+		opt[nr_opts++].name = TRANS_OPT_PUSH_CERT;
+	if (nr_opts > cas_options.nr)
+		opt[nr_opts - 1].value = "true";
+	set_helper_options(transport, opt, nr_opts, NULL);
+
+	if (nr_opts > cas_options.nr && opt[nr_opts - 1].ret) {
+		if (flags & TRANSPORT_PUSH_DRY_RUN)
 			die("helper %s does not support dry-run", data->name);
-	} else if (flags & TRANSPORT_PUSH_CERT) {
-		if (set_helper_option(transport, TRANS_OPT_PUSH_CERT, "true") != 0)
-			die("helper %s does not support --signed", data->name);
+		die("helper %s does not support --signed", data->name);
 	}
+	free(opt);
+	string_list_clear(&cas_options, 0);
 
 	strbuf_addch(&buf, '\n');
 	sendline(data, &buf);
@@ -854,23 +962,33 @@ static int push_refs_with_export(struct transport *transport,
 	struct helper_data *data = transport->data;
 	struct string_list revlist_args = STRING_LIST_INIT_DUP;
 	struct strbuf buf = STRBUF_INIT;
+	struct helper_option opt[2];
+	int i, nr_opts = 0;
 
 	if (!data->refspecs)
 		die("remote-helper doesn't support push; refspec needed");
 
-	if (flags & TRANSPORT_PUSH_DRY_RUN) {
-		if (set_helper_option(transport, "dry-run", "true") != 0)
+	if (flags & TRANSPORT_PUSH_DRY_RUN)
+		opt[nr_opts++].name = "dry-run";
+	else if (flags & TRANSPORT_PUSH_CERT)
+		opt[nr_opts++].name = TRANS_OPT_PUSH_CERT;
+	if (flags & TRANSPORT_PUSH_FORCE)
+		opt[nr_opts++].name = "force";
+	for (i = 0; i < nr_opts; i++)
+		opt[i].value = "true";
+	set_helper_options(transport, opt, nr_opts, NULL);
+
+	for (i = 0; i < nr_opts; i++) {
+		if (!opt[i].ret)
+			continue;
+		if (!strcmp(opt[i].name, "force"))
+			warning("helper %s does not support 'force'", data->name);
+		else if (flags & TRANSPORT_PUSH_DRY_RUN)
 			die("helper %s does not support dry-run", data->name);
-	} else if (flags & TRANSPORT_PUSH_CERT) {
-		if (set_helper_option(transport, TRANS_OPT_PUSH_CERT, "true") != 0)
+		else
 			die("helper %s does not support --signed", data->name);
 	}
 
-	if (flags & TRANSPORT_PUSH_FORCE) {
-		if (set_helper_option(transport, "force", "true") != 0)
-			warning("helper %s does not support 'force'", data->name);
-	}
-
 	helper = get_helper(transport);
 
 	write_constant(helper->in, "export\n");
@@ -975,7 +1093,8 @@ static int has_attribute(const char *attrs, const char *attr) {
 	}
 }
 
-static struct ref *get_refs_list(struct transport *transport, int for_push)
+static struct ref *get_refs_list(struct transport *transport, int for_push,
+				 const struct argv_array *ref_prefixes)
 {
 	struct helper_data *data = transport->data;
 	struct child_process *helper;
@@ -983,18 +1102,39 @@ static struct ref *get_refs_list(struct transport *transport, int for_push)
 	struct ref **tail = &ret;
 	struct ref *posn;
 	struct strbuf buf = STRBUF_INIT;
+	const char *list;
+	int i;
 
 	helper = get_helper(transport);
 
 	if (process_connect(transport, for_push)) {
 		do_take_over(transport);
-		return transport->get_refs_list(transport, for_push);
+		return transport->get_refs_list(transport, for_push,
+						ref_prefixes);
 	}
 
-	if (data->push && for_push)
-		write_str_in_full(helper->in, "list for-push\n");
-	else
-		write_str_in_full(helper->in, "list\n");
+	list = data->push && for_push ? "list for-push\n" : "list\n";
+	if (for_push || !ref_prefixes)
+		write_constant(helper->in, list);
+	else if (data->pipeline) {
+		/* Send the whole ref-prefix list along with "list". */
+		struct helper_option *opt;
+
+		opt = xcalloc(ref_prefixes->argc, sizeof(*opt));
+		for (i = 0; i < ref_prefixes->argc; i++) {
+			opt[i].name = "ref-prefix";
+			opt[i].value = ref_prefixes->argv[i];
+		}
+		set_helper_options(transport, opt, ref_prefixes->argc, list);
+		free(opt);
+	} else {
+		/* A helper that does not know the option lists all refs. */
+		for (i = 0; i < ref_prefixes->argc; i++)
+			if (set_helper_option(transport, "ref-prefix",
+					      ref_prefixes->argv[i]))
+				break;
+		write_constant(helper->in, list);
+	}
 
 	while (1) {
 		char *eov, *eon;
@@ -1108,6 +1248,8 @@ struct unidirectional_transfer {
 	int state;
 	/* Buffer. */
 	char buf[BUFFERSIZE];
+	/* Start of the data not yet written. */
+	size_t bufpos;
 	/* Buffer used. */
 	size_t bufuse;
 	/* Name of source. */
@@ -1136,12 +1278,22 @@ static void udt_close_if_finished(struct unidirectional_transfer *t)
 static int udt_do_read(struct unidirectional_transfer *t)
 {
 	ssize_t bytes;
+	size_t end = t->bufpos + t->bufuse;
 
 	if (t->bufuse == BUFFERSIZE)
 		return 0;	/* No space for more. */
+	if (end == BUFFERSIZE) {
+		/*
+		 * Only move what is left over to the front once
+		 * there is no room after it.
+		 */
+		memmove(t->buf, t->buf + t->bufpos, t->bufuse);
+		t->bufpos = 0;
+		end = t->bufuse;
+	}
 
 	transfer_debug("%s is readable", t->src_name);
-	bytes = read(t->src, t->buf + t->bufuse, BUFFERSIZE - t->bufuse);
+	bytes = read(t->src, t->buf + end, BUFFERSIZE - end);
 	if (bytes < 0 && errno != EWOULDBLOCK && errno != EAGAIN &&
 		errno != EINTR) {
 		error("read(%s) failed: %s", t->src_name, strerror(errno));
@@ -1169,14 +1321,13 @@ static int udt_do_write(struct unidirectional_transfer *t)
 		return 0;	/* Nothing to write. */
 
 	transfer_debug("%s is writable", t->dest_name);
-	bytes = xwrite(t->dest, t->buf, t->bufuse);
+	bytes = xwrite(t->dest, t->buf + t->bufpos, t->bufuse);
 	if (bytes < 0 && errno != EWOULDBLOCK) {
 		error("write(%s) failed: %s", t->dest_name, strerror(errno));
 		return -1;
 	} else if (bytes > 0) {
 		t->bufuse -= bytes;
-		if (t->bufuse)
-			memmove(t->buf, t->buf + bytes, t->bufuse);
+		t->bufpos = t->bufuse ? t->bufpos + bytes : 0;
 		transfer_debug("Wrote %i bytes to %s (buffer now at %i)",
 			(int)bytes, t->dest_name, (int)t->bufuse);
 	}
@@ -1348,6 +1499,7 @@ int bidirectional_transfer_loop(int input, int output)
 	state.ptg.src_is_sock = (input == output);
 	state.ptg.dest_is_sock = 0;
 	state.ptg.state = SSTATE_TRANSFERING;
+	state.ptg.bufpos = 0;
 	state.ptg.bufuse = 0;
 	state.ptg.src_name = "remote input";
 	state.ptg.dest_name = "stdout";
@@ -1357,6 +1509,7 @@ int bidirectional_transfer_loop(int input, int output)
 	state.gtp.src_is_sock = 0;
 	state.gtp.dest_is_sock = (input == output);
 	state.gtp.state = SSTATE_TRANSFERING;
+	state.gtp.bufpos = 0;
 	state.gtp.bufuse = 0;
 	state.gtp.src_name = "stdin";
 	state.gtp.dest_name = "remote output";
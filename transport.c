@@ -198,7 +198,8 @@ static const char *rsync_url(const char *url)
 	return url;
 }
 
-static struct ref *get_refs_via_rsync(struct transport *transport, int for_push)
+static struct ref *get_refs_via_rsync(struct transport *transport, int for_push,
+				      const struct argv_array *ref_prefixes)
 {
 	struct strbuf buf = STRBUF_INIT, temp_dir = STRBUF_INIT;
 	struct ref dummy = {NULL}, *tail = &dummy;
@@ -395,7 +396,8 @@ struct bundle_transport_data {
 	struct bundle_header header;
 };
 
-static struct ref *get_refs_from_bundle(struct transport *transport, int for_push)
+static struct ref *get_refs_from_bundle(struct transport *transport, int for_push,
+					const struct argv_array *ref_prefixes)
 {
 	struct bundle_transport_data *data = transport->data;
 	struct ref *result = NULL;
@@ -441,6 +443,7 @@ struct git_transport_data {
 	struct child_process *conn;
 	int fd[2];
 	unsigned got_remote_heads : 1;
+	unsigned protocol_v2 : 1;
 	struct sha1_array extra_have;
 	struct sha1_array shallow;
 };
@@ -479,6 +482,15 @@ static int set_git_option(struct git_transport_options *opts,
 	} else if (!strcmp(name, TRANS_OPT_PUSH_CERT)) {
 		opts->push_cert = !!value;
 		return 0;
+	} else if (!strcmp(name, TRANS_OPT_LIST_OBJECTS_FILTER)) {
+		if (!value)
+			list_objects_filter_release(&opts->filter_options);
+		else if (parse_list_objects_filter(&opts->filter_options, value))
+			die("transport: invalid filter option '%s'", value);
+		return 0;
+	} else if (!strcmp(name, TRANS_OPT_NO_DEPENDENTS)) {
+		opts->no_dependents = !!value;
+		return 0;
 	}
 	return 1;
 }
@@ -486,19 +498,25 @@ static int set_git_option(struct git_transport_options *opts,
 static int connect_setup(struct transport *transport, int for_push, int verbose)
 {
 	struct git_transport_data *data = transport->data;
+	int flags = 0;
 
 	if (data->conn)
 		return 0;
 
+	if (verbose)
+		flags |= CONNECT_VERBOSE;
+	if (!for_push && get_protocol_version_config() == protocol_v2)
+		flags |= CONNECT_PROTOCOL_V2;
 	data->conn = git_connect(data->fd, transport->url,
 				 for_push ? data->options.receivepack :
 				 data->options.uploadpack,
-				 verbose ? CONNECT_VERBOSE : 0);
+				 flags);
 
 	return 0;
 }
 
-static struct ref *get_refs_via_connect(struct transport *transport, int for_push)
+static struct ref *get_refs_via_connect(struct transport *transport, int for_push,
+					const struct argv_array *ref_prefixes)
 {
 	struct git_transport_data *data = transport->data;
 	struct ref *refs;
@@ -508,6 +526,9 @@ static struct ref *get_refs_via_connect(struct transport *transport, int for_pus
 			 for_push ? REF_NORMAL : 0,
 			 &data->extra_have,
 			 &data->shallow);
+	data->protocol_v2 = server_protocol_version() == protocol_v2;
+	if (data->protocol_v2)
+		ls_refs_v2(data->fd, &refs, 0, ref_prefixes, &data->shallow);
 	data->got_remote_heads = 1;
 
 	return refs;
@@ -536,13 +557,27 @@ static int fetch_refs_via_pack(struct transport *transport,
 		data->options.check_self_contained_and_connected;
 	args.cloning = transport->cloning;
 	args.update_shallow = data->options.update_shallow;
+	args.no_dependents = data->options.no_dependents;
+	args.filter_options = data->options.filter_options;
 
 	if (!data->got_remote_heads) {
 		connect_setup(transport, 0, 0);
 		get_remote_heads(data->fd[0], NULL, 0, &refs_tmp, 0,
 				 NULL, &data->shallow);
+		data->protocol_v2 = server_protocol_version() == protocol_v2;
+		if (data->protocol_v2) {
+			struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+			int i;
+
+			for (i = 0; i < nr_heads; i++)
+				argv_array_push(&ref_prefixes, to_fetch[i]->name);
+			ls_refs_v2(data->fd, &refs_tmp, 0, &ref_prefixes,
+				   &data->shallow);
+			argv_array_clear(&ref_prefixes);
+		}
 		data->got_remote_heads = 1;
 	}
+	args.protocol_v2 = data->protocol_v2;
 
 	refs = fetch_pack(&args, data->fd, data->conn,
 			  refs_tmp ? refs_tmp : transport->remote_refs,
@@ -809,6 +844,7 @@ static int git_transport_push(struct transport *transport, struct ref *remote_re
 {
 	struct git_transport_data *data = transport->data;
 	struct send_pack_args args;
+	int push_negotiate = 0;
 	int ret;
 
 	if (!data->got_remote_heads) {
@@ -832,6 +868,8 @@ static int git_transport_push(struct transport *transport, struct ref *remote_re
 	args.push_cert = !!(flags & TRANSPORT_PUSH_CERT);
 	args.atomic = !!(flags & TRANSPORT_PUSH_ATOMIC);
 	args.url = transport->url;
+	git_config_get_bool("push.negotiate", &push_negotiate);
+	args.push_negotiate = push_negotiate;
 
 	ret = send_pack(&args, data->fd, data->conn, remote_refs,
 			&data->extra_have);
@@ -1140,7 +1178,7 @@ int transport_push(struct transport *transport,
 		if (check_push_refs(local_refs, refspec_nr, refspec) < 0)
 			return -1;
 
-		remote_refs = transport->get_refs_list(transport, 1);
+		remote_refs = transport->get_refs_list(transport, 1, NULL);
 
 		if (flags & TRANSPORT_PUSH_ALL)
 			match_flags |= MATCH_REFS_ALL;
@@ -1219,10 +1257,12 @@ int transport_push(struct transport *transport,
 	return 1;
 }
 
-const struct ref *transport_get_remote_refs(struct transport *transport)
+const struct ref *transport_get_remote_refs(struct transport *transport,
+					     const struct argv_array *ref_prefixes)
 {
 	if (!transport->got_remote_refs) {
-		transport->remote_refs = transport->get_refs_list(transport, 0);
+		transport->remote_refs =
+			transport->get_refs_list(transport, 0, ref_prefixes);
 		transport->got_remote_refs = 1;
 	}
 
@@ -1371,7 +1411,7 @@ static int refs_from_alternate_cb(struct alternate_object_database *e,
 	other[len - 8] = '\0';
 	remote = remote_get(other);
 	transport = transport_get(remote, other);
-	for (extra = transport_get_remote_refs(transport);
+	for (extra = transport_get_remote_refs(transport, NULL);
 	     extra;
 	     extra = extra->next)
 		cb->fn(extra, cb->data);
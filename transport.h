@@ -4,6 +4,7 @@
 #include "cache.h"
 #include "run-command.h"
 #include "remote.h"
+#include "list-objects-filter.h"
 
 struct git_transport_options {
 	unsigned thin : 1;
@@ -13,10 +14,12 @@ struct git_transport_options {
 	unsigned self_contained_and_connected : 1;
 	unsigned update_shallow : 1;
 	unsigned push_cert : 1;
+	unsigned no_dependents : 1;
 	int depth;
 	const char *uploadpack;
 	const char *receivepack;
 	struct push_cas_option *cas;
+	struct list_objects_filter_options filter_options;
 };
 
 struct transport {
@@ -59,8 +62,13 @@ struct transport {
 	 * If the transport is able to determine the remote hash for
 	 * the ref without a huge amount of effort, it should store it
 	 * in the ref's old_sha1 field; otherwise it should be all 0.
+	 *
+	 * ref_prefixes, if not NULL or empty, says that only the refs
+	 * whose names begin with one of them are of interest; a
+	 * transport may return the others all the same.
 	 **/
-	struct ref *(*get_refs_list)(struct transport *transport, int for_push);
+	struct ref *(*get_refs_list)(struct transport *transport, int for_push,
+				     const struct argv_array *ref_prefixes);
 
 	/**
 	 * Fetch the objects for the given refs. Note that this gets
@@ -162,6 +170,18 @@ struct transport *transport_get(struct remote *, const char *);
 /* Send push certificates */
 #define TRANS_OPT_PUSH_CERT "pushcert"
 
+/*
+ * Leave out the objects the <filter-spec> names (see
+ * list-objects-filter.h) if the server supports it
+ */
+#define TRANS_OPT_LIST_OBJECTS_FILTER "filter"
+
+/*
+ * Fetch only the objects asked for, without negotiating what we
+ * have; for fetching missing objects into a partial clone
+ */
+#define TRANS_OPT_NO_DEPENDENTS "no-dependents"
+
 /**
  * Returns 0 if the option was used, non-zero otherwise. Prints a
  * message to stderr if the option is not used.
@@ -181,7 +201,13 @@ int transport_push(struct transport *connection,
 		   int refspec_nr, const char **refspec, int flags,
 		   unsigned int * reject_reasons);
 
-const struct ref *transport_get_remote_refs(struct transport *transport);
+/*
+ * Get the refs of the remote, which the transport caches: the
+ * ref_prefixes of the first call (see get_refs_list above) apply to
+ * all later ones.
+ */
+const struct ref *transport_get_remote_refs(struct transport *transport,
+					    const struct argv_array *ref_prefixes);
 
 int transport_fetch_refs(struct transport *transport, struct ref *refs);
 void transport_unlock_pack(struct transport *transport);
@@ -4,6 +4,7 @@
 #include "dir.h"
 #include "tree.h"
 #include "pathspec.h"
+#include "hashmap.h"
 
 static const char *get_mode(const char *str, unsigned int *modep)
 {
@@ -49,15 +50,109 @@ void init_tree_desc(struct tree_desc *desc, const void *buffer, unsigned long si
 		decode_tree_entry(desc, buffer, size);
 }
 
+/*
+ * The trees fill_tree_descriptor() read, most recently used first, up
+ * to core.treeCacheLimit bytes of them: a walk over several trees, or
+ * a command walking several times (a merge, a checkout after it), sees
+ * the same subtrees again and again.
+ */
+struct tree_cache_entry {
+	struct hashmap_entry ent;
+	struct tree_cache_entry *prev, *next;
+	unsigned char sha1[20];
+	unsigned long size;
+	void *buf;
+};
+
+static struct hashmap tree_cache;
+static struct tree_cache_entry tree_cache_lru = {
+	{ NULL }, &tree_cache_lru, &tree_cache_lru
+};
+static size_t tree_cache_size;
+
+static int tree_cache_cmp(const struct tree_cache_entry *e1,
+			  const struct tree_cache_entry *e2,
+			  const unsigned char *sha1)
+{
+	return hashcmp(e1->sha1, sha1 ? sha1 : e2->sha1);
+}
+
+static void tree_cache_unlink(struct tree_cache_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+}
+
+static void tree_cache_link(struct tree_cache_entry *e)
+{
+	e->next = tree_cache_lru.next;
+	e->prev = &tree_cache_lru;
+	e->next->prev = e;
+	tree_cache_lru.next = e;
+}
+
+static struct tree_cache_entry *tree_cache_get(const unsigned char *sha1)
+{
+	struct tree_cache_entry key, *e;
+
+	if (!tree_cache.tablesize)
+		return NULL;
+	hashmap_entry_init(&key, sha1hash(sha1));
+	e = hashmap_get(&tree_cache, &key, sha1);
+	if (e) {
+		tree_cache_unlink(e);
+		tree_cache_link(e);
+	}
+	return e;
+}
+
+static void tree_cache_put(const unsigned char *sha1,
+			   const void *buf, unsigned long size)
+{
+	struct tree_cache_entry *e;
+
+	if (size > tree_cache_limit / 4)
+		return;
+	if (!tree_cache.tablesize)
+		hashmap_init(&tree_cache, (hashmap_cmp_fn)tree_cache_cmp, 0);
+
+	while (tree_cache_size + size > tree_cache_limit) {
+		e = tree_cache_lru.prev;
+		tree_cache_unlink(e);
+		hashmap_remove(&tree_cache, e, NULL);
+		tree_cache_size -= e->size;
+		free(e->buf);
+		free(e);
+	}
+
+	e = xmalloc(sizeof(*e));
+	hashmap_entry_init(e, sha1hash(sha1));
+	hashcpy(e->sha1, sha1);
+	e->buf = xmemdupz(buf, size);
+	e->size = size;
+	hashmap_add(&tree_cache, e);
+	tree_cache_link(e);
+	tree_cache_size += size;
+}
+
 void *fill_tree_descriptor(struct tree_desc *desc, const unsigned char *sha1)
 {
 	unsigned long size = 0;
 	void *buf = NULL;
 
 	if (sha1) {
-		buf = read_object_with_reference(sha1, tree_type, &size, NULL);
-		if (!buf)
-			die("unable to read tree %s", sha1_to_hex(sha1));
+		struct tree_cache_entry *e = tree_cache_get(sha1);
+
+		if (e) {
+			size = e->size;
+			buf = xmemdupz(e->buf, size);
+		} else {
+			buf = read_object_with_reference(sha1, tree_type,
+							 &size, NULL);
+			if (!buf)
+				die("unable to read tree %s", sha1_to_hex(sha1));
+			tree_cache_put(sha1, buf, size);
+		}
 	}
 	init_tree_desc(desc, buf, size);
 	return buf;
@@ -852,6 +947,137 @@ static int match_wildcard_base(const struct pathspec_item *item,
 	return entry_interesting;
 }
 
+/* Compare a path of the lookup with "key". */
+static int lookup_cmp(const struct pathspec_lookup_path *path,
+		      const char *key, int keylen)
+{
+	int cmp = memcmp(path->match, key,
+			 path->len < keylen ? path->len : keylen);
+
+	return cmp ? cmp : path->len - keylen;
+}
+
+/* The first path in [begin, end) that does not sort before "key". */
+static int lookup_find(const struct pathspec_lookup *lookup,
+		       int begin, int end, const char *key, int keylen)
+{
+	while (begin < end) {
+		int mid = begin + (end - begin) / 2;
+		if (lookup_cmp(&lookup->paths[mid], key, keylen) < 0)
+			begin = mid + 1;
+		else
+			end = mid;
+	}
+	return begin;
+}
+
+static int lookup_has(const struct pathspec_lookup *lookup,
+		      int begin, int end, const char *key, int keylen)
+{
+	int i = lookup_find(lookup, begin, end, key, keylen);
+
+	return i < end && !lookup_cmp(&lookup->paths[i], key, keylen);
+}
+
+static int lookup_has_prefix(const struct pathspec_lookup *lookup,
+			     int i, int end, const char *key, int keylen)
+{
+	return i < end && lookup->paths[i].len >= keylen &&
+		!memcmp(lookup->paths[i].match, key, keylen);
+}
+
+/*
+ * Find the paths that the entries of directory "base" (ending with a
+ * slash unless empty) can match: those inside it form the run
+ * [begin, end).  Also note whether some path is the directory itself
+ * or one of its parents.
+ */
+static void lookup_set_base(struct pathspec_lookup *lookup,
+			    const char *base, int baselen)
+{
+	int i, lo, hi;
+
+	strbuf_reset(&lookup->base);
+	strbuf_add(&lookup->base, base, baselen);
+
+	lookup->base_has_parent = lookup_has(lookup, 0, lookup->nr, base, 0);
+	for (i = 0; i < baselen && !lookup->base_has_parent; i++)
+		if (base[i] == '/')
+			lookup->base_has_parent =
+				lookup_has(lookup, 0, lookup->nr, base, i) ||
+				lookup_has(lookup, 0, lookup->nr, base, i + 1);
+
+	lookup->begin = lookup_find(lookup, 0, lookup->nr, base, baselen);
+	lo = lookup->begin;
+	hi = lookup->nr;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (lookup_has_prefix(lookup, mid, hi, base, baselen))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	lookup->end = lo;
+}
+
+/*
+ * do_match() for a pathspec made of plain paths, bisecting the sorted
+ * paths instead of trying each of them in turn.  Returns 0 when the
+ * answer depends on which of several matching paths comes first in
+ * the pathspec, i.e. when one of them is the directory being walked
+ * or one of its parents; do_match() has to try them in order then.
+ */
+static int match_lookup(struct pathspec_lookup *lookup,
+			const struct name_entry *entry, int pathlen,
+			struct strbuf *base, int base_offset,
+			enum interesting *result)
+{
+	int baselen = base->len - base_offset;
+	const char *key;
+	int i, keylen, begin, end;
+
+	if (lookup->begin < 0 || lookup->base.len != baselen ||
+	    memcmp(lookup->base.buf, base->buf + base_offset, baselen))
+		lookup_set_base(lookup, base->buf + base_offset, baselen);
+	if (lookup->base_has_parent)
+		return 0;
+	begin = lookup->begin;
+	end = lookup->end;
+
+	strbuf_add(base, entry->path, pathlen);
+	key = base->buf + base_offset;
+	keylen = baselen + pathlen;
+
+	/* the entry itself, or a directory leading to a path */
+	i = lookup_find(lookup, begin, end, key, keylen);
+	if (i < end && !lookup_cmp(&lookup->paths[i], key, keylen))
+		*result = entry_interesting;
+	else if (S_ISDIR(entry->mode) || S_ISGITLINK(entry->mode)) {
+		strbuf_addch(base, '/');
+		key = base->buf + base_offset;
+		i = lookup_find(lookup, i, end, key, keylen + 1);
+		*result = lookup_has_prefix(lookup, i, end, key, keylen + 1) ?
+			entry_interesting : all_entries_not_interesting;
+	} else
+		*result = all_entries_not_interesting;
+
+	/*
+	 * As in match_entry(), later entries can only match if some
+	 * path sorts after this one, or is a prefix of its name.
+	 */
+	if (*result == all_entries_not_interesting && begin < end) {
+		if (lookup_cmp(&lookup->paths[end - 1], key, keylen) >= 0)
+			*result = entry_not_interesting;
+		for (i = 1; i < pathlen &&
+			    *result == all_entries_not_interesting; i++)
+			if (lookup_has(lookup, begin, end, key, baselen + i))
+				*result = entry_not_interesting;
+	}
+
+	strbuf_setlen(base, base_offset + baselen);
+	return 1;
+}
+
 /*
  * Is a tree entry interesting given the pathspec we have?
  *
@@ -867,6 +1093,7 @@ static enum interesting do_match(const struct name_entry *entry,
 	int pathlen, baselen = base->len - base_offset;
 	enum interesting never_interesting = ps->has_wildcard ?
 		entry_not_interesting : all_entries_not_interesting;
+	struct pathspec_lookup *lookup;
 
 	GUARD_PATHSPEC(ps,
 		       PATHSPEC_FROMTOP |
@@ -889,6 +1116,11 @@ static enum interesting do_match(const struct name_entry *entry,
 
 	pathlen = tree_entry_len(entry);
 
+	lookup = exclude ? NULL : get_pathspec_lookup(ps);
+	if (lookup && match_lookup(lookup, entry, pathlen, base, base_offset,
+				   &never_interesting))
+		return never_interesting;
+
 	for (i = ps->nr - 1; i >= 0; i--) {
 		const struct pathspec_item *item = ps->items+i;
 		const char *match = item->match;
@@ -4,11 +4,15 @@
 #include "tree.h"
 #include "tree-walk.h"
 #include "cache-tree.h"
+#include "pathspec.h"
 #include "unpack-trees.h"
 #include "progress.h"
 #include "refs.h"
 #include "attr.h"
 #include "split-index.h"
+#include "parallel-checkout.h"
+#include "fetch-object.h"
+#include "sha1-array.h"
 #include "dir.h"
 
 /*
@@ -185,14 +189,41 @@ static void unlink_entry(const struct cache_entry *ce)
 }
 
 static struct checkout state;
+/*
+ * In a partial clone, fetch the blobs about to be checked out that we
+ * do not have in one go, instead of one at a time as each is read.
+ */
+static void prefetch_missing_blobs(struct index_state *index)
+{
+	struct sha1_array to_fetch = SHA1_ARRAY_INIT;
+	int i;
+
+	if (!repository_format_partial_clone || !fetch_if_missing)
+		return;
+	for (i = 0; i < index->cache_nr; i++) {
+		const struct cache_entry *ce = index->cache[i];
+
+		if (!(ce->ce_flags & CE_UPDATE) || S_ISGITLINK(ce->ce_mode))
+			continue;
+		if (!has_sha1_file(ce->sha1))
+			sha1_array_append(&to_fetch, ce->sha1);
+	}
+	fetch_objects(repository_format_partial_clone, &to_fetch);
+	sha1_array_clear(&to_fetch);
+}
+
 static int check_updates(struct unpack_trees_options *o)
 {
 	unsigned cnt = 0, total = 0;
+	unsigned removed = 0, updated = 0;
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	int i;
 	int errs = 0;
 
+	if (o->update)
+		trace_region_enter("unpack_trees", "update worktree");
+
 	if (o->update && o->verbose_update) {
 		for (total = cnt = 0; cnt < index->cache_nr; cnt++) {
 			const struct cache_entry *ce = index->cache[cnt];
@@ -212,6 +243,7 @@ static int check_updates(struct unpack_trees_options *o)
 
 		if (ce->ce_flags & CE_WT_REMOVE) {
 			display_progress(progress, ++cnt);
+			removed++;
 			if (o->update && !o->dry_run)
 				unlink_entry(ce);
 			continue;
@@ -220,20 +252,35 @@ static int check_updates(struct unpack_trees_options *o)
 	remove_marked_cache_entries(&o->result);
 	remove_scheduled_dirs();
 
+	if (o->update && !o->dry_run) {
+		prefetch_missing_blobs(index);
+		init_parallel_checkout();
+		enable_delayed_checkout(&state);
+	}
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
 		if (ce->ce_flags & CE_UPDATE) {
 			display_progress(progress, ++cnt);
+			updated++;
 			ce->ce_flags &= ~CE_UPDATE;
 			if (o->update && !o->dry_run) {
 				errs |= checkout_entry(ce, &state, NULL);
 			}
 		}
 	}
+	if (o->update && !o->dry_run) {
+		errs |= run_parallel_checkout(&state);
+		errs |= finish_delayed_checkout(&state);
+	}
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
+	if (o->update) {
+		trace_counter("unpack_trees", "removed", removed);
+		trace_counter("unpack_trees", "updated", updated);
+		trace_region_leave("unpack_trees", "update worktree");
+	}
 	return errs != 0;
 }
 
@@ -446,17 +493,213 @@ static int switch_cache_bottom(struct traverse_info *info)
 	return ret;
 }
 
+/*
+ * When every tree has the same directory and the cache-tree of the
+ * index says that the index has exactly that directory, too, return
+ * the number of index entries under it, which are then what all the
+ * trees would give us.  Return 0 otherwise.
+ */
+static int all_trees_same_as_cache_tree(int n, unsigned long dirmask,
+					struct name_entry *names,
+					struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	int i;
+
+	if (!o->merge || dirmask != ((1ul << n) - 1))
+		return 0;
+	if (info->pathspec && info->pathspec->nr)
+		return 0;
+	for (i = 1; i < n; i++)
+		if (hashcmp(names[i].sha1, names[0].sha1))
+			return 0;
+	return cache_tree_matches_traversal(o->src_index->cache_tree,
+					    names, info);
+}
+
+/*
+ * Find the index entries of the directory "names" names, checking that
+ * they are the "nr" plain entries the cache-tree promised.
+ */
+static int index_pos_by_traverse_info(int nr, struct name_entry *names,
+				      struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	struct index_state *index = o->src_index;
+	int len = traverse_path_len(info, names);
+	char *name = xmalloc(len + 2);
+	int pos, i;
+
+	make_traverse_path(name, info, names);
+	name[len++] = '/';
+	name[len] = '\0';
+	pos = index_name_pos(index, name, len);
+	if (pos >= 0 || (pos = -pos - 1) + nr > index->cache_nr)
+		pos = -1;
+	for (i = 0; pos >= 0 && i < nr; i++) {
+		const struct cache_entry *ce = index->cache[pos + i];
+
+		if (ce_stage(ce) ||
+		    (ce->ce_flags & (CE_INTENT_TO_ADD | CE_UNPACKED)) ||
+		    ce_namelen(ce) <= len || memcmp(ce->name, name, len))
+			pos = -1;
+	}
+	free(name);
+	return pos;
+}
+
+/*
+ * Do what unpack_callback() would do for each entry of a directory
+ * that all the trees and the index have the same, without reading
+ * any of the trees: the entries of the trees are those of the index.
+ */
+static int traverse_by_cache_tree(int pos, int nr_entries, int n,
+				  struct traverse_info *info)
+{
+	struct cache_entry *src[MAX_UNPACK_TREES + 1] = { NULL, };
+	struct unpack_trees_options *o = info->data;
+	struct cache_entry *tree_ce = NULL;
+	int ce_len = 0;
+	int i, d;
+
+	for (i = 0; i < nr_entries; i++) {
+		int len, rc;
+
+		src[0] = o->src_index->cache[pos + i];
+		len = ce_namelen(src[0]);
+		if (cache_entry_size(len) > ce_len) {
+			ce_len = cache_entry_size(len) * 2;
+			free(tree_ce);
+			tree_ce = xcalloc(1, ce_len);
+			for (d = 1; d <= n; d++)
+				src[d] = tree_ce;
+		}
+		tree_ce->ce_mode = src[0]->ce_mode;
+		tree_ce->ce_flags = create_ce_flags(0);
+		tree_ce->ce_namelen = len;
+		hashcpy(tree_ce->sha1, src[0]->sha1);
+		memcpy(tree_ce->name, src[0]->name, len + 1);
+
+		rc = call_unpack_fn((const struct cache_entry * const *)src, o);
+		if (rc < 0) {
+			free(tree_ce);
+			return rc;
+		}
+		mark_ce_used(src[0], o);
+	}
+	free(tree_ce);
+	if (o->debug_unpack)
+		printf("Unpacked %d entries from %s to %s using cache-tree\n",
+		       nr_entries, o->src_index->cache[pos]->name,
+		       o->src_index->cache[pos + nr_entries - 1]->name);
+	return 0;
+}
+
+/*
+ * A two-way merge keeps whatever the index has under a directory that
+ * is the same tree in the old and the new commit (cases 4, 5, 14 and
+ * 15, and a staged deletion stays deleted), so there is no need to
+ * look at the trees or call the merge function for each entry.  Return
+ * the position of the entries under the directory, storing how many
+ * there are in "nr", or -1 if they have to go through twoway_merge()
+ * one by one after all.
+ */
+static int twoway_same_directory(int n, unsigned long dirmask,
+				 struct name_entry *names,
+				 struct traverse_info *info, int *nr)
+{
+	struct unpack_trees_options *o = info->data;
+	struct index_state *index = o->src_index;
+	int len, pos, i;
+	char *name;
+
+	if (o->fn != twoway_merge || n != 2 || dirmask != 3 ||
+	    o->initial_checkout || hashcmp(names[0].sha1, names[1].sha1))
+		return -1;
+	if (info->pathspec && info->pathspec->nr)
+		return -1;
+
+	len = traverse_path_len(info, names);
+	name = xmalloc(len + 2);
+	make_traverse_path(name, info, names);
+	name[len++] = '/';
+	name[len] = '\0';
+	pos = index_name_pos(index, name, len);
+	if (pos >= 0) {
+		free(name);
+		return -1;
+	}
+	pos = -pos - 1;
+	for (i = pos; i < index->cache_nr; i++) {
+		const struct cache_entry *ce = index->cache[i];
+
+		if (ce_namelen(ce) <= len || memcmp(ce->name, name, len))
+			break;
+		if (ce_stage(ce) || (ce->ce_flags & CE_UNPACKED)) {
+			pos = -1;
+			break;
+		}
+	}
+	free(name);
+	*nr = pos < 0 ? 0 : i - pos;
+	return pos;
+}
+
+static void keep_index_range(int pos, int nr, struct traverse_info *info)
+{
+	struct unpack_trees_options *o = info->data;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct cache_entry *ce = o->src_index->cache[pos + i];
+
+		add_entry(o, ce, 0, 0);
+		mark_ce_used(ce, o);
+	}
+}
+
 static int traverse_trees_recursive(int n, unsigned long dirmask,
 				    unsigned long df_conflicts,
 				    struct name_entry *names,
 				    struct traverse_info *info)
 {
-	int i, ret, bottom;
+	struct unpack_trees_options *o = info->data;
+	const unsigned char *prev_sha1 = NULL;
+	int i, ret, bottom, nr_entries;
 	struct tree_desc t[MAX_UNPACK_TREES];
 	void *buf[MAX_UNPACK_TREES];
 	struct traverse_info newinfo;
 	struct name_entry *p;
 
+	if (!df_conflicts) {
+		int pos = twoway_same_directory(n, dirmask, names, info,
+						&nr_entries);
+
+		if (pos >= 0) {
+			bottom = o->cache_bottom;
+			keep_index_range(pos, nr_entries, info);
+			o->cache_bottom = bottom;
+			return 0;
+		}
+	}
+
+	nr_entries = all_trees_same_as_cache_tree(n, dirmask, names, info);
+	if (nr_entries > 0 && !df_conflicts) {
+		int pos = index_pos_by_traverse_info(nr_entries, names, info);
+
+		if (pos >= 0) {
+			/*
+			 * The entries before "pos" have all been
+			 * unpacked by now, but keep cache_bottom as it
+			 * was to be safe.
+			 */
+			bottom = o->cache_bottom;
+			ret = traverse_by_cache_tree(pos, nr_entries, n, info);
+			o->cache_bottom = bottom;
+			return ret;
+		}
+	}
+
 	p = names;
 	while (!p->mode)
 		p++;
@@ -472,7 +715,13 @@ static int traverse_trees_recursive(int n, unsigned long dirmask,
 		const unsigned char *sha1 = NULL;
 		if (dirmask & 1)
 			sha1 = names[i].sha1;
-		buf[i] = fill_tree_descriptor(t+i, sha1);
+		/* the same tree as the previous one can share its buffer */
+		if (i && sha1 && prev_sha1 && !hashcmp(sha1, prev_sha1)) {
+			t[i] = t[i - 1];
+			buf[i] = NULL;
+		} else
+			buf[i] = fill_tree_descriptor(t+i, sha1);
+		prev_sha1 = sha1;
 	}
 
 	bottom = switch_cache_bottom(&newinfo);
@@ -9,11 +9,19 @@
 #include "diff.h"
 #include "revision.h"
 #include "list-objects.h"
+#include "list-objects-filter.h"
 #include "run-command.h"
 #include "connect.h"
 #include "sigchain.h"
 #include "version.h"
 #include "string-list.h"
+#include "pack.h"
+#include "pack-bitmap.h"
+#include "protocol.h"
+#include "argv-array.h"
+#include "lockfile.h"
+#include "ref-snapshot.h"
+#include "audit-log.h"
 
 static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
 
@@ -33,13 +41,23 @@ static unsigned long oldest_have;
 
 static int multi_ack;
 static int no_done;
+/* the client hangs up after the negotiation instead of saying "done" */
+static int negotiate_only;
 static int use_thin_pack, use_ofs_delta, use_include_tag;
 static int no_progress, daemon_mode;
 /* Allow specifying sha1 if it is a ref tip. */
 #define ALLOW_TIP_SHA1	01
 /* Allow request of a sha1 if it is reachable from a ref (possibly hidden ref). */
 #define ALLOW_REACHABLE_SHA1	02
+/* Allow request of any sha1. Implies ALLOW_TIP_SHA1 and ALLOW_REACHABLE_SHA1. */
+#define ALLOW_ANY_SHA1	07
 static unsigned int allow_unadvertised_object_request;
+static int allow_filter;
+static struct list_objects_filter_options filter_options;
+/* uploadpack.packfileURI is set, so some packs may be offloaded */
+static int allow_packfile_uris;
+/* the URI protocols the client can download packs over */
+static struct string_list uri_protocols = STRING_LIST_INIT_DUP;
 static int shallow_nr;
 static struct object_array have_obj;
 static struct object_array want_obj;
@@ -50,8 +68,43 @@ static int keepalive = 5;
  * otherwise maximum packet size (up to 65520 bytes).
  */
 static int use_sideband;
+static int use_sideband_bulk;
 static int advertise_refs;
 static int stateless_rpc;
+static int use_bitmap_negotiation = 1;
+/* transfer.refSnapshot: advertise the refs from $GIT_DIR/ref-snapshot */
+static int use_ref_snapshot;
+/* the values of uploadpack.packfileURI, which shape the pack we send */
+static struct string_list packfile_uris = STRING_LIST_INIT_DUP;
+/* uploadpack.bundleURI: bundles a cloning client may start from */
+static struct string_list bundle_uris = STRING_LIST_INIT_DUP;
+
+/*
+ * uploadpack.packCache: a directory keeping the packs we sent, named
+ * after a hash of everything that went into pack-objects, so that a
+ * request identical to an earlier one (say, a fleet of CI machines
+ * fetching the same new commit) is answered from disk.
+ */
+static const char *pack_cache_dir;
+static unsigned long pack_cache_size = 1024 * 1024 * 1024;
+static struct lock_file pack_cache_lock;
+static int pack_cache_fd = -1;
+
+/*
+ * For each entry of want_obj, the objects reachable from it according to
+ * the bitmap index, and how many entries of have_obj were checked
+ * against them.
+ */
+/* For the audit log */
+static unsigned int refs_advertised, haves_received, negotiation_rounds;
+static uintmax_t pack_bytes_sent;
+static const char *pack_cache_result;
+static struct strbuf pack_stats = STRBUF_INIT;
+
+static struct want_bitmap {
+	struct bitmap *reachable;
+	int haves_checked;
+} *want_bitmaps;
 
 static void reset_timeout(void)
 {
@@ -60,6 +113,10 @@ static void reset_timeout(void)
 
 static ssize_t send_client_data(int fd, const char *data, ssize_t sz)
 {
+	if (fd == 1)
+		pack_bytes_sent += sz;
+	if (use_sideband_bulk && fd == 1 && sz > use_sideband - 5)
+		return send_sideband_bulk(1, data, sz);
 	if (use_sideband)
 		return send_sideband(1, fd, data, sz, use_sideband);
 	if (fd == 3)
@@ -76,71 +133,362 @@ static ssize_t send_client_data(int fd, const char *data, ssize_t sz)
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct string_list *shallows = cb_data;
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		string_list_append(shallows, oid_to_hex(&graft->oid));
 	return 0;
 }
 
+static void add_sorted_objects(struct strbuf *out, const char *prefix,
+			       struct string_list *list)
+{
+	int i;
+
+	string_list_sort(list);
+	for (i = 0; i < list->nr; i++)
+		strbuf_addf(out, "%s%s\n", prefix, list->items[i].string);
+	string_list_clear(list, 0);
+}
+
+/*
+ * The input of pack-objects, with every list sorted so that requests
+ * that only differ in the order of their lines look the same to the
+ * pack cache.
+ */
+static void pack_objects_input(struct strbuf *input)
+{
+	struct string_list list = STRING_LIST_INIT_DUP;
+	int i;
+
+	if (shallow_nr) {
+		for_each_commit_graft(write_one_shallow, &list);
+		add_sorted_objects(input, "--shallow ", &list);
+	}
+	for (i = 0; i < want_obj.nr; i++)
+		string_list_append(&list,
+				   sha1_to_hex(want_obj.objects[i].item->sha1));
+	add_sorted_objects(input, "", &list);
+	strbuf_addstr(input, "--not\n");
+	for (i = 0; i < have_obj.nr; i++)
+		string_list_append(&list,
+				   sha1_to_hex(have_obj.objects[i].item->sha1));
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		string_list_append(&list,
+				   sha1_to_hex(extra_edge_obj.objects[i].item->sha1));
+	add_sorted_objects(input, "", &list);
+	strbuf_addch(input, '\n');
+}
+
+static int hash_tag_ref(const char *refname, const struct object_id *oid,
+			int flag, void *cb_data)
+{
+	git_SHA_CTX *ctx = cb_data;
+
+	git_SHA1_Update(ctx, refname, strlen(refname) + 1);
+	git_SHA1_Update(ctx, oid->hash, GIT_SHA1_RAWSZ);
+	return 0;
+}
+
+/*
+ * The pack only depends on the command line and input of
+ * pack-objects, except that --include-tag looks at our tags and
+ * --uri-protocol at uploadpack.packfileURI.  Progress output does not
+ * go into the cached pack.
+ */
+static void pack_cache_key(struct argv_array *args, struct strbuf *input,
+			   unsigned char *key)
+{
+	git_SHA_CTX ctx;
+	int i;
+
+	git_SHA1_Init(&ctx);
+	for (i = 0; i < args->argc; i++)
+		if (strcmp(args->argv[i], "--progress"))
+			git_SHA1_Update(&ctx, args->argv[i],
+					strlen(args->argv[i]) + 1);
+	git_SHA1_Update(&ctx, "", 1);
+	git_SHA1_Update(&ctx, input->buf, input->len);
+	if (use_include_tag)
+		for_each_tag_ref(hash_tag_ref, &ctx);
+	if (uri_protocols.nr)
+		for (i = 0; i < packfile_uris.nr; i++)
+			git_SHA1_Update(&ctx, packfile_uris.items[i].string,
+					strlen(packfile_uris.items[i].string) + 1);
+	git_SHA1_Final(key, &ctx);
+}
+
+/*
+ * Read whatever else "fd" has for us without blocking, so that a bulk
+ * frame carries as much as we can give it.
+ */
+static ssize_t read_available(int fd, char *buf, size_t len)
+{
+	ssize_t got = 0;
+#ifdef FIONREAD
+	int avail;
+
+	while (len && !ioctl(fd, FIONREAD, &avail) && avail > 0) {
+		ssize_t n = xread(fd, buf + got, (size_t)avail < len ? avail : len);
+		if (n <= 0)
+			break;
+		got += n;
+		len -= n;
+	}
+#endif
+	return got;
+}
+
+static void send_cached_pack(int fd, const char *path)
+{
+	size_t data_size = use_sideband_bulk ? SIDEBAND_BULK_MAX : 8192;
+	char *data = xmalloc(data_size);
+	ssize_t sz;
+
+	/* the cache is evicted least recently used first */
+	utime(path, NULL);
+	while ((sz = read_in_full(fd, data, data_size)) > 0) {
+		reset_timeout();
+		send_client_data(1, data, sz);
+	}
+	if (sz < 0)
+		die_errno("git upload-pack: unable to read cached pack '%s'",
+			  path);
+	close(fd);
+	free(data);
+	if (use_sideband)
+		packet_flush(1);
+}
+
+/*
+ * A lock on a cached pack that has not been written to for this long
+ * is assumed to have been left behind by a dead upload-pack.
+ */
+#define PACK_CACHE_STALE_LOCK 60
+
+/*
+ * Send the cached pack for "key" if there is one and return 1.
+ * Otherwise return 0, after taking the lock to write the pack into
+ * the cache as we produce it (pack_cache_fd) if we can.  If another
+ * upload-pack is already producing the same pack, wait for it rather
+ * than producing it a second time.
+ */
+static int use_pack_cache(const unsigned char *key)
+{
+	const char *path = mkpath("%s/%s.pack", pack_cache_dir,
+				  sha1_to_hex(key));
+	unsigned long waited = 0;
+	int fd;
+
+	if (mkdir(pack_cache_dir, 0777) && errno != EEXIST) {
+		warning("unable to create pack cache '%s': %s",
+			pack_cache_dir, strerror(errno));
+		return 0;
+	}
+
+	while (1) {
+		struct stat st;
+
+		fd = open(path, O_RDONLY);
+		if (fd >= 0) {
+			pack_cache_result = "hit";
+			send_cached_pack(fd, path);
+			return 1;
+		}
+		pack_cache_fd = hold_lock_file_for_update(&pack_cache_lock,
+							  path, 0);
+		if (pack_cache_fd >= 0)
+			break;
+		if (errno != EEXIST ||
+		    stat(mkpath("%s.lock", path), &st) ||
+		    time(NULL) - st.st_mtime > PACK_CACHE_STALE_LOCK)
+			return 0;
+
+		sleep_millisec(100);
+		waited += 100;
+		if (keepalive > 0 && use_sideband &&
+		    waited >= 1000 * keepalive) {
+			static const char buf[] = "0005\1";
+			write_or_die(1, buf, 5);
+			waited = 0;
+		}
+	}
+
+	/* someone may have finished it while we were taking the lock */
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		rollback_lock_file(&pack_cache_lock);
+		pack_cache_fd = -1;
+		send_cached_pack(fd, path);
+		return 1;
+	}
+	return 0;
+}
+
+static void write_pack_cache(const char *data, ssize_t sz)
+{
+	if (pack_cache_fd < 0)
+		return;
+	if (write_in_full(pack_cache_fd, data, sz) != sz) {
+		warning("unable to write to pack cache: %s", strerror(errno));
+		rollback_lock_file(&pack_cache_lock);
+		pack_cache_fd = -1;
+	}
+}
+
+struct cached_pack {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int cached_pack_cmp(const void *a_, const void *b_)
+{
+	const struct cached_pack *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/* Remove the least recently used packs until the cache fits again. */
+static void prune_pack_cache(void)
+{
+	struct cached_pack *packs = NULL;
+	int nr = 0, alloc = 0, i;
+	uint64_t total = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(pack_cache_dir);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		char *path;
+		struct stat st;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		path = xstrfmt("%s/%s", pack_cache_dir, de->d_name);
+		if (stat(path, &st)) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = path;
+		packs[nr].mtime = st.st_mtime;
+		packs[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(packs, nr, sizeof(*packs), cached_pack_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_size && !unlink(packs[i].path))
+			total -= packs[i].size;
+		free(packs[i].path);
+	}
+	free(packs);
+}
+
+static void finish_pack_cache(void)
+{
+	if (pack_cache_fd < 0)
+		return;
+	pack_cache_fd = -1;
+	if (commit_lock_file(&pack_cache_lock)) {
+		warning("unable to store pack in cache: %s", strerror(errno));
+		return;
+	}
+	prune_pack_cache();
+}
+
 static void create_pack_file(void)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
-	char data[8193], progress[128];
+	char *data, progress[128];
+	size_t data_size;
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
+	struct strbuf input = STRBUF_INIT;
 	int buffered = -1;
+	int stats_pipe[2] = { -1, -1 };
 	ssize_t sz;
-	const char *argv[13];
-	int i, arg = 0;
-	FILE *pipe_fd;
+	int i;
 
-	if (shallow_nr) {
-		argv[arg++] = "--shallow-file";
-		argv[arg++] = "";
-	}
-	argv[arg++] = "pack-objects";
-	argv[arg++] = "--revs";
-	if (use_thin_pack)
-		argv[arg++] = "--thin";
+	if (shallow_nr)
+		argv_array_pushl(&pack_objects.args, "--shallow-file", "", NULL);
+	argv_array_pushl(&pack_objects.args, "pack-objects", "--revs", NULL);
+	/*
+	 * A filtering client may well lack the objects a thin pack
+	 * would delta against.
+	 */
+	if (use_thin_pack && !filter_options.choice)
+		argv_array_push(&pack_objects.args, "--thin");
 
-	argv[arg++] = "--stdout";
+	argv_array_push(&pack_objects.args, "--stdout");
 	if (shallow_nr)
-		argv[arg++] = "--shallow";
+		argv_array_push(&pack_objects.args, "--shallow");
 	if (!no_progress)
-		argv[arg++] = "--progress";
+		argv_array_push(&pack_objects.args, "--progress");
 	if (use_ofs_delta)
-		argv[arg++] = "--delta-base-offset";
+		argv_array_push(&pack_objects.args, "--delta-base-offset");
 	if (use_include_tag)
-		argv[arg++] = "--include-tag";
-	argv[arg++] = NULL;
+		argv_array_push(&pack_objects.args, "--include-tag");
+	if (filter_options.choice)
+		argv_array_pushf(&pack_objects.args, "--filter=%s",
+				 filter_options.filter_spec);
+	/*
+	 * pack-objects then starts its output with the URIs of the
+	 * offloaded packs, which we pass on with the pack data.
+	 */
+	for (i = 0; i < uri_protocols.nr; i++)
+		argv_array_pushf(&pack_objects.args, "--uri-protocol=%s",
+				 uri_protocols.items[i].string);
+
+	pack_objects_input(&input);
+	if (pack_cache_dir) {
+		unsigned char key[20];
+
+		pack_cache_key(&pack_objects.args, &input, key);
+		if (use_pack_cache(key)) {
+			argv_array_clear(&pack_objects.args);
+			strbuf_release(&input);
+			return;
+		}
+		pack_cache_result = "miss";
+	}
+	if (audit_log_enabled() && !pipe(stats_pipe))
+		argv_array_pushf(&pack_objects.args, "--stats-fd=%d",
+				 stats_pipe[1]);
 
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
 	pack_objects.git_cmd = 1;
-	pack_objects.argv = argv;
 
 	if (start_command(&pack_objects))
 		die("git upload-pack: unable to fork git-pack-objects");
+	if (stats_pipe[1] >= 0)
+		close(stats_pipe[1]);
 
-	pipe_fd = xfdopen(pack_objects.in, "w");
-
-	if (shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
+	/*
+	 * Bulk frames are only as large as what we get from a single
+	 * read, so ask for a pipe that can hold a whole frame.
+	 */
+	data_size = 8193;
+	if (use_sideband_bulk) {
+		data_size = SIDEBAND_BULK_MAX + 1;
+#ifdef F_SETPIPE_SZ
+		fcntl(pack_objects.out, F_SETPIPE_SZ, SIDEBAND_BULK_MAX);
+#endif
+	}
+	data = xmalloc(data_size);
 
-	for (i = 0; i < want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			sha1_to_hex(want_obj.objects[i].item->sha1));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			sha1_to_hex(have_obj.objects[i].item->sha1));
-	for (i = 0; i < extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			sha1_to_hex(extra_edge_obj.objects[i].item->sha1));
-	fprintf(pipe_fd, "\n");
-	fflush(pipe_fd);
-	fclose(pipe_fd);
+	if (write_in_full(pack_objects.in, input.buf, input.len) != input.len)
+		die_errno("git upload-pack: unable to feed git-pack-objects");
+	close(pack_objects.in);
+	strbuf_release(&input);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -217,8 +565,11 @@ static void create_pack_file(void)
 				outsz++;
 			}
 			sz = xread(pack_objects.out, cp,
-				  sizeof(data) - outsz);
-			if (0 < sz)
+				  data_size - outsz);
+			if (0 < sz && use_sideband_bulk)
+				sz += read_available(pack_objects.out, cp + sz,
+						     data_size - outsz - sz);
+			else if (0 < sz)
 				;
 			else if (sz == 0) {
 				close(pack_objects.out);
@@ -236,6 +587,7 @@ static void create_pack_file(void)
 			sz = send_client_data(1, data, sz);
 			if (sz < 0)
 				goto fail;
+			write_pack_cache(data, sz);
 		}
 
 		/*
@@ -258,6 +610,11 @@ static void create_pack_file(void)
 		error("git upload-pack: git-pack-objects died with error.");
 		goto fail;
 	}
+	if (stats_pipe[0] >= 0) {
+		strbuf_read(&pack_stats, stats_pipe[0], 0);
+		strbuf_trim(&pack_stats);
+		close(stats_pipe[0]);
+	}
 
 	/* flush the data */
 	if (0 <= buffered) {
@@ -265,10 +622,13 @@ static void create_pack_file(void)
 		sz = send_client_data(1, data, 1);
 		if (sz < 0)
 			goto fail;
+		write_pack_cache(data, 1);
 		fprintf(stderr, "flushed.\n");
 	}
+	finish_pack_cache();
 	if (use_sideband)
 		packet_flush(1);
+	free(data);
 	return;
 
  fail:
@@ -344,6 +704,61 @@ static int reachable(struct commit *want)
 	return (want->object.flags & COMMON_KNOWN);
 }
 
+static int bitmap_has_commit_or_parent(struct bitmap *reachable,
+				       struct object *o)
+{
+	struct commit_list *parents;
+
+	if (bitmap_has_sha1(reachable, o->sha1))
+		return 1;
+	if (o->type != OBJ_COMMIT)
+		return 0;
+	/* got_sha1() counts the parents of a "have" as common, too */
+	for (parents = ((struct commit *)o)->parents; parents; parents = parents->next)
+		if (bitmap_has_sha1(reachable, parents->item->object.sha1))
+			return 1;
+	return 0;
+}
+
+/*
+ * Like reachable(), but answer from the bitmap index, which only needs
+ * a few membership tests per new "have" instead of a walk.  Returns -1
+ * if there is no usable bitmap index.
+ */
+static int bitmap_reachable(int nr, struct commit *want)
+{
+	struct want_bitmap *wb;
+
+	if (!use_bitmap_negotiation)
+		return -1;
+	if (!want_bitmaps) {
+		if (!bitmap_usable()) {
+			use_bitmap_negotiation = 0;
+			return -1;
+		}
+		want_bitmaps = xcalloc(want_obj.nr, sizeof(*want_bitmaps));
+	}
+	wb = &want_bitmaps[nr];
+
+	if (!wb->reachable) {
+		wb->reachable = bitmap_for_reachable(&want->object);
+		if (!wb->reachable) {
+			use_bitmap_negotiation = 0;
+			return -1;
+		}
+	}
+
+	for (; wb->haves_checked < have_obj.nr; wb->haves_checked++) {
+		struct object *have = have_obj.objects[wb->haves_checked].item;
+
+		if (bitmap_has_commit_or_parent(wb->reachable, have)) {
+			want->object.flags |= COMMON_KNOWN;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static int ok_to_give_up(void)
 {
 	int i;
@@ -366,6 +781,12 @@ static int ok_to_give_up(void)
 			want_obj.objects[i].item->flags |= COMMON_KNOWN;
 			continue;
 		}
+		switch (bitmap_reachable(i, (struct commit *)want)) {
+		case 1:
+			continue;
+		case 0:
+			return 0;
+		}
 		if (!reachable((struct commit *)want))
 			return 0;
 	}
@@ -379,11 +800,22 @@ static int get_common_commits(void)
 	int got_common = 0;
 	int got_other = 0;
 	int sent_ready = 0;
+	int round_haves = 0;
 
 	save_commit_buffer = 0;
 
 	for (;;) {
-		char *line = packet_read_line(0, NULL);
+		char *line;
+		int len = packet_read(0, NULL, NULL,
+				      packet_buffer, sizeof(packet_buffer),
+				      PACKET_READ_CHOMP_NEWLINE |
+				      (negotiate_only ? PACKET_READ_GENTLE_ON_EOF : 0));
+
+		if (len < 0) {
+			audit_log_status("ok");
+			exit(0);
+		}
+		line = len ? packet_buffer : NULL;
 		reset_timeout();
 
 		if (!line) {
@@ -395,17 +827,23 @@ static int get_common_commits(void)
 			if (have_obj.nr == 0 || multi_ack)
 				packet_write(1, "NAK\n");
 
+			negotiation_rounds++;
+			round_haves = 0;
 			if (no_done && sent_ready) {
 				packet_write(1, "ACK %s\n", last_hex);
 				return 0;
 			}
-			if (stateless_rpc)
+			if (stateless_rpc) {
+				audit_log_status("ok");
 				exit(0);
+			}
 			got_common = 0;
 			got_other = 0;
 			continue;
 		}
 		if (starts_with(line, "have ")) {
+			haves_received++;
+			round_haves++;
 			switch (got_sha1(line+5, sha1)) {
 			case -1: /* they have what we do not */
 				got_other = 1;
@@ -432,6 +870,8 @@ static int get_common_commits(void)
 			continue;
 		}
 		if (!strcmp(line, "done")) {
+			if (round_haves)
+				negotiation_rounds++;
 			if (have_obj.nr > 0) {
 				if (multi_ack)
 					packet_write(1, "ACK %s\n", last_hex);
@@ -545,6 +985,7 @@ static void receive_needs(void)
 	struct object_array shallows = OBJECT_ARRAY_INIT;
 	int depth = 0;
 	int has_non_tip = 0;
+	const char *arg;
 
 	shallow_nr = 0;
 	for (;;) {
@@ -579,6 +1020,17 @@ static void receive_needs(void)
 				die("Invalid deepen: %s", line);
 			continue;
 		}
+		if (allow_filter && skip_prefix(line, "filter ", &arg)) {
+			if (parse_list_objects_filter(&filter_options, arg))
+				die("git upload-pack: invalid filter: %s", arg);
+			continue;
+		}
+		if (allow_packfile_uris &&
+		    skip_prefix(line, "packfile-uris ", &arg)) {
+			string_list_clear(&uri_protocols, 0);
+			string_list_split(&uri_protocols, arg, ',', -1);
+			continue;
+		}
 		if (!starts_with(line, "want ") ||
 		    get_sha1_hex(line+5, sha1_buf))
 			die("git upload-pack: protocol error, "
@@ -592,6 +1044,8 @@ static void receive_needs(void)
 			multi_ack = 1;
 		if (parse_feature_request(features, "no-done"))
 			no_done = 1;
+		if (parse_feature_request(features, "negotiate-only"))
+			negotiate_only = 1;
 		if (parse_feature_request(features, "thin-pack"))
 			use_thin_pack = 1;
 		if (parse_feature_request(features, "ofs-delta"))
@@ -600,6 +1054,9 @@ static void receive_needs(void)
 			use_sideband = LARGE_PACKET_MAX;
 		else if (parse_feature_request(features, "side-band"))
 			use_sideband = DEFAULT_PACKET_MAX;
+		if (use_sideband == LARGE_PACKET_MAX &&
+		    parse_feature_request(features, "side-band-bulk"))
+			use_sideband_bulk = 1;
 		if (parse_feature_request(features, "no-progress"))
 			no_progress = 1;
 		if (parse_feature_request(features, "include-tag"))
@@ -624,7 +1081,8 @@ static void receive_needs(void)
 	 * have been based on the set of older refs advertised
 	 * by another process that handled the initial request.
 	 */
-	if (has_non_tip)
+	if (has_non_tip &&
+	    (allow_unadvertised_object_request & ALLOW_ANY_SHA1) != ALLOW_ANY_SHA1)
 		check_non_tip();
 
 	if (!use_sideband && daemon_mode)
@@ -719,23 +1177,23 @@ static void format_symref_info(struct strbuf *buf, struct string_list *symref)
 		strbuf_addf(buf, " symref=%s:%s", item->string, (char *)item->util);
 }
 
-static int send_ref(const char *refname, const struct object_id *oid,
-		    int flag, void *cb_data)
+static const char fetch_capabilities[] = "multi_ack thin-pack side-band"
+	" side-band-64k side-band-bulk ofs-delta shallow no-progress"
+	" include-tag multi_ack_detailed negotiate-only";
+
+static void send_ref_line(const char *refname, const struct object_id *oid,
+			  const struct object_id *peeled,
+			  struct string_list *symref)
 {
-	static const char *capabilities = "multi_ack thin-pack side-band"
-		" side-band-64k ofs-delta shallow no-progress"
-		" include-tag multi_ack_detailed";
+	static const char *capabilities = fetch_capabilities;
 	const char *refname_nons = strip_namespace(refname);
-	struct object_id peeled;
-
-	if (mark_our_ref(refname, oid))
-		return 0;
 
+	refs_advertised++;
 	if (capabilities) {
 		struct strbuf symref_info = STRBUF_INIT;
 
-		format_symref_info(&symref_info, cb_data);
-		packet_write(1, "%s %s%c%s%s%s%s%s agent=%s\n",
+		format_symref_info(&symref_info, symref);
+		packet_write(1, "%s %s%c%s%s%s%s%s%s%s agent=%s\n",
 			     oid_to_hex(oid), refname_nons,
 			     0, capabilities,
 			     (allow_unadvertised_object_request & ALLOW_TIP_SHA1) ?
@@ -743,6 +1201,8 @@ static int send_ref(const char *refname, const struct object_id *oid,
 			     (allow_unadvertised_object_request & ALLOW_REACHABLE_SHA1) ?
 				     " allow-reachable-sha1-in-want" : "",
 			     stateless_rpc ? " no-done" : "",
+			     allow_filter ? " filter" : "",
+			     allow_packfile_uris ? " packfile-uris" : "",
 			     symref_info.buf,
 			     git_user_agent_sanitized());
 		strbuf_release(&symref_info);
@@ -750,8 +1210,46 @@ static int send_ref(const char *refname, const struct object_id *oid,
 		packet_write(1, "%s %s\n", oid_to_hex(oid), refname_nons);
 	}
 	capabilities = NULL;
-	if (!peel_ref(refname, peeled.hash))
-		packet_write(1, "%s %s^{}\n", oid_to_hex(&peeled), refname_nons);
+	if (peeled)
+		packet_write(1, "%s %s^{}\n", oid_to_hex(peeled), refname_nons);
+}
+
+static int send_ref(const char *refname, const struct object_id *oid,
+		    int flag, void *cb_data)
+{
+	struct object_id peeled;
+
+	if (mark_our_ref(refname, oid))
+		return 0;
+	send_ref_line(refname, oid,
+		      peel_ref(refname, peeled.hash) ? NULL : &peeled,
+		      cb_data);
+	return 0;
+}
+
+static int send_snapshot_ref(const char *refname, const struct object_id *oid,
+			     const struct object_id *peeled,
+			     const char *symref_target, void *cb_data)
+{
+	if (!mark_our_ref(refname, oid))
+		send_ref_line(refname, oid, peeled, cb_data);
+	return 0;
+}
+
+static int check_snapshot_ref(const char *refname, const struct object_id *oid,
+			      const struct object_id *peeled,
+			      const char *symref_target, void *cb_data)
+{
+	mark_our_ref(refname, oid);
+	return 0;
+}
+
+static int find_snapshot_symref(const char *refname, const struct object_id *oid,
+				const struct object_id *peeled,
+				const char *symref_target, void *cb_data)
+{
+	if (symref_target)
+		string_list_append(cb_data, refname)->util = xstrdup(symref_target);
 	return 0;
 }
 
@@ -772,30 +1270,271 @@ static int find_symref(const char *refname, const struct object_id *oid,
 	return 0;
 }
 
-static void upload_pack(void)
+struct ls_refs_data {
+	int peel;
+	int symrefs;
+};
+
+static int send_ls_ref(const char *refname, const struct object_id *oid,
+		       int flag, void *cb_data)
 {
-	struct string_list symref = STRING_LIST_INIT_DUP;
+	struct ls_refs_data *data = cb_data;
+	struct strbuf line = STRBUF_INIT;
+	struct object_id peeled;
+
+	if (mark_our_ref(refname, oid))
+		return 0;
 
-	head_ref_namespaced(find_symref, &symref);
+	strbuf_addf(&line, "%s %s", oid_to_hex(oid), strip_namespace(refname));
+	if (data->symrefs && (flag & REF_ISSYMREF)) {
+		struct object_id unused;
+		const char *target = resolve_ref_unsafe(refname, 0,
+							unused.hash, NULL);
+		if (target)
+			strbuf_addf(&line, " symref-target:%s",
+				    strip_namespace(target));
+	}
+	if (data->peel && !peel_ref(refname, peeled.hash))
+		strbuf_addf(&line, " peeled:%s", oid_to_hex(&peeled));
+	packet_write(1, "%s\n", line.buf);
+	strbuf_release(&line);
+	refs_advertised++;
+	return 0;
+}
+
+/*
+ * Serve "ls-refs": list the refs whose names begin with one of the
+ * "ref-prefix" arguments (all of them if there is none), looking only
+ * at the parts of the ref hierarchy that can hold them.
+ */
+static void ls_refs(int have_args)
+{
+	struct ls_refs_data data;
+	struct string_list prefixes = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	const char *last = NULL;
+	char *line;
+
+	memset(&data, 0, sizeof(data));
+	while (have_args && (line = packet_read_line(0, NULL))) {
+		const char *arg;
+		if (!strcmp(line, "peel"))
+			data.peel = 1;
+		else if (!strcmp(line, "symrefs"))
+			data.symrefs = 1;
+		else if (skip_prefix(line, "ref-prefix ", &arg))
+			string_list_append(&prefixes, arg);
+		else
+			die("git upload-pack: unexpected ls-refs argument '%s'",
+			    line);
+	}
+
+	reset_timeout();
+	if (!prefixes.nr) {
+		head_ref_namespaced(send_ls_ref, &data);
+		for_each_namespaced_ref(send_ls_ref, &data);
+	} else {
+		string_list_sort(&prefixes);
+		for_each_string_list_item(item, &prefixes)
+			if (starts_with("HEAD", item->string)) {
+				head_ref_namespaced(send_ls_ref, &data);
+				break;
+			}
+		for_each_string_list_item(item, &prefixes) {
+			/* "refs/heads/" already covers "refs/heads/main" */
+			if (last && starts_with(item->string, last))
+				continue;
+			last = item->string;
+			if (starts_with("refs/", item->string)) {
+				for_each_namespaced_ref(send_ls_ref, &data);
+				break;
+			}
+			if (starts_with(item->string, "refs/"))
+				for_each_namespaced_ref_in(item->string,
+							   send_ls_ref, &data);
+		}
+	}
+	advertise_shallow_grafts(1);
+	packet_flush(1);
+	string_list_clear(&prefixes, 0);
+}
+
+static void serve_fetch(void)
+{
+	audit_log_phase("negotiation");
+	trace_region_enter("upload-pack", "receive needs");
+	receive_needs();
+	trace_region_leave("upload-pack", "receive needs");
+	if (!want_obj.nr)
+		return;
+	trace_region_enter("upload-pack", "negotiation");
+	get_common_commits();
+	trace_region_leave("upload-pack", "negotiation");
+	audit_log_phase("pack");
+	trace_region_enter("upload-pack", "send pack");
+	create_pack_file();
+	trace_region_leave("upload-pack", "send pack");
+}
+
+/*
+ * Serve "fetch", whose arguments are the want, shallow and deepen
+ * lines of the original protocol; the negotiation that follows them
+ * is unchanged.
+ */
+static void fetch_v2(int have_args)
+{
+	if (!have_args)
+		return;
+	head_ref_namespaced(check_ref, NULL);
+	for_each_namespaced_ref(check_ref, NULL);
+	serve_fetch();
+}
+
+/*
+ * Read and serve one command: "command=<name>", the capabilities the
+ * client uses up to a delim packet, then the arguments of the command
+ * up to a flush.  Return 0 when there is nothing more to serve.
+ */
+static int serve_command_v2(void)
+{
+	const char *arg;
+	char *command;
+	int len, have_args = 0, more = 1;
+
+	reset_timeout();
+	len = packet_read(0, NULL, NULL, packet_buffer, sizeof(packet_buffer),
+			  PACKET_READ_GENTLE_ON_EOF | PACKET_READ_CHOMP_NEWLINE);
+	if (len <= 0)
+		return 0;
+	if (!skip_prefix(packet_buffer, "command=", &arg))
+		die("git upload-pack: protocol error, "
+		    "expected a command, not '%s'", packet_buffer);
+	command = xstrdup(arg);
+
+	/* No client capability changes what we send yet. */
+	for (;;) {
+		len = packet_read(0, NULL, NULL,
+				  packet_buffer, sizeof(packet_buffer),
+				  PACKET_READ_CHOMP_NEWLINE | PACKET_READ_DELIM);
+		if (len == PACKET_DELIM)
+			have_args = 1;
+		if (len <= 0)
+			break;
+	}
+
+	if (!strcmp(command, "ls-refs"))
+		ls_refs(have_args);
+	else if (!strcmp(command, "fetch")) {
+		fetch_v2(have_args);
+		more = 0;
+	} else
+		die("git upload-pack: unknown command '%s'", command);
+	free(command);
+	return more;
+}
+
+static void upload_pack_v2(void)
+{
+	int i;
 
 	if (advertise_refs || !stateless_rpc) {
 		reset_timeout();
-		head_ref_namespaced(send_ref, &symref);
-		for_each_namespaced_ref(send_ref, &symref);
-		advertise_shallow_grafts(1);
+		packet_write(1, "version 2\n");
+		packet_write(1, "agent=%s\n", git_user_agent_sanitized());
+		packet_write(1, "ls-refs\n");
+		packet_write(1, "fetch=%s%s%s%s%s%s\n", fetch_capabilities,
+			     (allow_unadvertised_object_request & ALLOW_TIP_SHA1) ?
+				     " allow-tip-sha1-in-want" : "",
+			     (allow_unadvertised_object_request & ALLOW_REACHABLE_SHA1) ?
+				     " allow-reachable-sha1-in-want" : "",
+			     stateless_rpc ? " no-done" : "",
+			     allow_filter ? " filter" : "",
+			     allow_packfile_uris ? " packfile-uris" : "");
+		for (i = 0; i < bundle_uris.nr; i++)
+			packet_write(1, "bundle-uri=%s\n",
+				     bundle_uris.items[i].string);
 		packet_flush(1);
+	}
+	if (advertise_refs)
+		return;
+
+	/* A stateless server answers one command per request. */
+	while (serve_command_v2() && !stateless_rpc)
+		;
+}
+
+static void upload_pack(void)
+{
+	struct string_list symref = STRING_LIST_INIT_DUP;
+
+	if (determine_protocol_version_server() == protocol_v2) {
+		upload_pack_v2();
+		return;
+	}
+
+	if (use_ref_snapshot) {
+		struct ref_snapshot *snapshot = get_ref_snapshot();
+		struct strbuf prefix = STRBUF_INIT;
+
+		strbuf_addf(&prefix, "%srefs/", get_git_namespace());
+		ref_snapshot_head(snapshot, find_snapshot_symref, &symref);
+		if (advertise_refs || !stateless_rpc) {
+			reset_timeout();
+			ref_snapshot_head(snapshot, send_snapshot_ref, &symref);
+			ref_snapshot_for_each(snapshot, prefix.buf,
+					      send_snapshot_ref, &symref);
+			advertise_shallow_grafts(1);
+			packet_flush(1);
+		} else {
+			ref_snapshot_head(snapshot, check_snapshot_ref, NULL);
+			ref_snapshot_for_each(snapshot, prefix.buf,
+					      check_snapshot_ref, NULL);
+		}
+		strbuf_release(&prefix);
 	} else {
-		head_ref_namespaced(check_ref, NULL);
-		for_each_namespaced_ref(check_ref, NULL);
+		head_ref_namespaced(find_symref, &symref);
+
+		if (advertise_refs || !stateless_rpc) {
+			reset_timeout();
+			head_ref_namespaced(send_ref, &symref);
+			for_each_namespaced_ref(send_ref, &symref);
+			advertise_shallow_grafts(1);
+			packet_flush(1);
+		} else {
+			head_ref_namespaced(check_ref, NULL);
+			for_each_namespaced_ref(check_ref, NULL);
+		}
 	}
 	string_list_clear(&symref, 1);
 	if (advertise_refs)
 		return;
 
-	receive_needs();
-	if (want_obj.nr) {
-		get_common_commits();
-		create_pack_file();
+	serve_fetch();
+}
+
+static void audit_upload_pack(void)
+{
+	audit_log_addf("refs", "%u", refs_advertised);
+	audit_log_addf("wants", "%u", want_obj.nr);
+	audit_log_addf("haves", "%u", haves_received);
+	audit_log_addf("rounds", "%u", negotiation_rounds);
+	audit_log_addf("bytes", "%"PRIuMAX, pack_bytes_sent);
+	if (pack_cache_result)
+		audit_log_addf("pack_cache", "%s", pack_cache_result);
+	if (pack_stats.len) {
+		/* already "key=value ..." from pack-objects --stats-fd */
+		struct string_list fields = STRING_LIST_INIT_DUP;
+		int i;
+
+		string_list_split(&fields, pack_stats.buf, ' ', -1);
+		for (i = 0; i < fields.nr; i++) {
+			char *eq = strchr(fields.items[i].string, '=');
+			if (!eq)
+				continue;
+			*eq = '\0';
+			audit_log_addf(fields.items[i].string, "%s", eq + 1);
+		}
+		string_list_clear(&fields, 0);
 	}
 }
 
@@ -811,6 +1550,29 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 			allow_unadvertised_object_request |= ALLOW_REACHABLE_SHA1;
 		else
 			allow_unadvertised_object_request &= ~ALLOW_REACHABLE_SHA1;
+	} else if (!strcmp("uploadpack.allowanysha1inwant", var)) {
+		if (git_config_bool(var, value))
+			allow_unadvertised_object_request |= ALLOW_ANY_SHA1;
+		else
+			allow_unadvertised_object_request &= ~ALLOW_ANY_SHA1;
+	} else if (!strcmp("uploadpack.allowfilter", var)) {
+		allow_filter = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packfileuri", var)) {
+		allow_packfile_uris = 1;
+		if (value)
+			string_list_append(&packfile_uris, value);
+	} else if (!strcmp("uploadpack.bundleuri", var)) {
+		if (!value)
+			return config_error_nonbool(var);
+		string_list_append(&bundle_uris, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		return git_config_pathname(&pack_cache_dir, var, value);
+	} else if (!strcmp("uploadpack.packcachesize", var)) {
+		pack_cache_size = git_config_ulong(var, value);
+	} else if (!strcmp("uploadpack.bitmapnegotiation", var)) {
+		use_bitmap_negotiation = git_config_bool(var, value);
+	} else if (!strcmp("transfer.refsnapshot", var)) {
+		use_ref_snapshot = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.keepalive", var)) {
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
@@ -829,6 +1591,7 @@ int main(int argc, char **argv)
 
 	packet_trace_identity("upload-pack");
 	git_extract_argv0_path(argv[0]);
+	trace_event_command((const char **)argv);
 	check_replace_refs = 0;
 
 	for (i = 1; i < argc; i++) {
@@ -870,6 +1633,8 @@ int main(int argc, char **argv)
 		die("'%s' does not appear to be a git repository", dir);
 
 	git_config(upload_pack_config, NULL);
+	audit_log_start("upload-pack", "advertise", audit_upload_pack);
 	upload_pack();
+	audit_log_status("ok");
 	return 0;
 }
@@ -2,6 +2,11 @@
 #include "strbuf.h"
 #include "utf8.h"
 
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <emmintrin.h>
+#define UTF8_SSE2
+#endif
+
 /* This code is originally from http://www.cl.cam.ac.uk/~mgk25/ucs/ */
 
 struct interval {
@@ -183,6 +188,56 @@ invalid:
 	return ch;
 }
 
+/*
+ * Return how many of the "len" bytes at "s" lie between the ASCII
+ * characters "lo" and "hi" (inclusive) before the first that does not.
+ * Most text is plain ASCII, and such runs need not be decoded one
+ * character at a time; this looks at 16 (or 8) bytes at once.
+ */
+static size_t ascii_span(const char *s, size_t len,
+			 unsigned char lo, unsigned char hi)
+{
+	const uint64_t high = 0x8080808080808080ULL;
+	const uint64_t ones = 0x0101010101010101ULL;
+	size_t i = 0;
+
+#ifdef UTF8_SSE2
+	{
+		/* x is in range iff x - lo <= hi - lo, unsigned */
+		__m128i base = _mm_set1_epi8(lo);
+		__m128i range = _mm_set1_epi8(hi - lo);
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+			__m128i d = _mm_sub_epi8(v, base);
+			unsigned int mask = _mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_max_epu8(d, range), range));
+			if (mask != 0xffff)
+				return i + __builtin_ctz(~mask);
+		}
+	}
+#endif
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v;
+
+		memcpy(&v, s + i, sizeof(v));
+		/*
+		 * With the high bits clear, adding 0x80 - lo sets the high
+		 * bit of each byte that is >= lo, and adding 0x7f - hi that
+		 * of each byte that is > hi, without carrying over.
+		 */
+		if (v & high)
+			break;
+		if (((v + (0x80 - lo) * ones) & ~(v + (0x7f - hi) * ones) &
+		     high) != high)
+			break;
+	}
+	for (; i < len; i++)
+		if ((unsigned char)s[i] < lo || (unsigned char)s[i] > hi)
+			break;
+	return i;
+}
+
 /*
  * This function returns the number of columns occupied by the character
  * pointed to by the variable start. The pointer is updated to point at
@@ -212,6 +267,13 @@ int utf8_strnwidth(const char *string, int len, int skip_ansi)
 		len = strlen(string);
 	while (string && string < orig + len) {
 		int skip;
+		/* printable ASCII is one column each */
+		size_t run = ascii_span(string, orig + len - string, ' ', '~');
+		if (run) {
+			width += run;
+			string += run;
+			continue;
+		}
 		while (skip_ansi &&
 		       (skip = display_mode_esc_sequence_len(string)) != 0)
 			string += skip;
@@ -227,11 +289,13 @@ int utf8_strwidth(const char *string)
 
 int is_utf8(const char *text)
 {
-	while (*text) {
-		if (*text == '\n' || *text == '\t' || *text == '\r') {
-			text++;
-			continue;
-		}
+	const char *end = text + strlen(text);
+
+	while (text < end) {
+		/* ASCII, control characters included, is valid UTF-8 */
+		text += ascii_span(text, end - text, 0x01, 0x7f);
+		if (text == end)
+			break;
 		utf8_width(&text, NULL);
 		if (!text)
 			return 0;
@@ -265,13 +329,14 @@ void strbuf_add_wrapped_text(struct strbuf *buf,
 		const char *text, int indent1, int indent2, int width)
 {
 	int indent, w, assume_utf8 = 1;
-	const char *bol, *space, *start = text;
+	const char *bol, *space, *start = text, *end;
 	size_t orig_len = buf->len;
 
 	if (width <= 0) {
 		strbuf_add_indented_text(buf, text, indent1, indent2);
 		return;
 	}
+	end = text + strlen(text);
 
 retry:
 	bol = text;
@@ -328,6 +393,13 @@ new_line:
 			}
 			continue;
 		}
+		/* a word, or the part of it up to a non-ASCII character */
+		skip = ascii_span(text, end - text, '!', '~');
+		if (skip) {
+			w += skip;
+			text += skip;
+			continue;
+		}
 		if (assume_utf8) {
 			w += utf8_width(&text, NULL);
 			if (!text) {
@@ -133,7 +133,6 @@ static void ls_from_rev(uint32_t rev, const char *path)
 	printf("ls :%"PRIu32" ", rev);
 	quote_c_style(path, NULL, stdout, 0);
 	putchar('\n');
-	fflush(stdout);
 }
 
 static void ls_from_active_commit(const char *path)
@@ -142,12 +141,15 @@ static void ls_from_active_commit(const char *path)
 	printf("ls \"");
 	quote_c_style(path, NULL, stdout, 1);
 	printf("\"\n");
-	fflush(stdout);
 }
 
 static const char *get_response_line(void)
 {
-	const char *line = buffer_read_line(&report_buffer);
+	const char *line;
+
+	/* Requests stay buffered until the first answer is needed. */
+	fflush(stdout);
+	line = buffer_read_line(&report_buffer);
 	if (line)
 		return line;
 	if (buffer_ferror(&report_buffer))
@@ -192,6 +194,19 @@ static void check_preimage_overflow(off_t a, off_t b)
 		die("blob too large for current definition of off_t");
 }
 
+static int apply_delta_1(off_t len, struct line_buffer *input,
+			 struct sliding_view *preimage, uint32_t old_mode,
+			 FILE *out)
+{
+	if (old_mode == REPO_MODE_LNK) {
+		strbuf_addstr(&preimage->buf, "link ");
+		check_preimage_overflow(preimage->max_off, strlen("link "));
+		preimage->max_off += strlen("link ");
+		check_preimage_overflow(preimage->max_off, 1);
+	}
+	return svndiff0_apply(input, len, preimage, out);
+}
+
 static long apply_delta(off_t len, struct line_buffer *input,
 			const char *old_data, uint32_t old_mode)
 {
@@ -203,20 +218,13 @@ static long apply_delta(off_t len, struct line_buffer *input,
 		die("cannot open temporary file for blob retrieval");
 	if (old_data) {
 		const char *response;
-		printf("cat-blob %s\n", old_data);
-		fflush(stdout);
+		fast_export_request_blob(old_data);
 		response = get_response_line();
 		if (parse_cat_response_line(response, &preimage.max_off))
 			die("invalid cat-blob response: %s", response);
 		check_preimage_overflow(preimage.max_off, 1);
 	}
-	if (old_mode == REPO_MODE_LNK) {
-		strbuf_addstr(&preimage.buf, "link ");
-		check_preimage_overflow(preimage.max_off, strlen("link "));
-		preimage.max_off += strlen("link ");
-		check_preimage_overflow(preimage.max_off, 1);
-	}
-	if (svndiff0_apply(input, len, &preimage, out))
+	if (apply_delta_1(len, input, &preimage, old_mode, out))
 		die("cannot apply delta");
 	if (old_data) {
 		/* Read the remainder of preimage and trailing newline. */
@@ -312,6 +320,100 @@ int fast_export_ls(const char *path, uint32_t *mode, struct strbuf *dataref)
 	return parse_ls_response(get_response_line(), mode, dataref);
 }
 
+void fast_export_request_ls_rev(uint32_t rev, const char *path)
+{
+	ls_from_rev(rev, path);
+}
+
+void fast_export_request_ls(const char *path)
+{
+	ls_from_active_commit(path);
+}
+
+int fast_export_read_ls(uint32_t *mode, struct strbuf *dataref)
+{
+	return parse_ls_response(get_response_line(), mode, dataref);
+}
+
+void fast_export_request_blob(const char *dataref)
+{
+	printf("cat-blob %s\n", dataref);
+}
+
+static void die_feedback_short_read(void)
+{
+	if (buffer_ferror(&report_buffer))
+		die_errno("error reading from fast-import");
+	die("unexpected end of fast-import feedback");
+}
+
+off_t fast_export_read_blob(struct strbuf *mem, struct line_buffer *spill,
+			    size_t mem_limit)
+{
+	const char *response = get_response_line();
+	off_t len;
+
+	if (parse_cat_response_line(response, &len))
+		die("invalid cat-blob response: %s", response);
+	if ((uintmax_t)len <= mem_limit) {
+		if (buffer_read_binary(&report_buffer, mem, len) != len)
+			die_feedback_short_read();
+	} else {
+		struct strbuf chunk = STRBUF_INIT;
+		off_t left = len;
+		FILE *out;
+
+		if (buffer_tmpfile_init(spill) ||
+		    !(out = buffer_tmpfile_rewind(spill)))
+			die("cannot open temporary file for blob retrieval");
+		while (left) {
+			size_t n = left < 65536 ? left : 65536;
+
+			strbuf_reset(&chunk);
+			if (buffer_read_binary(&report_buffer, &chunk, n) != n)
+				die_feedback_short_read();
+			if (fwrite(chunk.buf, 1, n, out) != n)
+				die_errno("cannot write temporary file");
+			left -= n;
+		}
+		strbuf_release(&chunk);
+		if (buffer_tmpfile_prepare_to_read(spill) < 0)
+			die("cannot read temporary file for blob retrieval");
+	}
+	if (buffer_read_char(&report_buffer) != '\n')
+		die("missing newline after cat-blob response");
+	return len;
+}
+
+long fast_export_apply_delta(struct line_buffer *delta, off_t delta_len,
+			     struct line_buffer *preimage, off_t preimage_len,
+			     uint32_t old_mode, struct line_buffer *postimage)
+{
+	struct sliding_view view = SLIDING_VIEW_INIT(preimage, preimage_len);
+	long ret = -1;
+	FILE *out;
+
+	if (buffer_tmpfile_init(postimage) ||
+	    !(out = buffer_tmpfile_rewind(postimage)))
+		return error("cannot open temporary file for blob retrieval");
+	if (!apply_delta_1(delta_len, delta, &view, old_mode, out))
+		ret = buffer_tmpfile_prepare_to_read(postimage);
+	strbuf_release(&view.buf);
+	return ret;
+}
+
+void fast_export_postimage(uint32_t mode, struct line_buffer *postimage,
+			   long len)
+{
+	if (mode == REPO_MODE_LNK) {
+		buffer_skip_bytes(postimage, strlen("link "));
+		len -= strlen("link ");
+	}
+	printf("data %ld\n", len);
+	buffer_copy_bytes(postimage, len);
+	fputc('\n', stdout);
+}
+
 void fast_export_blob_delta(uint32_t mode,
 				uint32_t old_mode, const char *old_data,
 				off_t len, struct line_buffer *input)
@@ -320,11 +422,5 @@ void fast_export_blob_delta(uint32_t mode,
 
 	assert(len >= 0);
 	postimage_len = apply_delta(len, input, old_data, old_mode);
-	if (mode == REPO_MODE_LNK) {
-		buffer_skip_bytes(&postimage, strlen("link "));
-		postimage_len -= strlen("link ");
-	}
-	printf("data %ld\n", postimage_len);
-	buffer_copy_bytes(&postimage, postimage_len);
-	fputc('\n', stdout);
+	fast_export_postimage(mode, &postimage, postimage_len);
 }
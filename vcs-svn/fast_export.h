@@ -28,4 +28,32 @@ int fast_export_ls_rev(uint32_t rev, const char *path,
 int fast_export_ls(const char *path,
 			uint32_t *mode_out, struct strbuf *dataref_out);
 
+/*
+ * The same requests split in two, so that several can be sent before
+ * waiting for the first answer.  Answers are read in the order the
+ * requests were made.
+ */
+void fast_export_request_ls_rev(uint32_t rev, const char *path);
+void fast_export_request_ls(const char *path);
+int fast_export_read_ls(uint32_t *mode_out, struct strbuf *dataref_out);
+void fast_export_request_blob(const char *dataref);
+/*
+ * Read a blob into "mem" when it is at most "mem_limit" bytes long, or
+ * into the temporary file "spill" otherwise; returns its length.
+ */
+off_t fast_export_read_blob(struct strbuf *mem, struct line_buffer *spill,
+			size_t mem_limit);
+
+/*
+ * Apply a delta to a preimage read by fast_export_read_blob(), writing
+ * the postimage to the temporary file "postimage".  Unlike the rest of
+ * this API this does not touch the fast-import streams, and may run on
+ * several threads at once.  Returns the length of the postimage, or -1.
+ */
+long fast_export_apply_delta(struct line_buffer *delta, off_t delta_len,
+			struct line_buffer *preimage, off_t preimage_len,
+			uint32_t old_mode, struct line_buffer *postimage);
+void fast_export_postimage(uint32_t mode, struct line_buffer *postimage,
+			long len);
+
 #endif
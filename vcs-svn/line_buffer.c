@@ -25,6 +25,14 @@ int buffer_fdinit(struct line_buffer *buf, int fd)
 	return 0;
 }
 
+void buffer_meminit(struct line_buffer *buf, const char *data, size_t len)
+{
+	buf->infile = NULL;
+	buf->mem = data;
+	buf->mem_len = len;
+	buf->mem_pos = 0;
+}
+
 int buffer_tmpfile_init(struct line_buffer *buf)
 {
 	buf->infile = tmpfile();
@@ -36,6 +44,8 @@ int buffer_tmpfile_init(struct line_buffer *buf)
 int buffer_deinit(struct line_buffer *buf)
 {
 	int err;
+	if (!buf->infile)
+		return 0;
 	if (buf->infile == stdin)
 		return ferror(buf->infile);
 	err = ferror(buf->infile);
@@ -61,18 +71,48 @@ long buffer_tmpfile_prepare_to_read(struct line_buffer *buf)
 
 int buffer_ferror(struct line_buffer *buf)
 {
+	if (!buf->infile)
+		return 0;
 	return ferror(buf->infile);
 }
 
+static size_t mem_avail(struct line_buffer *buf, uintmax_t nbytes)
+{
+	size_t avail = buf->mem_len - buf->mem_pos;
+	return nbytes < avail ? nbytes : avail;
+}
+
 int buffer_read_char(struct line_buffer *buf)
 {
+	if (!buf->infile)
+		return buf->mem_pos < buf->mem_len ?
+			(unsigned char)buf->mem[buf->mem_pos++] : EOF;
 	return fgetc(buf->infile);
 }
 
+static char *mem_read_line(struct line_buffer *buf)
+{
+	const char *line = buf->mem + buf->mem_pos;
+	const char *eol = memchr(line, '\n', buf->mem_len - buf->mem_pos);
+	size_t len = eol ? eol - line : buf->mem_len - buf->mem_pos;
+
+	/* Same limits as fgets() into line_buffer. */
+	if (!len && !eol)
+		return NULL;
+	if (len + !!eol >= sizeof(buf->line_buffer))
+		return NULL;
+	memcpy(buf->line_buffer, line, len);
+	buf->line_buffer[len] = '\0';
+	buf->mem_pos += len + !!eol;
+	return buf->line_buffer;
+}
+
 /* Read a line without trailing newline. */
 char *buffer_read_line(struct line_buffer *buf)
 {
 	char *end;
+	if (!buf->infile)
+		return mem_read_line(buf);
 	if (!fgets(buf->line_buffer, sizeof(buf->line_buffer), buf->infile))
 		/* Error or data exhausted. */
 		return NULL;
@@ -94,6 +134,12 @@ char *buffer_read_line(struct line_buffer *buf)
 size_t buffer_read_binary(struct line_buffer *buf,
 				struct strbuf *sb, size_t size)
 {
+	if (!buf->infile) {
+		size = mem_avail(buf, size);
+		strbuf_add(sb, buf->mem + buf->mem_pos, size);
+		buf->mem_pos += size;
+		return size;
+	}
 	return strbuf_fread(sb, size, buf->infile);
 }
 
@@ -101,6 +147,12 @@ off_t buffer_copy_bytes(struct line_buffer *buf, off_t nbytes)
 {
 	char byte_buffer[COPY_BUFFER_LEN];
 	off_t done = 0;
+	if (!buf->infile) {
+		done = mem_avail(buf, nbytes);
+		fwrite(buf->mem + buf->mem_pos, 1, done, stdout);
+		buf->mem_pos += done;
+		return done;
+	}
 	while (done < nbytes && !feof(buf->infile) && !ferror(buf->infile)) {
 		off_t len = nbytes - done;
 		size_t in = len < COPY_BUFFER_LEN ? len : COPY_BUFFER_LEN;
@@ -117,6 +169,11 @@ off_t buffer_skip_bytes(struct line_buffer *buf, off_t nbytes)
 {
 	char byte_buffer[COPY_BUFFER_LEN];
 	off_t done = 0;
+	if (!buf->infile) {
+		done = mem_avail(buf, nbytes);
+		buf->mem_pos += done;
+		return done;
+	}
 	while (done < nbytes && !feof(buf->infile) && !ferror(buf->infile)) {
 		off_t len = nbytes - done;
 		size_t in = len < COPY_BUFFER_LEN ? len : COPY_BUFFER_LEN;
@@ -8,11 +8,15 @@
 struct line_buffer {
 	char line_buffer[LINE_BUFFER_LEN];
 	FILE *infile;
+	/* in-core input, when infile is NULL */
+	const char *mem;
+	size_t mem_len, mem_pos;
 };
-#define LINE_BUFFER_INIT { "", NULL }
+#define LINE_BUFFER_INIT { "", NULL, NULL, 0, 0 }
 
 int buffer_init(struct line_buffer *buf, const char *filename);
 int buffer_fdinit(struct line_buffer *buf, int fd);
+void buffer_meminit(struct line_buffer *buf, const char *data, size_t len);
 int buffer_deinit(struct line_buffer *buf);
 
 int buffer_tmpfile_init(struct line_buffer *buf);
@@ -13,6 +13,9 @@
 #include "line_buffer.h"
 #include "strbuf.h"
 #include "svndump.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 
 /*
  * Compare start of string to literal of equal length;
@@ -38,12 +41,14 @@
 
 static struct line_buffer input = LINE_BUFFER_INIT;
 
-static struct {
+struct node {
 	uint32_t action, srcRev, type;
 	off_t prop_length, text_length;
 	struct strbuf src, dst;
 	uint32_t text_delta, prop_delta;
-} node_ctx;
+};
+
+static struct node node_ctx;
 
 static struct {
 	uint32_t revision;
@@ -151,7 +156,7 @@ static void die_short_read(void)
 	die("invalid dump: unexpected end of file");
 }
 
-static void read_props(void)
+static void read_props(struct line_buffer *in)
 {
 	static struct strbuf key = STRBUF_INIT;
 	static struct strbuf val = STRBUF_INIT;
@@ -169,7 +174,7 @@ static void read_props(void)
 	 * symlink and executable bits separately instead.
 	 */
 	uint32_t type_set = 0;
-	while ((t = buffer_read_line(&input)) && strcmp(t, "PROPS-END")) {
+	while ((t = buffer_read_line(in)) && strcmp(t, "PROPS-END")) {
 		uint32_t len;
 		const char type = t[0];
 		int ch;
@@ -178,12 +183,12 @@ static void read_props(void)
 			die("invalid property line: %s", t);
 		len = atoi(&t[2]);
 		strbuf_reset(&val);
-		buffer_read_binary(&input, &val, len);
+		buffer_read_binary(in, &val, len);
 		if (val.len < len)
 			die_short_read();
 
 		/* Discard trailing newline. */
-		ch = buffer_read_char(&input);
+		ch = buffer_read_char(in);
 		if (ch == EOF)
 			die_short_read();
 		if (ch != '\n')
@@ -206,7 +211,162 @@ static void read_props(void)
 	}
 }
 
-static void handle_node(void)
+/*
+ * Pipelined mode (see svndump_pipeline()) reads the nodes of a
+ * revision ahead into a window before writing any of them out.  What
+ * they need from fast-import is asked for in batches, and their text
+ * deltas are applied on worker threads while earlier nodes are being
+ * written.  Each node is still written in dump order, by handle_node();
+ * what was fetched ahead of time for it is in "prefetched".
+ *
+ * Asking early for the paths of the commit being built is only right
+ * when no earlier node in the window touches the same path; a node
+ * for which that cannot be shown asks for itself when its turn comes.
+ */
+#define WINDOW_NODES 64
+#define WINDOW_BYTES (32 << 20)
+/*
+ * Requests sent before their answers are read must fit in the pipe to
+ * fast-import, as it stops reading them while its answers are unread.
+ */
+#define REQUEST_BATCH 4096
+
+struct lookup {
+	int known, missing;
+	uint32_t mode;
+	struct strbuf dataref;
+};
+
+enum delta_state {
+	DELTA_NONE,
+	DELTA_QUEUED,
+	DELTA_RUNNING,
+	DELTA_DONE
+};
+
+struct queued_node {
+	struct node node;
+	struct strbuf content;	/* properties, then text */
+	struct lookup copy, old;
+
+	/* a text delta to apply off the main thread */
+	int has_delta;
+	enum delta_state delta;
+	uint32_t delta_old_mode;
+	size_t delta_off;
+	off_t delta_len;
+	struct strbuf preimage;
+	struct line_buffer preimage_file;
+	off_t preimage_len;
+	struct line_buffer postimage;
+	long postimage_len;
+};
+
+static int pipeline_threads;
+static struct queued_node *window[WINDOW_NODES];
+static int window_nr;
+static size_t window_bytes;
+static struct queued_node *prefetched;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t delta_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delta_cond = PTHREAD_COND_INITIALIZER;
+static int next_delta;
+#define delta_lock() pthread_mutex_lock(&delta_mutex)
+#define delta_unlock() pthread_mutex_unlock(&delta_mutex)
+#define delta_wait() pthread_cond_wait(&delta_cond, &delta_mutex)
+#define delta_signal() pthread_cond_broadcast(&delta_cond)
+#else
+#define delta_lock()
+#define delta_unlock()
+#define delta_wait() die("BUG: waiting for a delta without threads")
+#define delta_signal()
+#endif
+
+static void copy_node(void)
+{
+	struct lookup *copy = prefetched ? &prefetched->copy : NULL;
+
+	if (!copy || !copy->known)
+		repo_copy(node_ctx.srcRev, node_ctx.src.buf, node_ctx.dst.buf);
+	else if (copy->missing)
+		fast_export_delete(node_ctx.dst.buf);
+	else
+		fast_export_modify(node_ctx.dst.buf, copy->mode,
+				   copy->dataref.buf);
+}
+
+static const char *read_old_path(uint32_t *mode)
+{
+	struct lookup *old = prefetched ? &prefetched->old : NULL;
+
+	if (!old || !old->known)
+		return repo_read_path(node_ctx.dst.buf, mode);
+	if (old->missing) {
+		/* Treat missing paths as directories. */
+		*mode = REPO_MODE_DIR;
+		return NULL;
+	}
+	*mode = old->mode;
+	return old->dataref.buf;
+}
+
+static void run_delta(struct queued_node *q)
+{
+	struct line_buffer delta = LINE_BUFFER_INIT;
+	struct line_buffer preimage = LINE_BUFFER_INIT;
+	struct line_buffer *pre = &q->preimage_file;
+
+	buffer_meminit(&delta, q->content.buf + q->delta_off,
+		       q->content.len - q->delta_off);
+	if (!pre->infile) {
+		buffer_meminit(&preimage, q->preimage.buf, q->preimage.len);
+		pre = &preimage;
+	}
+	q->postimage_len = fast_export_apply_delta(&delta, q->delta_len,
+						   pre, q->preimage_len,
+						   q->delta_old_mode,
+						   &q->postimage);
+}
+
+/* Apply the delta of "q" here, unless a worker already took it. */
+static void finish_delta(struct queued_node *q)
+{
+	int run;
+
+	delta_lock();
+	run = q->delta == DELTA_QUEUED;
+	if (run)
+		q->delta = DELTA_RUNNING;
+	else
+		while (q->delta != DELTA_DONE)
+			delta_wait();
+	delta_unlock();
+	if (run) {
+		run_delta(q);
+		delta_lock();
+		q->delta = DELTA_DONE;
+		delta_unlock();
+	}
+}
+
+static void write_delta(uint32_t mode, uint32_t old_mode, const char *old_data,
+			struct line_buffer *in)
+{
+	struct queued_node *q = prefetched;
+
+	if (!q || !q->has_delta) {
+		fast_export_blob_delta(mode, old_mode, old_data,
+				       node_ctx.text_length, in);
+		return;
+	}
+	finish_delta(q);
+	if (q->postimage_len < 0)
+		die("cannot apply delta");
+	fast_export_postimage(mode, &q->postimage, q->postimage_len);
+}
+
+static void handle_node(struct line_buffer *in)
 {
 	const uint32_t type = node_ctx.type;
 	const int have_props = node_ctx.prop_length != -1;
@@ -233,7 +393,7 @@ static void handle_node(void)
 		node_ctx.action = NODEACT_ADD;
 	}
 	if (node_ctx.srcRev) {
-		repo_copy(node_ctx.srcRev, node_ctx.src.buf, node_ctx.dst.buf);
+		copy_node();
 		if (node_ctx.action == NODEACT_ADD)
 			node_ctx.action = NODEACT_CHANGE;
 	}
@@ -249,7 +409,7 @@ static void handle_node(void)
 		old_data = NULL;
 	} else if (node_ctx.action == NODEACT_CHANGE) {
 		uint32_t mode;
-		old_data = repo_read_path(node_ctx.dst.buf, &mode);
+		old_data = read_old_path(&mode);
 		if (mode == REPO_MODE_DIR && type != REPO_MODE_DIR)
 			die("invalid dump: cannot modify a directory into a file");
 		if (mode != REPO_MODE_DIR && type == REPO_MODE_DIR)
@@ -274,7 +434,7 @@ static void handle_node(void)
 		if (!node_ctx.prop_delta)
 			node_ctx.type = type;
 		if (node_ctx.prop_length)
-			read_props();
+			read_props(in);
 	}
 
 	/*
@@ -292,12 +452,344 @@ static void handle_node(void)
 	}
 	if (!node_ctx.text_delta) {
 		fast_export_modify(node_ctx.dst.buf, node_ctx.type, "inline");
-		fast_export_data(node_ctx.type, node_ctx.text_length, &input);
+		fast_export_data(node_ctx.type, node_ctx.text_length, in);
 		return;
 	}
 	fast_export_modify(node_ctx.dst.buf, node_ctx.type, "inline");
-	fast_export_blob_delta(node_ctx.type, old_mode, old_data,
-				node_ctx.text_length, &input);
+	write_delta(node_ctx.type, old_mode, old_data, in);
+}
+
+static void swap_node(struct node *a, struct node *b)
+{
+	struct node tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/* Would handle_node() look up the old contents of the path? */
+static int node_reads_old_path(const struct node *n)
+{
+	uint32_t action = n->action;
+
+	if (action == NODEACT_DELETE)
+		return 0;
+	if (action == NODEACT_REPLACE)
+		action = NODEACT_ADD;
+	if (n->srcRev && action == NODEACT_ADD)
+		action = NODEACT_CHANGE;
+	return action == NODEACT_CHANGE && *n->dst.buf;
+}
+
+static int paths_overlap(const char *a, const char *b)
+{
+	size_t len_a = strlen(a), len_b = strlen(b);
+
+	if (len_a > len_b) {
+		const char *t = a;
+		a = b;
+		b = t;
+		len_a = len_b;
+	}
+	/* Is "a" the same path as "b", or one of its leading directories? */
+	return !len_a ||
+		(!strncmp(a, b, len_a) && (!b[len_a] || b[len_a] == '/'));
+}
+
+static int touched_earlier(int nr, const char *path)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (paths_overlap(window[i]->node.dst.buf, path))
+			return 1;
+	return 0;
+}
+
+enum request_type {
+	REQUEST_COPY,
+	REQUEST_OLD,
+	REQUEST_BLOB
+};
+
+struct request {
+	struct queued_node *q;
+	enum request_type type;
+};
+
+static size_t send_request(const struct request *r)
+{
+	const struct node *n = &r->q->node;
+
+	switch (r->type) {
+	case REQUEST_COPY:
+		fast_export_request_ls_rev(n->srcRev, n->src.buf);
+		return 2 * n->src.len + 16;
+	case REQUEST_OLD:
+		fast_export_request_ls(n->dst.buf);
+		return 2 * n->dst.len + 8;
+	case REQUEST_BLOB:
+		fast_export_request_blob(r->q->old.dataref.buf);
+		return 10 + r->q->old.dataref.len;
+	}
+	die("BUG: unknown request type %d", r->type);
+}
+
+static void read_lookup(struct lookup *l)
+{
+	strbuf_reset(&l->dataref);
+	l->known = 1;
+	l->missing = !!fast_export_read_ls(&l->mode, &l->dataref);
+}
+
+static void read_answer(const struct request *r)
+{
+	struct queued_node *q = r->q;
+
+	switch (r->type) {
+	case REQUEST_COPY:
+		read_lookup(&q->copy);
+		/* The copy is what the node's path will hold afterwards. */
+		if (node_reads_old_path(&q->node)) {
+			q->old.known = 1;
+			q->old.missing = q->copy.missing;
+			q->old.mode = q->copy.mode;
+			strbuf_reset(&q->old.dataref);
+			strbuf_addbuf(&q->old.dataref, &q->copy.dataref);
+		}
+		break;
+	case REQUEST_OLD:
+		read_lookup(&q->old);
+		break;
+	case REQUEST_BLOB:
+		strbuf_reset(&q->preimage);
+		q->preimage_len = fast_export_read_blob(&q->preimage,
+				&q->preimage_file, WINDOW_BYTES - window_bytes);
+		if (!q->preimage_file.infile)
+			window_bytes += q->preimage.len;
+		break;
+	}
+}
+
+static void run_requests(struct request *r, int nr)
+{
+	int i = 0;
+
+	while (i < nr) {
+		size_t bytes = 0;
+		int j = i;
+
+		while (j < nr && (j == i || bytes < REQUEST_BATCH))
+			bytes += send_request(&r[j++]);
+		while (i < j)
+			read_answer(&r[i++]);
+	}
+}
+
+/* Would handle_node() apply a text delta, and against what? */
+static int prepare_delta(struct queued_node *q)
+{
+	const struct node *n = &q->node;
+	uint32_t action = n->action;
+
+	if (!n->text_delta || n->text_length < 0 ||
+	    n->type == REPO_MODE_DIR)
+		return 0;
+	if (action == NODEACT_REPLACE)
+		action = NODEACT_ADD;
+	if (action == NODEACT_ADD && !n->srcRev) {
+		q->delta_old_mode = REPO_MODE_BLB;
+		q->preimage_len = 0;
+		return 1;
+	}
+	if (!node_reads_old_path(n) || !q->old.known || q->old.missing)
+		return 0;
+	switch (q->old.mode) {
+	case REPO_MODE_BLB:
+	case REPO_MODE_EXE:
+	case REPO_MODE_LNK:
+		q->delta_old_mode = q->old.mode;
+		return 2;
+	}
+	return 0;
+}
+
+static void prefetch_window(void)
+{
+	struct request *r = xmalloc(window_nr * sizeof(*r));
+	int i, nr = 0;
+
+	/* Look up copy sources and the paths changed in place. */
+	for (i = 0; i < window_nr; i++) {
+		struct queued_node *q = window[i];
+		const struct node *n = &q->node;
+
+		if (n->action == NODEACT_DELETE)
+			continue;
+		if (n->srcRev) {
+			r[nr].q = q;
+			r[nr++].type = REQUEST_COPY;
+		} else if (node_reads_old_path(n) &&
+			   !touched_earlier(i, n->dst.buf)) {
+			r[nr].q = q;
+			r[nr++].type = REQUEST_OLD;
+		}
+	}
+	run_requests(r, nr);
+
+	/* Fetch the preimages of the deltas that can be applied early. */
+	nr = 0;
+	for (i = 0; i < window_nr; i++) {
+		struct queued_node *q = window[i];
+		int how = prepare_delta(q);
+
+		if (!how)
+			continue;
+		if (how == 2) {
+			r[nr].q = q;
+			r[nr++].type = REQUEST_BLOB;
+		}
+		q->has_delta = 1;
+		q->delta = DELTA_QUEUED;
+		q->delta_off = q->node.prop_length > 0 ? q->node.prop_length : 0;
+		q->delta_len = q->node.text_length;
+	}
+	run_requests(r, nr);
+	free(r);
+}
+
+#ifndef NO_PTHREADS
+static void *delta_worker(void *data)
+{
+	for (;;) {
+		struct queued_node *q = NULL;
+
+		delta_lock();
+		while (next_delta < window_nr &&
+		       window[next_delta]->delta != DELTA_QUEUED)
+			next_delta++;
+		if (next_delta < window_nr) {
+			q = window[next_delta++];
+			q->delta = DELTA_RUNNING;
+		}
+		delta_unlock();
+		if (!q)
+			return NULL;
+
+		run_delta(q);
+
+		delta_lock();
+		q->delta = DELTA_DONE;
+		delta_signal();
+		delta_unlock();
+	}
+}
+#endif
+
+static void flush_window(void)
+{
+	struct line_buffer content = LINE_BUFFER_INIT;
+	int i;
+#ifndef NO_PTHREADS
+	pthread_t *threads = NULL;
+	int nr_threads = 0;
+#endif
+
+	if (!window_nr)
+		return;
+	prefetch_window();
+
+#ifndef NO_PTHREADS
+	for (i = 0; i < window_nr; i++)
+		nr_threads += window[i]->has_delta;
+	if (nr_threads < 2)
+		nr_threads = 0;	/* nothing to overlap with */
+	else if (nr_threads > pipeline_threads)
+		nr_threads = pipeline_threads;
+	next_delta = 0;
+	if (nr_threads)
+		threads = xcalloc(nr_threads, sizeof(*threads));
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, delta_worker, NULL))
+			die("unable to create thread: %s", strerror(errno));
+#endif
+
+	for (i = 0; i < window_nr; i++) {
+		struct queued_node *q = window[i];
+
+		swap_node(&node_ctx, &q->node);
+		buffer_meminit(&content, q->content.buf, q->content.len);
+		prefetched = q;
+		handle_node(&content);
+		prefetched = NULL;
+		swap_node(&node_ctx, &q->node);
+	}
+
+#ifndef NO_PTHREADS
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+#endif
+	for (i = 0; i < window_nr; i++) {
+		struct queued_node *q = window[i];
+
+		if (q->postimage.infile && buffer_deinit(&q->postimage))
+			die("cannot close temporary file for blob retrieval");
+		if (q->preimage_file.infile)
+			buffer_deinit(&q->preimage_file);
+		q->postimage.infile = NULL;
+		q->preimage_file.infile = NULL;
+		q->has_delta = 0;
+		q->delta = DELTA_NONE;
+		q->copy.known = q->old.known = 0;
+	}
+	window_nr = 0;
+	window_bytes = 0;
+}
+
+static void queue_node(void)
+{
+	off_t prop_length = node_ctx.prop_length > 0 ? node_ctx.prop_length : 0;
+	off_t text_length = node_ctx.text_length > 0 ? node_ctx.text_length : 0;
+	uintmax_t len = (uintmax_t)prop_length + text_length;
+	struct queued_node *q;
+
+	if (window_nr == WINDOW_NODES || len > WINDOW_BYTES - window_bytes)
+		flush_window();
+	if (len > WINDOW_BYTES) {
+		/* too large to read ahead */
+		handle_node(&input);
+		return;
+	}
+
+	if (!window[window_nr]) {
+		q = xcalloc(1, sizeof(*q));
+		strbuf_init(&q->node.src, 0);
+		strbuf_init(&q->node.dst, 0);
+		strbuf_init(&q->content, 0);
+		strbuf_init(&q->copy.dataref, 0);
+		strbuf_init(&q->old.dataref, 0);
+		strbuf_init(&q->preimage, 0);
+		window[window_nr] = q;
+	}
+	q = window[window_nr++];
+	swap_node(&node_ctx, &q->node);
+	strbuf_reset(&q->content);
+	if (buffer_read_binary(&input, &q->content, len) != len)
+		die_short_read();
+	if (prop_length &&
+	    (prop_length < strlen("PROPS-END\n") ||
+	     memcmp(q->content.buf + prop_length - strlen("PROPS-END\n"),
+		    "PROPS-END\n", strlen("PROPS-END\n"))))
+		die("invalid dump: properties do not end with PROPS-END");
+	window_bytes += len;
+}
+
+static void end_node(void)
+{
+	if (pipeline_threads)
+		queue_node();
+	else
+		handle_node(&input);
 }
 
 static void begin_revision(const char *remote_ref)
@@ -359,7 +851,8 @@ void svndump_read(const char *url, const char *local_ref, const char *notes_ref)
 			if (constcmp(t, "Revision-number"))
 				continue;
 			if (active_ctx == NODE_CTX)
-				handle_node();
+				end_node();
+			flush_window();
 			if (active_ctx == REV_CTX)
 				begin_revision(local_ref);
 			if (active_ctx != DUMP_CTX)
@@ -373,7 +866,7 @@ void svndump_read(const char *url, const char *local_ref, const char *notes_ref)
 				continue;
 			if (!constcmp(t + strlen("Node-"), "path")) {
 				if (active_ctx == NODE_CTX)
-					handle_node();
+					end_node();
 				if (active_ctx == REV_CTX)
 					begin_revision(local_ref);
 				active_ctx = NODE_CTX;
@@ -461,9 +954,9 @@ void svndump_read(const char *url, const char *local_ref, const char *notes_ref)
 			if (*t)
 				die("invalid dump: expected blank line after content length header");
 			if (active_ctx == REV_CTX) {
-				read_props();
+				read_props(&input);
 			} else if (active_ctx == NODE_CTX) {
-				handle_node();
+				end_node();
 				active_ctx = INTERNODE_CTX;
 			} else {
 				fprintf(stderr, "Unexpected content length header: %"PRIu32"\n", len);
@@ -475,13 +968,19 @@ void svndump_read(const char *url, const char *local_ref, const char *notes_ref)
 	if (buffer_ferror(&input))
 		die_short_read();
 	if (active_ctx == NODE_CTX)
-		handle_node();
+		end_node();
+	flush_window();
 	if (active_ctx == REV_CTX)
 		begin_revision(local_ref);
 	if (active_ctx != DUMP_CTX)
 		end_revision(notes_ref);
 }
 
+void svndump_pipeline(int threads)
+{
+	pipeline_threads = threads;
+}
+
 static void init(int report_fd)
 {
 	fast_export_init(report_fd);
@@ -516,6 +1015,8 @@ int svndump_init_fd(int in_fd, int back_fd)
 
 void svndump_deinit(void)
 {
+	int i;
+
 	fast_export_deinit();
 	reset_dump_ctx(NULL);
 	reset_rev_ctx(0);
@@ -525,6 +1026,19 @@ void svndump_deinit(void)
 	strbuf_release(&rev_ctx.note);
 	strbuf_release(&node_ctx.src);
 	strbuf_release(&node_ctx.dst);
+	for (i = 0; i < WINDOW_NODES && window[i]; i++) {
+		struct queued_node *q = window[i];
+
+		strbuf_release(&q->node.src);
+		strbuf_release(&q->node.dst);
+		strbuf_release(&q->content);
+		strbuf_release(&q->copy.dataref);
+		strbuf_release(&q->old.dataref);
+		strbuf_release(&q->preimage);
+		free(q);
+		window[i] = NULL;
+	}
+	window_nr = 0;
 	if (buffer_deinit(&input))
 		fprintf(stderr, "Input error\n");
 	if (ferror(stdout))
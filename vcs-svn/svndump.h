@@ -3,6 +3,13 @@
 
 int svndump_init(const char *filename);
 int svndump_init_fd(int in_fd, int back_fd);
+/*
+ * Read the nodes of each revision ahead, batching what is asked of
+ * fast-import and applying text deltas on up to "threads" threads
+ * besides the main one.  Zero, the default, handles one node at a
+ * time.
+ */
+void svndump_pipeline(int threads);
 void svndump_read(const char *url, const char *local_ref, const char *notes_ref);
 void svndump_deinit(void);
 void svndump_reset(void);
@@ -16,6 +16,8 @@
 #include "column.h"
 #include "strbuf.h"
 #include "utf8.h"
+#include "fsmonitor.h"
+#include "thread-utils.h"
 
 static const char cut_line[] =
 "------------------------ >8 ------------------------\n";
@@ -570,60 +572,176 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 	}
 }
 
-static void wt_status_collect_untracked(struct wt_status *s)
-{
-	int i;
+/*
+ * What wt_status_collect_untracked() needs to scan the working tree.
+ * Setting it up reads the exclude files, which uses the static buffers
+ * of git_path(), so it has to be done before the scan is handed to
+ * another thread.
+ */
+struct untracked_scan {
+	struct wt_status *s;
 	struct dir_struct dir;
-	uint64_t t_begin = getnanotime();
+	uint64_t t_begin;
+};
 
-	if (!s->show_untracked_files)
-		return;
+static void prepare_untracked_scan(struct untracked_scan *scan,
+				   struct wt_status *s)
+{
+	struct dir_struct *dir = &scan->dir;
 
-	memset(&dir, 0, sizeof(dir));
+	scan->s = s;
+	scan->t_begin = getnanotime();
+	memset(dir, 0, sizeof(*dir));
 	if (s->show_untracked_files != SHOW_ALL_UNTRACKED_FILES)
-		dir.flags |=
+		dir->flags |=
 			DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
 	if (s->show_ignored_files)
-		dir.flags |= DIR_SHOW_IGNORED_TOO;
+		dir->flags |= DIR_SHOW_IGNORED_TOO;
 	else
-		dir.untracked = the_index.untracked;
-	setup_standard_excludes(&dir);
+		dir->untracked = the_index.untracked;
+	setup_standard_excludes(dir);
+}
 
-	fill_directory(&dir, &s->pathspec);
+static void run_untracked_scan(struct untracked_scan *scan)
+{
+	struct wt_status *s = scan->s;
+	struct dir_struct *dir = &scan->dir;
+	int i;
+
+	fill_directory(dir, &s->pathspec);
 
-	for (i = 0; i < dir.nr; i++) {
-		struct dir_entry *ent = dir.entries[i];
+	for (i = 0; i < dir->nr; i++) {
+		struct dir_entry *ent = dir->entries[i];
 		if (cache_name_is_other(ent->name, ent->len) &&
 		    dir_path_match(ent, &s->pathspec, 0, NULL))
 			string_list_insert(&s->untracked, ent->name);
 		free(ent);
 	}
 
-	for (i = 0; i < dir.ignored_nr; i++) {
-		struct dir_entry *ent = dir.ignored[i];
+	for (i = 0; i < dir->ignored_nr; i++) {
+		struct dir_entry *ent = dir->ignored[i];
 		if (cache_name_is_other(ent->name, ent->len) &&
 		    dir_path_match(ent, &s->pathspec, 0, NULL))
 			string_list_insert(&s->ignored, ent->name);
 		free(ent);
 	}
 
-	free(dir.entries);
-	free(dir.ignored);
-	clear_directory(&dir);
+	free(dir->entries);
+	free(dir->ignored);
+	clear_directory(dir);
 
 	if (advice_status_u_option)
-		s->untracked_in_ms = (getnanotime() - t_begin) / 1000000;
+		s->untracked_in_ms = (getnanotime() - scan->t_begin) / 1000000;
 }
 
-void wt_status_collect(struct wt_status *s)
+static void wt_status_collect_untracked(struct wt_status *s)
 {
+	struct untracked_scan scan;
+
+	if (!s->show_untracked_files)
+		return;
+
+	prepare_untracked_scan(&scan, s);
+	run_untracked_scan(&scan);
+}
+
+static void wt_status_collect_changes(struct wt_status *s)
+{
+	trace_region_enter("status", "worktree");
 	wt_status_collect_changes_worktree(s);
+	trace_region_leave("status", "worktree");
 
+	trace_region_enter("status", "index");
 	if (s->is_initial)
 		wt_status_collect_changes_initial(s);
 	else
 		wt_status_collect_changes_index(s);
+	trace_region_leave("status", "index");
+}
+
+#ifndef NO_PTHREADS
+static void *untracked_scan_thread(void *data)
+{
+	trace_thread_start("untracked");
+	trace_region_enter("status", "untracked");
+	run_untracked_scan(data);
+	trace_region_leave("status", "untracked");
+	trace_thread_exit();
+	return NULL;
+}
+
+static int status_parallel(void)
+{
+	int val;
+
+	if (git_config_get_bool("status.parallel", &val))
+		return online_cpus() > 1;
+	return val;
+}
+
+/*
+ * Scan for untracked files in a thread of its own while the index is
+ * compared with the working tree and with HEAD.  The two diffs stay in
+ * this thread, as the diff machinery queues its pairs in a global; the
+ * scan only looks things up in the index and reads exclude files.
+ * Returns 0 if the thread could not be started.
+ */
+static int wt_status_collect_parallel(struct wt_status *s)
+{
+	struct untracked_scan scan;
+	pthread_t thread;
+
+	/* set up what both sides look at, before they can race for it */
+	lazy_init_name_hash(&the_index);
+	refresh_fsmonitor(&the_index);
+	prepare_untracked_scan(&scan, s);
+	enable_obj_read_lock();
+
+	if (pthread_create(&thread, NULL, untracked_scan_thread, &scan)) {
+		disable_obj_read_lock();
+		clear_directory(&scan.dir);
+		return 0;
+	}
+	wt_status_collect_changes(s);
+	if (pthread_join(thread, NULL))
+		die(_("unable to join untracked scan thread"));
+	disable_obj_read_lock();
+	return 1;
+}
+#endif
+
+#ifndef NO_PTHREADS
+static int index_has_gitlinks(struct index_state *istate)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (S_ISGITLINK(istate->cache[i]->ce_mode))
+			return 1;
+	return 0;
+}
+#endif
+
+void wt_status_collect(struct wt_status *s)
+{
+#ifndef NO_PTHREADS
+	/*
+	 * With -uall the scan looks for repositories nested in untracked
+	 * directories, while the diffs look at the submodules of the
+	 * index; both fill the submodule ref caches, which are not safe
+	 * to fill from two threads.
+	 */
+	if (s->show_untracked_files && status_parallel() &&
+	    !(s->show_untracked_files == SHOW_ALL_UNTRACKED_FILES &&
+	      index_has_gitlinks(&the_index)) &&
+	    wt_status_collect_parallel(s))
+		return;
+#endif
+	wt_status_collect_changes(s);
+
+	trace_region_enter("status", "untracked");
 	wt_status_collect_untracked(s);
+	trace_region_leave("status", "untracked");
 }
 
 static void wt_status_print_unmerged(struct wt_status *s)
@@ -1437,12 +1555,12 @@ static void wt_shortstatus_unmerged(struct string_list_item *it,
 	}
 	color_fprintf(s->fp, color(WT_STATUS_UNMERGED, s), "%s", how);
 	if (s->null_termination) {
-		fprintf(stdout, " %s%c", it->string, 0);
+		fprintf(s->fp, " %s%c", it->string, 0);
 	} else {
 		struct strbuf onebuf = STRBUF_INIT;
 		const char *one;
 		one = quote_path(it->string, s->prefix, &onebuf);
-		printf(" %s\n", one);
+		fprintf(s->fp, " %s\n", one);
 		strbuf_release(&onebuf);
 	}
 }
@@ -1455,36 +1573,36 @@ static void wt_shortstatus_status(struct string_list_item *it,
 	if (d->index_status)
 		color_fprintf(s->fp, color(WT_STATUS_UPDATED, s), "%c", d->index_status);
 	else
-		putchar(' ');
+		fputc(' ', s->fp);
 	if (d->worktree_status)
 		color_fprintf(s->fp, color(WT_STATUS_CHANGED, s), "%c", d->worktree_status);
 	else
-		putchar(' ');
-	putchar(' ');
+		fputc(' ', s->fp);
+	fputc(' ', s->fp);
 	if (s->null_termination) {
-		fprintf(stdout, "%s%c", it->string, 0);
+		fprintf(s->fp, "%s%c", it->string, 0);
 		if (d->head_path)
-			fprintf(stdout, "%s%c", d->head_path, 0);
+			fprintf(s->fp, "%s%c", d->head_path, 0);
 	} else {
 		struct strbuf onebuf = STRBUF_INIT;
 		const char *one;
 		if (d->head_path) {
 			one = quote_path(d->head_path, s->prefix, &onebuf);
 			if (*one != '"' && strchr(one, ' ') != NULL) {
-				putchar('"');
+				fputc('"', s->fp);
 				strbuf_addch(&onebuf, '"');
 				one = onebuf.buf;
 			}
-			printf("%s -> ", one);
+			fprintf(s->fp, "%s -> ", one);
 			strbuf_release(&onebuf);
 		}
 		one = quote_path(it->string, s->prefix, &onebuf);
 		if (*one != '"' && strchr(one, ' ') != NULL) {
-			putchar('"');
+			fputc('"', s->fp);
 			strbuf_addch(&onebuf, '"');
 			one = onebuf.buf;
 		}
-		printf("%s\n", one);
+		fprintf(s->fp, "%s\n", one);
 		strbuf_release(&onebuf);
 	}
 }
@@ -1493,13 +1611,13 @@ static void wt_shortstatus_other(struct string_list_item *it,
 				 struct wt_status *s, const char *sign)
 {
 	if (s->null_termination) {
-		fprintf(stdout, "%s %s%c", sign, it->string, 0);
+		fprintf(s->fp, "%s %s%c", sign, it->string, 0);
 	} else {
 		struct strbuf onebuf = STRBUF_INIT;
 		const char *one;
 		one = quote_path(it->string, s->prefix, &onebuf);
 		color_fprintf(s->fp, color(WT_STATUS_UNTRACKED, s), "%s", sign);
-		printf(" %s\n", one);
+		fprintf(s->fp, " %s\n", one);
 		strbuf_release(&onebuf);
 	}
 }
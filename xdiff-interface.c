@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "xdiff-interface.h"
+#include "streaming.h"
 #include "xdiff/xtypes.h"
 #include "xdiff/xdiffi.h"
 #include "xdiff/xemit.h"
@@ -156,6 +157,57 @@ int xdi_diff_outf(mmfile_t *mf1, mmfile_t *mf2,
 	return ret;
 }
 
+struct xdiff_count_state {
+	uintmax_t *added, *deleted;
+};
+
+static int count_change(long start_a, long count_a,
+			long start_b, long count_b, void *priv)
+{
+	struct xdiff_count_state *state = priv;
+
+	*state->added += count_b;
+	*state->deleted += count_a;
+	return 0;
+}
+
+static void count_line(void *priv, char *line, unsigned long len)
+{
+	struct xdiff_count_state *state = priv;
+
+	if (line[0] == '+')
+		(*state->added)++;
+	else if (line[0] == '-')
+		(*state->deleted)++;
+}
+
+/*
+ * Add the numbers of lines the diff adds and removes to "*added" and
+ * "*deleted".  They are taken straight from the changes xdiff finds,
+ * without formatting any hunks, except with XDF_IGNORE_BLANK_LINES:
+ * then which changes count depends on how they are grouped into
+ * hunks, so the lines are counted as they are emitted.
+ */
+int xdi_diff_count(mmfile_t *mf1, mmfile_t *mf2,
+		   xpparam_t const *xpp, xdemitconf_t const *xecfg,
+		   uintmax_t *added, uintmax_t *deleted)
+{
+	struct xdiff_count_state state;
+	xdemitconf_t cfg = *xecfg;
+	xdemitcb_t ecb;
+
+	state.added = added;
+	state.deleted = deleted;
+	if (xpp->flags & XDF_IGNORE_BLANK_LINES)
+		return xdi_diff_outf(mf1, mf2, count_line, &state, xpp, xecfg);
+
+	cfg.flags |= XDL_EMIT_CHANGES;
+	cfg.hunk_func = count_change;
+	memset(&ecb, 0, sizeof(ecb));
+	ecb.priv = &state;
+	return xdi_diff(mf1, mf2, xpp, &cfg, &ecb);
+}
+
 int read_mmfile(mmfile_t *ptr, const char *filename)
 {
 	struct stat st;
@@ -202,6 +254,31 @@ int buffer_is_binary(const char *ptr, unsigned long size)
 	return !!memchr(ptr, 0, size);
 }
 
+/*
+ * buffer_is_binary() on the contents of a blob or a file, reading
+ * only the part of it that buffer_is_binary() looks at.
+ */
+int blob_is_binary(const unsigned char *sha1)
+{
+	char buf[FIRST_FEW_BYTES];
+	ssize_t len = read_object_prefix(sha1, buf, sizeof(buf));
+
+	return len > 0 && buffer_is_binary(buf, len);
+}
+
+int file_is_binary(const char *path)
+{
+	char buf[FIRST_FEW_BYTES];
+	ssize_t len;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+	len = read_in_full(fd, buf, sizeof(buf));
+	close(fd);
+	return len > 0 && buffer_is_binary(buf, len);
+}
+
 struct ff_regs {
 	int nr;
 	struct ff_reg {
@@ -44,6 +44,7 @@ extern "C" {
 #define XDL_EMIT_FUNCNAMES (1 << 0)
 #define XDL_EMIT_COMMON (1 << 1)
 #define XDL_EMIT_FUNCCONTEXT (1 << 2)
+#define XDL_EMIT_CHANGES (1 << 3)
 
 #define XDL_MMB_READONLY (1 << 0)
 
@@ -131,6 +132,9 @@ typedef struct s_xmparam {
 
 int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 		xmparam_t const *xmp, mmbuffer_t *result);
+/* Like xdl_merge(), but hand the result to ecb->outf() piece by piece */
+int xdl_merge_stream(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		xmparam_t const *xmp, xdemitcb_t *ecb);
 
 #ifdef __cplusplus
 }
@@ -544,6 +544,15 @@ static int xdl_call_hunk_func(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
 {
 	xdchange_t *xch, *xche;
 
+	if (xecfg->flags & XDL_EMIT_CHANGES) {
+		/* each change on its own, without context */
+		for (xch = xscr; xch; xch = xch->next)
+			if (xecfg->hunk_func(xch->i1, xch->chg1,
+					     xch->i2, xch->chg2, ecb->priv) < 0)
+				return -1;
+		return 0;
+	}
+
 	for (xch = xscr; xch; xch = xche->next) {
 		xche = xdl_get_hunk(&xch, xecfg);
 		if (!xch)
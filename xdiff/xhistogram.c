@@ -57,7 +57,6 @@ struct histindex {
 		struct record *next;
 	} **records, /* an occurrence */
 	  **line_map; /* map of line to record chain */
-	chastore_t rcha;
 	unsigned int *next_ptrs;
 	unsigned int table_bits,
 		     records_size,
@@ -145,7 +144,8 @@ static int scanA(struct histindex *index, int line1, int count1)
 		 * This is the first time we have ever seen this particular
 		 * element in the sequence. Construct a new chain for it.
 		 */
-		if (!(rec = xdl_cha_alloc(&index->rcha)))
+		if (!(rec = xdl_arena_alloc(&index->env->arena,
+					    sizeof(struct record))))
 			return -1;
 		rec->ptr = ptr;
 		rec->cnt = 1;
@@ -263,6 +263,7 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 {
 	struct histindex index;
 	struct region lcs;
+	xdlarmark_t mark;
 	int sz;
 	int result = -1;
 
@@ -287,68 +288,58 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 	index.env = env;
 	index.xpp = xpp;
 
-	index.records = NULL;
-	index.line_map = NULL;
-	/* in case of early xdl_cha_free() */
-	index.rcha.head = NULL;
+	/* the index lives in the arena until the LCS has been found */
+	xdl_arena_mark(&env->arena, &mark);
 
 	index.table_bits = xdl_hashbits(count1);
 	sz = index.records_size = 1 << index.table_bits;
 	sz *= sizeof(struct record *);
-	if (!(index.records = (struct record **) xdl_malloc(sz)))
+	if (!(index.records = (struct record **) xdl_arena_alloc(&env->arena, sz)))
 		goto cleanup;
 	memset(index.records, 0, sz);
 
 	sz = index.line_map_size = count1;
 	sz *= sizeof(struct record *);
-	if (!(index.line_map = (struct record **) xdl_malloc(sz)))
+	if (!(index.line_map = (struct record **) xdl_arena_alloc(&env->arena, sz)))
 		goto cleanup;
 	memset(index.line_map, 0, sz);
 
 	sz = index.line_map_size;
 	sz *= sizeof(unsigned int);
-	if (!(index.next_ptrs = (unsigned int *) xdl_malloc(sz)))
+	if (!(index.next_ptrs = (unsigned int *) xdl_arena_alloc(&env->arena, sz)))
 		goto cleanup;
 	memset(index.next_ptrs, 0, sz);
 
-	/* lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx() */
-	if (xdl_cha_init(&index.rcha, sizeof(struct record), count1 / 4 + 1) < 0)
-		goto cleanup;
-
 	index.ptr_shift = line1;
 	index.max_chain_length = 64;
 
 	memset(&lcs, 0, sizeof(lcs));
-	if (find_lcs(&index, &lcs, line1, count1, line2, count2))
-		result = fall_back_to_classic_diff(&index, line1, count1, line2, count2);
-	else {
-		if (lcs.begin1 == 0 && lcs.begin2 == 0) {
-			while (count1--)
-				env->xdf1.rchg[line1++ - 1] = 1;
-			while (count2--)
-				env->xdf2.rchg[line2++ - 1] = 1;
-			result = 0;
-		} else {
-			result = histogram_diff(xpp, env,
-						line1, lcs.begin1 - line1,
-						line2, lcs.begin2 - line2);
-			if (result)
-				goto cleanup;
-			result = histogram_diff(xpp, env,
-						lcs.end1 + 1, LINE_END(1) - lcs.end1,
-						lcs.end2 + 1, LINE_END(2) - lcs.end2);
-			if (result)
-				goto cleanup;
-		}
+	result = find_lcs(&index, &lcs, line1, count1, line2, count2);
+	xdl_arena_release(&env->arena, &mark);
+
+	if (result)
+		return fall_back_to_classic_diff(&index, line1, count1, line2, count2);
+
+	if (lcs.begin1 == 0 && lcs.begin2 == 0) {
+		while (count1--)
+			env->xdf1.rchg[line1++ - 1] = 1;
+		while (count2--)
+			env->xdf2.rchg[line2++ - 1] = 1;
+		return 0;
 	}
 
-cleanup:
-	xdl_free(index.records);
-	xdl_free(index.line_map);
-	xdl_free(index.next_ptrs);
-	xdl_cha_free(&index.rcha);
+	result = histogram_diff(xpp, env,
+				line1, lcs.begin1 - line1,
+				line2, lcs.begin2 - line2);
+	if (result)
+		return result;
+	return histogram_diff(xpp, env,
+			      lcs.end1 + 1, LINE_END(1) - lcs.end1,
+			      lcs.end2 + 1, LINE_END(2) - lcs.end2);
 
-	return result;
+cleanup:
+	xdl_arena_release(&env->arena, &mark);
+	return -1;
 }
 
 int xdl_do_histogram_diff(mmfile_t *file1, mmfile_t *file2,
@@ -109,155 +109,160 @@ static int xdl_merge_cmp_lines(xdfenv_t *xe1, int i1, xdfenv_t *xe2, int i2,
 	return 0;
 }
 
-static int xdl_recs_copy_0(int use_orig, xdfenv_t *xe, int i, int count, int add_nl, char *dest)
+/*
+ * Where the merge result goes: into "dest", which has been sized by
+ * an earlier pass with neither "dest" nor "ecb" set, or to "ecb" as
+ * it is produced.
+ */
+typedef struct s_xdmerge_out {
+	char *dest;
+	xdemitcb_t *ecb;
+	long size;
+	int error;
+} xdmerge_out_t;
+
+static void xdl_merge_out(xdmerge_out_t *out, const char *ptr, long size)
+{
+	if (out->dest)
+		memcpy(out->dest + out->size, ptr, size);
+	else if (out->ecb && size && !out->error) {
+		mmbuffer_t mb;
+
+		mb.ptr = (char *)ptr;
+		mb.size = size;
+		if (out->ecb->outf(out->ecb->priv, &mb, 1) < 0)
+			out->error = -1;
+	}
+	out->size += size;
+}
+
+static void xdl_recs_copy_0(xdmerge_out_t *out, int use_orig, xdfenv_t *xe,
+			    int i, int count, int add_nl)
 {
 	xrecord_t **recs;
-	int size = 0;
+	const char *run = NULL;
+	long run_size = 0;
 
 	recs = (use_orig ? xe->xdf1.recs : xe->xdf2.recs) + i;
 
 	if (count < 1)
-		return 0;
+		return;
 
-	for (i = 0; i < count; size += recs[i++]->size)
-		if (dest)
-			memcpy(dest + size, recs[i]->ptr, recs[i]->size);
+	/* lines that are next to each other in the file go out together */
+	for (i = 0; i < count; i++) {
+		if (run && run + run_size != recs[i]->ptr) {
+			xdl_merge_out(out, run, run_size);
+			run = NULL;
+		}
+		if (!run) {
+			run = recs[i]->ptr;
+			run_size = 0;
+		}
+		run_size += recs[i]->size;
+	}
+	xdl_merge_out(out, run, run_size);
 	if (add_nl) {
 		i = recs[count - 1]->size;
-		if (i == 0 || recs[count - 1]->ptr[i - 1] != '\n') {
-			if (dest)
-				dest[size] = '\n';
-			size++;
-		}
+		if (i == 0 || recs[count - 1]->ptr[i - 1] != '\n')
+			xdl_merge_out(out, "\n", 1);
 	}
-	return size;
 }
 
-static int xdl_recs_copy(xdfenv_t *xe, int i, int count, int add_nl, char *dest)
+static void xdl_recs_copy(xdmerge_out_t *out, xdfenv_t *xe, int i, int count,
+			  int add_nl)
 {
-	return xdl_recs_copy_0(0, xe, i, count, add_nl, dest);
+	xdl_recs_copy_0(out, 0, xe, i, count, add_nl);
 }
 
-static int xdl_orig_copy(xdfenv_t *xe, int i, int count, int add_nl, char *dest)
+static void xdl_orig_copy(xdmerge_out_t *out, xdfenv_t *xe, int i, int count,
+			  int add_nl)
 {
-	return xdl_recs_copy_0(1, xe, i, count, add_nl, dest);
+	xdl_recs_copy_0(out, 1, xe, i, count, add_nl);
 }
 
-static int fill_conflict_hunk(xdfenv_t *xe1, const char *name1,
-			      xdfenv_t *xe2, const char *name2,
-			      const char *name3,
-			      int size, int i, int style,
-			      xdmerge_t *m, char *dest, int marker_size)
+static void xdl_marker_out(xdmerge_out_t *out, int ch, int marker_size,
+			   const char *name)
 {
-	int marker1_size = (name1 ? strlen(name1) + 1 : 0);
-	int marker2_size = (name2 ? strlen(name2) + 1 : 0);
-	int marker3_size = (name3 ? strlen(name3) + 1 : 0);
+	char buf[64];
+
+	memset(buf, ch, sizeof(buf));
+	while (marker_size > 0) {
+		int len = marker_size < sizeof(buf) ? marker_size : sizeof(buf);
+		xdl_merge_out(out, buf, len);
+		marker_size -= len;
+	}
+	if (name) {
+		xdl_merge_out(out, " ", 1);
+		xdl_merge_out(out, name, strlen(name));
+	}
+	xdl_merge_out(out, "\n", 1);
+}
 
+static void fill_conflict_hunk(xdmerge_out_t *out,
+			       xdfenv_t *xe1, const char *name1,
+			       xdfenv_t *xe2, const char *name2,
+			       const char *name3,
+			       int i, int style,
+			       xdmerge_t *m, int marker_size)
+{
 	if (marker_size <= 0)
 		marker_size = DEFAULT_CONFLICT_MARKER_SIZE;
 
 	/* Before conflicting part */
-	size += xdl_recs_copy(xe1, i, m->i1 - i, 0,
-			      dest ? dest + size : NULL);
+	xdl_recs_copy(out, xe1, i, m->i1 - i, 0);
 
-	if (!dest) {
-		size += marker_size + 1 + marker1_size;
-	} else {
-		memset(dest + size, '<', marker_size);
-		size += marker_size;
-		if (marker1_size) {
-			dest[size] = ' ';
-			memcpy(dest + size + 1, name1, marker1_size - 1);
-			size += marker1_size;
-		}
-		dest[size++] = '\n';
-	}
+	xdl_marker_out(out, '<', marker_size, name1);
 
 	/* Postimage from side #1 */
-	size += xdl_recs_copy(xe1, m->i1, m->chg1, 1,
-			      dest ? dest + size : NULL);
+	xdl_recs_copy(out, xe1, m->i1, m->chg1, 1);
 
 	if (style == XDL_MERGE_DIFF3) {
 		/* Shared preimage */
-		if (!dest) {
-			size += marker_size + 1 + marker3_size;
-		} else {
-			memset(dest + size, '|', marker_size);
-			size += marker_size;
-			if (marker3_size) {
-				dest[size] = ' ';
-				memcpy(dest + size + 1, name3, marker3_size - 1);
-				size += marker3_size;
-			}
-			dest[size++] = '\n';
-		}
-		size += xdl_orig_copy(xe1, m->i0, m->chg0, 1,
-				      dest ? dest + size : NULL);
+		xdl_marker_out(out, '|', marker_size, name3);
+		xdl_orig_copy(out, xe1, m->i0, m->chg0, 1);
 	}
 
-	if (!dest) {
-		size += marker_size + 1;
-	} else {
-		memset(dest + size, '=', marker_size);
-		size += marker_size;
-		dest[size++] = '\n';
-	}
+	xdl_marker_out(out, '=', marker_size, NULL);
 
 	/* Postimage from side #2 */
-	size += xdl_recs_copy(xe2, m->i2, m->chg2, 1,
-			      dest ? dest + size : NULL);
-	if (!dest) {
-		size += marker_size + 1 + marker2_size;
-	} else {
-		memset(dest + size, '>', marker_size);
-		size += marker_size;
-		if (marker2_size) {
-			dest[size] = ' ';
-			memcpy(dest + size + 1, name2, marker2_size - 1);
-			size += marker2_size;
-		}
-		dest[size++] = '\n';
-	}
-	return size;
+	xdl_recs_copy(out, xe2, m->i2, m->chg2, 1);
+
+	xdl_marker_out(out, '>', marker_size, name2);
 }
 
-static int xdl_fill_merge_buffer(xdfenv_t *xe1, const char *name1,
-				 xdfenv_t *xe2, const char *name2,
-				 const char *ancestor_name,
-				 int favor,
-				 xdmerge_t *m, char *dest, int style,
-				 int marker_size)
+static void xdl_fill_merge_buffer(xdmerge_out_t *out,
+				  xdfenv_t *xe1, const char *name1,
+				  xdfenv_t *xe2, const char *name2,
+				  const char *ancestor_name,
+				  int favor,
+				  xdmerge_t *m, int style,
+				  int marker_size)
 {
-	int size, i;
+	int i;
 
-	for (size = i = 0; m; m = m->next) {
+	for (i = 0; m; m = m->next) {
 		if (favor && !m->mode)
 			m->mode = favor;
 
 		if (m->mode == 0)
-			size = fill_conflict_hunk(xe1, name1, xe2, name2,
-						  ancestor_name,
-						  size, i, style, m, dest,
-						  marker_size);
+			fill_conflict_hunk(out, xe1, name1, xe2, name2,
+					   ancestor_name, i, style, m,
+					   marker_size);
 		else if (m->mode & 3) {
 			/* Before conflicting part */
-			size += xdl_recs_copy(xe1, i, m->i1 - i, 0,
-					      dest ? dest + size : NULL);
+			xdl_recs_copy(out, xe1, i, m->i1 - i, 0);
 			/* Postimage from side #1 */
 			if (m->mode & 1)
-				size += xdl_recs_copy(xe1, m->i1, m->chg1, (m->mode & 2),
-						      dest ? dest + size : NULL);
+				xdl_recs_copy(out, xe1, m->i1, m->chg1,
+					      (m->mode & 2));
 			/* Postimage from side #2 */
 			if (m->mode & 2)
-				size += xdl_recs_copy(xe2, m->i2, m->chg2, 0,
-						      dest ? dest + size : NULL);
+				xdl_recs_copy(out, xe2, m->i2, m->chg2, 0);
 		} else
 			continue;
 		i = m->i1 + m->chg1;
 	}
-	size += xdl_recs_copy(xe1, i, xe1->xdf2.nrec - i, 0,
-			      dest ? dest + size : NULL);
-	return size;
+	xdl_recs_copy(out, xe1, i, xe1->xdf2.nrec - i, 0);
 }
 
 /*
@@ -408,7 +413,7 @@ static int xdl_simplify_non_conflicts(xdfenv_t *xe1, xdmerge_t *m,
  */
 static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1,
 		xdfenv_t *xe2, xdchange_t *xscr2,
-		xmparam_t const *xmp, mmbuffer_t *result)
+		xmparam_t const *xmp, mmbuffer_t *result, xdemitcb_t *ecb)
 {
 	xdmerge_t *changes, *c;
 	xpparam_t const *xpp = &xmp->xpp;
@@ -549,65 +554,99 @@ static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1,
 		return -1;
 	}
 	/* output */
-	if (result) {
+	if (result || ecb) {
 		int marker_size = xmp->marker_size;
-		int size = xdl_fill_merge_buffer(xe1, name1, xe2, name2,
-						 ancestor_name,
-						 favor, changes, NULL, style,
-						 marker_size);
-		result->ptr = xdl_malloc(size);
-		if (!result->ptr) {
+		xdmerge_out_t out;
+
+		memset(&out, 0, sizeof(out));
+		if (ecb)
+			out.ecb = ecb;
+		else {
+			xdl_fill_merge_buffer(&out, xe1, name1, xe2, name2,
+					      ancestor_name, favor, changes,
+					      style, marker_size);
+			result->ptr = xdl_malloc(out.size);
+			if (!result->ptr) {
+				xdl_cleanup_merge(changes);
+				return -1;
+			}
+			result->size = out.size;
+			out.dest = result->ptr;
+			out.size = 0;
+		}
+		xdl_fill_merge_buffer(&out, xe1, name1, xe2, name2,
+				      ancestor_name, favor, changes,
+				      style, marker_size);
+		if (out.error) {
 			xdl_cleanup_merge(changes);
 			return -1;
 		}
-		result->size = size;
-		xdl_fill_merge_buffer(xe1, name1, xe2, name2,
-				      ancestor_name, favor, changes,
-				      result->ptr, style, marker_size);
 	}
 	return xdl_cleanup_merge(changes);
 }
 
-int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
-		xmparam_t const *xmp, mmbuffer_t *result)
+static int xdl_merge_0(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		       xmparam_t const *xmp, mmbuffer_t *result,
+		       xdemitcb_t *ecb)
 {
 	xdchange_t *xscr1, *xscr2;
 	xdfenv_t xe1, xe2;
 	int status;
 	xpparam_t const *xpp = &xmp->xpp;
 
-	result->ptr = NULL;
-	result->size = 0;
+	if (result) {
+		result->ptr = NULL;
+		result->size = 0;
+	}
 
-	if (xdl_do_diff(orig, mf1, xpp, &xe1) < 0 ||
-			xdl_do_diff(orig, mf2, xpp, &xe2) < 0) {
+	/*
+	 * The merge only looks at the records of the ancestor and of
+	 * both sides, so drop the rest of each diff as soon as its
+	 * script is built, including the second copy of the ancestor.
+	 */
+	if (xdl_do_diff(orig, mf1, xpp, &xe1) < 0)
 		return -1;
-	}
 	if (xdl_change_compact(&xe1.xdf1, &xe1.xdf2, xpp->flags) < 0 ||
 	    xdl_change_compact(&xe1.xdf2, &xe1.xdf1, xpp->flags) < 0 ||
 	    xdl_build_script(&xe1, &xscr1) < 0) {
 		xdl_free_env(&xe1);
 		return -1;
 	}
+	xdl_shrink_env(&xe1, 0);
+	if (xdl_do_diff(orig, mf2, xpp, &xe2) < 0) {
+		xdl_free_script(xscr1);
+		xdl_free_env(&xe1);
+		return -1;
+	}
 	if (xdl_change_compact(&xe2.xdf1, &xe2.xdf2, xpp->flags) < 0 ||
 	    xdl_change_compact(&xe2.xdf2, &xe2.xdf1, xpp->flags) < 0 ||
 	    xdl_build_script(&xe2, &xscr2) < 0) {
+		xdl_free_script(xscr1);
+		xdl_free_env(&xe1);
 		xdl_free_env(&xe2);
 		return -1;
 	}
+	xdl_shrink_env(&xe2, 1);
 	status = 0;
-	if (!xscr1) {
-		result->ptr = xdl_malloc(mf2->size);
-		memcpy(result->ptr, mf2->ptr, mf2->size);
-		result->size = mf2->size;
-	} else if (!xscr2) {
-		result->ptr = xdl_malloc(mf1->size);
-		memcpy(result->ptr, mf1->ptr, mf1->size);
-		result->size = mf1->size;
+	if (!xscr1 || !xscr2) {
+		mmfile_t *mf = !xscr1 ? mf2 : mf1;
+
+		if (ecb) {
+			mmbuffer_t mb;
+
+			mb.ptr = mf->ptr;
+			mb.size = mf->size;
+			if (mb.size && ecb->outf(ecb->priv, &mb, 1) < 0)
+				status = -1;
+		} else if (result) {
+			result->ptr = xdl_malloc(mf->size);
+			memcpy(result->ptr, mf->ptr, mf->size);
+			result->size = mf->size;
+		}
 	} else {
 		status = xdl_do_merge(&xe1, xscr1,
 				      &xe2, xscr2,
-				      xmp, result);
+				      xmp, result, ecb);
 	}
 	xdl_free_script(xscr1);
 	xdl_free_script(xscr2);
@@ -617,3 +656,15 @@ int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 
 	return status;
 }
+
+int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		xmparam_t const *xmp, mmbuffer_t *result)
+{
+	return xdl_merge_0(orig, mf1, mf2, xmp, result, NULL);
+}
+
+int xdl_merge_stream(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		     xmparam_t const *xmp, xdemitcb_t *ecb)
+{
+	return xdl_merge_0(orig, mf1, mf2, xmp, NULL, ecb);
+}
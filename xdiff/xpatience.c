@@ -140,7 +140,7 @@ static int fill_hashmap(mmfile_t *file1, mmfile_t *file2,
 	/* We know exactly how large we want the hash map */
 	result->alloc = count1 * 2;
 	result->entries = (struct entry *)
-		xdl_malloc(result->alloc * sizeof(struct entry));
+		xdl_arena_alloc(&env->arena, result->alloc * sizeof(struct entry));
 	if (!result->entries)
 		return -1;
 	memset(result->entries, 0, result->alloc * sizeof(struct entry));
@@ -188,10 +188,17 @@ static int binary_search(struct entry **sequence, int longest,
  */
 static struct entry *find_longest_common_sequence(struct hashmap *map)
 {
-	struct entry **sequence = xdl_malloc(map->nr * sizeof(struct entry *));
+	xdlarena_t *arena = &map->env->arena;
+	xdlarmark_t mark;
+	struct entry **sequence;
 	int longest = 0, i;
 	struct entry *entry;
 
+	xdl_arena_mark(arena, &mark);
+	sequence = xdl_arena_alloc(arena, map->nr * sizeof(struct entry *));
+	if (!sequence)
+		return NULL;
+
 	for (entry = map->first; entry; entry = entry->next) {
 		if (!entry->line2 || entry->line2 == NON_UNIQUE)
 			continue;
@@ -204,7 +211,7 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 
 	/* No common unique lines were found */
 	if (!longest) {
-		xdl_free(sequence);
+		xdl_arena_release(arena, &mark);
 		return NULL;
 	}
 
@@ -215,7 +222,7 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 		entry->previous->next = entry;
 		entry = entry->previous;
 	}
-	xdl_free(sequence);
+	xdl_arena_release(arena, &mark);
 	return entry;
 }
 
@@ -306,6 +313,7 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 {
 	struct hashmap map;
 	struct entry *first;
+	xdlarmark_t mark;
 	int result = 0;
 
 	/* trivial case: one side is empty */
@@ -319,6 +327,8 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		return 0;
 	}
 
+	/* the map is needed while recursing into the gaps between its lines */
+	xdl_arena_mark(&env->arena, &mark);
 	memset(&map, 0, sizeof(map));
 	if (fill_hashmap(file1, file2, xpp, env, &map,
 			line1, count1, line2, count2))
@@ -330,7 +340,7 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 			env->xdf1.rchg[line1++ - 1] = 1;
 		while(count2--)
 			env->xdf2.rchg[line2++ - 1] = 1;
-		xdl_free(map.entries);
+		xdl_arena_release(&env->arena, &mark);
 		return 0;
 	}
 
@@ -342,7 +352,7 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		result = fall_back_to_classic_diff(&map,
 			line1, count1, line2, count2);
 
-	xdl_free(map.entries);
+	xdl_arena_release(&env->arena, &mark);
 	return result;
 }
 
@@ -28,23 +28,31 @@
 #define XDL_SIMSCAN_WINDOW 100
 #define XDL_GUESS_NLINES1 256
 #define XDL_GUESS_NLINES2 20
+#define XDL_ARENA_NODE_SIZE 4096
 
 
 typedef struct s_xdlclass {
-	struct s_xdlclass *next;
 	unsigned long ha;
 	char const *line;
 	long size;
-	long idx;
 	long len1, len2;
 } xdlclass_t;
 
+/*
+ * An open addressing table keeps the low bits of the hash next to the
+ * class index, so that looking up a line only touches the class itself
+ * (and the line it was made from) when the hashes are equal.
+ */
+typedef struct s_xdlclass_slot {
+	unsigned int ha; /* low bits of the line hash */
+	unsigned int idx; /* 1 + index in rcrecs, or 0 if the slot is free */
+} xdlclass_slot_t;
+
 typedef struct s_xdlclassifier {
 	unsigned int hbits;
 	long hsize;
-	xdlclass_t **rchash;
-	chastore_t ncha;
-	xdlclass_t **rcrecs;
+	xdlclass_slot_t *rchash;
+	xdlclass_t *rcrecs;
 	long alloc;
 	long count;
 	long flags;
@@ -55,8 +63,7 @@ typedef struct s_xdlclassifier {
 
 static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags);
 static void xdl_free_classifier(xdlclassifier_t *cf);
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-			       unsigned int hbits, xrecord_t *rec);
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t *rec);
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf);
 static void xdl_free_ctx(xdfile_t *xdf);
@@ -68,28 +75,32 @@ static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2
 
 
 
+/*
+ * The low bits of a line hash mostly come from the first bytes of each
+ * word of the line; multiply to spread all of them over the slot index.
+ */
+static long xdl_class_slot(unsigned long ha, unsigned int hbits) {
+
+	return (long) ((ha * 0x9e3779b1UL) >> (CHAR_BIT * sizeof(unsigned long) - hbits));
+}
+
+
 static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 	cf->flags = flags;
 
-	cf->hbits = xdl_hashbits((unsigned int) size);
-	cf->hsize = 1 << cf->hbits;
+	cf->hbits = xdl_hashbits((unsigned int) size) + 1;
+	cf->hsize = 1L << cf->hbits;
 
-	if (xdl_cha_init(&cf->ncha, sizeof(xdlclass_t), size / 4 + 1) < 0) {
-
-		return -1;
-	}
-	if (!(cf->rchash = (xdlclass_t **) xdl_malloc(cf->hsize * sizeof(xdlclass_t *)))) {
+	if (!(cf->rchash = (xdlclass_slot_t *) xdl_malloc(cf->hsize * sizeof(xdlclass_slot_t)))) {
 
-		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
-	memset(cf->rchash, 0, cf->hsize * sizeof(xdlclass_t *));
+	memset(cf->rchash, 0, cf->hsize * sizeof(xdlclass_slot_t));
 
 	cf->alloc = size;
-	if (!(cf->rcrecs = (xdlclass_t **) xdl_malloc(cf->alloc * sizeof(xdlclass_t *)))) {
+	if (!(cf->rcrecs = (xdlclass_t *) xdl_malloc(cf->alloc * sizeof(xdlclass_t)))) {
 
 		xdl_free(cf->rchash);
-		xdl_cha_free(&cf->ncha);
 		return -1;
 	}
 
@@ -103,55 +114,83 @@ static void xdl_free_classifier(xdlclassifier_t *cf) {
 
 	xdl_free(cf->rcrecs);
 	xdl_free(cf->rchash);
-	xdl_cha_free(&cf->ncha);
 }
 
 
-static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t **rhash,
-			       unsigned int hbits, xrecord_t *rec) {
+/*
+ * Double the table once it is half full; the number of lines it was
+ * sized for is only a guess.
+ */
+static int xdl_grow_classifier(xdlclassifier_t *cf) {
+	unsigned int hbits = cf->hbits + 1;
+	long i, hi, hsize = 1L << hbits;
+	xdlclass_slot_t *rchash;
+
+	if (!(rchash = (xdlclass_slot_t *) xdl_malloc(hsize * sizeof(xdlclass_slot_t)))) {
+
+		return -1;
+	}
+	memset(rchash, 0, hsize * sizeof(xdlclass_slot_t));
+
+	for (i = 0; i < cf->count; i++) {
+		hi = xdl_class_slot(cf->rcrecs[i].ha, hbits);
+		while (rchash[hi].idx)
+			hi = (hi + 1) & (hsize - 1);
+		rchash[hi].ha = (unsigned int) cf->rcrecs[i].ha;
+		rchash[hi].idx = i + 1;
+	}
+
+	xdl_free(cf->rchash);
+	cf->rchash = rchash;
+	cf->hbits = hbits;
+	cf->hsize = hsize;
+
+	return 0;
+}
+
+
+static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t *rec) {
 	long hi;
-	char const *line;
+	xdlclass_slot_t *slot;
 	xdlclass_t *rcrec;
-	xdlclass_t **rcrecs;
-
-	line = rec->ptr;
-	hi = (long) XDL_HASHLONG(rec->ha, cf->hbits);
-	for (rcrec = cf->rchash[hi]; rcrec; rcrec = rcrec->next)
-		if (rcrec->ha == rec->ha &&
-				xdl_recmatch(rcrec->line, rcrec->size,
-					rec->ptr, rec->size, cf->flags))
-			break;
-
-	if (!rcrec) {
-		if (!(rcrec = xdl_cha_alloc(&cf->ncha))) {
+	xdlclass_t *rcrecs;
 
-			return -1;
+	for (hi = xdl_class_slot(rec->ha, cf->hbits); ; hi = (hi + 1) & (cf->hsize - 1)) {
+		slot = &cf->rchash[hi];
+		if (!slot->idx)
+			break;
+		if (slot->ha == (unsigned int) rec->ha) {
+			rcrec = &cf->rcrecs[slot->idx - 1];
+			if (xdl_recmatch(rcrec->line, rcrec->size,
+					 rec->ptr, rec->size, cf->flags))
+				break;
 		}
-		rcrec->idx = cf->count++;
-		if (cf->count > cf->alloc) {
+	}
+
+	if (!slot->idx) {
+		if (cf->count >= cf->alloc) {
 			cf->alloc *= 2;
-			if (!(rcrecs = (xdlclass_t **) xdl_realloc(cf->rcrecs, cf->alloc * sizeof(xdlclass_t *)))) {
+			if (!(rcrecs = (xdlclass_t *) xdl_realloc(cf->rcrecs, cf->alloc * sizeof(xdlclass_t)))) {
 
 				return -1;
 			}
 			cf->rcrecs = rcrecs;
 		}
-		cf->rcrecs[rcrec->idx] = rcrec;
-		rcrec->line = line;
+		rcrec = &cf->rcrecs[cf->count++];
+		rcrec->line = rec->ptr;
 		rcrec->size = rec->size;
 		rcrec->ha = rec->ha;
 		rcrec->len1 = rcrec->len2 = 0;
-		rcrec->next = cf->rchash[hi];
-		cf->rchash[hi] = rcrec;
+		slot->ha = (unsigned int) rec->ha;
+		slot->idx = (unsigned int) cf->count;
 	}
 
 	(pass == 1) ? rcrec->len1++ : rcrec->len2++;
 
-	rec->ha = (unsigned long) rcrec->idx;
+	rec->ha = (unsigned long) (slot->idx - 1);
 
-	hi = (long) XDL_HASHLONG(rec->ha, hbits);
-	rec->next = rhash[hi];
-	rhash[hi] = rec;
+	if (2 * cf->count > cf->hsize && xdl_grow_classifier(cf) < 0)
+		return -1;
 
 	return 0;
 }
@@ -159,13 +198,11 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
 
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf) {
-	unsigned int hbits;
-	long nrec, hsize, bsize;
+	long nrec, bsize;
 	unsigned long hav;
 	char const *blk, *cur, *top, *prev;
 	xrecord_t *crec;
 	xrecord_t **recs, **rrecs;
-	xrecord_t **rhash;
 	unsigned long *ha;
 	char *rchg;
 	long *rindex;
@@ -173,7 +210,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	ha = NULL;
 	rindex = NULL;
 	rchg = NULL;
-	rhash = NULL;
 	recs = NULL;
 
 	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec / 4 + 1) < 0)
@@ -181,16 +217,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 	if (!(recs = (xrecord_t **) xdl_malloc(narec * sizeof(xrecord_t *))))
 		goto abort;
 
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
-		hbits = hsize = 0;
-	else {
-		hbits = xdl_hashbits((unsigned int) narec);
-		hsize = 1 << hbits;
-		if (!(rhash = (xrecord_t **) xdl_malloc(hsize * sizeof(xrecord_t *))))
-			goto abort;
-		memset(rhash, 0, hsize * sizeof(xrecord_t *));
-	}
-
 	nrec = 0;
 	if ((cur = blk = xdl_mmfile_first(mf, &bsize)) != NULL) {
 		for (top = blk + bsize; cur < top; ) {
@@ -210,7 +236,7 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 			recs[nrec++] = crec;
 
 			if ((XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF) &&
-			    xdl_classify_record(pass, cf, rhash, hbits, crec) < 0)
+			    xdl_classify_record(pass, cf, crec) < 0)
 				goto abort;
 		}
 	}
@@ -226,8 +252,6 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 
 	xdf->nrec = nrec;
 	xdf->recs = recs;
-	xdf->hbits = hbits;
-	xdf->rhash = rhash;
 	xdf->rchg = rchg + 1;
 	xdf->rindex = rindex;
 	xdf->nreff = 0;
@@ -241,20 +265,29 @@ abort:
 	xdl_free(ha);
 	xdl_free(rindex);
 	xdl_free(rchg);
-	xdl_free(rhash);
 	xdl_free(recs);
 	xdl_cha_free(&xdf->rcha);
 	return -1;
 }
 
 
-static void xdl_free_ctx(xdfile_t *xdf) {
+static void xdl_free_diff_state(xdfile_t *xdf) {
 
-	xdl_free(xdf->rhash);
 	xdl_free(xdf->rindex);
-	xdl_free(xdf->rchg - 1);
+	xdf->rindex = NULL;
+	if (xdf->rchg)
+		xdl_free(xdf->rchg - 1);
+	xdf->rchg = NULL;
 	xdl_free(xdf->ha);
+	xdf->ha = NULL;
+}
+
+
+static void xdl_free_ctx(xdfile_t *xdf) {
+
+	xdl_free_diff_state(xdf);
 	xdl_free(xdf->recs);
+	xdf->recs = NULL;
 	xdl_cha_free(&xdf->rcha);
 }
 
@@ -265,11 +298,12 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	xdlclassifier_t cf;
 
 	memset(&cf, 0, sizeof(cf));
+	xdl_arena_init(&xe->arena, XDL_ARENA_NODE_SIZE);
 
 	/*
 	 * For histogram diff, we can afford a smaller sample size and
-	 * thus a poorer estimate of the number of lines, as the hash
-	 * table (rhash) won't be filled up/grown. The number of lines
+	 * thus a poorer estimate of the number of lines, as the
+	 * classifier won't be filled up/grown. The number of lines
 	 * (nrecs) will be updated correctly anyway by
 	 * xdl_prepare_ctx().
 	 */
@@ -315,6 +349,20 @@ void xdl_free_env(xdfenv_t *xe) {
 
 	xdl_free_ctx(&xe->xdf2);
 	xdl_free_ctx(&xe->xdf1);
+	xdl_arena_free(&xe->arena);
+}
+
+
+void xdl_shrink_env(xdfenv_t *xe, int drop_xdf1_recs) {
+
+	xdl_free_diff_state(&xe->xdf1);
+	xdl_free_diff_state(&xe->xdf2);
+	xdl_arena_free(&xe->arena);
+	if (drop_xdf1_recs) {
+		xdl_free(xe->xdf1.recs);
+		xe->xdf1.recs = NULL;
+		xdl_cha_free(&xe->xdf1.rcha);
+	}
 }
 
 
@@ -384,7 +432,6 @@ static int xdl_clean_mmatch(char const *dis, long i, long s, long e) {
 static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2) {
 	long i, nm, nreff, mlim;
 	xrecord_t **recs;
-	xdlclass_t *rcrec;
 	char *dis, *dis1, *dis2;
 
 	if (!(dis = (char *) xdl_malloc(xdf1->nrec + xdf2->nrec + 2))) {
@@ -398,16 +445,14 @@ static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xd
 	if ((mlim = xdl_bogosqrt(xdf1->nrec)) > XDL_MAX_EQLIMIT)
 		mlim = XDL_MAX_EQLIMIT;
 	for (i = xdf1->dstart, recs = &xdf1->recs[xdf1->dstart]; i <= xdf1->dend; i++, recs++) {
-		rcrec = cf->rcrecs[(*recs)->ha];
-		nm = rcrec ? rcrec->len2 : 0;
+		nm = cf->rcrecs[(*recs)->ha].len2;
 		dis1[i] = (nm == 0) ? 0: (nm >= mlim) ? 2: 1;
 	}
 
 	if ((mlim = xdl_bogosqrt(xdf2->nrec)) > XDL_MAX_EQLIMIT)
 		mlim = XDL_MAX_EQLIMIT;
 	for (i = xdf2->dstart, recs = &xdf2->recs[xdf2->dstart]; i <= xdf2->dend; i++, recs++) {
-		rcrec = cf->rcrecs[(*recs)->ha];
-		nm = rcrec ? rcrec->len1 : 0;
+		nm = cf->rcrecs[(*recs)->ha].len1;
 		dis2[i] = (nm == 0) ? 0: (nm >= mlim) ? 2: 1;
 	}
 
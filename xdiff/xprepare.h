@@ -28,6 +28,12 @@
 int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		    xdfenv_t *xe);
 void xdl_free_env(xdfenv_t *xe);
+/*
+ * Free what only the diff itself needs, keeping the records; with
+ * "drop_xdf1_recs" the records of the first file go too, leaving
+ * only its "nrec".
+ */
+void xdl_shrink_env(xdfenv_t *xe, int drop_xdf1_recs);
 
 
 
@@ -38,8 +38,28 @@ typedef struct s_chastore {
 	long scurr;
 } chastore_t;
 
+typedef struct s_xdlarnode {
+	struct s_xdlarnode *next;
+	long icurr, isize;
+} xdlarnode_t;
+
+/*
+ * Scratch memory for the diff algorithms, handed out and taken back
+ * in LIFO order: xdl_arena_release() frees everything allocated after
+ * the matching xdl_arena_mark() in one step, and keeps the nodes for
+ * the next allocations.
+ */
+typedef struct s_xdlarena {
+	xdlarnode_t *head, *cur;
+	long nsize;
+} xdlarena_t;
+
+typedef struct s_xdlarmark {
+	xdlarnode_t *node;
+	long icurr;
+} xdlarmark_t;
+
 typedef struct s_xrecord {
-	struct s_xrecord *next;
 	char const *ptr;
 	long size;
 	unsigned long ha;
@@ -48,8 +68,6 @@ typedef struct s_xrecord {
 typedef struct s_xdfile {
 	chastore_t rcha;
 	long nrec;
-	unsigned int hbits;
-	xrecord_t **rhash;
 	long dstart, dend;
 	xrecord_t **recs;
 	char *rchg;
@@ -60,6 +78,7 @@ typedef struct s_xdfile {
 
 typedef struct s_xdfenv {
 	xdfile_t xdf1, xdf2;
+	xdlarena_t arena;
 } xdfenv_t;
 
 
@@ -94,6 +94,7 @@ void xdl_cha_free(chastore_t *cha) {
 		cur = cur->next;
 		xdl_free(tmp);
 	}
+	cha->head = cha->tail = cha->ancur = NULL;
 }
 
 
@@ -122,6 +123,77 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	return data;
 }
 
+#define XDL_ARENA_ALIGN(n) (((n) + 7) & ~7L)
+#define XDL_ARENA_DATA(node) ((char *) (node) + XDL_ARENA_ALIGN(sizeof(xdlarnode_t)))
+
+void xdl_arena_init(xdlarena_t *ar, long nsize) {
+
+	ar->head = ar->cur = NULL;
+	ar->nsize = nsize;
+}
+
+
+void xdl_arena_free(xdlarena_t *ar) {
+	xdlarnode_t *cur, *tmp;
+
+	for (cur = ar->head; (tmp = cur) != NULL;) {
+		cur = cur->next;
+		xdl_free(tmp);
+	}
+	ar->head = ar->cur = NULL;
+}
+
+
+void *xdl_arena_alloc(xdlarena_t *ar, long size) {
+	xdlarnode_t *cur = ar->cur, *next;
+	void *data;
+
+	size = XDL_ARENA_ALIGN(size);
+	if (!cur || cur->icurr + size > cur->isize) {
+		/* the nodes after the current one are all free */
+		next = cur ? cur->next : ar->head;
+		if (!next || next->isize < size) {
+			long isize = XDL_MAX(size, ar->nsize);
+
+			if (!(next = (xdlarnode_t *)
+			      xdl_malloc(XDL_ARENA_ALIGN(sizeof(xdlarnode_t)) + isize))) {
+
+				return NULL;
+			}
+			next->isize = isize;
+			next->next = cur ? cur->next : ar->head;
+			if (cur)
+				cur->next = next;
+			else
+				ar->head = next;
+			/* grow geometrically, so that big diffs need few nodes */
+			ar->nsize *= 2;
+		}
+		next->icurr = 0;
+		ar->cur = cur = next;
+	}
+
+	data = XDL_ARENA_DATA(cur) + cur->icurr;
+	cur->icurr += size;
+
+	return data;
+}
+
+
+void xdl_arena_mark(xdlarena_t *ar, xdlarmark_t *mark) {
+
+	mark->node = ar->cur;
+	mark->icurr = ar->cur ? ar->cur->icurr : 0;
+}
+
+
+void xdl_arena_release(xdlarena_t *ar, xdlarmark_t const *mark) {
+
+	ar->cur = mark->node;
+	if (ar->cur)
+		ar->cur->icurr = mark->icurr;
+}
+
 long xdl_guess_lines(mmfile_t *mf, long sample) {
 	long nl = 0, size, tsize = 0;
 	char const *data, *cur, *top;
@@ -108,9 +108,18 @@ void git_inflate_end(git_zstream *strm)
 	      strm->z.msg ? strm->z.msg : "no message");
 }
 
+/* bytes produced by inflating, for the object access counters */
+static uintmax_t inflated_bytes;
+
+uintmax_t git_inflated_bytes(void)
+{
+	return inflated_bytes;
+}
+
 int git_inflate(git_zstream *strm, int flush)
 {
 	int status;
+	unsigned long total_out = strm->total_out;
 
 	for (;;) {
 		zlib_pre_call(strm);
@@ -131,6 +140,7 @@ int git_inflate(git_zstream *strm, int flush)
 			continue;
 		break;
 	}
+	inflated_bytes += strm->total_out - total_out;
 
 	switch (status) {
 	/* Z_BUF_ERROR: normal, needs more space in the output buffer */
@@ -146,6 +156,42 @@ int git_inflate(git_zstream *strm, int flush)
 	return status;
 }
 
+/*
+ * With USE_LIBDEFLATE, a zlib stream whose inflated size we know and
+ * which we have in memory as a whole is inflated by libdeflate, which
+ * is much faster at that than zlib.  A decompressor is cheap to make
+ * (it builds its tables for each block anyway), so each call makes its
+ * own, which keeps this safe to call from several threads.
+ */
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+
+long git_inflate_buffer(void *out, unsigned long size,
+			const void *in, unsigned long avail_in)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result res;
+	size_t used;
+
+	d = libdeflate_alloc_decompressor();
+	if (!d)
+		return -1;
+	res = libdeflate_zlib_decompress_ex(d, in, avail_in, out, size,
+					    &used, NULL);
+	libdeflate_free_decompressor(d);
+	if (res != LIBDEFLATE_SUCCESS)
+		return -1;
+	inflated_bytes += size;
+	return used;
+}
+#else
+long git_inflate_buffer(void *out, unsigned long size,
+			const void *in, unsigned long avail_in)
+{
+	return -1;
+}
+#endif
+
 #if defined(NO_DEFLATE_BOUND) || ZLIB_VERNUM < 0x1200
 #define deflateBound(c,s)  ((s) + (((s) + 7) >> 3) + (((s) + 63) >> 6) + 11)
 #endif